@@ -1,9 +1,18 @@
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <csignal>
+#include <cstring>
 #include <iostream>
 #include <map>
+#include <sstream>
 #include <string>
+#include <thread>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#include <zmq.h>
 
 typedef void (*sighandler_t)(int sig);
 
@@ -29,9 +38,192 @@ static std::vector<std::string> get_services(std::string whitelist_str, bool zmq
   return service_list;
 }
 
+#ifdef HAVE_LZ4
+// Batched mode: every tick the messages of the selected topics are packed into one
+// lz4 compressed frame on a single zmq socket. A frame is [u32 raw size][lz4 block],
+// the raw batch is a sequence of [u16 name length][name][u32 size][message].
+#define BATCH_PORT "8199"
+#define BATCH_TICK_MS 50
+// Larger batches are dropped by the sender and rejected by the receiver
+#define BATCH_MAX_SIZE (16 * 1024 * 1024)
+
+struct BatchTopic {
+  std::string name;
+  SubSocket *sock;
+  double min_interval = 0; // seconds between forwarded messages, 0 forwards everything
+  double last_sent = 0;
+};
+
+static double seconds_since_boot() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename T>
+static void append(std::string &buf, T v) {
+  buf.append((const char *)&v, sizeof(v));
+}
+
+// topics is a comma separated list of name[:hz]
+static int run_batch(std::string topics) {
+  MSGQContext sub_context;
+  std::vector<BatchTopic> batch_topics;
+
+  std::stringstream ss(topics);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    BatchTopic t;
+    size_t colon = item.find(':');
+    t.name = item.substr(0, colon);
+    if (colon != std::string::npos) {
+      t.min_interval = 1.0 / std::stod(item.substr(colon + 1));
+    }
+    // Decimated topics only ever need the latest message
+    t.sock = SubSocket::create(&sub_context, t.name, "127.0.0.1", t.min_interval > 0);
+    assert(t.sock != NULL);
+    batch_topics.push_back(t);
+  }
+
+  void *ctx = zmq_ctx_new();
+  void *pub = zmq_socket(ctx, ZMQ_PUB);
+
+  // Keep at most a couple of frames queued so a slow link only ever sees fresh data.
+  // With NODROP a full queue fails the send instead of silently dropping, which is counted
+  int hwm = 2, nodrop = 1;
+  zmq_setsockopt(pub, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+  zmq_setsockopt(pub, ZMQ_XPUB_NODROP, &nodrop, sizeof(nodrop));
+  int ret = zmq_bind(pub, "tcp://*:" BATCH_PORT);
+  assert(ret == 0);
+
+  std::string raw;
+  std::vector<char> compressed;
+  uint64_t frames = 0, dropped = 0;
+
+  while (true) {
+    auto next_tick = std::chrono::steady_clock::now() + std::chrono::milliseconds(BATCH_TICK_MS);
+    double now = seconds_since_boot();
+
+    raw.clear();
+    for (auto &t : batch_topics) {
+      bool due = t.min_interval == 0 || (now - t.last_sent) >= t.min_interval;
+
+      Message *msg;
+      while ((msg = t.sock->receive(true)) != NULL) {
+        if (due) {
+          append<uint16_t>(raw, t.name.size());
+          raw += t.name;
+          append<uint32_t>(raw, msg->getSize());
+          raw.append(msg->getData(), msg->getSize());
+          if (t.min_interval > 0) {
+            t.last_sent = now;
+            due = false;
+          }
+        }
+        delete msg;
+      }
+    }
+
+    if (raw.size() > BATCH_MAX_SIZE) {
+      dropped++;
+    } else if (raw.size() > 0) {
+      compressed.resize(sizeof(uint32_t) + LZ4_compressBound(raw.size()));
+      uint32_t raw_size = raw.size();
+      memcpy(compressed.data(), &raw_size, sizeof(raw_size));
+
+      int compressed_size = LZ4_compress_default(raw.data(), compressed.data() + sizeof(uint32_t), raw.size(), compressed.size() - sizeof(uint32_t));
+      if (compressed_size <= 0 || zmq_send(pub, compressed.data(), sizeof(uint32_t) + compressed_size, ZMQ_DONTWAIT) < 0) {
+        dropped++;
+      }
+
+      if (++frames % 200 == 0) {
+        std::cout << "sent " << frames << " frames, dropped " << dropped << ", last " << raw.size() << " -> " << compressed_size << " bytes" << std::endl;
+      }
+    }
+
+    std::this_thread::sleep_until(next_tick);
+  }
+  return 0;
+}
+
+// Receives batched frames from a device and republishes them on the local msgq sockets
+static int run_unbatch(std::string ip) {
+  void *ctx = zmq_ctx_new();
+  void *sub = zmq_socket(ctx, ZMQ_SUB);
+  zmq_setsockopt(sub, ZMQ_SUBSCRIBE, "", 0);
+  int ret = zmq_connect(sub, ("tcp://" + ip + ":" BATCH_PORT).c_str());
+  assert(ret == 0);
+
+  MSGQContext pub_context;
+  std::map<std::string, PubSocket*> pub_socks;
+  std::vector<char> raw;
+
+  while (true) {
+    zmq_msg_t frame;
+    zmq_msg_init(&frame);
+    if (zmq_msg_recv(&frame, sub, 0) < 0) {
+      zmq_msg_close(&frame);
+      continue;
+    }
+
+    const char *data = (const char *)zmq_msg_data(&frame);
+    size_t size = zmq_msg_size(&frame);
+    uint32_t raw_size = 0;
+    if (size >= sizeof(raw_size)) memcpy(&raw_size, data, sizeof(raw_size));
+
+    // the size comes off the network, it's only trusted up to the largest batch
+    int decompressed = -1;
+    if (size > sizeof(raw_size) && raw_size <= BATCH_MAX_SIZE && size - sizeof(raw_size) <= (size_t)LZ4_compressBound(BATCH_MAX_SIZE)) {
+      raw.resize(raw_size);
+      decompressed = LZ4_decompress_safe(data + sizeof(raw_size), raw.data(), size - sizeof(raw_size), raw_size);
+    }
+    zmq_msg_close(&frame);
+    if (decompressed < 0 || (uint32_t)decompressed != raw_size) {
+      std::cout << "dropping corrupt frame" << std::endl;
+      continue;
+    }
+    const size_t dest_size = raw_size;
+
+    size_t pos = 0;
+    while (pos + sizeof(uint16_t) <= dest_size) {
+      uint16_t name_len;
+      memcpy(&name_len, &raw[pos], sizeof(name_len));
+      pos += sizeof(name_len);
+      if (pos + name_len + sizeof(uint32_t) > dest_size) break;
+      std::string name((const char *)&raw[pos], name_len);
+      pos += name_len;
+
+      uint32_t msg_len;
+      memcpy(&msg_len, &raw[pos], sizeof(msg_len));
+      pos += sizeof(msg_len);
+      if (pos + msg_len > dest_size) break;
+
+      auto it = pub_socks.find(name);
+      if (it == pub_socks.end()) {
+        it = pub_socks.insert({name, PubSocket::create(&pub_context, name)}).first;
+      }
+      if (it->second != NULL) {
+        it->second->send((char *)&raw[pos], msg_len);
+      }
+      pos += msg_len;
+    }
+  }
+  return 0;
+}
+#endif
+
 int main(int argc, char** argv) {
   signal(SIGPIPE, (sighandler_t)sigpipe_handler);
 
+  // bridge --batch carState:10,modelV2,...  on the device
+  // bridge --unbatch <device ip>            on the receiving side
+  if (argc > 2 && (strcmp(argv[1], "--batch") == 0 || strcmp(argv[1], "--unbatch") == 0)) {
+#ifdef HAVE_LZ4
+    return strcmp(argv[1], "--batch") == 0 ? run_batch(argv[2]) : run_unbatch(argv[2]);
+#else
+    std::cout << "bridge was built without lz4, there's no batched mode" << std::endl;
+    return 1;
+#endif
+  }
+
   bool zmq_to_msgq = argc > 2;
   std::string ip = zmq_to_msgq ? argv[1] : "127.0.0.1";
   std::string whitelist_str = zmq_to_msgq ? std::string(argv[2]) : "";
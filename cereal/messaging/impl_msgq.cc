@@ -26,13 +26,24 @@ static bool service_exists(std::string path){
 }
 
 static size_t get_size(std::string endpoint){
-  size_t sz = DEFAULT_SEGMENT_SIZE;
+  // Ring sizes are set per service in services.py
+  for (const auto& it : services) {
+    if (it.name == endpoint) {
+      return it.segment_size;
+    }
+  }
+  return DEFAULT_SEGMENT_SIZE;
+}
+
+static size_t get_num_readers(std::string endpoint){
+  size_t n = NUM_READERS;
 
-  if (endpoint == "roadCameraState" || endpoint == "driverCameraState" || endpoint == "wideRoadCameraState"){
-    sz *= 10;
+  // Busy topics that debugging tools like to attach to on top of the real consumers
+  if (endpoint == "can" || endpoint == "carState" || endpoint == "controlsState" || endpoint == "modelV2"){
+    n *= 2;
   }
 
-  return sz;
+  return n;
 }
 
 
@@ -78,7 +89,7 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint));
   if (r != 0){
     return r;
   }
@@ -151,6 +162,30 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   return (Message*)r;
 }
 
+kj::ArrayPtr<const capnp::word> MSGQSubSocket::receiveAligned(AlignedBuffer &buf){
+  // Copy straight from the ring into buf, skipping the intermediate Message
+  msgq_msg_t view;
+  while (receiveView(&view)){
+    auto words = buf.align(view.data, view.size);
+    if (releaseView(&view)){
+      return words;
+    }
+  }
+  return {};
+}
+
+bool MSGQSubSocket::receiveView(msgq_msg_t *view){
+  return msgq_msg_recv_view(view, q) > 0;
+}
+
+bool MSGQSubSocket::viewValid(){
+  return msgq_msg_view_valid(q);
+}
+
+bool MSGQSubSocket::releaseView(msgq_msg_t *view){
+  return msgq_msg_release_view(view, q) == 0;
+}
+
 void MSGQSubSocket::setTimeout(int t){
   timeout = t;
 }
@@ -170,7 +205,7 @@ int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_en
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint));
   if (r != 0){
     return r;
   }
@@ -196,10 +231,51 @@ int MSGQPubSocket::send(char *data, size_t size){
   return msgq_msg_send(&msg, q);
 }
 
+int MSGQPubSocket::send_batch(const std::vector<kj::ArrayPtr<capnp::byte>> &msgs, bool notify){
+  std::vector<msgq_msg_t> batch(msgs.size());
+  for (size_t i = 0; i < msgs.size(); i++){
+    batch[i].data = (char *)msgs[i].begin();
+    batch[i].size = msgs[i].size();
+  }
+
+  return msgq_msg_send_batch(batch.data(), batch.size(), q, notify);
+}
+
+void MSGQPubSocket::notify_readers(const std::vector<PubSocket*> &sockets){
+  std::vector<msgq_queue_t*> queues;
+  for (auto s : sockets){
+    queues.push_back(((MSGQPubSocket *)s)->q);
+  }
+
+  msgq_notify_readers(queues.data(), queues.size());
+}
+
+char *MSGQPubSocket::reserve(size_t size){
+  if (msgq_msg_reserve(&reserved, size, q) < 0){
+    return NULL;
+  }
+
+  // capnp requires a zeroed first segment
+  memset(reserved.data, 0, size);
+  return reserved.data;
+}
+
+int MSGQPubSocket::commit(size_t size){
+  return msgq_msg_commit(&reserved, size, q);
+}
+
+void MSGQPubSocket::cancel(){
+  msgq_msg_cancel(q);
+}
+
 bool MSGQPubSocket::all_readers_updated() {
   return msgq_all_readers_updated(q);
 }
 
+int MSGQPubSocket::num_subscribers() {
+  return msgq_num_readers(q);
+}
+
 MSGQPubSocket::~MSGQPubSocket(){
   if (q != NULL){
     msgq_close_queue(q);
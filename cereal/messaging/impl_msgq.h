@@ -37,18 +37,33 @@ public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return (void*)q;}
+  uint64_t numConflated() {return q->read_conflated;}
   Message *receive(bool non_blocking=false);
+  kj::ArrayPtr<const capnp::word> receiveAligned(AlignedBuffer &buf);
+
+  // Zero-copy receive: view points into the shared ring and stays readable until releaseView.
+  // releaseView returns false if the writer overwrote the slot meanwhile, and the view must be dropped.
+  bool receiveView(msgq_msg_t *view);
+  bool viewValid();
+  bool releaseView(msgq_msg_t *view);
   ~MSGQSubSocket();
 };
 
 class MSGQPubSocket : public PubSocket {
 private:
   msgq_queue_t * q = NULL;
+  msgq_msg_t reserved;
 public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int send_batch(const std::vector<kj::ArrayPtr<capnp::byte>> &msgs, bool notify=true);
+  int num_subscribers();
+  char *reserve(size_t size);
+  int commit(size_t size);
+  void cancel();
   bool all_readers_updated();
+  static void notify_readers(const std::vector<PubSocket*> &sockets);
   ~MSGQPubSocket();
 };
 
@@ -9,18 +9,19 @@
 #include "services.h"
 #include "impl_zmq.h"
 
-static int get_port(std::string endpoint) {
-  int port = -1;
+static const struct service *get_service(std::string endpoint) {
   for (const auto& it : services) {
-    std::string name = it.name;
-    if (name == endpoint) {
-      port = it.port;
-      break;
+    if (endpoint == it.name) {
+      return &it;
     }
   }
+  return NULL;
+}
 
-  assert(port >= 0);
-  return port;
+static int get_port(std::string endpoint) {
+  const struct service *service = get_service(endpoint);
+  assert(service != NULL);
+  return service->port;
 }
 
 ZMQContext::ZMQContext() {
@@ -34,19 +35,42 @@ ZMQContext::~ZMQContext() {
 void ZMQMessage::init(size_t sz) {
   size = sz;
   data = new char[size];
+  owns_data = true;
 }
 
 void ZMQMessage::init(char * d, size_t sz) {
   size = sz;
   data = new char[size];
+  owns_data = true;
   memcpy(data, d, size);
 }
 
+void ZMQMessage::init(zmq_msg_t *m) {
+  zmq_msg_init(&msg);
+  zmq_msg_move(&msg, m);
+  has_msg = true;
+  size = zmq_msg_size(&msg);
+  data = (char *)zmq_msg_data(&msg);
+
+  // small messages live inside the zmq_msg_t and may not be word aligned
+  if ((uintptr_t)data % sizeof(capnp::word) != 0) {
+    char *copy = new char[size];
+    memcpy(copy, data, size);
+    data = copy;
+    owns_data = true;
+  }
+}
+
 void ZMQMessage::close() {
-  if (size > 0){
+  if (owns_data){
     delete[] data;
   }
+  if (has_msg){
+    zmq_msg_close(&msg);
+  }
+  data = NULL;
   size = 0;
+  owns_data = has_msg = false;
 }
 
 ZMQMessage::~ZMQMessage() {
@@ -62,9 +86,13 @@ int ZMQSubSocket::connect(Context *context, std::string endpoint, std::string ad
 
   zmq_setsockopt(sock, ZMQ_SUBSCRIBE, "", 0);
 
-  if (conflate){
+  const struct service *service = check_endpoint ? get_service(endpoint) : NULL;
+  if (conflate && !(service != NULL && service->zmq_batch)){
+    // zmq can't conflate multipart messages, batched services are always queued
     int arg = 1;
     zmq_setsockopt(sock, ZMQ_CONFLATE, &arg, sizeof(int));
+  } else if (service != NULL){
+    zmq_setsockopt(sock, ZMQ_RCVHWM, &service->zmq_hwm, sizeof(int));
   }
 
   int reconnect_ivl = 500;
@@ -87,12 +115,12 @@ Message * ZMQSubSocket::receive(bool non_blocking){
 
   int flags = non_blocking ? ZMQ_DONTWAIT : 0;
   int rc = zmq_msg_recv(&msg, sock, flags);
-  Message *r = NULL;
+  ZMQMessage *r = NULL;
 
   if (rc >= 0){
-    // Make a copy to ensure the data is aligned
+    // the parts of a batch are received one by one, like single messages
     r = new ZMQMessage;
-    r->init((char*)zmq_msg_data(&msg), zmq_msg_size(&msg));
+    r->init(&msg);
   }
 
   zmq_msg_close(&msg);
@@ -115,7 +143,11 @@ int ZMQPubSocket::connect(Context *context, std::string endpoint, bool check_end
 
   full_endpoint = "tcp://*:";
   if (check_endpoint){
-    full_endpoint += std::to_string(get_port(endpoint));
+    const struct service *service = get_service(endpoint);
+    assert(service != NULL);
+    full_endpoint += std::to_string(service->port);
+    zmq_setsockopt(sock, ZMQ_SNDHWM, &service->zmq_hwm, sizeof(int));
+    batch = service->zmq_batch;
   } else {
     full_endpoint += endpoint;
   }
@@ -131,6 +163,38 @@ int ZMQPubSocket::send(char *data, size_t size){
   return zmq_send(sock, data, size, ZMQ_DONTWAIT);
 }
 
+static void free_owned(void *data, void *hint){
+  delete (kj::Array<capnp::word> *)hint;
+}
+
+int ZMQPubSocket::send_owned(kj::Array<capnp::word> &&msg, size_t size){
+  // zmq frees it with the message, once it's out on every connection
+  auto owned = new kj::Array<capnp::word>(kj::mv(msg));
+  zmq_msg_t m;
+  if (zmq_msg_init_data(&m, owned->begin(), size, free_owned, owned) != 0){
+    delete owned;
+    return -1;
+  }
+  int rc = zmq_msg_send(&m, sock, ZMQ_DONTWAIT);
+  if (rc < 0){
+    zmq_msg_close(&m);
+  }
+  return rc;
+}
+
+int ZMQPubSocket::send_batch(const std::vector<kj::ArrayPtr<capnp::byte>> &msgs, bool notify){
+  if (!batch){
+    return PubSocket::send_batch(msgs, notify);
+  }
+  for (size_t i = 0; i < msgs.size(); i++){
+    int flags = ZMQ_DONTWAIT | (i + 1 < msgs.size() ? ZMQ_SNDMORE : 0);
+    if (zmq_send(sock, msgs[i].begin(), msgs[i].size(), flags) < 0){
+      return -1;
+    }
+  }
+  return msgs.size();
+}
+
 bool ZMQPubSocket::all_readers_updated() {
   assert(false); // TODO not implemented
   return false;
@@ -16,11 +16,16 @@ public:
 
 class ZMQMessage : public Message {
 private:
-  char * data;
-  size_t size;
+  char * data = NULL;
+  size_t size = 0;
+  bool owns_data = false;
+  zmq_msg_t msg;
+  bool has_msg = false;
 public:
   void init(size_t size);
   void init(char *data, size_t size);
+  // Takes over a received message, its data is used in place if capnp can read it there
+  void init(zmq_msg_t *m);
   size_t getSize(){return size;}
   char * getData(){return data;}
   void close();
@@ -43,10 +48,13 @@ class ZMQPubSocket : public PubSocket {
 private:
   void * sock;
   std::string full_endpoint;
+  bool batch = false;  // send_batch as one multipart message
 public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int send_owned(kj::Array<capnp::word> &&msg, size_t size);
+  int send_batch(const std::vector<kj::ArrayPtr<capnp::byte>> &msgs, bool notify=true);
   bool all_readers_updated();
   ~ZMQPubSocket();
 };
@@ -44,6 +44,15 @@ SubSocket * SubSocket::create(Context * context, std::string endpoint, std::stri
   }
 }
 
+kj::ArrayPtr<const capnp::word> SubSocket::receiveAligned(AlignedBuffer &buf){
+  Message *msg = receive(true);
+  if (msg == NULL) return {};
+
+  auto words = buf.align(msg);
+  delete msg;
+  return words;
+}
+
 PubSocket * PubSocket::create(){
   PubSocket * s;
   if (messaging_use_zmq()){
@@ -66,6 +75,35 @@ PubSocket * PubSocket::create(Context * context, std::string endpoint, bool chec
   }
 }
 
+int PubSocket::send_batch(const std::vector<kj::ArrayPtr<capnp::byte>> &msgs, bool notify){
+  for (auto &m : msgs){
+    if (send((char *)m.begin(), m.size()) < 0){
+      return -1;
+    }
+  }
+  return msgs.size();
+}
+
+int PubSocket::send_owned(kj::Array<capnp::word> &&msg, size_t size){
+  return send((char *)msg.begin(), size);
+}
+
+char *PubSocket::reserve(size_t size){
+  // Without a shared ring the message is built in a reused buffer and copied on commit
+  reserve_buf_.assign(size / sizeof(capnp::word) + 1, capnp::word());
+  return (char *)reserve_buf_.data();
+}
+
+int PubSocket::commit(size_t size){
+  return send((char *)reserve_buf_.data(), size);
+}
+
+void PubSocket::notify_readers(const std::vector<PubSocket*> &sockets){
+  if (!messaging_use_zmq()){
+    MSGQPubSocket::notify_readers(sockets);
+  }
+}
+
 Poller * Poller::create(){
   Poller * p;
   if (messaging_use_zmq()){
@@ -1,10 +1,14 @@
 #pragma once
+#include <array>
 #include <cstddef>
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
 #include <capnp/serialize.h>
 #include "../gen/cpp/log.capnp.h"
+#include "../services.h"
+#include "sim_clock.h"
 
 #ifdef __APPLE__
 #define CLOCK_BOOTTIME CLOCK_MONOTONIC
@@ -32,11 +36,17 @@ public:
 };
 
 
+class AlignedBuffer;
+
 class SubSocket {
 public:
   virtual int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true) = 0;
   virtual void setTimeout(int timeout) = 0;
   virtual Message *receive(bool non_blocking=false) = 0;
+  // Non blocking receive straight into buf, returns an empty array if nothing was ready
+  virtual kj::ArrayPtr<const capnp::word> receiveAligned(AlignedBuffer &buf);
+  // Messages a conflating socket skipped so far to hand out the newest, 0 where the transport can't tell
+  virtual uint64_t numConflated() { return 0; }
   virtual void * getRawSocket() = 0;
   static SubSocket * create();
   static SubSocket * create(Context * context, std::string endpoint, std::string address="127.0.0.1", bool conflate=false, bool check_endpoint=true);
@@ -48,11 +58,26 @@ public:
   virtual int connect(Context *context, std::string endpoint, bool check_endpoint=true) = 0;
   virtual int sendMessage(Message *message) = 0;
   virtual int send(char *data, size_t size) = 0;
+  // Sends msg, the first size bytes of it, and takes it. Transports that can hand it on without a copy do
+  virtual int send_owned(kj::Array<capnp::word> &&msg, size_t size);
+  // Publishes several messages at once. With notify=false waking up the readers is left to notify_readers
+  virtual int send_batch(const std::vector<kj::ArrayPtr<capnp::byte>> &msgs, bool notify=true);
   virtual bool all_readers_updated() = 0;
+  // Number of connected subscribers, -1 if the transport can't tell
+  virtual int num_subscribers() { return -1; }
+  // Zero-copy send: reserve hands out size zeroed bytes to build the next message in,
+  // commit publishes the first size bytes and cancel drops the reservation
+  virtual char *reserve(size_t size);
+  virtual int commit(size_t size);
+  virtual void cancel() {};
+  static void notify_readers(const std::vector<PubSocket*> &sockets);
   static PubSocket * create();
   static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true);
   static PubSocket * create(Context * context, std::string endpoint, int port, bool check_endpoint=true);
   virtual ~PubSocket(){};
+
+private:
+  std::vector<capnp::word> reserve_buf_;
 };
 
 class Poller {
@@ -74,6 +99,8 @@ public:
   inline bool allValid(const std::vector<const char *> &service_list = {}) { return all_(service_list, true, false); }
   inline bool allAliveAndValid(const std::vector<const char *> &service_list = {}) { return all_(service_list, true, true); }
   void drain();
+  // Called from update() with each message of the service as it's received, in service_list order
+  void set_callback(const char *name, std::function<void(const cereal::Event::Reader &)> callback);
   ~SubMaster();
 
   uint64_t frame = 0;
@@ -84,29 +111,40 @@ public:
   uint64_t rcv_time(const char *name) const;
   cereal::Event::Reader &operator[](const char *name) const;
 
+  // Index based access for hot loops, e.g. sm.get<Service::carState>()
+  bool updated(Service s) const;
+  bool alive(Service s) const;
+  bool valid(Service s) const;
+  uint64_t rcv_frame(Service s) const;
+  uint64_t rcv_time(Service s) const;
+  cereal::Event::Reader &operator[](Service s) const;
+  template <Service S> inline cereal::Event::Reader &get() const { return (*this)[S]; }
+
 private:
+  struct SubMessage;
   bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
+  void update_alive(uint64_t current_time);
+  SubMessage *find(const char *name) const;
+  SubMessage *at(const char *name) const;
+  SubMessage *find(Service s) const;
   Poller *poller_ = nullptr;
-  struct SubMessage;
-  std::map<SubSocket *, SubMessage *> messages_;
-  std::map<std::string, SubMessage *> services_;
+  std::vector<SubMessage *> messages_;
+  std::array<SubMessage *, SERVICE_COUNT> services_ = {};
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  MessageBuilder(kj::ArrayPtr<capnp::word> first_segment) : capnp::MallocMessageBuilder(first_segment) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
-    struct timespec t;
-    clock_gettime(CLOCK_BOOTTIME, &t);
-    uint64_t current_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
-    event.setLogMonoTime(current_time);
+    event.setLogMonoTime(sim_clock_gettime(CLOCK_BOOTTIME));
     event.setValid(valid);
     return event;
   }
 
-  kj::ArrayPtr<capnp::byte> toBytes() {
+  virtual kj::ArrayPtr<capnp::byte> toBytes() {
     heapArray_ = capnp::messageToFlatArray(*this);
     return heapArray_.asBytes();
   }
@@ -115,20 +153,64 @@ private:
   kj::Array<capnp::word> heapArray_;
 };
 
+// Builds a message in a buffer from a per-thread pool instead of fresh heap segments.
+// Buffers are sized from the largest message built for the same topic on the thread, so
+// once a topic has been seen its messages fit a single segment, nothing is allocated and
+// toBytes() returns the message in place.
+class PooledMessageBuilder : public MessageBuilder {
+public:
+  PooledMessageBuilder(const char *topic) : PooledMessageBuilder(acquire(topic)) {}
+  ~PooledMessageBuilder();
+  kj::ArrayPtr<capnp::byte> toBytes() override;
+
+private:
+  struct Segment {
+    kj::ArrayPtr<capnp::word> words;
+    size_t hint_idx;
+  };
+  PooledMessageBuilder(Segment segment) : MessageBuilder(segment.words), segment_(segment) {}
+  static Segment acquire(const char *topic);
+  Segment segment_;
+};
+
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
   inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
   int send(const char *name, MessageBuilder &msg);
+  // Sends the messages of one cycle, batched per service, with a single wakeup per reader thread
+  int send_many(const std::vector<std::pair<const char *, MessageBuilder *>> &msgs);
   ~PubMaster();
 
 private:
+  friend class RingMessageBuilder;
   std::map<std::string, PubSocket *> sockets_;
 };
 
+// Builds a message directly in the next msgq ring slot of a service, so send() only has to publish it.
+// Messages that outgrow max_size spill into heap segments and are sent as a regular copy, as are
+// messages that can't have a slot at all. Nothing else can be sent on the service while the builder is alive.
+class RingMessageBuilder : public MessageBuilder {
+public:
+  RingMessageBuilder(PubMaster &pm, const char *name, size_t max_size) : RingMessageBuilder(pm.sockets_.at(name), max_size) {}
+  RingMessageBuilder(PubSocket *socket, size_t max_size);
+  // the slot is handed out as the first segment here rather than to MallocMessageBuilder,
+  // whose destructor would zero it after it was published
+  kj::ArrayPtr<capnp::word> allocateSegment(unsigned int minimum_size) override;
+  int send();
+  ~RingMessageBuilder();
+
+private:
+  PubSocket *socket_;
+  kj::ArrayPtr<capnp::word> slot_;
+  bool slot_used_ = false;
+  bool done_ = false;
+};
+
 class AlignedBuffer {
 public:
   kj::ArrayPtr<const capnp::word> align(const char *data, const size_t size) {
+    data_size = size;
     words_size = size / sizeof(capnp::word) + 1;
     if (aligned_buf.size() < words_size) {
       aligned_buf = kj::heapArray<capnp::word>(words_size < 512 ? 512 : words_size);
@@ -139,7 +221,12 @@ public:
   inline kj::ArrayPtr<const capnp::word> align(Message *m) {
     return align(m->getData(), m->getSize());
   }
+  // The last aligned message as received, without the padding word
+  inline kj::ArrayPtr<const capnp::byte> bytes() const {
+    return aligned_buf.asBytes().slice(0, data_size);
+  }
 private:
   kj::Array<capnp::word> aligned_buf;
   size_t words_size;
+  size_t data_size = 0;
 };
@@ -7,26 +7,82 @@
 #include <chrono>
 #include <algorithm>
 #include <cstdlib>
+#include <climits>
 #include <csignal>
 #include <random>
 
 #include <poll.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
 #include <stdio.h>
 
 #include "msgq.h"
+#include "sim_clock.h"
+#include "trace.h"
 
-void sigusr2_handler(int signal) {
+// Readers are woken up through the doorbells now, but the prebuilt ui and soundd still tkill
+// SIGUSR2 at them. Its default action kills the process, so it's ignored until those are rebuilt.
+static void sigusr2_handler(int signal) {
   assert(signal == SIGUSR2);
 }
 
+static msgq_doorbell_t *msgq_get_doorbells(){
+  static msgq_doorbell_t *doorbells = []() -> msgq_doorbell_t* {
+    size_t size = NUM_DOORBELLS * sizeof(msgq_doorbell_t);
+    int fd = open("/dev/shm/msgq_doorbells", O_RDWR | O_CREAT, 0664);
+    if (fd < 0) {
+      std::cout << "Warning, could not open doorbells, falling back to polling" << std::endl;
+      return NULL;
+    }
+
+    if (ftruncate(fd, size) < 0){
+      close(fd);
+      return NULL;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (mem == MAP_FAILED) ? NULL : (msgq_doorbell_t *)mem;
+  }();
+
+  return doorbells;
+}
+
+static uint64_t msgq_get_tid(){
+  #ifdef __APPLE__
+    return getpid();
+  #else
+    return syscall(SYS_gettid);
+  #endif
+}
+
+static void doorbell_ring(uint64_t doorbell){
+  msgq_doorbell_t *doorbells = msgq_get_doorbells();
+  if (doorbells == NULL) return;
+
+  msgq_doorbell_t *bell = &doorbells[doorbell % NUM_DOORBELLS];
+  __atomic_add_fetch(&bell->seq, 1, __ATOMIC_SEQ_CST);
+
+  // Skip the syscall when nobody is parked on this doorbell
+  if (__atomic_load_n(&bell->waiters, __ATOMIC_SEQ_CST) == 0) return;
+
+  #ifdef __linux__
+    syscall(SYS_futex, &bell->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  #endif
+}
+
 uint64_t msgq_get_uid(void){
   std::random_device rd("/dev/urandom");
   std::uniform_int_distribution<uint64_t> distribution(0,std::numeric_limits<uint32_t>::max());
@@ -67,12 +123,57 @@ int msgq_msg_close(msgq_msg_t * msg){
   return 0;
 }
 
-void msgq_reset_reader(msgq_queue_t * q){
+uint64_t msgq_nanos(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static const bool msgq_stats_enabled = getenv("MSGQ_STATS") != nullptr;
+
+size_t msgq_stats_offset(size_t max_readers){
+  size_t offset = sizeof(msgq_header_t) + max_readers * sizeof(msgq_reader_t);
+  return (offset + alignof(msgq_reader_stats_t) - 1) / alignof(msgq_reader_stats_t) * alignof(msgq_reader_stats_t);
+}
+
+size_t msgq_header_size(size_t max_readers){
+  // The stats end on a cache line, which keeps the data segment aligned as well
+  return msgq_stats_offset(max_readers) + max_readers * sizeof(msgq_reader_stats_t);
+}
+
+static void msgq_sync_reader(msgq_queue_t * q){
   int id = q->reader_id;
   q->read_valids[id]->store(true);
   q->read_pointers[id]->store(*q->write_pointer);
 }
 
+void msgq_reset_reader(msgq_queue_t * q){
+  if (msgq_stats_enabled) q->stats[q->reader_id].resets++;
+  msgq_sync_reader(q);
+}
+
+static void msgq_update_stats(msgq_queue_t * q, const char *p){
+  if (!msgq_stats_enabled) return;
+
+  const msgq_slot_header_t *slot = (const msgq_slot_header_t *)p;
+  msgq_reader_stats_t *stats = &q->stats[q->reader_id];
+
+  // Sequence gaps are messages that were overwritten before we got to them.
+  // Conflating readers skip messages on purpose, so they don't count.
+  if (!q->read_conflate && stats->received > 0 && slot->seq > stats->last_seq + 1){
+    stats->lost += slot->seq - stats->last_seq - 1;
+  }
+  stats->last_seq = slot->seq;
+  stats->received++;
+
+  uint64_t latency_us = (msgq_nanos() - slot->send_time) / 1000;
+  int bucket = 0;
+  while (bucket < MSGQ_LATENCY_BUCKETS - 1 && latency_us >= (1ULL << bucket)){
+    bucket++;
+  }
+  stats->latency_hist[bucket]++;
+}
+
 void msgq_wait_for_subscriber(msgq_queue_t *q){
   while (*q->num_readers == 0){
     ;
@@ -82,62 +183,160 @@ void msgq_wait_for_subscriber(msgq_queue_t *q){
 }
 
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
+// MSGQ_HUGEPAGES=1 asks for transparent huge pages on the segments, which needs
+// /sys/kernel/mm/transparent_hugepage/shmem_enabled set to advise. MSGQ_HUGETLBFS=<dir>
+// puts the segments on a hugetlbfs mount instead, every process has to agree on it.
+static const bool msgq_thp = getenv("MSGQ_HUGEPAGES") != nullptr;
+static const char *msgq_hugetlbfs = getenv("MSGQ_HUGETLBFS");
+
+static size_t msgq_segment_page_size(){
+  static size_t page_size = []() -> size_t {
+    struct statfs fs;
+    if (msgq_hugetlbfs == nullptr || statfs(msgq_hugetlbfs, &fs) != 0) return 1;
+    return fs.f_bsize;
+  }();
+  return page_size;
+}
+
+// Opens the segment at path with mmap_size bytes. One of another size is mapped by processes with
+// the old geometry, resizing it under them would be a SIGBUS or garbage. It's replaced by a new
+// file instead, they stay on the old one until they reconnect.
+static int msgq_open_segment(const std::string &path, size_t mmap_size){
+  while (true){
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0664);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0){
+      close(fd);
+      return -1;
+    }
+    if ((size_t)st.st_size == mmap_size) return fd;
+
+    // Whoever sizes or replaces the segment holds the lock of the old file, the others check again after
+    flock(fd, LOCK_EX);
+    struct stat path_st;
+    if (stat(path.c_str(), &path_st) < 0 || path_st.st_ino != st.st_ino || fstat(fd, &st) < 0){
+      flock(fd, LOCK_UN);
+      close(fd);
+      continue;
+    }
+
+    int ret = fd;
+    if (st.st_size == 0){
+      // A new segment
+      if (ftruncate(fd, mmap_size) < 0) ret = -1;
+    } else if ((size_t)st.st_size != mmap_size){
+      std::string tmp_path = path + ".XXXXXX";
+      ret = mkstemp(&tmp_path[0]);
+      if (ret >= 0 && (fchmod(ret, 0664) < 0 || ftruncate(ret, mmap_size) < 0 || rename(tmp_path.c_str(), path.c_str()) < 0)){
+        close(ret);
+        unlink(tmp_path.c_str());
+        ret = -1;
+      }
+      if (ret >= 0){
+        std::cout << "Warning, replaced " << path << " of " << st.st_size << " bytes with " << mmap_size << " bytes" << std::endl;
+      }
+    }
+
+    flock(fd, LOCK_UN);
+    if (ret != fd) close(fd);
+    return ret;
+  }
+}
+
+std::string msgq_segment_path(const std::string &name){
+  return std::string(msgq_hugetlbfs ? msgq_hugetlbfs : "/dev/shm") + "/" MSGQ_SEGMENT_PREFIX + name;
+}
+
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t max_readers){
   assert(size < 0xFFFFFFFF); // Buffer must be smaller than 2^32 bytes
+  assert(max_readers > 0 && max_readers <= MAX_READERS);
+
   std::signal(SIGUSR2, sigusr2_handler);
 
-  const char * prefix = "/dev/shm/";
-  char * full_path = new char[strlen(path) + strlen(prefix) + 1];
-  strcpy(full_path, prefix);
-  strcat(full_path, path);
+  std::string full_path = msgq_segment_path(path);
 
-  auto fd = open(full_path, O_RDWR | O_CREAT, 0664);
+  size_t header_size = msgq_header_size(max_readers);
+
+  // hugetlbfs files are sized in whole huge pages
+  size_t page_size = msgq_segment_page_size();
+  size_t mmap_size = (size + header_size + page_size - 1) / page_size * page_size;
+
+  int fd = msgq_open_segment(full_path, mmap_size);
   if (fd < 0) {
     std::cout << "Warning, could not open: " << full_path << std::endl;
-    delete[] full_path;
     return -1;
   }
-  delete[] full_path;
-
-  int rc = ftruncate(fd, size + sizeof(msgq_header_t));
-  if (rc < 0){
-    close(fd);
-    return -1;
-  }
-  char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  char * mem = (char*)mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   close(fd);
 
-  if (mem == NULL){
+  if (mem == MAP_FAILED){
+    std::cout << "Warning, could not map: " << full_path << std::endl;
     return -1;
   }
+#ifdef MADV_HUGEPAGE
+  if (msgq_thp){
+    madvise(mem, mmap_size, MADV_HUGEPAGE);
+  }
+#endif
   q->mmap_p = mem;
+  q->mmap_size = mmap_size;
 
   msgq_header_t *header = (msgq_header_t *)mem;
+  msgq_reader_t *readers = (msgq_reader_t *)(mem + sizeof(msgq_header_t));
+
+  // The reader cap is derived from the endpoint, so all processes agree on it
+  if (header->max_readers != 0 && header->max_readers != max_readers){
+    std::cout << "Warning, " << path << " reader cap changed from " << header->max_readers << " to " << max_readers << std::endl;
+  }
+  header->max_readers = max_readers;
 
   // Setup pointers to header segment
   q->num_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_readers);
   q->write_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_pointer);
   q->write_uid = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_uid);
-
-  for (size_t i = 0; i < NUM_READERS; i++){
-    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_pointers[i]);
-    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_valids[i]);
-    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_uids[i]);
+  q->write_seq = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_seq);
+  q->readers = readers;
+  q->stats = (msgq_reader_stats_t *)(mem + msgq_stats_offset(max_readers));
+
+  q->read_pointers.resize(max_readers);
+  q->read_valids.resize(max_readers);
+  q->read_uids.resize(max_readers);
+  q->read_doorbells.resize(max_readers);
+  for (size_t i = 0; i < max_readers; i++){
+    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_pointer);
+    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_valid);
+    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_uid);
+    q->read_doorbells[i] = reinterpret_cast<std::atomic<uint64_t>*>(&readers[i].read_doorbell);
   }
 
-  q->data = mem + sizeof(msgq_header_t);
+  q->data = mem + header_size;
   q->size = size;
+  q->max_readers = max_readers;
+  q->header_size = header_size;
   q->reader_id = -1;
 
   q->endpoint = path;
   q->read_conflate = false;
+  q->read_conflated = 0;
+  q->view_active = false;
+  q->view_next_pointer = 0;
+  q->reserve_active = false;
+  q->reserve_pointer = 0;
+  q->reserve_size = 0;
 
   return 0;
 }
 
 void msgq_close_queue(msgq_queue_t *q){
   if (q->mmap_p != NULL){
-    munmap(q->mmap_p, q->size + sizeof(msgq_header_t));
+    // Hand our reader slot back, so it can be reused without evicting anybody
+    if (q->reader_id >= 0){
+      uint64_t uid = q->read_uid_local;
+      std::atomic_compare_exchange_strong(q->read_uids[q->reader_id], &uid, (uint64_t)0);
+    }
+    munmap(q->mmap_p, q->mmap_size);
   }
 }
 
@@ -149,21 +348,64 @@ void msgq_init_publisher(msgq_queue_t * q) {
   *q->write_uid = uid;
   *q->num_readers = 0;
 
-  for (size_t i = 0; i < NUM_READERS; i++){
+  for (size_t i = 0; i < q->max_readers; i++){
     *q->read_valids[i] = false;
     *q->read_uids[i] = 0;
+    *q->read_doorbells[i] = 0;
   }
 
   q->write_uid_local = uid;
 }
 
-static void thread_signal(uint32_t tid) {
-  #ifndef SYS_tkill
-    // TODO: this won't work for multithreaded programs
-    kill(tid, SIGUSR2);
-  #else
-    syscall(SYS_tkill, tid, SIGUSR2);
-  #endif
+int msgq_reclaim_readers(msgq_queue_t * q) {
+  int reclaimed = 0;
+  uint64_t num_readers = *q->num_readers;
+
+  for (uint64_t i = 0; i < num_readers; i++){
+    uint64_t uid = *q->read_uids[i];
+    if (uid == 0) continue;
+
+    // Probe the thread that registered the reader with a null signal
+    pid_t tid = uid & 0xFFFFFFFF;
+    if (kill(tid, 0) == 0 || errno != ESRCH) continue;
+
+    if (std::atomic_compare_exchange_strong(q->read_uids[i], &uid, (uint64_t)0)){
+      *q->read_valids[i] = false;
+      reclaimed++;
+    }
+  }
+
+  return reclaimed;
+}
+
+// Number of registered readers whose thread is still alive
+int msgq_num_readers(msgq_queue_t * q) {
+  msgq_reclaim_readers(q);
+
+  int count = 0;
+  uint64_t num_readers = *q->num_readers;
+  for (uint64_t i = 0; i < num_readers; i++){
+    if (*q->read_uids[i] != 0) count++;
+  }
+  return count;
+}
+
+static bool msgq_claim_reader(msgq_queue_t * q, uint64_t id, uint64_t uid) {
+  uint64_t free_uid = 0;
+  if (!std::atomic_compare_exchange_strong(q->read_uids[id], &free_uid, uid)){
+    return false;
+  }
+
+  q->reader_id = id;
+  q->read_uid_local = uid;
+
+  // We start with read_valid = false,
+  // on the first read the read pointer will be synchronized with the write pointer
+  *q->read_valids[id] = false;
+  *q->read_pointers[id] = 0;
+  *q->read_doorbells[id] = uid & 0xFFFFFFFF;
+  memset(&q->stats[id], 0, sizeof(msgq_reader_stats_t));
+  return true;
 }
 
 void msgq_init_subscriber(msgq_queue_t * q) {
@@ -177,19 +419,30 @@ void msgq_init_subscriber(msgq_queue_t * q) {
     uint64_t cur_num_readers = *q->num_readers;
     uint64_t new_num_readers = cur_num_readers + 1;
 
-    // No more slots available. Reset all subscribers to kick out inactive ones
-    if (new_num_readers > NUM_READERS){
+    // Reuse a slot released by a closed or reclaimed reader
+    bool found = false;
+    for (uint64_t i = 0; i < cur_num_readers && !found; i++){
+      found = msgq_claim_reader(q, i, uid);
+    }
+    if (found) break;
+
+    if (new_num_readers > q->max_readers){
+      // Try freeing slots of readers that died without closing the queue first
+      if (msgq_reclaim_readers(q) > 0){
+        continue;
+      }
+
+      // No more slots available. Reset all subscribers to kick out inactive ones
       std::cout << "Warning, evicting all subscribers!" << std::endl;
       *q->num_readers = 0;
 
-      for (size_t i = 0; i < NUM_READERS; i++){
+      for (size_t i = 0; i < q->max_readers; i++){
         *q->read_valids[i] = false;
 
-        uint64_t old_uid = *q->read_uids[i];
         *q->read_uids[i] = 0;
 
         // Wake up reader in case they are in a poll
-        thread_signal(old_uid & 0xFFFFFFFF);
+        doorbell_ring(*q->read_doorbells[i]);
       }
 
       continue;
@@ -200,40 +453,27 @@ void msgq_init_subscriber(msgq_queue_t * q) {
     if (std::atomic_compare_exchange_strong(q->num_readers,
                                             &cur_num_readers,
                                             new_num_readers)){
-      q->reader_id = cur_num_readers;
-      q->read_uid_local = uid;
-
-      // We start with read_valid = false,
-      // on the first read the read pointer will be synchronized with the write pointer
-      *q->read_valids[cur_num_readers] = false;
-      *q->read_pointers[cur_num_readers] = 0;
-      *q->read_uids[cur_num_readers] = uid;
-      break;
+      // The new slot is visible to others once num_readers is bumped, so it needs to be claimed as well
+      if (msgq_claim_reader(q, cur_num_readers, uid)){
+        break;
+      }
     }
   }
 
   //std::cout << "New subscriber id: " << q->reader_id << " uid: " << q->read_uid_local << " " << q->endpoint << std::endl;
-  msgq_reset_reader(q);
+  msgq_sync_reader(q);
 }
 
-int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
-  // Die if we are no longer the active publisher
-  if (q->write_uid_local != *q->write_uid){
-    std::cout << "Killing old publisher: " << q->endpoint << std::endl;
-    errno = EADDRINUSE;
-    return -1;
-  }
-
-  uint64_t total_msg_size = ALIGN(msg->size + sizeof(int64_t));
+// At least three messages have to fit into the ring, then the last one can always be accessed safely
+static bool msgq_msg_fits(size_t size, msgq_queue_t *q){
+  return 3 * ALIGN(size + MSGQ_SLOT_HEADER_SIZE) <= q->size;
+}
 
-  // We need to fit at least three messages in the queue,
-  // then we can always safely access the last message
-  assert(3 * total_msg_size <= q->size);
-
-  uint64_t num_readers = *q->num_readers;
-
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+// Makes room for a message of size bytes behind the local write pointer and returns its slot.
+// The write pointer itself is published by the caller.
+static char *msgq_msg_claim(size_t size, msgq_queue_t *q, uint64_t num_readers, uint32_t &write_cycles, uint32_t &write_pointer){
+  uint64_t total_msg_size = ALIGN(size + MSGQ_SLOT_HEADER_SIZE);
+  assert(msgq_msg_fits(size, q));
 
   char *p = q->data + write_pointer; // add base offset
 
@@ -256,10 +496,9 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
       }
     }
 
-    // Update global and local copies of write pointer and write_cycles
+    // Update local copies of write pointer and write_cycles
     write_pointer = 0;
     write_cycles = write_cycles + 1;
-    PACK64(*q->write_pointer, write_cycles, write_pointer);
 
     // Set actual pointer to the beginning of the data segment
     p = q->data;
@@ -267,7 +506,7 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
 
   // Invalidate readers that are in the area that will be written
   uint64_t start = write_pointer;
-  uint64_t end = ALIGN(start + sizeof(int64_t) + msg->size);
+  uint64_t end = ALIGN(start + MSGQ_SLOT_HEADER_SIZE + size);
 
   for (uint64_t i = 0; i < num_readers; i++){
     uint32_t read_cycles, read_pointer;
@@ -278,26 +517,183 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
     }
   }
 
+  return p;
+}
+
+// Writes one message behind the local write pointer, the caller publishes the pointer
+static void msgq_msg_write(msgq_msg_t * msg, msgq_queue_t *q, uint64_t num_readers, uint32_t &write_cycles, uint32_t &write_pointer, uint64_t seq, uint64_t send_time){
+  char *p = msgq_msg_claim(msg->size, q, num_readers, write_cycles, write_pointer);
 
   // Write size tag
   std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
   *size_p = msg->size;
 
+  msgq_slot_header_t *slot = (msgq_slot_header_t *)p;
+  slot->seq = seq;
+  slot->send_time = send_time;
+
   // Copy data
-  memcpy(p + sizeof(int64_t), msg->data, msg->size);
+  memcpy(p + MSGQ_SLOT_HEADER_SIZE, msg->data, msg->size);
+
+  write_pointer = ALIGN(write_pointer + msg->size + MSGQ_SLOT_HEADER_SIZE);
+}
+
+int msgq_msg_send_batch(msgq_msg_t * msgs, size_t num_msgs, msgq_queue_t *q, bool notify){
+  assert(!q->reserve_active);
+  TRACE_SPAN("msgq_send", q->endpoint.c_str());
+
+  // Die if we are no longer the active publisher
+  if (q->write_uid_local != *q->write_uid){
+    std::cout << "Killing old publisher: " << q->endpoint << std::endl;
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  // A message too large for the ring is dropped with the whole batch, the publisher carries on
+  size_t batch_size = 0, max_slot = 0;
+  for (size_t i = 0; i < num_msgs; i++){
+    if (!msgq_msg_fits(msgs[i].size, q)){
+      std::cout << "Message of " << msgs[i].size << " bytes too large for " << q->endpoint << std::endl;
+      errno = EMSGSIZE;
+      return -1;
+    }
+    size_t slot = ALIGN(msgs[i].size + MSGQ_SLOT_HEADER_SIZE);
+    batch_size += slot;
+    max_slot = std::max(max_slot, slot);
+  }
+
+  // The whole batch is published at once, so it must not lap its own first message. Wrapping
+  // around wastes less than one slot and a size tag at the end of the ring.
+  if (num_msgs > 1 && batch_size + max_slot + sizeof(int64_t) > q->size){
+    std::cout << "Batch of " << batch_size << " bytes too large for " << q->endpoint << std::endl;
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  uint64_t num_readers = *q->num_readers;
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  uint64_t seq = *q->write_seq;
+  uint64_t send_time = msgq_nanos();
+  for (size_t i = 0; i < num_msgs; i++){
+    msgq_msg_write(&msgs[i], q, num_readers, write_cycles, write_pointer, ++seq, send_time);
+  }
+  *q->write_seq = seq;
   __sync_synchronize();
 
-  // Update write pointer
-  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
+  // Update write pointer once, readers see either none or all of the batch
+  PACK64(*q->write_pointer, write_cycles, write_pointer);
+
+  if (notify){
+    msgq_notify_readers(&q, 1);
+  }
+
+  return num_msgs;
+}
+
+int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+  assert(!q->reserve_active);
+  int r = msgq_msg_send_batch(msg, 1, q, true);
+  return (r < 0) ? r : msg->size;
+}
+
+int msgq_msg_reserve(msgq_msg_t * msg, size_t size, msgq_queue_t *q){
+  assert(!q->reserve_active);
+
+  // Die if we are no longer the active publisher
+  if (q->write_uid_local != *q->write_uid){
+    std::cout << "Killing old publisher: " << q->endpoint << std::endl;
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  if (!msgq_msg_fits(size, q)){
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  // Readers in the reserved area are invalidated right away, nothing is visible to them until commit
+  char *p = msgq_msg_claim(size, q, *q->num_readers, write_cycles, write_pointer);
+
+  q->reserve_active = true;
+  q->reserve_size = size;
+  PACK64(q->reserve_pointer, write_cycles, write_pointer);
+
+  msg->data = p + MSGQ_SLOT_HEADER_SIZE;
+  msg->size = size;
+  return 0;
+}
+
+int msgq_msg_commit(msgq_msg_t * msg, size_t size, msgq_queue_t *q){
+  assert(q->reserve_active);
+  assert(size <= q->reserve_size);
+  q->reserve_active = false;
+
+  if (q->write_uid_local != *q->write_uid){
+    std::cout << "Killing old publisher: " << q->endpoint << std::endl;
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, q->reserve_pointer);
+
+  char *p = msg->data - MSGQ_SLOT_HEADER_SIZE;
+  uint64_t seq = *q->write_seq + 1;
+
+  std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
+  *size_p = size;
+
+  msgq_slot_header_t *slot = (msgq_slot_header_t *)p;
+  slot->seq = seq;
+  slot->send_time = msgq_nanos();
+
+  *q->write_seq = seq;
+  __sync_synchronize();
+
+  uint32_t new_ptr = ALIGN(write_pointer + size + MSGQ_SLOT_HEADER_SIZE);
   PACK64(*q->write_pointer, write_cycles, new_ptr);
 
-  // Notify readers
-  for (uint64_t i = 0; i < num_readers; i++){
-    uint64_t reader_uid = *q->read_uids[i];
-    thread_signal(reader_uid & 0xFFFFFFFF);
+  msgq_notify_readers(&q, 1);
+  return size;
+}
+
+void msgq_msg_cancel(msgq_queue_t *q){
+  // Nothing was published, the next send simply claims the same spot again
+  q->reserve_active = false;
+}
+
+void msgq_notify_readers(msgq_queue_t **queues, size_t num_queues){
+  // A thread polling several of these queues shares one doorbell, ring it only once
+  uint64_t doorbells[MAX_READERS * 4];
+  size_t num_doorbells = 0;
+
+  for (size_t j = 0; j < num_queues; j++){
+    msgq_queue_t *q = queues[j];
+    uint64_t num_readers = *q->num_readers;
+
+    for (uint64_t i = 0; i < num_readers; i++){
+      if (*q->read_uids[i] == 0) continue;
+
+      uint64_t doorbell = *q->read_doorbells[i];
+      if (std::find(doorbells, doorbells + num_doorbells, doorbell) != doorbells + num_doorbells) continue;
+
+      if (num_doorbells == sizeof(doorbells) / sizeof(doorbells[0])){
+        doorbell_ring(doorbell);
+      } else {
+        doorbells[num_doorbells++] = doorbell;
+      }
+    }
   }
 
-  return msg->size;
+  for (size_t i = 0; i < num_doorbells; i++){
+    doorbell_ring(doorbells[i]);
+  }
 }
 
 
@@ -329,6 +725,9 @@ int msgq_msg_ready(msgq_queue_t * q){
 }
 
 int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  // Only spans that actually return a message are recorded
+  uint64_t trace_start = trace_enabled ? trace_nanos() : 0;
+
  start:
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
@@ -381,13 +780,14 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   assert((uint64_t)size < q->size);
   assert(size > 0);
 
-  uint32_t new_read_pointer = ALIGN(read_pointer + sizeof(std::int64_t) + size);
+  uint32_t new_read_pointer = ALIGN(read_pointer + MSGQ_SLOT_HEADER_SIZE + size);
 
   // If conflate is true, check if this is the latest message, else start over
   if (q->read_conflate){
     if (new_read_pointer != write_pointer){
       // Update read pointer
       PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+      q->read_conflated++;
       goto start;
     }
   }
@@ -397,7 +797,7 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     return -1;
 
   __sync_synchronize();
-  memcpy(msg->data, p + sizeof(int64_t), size);
+  memcpy(msg->data, p + MSGQ_SLOT_HEADER_SIZE, size);
   __sync_synchronize();
 
   // Update read pointer
@@ -410,44 +810,209 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     goto start;
   }
 
+  msgq_update_stats(q, p);
+
+  if (trace_start != 0) trace_record("msgq_recv", q->endpoint.c_str(), trace_start, trace_nanos());
+  return msg->size;
+}
+
+
+
+int msgq_msg_recv_view(msgq_msg_t * msg, msgq_queue_t * q){
+  assert(!q->view_active); // Only one outstanding view per reader
+
+ start:
+  int id = q->reader_id;
+  assert(id >= 0); // Make sure subscriber is initialized
+
+  if (q->read_uid_local != *q->read_uids[id]){
+    std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
+    msgq_init_subscriber(q);
+    goto start;
+  }
+
+  // Check valid
+  if (!*q->read_valids[id]){
+    msgq_reset_reader(q);
+    goto start;
+  }
+
+  uint32_t read_cycles, read_pointer;
+  UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  char * p = q->data + read_pointer;
+
+  // Check if new message is available
+  if (read_pointer == write_pointer) {
+    msg->size = 0;
+    msg->data = NULL;
+    return 0;
+  }
+
+  // Read potential message size
+  std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
+  std::int64_t size = *size_p;
+
+  // Check if the size that was read is valid
+  if (!*q->read_valids[id]){
+    msgq_reset_reader(q);
+    goto start;
+  }
+
+  // If size is -1 the buffer was full, and we need to wrap around
+  if (size == -1){
+    read_cycles++;
+    PACK64(*q->read_pointers[id], read_cycles, 0);
+    goto start;
+  }
+
+  assert((uint64_t)size < q->size);
+  assert(size > 0);
+
+  uint32_t new_read_pointer = ALIGN(read_pointer + MSGQ_SLOT_HEADER_SIZE + size);
+
+  // If conflate is true, check if this is the latest message, else start over
+  if (q->read_conflate){
+    if (new_read_pointer != write_pointer){
+      PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+      q->read_conflated++;
+      goto start;
+    }
+  }
+
+  __sync_synchronize();
+
+  // Leave the read pointer on the size tag of this message. Any write covering
+  // the slot will now clear read_valids, which is what makes the view checkable.
+  // The payload is 8 byte aligned, so it can be handed to capnp without copying.
+  msg->size = size;
+  msg->data = p + MSGQ_SLOT_HEADER_SIZE;
+
+  q->view_active = true;
+  PACK64(q->view_next_pointer, read_cycles, new_read_pointer);
 
   return msg->size;
 }
 
+bool msgq_msg_view_valid(msgq_queue_t * q){
+  assert(q->view_active);
+  __sync_synchronize();
+  return *q->read_valids[q->reader_id] && q->read_uid_local == *q->read_uids[q->reader_id];
+}
+
+int msgq_msg_release_view(msgq_msg_t * msg, msgq_queue_t * q){
+  bool valid = msgq_msg_view_valid(q);
+  q->view_active = false;
 
+  char *p = msg->data - MSGQ_SLOT_HEADER_SIZE;
+  msg->size = 0;
+  msg->data = NULL;
+
+  if (!valid){
+    // The writer lapped us while the view was held, the next recv will resync
+    return -1;
+  }
+
+  msgq_update_stats(q, p);
+  *q->read_pointers[q->reader_id] = q->view_next_pointer;
+  return 0;
+}
 
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
   int num = 0;
+  uint64_t tid = msgq_get_tid();
 
-  // Check if messages ready
+  // Point the readers at the doorbell of the polling thread, which is not
+  // necessarily the thread that created the subscriber
   for (size_t i = 0; i < nitems; i++) {
-    items[i].revents = msgq_msg_ready(items[i].q);
-    if (items[i].revents) num++;
+    msgq_queue_t *q = items[i].q;
+    if (q->reader_id >= 0) *q->read_doorbells[q->reader_id] = tid;
   }
 
+  msgq_doorbell_t *doorbells = msgq_get_doorbells();
+  msgq_doorbell_t *bell = (doorbells != NULL) ? &doorbells[tid % NUM_DOORBELLS] : NULL;
+
+  // Never sleep forever, so evicted readers and dead publishers are noticed
   int ms = (timeout == -1) ? 100 : timeout;
   struct timespec ts;
   ts.tv_sec = ms / 1000;
   ts.tv_nsec = (ms % 1000) * 1000 * 1000;
 
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
 
-  while (num == 0) {
-    int ret;
+  // On simulated time the timeout is simulated too, the clock is checked between short real waits
+  const SimClock *sim = sim_clock();
+  const uint64_t sim_deadline = (sim != NULL) ? sim_clock_nanos(sim) + (uint64_t)ms * 1000 * 1000 : 0;
+  if (sim != NULL) {
+    ts.tv_sec = 0;
+    ts.tv_nsec = SIM_CLOCK_POLL_NS;
+  }
 
-    ret = nanosleep(&ts, &ts);
+  while (true) {
+    // Register as waiter before sampling seq and checking, so a concurrent send either
+    // shows up in the ready check or changes seq and makes the futex wait return immediately
+    uint32_t seq = 0;
+    if (bell != NULL) {
+      __atomic_add_fetch(&bell->waiters, 1, __ATOMIC_SEQ_CST);
+      seq = __atomic_load_n(&bell->seq, __ATOMIC_SEQ_CST);
+    }
 
     // Check if messages ready
     for (size_t i = 0; i < nitems; i++) {
-      if (items[i].revents == 0 && msgq_msg_ready(items[i].q)){
-        num += 1;
-        items[i].revents = 1;
-      }
+      items[i].revents = msgq_msg_ready(items[i].q);
+      if (items[i].revents) num++;
     }
 
-    // exit if we had a timeout and the sleep finished
-    if (timeout != -1 && ret == 0){
+    if (num > 0) {
+      if (bell != NULL) __atomic_sub_fetch(&bell->waiters, 1, __ATOMIC_SEQ_CST);
       break;
     }
+
+    int ret;
+    #ifdef __linux__
+    if (bell != NULL) {
+      ret = syscall(SYS_futex, &bell->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+      __atomic_sub_fetch(&bell->waiters, 1, __ATOMIC_SEQ_CST);
+    } else {
+      ret = nanosleep(&ts, &ts);
+    }
+    #else
+    ret = nanosleep(&ts, &ts);
+    #endif
+
+    // Interrupted by a signal, let the caller handle it
+    if (ret < 0 && errno == EINTR) {
+      break;
+    }
+
+    if (sim != NULL) {
+      if (timeout != -1 && sim_clock_nanos(sim) >= sim_deadline) break;
+      ts.tv_sec = 0;
+      ts.tv_nsec = SIM_CLOCK_POLL_NS;
+      continue;
+    }
+
+    // Recompute the remaining time for the next wait
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+      if (timeout != -1) break;
+
+      deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+      remaining = (int64_t)ms * 1000 * 1000;
+    }
+    ts.tv_sec = remaining / 1000000000;
+    ts.tv_nsec = remaining % 1000000000;
+  }
+
+  // One last check so a message that arrived together with the timeout isn't missed
+  if (num == 0) {
+    for (size_t i = 0; i < nitems; i++) {
+      items[i].revents = msgq_msg_ready(items[i].q);
+      if (items[i].revents) num++;
+    }
   }
 
   return num;
@@ -3,39 +3,99 @@
 #include <cstring>
 #include <string>
 #include <atomic>
+#include <vector>
 
 #define DEFAULT_SEGMENT_SIZE (10 * 1024 * 1024)
-#define NUM_READERS 10
+#define NUM_READERS 15 // default reader cap, can be raised per queue up to MAX_READERS
+#define MAX_READERS 64
+#define NUM_DOORBELLS 65536
 #define ALIGN(n) ((n + (8 - 1)) & -8)
 
+// The segment layout isn't that of the original msgq, which prebuilt binaries like the ui still
+// map under the plain service name. The version in the file name keeps the two apart.
+#define MSGQ_SEGMENT_PREFIX "msgq2_"
+
+// Latency histogram buckets, bucket i counts latencies below 2^i us, the last one everything above
+#define MSGQ_LATENCY_BUCKETS 16
+
 #define UNPACK64(higher, lower, input) do {uint64_t tmp = input; higher = tmp >> 32; lower = tmp & 0xFFFFFFFF;} while (0)
 #define PACK64(output, higher, lower) output = ((uint64_t)higher << 32 ) | ((uint64_t)lower & 0xFFFFFFFF)
 
 struct  msgq_header_t {
   uint64_t num_readers;
+  uint64_t max_readers;
   uint64_t write_pointer;
   uint64_t write_uid;
-  uint64_t read_pointers[NUM_READERS];
-  uint64_t read_valids[NUM_READERS];
-  uint64_t read_uids[NUM_READERS];
+  uint64_t write_seq;
+};
+
+// Every message in the ring is prefixed by its size, sequence number and send time
+struct msgq_slot_header_t {
+  int64_t size;
+  uint64_t seq;
+  uint64_t send_time;
+};
+#define MSGQ_SLOT_HEADER_SIZE sizeof(msgq_slot_header_t)
+
+// Per reader counters, only written by the owning reader and only with MSGQ_STATS=1 set.
+// They live in their own cache lines behind the reader table, away from the read pointers
+// that the writer scans on every send.
+struct alignas(64) msgq_reader_stats_t {
+  uint64_t received;
+  uint64_t lost;
+  uint64_t resets;
+  uint64_t last_seq;
+  uint64_t latency_hist[MSGQ_LATENCY_BUCKETS];
+};
+
+// Reader table, max_readers entries follow the header in shared memory, then max_readers stats
+struct msgq_reader_t {
+  uint64_t read_pointer;
+  uint64_t read_valid;
+  uint64_t read_uid;
+  uint64_t read_doorbell;
+};
+
+// One futex word per thread id, shared by all queues in /dev/shm/msgq_doorbells.
+// Writers bump the doorbell of every reader and only issue FUTEX_WAKE when somebody is parked on it.
+struct msgq_doorbell_t {
+  uint32_t seq;
+  uint32_t waiters;
 };
 
 struct msgq_queue_t {
   std::atomic<uint64_t> *num_readers;
   std::atomic<uint64_t> *write_pointer;
   std::atomic<uint64_t> *write_uid;
-  std::atomic<uint64_t> *read_pointers[NUM_READERS];
-  std::atomic<uint64_t> *read_valids[NUM_READERS];
-  std::atomic<uint64_t> *read_uids[NUM_READERS];
+  std::atomic<uint64_t> *write_seq;
+  msgq_reader_t *readers;
+  msgq_reader_stats_t *stats;
+  std::vector<std::atomic<uint64_t>*> read_pointers;
+  std::vector<std::atomic<uint64_t>*> read_valids;
+  std::vector<std::atomic<uint64_t>*> read_uids;
+  std::vector<std::atomic<uint64_t>*> read_doorbells;
   char * mmap_p;
+  size_t mmap_size;
   char * data;
   size_t size;
+  size_t max_readers;
+  size_t header_size;
   int reader_id;
   uint64_t read_uid_local;
   uint64_t write_uid_local;
 
   bool read_conflate;
+  uint64_t read_conflated; // messages skipped by read_conflate to get to the newest
   std::string endpoint;
+
+  // Outstanding zero-copy view, see msgq_msg_recv_view
+  bool view_active;
+  uint64_t view_next_pointer;
+
+  // Outstanding zero-copy write, see msgq_msg_reserve
+  bool reserve_active;
+  uint64_t reserve_pointer;
+  size_t reserve_size;
 };
 
 struct msgq_msg_t {
@@ -55,14 +115,40 @@ int msgq_msg_init_size(msgq_msg_t *msg, size_t size);
 int msgq_msg_init_data(msgq_msg_t *msg, char * data, size_t size);
 int msgq_msg_close(msgq_msg_t *msg);
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size);
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t max_readers=NUM_READERS);
 void msgq_close_queue(msgq_queue_t *q);
 void msgq_init_publisher(msgq_queue_t * q);
 void msgq_init_subscriber(msgq_queue_t * q);
+int msgq_reclaim_readers(msgq_queue_t * q);
+int msgq_num_readers(msgq_queue_t * q);
 
+// Sends and reserves fail with EMSGSIZE for a message that doesn't fit three times into the ring
 int msgq_msg_send(msgq_msg_t *msg, msgq_queue_t *q);
+// Writes all messages with a single write pointer update, a batch that doesn't fit into the
+// ring at once fails with EMSGSIZE. With notify=false the readers are woken up by a later
+// msgq_notify_readers, which can cover several queues at once.
+int msgq_msg_send_batch(msgq_msg_t *msgs, size_t num_msgs, msgq_queue_t *q, bool notify=true);
+void msgq_notify_readers(msgq_queue_t **queues, size_t num_queues);
+
+// Zero-copy send. msg->data is pointed at room for size bytes inside the next ring slot,
+// commit publishes the first size bytes of it. Other sends on the queue have to wait for commit or cancel.
+int msgq_msg_reserve(msgq_msg_t *msg, size_t size, msgq_queue_t *q);
+int msgq_msg_commit(msgq_msg_t *msg, size_t size, msgq_queue_t *q);
+void msgq_msg_cancel(msgq_queue_t *q);
 int msgq_msg_recv(msgq_msg_t *msg, msgq_queue_t *q);
 int msgq_msg_ready(msgq_queue_t * q);
+
+// Zero-copy receive. The returned msg points directly into the shared ring and must not be freed.
+// The read pointer is only advanced on release, so the writer keeps invalidating this reader if it overwrites the slot.
+int msgq_msg_recv_view(msgq_msg_t *msg, msgq_queue_t *q);
+bool msgq_msg_view_valid(msgq_queue_t *q);
+int msgq_msg_release_view(msgq_msg_t *msg, msgq_queue_t *q);
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout);
 
 bool msgq_all_readers_updated(msgq_queue_t *q);
+
+uint64_t msgq_nanos();
+// Path of the segment of a queue, in /dev/shm or MSGQ_HUGETLBFS
+std::string msgq_segment_path(const std::string &name);
+size_t msgq_header_size(size_t max_readers);
+size_t msgq_stats_offset(size_t max_readers);
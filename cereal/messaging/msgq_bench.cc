@@ -0,0 +1,103 @@
+// Measures the msgq receive path over many queues, to compare page sizes of the segments.
+//
+//   msgq_bench [-q queues] [-s segment_kb] [-b msg_bytes] [-n rounds]
+//   MSGQ_HUGEPAGES=1 msgq_bench ...
+//   MSGQ_HUGETLBFS=/dev/hugepages msgq_bench ...
+//
+// Every round sends one message to each queue and then reads all of them back through
+// the zero-copy view, touching every cache line of the payload. Only the reads are timed.
+// The huge page mapped shmem of the process is printed to check that the kernel used them.
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "msgq.h"
+
+struct Queue {
+  msgq_queue_t pub, sub;
+  std::string name;
+};
+
+static void print_huge_mapped() {
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (f == NULL) return;
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, "ShmemPmdMapped", 14) == 0 || strncmp(line, "FilePmdMapped", 13) == 0 ||
+        strncmp(line, "Shared_Hugetlb", 14) == 0) {
+      printf("  %s", line);
+    }
+  }
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  int num_queues = 100, rounds = 20000;
+  size_t segment_kb = 2048, msg_bytes = 4096;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "q:s:b:n:")) != -1) {
+    switch (opt) {
+      case 'q': num_queues = atoi(optarg); break;
+      case 's': segment_kb = atol(optarg); break;
+      case 'b': msg_bytes = atol(optarg); break;
+      case 'n': rounds = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-q queues] [-s segment_kb] [-b msg_bytes] [-n rounds]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<Queue> queues(num_queues);
+  for (int i = 0; i < num_queues; i++) {
+    Queue &q = queues[i];
+    q.name = "msgq_bench_" + std::to_string(getpid()) + "_" + std::to_string(i);
+    if (msgq_new_queue(&q.pub, q.name.c_str(), segment_kb * 1024) != 0 ||
+        msgq_new_queue(&q.sub, q.name.c_str(), segment_kb * 1024) != 0) {
+      fprintf(stderr, "can't create %s\n", q.name.c_str());
+      return 1;
+    }
+    msgq_init_publisher(&q.pub);
+    msgq_init_subscriber(&q.sub);
+  }
+
+  std::vector<char> payload(msg_bytes, 1);
+  uint64_t recv_ns = 0, received = 0, checksum = 0;
+  for (int r = 0; r < rounds; r++) {
+    for (auto &q : queues) {
+      msgq_msg_t msg;
+      msgq_msg_init_data(&msg, payload.data(), payload.size());
+      msgq_msg_send(&msg, &q.pub);
+      msgq_msg_close(&msg);
+    }
+
+    uint64_t start = msgq_nanos();
+    for (auto &q : queues) {
+      msgq_msg_t msg;
+      if (msgq_msg_recv_view(&msg, &q.sub) > 0) {
+        for (size_t i = 0; i < msg.size; i += 64) checksum += msg.data[i];
+        msgq_msg_release_view(&msg, &q.sub);
+        received++;
+      }
+    }
+    recv_ns += msgq_nanos() - start;
+  }
+
+  printf("%d queues of %zu KB, %zu byte messages\n", num_queues, segment_kb, msg_bytes);
+  printf("  received %lu, %.1f ns per message, %.2f GB/s (checksum %lu)\n", (unsigned long)received,
+         (double)recv_ns / received, (double)received * msg_bytes / recv_ns, (unsigned long)checksum);
+  print_huge_mapped();
+
+  for (auto &q : queues) {
+    msgq_close_queue(&q.sub);
+    msgq_close_queue(&q.pub);
+    unlink(msgq_segment_path(q.name).c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "msgq.h"
+
+// Dumps the per reader counters of every msgq queue under /dev/shm, or MSGQ_HUGETLBFS when set.
+// Readers only count with MSGQ_STATS=1 in their environment.
+
+static const char *queue_dir = getenv("MSGQ_HUGETLBFS") ? getenv("MSGQ_HUGETLBFS") : "/dev/shm";
+static const size_t prefix_len = strlen(MSGQ_SEGMENT_PREFIX);
+
+static std::string thread_name(uint64_t uid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/comm", (int)(uid & 0xFFFFFFFF));
+
+  char name[32] = "?";
+  FILE *f = fopen(path, "r");
+  if (f) {
+    if (fgets(name, sizeof(name), f)) name[strcspn(name, "\n")] = 0;
+    fclose(f);
+  }
+  return name;
+}
+
+static int percentile_us(const uint64_t *hist, uint64_t total, double p) {
+  uint64_t target = total * p, count = 0;
+  for (int i = 0; i < MSGQ_LATENCY_BUCKETS; i++) {
+    count += hist[i];
+    if (count > target) return 1 << i;
+  }
+  return 1 << (MSGQ_LATENCY_BUCKETS - 1);
+}
+
+static void dump_queue(const char *name) {
+  std::string path = msgq_segment_path(name);
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t)sizeof(msgq_header_t)) {
+    close(fd);
+    return;
+  }
+
+  msgq_header_t header;
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.max_readers == 0 || header.max_readers > MAX_READERS ||
+      header.num_readers > header.max_readers ||
+      st.st_size <= (off_t)msgq_header_size(header.max_readers)) {
+    close(fd);
+    return;
+  }
+
+  size_t len = msgq_header_size(header.max_readers);
+  char *mem = (char *)mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return;
+
+  msgq_reader_t *readers = (msgq_reader_t *)(mem + sizeof(msgq_header_t));
+  msgq_reader_stats_t *stats = (msgq_reader_stats_t *)(mem + msgq_stats_offset(header.max_readers));
+  printf("%s: %lu/%lu readers, %lu msgs sent, %lu KB ring\n", name,
+         (unsigned long)header.num_readers, (unsigned long)header.max_readers,
+         (unsigned long)header.write_seq, (unsigned long)(st.st_size - len) / 1024);
+
+  for (uint64_t i = 0; i < header.num_readers; i++) {
+    const msgq_reader_t &r = readers[i];
+    if (r.read_uid == 0) continue;
+
+    const msgq_reader_stats_t &s = stats[i];
+    printf("  [%2lu] %-16s tid %-6d recv %-10lu lost %-8lu resets %-6lu latency p50 <%dus p99 <%dus\n",
+           (unsigned long)i, thread_name(r.read_uid).c_str(), (int)(r.read_uid & 0xFFFFFFFF),
+           (unsigned long)s.received, (unsigned long)s.lost, (unsigned long)s.resets,
+           percentile_us(s.latency_hist, s.received, 0.5), percentile_us(s.latency_hist, s.received, 0.99));
+  }
+
+  munmap(mem, len);
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> names;
+  if (argc > 1) {
+    names.assign(argv + 1, argv + argc);
+  } else {
+    DIR *d = opendir(queue_dir);
+    if (d == NULL) {
+      perror("opendir");
+      return 1;
+    }
+    while (struct dirent *de = readdir(d)) {
+      if (strncmp(de->d_name, MSGQ_SEGMENT_PREFIX, prefix_len) == 0) names.push_back(de->d_name + prefix_len);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+  }
+
+  for (auto &name : names) {
+    dump_queue(name.c_str());
+  }
+  return 0;
+}
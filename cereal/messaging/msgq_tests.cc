@@ -0,0 +1,198 @@
+#include <cerrno>
+#include <string>
+
+#include <unistd.h>
+
+#include "catch2/catch.hpp"
+#include "messaging.h"
+#include "msgq.h"
+
+static std::string queue_name(const char *name) {
+  return std::string("msgq_test_") + name + "_" + std::to_string(getpid());
+}
+
+TEST_CASE("Oversized messages fail instead of aborting"){
+  const size_t size = 1024 * 1024;
+  std::string path = queue_name("oversized");
+  msgq_queue_t pub, sub;
+  REQUIRE(msgq_new_queue(&pub, path.c_str(), size) == 0);
+  REQUIRE(msgq_new_queue(&sub, path.c_str(), size) == 0);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  msgq_msg_t msg;
+  msgq_msg_init_size(&msg, size / 2);
+  memset(msg.data, 'a', msg.size);
+  errno = 0;
+  REQUIRE(msgq_msg_send(&msg, &pub) == -1);
+  REQUIRE(errno == EMSGSIZE);
+
+  msgq_msg_t reserved;
+  errno = 0;
+  REQUIRE(msgq_msg_reserve(&reserved, size / 2, &pub) == -1);
+  REQUIRE(errno == EMSGSIZE);
+  msgq_msg_close(&msg);
+
+  // nothing was written, the queue still works
+  msgq_msg_init_size(&msg, 128);
+  memset(msg.data, 'b', msg.size);
+  REQUIRE(msgq_msg_send(&msg, &pub) == 128);
+  msgq_msg_close(&msg);
+
+  msgq_msg_t recv;
+  REQUIRE(msgq_msg_recv(&recv, &sub) == 128);
+  REQUIRE(recv.data[0] == 'b');
+  msgq_msg_close(&recv);
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+  unlink(msgq_segment_path(path).c_str());
+}
+
+TEST_CASE("A conflating reader counts the messages it skips"){
+  const size_t size = 64 * 1024;
+  std::string path = queue_name("conflate");
+  msgq_queue_t pub, sub;
+  REQUIRE(msgq_new_queue(&pub, path.c_str(), size) == 0);
+  REQUIRE(msgq_new_queue(&sub, path.c_str(), size) == 0);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+  sub.read_conflate = true;
+
+  msgq_msg_t msg;
+  for (int i = 0; i < 3; i++){
+    msgq_msg_init_size(&msg, 16);
+    memset(msg.data, 'a' + i, msg.size);
+    REQUIRE(msgq_msg_send(&msg, &pub) == 16);
+    msgq_msg_close(&msg);
+  }
+
+  msgq_msg_t recv;
+  REQUIRE(msgq_msg_recv(&recv, &sub) == 16);
+  REQUIRE(recv.data[0] == 'c');
+  msgq_msg_close(&recv);
+  REQUIRE(sub.read_conflated == 2);
+
+  // the newest one alone isn't a skip
+  msgq_msg_init_size(&msg, 16);
+  REQUIRE(msgq_msg_send(&msg, &pub) == 16);
+  msgq_msg_close(&msg);
+  REQUIRE(msgq_msg_recv(&recv, &sub) == 16);
+  msgq_msg_close(&recv);
+  REQUIRE(sub.read_conflated == 2);
+
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+  unlink(msgq_segment_path(path).c_str());
+}
+
+TEST_CASE("A batch larger than the ring fails as a whole"){
+  const size_t size = 64 * 1024;
+  std::string path = queue_name("batch");
+  msgq_queue_t pub, sub;
+  REQUIRE(msgq_new_queue(&pub, path.c_str(), size) == 0);
+  REQUIRE(msgq_new_queue(&sub, path.c_str(), size) == 0);
+  msgq_init_publisher(&pub);
+  msgq_init_subscriber(&sub);
+
+  // every message fits on its own, together they'd overwrite the first ones
+  msgq_msg_t msgs[8];
+  for (int i = 0; i < 8; i++){
+    msgq_msg_init_size(&msgs[i], size / 4);
+    memset(msgs[i].data, 'a' + i, msgs[i].size);
+  }
+  errno = 0;
+  REQUIRE(msgq_msg_send_batch(msgs, 8, &pub) == -1);
+  REQUIRE(errno == EMSGSIZE);
+
+  msgq_msg_t recv;
+  REQUIRE(msgq_msg_recv(&recv, &sub) == 0);
+
+  REQUIRE(msgq_msg_send_batch(msgs, 2, &pub) == 2);
+  for (int i = 0; i < 2; i++){
+    REQUIRE(msgq_msg_recv(&recv, &sub) == (int)(size / 4));
+    REQUIRE(recv.data[0] == 'a' + i);
+    msgq_msg_close(&recv);
+  }
+
+  for (auto &msg : msgs) msgq_msg_close(&msg);
+  msgq_close_queue(&sub);
+  msgq_close_queue(&pub);
+  unlink(msgq_segment_path(path).c_str());
+}
+
+TEST_CASE("A segment of another size is replaced, not resized"){
+  std::string path = queue_name("resized");
+  msgq_queue_t old_pub, old_sub;
+  REQUIRE(msgq_new_queue(&old_pub, path.c_str(), 1024 * 1024) == 0);
+  REQUIRE(msgq_new_queue(&old_sub, path.c_str(), 1024 * 1024) == 0);
+  msgq_init_publisher(&old_pub);
+  msgq_init_subscriber(&old_sub);
+
+  // a process with other sizes gets a new file, the old mapping stays whole
+  msgq_queue_t new_pub;
+  REQUIRE(msgq_new_queue(&new_pub, path.c_str(), 64 * 1024) == 0);
+  msgq_init_publisher(&new_pub);
+  REQUIRE(new_pub.mmap_p != old_pub.mmap_p);
+
+  msgq_msg_t msg;
+  msgq_msg_init_size(&msg, 512 * 1024 / 3 - 64);
+  memset(msg.data, 'c', msg.size);
+  REQUIRE(msgq_msg_send(&msg, &old_pub) == (int)msg.size);
+  msgq_msg_close(&msg);
+
+  msgq_msg_t recv;
+  REQUIRE(msgq_msg_recv(&recv, &old_sub) > 0);
+  REQUIRE(recv.data[recv.size - 1] == 'c');
+  msgq_msg_close(&recv);
+
+  msgq_close_queue(&new_pub);
+  msgq_close_queue(&old_sub);
+  msgq_close_queue(&old_pub);
+  unlink(msgq_segment_path(path).c_str());
+}
+
+TEST_CASE("RingMessageBuilder leaves the published slot alone"){
+  if (messaging_use_zmq()) return;
+
+  std::string endpoint = queue_name("ring_builder");
+  Context *c = Context::create();
+  PubSocket *pub = PubSocket::create(c, endpoint, false);
+  SubSocket *sub = SubSocket::create(c, endpoint, "127.0.0.1", false, false);
+  REQUIRE(pub != NULL);
+  REQUIRE(sub != NULL);
+
+  // reserve, build, commit and destroy, then the reader decodes it
+  for (int i = 0; i < 3; i++){
+    std::string text = "ring message " + std::to_string(i);
+    {
+      RingMessageBuilder msg(pub, 1024);
+      msg.initEvent().setLogMessage(text);
+      REQUIRE(msg.send() > 0);
+    }
+
+    AlignedBuffer buf;
+    auto words = sub->receiveAligned(buf);
+    REQUIRE(words.size() > 0);
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    REQUIRE(event.isLogMessage());
+    REQUIRE(std::string(event.getLogMessage()) == text);
+  }
+
+  // too large for the slot, it goes out as a copy
+  {
+    std::string text(4096, 'x');
+    RingMessageBuilder msg(pub, 64);
+    msg.initEvent().setLogMessage(text);
+    REQUIRE(msg.send() > 0);
+  }
+  AlignedBuffer buf;
+  capnp::FlatArrayMessageReader reader(sub->receiveAligned(buf));
+  REQUIRE(reader.getRoot<cereal::Event>().getLogMessage().size() == 4096);
+
+  delete sub;
+  delete pub;
+  delete c;
+  unlink(msgq_segment_path(endpoint).c_str());
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+// Simulated time, for running the daemons faster than real time. With SIMULATED_TIME set,
+// nanos_since_boot, initEvent's logMonoTime, sleeps, RateKeepers and msgq poll timeouts all
+// run on a clock in shared memory instead of CLOCK_BOOTTIME. It only moves when the replay
+// controller (common/sim_clock.py) advances it, so a process waiting on it waits until the
+// controller has given it the time, however long that takes in real time.
+#define SIM_CLOCK_PATH "/dev/shm/sim_clock"
+#define SIM_CLOCK_MAGIC 0x4b4c4353  // "SCLK"
+
+// how often a sleep on the simulated clock looks at it, in real time
+#define SIM_CLOCK_POLL_NS 50000
+
+struct SimClock {
+  uint32_t magic;
+  uint32_t reserved;
+  std::atomic<uint64_t> nanos;
+};
+static_assert(sizeof(SimClock) == 16);
+
+// The simulated clock, or NULL when running on real time
+inline const SimClock *sim_clock() {
+  static const SimClock *clock = []() -> const SimClock * {
+    if (getenv("SIMULATED_TIME") == NULL) return NULL;
+
+    // falling back to real time would be nondeterministic without anyone noticing
+    int fd = open(SIM_CLOCK_PATH, O_RDONLY | O_CLOEXEC);
+    void *mem = fd >= 0 ? mmap(NULL, sizeof(SimClock), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (fd >= 0) close(fd);
+    if (mem == MAP_FAILED || ((const SimClock *)mem)->magic != SIM_CLOCK_MAGIC) {
+      fprintf(stderr, "SIMULATED_TIME is set, but there is no clock at %s\n", SIM_CLOCK_PATH);
+      abort();
+    }
+    return (const SimClock *)mem;
+  }();
+  return clock;
+}
+
+static inline uint64_t sim_clock_nanos(const SimClock *clock) {
+  return clock->nanos.load(std::memory_order_acquire);
+}
+
+// Nanoseconds on the simulated clock if there is one, on clock_id otherwise
+static inline uint64_t sim_clock_gettime(clockid_t clock_id) {
+  const SimClock *clock = sim_clock();
+  if (clock != NULL) return sim_clock_nanos(clock);
+
+  struct timespec t;
+  clock_gettime(clock_id, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+// Sleeps until the simulated clock reaches t, returns false without sleeping when running on real time
+static inline bool sim_clock_sleep_until(uint64_t t) {
+  const SimClock *clock = sim_clock();
+  if (clock == NULL) return false;
+
+  struct timespec ts = {.tv_sec = 0, .tv_nsec = SIM_CLOCK_POLL_NS};
+  while (sim_clock_nanos(clock) < t) {
+    nanosleep(&ts, NULL);
+  }
+  return true;
+}
+
+static inline bool sim_clock_sleep_for(uint64_t ns) {
+  const SimClock *clock = sim_clock();
+  return clock != NULL && sim_clock_sleep_until(sim_clock_nanos(clock) + ns);
+}
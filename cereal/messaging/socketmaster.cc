@@ -1,8 +1,10 @@
 #include <time.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <cstring>
 #include <string>
 #include <mutex>
+#include <algorithm>
 
 #include "services.h"
 #include "messaging.h"
@@ -10,9 +12,7 @@
 const bool SIMULATION = (getenv("SIMULATION") != nullptr) && (std::string(getenv("SIMULATION")) == "1");
 
 static inline uint64_t nanos_since_boot() {
-  struct timespec t;
-  clock_gettime(CLOCK_BOOTTIME, &t);
-  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+  return sim_clock_gettime(CLOCK_BOOTTIME);
 }
 
 static const service *get_service(const char *name) {
@@ -54,6 +54,7 @@ struct SubMaster::SubMessage {
   capnp::FlatArrayMessageReader *msg_reader = nullptr;
   AlignedBuffer aligned_buf;
   cereal::Event::Reader event;
+  std::function<void(const cereal::Event::Reader &)> callback;
 };
 
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const char *address,
@@ -72,45 +73,62 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const char *
       .ignore_alive = inList(ignore_alive, name),
       .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader))};
     m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
-    messages_[socket] = m;
-    services_[name] = m;
+    messages_.push_back(m);
+    services_[serv - services] = m;
   }
 }
 
 void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+  for (auto m : messages_) m->updated = false;
 
   auto sockets = poller_->poll(timeout);
   uint64_t current_time = nanos_since_boot();
 
-  std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
+  if (++frame == UINT64_MAX) frame = 1;
 
   for (auto s : sockets) {
-    Message *msg = s->receive(true);
-    if (msg == nullptr) continue;
+    SubMessage *m = nullptr;
+    for (auto it : messages_) {
+      if (it->socket == s) {
+        m = it;
+        break;
+      }
+    }
+    assert(m != nullptr);
 
-    SubMessage *m = messages_.at(s);
+    // Received into the per service buffer, the reader is reconstructed in place
+    auto words = s->receiveAligned(m->aligned_buf);
+    if (words.size() == 0) continue;
 
     m->msg_reader->~FlatArrayMessageReader();
     capnp::ReaderOptions options;
     options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
-    delete msg;
-    messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
+    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(words, options);
+
+    m->event = m->msg_reader->getRoot<cereal::Event>();
+    m->updated = true;
+    m->rcv_time = current_time;
+    m->rcv_frame = frame;
+    m->valid = m->event.getValid();
+    if (SIMULATION) m->alive = true;
+    if (m->callback) m->callback(m->event);
   }
 
-  update_msgs(current_time, messages);
+  update_alive(current_time);
+}
+
+void SubMaster::set_callback(const char *name, std::function<void(const cereal::Event::Reader &)> callback) {
+  at(name)->callback = callback;
 }
 
 void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages){
   if (++frame == UINT64_MAX) frame = 1;
 
   for(auto &kv : messages) {
-    auto m_find = services_.find(kv.first);
-    if (m_find == services_.end()){
+    SubMessage *m = find(kv.first.c_str());
+    if (m == nullptr){
       continue;
     }
-    SubMessage *m = m_find->second;
     m->event = kv.second;
     m->updated = true;
     m->rcv_time = current_time;
@@ -119,9 +137,12 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
     if (SIMULATION) m->alive = true;
   }
 
+  update_alive(current_time);
+}
+
+void SubMaster::update_alive(uint64_t current_time) {
   if (!SIMULATION) {
-    for (auto &kv : messages_) {
-      SubMessage *m = kv.second;
+    for (auto m : messages_) {
       m->alive = (m->freq <= (1e-5) || ((current_time - m->rcv_time) * (1e-9)) < (10.0 / m->freq));
     }
   }
@@ -129,8 +150,7 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
 
 bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid, bool alive) {
   int found = 0;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : messages_) {
     if (service_list.size() == 0 || inList(service_list, m->name.c_str())) {
       found += (!valid || m->valid) && (!alive || (m->alive || m->ignore_alive));
     }
@@ -151,34 +171,77 @@ void SubMaster::drain() {
   }
 }
 
+SubMaster::SubMessage *SubMaster::find(const char *name) const {
+  // A linear scan over the subscribed services is cheaper than a map for the usual handful of them
+  for (auto m : messages_) {
+    if (strcmp(m->name.c_str(), name) == 0) return m;
+  }
+  return nullptr;
+}
+
+SubMaster::SubMessage *SubMaster::at(const char *name) const {
+  SubMessage *m = find(name);
+  assert(m != nullptr);
+  return m;
+}
+
+SubMaster::SubMessage *SubMaster::find(Service s) const {
+  SubMessage *m = services_[(int)s];
+  assert(m != nullptr);
+  return m;
+}
+
 bool SubMaster::updated(const char *name) const {
-  return services_.at(name)->updated;
+  return at(name)->updated;
 }
 
 bool SubMaster::alive(const char *name) const {
-  return services_.at(name)->alive;
+  return at(name)->alive;
 }
 
 bool SubMaster::valid(const char *name) const {
-  return services_.at(name)->valid;
+  return at(name)->valid;
 }
 
 uint64_t SubMaster::rcv_frame(const char *name) const {
-  return services_.at(name)->rcv_frame;
+  return at(name)->rcv_frame;
 }
 
 uint64_t SubMaster::rcv_time(const char *name) const {
-  return services_.at(name)->rcv_time;
+  return at(name)->rcv_time;
 }
 
 cereal::Event::Reader &SubMaster::operator[](const char *name) const {
-  return services_.at(name)->event;
+  return at(name)->event;
 };
 
+bool SubMaster::updated(Service s) const {
+  return find(s)->updated;
+}
+
+bool SubMaster::alive(Service s) const {
+  return find(s)->alive;
+}
+
+bool SubMaster::valid(Service s) const {
+  return find(s)->valid;
+}
+
+uint64_t SubMaster::rcv_frame(Service s) const {
+  return find(s)->rcv_frame;
+}
+
+uint64_t SubMaster::rcv_time(Service s) const {
+  return find(s)->rcv_time;
+}
+
+cereal::Event::Reader &SubMaster::operator[](Service s) const {
+  return find(s)->event;
+}
+
 SubMaster::~SubMaster() {
   delete poller_;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : messages_) {
     m->msg_reader->~FlatArrayMessageReader();
     free(m->allocated_msg_reader);
     delete m->socket;
@@ -196,10 +259,154 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
 }
 
 int PubMaster::send(const char *name, MessageBuilder &msg) {
+  if (messaging_use_zmq()) {
+    // the flat array goes to zmq as the message, not copied into one
+    kj::Array<capnp::word> words = capnp::messageToFlatArray(msg);
+    const size_t size = words.asBytes().size();
+    return sockets_.at(name)->send_owned(kj::mv(words), size);
+  }
   auto bytes = msg.toBytes();
   return send(name, bytes.begin(), bytes.size());
 }
 
+int PubMaster::send_many(const std::vector<std::pair<const char *, MessageBuilder *>> &msgs) {
+  std::vector<PubSocket *> sockets;
+  std::vector<std::vector<kj::ArrayPtr<capnp::byte>>> batches;
+
+  // Group by service, keeping the order within each service
+  for (auto &[name, msg] : msgs) {
+    PubSocket *socket = sockets_.at(name);
+    size_t idx = std::find(sockets.begin(), sockets.end(), socket) - sockets.begin();
+    if (idx == sockets.size()) {
+      sockets.push_back(socket);
+      batches.emplace_back();
+    }
+    batches[idx].push_back(msg->toBytes());
+  }
+
+  int ret = 0;
+  for (size_t i = 0; i < sockets.size(); i++) {
+    if (sockets[i]->send_batch(batches[i], false) < 0) ret = -1;
+  }
+  PubSocket::notify_readers(sockets);
+  return ret;
+}
+
+namespace {
+
+// The buffers of PooledMessageBuilder and the size of the largest message per topic, per thread
+struct MessagePool {
+  struct Buffer {
+    kj::Array<capnp::word> words;
+    bool in_use;
+  };
+  std::vector<Buffer> buffers;
+  std::vector<std::pair<std::string, size_t>> hints;
+};
+
+thread_local MessagePool message_pool;
+
+const size_t POOL_FIRST_SEGMENT_WORDS = 1024;
+
+}  // namespace
+
+PooledMessageBuilder::Segment PooledMessageBuilder::acquire(const char *topic) {
+  MessagePool &pool = message_pool;
+  size_t hint_idx = 0;
+  while (hint_idx < pool.hints.size() && pool.hints[hint_idx].first != topic) hint_idx++;
+  if (hint_idx == pool.hints.size()) {
+    pool.hints.push_back({topic, POOL_FIRST_SEGMENT_WORDS});
+  }
+
+  // One extra word in front of the segment holds the segment table, plus some room to grow
+  size_t hint = pool.hints[hint_idx].second;
+  size_t words = hint + hint / 4 + 1;
+
+  // The smallest free buffer that fits, or else any free one is grown
+  MessagePool::Buffer *buf = nullptr;
+  for (auto &b : pool.buffers) {
+    if (b.in_use) continue;
+    bool fits = b.words.size() >= words;
+    if (!buf || (fits && (buf->words.size() < words || b.words.size() < buf->words.size()))) {
+      buf = &b;
+    }
+  }
+  if (!buf) {
+    buf = &pool.buffers.emplace_back(MessagePool::Buffer{});
+  }
+  if (buf->words.size() < words) {
+    // capnp expects a zeroed first segment, and zeroes what it used when the builder is destroyed
+    buf->words = kj::heapArray<capnp::word>(words);
+    memset(buf->words.begin(), 0, words * sizeof(capnp::word));
+  }
+  buf->in_use = true;
+  return {buf->words.slice(1, buf->words.size()), hint_idx};
+}
+
+PooledMessageBuilder::~PooledMessageBuilder() {
+  size_t words = 0;
+  for (auto &segment : getSegmentsForOutput()) words += segment.size();
+  size_t &hint = message_pool.hints[segment_.hint_idx].second;
+  hint = std::max(hint, words);
+
+  // The buffer stays alive in the pool, so the MallocMessageBuilder destructor can still zero it
+  for (auto &b : message_pool.buffers) {
+    if (b.words.begin() + 1 == segment_.words.begin()) b.in_use = false;
+  }
+}
+
+kj::ArrayPtr<capnp::byte> PooledMessageBuilder::toBytes() {
+  auto segments = getSegmentsForOutput();
+  if (segments.size() != 1 || segments[0].begin() != segment_.words.begin()) {
+    return MessageBuilder::toBytes();
+  }
+  // Single segment, write the segment table in front of it
+  uint32_t *table = (uint32_t *)(segment_.words.begin() - 1);
+  table[0] = 0;
+  table[1] = segments[0].size();
+  return kj::arrayPtr((capnp::byte *)table, (segments[0].size() + 1) * sizeof(capnp::word));
+}
+
+RingMessageBuilder::RingMessageBuilder(PubSocket *socket, size_t max_size) : socket_(socket) {
+  // One extra word in front of the segment holds the segment table
+  size_t words = max_size / sizeof(capnp::word) + 2;
+  capnp::word *p = (capnp::word *)socket->reserve(words * sizeof(capnp::word));
+  if (p != nullptr) {
+    slot_ = kj::arrayPtr(p + 1, words - 1);
+  }
+}
+
+kj::ArrayPtr<capnp::word> RingMessageBuilder::allocateSegment(unsigned int minimum_size) {
+  if (!slot_used_ && slot_.size() >= minimum_size) {
+    slot_used_ = true;
+    return slot_;
+  }
+  return MessageBuilder::allocateSegment(minimum_size);
+}
+
+int RingMessageBuilder::send() {
+  assert(!done_);
+  done_ = true;
+
+  auto segments = getSegmentsForOutput();
+  if (segments.size() == 1 && segments[0].begin() == slot_.begin()) {
+    // Still in the reserved slot, write the single segment table in front of it
+    uint32_t *table = (uint32_t *)(segments[0].begin() - 1);
+    table[0] = 0;
+    table[1] = segments[0].size();
+    return socket_->commit((segments[0].size() + 1) * sizeof(capnp::word));
+  }
+
+  // Spilled over into heap segments, flatten before the slot is reused by the regular send
+  kj::Array<capnp::word> flat = capnp::messageToFlatArray(*this);
+  if (slot_ != nullptr) socket_->cancel();
+  return socket_->send((char *)flat.begin(), flat.asBytes().size());
+}
+
+RingMessageBuilder::~RingMessageBuilder() {
+  if (!done_ && slot_ != nullptr) socket_->cancel();
+}
+
 PubMaster::~PubMaster() {
   for (auto s : sockets_) delete s.second;
 }
@@ -0,0 +1,112 @@
+#include "trace.h"
+#include "sim_clock.h"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef __APPLE__
+#define CLOCK_BOOTTIME CLOCK_MONOTONIC
+#endif
+
+const bool trace_enabled = getenv("TRACE") != nullptr;
+
+uint64_t trace_nanos() {
+  // Same clock as logMonoTime, so spans line up with rlogs
+  return sim_clock_gettime(CLOCK_BOOTTIME);
+}
+
+int trace_remove_stale_rings() {
+  DIR *d = opendir("/dev/shm");
+  if (d == NULL) return 0;
+
+  int removed = 0;
+  while (struct dirent *de = readdir(d)) {
+    if (strncmp(de->d_name, "trace_", 6) != 0) continue;
+    char *end;
+    long pid = strtol(de->d_name + 6, &end, 10);
+    if (*end != 0 || pid <= 0) continue;
+    if (kill(pid, 0) == 0 || errno != ESRCH) continue;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/shm/trace_%ld", pid);
+    if (unlink(path) == 0) removed++;
+  }
+  closedir(d);
+  return removed;
+}
+
+static trace_ring_t *trace_get_ring() {
+  static trace_ring_t *ring = []() -> trace_ring_t* {
+    // processes restarted by the manager leave theirs behind
+    trace_remove_stale_rings();
+
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/shm/trace_%d", getpid());
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0664);
+    if (fd < 0) return nullptr;
+
+    if (ftruncate(fd, sizeof(trace_ring_t)) < 0) {
+      close(fd);
+      return nullptr;
+    }
+
+    void *mem = mmap(NULL, sizeof(trace_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return nullptr;
+
+    trace_ring_t *r = (trace_ring_t *)mem;
+    r->pid = getpid();
+    FILE *f = fopen("/proc/self/comm", "r");
+    if (f) {
+      if (fgets(r->comm, sizeof(r->comm), f)) r->comm[strcspn(r->comm, "\n")] = 0;
+      fclose(f);
+    }
+    return r;
+  }();
+
+  return ring;
+}
+
+void trace_record(const char *name, const char *arg, uint64_t start, uint64_t end) {
+  trace_ring_t *ring = trace_get_ring();
+  if (ring == nullptr) return;
+
+  static thread_local uint32_t tid = 0;
+  if (tid == 0) {
+#ifdef __APPLE__
+    tid = getpid();
+#else
+    tid = syscall(SYS_gettid);
+#endif
+  }
+
+  uint64_t idx = __atomic_fetch_add(&ring->write_idx, 1, __ATOMIC_RELAXED);
+  trace_event_t *ev = &ring->events[idx % TRACE_RING_SIZE];
+
+  // Mark the slot as in progress, the exporter skips events whose seq doesn't match
+  __atomic_store_n(&ev->seq, 0, __ATOMIC_RELEASE);
+  ev->start = start;
+  ev->duration = end - start;
+  ev->tid = tid;
+  strncpy(ev->name, name, TRACE_NAME_LEN - 1);
+  ev->name[TRACE_NAME_LEN - 1] = 0;
+  if (arg != nullptr) {
+    strncpy(ev->arg, arg, TRACE_NAME_LEN - 1);
+    ev->arg[TRACE_NAME_LEN - 1] = 0;
+  } else {
+    ev->arg[0] = 0;
+  }
+  __atomic_store_n(&ev->seq, idx + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Lightweight tracing spans. With TRACE=1 in the environment every span is recorded into a
+// per process lock-free ring in /dev/shm/trace_<pid>, messaging/trace_dump exports all rings
+// in Chrome/Perfetto json format. When disabled a span costs a single branch.
+// The ring outlives its process so it can still be exported, it's removed by the next
+// process that starts tracing or by trace_dump once it has exported it.
+
+#define TRACE_RING_SIZE 8192
+#define TRACE_NAME_LEN 24
+
+struct trace_event_t {
+  uint64_t seq; // index + 1 once the event is complete, 0 while it is written
+  uint64_t start;
+  uint64_t duration;
+  uint32_t tid;
+  char name[TRACE_NAME_LEN];
+  char arg[TRACE_NAME_LEN];
+};
+
+struct trace_ring_t {
+  uint64_t write_idx;
+  uint32_t pid;
+  char comm[16];
+  trace_event_t events[TRACE_RING_SIZE];
+};
+
+extern const bool trace_enabled;
+
+uint64_t trace_nanos();
+void trace_record(const char *name, const char *arg, uint64_t start, uint64_t end);
+// Removes the rings of processes that are gone, returns how many
+int trace_remove_stale_rings();
+
+class TraceSpan {
+public:
+  inline TraceSpan(const char *name, const char *arg = nullptr) : name_(name), arg_(arg), start_(trace_enabled ? trace_nanos() : 0) {}
+  inline ~TraceSpan() {
+    if (start_ != 0) trace_record(name_, arg_, start_, trace_nanos());
+  }
+
+private:
+  const char *name_;
+  const char *arg_;
+  uint64_t start_;
+};
+
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
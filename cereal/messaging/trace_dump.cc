@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+// Exports the trace rings of all processes in Chrome/Perfetto json trace format.
+// Usage: trace_dump > trace.json, then open it in ui.perfetto.dev or chrome://tracing
+// The rings of processes that have exited are removed once they are exported.
+
+static void json_escape(FILE *out, const char *s) {
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') fputc('\\', out);
+    if ((unsigned char)*s >= 0x20) fputc(*s, out);
+  }
+}
+
+int main(int argc, char **argv) {
+  FILE *out = stdout;
+  if (argc > 1 && (out = fopen(argv[1], "w")) == NULL) {
+    perror("fopen");
+    return 1;
+  }
+
+  DIR *d = opendir("/dev/shm");
+  if (d == NULL) {
+    perror("opendir");
+    return 1;
+  }
+
+  fprintf(out, "{\"traceEvents\":[\n");
+  bool first = true;
+  size_t total = 0;
+
+  while (struct dirent *de = readdir(d)) {
+    if (strncmp(de->d_name, "trace_", 6) != 0) continue;
+
+    std::string path = std::string("/dev/shm/") + de->d_name;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) continue;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size != sizeof(trace_ring_t)) {
+      close(fd);
+      continue;
+    }
+
+    trace_ring_t *ring = (trace_ring_t *)mmap(NULL, sizeof(trace_ring_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) continue;
+
+    fprintf(out, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"", first ? "" : ",\n", ring->pid);
+    json_escape(out, ring->comm);
+    fprintf(out, "\"}}");
+    first = false;
+
+    uint64_t write_idx = __atomic_load_n(&ring->write_idx, __ATOMIC_ACQUIRE);
+    uint64_t begin = write_idx > TRACE_RING_SIZE ? write_idx - TRACE_RING_SIZE : 0;
+    for (uint64_t idx = begin; idx < write_idx; idx++) {
+      trace_event_t ev = ring->events[idx % TRACE_RING_SIZE];
+      if (ev.seq != idx + 1) continue; // overwritten or still being written
+
+      ev.name[TRACE_NAME_LEN - 1] = ev.arg[TRACE_NAME_LEN - 1] = 0;
+      fprintf(out, ",\n{\"name\":\"");
+      json_escape(out, ev.name);
+      fprintf(out, "\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+              ring->pid, ev.tid, ev.start / 1e3, ev.duration / 1e3);
+      if (ev.arg[0]) {
+        fprintf(out, ",\"args\":{\"arg\":\"");
+        json_escape(out, ev.arg);
+        fprintf(out, "\"}");
+      }
+      fprintf(out, "}");
+      total++;
+    }
+    munmap(ring, sizeof(trace_ring_t));
+  }
+  closedir(d);
+
+  fprintf(out, "\n]}\n");
+  if (out != stdout) fclose(out);
+  int removed = trace_remove_stale_rings();
+  fprintf(stderr, "exported %zu events, removed %d rings of exited processes\n", total, removed);
+  return 0;
+}
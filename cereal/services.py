@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
+import math
 import os
-from typing import Optional
+from typing import Optional, Tuple
 
 TICI = os.path.isfile('/TICI')
 RESERVED_PORT = 8022  # sshd
@@ -12,12 +13,37 @@ def new_port(port: int):
   return port + 1 if port >= RESERVED_PORT else port
 
 
+# msgq ring sizing. Every ring holds at least three worst case messages (required by msgq)
+# and SEGMENT_BUFFER_SECONDS of typical messages, so a slow reader can fall behind without losing any.
+# The worst case estimates get MSG_SIZE_HEADROOM on top, a message that still doesn't fit is dropped
+# by msgq with EMSGSIZE
+MIN_SEGMENT_SIZE = 1024 * 1024
+SEGMENT_BUFFER_SECONDS = 2.
+MSG_SIZE_HEADROOM = 2
+
+
+def segment_size(frequency: float, typical_msg_size: int, max_msg_size: int) -> int:
+  sz = max(MIN_SEGMENT_SIZE, 3 * MSG_SIZE_HEADROOM * max_msg_size, int(SEGMENT_BUFFER_SECONDS * frequency * typical_msg_size))
+  sz = 1 << (sz - 1).bit_length()
+  assert sz < 0xFFFFFFFF, "msgq rings must be smaller than 4 GB"
+  return sz
+
+
+# zmq (PC and the bridge) queues as many messages per socket as a msgq ring holds seconds of them,
+# instead of its default 1000, which is too little at high rates and a lot of memory for large messages
+MIN_ZMQ_HWM = 100
+
+
 class Service:
-  def __init__(self, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None):
+  def __init__(self, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None,
+               msg_sizes: Tuple[int, int] = (0, 0), zmq_batch: bool = False):
     self.port = port
     self.should_log = should_log
     self.frequency = frequency
     self.decimation = decimation
+    self.segment_size = segment_size(frequency, *msg_sizes)
+    self.zmq_hwm = max(MIN_ZMQ_HWM, math.ceil(SEGMENT_BUFFER_SECONDS * frequency))
+    self.zmq_batch = zmq_batch
 
 DCAM_FREQ = 10. if not TICI else 20.
 
@@ -59,6 +85,7 @@ services = {
   "wideRoadEncodeIdx": (True, 20., 1),
   "wideRoadCameraState": (True, 20., 20),
   "modelV2": (True, 20., 40),
+  "modelV2Shadow": (True, 0.),
   "managerState": (True, 2., 1),
   "uploaderState": (True, 0., 1),
   "liveMapData": (True, 0.),
@@ -69,9 +96,54 @@ services = {
   # dp
   "thermal": (True, 2., 1),
   "dragonConf": (False, 1.),
+
+  "cameraStats": (True, 1., 1),
+  "driverCameraRoi": (True, 0.),
+  "loggerdState": (True, 1., 1),
+  "loggerdSegment": (True, 0., 1),
+  "sendcanTiming": (True, 100.),
+  "pandaStates": (True, 2., 1),
+  "canStats": (True, 1., 1),
+  "canSignals": (True, 2., 1),
+  "gnssMeasurements": (True, 10.),
+  "threadLog": (True, 10.),
+  "daemonMetrics": (True, 1., 1),
+  "modelV2Compact": (True, 20.),
+}
+KB = 1024
+MB = 1024 * KB
+
+# service: (typical, worst case) encoded message size in bytes, for services
+# where three worst case messages don't fit into MIN_SEGMENT_SIZE or that are large and frequent
+msg_sizes = {
+  "can": (2 * KB, 32 * KB),
+  "sendcan": (1 * KB, 32 * KB),
+  "sensorEvents": (2 * KB, 16 * KB),
+  "modelV2": (40 * KB, 128 * KB),
+  "modelV2Shadow": (40 * KB, 128 * KB),
+  "modelV2Compact": (8 * KB, 64 * KB),
+  "driverState": (2 * KB, 64 * KB),
+  "cameraOdometry": (1 * KB, 64 * KB),
+  # a crash or a chatty process logs long lines in bursts
+  "logMessage": (1 * KB, 256 * KB),
+  "androidLog": (1 * KB, 256 * KB),
+  "threadLog": (16 * KB, 256 * KB),
+  "thumbnail": (64 * KB, 512 * KB),
+  "procLog": (64 * KB, 512 * KB),
+  "liveMapData": (16 * KB, 512 * KB),
+  # carry a full frame image when a snapshot is requested
+  "roadCameraState": (1 * KB, 8 * MB),
+  "driverCameraState": (1 * KB, 8 * MB),
+  "wideRoadCameraState": (1 * KB, 8 * MB),
 }
-service_list = {name: Service(new_port(idx), *vals) for  # type: ignore
-                idx, (name, vals) in enumerate(services.items())}
+
+# services whose batches (PubMaster::send_many) go out as one zmq multipart message. zmq can't
+# conflate multipart messages, their subscribers never conflate
+zmq_batched = {"sensorEvents"}
+
+service_list = {name: Service(new_port(idx), *vals, msg_sizes=msg_sizes.get(name, (0, 0)),  # type: ignore
+                              zmq_batch=name in zmq_batched)
+                for idx, (name, vals) in enumerate(services.items())}
 
 
 def build_header():
@@ -79,13 +151,22 @@ def build_header():
   h += "/* THIS IS AN AUTOGENERATED FILE, PLEASE EDIT services.py */\n"
   h += "#ifndef __SERVICES_H\n"
   h += "#define __SERVICES_H\n"
-  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; };\n"
+  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; int segment_size; " \
+       "int zmq_hwm; bool zmq_batch; };\n"
   h += "static struct service services[] = {\n"
   for k, v in service_list.items():
     should_log = "true" if v.should_log else "false"
     decimation = -1 if v.decimation is None else v.decimation
-    h += '  { "%s", %d, %s, %d, %d },\n' % \
-         (k, v.port, should_log, v.frequency, decimation)
+    zmq_batch = "true" if v.zmq_batch else "false"
+    h += '  { "%s", %d, %s, %d, %d, %d, %d, %s },\n' % \
+         (k, v.port, should_log, v.frequency, decimation, v.segment_size, v.zmq_hwm, zmq_batch)
+  h += "};\n"
+  h += "\n"
+  h += "// index into services[], for lookups without string compares\n"
+  h += "#define SERVICE_COUNT %d\n" % len(service_list)
+  h += "enum class Service : int {\n"
+  for k in service_list.keys():
+    h += "  %s,\n" % k
   h += "};\n"
   h += "#endif\n"
   return h
@@ -1,5 +1,7 @@
 #include "visionbuf.h"
 
+#include <unistd.h>
+
 #define ALIGN(x, align) (((x) + (align)-1) & ~((align)-1))
 
 #ifdef QCOM
@@ -22,6 +24,40 @@ void visionbuf_compute_aligned_width_and_height(int width, int height, int *alig
 #endif
 }
 
+void VisionBuf::init_meta() {
+  this->meta = (VisionBufMeta *)((uint8_t *)this->addr + this->mmap_len - VISIONBUF_META_SIZE);
+}
+
+// True when the server reused this buffer after the client received it
+bool VisionBuf::overwritten() {
+  return this->meta != nullptr && this->meta->generation != this->generation;
+}
+
+bool VisionBuf::hold() {
+  uint32_t pid = getpid();
+  for (auto &h : this->meta->holders) {
+    uint32_t free_slot = 0;
+    if (h.compare_exchange_strong(free_slot, pid)) return true;
+  }
+  return false;
+}
+
+void VisionBuf::release() {
+  uint32_t pid = getpid();
+  for (auto &h : this->meta->holders) {
+    uint32_t holder = pid;
+    if (h.compare_exchange_strong(holder, 0)) return;
+  }
+}
+
+size_t VisionBuf::holders() {
+  size_t n = 0;
+  for (auto &h : this->meta->holders) {
+    n += h != 0;
+  }
+  return n;
+}
+
 void VisionBuf::init_rgb(size_t width, size_t height, size_t stride) {
   this->rgb = true;
   this->width = width;
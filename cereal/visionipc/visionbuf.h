@@ -1,4 +1,6 @@
 #pragma once
+#include <atomic>
+
 #include "visionipc.h"
 
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
@@ -11,6 +13,17 @@
 #define VISIONBUF_SYNC_FROM_DEVICE 0
 #define VISIONBUF_SYNC_TO_DEVICE 1
 
+#define VISIONBUF_MAX_HOLDERS 12
+
+// Lives in the last bytes of every buffer mapping so it is shared between server and clients
+struct VisionBufMeta {
+  std::atomic<uint64_t> generation; // bumped each time the server hands the buffer out for writing
+  // pid of the client behind each reference currently holding the buffer, 0 for a free slot
+  std::atomic<uint32_t> holders[VISIONBUF_MAX_HOLDERS];
+};
+#define VISIONBUF_META_SIZE 64
+static_assert(sizeof(VisionBufMeta) <= VISIONBUF_META_SIZE);
+
 enum VisionStreamType {
   VISION_STREAM_RGB_BACK,
   VISION_STREAM_RGB_FRONT,
@@ -18,6 +31,8 @@ enum VisionStreamType {
   VISION_STREAM_YUV_BACK,
   VISION_STREAM_YUV_FRONT,
   VISION_STREAM_YUV_WIDE,
+  VISION_STREAM_YUV_BACK_SMALL,
+  VISION_STREAM_YUV_FRONT_ROI,
   VISION_STREAM_MAX,
 };
 
@@ -42,6 +57,8 @@ class VisionBuf {
   uint64_t server_id = 0;
   size_t idx = 0;
   VisionStreamType type;
+  VisionBufMeta * meta = nullptr;
+  uint64_t generation = 0; // Generation the client received, see overwritten()
 
   // OpenCL
   cl_mem buf_cl = nullptr;
@@ -50,11 +67,23 @@ class VisionBuf {
   // ion
   int handle = 0;
 
+  // CUDA, the same memory mapped into the GPU by init_cuda
+  void * buf_cuda = nullptr;
+
   void allocate(size_t len);
   void import();
   void init_cl(cl_device_id device_id, cl_context ctx);
+  void init_cuda();
   void init_rgb(size_t width, size_t height, size_t stride);
   void init_yuv(size_t width, size_t height);
+  void init_meta();
+  bool overwritten();
+  // Client side reference, false when all slots are taken and the buffer isn't held
+  bool hold();
+  void release();
+  // The references held right now, including those of clients that died holding
+  // the buffer until the server reclaims them
+  size_t holders();
   int sync(int dir);
   int free();
 };
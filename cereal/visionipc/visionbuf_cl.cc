@@ -11,6 +11,16 @@
 
 std::atomic<int> offset = 0;
 
+// VISIONIPC_HUGEPAGES=1 asks for transparent huge pages on the buffers, in the
+// server and in every client mapping them
+static const bool hugepages = getenv("VISIONIPC_HUGEPAGES") != nullptr;
+
+static void advise_hugepages(void *addr, size_t len) {
+#ifdef MADV_HUGEPAGE
+  if (hugepages) madvise(addr, len, MADV_HUGEPAGE);
+#endif
+}
+
 static void *malloc_with_fd(size_t len, int *fd) {
   char full_path[0x100];
 
@@ -28,18 +38,20 @@ static void *malloc_with_fd(size_t len, int *fd) {
   ftruncate(*fd, len);
   void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
   assert(addr != MAP_FAILED);
+  advise_hugepages(addr, len);
 
   return addr;
 }
 
 void VisionBuf::allocate(size_t len) {
   int fd;
-  void *addr = malloc_with_fd(len, &fd);
+  void *addr = malloc_with_fd(len + VISIONBUF_META_SIZE, &fd);
 
   this->len = len;
-  this->mmap_len = len;
+  this->mmap_len = len + VISIONBUF_META_SIZE;
   this->addr = addr;
   this->fd = fd;
+  init_meta();
 }
 
 void VisionBuf::init_cl(cl_device_id device_id, cl_context ctx){
@@ -57,6 +69,8 @@ void VisionBuf::import(){
   assert(this->fd >= 0);
   this->addr = mmap(NULL, this->mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
   assert(this->addr != MAP_FAILED);
+  advise_hugepages(this->addr, this->mmap_len);
+  init_meta();
 }
 
 
@@ -87,7 +101,7 @@ int VisionBuf::free() {
     if (err != 0) return err;
   }
 
-  err = munmap(this->addr, this->len);
+  err = munmap(this->addr, this->mmap_len);
   if (err != 0) return err;
 
   err = close(this->fd);
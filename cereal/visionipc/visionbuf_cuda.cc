@@ -0,0 +1,118 @@
+#include "visionbuf.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <cuda_runtime.h>
+
+// Jetson: CPU and GPU share the same memory, so a buffer mapped into CUDA is
+// the buffer itself, no copies. The memory is the shared memory of the other
+// backends to keep passing buffers by fd, each process maps it into CUDA
+// with init_cuda, only where it runs CUDA on it. OpenCL (pocl) uses the host
+// pointer as before.
+
+std::atomic<int> offset = 0;
+
+static void *malloc_with_fd(size_t len, int *fd) {
+  char full_path[0x100];
+  snprintf(full_path, sizeof(full_path)-1, "/dev/shm/visionbuf_%d_%d", getpid(), offset++);
+
+  *fd = open(full_path, O_RDWR | O_CREAT, 0664);
+  assert(*fd >= 0);
+
+  unlink(full_path);
+
+  ftruncate(*fd, len);
+  void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  assert(addr != MAP_FAILED);
+
+  return addr;
+}
+
+void VisionBuf::allocate(size_t len) {
+  int fd;
+  void *addr = malloc_with_fd(len + VISIONBUF_META_SIZE, &fd);
+
+  this->len = len;
+  this->mmap_len = len + VISIONBUF_META_SIZE;
+  this->addr = addr;
+  this->fd = fd;
+  this->buf_cuda = nullptr;
+  init_meta();
+}
+
+void VisionBuf::init_cl(cl_device_id device_id, cl_context ctx){
+  int err;
+
+  this->copy_q = clCreateCommandQueue(ctx, device_id, 0, &err);
+  assert(err == 0);
+
+  this->buf_cl = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, this->len, this->addr, &err);
+  assert(err == 0);
+}
+
+void VisionBuf::init_cuda() {
+  if (this->buf_cuda) return;
+
+  // mmap is page aligned, which is all cudaHostRegister asks for
+  cudaError_t err = cudaHostRegister(this->addr, this->mmap_len, cudaHostRegisterMapped);
+  assert(err == cudaSuccess);
+  err = cudaHostGetDevicePointer(&this->buf_cuda, this->addr, 0);
+  assert(err == cudaSuccess);
+}
+
+void VisionBuf::import(){
+  assert(this->fd >= 0);
+  this->addr = mmap(NULL, this->mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+  assert(this->addr != MAP_FAILED);
+  // the pointer the server sent is from its own mapping
+  this->buf_cuda = nullptr;
+  init_meta();
+}
+
+int VisionBuf::sync(int dir) {
+  int err = 0;
+  // the CUDA mapping is coherent, only pocl keeps a copy
+  if (!this->buf_cl) return 0;
+
+  if (dir == VISIONBUF_SYNC_FROM_DEVICE) {
+    err = clEnqueueReadBuffer(this->copy_q, this->buf_cl, CL_FALSE, 0, this->len, this->addr, 0, NULL, NULL);
+  } else {
+    err = clEnqueueWriteBuffer(this->copy_q, this->buf_cl, CL_FALSE, 0, this->len, this->addr, 0, NULL, NULL);
+  }
+
+  if (err == 0){
+    err = clFinish(this->copy_q);
+  }
+
+  return err;
+}
+
+int VisionBuf::free() {
+  int err = 0;
+  if (this->buf_cl){
+    err = clReleaseMemObject(this->buf_cl);
+    if (err != 0) return err;
+
+    err = clReleaseCommandQueue(this->copy_q);
+    if (err != 0) return err;
+  }
+
+  if (this->buf_cuda) {
+    err = cudaHostUnregister(this->addr);
+    if (err != 0) return err;
+    this->buf_cuda = nullptr;
+  }
+
+  err = munmap(this->addr, this->mmap_len);
+  if (err != 0) return err;
+
+  err = close(this->fd);
+  return err;
+}
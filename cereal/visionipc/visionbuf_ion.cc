@@ -42,7 +42,7 @@ void VisionBuf::allocate(size_t len) {
   ion_init();
 
   struct ion_allocation_data ion_alloc = {0};
-  ion_alloc.len = len + PADDING_CL;
+  ion_alloc.len = len + PADDING_CL + VISIONBUF_META_SIZE;
   ion_alloc.align = 4096;
   ion_alloc.heap_id_mask = 1 << ION_IOMMU_HEAP_ID;
   ion_alloc.flags = ION_FLAG_CACHED;
@@ -67,6 +67,7 @@ void VisionBuf::allocate(size_t len) {
   this->addr = addr;
   this->handle = ion_alloc.handle;
   this->fd = ion_fd_data.fd;
+  init_meta();
 }
 
 void VisionBuf::import(){
@@ -84,6 +85,7 @@ void VisionBuf::import(){
   this->handle = fd_data.handle;
   this->addr = mmap(NULL, this->mmap_len, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
   assert(this->addr != MAP_FAILED);
+  init_meta();
 }
 
 void VisionBuf::init_cl(cl_device_id device_id, cl_context ctx) {
@@ -2,6 +2,9 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <time.h>
+
+#include "../messaging/sim_clock.h"
 
 constexpr int VISIONIPC_MAX_FDS = 128;
 
@@ -9,10 +12,21 @@ struct VisionIpcBufExtra {
   uint32_t frame_id;
   uint64_t timestamp_sof;
   uint64_t timestamp_eof;
+
+  // Hand-off times of the processing stages, see vipc_nanos_since_boot
+  uint64_t timestamp_isp;      // ISP handed the frame to the camera process
+  uint64_t timestamp_sent;     // set by VisionIpcServer::send
+  uint64_t timestamp_received; // set by VisionIpcClient::recv
 };
 
+// Same clock as nanos_since_boot in selfdrive/common/timing.h
+static inline uint64_t vipc_nanos_since_boot() {
+  return sim_clock_gettime(CLOCK_BOOTTIME);
+}
+
 struct VisionIpcPacket {
   uint64_t server_id;
   size_t idx;
+  uint64_t generation;
   struct VisionIpcBufExtra extra;
 };
@@ -22,6 +22,7 @@ cdef extern from "visionipc.h":
     uint32_t frame_id
     uint64_t timestamp_sof
     uint64_t timestamp_eof
+    uint64_t timestamp_isp
 
 cdef extern from "visionipc_server.h":
   cdef cppclass VisionIpcServer:
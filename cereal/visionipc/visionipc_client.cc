@@ -3,12 +3,15 @@
 #include <iostream>
 #include <thread>
 
+#include <sys/stat.h>
+
 #include "visionipc/ipc.h"
 #include "visionipc/visionipc_client.h"
 #include "visionipc/visionipc_server.h"
 #include "logger/logger.h"
+#include "messaging/trace.h"
 
-VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), device_id(device_id), ctx(ctx) {
+VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), device_id(device_id), ctx(ctx), conflate(conflate) {
   msg_ctx = Context::create();
   sock = SubSocket::create(msg_ctx, get_endpoint_name(name, type), "127.0.0.1", conflate, false);
 
@@ -16,18 +19,32 @@ VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool c
   poller->registerSocket(sock);
 }
 
-// Connect is not thread safe. Do not use the buffers while calling connect
-bool VisionIpcClient::connect(bool blocking){
-  connected = false;
+void VisionIpcClient::release_held(){
+  if (held == nullptr) return;
 
-  // Cleanup old buffers on reconnect
-  for (size_t i = 0; i < num_buffers; i++){
-    if (buffers[i].free() != 0) {
-      LOGE("Failed to free buffer %zu", i);
-    }
+  if (held->overwritten()) {
+    frames_overwritten++;
+    LOGW("%s frame %zu was overwritten while held", name.c_str(), held->idx);
+  }
+  held->release();
+  held = nullptr;
+}
+
+void VisionIpcClient::import_buffer(VisionBuf &buf) {
+  buf.import();
+  if (buf.rgb) {
+    buf.init_rgb(buf.width, buf.height, buf.stride);
+  } else {
+    buf.init_yuv(buf.width, buf.height);
   }
 
-  num_buffers = 0;
+  if (device_id) buf.init_cl(device_id, ctx);
+}
+
+// Connect is not thread safe. Do not use the buffers while calling connect
+bool VisionIpcClient::connect(bool blocking){
+  connected = false;
+  release_held();
 
   // Connect to server socket and ask for all FDs of type
   std::string path = "/tmp/visionipc_" + name;
@@ -53,24 +70,48 @@ bool VisionIpcClient::connect(bool blocking){
   // Get FDs
   int fds[VISIONIPC_MAX_FDS];
   VisionBuf bufs[VISIONIPC_MAX_FDS];
-  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_buffers);
+  int num_fds = 0;
+  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_fds);
+  close(socket_fd);
+
+  assert(num_fds > 0);
+  assert(r == sizeof(VisionBuf) * num_fds);
+
+  // A buffer is the same one as before when it comes from the same server
+  // session and file, it is kept mapped and set up for OpenCL as it is. Only
+  // what changed is imported, and what the server doesn't have anymore freed.
+  // A server sends its buffers in the same order each time
+  BufKey keys[VISIONIPC_MAX_FDS];
+  bool kept[VISIONIPC_MAX_FDS] = {};
+  for (int i = 0; i < num_fds; i++) {
+    struct stat st = {};
+    fstat(fds[i], &st);
+    keys[i] = {bufs[i].server_id, st.st_dev, st.st_ino};
+    kept[i] = i < num_buffers && buffer_keys[i] == keys[i] && buffers[i].len == bufs[i].len;
+  }
 
-  assert(num_buffers > 0);
-  assert(r == sizeof(VisionBuf) * num_buffers);
+  for (int i = 0; i < num_buffers; i++) {
+    if (!kept[i] && buffers[i].free() != 0) {
+      LOGE("Failed to free buffer %d", i);
+    }
+  }
 
-  // Import buffers
-  for (size_t i = 0; i < num_buffers; i++){
-    buffers[i] = bufs[i];
-    buffers[i].fd = fds[i];
-    buffers[i].import();
-    if (buffers[i].rgb) {
-      buffers[i].init_rgb(buffers[i].width, buffers[i].height, buffers[i].stride);
+  buffers_reused = 0;
+  buffers_imported = 0;
+  for (int i = 0; i < num_fds; i++) {
+    if (kept[i]) {
+      // the fd we have refers to the same file already
+      close(fds[i]);
+      buffers_reused++;
     } else {
-      buffers[i].init_yuv(buffers[i].width, buffers[i].height);
+      buffers[i] = bufs[i];
+      buffers[i].fd = fds[i];
+      import_buffer(buffers[i]);
+      buffers_imported++;
     }
-
-    if (device_id) buffers[i].init_cl(device_id, ctx);
+    buffer_keys[i] = keys[i];
   }
+  num_buffers = num_fds;
 
   connected = true;
   return true;
@@ -83,6 +124,7 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     return nullptr;
   }
 
+  TRACE_SPAN("vipc_recv", name.c_str());
   Message * r = sock->receive(true);
   if (r == nullptr){
     return nullptr;
@@ -101,10 +143,29 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     return nullptr;
   }
 
+  // Take a reference before checking the generation, so the server either
+  // skips this buffer from now on or we notice it was already reused
+  release_held();
+  bool holding = buf->hold();
+  buf->generation = packet->generation;
+  if (buf->overwritten()) {
+    frames_overwritten++;
+    if (holding) buf->release();
+    delete r;
+    return nullptr;
+  }
+  if (holding) held = buf;
+
   if (extra) {
     *extra = packet->extra;
+    extra->timestamp_received = vipc_nanos_since_boot();
   }
 
+  const uint64_t conflated = sock->numConflated();
+  frames_skipped = conflated - last_conflated;
+  total_frames_skipped += frames_skipped;
+  last_conflated = conflated;
+
   if (buf->sync(VISIONBUF_SYNC_TO_DEVICE) != 0) {
     LOGE("Failed to sync buffer");
   }
@@ -116,6 +177,7 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
 
 
 VisionIpcClient::~VisionIpcClient(){
+  release_held();
   for (size_t i = 0; i < num_buffers; i++){
     if (buffers[i].free() != 0) {
       LOGE("Failed to free buffer %zu", i);
@@ -2,6 +2,7 @@
 #include <vector>
 #include <string>
 #include <unistd.h>
+#include <sys/types.h>
 
 #include "messaging/messaging.h"
 #include "visionipc/visionipc.h"
@@ -19,14 +20,44 @@ private:
   cl_device_id device_id = nullptr;
   cl_context ctx = nullptr;
 
+  VisionBuf * held = nullptr;
+  uint64_t last_conflated = 0;
+
+  // What a buffer was imported from, a reconnect to the same server keeps the
+  // buffers it still has instead of mapping them again
+  struct BufKey {
+    uint64_t server_id;
+    dev_t dev;
+    ino_t ino;
+    bool operator==(const BufKey &other) const {
+      return server_id == other.server_id && dev == other.dev && ino == other.ino;
+    }
+  };
+  BufKey buffer_keys[VISIONIPC_MAX_FDS];
+
   void init_msgq(bool conflate);
+  void release_held();
+  void import_buffer(VisionBuf &buf);
 
 public:
   bool connected = false;
   int num_buffers = 0;
   VisionBuf buffers[VISIONIPC_MAX_FDS];
+  uint64_t frames_overwritten = 0;
+  bool conflate;
+  // Frames the server sent that a conflating client dropped to return the
+  // newest one in the last recv, as counted by the socket. Frames the server
+  // never sent (camera drops) aren't in it
+  uint32_t frames_skipped = 0;
+  uint64_t total_frames_skipped = 0;
+  // Buffers the last connect kept from the connection before, and imported
+  int buffers_reused = 0;
+  int buffers_imported = 0;
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcClient();
+  // The returned buffer is held until the next recv, the server won't reuse it
+  // unless it runs out of buffers. Check buf->overwritten() before trusting the
+  // contents once done with it.
   VisionBuf * recv(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
   bool connect(bool blocking=true);
 };
@@ -22,6 +22,8 @@ cpdef enum VisionStreamType:
   VISION_STREAM_YUV_BACK
   VISION_STREAM_YUV_FRONT
   VISION_STREAM_YUV_WIDE
+  VISION_STREAM_YUV_BACK_SMALL
+  VISION_STREAM_YUV_FRONT_ROI
 
 
 cdef class VisionIpcServer:
@@ -44,6 +46,7 @@ cdef class VisionIpcServer:
     extra.frame_id = frame_id
     extra.timestamp_sof = timestamp_sof
     extra.timestamp_eof = timestamp_eof
+    extra.timestamp_isp = 0
 
     self.server.send(buf, &extra, False)
 
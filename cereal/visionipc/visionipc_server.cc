@@ -1,9 +1,16 @@
+#include <algorithm>
 #include <iostream>
 #include <chrono>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <random>
+#include <sstream>
+
+#include <cerrno>
 
 #include <poll.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -11,6 +18,7 @@
 #include "visionipc/ipc.h"
 #include "visionipc/visionipc_server.h"
 #include "logger/logger.h"
+#include "messaging/trace.h"
 
 std::string get_endpoint_name(std::string name, VisionStreamType type){
   if (messaging_use_zmq()){
@@ -29,8 +37,28 @@ VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_co
   server_id = distribution(rd);
 }
 
+// count VISIONIPC_BUFFERS sets for the stream, or 0
+static size_t buffer_count_override(VisionStreamType type) {
+  const char *env = getenv("VISIONIPC_BUFFERS");
+  if (env == nullptr) return 0;
+
+  std::stringstream ss(env);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    int t = -1, count = 0;
+    if (sscanf(item.c_str(), "%d:%d", &t, &count) == 2 && t == type && count > 0) {
+      return std::min(count, VISIONIPC_MAX_FDS - 1);
+    }
+  }
+  return 0;
+}
+
 void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height){
   // TODO: assert that this type is not created yet
+  if (size_t count = buffer_count_override(type)) {
+    LOGW("%s: %zu buffers for stream %d instead of %zu", name.c_str(), count, type, num_buffers);
+    num_buffers = count;
+  }
   assert(num_buffers < VISIONIPC_MAX_FDS);
   int aligned_w = 0, aligned_h = 0;
 
@@ -61,6 +89,10 @@ void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers,
   }
 
   cur_idx[type] = 0;
+  held_reuses[type] = 0;
+  max_held[type] = 0;
+  live_pids[type].clear();
+  client_checks[type] = {};
 
   // Create msgq publisher for each of the `name` + type combos
   // TODO: compute port number directly if using zmq
@@ -69,6 +101,7 @@ void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers,
 
 
 void VisionIpcServer::start_listener(){
+  log_memory_report();
   listener_thread = std::thread(&VisionIpcServer::listener, this);
 }
 
@@ -110,6 +143,7 @@ void VisionIpcServer::listener(){
       close(fd);
       continue;
     }
+    num_connects++;
 
     int fds[VISIONIPC_MAX_FDS];
     int num_fds = buffers[type].size();
@@ -138,14 +172,61 @@ void VisionIpcServer::listener(){
 
 
 
+// A holder seen alive isn't checked again for this long, it's a syscall per
+// held buffer otherwise
+const auto HOLDER_CHECK_INTERVAL = std::chrono::seconds(1);
+
+size_t VisionIpcServer::live_holders(VisionBuf *buf, std::chrono::steady_clock::time_point now) {
+  auto &alive_until = live_pids[buf->type];
+  size_t n = 0;
+  for (auto &h : buf->meta->holders) {
+    uint32_t pid = h;
+    if (pid == 0) continue;
+    auto it = alive_until.find(pid);
+    if (it == alive_until.end() || now > it->second) {
+      if (kill(pid, 0) != 0 && errno == ESRCH) {
+        alive_until.erase(pid);
+        h.compare_exchange_strong(pid, 0);
+        continue;
+      }
+      alive_until[pid] = now + HOLDER_CHECK_INTERVAL;
+    }
+    n++;
+  }
+  return n;
+}
+
 VisionBuf * VisionIpcServer::get_buffer(VisionStreamType type){
-  // Do we want to keep track if the buffer has been sent out yet and warn user?
   assert(buffers.count(type));
-  auto b = buffers[type];
-  return b[cur_idx[type]++ % b.size()];
+  auto &b = buffers[type];
+  size_t start = cur_idx[type]++;
+
+  // Skip buffers a client is still holding. When all of them are held by a
+  // slow consumer fall back to round robin, the client will see the frame as
+  // overwritten. A crashed client's references are dropped by live_holders().
+  const auto now = std::chrono::steady_clock::now();
+  VisionBuf *buf = nullptr;
+  size_t held = 0;
+  for (size_t i = 0; i < b.size(); i++) {
+    VisionBuf *candidate = b[(start + i) % b.size()];
+    if (live_holders(candidate, now) != 0) {
+      held++;
+    } else if (buf == nullptr) {
+      buf = candidate;
+    }
+  }
+  if (buf == nullptr) {
+    buf = b[start % b.size()];
+    held_reuses[type]++;
+  }
+  max_held[type] = std::max(max_held[type], held);
+
+  buf->meta->generation++;
+  return buf;
 }
 
 void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync){
+  TRACE_SPAN("vipc_send", name.c_str());
   if (sync) {
     if (buf->sync(VISIONBUF_SYNC_FROM_DEVICE) != 0) {
       LOGE("Failed to sync buffer");
@@ -158,14 +239,55 @@ void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync
   VisionIpcPacket packet = {0};
   packet.server_id = server_id;
   packet.idx = buf->idx;
+  packet.generation = buf->meta->generation;
   packet.extra = *extra;
+  packet.extra.timestamp_sent = vipc_nanos_since_boot();
 
   sockets[buf->type]->send((char*)&packet, sizeof(packet));
 }
 
+// Whether any client subscribes to the stream, so producers can skip work
+// nobody consumes. The subscriber count is refreshed once a second, or right
+// away when a new client connected through the listener.
+bool VisionIpcServer::has_clients(VisionStreamType type){
+  assert(client_checks.count(type));
+  ClientCheck &c = client_checks[type];
+
+  auto now = std::chrono::steady_clock::now();
+  uint64_t connects = num_connects;
+  if (connects != c.connects || now - c.last_check > std::chrono::seconds(1)) {
+    c.connects = connects;
+    c.last_check = now;
+    c.has_clients = sockets[type]->num_subscribers() != 0;
+  }
+  return c.has_clients;
+}
+
+std::vector<VisionIpcStreamMemory> VisionIpcServer::memory_report(){
+  std::vector<VisionIpcStreamMemory> report;
+  for (auto const& [type, bufs] : buffers) {
+    if (bufs.empty()) continue;
+    report.push_back({type, bufs.size(), bufs[0]->mmap_len, bufs[0]->handle != 0, bufs[0]->buf_cl != nullptr,
+                      sockets[type]->num_subscribers(), max_held[type]});
+  }
+  return report;
+}
+
+void VisionIpcServer::log_memory_report(){
+  size_t total = 0;
+  for (auto &m : memory_report()) {
+    total += m.count * m.size;
+    LOG("%s: stream %d: %zu x %.1f MB %s%s, %d clients, at most %zu held",
+        name.c_str(), m.type, m.count, m.size / 1e6, m.ion ? "ion" : "shm", m.cl ? "+cl" : "",
+        m.clients, m.max_held);
+  }
+  LOG("%s: %.1f MB of buffers", name.c_str(), total / 1e6);
+}
+
 VisionIpcServer::~VisionIpcServer(){
   should_exit = true;
   listener_thread.join();
+  log_memory_report();
 
   // VisionBuf cleanup
   for( auto const& [type, buf] : buffers ) {
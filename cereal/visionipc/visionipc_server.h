@@ -4,6 +4,7 @@
 #include <thread>
 #include <atomic>
 #include <map>
+#include <chrono>
 
 #include "messaging/messaging.h"
 #include "visionipc/visionipc.h"
@@ -11,6 +12,16 @@
 
 std::string get_endpoint_name(std::string name, VisionStreamType type);
 
+// What one stream's buffers take, see VisionIpcServer::memory_report
+struct VisionIpcStreamMemory {
+  VisionStreamType type;
+  size_t count;
+  size_t size;      // mapping of one buffer, with its meta
+  bool ion, cl;     // allocated from ion, mapped into OpenCL
+  int clients;      // subscribed right now, -1 if the transport can't tell
+  size_t max_held;  // most buffers clients held at once when one was handed out
+};
+
 class VisionIpcServer {
  private:
   cl_device_id device_id = nullptr;
@@ -22,13 +33,27 @@ class VisionIpcServer {
   std::thread listener_thread;
 
   std::map<VisionStreamType, std::atomic<size_t> > cur_idx;
+  std::map<VisionStreamType, std::atomic<uint64_t> > held_reuses;
+  std::map<VisionStreamType, size_t> max_held;
+  // per stream, the holder pids seen alive and until when that's trusted
+  std::map<VisionStreamType, std::map<uint32_t, std::chrono::steady_clock::time_point> > live_pids;
   std::map<VisionStreamType, std::vector<VisionBuf*> > buffers;
   std::map<VisionStreamType, std::map<VisionBuf*, size_t> > idxs;
 
+  struct ClientCheck {
+    uint64_t connects = 0;
+    std::chrono::steady_clock::time_point last_check;
+    bool has_clients = true;
+  };
+  std::atomic<uint64_t> num_connects = 0;
+  std::map<VisionStreamType, ClientCheck> client_checks;
+
   Context * msg_ctx;
   std::map<VisionStreamType, PubSocket*> sockets;
 
   void listener(void);
+  // the references to buf of clients still running, those of the dead ones are cleared
+  size_t live_holders(VisionBuf *buf, std::chrono::steady_clock::time_point now);
 
  public:
   VisionIpcServer(std::string name, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
@@ -36,7 +61,15 @@ class VisionIpcServer {
 
   VisionBuf * get_buffer(VisionStreamType type);
 
+  // VISIONIPC_BUFFERS=<type>:<count>,... overrides num_buffers per stream, e.g. "3:20,4:20,5:20"
+  // for 20 of each YUV stream. The exit report tells how many the clients needed
   void create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height);
   void send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync=true);
+  bool has_clients(VisionStreamType type);
+  // Times get_buffer had to hand out a buffer a client was still holding
+  uint64_t num_held_reuses(VisionStreamType type) { return held_reuses[type]; }
+  std::vector<VisionIpcStreamMemory> memory_report();
+  // one line per stream and the total, logged when the listener starts and on exit
+  void log_memory_report();
   void start_listener();
 };
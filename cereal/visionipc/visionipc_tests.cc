@@ -1,6 +1,10 @@
 #include <thread>
 #include <chrono>
 
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "catch2/catch.hpp"
 #include "visionipc_server.h"
 #include "visionipc_client.h"
@@ -129,7 +133,163 @@ TEST_CASE("Test conflate"){
   VisionBuf * recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf != nullptr);
   REQUIRE(extra_recv.frame_id == 2);
+  // counted by msgq where it drops them, zmq can't tell
+  const uint32_t skipped = messaging_use_zmq() ? 0 : 1;
+  REQUIRE(client.frames_skipped == skipped);
+
+  // a gap in the frame ids the server sent isn't a skip
+  extra.frame_id = 5;
+  server.send(buf, &extra);
+  recv_buf = client.recv(&extra_recv);
+  REQUIRE(extra_recv.frame_id == 5);
+  REQUIRE(client.frames_skipped == 0);
+
+  extra.frame_id = 6;
+  server.send(buf, &extra);
+  extra.frame_id = 7;
+  server.send(buf, &extra);
+  recv_buf = client.recv(&extra_recv);
+  REQUIRE(extra_recv.frame_id == 7);
+  REQUIRE(client.frames_skipped == skipped);
+  REQUIRE(client.total_frames_skipped == 2 * skipped);
 
   recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf == nullptr);
 }
+
+TEST_CASE("Held buffers are not reused"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+
+  VisionBuf * recv_buf = client.recv();
+  REQUIRE(recv_buf != nullptr);
+
+  // Both following buffers should avoid the one the client holds
+  REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK)->idx != recv_buf->idx);
+  REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK)->idx != recv_buf->idx);
+  REQUIRE(!recv_buf->overwritten());
+}
+
+TEST_CASE("Overwritten while held"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 1, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionIpcBufExtra extra = {0};
+  server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+
+  VisionBuf * recv_buf = client.recv();
+  REQUIRE(recv_buf != nullptr);
+
+  // Only one buffer, so the server has to reuse it
+  server.get_buffer(VISION_STREAM_YUV_BACK);
+  REQUIRE(recv_buf->overwritten());
+}
+
+TEST_CASE("A client killed while holding a buffer doesn't keep it"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 1, false, 100, 100);
+  server.start_listener();
+
+  int ready[2], held[2];
+  REQUIRE(pipe(ready) == 0);
+  REQUIRE(pipe(held) == 0);
+  pid_t pid = fork();
+  if (pid == 0) {
+    VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+    if (!client.connect()) _exit(1);
+    zmq_sleep();
+    char c = 0;
+    if (write(ready[1], &c, 1) != 1) _exit(1);
+    if (client.recv(nullptr, 5000) == nullptr) _exit(1);
+    if (write(held[1], &c, 1) != 1) _exit(1);
+    // never releases it
+    kill(getpid(), SIGKILL);
+  }
+
+  char c;
+  REQUIRE(read(ready[0], &c, 1) == 1);
+  VisionIpcBufExtra extra = {0};
+  VisionBuf *buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+  server.send(buf, &extra);
+  REQUIRE(read(held[0], &c, 1) == 1);
+  REQUIRE(buf->holders() == 1);
+
+  int status;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+  REQUIRE(WIFSIGNALED(status));
+
+  // the dead client's reference is dropped, the buffer is free again
+  REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK) == buf);
+  REQUIRE(server.num_held_reuses(VISION_STREAM_YUV_BACK) == 0);
+  REQUIRE(buf->holders() == 0);
+
+  for (int fd : {ready[0], ready[1], held[0], held[1]}) close(fd);
+}
+
+TEST_CASE("Reconnect keeps the buffers of the same server"){
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  {
+    VisionIpcServer server("camerad");
+    server.create_buffers(VISION_STREAM_YUV_BACK, 3, false, 100, 100);
+    server.start_listener();
+
+    REQUIRE(client.connect());
+    REQUIRE(client.buffers_imported == 3);
+    void *addr = client.buffers[0].addr;
+
+    REQUIRE(client.connect());
+    REQUIRE(client.buffers_reused == 3);
+    REQUIRE(client.buffers_imported == 0);
+    REQUIRE(client.buffers[0].addr == addr);
+  }
+
+  // a restarted server is a new session, its buffers are imported
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 3, false, 100, 100);
+  server.start_listener();
+  REQUIRE(client.connect());
+  REQUIRE(client.buffers_reused == 0);
+  REQUIRE(client.buffers_imported == 3);
+}
+
+TEST_CASE("Buffer counts and memory report"){
+  setenv("VISIONIPC_BUFFERS", "1:7,3:2", 1);
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 5, false, 100, 100);
+  server.create_buffers(VISION_STREAM_YUV_WIDE, 5, false, 100, 100);
+  unsetenv("VISIONIPC_BUFFERS");
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  REQUIRE(client.num_buffers == 2);
+  zmq_sleep();
+
+  VisionIpcBufExtra extra = {0};
+  server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+  REQUIRE(client.recv() != nullptr);
+  server.get_buffer(VISION_STREAM_YUV_BACK);
+
+  auto report = server.memory_report();
+  REQUIRE(report.size() == 2);
+  REQUIRE(report[0].type == VISION_STREAM_YUV_BACK);
+  REQUIRE(report[0].count == 2);
+  REQUIRE(report[0].size >= 100 * 100 * 3 / 2);
+  REQUIRE(report[0].max_held == 1);
+  REQUIRE(report[1].count == 5);
+  REQUIRE(report[1].max_held == 0);
+}
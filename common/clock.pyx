@@ -1,6 +1,7 @@
 # distutils: language = c++
 # cython: language_level = 3
 from posix.time cimport clock_gettime, timespec, CLOCK_MONOTONIC_RAW, clockid_t
+import time
 
 IF UNAME_SYSNAME == "Darwin":
   # Darwin doesn't have a CLOCK_BOOTTIME
@@ -8,6 +9,10 @@ IF UNAME_SYSNAME == "Darwin":
 ELSE:
   from posix.time cimport CLOCK_BOOTTIME
 
+cdef extern from "cereal/messaging/sim_clock.h":
+  unsigned long long sim_clock_gettime(clockid_t clock_id)
+  bint sim_clock_sleep_for(unsigned long long ns) nogil
+
 cdef double readclock(clockid_t clock_id):
   cdef timespec ts
   cdef double current
@@ -20,5 +25,14 @@ def monotonic_time():
   return readclock(CLOCK_MONOTONIC_RAW)
 
 def sec_since_boot():
-  return readclock(CLOCK_BOOTTIME)
+  # the simulated clock when SIMULATED_TIME is set, see cereal/messaging/sim_clock.h
+  return sim_clock_gettime(CLOCK_BOOTTIME) / 1000000000.
 
+def sleep(double seconds):
+  """time.sleep on the clock of sec_since_boot"""
+  cdef unsigned long long ns = <unsigned long long>(max(seconds, 0.) * 1e9)
+  cdef bint simulated
+  with nogil:
+    simulated = sim_clock_sleep_for(ns)
+  if not simulated:
+    time.sleep(seconds)
@@ -216,12 +216,14 @@ function to init param value.
 should add this into manager.py
 '''
 def init_params_vals(params):
+  vals = {}
   for conf in confs:
     if 'param' in conf['conf_type']:
       if conf['name'] == 'dp_car_list':
-        params.put(conf['name'], get_support_car_list())
+        vals[conf['name']] = get_support_car_list()
       elif params.get(conf['name']) is None:
-        params.put(conf['name'], to_param_val(conf['name'], conf['default']))
+        vals[conf['name']] = to_param_val(conf['name'], conf['default'])
+  params.put_many(vals)
 
 def gen_params_cc_keys():
   for conf in confs:
@@ -1,4 +1,6 @@
 from libcpp.string cimport string
+from libcpp.vector cimport vector
+from libcpp.map cimport map
 from libcpp cimport bool
 
 cdef extern from "selfdrive/common/params.cc":
@@ -23,8 +25,10 @@ cdef extern from "selfdrive/common/params.h":
     bool getBool(string) nogil
     int remove(string) nogil
     int put(string, string) nogil
+    int put_many(map[string, string]) nogil
     int putBool(string, bool) nogil
     bool checkKey(string) nogil
+    string wait_for_change(vector[string], int) nogil
     void clearAll(ParamKeyType)
 
     string get_params_path()
\ No newline at end of file
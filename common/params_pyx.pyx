@@ -2,6 +2,8 @@
 # cython: language_level = 3
 from libcpp cimport bool
 from libcpp.string cimport string
+from libcpp.vector cimport vector
+from libcpp.map cimport map
 from common.params_pxd cimport Params as c_Params, ParamKeyType as c_ParamKeyType
 
 import os
@@ -84,6 +86,17 @@ cdef class Params:
       r = self.p.getBool(k)
     return r
 
+  def wait_for_change(self, keys, int timeout_ms=-1):
+    """
+    Blocks until one of keys is put or deleted, or for timeout_ms when it's
+    not -1. Returns the key that changed, None on a timeout.
+    """
+    cdef vector[string] ks = [self.check_key(k) for k in keys]
+    cdef string changed
+    with nogil:
+      changed = self.p.wait_for_change(ks, timeout_ms)
+    return changed.decode() if changed.size() else None
+
   def put(self, key, dat):
     """
     Warning: This function blocks until the param is written to disk!
@@ -96,6 +109,21 @@ cdef class Params:
     with nogil:
       self.p.put(k, dat_bytes)
 
+  def put_many(self, values):
+    """
+    Writes all of the key, value pairs in the dict values or none of them.
+    Much faster than a put for each, there's one fsync of the params
+    directory, but it still blocks until the params are written to disk.
+    """
+    cdef map[string, string] vals
+    for key, dat in values.items():
+      vals[self.check_key(key)] = ensure_bytes(dat)
+    cdef int r
+    with nogil:
+      r = self.p.put_many(vals)
+    if r != 0:
+      raise OSError(f"failed to write params: {r}")
+
   def put_bool(self, key, bool val):
     cdef string k = self.check_key(key)
     with nogil:
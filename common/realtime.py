@@ -1,11 +1,10 @@
 """Utilities for reading real time clocks and keeping soft real time constraints."""
 import gc
 import os
-import time
 import multiprocessing
 from typing import Optional
 
-from common.clock import sec_since_boot  # pylint: disable=no-name-in-module, import-error
+from common.clock import sec_since_boot, sleep  # pylint: disable=no-name-in-module, import-error
 from selfdrive.hardware import PC, TICI
 
 
@@ -70,7 +69,7 @@ class Ratekeeper:
   def keep_time(self) -> bool:
     lagged = self.monitor_time()
     if self._remaining > 0:
-      time.sleep(self._remaining)
+      sleep(self._remaining)
     return lagged
 
   # this only monitor the cumulative lag, but does not enforce a rate
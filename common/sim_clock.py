@@ -0,0 +1,58 @@
+"""The replay controller's side of the simulated clock, see cereal/messaging/sim_clock.h
+
+  clock = SimClock(start_ns)
+  env = {**os.environ, **clock.environ}   # for the processes that run on it
+  clock.advance_to(msg.logMonoTime)       # before sending each message
+
+A process started with the environment sees time move only when the controller moves it.
+"""
+import ctypes
+import mmap
+import os
+import struct
+
+SIM_CLOCK_PATH = "/dev/shm/sim_clock"
+SIM_CLOCK_MAGIC = 0x4b4c4353
+
+HEADER = struct.Struct("<II")
+SIZE = HEADER.size + 8
+
+
+class SimClock():
+  def __init__(self, start_ns=0, path=SIM_CLOCK_PATH):
+    self.path = path
+    fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o666)
+    try:
+      os.ftruncate(fd, SIZE)
+      self._mem = mmap.mmap(fd, SIZE)
+    finally:
+      os.close(fd)
+    # one aligned 8 byte store per update, readers never see half of it
+    self._nanos = ctypes.c_uint64.from_buffer(self._mem, HEADER.size)
+    self._nanos.value = start_ns
+    # written last, readers check it before using the time
+    HEADER.pack_into(self._mem, 0, SIM_CLOCK_MAGIC, 0)
+
+  @property
+  def environ(self):
+    return {"SIMULATED_TIME": "1"}
+
+  @property
+  def nanos(self):
+    return self._nanos.value
+
+  def advance_to(self, t_ns):
+    """Moves the clock forward to t_ns, it never goes back"""
+    if t_ns > self._nanos.value:
+      self._nanos.value = t_ns
+
+  def advance(self, dt_ns):
+    self.advance_to(self.nanos + dt_ns)
+
+  def close(self):
+    del self._nanos  # the mmap can't close while exported
+    self._mem.close()
+    try:
+      os.unlink(self.path)
+    except FileNotFoundError:
+      pass
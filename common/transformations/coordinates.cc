@@ -14,12 +14,6 @@ double esq = 6.69437999014 * 0.001; // lgtm [cpp/short-global-name]
 double e1sq = 6.73949674228 * 0.001;
 
 
-static Geodetic to_degrees(Geodetic geodetic){
-  geodetic.lat = RAD2DEG(geodetic.lat);
-  geodetic.lon = RAD2DEG(geodetic.lon);
-  return geodetic;
-}
-
 static Geodetic to_radians(Geodetic geodetic){
   geodetic.lat = DEG2RAD(geodetic.lat);
   geodetic.lon = DEG2RAD(geodetic.lon);
@@ -27,22 +21,19 @@ static Geodetic to_radians(Geodetic geodetic){
 }
 
 
-ECEF geodetic2ecef(Geodetic g){
-  g = to_radians(g);
-  double xi = sqrt(1.0 - esq * pow(sin(g.lat), 2));
-  double x = (a / xi + g.alt) * cos(g.lat) * cos(g.lon);
-  double y = (a / xi + g.alt) * cos(g.lat) * sin(g.lon);
-  double z = (a / xi * (1.0 - esq) + g.alt) * sin(g.lat);
-  return {x, y, z};
+// the single point and batch conversions share these, so they give the same results
+static inline void geodetic2ecef_point(double lat, double lon, double alt, double &x, double &y, double &z){
+  lat = DEG2RAD(lat);
+  lon = DEG2RAD(lon);
+  double xi = sqrt(1.0 - esq * pow(sin(lat), 2));
+  x = (a / xi + alt) * cos(lat) * cos(lon);
+  y = (a / xi + alt) * cos(lat) * sin(lon);
+  z = (a / xi * (1.0 - esq) + alt) * sin(lat);
 }
 
-Geodetic ecef2geodetic(ECEF e){
+static inline void ecef2geodetic_point(double x, double y, double z, double &lat, double &lon, double &alt){
   // Convert from ECEF to geodetic using Ferrari's methods
   // https://en.wikipedia.org/wiki/Geographic_coordinate_conversion#Ferrari.27s_solution
-  double x = e.x;
-  double y = e.y;
-  double z = e.z;
-
   double r = sqrt(x * x + y * y);
   double Esq = a * a - b * b;
   double F = 54 * b * b * z * z;
@@ -57,10 +48,33 @@ Geodetic ecef2geodetic(ECEF e){
   double Z_0 = b * b * z / (a * V);
   double h = U * (1 - b * b / (a * V));
 
-  double lat = atan((z + e1sq * Z_0) / r);
-  double lon = atan2(y, x);
+  lat = RAD2DEG(atan((z + e1sq * Z_0) / r));
+  lon = RAD2DEG(atan2(y, x));
+  alt = h;
+}
+
+ECEF geodetic2ecef(Geodetic g){
+  ECEF e;
+  geodetic2ecef_point(g.lat, g.lon, g.alt, e.x, e.y, e.z);
+  return e;
+}
+
+Geodetic ecef2geodetic(ECEF e){
+  Geodetic g;
+  ecef2geodetic_point(e.x, e.y, e.z, g.lat, g.lon, g.alt);
+  return g;
+}
+
+void geodetic2ecef(const double *geodetic, double *ecef, size_t n){
+  for (size_t i = 0; i < n; i++){
+    geodetic2ecef_point(geodetic[i], geodetic[n + i], geodetic[2 * n + i], ecef[i], ecef[n + i], ecef[2 * n + i]);
+  }
+}
 
-  return to_degrees({lat, lon, h});
+void ecef2geodetic(const double *ecef, double *geodetic, size_t n){
+  for (size_t i = 0; i < n; i++){
+    ecef2geodetic_point(ecef[i], ecef[n + i], ecef[2 * n + i], geodetic[i], geodetic[n + i], geodetic[2 * n + i]);
+  }
 }
 
 LocalCoord::LocalCoord(Geodetic g, ECEF e){
@@ -100,3 +114,24 @@ Geodetic LocalCoord::ned2geodetic(NED n){
   ECEF e = ned2ecef(n);
   return ::ecef2geodetic(e);
 }
+
+// n x 3 column major is the structure of arrays layout, one row per point
+void LocalCoord::ecef2ned(const double *ecef, double *ned, size_t n){
+  Eigen::Map<const Eigen::MatrixX3d> e(ecef, n, 3);
+  Eigen::Map<Eigen::MatrixX3d>(ned, n, 3) = (e.rowwise() - init_ecef.transpose()) * ecef2ned_matrix.transpose();
+}
+
+void LocalCoord::ned2ecef(const double *ned, double *ecef, size_t n){
+  Eigen::Map<const Eigen::MatrixX3d> nd(ned, n, 3);
+  Eigen::Map<Eigen::MatrixX3d>(ecef, n, 3) = (nd * ned2ecef_matrix.transpose()).rowwise() + init_ecef.transpose();
+}
+
+void LocalCoord::geodetic2ned(const double *geodetic, double *ned, size_t n){
+  ::geodetic2ecef(geodetic, ned, n);
+  ecef2ned(ned, ned, n);
+}
+
+void LocalCoord::ned2geodetic(const double *ned, double *geodetic, size_t n){
+  ned2ecef(ned, geodetic, n);
+  ::ecef2geodetic(geodetic, geodetic, n);
+}
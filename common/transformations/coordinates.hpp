@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 #define DEG2RAD(x) ((x) * M_PI / 180.0)
 #define RAD2DEG(x) ((x) * 180.0 / M_PI)
 
@@ -25,6 +27,12 @@ struct Geodetic {
 ECEF geodetic2ecef(Geodetic g);
 Geodetic ecef2geodetic(ECEF e);
 
+// The batch versions take n points as a structure of arrays, the first n values
+// are the first coordinate of every point, then come the second and the third.
+// The output can be the same buffer as the input.
+void geodetic2ecef(const double *geodetic, double *ecef, size_t n);
+void ecef2geodetic(const double *ecef, double *geodetic, size_t n);
+
 class LocalCoord {
 public:
   Eigen::Matrix3d ned2ecef_matrix;
@@ -38,4 +46,9 @@ public:
   ECEF ned2ecef(NED n);
   NED geodetic2ned(Geodetic g);
   Geodetic ned2geodetic(NED n);
+
+  void ecef2ned(const double *ecef, double *ned, size_t n);
+  void ned2ecef(const double *ned, double *ecef, size_t n);
+  void geodetic2ned(const double *geodetic, double *ned, size_t n);
+  void ned2geodetic(const double *ned, double *geodetic, size_t n);
 };
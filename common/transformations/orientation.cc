@@ -52,6 +52,61 @@ Eigen::Vector3d rot2euler(const Eigen::Matrix3d &rot){
   return quat2euler(rot2quat(rot));
 }
 
+static inline Eigen::Vector3d load_vector(const double *v, size_t n, size_t i){
+  return {v[i], v[n + i], v[2 * n + i]};
+}
+
+static inline void store_vector(const Eigen::Vector3d &vec, double *v, size_t n, size_t i){
+  v[i] = vec(0);
+  v[n + i] = vec(1);
+  v[2 * n + i] = vec(2);
+}
+
+static inline Eigen::Quaterniond load_quat(const double *q, size_t n, size_t i){
+  return Eigen::Quaterniond(q[i], q[n + i], q[2 * n + i], q[3 * n + i]);
+}
+
+static inline void store_quat(const Eigen::Quaterniond &quat, double *q, size_t n, size_t i){
+  q[i] = quat.w();
+  q[n + i] = quat.x();
+  q[2 * n + i] = quat.y();
+  q[3 * n + i] = quat.z();
+}
+
+static inline Eigen::Matrix3d load_rot(const double *r, size_t n, size_t i){
+  Eigen::Matrix3d rot;
+  for (int j = 0; j < 9; j++) rot(j / 3, j % 3) = r[j * n + i];
+  return rot;
+}
+
+static inline void store_rot(const Eigen::Matrix3d &rot, double *r, size_t n, size_t i){
+  for (int j = 0; j < 9; j++) r[j * n + i] = rot(j / 3, j % 3);
+}
+
+void euler2quat(const double *euler, double *quat, size_t n){
+  for (size_t i = 0; i < n; i++) store_quat(euler2quat(load_vector(euler, n, i)), quat, n, i);
+}
+
+void quat2euler(const double *quat, double *euler, size_t n){
+  for (size_t i = 0; i < n; i++) store_vector(quat2euler(load_quat(quat, n, i)), euler, n, i);
+}
+
+void quat2rot(const double *quat, double *rot, size_t n){
+  for (size_t i = 0; i < n; i++) store_rot(quat2rot(load_quat(quat, n, i)), rot, n, i);
+}
+
+void rot2quat(const double *rot, double *quat, size_t n){
+  for (size_t i = 0; i < n; i++) store_quat(rot2quat(load_rot(rot, n, i)), quat, n, i);
+}
+
+void euler2rot(const double *euler, double *rot, size_t n){
+  for (size_t i = 0; i < n; i++) store_rot(euler2rot(load_vector(euler, n, i)), rot, n, i);
+}
+
+void rot2euler(const double *rot, double *euler, size_t n){
+  for (size_t i = 0; i < n; i++) store_vector(rot2euler(load_rot(rot, n, i)), euler, n, i);
+}
+
 Eigen::Matrix3d rot_matrix(double roll, double pitch, double yaw){
   return euler2rot({roll, pitch, yaw});
 }
@@ -15,3 +15,13 @@ Eigen::Matrix3d rot_matrix(double roll, double pitch, double yaw);
 Eigen::Matrix3d rot(Eigen::Vector3d axis, double angle);
 Eigen::Vector3d ecef_euler_from_ned(ECEF ecef_init, Eigen::Vector3d ned_pose);
 Eigen::Vector3d ned_euler_from_ecef(ECEF ecef_init, Eigen::Vector3d ecef_pose);
+
+// Batch versions over n structure of arrays points, see coordinates.hpp. Rotation
+// matrices are 9 arrays, entry (r, c) of every matrix is array 3 * r + c. The
+// output can't overlap the input.
+void euler2quat(const double *euler, double *quat, size_t n);
+void quat2euler(const double *quat, double *euler, size_t n);
+void quat2rot(const double *quat, double *rot, size_t n);
+void rot2quat(const double *rot, double *quat, size_t n);
+void euler2rot(const double *euler, double *rot, size_t n);
+void rot2euler(const double *rot, double *euler, size_t n);
@@ -47,6 +47,12 @@ cdef NED list2ned(ned):
     n.d = ned[2]
     return n
 
+# The *_batch functions convert many points in one call. They take and return
+# (size, n) arrays, each row is one coordinate of all n points, see coordinates.hpp.
+cdef np.ndarray batch_output(np.ndarray[double, ndim=2, mode="c"] inp, int in_size, int out_size):
+    assert inp.shape[0] == in_size
+    return np.empty((out_size, inp.shape[1]))
+
 cdef Geodetic list2geodetic(geodetic):
     cdef Geodetic g
     g.lat = geodetic[0]
@@ -84,6 +90,36 @@ def rot2euler_single(rot):
     cdef Vector3 e = rot2euler_c(r)
     return [e(0), e(1), e(2)]
 
+def euler2quat_batch(np.ndarray[double, ndim=2, mode="c"] euler):
+    cdef np.ndarray[double, ndim=2, mode="c"] quat = batch_output(euler, 3, 4)
+    euler2quat_c(<double*>euler.data, <double*>quat.data, euler.shape[1])
+    return quat
+
+def quat2euler_batch(np.ndarray[double, ndim=2, mode="c"] quat):
+    cdef np.ndarray[double, ndim=2, mode="c"] euler = batch_output(quat, 4, 3)
+    quat2euler_c(<double*>quat.data, <double*>euler.data, quat.shape[1])
+    return euler
+
+def quat2rot_batch(np.ndarray[double, ndim=2, mode="c"] quat):
+    cdef np.ndarray[double, ndim=2, mode="c"] rot = batch_output(quat, 4, 9)
+    quat2rot_c(<double*>quat.data, <double*>rot.data, quat.shape[1])
+    return rot
+
+def rot2quat_batch(np.ndarray[double, ndim=2, mode="c"] rot):
+    cdef np.ndarray[double, ndim=2, mode="c"] quat = batch_output(rot, 9, 4)
+    rot2quat_c(<double*>rot.data, <double*>quat.data, rot.shape[1])
+    return quat
+
+def euler2rot_batch(np.ndarray[double, ndim=2, mode="c"] euler):
+    cdef np.ndarray[double, ndim=2, mode="c"] rot = batch_output(euler, 3, 9)
+    euler2rot_c(<double*>euler.data, <double*>rot.data, euler.shape[1])
+    return rot
+
+def rot2euler_batch(np.ndarray[double, ndim=2, mode="c"] rot):
+    cdef np.ndarray[double, ndim=2, mode="c"] euler = batch_output(rot, 9, 3)
+    rot2euler_c(<double*>rot.data, <double*>euler.data, rot.shape[1])
+    return euler
+
 def rot_matrix(roll, pitch, yaw):
     return matrix2numpy(rot_matrix_c(roll, pitch, yaw))
 
@@ -111,6 +147,16 @@ def ecef2geodetic_single(ecef):
     cdef Geodetic g = ecef2geodetic_c(e)
     return [g.lat, g.lon, g.alt]
 
+def geodetic2ecef_batch(np.ndarray[double, ndim=2, mode="c"] geodetic):
+    cdef np.ndarray[double, ndim=2, mode="c"] ecef = batch_output(geodetic, 3, 3)
+    geodetic2ecef_c(<double*>geodetic.data, <double*>ecef.data, geodetic.shape[1])
+    return ecef
+
+def ecef2geodetic_batch(np.ndarray[double, ndim=2, mode="c"] ecef):
+    cdef np.ndarray[double, ndim=2, mode="c"] geodetic = batch_output(ecef, 3, 3)
+    ecef2geodetic_c(<double*>ecef.data, <double*>geodetic.data, ecef.shape[1])
+    return geodetic
+
 
 cdef class LocalCoord:
     cdef LocalCoord_c * lc
@@ -170,5 +216,29 @@ cdef class LocalCoord:
         cdef Geodetic g = self.lc.ned2geodetic(n)
         return [g.lat, g.lon, g.alt]
 
+    def ecef2ned_batch(self, np.ndarray[double, ndim=2, mode="c"] ecef):
+        assert self.lc
+        cdef np.ndarray[double, ndim=2, mode="c"] ned = batch_output(ecef, 3, 3)
+        self.lc.ecef2ned(<double*>ecef.data, <double*>ned.data, ecef.shape[1])
+        return ned
+
+    def ned2ecef_batch(self, np.ndarray[double, ndim=2, mode="c"] ned):
+        assert self.lc
+        cdef np.ndarray[double, ndim=2, mode="c"] ecef = batch_output(ned, 3, 3)
+        self.lc.ned2ecef(<double*>ned.data, <double*>ecef.data, ned.shape[1])
+        return ecef
+
+    def geodetic2ned_batch(self, np.ndarray[double, ndim=2, mode="c"] geodetic):
+        assert self.lc
+        cdef np.ndarray[double, ndim=2, mode="c"] ned = batch_output(geodetic, 3, 3)
+        self.lc.geodetic2ned(<double*>geodetic.data, <double*>ned.data, geodetic.shape[1])
+        return ned
+
+    def ned2geodetic_batch(self, np.ndarray[double, ndim=2, mode="c"] ned):
+        assert self.lc
+        cdef np.ndarray[double, ndim=2, mode="c"] geodetic = batch_output(ned, 3, 3)
+        self.lc.ned2geodetic(<double*>ned.data, <double*>geodetic.data, ned.shape[1])
+        return geodetic
+
     def __dealloc__(self):
         del self.lc
@@ -134,6 +134,7 @@ sudo apt-get install -y --no-install-recommends \
     libgles2-mesa-dev \
     libglfw3-dev \
     libglib2.0-0 \
+    liblz4-dev \
     liblzma-dev \
     libomp-dev \
     libopencv-dev \
@@ -144,6 +145,7 @@ sudo apt-get install -y --no-install-recommends \
     libtool \
     libusb-1.0-0-dev \
     libzmq3-dev \
+    libzstd-dev \
     libsdl-image1.2-dev libsdl-mixer1.2-dev libsdl-ttf2.0-dev libsmpeg-dev \
     libsdl1.2-dev  libportmidi-dev libswscale-dev libavformat-dev libavcodec-dev libfreetype6-dev \
     libsystemd-dev \
@@ -1,14 +1,23 @@
 #include "common.h"
 
+// the sums of the nibbles and of the bytes of a u64, each lane added in one
+// go instead of a loop
+static inline unsigned int sum_nibbles(uint64_t d) {
+  d = (d & 0x0F0F0F0F0F0F0F0FULL) + ((d >> 4) & 0x0F0F0F0F0F0F0F0FULL);  // bytes <= 30
+  return (d * 0x0101010101010101ULL) >> 56;  // <= 240
+}
+
+static inline unsigned int sum_bytes(uint64_t d) {
+  d = (d & 0x00FF00FF00FF00FFULL) + ((d >> 8) & 0x00FF00FF00FF00FFULL);  // u16s <= 510
+  return (d * 0x0001000100010001ULL) >> 48;  // <= 2040
+}
+
 unsigned int honda_checksum(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
   d >>= 4; // remove checksum
 
-  int s = 0;
   bool extended = address > 0x7FF; // extended can
-  while (address) { s += (address & 0xF); address >>= 4; }
-  while (d) { s += (d & 0xF); d >>= 4; }
-  s = 8-s;
+  int s = 8 - (int)sum_nibbles(address) - (int)sum_nibbles(d);
   if (extended) s += 3;
   s &= 0xF;
 
@@ -19,9 +28,7 @@ unsigned int toyota_checksum(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
   d >>= 8; // remove checksum
 
-  unsigned int s = l;
-  while (address) { s += address & 0xFF; address >>= 8; }
-  while (d) { s += d & 0xFF; d >>= 8; }
+  unsigned int s = l + sum_bytes(address) + sum_bytes(d);
 
   return s & 0xFF;
 }
@@ -29,49 +36,33 @@ unsigned int toyota_checksum(unsigned int address, uint64_t d, int l) {
 unsigned int subaru_checksum(unsigned int address, uint64_t d, int l) {
   d >>= ((8-l)*8); // remove padding
 
-  unsigned int s = 0;
-  while (address) { s += address & 0xFF; address >>= 8; }
-  l -= 1; // checksum is first byte
-  while (l) { s += d & 0xFF; d >>= 8; l -= 1; }
+  // checksum is first byte
+  const uint64_t mask = (l > 1) ? (~0ULL >> ((9 - l) * 8)) : 0;
+  unsigned int s = sum_bytes(address) + sum_bytes(d & mask);
 
   return s & 0xFF;
 }
 
+// Static lookup tables for CRC8 poly 0x2F, aka 8H2F/AUTOSAR, shifted through
+// n zero bytes in crc8_lut_8h2f[n]: the CRC of n + 1 bytes is the xor of a
+// lookup per byte, with no lookup waiting on the one before
+uint8_t crc8_lut_8h2f[8][256];
+// CRC8 poly 0x1D, aka SAE J1850, for Chrysler
+uint8_t crc8_lut_j1850[256];
+// CRC8 poly 0xD5 for the comma pedal
+uint8_t crc8_lut_d5[256];
+
 unsigned int chrysler_checksum(unsigned int address, uint64_t d, int l) {
   /* This function does not want the checksum byte in the input data.
-  jeep chrysler canbus checksum from http://illmatics.com/Remote%20Car%20Hacking.pdf */
+  jeep chrysler canbus checksum from http://illmatics.com/Remote%20Car%20Hacking.pdf
+  It's CRC8 SAE J1850: poly 0x1D, init and final xor 0xFF */
   uint8_t checksum = 0xFF;
   for (int j = 0; j < (l - 1); j++) {
-    uint8_t shift = 0x80;
-    uint8_t curr = (d >> 8*j) & 0xFF;
-    for (int i=0; i<8; i++) {
-      uint8_t bit_sum = curr & shift;
-      uint8_t temp_chk = checksum & 0x80U;
-      if (bit_sum != 0U) {
-        bit_sum = 0x1C;
-        if (temp_chk != 0U) {
-          bit_sum = 1;
-        }
-        checksum = checksum << 1;
-        temp_chk = checksum | 1U;
-        bit_sum ^= temp_chk;
-      } else {
-        if (temp_chk != 0U) {
-          bit_sum = 0x1D;
-        }
-        checksum = checksum << 1;
-        bit_sum ^= checksum;
-      }
-      checksum = bit_sum;
-      shift = shift >> 1;
-    }
+    checksum = crc8_lut_j1850[checksum ^ ((d >> 8*j) & 0xFF)];
   }
   return ~checksum & 0xFF;
 }
 
-// Static lookup table for fast computation of CRC8 poly 0x2F, aka 8H2F/AUTOSAR
-uint8_t crc8_lut_8h2f[256];
-
 void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
   uint8_t crc;
   int i, j;
@@ -91,7 +82,14 @@ void gen_crc_lookup_table(uint8_t poly, uint8_t crc_lut[]) {
 void init_crc_lookup_tables() {
   // At init time, set up static lookup tables for fast CRC computation.
 
-  gen_crc_lookup_table(0x2F, crc8_lut_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
+  gen_crc_lookup_table(0x2F, crc8_lut_8h2f[0]);    // CRC-8 8H2F/AUTOSAR for Volkswagen
+  for (int n = 1; n < 8; n++) {
+    for (int i = 0; i < 256; i++) {
+      crc8_lut_8h2f[n][i] = crc8_lut_8h2f[0][crc8_lut_8h2f[n - 1][i]];
+    }
+  }
+  gen_crc_lookup_table(0x1D, crc8_lut_j1850);   // CRC-8 SAE J1850 for Chrysler
+  gen_crc_lookup_table(0xD5, crc8_lut_d5);      // CRC-8 for the pedal
 }
 
 unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l) {
@@ -102,9 +100,13 @@ unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l) {
   uint8_t crc = 0xFF; // Standard init value for CRC8 8H2F/AUTOSAR
 
   // CRC the payload first, skipping over the first byte where the CRC lives.
-  for (int i = 1; i < l; i++) {
-    crc ^= (d >> (i*8)) & 0xFF;
-    crc = crc8_lut_8h2f[crc];
+  // The table is linear, so each byte's lookup is independent of the others:
+  // the byte i bytes before the end goes through crc8_lut_8h2f[i]
+  if (l > 1) {
+    crc = crc8_lut_8h2f[l - 2][crc ^ ((d >> 8) & 0xFF)];
+    for (int i = 2; i < l; i++) {
+      crc ^= crc8_lut_8h2f[l - 1 - i][(d >> (i*8)) & 0xFF];
+    }
   }
 
   // Look up and apply the magic final CRC padding byte, which permutes by CAN
@@ -167,30 +169,20 @@ unsigned int volkswagen_crc(unsigned int address, uint64_t d, int l) {
       crc ^= (uint8_t[]){0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}[counter];
       break;
   }
-  crc = crc8_lut_8h2f[crc];
+  crc = crc8_lut_8h2f[0][crc];
 
   return crc ^ 0xFF; // Return after standard final XOR for CRC8 8H2F/AUTOSAR
 }
 
 
 unsigned int pedal_checksum(uint64_t d, int l) {
-  uint8_t crc = 0xFF;
-  uint8_t poly = 0xD5; // standard crc8
+  uint8_t crc = 0xFF; // standard crc8, poly 0xD5
 
   d >>= ((8-l)*8); // remove padding
   d >>= 8; // remove checksum
 
-  int i, j;
-  for (i = 0; i < l - 1; i++) {
-    crc ^= (d >> (i*8)) & 0xFF;
-    for (j = 0; j < 8; j++) {
-      if ((crc & 0x80) != 0) {
-        crc = (uint8_t)((crc << 1) ^ poly);
-      }
-      else {
-        crc <<= 1;
-      }
-    }
+  for (int i = 0; i < l - 1; i++) {
+    crc = crc8_lut_d5[crc ^ ((d >> (i*8)) & 0xFF)];
   }
   return crc;
 }
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <sys/types.h>
 
 #include "common_dbc.h"
 #include <capnp/dynamic.h>
@@ -27,33 +31,129 @@ uint64_t read_u64_le(const uint8_t* v);
 
 class MessageState {
 public:
+  // what every frame of it touches first, together
   uint32_t address;
   unsigned int size;
-
-  std::vector<Signal> parse_sigs;
-  std::vector<double> vals;
-
-  uint16_t ts;
   uint64_t seen;
-  uint64_t check_threshold;
-
+  uint16_t ts;
   uint8_t counter;
   uint8_t counter_fail;
-
   bool ignore_checksum = false;
   bool ignore_counter = false;
+  uint64_t check_threshold;
+
+  // with the message's generated decoder: the index in the message of each of
+  // parse_sigs, their bits for it, and where it leaves all of them
+  MsgDecode decode = nullptr;
+  uint64_t wanted = 0;
+  std::vector<double> vals;
+  std::vector<double> decoded;
+  std::vector<uint8_t> sig_index;
+
+  std::vector<Signal> parse_sigs;
+
+  // with change tracking: how far each of parse_sigs moves before it's
+  // reported, negative for the untracked ones, and where it was last reported
+  std::vector<double> deadbands;
+  std::vector<double> reported;
 
+  // msg's signal sig_idx goes in parse_sigs
+  void add_sig(const Msg *msg, int sig_idx, double default_value);
   bool parse(uint64_t sec, uint16_t ts_, uint8_t * dat);
+  bool parse_generic(uint8_t * dat);
   bool update_counter_generic(int64_t v, int cnt_size);
 };
 
+// The latest values of CANParsers in shared memory, one table per DBC and
+// bus, written by one process (selfdrive/canshared.py) and read by the
+// CANParsers of the others in place of parsing the same frames again. Each
+// message is written under a seqlock: its seq is odd while it changes.
+// Only with CANSHARE set in the environment, for canshared and the readers
+#define CAN_SHARE_MAGIC "CANSHR2"
+#define CAN_SHARE_NAME_LEN 64
+
+struct CANShareHeader {
+  char magic[8];
+  uint32_t num_msgs;
+  uint32_t num_sigs;
+  int32_t pid;  // of the writer, the table is stale once it's gone
+  std::atomic<uint64_t> sec;  // logMonoTime of the last can written
+};
+
+struct CANShareMsg {
+  uint32_t address;
+  uint32_t first_sig;  // into the names and values
+  uint32_t num_sigs;
+  std::atomic<uint32_t> seq;
+  uint64_t seen;
+  uint16_t ts;
+};
+
+// A table mapped in: the header, num_msgs CANShareMsg, num_sigs names and num_sigs values
+class CANShare {
+public:
+  static bool enabled();
+  static std::string path(const std::string &dbc_name, int bus);
+  static size_t table_size(uint32_t num_msgs, uint32_t num_sigs);
+  CANShare(void *mem, size_t size);
+  ~CANShare();
+  // its writer still runs
+  bool writer_alive() const;
+
+  CANShareHeader *header;
+  CANShareMsg *msgs;
+  char (*names)[CAN_SHARE_NAME_LEN];
+  double *values;
+
+private:
+  void *mem;
+  size_t size;
+};
+
 class CANParser {
 private:
   const int bus;
   kj::Array<capnp::word> aligned_buf;
 
   const DBC *dbc = NULL;
-  std::unordered_map<uint32_t, MessageState> message_states;
+  std::vector<MessageState> message_states;
+  // index + 1 into message_states of the 11 bit addresses, 0 for the ones not
+  // parsed, and the extended ones sorted
+  std::vector<uint16_t> std_index;
+  std::vector<std::pair<uint32_t, uint16_t>> ext_index;
+  std::vector<uint64_t> updated;
+  // The checked messages: a min-heap of when each is due by the last time
+  // UpdateValid looked, refreshed from seen only once that passes, and the
+  // ones that are overdue
+  std::vector<std::pair<uint64_t, uint16_t>> deadlines;
+  std::vector<uint16_t> expired;
+  // the messages with a tracked signal
+  std::vector<uint16_t> tracked;
+
+  // with a shared table: per message its index there, where its values are
+  // and the seq last copied
+  struct SharedMsg {
+    uint32_t msg;
+    std::vector<uint32_t> values;
+    uint32_t seq;
+  };
+  std::string shared_path;
+  uint64_t next_attach = 0;
+  uint64_t next_alive_check = 0;
+  std::unique_ptr<CANShare> shared;
+  std::vector<SharedMsg> shared_msgs;
+  std::vector<double> shared_scratch;
+  bool attach_shared();
+
+  void build_index(std::map<uint32_t, MessageState> &states);
+  MessageState *lookup(uint32_t address) {
+    if (address < std_index.size()) {
+      const uint16_t i = std_index[address];
+      return i ? &message_states[i - 1] : nullptr;
+    }
+    auto it = std::lower_bound(ext_index.begin(), ext_index.end(), std::make_pair(address, (uint16_t)0));
+    return (it != ext_index.end() && it->first == address) ? &message_states[it->second] : nullptr;
+  }
 
 public:
   bool can_valid = false;
@@ -68,18 +168,101 @@ public:
   void UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans);
   #endif
   void UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cans);
+  // a frame on this parser's bus
+  void UpdateFrame(uint64_t sec, uint32_t address, uint16_t bus_time, const capnp::Data::Reader &dat);
   void UpdateValid(uint64_t sec);
+  // Copies the messages updated in the shared table once its writer has
+  // written the can of sec, true then. The frames are parsed when it has no
+  // live writer or doesn't get there in time
+  bool UpdateShared(uint64_t sec);
+  // the table at path, once it's there and when it has all of this parser's
+  // signals. Nothing without CANShare::enabled()
+  void share_from(const std::string &path) { if (CANShare::enabled()) shared_path = path; }
+  // the checked messages that made can_valid false: never seen, or not within their threshold
+  void invalid_messages(std::vector<uint32_t> &missing, std::vector<uint32_t> &timed_out) const;
   std::vector<SignalValue> query_latest();
+  // Change tracking: a signal is reported by query_changes when it's first seen
+  // and then when it moved more than deadband from the value last reported.
+  // All of the message's signals with an empty name, a negative deadband stops
+  // tracking. False when it isn't parsed
+  bool set_deadband(uint32_t address, const std::string &name, double deadband);
+  void query_changes(std::vector<SignalChange> &changes);
+  int get_bus() const { return bus; }
+
+  // The messages by index, their vals stay where they are for the parser's
+  // lifetime. Bit i of the bitmap is set when message i was parsed since the
+  // last clear_updated()
+  size_t message_count() const { return message_states.size(); }
+  const MessageState *message(size_t i) const { return &message_states[i]; }
+  const MessageState *find_message(uint32_t address) { return lookup(address); }
+  const uint64_t *updated_bits() const { return updated.data(); }
+  size_t updated_words() const { return updated.size(); }
+  void clear_updated() { std::fill(updated.begin(), updated.end(), 0); }
+};
+
+// Writes a CANParser's messages to a new shared table at path
+class CANShareWriter {
+public:
+  CANShareWriter(const CANParser &parser, const std::string &path);
+  // unlinks the table, unless another writer replaced it
+  ~CANShareWriter();
+  // the messages parser parsed since its last clear_updated(), which it clears
+  void publish(CANParser &parser);
+
+private:
+  std::string table_path;
+  ino_t ino;
+  std::unique_ptr<CANShare> table;
+};
+
+#ifndef DYNAMIC_CAPNP
+// Parsers of the buses of one car fed from the same events: each event is read
+// once and its frames go to the parsers of their bus
+class MultiBusCANParser {
+private:
+  kj::Array<capnp::word> aligned_buf;
+  std::vector<CANParser *> parsers;
+  // with their index in parsers
+  std::vector<std::vector<std::pair<size_t, CANParser *>>> by_bus;
+  std::vector<bool> from_shared;
+
+public:
+  // the parsers stay the caller's
+  MultiBusCANParser(const std::vector<CANParser *> &parsers);
+  void update_string(const std::string &data, bool sendcan);
+};
+#endif
+
+// the signals of a message looked up once, to pack it from values in their order
+struct PackPlan {
+  uint32_t address;
+  unsigned int size;
+  std::vector<const Signal *> sigs;  // nullptr for the names the message doesn't have
+  const Signal *counter = nullptr;
+  const Signal *checksum = nullptr;
 };
 
 class CANPacker {
 private:
   const DBC *dbc = NULL;
-  std::map<std::pair<uint32_t, std::string>, Signal> signal_lookup;
+  std::map<std::pair<uint32_t, std::string>, const Signal *> signal_lookup;
   std::map<uint32_t, Msg> message_lookup;
+  std::vector<PackPlan> plans;
+
+  PackPlan make_plan(uint32_t address, const std::vector<SignalPackValue> &values);
+  uint64_t pack(const PackPlan &plan, const double *values, int counter);
+  std::vector<uint8_t> pack_vector(const PackPlan &plan, const double *values, int counter);
 
 public:
   CANPacker(const std::string& dbc_name);
   uint64_t pack(uint32_t address, const std::vector<SignalPackValue> &values, int counter);
+  // the bytes of the message, for CAN-FD messages longer than 8 bytes too
+  std::vector<uint8_t> pack_vector(uint32_t address, const std::vector<SignalPackValue> &values, int counter);
   Msg* lookup_message(uint32_t address);
+
+  // Messages packed every frame: plan() looks the signals up once and returns
+  // an id, pack_plan() packs from a value per name, in the order given
+  int plan(uint32_t address, const std::vector<std::string> &signal_names);
+  uint64_t pack_plan(int plan, const double *values, int counter);
+  std::vector<uint8_t> pack_plan_vector(int plan, const double *values, int counter);
 };
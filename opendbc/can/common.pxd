@@ -1,7 +1,7 @@
 # distutils: language = c++
 #cython: language_level=3
 
-from libc.stdint cimport uint32_t, uint64_t, uint16_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t, uint16_t
 from libcpp.vector cimport vector
 from libcpp.map cimport map
 from libcpp.string cimport string
@@ -65,6 +65,12 @@ cdef extern from "common_dbc.h":
     const char* name
     double value
 
+  cdef struct SignalChange:
+    uint32_t address
+    const char* name
+    double value
+    uint64_t mono_time
+
   cdef struct SignalPackValue:
     string name
     double value
@@ -73,12 +79,44 @@ cdef extern from "common_dbc.h":
 cdef extern from "common.h":
   cdef const DBC* dbc_lookup(const string);
 
+  cdef cppclass MessageState:
+    uint32_t address
+    uint16_t ts
+    vector[Signal] parse_sigs
+    vector[double] vals
+
   cdef cppclass CANParser:
     bool can_valid
     CANParser(int, string, vector[MessageParseOptions], vector[SignalParseOptions])
+    CANParser(int, string, bool, bool)
+    void share_from(string)
     void update_string(string, bool)
     vector[SignalValue] query_latest()
+    size_t message_count()
+    const MessageState *message(size_t)
+    const uint64_t *updated_bits()
+    size_t updated_words()
+    void clear_updated()
+    void invalid_messages(vector[uint32_t] &, vector[uint32_t] &)
+    bool set_deadband(uint32_t, string, double)
+    void query_changes(vector[SignalChange] &)
+
+  cdef cppclass CANShare:
+    @staticmethod
+    string path(string, int)
+
+  cdef cppclass CANShareWriter:
+    CANShareWriter(const CANParser &, string)
+    void publish(CANParser &)
+
+  cdef cppclass MultiBusCANParser:
+    MultiBusCANParser(vector[CANParser *])
+    void update_string(string, bool)
 
   cdef cppclass CANPacker:
    CANPacker(string)
    uint64_t pack(uint32_t, vector[SignalPackValue], int counter)
+   vector[uint8_t] pack_vector(uint32_t, vector[SignalPackValue], int counter)
+   int plan(uint32_t, vector[string])
+   uint64_t pack_plan(int, const double *, int counter)
+   vector[uint8_t] pack_plan_vector(int, const double *, int counter)
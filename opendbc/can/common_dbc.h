@@ -30,6 +30,13 @@ struct SignalValue {
   double value;
 };
 
+struct SignalChange {
+  uint32_t address;
+  const char* name;
+  double value;
+  uint64_t mono_time;  // of the event the frame with it came in
+};
+
 enum SignalType {
   DEFAULT,
   HONDA_CHECKSUM,
@@ -52,12 +59,19 @@ struct Signal {
   SignalType type;
 };
 
+class MessageState;
+// Generated for the messages of up to 8 bytes: checks a frame of the message and
+// decodes the signals with their bit set in wanted, into vals by their index in
+// sigs. false when a check failed
+typedef bool (*MsgDecode)(MessageState &state, const uint8_t *dat, uint64_t wanted, double *vals);
+
 struct Msg {
   const char* name;
   uint32_t address;
   unsigned int size;
   size_t num_sigs;
   const Signal *sigs;
+  MsgDecode decode;  // nullptr for the generic parse
 };
 
 struct Val {
@@ -1,3 +1,12 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
 #include <vector>
 
 #include "common_dbc.h"
@@ -7,10 +16,148 @@ std::vector<const DBC*>& get_dbcs() {
   return vec;
 }
 
+static std::mutex dbcs_lock;
+
+// by name, built on the first lookup
+static std::unordered_map<std::string, const DBC*>& dbc_index() {
+  static std::unordered_map<std::string, const DBC*> index;
+  return index;
+}
+
+// A DBC written by process_dbc.py --binary, see process_binary there for the
+// format. It stays loaded for good, like the ones linked in
+struct LoadedDBC {
+  DBC dbc;
+  std::deque<std::string> strings;
+  std::vector<std::vector<Signal>> sigs;
+  std::vector<Msg> msgs;
+  std::vector<Val> vals;
+};
+
+class BinaryReader {
+public:
+  BinaryReader(const std::string &data) : data(data) {}
+  template <typename T>
+  T read() {
+    T v = {};
+    if (pos + sizeof(T) > data.size()) {
+      ok = false;
+      return v;
+    }
+    memcpy(&v, data.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return v;
+  }
+  const char *read_string(std::deque<std::string> &strings) {
+    const uint16_t len = read<uint16_t>();
+    if (!ok || pos + len > data.size()) {
+      ok = false;
+      strings.emplace_back();
+    } else {
+      strings.emplace_back(data, pos, len);
+      pos += len;
+    }
+    return strings.back().c_str();
+  }
+  bool ok = true;
+
+private:
+  const std::string &data;
+  size_t pos = 0;
+};
+
+static const DBC* dbc_load(const std::string& path) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return NULL;
+  const std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  if (data.compare(0, 4, "DBC1") != 0) {
+    fprintf(stderr, "%s: not a binary DBC\n", path.c_str());
+    return NULL;
+  }
+
+  LoadedDBC *l = new LoadedDBC();
+  BinaryReader r(data);
+  r.read<uint32_t>();  // magic
+  l->dbc.name = r.read_string(l->strings);
+
+  const uint32_t num_msgs = r.read<uint32_t>();
+  for (uint32_t i = 0; i < num_msgs && r.ok; i++) {
+    Msg msg = {};
+    msg.address = r.read<uint32_t>();
+    msg.size = r.read<uint32_t>();
+    msg.name = r.read_string(l->strings);
+    msg.num_sigs = r.read<uint32_t>();
+    std::vector<Signal> sigs;
+    for (size_t j = 0; j < msg.num_sigs && r.ok; j++) {
+      Signal sig = {};
+      sig.name = r.read_string(l->strings);
+      sig.b1 = r.read<int32_t>();
+      sig.b2 = r.read<int32_t>();
+      sig.bo = r.read<int32_t>();
+      sig.is_signed = r.read<uint8_t>();
+      sig.is_little_endian = r.read<uint8_t>();
+      sig.type = (SignalType)r.read<uint8_t>();
+      sig.factor = r.read<double>();
+      sig.offset = r.read<double>();
+      sigs.push_back(sig);
+    }
+    l->sigs.push_back(std::move(sigs));
+    l->msgs.push_back(msg);
+  }
+
+  const uint32_t num_vals = r.ok ? r.read<uint32_t>() : 0;
+  for (uint32_t i = 0; i < num_vals && r.ok; i++) {
+    Val val = {};
+    val.address = r.read<uint32_t>();
+    val.name = r.read_string(l->strings);
+    val.def_val = r.read_string(l->strings);
+    l->vals.push_back(val);
+  }
+
+  if (!r.ok) {
+    fprintf(stderr, "%s: binary DBC cut off\n", path.c_str());
+    delete l;
+    return NULL;
+  }
+
+  // the storage doesn't move anymore
+  for (size_t i = 0; i < l->msgs.size(); i++) {
+    l->msgs[i].sigs = l->sigs[i].data();
+    for (Val &val : l->vals) {
+      if (val.address == l->msgs[i].address) val.sigs = l->msgs[i].sigs;
+    }
+  }
+  l->dbc.num_msgs = l->msgs.size();
+  l->dbc.msgs = l->msgs.data();
+  l->dbc.num_vals = l->vals.size();
+  l->dbc.vals = l->vals.data();
+  return &l->dbc;
+}
+
 const DBC* dbc_lookup(const std::string& dbc_name) {
-  for (const auto& dbci : get_dbcs()) {
-    if (dbc_name == dbci->name) {
-      return dbci;
+  std::lock_guard<std::mutex> lk(dbcs_lock);
+  auto &index = dbc_index();
+  if (index.size() != get_dbcs().size()) {
+    for (const auto& dbci : get_dbcs()) {
+      index.emplace(dbci->name, dbci);
+    }
+  }
+  auto it = index.find(dbc_name);
+  if (it != index.end()) {
+    return it->second;
+  }
+
+  // the ones that aren't linked in, from the directories in $DBC_PATH
+  const char *dbc_path = getenv("DBC_PATH");
+  std::stringstream dirs(dbc_path ? dbc_path : "");
+  std::string dir;
+  while (std::getline(dirs, dir, ':')) {
+    if (dir.empty()) continue;
+    const DBC *dbc = dbc_load(dir + "/" + dbc_name + ".dbcbin");
+    if (dbc && dbc_name == dbc->name) {
+      get_dbcs().push_back(dbc);
+      index.emplace(dbc->name, dbc);
+      return dbc;
     }
   }
   return NULL;
@@ -1,6 +1,5 @@
 import re
 import os
-import struct
 import sys
 import numbers
 from collections import namedtuple, defaultdict
@@ -142,6 +141,8 @@ class dbc():
 
     msg_def = self.msgs[msg_id]
     size = msg_def[0][1]
+    # CAN-FD messages can be up to 64 bytes
+    nbytes = max(size, 8)
 
     result = 0
     for s in msg_def[1]:
@@ -158,19 +159,19 @@ class dbc():
           shift = s.start_bit
         else:
           b1 = (s.start_bit // 8) * 8 + (-s.start_bit - 1) % 8
-          shift = 64 - (b1 + s.size)
+          shift = nbytes * 8 - (b1 + s.size)
 
         mask = ((1 << s.size) - 1) << shift
         dat = (ival & ((1 << s.size) - 1)) << shift
 
         if s.is_little_endian:
-          mask = self.reverse_bytes(mask)
-          dat = self.reverse_bytes(dat)
+          mask = int.from_bytes(mask.to_bytes(nbytes, 'big'), 'little')
+          dat = int.from_bytes(dat.to_bytes(nbytes, 'big'), 'little')
 
         result &= ~mask
         result |= dat
 
-    result = struct.pack('>Q', result)
+    result = result.to_bytes(nbytes, 'big')
     return result[:size]
 
   def decode(self, x, arr=None, debug=False):
@@ -207,7 +208,8 @@ class dbc():
     if debug:
       print(name)
 
-    st = x[2].ljust(8, b'\x00')
+    nbytes = max(msg[0][1], len(x[2]), 8)
+    st = x[2].ljust(nbytes, b'\x00')
     le, be = None, None
 
     for s in msg[1]:
@@ -223,15 +225,15 @@ class dbc():
 
       if little_endian:
         if le is None:
-          le = struct.unpack("<Q", st)[0]
+          le = int.from_bytes(st, 'little')
         tmp = le
         shift_amount = start_bit
       else:
         if be is None:
-          be = struct.unpack(">Q", st)[0]
+          be = int.from_bytes(st, 'big')
         tmp = be
         b1 = (start_bit // 8) * 8 + (-start_bit - 1) % 8
-        shift_amount = 64 - (b1 + signal_size)
+        shift_amount = nbytes * 8 - (b1 + signal_size)
 
       if shift_amount < 0:
         continue
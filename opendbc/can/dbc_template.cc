@@ -1,4 +1,4 @@
-#include "common_dbc.h"
+#include "common.h"
 
 namespace {
 
@@ -6,11 +6,7 @@ namespace {
 const Signal sigs_{{address}}[] = {
   {% for sig in sigs %}
     {
-      {% if sig.is_little_endian %}
-        {% set b1 = sig.start_bit %}
-      {% else %}
-        {% set b1 = (sig.start_bit//8)*8  + (-sig.start_bit-1) % 8 %}
-      {% endif %}
+      {% set b1 = sig_b1(sig) %}
       .name = "{{sig.name}}",
       .b1 = {{b1}},
       .b2 = {{sig.size}},
@@ -19,32 +15,63 @@ const Signal sigs_{{address}}[] = {
       .factor = {{sig.factor}},
       .offset = {{sig.offset}},
       .is_little_endian = {{"true" if sig.is_little_endian else "false"}},
-      {% if checksum_type == "honda" and sig.name == "CHECKSUM" %}
-      .type = SignalType::HONDA_CHECKSUM,
-      {% elif checksum_type == "honda" and sig.name == "COUNTER" %}
-      .type = SignalType::HONDA_COUNTER,
-      {% elif checksum_type == "toyota" and sig.name == "CHECKSUM" %}
-      .type = SignalType::TOYOTA_CHECKSUM,
-      {% elif checksum_type == "volkswagen" and sig.name == "CHECKSUM" %}
-      .type = SignalType::VOLKSWAGEN_CHECKSUM,
-      {% elif checksum_type == "volkswagen" and sig.name == "COUNTER" %}
-      .type = SignalType::VOLKSWAGEN_COUNTER,
-      {% elif checksum_type == "subaru" and sig.name == "CHECKSUM" %}
-      .type = SignalType::SUBARU_CHECKSUM,
-      {% elif checksum_type == "chrysler" and sig.name == "CHECKSUM" %}
-      .type = SignalType::CHRYSLER_CHECKSUM,
-      {% elif address in [512, 513] and sig.name == "CHECKSUM_PEDAL" %}
-      .type = SignalType::PEDAL_CHECKSUM,
-      {% elif address in [512, 513] and sig.name == "COUNTER_PEDAL" %}
-      .type = SignalType::PEDAL_COUNTER,
-      {% else %}
-      .type = SignalType::DEFAULT,
-      {% endif %}
+      .type = SignalType::{{sig_type(address, sig)}},
     },
   {% endfor %}
 };
 {% endfor %}
 
+// The parser's decoding and checks with the layout of each message of up to 8
+// bytes built in. Checksums and counters are checked first, like sigs has them
+{% for address, msg_name, msg_size, sigs in msgs if msg_size <= 8 and sigs|length <= 64 %}
+bool decode_{{address}}(MessageState &s, const uint8_t *dat, uint64_t wanted, double *vals) {
+  [[maybe_unused]] const uint64_t le = read_u64_le(dat);
+  [[maybe_unused]] const uint64_t be = read_u64_be(dat);
+  int64_t v;
+  {% for sig in sigs %}
+  {% set type = sig_type(address, sig) %}
+  {% set b1 = sig_b1(sig) %}
+  // {{sig.name}}
+  {% if type == "DEFAULT" %}
+  if (wanted & (1ULL << {{loop.index0}})) {
+  {% else %}
+  {
+  {% endif %}
+    {% if sig.is_little_endian %}
+    v = (le >> {{b1}}) & {{"0x%XULL" % ((1 << sig.size) - 1)}};
+    {% else %}
+    v = (be >> {{64 - (b1 + sig.size)}}) & {{"0x%XULL" % ((1 << sig.size) - 1)}};
+    {% endif %}
+    {% if sig.is_signed and sig.size < 64 %}
+    if (v & {{"0x%XLL" % (1 << (sig.size - 1))}}) v -= {{"0x%XLL" % (1 << sig.size)}};
+    {% endif %}
+    {% if type == "HONDA_CHECKSUM" %}
+    if (!s.ignore_checksum && honda_checksum({{"0x%X" % address}}, be, {{msg_size}}) != v) {
+    {% elif type == "TOYOTA_CHECKSUM" %}
+    if (!s.ignore_checksum && toyota_checksum({{"0x%X" % address}}, be, {{msg_size}}) != v) {
+    {% elif type == "VOLKSWAGEN_CHECKSUM" %}
+    if (!s.ignore_checksum && volkswagen_crc({{"0x%X" % address}}, le, {{msg_size}}) != v) {
+    {% elif type == "SUBARU_CHECKSUM" %}
+    if (!s.ignore_checksum && subaru_checksum({{"0x%X" % address}}, be, {{msg_size}}) != v) {
+    {% elif type == "CHRYSLER_CHECKSUM" %}
+    if (!s.ignore_checksum && chrysler_checksum({{"0x%X" % address}}, le, {{msg_size}}) != v) {
+    {% elif type == "PEDAL_CHECKSUM" %}
+    if (!s.ignore_checksum && pedal_checksum(be, {{msg_size}}) != v) {
+    {% endif %}
+    {% if type.endswith("_CHECKSUM") %}
+      printf("{{"0x%X" % address}} {{"CRC" if type == "VOLKSWAGEN_CHECKSUM" else "PEDAL CHECKSUM" if type == "PEDAL_CHECKSUM" else "CHECKSUM"}} FAIL\n");
+      return false;
+    }
+    {% elif type.endswith("_COUNTER") %}
+    if (!s.ignore_counter && !s.update_counter_generic(v, {{sig.size}})) return false;
+    {% endif %}
+    vals[{{loop.index0}}] = v * {{sig.factor}} + {{sig.offset}};
+  }
+  {% endfor %}
+  return true;
+}
+
+{% endfor %}
 const Msg msgs[] = {
 {% for address, msg_name, msg_size, sigs in msgs %}
   {% set address_hex = "0x%X" % address %}
@@ -54,6 +81,9 @@ const Msg msgs[] = {
     .size = {{msg_size}},
     .num_sigs = ARRAYSIZE(sigs_{{address}}),
     .sigs = sigs_{{address}},
+    {% if msg_size <= 8 and sigs|length <= 64 %}
+    .decode = decode_{{address}},
+    {% endif %}
   },
 {% endfor %}
 };
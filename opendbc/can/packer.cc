@@ -33,6 +33,22 @@ static uint64_t set_value(uint64_t ret, const Signal& sig, int64_t ival) {
   return ret;
 }
 
+// set_value for CAN-FD messages longer than 8 bytes, see get_value_fd in parser.cc
+static void set_value_fd(std::vector<uint8_t> &dat, const Signal& sig, int64_t ival) {
+  for (int k = 0; k < sig.b2; k++) {
+    int bit, shift;
+    if (sig.is_little_endian) {
+      bit = sig.b1 + k;
+      shift = bit % 8;
+    } else {
+      bit = sig.b1 + sig.b2 - 1 - k;
+      shift = 7 - bit % 8;
+    }
+    dat[bit / 8] &= ~(1 << shift);
+    dat[bit / 8] |= ((ival >> k) & 1) << shift;
+  }
+}
+
 CANPacker::CANPacker(const std::string& dbc_name) {
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
@@ -42,23 +58,37 @@ CANPacker::CANPacker(const std::string& dbc_name) {
     message_lookup[msg->address] = *msg;
     for (int j=0; j<msg->num_sigs; j++) {
       const Signal* sig = &msg->sigs[j];
-      signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = *sig;
+      signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = sig;
     }
   }
   init_crc_lookup_tables();
 }
 
-uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
-  uint64_t ret = 0;
+PackPlan CANPacker::make_plan(uint32_t address, const std::vector<SignalPackValue> &signals) {
+  PackPlan plan = {.address = address, .size = message_lookup[address].size};
+  plan.sigs.reserve(signals.size());
   for (const auto& sigval : signals) {
-    double value = sigval.value;
-
     auto sig_it = signal_lookup.find(std::make_pair(address, sigval.name));
     if (sig_it == signal_lookup.end()) {
       WARN("undefined signal %s - %d\n", sigval.name.c_str(), address);
-      continue;
     }
-    const auto& sig = sig_it->second;
+    plan.sigs.push_back(sig_it != signal_lookup.end() ? sig_it->second : nullptr);
+  }
+
+  auto sig_it = signal_lookup.find(std::make_pair(address, "COUNTER"));
+  if (sig_it != signal_lookup.end()) plan.counter = sig_it->second;
+  sig_it = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
+  if (sig_it != signal_lookup.end()) plan.checksum = sig_it->second;
+  return plan;
+}
+
+uint64_t CANPacker::pack(const PackPlan &plan, const double *values, int counter) {
+  const uint32_t address = plan.address;
+  uint64_t ret = 0;
+  for (int i = 0; i < plan.sigs.size(); i++) {
+    if (!plan.sigs[i]) continue;
+    double value = values[i];
+    const auto& sig = *plan.sigs[i];
 
     int64_t ival = (int64_t)(round((value - sig.offset) / sig.factor));
     if (ival < 0) {
@@ -69,12 +99,11 @@ uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &s
   }
 
   if (counter >= 0){
-    auto sig_it = signal_lookup.find(std::make_pair(address, "COUNTER"));
-    if (sig_it == signal_lookup.end()) {
+    if (!plan.counter) {
       WARN("COUNTER not defined\n");
       return ret;
     }
-    const auto& sig = sig_it->second;
+    const auto& sig = *plan.counter;
 
     if ((sig.type != SignalType::HONDA_COUNTER) && (sig.type != SignalType::VOLKSWAGEN_COUNTER)) {
       WARN("COUNTER signal type not valid\n");
@@ -83,26 +112,25 @@ uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &s
     ret = set_value(ret, sig, counter);
   }
 
-  auto sig_it_checksum = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
-  if (sig_it_checksum != signal_lookup.end()) {
-    const auto& sig = sig_it_checksum->second;
+  if (plan.checksum) {
+    const auto& sig = *plan.checksum;
     if (sig.type == SignalType::HONDA_CHECKSUM) {
-      unsigned int chksm = honda_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = honda_checksum(address, ret, plan.size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::TOYOTA_CHECKSUM) {
-      unsigned int chksm = toyota_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = toyota_checksum(address, ret, plan.size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::VOLKSWAGEN_CHECKSUM) {
       // FIXME: Hackish fix for an endianness issue. The message is in reverse byte order
       // until later in the pack process. Checksums can be run backwards, CRCs not so much.
       // The correct fix is unclear but this works for the moment.
-      unsigned int chksm = volkswagen_crc(address, ReverseBytes(ret), message_lookup[address].size);
+      unsigned int chksm = volkswagen_crc(address, ReverseBytes(ret), plan.size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::SUBARU_CHECKSUM) {
-      unsigned int chksm = subaru_checksum(address, ret, message_lookup[address].size);
+      unsigned int chksm = subaru_checksum(address, ret, plan.size);
       ret = set_value(ret, sig, chksm);
     } else if (sig.type == SignalType::CHRYSLER_CHECKSUM) {
-      unsigned int chksm = chrysler_checksum(address, ReverseBytes(ret), message_lookup[address].size);
+      unsigned int chksm = chrysler_checksum(address, ReverseBytes(ret), plan.size);
       ret = set_value(ret, sig, chksm);
     } else {
       //WARN("CHECKSUM signal type not valid\n");
@@ -112,6 +140,67 @@ uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &s
   return ret;
 }
 
+std::vector<uint8_t> CANPacker::pack_vector(const PackPlan &plan, const double *values, int counter) {
+  std::vector<uint8_t> ret(plan.size);
+  if (plan.size <= 8) {
+    uint64_t dat = pack(plan, values, counter);
+    for (int i = 0; i < plan.size; i++) {
+      ret[i] = dat >> (56 - 8 * i);
+    }
+    return ret;
+  }
+
+  // no checksums, they only know the first 8 bytes
+  for (int i = 0; i < plan.sigs.size(); i++) {
+    if (!plan.sigs[i]) continue;
+    const auto& sig = *plan.sigs[i];
+    set_value_fd(ret, sig, (int64_t)(round((values[i] - sig.offset) / sig.factor)));
+  }
+  if (counter >= 0) {
+    if (!plan.counter) {
+      WARN("COUNTER not defined\n");
+      return ret;
+    }
+    set_value_fd(ret, *plan.counter, counter);
+  }
+  return ret;
+}
+
+static std::vector<double> plan_values(const std::vector<SignalPackValue> &signals) {
+  std::vector<double> values(signals.size());
+  for (int i = 0; i < signals.size(); i++) {
+    values[i] = signals[i].value;
+  }
+  return values;
+}
+
+uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
+  return pack(make_plan(address, signals), plan_values(signals).data(), counter);
+}
+
+std::vector<uint8_t> CANPacker::pack_vector(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
+  return pack_vector(make_plan(address, signals), plan_values(signals).data(), counter);
+}
+
+int CANPacker::plan(uint32_t address, const std::vector<std::string> &signal_names) {
+  std::vector<SignalPackValue> signals(signal_names.size());
+  for (int i = 0; i < signal_names.size(); i++) {
+    signals[i].name = signal_names[i];
+  }
+  plans.push_back(make_plan(address, signals));
+  return plans.size() - 1;
+}
+
+uint64_t CANPacker::pack_plan(int plan, const double *values, int counter) {
+  assert(plan >= 0 && plan < plans.size());
+  return pack(plans[plan], values, counter);
+}
+
+std::vector<uint8_t> CANPacker::pack_plan_vector(int plan, const double *values, int counter) {
+  assert(plan >= 0 && plan < plans.size());
+  return pack_vector(plans[plan], values, counter);
+}
+
 Msg* CANPacker::lookup_message(uint32_t address) {
   return &message_lookup[address];
 }
@@ -1,7 +1,7 @@
 # distutils: language = c++
 # cython: c_string_encoding=ascii, language_level=3
 
-from libc.stdint cimport uint32_t, uint64_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t
 from libcpp.vector cimport vector
 from libcpp.map cimport map
 from libcpp.string cimport string
@@ -18,6 +18,8 @@ cdef class CANPacker:
     const DBC *dbc
     map[string, (int, int)] name_to_address_and_size
     map[int, int] address_to_size
+    vector[double] plan_values
+    list plans
 
   def __init__(self, dbc_name):
     self.dbc = dbc_lookup(dbc_name)
@@ -25,13 +27,14 @@ cdef class CANPacker:
       raise RuntimeError(f"Can't lookup {dbc_name}")
 
     self.packer = new cpp_CANPacker(dbc_name)
+    self.plans = []
     num_msgs = self.dbc[0].num_msgs
     for i in range(num_msgs):
       msg = self.dbc[0].msgs[i]
       self.name_to_address_and_size[string(msg.name)] = (msg.address, msg.size)
       self.address_to_size[msg.address] = msg.size
 
-  cdef uint64_t pack(self, addr, values, counter):
+  cdef vector[SignalPackValue] pack_values(self, values):
     cdef vector[SignalPackValue] values_thing
     values_thing.reserve(len(values))
     cdef SignalPackValue spv
@@ -41,7 +44,10 @@ cdef class CANPacker:
       spv.value = value
       values_thing.push_back(spv)
 
-    return self.packer.pack(addr, values_thing, counter)
+    return values_thing
+
+  cdef uint64_t pack(self, addr, values, counter):
+    return self.packer.pack(addr, self.pack_values(values), counter)
 
   cdef inline uint64_t ReverseBytes(self, uint64_t x):
     return (((x & 0xff00000000000000ull) >> 56) |
@@ -60,6 +66,45 @@ cdef class CANPacker:
       size = self.address_to_size[name_or_addr]
     else:
       addr, size = self.name_to_address_and_size[name_or_addr.encode('utf8')]
+    cdef vector[uint8_t] dat
+    if size > 8:
+      # CAN-FD
+      dat = self.packer.pack_vector(addr, self.pack_values(values), counter)
+      return [addr, 0, bytes(dat), bus]
     cdef uint64_t val = self.pack(addr, values, counter)
     val = self.ReverseBytes(val)
     return [addr, 0, (<char *>&val)[:size], bus]
+
+  def plan(self, name_or_addr, signal_names):
+    """an id for make_can_msg_plan, which takes the values of signal_names in their order"""
+    cdef int addr, size
+    if type(name_or_addr) == int:
+      addr = name_or_addr
+      size = self.address_to_size[name_or_addr]
+    else:
+      addr, size = self.name_to_address_and_size[name_or_addr.encode('utf8')]
+
+    cdef vector[string] names
+    for name in signal_names:
+      names.push_back(name.encode('utf8'))
+    plan = self.packer.plan(addr, names)
+    self.plans.append((addr, size, len(names)))
+    return plan
+
+  cpdef make_can_msg_plan(self, int plan, bus, values, counter=-1):
+    addr, size, num_sigs = self.plans[plan]
+    assert len(values) == num_sigs
+
+    cdef int i
+    self.plan_values.resize(num_sigs)
+    for i in range(num_sigs):
+      self.plan_values[i] = values[i]
+
+    cdef vector[uint8_t] dat
+    if size > 8:
+      # CAN-FD
+      dat = self.packer.pack_plan_vector(plan, self.plan_values.data(), counter)
+      return [addr, 0, bytes(dat), bus]
+    cdef uint64_t val = self.packer.pack_plan(plan, self.plan_values.data(), counter)
+    val = self.ReverseBytes(val)
+    return [addr, 0, (<char *>&val)[:size], bus]
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cmath>
 #include <cstring>
 
 #include <unistd.h>
@@ -6,6 +7,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <algorithm>
+#include <functional>
 
 #include "common.h"
 
@@ -13,7 +15,50 @@
 // #define DEBUG printf
 #define INFO printf
 
+// signals of CAN-FD messages longer than 8 bytes, bit by bit. b1 is the lsb
+// of little endian signals counting from the lsb of byte 0, and the msb of big
+// endian ones counting from the msb of byte 0
+static int64_t get_value_fd(const uint8_t *dat, const Signal &sig) {
+  int64_t ret = 0;
+  for (int k = 0; k < sig.b2; k++) {
+    if (sig.is_little_endian) {
+      const int bit = sig.b1 + k;
+      ret |= (int64_t)((dat[bit / 8] >> (bit % 8)) & 1) << k;
+    } else {
+      const int bit = sig.b1 + k;
+      ret = (ret << 1) | ((dat[bit / 8] >> (7 - bit % 8)) & 1);
+    }
+  }
+  return ret;
+}
+
+void MessageState::add_sig(const Msg *msg, int sig_idx, double default_value) {
+  parse_sigs.push_back(msg->sigs[sig_idx]);
+  vals.push_back(default_value);
+  if (msg->decode) {
+    decode = msg->decode;
+    sig_index.push_back(sig_idx);
+    wanted |= 1ULL << sig_idx;
+    decoded.resize(msg->num_sigs);
+  }
+}
+
 bool MessageState::parse(uint64_t sec, uint16_t ts_, uint8_t * dat) {
+  if (decode) {
+    if (!decode(*this, dat, wanted, decoded.data())) return false;
+    for (int i = 0; i < parse_sigs.size(); i++) {
+      vals[i] = decoded[sig_index[i]];
+    }
+  } else if (!parse_generic(dat)) {
+    return false;
+  }
+  ts = ts_;
+  seen = sec;
+
+  return true;
+}
+
+bool MessageState::parse_generic(uint8_t * dat) {
   uint64_t dat_le = read_u64_le(dat);
   uint64_t dat_be = read_u64_be(dat);
 
@@ -21,7 +66,9 @@ bool MessageState::parse(uint64_t sec, uint16_t ts_, uint8_t * dat) {
     auto& sig = parse_sigs[i];
     int64_t tmp;
 
-    if (sig.is_little_endian){
+    if (size > 8) {
+      tmp = get_value_fd(dat, sig);
+    } else if (sig.is_little_endian){
       tmp = (dat_le >> sig.b1) & ((1ULL << sig.b2)-1);
     } else {
       tmp = (dat_be >> sig.bo) & ((1ULL << sig.b2)-1);
@@ -33,7 +80,8 @@ bool MessageState::parse(uint64_t sec, uint16_t ts_, uint8_t * dat) {
 
     DEBUG("parse 0x%X %s -> %lld\n", address, sig.name, tmp);
 
-    if (!ignore_checksum) {
+    // the checksums only know the first 8 bytes
+    if (!ignore_checksum && size <= 8) {
       if (sig.type == SignalType::HONDA_CHECKSUM) {
         if (honda_checksum(address, dat_be, size) != tmp) {
           INFO("0x%X CHECKSUM FAIL\n", address);
@@ -84,9 +132,6 @@ bool MessageState::parse(uint64_t sec, uint16_t ts_, uint8_t * dat) {
 
     vals[i] = tmp * sig.factor + sig.offset;
   }
-  ts = ts_;
-  seen = sec;
-
   return true;
 }
 
@@ -118,8 +163,9 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
   assert(dbc);
   init_crc_lookup_tables();
 
+  std::map<uint32_t, MessageState> states;
   for (const auto& op : options) {
-    MessageState &state = message_states[op.address];
+    MessageState &state = states[op.address];
     state.address = op.address;
     // state.check_frequency = op.check_frequency,
 
@@ -144,10 +190,8 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
 
     // track checksums and counters for this message
     for (int i = 0; i < msg->num_sigs; i++) {
-      const Signal *sig = &msg->sigs[i];
-      if (sig->type != SignalType::DEFAULT) {
-        state.parse_sigs.push_back(*sig);
-        state.vals.push_back(0);
+      if (msg->sigs[i].type != SignalType::DEFAULT) {
+        state.add_sig(msg, i, 0);
       }
     }
 
@@ -159,13 +203,13 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
         const Signal *sig = &msg->sigs[i];
         if (strcmp(sig->name, sigop.name) == 0
             && sig->type == SignalType::DEFAULT) {
-          state.parse_sigs.push_back(*sig);
-          state.vals.push_back(sigop.default_value);
+          state.add_sig(msg, i, sigop.default_value);
           break;
         }
       }
     }
   }
+  build_index(states);
 }
 
 CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter)
@@ -176,6 +220,7 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
   assert(dbc);
   init_crc_lookup_tables();
 
+  std::map<uint32_t, MessageState> states;
   for (int i = 0; i < dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
     MessageState state = {
@@ -186,13 +231,34 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
     };
 
     for (int j = 0; j < msg->num_sigs; j++) {
-      const Signal *sig = &msg->sigs[j];
-      state.parse_sigs.push_back(*sig);
-      state.vals.push_back(0);
+      state.add_sig(msg, j, 0);
     }
 
-    message_states[state.address] = state;
+    states[state.address] = state;
   }
+  build_index(states);
+}
+
+void CANParser::build_index(std::map<uint32_t, MessageState> &states) {
+  assert(states.size() < UINT16_MAX);
+  message_states.reserve(states.size());
+  std_index.assign(0x800, 0);
+  for (auto &kv : states) {
+    if (kv.first < std_index.size()) {
+      std_index[kv.first] = message_states.size() + 1;
+    } else {
+      ext_index.push_back({kv.first, (uint16_t)message_states.size()});
+    }
+    message_states.push_back(std::move(kv.second));
+  }
+  updated.assign((message_states.size() + 63) / 64, 0);
+
+  for (int i = 0; i < message_states.size(); i++) {
+    if (message_states[i].check_threshold > 0) {
+      deadlines.push_back({message_states[i].check_threshold, (uint16_t)i});
+    }
+  }
+  std::make_heap(deadlines.begin(), deadlines.end(), std::greater<>());
 }
 
 #ifndef DYNAMIC_CAPNP
@@ -210,8 +276,10 @@ void CANParser::update_string(const std::string &data, bool sendcan) {
 
   last_sec = event.getLogMonoTime();
 
-  auto cans = sendcan? event.getSendcan() : event.getCan();
-  UpdateCans(last_sec, cans);
+  if (sendcan || !UpdateShared(last_sec)) {
+    auto cans = sendcan? event.getSendcan() : event.getCan();
+    UpdateCans(last_sec, cans);
+  }
 
   UpdateValid(last_sec);
 }
@@ -228,17 +296,49 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Rea
       // DEBUG("skip %d: wrong bus\n", cmsg.getAddress());
       continue;
     }
-    auto state_it = message_states.find(cmsg.getAddress());
-    if (state_it == message_states.end()) {
-      // DEBUG("skip %d: not specified\n", cmsg.getAddress());
-      continue;
+    UpdateFrame(sec, cmsg.getAddress(), cmsg.getBusTime(), cmsg.getDat());
+  }
+}
+
+MultiBusCANParser::MultiBusCANParser(const std::vector<CANParser *> &parsers)
+  : aligned_buf(kj::heapArray<capnp::word>(1024)), parsers(parsers), from_shared(parsers.size()) {
+  for (size_t i = 0; i < parsers.size(); i++) {
+    CANParser *p = parsers[i];
+    assert(p->get_bus() >= 0 && p->get_bus() <= UINT8_MAX);
+    if (p->get_bus() >= by_bus.size()) {
+      by_bus.resize(p->get_bus() + 1);
     }
+    by_bus[p->get_bus()].push_back({i, p});
+  }
+}
 
-    if (cmsg.getDat().size() > 8) continue; //shouldn't ever happen
-    uint8_t dat[8] = {0};
-    memcpy(dat, cmsg.getDat().begin(), cmsg.getDat().size());
+void MultiBusCANParser::update_string(const std::string &data, bool sendcan) {
+  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+  memcpy(aligned_buf.begin(), data.data(), data.length());
+
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
+  cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+
+  const uint64_t sec = event.getLogMonoTime();
+  // the ones with a live shared table don't need the frames
+  for (size_t i = 0; i < parsers.size(); i++) {
+    from_shared[i] = !sendcan && parsers[i]->UpdateShared(sec);
+  }
+
+  auto cans = sendcan? event.getSendcan() : event.getCan();
+  for (auto c : cans) {
+    if (c.getSrc() >= by_bus.size()) continue;
+    for (const auto &[i, p] : by_bus[c.getSrc()]) {
+      if (!from_shared[i]) p->UpdateFrame(sec, c.getAddress(), c.getBusTime(), c.getDat());
+    }
+  }
 
-    state_it->second.parse(sec, cmsg.getBusTime(), dat);
+  for (CANParser *p : parsers) {
+    p->last_sec = sec;
+    p->UpdateValid(sec);
   }
 }
 #endif
@@ -252,39 +352,124 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cms
     return;
   }
 
-  auto state_it = message_states.find(cmsg.get("address").as<uint32_t>());
-  if (state_it == message_states.end()) {
-    DEBUG("skip %d: not specified\n", cmsg.get("address").as<uint32_t>());
+  UpdateFrame(sec, cmsg.get("address").as<uint32_t>(), cmsg.get("busTime").as<uint16_t>(), cmsg.get("dat").as<capnp::Data>());
+}
+
+void CANParser::UpdateFrame(uint64_t sec, uint32_t address, uint16_t bus_time, const capnp::Data::Reader &dat) {
+  MessageState *state = lookup(address);
+  if (!state) {
+    DEBUG("skip %d: not specified\n", address);
     return;
   }
 
-  auto dat = cmsg.get("dat").as<capnp::Data>();
-  if (dat.size() > 8) return; //shouldn't ever happen
-  uint8_t data[8] = {0};
+  if (dat.size() > 64) return; //shouldn't ever happen
+  uint8_t data[64] = {0};
   memcpy(data, dat.begin(), dat.size());
-  state_it->second.parse(sec, cmsg.get("busTime").as<uint16_t>(), data);
+  if (state->parse(sec, bus_time, data)) {
+    const size_t i = state - message_states.data();
+    updated[i / 64] |= 1ULL << (i % 64);
+  }
 }
 
 void CANParser::UpdateValid(uint64_t sec) {
-  can_valid = true;
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
-    if (state.check_threshold > 0 && (sec - state.seen) > state.check_threshold) {
+  // the overdue messages that were seen since
+  for (int i = 0; i < expired.size();) {
+    const MessageState &state = message_states[expired[i]];
+    if (sec - state.seen <= state.check_threshold) {
+      deadlines.push_back({state.seen + state.check_threshold, expired[i]});
+      std::push_heap(deadlines.begin(), deadlines.end(), std::greater<>());
+      expired[i] = expired.back();
+      expired.pop_back();
+    } else {
+      i++;
+    }
+  }
+
+  // the ones whose deadline passed, unless they were seen since
+  while (!deadlines.empty() && deadlines.front().first < sec) {
+    std::pop_heap(deadlines.begin(), deadlines.end(), std::greater<>());
+    const uint16_t i = deadlines.back().second;
+    deadlines.pop_back();
+
+    const MessageState &state = message_states[i];
+    if (sec - state.seen <= state.check_threshold) {
+      deadlines.push_back({state.seen + state.check_threshold, i});
+      std::push_heap(deadlines.begin(), deadlines.end(), std::greater<>());
+    } else {
       if (state.seen > 0) {
         DEBUG("0x%X TIMEOUT\n", state.address);
       } else {
         DEBUG("0x%X MISSING\n", state.address);
       }
-      can_valid = false;
+      expired.push_back(i);
     }
   }
+
+  can_valid = expired.empty();
+}
+
+bool CANParser::set_deadband(uint32_t address, const std::string &name, double deadband) {
+  MessageState *state = lookup(address);
+  if (!state) return false;
+
+  if (state->deadbands.empty()) {
+    state->deadbands.assign(state->parse_sigs.size(), -1.);
+    state->reported.assign(state->parse_sigs.size(), NAN);
+  }
+  bool found = false;
+  for (int i = 0; i < state->parse_sigs.size(); i++) {
+    if (name.empty() || name == state->parse_sigs[i].name) {
+      state->deadbands[i] = deadband;
+      state->reported[i] = NAN;
+      found = true;
+    }
+  }
+
+  const uint16_t idx = state - message_states.data();
+  const bool any = std::any_of(state->deadbands.begin(), state->deadbands.end(), [](double d) { return d >= 0; });
+  auto it = std::find(tracked.begin(), tracked.end(), idx);
+  if (any && it == tracked.end()) {
+    tracked.push_back(idx);
+  } else if (!any && it != tracked.end()) {
+    tracked.erase(it);
+  }
+  return found;
+}
+
+void CANParser::query_changes(std::vector<SignalChange> &changes) {
+  for (uint16_t idx : tracked) {
+    MessageState &state = message_states[idx];
+    if (state.seen == 0) continue;
+
+    for (int i = 0; i < state.parse_sigs.size(); i++) {
+      if (state.deadbands[i] < 0) continue;
+      const double v = state.vals[i];
+      if (!std::isnan(state.reported[i]) && std::abs(v - state.reported[i]) <= state.deadbands[i]) continue;
+
+      state.reported[i] = v;
+      changes.push_back({
+        .address = state.address,
+        .name = state.parse_sigs[i].name,
+        .value = v,
+        .mono_time = state.seen,
+      });
+    }
+  }
+}
+
+void CANParser::invalid_messages(std::vector<uint32_t> &missing, std::vector<uint32_t> &timed_out) const {
+  for (uint16_t i : expired) {
+    const MessageState &state = message_states[i];
+    (state.seen > 0 ? timed_out : missing).push_back(state.address);
+  }
+  std::sort(missing.begin(), missing.end());
+  std::sort(timed_out.begin(), timed_out.end());
 }
 
 std::vector<SignalValue> CANParser::query_latest() {
   std::vector<SignalValue> ret;
 
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
+  for (const auto& state : message_states) {
     if (last_sec != 0 && state.seen != last_sec) continue;
 
     for (int i=0; i<state.parse_sigs.size(); i++) {
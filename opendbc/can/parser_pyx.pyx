@@ -9,7 +9,9 @@ from libcpp.map cimport map
 from libcpp cimport bool
 
 from .common cimport CANParser as cpp_CANParser
-from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, DBC
+from .common cimport MultiBusCANParser as cpp_MultiBusCANParser
+from .common cimport CANShare, CANShareWriter
+from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, SignalChange, DBC, MessageState
 
 import os
 import numbers
@@ -17,6 +19,9 @@ from collections import defaultdict
 
 cdef int CAN_INVALID_CNT = 5
 
+cdef extern from *:
+  int __builtin_ctzll(unsigned long long)
+
 cdef class CANParser:
   cdef:
     cpp_CANParser *can
@@ -28,11 +33,20 @@ cdef class CANParser:
 
   cdef readonly:
     string dbc_name
+    int bus
+    list addresses
     dict vl
     dict ts
+    dict values
     bool can_valid
     int can_invalid_cnt
 
+  cdef:
+    # by the C++ parser's message index: the vl and ts dicts and the signal names
+    list msg_vl
+    list msg_ts
+    list msg_sig_names
+
   def __init__(self, dbc_name, signals, checks=None, bus=0, enforce_checks=True):
     if checks is None:
       checks = []
@@ -56,10 +70,8 @@ cdef class CANParser:
 
       self.msg_name_to_address[name] = msg.address
       self.address_to_msg_name[msg.address] = name
-      self.vl[msg.address] = {}
-      self.vl[name] = {}
-      self.ts[msg.address] = {}
-      self.ts[name] = {}
+      self.vl[msg.address] = self.vl[name] = {}
+      self.ts[msg.address] = self.ts[name] = {}
 
     # Convert message names into addresses
     for i in range(len(signals)):
@@ -94,6 +106,8 @@ cdef class CANParser:
 
     message_options = dict((address, 0) for _, address, _ in signals)
     message_options.update(dict(checks))
+    self.bus = bus
+    self.addresses = list(message_options)
 
     cdef vector[MessageParseOptions] message_options_v
     cdef MessageParseOptions mpo
@@ -103,13 +117,54 @@ cdef class CANParser:
       message_options_v.push_back(mpo)
 
     self.can = new cpp_CANParser(bus, dbc_name, message_options_v, signal_options_v)
+    # the values canshared parsed already, while it runs with CANSHARE set
+    self.can.share_from(CANShare.path(dbc_name, bus))
+
+    # values[address] and values[name] are views of the parser's values of the
+    # message, in the order of signal_names(address)
+    self.values = {}
+    self.msg_vl, self.msg_ts, self.msg_sig_names = [], [], []
+    cdef size_t i, j
+    cdef const MessageState *state
+    for i in range(self.can.message_count()):
+      state = self.can.message(i)
+      self.msg_vl.append(self.vl[state.address])
+      self.msg_ts.append(self.ts[state.address])
+      self.msg_sig_names.append([<unicode>state.parse_sigs[j].name for j in range(state.parse_sigs.size())])
+      if state.vals.size() > 0:
+        name = <unicode>self.address_to_msg_name[state.address].c_str()
+        self.values[state.address] = self.values[name] = <double[:state.vals.size()]>(<double *>&state.vals[0])
+
+      # the defaults until it's seen
+      self.update_msg(i)
+
     self.update_vl()
 
+  def signal_names(self, address):
+    if not isinstance(address, numbers.Number):
+      address = self.msg_name_to_address[address.encode('utf8')]
+    cdef size_t i
+    for i in range(self.can.message_count()):
+      if self.can.message(i).address == address:
+        return self.msg_sig_names[i]
+    return []
+
+  cdef void update_msg(self, size_t i):
+    cdef const MessageState *state = self.can.message(i)
+    cdef size_t j
+    vl = self.msg_vl[i]
+    ts = self.msg_ts[i]
+    names = self.msg_sig_names[i]
+    for j in range(state.vals.size()):
+      vl[names[j]] = state.vals[j]
+      ts[names[j]] = state.ts
+
   cdef unordered_set[uint32_t] update_vl(self):
-    cdef string sig_name
     cdef unordered_set[uint32_t] updated_val
+    cdef const uint64_t *bits = self.can.updated_bits()
+    cdef uint64_t word
+    cdef size_t w, i
 
-    can_values = self.can.query_latest()
     valid = self.can.can_valid
 
     # Update invalid flag
@@ -118,21 +173,40 @@ cdef class CANParser:
         self.can_invalid_cnt = 0
     self.can_valid = self.can_invalid_cnt < CAN_INVALID_CNT
 
-    for cv in can_values:
-      # Cast char * directly to unicode
-      name = <unicode>self.address_to_msg_name[cv.address].c_str()
-      cv_name = <unicode>cv.name
-
-      self.vl[cv.address][cv_name] = cv.value
-      self.ts[cv.address][cv_name] = cv.ts
+    # only the messages parsed since the last update
+    for w in range(self.can.updated_words()):
+      word = bits[w]
+      while word:
+        i = w * 64 + __builtin_ctzll(word)
+        word &= word - 1
 
-      self.vl[name][cv_name] = cv.value
-      self.ts[name][cv_name] = cv.ts
-
-      updated_val.insert(cv.address)
+        self.update_msg(i)
+        updated_val.insert(self.can.message(i).address)
+    self.can.clear_updated()
 
     return updated_val
 
+  def invalid_messages(self):
+    """the checked addresses that were missing and the ones that timed out at the last update"""
+    cdef vector[uint32_t] missing, timed_out
+    self.can.invalid_messages(missing, timed_out)
+    return list(missing), list(timed_out)
+
+  def set_deadband(self, address, signal=None, deadband=0.):
+    """changes() reports the signal, all of the message's without one, when it
+    moves more than deadband. A negative deadband stops it"""
+    if not isinstance(address, numbers.Number):
+      address = self.msg_name_to_address[address.encode('utf8')]
+    if not self.can.set_deadband(address, (signal or "").encode('utf8'), deadband):
+      raise RuntimeError(f"{self.dbc_name.decode('utf8')}: {address:#x} {signal} isn't parsed")
+
+  def changes(self):
+    """(address, signal, value, logMonoTime) of the tracked signals that changed
+    since the last call"""
+    cdef vector[SignalChange] changes
+    self.can.query_changes(changes)
+    return [(c.address, c.name.decode('utf8'), c.value, c.mono_time) for c in changes]
+
   def update_string(self, dat, sendcan=False):
     self.can.update_string(dat, sendcan)
     return self.update_vl()
@@ -146,6 +220,77 @@ cdef class CANParser:
 
     return updated_vals
 
+cdef class MultiBusCANParser:
+  """CANParsers of different buses updated from the same strings, each string
+  is read once for all of them"""
+  cdef:
+    cpp_MultiBusCANParser *can
+    list parsers
+
+  def __init__(self, parsers):
+    self.parsers = list(parsers)
+
+    cdef vector[cpp_CANParser *] parsers_v
+    cdef CANParser p
+    for p in self.parsers:
+      parsers_v.push_back(p.can)
+    self.can = new cpp_MultiBusCANParser(parsers_v)
+
+  def __dealloc__(self):
+    del self.can
+
+  def update_strings(self, strings, sendcan=False):
+    """the addresses updated by each parser, in the order they were given"""
+    updated_vals = [set() for _ in self.parsers]
+
+    cdef CANParser p
+    for s in strings:
+      self.can.update_string(s, sendcan)
+      for i, p in enumerate(self.parsers):
+        updated_vals[i].update(p.update_vl())
+
+    return updated_vals
+
+cdef class CANShareServer:
+  """Parses all of each (dbc_name, bus) once, for the CANParsers of the other
+  processes to read from its shared table"""
+  cdef:
+    vector[cpp_CANParser *] parsers
+    vector[CANShareWriter *] writers
+    cpp_MultiBusCANParser *can
+
+  def __init__(self, tables):
+    cdef cpp_CANParser *p
+    for dbc_name, bus in tables:
+      if not dbc_lookup(dbc_name):
+        raise RuntimeError(f"Can't find DBC: {dbc_name}")
+      p = new cpp_CANParser(bus, dbc_name, False, False)
+      self.parsers.push_back(p)
+      self.writers.push_back(new CANShareWriter(p[0], CANShare.path(dbc_name, bus)))
+    self.can = new cpp_MultiBusCANParser(self.parsers)
+
+  def __dealloc__(self):
+    self.close()
+
+  def close(self):
+    """Unlinks the tables"""
+    del self.can
+    self.can = NULL
+    cdef size_t i
+    for i in range(self.writers.size()):
+      del self.writers[i]
+    for i in range(self.parsers.size()):
+      del self.parsers[i]
+    self.writers.clear()
+    self.parsers.clear()
+
+  def update_strings(self, strings):
+    cdef size_t i
+    for s in strings:
+      self.can.update_string(s, False)
+      for i in range(self.writers.size()):
+        self.writers[i].publish(self.parsers[i][0])
+
 cdef class CANDefine():
   cdef:
     const DBC *dbc
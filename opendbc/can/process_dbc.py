@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 from __future__ import print_function
 import os
+import struct
 import sys
 
 import jinja2
@@ -8,15 +9,31 @@ import jinja2
 from collections import Counter
 from opendbc.can.dbc import dbc
 
-def process(in_fn, out_fn):
-  dbc_name = os.path.split(out_fn)[-1].replace('.cc', '')
-  # print("processing %s: %s -> %s" % (dbc_name, in_fn, out_fn))
+# SignalType in common_dbc.h
+SIGNAL_TYPES = ["DEFAULT", "HONDA_CHECKSUM", "HONDA_COUNTER", "TOYOTA_CHECKSUM", "PEDAL_CHECKSUM", "PEDAL_COUNTER",
+                "VOLKSWAGEN_CHECKSUM", "VOLKSWAGEN_COUNTER", "SUBARU_CHECKSUM", "CHRYSLER_CHECKSUM"]
 
-  template_fn = os.path.join(os.path.dirname(__file__), "dbc_template.cc")
+# the version of the binary DBC format read by dbc_load in dbc.cc
+BINARY_MAGIC = b"DBC1"
+
+
+def signal_type(checksum_type, address, sig):
+  if checksum_type is not None and sig.name in ("CHECKSUM", "COUNTER"):
+    t = "%s_%s" % (checksum_type.upper(), sig.name)
+    if t in SIGNAL_TYPES:
+      return t
+  if address in (0x200, 0x201):
+    return {"CHECKSUM_PEDAL": "PEDAL_CHECKSUM", "COUNTER_PEDAL": "PEDAL_COUNTER"}.get(sig.name, "DEFAULT")
+  return "DEFAULT"
 
-  with open(template_fn, "r") as template_f:
-    template = jinja2.Template(template_f.read(), trim_blocks=True, lstrip_blocks=True)
 
+def signal_b1(sig):
+  if sig.is_little_endian:
+    return sig.start_bit
+  return (sig.start_bit // 8) * 8 + (-sig.start_bit - 1) % 8
+
+
+def load(in_fn, dbc_name):
   can_dbc = dbc(in_fn)
 
   # process counter and checksums first
@@ -104,7 +121,23 @@ def process(in_fn, out_fn):
     if count > 1:
       sys.exit("%s: Duplicate message name in DBC file %s" % (dbc_name, name))
 
-  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals, len=len)
+  return can_dbc, checksum_type, msgs, def_vals
+
+
+def process(in_fn, out_fn):
+  dbc_name = os.path.split(out_fn)[-1].replace('.cc', '')
+  # print("processing %s: %s -> %s" % (dbc_name, in_fn, out_fn))
+
+  template_fn = os.path.join(os.path.dirname(__file__), "dbc_template.cc")
+
+  with open(template_fn, "r") as template_f:
+    template = jinja2.Template(template_f.read(), trim_blocks=True, lstrip_blocks=True)
+
+  can_dbc, checksum_type, msgs, def_vals = load(in_fn, dbc_name)
+
+  parser_code = template.render(dbc=can_dbc, checksum_type=checksum_type, msgs=msgs, def_vals=def_vals, len=len,
+                                sig_type=lambda address, sig: signal_type(checksum_type, address, sig),
+                                sig_b1=signal_b1)
 
   with open(out_fn, "a+") as out_f:
     out_f.seek(0)
@@ -113,18 +146,60 @@ def process(in_fn, out_fn):
       out_f.truncate()
       out_f.write(parser_code)
 
+def process_binary(in_fn, out_fn):
+  """A DBC that the parser and packer load at runtime, from a directory in
+  $DBC_PATH, without the generated decoders. Little endian, strings are a u16
+  length and the bytes:
+    magic, name, u32 message count, then per message
+      u32 address, u32 size, name, u32 signal count, then per signal
+        name, i32 b1, b2, bo, u8 is_signed, is_little_endian, type, f64 factor, offset
+    u32 value definition count, then per definition
+      u32 address, signal name, definition"""
+  dbc_name = os.path.split(out_fn)[-1].replace('.dbcbin', '')
+  can_dbc, checksum_type, msgs, def_vals = load(in_fn, dbc_name)
+
+  def string(s):
+    b = s.encode('ascii')
+    return struct.pack("<H", len(b)) + b
+
+  out = BINARY_MAGIC + string(can_dbc.name) + struct.pack("<I", len(msgs))
+  for address, msg_name, msg_size, sigs in msgs:
+    out += struct.pack("<II", address, msg_size) + string(msg_name) + struct.pack("<I", len(sigs))
+    for sig in sigs:
+      b1 = signal_b1(sig)
+      out += string(sig.name)
+      out += struct.pack("<iiiBBBdd", b1, sig.size, 64 - (b1 + sig.size), sig.is_signed, sig.is_little_endian,
+                         SIGNAL_TYPES.index(signal_type(checksum_type, address, sig)), sig.factor, sig.offset)
+
+  vals = [(address, sg_name, def_val) for address, sig in def_vals for sg_name, def_val in sig]
+  out += struct.pack("<I", len(vals))
+  for address, sg_name, def_val in vals:
+    # def_val is a C string literal
+    out += struct.pack("<I", address) + string(sg_name) + string(def_val[1:-1].replace(r"\?", "?"))
+
+  with open(out_fn, "wb") as out_f:
+    out_f.write(out)
+
+
 def main():
-  if len(sys.argv) != 3:
-    print("usage: %s dbc_directory output_filename" % (sys.argv[0],))
+  args = sys.argv[1:]
+  binary = "--binary" in args
+  if binary:
+    args.remove("--binary")
+  if len(args) != 2:
+    print("usage: %s [--binary] dbc_directory output_filename" % (sys.argv[0],))
     sys.exit(0)
 
-  dbc_dir = sys.argv[1]
-  out_fn = sys.argv[2]
+  dbc_dir = args[0]
+  out_fn = args[1]
 
-  dbc_name = os.path.split(out_fn)[-1].replace('.cc', '')
+  dbc_name = os.path.splitext(os.path.split(out_fn)[-1])[0]
   in_fn = os.path.join(dbc_dir, dbc_name + '.dbc')
 
-  process(in_fn, out_fn)
+  if binary:
+    process_binary(in_fn, out_fn)
+  else:
+    process(in_fn, out_fn)
 
 
 if __name__ == '__main__':
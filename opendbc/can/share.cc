@@ -0,0 +1,231 @@
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+// how long a reader waits for the writer to get to its can before parsing the frames itself
+const auto CAN_SHARE_WAIT = std::chrono::milliseconds(5);
+
+bool CANShare::enabled() {
+  static const bool enabled = getenv("CANSHARE") != nullptr;
+  return enabled;
+}
+
+std::string CANShare::path(const std::string &dbc_name, int bus) {
+  return "/dev/shm/canshare_" + dbc_name + "_" + std::to_string(bus);
+}
+
+size_t CANShare::table_size(uint32_t num_msgs, uint32_t num_sigs) {
+  return sizeof(CANShareHeader) + num_msgs * sizeof(CANShareMsg) + num_sigs * (CAN_SHARE_NAME_LEN + sizeof(double));
+}
+
+CANShare::CANShare(void *mem, size_t size) : mem(mem), size(size) {
+  uint8_t *p = (uint8_t *)mem;
+  header = (CANShareHeader *)p;
+  msgs = (CANShareMsg *)(p + sizeof(CANShareHeader));
+  names = (char (*)[CAN_SHARE_NAME_LEN])(msgs + header->num_msgs);
+  values = (double *)(names + header->num_sigs);
+}
+
+CANShare::~CANShare() {
+  munmap(mem, size);
+}
+
+bool CANShare::writer_alive() const {
+  return kill(header->pid, 0) == 0 || errno == EPERM;
+}
+
+CANShareWriter::CANShareWriter(const CANParser &parser, const std::string &path) : table_path(path) {
+  uint32_t num_sigs = 0;
+  for (size_t i = 0; i < parser.message_count(); i++) {
+    num_sigs += parser.message(i)->parse_sigs.size();
+  }
+  const size_t size = CANShare::table_size(parser.message_count(), num_sigs);
+
+  // written in full under another name, the readers never see it half done
+  const std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+  int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  int err = ftruncate(fd, size);
+  assert(err == 0);
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(mem != MAP_FAILED);
+  struct stat st;
+  err = fstat(fd, &st);
+  assert(err == 0);
+  ino = st.st_ino;
+  close(fd);
+
+  CANShareHeader *header = new (mem) CANShareHeader();
+  memcpy(header->magic, CAN_SHARE_MAGIC, sizeof(header->magic));
+  header->num_msgs = parser.message_count();
+  header->num_sigs = num_sigs;
+  header->pid = getpid();
+  table = std::make_unique<CANShare>(mem, size);
+
+  uint32_t sig = 0;
+  for (size_t i = 0; i < parser.message_count(); i++) {
+    const MessageState *state = parser.message(i);
+    CANShareMsg *m = new (&table->msgs[i]) CANShareMsg();
+    m->address = state->address;
+    m->first_sig = sig;
+    m->num_sigs = state->parse_sigs.size();
+    for (size_t j = 0; j < state->parse_sigs.size(); j++, sig++) {
+      strncpy(table->names[sig], state->parse_sigs[j].name, CAN_SHARE_NAME_LEN - 1);
+      table->values[sig] = state->vals[j];
+    }
+  }
+
+  err = rename(tmp_path.c_str(), path.c_str());
+  assert(err == 0);
+}
+
+CANShareWriter::~CANShareWriter() {
+  struct stat st;
+  if (stat(table_path.c_str(), &st) == 0 && st.st_ino == ino) {
+    unlink(table_path.c_str());
+  }
+}
+
+void CANShareWriter::publish(CANParser &parser) {
+  const uint64_t *bits = parser.updated_bits();
+  for (size_t w = 0; w < parser.updated_words(); w++) {
+    for (uint64_t word = bits[w]; word; word &= word - 1) {
+      const size_t i = w * 64 + __builtin_ctzll(word);
+      const MessageState *state = parser.message(i);
+      CANShareMsg &m = table->msgs[i];
+
+      const uint32_t seq = m.seq.load(std::memory_order_relaxed);
+      m.seq.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      m.seen = state->seen;
+      m.ts = state->ts;
+      memcpy(&table->values[m.first_sig], state->vals.data(), m.num_sigs * sizeof(double));
+      m.seq.store(seq + 2, std::memory_order_release);
+    }
+  }
+  parser.clear_updated();
+  table->header->sec.store(parser.last_sec, std::memory_order_release);
+}
+
+bool CANParser::attach_shared() {
+  int fd = open(shared_path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void *mem = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CANShareHeader)) {
+    mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) return false;
+
+  const CANShareHeader *header = (const CANShareHeader *)mem;
+  if (memcmp(header->magic, CAN_SHARE_MAGIC, sizeof(header->magic)) != 0 ||
+      CANShare::table_size(header->num_msgs, header->num_sigs) > (size_t)st.st_size) {
+    munmap(mem, st.st_size);
+    return false;
+  }
+  auto table = std::make_unique<CANShare>(mem, st.st_size);
+
+  std::unordered_map<uint32_t, uint32_t> by_address;
+  for (uint32_t i = 0; i < table->header->num_msgs; i++) {
+    by_address[table->msgs[i].address] = i;
+  }
+
+  std::vector<SharedMsg> msgs;
+  size_t max_sigs = 0;
+  for (const MessageState &state : message_states) {
+    auto it = by_address.find(state.address);
+    if (it == by_address.end()) {
+      shared_path.clear();  // it never will
+      return false;
+    }
+    const CANShareMsg &m = table->msgs[it->second];
+    SharedMsg sm = {.msg = it->second, .seq = 0};
+    for (const Signal &sig : state.parse_sigs) {
+      uint32_t j = 0;
+      while (j < m.num_sigs && strncmp(table->names[m.first_sig + j], sig.name, CAN_SHARE_NAME_LEN) != 0) j++;
+      if (j == m.num_sigs) {
+        shared_path.clear();
+        return false;
+      }
+      sm.values.push_back(m.first_sig + j);
+    }
+    max_sigs = std::max(max_sigs, sm.values.size());
+    msgs.push_back(std::move(sm));
+  }
+
+  shared = std::move(table);
+  shared_msgs = std::move(msgs);
+  shared_scratch.resize(max_sigs);
+  return true;
+}
+
+bool CANParser::UpdateShared(uint64_t sec) {
+  // canshared stopped, a new one writes a new table. Checked once a second,
+  // it's a syscall
+  if (shared && sec >= next_alive_check) {
+    next_alive_check = sec + 1000000000ULL;
+    if (!shared->writer_alive()) shared.reset();
+  }
+  if (!shared) {
+    if (shared_path.empty() || sec < next_attach) return false;
+    next_attach = sec + 1000000000ULL;
+    if (!attach_shared()) return false;
+    if (!shared->writer_alive()) {
+      shared.reset();
+      return false;
+    }
+    next_alive_check = sec + 1000000000ULL;
+  }
+
+  // the values of this very can, the writer reads the same one
+  if (shared->header->sec.load(std::memory_order_acquire) < sec) {
+    const auto deadline = std::chrono::steady_clock::now() + CAN_SHARE_WAIT;
+    while (shared->header->sec.load(std::memory_order_acquire) < sec) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      std::this_thread::yield();
+    }
+  }
+
+  for (size_t i = 0; i < message_states.size(); i++) {
+    SharedMsg &sm = shared_msgs[i];
+    const CANShareMsg &m = shared->msgs[sm.msg];
+
+    // a few tries when it's being written, it's the next update's otherwise
+    for (int tries = 0; tries < 3; tries++) {
+      const uint32_t seq = m.seq.load(std::memory_order_acquire);
+      if (seq == sm.seq) break;
+      if (seq & 1) continue;
+
+      for (size_t j = 0; j < sm.values.size(); j++) {
+        shared_scratch[j] = shared->values[sm.values[j]];
+      }
+      const uint64_t seen = m.seen;
+      const uint16_t ts = m.ts;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m.seq.load(std::memory_order_relaxed) != seq) continue;
+
+      MessageState &state = message_states[i];
+      std::copy(shared_scratch.begin(), shared_scratch.begin() + sm.values.size(), state.vals.begin());
+      // the writer can be an event ahead
+      state.seen = std::min(seen, sec);
+      state.ts = ts;
+      sm.seq = seq;
+      updated[i / 64] |= 1ULL << (i % 64);
+      break;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,199 @@
+// Checks the checksums in common.cc against the plain loops they replaced and
+// times both, run from opendbc/can.
+//
+//   checksum_bench [-n iterations]
+
+#include <getopt.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "opendbc/can/common.h"
+#include "selfdrive/common/timing.h"
+
+namespace ref {
+
+unsigned int honda_checksum(unsigned int address, uint64_t d, int l) {
+  d >>= ((8-l)*8);
+  d >>= 4;
+
+  int s = 0;
+  bool extended = address > 0x7FF;
+  while (address) { s += (address & 0xF); address >>= 4; }
+  while (d) { s += (d & 0xF); d >>= 4; }
+  s = 8-s;
+  if (extended) s += 3;
+  s &= 0xF;
+
+  return s;
+}
+
+unsigned int toyota_checksum(unsigned int address, uint64_t d, int l) {
+  d >>= ((8-l)*8);
+  d >>= 8;
+
+  unsigned int s = l;
+  while (address) { s += address & 0xFF; address >>= 8; }
+  while (d) { s += d & 0xFF; d >>= 8; }
+
+  return s & 0xFF;
+}
+
+unsigned int subaru_checksum(unsigned int address, uint64_t d, int l) {
+  d >>= ((8-l)*8);
+
+  unsigned int s = 0;
+  while (address) { s += address & 0xFF; address >>= 8; }
+  l -= 1;
+  while (l) { s += d & 0xFF; d >>= 8; l -= 1; }
+
+  return s & 0xFF;
+}
+
+unsigned int chrysler_checksum(unsigned int address, uint64_t d, int l) {
+  uint8_t checksum = 0xFF;
+  for (int j = 0; j < (l - 1); j++) {
+    uint8_t shift = 0x80;
+    uint8_t curr = (d >> 8*j) & 0xFF;
+    for (int i=0; i<8; i++) {
+      uint8_t bit_sum = curr & shift;
+      uint8_t temp_chk = checksum & 0x80U;
+      if (bit_sum != 0U) {
+        bit_sum = 0x1C;
+        if (temp_chk != 0U) {
+          bit_sum = 1;
+        }
+        checksum = checksum << 1;
+        temp_chk = checksum | 1U;
+        bit_sum ^= temp_chk;
+      } else {
+        if (temp_chk != 0U) {
+          bit_sum = 0x1D;
+        }
+        checksum = checksum << 1;
+        bit_sum ^= checksum;
+      }
+      checksum = bit_sum;
+      shift = shift >> 1;
+    }
+  }
+  return ~checksum & 0xFF;
+}
+
+// the CRC part of volkswagen_crc, before the padding byte, bit by bit
+unsigned int volkswagen_payload_crc(uint64_t d, int l) {
+  uint8_t crc = 0xFF;
+  for (int i = 1; i < l; i++) {
+    crc ^= (d >> (i*8)) & 0xFF;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x2F) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+unsigned int pedal_checksum(uint64_t d, int l) {
+  uint8_t crc = 0xFF;
+  uint8_t poly = 0xD5;
+
+  d >>= ((8-l)*8);
+  d >>= 8;
+
+  int i, j;
+  for (i = 0; i < l - 1; i++) {
+    crc ^= (d >> (i*8)) & 0xFF;
+    for (j = 0; j < 8; j++) {
+      if ((crc & 0x80) != 0) {
+        crc = (uint8_t)((crc << 1) ^ poly);
+      }
+      else {
+        crc <<= 1;
+      }
+    }
+  }
+  return crc;
+}
+
+}  // namespace ref
+
+struct Frame {
+  unsigned int address;
+  uint64_t d;
+  int l;
+};
+
+typedef std::function<unsigned int(const Frame &)> Checksum;
+
+static double time_ns(const std::vector<Frame> &frames, int iterations, const Checksum &f) {
+  volatile unsigned int sink = 0;
+  const double start = nanos_since_boot();
+  for (int n = 0; n < iterations; n++) {
+    for (const Frame &fr : frames) sink = sink + f(fr);
+  }
+  return (nanos_since_boot() - start) / ((double)iterations * frames.size());
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = 1000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt == 'n') {
+      iterations = atoi(optarg);
+    } else {
+      fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  init_crc_lookup_tables();
+
+  std::mt19937_64 rng(42);
+  std::vector<Frame> frames(4096);
+  for (Frame &f : frames) {
+    f.l = 1 + rng() % 8;
+    f.address = (rng() % 4) ? rng() % 0x800 : rng() % 0x20000000;
+    f.d = rng();
+  }
+
+  // volkswagen_crc xors in a padding byte by address before the last lookup,
+  // with address 0x86 it's constant so the payload CRC can be compared
+  const std::vector<std::pair<const char *, std::pair<Checksum, Checksum>>> checksums = {
+    {"honda", {[](const Frame &f) { return honda_checksum(f.address, f.d, f.l); },
+               [](const Frame &f) { return ref::honda_checksum(f.address, f.d, f.l); }}},
+    {"toyota", {[](const Frame &f) { return toyota_checksum(f.address, f.d, f.l); },
+                [](const Frame &f) { return ref::toyota_checksum(f.address, f.d, f.l); }}},
+    {"subaru", {[](const Frame &f) { return subaru_checksum(f.address, f.d, f.l); },
+                [](const Frame &f) { return ref::subaru_checksum(f.address, f.d, f.l); }}},
+    {"chrysler", {[](const Frame &f) { return chrysler_checksum(f.address, f.d, f.l); },
+                  [](const Frame &f) { return ref::chrysler_checksum(f.address, f.d, f.l); }}},
+    {"pedal", {[](const Frame &f) { return pedal_checksum(f.d, f.l); },
+               [](const Frame &f) { return ref::pedal_checksum(f.d, f.l); }}},
+    {"volkswagen", {[](const Frame &f) { return volkswagen_crc(0x86, f.d, f.l); },
+                    [](const Frame &f) {
+                      uint8_t crc = ref::volkswagen_payload_crc(f.d, f.l) ^ 0x86;
+                      for (int j = 0; j < 8; j++) {
+                        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x2F) : (uint8_t)(crc << 1);
+                      }
+                      return (unsigned int)(crc ^ 0xFF);
+                    }}},
+  };
+
+  int failed = 0;
+  printf("%-12s %10s %10s\n", "checksum", "ns", "ref ns");
+  for (const auto &c : checksums) {
+    for (const Frame &f : frames) {
+      if (c.second.first(f) != c.second.second(f)) {
+        printf("%s mismatch: address 0x%X, d 0x%016lX, l %d\n", c.first, f.address, (unsigned long)f.d, f.l);
+        failed++;
+        break;
+      }
+    }
+    printf("%-12s %10.2f %10.2f\n", c.first, time_ns(frames, iterations, c.second.first),
+           time_ns(frames, iterations, c.second.second));
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+// Times the CAN parser and packer on every DBC, run from opendbc/can.
+//
+//   parser_bench [-d dbc]... [-r rlog]... [-b bus] [-n iterations] [-e events] [-f frames]
+//
+// Without rlogs each DBC parses -e synthetic can events of -f frames of random
+// messages of it, packed with random values and valid counters and checksums.
+// With -r it's the can events of the logs on bus -b, for the DBCs given with -d.
+// The parser is CANParser with all signals: update_string (UpdateCans and
+// UpdateValid) and query_latest for each event, the packer packs every message
+// by signal names and with a pack plan. Allocations are counted through
+// operator new.
+
+#include <getopt.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "opendbc/can/common.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/loggerd/log_reader.h"
+
+static uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+struct Event {
+  std::string data;
+  size_t frames;
+};
+
+static std::string serialize(capnp::MallocMessageBuilder &msg) {
+  auto words = capnp::messageToFlatArray(msg);
+  auto bytes = words.asBytes();
+  return std::string(bytes.begin(), bytes.end());
+}
+
+static void load_log(const std::string &path, int bus, std::vector<Event> &events) {
+  std::vector<uint8_t> data = log_read_all(path);
+  kj::Array<capnp::word> words = kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+  memcpy(words.begin(), data.data(), words.size() * sizeof(capnp::word));
+
+  kj::ArrayPtr<const capnp::word> rest = words;
+  try {
+    while (rest.size() > 0) {
+      capnp::FlatArrayMessageReader msg(rest);
+      auto event = msg.getRoot<cereal::Event>();
+      if (event.isCan()) {
+        size_t frames = 0;
+        for (auto c : event.getCan()) frames += c.getSrc() == bus;
+        auto bytes = kj::arrayPtr(rest.begin(), msg.getEnd()).asBytes();
+        events.push_back({std::string(bytes.begin(), bytes.end()), frames});
+      }
+      rest = kj::arrayPtr(msg.getEnd(), rest.end());
+    }
+  } catch (const kj::Exception &e) {
+    fprintf(stderr, "%s: log data cut off: %s\n", path.c_str(), e.getDescription().cStr());
+  }
+}
+
+// a raw value that fits the signal, scaled
+static double random_value(const Signal &sig, std::mt19937_64 &rng) {
+  const int64_t raw = sig.b2 >= 63 ? (int64_t)(rng() >> 2) : (int64_t)(rng() % (1ULL << sig.b2));
+  const int64_t v = (sig.is_signed && sig.b2 < 64 && (raw >> (sig.b2 - 1))) ? raw - (1LL << sig.b2) : raw;
+  return v * sig.factor + sig.offset;
+}
+
+// the counters and checksums the packer fills in itself
+static bool packer_sets(const Signal &sig) {
+  return sig.type != SignalType::DEFAULT && sig.type != SignalType::PEDAL_COUNTER && sig.type != SignalType::PEDAL_CHECKSUM;
+}
+
+// the size of the COUNTER the packer takes a counter for, 0 without one
+static int counter_size(const Msg &m) {
+  for (int i = 0; i < m.num_sigs; i++) {
+    const Signal &sig = m.sigs[i];
+    if (strcmp(sig.name, "COUNTER") == 0 &&
+        (sig.type == SignalType::HONDA_COUNTER || sig.type == SignalType::VOLKSWAGEN_COUNTER)) {
+      return sig.b2;
+    }
+  }
+  return 0;
+}
+
+static std::vector<Event> synthetic_events(const DBC *dbc, CANPacker &packer, int num_events, int num_frames) {
+  std::mt19937_64 rng(42);
+  std::vector<int> counters(dbc->num_msgs, 0);
+  std::vector<Event> events;
+  for (int e = 0; e < num_events; e++) {
+    capnp::MallocMessageBuilder msg;
+    auto event = msg.initRoot<cereal::Event>();
+    event.setLogMonoTime(1000000000ULL + e * 10000000ULL);
+    auto can = event.initCan(num_frames);
+    for (int f = 0; f < num_frames; f++) {
+      const int m = rng() % dbc->num_msgs;
+      const Msg &dm = dbc->msgs[m];
+
+      // counters count up, checksums other than the pedal's are the packer's
+      const int count = counters[m]++;
+      std::vector<SignalPackValue> values;
+      for (int i = 0; i < dm.num_sigs; i++) {
+        const Signal &sig = dm.sigs[i];
+        if (sig.type == SignalType::PEDAL_COUNTER) {
+          values.push_back({sig.name, (double)(count % (1 << sig.b2))});
+        } else if (!packer_sets(sig)) {
+          values.push_back({sig.name, random_value(sig, rng)});
+        }
+      }
+      const int size = counter_size(dm);
+      std::vector<uint8_t> dat = packer.pack_vector(dm.address, values, size ? count % (1 << size) : -1);
+
+      can[f].setAddress(dm.address);
+      can[f].setBusTime(e * num_frames + f);
+      can[f].setSrc(0);
+      can[f].setDat(kj::arrayPtr(dat.data(), dat.size()));
+    }
+    events.push_back({serialize(msg), (size_t)num_frames});
+  }
+  return events;
+}
+
+static void bench_parser(const DBC *dbc, int bus, const std::vector<Event> &events, int iterations) {
+  CANParser parser(bus, dbc->name, false, false);
+  size_t frames = 0, values = 0;
+  double update_ns = 0, query_ns = 0;
+  uint64_t update_allocs = 0, query_allocs = 0;
+  for (int n = 0; n < iterations; n++) {
+    for (const Event &e : events) {
+      uint64_t a = allocations;
+      double t = nanos_since_boot();
+      parser.update_string(e.data, false);
+      update_ns += nanos_since_boot() - t;
+      update_allocs += allocations - a;
+
+      a = allocations;
+      t = nanos_since_boot();
+      values += parser.query_latest().size();
+      query_ns += nanos_since_boot() - t;
+      query_allocs += allocations - a;
+      frames += e.frames;
+    }
+  }
+  const double num_events = (double)iterations * events.size();
+  printf("%-50s parser  %10.0f frames/s %8.1f ns/frame %6.2f allocs/frame, "
+         "query_latest %8.1f ns/event %6.2f allocs/event %6.1f values/event\n",
+         dbc->name, frames / ((update_ns + query_ns) / 1e9), update_ns / frames, (double)update_allocs / frames,
+         query_ns / num_events, query_allocs / num_events, values / num_events);
+}
+
+static void bench_packer(const DBC *dbc, int iterations) {
+  CANPacker packer(dbc->name);
+  std::mt19937_64 rng(42);
+
+  struct Packed {
+    uint32_t address;
+    std::vector<SignalPackValue> values;
+    std::vector<double> plan_values;
+    int plan;
+    bool counter;
+  };
+  std::vector<Packed> msgs;
+  for (int m = 0; m < dbc->num_msgs; m++) {
+    const Msg &dm = dbc->msgs[m];
+    Packed p = {.address = dm.address, .counter = counter_size(dm) > 0};
+    std::vector<std::string> names;
+    for (int i = 0; i < dm.num_sigs; i++) {
+      if (packer_sets(dm.sigs[i])) continue;
+      p.values.push_back({dm.sigs[i].name, random_value(dm.sigs[i], rng)});
+      p.plan_values.push_back(p.values.back().value);
+      names.push_back(dm.sigs[i].name);
+    }
+    p.plan = packer.plan(dm.address, names);
+    msgs.push_back(std::move(p));
+  }
+
+  uint64_t sink = 0;
+  uint64_t allocations_start = allocations;
+  double start = nanos_since_boot();
+  for (int n = 0; n < iterations; n++) {
+    for (const Packed &p : msgs) sink += packer.pack_vector(p.address, p.values, p.counter ? n % 4 : -1).size();
+  }
+  const double names_ns = (nanos_since_boot() - start) / ((double)iterations * msgs.size());
+  const double names_allocs = (double)(allocations - allocations_start) / ((double)iterations * msgs.size());
+
+  allocations_start = allocations;
+  start = nanos_since_boot();
+  for (int n = 0; n < iterations; n++) {
+    for (const Packed &p : msgs) sink += packer.pack_plan_vector(p.plan, p.plan_values.data(), p.counter ? n % 4 : -1).size();
+  }
+  const double plan_ns = (nanos_since_boot() - start) / ((double)iterations * msgs.size());
+  const double plan_allocs = (double)(allocations - allocations_start) / ((double)iterations * msgs.size());
+
+  printf("%-50s packer  %8.1f ns/msg %6.2f allocs/msg by name, %8.1f ns/msg %6.2f allocs/msg with a plan (%lu)\n",
+         dbc->name, names_ns, names_allocs, plan_ns, plan_allocs, (unsigned long)(sink & 1));
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> dbc_names, logs;
+  int bus = 0, iterations = 20, num_events = 100, num_frames = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:r:b:n:e:f:")) != -1) {
+    switch (opt) {
+      case 'd': dbc_names.push_back(optarg); break;
+      case 'r': logs.push_back(optarg); break;
+      case 'b': bus = atoi(optarg); break;
+      case 'n': iterations = atoi(optarg); break;
+      case 'e': num_events = atoi(optarg); break;
+      case 'f': num_frames = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-d dbc]... [-r rlog]... [-b bus] [-n iterations] [-e events] [-f frames]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<const DBC *> dbcs;
+  for (const std::string &name : dbc_names) {
+    const DBC *dbc = dbc_lookup(name);
+    if (!dbc) {
+      fprintf(stderr, "no DBC %s\n", name.c_str());
+      return 1;
+    }
+    dbcs.push_back(dbc);
+  }
+  if (dbcs.empty()) {
+    if (!logs.empty()) {
+      fprintf(stderr, "-r needs the DBCs of the car with -d\n");
+      return 1;
+    }
+    dbcs = get_dbcs();
+  }
+
+  std::vector<Event> log_events;
+  for (const std::string &path : logs) load_log(path, bus, log_events);
+  if (!logs.empty() && log_events.empty()) {
+    fprintf(stderr, "no can events in the logs\n");
+    return 1;
+  }
+
+  for (const DBC *dbc : dbcs) {
+    if (dbc->num_msgs == 0) continue;
+    if (logs.empty()) {
+      CANPacker packer(dbc->name);
+      bench_parser(dbc, 0, synthetic_events(dbc, packer, num_events, num_frames), iterations);
+    } else {
+      bench_parser(dbc, bus, log_events, iterations);
+    }
+    bench_packer(dbc, iterations * 100);
+  }
+  return 0;
+}
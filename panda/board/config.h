@@ -33,6 +33,8 @@
    (_a > 0) ? _a : (-_a); })
 
 #define MAX_RESP_LEN 0x40U
+// control reads of more than a packet, the GPS UART ones
+#define MAX_EP0_RESP_LEN 0x400U
 
 #define GET_BUS(msg) (((msg)->RDTR >> 4) & 0xFF)
 #define GET_LEN(msg) ((msg)->RDTR & 0xF)
@@ -63,8 +63,22 @@ void can_set_gmlan(uint8_t bus) {
   }
 }
 
+void can_health_controller(uint8_t can_number, struct can_health_t *health) {
+  uint32_t esr = CANIF_FROM_CAN_NUM(can_number)->ESR;
+  health->bus_off = ((esr & CAN_ESR_BOFF) != 0U) ? 1U : 0U;
+  health->error_passive = ((esr & CAN_ESR_EPVF) != 0U) ? 1U : 0U;
+  health->error_warning = ((esr & CAN_ESR_EWGF) != 0U) ? 1U : 0U;
+  health->last_error = (esr >> CAN_ESR_LEC_Pos) & 0x7U;
+  health->transmit_error_cnt = (esr >> CAN_ESR_TEC_Pos) & 0xFFU;
+  health->receive_error_cnt = (esr >> CAN_ESR_REC_Pos) & 0xFFU;
+}
+
+// bus off as of the last error interrupt, to count the times it went there
+bool can_bus_off_last[CAN_MAX] = {false, false, false};
+
 // CAN error
-void can_sce(CAN_TypeDef *CAN) {
+void can_sce(uint8_t can_number) {
+  CAN_TypeDef *CAN = CANIF_FROM_CAN_NUM(can_number);
   ENTER_CRITICAL();
 
   #ifdef DEBUG
@@ -87,6 +101,12 @@ void can_sce(CAN_TypeDef *CAN) {
   #endif
 
   can_err_cnt += 1;
+  can_error_cnt[can_number] += 1U;
+  bool bus_off = (CAN->ESR & CAN_ESR_BOFF) != 0U;
+  if (bus_off && !can_bus_off_last[can_number]) {
+    can_bus_off_cnt[can_number] += 1U;
+  }
+  can_bus_off_last[can_number] = bus_off;
   llcan_clear_send(CAN);
   EXIT_CRITICAL();
 }
@@ -110,7 +130,7 @@ void process_can(uint8_t can_number) {
         if ((CAN->TSR & CAN_TSR_TXOK0) == CAN_TSR_TXOK0) {
           CAN_FIFOMailBox_TypeDef to_push;
           to_push.RIR = CAN->sTxMailBox[0].TIR;
-          to_push.RDTR = (CAN->sTxMailBox[0].TDTR & 0xFFFF000FU) | ((CAN_BUS_RET_FLAG | bus_number) << 4);
+          to_push.RDTR = (CAN->sTxMailBox[0].TDTR & 0xFU) | ((CAN_BUS_RET_FLAG | bus_number) << 4) | CAN_TIMESTAMP();
           to_push.RDLR = CAN->sTxMailBox[0].TDLR;
           to_push.RDHR = CAN->sTxMailBox[0].TDHR;
           can_send_errs += can_push(&can_rx_q, &to_push) ? 0U : 1U;
@@ -133,7 +153,7 @@ void process_can(uint8_t can_number) {
         CAN->TSR |= CAN_TSR_RQCP0;
       }
 
-      if (can_pop(can_queues[bus_number], &to_send)) {
+      if (can_pop_tx(bus_number, &to_send, NULL)) {
         can_tx_cnt += 1;
         // only send if we have received a packet
         CAN->sTxMailBox[0].TDLR = to_send.RDLR;
@@ -170,7 +190,7 @@ void can_rx(uint8_t can_number) {
     to_push.RDHR = CAN->sFIFOMailBox[0].RDHR;
 
     // modify RDTR for our API
-    to_push.RDTR = (to_push.RDTR & 0xFFFF000F) | (bus_number << 4);
+    to_push.RDTR = (to_push.RDTR & 0xFU) | (bus_number << 4) | CAN_TIMESTAMP();
 
     // forwarding (panda only)
     int bus_fwd_num = (can_forwarding[bus_number] != -1) ? can_forwarding[bus_number] : safety_fwd_hook(bus_number, &to_push);
@@ -187,7 +207,9 @@ void can_rx(uint8_t can_number) {
     ignition_can_hook(&to_push);
 
     current_board->set_led(LED_BLUE, true);
-    can_send_errs += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    if (can_filter_rx(&to_push)) {
+      can_send_errs += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    }
 
     // next
     CAN->RF0R |= CAN_RF0R_RFOM0;
@@ -196,15 +218,19 @@ void can_rx(uint8_t can_number) {
 
 void CAN1_TX_IRQ_Handler(void) { process_can(0); }
 void CAN1_RX0_IRQ_Handler(void) { can_rx(0); }
-void CAN1_SCE_IRQ_Handler(void) { can_sce(CAN1); }
+void CAN1_SCE_IRQ_Handler(void) { can_sce(0); }
 
 void CAN2_TX_IRQ_Handler(void) { process_can(1); }
 void CAN2_RX0_IRQ_Handler(void) { can_rx(1); }
-void CAN2_SCE_IRQ_Handler(void) { can_sce(CAN2); }
+void CAN2_SCE_IRQ_Handler(void) { can_sce(1); }
 
 void CAN3_TX_IRQ_Handler(void) { process_can(2); }
 void CAN3_RX0_IRQ_Handler(void) { can_rx(2); }
-void CAN3_SCE_IRQ_Handler(void) { can_sce(CAN3); }
+void CAN3_SCE_IRQ_Handler(void) { can_sce(2); }
+
+bool can_set_filter(uint8_t can_number, const uint32_t ids[], uint16_t len) {
+  return llcan_set_filter(CANIF_FROM_CAN_NUM(can_number), ids, len);
+}
 
 bool can_init(uint8_t can_number) {
   bool ret = false;
@@ -223,6 +249,7 @@ bool can_init(uint8_t can_number) {
     CAN_TypeDef *CAN = CANIF_FROM_CAN_NUM(can_number);
     ret &= can_set_speed(can_number);
     ret &= llcan_init(CAN);
+    can_filter_hw_apply(can_number);
     // in case there are queued up messages
     process_can(can_number);
   }
@@ -3,13 +3,36 @@ typedef struct {
   volatile uint32_t r_ptr;
   uint32_t fifo_size;
   CAN_FIFOMailBox_TypeDef *elems;
+  uint8_t *fd_data;  // bytes 8 to 63 of CAN-FD frames, CANFD_EXT_LEN per element. NULL without CAN-FD
+  uint32_t max_used;  // most elements held since it was last reported
 } can_ring;
 
 #define CAN_BUS_RET_FLAG 0x80U
 #define CAN_BUS_NUM_MASK 0x7FU
 
+// CAN-FD frames are mailboxes with these flags in RDTR, next to the bus number.
+// The DLC in the low nibble goes up to 15 (64 bytes) for them
+#define CAN_FD_FLAG 0x1000U
+#define CAN_BRS_FLAG 0x2000U
+// Frames the host sends with CAN_PRIO_FLAG go through the priority queue of their
+// bus, which is emptied first. Each queue keeps the host's order, the car ports
+// rely on it for counters and multi-frame messages
+#define CAN_PRIO_FLAG 0x4000U
+#define CANFD_EXT_LEN 56U
+#define CANFD_MAX_LEN 64U
+
+const uint8_t dlc_to_len[] = {0U, 1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U, 12U, 16U, 20U, 24U, 32U, 48U, 64U};
+#define GET_FD_LEN(msg) ((((msg)->RDTR & CAN_FD_FLAG) != 0U) ? dlc_to_len[(msg)->RDTR & 0xFU] : MIN((msg)->RDTR & 0xFU, 8U))
+// words of data past the first 8 bytes
+#define GET_FD_EXT_WORDS(msg) ((GET_FD_LEN(msg) > 8U) ? ((GET_FD_LEN(msg) - 5U) / 4U) : 0U)
+
 #define BUS_MAX 4U
 
+// RDTR bits 16-31 of received and sent frames, when they were on the bus in 8 us
+// ticks of the microsecond timer. That's 524 ms before it wraps, the host reads
+// the whole timer with 0xfb to put them on its clock
+#define CAN_TIMESTAMP() (((microsecond_timer_get() >> 3) & 0xFFFFU) << 16)
+
 uint32_t can_rx_errs = 0;
 uint32_t can_send_errs = 0;
 uint32_t can_fwd_errs = 0;
@@ -37,23 +60,56 @@ int pending_can_live = 0;
 int can_loopback = 0;
 int can_silent = ALL_CAN_SILENT;
 
+// CAN controller state of one bus, for 0xc2
+// When changing this struct, boardd needs to be kept up to date!
+struct __attribute__((packed)) can_health_t {
+  uint32_t bus_off_cnt;         // times the controller went bus off
+  uint32_t error_cnt;           // error interrupts
+  uint32_t can_speed;           // in 100 bit/s, like can_speed
+  uint32_t can_data_speed;      // of the CAN-FD data phase, 0 without one
+  uint8_t bus_off;
+  uint8_t error_passive;
+  uint8_t error_warning;
+  uint8_t last_error;           // last error code of the controller
+  uint8_t transmit_error_cnt;
+  uint8_t receive_error_cnt;
+  uint16_t tx_q_max_used;       // most frames waiting to be sent since the last 0xc2
+  uint16_t tx_prio_q_max_used;  // of those with CAN_PRIO_FLAG
+};
+
 // ******************* functions prototypes *********************
 bool can_init(uint8_t can_number);
+bool can_set_filter(uint8_t can_number, const uint32_t ids[], uint16_t len);
 void process_can(uint8_t can_number);
+void can_health_controller(uint8_t can_number, struct can_health_t *health);
 
 // ********************* instantiate queues *********************
+#ifdef STM32H7
+// the FD payloads don't fit next to the queues in DTCM, they live in AXI SRAM
 #define can_buffer(x, size) \
   CAN_FIFOMailBox_TypeDef elems_##x[size]; \
-  can_ring can_##x = { .w_ptr = 0, .r_ptr = 0, .fifo_size = (size), .elems = (CAN_FIFOMailBox_TypeDef *)&(elems_##x) };
+  uint8_t fd_data_##x[(size) * CANFD_EXT_LEN] __attribute__((section(".axisram"))); \
+  can_ring can_##x = { .w_ptr = 0, .r_ptr = 0, .fifo_size = (size), .elems = (CAN_FIFOMailBox_TypeDef *)&(elems_##x), .fd_data = fd_data_##x, .max_used = 0U };
+#else
+#define can_buffer(x, size) \
+  CAN_FIFOMailBox_TypeDef elems_##x[size]; \
+  can_ring can_##x = { .w_ptr = 0, .r_ptr = 0, .fifo_size = (size), .elems = (CAN_FIFOMailBox_TypeDef *)&(elems_##x), .fd_data = NULL, .max_used = 0U };
+#endif
 
 can_buffer(rx_q, 0x1000)
 can_buffer(tx1_q, 0x100)
 can_buffer(tx2_q, 0x100)
 can_buffer(tx3_q, 0x100)
 can_buffer(txgmlan_q, 0x100)
+can_buffer(tx1_prio_q, 0x40)
+can_buffer(tx2_prio_q, 0x40)
+can_buffer(tx3_prio_q, 0x40)
+can_buffer(txgmlan_prio_q, 0x40)
 // FIXME:
 // cppcheck-suppress misra-c2012-9.3
 can_ring *can_queues[] = {&can_tx1_q, &can_tx2_q, &can_tx3_q, &can_txgmlan_q};
+// cppcheck-suppress misra-c2012-9.3
+can_ring *can_prio_queues[] = {&can_tx1_prio_q, &can_tx2_prio_q, &can_tx3_prio_q, &can_txgmlan_prio_q};
 
 // global CAN stats
 int can_rx_cnt = 0;
@@ -63,12 +119,17 @@ int can_err_cnt = 0;
 int can_overflow_cnt = 0;
 
 // ********************* interrupt safe queue *********************
-bool can_pop(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
+// fd_data gets bytes 8 to 63 of a CAN-FD frame, it may be NULL for queues
+// that only see classic frames
+bool can_pop_fd(can_ring *q, CAN_FIFOMailBox_TypeDef *elem, uint8_t *fd_data) {
   bool ret = 0;
 
   ENTER_CRITICAL();
   if (q->w_ptr != q->r_ptr) {
     *elem = q->elems[q->r_ptr];
+    if ((fd_data != NULL) && (q->fd_data != NULL) && ((elem->RDTR & CAN_FD_FLAG) != 0U)) {
+      (void)memcpy(fd_data, &q->fd_data[q->r_ptr * CANFD_EXT_LEN], CANFD_EXT_LEN);
+    }
     if ((q->r_ptr + 1U) == q->fifo_size) {
       q->r_ptr = 0;
     } else {
@@ -81,7 +142,20 @@ bool can_pop(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
   return ret;
 }
 
-bool can_push(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
+bool can_pop(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
+  return can_pop_fd(q, elem, NULL);
+}
+
+// next frame to send on a bus, priority queue first
+bool can_pop_tx(uint8_t bus_number, CAN_FIFOMailBox_TypeDef *elem, uint8_t *fd_data) {
+  bool ret = can_pop_fd(can_prio_queues[bus_number], elem, fd_data);
+  if (!ret) {
+    ret = can_pop_fd(can_queues[bus_number], elem, fd_data);
+  }
+  return ret;
+}
+
+bool can_push_fd(can_ring *q, CAN_FIFOMailBox_TypeDef *elem, const uint8_t *fd_data) {
   bool ret = false;
   uint32_t next_w_ptr;
 
@@ -93,10 +167,20 @@ bool can_push(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
   }
   if (next_w_ptr != q->r_ptr) {
     q->elems[q->w_ptr] = *elem;
+    if ((fd_data != NULL) && (q->fd_data != NULL)) {
+      (void)memcpy(&q->fd_data[q->w_ptr * CANFD_EXT_LEN], fd_data, CANFD_EXT_LEN);
+    }
     q->w_ptr = next_w_ptr;
     ret = true;
+    uint32_t used = (next_w_ptr >= q->r_ptr) ? (next_w_ptr - q->r_ptr) : (q->fifo_size - q->r_ptr + next_w_ptr);
+    q->max_used = MAX(q->max_used, used);
   }
   EXIT_CRITICAL();
+  #ifdef ENABLE_SPI
+    if (ret && (q == &can_rx_q)) {
+      spi_irq_update();
+    }
+  #endif
   if (!ret) {
     can_overflow_cnt++;
     #ifdef DEBUG
@@ -106,6 +190,10 @@ bool can_push(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
   return ret;
 }
 
+bool can_push(can_ring *q, CAN_FIFOMailBox_TypeDef *elem) {
+  return can_push_fd(q, elem, NULL);
+}
+
 uint32_t can_slots_empty(can_ring *q) {
   uint32_t ret = 0;
 
@@ -127,6 +215,15 @@ void can_clear(can_ring *q) {
   EXIT_CRITICAL();
 }
 
+// returns the most elements q held since the last call
+uint32_t can_take_max_used(can_ring *q) {
+  ENTER_CRITICAL();
+  uint32_t ret = q->max_used;
+  q->max_used = 0U;
+  EXIT_CRITICAL();
+  return ret;
+}
+
 // assign CAN numbering
 // bus num: Can bus number on ODB connector. Sent to/from USB
 //    Min: 0; Max: 127; Bit 7 marks message as receipt (bus 129 is receipt for but 1)
@@ -145,19 +242,86 @@ uint32_t can_speed[] = {5000, 5000, 5000, 333};
 uint32_t can_data_speed[] = {5000, 5000, 5000}; //For CAN FD with BRS only
 #define CAN_MAX 3U
 
+// errors of each CAN controller, by can number
+uint32_t can_bus_off_cnt[CAN_MAX] = {0U, 0U, 0U};
+uint32_t can_error_cnt[CAN_MAX] = {0U, 0U, 0U};
+
 #define CANIF_FROM_CAN_NUM(num) (cans[num])
 #define BUS_NUM_FROM_CAN_NUM(num) (bus_lookup[num])
 #define CAN_NUM_FROM_BUS_NUM(num) (can_num_lookup[num])
 
+void can_health_get(uint8_t bus_number, struct can_health_t *health) {
+  (void)memset(health, 0, sizeof(struct can_health_t));
+  health->can_speed = can_speed[bus_number];
+  if (bus_number < BUS_MAX) {
+    health->tx_q_max_used = (uint16_t)can_take_max_used(can_queues[bus_number]);
+    health->tx_prio_q_max_used = (uint16_t)can_take_max_used(can_prio_queues[bus_number]);
+  }
+  uint8_t can_number = CAN_NUM_FROM_BUS_NUM(bus_number);
+  if (can_number < CAN_MAX) {
+    #ifdef STM32H7
+      health->can_data_speed = can_data_speed[bus_number];
+    #endif
+    health->bus_off_cnt = can_bus_off_cnt[can_number];
+    health->error_cnt = can_error_cnt[can_number];
+    can_health_controller(can_number, health);
+  }
+}
+
 void can_init_all(void) {
   bool ret = true;
   for (uint8_t i=0U; i < CAN_MAX; i++) {
     can_clear(can_queues[i]);
+    can_clear(can_prio_queues[i]);
     ret &= can_init(i);
   }
   UNUSED(ret);
 }
 
+// The safety model reads bus 0 and the buses of its rx checks, all of them, and forwarded
+// buses must get every frame. Forwarding hooks only block a few addresses, one probe does
+bool can_bus_needs_all(uint8_t bus_number) {
+  bool ret = (bus_number == 0U) || (can_forwarding[bus_number] != -1);
+
+  CAN_FIFOMailBox_TypeDef probe = {.RIR = 0U, .RDTR = (uint32_t)bus_number << 4, .RDLR = 0U, .RDHR = 0U};
+  ret = ret || (safety_fwd_hook(bus_number, &probe) != -1);
+
+  for (int i = 0; i < current_rx_checks->len; i++) {
+    for (int j = 0; current_rx_checks->check[i].msg[j].addr != 0; j++) {
+      ret = ret || (current_rx_checks->check[i].msg[j].bus == (int)bus_number);
+    }
+  }
+  return ret;
+}
+
+// Programs the ID filters of a CAN controller from the host's table, see can_filter.h
+void can_filter_hw_apply(uint8_t can_number) {
+  uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
+  uint32_t ids[128];
+  uint16_t len = 0U;
+  bool filtered = can_filter_hw && can_filter_enabled && !can_bus_needs_all(bus_number);
+
+  for (uint16_t i = 0U; filtered && (i < can_filter_len); i++) {
+    if ((can_filter[i].key >> 29) == bus_number) {
+      if (len < (sizeof(ids) / sizeof(ids[0]))) {
+        ids[len] = can_filter[i].key & 0x1FFFFFFFU;
+        len++;
+      } else {
+        filtered = false;
+      }
+    }
+  }
+  if (!can_set_filter(can_number, filtered ? ids : NULL, len)) {
+    puts("CAN filter: too many messages on bus "); puth2(bus_number); puts(" for the controller\n");
+  }
+}
+
+void can_filter_hw_update(void) {
+  for (uint8_t i = 0U; i < CAN_MAX; i++) {
+    can_filter_hw_apply(i);
+  }
+}
+
 void can_flip_buses(uint8_t bus1, uint8_t bus2){
   bus_lookup[bus1] = bus2;
   bus_lookup[bus2] = bus1;
@@ -198,25 +362,46 @@ bool can_tx_check_min_slots_free(uint32_t min) {
     (can_slots_empty(&can_tx1_q) >= min) &&
     (can_slots_empty(&can_tx2_q) >= min) &&
     (can_slots_empty(&can_tx3_q) >= min) &&
-    (can_slots_empty(&can_txgmlan_q) >= min);
+    (can_slots_empty(&can_txgmlan_q) >= min) &&
+    (can_slots_empty(&can_tx1_prio_q) >= min) &&
+    (can_slots_empty(&can_tx2_prio_q) >= min) &&
+    (can_slots_empty(&can_tx3_prio_q) >= min) &&
+    (can_slots_empty(&can_txgmlan_prio_q) >= min);
 }
 
-void can_send(CAN_FIFOMailBox_TypeDef *to_push, uint8_t bus_number, bool skip_tx_hook) {
+// fd_data is bytes 8 to 63 of a CAN-FD frame, NULL for classic ones. Safety
+// sees the first 8 bytes of FD frames, boards without CAN-FD drop them
+void can_send_fd(CAN_FIFOMailBox_TypeDef *to_push, const uint8_t *fd_data, uint8_t bus_number, bool skip_tx_hook) {
   if (skip_tx_hook || safety_tx_hook(to_push) != 0) {
     if (bus_number < BUS_MAX) {
+      can_ring *q = ((to_push->RDTR & CAN_PRIO_FLAG) != 0U) ? can_prio_queues[bus_number] : can_queues[bus_number];
       // add CAN packet to send queue
       // bus number isn't passed through
-      to_push->RDTR &= 0xF;
-      if ((bus_number == 3U) && (can_num_lookup[3] == 0xFFU)) {
+      to_push->RDTR &= (0xFU | CAN_FD_FLAG | CAN_BRS_FLAG);
+      if ((to_push->RDTR & CAN_FD_FLAG) != 0U) {
+        if ((q->fd_data != NULL) && ((GET_FD_LEN(to_push) <= 8U) || (fd_data != NULL))) {
+          can_fwd_errs += can_push_fd(q, to_push, fd_data) ? 0U : 1U;
+          process_can(CAN_NUM_FROM_BUS_NUM(bus_number));
+        } else {
+          can_fwd_errs += 1U;
+        }
+      } else if ((bus_number == 3U) && (can_num_lookup[3] == 0xFFU)) {
         gmlan_send_errs += bitbang_gmlan(to_push) ? 0U : 1U;
       } else {
-        can_fwd_errs += can_push(can_queues[bus_number], to_push) ? 0U : 1U;
+        can_fwd_errs += can_push(q, to_push) ? 0U : 1U;
         process_can(CAN_NUM_FROM_BUS_NUM(bus_number));
       }
     }
   }
 }
 
+void can_send(CAN_FIFOMailBox_TypeDef *to_push, uint8_t bus_number, bool skip_tx_hook) {
+  can_send_fd(to_push, NULL, bus_number, skip_tx_hook);
+}
+
 void can_set_forwarding(int from, int to) {
   can_forwarding[from] = to;
+  if (can_filter_hw) {
+    can_filter_hw_update();
+  }
 }
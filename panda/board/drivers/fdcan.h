@@ -35,6 +35,19 @@ void cycle_transceiver(uint8_t can_number) {
   puts("Cycled transceiver number: "); puth(transceiver_number); puts("\n");
 }
 
+void can_health_controller(uint8_t can_number, struct can_health_t *health) {
+  FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
+  // the last error code reads back as "no change" after this
+  uint32_t psr = CANx->PSR;
+  uint32_t ecr = CANx->ECR;
+  health->bus_off = ((psr & FDCAN_PSR_BO) != 0U) ? 1U : 0U;
+  health->error_passive = ((psr & FDCAN_PSR_EP) != 0U) ? 1U : 0U;
+  health->error_warning = ((psr & FDCAN_PSR_EW) != 0U) ? 1U : 0U;
+  health->last_error = (psr >> FDCAN_PSR_LEC_Pos) & 0x7U;
+  health->transmit_error_cnt = (ecr >> FDCAN_ECR_TEC_Pos) & 0xFFU;
+  health->receive_error_cnt = (ecr >> FDCAN_ECR_REC_Pos) & 0x7FU;
+}
+
 // ***************************** CAN *****************************
 void process_can(uint8_t can_number) {
   if (can_number != 0xffU) {
@@ -47,7 +60,8 @@ void process_can(uint8_t can_number) {
 
     if ((CANx->TXFQS & FDCAN_TXFQS_TFQF) == 0) {
       CAN_FIFOMailBox_TypeDef to_send;
-      if (can_pop(can_queues[bus_number], &to_send)) {
+      uint32_t fd_data[CANFD_EXT_LEN / 4U];
+      if (can_pop_tx(bus_number, &to_send, (uint8_t *)fd_data)) {
         can_tx_cnt += 1;
         uint32_t TxFIFOSA = FDCAN_START_ADDRESS + (can_number * FDCAN_OFFSET) + (FDCAN_RX_FIFO_0_EL_CNT * FDCAN_RX_FIFO_0_EL_SIZE);
         uint8_t tx_index = (CANx->TXFQS >> FDCAN_TXFQS_TFQPI_Pos) & 0x1F;
@@ -57,11 +71,16 @@ void process_can(uint8_t can_number) {
 
         // Convert from "mailbox type"
         fifo->RIR = ((to_send.RIR & 0x6) << 28) | (to_send.RIR >> 3);  // identifier format and frame type | identifier
-        //REDEBUG: enable CAN FD and BRS for test purposes
-        //fifo->RDTR = ((to_send.RDTR & 0xF) << 16) | ((to_send.RDTR) >> 16) | (1U << 21) | (1U << 20); // DLC (length) | timestamp | enable CAN FD | enable BRS
-        fifo->RDTR = ((to_send.RDTR & 0xF) << 16) | ((to_send.RDTR) >> 16); // DLC (length) | timestamp
+        bool fd = (to_send.RDTR & CAN_FD_FLAG) != 0U;
+        bool brs = (to_send.RDTR & CAN_BRS_FLAG) != 0U;
+        fifo->RDTR = ((to_send.RDTR & 0xF) << 16) | ((fd ? 1U : 0U) << 21) | ((brs ? 1U : 0U) << 20); // DLC (length) | CAN FD | BRS
         fifo->RDLR = to_send.RDLR;
         fifo->RDHR = to_send.RDHR;
+        // message RAM takes words, the rest of the data follows the first 8 bytes
+        volatile uint32_t *fifo_fd_data = &((volatile uint32_t *)fifo)[4];
+        for (uint32_t i = 0U; fd && (i < GET_FD_EXT_WORDS(&to_send)); i++) {
+          fifo_fd_data[i] = fd_data[i];
+        }
         
         CANx->TXBAR = (1UL << tx_index); 
 
@@ -69,10 +88,10 @@ void process_can(uint8_t can_number) {
         can_txd_cnt += 1;
         CAN_FIFOMailBox_TypeDef to_push;
         to_push.RIR = to_send.RIR;
-        to_push.RDTR = (to_send.RDTR & 0xFFFF000FU) | ((CAN_BUS_RET_FLAG | bus_number) << 4);
+        to_push.RDTR = (to_send.RDTR & (0xFU | CAN_FD_FLAG | CAN_BRS_FLAG)) | ((CAN_BUS_RET_FLAG | bus_number) << 4) | CAN_TIMESTAMP();
         to_push.RDLR = to_send.RDLR;
         to_push.RDHR = to_send.RDHR;
-        can_send_errs += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+        can_send_errs += can_push_fd(&can_rx_q, &to_push, fd ? (uint8_t *)fd_data : NULL) ? 0U : 1U;
 
         if (can_tx_check_min_slots_free(MAX_CAN_MSGS_PER_BULK_TRANSFER)) {
           usb_outep3_resume_if_paused();
@@ -83,6 +102,7 @@ void process_can(uint8_t can_number) {
     // Recover after Bus-off state
     if (((CANx->PSR & FDCAN_PSR_BO) != 0) && ((CANx->CCCR & FDCAN_CCCR_INIT) != 0)) {
       bus_off_err[can_number] += 1U;
+      can_bus_off_cnt[can_number] += 1U;
       puts("CAN is in Bus_Off state! Resetting... CAN number: "); puth(can_number); puts("\n");
       if (bus_off_err[can_number] > BUS_OFF_FAIL_LIMIT) {
         cycle_transceiver(can_number);
@@ -133,12 +153,19 @@ void can_rx(uint8_t can_number) {
 
       // Need to convert real CAN frame format to mailbox "type"
       to_push.RIR = ((fifo->RIR >> 28) & 0x6) | (fifo->RIR << 3); // identifier format and frame type | identifier
-      to_push.RDTR = ((fifo->RDTR >> 16) & 0xF) | (fifo->RDTR << 16); // DLC (length) | timestamp
+      to_push.RDTR = ((fifo->RDTR >> 16) & 0xF) | CAN_TIMESTAMP(); // DLC (length) | timestamp
+      to_push.RDTR |= (((fifo->RDTR >> 21) & 0x1U) != 0U) ? CAN_FD_FLAG : 0U;
+      to_push.RDTR |= (((fifo->RDTR >> 20) & 0x1U) != 0U) ? CAN_BRS_FLAG : 0U;
       to_push.RDLR = fifo->RDLR;
       to_push.RDHR = fifo->RDHR;
+      uint32_t fd_data[CANFD_EXT_LEN / 4U] = {0};
+      volatile uint32_t *fifo_fd_data = &((volatile uint32_t *)fifo)[4];
+      for (uint32_t i = 0U; i < GET_FD_EXT_WORDS(&to_push); i++) {
+        fd_data[i] = fifo_fd_data[i];
+      }
 
       // modify RDTR for our API
-      to_push.RDTR = (to_push.RDTR & 0xFFFF000F) | (bus_number << 4);
+      to_push.RDTR = (to_push.RDTR & (0xFFFF000FU | CAN_FD_FLAG | CAN_BRS_FLAG)) | (bus_number << 4);
 
       // forwarding (panda only)
       int bus_fwd_num = (can_forwarding[bus_number] != -1) ? can_forwarding[bus_number] : safety_fwd_hook(bus_number, &to_push);
@@ -148,14 +175,16 @@ void can_rx(uint8_t can_number) {
         to_send.RDTR = to_push.RDTR;
         to_send.RDLR = to_push.RDLR;
         to_send.RDHR = to_push.RDHR;
-        can_send(&to_send, bus_fwd_num, true);
+        can_send_fd(&to_send, (uint8_t *)fd_data, bus_fwd_num, true);
       }
 
       can_rx_errs += safety_rx_hook(&to_push) ? 0U : 1U;
       ignition_can_hook(&to_push);
 
       current_board->set_led(LED_BLUE, true);
-      can_send_errs += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+      if (can_filter_rx(&to_push)) {
+        can_send_errs += can_push_fd(&can_rx_q, &to_push, (uint8_t *)fd_data) ? 0U : 1U;
+      }
 
       // update read index 
       CANx->RXF0A = rx_fifo_idx;
@@ -167,6 +196,7 @@ void can_rx(uint8_t can_number) {
     #endif
     CANx->IR |= (FDCAN_IR_PEA | FDCAN_IR_PED | FDCAN_IR_RF0L | FDCAN_IR_RF0F | FDCAN_IR_EW | FDCAN_IR_MRAF | FDCAN_IR_TOO); // Clean all error flags
     can_err_cnt += 1;
+    can_error_cnt[can_number] += 1U;
   } else { 
     
   }
@@ -182,6 +212,10 @@ void FDCAN2_IT1_IRQ_Handler(void) { process_can(1); }
 void FDCAN3_IT0_IRQ_Handler(void) { can_rx(2);  }
 void FDCAN3_IT1_IRQ_Handler(void) { process_can(2); }
 
+bool can_set_filter(uint8_t can_number, const uint32_t ids[], uint16_t len) {
+  return llcan_set_filter(CANIF_FROM_CAN_NUM(can_number), ids, len);
+}
+
 bool can_init(uint8_t can_number) {
   bool ret = false;
 
@@ -196,6 +230,7 @@ bool can_init(uint8_t can_number) {
     FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
     ret &= can_set_speed(can_number);
     ret &= llcan_init(CANx);
+    can_filter_hw_apply(can_number);
     // in case there are queued up messages
     process_can(can_number);
   }
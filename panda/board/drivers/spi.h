@@ -0,0 +1,174 @@
+// Panda host protocol on SPI, for a host that's wired to the panda instead of on USB.
+// The host is the master, every step of a transaction is a chip select of its own:
+//   1. header: SPI_SYNC, endpoint, tx_len (u16), max_rx_len (u16), xor checksum of them
+//   2. one byte reads until SPI_ACK, SPI_NACK for a bad header
+//   3. tx_len bytes of data, then their xor checksum
+//   4. one byte reads until SPI_ACK, SPI_NACK for a bad checksum or a full CAN tx queue
+//   5. rx_len (u16), rx_len bytes of data, then the xor checksum of both
+// The u16s are little endian. Endpoints are the USB ones: 0 control with the setup
+// packet as data, 1 CAN in, 2 serial out, 3 CAN out.
+// A transaction the host gave up on is dropped by the tick, see spi_tick
+
+#define SPI_SYNC 0x5AU
+#define SPI_ACK 0x79U
+#define SPI_NACK 0x1FU
+
+#define SPI_HEADER_LEN 7U
+#define SPI_BUF_SIZE 0x1000U
+
+#define SPI_STATE_HEADER 0U
+#define SPI_STATE_HEADER_ACK 1U
+#define SPI_STATE_HEADER_NACK 2U
+#define SPI_STATE_DATA 3U
+#define SPI_STATE_RESPONSE 4U
+
+// DMA can't get to the DTCM, the rest of the RAM. The data starts word aligned
+// for the USB callbacks, the response after a byte of padding and its 3 byte head
+uint8_t spi_buf_rx[SPI_BUF_SIZE + 4U] __attribute__((section(".axisram"), aligned(4)));
+uint8_t spi_buf_tx[SPI_BUF_SIZE + 5U] __attribute__((section(".axisram"), aligned(4)));
+
+uint8_t spi_state = SPI_STATE_HEADER;
+uint8_t spi_endpoint = 0U;
+uint16_t spi_data_len = 0U;
+uint16_t spi_max_rx_len = 0U;
+// steps done, for the tick to see the ones that stall
+uint32_t spi_steps = 0U;
+uint32_t spi_tick_steps = 0U;
+
+uint8_t spi_checksum(const uint8_t *data, uint16_t len) {
+  uint8_t sum = 0U;
+  for (uint16_t i = 0U; i < len; i++) {
+    sum ^= data[i];
+  }
+  return sum;
+}
+
+void spi_irq_update(void) {
+  // low while there's CAN for the host to read
+  bool empty;
+  ENTER_CRITICAL();
+  empty = (can_rx_q.r_ptr == can_rx_q.w_ptr) && (usb_can_in_pos == usb_can_in_len);
+  EXIT_CRITICAL();
+  set_gpio_output(SPI_IRQ_GPIO, SPI_IRQ_PIN, empty);
+}
+
+void spi_wait_header(void) {
+  spi_state = SPI_STATE_HEADER;
+  llspi_arm(spi_buf_rx, SPI_HEADER_LEN, NULL, 0U);
+}
+
+// a single byte for the host's one byte reads, then the next state
+void spi_reply_byte(uint8_t b, uint8_t state) {
+  spi_buf_tx[0] = b;
+  spi_state = state;
+  llspi_arm(spi_buf_rx, 1U, spi_buf_tx, 1U);
+}
+
+void spi_handle_header(void) {
+  spi_endpoint = spi_buf_rx[1];
+  spi_data_len = (uint16_t)spi_buf_rx[2] | ((uint16_t)spi_buf_rx[3] << 8U);
+  spi_max_rx_len = MIN((uint16_t)spi_buf_rx[4] | ((uint16_t)spi_buf_rx[5] << 8U), (uint16_t)SPI_BUF_SIZE);
+
+  bool ok = (spi_buf_rx[0] == SPI_SYNC) && (spi_checksum(spi_buf_rx, SPI_HEADER_LEN - 1U) == spi_buf_rx[SPI_HEADER_LEN - 1U]);
+  ok = ok && (spi_endpoint <= 3U) && (spi_data_len <= SPI_BUF_SIZE);
+  spi_reply_byte(ok ? SPI_ACK : SPI_NACK, ok ? SPI_STATE_HEADER_ACK : SPI_STATE_HEADER_NACK);
+}
+
+void spi_handle_data(void) {
+  uint8_t *resp = &spi_buf_tx[4];
+  uint16_t resp_len = 0U;
+
+  bool ok = spi_checksum(spi_buf_rx, spi_data_len) == spi_buf_rx[spi_data_len];
+  if (ok) {
+    switch (spi_endpoint) {
+      case 0U:
+        if (spi_data_len == sizeof(USB_Setup_TypeDef)) {
+          USB_Setup_TypeDef setup;
+          (void)memcpy(&setup, spi_buf_rx, sizeof(setup));
+          int len = usb_cb_control_msg(&setup, resp, true);
+          resp_len = MIN((uint16_t)len, MIN(setup.b.wLength.w, spi_max_rx_len));
+        } else {
+          ok = false;
+        }
+        break;
+      case 1U:
+        // in the USB packet sizes the callback is made for
+        while (resp_len < spi_max_rx_len) {
+          int len = usb_cb_ep1_in(&resp[resp_len], MIN((uint32_t)spi_max_rx_len - resp_len, 0x40U), true);
+          if (len == 0) {
+            break;
+          }
+          resp_len += (uint16_t)len;
+        }
+        break;
+      case 2U:
+        usb_cb_ep2_out(spi_buf_rx, spi_data_len, true);
+        break;
+      case 3U:
+        // the host sends it again when the queues have room, packets are at least 16 bytes
+        ok = can_tx_check_min_slots_free(MAX(spi_data_len / 16U, 1U));
+        if (ok) {
+          usb_cb_ep3_out(spi_buf_rx, spi_data_len, true);
+        }
+        break;
+      default:
+        ok = false;
+        break;
+    }
+  }
+
+  spi_state = SPI_STATE_RESPONSE;
+  if (ok) {
+    spi_buf_tx[1] = SPI_ACK;
+    spi_buf_tx[2] = resp_len & 0xFFU;
+    spi_buf_tx[3] = (resp_len >> 8U) & 0xFFU;
+    resp[resp_len] = spi_checksum(&spi_buf_tx[2], resp_len + 2U);
+    llspi_arm(spi_buf_rx, resp_len + 4U, &spi_buf_tx[1], resp_len + 4U);
+  } else {
+    spi_buf_tx[1] = SPI_NACK;
+    llspi_arm(spi_buf_rx, 1U, &spi_buf_tx[1], 1U);
+  }
+
+  if (spi_endpoint == 1U) {
+    spi_irq_update();
+  }
+}
+
+// from the RX DMA, the host clocked all of the current step
+void spi_rx_done(void) {
+  spi_steps++;
+  switch (spi_state) {
+    case SPI_STATE_HEADER:
+      spi_handle_header();
+      break;
+    case SPI_STATE_HEADER_ACK:
+      spi_state = SPI_STATE_DATA;
+      llspi_arm(spi_buf_rx, spi_data_len + 1U, NULL, 0U);
+      break;
+    case SPI_STATE_DATA:
+      spi_handle_data();
+      break;
+    default:
+      // the NACK or the response went out
+      spi_wait_header();
+      break;
+  }
+}
+
+// 8Hz. A transaction that didn't move since the last tick was given up on,
+// the host waits for this before it starts over
+void spi_tick(void) {
+  ENTER_CRITICAL();
+  bool idle = (spi_state == SPI_STATE_HEADER) && (llspi_rx_remaining() == SPI_HEADER_LEN);
+  if (!idle && (spi_steps == spi_tick_steps)) {
+    spi_wait_header();
+  }
+  spi_tick_steps = spi_steps;
+  EXIT_CRITICAL();
+}
+
+void spi_init(void) {
+  llspi_init();
+  spi_wait_header();
+  spi_irq_update();
+}
@@ -2,7 +2,7 @@
 
 // ***************************** Definitions *****************************
 #define FIFO_SIZE_INT 0x400U
-#define FIFO_SIZE_DMA 0x1000U
+#define FIFO_SIZE_DMA 0x2000U
 
 typedef struct uart_ring {
   volatile uint16_t w_ptr_tx;
@@ -90,6 +90,14 @@ bool getc(uart_ring *q, char *elem) {
   return ret;
 }
 
+uint16_t uart_rx_available(uart_ring *q) {
+  uint16_t ret;
+  ENTER_CRITICAL();
+  ret = (q->w_ptr_rx + q->rx_fifo_size - q->r_ptr_rx) % q->rx_fifo_size;
+  EXIT_CRITICAL();
+  return ret;
+}
+
 bool injectc(uart_ring *q, char elem) {
   int ret = false;
   uint16_t next_w_ptr;
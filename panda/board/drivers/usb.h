@@ -86,7 +86,8 @@ void usb_outep3_resume_if_paused(void);
 #define STS_SETUP_COMP                         4
 #define STS_SETUP_UPDT                         6
 
-uint8_t resp[MAX_RESP_LEN];
+// written to the FIFOs a word at a time
+uint8_t resp[MAX_EP0_RESP_LEN] __attribute__((aligned(4)));
 
 // for the repeating interfaces
 #define DSCR_INTERFACE_LEN 9
@@ -140,12 +141,12 @@ uint8_t device_qualifier[] = {
 
 uint8_t configuration_desc[] = {
   DSCR_CONFIG_LEN, USB_DESC_TYPE_CONFIGURATION, // Length, Type,
-  TOUSBORDER(0x0045U), // Total Len (uint16)
+  TOUSBORDER(0x0053U), // Total Len (uint16)
   0x01, 0x01, STRING_OFFSET_ICONFIGURATION, // Num Interface, Config Value, Configuration
   0xc0, 0x32, // Attributes, Max Power
   // interface 0 ALT 0
   DSCR_INTERFACE_LEN, USB_DESC_TYPE_INTERFACE, // Length, Type
-  0x00, 0x00, 0x03, // Index, Alt Index idx, Endpoint count
+  0x00, 0x00, 0x04, // Index, Alt Index idx, Endpoint count
   0XFF, 0xFF, 0xFF, // Class, Subclass, Protocol
   0x00, // Interface
     // endpoint 1, read CAN
@@ -163,9 +164,14 @@ uint8_t configuration_desc[] = {
     ENDPOINT_SND | 3, ENDPOINT_TYPE_BULK, // Endpoint Num/Direction, Type
     TOUSBORDER(0x0040U), // Max Packet (0x0040)
     0x00, // Polling Interval
+    // endpoint 2, read health
+    DSCR_ENDPOINT_LEN, USB_DESC_TYPE_ENDPOINT, // Length, Type
+    ENDPOINT_RCV | 2, ENDPOINT_TYPE_INT, // Endpoint Num/Direction, Type
+    TOUSBORDER(0x0040U), // Max Packet (0x0040)
+    0x05, // Polling Interval (5 frames)
   // interface 0 ALT 1
   DSCR_INTERFACE_LEN, USB_DESC_TYPE_INTERFACE, // Length, Type
-  0x00, 0x01, 0x03, // Index, Alt Index idx, Endpoint count
+  0x00, 0x01, 0x04, // Index, Alt Index idx, Endpoint count
   0XFF, 0xFF, 0xFF, // Class, Subclass, Protocol
   0x00, // Interface
     // endpoint 1, read CAN
@@ -183,6 +189,11 @@ uint8_t configuration_desc[] = {
     ENDPOINT_SND | 3, ENDPOINT_TYPE_BULK, // Endpoint Num/Direction, Type
     TOUSBORDER(0x0040U), // Max Packet (0x0040)
     0x00, // Polling Interval
+    // endpoint 2, read health
+    DSCR_ENDPOINT_LEN, USB_DESC_TYPE_ENDPOINT, // Length, Type
+    ENDPOINT_RCV | 2, ENDPOINT_TYPE_INT, // Endpoint Num/Direction, Type
+    TOUSBORDER(0x0040U), // Max Packet (0x0040)
+    0x05, // Polling Interval (5 frames)
 };
 
 // STRING_DESCRIPTOR_HEADER is for uint16 string descriptors
@@ -367,6 +378,9 @@ bool outep3_processing = false;
 // Store the current interface alt setting.
 int current_int0_alt_setting = 0;
 
+// the interrupt IN endpoint 2 is set up, with the configuration
+bool ep2_in_active = false;
+
 // packet read and write
 
 void *USB_ReadPacket(void *dest, uint16_t len) {
@@ -454,6 +468,10 @@ void usb_reset(void) {
   // EP1, massive
   USBx->DIEPTXF[0] = (0x40U << 16) | 0x80U;
 
+  // EP2, one health packet
+  USBx->DIEPTXF[1] = (0x10U << 16) | 0xC0U;
+  ep2_in_active = false;
+
   // flush TX fifo
   USBx->GRSTCTL = USB_OTG_GRSTCTL_TXFFLSH | USB_OTG_GRSTCTL_TXFNUM_4;
   while ((USBx->GRSTCTL & USB_OTG_GRSTCTL_TXFFLSH) == USB_OTG_GRSTCTL_TXFFLSH);
@@ -488,6 +506,11 @@ void usb_setup(void) {
                               USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_USBAEP;
       USBx_INEP(1)->DIEPINT = 0xFF;
 
+      USBx_INEP(2)->DIEPCTL = (0x40U & USB_OTG_DIEPCTL_MPSIZ) | (3U << 18) | (2U << 22) |
+                              USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_USBAEP;
+      USBx_INEP(2)->DIEPINT = 0xFF;
+      ep2_in_active = true;
+
       USBx_OUTEP(2)->DOEPTSIZ = (1U << 19) | 0x40U;
       USBx_OUTEP(2)->DOEPCTL = (0x40U & USB_OTG_DOEPCTL_MPSIZ) | (2U << 18) |
                                USB_OTG_DOEPCTL_SD0PID_SEVNFRM | USB_OTG_DOEPCTL_USBAEP;
@@ -644,8 +667,7 @@ void usb_setup(void) {
       resp_len = usb_cb_control_msg(&setup, resp, 1);
       // response pending if -1 was returned
       if (resp_len != -1) {
-        USB_WritePacket(resp, MIN(resp_len, setup.b.wLength.w), 0);
-        USBx_OUTEP(0)->DOEPCTL |= USB_OTG_DOEPCTL_CNAK;
+        USB_WritePacket_EP0(resp, MIN(resp_len, setup.b.wLength.w));
       }
   }
 }
@@ -919,6 +941,7 @@ void usb_irqhandler(void) {
     // clear interrupts
     USBx_INEP(0)->DIEPINT = USBx_INEP(0)->DIEPINT; // Why ep0?
     USBx_INEP(1)->DIEPINT = USBx_INEP(1)->DIEPINT;
+    USBx_INEP(2)->DIEPINT = USBx_INEP(2)->DIEPINT;
   }
 
   // clear all interrupts we handled
@@ -938,6 +961,24 @@ void usb_outep3_resume_if_paused(void) {
   EXIT_CRITICAL();
 }
 
+// whether the interrupt endpoint 2 is configured and the host read its last packet
+bool usb_ep2_in_ready(void) {
+  return ep2_in_active && ((USBx_INEP(2)->DIEPCTL & USB_OTG_DIEPCTL_EPENA) == 0U);
+}
+
+// queues a packet of at most 0x40 bytes on the interrupt endpoint 2, src
+// aligned to 4. false while the host hasn't read the last one yet
+bool usb_ep2_in_write(const void *src, uint16_t len) {
+  bool ret = false;
+  ENTER_CRITICAL();
+  if (usb_ep2_in_ready()) {
+    USB_WritePacket(src, len, 2);
+    ret = true;
+  }
+  EXIT_CRITICAL();
+  return ret;
+}
+
 bool usb_enumerated(void) {
   // This relies on the USB being suspended after no activity for 3ms.
   // Seems pretty stable in combination with the EOPF to reject noise.
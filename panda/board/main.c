@@ -45,6 +45,8 @@ struct __attribute__((packed)) health_t {
   uint8_t fault_status_pkt;
   uint8_t power_save_enabled_pkt;
   uint8_t heartbeat_lost_pkt;
+  uint32_t can_rx_q_size_pkt;
+  uint32_t can_rx_q_max_used_pkt;
 };
 
 
@@ -194,26 +196,145 @@ int get_health_pkt(void *dat) {
   health->power_save_enabled_pkt = (uint8_t)(power_save_status == POWER_SAVE_STATUS_ENABLED);
   health->heartbeat_lost_pkt = (uint8_t)(heartbeat_lost);
 
+  // high-water mark of the rx queue, a host that sees it near the size drains faster
+  health->can_rx_q_size_pkt = can_rx_q.fifo_size - 1U;
+  health->can_rx_q_max_used_pkt = can_take_max_used(&can_rx_q);
+
   health->fault_status_pkt = fault_status;
   health->faults_pkt = faults;
 
   return sizeof(*health);
 }
 
+// The health packet also goes out on the interrupt endpoint 2, right away when
+// ignition, safety or faults changed and otherwise every 500 ms, so the host
+// neither polls 0xd2 for it nor waits half a second for an ignition edge
+#define HEALTH_PUSH_TICKS 4U
+uint32_t health_push_buf[MAX_RESP_LEN / 4U];
+uint8_t health_push_ticks = 0U;
+
+bool health_push_changed(const struct health_t *last) {
+  return (last->ignition_line_pkt != (uint8_t)(current_board->check_ignition())) ||
+         (last->ignition_can_pkt != (uint8_t)(ignition_can)) ||
+         (last->controls_allowed_pkt != (uint8_t)(controls_allowed)) ||
+         (last->safety_mode_pkt != (uint8_t)(current_safety_mode)) ||
+         (last->safety_param_pkt != current_safety_param) ||
+         (last->car_harness_status_pkt != car_harness_status) ||
+         (last->power_save_enabled_pkt != (uint8_t)(power_save_status == POWER_SAVE_STATUS_ENABLED)) ||
+         (last->heartbeat_lost_pkt != (uint8_t)(heartbeat_lost)) ||
+         (last->fault_status_pkt != fault_status) ||
+         (last->faults_pkt != faults);
+}
+
+// called at 8Hz, a host that doesn't read the endpoint gets the packet that's waiting in it
+void health_push_tick(void) {
+  health_push_ticks += 1U;
+  if ((health_push_ticks >= HEALTH_PUSH_TICKS) || health_push_changed((struct health_t *)health_push_buf)) {
+    // not while the last one waits, the rx queue high-water mark is taken with every packet
+    if (usb_ep2_in_ready()) {
+      int len = get_health_pkt(health_push_buf);
+      if (usb_ep2_in_write(health_push_buf, (uint16_t)len)) {
+        health_push_ticks = 0U;
+      }
+    }
+  }
+}
+
 int get_rtc_pkt(void *dat) {
   timestamp_t t = rtc_get_time();
   (void)memcpy(dat, &t, sizeof(t));
   return sizeof(t);
 }
 
+// ********************* USB CAN packets *********************
+// Version 1 packets are the 16 byte mailboxes. Version 2 ones carry CAN-FD
+// frames, they are two header words and the data padded with zeros to a
+// multiple of 8 bytes, at least 8:
+//   word 0: bits 0-7 bus (CAN_BUS_RET_FLAG for sent frames), bits 8-11 DLC,
+//           bit 12 CAN-FD, bit 13 bit rate switch, bits 16-31 bus time
+//   word 1: bits 0-28 address, bit 31 extended address
+// Packets may span USB packets, the host sets the version with 0xfa
+#define CAN_PACKET_V2_HEAD 8U
+#define CAN_PACKET_V2_MAX (CAN_PACKET_V2_HEAD + CANFD_MAX_LEN)
+#define CAN_PACKET_V2_SIZE(len) (CAN_PACKET_V2_HEAD + MAX(((len) + 7U) & ~7U, 8U))
+
+uint8_t usb_can_version = 1U;
+uint32_t usb_can_in[CAN_PACKET_V2_MAX / 4U];
+uint32_t usb_can_in_len = 0U;
+uint32_t usb_can_in_pos = 0U;
+uint32_t usb_can_out[CAN_PACKET_V2_MAX / 4U];
+uint32_t usb_can_out_len = 0U;
+
+void usb_can_set_version(uint8_t version) {
+  ENTER_CRITICAL();
+  usb_can_version = version;
+  usb_can_in_len = 0U;
+  usb_can_in_pos = 0U;
+  usb_can_out_len = 0U;
+  EXIT_CRITICAL();
+}
+
+uint32_t can_packet_v2_encode(uint32_t *pkt, const CAN_FIFOMailBox_TypeDef *msg, const uint32_t *fd_data) {
+  uint32_t len = GET_FD_LEN(msg);
+  pkt[0] = ((msg->RDTR >> 4) & 0xFFU) | ((msg->RDTR & 0xFU) << 8) | (msg->RDTR & (0xFFFF0000U | CAN_FD_FLAG | CAN_BRS_FLAG));
+  pkt[1] = ((msg->RIR & 4U) != 0U) ? ((msg->RIR >> 3) | 0x80000000U) : (msg->RIR >> 21);
+  pkt[2] = msg->RDLR;
+  pkt[3] = msg->RDHR;
+  uint32_t size = CAN_PACKET_V2_SIZE(len);
+  for (uint32_t i = 4U; i < (size / 4U); i++) {
+    pkt[i] = fd_data[i - 4U];
+  }
+  return size;
+}
+
+void can_packet_v2_send(const uint32_t *pkt) {
+  CAN_FIFOMailBox_TypeDef to_push;
+  uint32_t addr = pkt[1] & 0x1FFFFFFFU;
+  // transmit request set, as the v1 host does
+  to_push.RIR = ((pkt[1] & 0x80000000U) != 0U) ? ((addr << 3) | 5U) : ((addr << 21) | 1U);
+  to_push.RDTR = ((pkt[0] >> 8) & 0xFU) | ((pkt[0] & 0xFFU) << 4) | (pkt[0] & (CAN_FD_FLAG | CAN_BRS_FLAG | CAN_PRIO_FLAG));
+  to_push.RDLR = pkt[2];
+  to_push.RDHR = pkt[3];
+  uint8_t bus_number = pkt[0] & CAN_BUS_NUM_MASK;
+  can_send_fd(&to_push, (const uint8_t *)&pkt[4], bus_number, false);
+}
+
 int usb_cb_ep1_in(void *usbdata, int len, bool hardwired) {
   UNUSED(hardwired);
-  CAN_FIFOMailBox_TypeDef *reply = (CAN_FIFOMailBox_TypeDef *)usbdata;
   int ilen = 0;
-  while (ilen < MIN(len/0x10, 4) && can_pop(&can_rx_q, &reply[ilen])) {
-    ilen++;
+  if (usb_can_version == 1U) {
+    CAN_FIFOMailBox_TypeDef *reply = (CAN_FIFOMailBox_TypeDef *)usbdata;
+    while (ilen < MIN(len/0x10, 4) && can_pop(&can_rx_q, &reply[ilen])) {
+      ilen++;
+    }
+    ilen *= 0x10;
+  } else {
+    // stream the packets, one may continue in the next USB packet. Packets that
+    // fit are encoded straight into the reply, only a split one is staged in
+    // usb_can_in. usbdata is word aligned and packets are multiples of 8 bytes
+    uint8_t *reply = (uint8_t *)usbdata;
+    while (ilen < len) {
+      if (usb_can_in_pos == usb_can_in_len) {
+        CAN_FIFOMailBox_TypeDef msg;
+        // only read for CAN-FD frames, can_pop_fd fills all of it for them
+        uint32_t fd_data[CANFD_EXT_LEN / 4U];
+        if (!can_pop_fd(&can_rx_q, &msg, (uint8_t *)fd_data)) {
+          break;
+        }
+        if (((ilen % 4) == 0) && (CAN_PACKET_V2_SIZE(GET_FD_LEN(&msg)) <= (uint32_t)(len - ilen))) {
+          ilen += (int)can_packet_v2_encode((uint32_t *)&reply[ilen], &msg, fd_data);
+          continue;
+        }
+        usb_can_in_len = can_packet_v2_encode(usb_can_in, &msg, fd_data);
+        usb_can_in_pos = 0U;
+      }
+      uint32_t n = MIN((uint32_t)(len - ilen), usb_can_in_len - usb_can_in_pos);
+      (void)memcpy(&reply[ilen], &((uint8_t *)usb_can_in)[usb_can_in_pos], n);
+      usb_can_in_pos += n;
+      ilen += (int)n;
+    }
   }
-  return ilen*0x10;
+  return ilen;
 }
 
 // send on serial, first byte to select the ring
@@ -235,17 +356,40 @@ void usb_cb_ep2_out(void *usbdata, int len, bool hardwired) {
 // send on CAN
 void usb_cb_ep3_out(void *usbdata, int len, bool hardwired) {
   UNUSED(hardwired);
-  int dpkt = 0;
-  uint32_t *d32 = (uint32_t *)usbdata;
-  for (dpkt = 0; dpkt < (len / 4); dpkt += 4) {
-    CAN_FIFOMailBox_TypeDef to_push;
-    to_push.RDHR = d32[dpkt + 3];
-    to_push.RDLR = d32[dpkt + 2];
-    to_push.RDTR = d32[dpkt + 1];
-    to_push.RIR = d32[dpkt];
-
-    uint8_t bus_number = (to_push.RDTR >> 4) & CAN_BUS_NUM_MASK;
-    can_send(&to_push, bus_number, false);
+  if (usb_can_version == 1U) {
+    int dpkt = 0;
+    uint32_t *d32 = (uint32_t *)usbdata;
+    for (dpkt = 0; dpkt < (len / 4); dpkt += 4) {
+      CAN_FIFOMailBox_TypeDef to_push;
+      to_push.RDHR = d32[dpkt + 3];
+      to_push.RDLR = d32[dpkt + 2];
+      to_push.RDTR = d32[dpkt + 1];
+      to_push.RIR = d32[dpkt];
+
+      uint8_t bus_number = (to_push.RDTR >> 4) & CAN_BUS_NUM_MASK;
+      can_send(&to_push, bus_number, false);
+    }
+  } else {
+    // gather the packets, the header says how long each one is
+    uint8_t *d8 = (uint8_t *)usbdata;
+    uint8_t *pkt = (uint8_t *)usb_can_out;
+    int pos = 0;
+    while (pos < len) {
+      uint32_t want = CAN_PACKET_V2_HEAD;
+      if (usb_can_out_len >= CAN_PACKET_V2_HEAD) {
+        bool fd = (usb_can_out[0] & CAN_FD_FLAG) != 0U;
+        uint32_t dlc = (usb_can_out[0] >> 8) & 0xFU;
+        want = CAN_PACKET_V2_SIZE(fd ? dlc_to_len[dlc] : MIN(dlc, 8U));
+      }
+      uint32_t n = MIN((uint32_t)(len - pos), want - usb_can_out_len);
+      (void)memcpy(&pkt[usb_can_out_len], &d8[pos], n);
+      usb_can_out_len += n;
+      pos += (int)n;
+      if ((usb_can_out_len == want) && (want > CAN_PACKET_V2_HEAD)) {
+        can_packet_v2_send(usb_can_out);
+        usb_can_out_len = 0U;
+      }
+    }
   }
 }
 
@@ -260,6 +404,11 @@ void usb_cb_enumeration_complete(void) {
   is_enumerated = 1;
 }
 
+#ifdef ENABLE_SPI
+  // the host protocol on SPI, on top of the callbacks above
+  #include "drivers/spi.h"
+#endif
+
 int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired) {
   unsigned int resp_len = 0;
   uart_ring *ur = NULL;
@@ -335,6 +484,7 @@ int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired)
       puts(" txd: "); puth(can_txd_cnt);
       puts(" rx: "); puth(can_rx_cnt);
       puts(" err: "); puth(can_err_cnt);
+      puts(" filtered: "); puth(can_filter_dropped);
       puts("\n");
       break;
     // **** 0xc1: get hardware type
@@ -342,6 +492,37 @@ int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired)
       resp[0] = hw_type;
       resp_len = 1;
       break;
+    // **** 0xc2: get CAN health of one bus
+    case 0xc2:
+      if (setup->b.wValue.w < BUS_MAX) {
+        can_health_get(setup->b.wValue.w, (struct can_health_t *)resp);
+        resp_len = sizeof(struct can_health_t);
+      }
+      break;
+    // **** 0xc3: set the CAN filter, wValue 1 for an empty table and 0 to forward everything
+    case 0xc3:
+      can_filter_clear(setup->b.wValue.w != 0U);
+      break;
+    // **** 0xc4: add a message to the CAN filter, address low bits in wValue, high bits and bus (<< 13) in wIndex
+    case 0xc4:
+      resp[0] = can_filter_add(setup->b.wIndex.w >> 13, ((uint32_t)(setup->b.wIndex.w & 0x1FFFU) << 16) | setup->b.wValue.w) ? 1U : 0U;
+      resp_len = 1;
+      break;
+    // **** 0xc5: forward one in wValue frames of the messages added to the CAN filter after this
+    case 0xc5:
+      can_filter_decimation = MAX(setup->b.wValue.w, 1U);
+      break;
+    // **** 0xc6: drop what's not in the CAN filter in the CAN controllers too, wValue 0 to receive all of it again
+    case 0xc6:
+      can_filter_hw = (setup->b.wValue.w != 0U);
+      can_filter_hw_update();
+      break;
+    // **** 0xc7: get the time spent in the safety hooks since the last call
+    case 0xc7:
+      COMPILE_TIME_ASSERT(sizeof(struct safety_hook_stats_t) <= MAX_RESP_LEN);
+      safety_hook_stats_get((struct safety_hook_stats_t *)resp);
+      resp_len = sizeof(struct safety_hook_stats_t);
+      break;
     // **** 0xd0: fetch serial number
     case 0xd0:
       // addresses are OTP
@@ -509,10 +690,17 @@ int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired)
         dma_pointer_handler(ur, DMA2_Stream5->NDTR);
       }
 
-      // read
-      while ((resp_len < MIN(setup->b.wLength.w, MAX_RESP_LEN)) &&
-                         getc(ur, (char*)&resp[resp_len])) {
-        ++resp_len;
+      // read, GPS reads get more than a packet. Those end on a short packet,
+      // there's no zero length one after a full packet that's shorter than wLength
+      {
+        uint16_t max_len = MIN(setup->b.wLength.w, (ur == &uart_ring_gps) ? MAX_EP0_RESP_LEN : MAX_RESP_LEN);
+        uint16_t read_len = MIN(uart_rx_available(ur), max_len);
+        if ((read_len < max_len) && (read_len >= MAX_RESP_LEN) && ((read_len % MAX_RESP_LEN) == 0U)) {
+          read_len--;
+        }
+        while ((resp_len < read_len) && getc(ur, (char*)&resp[resp_len])) {
+          ++resp_len;
+        }
       }
       break;
     // **** 0xe1: uart set baud rate
@@ -587,6 +775,7 @@ int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired)
       } else if (setup->b.wValue.w < BUS_MAX) {
         puts("Clearing CAN Tx queue\n");
         can_clear(can_queues[setup->b.wValue.w]);
+        can_clear(can_prio_queues[setup->b.wValue.w]);
       } else {
         puts("Clearing CAN CAN ring buffer failed: wrong bus number\n");
       }
@@ -647,6 +836,22 @@ int usb_cb_control_msg(USB_Setup_TypeDef *setup, uint8_t *resp, bool hardwired)
         UNUSED(ret);
       }
       break;
+    // **** 0xfa: set the version of USB CAN packets, returns the one in use
+    case 0xfa:
+      if ((setup->b.wValue.w == 1U) || (setup->b.wValue.w == 2U)) {
+        usb_can_set_version((uint8_t)setup->b.wValue.w);
+      }
+      resp[0] = usb_can_version;
+      resp_len = 1;
+      break;
+    // **** 0xfb: get microsecond timer, the clock of the CAN timestamps
+    case 0xfb:
+      {
+        uint32_t us = microsecond_timer_get();
+        (void)memcpy(resp, &us, sizeof(us));
+        resp_len = sizeof(us);
+      }
+      break;
     default:
       puts("NO HANDLER ");
       puth(setup->b.bRequest);
@@ -679,6 +884,12 @@ void tick_handler(void) {
     // siren
     current_board->set_siren((loop_counter & 1U) && (siren_enabled || (siren_countdown > 0U)));
 
+    #ifdef ENABLE_SPI
+      spi_tick();
+    #endif
+
+    health_push_tick();
+
     // decimated to 1Hz
     if (loop_counter == 0U) {
       can_live = pending_can_live;
@@ -846,6 +1057,7 @@ int main(void) {
   }
 
   microsecond_timer_init();
+  safety_hook_time_init();
 
   // init to SILENT and can silent
   set_safety_mode(SAFETY_SILENT, 0);
@@ -863,6 +1075,10 @@ int main(void) {
   // enable USB (right before interrupts or enum can fail!)
   usb_init();
 
+#ifdef ENABLE_SPI
+  spi_init();
+#endif
+
   puts("**** INTERRUPTS ON ****\n");
   enable_interrupts();
 
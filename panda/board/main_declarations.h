@@ -7,6 +7,9 @@ typedef struct harness_configuration harness_configuration;
 void can_flip_buses(uint8_t bus1, uint8_t bus2);
 void pwm_init(TIM_TypeDef *TIM, uint8_t channel);
 void pwm_set(TIM_TypeDef *TIM, uint8_t channel, uint8_t percentage);
+#ifdef ENABLE_SPI
+void spi_irq_update(void);
+#endif
 
 // ********************* Globals **********************
 uint8_t hw_type = 0;
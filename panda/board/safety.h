@@ -15,6 +15,7 @@
 #include "safety/safety_nissan.h"
 #include "safety/safety_volkswagen.h"
 #include "safety/safety_elm327.h"
+#include "safety/can_filter.h"
 
 // from cereal.car.CarParams.SafetyModel
 #define SAFETY_SILENT 0U
@@ -45,12 +46,82 @@ int16_t current_safety_param = 0;
 const safety_hooks *current_hooks = &nooutput_hooks;
 const addr_checks *current_rx_checks = &default_rx_checks;
 
+// Cycles spent in the hooks, from the DWT cycle counter, for 0xc7. Hooks called outside
+// of an interrupt count the interrupts they got preempted by too.
+// When changing this struct, boardd needs to be kept up to date!
+struct __attribute__((packed)) safety_hook_time_t {
+  uint32_t calls;
+  uint32_t max_cycles;
+  uint32_t avg_cycles;
+};
+
+struct __attribute__((packed)) safety_hook_stats_t {
+  uint32_t core_freq;  // in MHz, cycles per us
+  struct safety_hook_time_t rx;
+  struct safety_hook_time_t tx;
+  struct safety_hook_time_t fwd;
+};
+
+#define SAFETY_HOOK_RX 0U
+#define SAFETY_HOOK_TX 1U
+#define SAFETY_HOOK_FWD 2U
+
+typedef struct {
+  uint32_t calls;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+} safety_hook_time;
+
+safety_hook_time safety_hook_times[3];
+
+void safety_hook_time_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  #ifdef STM32H7
+    DWT->LAR = 0xC5ACCE55U;  // unlock
+  #endif
+  DWT->CYCCNT = 0U;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void safety_hook_time_add(uint8_t hook, uint32_t start) {
+  uint32_t cycles = DWT->CYCCNT - start;
+  ENTER_CRITICAL();
+  safety_hook_time *t = &safety_hook_times[hook];
+  t->calls += 1U;
+  t->max_cycles = MAX(t->max_cycles, cycles);
+  t->total_cycles += cycles;
+  EXIT_CRITICAL();
+}
+
+// since the last call
+void safety_hook_stats_get(struct safety_hook_stats_t *stats) {
+  struct safety_hook_time_t *out[3] = {&stats->rx, &stats->tx, &stats->fwd};
+  stats->core_freq = CORE_FREQ;
+  ENTER_CRITICAL();
+  for (uint8_t i = 0U; i < 3U; i++) {
+    safety_hook_time *t = &safety_hook_times[i];
+    out[i]->calls = t->calls;
+    out[i]->max_cycles = t->max_cycles;
+    out[i]->avg_cycles = (t->calls > 0U) ? (uint32_t)(t->total_cycles / t->calls) : 0U;
+    t->calls = 0U;
+    t->max_cycles = 0U;
+    t->total_cycles = 0U;
+  }
+  EXIT_CRITICAL();
+}
+
 int safety_rx_hook(CAN_FIFOMailBox_TypeDef *to_push) {
-  return current_hooks->rx(to_push);
+  uint32_t start = DWT->CYCCNT;
+  int ret = current_hooks->rx(to_push);
+  safety_hook_time_add(SAFETY_HOOK_RX, start);
+  return ret;
 }
 
 int safety_tx_hook(CAN_FIFOMailBox_TypeDef *to_send) {
-  return current_hooks->tx(to_send);
+  uint32_t start = DWT->CYCCNT;
+  int ret = current_hooks->tx(to_send);
+  safety_hook_time_add(SAFETY_HOOK_TX, start);
+  return ret;
 }
 
 int safety_tx_lin_hook(int lin_num, uint8_t *data, int len) {
@@ -58,7 +129,10 @@ int safety_tx_lin_hook(int lin_num, uint8_t *data, int len) {
 }
 
 int safety_fwd_hook(int bus_num, CAN_FIFOMailBox_TypeDef *to_fwd) {
-  return current_hooks->fwd(bus_num, to_fwd);
+  uint32_t start = DWT->CYCCNT;
+  int ret = current_hooks->fwd(bus_num, to_fwd);
+  safety_hook_time_add(SAFETY_HOOK_FWD, start);
+  return ret;
 }
 
 // Given a CRC-8 poly, generate a static lookup table to use with a fast CRC-8
@@ -286,6 +360,7 @@ int set_safety_hooks(uint16_t mode, int16_t param) {
   torque_driver.max = 0;
   angle_meas.min = 0;
   angle_meas.max = 0;
+  can_filter_clear(false);
 
   int set_status = -1;  // not set
   int hook_config_count = sizeof(safety_hook_registry) / sizeof(safety_hook_config);
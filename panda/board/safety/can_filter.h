@@ -0,0 +1,91 @@
+// Received CAN forwarded to the host. Without a table it's all of it, with one
+// only the messages in it, every decimation-th frame of each. The host sets the
+// table from the messages the car port parses, a safety mode change drops it:
+// fingerprinting and the other modes see everything again
+// With can_filter_hw the CAN controllers' ID filters drop the rest of a bus before
+// it takes an interrupt, on the buses the safety model doesn't need all of
+#define CAN_FILTER_MAX 256U
+
+typedef struct {
+  uint32_t key;  // bus << 29 | address
+  uint16_t decimation;
+  uint16_t cnt;
+} can_filter_entry;
+
+// sorted by key
+can_filter_entry can_filter[CAN_FILTER_MAX];
+uint16_t can_filter_len = 0U;
+bool can_filter_enabled = false;
+uint16_t can_filter_decimation = 1U;
+uint32_t can_filter_dropped = 0U;
+// the CAN controllers drop what's not in the table too, where they can: see can_filter_hw_apply
+bool can_filter_hw = false;
+
+void can_filter_hw_update(void);
+
+void can_filter_clear(bool enable) {
+  ENTER_CRITICAL();
+  bool hw = can_filter_hw;
+  can_filter_enabled = enable;
+  can_filter_len = 0U;
+  can_filter_decimation = 1U;
+  can_filter_hw = false;
+  EXIT_CRITICAL();
+  if (hw) {
+    can_filter_hw_update();
+  }
+}
+
+// false when the table is full
+bool can_filter_add(uint8_t bus, uint32_t addr) {
+  uint32_t key = ((uint32_t)bus << 29) | (addr & 0x1FFFFFFFU);
+  bool ret = true;
+
+  ENTER_CRITICAL();
+  uint16_t i = 0U;
+  while ((i < can_filter_len) && (can_filter[i].key < key)) {
+    i++;
+  }
+  if ((i < can_filter_len) && (can_filter[i].key == key)) {
+    can_filter[i].decimation = can_filter_decimation;
+  } else if (can_filter_len < CAN_FILTER_MAX) {
+    for (uint16_t j = can_filter_len; j > i; j--) {
+      can_filter[j] = can_filter[j - 1U];
+    }
+    can_filter[i].key = key;
+    can_filter[i].decimation = can_filter_decimation;
+    can_filter[i].cnt = 0U;
+    can_filter_len++;
+  } else {
+    ret = false;
+  }
+  EXIT_CRITICAL();
+  return ret;
+}
+
+// from the CAN RX interrupts, true to push it for the host
+bool can_filter_rx(CAN_FIFOMailBox_TypeDef *to_push) {
+  bool ret = !can_filter_enabled;
+  if (!ret) {
+    uint32_t key = ((uint32_t)GET_BUS(to_push) << 29) | (uint32_t)GET_ADDR(to_push);
+    int lo = 0;
+    int hi = (int)can_filter_len - 1;
+    while (lo <= hi) {
+      int mid = (lo + hi) / 2;
+      if (can_filter[mid].key < key) {
+        lo = mid + 1;
+      } else if (can_filter[mid].key > key) {
+        hi = mid - 1;
+      } else {
+        can_filter[mid].cnt++;
+        if (can_filter[mid].cnt >= can_filter[mid].decimation) {
+          can_filter[mid].cnt = 0U;
+          ret = true;
+        }
+        break;
+      }
+    }
+    can_filter_dropped += ret ? 0U : 1U;
+  }
+  return ret;
+}
@@ -64,6 +64,82 @@ bool llcan_set_speed(CAN_TypeDef *CAN_obj, uint32_t speed, bool loopback, bool s
   return ret;
 }
 
+// Filter banks of one CAN: CAN1 and CAN2 split the 28 banks of CAN1 at CAN2SB (14 after reset), CAN3 has its own
+#define CAN_FILTER_BANKS 14U
+
+void llcan_set_filter_bank(CAN_TypeDef *filter_obj, uint8_t bank, bool list, bool scale_32, uint32_t fr1, uint32_t fr2) {
+  uint32_t bit = 1UL << bank;
+  filter_obj->FM1R = list ? (filter_obj->FM1R | bit) : (filter_obj->FM1R & ~bit);
+  filter_obj->FS1R = scale_32 ? (filter_obj->FS1R | bit) : (filter_obj->FS1R & ~bit);
+  filter_obj->FFA1R &= ~bit;  // to FIFO 0
+  filter_obj->sFilterRegister[bank].FR1 = fr1;
+  filter_obj->sFilterRegister[bank].FR2 = fr2;
+  filter_obj->FA1R |= bit;
+}
+
+// Receive only the ids, 11 bit if <= 0x7FF and 29 bit otherwise, or everything with ids NULL.
+// Standard ids take a quarter of a bank, extended ones half. False, and everything, if they don't fit.
+bool llcan_set_filter(CAN_TypeDef *CAN_obj, const uint32_t ids[], uint16_t len) {
+  CAN_TypeDef *filter_obj = (CAN_obj == CAN2) ? CAN1 : CAN_obj;
+  uint8_t first_bank = (CAN_obj == CAN2) ? CAN_FILTER_BANKS : 0U;
+
+  uint16_t std_cnt = 0U;
+  for (uint16_t i = 0U; i < len; i++) {
+    if (ids[i] <= 0x7FFU) {
+      std_cnt++;
+    }
+  }
+  uint16_t ext_cnt = len - std_cnt;
+  bool ret = (ids == NULL) || ((((std_cnt + 3U) / 4U) + ((ext_cnt + 1U) / 2U)) <= CAN_FILTER_BANKS);
+
+  register_set_bits(&(filter_obj->FMR), CAN_FMR_FINIT);
+  filter_obj->FA1R &= ~(((1UL << CAN_FILTER_BANKS) - 1U) << first_bank);
+  if ((ids == NULL) || !ret) {
+    // no mask
+    llcan_set_filter_bank(filter_obj, first_bank, false, true, 0U, 0U);
+  } else {
+    // no active bank drops everything, that's an empty list
+    uint8_t bank = first_bank;
+    uint32_t fr[4] = {0U};
+    uint16_t n = 0U;
+    // 16 bit list mode: STID << 5, RTR and IDE 0
+    for (uint16_t i = 0U; i < len; i++) {
+      if (ids[i] <= 0x7FFU) {
+        fr[n % 4U] = ids[i] << 5;
+        n++;
+        if ((n % 4U) == 0U) {
+          llcan_set_filter_bank(filter_obj, bank, true, false, (fr[1] << 16) | fr[0], (fr[3] << 16) | fr[2]);
+          bank++;
+        }
+      }
+    }
+    if ((n % 4U) != 0U) {
+      for (uint16_t j = n % 4U; j < 4U; j++) {
+        fr[j] = fr[0];
+      }
+      llcan_set_filter_bank(filter_obj, bank, true, false, (fr[1] << 16) | fr[0], (fr[3] << 16) | fr[2]);
+      bank++;
+    }
+    // 32 bit list mode: EXID << 3 with IDE set
+    n = 0U;
+    for (uint16_t i = 0U; i < len; i++) {
+      if (ids[i] > 0x7FFU) {
+        fr[n % 2U] = (ids[i] << 3) | 4U;
+        n++;
+        if ((n % 2U) == 0U) {
+          llcan_set_filter_bank(filter_obj, bank, true, true, fr[0], fr[1]);
+          bank++;
+        }
+      }
+    }
+    if ((n % 2U) != 0U) {
+      llcan_set_filter_bank(filter_obj, bank, true, true, fr[0], fr[0]);
+    }
+  }
+  register_clear_bits(&(filter_obj->FMR), CAN_FMR_FINIT);
+  return ret;
+}
+
 bool llcan_init(CAN_TypeDef *CAN_obj) {
   bool ret = true;
 
@@ -85,13 +161,8 @@ bool llcan_init(CAN_TypeDef *CAN_obj) {
   }
 
   if(ret){
-    // no mask
-    // For some weird reason some of these registers do not want to set properly on CAN2 and CAN3. Probably something to do with the single/dual mode and their different filters.
-    CAN_obj->sFilterRegister[0].FR1 = 0U;
-    CAN_obj->sFilterRegister[0].FR2 = 0U;
-    CAN_obj->sFilterRegister[14].FR1 = 0U;
-    CAN_obj->sFilterRegister[14].FR2 = 0U;
-    CAN_obj->FA1R |= 1U | (1U << 14);
+    // no mask, can_init sets the host's filter after
+    (void)llcan_set_filter(CAN_obj, NULL, 0U);
 
     // Exit init mode, do not wait
     register_clear_bits(&(CAN_obj->FMR), CAN_FMR_FINIT);
@@ -14,22 +14,29 @@
 // 10=600, 20=300, 50=120, 83.333=72, 100=60, 125=48, 250=24, 500=12, 1000=6, 2000=3, 3000=2, 6000=1
 #define can_speed_to_prescaler(x) (CAN_PCLK / CAN_QUANTA * 10U / (x))
 
+// Elements hold 64 bytes for CAN-FD, (24 + 16) * 72 bytes and the 128 words of ID filters fit in FDCAN_OFFSET
 // RX FIFO 0
-#define FDCAN_RX_FIFO_0_EL_CNT 32UL
+#define FDCAN_RX_FIFO_0_EL_CNT 24UL
 #define FDCAN_RX_FIFO_0_HEAD_SIZE 8UL // bytes
-#define FDCAN_RX_FIFO_0_DATA_SIZE 8UL // bytes
+#define FDCAN_RX_FIFO_0_DATA_SIZE 64UL // bytes
 #define FDCAN_RX_FIFO_0_EL_SIZE (FDCAN_RX_FIFO_0_HEAD_SIZE + FDCAN_RX_FIFO_0_DATA_SIZE)
 #define FDCAN_RX_FIFO_0_EL_W_SIZE (FDCAN_RX_FIFO_0_EL_SIZE / 4UL)
 #define FDCAN_RX_FIFO_0_OFFSET 0UL
 
 // TX FIFO
-#define FDCAN_TX_FIFO_EL_CNT 32UL
+#define FDCAN_TX_FIFO_EL_CNT 16UL
 #define FDCAN_TX_FIFO_HEAD_SIZE 8UL // bytes
-#define FDCAN_TX_FIFO_DATA_SIZE 8UL // bytes
+#define FDCAN_TX_FIFO_DATA_SIZE 64UL // bytes
 #define FDCAN_TX_FIFO_EL_SIZE (FDCAN_TX_FIFO_HEAD_SIZE + FDCAN_TX_FIFO_DATA_SIZE)
 #define FDCAN_TX_FIFO_EL_W_SIZE (FDCAN_TX_FIFO_EL_SIZE / 4UL)
 #define FDCAN_TX_FIFO_OFFSET (FDCAN_RX_FIFO_0_OFFSET + (FDCAN_RX_FIFO_0_EL_CNT * FDCAN_RX_FIFO_0_EL_W_SIZE))
 
+// ID filters, dual ID elements with two ids each. A standard element is a word, an extended one two
+#define FDCAN_STD_FILTER_EL_CNT 64UL
+#define FDCAN_STD_FILTER_OFFSET (FDCAN_TX_FIFO_OFFSET + (FDCAN_TX_FIFO_EL_CNT * FDCAN_TX_FIFO_EL_W_SIZE))
+#define FDCAN_EXT_FILTER_EL_CNT 32UL
+#define FDCAN_EXT_FILTER_OFFSET (FDCAN_STD_FILTER_OFFSET + FDCAN_STD_FILTER_EL_CNT)
+
 #define CAN_NAME_FROM_CANIF(CAN_DEV) (((CAN_DEV)==FDCAN1) ? "FDCAN1" : (((CAN_DEV) == FDCAN2) ? "FDCAN2" : "FDCAN3"))
 #define CAN_NUM_FROM_CANIF(CAN_DEV) (((CAN_DEV)==FDCAN1) ? 0UL : (((CAN_DEV) == FDCAN2) ? 1UL : 2UL))
 
@@ -120,6 +127,79 @@ bool llcan_set_speed(FDCAN_GlobalTypeDef *CANx, uint32_t speed, uint32_t data_sp
   return ret;
 }
 
+// Receive only the ids, 11 bit if <= 0x7FF and 29 bit otherwise, or everything with ids NULL.
+// False, and everything, if they don't fit the filter lists.
+bool llcan_set_filter(FDCAN_GlobalTypeDef *CANx, const uint32_t ids[], uint16_t len) {
+  uint32_t can_number = CAN_NUM_FROM_CANIF(CANx);
+
+  uint16_t std_cnt = 0U;
+  for (uint16_t i = 0U; i < len; i++) {
+    if (ids[i] <= 0x7FFU) {
+      std_cnt++;
+    }
+  }
+  uint16_t ext_cnt = len - std_cnt;
+  bool ret = (ids == NULL) || ((((std_cnt + 1U) / 2U) <= FDCAN_STD_FILTER_EL_CNT) && (((ext_cnt + 1U) / 2U) <= FDCAN_EXT_FILTER_EL_CNT));
+  bool filtered = (ids != NULL) && ret;
+
+  if (fdcan_request_init(CANx)) {
+    CANx->CCCR |= FDCAN_CCCR_CCE;
+
+    uint32_t std_el = 0U;
+    uint32_t ext_el = 0U;
+    if (filtered) {
+      uint32_t FilterSA = FDCAN_START_ADDRESS + (can_number * FDCAN_OFFSET);
+      volatile uint32_t *std_filters = (volatile uint32_t *)(FilterSA + (FDCAN_STD_FILTER_OFFSET * 4U));
+      volatile uint32_t *ext_filters = (volatile uint32_t *)(FilterSA + (FDCAN_EXT_FILTER_OFFSET * 4U));
+      uint32_t pair[2] = {0U};
+      uint16_t n = 0U;
+      // SFT dual ID, SFEC store in FIFO 0, SFID1 and SFID2
+      for (uint16_t i = 0U; i < len; i++) {
+        if (ids[i] <= 0x7FFU) {
+          pair[n % 2U] = ids[i];
+          n++;
+          if ((n % 2U) == 0U) {
+            std_filters[std_el] = (0x1UL << 30) | (0x1UL << 27) | (pair[0] << 16) | pair[1];
+            std_el++;
+          }
+        }
+      }
+      if ((n % 2U) != 0U) {
+        std_filters[std_el] = (0x1UL << 30) | (0x1UL << 27) | (pair[0] << 16) | pair[0];
+        std_el++;
+      }
+      // EFEC store in FIFO 0 and EFID1, EFT dual ID and EFID2
+      n = 0U;
+      for (uint16_t i = 0U; i < len; i++) {
+        if (ids[i] > 0x7FFU) {
+          pair[n % 2U] = ids[i];
+          n++;
+          if ((n % 2U) == 0U) {
+            ext_filters[2U * ext_el] = (0x1UL << 29) | pair[0];
+            ext_filters[(2U * ext_el) + 1U] = (0x1UL << 30) | pair[1];
+            ext_el++;
+          }
+        }
+      }
+      if ((n % 2U) != 0U) {
+        ext_filters[2U * ext_el] = (0x1UL << 29) | pair[0];
+        ext_filters[(2U * ext_el) + 1U] = (0x1UL << 30) | pair[0];
+        ext_el++;
+      }
+    }
+    register_set(&(CANx->SIDFC), ((FDCAN_STD_FILTER_OFFSET + (can_number * FDCAN_OFFSET_W)) << FDCAN_SIDFC_FLSSA_Pos) | (std_el << FDCAN_SIDFC_LSS_Pos), (FDCAN_SIDFC_FLSSA | FDCAN_SIDFC_LSS));
+    register_set(&(CANx->XIDFC), ((FDCAN_EXT_FILTER_OFFSET + (can_number * FDCAN_OFFSET_W)) << FDCAN_XIDFC_FLESA_Pos) | (ext_el << FDCAN_XIDFC_LSE_Pos), (FDCAN_XIDFC_FLESA | FDCAN_XIDFC_LSE));
+    // non-matching frames to FIFO 0 (0) or rejected (3)
+    uint32_t anf = filtered ? 0x3U : 0x0U;
+    register_set(&(CANx->GFC), (anf << FDCAN_GFC_ANFS_Pos) | (anf << FDCAN_GFC_ANFE_Pos), (FDCAN_GFC_ANFS | FDCAN_GFC_ANFE));
+
+    if (!fdcan_exit_init(CANx)) {
+      puts(CAN_NAME_FROM_CANIF(CANx)); puts(" llcan_set_filter timed out!\n");
+    }
+  }
+  return ret;
+}
+
 bool llcan_init(FDCAN_GlobalTypeDef *CANx) {
   uint32_t can_number = CAN_NUM_FROM_CANIF(CANx);
   bool ret = fdcan_request_init(CANx);
@@ -138,10 +218,9 @@ bool llcan_init(FDCAN_GlobalTypeDef *CANx) {
 
     // Set TX mode to FIFO
     CANx->TXBC &= ~(FDCAN_TXBC_TFQM);
-    // Configure TX element size (for now 8 bytes, no need to change)
-    //CANx->TXESC |= 0x000U;
-    //Configure RX FIFO0, FIFO1, RX buffer element sizes (no need for now, using classic 8 bytes)
-    register_set(&(CANx->RXESC), 0x0U, (FDCAN_RXESC_F0DS | FDCAN_RXESC_F1DS | FDCAN_RXESC_RBDS));
+    // TX and RX FIFO 0 elements carry 64 bytes of data (0x7), the others aren't used
+    register_set(&(CANx->TXESC), (0x7U << FDCAN_TXESC_TBDS_Pos), FDCAN_TXESC_TBDS);
+    register_set(&(CANx->RXESC), (0x7U << FDCAN_RXESC_F0DS_Pos), (FDCAN_RXESC_F0DS | FDCAN_RXESC_F1DS | FDCAN_RXESC_RBDS));
     // Disable filtering, accept all valid frames received
     CANx->XIDFC &= ~(FDCAN_XIDFC_LSE); // No extended filters
     CANx->SIDFC &= ~(FDCAN_SIDFC_LSS); // No standard filters
@@ -0,0 +1,90 @@
+// IRQs: DMA2_Stream2
+
+void llspi_init(void);
+void spi_rx_done(void);
+
+// end API
+
+// SPI4 slave on E11 (NSS), E12 (SCK), E13 (MISO), E14 (MOSI), both directions on
+// DMA2 through DMAMUX1, stream 2 for RX and stream 3 for TX
+#define SPI_DMAMUX_RX 83U // spi4_rx_dma
+#define SPI_DMAMUX_TX 84U // spi4_tx_dma
+
+// E15: data ready towards the host, low while the panda has CAN to read
+#define SPI_IRQ_GPIO GPIOE
+#define SPI_IRQ_PIN 15U
+
+// Arms the next step of a transaction, the RX side counts the bytes the host clocks.
+// tx may be NULL, the host reads zeros from the underrun pattern then
+void llspi_arm(uint8_t *rx, uint16_t rx_len, uint8_t *tx, uint16_t tx_len) {
+  // disabling the SPI flushes its FIFOs of what the host clocked before
+  register_clear_bits(&(SPI4->CR1), SPI_CR1_SPE);
+  register_clear_bits(&(DMA2_Stream2->CR), DMA_SxCR_EN);
+  register_clear_bits(&(DMA2_Stream3->CR), DMA_SxCR_EN);
+  while (((DMA2_Stream2->CR & DMA_SxCR_EN) != 0U) || ((DMA2_Stream3->CR & DMA_SxCR_EN) != 0U)) {
+    // wait for the streams to stop
+  }
+  DMA2->LIFCR = DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2 | DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2 |
+                DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3;
+  register_clear_bits(&(SPI4->CFG1), SPI_CFG1_RXDMAEN | SPI_CFG1_TXDMAEN);
+
+  // RX: periph -> memory, increment memory, interrupt when it's done
+  register_set_bits(&(SPI4->CFG1), SPI_CFG1_RXDMAEN);
+  register_set(&(DMA2_Stream2->M0AR), (uint32_t)rx, 0xFFFFFFFFU);
+  register_set(&(DMA2_Stream2->PAR), (uint32_t)&(SPI4->RXDR), 0xFFFFFFFFU);
+  DMA2_Stream2->NDTR = rx_len;
+  register_set(&(DMA2_Stream2->CR), (DMA_SxCR_MINC | DMA_SxCR_TCIE | DMA_SxCR_EN), 0x1E077EFEU);
+
+  // TX: memory -> periph, increment memory
+  if (tx != NULL) {
+    register_set(&(DMA2_Stream3->M0AR), (uint32_t)tx, 0xFFFFFFFFU);
+    register_set(&(DMA2_Stream3->PAR), (uint32_t)&(SPI4->TXDR), 0xFFFFFFFFU);
+    DMA2_Stream3->NDTR = tx_len;
+    register_set(&(DMA2_Stream3->CR), (DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_EN), 0x1E077EFEU);
+    register_set_bits(&(SPI4->CFG1), SPI_CFG1_TXDMAEN);
+  }
+
+  register_set_bits(&(SPI4->CR1), SPI_CR1_SPE);
+}
+
+// bytes the host still has to clock for the armed step
+uint16_t llspi_rx_remaining(void) {
+  return (uint16_t)DMA2_Stream2->NDTR;
+}
+
+// ***************************** SPI IRQs *****************************
+// SPI RX, every step of a transaction ends with it
+void DMA2_Stream2_IRQ_Handler(void) {
+  DMA2->LIFCR = DMA_LIFCR_CTCIF2;
+  spi_rx_done();
+}
+
+// ***************************** SPI init *****************************
+void llspi_init(void) {
+  // a transaction is 4 steps, at a few thousand of them per second
+  REGISTER_INTERRUPT(DMA2_Stream2_IRQn, DMA2_Stream2_IRQ_Handler, 50000U, FAULT_INTERRUPT_RATE_SPI_DMA)
+
+  register_set_bits(&(RCC->AHB1ENR), RCC_AHB1ENR_DMA2EN);
+  register_set_bits(&(RCC->APB2ENR), RCC_APB2ENR_SPI4EN);
+
+  set_gpio_alternate(GPIOE, 11, GPIO_AF5_SPI4);
+  set_gpio_alternate(GPIOE, 12, GPIO_AF5_SPI4);
+  set_gpio_alternate(GPIOE, 13, GPIO_AF5_SPI4);
+  set_gpio_alternate(GPIOE, 14, GPIO_AF5_SPI4);
+  register_set_bits(&(GPIOE->OSPEEDR), GPIO_OSPEEDR_OSPEED12 | GPIO_OSPEEDR_OSPEED13);
+
+  set_gpio_pullup(SPI_IRQ_GPIO, SPI_IRQ_PIN, PULL_NONE);
+  set_gpio_output(SPI_IRQ_GPIO, SPI_IRQ_PIN, 1);
+  set_gpio_mode(SPI_IRQ_GPIO, SPI_IRQ_PIN, MODE_OUTPUT);
+
+  // slave, mode 0, hardware NSS, 8 bit frames. The host reads zeros on an underrun
+  register_set(&(SPI4->CFG1), (7U << SPI_CFG1_DSIZE_Pos), 0xFFFFFFFFU);
+  register_set(&(SPI4->CFG2), SPI_CFG2_AFCNTR, 0xFFFFFFFFU);
+  register_set(&(SPI4->UDRDR), 0x00U, 0xFFFFFFFFU);
+  register_set(&(SPI4->CR2), 0U, 0xFFFFFFFFU);
+
+  register_set(&(DMAMUX1_Channel10->CCR), SPI_DMAMUX_RX, 0xFFFFFFFFU);
+  register_set(&(DMAMUX1_Channel11->CCR), SPI_DMAMUX_TX, 0xFFFFFFFFU);
+
+  NVIC_EnableIRQ(DMA2_Stream2_IRQn);
+}
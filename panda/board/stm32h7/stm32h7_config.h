@@ -65,6 +65,10 @@
   #include "stm32h7/llfdcan.h"
 #endif
 
+#if defined(ENABLE_SPI) && !defined(BOOTSTUB)
+  #include "stm32h7/llspi.h"
+#endif
+
 #include "stm32h7/llusb.h"
 
 void early_gpio_float(void) {
@@ -202,6 +202,13 @@ class Panda(object):
     assert(self._handle is not None)
     print("connected")
 
+    # boardd may have left the panda on CAN-FD capable packets, this library reads 16 byte ones
+    if not self.wifi and not self.bootstub:
+      try:
+        self._handle.controlRead(Panda.REQUEST_IN, 0xfa, 1, 0, 1)
+      except Exception:
+        pass
+
   def reset(self, enter_bootstub=False, enter_bootloader=False):
     # reset
     try:
@@ -342,8 +349,10 @@ class Panda(object):
   # ******************* health *******************
 
   def health(self):
-    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, 44)
-    a = struct.unpack("<IIIIIIIIBBBBBBBHBBB", dat)
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, 52)
+    a = struct.unpack("<IIIIIIIIBBBBBBBHBBB", dat[:44])
+    # older firmware doesn't report its rx queue
+    rx_q = struct.unpack("<II", dat[44:52]) if len(dat) >= 52 else (0, 0)
     return {
       "uptime": a[0],
       "voltage": a[1],
@@ -364,8 +373,37 @@ class Panda(object):
       "fault_status": a[16],
       "power_save_enabled": a[17],
       "heartbeat_lost": a[18],
+      "can_rx_q_size": rx_q[0],
+      "can_rx_q_max_used": rx_q[1],
     }
 
+  def can_health(self, bus):
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc2, bus, 0, 26)
+    # older firmware doesn't report its tx queues
+    a = struct.unpack("<IIIIBBBBBB", dat[:22]) + (struct.unpack("<HH", dat[22:26]) if len(dat) >= 26 else (0, 0))
+    return {
+      "bus_off_cnt": a[0],
+      "error_cnt": a[1],
+      "can_speed": a[2],
+      "can_data_speed": a[3],
+      "bus_off": a[4],
+      "error_passive": a[5],
+      "error_warning": a[6],
+      "last_error": a[7],
+      "transmit_error_cnt": a[8],
+      "receive_error_cnt": a[9],
+      "tx_q_max_used": a[10],
+      "tx_prio_q_max_used": a[11],
+    }
+
+  def safety_hook_stats(self):
+    """calls, max and average us in the rx, tx and fwd safety hooks since the last call"""
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc7, 0, 0, 40)
+    a = struct.unpack("<I9I", dat)
+    core_freq = a[0]
+    return {hook: {"calls": a[1 + 3*i], "max_us": a[2 + 3*i] / core_freq, "avg_us": a[3 + 3*i] / core_freq}
+            for i, hook in enumerate(("rx", "tx", "fwd"))}
+
   # ******************* control *******************
 
   def enter_bootloader(self):
@@ -461,6 +499,23 @@ class Panda(object):
     # TODO: This feature may not work correctly with saturated buses
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xdd, from_bus, to_bus, b'')
 
+  def set_can_filter(self, messages, hw_filter=True):
+    """Only forwards the received messages in messages, a list of (bus, address)
+    or (bus, address, decimation) to get one in decimation frames of it. None
+    forwards everything. Setting the safety mode clears it. With hw_filter the
+    CAN controllers drop the rest on the buses the safety mode doesn't read or forward."""
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xc3, int(messages is not None), 0, b'')
+    decimation = 1
+    for m in messages or []:
+      bus, addr, dec = (tuple(m) + (1,))[:3]
+      if dec != decimation:
+        decimation = dec
+        self._handle.controlWrite(Panda.REQUEST_OUT, 0xc5, decimation, 0, b'')
+      if self._handle.controlRead(Panda.REQUEST_IN, 0xc4, addr & 0xFFFF, (addr >> 16) | (bus << 13), 1) != b'\x01':
+        raise RuntimeError("CAN filter full")
+    if messages is not None and hw_filter:
+      self._handle.controlWrite(Panda.REQUEST_OUT, 0xc6, 1, 0, b'')
+
   def set_gmlan(self, bus=2):
     # TODO: check panda type
     if bus is None:
@@ -555,6 +610,11 @@ class Panda(object):
     """
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xf1, bus, 0, b'')
 
+  def get_microsecond_timer(self):
+    """The panda's microsecond timer, CAN bus times are bits 3 to 18 of it"""
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xfb, 0, 0, 4)
+    return struct.unpack("I", dat)[0]
+
   # ******************* isotp *******************
 
   def isotp_send(self, addr, dat, bus, recvaddr=None, subaddr=None):
@@ -24,10 +24,12 @@ struct EKF {
   void (*inv_err_fun)(double *, double *, double *);
   void (*H_mod_fun)(double *, double *);
   void (*predict)(double *, double *, double *, double);
+  void (*f_F_fun)(double *, double, double *, double *);
   std::unordered_map<int, void (*)(double *, double *, double *)> hs = {};
   std::unordered_map<int, void (*)(double *, double *, double *)> Hs = {};
   std::unordered_map<int, void (*)(double *, double *, double *, double *, double *)> updates = {};
   std::unordered_map<int, void (*)(double *, double *, double *)> Hes = {};
+  std::unordered_map<int, void (*)(double *, double *, double *, double *)> hHs = {};
   std::unordered_map<std::string, void (*)(double)> sets = {};
   std::unordered_map<std::string, extra_routine_t> extra_routines = {};
 };
@@ -5,7 +5,8 @@ using namespace Eigen;
 
 EKFSym::EKFSym(std::string name, Map<MatrixXdr> Q, Map<VectorXd> x_initial, Map<MatrixXdr> P_initial, int dim_main,
     int dim_main_err, int N, int dim_augment, int dim_augment_err, std::vector<int> maha_test_kinds,
-    std::vector<int> quaternion_idxs, std::vector<std::string> global_vars, double max_rewind_age)
+    std::vector<int> quaternion_idxs, std::vector<std::string> global_vars, double max_rewind_age,
+    double max_rewind_rate, bool rewind_covs)
 {
   // TODO: add logger
 
@@ -38,7 +39,15 @@ EKFSym::EKFSym(std::string name, Map<MatrixXdr> Q, Map<VectorXd> x_initial, Map<
   // Process noise
   this->Q = Q;
 
+  // enough checkpoints to cover max_rewind_age at the fastest observation rate
   this->max_rewind_age = max_rewind_age;
+  this->rewind_covs = rewind_covs;
+  int rewind_to_keep = REWIND_TO_KEEP;
+  if (max_rewind_rate > 0.0) {
+    rewind_to_keep = std::min(rewind_to_keep, (int)std::ceil(max_rewind_age * max_rewind_rate) + 1);
+  }
+  this->rewind_states.resize(rewind_to_keep);
+  this->replay.reserve(rewind_to_keep);
   this->init_state(x_initial, P_initial, NAN);
 }
 
@@ -85,13 +94,14 @@ std::optional<Estimate> EKFSym::predict_and_update_batch(double t, int kind, std
 {
   // TODO handle rewinding at this level
 
-  std::deque<Observation> rewound;
+  this->replay.clear();
   if (!std::isnan(this->filter_time) && t < this->filter_time) {
-    if (this->rewind_t.empty() || t < this->rewind_t.front() || t < this->rewind_t.back() - this->max_rewind_age) {
+    if (this->rewind_count == 0 || t < this->rewind_at(0).t ||
+        t < this->rewind_at(this->rewind_count - 1).t - this->max_rewind_age) {
       std::cout << "observation too old at " << t << " with filter at " << this->filter_time << ", ignoring" << std::endl;
       return std::nullopt;
     }
-    rewound = this->rewind(t);
+    this->rewind(t);
   }
 
   Observation obs;
@@ -108,51 +118,53 @@ std::optional<Estimate> EKFSym::predict_and_update_batch(double t, int kind, std
   std::optional<Estimate> res = std::make_optional(this->predict_and_update_batch(obs, augment));
 
   // optional fast forward
-  while (!rewound.empty()) {
-    this->predict_and_update_batch(rewound.front(), false);
-    rewound.pop_front();
+  for (int i = this->replay.size() - 1; i >= 0; i--) {
+    this->predict_and_update_batch(this->replay[i], false);
   }
 
   return res;
 }
 
 void EKFSym::reset_rewind() {
-  this->rewind_obscache.clear();
-  this->rewind_t.clear();
-  this->rewind_states.clear();
+  this->rewind_start = 0;
+  this->rewind_count = 0;
 }
 
-std::deque<Observation> EKFSym::rewind(double t) {
-  std::deque<Observation> rewound;
+Checkpoint& EKFSym::rewind_at(int i) {
+  return this->rewind_states[(this->rewind_start + i) % this->rewind_states.size()];
+}
 
+void EKFSym::rewind(double t) {
   // rewind observations until t is after previous observation
-  while (this->rewind_t.back() > t) {
-    rewound.push_front(this->rewind_obscache.back());
-    this->rewind_t.pop_back();
-    this->rewind_states.pop_back();
-    this->rewind_obscache.pop_back();
+  while (this->rewind_at(this->rewind_count - 1).t > t) {
+    this->replay.push_back(this->rewind_at(this->rewind_count - 1).obs);
+    this->rewind_count--;
   }
 
   // set the state to the time right before that
-  this->filter_time = this->rewind_t.back();
-  this->x = this->rewind_states.back().first;
-  this->P = this->rewind_states.back().second;
-
-  return rewound;
+  const Checkpoint& c = this->rewind_at(this->rewind_count - 1);
+  this->filter_time = c.t;
+  this->x = c.x;
+  if (this->rewind_covs) {
+    this->P = c.P;
+  }
 }
 
 void EKFSym::checkpoint(Observation& obs) {
-  // push to rewinder
-  this->rewind_t.push_back(this->filter_time);
-  this->rewind_states.push_back(std::make_pair(this->x, this->P));
-  this->rewind_obscache.push_back(obs);
-
   // only keep a certain number around
-  if (this->rewind_t.size() > REWIND_TO_KEEP) {
-    this->rewind_t.pop_front();
-    this->rewind_states.pop_front();
-    this->rewind_obscache.pop_front();
+  if (this->rewind_count == this->rewind_states.size()) {
+    this->rewind_start = (this->rewind_start + 1) % this->rewind_states.size();
+    this->rewind_count--;
+  }
+
+  // push to rewinder, reusing the storage of the checkpoint it replaces
+  Checkpoint& c = this->rewind_at(this->rewind_count++);
+  c.t = this->filter_time;
+  c.x = this->x;
+  if (this->rewind_covs) {
+    c.P = this->P;
   }
+  c.obs = obs;
 }
 
 Estimate EKFSym::predict_and_update_batch(Observation& obs, bool augment) {
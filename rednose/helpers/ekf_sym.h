@@ -28,6 +28,14 @@ typedef struct Observation {
   std::vector<std::vector<double>> extra_args;
 } Observation;
 
+// the filter time, the state right after obs was applied and obs
+typedef struct Checkpoint {
+  double t;
+  Eigen::VectorXd x;
+  MatrixXdr P;
+  Observation obs;
+} Checkpoint;
+
 typedef struct Estimate {
   Eigen::VectorXd xk1;
   Eigen::VectorXd xk;
@@ -46,7 +54,8 @@ public:
       Eigen::Map<MatrixXdr> P_initial, int dim_main, int dim_main_err, int N = 0, int dim_augment = 0,
       int dim_augment_err = 0, std::vector<int> maha_test_kinds = std::vector<int>(),
       std::vector<int> quaternion_idxs = std::vector<int>(),
-      std::vector<std::string> global_vars = std::vector<std::string>(), double max_rewind_age = 1.0);
+      std::vector<std::string> global_vars = std::vector<std::string>(), double max_rewind_age = 1.0,
+      double max_rewind_rate = 0.0, bool rewind_covs = true);
   void init_state(Eigen::Map<Eigen::VectorXd> state, Eigen::Map<MatrixXdr> covs, double filter_time);
 
   Eigen::VectorXd state();
@@ -65,7 +74,8 @@ public:
   extra_routine_t get_extra_routine(const std::string& routine);
 
 private:
-  std::deque<Observation> rewind(double t);
+  Checkpoint& rewind_at(int i);
+  void rewind(double t);
   void checkpoint(Observation& obs);
 
   Estimate predict_and_update_batch(Observation& obs, bool augment);
@@ -100,9 +110,11 @@ private:
 
   // rewind stuff
   double max_rewind_age;
-  std::deque<double> rewind_t;
-  std::deque<std::pair<Eigen::VectorXd, MatrixXdr>> rewind_states;
-  std::deque<Observation> rewind_obscache;
+  bool rewind_covs;  // when false only the state is restored on rewind, P stays the latest
+  std::vector<Checkpoint> rewind_states;  // ring of rewind_count checkpoints from rewind_start
+  int rewind_start = 0;
+  int rewind_count = 0;
+  std::vector<Observation> replay;  // rewound observations, newest first
 
   Eigen::VectorXd augment_times;
 
@@ -6,7 +6,7 @@ import numpy as np
 import sympy as sp
 from numpy import dot
 
-from rednose.helpers.sympy_helpers import sympy_into_c
+from rednose.helpers.sympy_helpers import sympy_into_c, sympy_into_c_fused
 from rednose.helpers import TEMPLATE_DIR, load_code
 from rednose.helpers.chi2_lookup import chi2_ppf
 
@@ -115,6 +115,15 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
   # Generate and wrap all th c code
   sympy_header, code = sympy_into_c(sympy_functions, global_vars)
 
+  # fused value and jacobian functions used by predict and update, sharing subexpressions
+  fused_functions = [('f_F_fun', [f_sym, F_sym], [x_sym, dt_sym])]
+  for h_sym, kind, ea_sym, H_sym, He_sym in obs_eqs:
+    fused_functions.append(('hH_%d' % kind, [h_sym, H_sym], [x_sym, ea_sym]))
+  for fused_name, exprs, args in fused_functions:
+    fused_header, fused_code = sympy_into_c_fused(fused_name, exprs, args)
+    sympy_header += "\n" + fused_header
+    code += "\n" + fused_code
+
   header = "#pragma once\n"
   header += "#include \"rednose/helpers/common_ekf.h\"\n"
   header += "extern \"C\" {\n"
@@ -125,6 +134,7 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
   pre_code += "#define EDIM %d\n" % dim_err
   pre_code += "#define MEDIM %d\n" % dim_main_err
   pre_code += "typedef void (*Hfun)(double *, double *, double *);\n"
+  pre_code += "typedef void (*hHfun)(double *, double *, double *, double *);\n"
 
   if global_vars is not None:
     for var in global_vars:
@@ -148,7 +158,7 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
 
     header += f"void {name}_update_{kind}(double *in_x, double *in_P, double *in_z, double *in_R, double *in_ea);\n"
     post_code += f"void {name}_update_{kind}(double *in_x, double *in_P, double *in_z, double *in_R, double *in_ea) {{\n"
-    post_code += f"  update<{h_sym.shape[0]}, 3, {int(maha_test)}>(in_x, in_P, h_{kind}, H_{kind}, {He_str}, in_z, in_R, in_ea, MAHA_THRESH_{kind});\n"
+    post_code += f"  update<{h_sym.shape[0]}, 3, {int(maha_test)}>(in_x, in_P, hH_{kind}, {He_str}, in_z, in_R, in_ea, MAHA_THRESH_{kind});\n"
     post_code += "}\n"
 
   # For ffi loading of specific functions
@@ -172,12 +182,13 @@ def gen_code(folder, name, f_sym, dt_sym, x_sym, obs_eqs, dim_x, dim_err, eskf_p
 
   post_code += "}\n\n" # extern c
 
-  funcs = ['f_fun', 'F_fun', 'err_fun', 'inv_err_fun', 'H_mod_fun', 'predict']
+  funcs = ['f_fun', 'F_fun', 'err_fun', 'inv_err_fun', 'H_mod_fun', 'predict', 'f_F_fun']
   func_lists = {
     'h': [kind for _, kind, _, _, _ in obs_eqs],
     'H': [kind for _, kind, _, _, _ in obs_eqs],
     'update': [kind for _, kind, _, _, _ in obs_eqs],
     'He': [kind for _, kind, _, _, _ in obs_eqs if msckf and kind in feature_track_kinds],
+    'hH': [kind for _, kind, _, _, _ in obs_eqs],
     'set': [var.name for var in global_vars] if global_vars is not None else [],
   }
   func_extra = [x[0] for x in extra_routines]
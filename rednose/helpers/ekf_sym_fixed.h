@@ -0,0 +1,198 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <eigen3/Eigen/Dense>
+
+#include "common_ekf.h"
+#include "ekf_sym.h"
+
+namespace EKFS {
+
+// EKFSym for a filter of fixed dimensions without augmented states: the state,
+// covariances and observations are fixed size Eigen types, and the rewind
+// history is a circular buffer allocated with the filter, so predicting and
+// updating doesn't allocate. Updates take up to MAX_BATCH observations of one
+// kind, each of up to MAX_Z values, sharing up to MAX_EXTRA extra args.
+template <int DIM_X, int DIM_ERR, int MAX_Z = 6, int MAX_EXTRA = 4, int MAX_BATCH = 8>
+class EKFSymFixed {
+public:
+  typedef Eigen::Matrix<double, DIM_X, 1> StateVec;
+  typedef Eigen::Matrix<double, DIM_ERR, DIM_ERR, Eigen::RowMajor> CovMat;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1, Eigen::ColMajor, MAX_Z * MAX_BATCH, 1> BatchVec;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor, MAX_Z * MAX_BATCH, MAX_Z> BatchMat;
+  static constexpr int max_batch = MAX_BATCH;
+
+  EKFSymFixed(std::string name, const CovMat &Q, const StateVec &x_initial, const CovMat &P_initial,
+      std::vector<int> quaternion_idxs = std::vector<int>(), double max_rewind_age = 1.0)
+    : Q(Q), quaternion_idxs(quaternion_idxs), max_rewind_age(max_rewind_age), rewind_states(REWIND_TO_KEEP) {
+    this->ekf = ekf_lookup(name);
+    assert(this->ekf);
+    this->replay.reserve(REWIND_TO_KEEP);
+    this->init_state(x_initial, P_initial, NAN);
+  }
+
+  void init_state(const StateVec &state, const CovMat &covs, double filter_time) {
+    this->x = state;
+    this->P = covs;
+    this->filter_time = filter_time;
+    this->reset_rewind();
+  }
+
+  const StateVec &state() const { return this->x; }
+  const CovMat &covs() const { return this->P; }
+  void set_filter_time(double t) { this->filter_time = t; }
+  double get_filter_time() const { return this->filter_time; }
+  void set_global(std::string global_var, double val) { this->ekf->sets.at(global_var)(val); }
+  extra_routine_t get_extra_routine(const std::string& routine) const { return this->ekf->extra_routines.at(routine); }
+
+  void reset_rewind() {
+    this->rewind_start = 0;
+    this->rewind_count = 0;
+  }
+
+  void predict(double t) {
+    // initialize time
+    if (std::isnan(this->filter_time)) {
+      this->filter_time = t;
+    }
+
+    double dt = t - this->filter_time;
+    assert(dt >= 0.0);
+
+    this->ekf->predict(this->x.data(), this->P.data(), const_cast<double *>(this->Q.data()), dt);
+    this->normalize_quaternions();
+    this->filter_time = t;
+  }
+
+  // false when the observation is older than the rewind history
+  bool predict_and_update(double t, int kind, const Eigen::Ref<const Eigen::VectorXd> &z,
+      const Eigen::Ref<const MatrixXdr> &R, const std::vector<double> &extra_args = {}) {
+    return this->predict_and_update_batch(t, kind, z, R, extra_args);
+  }
+
+  // n observations of the same kind after a single predict to t, with their
+  // z and R blocks stacked vertically: z is n * dim_z and R is n * dim_z x dim_z
+  bool predict_and_update_batch(double t, int kind, const Eigen::Ref<const Eigen::VectorXd> &z,
+      const Eigen::Ref<const MatrixXdr> &R, const std::vector<double> &extra_args = {}) {
+    assert(R.cols() <= MAX_Z && z.rows() == R.rows() && z.rows() % R.cols() == 0);
+    assert(z.rows() <= MAX_Z * MAX_BATCH);
+    assert(extra_args.size() <= MAX_EXTRA);
+
+    this->replay.clear();
+    if (!std::isnan(this->filter_time) && t < this->filter_time) {
+      if (this->rewind_count == 0 || t < this->rewind_at(0).t ||
+          t < this->rewind_at(this->rewind_count - 1).t - this->max_rewind_age) {
+        std::cout << "observation too old at " << t << " with filter at " << this->filter_time << ", ignoring" << std::endl;
+        return false;
+      }
+      this->rewind(t);
+    }
+
+    Observation obs;
+    obs.t = t;
+    obs.kind = kind;
+    obs.z = z;
+    obs.R = R;
+    obs.extra_args = Eigen::Map<const Eigen::VectorXd>(extra_args.data(), extra_args.size());
+    this->predict_and_update(obs);
+
+    // fast forward through the rewound ones
+    for (int i = this->replay.size() - 1; i >= 0; i--) {
+      this->predict_and_update(this->replay[i]);
+    }
+    return true;
+  }
+
+private:
+  struct Observation {
+    double t;
+    int kind;
+    BatchVec z;
+    BatchMat R;
+    Eigen::Matrix<double, Eigen::Dynamic, 1, Eigen::ColMajor, MAX_EXTRA, 1> extra_args;
+  };
+
+  // the filter time, the state right after obs was applied and obs
+  struct Checkpoint {
+    double t;
+    StateVec x;
+    CovMat P;
+    Observation obs;
+  };
+
+  Checkpoint &rewind_at(int i) { return this->rewind_states[(this->rewind_start + i) % REWIND_TO_KEEP]; }
+
+  // to the last checkpoint at or before t, the ones after it go to replay newest first
+  void rewind(double t) {
+    while (this->rewind_at(this->rewind_count - 1).t > t) {
+      this->replay.push_back(this->rewind_at(this->rewind_count - 1).obs);
+      this->rewind_count--;
+    }
+
+    const Checkpoint &c = this->rewind_at(this->rewind_count - 1);
+    this->filter_time = c.t;
+    this->x = c.x;
+    this->P = c.P;
+  }
+
+  void checkpoint(const Observation &obs) {
+    if (this->rewind_count == REWIND_TO_KEEP) {
+      this->rewind_start = (this->rewind_start + 1) % REWIND_TO_KEEP;
+      this->rewind_count--;
+    }
+    Checkpoint &c = this->rewind_at(this->rewind_count++);
+    c.t = this->filter_time;
+    c.x = this->x;
+    c.P = this->P;
+    c.obs = obs;
+  }
+
+  void predict_and_update(Observation &obs) {
+    this->predict(obs.t);
+
+    // with a block diagonal R the stacked update is the same as updating with each block in turn,
+    // the update writes the innovation over z so it gets a copy to keep obs intact for replays
+    auto update = this->ekf->updates.at(obs.kind);
+    int dim_z = obs.R.cols();
+    this->y = obs.z;
+    for (int i = 0; i < obs.z.rows(); i += dim_z) {
+      update(this->x.data(), this->P.data(), this->y.data() + i, obs.R.data() + i * dim_z, obs.extra_args.data());
+      this->normalize_quaternions();
+    }
+    this->checkpoint(obs);
+  }
+
+  void normalize_quaternions() {
+    for (int idx : this->quaternion_idxs) {
+      this->x.template segment<4>(idx).normalize();
+    }
+  }
+
+  // stuct with linked sympy generated functions
+  const EKF *ekf = NULL;
+
+  StateVec x;  // state
+  CovMat P;  // covs
+  double filter_time;
+
+  // process noise
+  const CovMat Q;
+
+  const std::vector<int> quaternion_idxs;
+
+  // rewind stuff
+  const double max_rewind_age;
+  std::vector<Checkpoint> rewind_states;
+  int rewind_start = 0;
+  int rewind_count = 0;
+  std::vector<Observation> replay;
+  BatchVec y;
+};
+
+}
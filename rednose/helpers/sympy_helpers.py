@@ -153,3 +153,30 @@ def sympy_into_c(sympy_functions, global_vars=None):
   c_code = '\n'.join(x for x in c_code.split("\n") if len(x) > 0 and x[0] != '#')
 
   return c_header, c_code
+
+
+def sympy_into_c_fused(name, exprs, args):
+  # one C function for several outputs, e.g. an observation and its jacobian,
+  # with the subexpressions they share computed once
+  replacements, reduced = sp.cse([sp.Matrix(e) for e in exprs], symbols=sp.numbered_symbols('cse'))
+
+  params = []
+  for aa in args:
+    if aa is None:
+      params.append('double *unused')
+    elif isinstance(aa, sp.MatrixSymbol):
+      params.append(f'double *{aa.name}')
+    else:
+      params.append(f'double {aa.name}')
+  params += [f'double *out_{i}' for i in range(len(exprs))]
+  signature = f"void {name}({', '.join(params)})"
+
+  c_code = signature + " {\n"
+  for sym, expr in replacements:
+    c_code += f"  const double {sym} = {sp.ccode(expr, standard='C99')};\n"
+  for i, mat in enumerate(reduced):
+    for j, expr in enumerate(mat):
+      c_code += f"  out_{i}[{j}] = {sp.ccode(expr, standard='C99')};\n"
+  c_code += "}\n"
+
+  return signature + ";", c_code
@@ -11,14 +11,12 @@ void predict(double *in_x, double *in_P, double *in_Q, double dt) {
   double nx[DIM] = {0};
   double in_F[EDIM*EDIM] = {0};
 
-  // functions from sympy
-  f_fun(in_x, dt, nx);
-  F_fun(in_x, dt, in_F);
+  // state and jacobian from sympy in one pass
+  f_F_fun(in_x, dt, nx, in_F);
 
-
-  EEM F(in_F);
+  Eigen::Map<EEM> F(in_F);
   EEM P(in_P);
-  EEM Q(in_Q);
+  Eigen::Map<EEM> Q(in_Q);
 
   RRM F_main = F.topLeftCorner(MEDIM, MEDIM);
   P.topLeftCorner(MEDIM, MEDIM) = (F_main * P.topLeftCorner(MEDIM, MEDIM)) * F_main.transpose();
@@ -35,7 +33,7 @@ void predict(double *in_x, double *in_P, double *in_Q, double dt) {
 // note: extra_args dim only correct when null space projecting
 // otherwise 1
 template <int ZDIM, int EADIM, bool MAHA_TEST>
-void update(double *in_x, double *in_P, Hfun h_fun, Hfun H_fun, Hfun Hea_fun, double *in_z, double *in_R, double *in_ea, double MAHA_THRESHOLD) {
+void update(double *in_x, double *in_P, hHfun hH_fun, Hfun Hea_fun, double *in_z, double *in_R, double *in_ea, double MAHA_THRESHOLD) {
   typedef Eigen::Matrix<double, ZDIM, ZDIM, Eigen::RowMajor> ZZM;
   typedef Eigen::Matrix<double, ZDIM, DIM, Eigen::RowMajor> ZDM;
   typedef Eigen::Matrix<double, Eigen::Dynamic, EDIM, Eigen::RowMajor> XEM;
@@ -55,10 +53,9 @@ void update(double *in_x, double *in_P, Hfun h_fun, Hfun H_fun, Hfun Hea_fun, do
   EEM P(in_P);
   ZZM pre_R(in_R);
 
-  // functions from sympy
-  h_fun(in_x, in_ea, in_hx);
-  H_fun(in_x, in_ea, in_H);
-  ZDM pre_H(in_H);
+  // observation and jacobian from sympy in one pass
+  hH_fun(in_x, in_ea, in_hx, in_H);
+  Eigen::Map<ZDM> pre_H(in_H);
 
   // get y (y = z - hx)
   Eigen::Matrix<double, ZDIM, 1> pre_y(in_hx); pre_y = z - pre_y;
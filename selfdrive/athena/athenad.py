@@ -57,6 +57,17 @@ UploadItem = namedtuple('UploadItem', ['path', 'url', 'headers', 'created_at', '
 
 cur_upload_items = {}
 
+# the uploader holds back while athenad was active within ATHENA_YIELD_TIME, see uploader.py
+last_active = 0.
+
+
+def mark_active():
+  global last_active
+  now = sec_since_boot()
+  if now - last_active > 1.:
+    last_active = now
+    Params().put("AthenadActiveTime", str(int(now * 1e9)))
+
 
 def handle_long_poll(ws):
   end_event = threading.Event()
@@ -91,6 +102,7 @@ def jsonrpc_handler(end_event):
     try:
       data = recv_queue.get(timeout=1)
       if "method" in data:
+        mark_active()
         cloudlog.debug(f"athena.jsonrpc_handler.call_method {data}")
         response = JSONRPCResponseManager.handle(data, dispatcher)
         send_queue.put_nowait(response.json)
@@ -120,6 +132,7 @@ def upload_handler(end_event):
       try:
         def cb(sz, cur):
           cur_upload_items[tid] = cur_upload_items[tid]._replace(progress=cur / sz if sz else 1)
+          mark_active()
 
         _do_upload(cur_upload_items[tid], cb)
       except (requests.exceptions.Timeout, requests.exceptions.ConnectionError, requests.exceptions.SSLError) as e:
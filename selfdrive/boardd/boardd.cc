@@ -1,5 +1,6 @@
 #include <sched.h>
 #include <sys/cdefs.h>
+#include <sys/eventfd.h>
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -12,20 +13,33 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <libusb-1.0/libusb.h>
 
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/messaging/messaging.h"
+#include "cereal/messaging/trace.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/readiness.h"
+#include "selfdrive/common/ratekeeper.h"
+#include "selfdrive/common/sched.h"
+#include "selfdrive/common/spsc_queue.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/time_sync.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 #include "selfdrive/locationd/ublox_msg.h"
 
+#include "selfdrive/boardd/event_loop.h"
 #include "selfdrive/boardd/panda.h"
 #include "selfdrive/boardd/pigeon.h"
 
@@ -35,81 +49,103 @@
 #define SATURATE_IL 1600
 #define NIBBLE_TO_HEX(n) ((n) < 10 ? (n) + '0' : ((n) - 10) + 'a')
 
-std::atomic<bool> safety_setter_thread_running(false);
 std::atomic<bool> ignition(false);
 
 ExitHandler do_exit;
 
-void safety_setter_thread(Panda *panda) {
-  LOGD("Starting safety setter thread");
-  // diagnostic only is the default, needed for VIN query
-  if (!panda->disable_relay) {
-  panda->set_safety_model(cereal::CarParams::SafetyModel::ELM327);
+// Sets the safety mode on car start: the VIN query goes first, then CarParams
+// are waited for. update() goes on after start() until the mode is set, it's
+// called when a param changed and every 100 ms, 1 s with the params watch
+class SafetySetter {
+public:
+  SafetySetter(const std::vector<Panda *> &pandas)
+    : pandas(pandas), watcher(p.getParamsPath(), {"CarVin", "ControlsReady", "CarParams"}) {}
+
+  // readable when a param changed, -1 without the watch
+  int params_fd() const { return watcher.fd(); }
+  void params_changed() {
+    if (!watcher.changed().empty()) update();
   }
 
-  Params p = Params();
-
-  if (!panda->disable_relay && !panda->is_old_panda) {
-  // switch to SILENT when CarVin param is read
-  while (true) {
-    if (do_exit || !panda->connected) {
-      safety_setter_thread_running = false;
+  void start() {
+    if (state != IDLE) {
+      LOGW("Safety setter already running");
       return;
-    };
+    }
+    LOGD("Starting safety setter");
+    Panda *panda = pandas[0];
+    // fingerprinting needs all of the CAN. Not every panda gets a new safety mode
+    // that drops the filter: the others keep NO_OUTPUT, and so does this one with the relay disabled
+    for (auto p : pandas) {
+      p->set_can_filter({});
+    }
+    // diagnostic only is the default, needed for VIN query
+    if (!panda->disable_relay) {
+    panda->set_safety_model(cereal::CarParams::SafetyModel::ELM327);
+    }
 
-    std::string value_vin = p.get("CarVin");
-    if (value_vin.size() > 0) {
-      // sanity check VIN format
-      assert(value_vin.size() == 17);
-      LOGW("got CarVin %s", value_vin.c_str());
-      break;
+    if (!panda->disable_relay && !panda->is_old_panda) {
+      state = WAIT_VIN;
+    } else {
+      LOGW("waiting for params to set safety model");
+      state = WAIT_PARAMS;
     }
-    util::sleep_for(100);
+    update();
   }
 
-  // VIN query done, stop listening to OBDII
-  panda->set_safety_model(cereal::CarParams::SafetyModel::ELM327, 1);
-  }
-  std::string params;
-  LOGW("waiting for params to set safety model");
-  while (true) {
-    if (do_exit || !panda->connected) {
-      safety_setter_thread_running = false;
-      return;
-    };
+  void update() {
+    if (state == WAIT_VIN) {
+      // switch to SILENT when CarVin param is read
+      std::string value_vin = p.get("CarVin");
+      if (value_vin.size() == 0) return;
 
-    if (p.getBool("ControlsReady")) {
-      params = p.get("CarParams");
-      if (params.size() > 0) break;
+      // sanity check VIN format
+      assert(value_vin.size() == 17);
+      LOGW("got CarVin %s", value_vin.c_str());
+
+      // VIN query done, stop listening to OBDII
+      pandas[0]->set_safety_model(cereal::CarParams::SafetyModel::ELM327, 1);
+      LOGW("waiting for params to set safety model");
+      state = WAIT_PARAMS;
+    } else if (state == WAIT_PARAMS) {
+      if (!p.getBool("ControlsReady")) return;
+      std::unique_ptr<ParamsMapping> params = p.map("CarParams");
+      if (!params) return;
+      LOGW("got %zu bytes CarParams", params->size());
+
+      capnp::FlatArrayMessageReader cmsg(kj::arrayPtr((const capnp::word *)params->data(), params->size() / sizeof(capnp::word)));
+      cereal::CarParams::Reader car_params = cmsg.getRoot<cereal::CarParams>();
+      cereal::CarParams::SafetyModel safety_model = car_params.getSafetyModel();
+
+      Panda *panda = pandas[0];
+      panda->set_unsafe_mode(9);  // see safety_declarations.h for allowed values
+
+      auto safety_param = car_params.getSafetyParam();
+      LOGW("setting safety model: %d with param %d", (int)safety_model, safety_param);
+
+      panda->set_safety_model(safety_model, safety_param);
+      for (auto p : pandas) {
+        p->set_can_filter(car_params.getCanRxFilter());
+      }
+      state = IDLE;
     }
-    util::sleep_for(100);
   }
-  LOGW("got %d bytes CarParams", params.size());
-
-  AlignedBuffer aligned_buf;
-  capnp::FlatArrayMessageReader cmsg(aligned_buf.align(params.data(), params.size()));
-  cereal::CarParams::Reader car_params = cmsg.getRoot<cereal::CarParams>();
-  cereal::CarParams::SafetyModel safety_model = car_params.getSafetyModel();
 
-  panda->set_unsafe_mode(9);  // see safety_declarations.h for allowed values
+private:
+  enum { IDLE, WAIT_VIN, WAIT_PARAMS } state = IDLE;
+  const std::vector<Panda *> &pandas;
+  Params p;
+  ParamsWatcher watcher;
+};
 
-  auto safety_param = car_params.getSafetyParam();
-  LOGW("setting safety model: %d with param %d", (int)safety_model, safety_param);
 
-  panda->set_safety_model(safety_model, safety_param);
-
-  safety_setter_thread_running = false;
+// a reconnect writes the same values again, that's a fsync each for nothing
+static void put_changed(Params &params, const char *key, const std::string &value) {
+  if (params.get(key) != value) params.put(key, value);
 }
 
-
-Panda *usb_connect() {
-  std::unique_ptr<Panda> panda;
-  try {
-    panda = std::make_unique<Panda>();
-  } catch (std::exception &e) {
-    return nullptr;
-  }
-
+// sets up a panda that was just opened, false if it doesn't answer
+static bool usb_connect(Panda *panda, bool primary) {
   Params params = Params();
 
   if (getenv("BOARDD_LOOPBACK")) {
@@ -117,25 +153,29 @@ Panda *usb_connect() {
   }
 
   if (auto fw_sig = panda->get_firmware_version(); fw_sig) {
-    params.put("PandaFirmware", (const char *)fw_sig->data(), fw_sig->size());
-
     // Convert to hex for offroad
-    char fw_sig_hex_buf[16] = {0};
+    char fw_sig_hex_buf[17] = {0};
     const uint8_t *fw_sig_buf = fw_sig->data();
     for (size_t i = 0; i < 8; i++) {
       fw_sig_hex_buf[2*i] = NIBBLE_TO_HEX((uint8_t)fw_sig_buf[i] >> 4);
       fw_sig_hex_buf[2*i+1] = NIBBLE_TO_HEX((uint8_t)fw_sig_buf[i] & 0xF);
     }
 
-    params.put("PandaFirmwareHex", fw_sig_hex_buf, 16);
+    if (primary) {
+      put_changed(params, "PandaFirmware", std::string((const char *)fw_sig->data(), fw_sig->size()));
+      put_changed(params, "PandaFirmwareHex", std::string(fw_sig_hex_buf, 16));
+    }
     LOGW("fw signature: %.*s", 16, fw_sig_hex_buf);
-  } else { return nullptr; }
+  } else { return false; }
 
   // get panda serial
   if (auto serial = panda->get_serial(); serial) {
-    params.put("PandaDongleId", serial->c_str(), serial->length());
+    if (primary) put_changed(params, "PandaDongleId", *serial);
     LOGW("panda serial: %s", serial->c_str());
-  } else { return nullptr; }
+  } else { return false; }
+
+  // the rest is the device's, it goes through the primary panda
+  if (!primary) return true;
 
   // power on charging, only the first time. Panda can also change mode and it causes a brief disconneciton
 #if !defined(__x86_64__) && !defined(XNX)
@@ -143,12 +183,12 @@ Panda *usb_connect() {
   std::call_once(connected_once, &Panda::set_usb_power_mode, panda, cereal::PandaState::UsbPowerMode::CDP);
 #endif
 
-  if (panda->has_rtc) {
-    setenv("TZ","UTC",1);
-    struct tm sys_time = util::get_time();
+  // the RTC is only read when the system time needs it
+  struct tm sys_time = util::get_time();
+  if (panda->has_rtc && !util::time_valid(sys_time)) {
     struct tm rtc_time = panda->get_rtc();
 
-    if (!util::time_valid(sys_time) && util::time_valid(rtc_time)) {
+    if (util::time_valid(rtc_time)) {
       LOGE("System time wrong, setting from RTC. "
            "System: %d-%02d-%02d %02d:%02d:%02d RTC: %d-%02d-%02d %02d:%02d:%02d",
            sys_time.tm_year + 1900, sys_time.tm_mon + 1, sys_time.tm_mday,
@@ -161,36 +201,116 @@ Panda *usb_connect() {
     }
   }
 
-  return panda.release();
+  return true;
+}
+
+// BOARDD_PANDAS is a comma separated list of serials, the first one is the
+// primary panda. Without it all connected pandas are used, the internal one or
+// else the lowest serial is primary. The others follow by serial, the buses
+// of each panda come PANDA_BUS_CNT after those of the one before
+static std::vector<std::string> panda_serials(bool &ordered) {
+  std::vector<std::string> serials;
+  std::string list = util::getenv("BOARDD_PANDAS");
+  ordered = !list.empty();
+  if (ordered) {
+    std::stringstream ss(list);
+    for (std::string serial; std::getline(ss, serial, ',');) {
+      if (!serial.empty()) serials.push_back(serial);
+    }
+  } else {
+    serials = Panda::list();
+    std::sort(serials.begin(), serials.end());
+  }
+  return serials;
 }
 
-// must be called before threads or with mutex
-static Panda *usb_retry_connect() {
+// must be called before threads or with mutex. Until the pandas are there an
+// empty pandaState goes out every 500 ms
+static std::vector<Panda *> usb_retry_connect(PubMaster &pm) {
   LOGW("attempting to connect");
+  double last_state_time = 0;
   while (!do_exit) {
+    if (millis_since_boot() - last_state_time >= 500) {
+      last_state_time = millis_since_boot();
+      MessageBuilder msg;
+      auto pandaState  = msg.initEvent().initPandaState();
+
+      pandaState.setPandaType(cereal::PandaState::PandaType::UNKNOWN);
+      pm.send("pandaState", msg);
+    }
+
     #ifdef XNX
     std::system("python /data/openpilot/scripts/reset_usb.py");
     util::sleep_for(500);
     #endif
-    Panda *panda = usb_connect();
-    if (panda) {
-      LOGW("connected to board");
-      return panda;
+    bool ordered = false;
+    std::vector<std::string> serials = panda_serials(ordered);
+    if (serials.empty()) serials.push_back("");  // whatever panda there is
+
+    // the pandas are separate devices, they're opened and set up at the same time
+    std::vector<std::future<Panda *>> opening;
+    for (auto &serial : serials) {
+      opening.push_back(std::async(std::launch::async, [serial]() -> Panda * {
+        try {
+          return new Panda(serial);
+        } catch (std::exception &e) {
+          return nullptr;
+        }
+      }));
     }
-    util::sleep_for(100);
+    std::vector<Panda *> pandas;
+    for (auto &f : opening) pandas.push_back(f.get());
+
+    if (!ordered && pandas.size() > 1) {
+      // the internal panda powers and times the device, it's the primary one
+      for (int i = 0; i < pandas.size(); i++) {
+        if (pandas[i] && (pandas[i]->hw_type == cereal::PandaState::PandaType::UNO ||
+                          pandas[i]->hw_type == cereal::PandaState::PandaType::DOS)) {
+          std::rotate(pandas.begin(), pandas.begin() + i, pandas.begin() + i + 1);
+          break;
+        }
+      }
+    }
+
+    std::vector<std::future<bool>> setup;
+    for (int i = 0; i < pandas.size(); i++) {
+      setup.push_back(std::async(std::launch::async, [panda = pandas[i], i]() {
+        return panda != nullptr && usb_connect(panda, i == 0);
+      }));
+    }
+    bool ok = true;
+    for (auto &f : setup) ok &= f.get();
+
+    if (ok) {
+      for (int i = 0; i < pandas.size(); i++) pandas[i]->bus_offset = i * PANDA_BUS_CNT;
+      LOGW("connected to %zu board(s)", pandas.size());
+      return pandas;
+    }
+    for (auto panda : pandas) delete panda;
+    // back as soon as a panda enumerates
+    PandaTransport::wait_for_device(100);
   };
-  return nullptr;
+  return {};
 }
 
-void can_recv(Panda *panda, PubMaster &pm) {
-  kj::Array<capnp::word> can_data;
-  panda->can_receive(can_data);
-  auto bytes = can_data.asBytes();
-  pm.send("can", bytes.begin(), bytes.size());
+// a lost panda restarts all of them
+static bool pandas_connected(const std::vector<Panda *> &pandas) {
+  return std::all_of(pandas.begin(), pandas.end(), [](Panda *p) { return p->connected.load(); });
 }
 
-void can_send_thread(Panda *panda, bool fake_send) {
+// Every panda has its own send and receive workers. The receive workers hand
+// their packets to can_publish_thread, which merges them into one can stream
+struct CanChunk {
+  uint64_t recv_time;  // when it came in, 0 for a read that got nothing
+  int size;            // bytes of packets in data
+  uint32_t data[CAN_RECV_BUF_SIZE / 4];
+};
+// room for a full drain of the panda while the publisher is busy
+typedef SPSCQueue<CanChunk, 2 * CAN_RECV_DRAIN> CanQueue;
+
+void can_send_thread(const std::vector<Panda *> &pandas, int idx, bool fake_send) {
   LOGD("start send thread");
+  Panda *panda = pandas[idx];
 
   AlignedBuffer aligned_buf;
   Context * context = Context::create();
@@ -199,7 +319,7 @@ void can_send_thread(Panda *panda, bool fake_send) {
   subscriber->setTimeout(100);
 
   // run as fast as messages come in
-  while (!do_exit && panda->connected) {
+  while (!do_exit && pandas_connected(pandas)) {
     Message * msg = subscriber->receive();
 
     if (!msg) {
@@ -226,99 +346,404 @@ void can_send_thread(Panda *panda, bool fake_send) {
   delete context;
 }
 
-void can_recv_thread(Panda *panda) {
-  LOGD("start recv thread");
+// BOARDD_ASYNC_SEND writes sendcan with async transfers that don't wait for
+// usb_lock, and control transfers of the other threads yield to them. The
+// time each sendcan took through the primary panda goes out as sendcanTiming
+void can_send_async_thread(const std::vector<Panda *> &pandas, int idx, bool fake_send) {
+  LOGD("start async send thread");
+  Panda *panda = pandas[idx];
 
-  // can = 8006
-  PubMaster pm({"can"});
+  AlignedBuffer aligned_buf;
+  Context * context = Context::create();
+  SubSocket * subscriber = SubSocket::create(context, "sendcan");
+  assert(subscriber != NULL);
+  subscriber->setTimeout(100);
+  std::unique_ptr<PubMaster> pm;
+  if (idx == 0) pm = std::make_unique<PubMaster>(std::vector<const char *>{"sendcanTiming"});
+  std::vector<CanSendTiming> done;
 
-  // run at 100hz
-  const uint64_t dt = 10000000ULL;
-  uint64_t next_frame_time = nanos_since_boot() + dt;
+  while (!do_exit && pandas_connected(pandas)) {
+    Message * msg = subscriber->receive();
+
+    if (!msg) {
+      if (errno == EINTR) {
+        do_exit = true;
+      }
+      continue;
+    }
 
-  while (!do_exit && panda->connected) {
-    can_recv(panda, pm);
+    CanSendTiming timing = {.recv_time = nanos_since_boot()};
+    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg));
+    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+    timing.sendcan_time = event.getLogMonoTime();
 
-    uint64_t cur_time = nanos_since_boot();
-    int64_t remaining = next_frame_time - cur_time;
-    if (remaining > 0) {
-      std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
-    } else {
-      if (ignition) {
-        LOGW("missed cycles (%d) %lld", (int)-1*remaining/dt, remaining);
+    //Dont send if older than 1 second
+    bool sent = false;
+    if (nanos_since_boot() - event.getLogMonoTime() < 1e9) {
+      if (!fake_send) {
+        sent = panda->can_send_async(event.getSendcan(), timing);
       }
-      next_frame_time = cur_time;
     }
+    delete msg;
 
-    next_frame_time += dt;
+    // the next sendcan is at least a few ms away, so waiting for this one costs nothing
+    if (sent) panda->can_send_poll(done, 5000);
+    for (auto &t : done) {
+      if (!pm) break;
+      PooledMessageBuilder timing_msg("sendcanTiming");
+      auto st = timing_msg.initEvent().initSendcanTiming();
+      st.setSendcanMonoTime(t.sendcan_time);
+      st.setReceiveTime(t.recv_time);
+      st.setSubmitTime(t.submit_time);
+      st.setCompleteTime(t.complete_time);
+      st.setMessages(t.messages);
+      st.setSuccess(t.ok);
+      pm->send("sendcanTiming", timing_msg);
+    }
+    done.clear();
   }
+  panda->can_send_stop();
+
+  delete subscriber;
+  delete context;
 }
 
-void panda_state_thread(Panda *&panda, bool spoofing_started) {
-  LOGD("start panda state thread");
-  PubMaster pm({"pandaState"});
+void can_recv_thread(const std::vector<Panda *> &pandas, int idx, CanQueue &queue) {
+  LOGD("start recv thread");
+  Panda *panda = pandas[idx];
 
-  uint32_t no_ignition_cnt = 0;
-  bool ignition_last = false;
-  Params params = Params();
-  if (params.getBool("dp_toyota_disable_relay")) panda->disable_relay = true;
+  // run at 100hz
+  RateKeeper rk("can_recv", 100);
+
+  CanChunk chunk;
+  while (!do_exit && pandas_connected(pandas)) {
+    // under high bus load the panda's queue fills faster than one read per
+    // cycle takes out, read again right away until it comes back short
+    for (int i = 0; i < CAN_RECV_DRAIN; i++) {
+      bool full = false;
+      chunk.size = panda->can_receive(chunk.data, full);
+      chunk.recv_time = chunk.size > 0 ? nanos_since_boot() : 0;
+      if (!queue.push(chunk)) {
+        LOGE_100("can queue of panda %d full", idx);
+      }
+      if (!full) break;
+      if (i == CAN_RECV_DRAIN - 1) LOGW("Receive buffer full");
+    }
 
-  // Broadcast empty pandaState message when panda is not yet connected
-  while (!do_exit && !panda) {
-    MessageBuilder msg;
-    auto pandaState  = msg.initEvent().initPandaState();
+    int64_t remaining = rk.remaining();
+    if (rk.keepTime() && ignition) {
+      LOGW("missed cycles (%d) %lld", (int)(-remaining / 10000000LL), (long long)remaining);
+    }
+  }
+}
 
-    pandaState.setPandaType(cereal::PandaState::PandaType::UNKNOWN);
-    pm.send("pandaState", msg);
-    util::sleep_for(500);
+// BOARDD_ASYNC_RECV hands packets on as soon as transfers on the CAN endpoint
+// complete instead of on a 100 Hz tick
+void can_recv_async_thread(const std::vector<Panda *> &pandas, int idx, CanQueue &queue) {
+  LOGD("start async recv thread");
+  Panda *panda = pandas[idx];
+
+  std::vector<uint32_t> data;
+  CanChunk chunk;
+  panda->can_recv_start(CAN_RECV_TRANSFERS);
+  while (!do_exit && pandas_connected(pandas)) {
+    const uint64_t recv_time = panda->can_recv_poll(data, 10000);
+    for (size_t pos = 0; pos < data.size(); pos += chunk.size / 4) {
+      chunk.recv_time = recv_time;
+      // chunks end on packet boundaries, there's always a whole one as packets are smaller than RECV_SIZE
+      chunk.size = panda->can_packets_size(&data[pos], std::min(data.size() - pos, (size_t)RECV_SIZE / 4) * sizeof(uint32_t));
+      std::copy_n(&data[pos], chunk.size / sizeof(uint32_t), chunk.data);
+      if (!queue.push(chunk)) {
+        LOGE_100("can queue of panda %d full", idx);
+      }
+    }
+    data.clear();
   }
+  panda->can_recv_stop();
+}
 
-  // run at 2hz
-  while (!do_exit && panda->connected) {
-    health_t pandaState = panda->get_state();
+// Publishes what the receive workers got as one can message. The primary
+// panda sets the pace, the packets of the others go out with its next message,
+// at most 2 ms later. BOARDD_CAN_COALESCE_MS holds what came in for that long
+// to send fewer, larger messages. Without any CAN traffic an empty can is
+// still sent at 100 Hz
+void can_publish_thread(const std::vector<Panda *> &pandas, std::vector<std::unique_ptr<CanQueue>> &queues) {
+  LOGD("start can publish thread");
 
-    if (spoofing_started) {
-      pandaState.ignition_line = 1;
+  PubMaster pm({"can"});
+  const uint64_t coalesce = util::getenv("BOARDD_CAN_COALESCE_MS", 0) * 1000000ULL;
+  const uint64_t max_interval = 10000000ULL;
+  const int max_wait_ms = pandas.size() > 1 ? 2 : 10;
+
+  // receive to publish latency, logged every minute
+  uint64_t latency_sum = 0, latency_max = 0, latency_cnt = 0;
+  uint64_t last_report = nanos_since_boot();
+
+  // chunks waiting to be published and the panda they are from
+  std::vector<std::pair<int, CanChunk>> pending;
+  pending.reserve(8 * queues.size());
+  uint64_t first_recv = 0, last_publish = nanos_since_boot();
+  CanChunk chunk;
+  while (!do_exit && pandas_connected(pandas)) {
+    uint64_t now = nanos_since_boot();
+    const uint64_t deadline = first_recv ? first_recv + coalesce : last_publish + max_interval;
+    const int wait_ms = deadline > now ? std::min<int>((deadline - now + 999999) / 1000000, max_wait_ms) : 0;
+    for (int i = 0; i < queues.size(); i++) {
+      while (queues[i]->try_pop(chunk, i == 0 ? wait_ms : 0)) {
+        if (chunk.size > 0) {
+          pending.push_back({i, chunk});
+          if (first_recv == 0 || chunk.recv_time < first_recv) first_recv = chunk.recv_time;
+        }
+        if (i == 0) break;
+      }
     }
-    if (!panda->disable_relay) {
-    // Make sure CAN buses are live: safety_setter_thread does not work if Panda CAN are silent and there is only one other CAN node
-    if (pandaState.safety_model == (uint8_t)(cereal::CarParams::SafetyModel::SILENT)) {
-      panda->set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
+
+    now = nanos_since_boot();
+    if ((first_recv != 0 && now >= first_recv + coalesce) || now >= last_publish + max_interval) {
+      TRACE_SPAN("can_recv");
+      int num_msg = 0, data_words = 0;
+      bool valid = true;
+      for (auto &[i, c] : pending) num_msg += pandas[i]->can_count(c.data, c.size, data_words);
+      for (auto panda : pandas) valid &= panda->comms_healthy;
+
+      // built in place in the can ring, no allocations or copies per message
+      RingMessageBuilder msg(pm, "can", CAN_MSG_SIZE(num_msg, data_words));
+      auto can_data = msg.initEvent(valid).initCan(num_msg);
+      int start = 0;
+      for (auto &[i, c] : pending) {
+        pandas[i]->can_unpack(c.data, c.size, c.recv_time, can_data, start);
+        int unused = 0;
+        start += pandas[i]->can_count(c.data, c.size, unused);
+      }
+      msg.send();
+
+      last_publish = nanos_since_boot();
+      if (first_recv != 0) {
+        const uint64_t latency = last_publish - first_recv;
+        latency_sum += latency;
+        latency_max = std::max(latency_max, latency);
+        latency_cnt++;
+      }
+      pending.clear();
+      first_recv = 0;
     }
+
+    if (now - last_report > 60000000000ULL) {
+      if (latency_cnt > 0) {
+        LOG("can recv: %lu messages with data, usb to publish %.3f ms mean, %.3f ms max",
+            latency_cnt, latency_sum / latency_cnt / 1e6, latency_max / 1e6);
+      }
+      latency_sum = latency_max = latency_cnt = 0;
+      last_report = now;
     }
-    ignition = ((pandaState.ignition_line != 0) || (pandaState.ignition_can != 0));
+  }
+}
 
-    if (ignition) {
-      no_ignition_cnt = 0;
-    } else {
-      no_ignition_cnt += 1;
+static void fill_panda_state(cereal::PandaState::Builder &ps, Panda *panda, const health_t &pandaState, bool primary) {
+  ps.setUptime(pandaState.uptime);
+
+  // the device's own supply is only measured for the panda that powers it
+  if (primary && Hardware::TICI()) {
+    double read_time = millis_since_boot();
+    static util::FileReader voltage("/sys/class/hwmon/hwmon1/in1_input");
+    static util::FileReader current("/sys/class/hwmon/hwmon1/curr1_input");
+    ps.setVoltage(std::atoi(voltage.read().c_str()));
+    ps.setCurrent(std::atoi(current.read().c_str()));
+    read_time = millis_since_boot() - read_time;
+    if (read_time > 50) {
+      LOGW("reading hwmon took %lfms", read_time);
     }
+  } else {
+    ps.setVoltage(pandaState.voltage);
+    ps.setCurrent(pandaState.current);
+  }
 
-#if !defined(__x86_64__) && !defined(XNX)
-    bool power_save_desired = !ignition;
-    if (pandaState.power_save_enabled != power_save_desired) {
-      panda->set_power_saving(power_save_desired);
+  ps.setIgnitionLine(pandaState.ignition_line);
+  ps.setIgnitionCan(pandaState.ignition_can);
+  ps.setControlsAllowed(pandaState.controls_allowed);
+  ps.setGasInterceptorDetected(pandaState.gas_interceptor_detected);
+  ps.setHasGps(true);
+  ps.setCanRxErrs(pandaState.can_rx_errs);
+  ps.setCanSendErrs(pandaState.can_send_errs);
+  ps.setCanFwdErrs(pandaState.can_fwd_errs);
+  ps.setGmlanSendErrs(pandaState.gmlan_send_errs);
+  ps.setPandaType(panda->hw_type);
+  ps.setUsbPowerMode(cereal::PandaState::UsbPowerMode(pandaState.usb_power_mode));
+  ps.setSafetyModel(cereal::CarParams::SafetyModel(pandaState.safety_model));
+  ps.setSafetyParam(pandaState.safety_param);
+  ps.setFaultStatus(cereal::PandaState::FaultStatus(pandaState.fault_status));
+  ps.setPowerSaveEnabled((bool)(pandaState.power_save_enabled));
+  ps.setHeartbeatLost((bool)(pandaState.heartbeat_lost));
+  ps.setHarnessStatus(cereal::PandaState::HarnessStatus(pandaState.car_harness_status));
+  ps.setCanRxQueueSize(pandaState.can_rx_q_size);
+  ps.setCanRxQueueMaxUsed(pandaState.can_rx_q_max_used);
+  if (pandaState.can_rx_q_size > 0 && pandaState.can_rx_q_max_used >= pandaState.can_rx_q_size * 3 / 4) {
+    LOGW("panda CAN rx queue at %u of %u", pandaState.can_rx_q_max_used, pandaState.can_rx_q_size);
+  }
+
+  if (auto hook_stats = panda->get_safety_hook_stats()) {
+    auto fill = [&](cereal::PandaState::SafetyHookStats::Builder b, const safety_hook_time_t &t) {
+      b.setCalls(t.calls);
+      b.setMaxUs((float)t.max_cycles / hook_stats->core_freq);
+      b.setAvgUs((float)t.avg_cycles / hook_stats->core_freq);
+    };
+    fill(ps.initSafetyRxHook(), hook_stats->rx);
+    fill(ps.initSafetyTxHook(), hook_stats->tx);
+    fill(ps.initSafetyFwdHook(), hook_stats->fwd);
+  }
+
+  // Convert faults bitset to capnp list
+  std::bitset<sizeof(pandaState.faults) * 8> fault_bits(pandaState.faults);
+  auto faults = ps.initFaults(fault_bits.count());
+
+  size_t i = 0;
+  for (size_t f = size_t(cereal::PandaState::FaultType::RELAY_MALFUNCTION);
+      f <= size_t(cereal::PandaState::FaultType::INTERRUPT_RATE_TICK); f++) {
+    if (fault_bits.test(f)) {
+      faults.set(i, cereal::PandaState::FaultType(f));
+      i++;
     }
-    if (!panda->disable_relay) {
-    // set safety mode to NO_OUTPUT when car is off. ELM327 is an alternative if we want to leverage athenad/connect
-    if (!ignition && (pandaState.safety_model != (uint8_t)(cereal::CarParams::SafetyModel::NO_OUTPUT))) {
-      panda->set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
+  }
+}
+
+// rates since the last call, bus load from the bit rates the panda reports.
+// Old firmware doesn't have the CAN health request, that's 500 kbit/s
+static void publish_can_stats(PubMaster &pm, const std::vector<Panda *> &pandas, uint64_t &last_time) {
+  const uint64_t now = nanos_since_boot();
+  const double dt = (now - last_time) * 1e-9;
+  last_time = now;
+
+  PooledMessageBuilder msg("canStats");
+  auto can_stats = msg.initEvent().initCanStats();
+  auto buses = can_stats.initBuses(pandas.size() * PANDA_BUS_CNT);
+  auto panda_stats = can_stats.initPandas(pandas.size());
+  for (int i = 0; i < pandas.size(); i++) {
+    const CanStats stats = pandas[i]->take_can_stats();
+    for (int b = 0; b < PANDA_BUS_CNT; b++) {
+      const CanStats::Bus &s = stats.buses[b];
+      auto bus = buses[i * PANDA_BUS_CNT + b];
+      bus.setBus(pandas[i]->bus_offset + b);
+      bus.setFramesPerSecond(s.frames / dt);
+      bus.setBytesPerSecond(s.bytes / dt);
+
+      double speed = 500e3, data_speed = 500e3;
+      if (auto health = pandas[i]->get_can_health(b)) {
+        bus.setBusOff(health->bus_off);
+        bus.setBusOffCount(health->bus_off_cnt);
+        bus.setErrorPassive(health->error_passive);
+        bus.setErrorWarning(health->error_warning);
+        bus.setErrorCount(health->error_cnt);
+        bus.setLastError(health->last_error);
+        bus.setTransmitErrorCounter(health->transmit_error_cnt);
+        bus.setReceiveErrorCounter(health->receive_error_cnt);
+        bus.setTxQueueMaxUsed(health->tx_q_max_used);
+        bus.setTxPriorityQueueMaxUsed(health->tx_prio_q_max_used);
+        // in 100 bit/s, only CAN-FD controllers have a data bit rate
+        if (health->can_speed > 0) speed = health->can_speed * 100.;
+        data_speed = health->can_data_speed > 0 ? health->can_data_speed * 100. : speed;
+      }
+      bus.setSpeedKbps(speed / 1e3);
+      bus.setDataSpeedKbps(data_speed / 1e3);
+      bus.setBusLoad(100. * (s.nominal_bits / speed + s.data_bits / data_speed) / dt);
     }
+
+    auto latency = panda_stats[i].initTransferLatency(CAN_LATENCY_BUCKETS);
+    for (int l = 0; l < CAN_LATENCY_BUCKETS; l++) latency.set(l, stats.latency[l]);
+    panda_stats[i].setRecvFull(stats.recv_full);
+  }
+  pm.send("canStats", msg);
+}
+
+// The health the pandas push on their interrupt endpoint, the newest of each.
+// A push that changes ignition, safety or faults makes event_fd readable
+class PushedHealth {
+public:
+  PushedHealth(size_t pandas) : states(pandas), times(pandas, 0) {
+    fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    assert(fd >= 0);
+  }
+  ~PushedHealth() { close(fd); }
+  int event_fd() const { return fd; }
+
+  void put(int idx, const health_t &health) {
+    std::lock_guard lk(lock);
+    const health_t &last = states[idx];
+    const bool changed = times[idx] == 0 ||
+      health.ignition_line != last.ignition_line || health.ignition_can != last.ignition_can ||
+      health.controls_allowed != last.controls_allowed || health.safety_model != last.safety_model ||
+      health.safety_param != last.safety_param || health.car_harness_status != last.car_harness_status ||
+      health.power_save_enabled != last.power_save_enabled || health.heartbeat_lost != last.heartbeat_lost ||
+      health.fault_status != last.fault_status || health.faults != last.faults;
+    states[idx] = health;
+    times[idx] = nanos_since_boot();
+    if (changed) {
+      uint64_t one = 1;
+      write(fd, &one, sizeof(one));
     }
-#endif
+  }
 
-    // clear VIN, CarParams, and set new safety on car start
-    if (ignition && !ignition_last) {
-      params.clearAll(CLEAR_ON_IGNITION_ON);
+  // the panda's pushed health, if one came in the last second
+  bool get(int idx, health_t &health) {
+    std::lock_guard lk(lock);
+    if (times[idx] == 0 || nanos_since_boot() - times[idx] > 1e9) return false;
+    health = states[idx];
+    return true;
+  }
 
-      if (!safety_setter_thread_running) {
-        safety_setter_thread_running = true;
-        std::thread(safety_setter_thread, panda).detach();
-      } else {
-        LOGW("Safety setter thread already running");
+  void clear_event() {
+    uint64_t count;
+    read(fd, &count, sizeof(count));
+  }
+
+private:
+  std::mutex lock;
+  std::vector<health_t> states;
+  std::vector<uint64_t> times;
+  int fd;
+};
+
+// waits for the health the panda pushes, until it turns out the firmware doesn't
+void health_recv_thread(const std::vector<Panda *> &pandas, int idx, PushedHealth &pushed) {
+  Panda *panda = pandas[idx];
+  health_t health;
+  while (!do_exit && pandas_connected(pandas)) {
+    int ret = panda->health_recv(health, 100);
+    if (ret < 0) {
+      LOGW("panda %d doesn't push its health, it's polled", idx);
+      break;
+    } else if (ret > 0) {
+      pushed.put(idx, health);
+    }
+  }
+}
+
+// pandaState is the primary panda, pandaStates has every connected one in bus order.
+// Runs at 2hz, canStats at 1hz. The health is the pushed one where the panda
+// pushes it, a change in it is handled and published right away by pushed()
+class PandaStateJob {
+public:
+  PandaStateJob(PubMaster &pm, const std::vector<Panda *> &pandas, PushedHealth &pushed_health,
+                SafetySetter &safety_setter, bool spoofing_started)
+    : pm(pm), pandas(pandas), pushed_health(pushed_health), safety_setter(safety_setter),
+      spoofing_started(spoofing_started), states(pandas.size()) {
+    can_stats_time = nanos_since_boot();
+    for (auto p : pandas) p->take_can_stats();
+  }
+
+  void update() {
+    Panda *panda = pandas[0];
+    for (int i = 0; i < pandas.size(); i++) {
+      if (!pushed_health.get(i, states[i])) {
+        states[i] = pandas[i]->get_state();
       }
-    } else if (!ignition && ignition_last) {
-      params.clearAll(CLEAR_ON_IGNITION_OFF);
+      pandas[i]->clock_sync();
+    }
+    handle_states();
+
+    if (ignition) {
+      no_ignition_cnt = 0;
+    } else {
+      no_ignition_cnt += 1;
     }
 
     // Write to rtc once per minute when no ignition present
@@ -330,6 +755,7 @@ void panda_state_thread(Panda *&panda, bool spoofing_started) {
       if (util::time_valid(sys_time)) {
         struct tm rtc_time = panda->get_rtc();
         double seconds = difftime(mktime(&rtc_time), mktime(&sys_time));
+        time_sync_write_rtc(nanos_since_boot(), std::abs(seconds) > 1.1 ? 0 : seconds * 1e9);
 
         if (std::abs(seconds) > 1.1) {
           panda->set_rtc(sys_time);
@@ -344,85 +770,131 @@ void panda_state_thread(Panda *&panda, bool spoofing_started) {
       }
     }
 
+    fan_speed_rpm = panda->get_fan_speed();
+    publish();
+
+    if (cnt++ % 2 == 1) {
+      publish_can_stats(pm, pandas, can_stats_time);
+    }
+
+    for (auto p : pandas) p->send_heartbeat();
+  }
+
+  // a panda pushed a change of its ignition, safety or faults
+  void pushed() {
+    pushed_health.clear_event();
+    for (int i = 0; i < pandas.size(); i++) {
+      pushed_health.get(i, states[i]);
+    }
+    handle_states();
+    publish();
+  }
+
+private:
+  void handle_states() {
+    Panda *panda = pandas[0];
+    health_t &pandaState = states[0];
+
+    if (spoofing_started) {
+      pandaState.ignition_line = 1;
+    }
+    if (!panda->disable_relay) {
+    // Make sure CAN buses are live: the safety setter does not work if Panda CAN are silent and there is only one other CAN node
+    if (pandaState.safety_model == (uint8_t)(cereal::CarParams::SafetyModel::SILENT)) {
+      panda->set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
+    }
+    }
+    ignition = ((pandaState.ignition_line != 0) || (pandaState.ignition_can != 0));
+
+    // the other pandas only listen and send what's addressed to their buses
+    for (int i = 1; i < pandas.size(); i++) {
+      if (states[i].safety_model != (uint8_t)(cereal::CarParams::SafetyModel::NO_OUTPUT)) {
+        pandas[i]->set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
+      }
+    }
+
+#if !defined(__x86_64__) && !defined(XNX)
+    bool power_save_desired = !ignition;
+    for (int i = 0; i < pandas.size(); i++) {
+      if (states[i].power_save_enabled != power_save_desired) {
+        pandas[i]->set_power_saving(power_save_desired);
+      }
+    }
+    if (!panda->disable_relay) {
+    // set safety mode to NO_OUTPUT when car is off. ELM327 is an alternative if we want to leverage athenad/connect
+    if (!ignition && (pandaState.safety_model != (uint8_t)(cereal::CarParams::SafetyModel::NO_OUTPUT))) {
+      panda->set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
+    }
+    }
+#endif
+
+    // clear VIN, CarParams, and set new safety on car start
+    if (ignition && !ignition_last) {
+      params.clearAll(CLEAR_ON_IGNITION_ON);
+      safety_setter.start();
+    } else if (!ignition && ignition_last) {
+      params.clearAll(CLEAR_ON_IGNITION_OFF);
+    }
     ignition_last = ignition;
-    uint16_t fan_speed_rpm = panda->get_fan_speed();
+  }
+
+  void publish() {
+    Panda *panda = pandas[0];
 
     // build msg
-    MessageBuilder msg;
+    PooledMessageBuilder msg("pandaState");
     auto evt = msg.initEvent();
     evt.setValid(panda->comms_healthy);
 
     auto ps = evt.initPandaState();
-    ps.setUptime(pandaState.uptime);
-
-    if (Hardware::TICI()) {
-      double read_time = millis_since_boot();
-      ps.setVoltage(std::atoi(util::read_file("/sys/class/hwmon/hwmon1/in1_input").c_str()));
-      ps.setCurrent(std::atoi(util::read_file("/sys/class/hwmon/hwmon1/curr1_input").c_str()));
-      read_time = millis_since_boot() - read_time;
-      if (read_time > 50) {
-        LOGW("reading hwmon took %lfms", read_time);
-      }
-    } else {
-      ps.setVoltage(pandaState.voltage);
-      ps.setCurrent(pandaState.current);
-    }
-
-    ps.setIgnitionLine(pandaState.ignition_line);
-    ps.setIgnitionCan(pandaState.ignition_can);
-    ps.setControlsAllowed(pandaState.controls_allowed);
-    ps.setGasInterceptorDetected(pandaState.gas_interceptor_detected);
-    ps.setHasGps(true);
-    ps.setCanRxErrs(pandaState.can_rx_errs);
-    ps.setCanSendErrs(pandaState.can_send_errs);
-    ps.setCanFwdErrs(pandaState.can_fwd_errs);
-    ps.setGmlanSendErrs(pandaState.gmlan_send_errs);
-    ps.setPandaType(panda->hw_type);
-    ps.setUsbPowerMode(cereal::PandaState::UsbPowerMode(pandaState.usb_power_mode));
-    ps.setSafetyModel(cereal::CarParams::SafetyModel(pandaState.safety_model));
-    ps.setSafetyParam(pandaState.safety_param);
+    fill_panda_state(ps, panda, states[0], true);
     ps.setFanSpeedRpm(fan_speed_rpm);
-    ps.setFaultStatus(cereal::PandaState::FaultStatus(pandaState.fault_status));
-    ps.setPowerSaveEnabled((bool)(pandaState.power_save_enabled));
-    ps.setHeartbeatLost((bool)(pandaState.heartbeat_lost));
-    ps.setHarnessStatus(cereal::PandaState::HarnessStatus(pandaState.car_harness_status));
-
-    // Convert faults bitset to capnp list
-    std::bitset<sizeof(pandaState.faults) * 8> fault_bits(pandaState.faults);
-    auto faults = ps.initFaults(fault_bits.count());
-
-    size_t i = 0;
-    for (size_t f = size_t(cereal::PandaState::FaultType::RELAY_MALFUNCTION);
-        f <= size_t(cereal::PandaState::FaultType::INTERRUPT_RATE_TICK); f++) {
-      if (fault_bits.test(f)) {
-        faults.set(i, cereal::PandaState::FaultType(f));
-        i++;
-      }
-    }
     pm.send("pandaState", msg);
-    panda->send_heartbeat();
-    util::sleep_for(500);
-  }
-}
 
-void hardware_control_thread(Panda *panda) {
-  LOGD("start hardware control thread");
-  SubMaster sm({"deviceState", "driverCameraState", "dragonConf"});
-
-  uint64_t last_front_frame_t = 0;
-  uint16_t prev_fan_speed = 999;
-  uint16_t ir_pwr = 0;
-  uint16_t prev_ir_pwr = 999;
-  bool prev_charging_disabled = false;
-  unsigned int cnt = 0;
-
-  FirstOrderFilter integ_lines_filter(0, 30.0, 0.05);
+    PooledMessageBuilder states_msg("pandaStates");
+    auto states_evt = states_msg.initEvent();
+    bool valid = true;
+    auto pss = states_evt.initPandaStates(pandas.size());
+    for (int i = 0; i < pandas.size(); i++) {
+      auto ps_i = pss[i];
+      fill_panda_state(ps_i, pandas[i], states[i], i == 0);
+      if (i == 0) ps_i.setFanSpeedRpm(fan_speed_rpm);
+      valid &= pandas[i]->comms_healthy;
+    }
+    states_evt.setValid(valid);
+    pm.send("pandaStates", states_msg);
+  }
 
-  while (!do_exit && panda->connected) {
+  PubMaster &pm;
+  const std::vector<Panda *> &pandas;
+  PushedHealth &pushed_health;
+  SafetySetter &safety_setter;
+  const bool spoofing_started;
+  Params params;
+
+  std::vector<health_t> states;
+  uint16_t fan_speed_rpm = 0;
+  uint64_t can_stats_time;
+  uint32_t cnt = 0;
+  uint32_t no_ignition_cnt = 0;
+  bool ignition_last = false;
+};
+
+// Charging, fan and IR of the primary panda. The SubMaster is polled, a job mustn't wait for it
+class HardwareControlJob {
+public:
+  HardwareControlJob(const std::vector<Panda *> &pandas)
+    : pandas(pandas), sm({"deviceState", "driverCameraState", "dragonConf"}), integ_lines_filter(0, 30.0, 0.05) {}
+
+  void update() {
+    Panda *panda = pandas[0];
+    sm.update(0);
+    const bool device_state_updated = sm.updated("deviceState");
+    const bool camera_state_updated = sm.updated("driverCameraState");
+    if (!device_state_updated && !camera_state_updated) return;
     cnt++;
-    sm.update(1000); // TODO: what happens if EINTR is sent while in sm.update?
 
-    if (!Hardware::PC() && !Hardware::JETSON() && sm.updated("deviceState")) {
+    if (!Hardware::PC() && !Hardware::JETSON() && device_state_updated) {
       // Charging mode
       bool charging_disabled = sm["deviceState"].getDeviceState().getChargingDisabled();
       if (charging_disabled != prev_charging_disabled) {
@@ -437,8 +909,8 @@ void hardware_control_thread(Panda *panda) {
       }
     }
     // Other pandas don't have fan/IR to control
-    if (panda->hw_type != cereal::PandaState::PandaType::UNO && panda->hw_type != cereal::PandaState::PandaType::DOS) continue;
-    if (sm.updated("deviceState")) {
+    if (panda->hw_type != cereal::PandaState::PandaType::UNO && panda->hw_type != cereal::PandaState::PandaType::DOS) return;
+    if (device_state_updated) {
       // Fan speed
       uint16_t fan_speed = sm["deviceState"].getDeviceState().getFanSpeedPercentDesired();
       if (fan_speed != prev_fan_speed || cnt % 100 == 0) {
@@ -446,7 +918,7 @@ void hardware_control_thread(Panda *panda) {
         prev_fan_speed = fan_speed;
       }
     }
-    if (!panda->is_old_panda && sm.updated("driverCameraState")) {
+    if (!panda->is_old_panda && camera_state_updated) {
       auto event = sm["driverCameraState"];
       int cur_integ_lines = event.getDriverCameraState().getIntegLines();
       float cur_gain = event.getDriverCameraState().getGain();
@@ -474,50 +946,68 @@ void hardware_control_thread(Panda *panda) {
       panda->set_ir_pwr(ir_pwr);
       prev_ir_pwr = ir_pwr;
     }
-
   }
-}
 
-static void pigeon_publish_raw(PubMaster &pm, const std::string &dat) {
+private:
+  const std::vector<Panda *> &pandas;
+  SubMaster sm;
+
+  uint64_t last_front_frame_t = 0;
+  uint16_t prev_fan_speed = 999;
+  uint16_t ir_pwr = 0;
+  uint16_t prev_ir_pwr = 999;
+  bool prev_charging_disabled = false;
+  unsigned int cnt = 0;
+
+  FirstOrderFilter integ_lines_filter;
+};
+
+static void pigeon_publish_raw(PubMaster &pm, const uint8_t *dat, size_t len) {
   // create message
-  MessageBuilder msg;
-  msg.initEvent().setUbloxRaw(capnp::Data::Reader((uint8_t*)dat.data(), dat.length()));
+  PooledMessageBuilder msg("ubloxRaw");
+  msg.initEvent().setUbloxRaw(capnp::Data::Reader(dat, len));
   pm.send("ubloxRaw", msg);
 }
 
-void pigeon_thread(Panda *panda) {
-  // dp - use toyota directly
-  if (panda->disable_relay) {
-    panda->set_safety_model(cereal::CarParams::SafetyModel::TOYOTA);
+// Reads the GPS at 100 Hz. Its init takes seconds, that runs on a thread of its
+// own and the GPS isn't read until it's done
+class PigeonJob {
+public:
+  PigeonJob(PubMaster &pm, Panda *panda) : pm(pm) {
+    pigeon = Hardware::TICI() ? Pigeon::connect("/dev/ttyHS0") : Pigeon::connect(panda);
   }
 
-  if (!panda->has_gps) return;
-
-  PubMaster pm({"ubloxRaw"});
-  bool ignition_last = false;
+  ~PigeonJob() {
+    if (init_thread.joinable()) init_thread.join();
+    delete pigeon;
+  }
 
-  Pigeon *pigeon = Hardware::TICI() ? Pigeon::connect("/dev/ttyHS0") : Pigeon::connect(panda);
+  void update() {
+    if (init_thread.joinable()) {
+      if (initializing) return;
+      init_thread.join();
 
-  std::unordered_map<char, uint64_t> last_recv_time;
-  std::unordered_map<char, int64_t> cls_max_dt = {
-    {(char)ublox::CLASS_NAV, int64_t(900000000ULL)}, // 0.9s
-    {(char)ublox::CLASS_RXM, int64_t(900000000ULL)}, // 0.9s
-  };
+      // Set receive times to current time
+      uint64_t t = nanos_since_boot() + 10000000000ULL; // Give ublox 10 seconds to start
+      for (const auto& [msg_cls, dt] : cls_max_dt) {
+        last_recv_time[msg_cls] = t;
+      }
+    }
 
-  while (!do_exit && panda->connected) {
     bool need_reset = false;
     std::string recv = pigeon->receive();
 
-    // Parse message header
-    if (ignition && recv.length() >= 3) {
-      if (recv[0] == (char)ublox::PREAMBLE1 && recv[1] == (char)ublox::PREAMBLE2) {
-        const char msg_cls = recv[2];
+    // one ubloxRaw per message, as soon as its last byte is in
+    framer.add_data((const uint8_t *)recv.data(), recv.length(), [&](const uint8_t *dat, size_t len) {
+      if (ignition) {
+        const char msg_cls = dat[2];
         uint64_t t = nanos_since_boot();
         if (t > last_recv_time[msg_cls]) {
           last_recv_time[msg_cls] = t;
         }
       }
-    }
+      pigeon_publish_raw(pm, dat, len);
+    });
 
     // Check based on message frequency
     for (const auto& [msg_cls, max_dt] : cls_max_dt) {
@@ -535,20 +1025,15 @@ void pigeon_thread(Panda *panda) {
       LOGW("received invalid ublox message while onroad, resetting panda GPS");
     }
 
-    if (recv.length() > 0) {
-      pigeon_publish_raw(pm, recv);
-    }
-
     // init pigeon on rising ignition edge
     // since it was turned off in low power mode
     if((ignition && !ignition_last) || need_reset) {
-      pigeon->init();
-
-      // Set receive times to current time
-      uint64_t t = nanos_since_boot() + 10000000000ULL; // Give ublox 10 seconds to start
-      for (const auto& [msg_cls, dt] : cls_max_dt) {
-        last_recv_time[msg_cls] = t;
-      }
+      framer.reset();
+      initializing = true;
+      init_thread = std::thread([this]() {
+        pigeon->init();
+        initializing = false;
+      });
     } else if (!ignition && ignition_last) {
       // power off on falling edge of ignition
       LOGD("powering off pigeon\n");
@@ -557,41 +1042,94 @@ void pigeon_thread(Panda *panda) {
     }
 
     ignition_last = ignition;
-
-    // 10ms - 100 Hz
-    util::sleep_for(10);
   }
 
-  delete pigeon;
-}
+private:
+  PubMaster &pm;
+  Pigeon *pigeon;
+  std::thread init_thread;
+  std::atomic<bool> initializing{false};
+  bool ignition_last = false;
+
+  UbloxFramer framer;
+  std::unordered_map<char, uint64_t> last_recv_time;
+  std::unordered_map<char, int64_t> cls_max_dt = {
+    {(char)ublox::CLASS_NAV, int64_t(900000000ULL)}, // 0.9s
+    {(char)ublox::CLASS_RXM, int64_t(900000000ULL)}, // 0.9s
+  };
+};
 
 int main() {
+  Readiness readiness("boardd");
   LOGW("starting boardd");
 
   // set process priority and affinity
-  int err = set_realtime_priority(54);
-  LOG("set priority returns %d", err);
+  int err = sched_apply("boardd", "main");
+  LOG("set scheduling returns %d", err);
 
-  err = set_core_affinity(Hardware::TICI()? 4 : Hardware::JETSON()? 2 : 3);
-  LOG("set affinity returns %d", err);
+  // before the connect threads, they read the environment
+  setenv("TZ","UTC",1);
+  PubMaster pm({"pandaState", "pandaStates", "canStats", "ubloxRaw"});
+  Params params;
+  const bool spoofing_started = getenv("STARTED") != nullptr;
 
+  bool ready = false;
   while (!do_exit) {
-    Panda *panda = nullptr;
+    // connect to the boards
+    if (!ready) readiness.phase("connect");
+    std::vector<Panda *> pandas = usb_retry_connect(pm);
+    if (pandas.empty()) break;
+
+    Panda *panda = pandas[0];
+    if (params.getBool("dp_toyota_disable_relay")) panda->disable_relay = true;
+    // dp - use toyota directly
+    if (panda->disable_relay) {
+      panda->set_safety_model(cereal::CarParams::SafetyModel::TOYOTA);
+    }
+
+    // CAN has threads of its own, realtime and pinned
+    PushedHealth pushed_health(pandas.size());
     std::vector<std::thread> threads;
-    threads.emplace_back(panda_state_thread, std::ref(panda), getenv("STARTED") != nullptr);
+    std::vector<std::unique_ptr<CanQueue>> queues;
+    const bool fake_send = getenv("FAKESEND") != nullptr;
+    for (int i = 0; i < pandas.size(); i++) {
+      queues.push_back(std::make_unique<CanQueue>());
+      threads.emplace_back(getenv("BOARDD_ASYNC_SEND") ? can_send_async_thread : can_send_thread, std::cref(pandas), i, fake_send);
+      threads.emplace_back(getenv("BOARDD_ASYNC_RECV") ? can_recv_async_thread : can_recv_thread, std::cref(pandas), i, std::ref(*queues[i]));
+    }
+    threads.emplace_back(can_publish_thread, std::cref(pandas), std::ref(queues));
+    for (int i = 0; i < pandas.size(); i++) {
+      threads.emplace_back(health_recv_thread, std::cref(pandas), i, std::ref(pushed_health));
+    }
+    if (!ready) {
+      readiness.ready();
+      ready = true;
+    }
 
-    // connect to the board
-    panda = usb_retry_connect();
-    if (panda != nullptr) {
-      threads.emplace_back(can_send_thread, panda, getenv("FAKESEND") != nullptr);
-      threads.emplace_back(can_recv_thread, panda);
-      threads.emplace_back(hardware_control_thread, panda);
-      threads.emplace_back(pigeon_thread, panda);
+    // everything else is housekeeping on this thread. Fan, IR, charging and GPS are the primary panda's
+    {
+      EventLoop loop;
+      SafetySetter safety_setter(pandas);
+      PandaStateJob panda_state(pm, pandas, pushed_health, safety_setter, spoofing_started);
+      HardwareControlJob hardware_control(pandas);
+      std::unique_ptr<PigeonJob> pigeon;
+
+      loop.add_job("pandaState", 500, 3, [&]() { panda_state.update(); });
+      loop.add_fd_job("pushed health", pushed_health.event_fd(), 3, [&]() { panda_state.pushed(); });
+      if (safety_setter.params_fd() >= 0) {
+        loop.add_fd_job("params watch", safety_setter.params_fd(), 2, [&]() { safety_setter.params_changed(); });
+      }
+      loop.add_job("safety setter", safety_setter.params_fd() >= 0 ? 1000 : 100, 2, [&]() { safety_setter.update(); });
+      loop.add_job("hardware control", 50, 1, [&]() { hardware_control.update(); });
+      if (panda->has_gps) {
+        pigeon = std::make_unique<PigeonJob>(pm, panda);
+        loop.add_job("pigeon", 10, 0, [&]() { pigeon->update(); });
+      }
+      loop.run([&]() { return !do_exit && pandas_connected(pandas); });
     }
 
     for (auto &t : threads) t.join();
 
-    delete panda;
-    panda = nullptr;
+    for (auto panda : pandas) delete panda;
   }
 }
@@ -9,6 +9,7 @@ cdef struct can_frame:
   string dat
   long busTime
   long src
+  bool priority
 
 cdef extern void can_list_to_can_capnp_cpp(const vector[can_frame] &can_list, string &out, bool sendCan, bool valid)
 
@@ -22,6 +23,8 @@ def can_list_to_can_capnp(can_msgs, msgtype='can', valid=True):
     f.busTime = can_msg[1]
     f.dat = can_msg[2]
     f.src = can_msg[3]
+    # optional, see selfdrive.car.priority_msg
+    f.priority = len(can_msg) > 4 and can_msg[4]
     can_list.push_back(f)
   cdef string out
   can_list_to_can_capnp_cpp(can_list, out, msgtype == 'sendcan', valid)
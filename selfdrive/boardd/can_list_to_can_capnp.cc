@@ -5,6 +5,7 @@ typedef struct {
 	std::string dat;
 	long busTime;
 	long src;
+	bool priority;
 } can_frame;
 
 extern "C" {
@@ -21,6 +22,7 @@ void can_list_to_can_capnp_cpp(const std::vector<can_frame> &can_list, std::stri
     c.setBusTime(it->busTime);
     c.setDat(kj::arrayPtr((uint8_t*)it->dat.data(), it->dat.size()));
     c.setSrc(it->src);
+    if (it->priority) c.setPriority(true);
   }
   const uint64_t msg_size = capnp::computeSerializedSizeInWords(msg) * sizeof(capnp::word);
   out.resize(msg_size);
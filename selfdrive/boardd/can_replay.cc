@@ -0,0 +1,361 @@
+// Plays recorded CAN back to the pandas with the timing it had on the bus, for
+// bench and HIL rigs. It takes the pandas over, stop boardd first.
+//
+//   can_replay [-s] [-l] [-r rate] [-b batch_us] rlog...
+//
+// The frames of the logs' can events, or sendcan events with -s, go out on the
+// bus they were on; returned and rejected frames are left out. Each is due at
+// its hardware timestamp, busMonoTime (logMonoTime for sendcan), relative to the
+// first frame and scaled by -r. Frames that are due within -b us of each other
+// go to the pandas together, like a sendcan event. -l replays the logs in a loop.
+// Seekable logs are only decompressed where the event index has the service.
+//
+// The timing error is how late a frame was: when the USB write of its batch was
+// done, and when it was on the bus, the panda's timestamp of the frame it
+// returns. Both go to stdout every 10 s and at the end
+
+#include <getopt.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <capnp/serialize.h>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/log_reader.h"
+
+#include "selfdrive/boardd/panda.h"
+
+// returned frames the bus timing waits for, older ones were lost
+#define ECHO_TIMEOUT_NS 1000000000ULL
+#define REPORT_INTERVAL_NS 10000000000ULL
+
+ExitHandler do_exit;
+
+struct ReplayFrame {
+  uint64_t time;  // due, on the clock of the log
+  uint32_t addr;
+  uint32_t dat;   // offset in ReplayLog::dat
+  uint8_t src, len;
+};
+
+struct ReplayLog {
+  std::vector<ReplayFrame> frames;
+  std::vector<uint8_t> dat;
+};
+
+static void add_events(const std::vector<uint8_t> &data, bool sendcan, ReplayLog &log) {
+  kj::Array<capnp::word> words = kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+  memcpy(words.begin(), data.data(), words.size() * sizeof(capnp::word));
+
+  kj::ArrayPtr<const capnp::word> rest = words;
+  try {
+    while (rest.size() > 0) {
+      capnp::FlatArrayMessageReader msg(rest);
+      auto event = msg.getRoot<cereal::Event>();
+      if (sendcan ? event.isSendcan() : event.isCan()) {
+        for (auto c : sendcan ? event.getSendcan() : event.getCan()) {
+          if (c.getSrc() >= 128) continue;
+          auto dat = c.getDat();
+          const uint64_t bus_time = c.getBusMonoTime();
+          log.frames.push_back({.time = bus_time != 0 ? bus_time : event.getLogMonoTime(), .addr = c.getAddress(),
+                                .dat = (uint32_t)log.dat.size(), .src = c.getSrc(), .len = (uint8_t)dat.size()});
+          log.dat.insert(log.dat.end(), dat.begin(), dat.end());
+        }
+      }
+      rest = kj::arrayPtr(msg.getEnd(), rest.end());
+    }
+  } catch (const kj::Exception &e) {
+    fprintf(stderr, "log data cut off: %s\n", e.getDescription().cStr());
+  }
+}
+
+static void load_log(const std::string &path, bool sendcan, ReplayLog &log) {
+  const unsigned int service = (unsigned int)(sendcan ? cereal::Event::SENDCAN : cereal::Event::CAN);
+  const std::vector<LogIndexBlock> blocks = log_read_index(path);
+  if (blocks.empty()) {
+    add_events(log_read_all(path), sendcan, log);
+    return;
+  }
+  for (const auto &b : blocks) {
+    if (!b.has(service)) continue;
+    std::vector<uint8_t> data = log_read_block(path, b);
+    if (data.empty()) fprintf(stderr, "%s: block at %lu doesn't decompress\n", path.c_str(), (unsigned long)b.offset);
+    add_events(data, sendcan, log);
+  }
+}
+
+// a histogram of the errors in 10 us bins, the ones over 100 ms go in the outer bins
+#define TIMING_BIN_US 10
+#define TIMING_BINS 10000
+class TimingError {
+public:
+  void add(double us) {
+    bins[std::clamp((int)std::lround(us / TIMING_BIN_US) + TIMING_BINS, 0, 2 * TIMING_BINS)]++;
+    min = std::min(min, us);
+    max = std::max(max, us);
+    cnt++;
+  }
+  void add(const TimingError &e) {
+    for (int i = 0; i < bins.size(); i++) bins[i] += e.bins[i];
+    min = std::min(min, e.min);
+    max = std::max(max, e.max);
+    cnt += e.cnt;
+  }
+  std::string report() const {
+    if (cnt == 0) return "-";
+    char buf[128];
+    snprintf(buf, sizeof(buf), "min %.0f p50 %d p99 %d max %.0f us", min, percentile(0.5), percentile(0.99), max);
+    return buf;
+  }
+  void clear() { *this = TimingError(); }
+
+private:
+  int percentile(double q) const {
+    uint64_t n = 0;
+    int i = 0;
+    while (i < 2 * TIMING_BINS && (n += bins[i]) <= q * cnt) i++;
+    return (i - TIMING_BINS) * TIMING_BIN_US;
+  }
+
+  std::vector<uint64_t> bins = std::vector<uint64_t>(2 * TIMING_BINS + 1);
+  double min = 1e18, max = -1e18;
+  uint64_t cnt = 0;
+};
+
+// the due times of the frames that are out, by bus and address, for the frames the pandas return
+struct SentFrames {
+  std::mutex lock;
+  std::map<uint64_t, std::deque<uint64_t>> due;
+  TimingError bus_error;
+  uint64_t lost = 0;
+
+  static uint64_t key(uint8_t bus, uint32_t addr) { return ((uint64_t)bus << 32) | addr; }
+};
+
+static void echo_thread(Panda *panda, SentFrames &sent, std::atomic<bool> &done) {
+  std::vector<uint32_t> buf(CAN_RECV_BUF_SIZE / 4);
+  uint64_t last_sync = nanos_since_boot();
+  while (!do_exit && !done && panda->connected) {
+    bool full = false;
+    const int size = panda->can_receive(buf.data(), full);
+    const uint64_t recv_time = nanos_since_boot();
+    if (size > 0) {
+      int data_words = 0;
+      const int num_msg = panda->can_count(buf.data(), size, data_words);
+      MessageBuilder msg;
+      auto can = msg.initEvent().initCan(num_msg);
+      panda->can_unpack(buf.data(), size, recv_time, can, 0);
+
+      std::lock_guard lk(sent.lock);
+      for (auto c : can) {
+        if (c.getSrc() < 128 || c.getSrc() >= 192) continue;
+        auto &due = sent.due[SentFrames::key(c.getSrc() - 128, c.getAddress())];
+        while (!due.empty() && c.getBusMonoTime() > due.front() + ECHO_TIMEOUT_NS) {
+          due.pop_front();
+          sent.lost++;
+        }
+        if (due.empty()) continue;
+        if (panda->has_clock) sent.bus_error.add(((int64_t)c.getBusMonoTime() - (int64_t)due.front()) / 1e3);
+        due.pop_front();
+      }
+    }
+
+    // the bus timestamps follow the panda's clock, and without heartbeat it stops sending
+    if (recv_time - last_sync > 500000000ULL) {
+      panda->clock_sync();
+      panda->send_heartbeat();
+      last_sync = recv_time;
+    }
+    if (!full) util::sleep_for(1);
+  }
+}
+
+static void sleep_until(uint64_t t) {
+  const struct timespec ts = {.tv_sec = (time_t)(t / 1000000000ULL), .tv_nsec = (long)(t % 1000000000ULL)};
+  while (clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, NULL) == EINTR && !do_exit) {}
+}
+
+// sends the frames from start on that are due within batch_ns of it, returns where the next batch starts
+static size_t send_batch(const std::vector<Panda *> &pandas, const ReplayLog &log, size_t start, uint64_t batch_ns,
+                         uint64_t t0, uint64_t start_time, double rate, SentFrames &sent, TimingError &usb_error) {
+  auto due = [&](const ReplayFrame &f) { return start_time + (uint64_t)((f.time - t0) / rate); };
+  size_t end = start;
+  while (end < log.frames.size() && log.frames[end].time - log.frames[start].time <= batch_ns) end++;
+
+  MessageBuilder msg;
+  auto can = msg.initEvent().initSendcan(end - start);
+  for (size_t i = start; i < end; i++) {
+    const ReplayFrame &f = log.frames[i];
+    auto c = can[i - start];
+    c.setAddress(f.addr);
+    c.setSrc(f.src);
+    c.setDat(capnp::Data::Reader(log.dat.data() + f.dat, f.len));
+  }
+
+  sleep_until(due(log.frames[start]));
+  {
+    std::lock_guard lk(sent.lock);
+    for (size_t i = start; i < end; i++) {
+      auto &d = sent.due[SentFrames::key(log.frames[i].src, log.frames[i].addr)];
+      // frames that aren't returned don't pile up
+      while (!d.empty() && due(log.frames[i]) > d.front() + ECHO_TIMEOUT_NS) {
+        d.pop_front();
+        sent.lost++;
+      }
+      d.push_back(due(log.frames[i]));
+    }
+  }
+  auto frames = can.asReader();
+  for (auto panda : pandas) panda->can_send(frames);
+
+  const uint64_t done = nanos_since_boot();
+  for (size_t i = start; i < end; i++) {
+    usb_error.add(((int64_t)done - (int64_t)due(log.frames[i])) / 1e3);
+  }
+  return end;
+}
+
+static std::vector<Panda *> connect_pandas() {
+  // in the order of BOARDD_PANDAS like boardd, or by serial
+  std::vector<std::string> serials;
+  std::stringstream ss(util::getenv("BOARDD_PANDAS"));
+  for (std::string serial; std::getline(ss, serial, ',');) {
+    if (!serial.empty()) serials.push_back(serial);
+  }
+  if (serials.empty()) {
+    serials = Panda::list();
+    std::sort(serials.begin(), serials.end());
+  }
+
+  std::vector<Panda *> pandas;
+  for (int i = 0; i < serials.size(); i++) {
+    try {
+      pandas.push_back(new Panda(serials[i]));
+    } catch (std::exception &e) {
+      fprintf(stderr, "can't connect to panda %s\n", serials[i].c_str());
+      break;
+    }
+    pandas.back()->bus_offset = i * PANDA_BUS_CNT;
+  }
+  return pandas;
+}
+
+int main(int argc, char **argv) {
+  bool sendcan = false, loop = false;
+  double rate = 1.;
+  uint64_t batch_ns = 1000000ULL;
+  int c;
+  while ((c = getopt(argc, argv, "slr:b:")) != -1) {
+    switch (c) {
+      case 's': sendcan = true; break;
+      case 'l': loop = true; break;
+      case 'r': rate = atof(optarg); break;
+      case 'b': batch_ns = atol(optarg) * 1000ULL; break;
+      default:
+        fprintf(stderr, "usage: %s [-s] [-l] [-r rate] [-b batch_us] rlog...\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind == argc || rate <= 0) {
+    fprintf(stderr, "usage: %s [-s] [-l] [-r rate] [-b batch_us] rlog...\n", argv[0]);
+    return 1;
+  }
+
+  ReplayLog log;
+  for (int i = optind; i < argc; i++) {
+    load_log(argv[i], sendcan, log);
+  }
+  // the pandas of a log aren't merged by time
+  std::stable_sort(log.frames.begin(), log.frames.end(), [](auto &a, auto &b) { return a.time < b.time; });
+  if (log.frames.empty()) {
+    fprintf(stderr, "no frames to replay\n");
+    return 1;
+  }
+  printf("%zu frames over %.1f s\n", log.frames.size(), (log.frames.back().time - log.frames.front().time) / 1e9);
+
+  std::vector<Panda *> pandas = connect_pandas();
+  if (pandas.empty()) return 1;
+  for (auto panda : pandas) {
+    panda->set_safety_model(cereal::CarParams::SafetyModel::ALL_OUTPUT);
+    panda->set_can_filter({});
+    panda->clock_sync();
+  }
+
+  SentFrames sent;
+  std::atomic<bool> done = false;
+  std::vector<std::thread> threads;
+  for (auto panda : pandas) threads.emplace_back(echo_thread, panda, std::ref(sent), std::ref(done));
+
+  util::set_realtime_priority(1);
+
+  // for the last 10 s, added to the totals after each report
+  TimingError usb_error, total_usb_error, total_bus_error;
+  uint64_t frames_sent = 0, interval_frames = 0;
+  const uint64_t t0 = log.frames.front().time;
+  uint64_t start_time = nanos_since_boot() + 100000000ULL;
+  uint64_t next_report = start_time + REPORT_INTERVAL_NS;
+  auto report = [&](bool last) {
+    std::lock_guard lk(sent.lock);
+    if (!last) {
+      printf("last 10 s: %lu frames, usb %s, bus %s\n", (unsigned long)interval_frames,
+             usb_error.report().c_str(), sent.bus_error.report().c_str());
+    }
+    frames_sent += interval_frames;
+    total_usb_error.add(usb_error);
+    total_bus_error.add(sent.bus_error);
+    interval_frames = 0;
+    usb_error.clear();
+    sent.bus_error.clear();
+    if (last) {
+      printf("replayed %lu frames, usb %s, bus %s, %lu not returned\n", (unsigned long)frames_sent,
+             total_usb_error.report().c_str(), total_bus_error.report().c_str(), (unsigned long)sent.lost);
+    }
+    fflush(stdout);
+  };
+
+  do {
+    for (size_t i = 0; i < log.frames.size() && !do_exit;) {
+      const size_t next = send_batch(pandas, log, i, batch_ns, t0, start_time, rate, sent, usb_error);
+      interval_frames += next - i;
+      i = next;
+      if (!std::all_of(pandas.begin(), pandas.end(), [](Panda *p) { return p->connected.load(); })) {
+        fprintf(stderr, "panda lost\n");
+        do_exit = true;
+      }
+      if (nanos_since_boot() > next_report) {
+        report(false);
+        next_report += REPORT_INTERVAL_NS;
+      }
+    }
+    start_time = nanos_since_boot() + 100000000ULL;
+  } while (loop && !do_exit);
+
+  // the last frames come back
+  util::sleep_for(100);
+  done = true;
+  for (auto &t : threads) t.join();
+  report(true);
+
+  for (auto panda : pandas) {
+    panda->set_safety_model(cereal::CarParams::SafetyModel::NO_OUTPUT);
+    delete panda;
+  }
+  return 0;
+}
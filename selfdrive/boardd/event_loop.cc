@@ -0,0 +1,81 @@
+#include "selfdrive/boardd/event_loop.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+
+// a job that takes longer holds up everything else on the loop
+#define SLOW_JOB_MS 50.
+
+EventLoop::EventLoop() {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  assert(epoll_fd >= 0);
+}
+
+EventLoop::~EventLoop() {
+  for (auto &job : jobs) {
+    if (job->timer) close(job->fd);
+  }
+  close(epoll_fd);
+}
+
+void EventLoop::add_job(const std::string &name, int period_ms, int priority, std::function<void()> job) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  assert(fd >= 0);
+  const struct timespec period = {.tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000L};
+  const struct itimerspec spec = {.it_interval = period, .it_value = {.tv_sec = 0, .tv_nsec = 1}};
+  int err = timerfd_settime(fd, 0, &spec, NULL);
+  assert(err == 0);
+
+  add(Job{name, fd, true, priority, std::move(job)});
+}
+
+void EventLoop::add_fd_job(const std::string &name, int fd, int priority, std::function<void()> job) {
+  add(Job{name, fd, false, priority, std::move(job)});
+}
+
+void EventLoop::add(Job job) {
+  jobs.push_back(std::make_unique<Job>(std::move(job)));
+  struct epoll_event ev = {.events = EPOLLIN, .data = {.ptr = jobs.back().get()}};
+  int err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, jobs.back()->fd, &ev);
+  assert(err == 0);
+}
+
+void EventLoop::run(const std::function<bool()> &keep_running) {
+  std::vector<struct epoll_event> events(std::max<size_t>(jobs.size(), 1));
+  std::vector<Job *> due;
+  while (keep_running()) {
+    int n = epoll_wait(epoll_fd, events.data(), events.size(), 100);
+    if (n < 0) {
+      if (errno != EINTR) LOGE("epoll_wait failed: %d", errno);
+      continue;
+    }
+
+    due.clear();
+    for (int i = 0; i < n; i++) {
+      Job *job = (Job *)events[i].data.ptr;
+      uint64_t expirations;
+      if (!job->timer || read(job->fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        due.push_back(job);
+      }
+    }
+    std::stable_sort(due.begin(), due.end(), [](Job *a, Job *b) { return a->priority > b->priority; });
+
+    for (Job *job : due) {
+      if (!keep_running()) break;
+      const double start = millis_since_boot();
+      job->fn();
+      const double dt = millis_since_boot() - start;
+      if (dt > SLOW_JOB_MS) {
+        LOGW("boardd %s job took %.1f ms", job->name.c_str(), dt);
+      }
+    }
+  }
+}
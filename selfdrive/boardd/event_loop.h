@@ -0,0 +1,36 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Periodic jobs on one thread, a timerfd each on an epoll. Jobs that are due
+// together run by priority, highest first. A job that overruns delays the
+// others, the runs it missed aren't made up for.
+// Blocking work doesn't belong in a job, it goes on a thread of its own
+class EventLoop {
+public:
+  EventLoop();
+  ~EventLoop();
+
+  // job runs every period_ms, the first time right away
+  void add_job(const std::string &name, int period_ms, int priority, std::function<void()> job);
+  // job runs when fd is readable and has to read what's there, fd stays the caller's
+  void add_fd_job(const std::string &name, int fd, int priority, std::function<void()> job);
+  // runs jobs while keep_running(), it's checked at least every 100 ms
+  void run(const std::function<bool()> &keep_running);
+
+private:
+  struct Job {
+    std::string name;
+    int fd;
+    bool timer;
+    int priority;
+    std::function<void()> fn;
+  };
+  void add(Job job);
+
+  int epoll_fd;
+  std::vector<std::unique_ptr<Job>> jobs;
+};
@@ -2,74 +2,25 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstring>
 #include <stdexcept>
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/gpio.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
-static int init_usb_ctx(libusb_context *context) {
-  int err = libusb_init(&context);
-  if (err != 0) {
-    LOGE("libusb initialization error");
-    return err;
-  }
-
-#if LIBUSB_API_VERSION >= 0x01000106
-  libusb_set_option(context, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
-#else
-  libusb_set_debug(context, 3);
-#endif
-
-  return err;
-}
-
-
 Panda::Panda(std::string serial) {
-  // init libusb
-  ssize_t num_devices;
-  libusb_device **dev_list = NULL;
-  int err = init_usb_ctx(ctx);
-  if (err != 0) { goto fail; }
-
-  // connect by serial
-  num_devices = libusb_get_device_list(ctx, &dev_list);
-  if (num_devices < 0) { goto fail; }
-  for (size_t i = 0; i < num_devices; ++i) {
-    libusb_device_descriptor desc;
-    libusb_get_device_descriptor(dev_list[i], &desc);
-    if (desc.idVendor == 0xbbaa && desc.idProduct == 0xddcc) {
-      libusb_open(dev_list[i], &dev_handle);
-      if (dev_handle == NULL) { goto fail; }
-
-      unsigned char desc_serial[26] = { 0 };
-      int ret = libusb_get_string_descriptor_ascii(dev_handle, desc.iSerialNumber, desc_serial, std::size(desc_serial));
-      if (ret < 0) { goto fail; }
-
-      usb_serial = std::string((char *)desc_serial, ret).c_str();
-      if (serial.empty() || serial == usb_serial) {
-        break;
-      }
-      libusb_close(dev_handle);
-      dev_handle = NULL;
-    }
+  transport = PandaTransport::open(serial);
+  if (!transport) {
+    throw std::runtime_error("Error connecting to panda");
   }
-  if (dev_handle == NULL) goto fail;
-  libusb_free_device_list(dev_list, 1);
-  dev_list = nullptr;
-
-  if (libusb_kernel_driver_active(dev_handle, 0) == 1) {
-    libusb_detach_kernel_driver(dev_handle, 0);
-  }
-
-  err = libusb_set_configuration(dev_handle, 1);
-  if (err != 0) { goto fail; }
-
-  err = libusb_claim_interface(dev_handle, 0);
-  if (err != 0) { goto fail; }
+  usb_serial = transport->serial;
 
   hw_type = get_hw_type();
 
@@ -81,14 +32,15 @@ Panda::Panda(std::string serial) {
   has_rtc = (hw_type == cereal::PandaState::PandaType::UNO) ||
             (hw_type == cereal::PandaState::PandaType::DOS);
 
-  return;
-
-fail:
-  if (dev_list != NULL) {
-    libusb_free_device_list(dev_list, 1);
+  // CAN-FD capable packets when the firmware has them, it answers with the version it uses
+  {
+    uint8_t version = 0;
+    can_version = (usb_read(0xfa, 2, 0, &version, 1) == 1 && version == 2) ? 2 : 1;
   }
-  cleanup();
-  throw std::runtime_error("Error connecting to panda");
+
+  // sendcan of all three buses at once never has to grow it
+  send_buf.reserve(RECV_SIZE / sizeof(uint32_t));
+  recv_partial.reserve(CAN_PACKET_V2_MAX / sizeof(uint32_t));
 }
 
 Panda::~Panda() {
@@ -98,55 +50,11 @@ Panda::~Panda() {
 }
 
 void Panda::cleanup() {
-  if (dev_handle) {
-    libusb_release_interface(dev_handle, 0);
-    libusb_close(dev_handle);
-  }
-
-  if (ctx) {
-    libusb_exit(ctx);
-  }
+  transport.reset();
 }
 
 std::vector<std::string> Panda::list() {
-  // init libusb
-  ssize_t num_devices;
-  libusb_context *context = NULL;
-  libusb_device **dev_list = NULL;
-  std::vector<std::string> serials;
-
-  int err = init_usb_ctx(context);
-  if (err != 0) { return serials; }
-
-  num_devices = libusb_get_device_list(context, &dev_list);
-  if (num_devices < 0) {
-    LOGE("libusb can't get device list");
-    goto finish;
-  }
-  for (size_t i = 0; i < num_devices; ++i) {
-    libusb_device *device = dev_list[i];
-    libusb_device_descriptor desc;
-    libusb_get_device_descriptor(device, &desc);
-    if (desc.idVendor == 0xbbaa && desc.idProduct == 0xddcc) {
-      libusb_device_handle *handle = NULL;
-      libusb_open(device, &handle);
-      unsigned char desc_serial[26] = { 0 };
-      int ret = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, desc_serial, std::size(desc_serial));
-      libusb_close(handle);
-
-      if (ret < 0) { goto finish; }
-      serials.push_back(std::string((char *)desc_serial, ret).c_str());
-    }
-  }
-
-finish:
-  if (dev_list != NULL) {
-    libusb_free_device_list(dev_list, 1);
-  }
-  if (context) {
-    libusb_exit(context);
-  }
-  return serials;
+  return PandaTransport::list();
 }
 
 void Panda::handle_usb_issue(int err, const char func[]) {
@@ -166,9 +74,10 @@ int Panda::usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigne
     return LIBUSB_ERROR_NO_DEVICE;
   }
 
+  wait_for_sends();
   std::lock_guard lk(usb_lock);
   do {
-    err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, NULL, 0, timeout);
+    err = transport->control_transfer(bmRequestType, bRequest, wValue, wIndex, NULL, 0, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
   } while (err < 0 && connected);
 
@@ -183,9 +92,10 @@ int Panda::usb_read(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned
     return LIBUSB_ERROR_NO_DEVICE;
   }
 
+  wait_for_sends();
   std::lock_guard lk(usb_lock);
   do {
-    err = libusb_control_transfer(dev_handle, bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
+    err = transport->control_transfer(bmRequestType, bRequest, wValue, wIndex, data, wLength, timeout);
     if (err < 0) handle_usb_issue(err, __func__);
   } while (err < 0 && connected);
 
@@ -203,8 +113,8 @@ int Panda::usb_bulk_write(unsigned char endpoint, unsigned char* data, int lengt
   std::lock_guard lk(usb_lock);
   do {
     // Try sending can messages. If the receive buffer on the panda is full it will NAK
-    // and libusb will try again. After 5ms, it will time out. We will drop the messages.
-    err = libusb_bulk_transfer(dev_handle, endpoint, data, length, &transferred, timeout);
+    // and the transfer is tried again. After 5ms, it will time out. We will drop the messages.
+    err = transport->bulk_transfer(endpoint, data, length, &transferred, timeout);
 
     if (err == LIBUSB_ERROR_TIMEOUT) {
       LOGW("Transmit buffer full");
@@ -228,7 +138,7 @@ int Panda::usb_bulk_read(unsigned char endpoint, unsigned char* data, int length
   std::lock_guard lk(usb_lock);
 
   do {
-    err = libusb_bulk_transfer(dev_handle, endpoint, data, length, &transferred, timeout);
+    err = transport->bulk_transfer(endpoint, data, length, &transferred, timeout);
 
     if (err == LIBUSB_ERROR_TIMEOUT) {
       break; // timeout is okay to exit, recv still happened
@@ -248,6 +158,32 @@ void Panda::set_safety_model(cereal::CarParams::SafetyModel safety_model, int sa
   usb_write(0xdc, (uint16_t)safety_model, safety_param);
 }
 
+void Panda::set_can_filter(capnp::List<cereal::CarParams::CanFilter>::Reader filter) {
+  std::vector<std::pair<uint8_t, uint32_t>> messages;
+  for (auto f : filter) {
+    if (f.getBus() >= bus_offset && f.getBus() - bus_offset < PANDA_BUS_CNT) {
+      messages.push_back({f.getBus() - bus_offset, f.getAddress()});
+    }
+  }
+  // with none of our buses parsed they still all show up in the logs
+  usb_write(0xc3, !messages.empty(), 0);
+  for (auto &[bus, addr] : messages) {
+    unsigned char added = 0;
+    usb_read(0xc4, addr & 0xFFFF, (addr >> 16) | (bus << 13), &added, 1);
+    if (added != 1) {
+      // a full table or firmware without the filter, everything goes to the host
+      LOGW("can't set the CAN filter, %zu messages", messages.size());
+      usb_write(0xc3, 0, 0);
+      return;
+    }
+  }
+  if (!messages.empty()) {
+    // the controllers drop the rest of the buses the safety mode doesn't need all of
+    usb_write(0xc6, 1, 0);
+    LOGW("CAN filter set, %zu messages", messages.size());
+  }
+}
+
 void Panda::set_unsafe_mode(uint16_t unsafe_mode) {
   usb_write(0xdf, unsafe_mode, 0);
 }
@@ -314,6 +250,24 @@ health_t Panda::get_state() {
   return health;
 }
 
+int Panda::health_recv(health_t &health, unsigned int timeout) {
+  if (!connected) {
+    return -1;
+  }
+
+  // an endpoint of its own, waiting on it without usb_lock holds up nothing else
+  unsigned char buf[0x40];
+  int transferred = 0;
+  int err = transport->bulk_transfer(0x82, buf, sizeof(buf), &transferred, timeout);
+  if (err == LIBUSB_ERROR_TIMEOUT) {
+    return 0;
+  } else if (err != 0 || transferred < (int)sizeof(health)) {
+    return -1;
+  }
+  memcpy(&health, buf, sizeof(health));
+  return 1;
+}
+
 void Panda::set_loopback(bool loopback) {
   usb_write(0xe5, loopback, 0);
 }
@@ -325,6 +279,18 @@ std::optional<std::vector<uint8_t>> Panda::get_firmware_version() {
   return ((read_1 == 64) && (read_2 == 64)) ? std::make_optional(fw_sig_buf) : std::nullopt;
 }
 
+std::optional<can_health_t> Panda::get_can_health(uint8_t bus) {
+  can_health_t health = {};
+  int err = usb_read(0xc2, bus, 0, (unsigned char*)&health, sizeof(health));
+  return err >= (int)offsetof(can_health_t, tx_q_max_used) ? std::make_optional(health) : std::nullopt;
+}
+
+std::optional<safety_hook_stats_t> Panda::get_safety_hook_stats() {
+  safety_hook_stats_t stats = {};
+  int err = usb_read(0xc7, 0, 0, (unsigned char*)&stats, sizeof(stats));
+  return err == sizeof(stats) && stats.core_freq > 0 ? std::make_optional(stats) : std::nullopt;
+}
+
 std::optional<std::string> Panda::get_serial() {
   char serial_buf[17] = {'\0'};
   int err = usb_read(0xd0, 0, 0, (uint8_t*)serial_buf, 16);
@@ -343,60 +309,450 @@ void Panda::send_heartbeat() {
   usb_write(0xf3, 1, 0);
 }
 
+void Panda::clock_sync() {
+  if (!has_clock) return;
+
+  uint64_t best_t0 = 0, best_t1 = 0;
+  uint32_t best_us = 0;
+  for (int i = 0; i < 3; i++) {
+    uint32_t us = 0;
+    const uint64_t t0 = nanos_since_boot();
+    const int got = usb_read(0xfb, 0, 0, (unsigned char *)&us, sizeof(us));
+    const uint64_t t1 = nanos_since_boot();
+    if (got != sizeof(us)) {
+      // older firmware doesn't answer, its bus times aren't on the microsecond timer
+      if (got == 0) {
+        LOGW("panda %s has no CAN timestamps, can has the receive times", usb_serial.c_str());
+        has_clock = false;
+      }
+      return;
+    }
+    if (best_t1 == 0 || t1 - t0 < best_t1 - best_t0) {
+      best_t0 = t0;
+      best_t1 = t1;
+      best_us = us;
+    }
+  }
+  clock.add_sample(best_t0, best_us, best_t1);
+}
+
+#define CAN_FD_FLAG 0x1000
+#define CAN_BRS_FLAG 0x2000
+#define CAN_PRIO_FLAG 0x4000
+static const uint8_t dlc_to_len[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+// data length and packet size of a v2 packet from its first word
+static inline int can_v2_len(uint32_t w0) {
+  const uint32_t dlc = (w0 >> 8) & 0xF;
+  return (w0 & CAN_FD_FLAG) ? dlc_to_len[dlc] : std::min(dlc, 8U);
+}
+static inline int can_v2_size(int len) {
+  return 8 + std::max((len + 7) & ~7, 8);
+}
+
+// bus is a packet's bus number with its flags: frames we sent were on the bus too,
+// rejected ones weren't
+static void count_frame(CanStats &stats, uint32_t bus, int len, bool extended, bool fd, bool brs) {
+  if ((bus & 0xC0) == 0xC0 || (bus & 0x3F) >= PANDA_BUS_CNT) return;
+
+  CanStats::Bus &s = stats.buses[bus & 0x3F];
+  s.frames++;
+  s.bytes += len;
+  if (!fd) {
+    s.nominal_bits += (extended ? 67 : 47) + 8 * len;
+    return;
+  }
+  // up to BRS and from the ACK on at the nominal rate, from ESI to the CRC delimiter at the data rate
+  s.nominal_bits += (extended ? 36 : 17) + 12;
+  (brs ? s.data_bits : s.nominal_bits) += 8 * len + (len > 16 ? 31 : 27);
+}
+
+// v1 panda CAN packets are four words: the address, then length, bus and bus
+// time, then up to 8 bytes of data. v2 ones are described in panda.h, longer
+// messages go out as CAN-FD frames with bit rate switch. Only the messages for
+// the buses of this panda are packed, it returns how many.
+// send only grows to the largest batch yet
+static int can_pack(capnp::List<cereal::CanData>::Reader can_data_list, uint8_t bus_offset, int version, std::vector<uint32_t> &send) {
+  send.resize(can_data_list.size() * (version == 1 ? 4 : CAN_PACKET_V2_MAX / 4));
+
+  int count = 0;
+  uint32_t *p = send.data();
+  for (auto cmsg : can_data_list) {
+    const uint8_t bus = cmsg.getSrc() - bus_offset;
+    if (cmsg.getSrc() < bus_offset || bus >= PANDA_BUS_CNT) continue;
+
+    const uint32_t addr = cmsg.getAddress();
+    auto can_data = cmsg.getDat();
+    if (can_data.size() > (version == 1 ? 8 : 64)) {
+      LOGE_100("can message 0x%x of %zu bytes doesn't fit a v%d packet", addr, can_data.size(), version);
+      continue;
+    }
+
+    if (version == 1) {
+      p[0] = addr >= 0x800 ? (addr << 3) | 5 : (addr << 21) | 1;  // extended : normal
+      p[1] = can_data.size() | (bus << 4) | (cmsg.getPriority() ? CAN_PRIO_FLAG : 0);
+      uint64_t dat = 0;
+      memcpy(&dat, can_data.begin(), can_data.size());
+      memcpy(&p[2], &dat, sizeof(dat));
+      p += 4;
+    } else {
+      uint32_t dlc = std::min(can_data.size(), (size_t)8);
+      while (dlc_to_len[dlc] < can_data.size()) dlc++;
+      const int size = can_v2_size(dlc_to_len[dlc]);
+      p[0] = bus | (dlc << 8) | (dlc > 8 ? CAN_FD_FLAG | CAN_BRS_FLAG : 0) | (cmsg.getPriority() ? CAN_PRIO_FLAG : 0);
+      p[1] = addr | (addr >= 0x800 ? 0x80000000 : 0);
+      // FD frames longer than the message are padded with zeros
+      memset(&p[2], 0, size - 8);
+      memcpy(&p[2], can_data.begin(), can_data.size());
+      p += size / 4;
+    }
+    count++;
+  }
+  send.resize(p - send.data());
+  return count;
+}
+
 void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
-  static std::vector<uint32_t> send;
-  const int msg_count = can_data_list.size();
+  if (can_pack(can_data_list, bus_offset, can_version, send_buf) == 0) return;
+  usb_bulk_write(3, (unsigned char*)send_buf.data(), send_buf.size() * sizeof(uint32_t), 5);
+}
+
+void Panda::can_send_callback(PandaTransfer *transfer) {
+  SendTransfer *t = (SendTransfer *)transfer->user_data;
+  t->timing.complete_time = nanos_since_boot();
+  t->timing.ok = transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length == transfer->length;
+
+  Panda *panda = t->panda;
+  {
+    std::lock_guard lk(panda->send_lock);
+    panda->send_done.push_back(t);
+    panda->sends_in_flight--;
+  }
+  panda->send_cv.notify_all();
+}
+
+void Panda::wait_for_sends() {
+  std::unique_lock lk(send_lock);
+  send_cv.wait_for(lk, std::chrono::milliseconds(5), [&] { return sends_in_flight == 0; });
+}
 
-  send.resize(msg_count*0x10);
+bool Panda::can_send_async(capnp::List<cereal::CanData>::Reader can_data_list, CanSendTiming timing) {
+  if (!connected) return false;
 
-  for (int i = 0; i < msg_count; i++) {
-    auto cmsg = can_data_list[i];
-    if (cmsg.getAddress() >= 0x800) { // extended
-      send[i*4] = (cmsg.getAddress() << 3) | 5;
-    } else { // normal
-      send[i*4] = (cmsg.getAddress() << 21) | 1;
+  // all in flight, the oldest has had the most time to finish
+  if (send_free.empty() && send_transfers.size() >= CAN_SEND_TRANSFERS) {
+    std::vector<CanSendTiming> unused;
+    can_send_poll(unused, 5000);
+    if (send_free.empty()) {
+      LOGW("Transmit queue full");
+      return false;
     }
-    auto can_data = cmsg.getDat();
-    assert(can_data.size() <= 8);
-    send[i*4+1] = can_data.size() | (cmsg.getSrc() << 4);
-    memcpy(&send[i*4+2], can_data.begin(), can_data.size());
   }
 
-  usb_bulk_write(3, (unsigned char*)send.data(), send.size(), 5);
+  const int messages = can_pack(can_data_list, bus_offset, can_version, send_buf);
+  if (messages == 0) return false;
+
+  SendTransfer *t;
+  if (!send_free.empty()) {
+    t = send_free.back();
+    send_free.pop_back();
+  } else {
+    send_transfers.push_back(std::make_unique<SendTransfer>());
+    t = send_transfers.back().get();
+    t->panda = this;
+    t->transfer = transport->alloc_transfer();
+    t->transfer->endpoint = 3;
+    t->transfer->callback = can_send_callback;
+    t->transfer->user_data = t;
+  }
+
+  // the panda NAKs while its receive buffer is full, after 5 ms the messages are dropped
+  t->data.assign(send_buf.begin(), send_buf.end());
+  t->timing = timing;
+  t->timing.messages = messages;
+  t->transfer->buffer = (unsigned char *)t->data.data();
+  t->transfer->length = t->data.size() * sizeof(uint32_t);
+  t->transfer->timeout = 5;
+
+  {
+    std::lock_guard lk(send_lock);
+    sends_in_flight++;
+  }
+  t->timing.submit_time = nanos_since_boot();
+  int err = transport->submit(t->transfer);
+  if (err != 0) {
+    {
+      std::lock_guard lk(send_lock);
+      sends_in_flight--;
+    }
+    send_cv.notify_all();
+    handle_usb_issue(err, __func__);
+    send_free.push_back(t);
+    return false;
+  }
+  return true;
 }
 
-int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
-  uint32_t data[RECV_SIZE/4];
-  int recv = usb_bulk_read(0x81, (unsigned char*)data, RECV_SIZE);
+void Panda::can_send_poll(std::vector<CanSendTiming> &done, int timeout_us) {
+  const uint64_t deadline = nanos_since_boot() + timeout_us * 1000ULL;
+  while (true) {
+    {
+      std::lock_guard lk(send_lock);
+      if (sends_in_flight == 0) break;
+    }
+    const uint64_t now = nanos_since_boot();
+    if (now >= deadline) break;
+    transport->handle_events((deadline - now) / 1000);
+  }
+
+  std::vector<SendTransfer *> finished;
+  {
+    std::lock_guard lk(send_lock);
+    finished.swap(send_done);
+  }
+  for (auto t : finished) {
+    if (t->transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
+      LOGW("Transmit buffer full");
+    } else if (t->transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+      handle_usb_issue(LIBUSB_ERROR_NO_DEVICE, __func__);
+    } else if (!t->timing.ok) {
+      handle_usb_issue(LIBUSB_ERROR_IO, __func__);
+    }
+    done.push_back(t->timing);
+    send_free.push_back(t);
+  }
+}
+
+void Panda::can_send_stop() {
+  std::vector<CanSendTiming> unused;
+  can_send_poll(unused, 100000);
+  if (send_free.size() != send_transfers.size()) {
+    LOGE("%zu CAN sends didn't complete, leaking them", send_transfers.size() - send_free.size());
+    for (auto &t : send_transfers) t.release();
+  } else {
+    for (auto &t : send_transfers) transport->free_transfer(t->transfer);
+  }
+  send_transfers.clear();
+  send_free.clear();
+}
+
+int Panda::can_receive(uint32_t *data, bool &full) {
+  // a packet the last read cut off goes first
+  const int partial = recv_partial.size() * sizeof(uint32_t);
+  std::copy(recv_partial.begin(), recv_partial.end(), data);
+  const uint64_t start = nanos_since_boot();
+  int recv = usb_bulk_read(0x81, (unsigned char*)data + partial, RECV_SIZE);
 
   // Not sure if this can happen
   if (recv < 0) recv = 0;
+  full = recv == RECV_SIZE;
+  count_transfer(nanos_since_boot() - start, recv);
 
-  if (recv == RECV_SIZE) {
-    LOGW("Receive buffer full");
+  const int size = partial + recv;
+  const int whole = can_packets_size(data, size);
+  recv_partial.assign(data + whole / 4, data + size / 4);
+  return whole;
+}
+
+int Panda::can_packets_size(const uint32_t *data, int size) const {
+  if (can_version == 1) return size / 0x10 * 0x10;
+
+  int pos = 0;
+  while (pos + 8 <= size) {
+    const int pkt = can_v2_size(can_v2_len(data[pos / 4]));
+    if (pos + pkt > size) break;
+    pos += pkt;
   }
+  return pos;
+}
 
-  size_t num_msg = recv / 0x10;
-  MessageBuilder msg;
-  auto evt = msg.initEvent();
-  evt.setValid(comms_healthy);
+int Panda::can_count(const uint32_t *data, int size, int &data_words) const {
+  if (can_version == 1) {
+    data_words += size / 0x10;
+    return size / 0x10;
+  }
 
-  // populate message
-  auto canData = evt.initCan(num_msg);
-  for (int i = 0; i < num_msg; i++) {
-    if (data[i*4] & 4) {
-      // extended
-      canData[i].setAddress(data[i*4] >> 3);
-      //printf("got extended: %x\n", data[i*4] >> 3);
-    } else {
-      // normal
-      canData[i].setAddress(data[i*4] >> 21);
+  int num_msg = 0;
+  for (int pos = 0; pos + 8 <= size; num_msg++) {
+    const int len = can_v2_len(data[pos / 4]);
+    data_words += (len + 7) / 8;
+    pos += can_v2_size(len);
+  }
+  return num_msg;
+}
+
+void Panda::can_unpack(const uint32_t *data, int size, uint64_t recv_time, capnp::List<cereal::CanData>::Builder can_data, int start) {
+  const PandaClock::Fit fit = clock.fit();
+  CanStats counted;
+  if (can_version == 1) {
+    const int num_msg = size / 0x10;
+    for (int i = 0; i < num_msg; i++, data += 4) {
+      const uint32_t w0 = data[0], w1 = data[1];
+      auto c = can_data[start + i];
+      // extended addresses are 29 bits from bit 3, normal ones 11 bits from bit 21
+      c.setAddress(w0 >> ((w0 & 4) ? 3 : 21));
+      c.setBusTime(w1 >> 16);
+      c.setBusMonoTime(PandaClock::frame_time(fit, w1 >> 16, recv_time));
+      // the flags of sent and rejected messages are above the bus number
+      c.setSrc(((w1 >> 4) & 0xff) + bus_offset);
+      const int len = std::min(w1 & 0xF, 8U);
+      memcpy(c.initDat(len).begin(), &data[2], len);
+      count_frame(counted, (w1 >> 4) & 0xff, len, w0 & 4, false, false);
+    }
+  } else {
+    for (int pos = 0, i = start; pos + 8 <= size; i++) {
+      const uint32_t w0 = data[pos / 4], w1 = data[pos / 4 + 1];
+      const int len = can_v2_len(w0);
+      auto c = can_data[i];
+      c.setAddress(w1 & 0x1FFFFFFF);
+      c.setBusTime(w0 >> 16);
+      c.setBusMonoTime(PandaClock::frame_time(fit, w0 >> 16, recv_time));
+      c.setSrc((w0 & 0xff) + bus_offset);
+      memcpy(c.initDat(len).begin(), &data[pos / 4 + 2], len);
+      count_frame(counted, w0 & 0xff, len, w1 >> 31, w0 & CAN_FD_FLAG, w0 & CAN_BRS_FLAG);
+      pos += can_v2_size(len);
+    }
+  }
+
+  std::lock_guard lk(stats_lock);
+  for (int b = 0; b < PANDA_BUS_CNT; b++) {
+    stats.buses[b].frames += counted.buses[b].frames;
+    stats.buses[b].bytes += counted.buses[b].bytes;
+    stats.buses[b].nominal_bits += counted.buses[b].nominal_bits;
+    stats.buses[b].data_bits += counted.buses[b].data_bits;
+  }
+}
+
+void Panda::count_transfer(uint64_t latency_ns, int length) {
+  int bucket = 0;
+  while (bucket < CAN_LATENCY_BUCKETS - 1 && latency_ns >= (125000ULL << bucket)) bucket++;
+
+  std::lock_guard lk(stats_lock);
+  stats.latency[bucket]++;
+  stats.recv_full += length == RECV_SIZE;
+}
+
+CanStats Panda::take_can_stats() {
+  std::lock_guard lk(stats_lock);
+  CanStats taken = stats;
+  stats = CanStats();
+  return taken;
+}
+
+void Panda::can_recv_callback(PandaTransfer *transfer) {
+  Panda *panda = (Panda *)transfer->user_data;
+  std::lock_guard lk(panda->recv_lock);
+  panda->recv_done.push_back({transfer, nanos_since_boot()});
+}
+
+void Panda::can_recv_start(int transfers) {
+  assert(recv_transfers.empty());
+  recv_stopping = false;
+  for (int i = 0; i < transfers; i++) {
+    // a ring of transfers that are submitted again as they complete
+    PandaTransfer *transfer = transport->alloc_transfer();
+    transfer->endpoint = 0x81;
+    transfer->buffer = transport->alloc_buffer(RECV_SIZE);
+    transfer->length = RECV_SIZE;
+    transfer->timeout = TIMEOUT;
+    transfer->callback = can_recv_callback;
+    transfer->user_data = this;
+    recv_transfers.push_back(transfer);
+    recv_submit_time.push_back(nanos_since_boot());
+
+    int err = transport->submit(transfer);
+    if (err != 0) {
+      handle_usb_issue(err, __func__);
+      continue;
+    }
+    recv_in_flight++;
+  }
+}
+
+uint64_t Panda::can_recv_poll(std::vector<uint32_t> &out, int timeout_us) {
+  bool pending;
+  {
+    std::lock_guard lk(recv_lock);
+    pending = !recv_done.empty();
+  }
+  if (!pending && recv_in_flight > 0) {
+    transport->handle_events(timeout_us);
+  } else if (!pending) {
+    std::this_thread::sleep_for(std::chrono::microseconds(timeout_us));
+  }
+
+  std::deque<std::pair<PandaTransfer *, uint64_t>> done;
+  {
+    std::lock_guard lk(recv_lock);
+    done.swap(recv_done);
+  }
+
+  if (done.empty()) return 0;
+
+  // transfers complete in order, a packet one of them cut off goes on in the next
+  const size_t start = out.size();
+  out.insert(out.end(), recv_partial.begin(), recv_partial.end());
+
+  uint64_t first_recv = 0;
+  for (auto &[transfer, recv_time] : done) {
+    const size_t idx = std::find(recv_transfers.begin(), recv_transfers.end(), transfer) - recv_transfers.begin();
+    switch (transfer->status) {
+      case LIBUSB_TRANSFER_COMPLETED:
+        count_transfer(recv_time - recv_submit_time[idx], transfer->actual_length);
+        if (transfer->actual_length > 0) {
+          const uint32_t *data = (const uint32_t *)transfer->buffer;
+          out.insert(out.end(), data, data + transfer->actual_length / 4);
+          if (first_recv == 0) first_recv = recv_time;
+        }
+        break;
+      case LIBUSB_TRANSFER_OVERFLOW:
+        comms_healthy = false;
+        LOGE_100("overflow got 0x%x", transfer->actual_length);
+        break;
+      case LIBUSB_TRANSFER_NO_DEVICE:
+        handle_usb_issue(LIBUSB_ERROR_NO_DEVICE, __func__);
+        break;
+      case LIBUSB_TRANSFER_CANCELLED:
+        break;
+      default:
+        handle_usb_issue(LIBUSB_ERROR_IO, __func__);
+        break;
+    }
+
+    // submitted again right away, so the next packets already have somewhere to go
+    recv_submit_time[idx] = nanos_since_boot();
+    if (recv_stopping || !connected || transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+      recv_in_flight--;
+    } else if (int err = transport->submit(transfer); err != 0) {
+      handle_usb_issue(err, __func__);
+      recv_in_flight--;
+    }
+  }
+
+  const int whole = can_packets_size(out.data() + start, (out.size() - start) * sizeof(uint32_t));
+  recv_partial.assign(out.begin() + start + whole / 4, out.end());
+  out.resize(start + whole / 4);
+  return whole > 0 ? first_recv : 0;
+}
+
+void Panda::can_recv_stop() {
+  recv_stopping = true;
+  for (auto transfer : recv_transfers) {
+    transport->cancel(transfer);
+  }
+  // cancelled transfers still complete, they can only be freed after that
+  std::vector<uint32_t> unused;
+  for (int i = 0; i < 100 && recv_in_flight > 0; i++) {
+    can_recv_poll(unused, 10000);
+  }
+  if (recv_in_flight > 0) {
+    LOGE("%d CAN transfers didn't complete, leaking them", recv_in_flight);
+  } else {
+    for (auto transfer : recv_transfers) {
+      transport->free_buffer(transfer->buffer, RECV_SIZE);
+      transport->free_transfer(transfer);
     }
-    canData[i].setBusTime(data[i*4+1] >> 16);
-    int len = data[i*4+1]&0xF;
-    canData[i].setDat(kj::arrayPtr((uint8_t*)&data[i*4+2], len));
-    canData[i].setSrc((data[i*4+1] >> 4) & 0xff);
   }
-  out_buf = capnp::messageToFlatArray(msg);
-  return recv;
+  recv_transfers.clear();
+  recv_submit_time.clear();
 }
@@ -1,20 +1,44 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <ctime>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <utility>
 #include <vector>
 
-#include <libusb-1.0/libusb.h>
-
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/boardd/panda_clock.h"
+#include "selfdrive/boardd/panda_transport.h"
 
 // double the FIFO size
 #define RECV_SIZE (0x1000)
 #define TIMEOUT 0
+// CAN buses of one panda, the ones of the next panda come after them in can and sendcan
+#define PANDA_BUS_CNT 4
+// upper bound of the encoded size of a can event with num_msg messages and
+// data_words words of data: three words per message for its struct, plus the event itself
+#define CAN_MSG_SIZE(num_msg, data_words) (128 + (num_msg) * 3 * 8 + (data_words) * 8)
+// USB CAN packets. Version 1 is four words per message with up to 8 bytes of
+// data. Version 2, when the firmware has it, carries CAN-FD frames of up to 64
+// bytes: two header words, then the data padded to a multiple of 8 bytes, at least 8
+//   word 0: bits 0-7 bus, bits 8-11 DLC, bit 12 CAN-FD, bit 13 bit rate switch, bits 16-31 bus time
+//   word 1: bits 0-28 address, bit 31 extended
+// v2 packets can continue in the next read, see panda/board/main.c
+#define CAN_PACKET_V2_MAX (8 + 64)
+// room for a read of RECV_SIZE after what's left of the last one
+#define CAN_RECV_BUF_SIZE (RECV_SIZE + CAN_PACKET_V2_MAX)
+// async receive transfers kept in flight on the CAN endpoint
+#define CAN_RECV_TRANSFERS 4
+// async sends that may be in flight at once
+#define CAN_SEND_TRANSFERS 4
+// back-to-back reads after one came back full, enough to empty the panda's rx queue
+#define CAN_RECV_DRAIN 16
 
 // copied from panda/board/main.c
 struct __attribute__((packed)) health_t {
@@ -37,16 +61,101 @@ struct __attribute__((packed)) health_t {
   uint8_t fault_status;
   uint8_t power_save_enabled;
   uint8_t heartbeat_lost;
+  // zero with firmware that doesn't report them
+  uint32_t can_rx_q_size;
+  uint32_t can_rx_q_max_used;
+};
+
+// copied from panda/board/drivers/can_common.h
+struct __attribute__((packed)) can_health_t {
+  uint32_t bus_off_cnt;
+  uint32_t error_cnt;
+  uint32_t can_speed;       // in 100 bit/s
+  uint32_t can_data_speed;  // 0 without CAN-FD
+  uint8_t bus_off;
+  uint8_t error_passive;
+  uint8_t error_warning;
+  uint8_t last_error;
+  uint8_t transmit_error_cnt;
+  uint8_t receive_error_cnt;
+  // zero with firmware that doesn't report them
+  uint16_t tx_q_max_used;
+  uint16_t tx_prio_q_max_used;
+};
+
+// copied from panda/board/safety.h
+struct __attribute__((packed)) safety_hook_time_t {
+  uint32_t calls;
+  uint32_t max_cycles;
+  uint32_t avg_cycles;
 };
 
+struct __attribute__((packed)) safety_hook_stats_t {
+  uint32_t core_freq;  // in MHz
+  safety_hook_time_t rx;
+  safety_hook_time_t tx;
+  safety_hook_time_t fwd;
+};
+
+// CAN receive transfers by how long they took, buckets doubling from 125 us
+#define CAN_LATENCY_BUCKETS 8
+
+// what went through the CAN path of one panda, for canStats
+struct CanStats {
+  struct Bus {
+    uint32_t frames = 0, bytes = 0;
+    // on the wire at the nominal and the CAN-FD data bit rate, bit stuffing aside
+    uint64_t nominal_bits = 0, data_bits = 0;
+  } buses[PANDA_BUS_CNT];
+  uint32_t latency[CAN_LATENCY_BUCKETS] = {};
+  uint32_t recv_full = 0;
+};
+
+// stages of an async CAN send, in nanos_since_boot
+struct CanSendTiming {
+  uint64_t sendcan_time, recv_time, submit_time, complete_time;
+  uint32_t messages;
+  bool ok;
+};
 
 class Panda {
  private:
-  libusb_context *ctx = NULL;
-  libusb_device_handle *dev_handle = NULL;
+  std::unique_ptr<PandaTransport> transport;
   std::mutex usb_lock;
   void handle_usb_issue(int err, const char func[]);
   void cleanup();
+  std::vector<uint32_t> send_buf;
+  // start of a v2 packet that a read cut off
+  std::vector<uint32_t> recv_partial;
+
+  // async CAN receive, transfers that completed wait in recv_done with the time they did
+  static void can_recv_callback(PandaTransfer *transfer);
+  std::vector<PandaTransfer *> recv_transfers;
+  std::mutex recv_lock;
+  std::deque<std::pair<PandaTransfer *, uint64_t>> recv_done;
+  int recv_in_flight = 0;
+  bool recv_stopping = false;
+  std::vector<uint64_t> recv_submit_time;  // of each of recv_transfers
+
+  std::mutex stats_lock;
+  CanStats stats;
+  void count_transfer(uint64_t latency_ns, int length);
+
+  // async CAN send, finished transfers wait in send_done
+  struct SendTransfer {
+    Panda *panda;
+    PandaTransfer *transfer;
+    std::vector<uint32_t> data;
+    CanSendTiming timing;
+  };
+  static void can_send_callback(PandaTransfer *transfer);
+  // control transfers wait for the sends in flight first
+  void wait_for_sends();
+  std::vector<std::unique_ptr<SendTransfer>> send_transfers;
+  std::vector<SendTransfer *> send_free, send_done;
+  std::mutex send_lock;
+  std::condition_variable send_cv;
+  int sends_in_flight = 0;
 
  public:
   Panda(std::string serial="");
@@ -57,6 +166,11 @@ class Panda {
   std::atomic<bool> comms_healthy = true;
   cereal::PandaState::PandaType hw_type = cereal::PandaState::PandaType::UNKNOWN;
   bool has_rtc = false;
+  uint8_t bus_offset = 0;
+  int can_version = 1;  // USB CAN packet version
+  // the panda's CAN timestamps on the boot time clock, without it with older firmware
+  PandaClock clock;
+  bool has_clock = true;
 
   // Static functions
   static std::vector<std::string> list();
@@ -71,20 +185,63 @@ class Panda {
   cereal::PandaState::PandaType get_hw_type();
   void set_safety_model(cereal::CarParams::SafetyModel safety_model, int safety_param=0);
   void set_unsafe_mode(uint16_t unsafe_mode);
+  // only the received messages in it are forwarded, until the next set_safety_model.
+  // Without any for this panda's buses it forwards everything
+  void set_can_filter(capnp::List<cereal::CarParams::CanFilter>::Reader filter);
   void set_rtc(struct tm sys_time);
   struct tm get_rtc();
   void set_fan_speed(uint16_t fan_speed);
   uint16_t get_fan_speed();
   void set_ir_pwr(uint16_t ir_pwr);
   health_t get_state();
+  // health the firmware pushes on its interrupt endpoint, as something in it
+  // changed and every 500 ms. 1 with a new one in health, 0 when none came in
+  // timeout ms, -1 if the panda doesn't push it (older firmware, SPI)
+  int health_recv(health_t &health, unsigned int timeout);
   void set_loopback(bool loopback);
   std::optional<std::vector<uint8_t>> get_firmware_version();
   std::optional<std::string> get_serial();
   void set_power_saving(bool power_saving);
   void set_usb_power_mode(cereal::PandaState::UsbPowerMode power_mode);
   void send_heartbeat();
+  // a few handshakes with the panda's timer for clock, the one that took the least goes in
+  void clock_sync();
   void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
-  int can_receive(kj::Array<capnp::word>& out_buf);
+  // reads CAN packets into data, which has room for CAN_RECV_BUF_SIZE bytes,
+  // and returns how many bytes of whole packets it got. full is set when the
+  // read was RECV_SIZE, the panda has more queued then
+  int can_receive(uint32_t *data, bool &full);
+  // bytes of the whole packets at the start of size bytes of data
+  int can_packets_size(const uint32_t *data, int size) const;
+  // messages in size bytes of packets, adds the words their data takes in a can event to data_words
+  int can_count(const uint32_t *data, int size, int &data_words) const;
+  // fills can_data from start on with size bytes of CAN packets of this panda,
+  // that were read at recv_time
+  void can_unpack(const uint32_t *data, int size, uint64_t recv_time, capnp::List<cereal::CanData>::Builder can_data, int start);
+
+  // Async receive instead of can_receive: can_recv_start keeps transfers in
+  // flight on the CAN endpoint, can_recv_poll waits up to timeout_us for them,
+  // appends the whole packets they got to out and submits them again. It returns the time
+  // the first one with data completed, 0 if none did. Callbacks run on any
+  // thread that handles USB events, so only one thread may poll
+  void can_recv_start(int transfers);
+  uint64_t can_recv_poll(std::vector<uint32_t> &out, int timeout_us);
+  void can_recv_stop();
+
+  // Async send instead of can_send: the transfer goes out without usb_lock,
+  // and control transfers of other threads wait up to 5 ms for it first.
+  // can_send_poll handles USB events until the sends in flight are done,
+  // at most timeout_us, and appends the timings of the finished ones to done
+  bool can_send_async(capnp::List<cereal::CanData>::Reader can_data_list, CanSendTiming timing);
+  void can_send_poll(std::vector<CanSendTiming> &done, int timeout_us);
+  void can_send_stop();
+
+  // the CAN stats since the last call
+  CanStats take_can_stats();
+  // nullopt with firmware that doesn't have it
+  std::optional<can_health_t> get_can_health(uint8_t bus);
+  // since the last call, none with firmware that doesn't time the safety hooks
+  std::optional<safety_hook_stats_t> get_safety_hook_stats();
 
   // dp
   bool has_gps = true;
@@ -0,0 +1,87 @@
+#include "selfdrive/boardd/panda_clock.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "selfdrive/common/swaglog.h"
+
+// crystals are good to well under this
+#define MAX_DRIFT_PPM 500.
+// samples this far off the fit mean the timer jumped, the panda reset
+#define MAX_RESIDUAL_NS 5000000LL
+
+uint64_t PandaClock::Fit::boot_time(int64_t panda_us) const {
+  return y0 + std::llround(slope * (panda_us - x0));
+}
+
+int64_t PandaClock::Fit::panda_time(uint64_t boot_ns) const {
+  return x0 + std::llround((int64_t)(boot_ns - y0) / slope);
+}
+
+void PandaClock::add_sample(uint64_t t0, uint32_t panda_us, uint64_t t1) {
+  if (t1 - t0 > PANDA_CLOCK_MAX_RTT_NS) return;
+
+  std::lock_guard lk(lock);
+  if (!samples.empty() && panda_us < last_us) {
+    if (last_us - panda_us > (1U << 31)) {
+      wraps++;
+    } else {
+      samples.clear();
+    }
+  }
+  last_us = panda_us;
+
+  const Sample s = {.x = (wraps << 32) + panda_us, .y = t0 + (t1 - t0) / 2};
+  if (cur.valid && std::abs((int64_t)(s.y - cur.boot_time(s.x))) > MAX_RESIDUAL_NS) {
+    LOGW("panda clock jumped, restarting its sync");
+    samples.clear();
+  }
+  samples.push_back(s);
+  if (samples.size() > PANDA_CLOCK_SAMPLES) samples.pop_front();
+  update_fit();
+}
+
+void PandaClock::update_fit() {
+  // least squares relative to the first sample, doubles don't have the bits for boot times
+  const Sample &first = samples.front();
+  double mx = 0, my = 0;
+  for (auto &s : samples) {
+    mx += s.x - first.x;
+    my += (int64_t)(s.y - first.y);
+  }
+  mx /= samples.size();
+  my /= samples.size();
+
+  double sxy = 0, sxx = 0;
+  for (auto &s : samples) {
+    const double dx = s.x - first.x - mx, dy = (int64_t)(s.y - first.y) - my;
+    sxy += dx * dy;
+    sxx += dx * dx;
+  }
+
+  // the drift needs a second of samples to show
+  double slope = 1000.;
+  if (samples.back().x - first.x > 1000000) {
+    slope = std::clamp(sxy / sxx, 1000. * (1. - MAX_DRIFT_PPM * 1e-6), 1000. * (1. + MAX_DRIFT_PPM * 1e-6));
+  }
+  cur.valid = true;
+  cur.slope = slope;
+  cur.x0 = samples.back().x;
+  cur.y0 = first.y + std::llround(my + slope * (cur.x0 - first.x - mx));
+}
+
+PandaClock::Fit PandaClock::fit() const {
+  std::lock_guard lk(lock);
+  return cur;
+}
+
+uint64_t PandaClock::frame_time(const Fit &fit, uint16_t bus_time, uint64_t recv_time) {
+  if (!fit.valid) return recv_time;
+
+  // frames are at most 524 ms old, the 16 bits of ticks don't wrap before they're read.
+  // The fit may put recv_time a little before the frame, that's a negative age
+  const int64_t now = fit.panda_time(recv_time) >> 3;
+  int age = (uint16_t)(now - bus_time);
+  if (age > 0xff00) age -= 0x10000;
+  return fit.boot_time(((now - age) << 3) + 4);
+}
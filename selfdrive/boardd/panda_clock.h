@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// handshakes the fit is made of, two per second
+#define PANDA_CLOCK_SAMPLES 32
+// handshakes that took longer don't say much about when the timer was read
+#define PANDA_CLOCK_MAX_RTT_NS 2000000ULL
+
+// Maps the panda's microsecond timer to nanos_since_boot. Every handshake
+// reads the timer between two host timestamps, a line through the last
+// PANDA_CLOCK_SAMPLES of them follows the offset and the drift of the panda's crystal
+class PandaClock {
+public:
+  struct Fit {
+    bool valid = false;
+    int64_t x0 = 0;        // panda us, the timer wraps are counted
+    uint64_t y0 = 0;       // boot time at x0
+    double slope = 1000.;  // ns per panda us
+
+    uint64_t boot_time(int64_t panda_us) const;
+    int64_t panda_time(uint64_t boot_ns) const;
+  };
+
+  // t0 and t1 are nanos_since_boot before and after the panda read panda_us
+  void add_sample(uint64_t t0, uint32_t panda_us, uint64_t t1);
+  Fit fit() const;
+
+  // boot time of a frame with bus_time, the timer in 8 us ticks, that boardd
+  // read at recv_time. Just recv_time without a fit
+  static uint64_t frame_time(const Fit &fit, uint16_t bus_time, uint64_t recv_time);
+
+private:
+  struct Sample {
+    int64_t x;
+    uint64_t y;
+  };
+  void update_fit();
+
+  mutable std::mutex lock;
+  std::deque<Sample> samples;
+  int64_t wraps = 0;
+  uint32_t last_us = 0;
+  Fit cur;
+};
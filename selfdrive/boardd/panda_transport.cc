@@ -0,0 +1,221 @@
+#include "selfdrive/boardd/panda_transport.h"
+
+#include <cassert>
+#include <iterator>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+static int init_usb_ctx(libusb_context **context) {
+  int err = libusb_init(context);
+  if (err != 0) {
+    LOGE("libusb initialization error");
+    return err;
+  }
+
+#if LIBUSB_API_VERSION >= 0x01000106
+  libusb_set_option(*context, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
+#else
+  libusb_set_debug(*context, 3);
+#endif
+
+  return err;
+}
+
+static bool is_panda(libusb_device *device, libusb_device_descriptor &desc) {
+  libusb_get_device_descriptor(device, &desc);
+  return desc.idVendor == 0xbbaa && desc.idProduct == 0xddcc;
+}
+
+static int get_serial(libusb_device_handle *handle, const libusb_device_descriptor &desc, std::string &serial) {
+  unsigned char desc_serial[26] = { 0 };
+  int ret = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, desc_serial, std::size(desc_serial));
+  if (ret >= 0) {
+    serial = std::string((char *)desc_serial, ret).c_str();
+  }
+  return ret;
+}
+
+class LibusbTransport : public PandaTransport {
+public:
+  ~LibusbTransport() {
+    if (dev_handle) {
+      libusb_release_interface(dev_handle, 0);
+      libusb_close(dev_handle);
+    }
+    if (ctx) {
+      libusb_exit(ctx);
+    }
+  }
+
+  bool open(const std::string &want_serial) {
+    if (init_usb_ctx(&ctx) != 0) return false;
+
+    // connect by serial
+    libusb_device **dev_list = NULL;
+    ssize_t num_devices = libusb_get_device_list(ctx, &dev_list);
+    if (num_devices < 0) return false;
+    for (size_t i = 0; i < num_devices; ++i) {
+      libusb_device_descriptor desc;
+      if (!is_panda(dev_list[i], desc)) continue;
+
+      libusb_open(dev_list[i], &dev_handle);
+      if (dev_handle == NULL) break;
+      if (get_serial(dev_handle, desc, serial) < 0) {
+        libusb_close(dev_handle);
+        dev_handle = NULL;
+        break;
+      }
+      if (want_serial.empty() || want_serial == serial) {
+        break;
+      }
+      libusb_close(dev_handle);
+      dev_handle = NULL;
+    }
+    libusb_free_device_list(dev_list, 1);
+    if (dev_handle == NULL) return false;
+
+    if (libusb_kernel_driver_active(dev_handle, 0) == 1) {
+      libusb_detach_kernel_driver(dev_handle, 0);
+    }
+    return libusb_set_configuration(dev_handle, 1) == 0 && libusb_claim_interface(dev_handle, 0) == 0;
+  }
+
+  int control_transfer(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                       unsigned char *data, uint16_t length, unsigned int timeout) override {
+    return libusb_control_transfer(dev_handle, request_type, request, value, index, data, length, timeout);
+  }
+
+  int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) override {
+    return libusb_bulk_transfer(dev_handle, endpoint, data, length, transferred, timeout);
+  }
+
+  PandaTransfer *alloc_transfer() override {
+    Transfer *t = new Transfer;
+    t->transfer = libusb_alloc_transfer(0);
+    assert(t->transfer != NULL);
+    return t;
+  }
+
+  void free_transfer(PandaTransfer *transfer) override {
+    Transfer *t = (Transfer *)transfer;
+    libusb_free_transfer(t->transfer);
+    delete t;
+  }
+
+  int submit(PandaTransfer *transfer) override {
+    Transfer *t = (Transfer *)transfer;
+    libusb_fill_bulk_transfer(t->transfer, dev_handle, t->endpoint, t->buffer, t->length, callback, t, t->timeout);
+    return libusb_submit_transfer(t->transfer);
+  }
+
+  int cancel(PandaTransfer *transfer) override {
+    return libusb_cancel_transfer(((Transfer *)transfer)->transfer);
+  }
+
+  void handle_events(int timeout_us) override {
+    struct timeval tv = {.tv_sec = timeout_us / 1000000, .tv_usec = timeout_us % 1000000};
+    libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  }
+
+private:
+  struct Transfer : PandaTransfer {
+    libusb_transfer *transfer;
+  };
+
+  static void LIBUSB_CALL callback(libusb_transfer *transfer) {
+    Transfer *t = (Transfer *)transfer->user_data;
+    t->status = transfer->status;
+    t->actual_length = transfer->actual_length;
+    t->callback(t);
+  }
+
+  libusb_context *ctx = NULL;
+  libusb_device_handle *dev_handle = NULL;
+};
+
+static std::vector<std::string> libusb_list() {
+  std::vector<std::string> serials;
+  libusb_context *context = NULL;
+  if (init_usb_ctx(&context) != 0) return serials;
+
+  libusb_device **dev_list = NULL;
+  ssize_t num_devices = libusb_get_device_list(context, &dev_list);
+  if (num_devices < 0) {
+    LOGE("libusb can't get device list");
+    libusb_exit(context);
+    return serials;
+  }
+  for (size_t i = 0; i < num_devices; ++i) {
+    libusb_device_descriptor desc;
+    if (!is_panda(dev_list[i], desc)) continue;
+
+    libusb_device_handle *handle = NULL;
+    libusb_open(dev_list[i], &handle);
+    if (handle == NULL) continue;
+    std::string serial;
+    int ret = get_serial(handle, desc, serial);
+    libusb_close(handle);
+
+    if (ret < 0) break;
+    serials.push_back(serial);
+  }
+
+  if (dev_list != NULL) {
+    libusb_free_device_list(dev_list, 1);
+  }
+  libusb_exit(context);
+  return serials;
+}
+
+std::vector<std::string> PandaTransport::list() {
+  std::vector<std::string> serials;
+  if (util::getenv("BOARDD_SPI", 0)) {
+    serials = spi_list();
+  }
+  for (auto &serial : util::getenv("BOARDD_USBFS", 0) ? usbfs_list() : libusb_list()) {
+    serials.push_back(serial);
+  }
+  return serials;
+}
+
+static int LIBUSB_CALL hotplug_arrived(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data) {
+  *(bool *)user_data = true;
+  return 0;
+}
+
+void PandaTransport::wait_for_device(int timeout_ms) {
+  // a context of its own that's only there for the hotplug events
+  static libusb_context *ctx = NULL;
+  static bool arrived = false;
+  static const bool hotplug = []() {
+    if (util::getenv("BOARDD_USBFS", 0) || util::getenv("BOARDD_SPI", 0)) return false;
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) || init_usb_ctx(&ctx) != 0) return false;
+    return libusb_hotplug_register_callback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, LIBUSB_HOTPLUG_NO_FLAGS,
+                                            0xbbaa, 0xddcc, LIBUSB_HOTPLUG_MATCH_ANY, hotplug_arrived, &arrived, NULL) == LIBUSB_SUCCESS;
+  }();
+
+  if (!hotplug) {
+    util::sleep_for(timeout_ms);
+    return;
+  }
+
+  arrived = false;
+  const double end = millis_since_boot() + timeout_ms;
+  for (double remaining = timeout_ms; !arrived && remaining > 0; remaining = end - millis_since_boot()) {
+    struct timeval tv = {.tv_sec = (long)remaining / 1000, .tv_usec = ((long)(remaining * 1000)) % 1000000};
+    libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  }
+}
+
+std::unique_ptr<PandaTransport> PandaTransport::open(const std::string &serial) {
+  if (util::getenv("BOARDD_SPI", 0)) {
+    if (auto transport = spi_open(serial)) return transport;
+  }
+  if (util::getenv("BOARDD_USBFS", 0)) return usbfs_open(serial);
+
+  auto transport = std::make_unique<LibusbTransport>();
+  if (!transport->open(serial)) return nullptr;
+  return transport;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libusb-1.0/libusb.h>
+
+// An async bulk transfer, filled in like a libusb_transfer. status is a
+// libusb_transfer_status once it completed
+struct PandaTransfer {
+  unsigned char endpoint = 0;
+  unsigned char *buffer = nullptr;
+  int length = 0;
+  unsigned int timeout = 0;  // ms, 0 for none
+  void (*callback)(PandaTransfer *transfer) = nullptr;
+  void *user_data = nullptr;
+
+  int status = LIBUSB_TRANSFER_COMPLETED;
+  int actual_length = 0;
+};
+
+// USB access to one panda. libusb by default, BOARDD_USBFS=1 talks to usbfs
+// directly instead. BOARDD_SPI=1 adds the panda on the host's SPI, ahead of the
+// ones on USB. Every backend returns LIBUSB_ERROR codes
+class PandaTransport {
+public:
+  virtual ~PandaTransport() = default;
+
+  virtual int control_transfer(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                               unsigned char *data, uint16_t length, unsigned int timeout) = 0;
+  virtual int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) = 0;
+
+  // Async transfers. Callbacks run in handle_events, on whichever thread calls it
+  virtual PandaTransfer *alloc_transfer() = 0;
+  virtual void free_transfer(PandaTransfer *transfer) = 0;
+  virtual int submit(PandaTransfer *transfer) = 0;
+  virtual int cancel(PandaTransfer *transfer) = 0;
+  virtual void handle_events(int timeout_us) = 0;
+  // buffers async transfers can use without the kernel copying them, where the backend has them
+  virtual unsigned char *alloc_buffer(int size) { return (unsigned char *)malloc(size); }
+  virtual void free_buffer(unsigned char *buffer, int size) { free(buffer); }
+
+  std::string serial;
+
+  static std::vector<std::string> list();
+  // the panda with serial, or the first one without, nullptr when there's none
+  static std::unique_ptr<PandaTransport> open(const std::string &serial);
+  // returns when a panda shows up on USB, or after timeout_ms. Without libusb
+  // hotplug, and for the other backends, it just waits the timeout
+  static void wait_for_device(int timeout_ms);
+};
+
+std::vector<std::string> usbfs_list();
+std::unique_ptr<PandaTransport> usbfs_open(const std::string &serial);
+std::vector<std::string> spi_list();
+std::unique_ptr<PandaTransport> spi_open(const std::string &serial);
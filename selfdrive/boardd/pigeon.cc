@@ -43,7 +43,7 @@ Pigeon * Pigeon::connect(const char * tty) {
 
 bool Pigeon::wait_for_ack(const std::string &ack, const std::string &nack) {
   std::string s;
-  while (!do_exit) {
+  while (!do_exit && connected()) {
     s += receive();
 
     if (s.find(ack) != std::string::npos) {
@@ -73,7 +73,7 @@ bool Pigeon::send_with_ack(const std::string &cmd) {
 
 void Pigeon::init() {
   for (int i = 0; i < 10; i++) {
-    if (do_exit) return;
+    if (do_exit || !connected()) return;
     LOGW("panda GPS start");
 
     // power off pigeon
@@ -170,8 +170,9 @@ void PandaPigeon::send(const std::string &s) {
 
 std::string PandaPigeon::receive() {
   std::string r;
-  r.reserve(0x1000 + 0x40);
-  unsigned char dat[0x40];
+  r.reserve(0x1000 + 0x400);
+  // a packet per read from older firmware
+  unsigned char dat[0x400];
   while (r.length() < 0x1000) {
     int len = panda->usb_read(0xe0, 1, 0, dat, sizeof(dat));
     if (len <= 0) break;
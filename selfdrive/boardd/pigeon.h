@@ -22,6 +22,8 @@ class Pigeon {
   virtual void send(const std::string &s) = 0;
   virtual std::string receive() = 0;
   virtual void set_power(bool power) = 0;
+  // init and the waits for an ack give up once it's gone
+  virtual bool connected() { return true; }
 };
 
 class PandaPigeon : public Pigeon {
@@ -33,6 +35,7 @@ public:
   void send(const std::string &s);
   std::string receive();
   void set_power(bool power);
+  bool connected() { return panda->connected; }
 };
 
 
@@ -0,0 +1,350 @@
+// Panda transport on spidev, for a panda that's wired to the host's SPI instead
+// of its USB. The protocol is the one in panda/board/drivers/spi.h, every
+// transfer is a transaction on the endpoint of the same number. The panda pulls
+// a GPIO low while it has CAN to read, async receives wait for that line when
+// BOARDD_SPI_IRQ_GPIO has its number and poll the panda without it.
+// There's no hotplug, a panda that doesn't answer shows as timeouts
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/spi/spidev.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+#include "selfdrive/boardd/panda_transport.h"
+#include "selfdrive/common/gpio.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+#define SPI_DEVICE "/dev/spidev0.0"
+#define SPI_SPEED_HZ 30000000
+
+#define SPI_SYNC 0x5A
+#define SPI_ACK 0x79
+#define SPI_NACK 0x1F
+#define SPI_HEADER_LEN 7
+// most data a transaction carries either way
+#define SPI_BUF_SIZE 0x1000
+// spidev's default bufsiz, the longest transfer it takes
+#define SPI_XFER_MAX 4096
+// CAN sends are split in these, the panda only takes what fits its tx queues
+#define SPI_CAN_OUT_MAX 0x400
+
+// for transfers without a timeout, unlike USB nothing says the panda is gone
+#define SPI_TIMEOUT_MS 100
+// the panda drops a stalled transaction within two of its 8Hz ticks
+#define SPI_RESYNC_MS 250
+// receive polls without the data ready line
+#define SPI_POLL_US 1000
+
+static uint8_t checksum(const uint8_t *data, int len, uint8_t sum = 0) {
+  for (int i = 0; i < len; i++) {
+    sum ^= data[i];
+  }
+  return sum;
+}
+
+class SpiTransport : public PandaTransport {
+public:
+  ~SpiTransport() {
+    if (irq_fd >= 0) close(irq_fd);
+    if (fd >= 0) close(fd);
+    if (tx_buf != NULL) munmap(tx_buf, SPI_BUF_SIZE + 1);
+    if (rx_buf != NULL) munmap(rx_buf, SPI_BUF_SIZE + 1);
+  }
+
+  bool open(const std::string &want_serial) {
+    fd = ::open(SPI_DEVICE, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    uint8_t mode = SPI_MODE_0, bits = 8;
+    uint32_t speed = SPI_SPEED_HZ;
+    if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+        ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) {
+      LOGE("can't set up %s: %s", SPI_DEVICE, strerror(errno));
+      return false;
+    }
+
+    // what spidev copies from and to, locked so that never faults
+    tx_buf = alloc_locked(SPI_BUF_SIZE + 1);
+    rx_buf = alloc_locked(SPI_BUF_SIZE + 1);
+    if (tx_buf == NULL || rx_buf == NULL) return false;
+
+    if (int pin = util::getenv("BOARDD_SPI_IRQ_GPIO", -1); pin >= 0) {
+      if (gpio_init(pin, false) == 0 && gpio_set_edge(pin, "falling") == 0) {
+        irq_fd = gpio_open(pin);
+      }
+      if (irq_fd < 0) LOGW("no data ready line on gpio %d, polling the panda", pin);
+    }
+
+    // no descriptors, the panda has a request for its serial
+    char serial_buf[17] = {'\0'};
+    const uint8_t request_type = LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+    if (control_transfer(request_type, 0xd0, 0, 0, (unsigned char *)serial_buf, 16, 0) < 0) return false;
+    serial = serial_buf;
+    return want_serial.empty() || want_serial == serial;
+  }
+
+  int control_transfer(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                       unsigned char *data, uint16_t length, unsigned int timeout) override {
+    // control writes with data don't exist on the panda
+    const bool in = request_type & LIBUSB_ENDPOINT_IN;
+    if (!in && length != 0) return LIBUSB_ERROR_NOT_SUPPORTED;
+
+    // the setup packet as the panda's USB stack gets it
+    const uint8_t setup[8] = {
+      request_type, request,
+      (uint8_t)(value & 0xff), (uint8_t)(value >> 8),
+      (uint8_t)(index & 0xff), (uint8_t)(index >> 8),
+      (uint8_t)(length & 0xff), (uint8_t)(length >> 8),
+    };
+    return transaction(0, setup, sizeof(setup), in ? data : NULL, in ? length : 0, timeout);
+  }
+
+  int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) override {
+    *transferred = 0;
+    if (endpoint & LIBUSB_ENDPOINT_IN) {
+      int ret = transaction(endpoint & ~LIBUSB_ENDPOINT_IN, NULL, 0, data, std::min(length, SPI_BUF_SIZE), timeout);
+      if (ret < 0) return ret;
+      *transferred = ret;
+      return 0;
+    }
+
+    const int max_len = endpoint == 3 ? SPI_CAN_OUT_MAX : SPI_BUF_SIZE;
+    while (*transferred < length) {
+      const int len = std::min(length - *transferred, max_len);
+      int ret = transaction(endpoint, data + *transferred, len, NULL, 0, timeout);
+      if (ret < 0) return ret;
+      *transferred += len;
+    }
+    return 0;
+  }
+
+  PandaTransfer *alloc_transfer() override {
+    return new PandaTransfer();
+  }
+
+  void free_transfer(PandaTransfer *transfer) override {
+    delete transfer;
+  }
+
+  int submit(PandaTransfer *transfer) override {
+    {
+      std::lock_guard lk(lock);
+      const uint64_t deadline = transfer->timeout ? nanos_since_boot() + transfer->timeout * 1000000ULL : 0;
+      pending.push_back({transfer, deadline});
+    }
+    cv.notify_all();
+    return 0;
+  }
+
+  int cancel(PandaTransfer *transfer) override {
+    std::lock_guard lk(lock);
+    auto it = std::find_if(pending.begin(), pending.end(), [=](auto &p) { return p.transfer == transfer; });
+    if (it == pending.end()) return LIBUSB_ERROR_NOT_FOUND;
+    pending.erase(it);
+    finish(transfer, LIBUSB_TRANSFER_CANCELLED);
+    return 0;
+  }
+
+  // Runs the async transfers: the ones that finished while queued, then a send,
+  // or a receive once the panda has CAN for it
+  void handle_events(int timeout_us) override {
+    const uint64_t deadline = nanos_since_boot() + timeout_us * 1000ULL;
+    for (bool waited = false; ; waited = true) {
+      std::deque<PandaTransfer *> done;
+      PandaTransfer *next = NULL;
+      bool receiving = false;
+      {
+        std::lock_guard lk(lock);
+        const uint64_t now = nanos_since_boot();
+        for (auto it = pending.begin(); it != pending.end();) {
+          if (it->deadline != 0 && now >= it->deadline) {
+            finish(it->transfer, LIBUSB_TRANSFER_TIMED_OUT);
+            it = pending.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        done.swap(finished);
+
+        auto it = std::find_if(pending.begin(), pending.end(), [](auto &p) { return !(p.transfer->endpoint & LIBUSB_ENDPOINT_IN); });
+        receiving = it == pending.end() && !pending.empty();
+        if (it == pending.end() && receiving && data_ready()) it = pending.begin();
+        if (it != pending.end()) {
+          next = it->transfer;
+          pending.erase(it);
+        }
+      }
+
+      for (auto t : done) t->callback(t);
+      if (next != NULL) {
+        run(next);
+        return;
+      }
+      if (!done.empty() || waited) return;
+
+      const uint64_t now = nanos_since_boot();
+      if (now >= deadline) return;
+      wait(deadline - now, receiving);
+    }
+  }
+
+private:
+  struct Pending {
+    PandaTransfer *transfer;
+    uint64_t deadline;
+  };
+
+  static uint8_t *alloc_locked(int size) {
+    void *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_LOCKED, -1, 0);
+    return buf == MAP_FAILED ? NULL : (uint8_t *)buf;
+  }
+
+  // with lock held
+  void finish(PandaTransfer *transfer, int status) {
+    transfer->status = status;
+    transfer->actual_length = 0;
+    finished.push_back(transfer);
+  }
+
+  // with lock held
+  bool data_ready() {
+    if (irq_fd >= 0) return gpio_get(irq_fd) == 0;
+    return nanos_since_boot() - last_empty_read >= SPI_POLL_US * 1000ULL;
+  }
+
+  void wait(uint64_t timeout_ns, bool receiving) {
+    if (!receiving) {
+      // for a submit
+      std::unique_lock lk(lock);
+      cv.wait_for(lk, std::chrono::nanoseconds(timeout_ns), [&] { return !pending.empty() || !finished.empty(); });
+    } else if (irq_fd >= 0) {
+      // the data ready edge, in slices that let sends submitted meanwhile go
+      struct pollfd pfd = {.fd = irq_fd, .events = POLLPRI};
+      poll(&pfd, 1, std::min<uint64_t>((timeout_ns + 999999) / 1000000, 1));
+    } else {
+      usleep(std::min<uint64_t>(timeout_ns / 1000, SPI_POLL_US));
+    }
+  }
+
+  void run(PandaTransfer *t) {
+    int transferred = 0;
+    int ret = bulk_transfer(t->endpoint, t->buffer, t->length, &transferred, t->timeout);
+    if ((t->endpoint & LIBUSB_ENDPOINT_IN) && transferred == 0) {
+      std::lock_guard lk(lock);
+      last_empty_read = nanos_since_boot();
+    }
+    t->actual_length = transferred;
+    t->status = ret == 0 ? LIBUSB_TRANSFER_COMPLETED : (ret == LIBUSB_ERROR_TIMEOUT ? LIBUSB_TRANSFER_TIMED_OUT : LIBUSB_TRANSFER_ERROR);
+    t->callback(t);
+  }
+
+  int xfer(const uint8_t *tx, uint8_t *rx, int len) {
+    for (int pos = 0; pos < len; pos += SPI_XFER_MAX) {
+      struct spi_ioc_transfer tr = {};
+      tr.tx_buf = tx != NULL ? (uint64_t)(tx + pos) : 0;
+      tr.rx_buf = rx != NULL ? (uint64_t)(rx + pos) : 0;
+      tr.len = std::min(len - pos, SPI_XFER_MAX);
+      tr.speed_hz = SPI_SPEED_HZ;
+      tr.bits_per_word = 8;
+      if (ioctl(fd, SPI_IOC_MESSAGE(1), &tr) < 0) {
+        LOGE_100("spi transfer failed: %s", strerror(errno));
+        return LIBUSB_ERROR_IO;
+      }
+    }
+    return 0;
+  }
+
+  // the panda wasn't where the transaction had it, it starts over from a header after a while
+  int resync(const char *what) {
+    LOGE_100("panda %s on spi, resyncing", what);
+    util::sleep_for(SPI_RESYNC_MS);
+    return LIBUSB_ERROR_TIMEOUT;
+  }
+
+  // 0 on SPI_ACK, LIBUSB_ERROR_BUSY on SPI_NACK
+  int wait_ack(uint64_t deadline) {
+    while (true) {
+      uint8_t b = 0;
+      if (int ret = xfer(NULL, &b, 1); ret < 0) return ret;
+      if (b == SPI_ACK) return 0;
+      if (b == SPI_NACK) return LIBUSB_ERROR_BUSY;
+      if (nanos_since_boot() >= deadline) return resync("didn't ack");
+    }
+  }
+
+  int transaction_once(uint8_t endpoint, const uint8_t *tx, int tx_len, uint8_t *rx, int max_rx_len, uint64_t deadline) {
+    uint8_t header[SPI_HEADER_LEN] = {
+      SPI_SYNC, endpoint,
+      (uint8_t)(tx_len & 0xff), (uint8_t)(tx_len >> 8),
+      (uint8_t)(max_rx_len & 0xff), (uint8_t)(max_rx_len >> 8),
+    };
+    header[SPI_HEADER_LEN - 1] = checksum(header, SPI_HEADER_LEN - 1);
+    int ret;
+    if ((ret = xfer(header, NULL, SPI_HEADER_LEN)) < 0 || (ret = wait_ack(deadline)) < 0) return ret;
+
+    if (tx_len > 0) memcpy(tx_buf, tx, tx_len);
+    tx_buf[tx_len] = checksum(tx_buf, tx_len);
+    if ((ret = xfer(tx_buf, NULL, tx_len + 1)) < 0 || (ret = wait_ack(deadline)) < 0) return ret;
+
+    uint8_t len_buf[2];
+    if ((ret = xfer(NULL, len_buf, sizeof(len_buf))) < 0) return ret;
+    const int rx_len = len_buf[0] | (len_buf[1] << 8);
+    if (rx_len > max_rx_len) return resync("sent too much");
+
+    if ((ret = xfer(NULL, rx_buf, rx_len + 1)) < 0) return ret;
+    if (checksum(rx_buf, rx_len, checksum(len_buf, sizeof(len_buf))) != rx_buf[rx_len]) {
+      LOGE_100("bad checksum from the panda on spi");
+      return LIBUSB_ERROR_IO;
+    }
+    if (rx_len > 0) memcpy(rx, rx_buf, rx_len);
+    return rx_len;
+  }
+
+  // the bytes that came back or a LIBUSB_ERROR. A NACK is tried again until the timeout
+  int transaction(uint8_t endpoint, const uint8_t *tx, int tx_len, uint8_t *rx, int max_rx_len, unsigned int timeout) {
+    const uint64_t deadline = nanos_since_boot() + (timeout ? timeout : SPI_TIMEOUT_MS) * 1000000ULL;
+    std::lock_guard lk(bus_lock);
+    while (true) {
+      int ret = transaction_once(endpoint, tx, tx_len, rx, max_rx_len, deadline);
+      if (ret != LIBUSB_ERROR_BUSY) return ret;
+      if (nanos_since_boot() >= deadline) return LIBUSB_ERROR_TIMEOUT;
+      usleep(100);
+    }
+  }
+
+  int fd = -1;
+  int irq_fd = -1;
+  uint8_t *tx_buf = NULL, *rx_buf = NULL;
+  std::mutex bus_lock;
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<Pending> pending;
+  std::deque<PandaTransfer *> finished;
+  uint64_t last_empty_read = 0;
+};
+
+std::vector<std::string> spi_list() {
+  SpiTransport transport;
+  if (!transport.open("")) return {};
+  return {transport.serial};
+}
+
+std::unique_ptr<PandaTransport> spi_open(const std::string &serial) {
+  auto transport = std::make_unique<SpiTransport>();
+  if (!transport->open(serial)) return nullptr;
+  LOGW("panda %s on spi", transport->serial.c_str());
+  return transport;
+}
@@ -0,0 +1,311 @@
+// Panda transport straight on usbfs: control and sync bulk transfers are one
+// ioctl each, async ones are URBs reaped by poll() on the device. That skips
+// libusb's event handling and locking on the CAN path. URB buffers are mapped
+// from the kernel where it supports it (Linux 4.6), so they aren't copied.
+// Bulk streams (USBDEVFS_ALLOC_STREAMS) are USB 3 only, the panda doesn't have them
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/usbdevice_fs.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <set>
+
+#include "selfdrive/boardd/panda_transport.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+#define SYSFS_USB "/sys/bus/usb/devices/"
+
+static int usb_error(int err) {
+  switch (err) {
+    case ENODEV:
+    case ESHUTDOWN:
+      return LIBUSB_ERROR_NO_DEVICE;
+    case ETIMEDOUT:
+      return LIBUSB_ERROR_TIMEOUT;
+    case EPIPE:
+      return LIBUSB_ERROR_PIPE;
+    case EOVERFLOW:
+      return LIBUSB_ERROR_OVERFLOW;
+    case EBUSY:
+      return LIBUSB_ERROR_BUSY;
+    case EINTR:
+      return LIBUSB_ERROR_INTERRUPTED;
+    case ENOMEM:
+      return LIBUSB_ERROR_NO_MEM;
+    default:
+      return LIBUSB_ERROR_IO;
+  }
+}
+
+// the URB status of a reaped transfer
+static int transfer_status(int status, bool timed_out) {
+  switch (-status) {
+    case 0:
+      return LIBUSB_TRANSFER_COMPLETED;
+    case ENOENT:
+    case ECONNRESET:
+      return timed_out ? LIBUSB_TRANSFER_TIMED_OUT : LIBUSB_TRANSFER_CANCELLED;
+    case ENODEV:
+    case ESHUTDOWN:
+      return LIBUSB_TRANSFER_NO_DEVICE;
+    case EOVERFLOW:
+      return LIBUSB_TRANSFER_OVERFLOW;
+    case EPIPE:
+      return LIBUSB_TRANSFER_STALL;
+    default:
+      return LIBUSB_TRANSFER_ERROR;
+  }
+}
+
+struct UsbfsDevice {
+  std::string serial;
+  std::string path;  // /dev/bus/usb/BBB/DDD
+  int configuration;
+};
+
+static std::string sysfs_attr(const std::string &dev, const char *attr) {
+  std::string s = util::read_file(SYSFS_USB + dev + "/" + attr);
+  return s.substr(0, s.find('\n'));
+}
+
+static std::vector<UsbfsDevice> list_devices() {
+  std::vector<UsbfsDevice> devices;
+  DIR *d = opendir(SYSFS_USB);
+  if (d == NULL) {
+    LOGE("can't list usb devices");
+    return devices;
+  }
+  while (struct dirent *de = readdir(d)) {
+    // interfaces have a ':' in their name
+    const std::string dev = de->d_name;
+    if (dev[0] == '.' || dev.find(':') != std::string::npos) continue;
+    if (sysfs_attr(dev, "idVendor") != "bbaa" || sysfs_attr(dev, "idProduct") != "ddcc") continue;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/bus/usb/%03d/%03d", atoi(sysfs_attr(dev, "busnum").c_str()), atoi(sysfs_attr(dev, "devnum").c_str()));
+    devices.push_back({sysfs_attr(dev, "serial"), path, atoi(sysfs_attr(dev, "bConfigurationValue").c_str())});
+  }
+  closedir(d);
+  return devices;
+}
+
+class UsbfsTransport : public PandaTransport {
+public:
+  ~UsbfsTransport() {
+    if (fd < 0) return;
+
+    // whatever is still in flight has to be reaped before the fd goes
+    std::vector<UsbfsTransfer *> pending;
+    {
+      std::lock_guard lk(lock);
+      pending.assign(in_flight.begin(), in_flight.end());
+    }
+    for (auto t : pending) ioctl(fd, USBDEVFS_DISCARDURB, &t->urb);
+    for (int i = 0; i < 100 && !idle(); i++) handle_events(10000);
+
+    unsigned int interface = 0;
+    ioctl(fd, USBDEVFS_RELEASEINTERFACE, &interface);
+    close(fd);
+  }
+
+  bool open(const std::string &want_serial) {
+    for (auto &dev : list_devices()) {
+      if (!want_serial.empty() && want_serial != dev.serial) continue;
+
+      fd = ::open(dev.path.c_str(), O_RDWR | O_CLOEXEC);
+      if (fd < 0) {
+        LOGE("can't open %s: %s", dev.path.c_str(), strerror(errno));
+        return false;
+      }
+      serial = dev.serial;
+
+      // no kernel driver binds to the panda, detaching is usually a no-op
+      struct usbdevfs_ioctl disconnect = {.ifno = 0, .ioctl_code = USBDEVFS_DISCONNECT, .data = NULL};
+      ioctl(fd, USBDEVFS_IOCTL, &disconnect);
+
+      unsigned int configuration = 1, interface = 0;
+      if (dev.configuration != 1 && ioctl(fd, USBDEVFS_SETCONFIGURATION, &configuration) < 0) return false;
+      return ioctl(fd, USBDEVFS_CLAIMINTERFACE, &interface) == 0;
+    }
+    return false;
+  }
+
+  int control_transfer(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                       unsigned char *data, uint16_t length, unsigned int timeout) override {
+    struct usbdevfs_ctrltransfer ctrl = {
+      .bRequestType = request_type,
+      .bRequest = request,
+      .wValue = value,
+      .wIndex = index,
+      .wLength = length,
+      .timeout = timeout,
+      .data = data,
+    };
+    int ret = ioctl(fd, USBDEVFS_CONTROL, &ctrl);
+    return ret < 0 ? usb_error(errno) : ret;
+  }
+
+  int bulk_transfer(unsigned char endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout) override {
+    struct usbdevfs_bulktransfer bulk = {.ep = endpoint, .len = (unsigned int)length, .timeout = timeout, .data = data};
+    int ret = ioctl(fd, USBDEVFS_BULK, &bulk);
+    *transferred = std::max(ret, 0);
+    return ret < 0 ? usb_error(errno) : 0;
+  }
+
+  PandaTransfer *alloc_transfer() override {
+    return new UsbfsTransfer();
+  }
+
+  void free_transfer(PandaTransfer *transfer) override {
+    delete (UsbfsTransfer *)transfer;
+  }
+
+  int submit(PandaTransfer *transfer) override {
+    UsbfsTransfer *t = (UsbfsTransfer *)transfer;
+    t->urb = {};
+    t->urb.type = USBDEVFS_URB_TYPE_BULK;
+    t->urb.endpoint = t->endpoint;
+    t->urb.buffer = t->buffer;
+    t->urb.buffer_length = t->length;
+    t->urb.usercontext = t;
+    // usbfs URBs have no timeouts, handle_events discards them when they're up
+    t->deadline = t->timeout ? nanos_since_boot() + t->timeout * 1000000ULL : 0;
+    t->timed_out = false;
+
+    std::lock_guard lk(lock);
+    if (ioctl(fd, USBDEVFS_SUBMITURB, &t->urb) < 0) return usb_error(errno);
+    in_flight.insert(t);
+    return 0;
+  }
+
+  int cancel(PandaTransfer *transfer) override {
+    UsbfsTransfer *t = (UsbfsTransfer *)transfer;
+    std::lock_guard lk(lock);
+    if (in_flight.count(t) == 0) return LIBUSB_ERROR_NOT_FOUND;
+    return ioctl(fd, USBDEVFS_DISCARDURB, &t->urb) < 0 ? usb_error(errno) : 0;
+  }
+
+  void handle_events(int timeout_us) override {
+    // up to the first deadline of the URBs in flight
+    int timeout_ms = (timeout_us + 999) / 1000;
+    const uint64_t now = nanos_since_boot();
+    {
+      std::lock_guard lk(lock);
+      for (auto t : in_flight) {
+        if (t->deadline != 0 && !t->timed_out) {
+          timeout_ms = std::min(timeout_ms, (int)((std::max(t->deadline, now) - now + 999999) / 1000000));
+        }
+      }
+    }
+
+    // usbfs raises POLLOUT while there are URBs to reap
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    poll(&pfd, 1, timeout_ms);
+
+    while (true) {
+      struct usbdevfs_urb *urb = NULL;
+      if (ioctl(fd, USBDEVFS_REAPURBNDELAY, &urb) < 0) {
+        if (errno == ENODEV) {
+          // the device is gone, nothing in flight comes back
+          fail_in_flight();
+        }
+        break;
+      }
+      UsbfsTransfer *t = (UsbfsTransfer *)urb->usercontext;
+      {
+        std::lock_guard lk(lock);
+        in_flight.erase(t);
+      }
+      t->status = transfer_status(urb->status, t->timed_out);
+      t->actual_length = urb->actual_length;
+      t->callback(t);
+    }
+
+    // the ones past their deadline come back as discarded
+    std::lock_guard lk(lock);
+    const uint64_t after = nanos_since_boot();
+    for (auto t : in_flight) {
+      if (t->deadline != 0 && !t->timed_out && after >= t->deadline) {
+        t->timed_out = true;
+        ioctl(fd, USBDEVFS_DISCARDURB, &t->urb);
+      }
+    }
+  }
+
+  unsigned char *alloc_buffer(int size) override {
+    void *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buf == MAP_FAILED) return PandaTransport::alloc_buffer(size);
+
+    std::lock_guard lk(lock);
+    mapped.insert(buf);
+    return (unsigned char *)buf;
+  }
+
+  void free_buffer(unsigned char *buffer, int size) override {
+    std::unique_lock lk(lock);
+    if (mapped.erase(buffer) == 0) {
+      lk.unlock();
+      PandaTransport::free_buffer(buffer, size);
+      return;
+    }
+    munmap(buffer, size);
+  }
+
+private:
+  struct UsbfsTransfer : PandaTransfer {
+    uint64_t deadline;
+    bool timed_out;
+    struct usbdevfs_urb urb;  // last, it ends in the iso packets
+  };
+
+  bool idle() {
+    std::lock_guard lk(lock);
+    return in_flight.empty();
+  }
+
+  void fail_in_flight() {
+    std::vector<UsbfsTransfer *> failed;
+    {
+      std::lock_guard lk(lock);
+      failed.assign(in_flight.begin(), in_flight.end());
+      in_flight.clear();
+    }
+    for (auto t : failed) {
+      t->status = LIBUSB_TRANSFER_NO_DEVICE;
+      t->actual_length = 0;
+      t->callback(t);
+    }
+  }
+
+  int fd = -1;
+  std::mutex lock;
+  std::set<UsbfsTransfer *> in_flight;
+  std::set<void *> mapped;
+};
+
+std::vector<std::string> usbfs_list() {
+  std::vector<std::string> serials;
+  for (auto &dev : list_devices()) {
+    serials.push_back(dev.serial);
+  }
+  return serials;
+}
+
+std::unique_ptr<PandaTransport> usbfs_open(const std::string &serial) {
+  auto transport = std::make_unique<UsbfsTransport>();
+  if (!transport->open(serial)) return nullptr;
+  LOGW("panda %s on usbfs", transport->serial.c_str());
+  return transport;
+}
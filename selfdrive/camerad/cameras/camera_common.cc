@@ -2,9 +2,11 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <chrono>
+#include <mutex>
 #include <thread>
 
 #include "libyuv.h"
@@ -12,9 +14,12 @@
 
 #include "selfdrive/camerad/imgproc/utils.h"
 #include "selfdrive/common/clutil.h"
+#include "selfdrive/common/load_governor.h"
 #include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/sched.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 
@@ -31,6 +36,44 @@
 #endif
 
 const int YUV_COUNT = 100;
+const double DEBAYER_SLOW_MS = 50.;  // one frame interval at 20 fps
+
+void FrameDropStats::add(Reason r, uint32_t n) {
+  const uint64_t sec = nanos_since_boot() / 1000000000ULL;
+  const int b = sec % WINDOW_SECONDS;
+  if (bucket_sec[b] != sec) {
+    bucket_sec[b] = sec;
+    std::fill(std::begin(buckets[b]), std::end(buckets[b]), 0);
+  }
+  buckets[b][r] += n;
+  totals[r] += n;
+}
+
+uint32_t FrameDropStats::window(Reason r) const {
+  const uint64_t sec = nanos_since_boot() / 1000000000ULL;
+  uint32_t sum = 0;
+  for (int b = 0; b < WINDOW_SECONDS; b++) {
+    if (sec - bucket_sec[b] < WINDOW_SECONDS) sum += buckets[b][r];
+  }
+  return sum;
+}
+
+void RequestSlackStats::add(float ms) {
+  std::lock_guard lk(lock);
+  min_ms = count == 0 ? ms : std::min(min_ms, ms);
+  sum_ms += ms;
+  count++;
+}
+
+bool RequestSlackStats::take(float &min, float &avg) {
+  std::lock_guard lk(lock);
+  if (count == 0) return false;
+  min = min_ms;
+  avg = sum_ms / count;
+  min_ms = sum_ms = 0;
+  count = 0;
+  return true;
+}
 
 static cl_program build_debayer_program(cl_device_id device_id, cl_context context, const CameraInfo *ci, const CameraBuf *b, const CameraState *s) {
   char args[4096];
@@ -52,6 +95,11 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
   this->yuv_type = yuv_type;
   this->release_callback = release_callback;
 
+  // camerad reads the RGB frame itself for the thumbnail, autofocus and the SEND_* images
+  keep_rgb = rgb_type == VISION_STREAM_RGB_BACK ||
+             (rgb_type == VISION_STREAM_RGB_FRONT && env_send_driver) ||
+             (rgb_type == VISION_STREAM_RGB_WIDE && env_send_wide_road);
+
   const CameraInfo *ci = &s->ci;
   camera_state = s;
   frame_buf_count = frame_cnt;
@@ -85,11 +133,19 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
   if (ci->bayer) {
     cl_program prg_debayer = build_debayer_program(device_id, context, ci, this, s);
     krnl_debayer = CL_CHECK_ERR(clCreateKernel(prg_debayer, "debayer10", &err));
+    if (env_debayer_yuv && !Hardware::TICI()) {
+      krnl_debayer_yuv = CL_CHECK_ERR(clCreateKernel(prg_debayer, "debayer10_yuv", &err));
+    }
     CL_CHECK(clReleaseProgram(prg_debayer));
   }
 
   rgb2yuv = std::make_unique<Rgb2Yuv>(context, device_id, rgb_width, rgb_height, rgb_stride);
 
+  cl_program prg_ae = cl_program_from_file(context, device_id, "imgproc/ae_hist.cl", "-cl-fast-relaxed-math");
+  krnl_ae_hist = CL_CHECK_ERR(clCreateKernel(prg_ae, "ae_histogram", &err));
+  CL_CHECK(clReleaseProgram(prg_ae));
+  ae_hist_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, 256 * sizeof(uint32_t), NULL, &err));
+
 #ifdef __APPLE__
   q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
 #else
@@ -98,17 +154,44 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
 #endif
 }
 
+// Additional downscaled YUV stream, produced on the GPU from the full size one
+void CameraBuf::init_small_yuv(cl_device_id device_id, cl_context context, VisionStreamType type, int width, int height) {
+  small_yuv_type = type;
+  vipc_server->create_buffers(type, YUV_COUNT, false, width, height);
+  yuv_scaler = std::make_unique<YuvScaler>(context, device_id, rgb_width, rgb_height, width, height);
+}
+
+void CameraBuf::init_roi_yuv(cl_device_id device_id, cl_context context, VisionStreamType type, int width, int height, const YuvScaler::Rect &rect, bool mirror) {
+  roi_yuv_type = type;
+  vipc_server->create_buffers(type, YUV_COUNT, false, width, height);
+  roi_scaler = std::make_unique<YuvScaler>(context, device_id, rgb_width, rgb_height, width, height);
+  set_roi(rect, mirror);
+}
+
+void CameraBuf::set_roi(const YuvScaler::Rect &rect, bool mirror) {
+  if (rect.w < 2 || rect.h < 2 || rect.x < 0 || rect.y < 0 ||
+      rect.x + rect.w > rgb_width || rect.y + rect.h > rgb_height) {
+    LOGE("ignoring roi %d,%d %dx%d outside of the %dx%d frame", rect.x, rect.y, rect.w, rect.h, rgb_width, rgb_height);
+    return;
+  }
+  roi_rect = rect;
+  roi_mirror = mirror;
+}
+
 CameraBuf::~CameraBuf() {
   for (int i = 0; i < frame_buf_count; i++) {
     camera_bufs[i].free();
   }
 
   if (krnl_debayer) CL_CHECK(clReleaseKernel(krnl_debayer));
+  if (krnl_debayer_yuv) CL_CHECK(clReleaseKernel(krnl_debayer_yuv));
+  if (krnl_ae_hist) CL_CHECK(clReleaseKernel(krnl_ae_hist));
+  if (ae_hist_cl) CL_CHECK(clReleaseMemObject(ae_hist_cl));
   if (q) CL_CHECK(clReleaseCommandQueue(q));
 }
 
 bool CameraBuf::acquire() {
-  if (!safe_queue.try_pop(cur_buf_idx, 1)) return false;
+  if (!frame_queue.try_pop(cur_buf_idx, 1)) return false;
 
   if (camera_bufs_metadata[cur_buf_idx].frame_id == -1) {
     LOGE("no frame data? wtf");
@@ -117,10 +200,35 @@ bool CameraBuf::acquire() {
   }
 
   cur_frame_data = camera_bufs_metadata[cur_buf_idx];
+  const double t_start = millis_since_boot();
   cur_rgb_buf = vipc_server->get_buffer(rgb_type);
+  cur_yuv_buf = vipc_server->get_buffer(yuv_type);
 
-  cl_event debayer_event;
+  // Only the UI consumes RGB. When nobody does the fused kernel skips writing
+  // it, otherwise it is still produced as the input of Rgb2Yuv but not sent.
+  // Under load the UI gets every other frame.
+  const bool send_rgb = keep_rgb || (vipc_server->has_clients(rgb_type) &&
+                                     !(load_shed(LoadShed::RGB_STREAMS) && cur_frame_data.frame_id % 2));
+
+  cl_event debayer_event = nullptr;
   cl_mem camrabuf_cl = camera_bufs[cur_buf_idx].buf_cl;
+#ifndef QCOM2
+  if (krnl_debayer_yuv) {
+    float digital_gain = camera_state->digital_gain;
+    if ((int)digital_gain == 0) {
+      digital_gain = 1.0;
+    }
+    const int write_rgb = send_rgb;
+    CL_CHECK(clSetKernelArg(krnl_debayer_yuv, 0, sizeof(cl_mem), &camrabuf_cl));
+    CL_CHECK(clSetKernelArg(krnl_debayer_yuv, 1, sizeof(cl_mem), &cur_rgb_buf->buf_cl));
+    CL_CHECK(clSetKernelArg(krnl_debayer_yuv, 2, sizeof(cl_mem), &cur_yuv_buf->buf_cl));
+    CL_CHECK(clSetKernelArg(krnl_debayer_yuv, 3, sizeof(float), &digital_gain));
+    CL_CHECK(clSetKernelArg(krnl_debayer_yuv, 4, sizeof(int), &write_rgb));
+    const size_t debayer_work_size = rgb_height / 2;
+    CL_CHECK(clEnqueueNDRangeKernel(q, krnl_debayer_yuv, 1, NULL,
+                                    &debayer_work_size, NULL, 0, 0, &debayer_event));
+  } else
+#endif
   if (camera_state->ci.bayer) {
     CL_CHECK(clSetKernelArg(krnl_debayer, 0, sizeof(cl_mem), &camrabuf_cl));
     CL_CHECK(clSetKernelArg(krnl_debayer, 1, sizeof(cl_mem), &cur_rgb_buf->buf_cl));
@@ -141,25 +249,54 @@ bool CameraBuf::acquire() {
     CL_CHECK(clEnqueueNDRangeKernel(q, krnl_debayer, 1, NULL,
                                     &debayer_work_size, NULL, 0, 0, &debayer_event));
 #endif
-  } else {
+  } else if (send_rgb) {
     assert(rgb_stride == camera_state->ci.frame_stride);
     CL_CHECK(clEnqueueCopyBuffer(q, camrabuf_cl, cur_rgb_buf->buf_cl, 0, 0,
                                cur_rgb_buf->len, 0, 0, &debayer_event));
+  } else {
+    // frame is RGB already and nobody wants it, convert straight from the camera buffer
+    assert(rgb_stride == camera_state->ci.frame_stride);
   }
 
-  clWaitForEvents(1, &debayer_event);
-  CL_CHECK(clReleaseEvent(debayer_event));
+  if (debayer_event) {
+    clWaitForEvents(1, &debayer_event);
+    CL_CHECK(clReleaseEvent(debayer_event));
+  }
 
-  cur_yuv_buf = vipc_server->get_buffer(yuv_type);
-  rgb2yuv->queue(q, cur_rgb_buf->buf_cl, cur_yuv_buf->buf_cl);
+  if (!krnl_debayer_yuv) {
+    const bool rgb_in_place = !camera_state->ci.bayer && !send_rgb;
+    rgb2yuv->queue(q, rgb_in_place ? camrabuf_cl : cur_rgb_buf->buf_cl, cur_yuv_buf->buf_cl);
+  }
+
+  if (yuv_scaler) {
+    cur_small_yuv_buf = vipc_server->get_buffer(small_yuv_type);
+    yuv_scaler->queue(q, cur_yuv_buf->buf_cl, cur_small_yuv_buf->buf_cl);
+  }
+
+  const bool send_roi = roi_scaler && vipc_server->has_clients(roi_yuv_type);
+  if (send_roi) {
+    cur_roi_yuv_buf = vipc_server->get_buffer(roi_yuv_type);
+    roi_scaler->queue_crop(q, cur_yuv_buf->buf_cl, cur_roi_yuv_buf->buf_cl, roi_rect, roi_mirror);
+  }
+
+  update_drop_stats(millis_since_boot() - t_start);
 
   VisionIpcBufExtra extra = {
                         cur_frame_data.frame_id,
                         cur_frame_data.timestamp_sof,
                         cur_frame_data.timestamp_eof,
+                        cur_frame_data.timestamp_isp,
   };
-  vipc_server->send(cur_rgb_buf, &extra);
+  if (send_rgb) {
+    vipc_server->send(cur_rgb_buf, &extra);
+  }
   vipc_server->send(cur_yuv_buf, &extra);
+  if (yuv_scaler) {
+    vipc_server->send(cur_small_yuv_buf, &extra);
+  }
+  if (send_roi) {
+    vipc_server->send(cur_roi_yuv_buf, &extra);
+  }
 
   return true;
 }
@@ -171,7 +308,59 @@ void CameraBuf::release() {
 }
 
 void CameraBuf::queue(size_t buf_idx) {
-  safe_queue.push(buf_idx);
+  // never more buffers in flight than the queue holds
+  bool ret = frame_queue.push(buf_idx);
+  assert(ret);
+  if (frame_queue.size() + 1 >= (size_t)frame_buf_count) {
+    backlogged = true;
+  }
+}
+
+// Classify why frames went missing since the previous acquire
+void CameraBuf::update_drop_stats(double debayer_ms) {
+  frames_processed++;
+
+  const uint32_t frame_id = cur_frame_data.frame_id;
+  const bool was_backlogged = backlogged.exchange(false);
+  if (has_last_frame && frame_id > last_frame_id + 1) {
+    drop_stats.add(was_backlogged ? FrameDropStats::QUEUE_FULL : FrameDropStats::ISP_OVERFLOW, frame_id - last_frame_id - 1);
+  }
+  has_last_frame = true;
+  last_frame_id = frame_id;
+
+  if (debayer_ms > DEBAYER_SLOW_MS) {
+    drop_stats.add(FrameDropStats::DEBAYER_SLOW);
+  }
+
+  const uint64_t held_reuses = vipc_server->num_held_reuses(yuv_type);
+  if (held_reuses > last_held_reuses) {
+    drop_stats.add(FrameDropStats::CONSUMER_HELD, held_reuses - last_held_reuses);
+  }
+  last_held_reuses = held_reuses;
+}
+
+// Histogram of the current YUV frame's luminance, computed on the GPU so only the 256 bins are read back
+void CameraBuf::ae_histogram(uint32_t hist[256], int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) const {
+  if (x_end <= x_start || y_end <= y_start) return;
+
+  const uint32_t zero = 0;
+  CL_CHECK(clEnqueueFillBuffer(q, ae_hist_cl, &zero, sizeof(zero), 0, 256 * sizeof(uint32_t), 0, NULL, NULL));
+
+  const int stride = rgb_width;
+  CL_CHECK(clSetKernelArg(krnl_ae_hist, 0, sizeof(cl_mem), &cur_yuv_buf->buf_cl));
+  CL_CHECK(clSetKernelArg(krnl_ae_hist, 1, sizeof(cl_mem), &ae_hist_cl));
+  CL_CHECK(clSetKernelArg(krnl_ae_hist, 2, sizeof(int), &stride));
+  CL_CHECK(clSetKernelArg(krnl_ae_hist, 3, sizeof(int), &x_start));
+  CL_CHECK(clSetKernelArg(krnl_ae_hist, 4, sizeof(int), &x_end));
+  CL_CHECK(clSetKernelArg(krnl_ae_hist, 5, sizeof(int), &x_skip));
+  CL_CHECK(clSetKernelArg(krnl_ae_hist, 6, sizeof(int), &y_start));
+  CL_CHECK(clSetKernelArg(krnl_ae_hist, 7, sizeof(int), &y_skip));
+
+  const size_t local_work_size = 64;
+  const size_t num_rows = (y_end - y_start + y_skip - 1) / y_skip;
+  const size_t global_work_size = num_rows * local_work_size;
+  CL_CHECK(clEnqueueNDRangeKernel(q, krnl_ae_hist, 1, NULL, &global_work_size, &local_work_size, 0, NULL, NULL));
+  CL_CHECK(clEnqueueReadBuffer(q, ae_hist_cl, CL_TRUE, 0, 256 * sizeof(uint32_t), hist, 0, NULL, NULL));
 }
 
 // common functions
@@ -280,18 +469,41 @@ static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
   free(thumbnail_buffer);
 }
 
+static void fill_drops(cereal::CameraStats::Drops::Builder drops, const FrameDropStats &s, bool window) {
+  auto count = [&](FrameDropStats::Reason r) { return window ? s.window(r) : s.total(r); };
+  drops.setIspOverflow(count(FrameDropStats::ISP_OVERFLOW));
+  drops.setQueueFull(count(FrameDropStats::QUEUE_FULL));
+  drops.setDebayerSlow(count(FrameDropStats::DEBAYER_SLOW));
+  drops.setConsumerHeld(count(FrameDropStats::CONSUMER_HELD));
+}
+
+void publish_camera_stats(PubMaster *pm, cereal::CameraStats::Camera camera, CameraBuf *b) {
+  MessageBuilder msg;
+  auto stats = msg.initEvent().initCameraStats();
+  stats.setCamera(camera);
+  stats.setFramesProcessed(b->frames_processed);
+  stats.setWindowSeconds(FrameDropStats::WINDOW_SECONDS);
+  fill_drops(stats.initDrops(), b->drop_stats, false);
+  fill_drops(stats.initDropsWindow(), b->drop_stats, true);
+  if (float min_ms, avg_ms; b->request_slack.take(min_ms, avg_ms)) {
+    stats.setRequestSlackMinMs(min_ms);
+    stats.setRequestSlackAvgMs(avg_ms);
+  }
+
+  // every camera thread publishes on the same socket
+  static std::mutex send_lock;
+  std::lock_guard lk(send_lock);
+  pm->send("cameraStats", msg);
+}
+
 float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) {
   int lum_med;
   uint32_t lum_binning[256] = {0};
-  const uint8_t *pix_ptr = b->cur_yuv_buf->y;
+  b->ae_histogram(lum_binning, x_start, x_end, x_skip, y_start, y_end, y_skip);
 
   unsigned int lum_total = 0;
-  for (int y = y_start; y < y_end; y += y_skip) {
-    for (int x = x_start; x < x_end; x += x_skip) {
-      uint8_t lum = pix_ptr[(y * b->rgb_width) + x];
-      lum_binning[lum]++;
-      lum_total += 1;
-    }
+  for (int i = 0; i < 256; i++) {
+    lum_total += lum_binning[i];
   }
 
 
@@ -312,14 +524,19 @@ extern ExitHandler do_exit;
 
 void *processing_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback) {
   const char *thread_name = nullptr;
+  cereal::CameraStats::Camera camera;
   if (cs == &cameras->road_cam) {
     thread_name = "RoadCamera";
+    camera = cereal::CameraStats::Camera::ROAD;
   } else if (cs == &cameras->driver_cam) {
     thread_name = "DriverCamera";
+    camera = cereal::CameraStats::Camera::DRIVER;
   } else {
     thread_name = "WideRoadCamera";
+    camera = cereal::CameraStats::Camera::WIDE_ROAD;
   }
   set_thread_name(thread_name);
+  sched_apply("camerad", thread_name);
 
   uint32_t cnt = 0;
   while (!do_exit) {
@@ -331,6 +548,9 @@ void *processing_thread(MultiCameraState *cameras, CameraState *cs, process_thre
       // this takes 10ms???
       publish_thumbnail(cameras->pm, &(cs->buf));
     }
+    if (cameras->pm && cnt % 20 == 0) {
+      publish_camera_stats(cameras->pm, camera, &cs->buf);
+    }
     cs->buf.release();
     ++cnt;
   }
@@ -376,13 +596,25 @@ static void driver_cam_auto_exposure(CameraState *c, SubMaster &sm) {
   camera_autoexposure(c, set_exposure_target(b, rect.x1, rect.x2, rect.x_skip, rect.y1, rect.y2, rect.y_skip));
 }
 
+// VISION_STREAM_YUV_FRONT_ROI, what driver monitoring looks at. The rect can be moved with driverCameraRoi
+void init_driver_roi(cl_device_id device_id, cl_context ctx, CameraBuf *b) {
+  const bool is_rhd = Params().getBool("IsRHD");
+  const DMCropRect rect = get_driver_crop_rect(b->rgb_width, b->rgb_height, is_rhd);
+  b->init_roi_yuv(device_id, ctx, VISION_STREAM_YUV_FRONT_ROI, DM_INPUT_WIDTH, DM_INPUT_HEIGHT,
+                  {rect.x, rect.y, rect.w, rect.h}, is_rhd);
+}
+
 void common_process_driver_camera(SubMaster *sm, PubMaster *pm, CameraState *c, int cnt) {
   int j = Hardware::TICI() ? 1 : 3;
   if (cnt % j == 0) {
     sm->update(0);
     driver_cam_auto_exposure(c, *sm);
+    if (sm->updated("driverCameraRoi")) {
+      auto roi = (*sm)["driverCameraRoi"].getDriverCameraRoi();
+      c->buf.set_roi({roi.getX(), roi.getY(), roi.getWidth(), roi.getHeight()}, roi.getMirror());
+    }
   }
-  MessageBuilder msg;
+  PooledMessageBuilder msg("driverCameraState");
   auto framed = msg.initEvent().initDriverCameraState();
   framed.setFrameType(cereal::FrameData::FrameType::FRONT);
   fill_frame_data(framed, c->buf.cur_frame_data);
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include "cereal/messaging/messaging.h"
@@ -10,10 +12,12 @@
 #include "cereal/visionipc/visionipc.h"
 #include "cereal/visionipc/visionipc_server.h"
 #include "selfdrive/camerad/transforms/rgb_to_yuv.h"
+#include "selfdrive/camerad/transforms/yuv_scale.h"
 #include "selfdrive/common/mat.h"
-#include "selfdrive/common/queue.h"
+#include "selfdrive/common/spsc_queue.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/visionimg.h"
+#include "selfdrive/hardware/hw.h"
 
 #define CAMERA_ID_IMX298 0
 #define CAMERA_ID_IMX179 1
@@ -29,6 +33,10 @@
 
 #define UI_BUF_COUNT 4
 
+// Size of VISION_STREAM_YUV_BACK_SMALL, encoded by loggerd as qcamera
+const int QCAM_WIDTH = Hardware::TICI() ? 526 : 480;
+const int QCAM_HEIGHT = Hardware::TICI() ? 330 : 360;
+
 enum CameraType {
   RoadCam = 0,
   DriverCam,
@@ -38,6 +46,8 @@ enum CameraType {
 const bool env_send_driver = getenv("SEND_DRIVER") != NULL;
 const bool env_send_road = getenv("SEND_ROAD") != NULL;
 const bool env_send_wide_road = getenv("SEND_WIDE_ROAD") != NULL;
+// debayer straight to YUV in a single pass, EON only
+const bool env_debayer_yuv = getenv("DEBAYER_YUV") != NULL;
 
 typedef void (*release_cb)(void *cookie, int buf_idx);
 
@@ -70,8 +80,9 @@ typedef struct FrameMetadata {
   unsigned int frame_length;
 
   // Timestamps
-  uint64_t timestamp_sof; // only set on tici
+  uint64_t timestamp_sof;
   uint64_t timestamp_eof;
+  uint64_t timestamp_isp; // nanos_since_boot when the ISP handed the frame over
 
   // Exposure
   unsigned int integ_lines;
@@ -92,6 +103,35 @@ typedef struct CameraExpInfo {
   float grey_frac;
 } CameraExpInfo;
 
+// Lost frames by reason, kept in per second buckets for a moving window
+class FrameDropStats {
+public:
+  enum Reason { ISP_OVERFLOW, QUEUE_FULL, DEBAYER_SLOW, CONSUMER_HELD, REASON_MAX };
+  static constexpr int WINDOW_SECONDS = 10;
+
+  void add(Reason r, uint32_t n = 1);
+  uint32_t total(Reason r) const { return totals[r]; }
+  uint32_t window(Reason r) const;
+
+private:
+  uint32_t totals[REASON_MAX] = {};
+  uint32_t buckets[WINDOW_SECONDS][REASON_MAX] = {};
+  uint64_t bucket_sec[WINDOW_SECONDS] = {};
+};
+
+// How far ahead of its start of frame each ISP request was scheduled
+class RequestSlackStats {
+public:
+  void add(float ms);
+  // min and mean since the previous call, false if nothing was added
+  bool take(float &min, float &avg);
+
+private:
+  std::mutex lock;
+  float min_ms = 0, sum_ms = 0;
+  int count = 0;
+};
+
 struct MultiCameraState;
 struct CameraState;
 
@@ -100,14 +140,30 @@ private:
   VisionIpcServer *vipc_server;
   CameraState *camera_state;
   cl_kernel krnl_debayer;
+  cl_kernel krnl_debayer_yuv = nullptr;
+  cl_kernel krnl_ae_hist = nullptr;
+  cl_mem ae_hist_cl = nullptr;
 
   std::unique_ptr<Rgb2Yuv> rgb2yuv;
+  std::unique_ptr<YuvScaler> yuv_scaler;
+  std::unique_ptr<YuvScaler> roi_scaler;
+  YuvScaler::Rect roi_rect;
+  bool roi_mirror;
 
-  VisionStreamType rgb_type, yuv_type;
+  VisionStreamType rgb_type, yuv_type, small_yuv_type = VISION_STREAM_MAX, roi_yuv_type = VISION_STREAM_MAX;
 
   int cur_buf_idx;
+  bool keep_rgb;
+
+  // filled by the ISP event thread, drained by the processing thread
+  SPSCQueue<int, 32> frame_queue;
+  // set by queue when every buffer is waiting in camerad, so the ISP has none left
+  std::atomic<bool> backlogged = false;
+  bool has_last_frame = false;
+  uint32_t last_frame_id = 0;
+  uint64_t last_held_reuses = 0;
 
-  SafeQueue<int> safe_queue;
+  void update_drop_stats(double debayer_ms);
 
   int frame_buf_count;
   release_cb release_callback;
@@ -117,18 +173,28 @@ public:
   FrameMetadata cur_frame_data;
   VisionBuf *cur_rgb_buf;
   VisionBuf *cur_yuv_buf;
+  VisionBuf *cur_small_yuv_buf = nullptr;
+  VisionBuf *cur_roi_yuv_buf = nullptr;
   std::unique_ptr<VisionBuf[]> camera_bufs;
   std::unique_ptr<FrameMetadata[]> camera_bufs_metadata;
   int rgb_width, rgb_height, rgb_stride;
+  uint32_t frames_processed = 0;
+  FrameDropStats drop_stats;
+  RequestSlackStats request_slack;
 
   mat3 yuv_transform;
 
   CameraBuf() = default;
   ~CameraBuf();
   void init(cl_device_id device_id, cl_context context, CameraState *s, VisionIpcServer * v, int frame_cnt, VisionStreamType rgb_type, VisionStreamType yuv_type, release_cb release_callback=nullptr);
+  void init_small_yuv(cl_device_id device_id, cl_context context, VisionStreamType type, int width, int height);
+  // a crop of the frame scaled to width x height, only produced while a client is connected
+  void init_roi_yuv(cl_device_id device_id, cl_context context, VisionStreamType type, int width, int height, const YuvScaler::Rect &rect, bool mirror);
+  void set_roi(const YuvScaler::Rect &rect, bool mirror);
   bool acquire();
   void release();
   void queue(size_t buf_idx);
+  void ae_histogram(uint32_t hist[256], int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip) const;
 };
 
 typedef void (*process_thread_cb)(MultiCameraState *s, CameraState *c, int cnt);
@@ -138,6 +204,8 @@ kj::Array<uint8_t> get_frame_image(const CameraBuf *b);
 float set_exposure_target(const CameraBuf *b, int x_start, int x_end, int x_skip, int y_start, int y_end, int y_skip);
 std::thread start_process_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback);
 void common_process_driver_camera(SubMaster *sm, PubMaster *pm, CameraState *c, int cnt);
+void init_driver_roi(cl_device_id device_id, cl_context ctx, CameraBuf *b);
+void publish_camera_stats(PubMaster *pm, cereal::CameraStats::Camera camera, CameraBuf *b);
 
 void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_id, cl_context ctx);
 void cameras_open(MultiCameraState *s);
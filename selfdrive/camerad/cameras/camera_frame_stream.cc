@@ -13,6 +13,11 @@
 
 extern ExitHandler do_exit;
 
+// With FRAME_STREAM_MAX_SPEED=1 frames are never dropped, ingest waits for a free
+// buffer instead. Meant for replaying footage faster than real time, where the
+// publisher paces itself on the consumers (e.g. modelV2) instead of the clock.
+const bool env_max_speed = getenv("FRAME_STREAM_MAX_SPEED") != NULL;
+
 namespace {
 
 // TODO: make this more generic
@@ -34,6 +39,11 @@ CameraInfo cameras_supported[CAMERA_ID_MAX] = {
   },
 };
 
+void camera_release_buffer(void *cookie, int buf_idx) {
+  CameraState *s = (CameraState *)cookie;
+  s->buf_in_use[buf_idx] = false;
+}
+
 void camera_init(VisionIpcServer * v, CameraState *s, int camera_id, unsigned int fps, cl_device_id device_id, cl_context ctx, VisionStreamType rgb_type, VisionStreamType yuv_type) {
   assert(camera_id < std::size(cameras_supported));
   s->ci = cameras_supported[camera_id];
@@ -41,7 +51,8 @@ void camera_init(VisionIpcServer * v, CameraState *s, int camera_id, unsigned in
 
   s->camera_num = camera_id;
   s->fps = fps;
-  s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type);
+  for (auto &in_use : s->buf_in_use) in_use = false;
+  s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type, camera_release_buffer);
 }
 
 void run_frame_stream(CameraState &camera, const char* frame_pkt) {
@@ -51,6 +62,12 @@ void run_frame_stream(CameraState &camera, const char* frame_pkt) {
   while (!do_exit) {
     sm.update(1000);
     if(sm.updated(frame_pkt)) {
+      // never overwrite a frame camerad has not finished with
+      while (camera.buf_in_use[buf_idx] && env_max_speed && !do_exit) {
+        util::sleep_for(1);
+      }
+      if (camera.buf_in_use[buf_idx]) continue;
+
       auto msg = static_cast<capnp::DynamicStruct::Reader>(sm[frame_pkt]);
       auto frame = msg.get(frame_pkt).as<capnp::DynamicStruct>();
       camera.buf.camera_bufs_metadata[buf_idx] = {
@@ -64,6 +81,7 @@ void run_frame_stream(CameraState &camera, const char* frame_pkt) {
 
       auto image = frame.get("image").as<capnp::Data>();
       clEnqueueWriteBuffer(q, yuv_cl, CL_TRUE, 0, image.size(), image.begin(), 0, NULL, NULL);
+      camera.buf_in_use[buf_idx] = true;
       camera.buf.queue(buf_idx);
       buf_idx = (buf_idx + 1) % FRAME_BUF_COUNT;
     }
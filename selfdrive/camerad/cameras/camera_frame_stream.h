@@ -7,6 +7,8 @@
 #include <CL/cl.h>
 #endif
 
+#include <atomic>
+
 #include "camera_common.h"
 
 #define FRAME_BUF_COUNT 16
@@ -19,6 +21,8 @@ typedef struct CameraState {
   float digital_gain;
 
   CameraBuf buf;
+  // set while a buffer waits in or is being processed by camerad
+  std::atomic<bool> buf_in_use[FRAME_BUF_COUNT];
 } CameraState;
 
 typedef struct MultiCameraState {
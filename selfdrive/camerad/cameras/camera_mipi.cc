@@ -9,6 +9,9 @@
 #include <opencv2/core.hpp>
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui.hpp>
+#ifdef USE_CUDA
+#include <opencv2/cudawarping.hpp>
+#endif
 #pragma clang diagnostic pop
 
 #include "selfdrive/common/clutil.h"
@@ -63,6 +66,12 @@ void camera_init(VisionIpcServer * v, CameraState *s, int camera_id, unsigned in
   s->camera_num = camera_id;
   s->fps = fps;
   s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type);
+#ifdef USE_CUDA
+  // the warp writes straight into the camera buffers
+  for (int i = 0; i < FRAME_BUF_COUNT; i++) {
+    s->buf.camera_bufs[i].init_cuda();
+  }
+#endif
 }
 
 void run_camera(CameraState *s, cv::VideoCapture &video_cap, float *ts) {
@@ -73,16 +82,32 @@ void run_camera(CameraState *s, cv::VideoCapture &video_cap, float *ts) {
   uint32_t frame_id = 0;
   size_t buf_idx = 0;
 
+#ifdef USE_CUDA
+  cv::cuda::Stream stream;
+  cv::cuda::GpuMat frame_gpu;
+#endif
+
   while (!do_exit) {
-    cv::Mat frame_mat, transformed_mat;
+    cv::Mat frame_mat;
     video_cap >> frame_mat;
-    cv::warpPerspective(frame_mat, transformed_mat, transform, size, cv::INTER_LINEAR, cv::BORDER_CONSTANT, 0);
 
     s->buf.camera_bufs_metadata[buf_idx] = {.frame_id = frame_id};
 
     auto &buf = s->buf.camera_bufs[buf_idx];
+#ifdef USE_CUDA
+    // on the GPU, into the buffer itself instead of a Mat to copy from
+    cv::cuda::GpuMat out(size, CV_8UC3, buf.buf_cuda, s->ci.frame_stride);
+    frame_gpu.upload(frame_mat, stream);
+    cv::cuda::warpPerspective(frame_gpu, out, transform, size, cv::INTER_LINEAR, cv::BORDER_CONSTANT, 0, stream);
+    stream.waitForCompletion();
+    // pocl's buffer uses the same memory, it's only told the frame changed
+    CL_CHECK(buf.sync(VISIONBUF_SYNC_TO_DEVICE));
+#else
+    cv::Mat transformed_mat;
+    cv::warpPerspective(frame_mat, transformed_mat, transform, size, cv::INTER_LINEAR, cv::BORDER_CONSTANT, 0);
     int transformed_size = transformed_mat.total() * transformed_mat.elemSize();
     CL_CHECK(clEnqueueWriteBuffer(buf.copy_q, buf.buf_cl, CL_TRUE, 0, transformed_size, transformed_mat.data, 0, NULL, NULL));
+#endif
 
     s->buf.queue(buf_idx);
 
@@ -113,7 +138,7 @@ static void road_camera_thread(CameraState *s) {
 void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_id, cl_context ctx) {
   camera_init(v, &s->road_cam, CAMERA_ID_IMX477, 20, device_id, ctx,
               VISION_STREAM_RGB_BACK, VISION_STREAM_YUV_BACK);
-  s->pm = new PubMaster({"roadCameraState", "thumbnail"});
+  s->pm = new PubMaster({"roadCameraState", "thumbnail", "cameraStats"});
 }
 
 void camera_autoexposure(CameraState *s, float grey_frac) {}
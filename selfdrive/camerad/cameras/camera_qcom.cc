@@ -8,8 +8,12 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
+#include <mutex>
+#include <vector>
 
 #include <cutils/properties.h>
 #include <linux/media.h>
@@ -38,9 +42,12 @@ static int cam_ioctl(int fd, unsigned long int request, void *arg, const char *l
   }
   return err;
 }
-// global var for AE/AF ops
-std::atomic<CameraExpInfo> road_cam_exp{{0}};
-std::atomic<CameraExpInfo> driver_cam_exp{{0}};
+// AE/AF ops for the ops thread, which sleeps until there are some
+static std::mutex ops_lock;
+static std::condition_variable ops_cv;
+static CameraExpInfo road_cam_exp = {0};
+static CameraExpInfo driver_cam_exp = {0};
+static bool sof_pending[2] = {};
 
 CameraInfo cameras_supported[CAMERA_ID_MAX] = {
   [CAMERA_ID_IMX298] = {
@@ -110,7 +117,31 @@ int sensor_write_regs(CameraState *s, struct msm_camera_i2c_reg_array* arr, size
     .delay = 0,
   };
   sensorb_cfg_data cfg_data = {.cfgtype = CFG_WRITE_I2C_ARRAY, .cfg.setting = &out_settings};
-  return HANDLE_EINTR(ioctl(s->sensor_fd, VIDIOC_MSM_SENSOR_CFG, &cfg_data));
+  int err = HANDLE_EINTR(ioctl(s->sensor_fd, VIDIOC_MSM_SENSOR_CFG, &cfg_data));
+  if (err == 0) {
+    for (size_t i = 0; i < size; i++) s->sensor_regs[arr[i].reg_addr] = arr[i].reg_data;
+  }
+  return err;
+}
+
+// Writes only the registers that change, in one transfer. hold_reg is the
+// group hold register, its writes around the others go out with them.
+static int sensor_write_changed_regs(CameraState *s, struct msm_camera_i2c_reg_array* arr, size_t size,
+                                     msm_camera_i2c_data_type data_type, uint16_t hold_reg = 0) {
+  std::vector<msm_camera_i2c_reg_array> changed;
+  bool any = false;
+  for (size_t i = 0; i < size; i++) {
+    if (hold_reg != 0 && arr[i].reg_addr == hold_reg) {
+      changed.push_back(arr[i]);
+      continue;
+    }
+    auto it = s->sensor_regs.find(arr[i].reg_addr);
+    if (it == s->sensor_regs.end() || it->second != arr[i].reg_data) {
+      changed.push_back(arr[i]);
+      any = true;
+    }
+  }
+  return any ? sensor_write_regs(s, changed.data(), changed.size(), data_type) : 0;
 }
 
 static int imx298_apply_exposure(CameraState *s, int gain, int integ_lines, uint32_t frame_length) {
@@ -140,7 +171,7 @@ static int imx298_apply_exposure(CameraState *s, int gain, int integ_lines, uint
     // REG_HOLD
     {0x104,0x0,0},
   };
-  return sensor_write_regs(s, reg_array, std::size(reg_array), MSM_CAMERA_I2C_BYTE_DATA);
+  return sensor_write_changed_regs(s, reg_array, std::size(reg_array), MSM_CAMERA_I2C_BYTE_DATA, 0x104);
 }
 
 static int ov8865_apply_exposure(CameraState *s, int gain, int integ_lines, uint32_t frame_length) {
@@ -175,7 +206,7 @@ static int ov8865_apply_exposure(CameraState *s, int gain, int integ_lines, uint
 
     //{0x104,0x0,0},
   };
-  return sensor_write_regs(s, reg_array, std::size(reg_array), MSM_CAMERA_I2C_BYTE_DATA);
+  return sensor_write_changed_regs(s, reg_array, std::size(reg_array), MSM_CAMERA_I2C_BYTE_DATA);
 }
 
 static int imx179_s5k3p8sp_apply_exposure(CameraState *s, int gain, int integ_lines, uint32_t frame_length) {
@@ -193,7 +224,7 @@ static int imx179_s5k3p8sp_apply_exposure(CameraState *s, int gain, int integ_li
     // REG_HOLD
     {0x104,0x0,0},
   };
-  return sensor_write_regs(s, reg_array, std::size(reg_array), MSM_CAMERA_I2C_BYTE_DATA);
+  return sensor_write_changed_regs(s, reg_array, std::size(reg_array), MSM_CAMERA_I2C_BYTE_DATA, 0x104);
 }
 
 static void camera_init(VisionIpcServer *v, CameraState *s, int camera_id, int camera_num,
@@ -270,6 +301,7 @@ void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_i
               device_id, ctx,
               VISION_STREAM_RGB_BACK, VISION_STREAM_YUV_BACK);
   s->road_cam.apply_exposure = imx298_apply_exposure;
+  s->road_cam.buf.init_small_yuv(device_id, ctx, VISION_STREAM_YUV_BACK_SMALL, QCAM_WIDTH, QCAM_HEIGHT);
 
   if (s->device == DEVICE_OP3T) {
     camera_init(v, &s->driver_cam, CAMERA_ID_S5K3P8SP, 1,
@@ -290,12 +322,13 @@ void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_i
                 VISION_STREAM_RGB_FRONT, VISION_STREAM_YUV_FRONT);
     s->driver_cam.apply_exposure = imx179_s5k3p8sp_apply_exposure;
   }
+  init_driver_roi(device_id, ctx, &s->driver_cam.buf);
 
   s->road_cam.device = s->device;
   s->driver_cam.device = s->device;
 
-  s->sm = new SubMaster({"driverState"});
-  s->pm = new PubMaster({"roadCameraState", "driverCameraState", "thumbnail"});
+  s->sm = new SubMaster({"driverState", "driverCameraRoi"});
+  s->pm = new PubMaster({"roadCameraState", "driverCameraState", "thumbnail", "cameraStats"});
 
   for (int i = 0; i < FRAME_BUF_COUNT; i++) {
     // TODO: make lengths correct
@@ -303,11 +336,10 @@ void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_i
     s->stats_bufs[i].allocate(0xb80);
   }
   std::fill_n(s->lapres, std::size(s->lapres), 16160);
-  s->lap_conv = new LapConv(device_id, ctx, s->road_cam.buf.rgb_width, s->road_cam.buf.rgb_height, 3);
+  s->lap_conv = new LapConv(device_id, ctx, s->road_cam.buf.rgb_width, s->road_cam.buf.rgb_height, s->road_cam.buf.rgb_stride);
 }
 
 static void set_exposure(CameraState *s, float exposure_frac, float gain_frac) {
-  int err = 0;
   uint32_t gain = s->cur_gain;
   uint32_t integ_lines = s->cur_integ_lines;
 
@@ -333,29 +365,57 @@ static void set_exposure(CameraState *s, float exposure_frac, float gain_frac) {
     gain = (s->max_gain/510) * (512 - 512/(256*gain_frac));
   }
 
-  if (gain != s->cur_gain || integ_lines != s->cur_integ_lines) {
-    if (s->apply_exposure == ov8865_apply_exposure) {
-      gain = 800 * gain_frac; // ISO
-      err = s->apply_exposure(s, gain, integ_lines, s->frame_length);
-    } else if (s->apply_exposure) {
-      err = s->apply_exposure(s, gain, integ_lines, s->frame_length);
-    }
-    if (err == 0) {
-      std::lock_guard lk(s->frame_info_lock);
-      s->cur_gain = gain;
-      s->cur_integ_lines = integ_lines;
-    } else {
-      LOGE("camera %d apply_exposure err: %d", s->camera_num, err);
-    }
+  if (s->apply_exposure == ov8865_apply_exposure) {
+    gain = 800 * gain_frac; // ISO
   }
 
-  if (err == 0) {
-    s->cur_exposure_frac = exposure_frac;
+  // written at the next start of frame, a newer one before that replaces it
+  std::lock_guard lk(s->frame_info_lock);
+  if (gain != s->cur_gain || integ_lines != s->cur_integ_lines || s->exposure_pending) {
+    s->pending_gain = gain;
+    s->pending_integ_lines = integ_lines;
+    s->pending_gain_frac = gain_frac;
+    s->exposure_pending = true;
+  }
+  s->cur_exposure_frac = exposure_frac;
+  s->cur_gain_frac = gain_frac;
+
+  //LOGD("set exposure: %f %f", exposure_frac, gain_frac);
+}
+
+// Writes the pending exposure, the frames from first_frame_id on are taken with it
+static void write_exposure(CameraState *s, uint32_t first_frame_id) {
+  int gain, integ_lines;
+  float gain_frac;
+  {
     std::lock_guard lk(s->frame_info_lock);
-    s->cur_gain_frac = gain_frac;
+    if (!s->exposure_pending) return;
+    s->exposure_pending = false;
+    gain = s->pending_gain;
+    integ_lines = s->pending_integ_lines;
+    gain_frac = s->pending_gain_frac;
+  }
+
+  int err = s->apply_exposure ? s->apply_exposure(s, gain, integ_lines, s->frame_length) : 0;
+  if (err != 0) {
+    LOGE("camera %d apply_exposure err: %d", s->camera_num, err);
+    return;
   }
 
-  //LOGD("set exposure: %f %f - %d", exposure_frac, gain_frac, err);
+  std::lock_guard lk(s->frame_info_lock);
+  s->cur_gain = gain;
+  s->cur_integ_lines = integ_lines;
+  s->exposure_history_idx = (s->exposure_history_idx + 1) % EXPOSURE_HISTORY;
+  s->exposure_history[s->exposure_history_idx] = {.frame_id = first_frame_id, .integ_lines = integ_lines, .gain_frac = gain_frac};
+}
+
+// The exposure frame_id was taken with, call with frame_info_lock held
+static const ExposureChange &exposure_for_frame(const CameraState *s, uint32_t frame_id) {
+  for (int i = 0; i < EXPOSURE_HISTORY - 1; i++) {
+    const ExposureChange &e = s->exposure_history[(s->exposure_history_idx + EXPOSURE_HISTORY - i) % EXPOSURE_HISTORY];
+    if (e.frame_id <= frame_id) return e;
+  }
+  return s->exposure_history[(s->exposure_history_idx + 1) % EXPOSURE_HISTORY];
 }
 
 static void do_autoexposure(CameraState *s, float grey_frac) {
@@ -1154,6 +1214,7 @@ static void road_camera_start(CameraState *s) {
   struct msm_actuator_cfg_data actuator_cfg_data = {0};
 
   set_exposure(s, 1.0, 1.0);
+  write_exposure(s, 0);
   int inf_step;
 
   int err = sensor_write_regs(s, start_reg_array, std::size(start_reg_array), MSM_CAMERA_I2C_BYTE_DATA);
@@ -1331,21 +1392,18 @@ static void do_autofocus(CameraState *s, SubMaster *sm) {
 }
 
 void camera_autoexposure(CameraState *s, float grey_frac) {
-  if (s->camera_num == 0) {
-    CameraExpInfo tmp = road_cam_exp.load();
-    tmp.op_id++;
-    tmp.grey_frac = grey_frac;
-    road_cam_exp.store(tmp);
-  } else {
-    CameraExpInfo tmp = driver_cam_exp.load();
-    tmp.op_id++;
-    tmp.grey_frac = grey_frac;
-    driver_cam_exp.store(tmp);
+  {
+    std::lock_guard lk(ops_lock);
+    CameraExpInfo &exp = s->camera_num == 0 ? road_cam_exp : driver_cam_exp;
+    exp.op_id++;
+    exp.grey_frac = grey_frac;
   }
+  ops_cv.notify_one();
 }
 
 static void driver_camera_start(CameraState *s) {
   set_exposure(s, 1.0, 1.0);
+  write_exposure(s, 0);
   int err = sensor_write_regs(s, start_reg_array, std::size(start_reg_array), MSM_CAMERA_I2C_BYTE_DATA);
   LOG("sensor start regs: %d", err);
 }
@@ -1480,30 +1538,53 @@ static FrameMetadata get_frame_metadata(CameraState *s, uint32_t frame_id) {
   };
 }
 
+// Wakes on new frame stats, runs AE/AF on them, and writes the exposure that
+// comes out of it at the camera's next start of frame. Stats that came in
+// while it was busy are coalesced, only the newest counts.
 static void ops_thread(MultiCameraState *s) {
   int last_road_cam_op_id = 0;
   int last_driver_cam_op_id = 0;
-
-  CameraExpInfo road_cam_op;
-  CameraExpInfo driver_cam_op;
+  CameraState *cameras[2] = {&s->road_cam, &s->driver_cam};
 
   set_thread_name("camera_settings");
   SubMaster sm({"sensorEvents"});
-  while(!do_exit) {
-    road_cam_op = road_cam_exp.load();
+  while (!do_exit) {
+    CameraExpInfo road_cam_op, driver_cam_op;
+    bool sof[2];
+    {
+      std::unique_lock lk(ops_lock);
+      // the timeout is only for do_exit
+      ops_cv.wait_for(lk, std::chrono::milliseconds(100), [&]() {
+        return road_cam_exp.op_id != last_road_cam_op_id || driver_cam_exp.op_id != last_driver_cam_op_id ||
+               sof_pending[0] || sof_pending[1];
+      });
+      road_cam_op = road_cam_exp;
+      driver_cam_op = driver_cam_exp;
+      std::copy(std::begin(sof_pending), std::end(sof_pending), sof);
+      std::fill(std::begin(sof_pending), std::end(sof_pending), false);
+    }
+
+    for (int i = 0; i < 2; i++) {
+      if (!sof[i]) continue;
+      uint32_t frame_id;
+      {
+        std::lock_guard lk(cameras[i]->frame_info_lock);
+        frame_id = cameras[i]->sof_frame_id;
+      }
+      write_exposure(cameras[i], frame_id + SENSOR_EXPOSURE_DELAY);
+    }
+
     if (road_cam_op.op_id != last_road_cam_op_id) {
       do_autoexposure(&s->road_cam, road_cam_op.grey_frac);
+      // the accelerometer is only read when focusing, there's nothing to do on it before
       do_autofocus(&s->road_cam, &sm);
       last_road_cam_op_id = road_cam_op.op_id;
     }
 
-    driver_cam_op = driver_cam_exp.load();
     if (driver_cam_op.op_id != last_driver_cam_op_id) {
       do_autoexposure(&s->driver_cam, driver_cam_op.grey_frac);
       last_driver_cam_op_id = driver_cam_op.op_id;
     }
-
-    util::sleep_for(50);
   }
 }
 
@@ -1540,11 +1621,12 @@ void process_driver_camera(MultiCameraState *s, CameraState *c, int cnt) {
 // called by processing_thread
 void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
   const CameraBuf *b = &c->buf;
-  const int roi_id = cnt % std::size(s->lapres);  // rolling roi
-  s->lapres[roi_id] = s->lap_conv->Update(b->q, (uint8_t *)b->cur_rgb_buf->addr, roi_id);
-  setup_self_recover(c, &s->lapres[0], std::size(s->lapres));
+  // scores lag one frame behind, the GPU pass runs while the next frame comes in
+  if (s->lap_conv->Update(b->q, b->cur_rgb_buf->buf_cl, s->lapres)) {
+    setup_self_recover(c, &s->lapres[0], std::size(s->lapres));
+  }
 
-  MessageBuilder msg;
+  PooledMessageBuilder msg("roadCameraState");
   auto framed = msg.initEvent().initRoadCameraState();
   fill_frame_data(framed, b->cur_frame_data);
   if (env_send_road) {
@@ -1597,6 +1679,7 @@ void cameras_run(MultiCameraState *s) {
         const int buffer = (isp_event_data->u.buf_done.stream_id & 0xFFFF) - 1;
         if (buffer == 0) {
           c->buf.camera_bufs_metadata[buf_idx] = get_frame_metadata(c, isp_event_data->frame_id);
+          c->buf.camera_bufs_metadata[buf_idx].timestamp_isp = nanos_since_boot();
           c->buf.queue(buf_idx);
         } else {
           auto &ss = c->ss[buffer];
@@ -1607,19 +1690,39 @@ void cameras_run(MultiCameraState *s) {
           HANDLE_EINTR(ioctl(c->isp_fd, VIDIOC_MSM_ISP_ENQUEUE_BUF, &ss.qbuf_info[buf_idx]));
         }
 
+      } else if (ev.type == ISP_EVENT_SOF) {
+        {
+          std::lock_guard lk(c->frame_info_lock);
+          c->sof_frame_id = isp_event_data->frame_id;
+          c->sof_timestamp = (isp_event_data->mono_timestamp.tv_sec * 1000000000ULL + isp_event_data->mono_timestamp.tv_usec * 1000);
+        }
+        // a new exposure is written right after the start of frame, so it's all in before the next one
+        if (c->exposure_pending) {
+          {
+            std::lock_guard lk(ops_lock);
+            sof_pending[i] = true;
+          }
+          ops_cv.notify_one();
+        }
+
       } else if (ev.type == ISP_EVENT_EOF) {
         const uint64_t timestamp = (isp_event_data->mono_timestamp.tv_sec * 1000000000ULL + isp_event_data->mono_timestamp.tv_usec * 1000);
         std::lock_guard lk(c->frame_info_lock);
+        // without a matching SOF event, estimate it from the readout time of the active lines
+        const uint64_t readout_ns = (uint64_t)c->ci.frame_height * c->line_length_pclk * 1000000000ULL / c->pixel_clock;
+        const uint64_t timestamp_sof = (c->sof_frame_id == isp_event_data->frame_id) ? c->sof_timestamp : timestamp - readout_ns;
+        const ExposureChange &exposure = exposure_for_frame(c, isp_event_data->frame_id);
         c->frame_metadata[c->frame_metadata_idx] = (FrameMetadata){
             .frame_id = isp_event_data->frame_id,
+            .timestamp_sof = timestamp_sof,
             .timestamp_eof = timestamp,
             .frame_length = (uint32_t)c->frame_length,
-            .integ_lines = (uint32_t)c->cur_integ_lines,
+            .integ_lines = (uint32_t)exposure.integ_lines,
             .lens_pos = c->cur_lens_pos,
             .lens_sag = c->last_sag_acc_z,
             .lens_err = c->focus_err,
             .lens_true_pos = c->lens_true_pos,
-            .gain = c->cur_gain_frac,
+            .gain = exposure.gain_frac,
             .measured_grey_fraction = c->measured_grey_fraction,
             .target_grey_fraction = c->target_grey_fraction,
             .high_conversion_gain = false,
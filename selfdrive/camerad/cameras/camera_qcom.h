@@ -3,6 +3,7 @@
 #include <atomic>
 #include <cstdint>
 #include <memory>
+#include <unordered_map>
 
 #include "cereal/messaging/messaging.h"
 #include "cereal/visionipc/visionbuf.h"
@@ -17,6 +18,9 @@
 
 #define FRAME_BUF_COUNT 4
 #define METADATA_BUF_COUNT 4
+#define EXPOSURE_HISTORY 4
+// frames from the start of frame an exposure is written at until the first one taken with it
+#define SENSOR_EXPOSURE_DELAY 2
 
 #define DEVICE_OP3 0
 #define DEVICE_OP3T 1
@@ -47,6 +51,12 @@ typedef struct StreamState {
   VisionBuf *bufs;
 } StreamState;
 
+typedef struct ExposureChange {
+  uint32_t frame_id;  // the first frame taken with it
+  int integ_lines;
+  float gain_frac;
+} ExposureChange;
+
 typedef struct CameraState {
   int camera_num;
   int camera_id;
@@ -68,6 +78,8 @@ typedef struct CameraState {
   std::mutex frame_info_lock;
   FrameMetadata frame_metadata[METADATA_BUF_COUNT];
   int frame_metadata_idx;
+  uint32_t sof_frame_id;
+  uint64_t sof_timestamp;
 
   // exposure
   uint32_t pixel_clock, line_length_pclk;
@@ -82,6 +94,16 @@ typedef struct CameraState {
   std::atomic<float> digital_gain;
   camera_apply_exposure_func apply_exposure;
 
+  // the exposure the ops thread settled on, written at the next start of frame
+  // so the registers change between frames. Under frame_info_lock
+  std::atomic<bool> exposure_pending;
+  int pending_gain, pending_integ_lines;
+  float pending_gain_frac;
+  ExposureChange exposure_history[EXPOSURE_HISTORY];
+  int exposure_history_idx;
+  // the last value written to each sensor register, writing the same again is skipped
+  std::unordered_map<uint16_t, uint16_t> sensor_regs;
+
   // rear camera only,used for focusing
   unique_fd actuator_fd, ois_fd, eeprom_fd;
   std::atomic<float> focus_err;
@@ -104,7 +126,7 @@ typedef struct MultiCameraState {
   unique_fd ispif_fd;
   unique_fd msmcfg_fd;
   unique_fd v4l_fd;
-  uint16_t lapres[(ROI_X_MAX-ROI_X_MIN+1)*(ROI_Y_MAX-ROI_Y_MIN+1)];
+  uint16_t lapres[LAPMAP_SIZE];
 
   VisionBuf focus_bufs[FRAME_BUF_COUNT];
   VisionBuf stats_bufs[FRAME_BUF_COUNT];
@@ -6,6 +6,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cerrno>
@@ -465,6 +466,7 @@ void enqueue_buffer(struct CameraState *s, int i, bool dp) {
     // LOGD("fence wait: %d %d", ret, sync_wait.sync_obj);
 
     s->buf.camera_bufs_metadata[i].timestamp_eof = (uint64_t)nanos_since_boot(); // set true eof
+    s->buf.camera_bufs_metadata[i].timestamp_isp = s->buf.camera_bufs_metadata[i].timestamp_eof;
     if (dp) s->buf.queue(i);
 
     // destroy old output fence
@@ -506,15 +508,41 @@ void enqueue_buffer(struct CameraState *s, int i, bool dp) {
 
   // push the buffer
   config_isp(s, s->buf_handle[i], s->sync_objs[i], request_id, s->buf0_handle, 65632*(i+1));
+  s->request_sched_time[i] = nanos_since_boot();
 }
 
 void enqueue_req_multi(struct CameraState *s, int start, int n, bool dp) {
    for (int i=start;i<start+n;++i) {
-     s->request_ids[(i - 1) % FRAME_BUF_COUNT] = i;
-     enqueue_buffer(s, (i - 1) % FRAME_BUF_COUNT, dp);
+     s->request_ids[(i - 1) % s->request_depth] = i;
+     enqueue_buffer(s, (i - 1) % s->request_depth, dp);
    }
 }
 
+// called from the event loop, the work is done by request_thread
+static void post_req_multi(struct CameraState *s, int start, int n, bool dp) {
+  s->request_queue.push({.clear = false, .start = start, .n = n, .dp = dp});
+}
+
+static void post_clear_req_queue(struct CameraState *s) {
+  s->request_queue.push({.clear = true});
+}
+
+static void request_thread(CameraState *s) {
+  char name[16];
+  snprintf(name, sizeof(name), "camera_req_%d", s->camera_num);
+  set_thread_name(name);
+
+  CameraState::RequestCmd cmd;
+  while (!do_exit) {
+    if (!s->request_queue.try_pop(cmd, 50)) continue;
+    if (cmd.clear) {
+      clear_req_queue(s->multi_cam_state->video0_fd, s->session_handle, s->link_handle);
+    } else {
+      enqueue_req_multi(s, cmd.start, cmd.n, cmd.dp);
+    }
+  }
+}
+
 // ******************* camera *******************
 
 static void camera_init(MultiCameraState *multi_cam_state, VisionIpcServer * v, CameraState *s, int camera_id, int camera_num, unsigned int fps, cl_device_id device_id, cl_context ctx, VisionStreamType rgb_type, VisionStreamType yuv_type) {
@@ -529,6 +557,9 @@ static void camera_init(MultiCameraState *multi_cam_state, VisionIpcServer * v,
   s->request_id_last = 0;
   s->skipped = true;
 
+  const char *depth = getenv("CAMERA_REQUEST_DEPTH");
+  s->request_depth = depth ? std::clamp(atoi(depth), 2, FRAME_BUF_COUNT) : FRAME_BUF_COUNT_DEFAULT;
+
   s->min_ev = EXPOSURE_TIME_MIN * sensor_analog_gains[ANALOG_GAIN_MIN_IDX];
   s->max_ev = EXPOSURE_TIME_MAX * sensor_analog_gains[ANALOG_GAIN_MAX_IDX] * DC_GAIN;
   s->target_grey_fraction = 0.3;
@@ -538,7 +569,7 @@ static void camera_init(MultiCameraState *multi_cam_state, VisionIpcServer * v,
   s->exposure_time = 5;
   s->cur_ev[0] = s->cur_ev[1] = s->cur_ev[2] = (s->dc_gain_enabled ? DC_GAIN : 1) * sensor_analog_gains[s->gain_idx] * s->exposure_time;
 
-  s->buf.init(device_id, ctx, s, v, FRAME_BUF_COUNT, rgb_type, yuv_type);
+  s->buf.init(device_id, ctx, s, v, s->request_depth, rgb_type, yuv_type);
 }
 
 int open_v4l_by_name_and_index(const char name[], int index, int flags = O_RDWR | O_NONBLOCK) {
@@ -728,22 +759,24 @@ static void camera_open(CameraState *s) {
   ret = device_control(s->sensor_fd, CAM_START_DEV, s->session_handle, s->sensor_dev_handle);
   LOGD("start sensor: %d", ret);
 
-  enqueue_req_multi(s, 1, FRAME_BUF_COUNT, 0);
+  enqueue_req_multi(s, 1, s->request_depth, 0);
 }
 
 void cameras_init(VisionIpcServer *v, MultiCameraState *s, cl_device_id device_id, cl_context ctx) {
   camera_init(s, v, &s->road_cam, CAMERA_ID_AR0231, 1, 20, device_id, ctx,
               VISION_STREAM_RGB_BACK, VISION_STREAM_YUV_BACK); // swap left/right
+  s->road_cam.buf.init_small_yuv(device_id, ctx, VISION_STREAM_YUV_BACK_SMALL, QCAM_WIDTH, QCAM_HEIGHT);
   printf("road camera initted \n");
   camera_init(s, v, &s->wide_road_cam, CAMERA_ID_AR0231, 0, 20, device_id, ctx,
               VISION_STREAM_RGB_WIDE, VISION_STREAM_YUV_WIDE);
   printf("wide road camera initted \n");
   camera_init(s, v, &s->driver_cam, CAMERA_ID_AR0231, 2, 20, device_id, ctx,
               VISION_STREAM_RGB_FRONT, VISION_STREAM_YUV_FRONT);
+  init_driver_roi(device_id, ctx, &s->driver_cam.buf);
   printf("driver camera initted \n");
 
-  s->sm = new SubMaster({"driverState"});
-  s->pm = new PubMaster({"roadCameraState", "driverCameraState", "wideRoadCameraState", "thumbnail"});
+  s->sm = new SubMaster({"driverState", "driverCameraRoi"});
+  s->pm = new PubMaster({"roadCameraState", "driverCameraState", "wideRoadCameraState", "thumbnail", "cameraStats"});
 }
 
 void cameras_open(MultiCameraState *s) {
@@ -859,13 +892,18 @@ void handle_camera_event(CameraState *s, void *evdat) {
 
   if (real_id != 0) { // next ready
     if (real_id == 1) {s->idx_offset = main_id;}
-    int buf_idx = (real_id - 1) % FRAME_BUF_COUNT;
+    int buf_idx = (real_id - 1) % s->request_depth;
+
+    // slack left before the ISP would have run out of requests
+    if (s->request_ids[buf_idx] == real_id) {
+      s->buf.request_slack.add((int64_t)(timestamp - s->request_sched_time[buf_idx]) / 1e6);
+    }
 
     // check for skipped frames
     if (main_id > s->frame_id_last + 1 && !s->skipped) {
       // realign
-      clear_req_queue(s->multi_cam_state->video0_fd, event_data->session_hdl, event_data->u.frame_msg.link_hdl);
-      enqueue_req_multi(s, real_id + 1, FRAME_BUF_COUNT - 1, 0);
+      post_clear_req_queue(s);
+      post_req_multi(s, real_id + 1, s->request_depth - 1, 0);
       s->skipped = true;
     } else if (main_id == s->frame_id_last + 1) {
       s->skipped = false;
@@ -873,7 +911,7 @@ void handle_camera_event(CameraState *s, void *evdat) {
 
     // check for dropped requests
     if (real_id > s->request_id_last + 1) {
-      enqueue_req_multi(s, s->request_id_last + 1 + FRAME_BUF_COUNT, real_id - (s->request_id_last + 1), 0);
+      post_req_multi(s, s->request_id_last + 1 + s->request_depth, real_id - (s->request_id_last + 1), 0);
     }
 
     // metas
@@ -892,12 +930,12 @@ void handle_camera_event(CameraState *s, void *evdat) {
     s->exp_lock.unlock();
 
     // dispatch
-    enqueue_req_multi(s, real_id + FRAME_BUF_COUNT, 1, 1);
+    post_req_multi(s, real_id + s->request_depth, 1, 1);
   } else { // not ready
     // reset after half second of no response
     if (main_id > s->frame_id_last + 10) {
-      clear_req_queue(s->multi_cam_state->video0_fd, event_data->session_hdl, event_data->u.frame_msg.link_hdl);
-      enqueue_req_multi(s, s->request_id_last + 1, FRAME_BUF_COUNT, 0);
+      post_clear_req_queue(s);
+      post_req_multi(s, s->request_id_last + 1, s->request_depth, 0);
       s->frame_id_last = main_id;
       s->skipped = true;
     }
@@ -1020,7 +1058,7 @@ void process_driver_camera(MultiCameraState *s, CameraState *c, int cnt) {
 void process_road_camera(MultiCameraState *s, CameraState *c, int cnt) {
   const CameraBuf *b = &c->buf;
 
-  MessageBuilder msg;
+  PooledMessageBuilder msg(c == &s->road_cam ? "roadCameraState" : "wideRoadCameraState");
   auto framed = c == &s->road_cam ? msg.initEvent().initRoadCameraState() : msg.initEvent().initWideRoadCameraState();
   fill_frame_data(framed, b->cur_frame_data);
   if ((c == &s->road_cam && env_send_road) || (c == &s->wide_road_cam && env_send_wide_road)) {
@@ -1042,6 +1080,9 @@ void cameras_run(MultiCameraState *s) {
   threads.push_back(start_process_thread(s, &s->road_cam, process_road_camera));
   threads.push_back(start_process_thread(s, &s->driver_cam, process_driver_camera));
   threads.push_back(start_process_thread(s, &s->wide_road_cam, process_road_camera));
+  for (CameraState *c : {&s->road_cam, &s->wide_road_cam, &s->driver_cam}) {
+    threads.push_back(std::thread(request_thread, c));
+  }
 
   // start devices
   LOG("-- Starting devices");
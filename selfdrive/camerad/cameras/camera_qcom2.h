@@ -1,13 +1,16 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 #include <media/cam_req_mgr.h>
 
 #include "selfdrive/camerad/cameras/camera_common.h"
+#include "selfdrive/common/queue.h"
 #include "selfdrive/common/util.h"
 
-#define FRAME_BUF_COUNT 4
+#define FRAME_BUF_COUNT 8  // most ISP requests in flight, the depth is set by CAMERA_REQUEST_DEPTH
+#define FRAME_BUF_COUNT_DEFAULT 4
 #define DEBAYER_LOCAL_WORKSIZE 16
 typedef struct CameraState {
   MultiCameraState *multi_cam_state;
@@ -41,7 +44,19 @@ typedef struct CameraState {
   int buf0_handle;
   int buf_handle[FRAME_BUF_COUNT];
   int sync_objs[FRAME_BUF_COUNT];
-  int request_ids[FRAME_BUF_COUNT];
+  std::atomic<int> request_ids[FRAME_BUF_COUNT];
+  std::atomic<uint64_t> request_sched_time[FRAME_BUF_COUNT];
+  int request_depth;  // ISP requests kept in flight, one camera buffer each
+
+  // Fence waits and re-enqueueing run on a thread per camera, so one camera waiting
+  // for its frame to end doesn't hold up the event loop shared by all of them.
+  struct RequestCmd {
+    bool clear;
+    int start, n;
+    bool dp;
+  };
+  SafeQueue<RequestCmd> request_queue;
+
   int request_id_last;
   int frame_id_last;
   int idx_offset;
@@ -0,0 +1,30 @@
+// Luminance histogram of the sampled pixels in a rect of the Y plane.
+// One work group per sampled row, reduced in local memory before touching the global bins.
+__kernel void ae_histogram(__global uchar const * const y_plane,
+                           __global uint * hist,
+                           int stride,
+                           int x_start, int x_end, int x_skip,
+                           int y_start, int y_skip)
+{
+  __local uint local_hist[256];
+  const int lid = get_local_id(0);
+  const int lsize = get_local_size(0);
+
+  for (int i = lid; i < 256; i += lsize) {
+    local_hist[i] = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const int row = y_start + get_group_id(0) * y_skip;
+  __global uchar const * const line = y_plane + mul24(row, stride);
+  for (int x = x_start + lid * x_skip; x < x_end; x += lsize * x_skip) {
+    atomic_inc(&local_hist[line[x]]);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int i = lid; i < 256; i += lsize) {
+    if (local_hist[i]) {
+      atomic_add(&hist[i], local_hist[i]);
+    }
+  }
+}
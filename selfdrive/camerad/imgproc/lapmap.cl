@@ -0,0 +1,59 @@
+// Laplacian sharpness score of every autofocus ROI in one launch.
+// One work group per ROI reduces the 3x3 laplacian of the gray image to its
+// mean, max and variance, the score is 5 * variance + max.
+#ifndef LOCAL_SIZE
+#define LOCAL_SIZE 256
+#endif
+
+inline int gray(__global const uchar *p) {
+  return p[0] / 9 + p[1] / 2 + p[2] / 3;
+}
+
+__kernel void lapmap(__global const uchar *rgb, __global ushort *lapmap)
+{
+  __local int l_sum[LOCAL_SIZE];
+  __local int l_max[LOCAL_SIZE];
+  __local long l_sq[LOCAL_SIZE];
+
+  const int roi = get_group_id(0);
+  const int lid = get_local_id(0);
+  const int x0 = (ROI_X_MIN + roi % ROI_COLS) * ROI_W;
+  const int y0 = (ROI_Y_MIN + roi / ROI_COLS) * ROI_H;
+
+  int sum = 0, mx = 0;
+  long sq = 0;
+  for (int i = lid; i < ROI_W * ROI_H; i += LOCAL_SIZE) {
+    const int x = i % ROI_W;
+    const int y = i / ROI_W;
+    // the ROI border has no full neighbourhood and counts as 0
+    short v = 0;
+    if (x > 0 && x < ROI_W - 1 && y > 0 && y < ROI_H - 1) {
+      __global const uchar *p = rgb + (y0 + y) * STRIDE + (x0 + x) * 3;
+      v = gray(p - STRIDE) + gray(p - 3) - 4 * gray(p) + gray(p + 3) + gray(p + STRIDE);
+    }
+    sum += v;
+    mx = max(mx, (int)v);
+    sq += v * v;
+  }
+  l_sum[lid] = sum;
+  l_max[lid] = mx;
+  l_sq[lid] = sq;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int s = LOCAL_SIZE / 2; s > 0; s >>= 1) {
+    if (lid < s) {
+      l_sum[lid] += l_sum[lid + s];
+      l_max[lid] = max(l_max[lid], l_max[lid + s]);
+      l_sq[lid] += l_sq[lid + s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (lid == 0) {
+    const int n = ROI_W * ROI_H;
+    const long mean = (short)(l_sum[0] / n);
+    // sum of (v - mean)^2, expanded so a single pass is enough
+    const long var = l_sq[0] - 2 * mean * l_sum[0] + n * mean * mean;
+    lapmap[roi] = min(5.0f * var / n + l_max[0], 65535.0f);
+  }
+}
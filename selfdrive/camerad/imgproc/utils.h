@@ -2,7 +2,6 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <vector>
 
 #include "selfdrive/common/clutil.h"
 
@@ -13,29 +12,25 @@
 #define ROI_X_MAX 6
 #define ROI_Y_MIN 2
 #define ROI_Y_MAX 3
+#define LAPMAP_SIZE ((ROI_X_MAX - ROI_X_MIN + 1) * (ROI_Y_MAX - ROI_Y_MIN + 1))
 
 #define LM_THRESH 120
 #define LM_PREC_THRESH 0.9 // 90 perc is blur
 
-// only apply to QCOM
-#define FULL_STRIDE_X 1280
-#define FULL_STRIDE_Y 896
-
-#define CONV_LOCAL_WORKSIZE 16
-
 class LapConv {
 public:
-  LapConv(cl_device_id device_id, cl_context ctx, int rgb_width, int rgb_height, int filter_size);
+  LapConv(cl_device_id device_id, cl_context ctx, int rgb_width, int rgb_height, int rgb_stride);
   ~LapConv();
-  uint16_t Update(cl_command_queue q, const uint8_t *rgb_buf, const int roi_id);
+  // Scores all ROIs of the frame in rgb_cl without waiting for the GPU. The scores
+  // of the previous call are copied to lapmap, returns false if there were none yet
+  bool Update(cl_command_queue q, cl_mem rgb_cl, uint16_t lapmap[LAPMAP_SIZE]);
 
 private:
-  cl_mem roi_cl, result_cl, filter_cl;
+  cl_mem lapmap_cl;
   cl_program prg;
   cl_kernel krnl;
-  const int width, height;
-  std::vector<uint8_t> roi_buf;
-  std::vector<int16_t> result_buf;
+  cl_event read_event = nullptr;
+  uint16_t lapmap_buf[LAPMAP_SIZE];
 };
 
 bool is_blur(const uint16_t *lapmap, const size_t size);
@@ -11,6 +11,8 @@
 #include "cereal/visionipc/visionipc_server.h"
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/readiness.h"
+#include "selfdrive/common/sched.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
@@ -29,14 +31,17 @@
 
 ExitHandler do_exit;
 
-void party(cl_device_id device_id, cl_context context) {
+void party(cl_device_id device_id, cl_context context, Readiness &readiness) {
   MultiCameraState cameras = {};
   VisionIpcServer vipc_server("camerad", device_id, context);
 
+  readiness.phase("cameras init");
   cameras_init(&vipc_server, &cameras, device_id, context);
+  readiness.phase("cameras open");
   cameras_open(&cameras);
 
   vipc_server.start_listener();
+  readiness.ready();
 
   cameras_run(&cameras);
 }
@@ -46,14 +51,9 @@ void party(cl_device_id device_id, cl_context context) {
 #endif
 
 int main(int argc, char *argv[]) {
-  set_realtime_priority(53);
-  if (Hardware::EON()) {
-    set_core_affinity(2);
-  } else if (Hardware::TICI()) {
-    set_core_affinity(6);
-  } else if (Hardware::JETSON()) {
-    set_core_affinity(0);
-  }
+  Readiness readiness("camerad");
+  sched_apply("camerad", "main");
+  readiness.phase("cl init");
 
   #ifdef XNX
   cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_GPU);
@@ -69,7 +69,7 @@ int main(int argc, char *argv[]) {
   cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
 #endif
 
-  party(device_id, context);
+  party(device_id, context, readiness);
 
   CL_CHECK(clReleaseContext(context));
 }
@@ -0,0 +1,342 @@
+// Benchmarks the camerad OpenCL kernels on a raw frame, run from selfdrive/camerad.
+//
+//   kernel_bench [-c eon|tici] [-f raw_frame] [-n iterations] [-l kernel=WxH]... [-s dir | -r dir]
+//
+// Without -f a fixed pseudo random frame is used, so saved references stay valid.
+// -l overrides the local work size of one kernel, -s saves every kernel's output
+// to dir and -r checks them bit for bit against a set saved before.
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <CL/cl.h>
+
+#include "selfdrive/camerad/imgproc/utils.h"
+#include "selfdrive/common/clutil.h"
+
+struct Sensor {
+  const char *name;
+  int frame_width, frame_height, frame_stride;
+  int bayer_flip, hdr;
+  int rgb_width, rgb_height;
+  const char *debayer_cl;
+  int qcam_width, qcam_height;
+};
+
+static const Sensor sensors[] = {
+  {"eon", 2328, 1748, 2912, 0, 1, 1164, 874, "cameras/debayer.cl", 480, 360},
+  {"tici", 1928, 1208, 2416, 1, 0, 1928, 1208, "cameras/real_debayer.cl", 526, 330},
+};
+
+struct Result {
+  std::string name;
+  double min_us, median_us, mpix_per_s;
+  std::string check;
+};
+
+class Bench {
+public:
+  Bench(int iterations, const std::map<std::string, std::vector<size_t>> &local_sizes,
+        const char *save_dir, const char *ref_dir)
+      : iterations(iterations), local_sizes(local_sizes), save_dir(save_dir), ref_dir(ref_dir) {
+    device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+    context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+    q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err));
+  }
+
+  ~Bench() {
+    for (cl_kernel k : kernels) CL_CHECK(clReleaseKernel(k));
+    for (cl_mem m : buffers) CL_CHECK(clReleaseMemObject(m));
+    CL_CHECK(clReleaseCommandQueue(q));
+    CL_CHECK(clReleaseContext(context));
+  }
+
+  cl_kernel kernel(const char *file, const char *name, const std::string &args) {
+    cl_program prg = cl_program_from_file(context, device_id, file, args.c_str());
+    cl_kernel k = CL_CHECK_ERR(clCreateKernel(prg, name, &err));
+    CL_CHECK(clReleaseProgram(prg));
+    kernels.push_back(k);
+    return k;
+  }
+
+  cl_mem buffer(size_t size, const void *data = nullptr) {
+    cl_mem_flags flags = CL_MEM_READ_WRITE | (data ? CL_MEM_COPY_HOST_PTR : 0);
+    cl_mem m = CL_CHECK_ERR(clCreateBuffer(context, flags, size, (void *)data, &err));
+    buffers.push_back(m);
+    return m;
+  }
+
+  // Runs k and records its GPU time. out is read back and checked after the last run,
+  // before_each is called ahead of every run for kernels that accumulate into their output
+  bool run(const std::string &name, cl_kernel k, std::vector<size_t> global, std::vector<size_t> local,
+           double pixels, cl_mem out, size_t out_size, void (*before_each)(Bench &, cl_mem) = nullptr) {
+    if (auto it = local_sizes.find(name); it != local_sizes.end()) {
+      local = it->second;
+      if (local.size() != global.size()) {
+        printf("%s: local size needs %zu dimensions\n", name.c_str(), global.size());
+        return false;
+      }
+    }
+
+    std::vector<double> times_us;
+    for (int i = 0; i < iterations; i++) {
+      if (before_each) before_each(*this, out);
+
+      cl_event event;
+      cl_int ret = clEnqueueNDRangeKernel(q, k, global.size(), NULL, global.data(), local.empty() ? NULL : local.data(), 0, NULL, &event);
+      if (ret != CL_SUCCESS) {
+        printf("%s: enqueue failed: %s\n", name.c_str(), cl_get_error_string(ret));
+        return false;
+      }
+      CL_CHECK(clWaitForEvents(1, &event));
+
+      cl_ulong start = 0, end = 0;
+      CL_CHECK(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL));
+      CL_CHECK(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL));
+      CL_CHECK(clReleaseEvent(event));
+      times_us.push_back((end - start) / 1e3);
+    }
+
+    std::sort(times_us.begin(), times_us.end());
+    const double median_us = times_us[times_us.size() / 2];
+    results.push_back({name, times_us[0], median_us, pixels / median_us, check(name, out, out_size)});
+    return true;
+  }
+
+  bool report() {
+    bool exact = true;
+    printf("%-18s %10s %10s %10s  %s\n", "kernel", "min us", "median us", "MP/s", "output");
+    for (auto &r : results) {
+      printf("%-18s %10.1f %10.1f %10.1f  %s\n", r.name.c_str(), r.min_us, r.median_us, r.mpix_per_s, r.check.c_str());
+      exact = exact && r.check.find("differ") == std::string::npos && r.check.find("missing") == std::string::npos;
+    }
+    return exact;
+  }
+
+  cl_command_queue q;
+
+private:
+  std::string check(const std::string &name, cl_mem out, size_t out_size) {
+    std::vector<uint8_t> data(out_size);
+    CL_CHECK(clEnqueueReadBuffer(q, out, CL_TRUE, 0, out_size, data.data(), 0, NULL, NULL));
+
+    if (save_dir) {
+      std::ofstream f(std::string(save_dir) + "/" + name + ".bin", std::ios::binary);
+      f.write((const char *)data.data(), data.size());
+      return "saved";
+    }
+    if (!ref_dir) return "";
+
+    std::ifstream f(std::string(ref_dir) + "/" + name + ".bin", std::ios::binary);
+    std::vector<uint8_t> ref((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if (ref.size() != data.size()) return "reference missing or of the wrong size";
+
+    size_t differ = 0;
+    int max_diff = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+      if (data[i] != ref[i]) {
+        differ++;
+        max_diff = std::max(max_diff, std::abs((int)data[i] - (int)ref[i]));
+      }
+    }
+    if (differ == 0) return "bit exact";
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%zu bytes differ, max diff %d", differ, max_diff);
+    return buf;
+  }
+
+  cl_device_id device_id;
+  cl_context context;
+  std::vector<cl_kernel> kernels;
+  std::vector<cl_mem> buffers;
+
+  const int iterations;
+  const std::map<std::string, std::vector<size_t>> local_sizes;
+  const char *save_dir, *ref_dir;
+  std::vector<Result> results;
+};
+
+static void clear_hist(Bench &b, cl_mem hist) {
+  const uint32_t zero = 0;
+  CL_CHECK(clEnqueueFillBuffer(b.q, hist, &zero, sizeof(zero), 0, 256 * sizeof(uint32_t), 0, NULL, NULL));
+}
+
+static std::vector<uint8_t> load_frame(const char *path, size_t size) {
+  std::vector<uint8_t> frame(size);
+  if (path) {
+    std::ifstream f(path, std::ios::binary);
+    f.read((char *)frame.data(), frame.size());
+    if (f.gcount() != (std::streamsize)frame.size()) {
+      printf("%s: expected %zu bytes\n", path, size);
+      exit(1);
+    }
+  } else {
+    uint32_t x = 1337;
+    for (auto &v : frame) {
+      x = x * 1103515245 + 12345;
+      v = x >> 24;
+    }
+  }
+  return frame;
+}
+
+int main(int argc, char **argv) {
+  const Sensor *s = &sensors[0];
+  const char *frame_path = nullptr, *save_dir = nullptr, *ref_dir = nullptr;
+  int iterations = 50;
+  std::map<std::string, std::vector<size_t>> local_sizes;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:f:n:l:s:r:")) != -1) {
+    switch (opt) {
+      case 'c':
+        s = nullptr;
+        for (auto &sensor : sensors) {
+          if (strcmp(sensor.name, optarg) == 0) s = &sensor;
+        }
+        if (!s) {
+          printf("unknown camera %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'f': frame_path = optarg; break;
+      case 'n': iterations = std::max(1, atoi(optarg)); break;
+      case 's': save_dir = optarg; break;
+      case 'r': ref_dir = optarg; break;
+      case 'l': {
+        // kernel=W or kernel=WxH
+        char *eq = strchr(optarg, '=');
+        if (!eq) {
+          printf("-l expects kernel=WxH\n");
+          return 1;
+        }
+        std::vector<size_t> dims;
+        for (char *p = eq + 1; *p; p += (*p == 'x')) {
+          dims.push_back(strtoul(p, &p, 10));
+        }
+        local_sizes[std::string(optarg, eq - optarg)] = dims;
+        break;
+      }
+      default:
+        return 1;
+    }
+  }
+
+  Bench b(iterations, local_sizes, save_dir, ref_dir);
+  const bool tici = strcmp(s->name, "tici") == 0;
+  const int w = s->rgb_width, h = s->rgb_height;
+  const int rgb_stride = w * 3;
+  const size_t yuv_size = w * h * 3 / 2;
+  const double frame_pixels = (double)s->frame_width * s->frame_height;
+  printf("%s: %dx%d raw, %dx%d rgb, %d iterations\n", s->name, s->frame_width, s->frame_height, w, h, iterations);
+
+  std::vector<uint8_t> frame = load_frame(frame_path, (size_t)s->frame_stride * s->frame_height);
+  cl_mem raw_cl = b.buffer(frame.size(), frame.data());
+  cl_mem rgb_cl = b.buffer(rgb_stride * h);
+  cl_mem yuv_cl = b.buffer(yuv_size);
+
+  // debayer, same build arguments as camerad
+  char args[4096];
+  snprintf(args, sizeof(args),
+           "-cl-fast-relaxed-math -cl-denorms-are-zero "
+           "-DFRAME_WIDTH=%d -DFRAME_HEIGHT=%d -DFRAME_STRIDE=%d "
+           "-DRGB_WIDTH=%d -DRGB_HEIGHT=%d -DRGB_STRIDE=%d "
+           "-DBAYER_FLIP=%d -DHDR=%d -DCAM_NUM=%d",
+           s->frame_width, s->frame_height, s->frame_stride, w, h, rgb_stride, s->bayer_flip, s->hdr, 0);
+  cl_kernel debayer = b.kernel(s->debayer_cl, "debayer10", args);
+  CL_CHECK(clSetKernelArg(debayer, 0, sizeof(cl_mem), &raw_cl));
+  CL_CHECK(clSetKernelArg(debayer, 1, sizeof(cl_mem), &rgb_cl));
+  if (tici) {
+    std::vector<size_t> local = {16, 16};
+    if (auto it = local_sizes.find("debayer10"); it != local_sizes.end() && it->second.size() == 2) local = it->second;
+    const size_t local_mem = (local[0] + 2) * (local[1] + 2) * sizeof(short int);
+    CL_CHECK(clSetKernelArg(debayer, 2, local_mem, NULL));
+    b.run("debayer10", debayer, {(size_t)s->frame_width, (size_t)s->frame_height}, local, frame_pixels, rgb_cl, rgb_stride * h);
+  } else {
+    const float gain = 1.0;
+    CL_CHECK(clSetKernelArg(debayer, 2, sizeof(float), &gain));
+    b.run("debayer10", debayer, {(size_t)h}, {}, frame_pixels, rgb_cl, rgb_stride * h);
+
+    // the fused kernel writes its own rgb copy so the one above stays the rgb_to_yuv input
+    cl_mem fused_rgb_cl = b.buffer(rgb_stride * h);
+    cl_mem fused_yuv_cl = b.buffer(yuv_size);
+    cl_kernel debayer_yuv = b.kernel(s->debayer_cl, "debayer10_yuv", args);
+    const int write_rgb = 1;
+    CL_CHECK(clSetKernelArg(debayer_yuv, 0, sizeof(cl_mem), &raw_cl));
+    CL_CHECK(clSetKernelArg(debayer_yuv, 1, sizeof(cl_mem), &fused_rgb_cl));
+    CL_CHECK(clSetKernelArg(debayer_yuv, 2, sizeof(cl_mem), &fused_yuv_cl));
+    CL_CHECK(clSetKernelArg(debayer_yuv, 3, sizeof(float), &gain));
+    CL_CHECK(clSetKernelArg(debayer_yuv, 4, sizeof(int), &write_rgb));
+    b.run("debayer10_yuv", debayer_yuv, {(size_t)h / 2}, {}, frame_pixels, fused_yuv_cl, yuv_size);
+  }
+
+  snprintf(args, sizeof(args),
+           "-cl-fast-relaxed-math -cl-denorms-are-zero "
+           "-DWIDTH=%d -DHEIGHT=%d -DUV_WIDTH=%d -DUV_HEIGHT=%d -DRGB_STRIDE=%d -DRGB_SIZE=%d",
+           w, h, w / 2, h / 2, rgb_stride, w * h);
+  cl_kernel rgb_to_yuv = b.kernel("transforms/rgb_to_yuv.cl", "rgb_to_yuv", args);
+  CL_CHECK(clSetKernelArg(rgb_to_yuv, 0, sizeof(cl_mem), &rgb_cl));
+  CL_CHECK(clSetKernelArg(rgb_to_yuv, 1, sizeof(cl_mem), &yuv_cl));
+  b.run("rgb_to_yuv", rgb_to_yuv, {(size_t)(w + 3) / 4, (size_t)(h + 3) / 4}, {}, w * h, yuv_cl, yuv_size);
+
+  // qcamera downscale and the driver monitoring crop
+  const int qw = s->qcam_width, qh = s->qcam_height;
+  cl_mem qcam_cl = b.buffer(qw * qh * 3 / 2);
+  snprintf(args, sizeof(args), "-cl-fast-relaxed-math -cl-denorms-are-zero -DIN_WIDTH=%d -DIN_HEIGHT=%d -DOUT_WIDTH=%d -DOUT_HEIGHT=%d",
+           w, h, qw, qh);
+  cl_kernel yuv_scale = b.kernel("transforms/yuv_scale.cl", "yuv_scale", args);
+  CL_CHECK(clSetKernelArg(yuv_scale, 0, sizeof(cl_mem), &yuv_cl));
+  CL_CHECK(clSetKernelArg(yuv_scale, 1, sizeof(cl_mem), &qcam_cl));
+  b.run("yuv_scale", yuv_scale, {(size_t)qw / 2, (size_t)qh / 2}, {}, qw * qh, qcam_cl, qw * qh * 3 / 2);
+
+  const int dw = 320, dh = 640;
+  cl_mem roi_cl = b.buffer(dw * dh * 3 / 2);
+  snprintf(args, sizeof(args), "-cl-fast-relaxed-math -cl-denorms-are-zero -DIN_WIDTH=%d -DIN_HEIGHT=%d -DOUT_WIDTH=%d -DOUT_HEIGHT=%d",
+           w, h, dw, dh);
+  cl_kernel crop = b.kernel("transforms/yuv_scale.cl", "yuv_crop_scale", args);
+  const int rect[4] = {w - h / 2, 0, h / 2, h};
+  const int mirror = 1;
+  CL_CHECK(clSetKernelArg(crop, 0, sizeof(cl_mem), &yuv_cl));
+  CL_CHECK(clSetKernelArg(crop, 1, sizeof(cl_mem), &roi_cl));
+  for (int i = 0; i < 4; i++) CL_CHECK(clSetKernelArg(crop, 2 + i, sizeof(int), &rect[i]));
+  CL_CHECK(clSetKernelArg(crop, 6, sizeof(int), &mirror));
+  b.run("yuv_crop_scale", crop, {(size_t)dw / 2, (size_t)dh / 2}, {}, dw * dh, roi_cl, dw * dh * 3 / 2);
+
+  // autofocus sharpness, the work group size is a build define of the kernel
+  size_t lap_local = 256;
+  if (auto it = local_sizes.find("lapmap"); it != local_sizes.end() && !it->second.empty()) lap_local = it->second[0];
+  const int roi_w = w / NUM_SEGMENTS_X, roi_h = h / NUM_SEGMENTS_Y;
+  snprintf(args, sizeof(args),
+           "-cl-fast-relaxed-math -cl-denorms-are-zero -DLOCAL_SIZE=%zu "
+           "-DROI_W=%d -DROI_H=%d -DSTRIDE=%d -DROI_X_MIN=%d -DROI_Y_MIN=%d -DROI_COLS=%d",
+           lap_local, roi_w, roi_h, rgb_stride, ROI_X_MIN, ROI_Y_MIN, ROI_X_MAX - ROI_X_MIN + 1);
+  cl_mem lapmap_cl = b.buffer(LAPMAP_SIZE * sizeof(uint16_t));
+  cl_kernel lapmap = b.kernel("imgproc/lapmap.cl", "lapmap", args);
+  CL_CHECK(clSetKernelArg(lapmap, 0, sizeof(cl_mem), &rgb_cl));
+  CL_CHECK(clSetKernelArg(lapmap, 1, sizeof(cl_mem), &lapmap_cl));
+  b.run("lapmap", lapmap, {LAPMAP_SIZE * lap_local}, {lap_local}, LAPMAP_SIZE * roi_w * roi_h, lapmap_cl, LAPMAP_SIZE * sizeof(uint16_t));
+
+  // auto exposure histogram over the whole frame, every other pixel
+  const int skip = 2;
+  const int hist_args[6] = {w, 0, w, skip, 0, skip};
+  cl_mem hist_cl = b.buffer(256 * sizeof(uint32_t));
+  cl_kernel ae_hist = b.kernel("imgproc/ae_hist.cl", "ae_histogram", "-cl-fast-relaxed-math");
+  CL_CHECK(clSetKernelArg(ae_hist, 0, sizeof(cl_mem), &yuv_cl));
+  CL_CHECK(clSetKernelArg(ae_hist, 1, sizeof(cl_mem), &hist_cl));
+  for (int i = 0; i < 6; i++) CL_CHECK(clSetKernelArg(ae_hist, 2 + i, sizeof(int), &hist_args[i]));
+  size_t hist_local = 64;
+  if (auto it = local_sizes.find("ae_histogram"); it != local_sizes.end() && !it->second.empty()) hist_local = it->second[0];
+  b.run("ae_histogram", ae_hist, {(h / skip) * hist_local}, {hist_local}, (w / skip) * (h / skip), hist_cl, 256 * sizeof(uint32_t), clear_hist);
+
+  return b.report() ? 0 : 1;
+}
@@ -0,0 +1,56 @@
+#include "selfdrive/camerad/transforms/yuv_scale.h"
+
+#include <cassert>
+#include <cstdio>
+
+YuvScaler::YuvScaler(cl_context ctx, cl_device_id device_id, int in_width, int in_height, int out_width, int out_height) {
+  assert(in_width % 2 == 0 && in_height % 2 == 0);
+  assert(out_width % 2 == 0 && out_height % 2 == 0);
+  downscale = out_width <= in_width && out_height <= in_height;
+
+  char args[1024];
+  snprintf(args, sizeof(args),
+           "-cl-fast-relaxed-math -cl-denorms-are-zero "
+           "-DIN_WIDTH=%d -DIN_HEIGHT=%d -DOUT_WIDTH=%d -DOUT_HEIGHT=%d",
+           in_width, in_height, out_width, out_height);
+
+  cl_program prg = cl_program_from_file(ctx, device_id, "transforms/yuv_scale.cl", args);
+  krnl = CL_CHECK_ERR(clCreateKernel(prg, "yuv_scale", &err));
+  krnl_crop = CL_CHECK_ERR(clCreateKernel(prg, "yuv_crop_scale", &err));
+  CL_CHECK(clReleaseProgram(prg));
+
+  // one work item per 2x2 block of output luma and its chroma sample
+  work_size[0] = out_width / 2;
+  work_size[1] = out_height / 2;
+}
+
+YuvScaler::~YuvScaler() {
+  CL_CHECK(clReleaseKernel(krnl));
+  CL_CHECK(clReleaseKernel(krnl_crop));
+}
+
+void YuvScaler::queue(cl_command_queue q, cl_mem in_yuv_cl, cl_mem out_yuv_cl) {
+  assert(downscale);
+  CL_CHECK(clSetKernelArg(krnl, 0, sizeof(cl_mem), &in_yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl, 1, sizeof(cl_mem), &out_yuv_cl));
+  run(q, krnl);
+}
+
+void YuvScaler::queue_crop(cl_command_queue q, cl_mem in_yuv_cl, cl_mem out_yuv_cl, const Rect &rect, bool mirror) {
+  const int mirror_arg = mirror;
+  CL_CHECK(clSetKernelArg(krnl_crop, 0, sizeof(cl_mem), &in_yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl_crop, 1, sizeof(cl_mem), &out_yuv_cl));
+  CL_CHECK(clSetKernelArg(krnl_crop, 2, sizeof(int), &rect.x));
+  CL_CHECK(clSetKernelArg(krnl_crop, 3, sizeof(int), &rect.y));
+  CL_CHECK(clSetKernelArg(krnl_crop, 4, sizeof(int), &rect.w));
+  CL_CHECK(clSetKernelArg(krnl_crop, 5, sizeof(int), &rect.h));
+  CL_CHECK(clSetKernelArg(krnl_crop, 6, sizeof(int), &mirror_arg));
+  run(q, krnl_crop);
+}
+
+void YuvScaler::run(cl_command_queue q, cl_kernel k) {
+  cl_event event;
+  CL_CHECK(clEnqueueNDRangeKernel(q, k, 2, NULL, &work_size[0], NULL, 0, 0, &event));
+  CL_CHECK(clWaitForEvents(1, &event));
+  CL_CHECK(clReleaseEvent(event));
+}
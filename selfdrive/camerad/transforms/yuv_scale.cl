@@ -0,0 +1,89 @@
+#define IN_UV_WIDTH (IN_WIDTH / 2)
+#define IN_UV_HEIGHT (IN_HEIGHT / 2)
+#define IN_Y_SIZE (IN_WIDTH * IN_HEIGHT)
+#define OUT_UV_WIDTH (OUT_WIDTH / 2)
+#define OUT_UV_HEIGHT (OUT_HEIGHT / 2)
+#define OUT_Y_SIZE (OUT_WIDTH * OUT_HEIGHT)
+
+// Average of the 2x2 source pixels around (x, y), in 16.16 fixed point coordinates
+inline uchar sample(__global uchar const * const plane, int stride, int w, int h, int fx, int fy) {
+  const int x = min(fx >> 16, w - 2);
+  const int y = min(fy >> 16, h - 2);
+  const int i = mad24(y, stride, x);
+  return (convert_ushort(plane[i]) + convert_ushort(plane[i + 1]) +
+          convert_ushort(plane[i + stride]) + convert_ushort(plane[i + stride + 1]) + 2) >> 2;
+}
+
+__kernel void yuv_scale(__global uchar const * const in_yuv,
+                        __global uchar * out_yuv)
+{
+  const int dx = get_global_id(0);
+  const int dy = get_global_id(1);
+
+  const int step_x = (IN_WIDTH << 16) / OUT_WIDTH;
+  const int step_y = (IN_HEIGHT << 16) / OUT_HEIGHT;
+
+  // 2x2 block of Y
+  const int ox = dx * 2, oy = dy * 2;
+  for (int j = 0; j < 2; j++) {
+    for (int i = 0; i < 2; i++) {
+      out_yuv[mad24(oy + j, OUT_WIDTH, ox + i)] =
+        sample(in_yuv, IN_WIDTH, IN_WIDTH, IN_HEIGHT, (ox + i) * step_x, (oy + j) * step_y);
+    }
+  }
+
+  // one U and V sample, the chroma planes scale by the same factor
+  __global uchar const * const in_u = in_yuv + IN_Y_SIZE;
+  __global uchar const * const in_v = in_u + IN_UV_WIDTH * IN_UV_HEIGHT;
+  const int uvi = mad24(dy, OUT_UV_WIDTH, dx);
+  out_yuv[OUT_Y_SIZE + uvi] = sample(in_u, IN_UV_WIDTH, IN_UV_WIDTH, IN_UV_HEIGHT, dx * step_x, dy * step_y);
+  out_yuv[OUT_Y_SIZE + OUT_UV_WIDTH * OUT_UV_HEIGHT + uvi] = sample(in_v, IN_UV_WIDTH, IN_UV_WIDTH, IN_UV_HEIGHT, dx * step_x, dy * step_y);
+}
+
+// Bilinear sample at (fx, fy) in 16.16 fixed point, clamped to the plane
+inline uchar sample_bilinear(__global uchar const * const plane, int stride, int w, int h, int fx, int fy) {
+  fx = clamp(fx, 0, (w - 1) << 16);
+  fy = clamp(fy, 0, (h - 1) << 16);
+  const int x = min(fx >> 16, w - 2);
+  const int y = min(fy >> 16, h - 2);
+  // 8 bit weights keep the products in range
+  const int ax = (fx - (x << 16)) >> 8;
+  const int ay = (fy - (y << 16)) >> 8;
+  const int i = mad24(y, stride, x);
+  const int top = plane[i] * (256 - ax) + plane[i + 1] * ax;
+  const int bottom = plane[i + stride] * (256 - ax) + plane[i + stride + 1] * ax;
+  return (top * (256 - ay) + bottom * ay + 32768) >> 16;
+}
+
+// Scales the rect (rx, ry, rw, rh) of the input to the full output
+__kernel void yuv_crop_scale(__global uchar const * const in_yuv,
+                             __global uchar * out_yuv,
+                             int rx, int ry, int rw, int rh, int mirror)
+{
+  const int dx = get_global_id(0);
+  const int dy = get_global_id(1);
+
+  // pixel centers map to pixel centers, chroma uses the same step on half the coordinates
+  const int step_x = (rw << 16) / OUT_WIDTH;
+  const int step_y = (rh << 16) / OUT_HEIGHT;
+  const int sx = mirror ? OUT_UV_WIDTH - 1 - dx : dx;
+
+  const int ox = dx * 2, oy = dy * 2;
+  const int sox = sx * 2;
+  for (int j = 0; j < 2; j++) {
+    for (int i = 0; i < 2; i++) {
+      const int src_x = mirror ? sox + 1 - i : sox + i;
+      const int fx = (rx << 16) + src_x * step_x + step_x / 2 - 32768;
+      const int fy = (ry << 16) + (oy + j) * step_y + step_y / 2 - 32768;
+      out_yuv[mad24(oy + j, OUT_WIDTH, ox + i)] = sample_bilinear(in_yuv, IN_WIDTH, IN_WIDTH, IN_HEIGHT, fx, fy);
+    }
+  }
+
+  __global uchar const * const in_u = in_yuv + IN_Y_SIZE;
+  __global uchar const * const in_v = in_u + IN_UV_WIDTH * IN_UV_HEIGHT;
+  const int fx = (rx << 15) + sx * step_x + step_x / 2 - 32768;
+  const int fy = (ry << 15) + dy * step_y + step_y / 2 - 32768;
+  const int uvi = mad24(dy, OUT_UV_WIDTH, dx);
+  out_yuv[OUT_Y_SIZE + uvi] = sample_bilinear(in_u, IN_UV_WIDTH, IN_UV_WIDTH, IN_UV_HEIGHT, fx, fy);
+  out_yuv[OUT_Y_SIZE + OUT_UV_WIDTH * OUT_UV_HEIGHT + uvi] = sample_bilinear(in_v, IN_UV_WIDTH, IN_UV_WIDTH, IN_UV_HEIGHT, fx, fy);
+}
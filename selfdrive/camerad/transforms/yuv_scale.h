@@ -0,0 +1,21 @@
+#pragma once
+
+#include "selfdrive/common/clutil.h"
+
+// Resizes an I420 frame into a smaller I420 frame on the GPU
+class YuvScaler {
+public:
+  struct Rect { int x, y, w, h; };
+
+  YuvScaler(cl_context ctx, cl_device_id device_id, int in_width, int in_height, int out_width, int out_height);
+  ~YuvScaler();
+  // whole frame, box filtered. Only for output sizes up to the input size
+  void queue(cl_command_queue q, cl_mem in_yuv_cl, cl_mem out_yuv_cl);
+  // bilinear scale of rect of the input, mirrored horizontally if asked to
+  void queue_crop(cl_command_queue q, cl_mem in_yuv_cl, cl_mem out_yuv_cl, const Rect &rect, bool mirror);
+private:
+  void run(cl_command_queue q, cl_kernel k);
+  bool downscale;
+  size_t work_size[2];
+  cl_kernel krnl, krnl_crop;
+};
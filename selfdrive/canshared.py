@@ -0,0 +1,38 @@
+#!/usr/bin/env python3
+import cereal.messaging as messaging
+from cereal import car
+from common.params import Params
+from common.realtime import config_realtime_process, Priority
+from opendbc.can.parser import CANShareServer
+from selfdrive.car import get_car_dbcs
+from selfdrive.hardware import TICI
+from selfdrive.swaglog import cloudlog
+
+# with the car's DBCs on all of them, for whichever bus each process reads them on
+BUSES = (0, 1, 2)
+
+
+def main():
+  # ahead of the CANParsers reading from it, controlsd's above all
+  config_realtime_process(4 if TICI else 3, Priority.CTRL_HIGH)
+
+  CP = car.CarParams.from_bytes(Params().get("CarParams", block=True))
+  dbc_names = sorted({d for d in get_car_dbcs(CP).values() if d})
+  if not dbc_names:
+    cloudlog.warning(f"canshared: no DBCs for {CP.carFingerprint}")
+    return
+
+  server = CANShareServer([(d, bus) for d in dbc_names for bus in BUSES])
+  cloudlog.info(f"canshared: sharing {dbc_names}")
+
+  can_sock = messaging.sub_sock('can')
+  try:
+    while True:
+      server.update_strings(messaging.drain_sock_raw(can_sock, wait_for_one=True))
+  finally:
+    # the readers go back to parsing the frames themselves
+    server.close()
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+import json
+import os
+
+import cereal.messaging as messaging
+from cereal import car
+from common.params import Params
+from common.realtime import sec_since_boot
+from opendbc import DBC_PATH
+from opendbc.can.dbc import dbc
+from opendbc.can.parser import CANParser
+from selfdrive.car import get_car_dbcs
+from selfdrive.swaglog import cloudlog
+
+# they change with every frame
+SKIPPED_SIGNALS = ("COUNTER", "CHECKSUM", "COUNTER_PEDAL", "CHECKSUM_PEDAL")
+PUBLISH_INTERVAL = 0.5  # s
+
+
+def load_deadbands(params):
+  # CanSignalsDeadbands is {"SIGNAL": deadband, "MESSAGE.SIGNAL": deadband}, the
+  # others are logged on any change and the negative ones not at all
+  try:
+    return json.loads(params.get("CanSignalsDeadbands") or "{}")
+  except ValueError:
+    cloudlog.exception("cansignalsd: bad CanSignalsDeadbands")
+    return {}
+
+
+def main():
+  params = Params()
+  CP = car.CarParams.from_bytes(params.get("CarParams", block=True))
+  dbc_name = get_car_dbcs(CP).get('pt')
+  if dbc_name is None:
+    cloudlog.warning(f"cansignalsd: no powertrain DBC for {CP.carFingerprint}")
+    return
+
+  can_dbc = dbc(os.path.join(DBC_PATH, dbc_name + '.dbc'))
+  deadbands = load_deadbands(params)
+  tracked = []
+  for address, ((msg_name, _), sigs) in can_dbc.msgs.items():
+    for sig in sigs:
+      deadband = deadbands.get(f"{msg_name}.{sig.name}", deadbands.get(sig.name, 0.))
+      if sig.name not in SKIPPED_SIGNALS and deadband >= 0:
+        tracked.append((address, sig.name, deadband))
+
+  cp = CANParser(dbc_name, [(name, address, 0) for address, name, _ in tracked], [], bus=0)
+  for address, name, deadband in tracked:
+    cp.set_deadband(address, name, deadband)
+  cloudlog.info(f"cansignalsd: tracking {len(tracked)} signals of {dbc_name}")
+
+  can_sock = messaging.sub_sock('can')
+  pm = messaging.PubMaster(['canSignals'])
+
+  changes = []
+  last_publish = sec_since_boot()
+  while True:
+    for s in messaging.drain_sock_raw(can_sock, wait_for_one=True):
+      cp.update_string(s)
+      changes += cp.changes()
+
+    now = sec_since_boot()
+    if now - last_publish < PUBLISH_INTERVAL:
+      continue
+    last_publish = now
+
+    dat = messaging.new_message('canSignals')
+    dat.canSignals.dbc = dbc_name
+    dat.canSignals.bus = 0
+    dat.canSignals.changes = [{"address": a, "signal": n, "value": v, "monoTime": t} for a, n, v, t in changes]
+    pm.send('canSignals', dat)
+    changes = []
+
+
+if __name__ == "__main__":
+  main()
@@ -1,4 +1,6 @@
 # functions common among cars
+import importlib
+
 from common.numpy_fast import clip
 
 # kg of standard extra cargo to count for drive, gas, etc...
@@ -44,6 +46,14 @@ def dbc_dict(pt_dbc, radar_dbc, chassis_dbc=None, body_dbc=None):
   return {'pt': pt_dbc, 'radar': radar_dbc, 'chassis': chassis_dbc, 'body': body_dbc}
 
 
+def get_car_dbcs(CP):
+  # the car's dbc_dict, empty for the ones without DBCs
+  try:
+    return importlib.import_module('selfdrive.car.%s.values' % CP.carName).DBC[CP.carFingerprint]
+  except (ImportError, AttributeError, KeyError):
+    return {}
+
+
 def apply_std_steer_torque_limits(apply_torque, apply_torque_last, driver_torque, LIMITS):
 
   # limits due to driver torque
@@ -121,3 +131,9 @@ def create_gas_command(packer, gas_amount, idx):
 
 def make_can_msg(addr, dat, bus):
   return [addr, 0, dat, bus]
+
+
+def priority_msg(msg):
+  """The panda sends msg ahead of the frames of its bus without priority, for the actuator
+  commands that shouldn't wait behind UI and HUD messages"""
+  return msg[:4] + [True]
@@ -1,5 +1,6 @@
 import os
 import json
+import importlib
 import threading
 import requests
 from common.params import Params, put_nonblocking
@@ -12,6 +13,7 @@ from selfdrive.swaglog import cloudlog
 import cereal.messaging as messaging
 from selfdrive.car import gen_empty_fingerprint
 import selfdrive.crash as crash
+from opendbc.can.parser import CANParser
 
 from cereal import car
 EventName = car.CarEvent.EventName
@@ -234,3 +236,10 @@ def get_car(logcan, sendcan):
     put_nonblocking("dp_sr_custom", '9.99')
     put_nonblocking("dp_sr_stock", '9.99')
     return None, None
+
+
+def get_can_rx_filter(CI, CP):
+  # the messages the parsers of the car and radar interfaces read, radard has its own radar interface
+  RadarInterface = importlib.import_module('selfdrive.car.%s.radar_interface' % CP.carName).RadarInterface
+  parsers = [p for obj in (CI, RadarInterface(CP)) for p in vars(obj).values() if isinstance(p, CANParser)]
+  return sorted({(p.bus, addr) for p in parsers for addr in p.addresses})
@@ -260,8 +260,7 @@ class CarInterface(CarInterfaceBase):
     return ret
 
   def update(self, c, can_strings, dragonconf):
-    self.cp.update_strings(can_strings)
-    self.cp_cam.update_strings(can_strings)
+    self.can_parsers.update_strings(can_strings)
 
     ret = self.CS.update(self.cp, self.cp_cam)
     # dp
@@ -5,6 +5,7 @@ from typing import Dict
 from cereal import car
 from common.kalman.simple_kalman import KF1D
 from common.realtime import DT_CTRL
+from opendbc.can.parser import MultiBusCANParser
 from selfdrive.car import gen_empty_fingerprint
 from selfdrive.config import Conversions as CV
 from selfdrive.controls.lib.drive_helpers import V_CRUISE_MAX
@@ -41,6 +42,7 @@ class CarInterfaceBase():
       self.cp = self.CS.get_can_parser(CP)
       self.cp_cam = self.CS.get_cam_can_parser(CP)
       self.cp_body = self.CS.get_body_can_parser(CP)
+      self.can_parsers = self.multi_bus_parser(self.cp, self.cp_cam, self.cp_body)
 
     self.CC = None
     if CarController is not None:
@@ -48,6 +50,11 @@ class CarInterfaceBase():
 
     self.dragonconf = None
 
+  @staticmethod
+  def multi_bus_parser(*parsers):
+    # the car's parsers all read each can_strings message in one pass
+    return MultiBusCANParser([cp for cp in parsers if cp is not None])
+
   @staticmethod
   def get_pid_accel_limits(CP, current_speed, cruise_speed):
     return ACCEL_MIN, ACCEL_MAX
@@ -14,13 +14,67 @@
 
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
 
 #include "cereal/messaging/messaging.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/time_sync.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
 ExitHandler do_exit;
 
+// a jump larger than this is the clock being set, not drift
+#define CLOCK_STEP_NS (50 * 1000000LL)
+// drift is the slope of the offset over at least DRIFT_MIN_S, and at most about twice DRIFT_WINDOW_S
+#define DRIFT_MIN_S 10
+#define DRIFT_WINDOW_S 600
+// GPS fixes older than this don't count
+#define GPS_TIMEOUT_NS (2 * 1000000000ULL)
+
+// The offset of a clock from the boot clock and its drift. Samples that only
+// have ms resolution or jitter (GPS) are low passed with alpha < 1.
+class ClockOffset {
+ public:
+  ClockOffset(double alpha) : alpha(alpha) {}
+
+  void update(uint64_t boot, int64_t sample) {
+    if (!valid || std::llabs(sample - at(boot)) > CLOCK_STEP_NS) {
+      if (valid) LOGW("clock stepped by %.3f s", (sample - at(boot)) * 1e-9);
+      valid = true;
+      offset = anchor_offset = sample;
+      last_boot = anchor_boot = boot;
+      drift_ppm = 0;
+      return;
+    }
+
+    offset = at(boot) + (int64_t)(alpha * (sample - at(boot)));
+    last_boot = boot;
+    const double baseline = (boot - anchor_boot) * 1e-9;
+    if (baseline >= DRIFT_MIN_S) {
+      drift_ppm = (offset - anchor_offset) * 1e-3 / baseline;
+    }
+    if (baseline >= 2 * DRIFT_WINDOW_S) {
+      anchor_boot = boot - DRIFT_WINDOW_S * 1000000000ULL;
+      anchor_offset = offset - (int64_t)(drift_ppm * DRIFT_WINDOW_S * 1e3);
+    }
+  }
+
+  int64_t at(uint64_t boot) const {
+    return time_sync_extrapolate(offset, drift_ppm, last_boot, boot);
+  }
+
+  bool valid = false;
+  int64_t offset = 0;
+  double drift_ppm = 0;
+
+ private:
+  const double alpha;
+  uint64_t last_boot = 0;
+  uint64_t anchor_boot = 0;
+  int64_t anchor_offset = 0;
+};
+
 #ifdef QCOM
 namespace {
   int64_t arm_cntpct() {
@@ -34,6 +88,10 @@ namespace {
 int main() {
   setpriority(PRIO_PROCESS, 0, -13);
   PubMaster pm({"clocks"});
+  SubMaster sm({"gpsLocationExternal"});
+
+  ClockOffset wall(1.), gps(0.1);
+  uint64_t last_gps = 0;
 
 #ifndef __APPLE__
   int timerfd = timerfd_create(CLOCK_BOOTTIME, 0);
@@ -69,6 +127,28 @@ int main() {
     uint64_t modem_uptime_v = arm_cntpct() / 19200ULL; // 19.2 mhz clock
 #endif
 
+    // the GPS time is of the fix, the message comes a roughly constant latency after it
+    sm.update(0);
+    if (sm.updated("gpsLocationExternal")) {
+      auto fix = sm["gpsLocationExternal"].getGpsLocationExternal();
+      if ((fix.getFlags() % 2) && fix.getUnixTimestampMillis() > 0) {
+        last_gps = sm["gpsLocationExternal"].getLogMonoTime();
+        gps.update(last_gps, fix.getUnixTimestampMillis() * 1000000LL - (int64_t)last_gps);
+      }
+    }
+    const bool gps_valid = gps.valid && boottime - last_gps < GPS_TIMEOUT_NS;
+    wall.update(boottime, (int64_t)wall_time - (int64_t)boottime);
+
+    TimeSync ts;
+    time_sync_read(&ts);
+    ts.ref_boot_ns = boottime;
+    ts.wall_offset_ns = wall.offset;
+    ts.wall_drift_ppm = wall.drift_ppm;
+    ts.gps_valid = gps_valid;
+    ts.gps_offset_ns = gps.at(boottime);
+    ts.gps_drift_ppm = gps.drift_ppm;
+    time_sync_write(ts);
+
     MessageBuilder msg;
     auto clocks = msg.initEvent().initClocks();
 
@@ -79,6 +159,17 @@ int main() {
 #ifdef QCOM
     clocks.setModemUptimeMillis(modem_uptime_v);
 #endif
+    clocks.setWallOffsetNanos(wall.offset);
+    clocks.setWallDriftPpm(wall.drift_ppm);
+    clocks.setGpsValid(gps_valid);
+    if (gps_valid) {
+      clocks.setGpsOffsetNanos(ts.gps_offset_ns);
+      clocks.setGpsDriftPpm(gps.drift_ppm);
+    }
+    clocks.setRtcValid(ts.rtc_valid);
+    if (ts.rtc_valid) {
+      clocks.setRtcSkewNanos(ts.rtc_skew_ns);
+    }
 
     pm.send("clocks", msg);
   }
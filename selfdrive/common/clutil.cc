@@ -1,6 +1,8 @@
 #include "selfdrive/common/clutil.h"
 
+#include <dirent.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <cstring>
@@ -56,6 +58,112 @@ void cl_print_build_errors(cl_program program, cl_device_id device) {
   std::cout << "build failed; status=" << status << ", log:" << std::endl << log << std::endl; 
 }
 
+// Built programs are cached under CL_CACHE_DIR, one file per source file.
+// The key is the source, the build args and the device and driver versions,
+// a file with another key is stale and gets replaced on the next build
+#define CL_CACHE_MAGIC 0x48434c43  // "CLCH"
+
+struct CacheHeader {
+  uint32_t magic;
+  uint32_t key_size;
+  uint64_t binary_size;
+  uint64_t binary_hash;
+};
+
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ ((const uint8_t *)data)[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::string cache_dir() {
+  std::string dir = util::getenv("CL_CACHE_DIR");
+  if (dir.empty()) {
+#if defined(QCOM) || defined(QCOM2)
+    dir = "/data/clcache";
+#else
+    dir = util::getenv("HOME") + "/.comma/clcache";
+#endif
+  }
+  return dir;
+}
+
+std::string cache_key(cl_device_id device_id, const std::string &src, const char *args) {
+  return get_device_info(device_id, CL_DEVICE_NAME) + "\n" + get_device_info(device_id, CL_DEVICE_VERSION) + "\n" +
+         get_device_info(device_id, CL_DRIVER_VERSION) + "\n" + (args ? args : "") + "\n" + src;
+}
+
+std::string cache_path(const char *path, const std::string &key) {
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)fnv1a(key.data(), key.size()));
+  return cache_dir() + "/" + util::base_name(path) + "." + hash + ".bin";
+}
+
+cl_program cache_load(cl_context ctx, cl_device_id device_id, const std::string &file, const std::string &key, const char *args) {
+  std::string dat = util::read_file(file);
+  if (dat.size() < sizeof(CacheHeader)) return NULL;
+
+  CacheHeader header;
+  memcpy(&header, dat.data(), sizeof(header));
+  const char *binary = dat.data() + sizeof(header) + header.key_size;
+  if (header.magic != CL_CACHE_MAGIC || dat.size() != sizeof(header) + header.key_size + header.binary_size ||
+      dat.compare(sizeof(header), header.key_size, key) != 0 || fnv1a(binary, header.binary_size) != header.binary_hash) {
+    std::cout << "clcache: " << file << " is invalid" << std::endl;
+    unlink(file.c_str());
+    return NULL;
+  }
+
+  const size_t binary_size = header.binary_size;
+  const unsigned char *binaries[] = {(const unsigned char *)binary};
+  cl_int err, status;
+  cl_program prg = clCreateProgramWithBinary(ctx, 1, &device_id, &binary_size, binaries, &status, &err);
+  if (err == CL_SUCCESS && status == CL_SUCCESS) {
+    err = clBuildProgram(prg, 1, &device_id, args, NULL, NULL);
+  }
+  if (err != CL_SUCCESS || status != CL_SUCCESS) {
+    std::cout << "clcache: " << file << " doesn't load: " << cl_get_error_string(err != CL_SUCCESS ? err : status) << std::endl;
+    if (prg) clReleaseProgram(prg);
+    unlink(file.c_str());
+    return NULL;
+  }
+  return prg;
+}
+
+void cache_save(cl_program prg, const char *path, const std::string &file, const std::string &key) {
+  size_t binary_size = 0;
+  if (clGetProgramInfo(prg, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL) != CL_SUCCESS || binary_size == 0) return;
+
+  CacheHeader header = {CL_CACHE_MAGIC, (uint32_t)key.size(), binary_size, 0};
+  std::string dat(sizeof(header) + key.size() + binary_size, '\0');
+  unsigned char *binary = (unsigned char *)&dat[sizeof(header) + key.size()];
+  if (clGetProgramInfo(prg, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) != CL_SUCCESS) return;
+  header.binary_hash = fnv1a(binary, binary_size);
+  memcpy(&dat[0], &header, sizeof(header));
+  memcpy(&dat[sizeof(header)], key.data(), key.size());
+
+  // drop what the older versions of this file built
+  const std::string dir = cache_dir(), prefix = util::base_name(path) + ".";
+  if (DIR *d = opendir(dir.c_str())) {
+    while (struct dirent *e = readdir(d)) {
+      const std::string name = e->d_name;
+      if (name.compare(0, prefix.size(), prefix) == 0 && dir + "/" + name != file) {
+        unlink((dir + "/" + name).c_str());
+      }
+    }
+    closedir(d);
+  } else {
+    mkdir(dir.c_str(), 0775);
+  }
+
+  // other processes may be reading it, so it's replaced in one go
+  const std::string tmp = file + ".tmp" + std::to_string(getpid());
+  if (util::write_file(tmp.c_str(), dat.data(), dat.size(), O_WRONLY | O_CREAT | O_TRUNC) != 0 || rename(tmp.c_str(), file.c_str()) != 0) {
+    std::cout << "clcache: failed to write " << file << std::endl;
+    unlink(tmp.c_str());
+  }
+}
+
 }  // namespace
 
 cl_device_id cl_get_device_id(cl_device_type device_type) {
@@ -80,11 +188,20 @@ cl_device_id cl_get_device_id(cl_device_type device_type) {
 cl_program cl_program_from_file(cl_context ctx, cl_device_id device_id, const char* path, const char* args) {
   std::string src = util::read_file(path);
   assert(src.length() > 0);
+
+  const bool use_cache = util::getenv("CL_CACHE", 1) != 0;
+  const std::string key = use_cache ? cache_key(device_id, src, args) : "";
+  const std::string file = use_cache ? cache_path(path, key) : "";
+  if (use_cache) {
+    if (cl_program prg = cache_load(ctx, device_id, file, key, args)) return prg;
+  }
+
   cl_program prg = CL_CHECK_ERR(clCreateProgramWithSource(ctx, 1, (const char*[]){src.c_str()}, NULL, &err));
   if (int err = clBuildProgram(prg, 1, &device_id, args, NULL, NULL); err != 0) {
     cl_print_build_errors(prg, device_id);
     assert(0);
   }
+  if (use_cache) cache_save(prg, path, file, key);
   return prg;
 }
 
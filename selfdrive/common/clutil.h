@@ -23,5 +23,7 @@
   })
 
 cl_device_id cl_get_device_id(cl_device_type device_type);
+// builds the program from a file, or loads what the last build of the same
+// source, args and driver left in the cache. CL_CACHE=0 always builds
 cl_program cl_program_from_file(cl_context ctx, cl_device_id device_id, const char* path, const char* args);
 const char* cl_get_error_string(int err);
@@ -8,6 +8,7 @@
   #define GPIO_UBLOX_PWR_EN     34
   #define GPIO_STM_RST_N        124
   #define GPIO_STM_BOOT0        134
+  #define GPIO_LSM_INT          84
 #else
   #define GPIO_HUB_RST_N        0
   #define GPIO_UBLOX_RST_N      0
@@ -15,7 +16,14 @@
   #define GPIO_UBLOX_PWR_EN     0
   #define GPIO_STM_RST_N        0
   #define GPIO_STM_BOOT0        0
+  #define GPIO_LSM_INT          0
 #endif
 
 int gpio_init(int pin_nr, bool output);
 int gpio_set(int pin_nr, bool high);
+// edge is "none", "rising", "falling" or "both". poll() on the value file
+// wakes with POLLPRI on those
+int gpio_set_edge(int pin_nr, const char *edge);
+// fd of the value file, for gpio_get and poll()
+int gpio_open(int pin_nr);
+int gpio_get(int fd);
@@ -13,5 +13,7 @@ class I2CBus {
     ~I2CBus();
 
     int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len);
+    // len bytes from register_address on in a single transaction, not limited to an SMBus block
+    int read_burst(uint8_t device_address, uint register_address, uint8_t *buffer, uint16_t len);
     int set_register(uint8_t device_address, uint register_address, uint8_t data);
 };
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+// Shared state of loadgovd, the load governor. Under thermal, GPU or deadline
+// pressure it raises the level, and the daemons drop the optional work at or
+// below it, in this order. Critical paths aren't on the list, they keep their
+// deadlines while these degrade.
+//
+// Daemons with deadlines report how many they meet with a LoadDeadline, the
+// governor looks at the fraction missed.
+#define LOAD_GOVERNOR_PATH "/dev/shm/load_governor"
+#define LOAD_GOVERNOR_MAGIC 0x44564f47  // "GOVD"
+#define LOAD_GOVERNOR_MAX_DEADLINES 32
+
+enum class LoadShed : uint32_t {
+  NONE = 0,
+  UI_EFFECTS,        // animations and such in the UI
+  RGB_STREAMS,       // RGB camera streams that only the UI uses, at half rate
+  QCAMERA,           // qcamera at half rate
+  DMONITORING_RATE,  // driver monitoring model at half rate
+  SHADOW_MODELS,     // shadow driving models off
+  MAX = SHADOW_MODELS,
+};
+
+struct LoadDeadlineSlot {
+  std::atomic<uint32_t> state;  // 0 free, 1 being claimed, 2 in use
+  char name[28];
+  std::atomic<uint64_t> cycles;
+  std::atomic<uint64_t> misses;
+};
+
+struct LoadGovernorState {
+  uint32_t magic;
+  std::atomic<uint32_t> level;
+  LoadDeadlineSlot deadlines[LOAD_GOVERNOR_MAX_DEADLINES];
+};
+
+// Zero filled when made, which is level NONE. NULL where there's no shared
+// memory, nothing is ever shed then.
+inline LoadGovernorState *load_governor() {
+  static LoadGovernorState *state = []() -> LoadGovernorState * {
+    int fd = open(LOAD_GOVERNOR_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) return nullptr;
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, sizeof(LoadGovernorState)) == 0) {
+      mem = mmap(NULL, sizeof(LoadGovernorState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED) return nullptr;
+    ((LoadGovernorState *)mem)->magic = LOAD_GOVERNOR_MAGIC;
+    return (LoadGovernorState *)mem;
+  }();
+  return state;
+}
+
+static inline uint32_t load_level() {
+  LoadGovernorState *s = load_governor();
+  return s != nullptr ? s->level.load(std::memory_order_relaxed) : 0;
+}
+
+// true if the work should be skipped right now
+static inline bool load_shed(LoadShed work) {
+  return load_level() >= (uint32_t)work;
+}
+
+// Counts the deadlines of one loop under name. A daemon that restarts gets the same slot back.
+class LoadDeadline {
+public:
+  LoadDeadline(const char *name) {
+    LoadGovernorState *s = load_governor();
+    if (s == nullptr) return;
+
+    for (int pass = 0; pass < 2 && slot == nullptr; pass++) {
+      for (auto &d : s->deadlines) {
+        uint32_t state = d.state.load(std::memory_order_acquire);
+        if (state == 2 && strncmp(d.name, name, sizeof(d.name) - 1) == 0) {
+          slot = &d;
+          break;
+        }
+        // claim a free one only once it's clear there's no slot with the name
+        if (pass == 1 && state == 0 && d.state.compare_exchange_strong(state, 1)) {
+          strncpy(d.name, name, sizeof(d.name) - 1);
+          d.state.store(2, std::memory_order_release);
+          slot = &d;
+          break;
+        }
+      }
+    }
+  }
+
+  void add(uint64_t cycles, uint64_t misses = 0) {
+    if (slot == nullptr) return;
+    slot->cycles.fetch_add(cycles, std::memory_order_relaxed);
+    if (misses > 0) slot->misses.fetch_add(misses, std::memory_order_relaxed);
+  }
+
+private:
+  LoadDeadlineSlot *slot = nullptr;
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+// Counters, gauges and histograms for the native daemons. They live in
+// /dev/shm/metrics_<pid>, proclogd reads every process' file and publishes
+// them as daemonMetrics at 1 Hz. Recording is a relaxed atomic add on a per
+// thread shard, nothing is formatted or sent by the daemon itself.
+//
+//   static metrics::Counter &sent = metrics::counter("can_sent");
+//   sent.add(n);
+//   static metrics::Histogram &latency = metrics::histogram("usb_latency_us");
+//   latency.record(us);
+//
+// Names are unique per process, asking for a name again returns the same metric.
+
+namespace metrics {
+
+const int NAME_SIZE = 48;
+const int MAX_COUNTERS = 64;
+const int MAX_GAUGES = 64;
+const int MAX_HISTOGRAMS = 16;
+const int COUNTER_SHARDS = 8;
+const int HISTOGRAM_SHARDS = 4;
+
+// log-linear buckets: values below 8 exactly, above that 8 per power of two
+// (12.5% wide) up to 2^41, larger values go in the last bucket
+const int SUB_BUCKETS = 8;
+const int MAX_EXPONENT = 41;
+const int HISTOGRAM_BUCKETS = (MAX_EXPONENT - 1) * SUB_BUCKETS;
+
+const std::string SHM_PREFIX = "/dev/shm/metrics_";  // + <pid>
+const uint32_t SHM_MAGIC = 0x6d657431;
+
+inline int bucket_index(uint64_t v) {
+  if (v < SUB_BUCKETS) return v;
+  int e = 63 - __builtin_clzll(v);
+  if (e > MAX_EXPONENT) return HISTOGRAM_BUCKETS - 1;
+  return (e - 2) * SUB_BUCKETS + ((v >> (e - 3)) & (SUB_BUCKETS - 1));
+}
+
+// the smallest value of bucket i
+inline uint64_t bucket_value(int i) {
+  if (i < SUB_BUCKETS) return i;
+  int e = i / SUB_BUCKETS + 2;
+  return (uint64_t)(SUB_BUCKETS + i % SUB_BUCKETS) << (e - 3);
+}
+
+// spreads threads over the shards
+inline int thread_shard() {
+  static std::atomic<int> next_shard = 0;
+  thread_local int shard = next_shard++;
+  return shard;
+}
+
+class Counter {
+public:
+  void add(uint64_t n = 1) { shards[thread_shard() % COUNTER_SHARDS].value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const {
+    uint64_t sum = 0;
+    for (auto &s : shards) sum += s.value.load(std::memory_order_relaxed);
+    return sum;
+  }
+
+  char name[NAME_SIZE];
+
+private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value;
+  } shards[COUNTER_SHARDS];
+};
+
+class Gauge {
+public:
+  void set(double v) { value_.store(v, std::memory_order_relaxed); }
+  double value() const { return value_.load(std::memory_order_relaxed); }
+
+  char name[NAME_SIZE];
+
+private:
+  std::atomic<double> value_;
+};
+
+class Histogram {
+public:
+  void record(uint64_t v) {
+    Shard &s = shards[thread_shard() % HISTOGRAM_SHARDS];
+    s.buckets[bucket_index(v)].fetch_add(1, std::memory_order_relaxed);
+    s.sum.fetch_add(v, std::memory_order_relaxed);
+  }
+
+  // the totals since the process started, summed over the shards
+  void read(uint64_t buckets[HISTOGRAM_BUCKETS], uint64_t &sum) const {
+    memset(buckets, 0, HISTOGRAM_BUCKETS * sizeof(uint64_t));
+    sum = 0;
+    for (auto &s : shards) {
+      for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        buckets[i] += s.buckets[i].load(std::memory_order_relaxed);
+      }
+      sum += s.sum.load(std::memory_order_relaxed);
+    }
+  }
+
+  char name[NAME_SIZE];
+
+private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+  } shards[HISTOGRAM_SHARDS];
+};
+
+// the layout of /dev/shm/metrics_<pid>. a metric is written before its count
+// is raised, readers only look at the first num_* of each kind
+struct Registry {
+  uint32_t magic;
+  std::atomic<uint32_t> num_counters, num_gauges, num_histograms;
+  Counter counters[MAX_COUNTERS];
+  Gauge gauges[MAX_GAUGES];
+  Histogram histograms[MAX_HISTOGRAMS];
+};
+
+namespace detail {
+
+struct Shm {
+  Registry *registry = nullptr;
+  std::string path;
+  std::mutex lock;
+
+  Shm() {
+    path = SHM_PREFIX + std::to_string(getpid());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0 && ftruncate(fd, sizeof(Registry)) == 0) {
+      void *p = mmap(nullptr, sizeof(Registry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      registry = p != MAP_FAILED ? (Registry *)p : nullptr;
+    }
+    if (fd >= 0) close(fd);
+    if (!registry) {
+      // nobody will see the metrics, but recording them still works
+      path.clear();
+      registry = (Registry *)mmap(nullptr, sizeof(Registry), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    registry->magic = SHM_MAGIC;
+  }
+  ~Shm() {
+    if (!path.empty()) unlink(path.c_str());
+  }
+};
+
+inline Shm &shm() {
+  static Shm shm;
+  return shm;
+}
+
+template <typename T, int N>
+T &get(T (&metrics)[N], std::atomic<uint32_t> &num, const char *name) {
+  static T overflow;  // shared by the names that didn't fit, never published
+  Shm &s = shm();
+  std::lock_guard lk(s.lock);
+  uint32_t n = num.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < n; i++) {
+    if (strncmp(metrics[i].name, name, NAME_SIZE - 1) == 0) return metrics[i];
+  }
+  if (n == N) return overflow;
+  strncpy(metrics[n].name, name, NAME_SIZE - 1);
+  num.store(n + 1, std::memory_order_release);
+  return metrics[n];
+}
+
+}  // namespace detail
+
+inline Counter &counter(const char *name) {
+  Registry *r = detail::shm().registry;
+  return detail::get(r->counters, r->num_counters, name);
+}
+
+inline Gauge &gauge(const char *name) {
+  Registry *r = detail::shm().registry;
+  return detail::get(r->gauges, r->num_gauges, name);
+}
+
+inline Histogram &histogram(const char *name) {
+  Registry *r = detail::shm().registry;
+  return detail::get(r->histograms, r->num_histograms, name);
+}
+
+}  // namespace metrics
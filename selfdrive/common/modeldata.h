@@ -48,4 +48,34 @@ static inline mat3 get_model_yuv_transform(bool bayer = true) {
   return bayer ? transform_scale_buffer(transform, db_s) : transform;
 }
 
+// Input of the driver monitoring model. camerad crops the driver camera and scales it
+// to this size on VISION_STREAM_YUV_FRONT_ROI
+const int DM_INPUT_WIDTH = 320;
+const int DM_INPUT_HEIGHT = 640;
+
+struct DMCropRect { int x, y, w, h; };
+
+static inline DMCropRect get_driver_crop_rect(int width, int height, bool is_rhd) {
+  DMCropRect rect;
+  if (Hardware::TICI()) {
+    const int full_width_tici = 1928;
+    const int full_height_tici = 1208;
+    const int adapt_width_tici = 668;
+    const int cropped_height = adapt_width_tici / 1.33;
+    rect = {full_width_tici / 2 - adapt_width_tici / 2,
+            full_height_tici / 2 - cropped_height / 2 - 196,
+            cropped_height / 2,
+            cropped_height};
+    if (!is_rhd) {
+      rect.x += adapt_width_tici - rect.w + 32;
+    }
+  } else {
+    rect = {0, 0, height / 2, height};
+    if (!is_rhd) {
+      rect.x += width - rect.w;
+    }
+  }
+  return rect;
+}
+
 #endif
@@ -5,18 +5,27 @@
 #endif  // _GNU_SOURCE
 
 #include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <chrono>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 
@@ -128,8 +137,12 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"ApiCache_Owner", PERSISTENT},
     {"ApiCache_NavDestinations", PERSISTENT},
     {"AthenadPid", PERSISTENT},
+    {"AthenadActiveTime", CLEAR_ON_MANAGER_START},
     {"CalibrationParams", PERSISTENT},
+    {"CanFullCapture", PERSISTENT},
+    {"CanSignalsDeadbands", PERSISTENT},
     {"CarBatteryCapacity", PERSISTENT},
+    {"CarDBCs", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT | CLEAR_ON_IGNITION_ON},
     {"CarParams", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT | CLEAR_ON_IGNITION_ON},
     {"CarParamsCache", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT},
     {"CarVin", CLEAR_ON_MANAGER_START | CLEAR_ON_PANDA_DISCONNECT | CLEAR_ON_IGNITION_ON},
@@ -142,6 +155,7 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"DisablePowerDown", PERSISTENT},
     {"DisableUpdates", PERSISTENT},
     {"EnableWideCamera", CLEAR_ON_MANAGER_START},
+    {"EncoderProfiles", PERSISTENT},
     {"DoUninstall", CLEAR_ON_MANAGER_START},
     {"DongleId", PERSISTENT},
     {"GitDiff", PERSISTENT},
@@ -168,6 +182,8 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"LastUpdateException", PERSISTENT},
     {"LastUpdateTime", PERSISTENT},
     {"LiveParameters", PERSISTENT},
+    {"LogModelCompact", PERSISTENT},
+    {"ModelIORecordFrames", CLEAR_ON_MANAGER_START},
     {"MapboxToken", PERSISTENT | DONT_LOG},
     {"NavDestination", CLEAR_ON_MANAGER_START | CLEAR_ON_IGNITION_OFF},
     {"NavSettingTime24h", PERSISTENT},
@@ -178,9 +194,12 @@ std::unordered_map<std::string, uint32_t> keys = {
     {"PandaHeartbeatLost", CLEAR_ON_MANAGER_START | CLEAR_ON_IGNITION_OFF},
     {"Passive", PERSISTENT},
     {"PrimeRedirected", PERSISTENT},
+    {"RecordColumns", PERSISTENT},
     {"RecordFront", PERSISTENT},
     {"RecordFrontLock", PERSISTENT},  // for the internal fleet
     {"ReleaseNotes", PERSISTENT},
+    {"ShadowModelInterval", PERSISTENT},
+    {"ShadowModelPath", PERSISTENT},
     {"ShouldDoUpdate", CLEAR_ON_MANAGER_START},
     {"ShowDebugUI", PERSISTENT},
     {"SpeedLimitControl", PERSISTENT},
@@ -297,13 +316,278 @@ std::unordered_map<std::string, uint32_t> keys = {
 
 } // namespace
 
+// Values of the params shared by all processes in /dev/shm, one slot per key.
+// Writers update a slot under the params lock after the file is in place, a
+// seqlock lets readers copy it without taking any lock. Slots start out
+// unknown and are filled from disk by the first reader.
+// Scripts write the files without Params, so a slot also has the version of
+// the file it was filled from, and is only used while the file is still that
+class ParamsCache {
+public:
+  static std::shared_ptr<ParamsCache> get(const std::string &params_path);
+  ParamsCache(const std::string &params_path);
+  ~ParamsCache();
+
+  // a version of a value file: a rename gives a new inode, a write in place a new mtime or size
+  struct FileId {
+    uint64_t ino;  // 0 without a file
+    int64_t mtime_ns;
+    int64_t size;
+    bool operator==(const FileId &other) const {
+      return ino == other.ino && mtime_ns == other.mtime_ns && size == other.size;
+    }
+  };
+  static FileId file_id(const struct stat &st) {
+    return {(uint64_t)st.st_ino, st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec, (int64_t)st.st_size};
+  }
+
+  enum Lookup { HIT, ON_DISK, UNKNOWN };
+  // the value if the slot of key has one of file. Otherwise it's read from
+  // disk, and an unknown or outdated slot can then be filled
+  Lookup read(const char *key, const FileId &file, std::string &value);
+  // fill a slot with what a reader found on disk, under the shared params lock
+  void fill(const char *key, const FileId &file, const std::string &value);
+  // a put or remove of key, under the exclusive params lock
+  void store(const char *key, const FileId &file, const char *value, size_t size, bool present);
+
+private:
+  enum : uint32_t { SLOT_UNKNOWN = 0, SLOT_ABSENT, SLOT_PRESENT, SLOT_ON_DISK };
+  static const size_t VALUE_SIZE = 220;
+  struct Slot {
+    std::atomic<uint32_t> seq;  // odd while it's written
+    uint32_t state;
+    FileId file;
+    uint32_t size;
+    char value[VALUE_SIZE];
+  };
+  struct Header {
+    uint64_t dir_ino;  // of the values directory the slots are of
+    uint32_t num_slots;
+    uint32_t slot_size;  // 0 in a cache of an older layout
+  };
+
+  int slot_index(const char *key);
+  bool lock_slot(Slot &slot, uint32_t expected_seq, bool wait);
+  void write_slot(Slot &slot, uint32_t state, const FileId &file, const char *value, size_t size);
+
+  Header *header = nullptr;
+  Slot *slots = nullptr;
+  size_t mem_size = 0;
+};
+
+namespace {
+
+// the keys by name, the slot of a key is its index. Processes only share a
+// cache when they know the same keys, the name has a hash of them
+const std::vector<std::string> &sorted_keys() {
+  static const std::vector<std::string> sorted = []() {
+    std::vector<std::string> v;
+    for (auto &[key, type] : keys) v.push_back(key);
+    std::sort(v.begin(), v.end());
+    return v;
+  }();
+  return sorted;
+}
+
+uint64_t fnv1a(const std::string &s, uint64_t h = 14695981039346656037ULL) {
+  for (unsigned char c : s) {
+    h = (h ^ c) * 1099511628211ULL;
+  }
+  return h;
+}
+
+// the value in path and the version of the file it's from, false when the
+// file changed while it was read
+bool read_param_file(const std::string &path, std::string &value, ParamsCache::FileId &file) {
+  value.clear();
+  file = {};
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) return errno == ENOENT;
+
+  struct stat before = {}, after = {};
+  bool ok = fstat(fd, &before) == 0;
+  char buf[4096];
+  ssize_t n;
+  while (ok && (n = HANDLE_EINTR(::read(fd, buf, sizeof(buf)))) != 0) {
+    if (n < 0) ok = false;
+    else value.append(buf, n);
+  }
+  ok = ok && fstat(fd, &after) == 0 && ParamsCache::file_id(before) == ParamsCache::file_id(after);
+  close(fd);
+  file = ParamsCache::file_id(after);
+  return ok;
+}
+
+} // namespace
+
+std::shared_ptr<ParamsCache> ParamsCache::get(const std::string &params_path) {
+  static std::mutex lock;
+  static std::map<std::string, std::weak_ptr<ParamsCache>> caches;
+
+  std::lock_guard lk(lock);
+  std::shared_ptr<ParamsCache> cache = caches[params_path].lock();
+  if (!cache) {
+    cache = std::make_shared<ParamsCache>(params_path);
+    if (!cache->slots) cache = nullptr;
+    caches[params_path] = cache;
+  }
+  return cache;
+}
+
+ParamsCache::ParamsCache(const std::string &params_path) {
+  uint64_t h = fnv1a(params_path);
+  for (const std::string &key : sorted_keys()) h = fnv1a(key, h);
+  const std::string shm_path = util::string_format("/dev/shm/params_cache_%016llx", (unsigned long long)h);
+
+  const size_t num_slots = sorted_keys().size();
+  mem_size = sizeof(Header) + num_slots * sizeof(Slot);
+  int fd = HANDLE_EINTR(open(shm_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0664));
+  if (fd < 0) {
+    LOGW("No params cache at %s, errno=%d", shm_path.c_str(), errno);
+    return;
+  }
+  // a new file is all zeroes: every slot unknown
+  void *mem = MAP_FAILED;
+  if (ftruncate(fd, mem_size) == 0) {
+    mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) {
+    LOGW("Failed to map params cache %s, errno=%d", shm_path.c_str(), errno);
+    return;
+  }
+  header = (Header *)mem;
+  slots = (Slot *)((char *)mem + sizeof(Header));
+
+  // the values directory was replaced, e.g. by a test, since the slots were filled
+  struct stat st;
+  std::string dir = params_path + "/d";
+  auto outdated = [&]() {
+    return header->dir_ino != st.st_ino || header->num_slots != num_slots || header->slot_size != sizeof(Slot);
+  };
+  if (stat(dir.c_str(), &st) == 0 && outdated()) {
+    FileLock file_lock(params_path + "/.lock", LOCK_EX);
+    std::lock_guard<FileLock> lk(file_lock);
+    if (outdated()) {
+      for (size_t i = 0; i < num_slots; i++) {
+        lock_slot(slots[i], 0, true);
+        write_slot(slots[i], SLOT_UNKNOWN, {}, nullptr, 0);
+      }
+      header->num_slots = num_slots;
+      header->slot_size = sizeof(Slot);
+      header->dir_ino = st.st_ino;
+    }
+  }
+}
+
+ParamsCache::~ParamsCache() {
+  if (header) munmap(header, mem_size);
+}
+
+int ParamsCache::slot_index(const char *key) {
+  const std::vector<std::string> &sorted = sorted_keys();
+  auto it = std::lower_bound(sorted.begin(), sorted.end(), key);
+  return (it != sorted.end() && *it == key) ? it - sorted.begin() : -1;
+}
+
+// takes the slot for writing if its seq is still expected_seq, or whatever it
+// is with wait. A writer that died halfway leaves it odd, that's waited out.
+// Writers hold a slot for a copy, a longer wait yields and then sleeps so a
+// preempted writer gets the cpu back
+bool ParamsCache::lock_slot(Slot &slot, uint32_t expected_seq, bool wait) {
+  for (int spins = 0;; spins++) {
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    if (!wait && seq != expected_seq) return false;
+    if ((seq & 1) && spins > 2000) {  // ~50 ms
+      std::atomic_thread_fence(std::memory_order_release);
+      return true;
+    }
+    if (!(seq & 1) && slot.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+      std::atomic_thread_fence(std::memory_order_release);
+      return true;
+    }
+    if (spins >= 1000) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    } else if (spins >= 100) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ParamsCache::write_slot(Slot &slot, uint32_t state, const FileId &file, const char *value, size_t size) {
+  if (state == SLOT_PRESENT && size > VALUE_SIZE) {
+    state = SLOT_ON_DISK;
+  }
+  slot.state = state;
+  slot.file = file;
+  slot.size = state == SLOT_PRESENT ? size : 0;
+  if (slot.size > 0) memcpy(slot.value, value, size);
+  slot.seq.fetch_add(1, std::memory_order_release);
+}
+
+ParamsCache::Lookup ParamsCache::read(const char *key, const FileId &file, std::string &value) {
+  int i = slot_index(key);
+  if (i < 0) return ON_DISK;
+
+  Slot &slot = slots[i];
+  char buf[VALUE_SIZE];
+  for (int tries = 0; tries < 100; tries++) {
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1) continue;
+    uint32_t state = slot.state;
+    FileId slot_file = slot.file;
+    uint32_t size = std::min<uint32_t>(slot.size, VALUE_SIZE);
+    memcpy(buf, slot.value, size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+
+    if (state == SLOT_UNKNOWN || !(slot_file == file)) {
+      return UNKNOWN;
+    } else if (state == SLOT_PRESENT) {
+      value.assign(buf, size);
+      return HIT;
+    } else if (state == SLOT_ABSENT) {
+      value.clear();
+      return HIT;
+    }
+    return ON_DISK;
+  }
+  return ON_DISK;
+}
+
+void ParamsCache::fill(const char *key, const FileId &file, const std::string &value) {
+  int i = slot_index(key);
+  if (i < 0) return;
+
+  // only an unknown or outdated slot, and not when another reader is at it
+  Slot &slot = slots[i];
+  auto stale = [&]() { return slot.state == SLOT_UNKNOWN || !(slot.file == file); };
+  uint32_t seq = slot.seq.load(std::memory_order_acquire);
+  if ((seq & 1) || !stale() || !lock_slot(slot, seq, false)) return;
+  if (!stale()) {
+    slot.seq.fetch_add(1, std::memory_order_release);
+    return;
+  }
+  write_slot(slot, value.empty() ? SLOT_ABSENT : SLOT_PRESENT, file, value.data(), value.size());
+}
+
+void ParamsCache::store(const char *key, const FileId &file, const char *value, size_t size, bool present) {
+  int i = slot_index(key);
+  if (i < 0) return;
+
+  lock_slot(slots[i], 0, true);
+  write_slot(slots[i], present ? SLOT_PRESENT : SLOT_ABSENT, file, value, size);
+}
+
 Params::Params() : params_path(Path::params()) {
   static std::once_flag once_flag;
   std::call_once(once_flag, ensure_params_path, params_path);
+  cache = ParamsCache::get(params_path);
 }
 
 Params::Params(const std::string &path) : params_path(path) {
   ensure_params_path(params_path);
+  cache = ParamsCache::get(params_path);
 }
 
 bool Params::checkKey(const std::string &key) {
@@ -336,6 +620,9 @@ int Params::put(const char* key, const char* value, size_t value_size) {
 
     // fsync to force persist the changes.
     if ((result = fsync(tmp_fd)) < 0) break;
+    // the rename keeps the inode and mtime the cache knows the value by
+    struct stat st = {};
+    fstat(tmp_fd, &st);
 
     FileLock file_lock(params_path + "/.lock", LOCK_EX);
     std::lock_guard<FileLock> lk(file_lock);
@@ -343,6 +630,7 @@ int Params::put(const char* key, const char* value, size_t value_size) {
     // Move temp into place.
     std::string path = params_path + "/d/" + std::string(key);
     if ((result = rename(tmp_path.c_str(), path.c_str())) < 0) break;
+    if (cache) cache->store(key, ParamsCache::file_id(st), value, value_size, true);
 
     // fsync parent directory
     path = params_path + "/d";
@@ -354,12 +642,77 @@ int Params::put(const char* key, const char* value, size_t value_size) {
   return result;
 }
 
+int Params::put_many(const std::map<std::string, std::string> &values) {
+  // like put, but every value is staged and synced before the first one is
+  // moved into place, then the renames go under one lock and one directory fsync
+  std::vector<std::pair<std::string, int>> tmp_files;
+  auto cleanup = [&]() {
+    for (auto &[tmp_path, fd] : tmp_files) {
+      close(fd);
+      ::unlink(tmp_path.c_str());
+    }
+  };
+
+  for (auto &[key, value] : values) {
+    std::string tmp_path = params_path + "/.tmp_value_XXXXXX";
+    int tmp_fd = mkstemp((char*)tmp_path.c_str());
+    if (tmp_fd < 0) {
+      cleanup();
+      return -1;
+    }
+    tmp_files.push_back({tmp_path, tmp_fd});
+
+    ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value.data(), value.size()));
+    if (bytes_written < 0 || (size_t)bytes_written != value.size()) {
+      cleanup();
+      return -20;
+    }
+  }
+  std::vector<ParamsCache::FileId> files;
+  for (auto &[tmp_path, fd] : tmp_files) {
+    if (int result = fsync(fd); result < 0) {
+      cleanup();
+      return result;
+    }
+    struct stat st = {};
+    fstat(fd, &st);
+    files.push_back(ParamsCache::file_id(st));
+  }
+
+  int result = 0;
+  {
+    FileLock file_lock(params_path + "/.lock", LOCK_EX);
+    std::lock_guard<FileLock> lk(file_lock);
+
+    // a rename only fails on a broken params directory, which the fsync reports as well
+    auto tmp = tmp_files.begin();
+    for (auto &[key, value] : values) {
+      std::string path = params_path + "/d/" + key;
+      if (rename(tmp->first.c_str(), path.c_str()) < 0) {
+        result = -1;
+      } else if (cache) {
+        cache->store(key.c_str(), files[tmp - tmp_files.begin()], value.data(), value.size(), true);
+      }
+      ++tmp;
+    }
+
+    std::string path = params_path + "/d";
+    if (int r = fsync_dir(path.c_str()); r < 0) result = r;
+  }
+
+  cleanup();
+  return result;
+}
+
 int Params::remove(const char *key) {
   FileLock file_lock(params_path + "/.lock", LOCK_EX);
   std::lock_guard<FileLock> lk(file_lock);
   // Delete value.
   std::string path = params_path + "/d/" + key;
   int result = unlink(path.c_str());
+  if (result == 0 || errno == ENOENT) {
+    if (cache) cache->store(key, {}, nullptr, 0, false);
+  }
   if (result != 0) {
     return result;
   }
@@ -371,19 +724,45 @@ int Params::remove(const char *key) {
 std::string Params::get(const char *key, bool block) {
   std::string path = params_path + "/d/" + key;
   if (!block) {
-    return util::read_file(path);
+    if (!cache) return util::read_file(path);
+
+    // a stat is what tells a cached value from one a script wrote since
+    std::string value;
+    struct stat st;
+    ParamsCache::FileId file = stat(path.c_str(), &st) == 0 ? ParamsCache::file_id(st) : ParamsCache::FileId{};
+    ParamsCache::Lookup lookup = cache->read(key, file, value);
+    if (lookup == ParamsCache::HIT) {
+      return value;
+    } else if (lookup == ParamsCache::ON_DISK) {
+      return util::read_file(path);
+    }
+    // nothing can be put while the file is read under the lock, so what's read can go into the cache.
+    // A script writing it meanwhile changes its version, then it's left for the next reader
+    FileLock file_lock(params_path + "/.lock", LOCK_SH);
+    std::lock_guard<FileLock> lk(file_lock);
+    if (read_param_file(path, value, file)) {
+      cache->fill(key, file, value);
+    }
+    return value;
   } else {
-    // blocking read until successful
+    // blocking read until successful, woken up by the put. The watch is there
+    // before the first read so a put in between isn't missed
     params_do_exit = 0;
     void (*prev_handler_sigint)(int) = std::signal(SIGINT, params_sig_handler);
     void (*prev_handler_sigterm)(int) = std::signal(SIGTERM, params_sig_handler);
 
+    ParamsWatcher watcher(params_path, {key});
     std::string value;
     while (!params_do_exit) {
       if (value = util::read_file(path); !value.empty()) {
         break;
       }
-      util::sleep_for(100);  // 0.1 s
+      // a signal before the wait starts doesn't interrupt it, don't wait forever
+      if (watcher.fd() >= 0) {
+        watcher.wait(1000);
+      } else {
+        util::sleep_for(100);  // 0.1 s
+      }
     }
 
     std::signal(SIGINT, prev_handler_sigint);
@@ -392,6 +771,58 @@ std::string Params::get(const char *key, bool block) {
   }
 }
 
+std::optional<int64_t> Params::parseInt(const std::string &value) {
+  if (value.empty()) return std::nullopt;
+  char *end = nullptr;
+  errno = 0;
+  long long v = strtoll(value.c_str(), &end, 10);
+  if (errno != 0 || end == value.c_str() || (*end != '\0' && *end != '\n')) return std::nullopt;
+  return v;
+}
+
+std::optional<double> Params::parseFloat(const std::string &value) {
+  if (value.empty()) return std::nullopt;
+  char *end = nullptr;
+  double v = strtod(value.c_str(), &end);
+  if (end == value.c_str() || (*end != '\0' && *end != '\n')) return std::nullopt;
+  return v;
+}
+
+int Params::putFloat(const char *key, double val) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%.17g", val);
+  return put(key, buf, len);
+}
+
+std::unique_ptr<ParamsMapping> Params::map(const char *key) {
+  std::string path = params_path + "/d/" + key;
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  return data == MAP_FAILED ? nullptr : std::make_unique<ParamsMapping>(data, st.st_size);
+}
+
+ParamsMapping::~ParamsMapping() {
+  munmap(data_, size_);
+}
+
+std::unique_ptr<ParamsWatch> Params::watch(const std::vector<std::string> &keys,
+                                           std::function<void(const std::string &key)> f) {
+  return std::make_unique<ParamsWatch>(params_path, keys, f);
+}
+
+std::string Params::wait_for_change(const std::vector<std::string> &keys, int timeout_ms) {
+  ParamsWatcher watcher(params_path, keys);
+  std::vector<std::string> changed = watcher.wait(timeout_ms);
+  return changed.empty() ? "" : changed[0];
+}
+
 std::map<std::string, std::string> Params::readAll() {
   FileLock file_lock(params_path + "/.lock", LOCK_SH);
   std::lock_guard<FileLock> lk(file_lock);
@@ -409,6 +840,7 @@ void Params::clearAll(ParamKeyType key_type) {
     if (type & key_type) {
       path = params_path + "/d/" + key;
       unlink(path.c_str());
+      if (cache) cache->store(key.c_str(), {}, nullptr, 0, false);
     }
   }
 
@@ -420,3 +852,141 @@ void Params::clearAll(ParamKeyType key_type) {
 std::string Params::get_params_path() {
   return params_path;
 }
+
+ParamsWatcher::ParamsWatcher(const std::string &params_path, const std::vector<std::string> &keys) : keys(keys) {
+  // values are renamed into place by put and unlinked by remove
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0) {
+    LOGE("Failed to init params watch, errno=%d", errno);
+    return;
+  }
+  std::string path = params_path + "/d";
+  if (inotify_add_watch(inotify_fd, path.c_str(), IN_MOVED_TO | IN_DELETE) < 0) {
+    LOGE("Failed to watch %s, errno=%d", path.c_str(), errno);
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+}
+
+ParamsWatcher::~ParamsWatcher() {
+  if (inotify_fd >= 0) close(inotify_fd);
+}
+
+std::vector<std::string> ParamsWatcher::changed() {
+  std::vector<std::string> ret;
+  if (inotify_fd < 0) return ret;
+
+  alignas(struct inotify_event) char buf[4096];
+  ssize_t len;
+  while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      if (event->len == 0) continue;
+      std::string key(event->name);
+      if ((keys.empty() || std::find(keys.begin(), keys.end(), key) != keys.end()) &&
+          std::find(ret.begin(), ret.end(), key) == ret.end()) {
+        ret.push_back(key);
+      }
+    }
+  }
+  return ret;
+}
+
+std::vector<std::string> ParamsWatcher::wait(int timeout_ms) {
+  if (inotify_fd < 0) {
+    if (timeout_ms > 0) util::sleep_for(timeout_ms);
+    return {};
+  }
+
+  const double deadline = millis_since_boot() + timeout_ms;
+  while (true) {
+    struct pollfd pfd = {.fd = inotify_fd, .events = POLLIN};
+    int remaining = timeout_ms < 0 ? -1 : std::max(0, (int)(deadline - millis_since_boot()));
+    if (poll(&pfd, 1, remaining) <= 0) return {};
+
+    // other params in the directory wake it up too
+    std::vector<std::string> ret = changed();
+    if (!ret.empty()) return ret;
+  }
+}
+
+ParamsWatch::ParamsWatch(const std::string &params_path, const std::vector<std::string> &keys,
+                         std::function<void(const std::string &key)> f) : watcher(params_path, keys) {
+  stop_fd = eventfd(0, EFD_CLOEXEC);
+  thread = std::thread([=]() {
+    set_thread_name("params_watch");
+    struct pollfd fds[] = {{.fd = stop_fd, .events = POLLIN}, {.fd = watcher.fd(), .events = POLLIN}};
+    while (HANDLE_EINTR(poll(fds, watcher.fd() >= 0 ? 2 : 1, -1)) > 0 && !(fds[0].revents & POLLIN)) {
+      for (const std::string &key : watcher.changed()) {
+        f(key);
+      }
+    }
+  });
+}
+
+ParamsWatch::~ParamsWatch() {
+  uint64_t one = 1;
+  write(stop_fd, &one, sizeof(one));
+  thread.join();
+  close(stop_fd);
+}
+
+ParamsWriter::ParamsWriter(size_t max_keys) : max_keys(max_keys) {
+  thread = std::thread(&ParamsWriter::writer_thread, this);
+}
+
+ParamsWriter::ParamsWriter(const std::string &path, size_t max_keys) : params(path), max_keys(max_keys) {
+  thread = std::thread(&ParamsWriter::writer_thread, this);
+}
+
+ParamsWriter::~ParamsWriter() {
+  {
+    std::lock_guard lk(lock);
+    exit = true;
+  }
+  cv.notify_all();
+  thread.join();
+}
+
+bool ParamsWriter::put(const std::string &key, const std::string &value) {
+  {
+    std::lock_guard lk(lock);
+    auto it = pending.find(key);
+    if (it != pending.end()) {
+      it->second = value;
+    } else if (pending.size() < max_keys) {
+      pending.emplace(key, value);
+    } else {
+      return false;
+    }
+    queued++;
+  }
+  cv.notify_all();
+  return true;
+}
+
+void ParamsWriter::flush() {
+  std::unique_lock lk(lock);
+  const uint64_t target = queued;
+  cv.wait(lk, [&]() { return written >= target; });
+}
+
+void ParamsWriter::writer_thread() {
+  set_thread_name("params_writer");
+  std::unique_lock lk(lock);
+  while (true) {
+    cv.wait(lk, [&]() { return exit || !pending.empty(); });
+    if (pending.empty()) break;
+
+    std::map<std::string, std::string> values;
+    values.swap(pending);
+    const uint64_t done = queued;
+    lk.unlock();
+    if (params.put_many(values) != 0) {
+      LOGE("Failed to write %zu params", values.size());
+    }
+    lk.lock();
+    written = done;
+    cv.notify_all();
+  }
+}
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <type_traits>
+#include <thread>
+#include <vector>
 
 enum ParamKeyType {
   PERSISTENT = 0x02,
@@ -14,6 +22,53 @@ enum ParamKeyType {
   ALL = 0xFFFFFFFF
 };
 
+// Watches params for puts and removes through inotify, keys are all of them
+// when empty. fd() goes into a poll loop, readable when there are changes
+class ParamsWatcher {
+public:
+  ParamsWatcher(const std::string &params_path, const std::vector<std::string> &keys = {});
+  ~ParamsWatcher();
+
+  int fd() const { return inotify_fd; }
+  // the keys that changed since the last call, without blocking
+  std::vector<std::string> changed();
+  // blocks until keys change, for up to timeout_ms when it's not -1. Empty on
+  // a timeout or a signal
+  std::vector<std::string> wait(int timeout_ms = -1);
+
+private:
+  int inotify_fd = -1;
+  std::vector<std::string> keys;
+};
+
+// A thread calling f(key) for the changes of a ParamsWatcher, until it's destroyed
+class ParamsWatch {
+public:
+  ParamsWatch(const std::string &params_path, const std::vector<std::string> &keys,
+              std::function<void(const std::string &key)> f);
+  ~ParamsWatch();
+
+private:
+  ParamsWatcher watcher;
+  int stop_fd;
+  std::thread thread;
+};
+
+class ParamsCache;
+
+class ParamsMapping {
+public:
+  ParamsMapping(void *data, size_t size) : data_(data), size_(size) {}
+  ~ParamsMapping();
+
+  const char *data() const { return (const char *)data_; }
+  size_t size() const { return size_; }
+
+private:
+  void *data_;
+  size_t size_;
+};
+
 class Params {
 public:
   Params();
@@ -49,10 +104,21 @@ public:
 
   template <class T>
   std::optional<T> get(const char *key, bool block = false) {
-    std::istringstream iss(get(key, block));
-    T value{};
-    iss >> value;
-    return iss.fail() ? std::nullopt : std::optional(value);
+    if constexpr (std::is_same_v<T, bool>) {
+      std::string value = get(key, block);
+      return value.empty() ? std::nullopt : std::optional(value == "1");
+    } else if constexpr (std::is_integral_v<T>) {
+      auto value = parseInt(get(key, block));
+      return value ? std::optional((T)*value) : std::nullopt;
+    } else if constexpr (std::is_floating_point_v<T>) {
+      auto value = parseFloat(get(key, block));
+      return value ? std::optional((T)*value) : std::nullopt;
+    } else {
+      std::istringstream iss(get(key, block));
+      T value{};
+      iss >> value;
+      return iss.fail() ? std::nullopt : std::optional(value);
+    }
   }
 
   inline bool getBool(const std::string &key) {
@@ -63,6 +129,31 @@ public:
     return get(key) == "1";
   }
 
+  // values are stored as text for python and the shell, these parse them
+  // without a stream. nullopt when missing or not a number
+  inline std::optional<int64_t> getInt(const char *key) {
+    return parseInt(get(key));
+  }
+
+  inline std::optional<double> getFloat(const char *key) {
+    return parseFloat(get(key));
+  }
+
+  static std::optional<int64_t> parseInt(const std::string &value);
+  static std::optional<double> parseFloat(const std::string &value);
+
+  // the value mapped from its file, null when there's none. The mapping is
+  // page aligned, so capnp messages are read in place without a copy, and
+  // stays the same value when the param is put again
+  std::unique_ptr<ParamsMapping> map(const char *key);
+
+  // f(key) on a thread of its own for every change of keys, all of them when
+  // empty, for as long as the returned watch lives
+  std::unique_ptr<ParamsWatch> watch(const std::vector<std::string> &keys,
+                                     std::function<void(const std::string &key)> f);
+  // the first of keys that changes, "" after timeout_ms when it's not -1
+  std::string wait_for_change(const std::vector<std::string> &keys, int timeout_ms = -1);
+
   // helpers for writing values
   int put(const char* key, const char* val, size_t value_size);
 
@@ -70,6 +161,9 @@ public:
     return put(key.c_str(), val.data(), val.size());
   }
 
+  // writes all of values or none of them, with one fsync of the directory
+  int put_many(const std::map<std::string, std::string> &values);
+
   inline int putBool(const char *key, bool val) {
     return put(key, val ? "1" : "0", 1);
   }
@@ -78,8 +172,45 @@ public:
     return putBool(key.c_str(), val);
   }
 
+  inline int putInt(const char *key, int64_t val) {
+    return put(key, std::to_string(val));
+  }
+
+  int putFloat(const char *key, double val);
+
   inline std::string get_params_path();
 
 private:
   const std::string params_path;
+  std::shared_ptr<ParamsCache> cache;  // null without /dev/shm
+};
+
+// Writes params on a thread of its own, so realtime threads never wait on the
+// filesystem. A put replaces a value of the same key that's still queued, and
+// returns false when max_keys other keys are. What's queued is written with
+// put_many, the destructor writes what's left
+class ParamsWriter {
+public:
+  ParamsWriter(size_t max_keys = 64);
+  ParamsWriter(const std::string &path, size_t max_keys = 64);
+  ~ParamsWriter();
+
+  bool put(const std::string &key, const std::string &value);
+  inline bool putBool(const std::string &key, bool val) {
+    return put(key, val ? "1" : "0");
+  }
+  // blocks until everything put so far is written
+  void flush();
+
+private:
+  void writer_thread();
+
+  Params params;
+  const size_t max_keys;
+  std::mutex lock;
+  std::condition_variable cv;
+  std::map<std::string, std::string> pending;
+  uint64_t queued = 0, written = 0;  // puts, to tell flush when they're done
+  bool exit = false;
+  std::thread thread;
 };
@@ -0,0 +1,54 @@
+#include "selfdrive/common/ratekeeper.h"
+
+#include <cerrno>
+#include <ctime>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/watchdog.h"
+
+RateKeeper::RateKeeper(const std::string &name, float rate, bool kick_watchdog)
+    : interval(1e9 / rate), kick_watchdog(kick_watchdog),
+      jitter(metrics::histogram((name + "_jitter_us").c_str())),
+      overruns(metrics::counter((name + "_overruns").c_str())),
+      deadline(name.c_str()) {
+  next_time = nanos_monotonic() + interval;
+}
+
+int64_t RateKeeper::remaining() const {
+  return (int64_t)(next_time - nanos_monotonic());
+}
+
+bool RateKeeper::keepTime() {
+  bool lagged = remaining() < 0;
+  if (!lagged && !sim_clock_sleep_until(next_time)) {
+    struct timespec ts = {.tv_sec = (time_t)(next_time / 1000000000ULL), .tv_nsec = (long)(next_time % 1000000000ULL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+  }
+  return endCycle(nanos_monotonic()) || lagged;
+}
+
+bool RateKeeper::monitorTime() {
+  return endCycle(nanos_monotonic());
+}
+
+bool RateKeeper::endCycle(uint64_t now) {
+  frame_++;
+  if (kick_watchdog && now - last_kick > 1000000000ULL) {
+    watchdog_kick();
+    last_kick = now;
+  }
+
+  bool lagged = now >= next_time + interval;
+  if (lagged) {
+    // skip the cycles that were missed
+    const uint64_t missed = (now - next_time) / interval;
+    overruns.add(missed);
+    deadline.add(missed + 1, missed);
+    next_time = now + interval;
+  } else {
+    jitter.record(now > next_time ? (now - next_time) / 1000 : 0);
+    deadline.add(1);
+    next_time += interval;
+  }
+  return lagged;
+}
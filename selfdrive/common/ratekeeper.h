@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "selfdrive/common/load_governor.h"
+#include "selfdrive/common/metrics.h"
+
+// Keeps a loop at a fixed rate, like Ratekeeper in common/realtime.py.
+// Cycles start on a fixed grid of absolute deadlines, so the work done in a
+// cycle doesn't add to the period. A cycle that ends a whole period late
+// counts the cycles it missed as overruns and restarts the grid.
+//
+// How late each cycle starts goes into the <name>_jitter_us histogram and the
+// missed cycles into the <name>_overruns counter of daemonMetrics. Both are
+// also counted for the load governor, see load_governor.h.
+class RateKeeper {
+public:
+  // with kick_watchdog the manager's watchdog is kicked once a second
+  RateKeeper(const std::string &name, float rate, bool kick_watchdog = false);
+
+  // sleeps until the next cycle, returns whether this one overran it
+  bool keepTime();
+  // ends the cycle for loops that waited on something else until remaining()
+  // ran out, returns whether it overran
+  bool monitorTime();
+
+  // ns until the next cycle starts, negative when it's late
+  int64_t remaining() const;
+  uint64_t frame() const { return frame_; }
+
+private:
+  bool endCycle(uint64_t now);
+
+  const uint64_t interval;
+  const bool kick_watchdog;
+  uint64_t next_time;
+  uint64_t last_kick = 0;
+  uint64_t frame_ = 0;
+  metrics::Histogram &jitter;
+  metrics::Counter &overruns;
+  LoadDeadline deadline;
+};
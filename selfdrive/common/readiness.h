@@ -0,0 +1,141 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+
+// Startup readiness of the daemons. Each one reports the phases of its init
+// as it goes through them and when it's ready, the manager reads all of them
+// and publishes them in managerState, with the time from going onroad to
+// everything being ready. selfdrive/manager/readiness.py has the same layout.
+//
+// A slot per daemon name, claimed under a lock on the file and kept across
+// restarts. Its writer updates it under seq, odd while writing.
+#define READINESS_PATH "/dev/shm/readiness"
+#define READINESS_SLOTS 64
+#define READINESS_MAX_PHASES 7
+
+enum ReadinessState : uint32_t {
+  READINESS_FREE = 0,
+  READINESS_INITIALIZING = 1,
+  READINESS_READY = 2,
+};
+
+struct ReadinessPhase {
+  char name[16];
+  uint64_t duration_ns;
+};
+
+struct ReadinessSlot {
+  uint32_t used;
+  std::atomic<uint32_t> seq;
+  int32_t pid;
+  uint32_t state;
+  char name[32];
+  uint64_t start_ns;  // boot clock
+  uint64_t ready_ns;
+  uint32_t num_phases;
+  uint32_t reserved;
+  ReadinessPhase phases[READINESS_MAX_PHASES];
+  uint8_t padding[16];
+};
+static_assert(sizeof(ReadinessSlot) == 256);
+
+class Readiness {
+public:
+  // the daemon starts initializing now, call it first thing
+  explicit Readiness(const char *name) : start_ns(nanos_since_boot()), phase_start_ns(start_ns) {
+    strncpy(this->name, name, sizeof(this->name) - 1);
+    const size_t size = sizeof(ReadinessSlot) * READINESS_SLOTS;
+    int fd = open(READINESS_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) return;
+
+    flock(fd, LOCK_EX);
+    void *mem = ftruncate(fd, size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (mem != MAP_FAILED) {
+      ReadinessSlot *slots = (ReadinessSlot *)mem;
+      ReadinessSlot *free_slot = nullptr;
+      for (int i = 0; i < READINESS_SLOTS && slot == nullptr; i++) {
+        if (slots[i].used && strncmp(slots[i].name, name, sizeof(slots[i].name) - 1) == 0) slot = &slots[i];
+        if (!slots[i].used && free_slot == nullptr) free_slot = &slots[i];
+      }
+      if (slot == nullptr && free_slot != nullptr) {
+        slot = free_slot;
+        strncpy(slot->name, name, sizeof(slot->name) - 1);
+        slot->used = 1;
+      }
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    if (slot == nullptr) {
+      LOGE("no readiness slot for %s", name);
+      return;
+    }
+    update([&](ReadinessSlot *s) {
+      s->pid = getpid();
+      s->state = READINESS_INITIALIZING;
+      s->start_ns = start_ns;
+      s->ready_ns = 0;
+      s->num_phases = 0;
+    });
+  }
+
+  // ends the phase before, the time until now counts towards it
+  void phase(const char *phase_name) {
+    end_phase();
+    strncpy(current, phase_name, sizeof(current) - 1);
+  }
+
+  void ready() {
+    end_phase();
+    const uint64_t now = nanos_since_boot();
+    update([&](ReadinessSlot *s) {
+      s->state = READINESS_READY;
+      s->ready_ns = now;
+    });
+    LOGW("%s ready in %.1f ms", name, (now - start_ns) * 1e-6);
+  }
+
+private:
+  template <typename F>
+  void update(F f) {
+    if (slot == nullptr) return;
+    const uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+    slot->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    f(slot);
+    slot->seq.store(seq + 2, std::memory_order_release);
+  }
+
+  void end_phase() {
+    const uint64_t now = nanos_since_boot();
+    if (current[0] != '\0') {
+      LOGD("%s: %s took %.1f ms", name, current, (now - phase_start_ns) * 1e-6);
+      update([&](ReadinessSlot *s) {
+        if (s->num_phases < READINESS_MAX_PHASES) {
+          ReadinessPhase &p = s->phases[s->num_phases++];
+          memset(p.name, 0, sizeof(p.name));
+          strncpy(p.name, current, sizeof(p.name) - 1);
+          p.duration_ns = now - phase_start_ns;
+        }
+      });
+    }
+    current[0] = '\0';
+    phase_start_ns = now;
+  }
+
+  ReadinessSlot *slot = nullptr;
+  const uint64_t start_ns;
+  uint64_t phase_start_ns;
+  char name[32] = {};
+  char current[16] = {};
+};
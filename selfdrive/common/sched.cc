@@ -0,0 +1,191 @@
+#include "selfdrive/common/sched.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include "json11.hpp"
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#ifndef __USE_GNU
+#define __USE_GNU
+#endif
+#include <sched.h>
+#endif  // __linux__
+
+typedef std::map<std::string, ThreadSched> SchedTable;
+
+// Camera and model threads stay off the core servicing the USB/CAN interrupts,
+// which is where boardd runs.
+static SchedTable default_table() {
+  if (Hardware::EON()) {
+    return {
+      {"boardd/main", {{3}, SCHED_FIFO, 54}},
+      {"camerad/main", {{2}, SCHED_FIFO, 53}},
+      {"camerad/RoadCamera", {{2}, SCHED_FIFO, 53}},
+      {"camerad/DriverCamera", {{2}, SCHED_FIFO, 53}},
+      {"modeld/main", {{2}, SCHED_FIFO, 54}},
+      {"modeld/prepare", {{2}, SCHED_FIFO, 53}},
+      {"modeld/publish", {{2}, SCHED_FIFO, 52}},
+      {"modeld/calibration", {{2}, SCHED_FIFO, 50}},
+      {"modeld/shadow", {{0, 1}, SCHED_OTHER, 10}},
+      {"loggerd/main", {{0, 1, 2}, SCHED_OTHER, -20}},
+      {"loggerd/compress", {{0, 1}, SCHED_OTHER, -10}},
+    };
+  } else if (Hardware::TICI()) {
+    return {
+      {"boardd/main", {{4}, SCHED_FIFO, 54}},
+      {"camerad/main", {{6}, SCHED_FIFO, 53}},
+      {"camerad/RoadCamera", {{6}, SCHED_FIFO, 53}},
+      {"camerad/DriverCamera", {{6}, SCHED_FIFO, 53}},
+      {"camerad/WideRoadCamera", {{6}, SCHED_FIFO, 53}},
+      {"modeld/main", {{7}, SCHED_FIFO, 54}},
+      {"modeld/prepare", {{7}, SCHED_FIFO, 53}},
+      {"modeld/publish", {{7}, SCHED_FIFO, 52}},
+      {"modeld/calibration", {{7}, SCHED_FIFO, 50}},
+      {"modeld/shadow", {{0, 1, 2, 3, 5}, SCHED_OTHER, 10}},
+      {"loggerd/main", {{0, 1, 2, 3, 5, 6, 7}, SCHED_OTHER, -20}},
+      {"loggerd/compress", {{0, 1, 2, 3, 5}, SCHED_OTHER, -10}},
+    };
+  } else if (Hardware::JETSON()) {
+    return {
+      {"boardd/main", {{2}, SCHED_FIFO, 54}},
+      {"camerad/main", {{0}, SCHED_FIFO, 53}},
+      {"camerad/RoadCamera", {{0}, SCHED_FIFO, 53}},
+      {"modeld/main", {{1}, SCHED_FIFO, 54}},
+      {"modeld/prepare", {{1}, SCHED_FIFO, 53}},
+      {"modeld/publish", {{1}, SCHED_FIFO, 52}},
+      {"modeld/calibration", {{1}, SCHED_FIFO, 50}},
+      {"modeld/shadow", {{0, 2}, SCHED_OTHER, 10}},
+      {"loggerd/main", {{}, SCHED_OTHER, -20}},
+      {"loggerd/compress", {{}, SCHED_OTHER, -10}},
+    };
+  }
+  return {
+    {"boardd/main", {{3}, SCHED_FIFO, 54}},
+    {"camerad/main", {{}, SCHED_FIFO, 53}},
+    {"modeld/main", {{}, SCHED_FIFO, 54}},
+    {"modeld/prepare", {{}, SCHED_FIFO, 53}},
+    {"modeld/publish", {{}, SCHED_FIFO, 52}},
+    {"modeld/calibration", {{}, SCHED_FIFO, 50}},
+    {"modeld/shadow", {{}, SCHED_OTHER, 10}},
+    {"loggerd/main", {{}, SCHED_OTHER, -20}},
+    {"loggerd/compress", {{}, SCHED_OTHER, -10}},
+  };
+}
+
+static int parse_policy(const std::string &name) {
+  if (name == "fifo") return SCHED_FIFO;
+  if (name == "rr") return SCHED_RR;
+  if (name == "other") return SCHED_OTHER;
+  return -1;
+}
+
+static const char *policy_name(int policy) {
+  switch (policy) {
+    case SCHED_FIFO: return "fifo";
+    case SCHED_RR: return "rr";
+    case SCHED_OTHER: return "other";
+    default: return "?";
+  }
+}
+
+static void load_overrides(SchedTable &table, const char *path) {
+  std::string content = util::read_file(path);
+  if (content.empty()) {
+    LOGE("sched: can't read %s", path);
+    return;
+  }
+
+  std::string err;
+  auto json = json11::Json::parse(content, err);
+  if (!err.empty()) {
+    LOGE("sched: failed to parse %s: %s", path, err.c_str());
+    return;
+  }
+
+  for (auto &[key, v] : json.object_items()) {
+    ThreadSched ts = {};
+    for (auto &core : v["cores"].array_items()) {
+      ts.cores.push_back(core.int_value());
+    }
+    ts.policy = parse_policy(v["policy"].string_value());
+    ts.priority = v["priority"].int_value();
+    if (ts.policy < 0) {
+      LOGE("sched: bad policy for %s", key.c_str());
+      continue;
+    }
+    table[key] = ts;
+  }
+}
+
+static const SchedTable &sched_table() {
+  static const SchedTable table = []() {
+    SchedTable t = default_table();
+    if (const char *path = getenv("SCHED_CONFIG")) {
+      load_overrides(t, path);
+    }
+    return t;
+  }();
+  return table;
+}
+
+int sched_apply(const char *process, const char *thread) {
+#ifdef __linux__
+  const std::string key = std::string(process) + "/" + thread;
+  const long tid = syscall(SYS_gettid);
+  int ret = 0;
+
+  auto &table = sched_table();
+  if (auto it = table.find(key); it != table.end()) {
+    const ThreadSched &ts = it->second;
+    if (!ts.cores.empty()) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      for (int core : ts.cores) CPU_SET(core, &cpus);
+      if (sched_setaffinity(tid, sizeof(cpus), &cpus) != 0) {
+        LOGE("sched: %s affinity failed: %s", key.c_str(), strerror(errno));
+        ret = -1;
+      }
+    }
+
+    struct sched_param sp = {};
+    sp.sched_priority = ts.policy == SCHED_OTHER ? 0 : ts.priority;
+    if (sched_setscheduler(tid, ts.policy, &sp) != 0) {
+      LOGE("sched: %s policy failed: %s", key.c_str(), strerror(errno));
+      ret = -1;
+    }
+    if (ts.policy == SCHED_OTHER && setpriority(PRIO_PROCESS, tid, ts.priority) != 0) {
+      LOGE("sched: %s nice failed: %s", key.c_str(), strerror(errno));
+      ret = -1;
+    }
+  }
+
+  // report the effective placement, whether it came from the table or not
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  sched_getaffinity(tid, sizeof(cpus), &cpus);
+  std::string cores;
+  for (int i = 0; i < CPU_SETSIZE; i++) {
+    if (CPU_ISSET(i, &cpus)) cores += (cores.empty() ? "" : ",") + std::to_string(i);
+  }
+
+  const int policy = sched_getscheduler(tid);
+  struct sched_param sp = {};
+  sched_getparam(tid, &sp);
+  const int priority = policy == SCHED_OTHER ? getpriority(PRIO_PROCESS, tid) : sp.sched_priority;
+  LOGW("sched: %s tid %ld cores %s policy %s priority %d", key.c_str(), tid, cores.c_str(), policy_name(policy), priority);
+  return ret;
+#else
+  return -1;
+#endif
+}
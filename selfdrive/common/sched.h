@@ -0,0 +1,17 @@
+#pragma once
+
+#include <vector>
+
+// Placement of one thread. An empty core list keeps the inherited affinity,
+// priority is the SCHED_FIFO/SCHED_RR priority or the nice value for SCHED_OTHER.
+struct ThreadSched {
+  std::vector<int> cores;
+  int policy;
+  int priority;
+};
+
+// Applies what the placement table lists for the calling thread and logs where it
+// ended up. The built-in table per device can be overridden by a json file at
+// $SCHED_CONFIG: {"camerad/RoadCamera": {"cores": [6], "policy": "fifo", "priority": 53}}.
+// Threads missing from the table keep the settings they inherited.
+int sched_apply(const char *process, const char *thread);
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// push never blocks, a consumer waiting in try_pop sleeps on a futex and is only
+// woken with a syscall when it actually waits.
+template <class T, size_t N>
+class SPSCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "size must be a power of two");
+
+public:
+  SPSCQueue() = default;
+
+  // Returns false if the queue is full
+  bool push(const T& v) {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N) return false;
+
+    buf[h & (N - 1)] = v;
+    head.store(h + 1, std::memory_order_seq_cst);
+
+    if (waiting.load(std::memory_order_seq_cst)) {
+      waiting.store(false, std::memory_order_relaxed);
+      wake();
+    }
+    return true;
+  }
+
+  bool try_pop(T& v, int timeout_ms = 0) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t h = head.load(std::memory_order_acquire);
+
+    if (h == t && timeout_ms > 0) {
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+      while (h == t) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) return false;
+
+        // announce the wait, then recheck so a concurrent push can't be missed
+        waiting.store(true, std::memory_order_seq_cst);
+        h = head.load(std::memory_order_seq_cst);
+        if (h != t) break;
+        wait(h, deadline - now);
+        h = head.load(std::memory_order_acquire);
+      }
+    }
+    if (h == t) return false;
+
+    v = buf[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  size_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+private:
+  void wait(uint32_t expected, std::chrono::steady_clock::duration timeout) {
+#ifdef __linux__
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+    struct timespec ts = {.tv_sec = (time_t)(ns / 1000000000), .tv_nsec = (long)(ns % 1000000000)};
+    syscall(SYS_futex, (uint32_t *)&head, FUTEX_WAIT_PRIVATE, expected, &ts, NULL, 0);
+#else
+    std::this_thread::sleep_for(std::min(timeout, std::chrono::steady_clock::duration(std::chrono::microseconds(100))));
+#endif
+  }
+
+  void wake() {
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)&head, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+  }
+
+  alignas(64) std::atomic<uint32_t> head = 0;  // written by the producer
+  alignas(64) std::atomic<uint32_t> tail = 0;  // written by the consumer
+  alignas(64) std::atomic<bool> waiting = false;
+  T buf[N];
+};
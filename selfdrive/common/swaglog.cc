@@ -4,122 +4,446 @@
 
 #include "selfdrive/common/swaglog.h"
 
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdarg>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <zmq.h>
-#include "json11.hpp"
 
 #include "selfdrive/common/util.h"
 #include "selfdrive/common/version.h"
 #include "selfdrive/hardware/hw.h"
 
+// Every thread that logs gets its own single producer ring. cloudlog_e only
+// formats the message into the next entry; a flusher thread turns the entries
+// into json and sends them to logmessaged, so callers never wait on each other
+// or on zmq. A full ring drops the message, the flusher reports how many.
+//
+// Messages are json, prefixed with their levelnum. Structured messages are
+// binary frames instead, a type byte and the sender's uint32 pid, then
+//   FRAME_CONTEXT  the ctx json, sent before the first record and after binds
+//   FRAME_SITE     uint32 id, int32 levelnum, int32 lineno, filename\0 func\0 fmt
+//   FRAME_RECORD   uint32 id, double created, the arguments from ArgWriter
+// which logmessaged turns back into the same json.
+
+namespace {
+
+const int RING_SIZE = 128;
+const int FLUSH_INTERVAL_MS = 10;
+
+enum FrameType : uint8_t {
+  FRAME_CONTEXT = 1,
+  FRAME_SITE = 2,
+  FRAME_RECORD = 3,
+};
+
+struct LogEntry {
+  int levelnum;
+  const char *filename;  // __FILE__ and __func__, static
+  const char *func;
+  int lineno;
+  double created;
+  const CloudlogSite *site;  // structured, msg holds args_len bytes of arguments
+  size_t args_len;
+  char *long_msg;  // heap copy of a message that doesn't fit in msg
+  char msg[CLOUDLOG_ARGS_SIZE];
+};
+
+struct LogRing {
+  LogEntry entries[RING_SIZE];
+  std::atomic<uint64_t> head = 0;  // written by the logging thread
+  std::atomic<uint64_t> tail = 0;  // written by the flusher
+  std::atomic<uint64_t> dropped = 0;
+  std::atomic<bool> alive = true;
+};
+
+void json_escape(std::string &out, const char *s) {
+  out += '"';
+  for (; *s; s++) {
+    unsigned char c = *s;
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out += c;
+        }
+    }
+  }
+  out += '"';
+}
+
+}  // namespace
+
 class LogState {
  public:
-  LogState() = default;
   ~LogState();
-  std::mutex lock;
-  bool inited;
-  json11::Json::object ctx_j;
-  void *zctx;
-  void *sock;
+  void init();
+  void bind(const char *k, const std::string &json_v);
+  LogRing *thread_ring();
+  void wake();
+  LogEntry *reserve(LogRing *ring, uint64_t &used);
+  void commit(LogRing *ring, int levelnum, uint64_t used);
+
+  std::atomic<bool> inited = false;
   int print_level;
+
+ private:
+  void serialize_ctx();
+  void flush_thread();
+  bool flush();
+  void send(const LogEntry &e, const std::string &ctx);
+  void send_structured(const LogEntry &e, const std::string &ctx);
+  void send_frame(FrameType type, const std::string &payload);
+
+  std::mutex lock;  // init, bind, the ring list; never taken by cloudlog_e once a thread has its ring
+  std::vector<std::pair<std::string, std::string>> ctx;
+  std::string ctx_json;  // ctx serialized once per bind
+  std::vector<std::shared_ptr<LogRing>> rings;
+  std::string log_s;
+  std::unordered_map<const CloudlogSite *, uint32_t> site_ids;  // the sites logmessaged knows
+  std::string sent_ctx;
+  uint32_t pid;
+  void *zctx = nullptr;
+  void *sock = nullptr;
+  int wake_fd = -1;
+  std::atomic<bool> do_exit = false;
+  std::thread thread;
 };
 
+static LogState s;
+
 LogState::~LogState() {
+  if (!inited) return;
+  do_exit = true;
+  wake();
+  thread.join();
+  close(wake_fd);
   zmq_close(sock);
   zmq_ctx_destroy(zctx);
 }
 
-static LogState s = {};
-
-static void cloudlog_bind_locked(const char* k, const char* v) {
-  s.ctx_j[k] = v;
-}
+void LogState::init() {
+  std::lock_guard lk(lock);
+  if (inited) return;
 
-static void cloudlog_init() {
-  if (s.inited) return;
-  s.ctx_j = json11::Json::object {};
-  s.zctx = zmq_ctx_new();
-  s.sock = zmq_socket(s.zctx, ZMQ_PUSH);
+  zctx = zmq_ctx_new();
+  sock = zmq_socket(zctx, ZMQ_PUSH);
 
   int timeout = 100; // 100 ms timeout on shutdown for messages to be received by logmessaged
-  zmq_setsockopt(s.sock, ZMQ_LINGER, &timeout, sizeof(timeout));
-
-  zmq_connect(s.sock, "ipc:///tmp/logmessage");
-
-  s.print_level = CLOUDLOG_WARNING;
-  const char* print_level = getenv("LOGPRINT");
-  if (print_level) {
-    if (strcmp(print_level, "debug") == 0) {
-      s.print_level = CLOUDLOG_DEBUG;
-    } else if (strcmp(print_level, "info") == 0) {
-      s.print_level = CLOUDLOG_INFO;
-    } else if (strcmp(print_level, "warning") == 0) {
-      s.print_level = CLOUDLOG_WARNING;
+  zmq_setsockopt(sock, ZMQ_LINGER, &timeout, sizeof(timeout));
+
+  zmq_connect(sock, "ipc:///tmp/logmessage");
+  pid = getpid();
+
+  print_level = CLOUDLOG_WARNING;
+  const char* print_level_env = getenv("LOGPRINT");
+  if (print_level_env) {
+    if (strcmp(print_level_env, "debug") == 0) {
+      print_level = CLOUDLOG_DEBUG;
+    } else if (strcmp(print_level_env, "info") == 0) {
+      print_level = CLOUDLOG_INFO;
+    } else if (strcmp(print_level_env, "warning") == 0) {
+      print_level = CLOUDLOG_WARNING;
     }
   }
 
+  auto bind_str = [&](const char *k, const char *v) {
+    std::string json_v;
+    json_escape(json_v, v);
+    ctx.push_back({k, json_v});
+  };
+
   // openpilot bindings
   char* dongle_id = getenv("DONGLE_ID");
   if (dongle_id) {
-    cloudlog_bind_locked("dongle_id", dongle_id);
+    bind_str("dongle_id", dongle_id);
   }
-  cloudlog_bind_locked("version", COMMA_VERSION);
-  s.ctx_j["dirty"] = !getenv("CLEAN");
+  bind_str("version", COMMA_VERSION);
+  ctx.push_back({"dirty", getenv("CLEAN") ? "false" : "true"});
 
   // device type
   if (Hardware::EON()) {
-    cloudlog_bind_locked("device", "eon");
+    bind_str("device", "eon");
   } else if (Hardware::TICI()) {
-    cloudlog_bind_locked("device", "tici");
+    bind_str("device", "tici");
   } else if (Hardware::JETSON()) {
-    cloudlog_bind_locked("device", "jetson");
+    bind_str("device", "jetson");
   } else {
-    cloudlog_bind_locked("device", "pc");
+    bind_str("device", "pc");
   }
+  serialize_ctx();
 
-  s.inited = true;
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  assert(wake_fd >= 0);
+  thread = std::thread(&LogState::flush_thread, this);
+  inited = true;
 }
 
-void log(int levelnum, const char* filename, int lineno, const char* func, const char* msg, const std::string& log_s) {
-  std::lock_guard lk(s.lock);
-  cloudlog_init();
-  if (levelnum >= s.print_level) {
-    printf("%s: %s\n", filename, msg);
+void LogState::bind(const char *k, const std::string &json_v) {
+  std::lock_guard lk(lock);
+  auto it = std::find_if(ctx.begin(), ctx.end(), [=](auto &kv) { return kv.first == k; });
+  if (it != ctx.end()) {
+    it->second = json_v;
+  } else {
+    ctx.push_back({k, json_v});
+  }
+  serialize_ctx();
+}
+
+// called with lock held
+void LogState::serialize_ctx() {
+  ctx_json = "{";
+  for (auto &[key, v] : ctx) {
+    if (ctx_json.size() > 1) ctx_json += ',';
+    json_escape(ctx_json, key.c_str());
+    ctx_json += ':';
+    ctx_json += v;
+  }
+  ctx_json += '}';
+}
+
+LogRing *LogState::thread_ring() {
+  // the ring outlives its thread until the flusher has sent what's left in it
+  struct Handle {
+    std::shared_ptr<LogRing> ring = std::make_shared<LogRing>();
+    Handle() {
+      std::lock_guard lk(s.lock);
+      s.rings.push_back(ring);
+    }
+    ~Handle() { ring->alive = false; }
+  };
+  thread_local Handle handle;
+  return handle.ring.get();
+}
+
+void LogState::wake() {
+  uint64_t one = 1;
+  write(wake_fd, &one, sizeof(one));
+}
+
+void LogState::flush_thread() {
+  set_thread_name("swaglog");
+  struct pollfd fds[] = {{.fd = wake_fd, .events = POLLIN}};
+  while (!do_exit) {
+    if (poll(fds, 1, FLUSH_INTERVAL_MS) > 0) {
+      uint64_t n;
+      read(wake_fd, &n, sizeof(n));
+    }
+    flush();
+  }
+  while (flush()) {}
+}
+
+// sends everything queued so far, returns whether there was anything
+bool LogState::flush() {
+  std::vector<std::shared_ptr<LogRing>> to_flush;
+  std::string ctx_copy;
+  {
+    std::lock_guard lk(lock);
+    to_flush = rings;
+    ctx_copy = ctx_json;
+  }
+
+  bool sent = false;
+  for (auto &ring : to_flush) {
+    bool alive = ring->alive;
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      LogEntry &e = ring->entries[tail % RING_SIZE];
+      if (e.site) {
+        send_structured(e, ctx_copy);
+      } else {
+        send(e, ctx_copy);
+      }
+      free(e.long_msg);
+      ring->tail.store(tail + 1, std::memory_order_release);
+      sent = true;
+    }
+
+    if (uint64_t dropped = ring->dropped.exchange(0)) {
+      LogEntry e = {.levelnum = CLOUDLOG_WARNING, .filename = __FILE__, .func = __func__, .lineno = __LINE__,
+                    .created = seconds_since_epoch()};
+      snprintf(e.msg, sizeof(e.msg), "cloudlog: %llu messages dropped", (unsigned long long)dropped);
+      send(e, ctx_copy);
+    }
+
+    // a thread that exited won't write again
+    if (!alive) {
+      std::lock_guard lk(lock);
+      rings.erase(std::find(rings.begin(), rings.end(), ring));
+    }
+  }
+  return sent;
+}
+
+void LogState::send(const LogEntry &e, const std::string &ctx) {
+  char num[48];
+  log_s.clear();
+  log_s += (char)e.levelnum;
+  log_s += "{\"msg\":";
+  json_escape(log_s, e.long_msg ? e.long_msg : e.msg);
+  log_s += ",\"ctx\":";
+  log_s += ctx;
+  snprintf(num, sizeof(num), ",\"levelnum\":%d", e.levelnum);
+  log_s += num;
+  log_s += ",\"filename\":";
+  json_escape(log_s, e.filename);
+  snprintf(num, sizeof(num), ",\"lineno\":%d", e.lineno);
+  log_s += num;
+  log_s += ",\"funcname\":";
+  json_escape(log_s, e.func);
+  snprintf(num, sizeof(num), ",\"created\":%.17g}", e.created);
+  log_s += num;
+  zmq_send(sock, log_s.data(), log_s.size(), ZMQ_NOBLOCK);
+}
+
+void LogState::send_frame(FrameType type, const std::string &payload) {
+  log_s.clear();
+  log_s += (char)type;
+  log_s.append((const char *)&pid, sizeof(pid));
+  log_s += payload;
+  zmq_send(sock, log_s.data(), log_s.size(), ZMQ_NOBLOCK);
+}
+
+void LogState::send_structured(const LogEntry &e, const std::string &ctx) {
+  if (ctx != sent_ctx) {
+    send_frame(FRAME_CONTEXT, ctx);
+    sent_ctx = ctx;
+  }
+
+  auto append = [](std::string &out, const auto &v) { out.append((const char *)&v, sizeof(v)); };
+  auto [it, inserted] = site_ids.try_emplace(e.site, site_ids.size());
+  uint32_t id = it->second;
+  std::string payload;
+  if (inserted) {
+    append(payload, id);
+    append(payload, (int32_t)e.site->levelnum);
+    append(payload, (int32_t)e.site->lineno);
+    payload.append(e.site->filename, strlen(e.site->filename) + 1);
+    payload.append(e.site->func, strlen(e.site->func) + 1);
+    payload += e.site->fmt;
+    send_frame(FRAME_SITE, payload);
+    payload.clear();
+  }
+
+  append(payload, id);
+  append(payload, e.created);
+  payload.append(e.msg, e.args_len);
+  send_frame(FRAME_RECORD, payload);
+}
+
+LogEntry *LogState::reserve(LogRing *ring, uint64_t &used) {
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  used = head - ring->tail.load(std::memory_order_acquire);
+  if (used == RING_SIZE) {
+    ring->dropped++;
+    return nullptr;
+  }
+  LogEntry *e = &ring->entries[head % RING_SIZE];
+  e->created = seconds_since_epoch();
+  e->site = nullptr;
+  e->long_msg = nullptr;
+  return e;
+}
+
+void LogState::commit(LogRing *ring, int levelnum, uint64_t used) {
+  ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  // errors go out right away, everything else within FLUSH_INTERVAL_MS
+  if (levelnum >= CLOUDLOG_ERROR || used >= RING_SIZE / 2) {
+    wake();
   }
-  char levelnum_c = levelnum;
-  zmq_send(s.sock, (levelnum_c + log_s).c_str(), log_s.length() + 1, ZMQ_NOBLOCK);
 }
 
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) {
-  char* msg_buf = nullptr;
-  va_list args;
+  if (!s.inited.load(std::memory_order_acquire)) {
+    s.init();
+  }
+
+  LogRing *ring = s.thread_ring();
+  uint64_t used;
+  LogEntry *entry = s.reserve(ring, used);
+  if (!entry) return;
+
+  LogEntry &e = *entry;
+  e.levelnum = levelnum;
+  e.filename = filename;
+  e.func = func;
+  e.lineno = lineno;
+
+  va_list args, args_copy;
   va_start(args, fmt);
-  vasprintf(&msg_buf, fmt, args);
+  va_copy(args_copy, args);
+  int len = vsnprintf(e.msg, sizeof(e.msg), fmt, args);
+  if (len >= (int)sizeof(e.msg) && vasprintf(&e.long_msg, fmt, args_copy) < 0) {
+    e.long_msg = nullptr;
+  }
+  va_end(args_copy);
   va_end(args);
+  if (len < 0) return;
+
+  if (levelnum >= s.print_level) {
+    printf("%s: %s\n", filename, e.long_msg ? e.long_msg : e.msg);
+  }
 
-  if (!msg_buf) return;
+  s.commit(ring, levelnum, used);
+}
 
-  json11::Json log_j = json11::Json::object {
-    {"msg", msg_buf},
-    {"ctx", s.ctx_j},
-    {"levelnum", levelnum},
-    {"filename", filename},
-    {"lineno", lineno},
-    {"funcname", func},
-    {"created", seconds_since_epoch()}
-  };
-  std::string log_s = log_j.dump();
-  log(levelnum, filename, lineno, func, msg_buf, log_s);
-  free(msg_buf);
+void cloudlog_s(const CloudlogSite *site, const uint8_t *args, size_t len, ...) {
+  if (!s.inited.load(std::memory_order_acquire)) {
+    s.init();
+  }
+
+  if (site->levelnum >= s.print_level) {
+    char *msg = nullptr;
+    va_list fmt_args;
+    va_start(fmt_args, len);
+    if (vasprintf(&msg, site->fmt, fmt_args) >= 0) {
+      printf("%s: %s\n", site->filename, msg);
+      free(msg);
+    }
+    va_end(fmt_args);
+  }
+
+  LogRing *ring = s.thread_ring();
+  uint64_t used;
+  LogEntry *e = s.reserve(ring, used);
+  if (!e) return;
+
+  e->levelnum = site->levelnum;
+  e->site = site;
+  e->args_len = len;
+  memcpy(e->msg, args, len);
+  s.commit(ring, site->levelnum, used);
 }
 
 void cloudlog_bind(const char* k, const char* v) {
-  std::lock_guard lk(s.lock);
-  cloudlog_init();
-  cloudlog_bind_locked(k, v);
+  if (!s.inited.load(std::memory_order_acquire)) {
+    s.init();
+  }
+  std::string json_v;
+  json_escape(json_v, v);
+  s.bind(k, json_v);
 }
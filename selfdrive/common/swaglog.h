@@ -1,5 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
 #include "selfdrive/common/timing.h"
 
 #define CLOUDLOG_DEBUG 10
@@ -8,17 +13,121 @@
 #define CLOUDLOG_ERROR 40
 #define CLOUDLOG_CRITICAL 50
 
+// levels below CLOUDLOG_MIN_LEVEL compile to nothing, e.g. -DCLOUDLOG_MIN_LEVEL=20 drops LOGD
+#ifndef CLOUDLOG_MIN_LEVEL
+#define CLOUDLOG_MIN_LEVEL CLOUDLOG_DEBUG
+#endif
+
+// filename and func must be static strings, the message is sent after cloudlog_e returns
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) /*__attribute__ ((format (printf, 6, 7)))*/;
 
 void cloudlog_bind(const char* k, const char* v);
 
-#define cloudlog(lvl, fmt, ...) cloudlog_e(lvl, __FILE__, __LINE__, \
-                                           __func__, \
-                                           fmt, ## __VA_ARGS__)
+// Structured logging, for translation units built with -DCLOUDLOG_STRUCTURED.
+// Every call site is a static CloudlogSite that is sent to logmessaged once,
+// after that a message is its site and the raw arguments, which logmessaged
+// formats. The caller only copies the arguments, strings included.
+
+#define CLOUDLOG_ARGS_SIZE 384
+
+struct CloudlogSite {
+  int levelnum;
+  const char *filename;
+  int lineno;
+  const char *func;
+  const char *fmt;
+};
+
+// args and len are the arguments as cloudlog_structured encodes them, the
+// arguments themselves follow for printing to stdout
+void cloudlog_s(const CloudlogSite *site, const uint8_t *args, size_t len, ...);
+
+namespace cloudlog_detail {
+
+struct ArgWriter {
+  uint8_t buf[CLOUDLOG_ARGS_SIZE];
+  size_t len = 0;
+
+  void put(uint8_t tag, const void *data, size_t size) {
+    if (len + 1 + size > sizeof(buf)) {
+      len = sizeof(buf);  // full, logmessaged sees the missing arguments
+      return;
+    }
+    buf[len++] = tag;
+    memcpy(buf + len, data, size);
+    len += size;
+  }
+
+  // 's', uint16 length, the bytes. strings are cut to 255 bytes, which
+  // leaves room for the rest and bounds the read of a %.*s buffer
+  void put_str(const char *str, size_t size) {
+    if (!str) {
+      str = "(null)";
+      size = 6;
+    }
+    if (len + 3 > sizeof(buf)) {
+      len = sizeof(buf);
+      return;
+    }
+    size = std::min(size, sizeof(buf) - len - 3);
+    uint16_t size16 = size;
+    buf[len++] = 's';
+    memcpy(buf + len, &size16, sizeof(size16));
+    memcpy(buf + len + sizeof(size16), str, size);
+    len += sizeof(size16) + size;
+  }
+};
+
+template <typename T>
+void write_arg(ArgWriter &w, T arg) {
+  if constexpr (std::is_same_v<T, char *> || std::is_same_v<T, const char *>) {
+    w.put_str(arg, arg ? strnlen(arg, 255) : 0);
+  } else if constexpr (std::is_pointer_v<T> || std::is_null_pointer_v<T>) {
+    uint64_t v = (uintptr_t)arg;
+    w.put('p', &v, sizeof(v));
+  } else if constexpr (std::is_floating_point_v<T>) {
+    double v = arg;
+    w.put('f', &v, sizeof(v));
+  } else if constexpr (std::is_enum_v<T> || std::is_signed_v<T>) {
+    int64_t v = (int64_t)arg;
+    w.put('i', &v, sizeof(v));
+  } else {
+    static_assert(std::is_unsigned_v<T>, "cloudlog: unsupported argument");
+    uint64_t v = arg;
+    w.put('u', &v, sizeof(v));
+  }
+}
+
+}  // namespace cloudlog_detail
+
+// by value, packed struct fields can't bind to references
+template <typename... Args>
+void cloudlog_structured(const CloudlogSite &site, Args... args) {
+  cloudlog_detail::ArgWriter w;
+  (cloudlog_detail::write_arg(w, args), ...);
+  cloudlog_s(&site, w.buf, w.len, args...);
+}
+
+#ifdef CLOUDLOG_STRUCTURED
+#define cloudlog(lvl, fmt, ...)                                                         \
+do {                                                                                    \
+  if ((lvl) >= CLOUDLOG_MIN_LEVEL) {                                                    \
+    static const CloudlogSite __site = {lvl, __FILE__, __LINE__, __func__, fmt};       \
+    cloudlog_structured(__site, ## __VA_ARGS__);                                        \
+  }                                                                                     \
+} while (0)
+#else
+#define cloudlog(lvl, fmt, ...)                                                         \
+do {                                                                                    \
+  if ((lvl) >= CLOUDLOG_MIN_LEVEL) {                                                    \
+    cloudlog_e(lvl, __FILE__, __LINE__, __func__, fmt, ## __VA_ARGS__);                 \
+  }                                                                                     \
+} while (0)
+#endif
 
 #define cloudlog_rl(burst, millis, lvl, fmt, ...)   \
-{                                                   \
+if ((lvl) >= CLOUDLOG_MIN_LEVEL) {                  \
   static uint64_t __begin = 0;                      \
   static int __printed = 0;                         \
   static int __missed = 0;                          \
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include "selfdrive/common/timing.h"
+
+// The current mapping between the boot clock and wall, GPS and panda RTC time,
+// kept by clocksd (and boardd for the RTC) in shared memory. Converting a
+// logMonoTime to wall time with it is a read of a few words instead of a
+// message, and every process converts the same way.
+//
+// Offsets are the other clock minus the boot clock at ref_boot_ns, drifts are
+// how fast they change in ppm. clocksd updates once a second under seq: odd
+// while writing, readers retry until they see the same even value around their
+// read.
+#define TIME_SYNC_PATH "/dev/shm/time_sync"
+#define TIME_SYNC_MAGIC 0x434e5953  // "SYNC"
+
+struct TimeSyncMap {
+  uint32_t magic;
+  std::atomic<uint32_t> seq;
+
+  std::atomic<uint64_t> ref_boot_ns;
+  std::atomic<int64_t> wall_offset_ns;
+  std::atomic<double> wall_drift_ppm;
+  std::atomic<bool> gps_valid;
+  std::atomic<int64_t> gps_offset_ns;
+  std::atomic<double> gps_drift_ppm;
+
+  // written by boardd when it reads the RTC, panda RTC minus wall time
+  std::atomic<bool> rtc_valid;
+  std::atomic<uint64_t> rtc_boot_ns;
+  std::atomic<int64_t> rtc_skew_ns;
+};
+
+struct TimeSync {
+  bool valid = false;
+  uint64_t ref_boot_ns = 0;
+  int64_t wall_offset_ns = 0;
+  double wall_drift_ppm = 0;
+  bool gps_valid = false;
+  int64_t gps_offset_ns = 0;
+  double gps_drift_ppm = 0;
+  bool rtc_valid = false;
+  uint64_t rtc_boot_ns = 0;
+  int64_t rtc_skew_ns = 0;
+};
+
+// The shared mapping, NULL if clocksd hasn't made it yet. Writers create it.
+inline TimeSyncMap *time_sync_map(bool writer = false) {
+  static TimeSyncMap *map = nullptr;
+  static uint64_t next_try = 0;
+  if (map != nullptr) return map;
+  // readers look for it again once a second, not on every conversion
+  if (!writer) {
+    const uint64_t now = nanos_since_boot();
+    if (now < next_try) return nullptr;
+    next_try = now + 1000000000ULL;
+  }
+
+  int fd = writer ? open(TIME_SYNC_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0666) : open(TIME_SYNC_PATH, O_RDWR | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+  if (writer && ftruncate(fd, sizeof(TimeSyncMap)) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  void *mem = mmap(NULL, sizeof(TimeSyncMap), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return nullptr;
+
+  TimeSyncMap *m = (TimeSyncMap *)mem;
+  if (writer) {
+    m->magic = TIME_SYNC_MAGIC;
+  } else if (m->magic != TIME_SYNC_MAGIC) {
+    munmap(mem, sizeof(TimeSyncMap));
+    return nullptr;
+  }
+  return map = m;
+}
+
+static inline bool time_sync_read(TimeSync *out) {
+  TimeSyncMap *m = time_sync_map();
+  if (m == nullptr) return false;
+
+  uint32_t seq;
+  do {
+    seq = m->seq.load(std::memory_order_acquire);
+    out->ref_boot_ns = m->ref_boot_ns.load(std::memory_order_relaxed);
+    out->wall_offset_ns = m->wall_offset_ns.load(std::memory_order_relaxed);
+    out->wall_drift_ppm = m->wall_drift_ppm.load(std::memory_order_relaxed);
+    out->gps_valid = m->gps_valid.load(std::memory_order_relaxed);
+    out->gps_offset_ns = m->gps_offset_ns.load(std::memory_order_relaxed);
+    out->gps_drift_ppm = m->gps_drift_ppm.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || seq != m->seq.load(std::memory_order_relaxed));
+
+  out->rtc_valid = m->rtc_valid.load(std::memory_order_relaxed);
+  out->rtc_boot_ns = m->rtc_boot_ns.load(std::memory_order_relaxed);
+  out->rtc_skew_ns = m->rtc_skew_ns.load(std::memory_order_relaxed);
+  out->valid = out->ref_boot_ns != 0;
+  return out->valid;
+}
+
+static inline void time_sync_write(const TimeSync &ts) {
+  TimeSyncMap *m = time_sync_map(true);
+  if (m == nullptr) return;
+
+  uint32_t seq = m->seq.load(std::memory_order_relaxed);
+  m->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  m->ref_boot_ns.store(ts.ref_boot_ns, std::memory_order_relaxed);
+  m->wall_offset_ns.store(ts.wall_offset_ns, std::memory_order_relaxed);
+  m->wall_drift_ppm.store(ts.wall_drift_ppm, std::memory_order_relaxed);
+  m->gps_valid.store(ts.gps_valid, std::memory_order_relaxed);
+  m->gps_offset_ns.store(ts.gps_offset_ns, std::memory_order_relaxed);
+  m->gps_drift_ppm.store(ts.gps_drift_ppm, std::memory_order_relaxed);
+  m->seq.store(seq + 2, std::memory_order_release);
+}
+
+static inline void time_sync_write_rtc(uint64_t boot_ns, int64_t skew_ns) {
+  TimeSyncMap *m = time_sync_map(true);
+  if (m == nullptr) return;
+
+  m->rtc_skew_ns.store(skew_ns, std::memory_order_relaxed);
+  m->rtc_boot_ns.store(boot_ns, std::memory_order_relaxed);
+  m->rtc_valid.store(true, std::memory_order_release);
+}
+
+static inline int64_t time_sync_extrapolate(int64_t offset_ns, double drift_ppm, uint64_t ref_boot_ns, uint64_t boot_ns) {
+  return offset_ns + (int64_t)(((double)boot_ns - (double)ref_boot_ns) * drift_ppm * 1e-6);
+}
+
+// Wall time at boot_ns, from the mapping or the clocks right now without one
+static inline uint64_t time_sync_boot_to_wall(uint64_t boot_ns) {
+  TimeSync ts;
+  if (!time_sync_read(&ts)) return boot_ns + (nanos_since_epoch() - nanos_since_boot());
+  return boot_ns + time_sync_extrapolate(ts.wall_offset_ns, ts.wall_drift_ppm, ts.ref_boot_ns, boot_ns);
+}
+
+// GPS time at boot_ns, 0 without a GPS fix
+static inline uint64_t time_sync_boot_to_gps(uint64_t boot_ns) {
+  TimeSync ts;
+  if (!time_sync_read(&ts) || !ts.gps_valid) return 0;
+  return boot_ns + time_sync_extrapolate(ts.gps_offset_ns, ts.gps_drift_ppm, ts.ref_boot_ns, boot_ns);
+}
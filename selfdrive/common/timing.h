@@ -3,26 +3,23 @@
 #include <cstdint>
 #include <ctime>
 
+#include "cereal/messaging/sim_clock.h"
+
 #ifdef __APPLE__
 #define CLOCK_BOOTTIME CLOCK_MONOTONIC
 #endif
 
+// The boot and monotonic clocks are the simulated clock when SIMULATED_TIME is set, see sim_clock.h
 static inline uint64_t nanos_since_boot() {
-  struct timespec t;
-  clock_gettime(CLOCK_BOOTTIME, &t);
-  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+  return sim_clock_gettime(CLOCK_BOOTTIME);
 }
 
 static inline double millis_since_boot() {
-  struct timespec t;
-  clock_gettime(CLOCK_BOOTTIME, &t);
-  return t.tv_sec * 1000.0 + t.tv_nsec * 1e-6;
+  return nanos_since_boot() * 1e-6;
 }
 
 static inline double seconds_since_boot() {
-  struct timespec t;
-  clock_gettime(CLOCK_BOOTTIME, &t);
-  return (double)t.tv_sec + t.tv_nsec * 1e-9;
+  return nanos_since_boot() * 1e-9;
 }
 
 static inline uint64_t nanos_since_epoch() {
@@ -39,9 +36,7 @@ static inline double seconds_since_epoch() {
 
 // you probably should use nanos_since_boot instead
 static inline uint64_t nanos_monotonic() {
-  struct timespec t;
-  clock_gettime(CLOCK_MONOTONIC, &t);
-  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+  return sim_clock_gettime(CLOCK_MONOTONIC);
 }
 
 static inline uint64_t nanos_monotonic_raw() {
@@ -6,7 +6,6 @@
 #include <cerrno>
 #include <cstring>
 #include <dirent.h>
-#include <fstream>
 #include <sstream>
 #include <iomanip>
 
@@ -55,27 +54,54 @@ int set_core_affinity(int core) {
 
 namespace util {
 
-std::string read_file(const std::string& fn) {
-  std::ifstream f(fn, std::ios::binary | std::ios::in);
-  if (f.is_open()) {
-    f.seekg(0, std::ios::end);
-    int size = f.tellg();
-    if (f.good() && size > 0) {
-      std::string result(size, '\0');
-      f.seekg(0, std::ios::beg);
-      f.read(result.data(), size);
-      // return either good() or has reached end-of-file (e.g. /sys/power/wakeup_count)
-      if (f.good() || f.eof()) {
-        result.resize(f.gcount());
-        return result;
-      }
+// reads from the current offset until EOF into buf, growing it, returns the length or -1
+static ssize_t read_to_end(int fd, std::string &buf, bool positional) {
+  size_t len = 0;
+  while (true) {
+    if (len == buf.size()) buf.resize(std::max<size_t>(buf.size() * 2, 256));
+    ssize_t n = positional ? HANDLE_EINTR(pread(fd, buf.data() + len, buf.size() - len, len))
+                           : HANDLE_EINTR(read(fd, buf.data() + len, buf.size() - len));
+    if (n < 0) {
+      // keep what was read before, e.g. /sys/power/wakeup_count fails after the value
+      return len > 0 ? len : -1;
     }
-    // fallback for files created on read, e.g. procfs
-    std::stringstream buffer;
-    buffer << f.rdbuf();
-    return buffer.str();
+    if (n == 0) return len;
+    len += n;
   }
-  return std::string();
+}
+
+std::string read_file(const std::string& fn) {
+  int fd = HANDLE_EINTR(open(fn.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) return std::string();
+
+  // procfs and sysfs report no or a made up size, so read until EOF either way
+  struct stat st;
+  std::string result;
+  result.resize(fstat(fd, &st) == 0 && st.st_size > 0 ? st.st_size + 1 : 4096);
+  ssize_t len = read_to_end(fd, result, false);
+  close(fd);
+  result.resize(std::max<ssize_t>(len, 0));
+  return result;
+}
+
+FileReader::FileReader(const std::string &path) : path_(path) {
+  fd_ = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+}
+
+FileReader::FileReader(FileReader &&other) : path_(std::move(other.path_)), fd_(other.fd_), buf_(std::move(other.buf_)) {
+  other.fd_ = -1;
+}
+
+FileReader::~FileReader() {
+  if (fd_ >= 0) close(fd_);
+}
+
+const std::string &FileReader::read() {
+  // shrinking keeps the capacity, so every read can use all of it
+  buf_.resize(buf_.capacity());
+  ssize_t len = fd_ >= 0 ? read_to_end(fd_, buf_, true) : -1;
+  buf_.resize(std::max<ssize_t>(len, 0));
+  return buf_;
 }
 
 std::map<std::string, std::string> read_files_in_dir(const std::string &path) {
@@ -13,6 +13,8 @@
 #include <string>
 #include <thread>
 
+#include "cereal/messaging/sim_clock.h"
+
 // keep trying if x gets interrupted by a signal
 #define HANDLE_EINTR(x)                                       \
   ({                                                          \
@@ -76,8 +78,28 @@ int write_file(const char* path, const void* data, size_t size, int flags = O_WR
 std::string readlink(const std::string& path);
 bool file_exists(const std::string& fn);
 
+// Keeps a polled sysfs or procfs file open and rereads it from the start with pread,
+// without reopening it or allocating once the buffer has grown to fit. The returned
+// string is reused by the next read, it's empty when the file can't be read.
+class FileReader {
+public:
+  FileReader(const std::string &path);
+  FileReader(FileReader &&other);
+  ~FileReader();
+  const std::string &read();
+  bool is_open() const { return fd_ >= 0; }
+  const std::string &path() const { return path_; }
+
+private:
+  std::string path_;
+  int fd_ = -1;
+  std::string buf_;
+};
+
 inline void sleep_for(const int milliseconds) {
-  std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+  if (!sim_clock_sleep_for(milliseconds * 1000000ULL)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+  }
 }
 
 }  // namespace util
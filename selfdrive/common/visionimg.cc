@@ -2,6 +2,57 @@
 
 #include <cassert>
 
+const char *YUV_TO_RGB_FRAGMENT_SHADER =
+#ifdef __APPLE__
+  "#version 150\n"
+#else
+  "#version 300 es\n"
+  "precision mediump float;\n"
+#endif
+  "in vec2 uv;\n"
+  "uniform sampler2D tex_y;\n"
+  "uniform sampler2D tex_u;\n"
+  "uniform sampler2D tex_v;\n"
+  "out vec4 colorOut;\n"
+  "void main() {\n"
+  "  float y = 1.164 * (texture(tex_y, uv).r - 0.0625);\n"
+  "  float u = texture(tex_u, uv).r - 0.5;\n"
+  "  float v = texture(tex_v, uv).r - 0.5;\n"
+  "  colorOut = vec4(y + 1.596 * v, y - 0.391 * u - 0.813 * v, y + 2.018 * u, 1.0);\n"
+  "}\n";
+
+static GLuint plane_texture(int width, int height, const uint8_t *data) {
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return tex;
+}
+
+static void init_yuv_textures(EGLImageTexture *t, const VisionBuf *buf) {
+  t->frame_tex = plane_texture(buf->width, buf->height, buf->y);
+  t->u_tex = plane_texture(buf->width / 2, buf->height / 2, buf->u);
+  t->v_tex = plane_texture(buf->width / 2, buf->height / 2, buf->v);
+}
+
+void EGLImageTexture::update(const VisionBuf *buf) {
+  if (buf->rgb) return;
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  const GLuint textures[] = {frame_tex, u_tex, v_tex};
+  const uint8_t *planes[] = {buf->y, buf->u, buf->v};
+  for (int i = 0; i < 3; i++) {
+    const int div = i == 0 ? 1 : 2;
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buf->width / div, buf->height / div, GL_RED, GL_UNSIGNED_BYTE, planes[i]);
+  }
+}
+
 #ifdef QCOM
 #include <gralloc_priv.h>
 #include <system/graphics.h>
@@ -12,6 +63,12 @@
 using namespace android;
 
 EGLImageTexture::EGLImageTexture(const VisionBuf *buf) {
+  // gralloc has no format for camerad's planar YUV, those planes are uploaded
+  if (!buf->rgb) {
+    init_yuv_textures(this, buf);
+    return;
+  }
+
   const int bpp = 3;
   assert((buf->len % buf->stride) == 0);
   assert((buf->stride % bpp) == 0);
@@ -42,6 +99,11 @@ EGLImageTexture::EGLImageTexture(const VisionBuf *buf) {
 
 EGLImageTexture::~EGLImageTexture() {
   glDeleteTextures(1, &frame_tex);
+  if (private_handle == nullptr) {
+    glDeleteTextures(1, &u_tex);
+    glDeleteTextures(1, &v_tex);
+    return;
+  }
   EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
   assert(display != EGL_NO_DISPLAY);
   eglDestroyImageKHR(display, img_khr);
@@ -51,6 +113,11 @@ EGLImageTexture::~EGLImageTexture() {
 #else // ifdef QCOM
 
 EGLImageTexture::EGLImageTexture(const VisionBuf *buf) {
+  if (!buf->rgb) {
+    init_yuv_textures(this, buf);
+    return;
+  }
+
   glGenTextures(1, &frame_tex);
   glBindTexture(GL_TEXTURE_2D, frame_tex);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, buf->width, buf->height, 0, GL_RGB, GL_UNSIGNED_BYTE, buf->addr);
@@ -59,5 +126,7 @@ EGLImageTexture::EGLImageTexture(const VisionBuf *buf) {
 
 EGLImageTexture::~EGLImageTexture() {
   glDeleteTextures(1, &frame_tex);
+  glDeleteTextures(1, &u_tex);
+  glDeleteTextures(1, &v_tex);
 }
 #endif // ifdef QCOM
@@ -15,11 +15,19 @@
 #undef Status
 #endif
 
+// Converts the planes of a YUV EGLImageTexture (samplers tex_y, tex_u, tex_v) to RGB, the
+// inverse of camerad's BT.601 limited range rgb_to_yuv. Lets a UI draw the YUV streams directly.
+extern const char *YUV_TO_RGB_FRAGMENT_SHADER;
+
 class EGLImageTexture {
  public:
   EGLImageTexture(const VisionBuf *buf);
   ~EGLImageTexture();
+  // Uploads the planes of a new frame, only needed for YUV buffers
+  void update(const VisionBuf *buf);
   GLuint frame_tex = 0;
+  // YUV buffers use one single channel texture per plane, frame_tex holds Y
+  GLuint u_tex = 0, v_tex = 0;
 #ifdef QCOM
   void *private_handle = nullptr;
   EGLImageKHR img_khr = 0;
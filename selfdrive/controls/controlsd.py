@@ -1,5 +1,6 @@
 #!/usr/bin/env python3
 import os
+import json
 import math
 from numbers import Number
 
@@ -12,7 +13,8 @@ import cereal.messaging as messaging
 from selfdrive.config import Conversions as CV
 from selfdrive.swaglog import cloudlog
 from selfdrive.boardd.boardd import can_list_to_can_capnp
-from selfdrive.car.car_helpers import get_car, get_startup_event, get_one_can
+from selfdrive.car import get_car_dbcs
+from selfdrive.car.car_helpers import get_car, get_startup_event, get_one_can, get_can_rx_filter
 from selfdrive.controls.lib.lane_planner import CAMERA_OFFSET
 from selfdrive.controls.lib.drive_helpers import update_v_cruise, initialize_v_cruise
 from selfdrive.controls.lib.drive_helpers import get_lag_adjusted_curvature
@@ -27,6 +29,7 @@ from selfdrive.controls.lib.vehicle_model import VehicleModel
 from selfdrive.locationd.calibrationd import Calibration
 from selfdrive.hardware import HARDWARE, TICI, EON, JETSON
 from selfdrive.manager.process_config import managed_processes
+from selfdrive.manager.readiness import Readiness
 
 LDW_MIN_SPEED = 31 * CV.MPH_TO_MS
 LANE_DEPARTURE_THRESHOLD = 0.1
@@ -52,6 +55,8 @@ ButtonEvent = car.CarState.ButtonEvent
 
 class Controls:
   def __init__(self, sm=None, pm=None, can_sock=None):
+    # startup readiness for the manager, not when tests or process replay drive it
+    self.readiness = Readiness("controlsd") if sm is None else None
     params = Params()
     self.dp_jetson = params.get_bool('dp_jetson')
     self.dp_lexus_rx_rpm_fix = params.get_bool('dp_lexus_rx_rpm_fix')
@@ -91,9 +96,15 @@ class Controls:
 
     # wait for one pandaState and one CAN packet
     print("Waiting for CAN messages...")
+    if self.readiness is not None:
+      self.readiness.phase("can")
     get_one_can(self.can_sock)
 
+    if self.readiness is not None:
+      self.readiness.phase("fingerprint")
     self.CI, self.CP = get_car(self.can_sock, self.pm.sock['sendcan'])
+    if self.readiness is not None:
+      self.readiness.phase("init")
 
     # read params
     self.is_metric = params.get_bool("IsMetric")
@@ -116,7 +127,12 @@ class Controls:
     if self.read_only:
       self.CP.safetyModel = car.CarParams.SafetyModel.noOutput
 
-    # Write CarParams for radard
+    # the pandas only forward what gets parsed, unless all of the CAN is wanted in the logs
+    if not params.get_bool("CanFullCapture"):
+      self.CP.canRxFilter = [{'bus': bus, 'address': addr} for bus, addr in get_can_rx_filter(self.CI, self.CP)]
+
+    # Write CarParams for radard, the native one reads the car's DBCs from CarDBCs
+    params.put("CarDBCs", json.dumps(get_car_dbcs(self.CP)))
     cp_bytes = self.CP.to_bytes()
     params.put("CarParams", cp_bytes)
     put_nonblocking("CarParamsCache", cp_bytes)
@@ -300,10 +316,11 @@ class Controls:
       logs = messaging.drain_sock(self.log_sock, wait_for_one=False)
       messages = []
       for m in logs:
-        try:
-          messages.append(m.androidLog.message)
-        except UnicodeDecodeError:
-          pass
+        for entry in m.androidLog.entries:
+          try:
+            messages.append(entry.message)
+          except UnicodeDecodeError:
+            pass
 
       for err in ["ERROR_CRC", "ERROR_ECC", "ERROR_STREAM_UNDERFLOW", "APPLY FAILED"]:
         for m in messages:
@@ -358,6 +375,8 @@ class Controls:
       self.CI.init(self.CP, self.can_sock, self.pm.sock['sendcan'])
       self.initialized = True
       Params().put_bool("ControlsReady", True)
+      if self.readiness is not None:
+        self.readiness.ready()
 
     # Check for CAN timeout
     if not can_strs:
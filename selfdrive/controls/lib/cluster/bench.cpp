@@ -0,0 +1,51 @@
+// Times the sweep and the distance matrix paths of cluster_points_centroid on
+// radar-like points, 3 dimensions with a cutoff of 2.5 like radard.
+//
+//   ./bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "fastcluster.h"
+}
+
+typedef void (*cluster_fn)(int n, int m, double* pts, double dist, int* idx);
+
+static double time_us(cluster_fn fn, std::vector<double> &pts, int n, int iterations) {
+  std::vector<int> idx(n);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    fn(n, 3, pts.data(), 2.5 * 2.5, idx.data());
+  }
+  std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int main(int argc, const char* argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100;
+
+  // tracks in 100 m ahead over 3 lanes, a few of them on the same car
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> d_rel(0, 100), y_rel(-5, 5), v_rel(-10, 10), jitter(-1, 1);
+
+  printf("%6s %12s %12s\n", "points", "pdist us", "sweep us");
+  for (int n : {8, 16, 32, 64, 128, 256, 512}) {
+    std::vector<double> pts(n * 3);
+    for (int i = 0; i < n; i++) {
+      if (i > 0 && i % 4 == 0) {
+        for (int k = 0; k < 3; k++) pts[i * 3 + k] = pts[(i - 1) * 3 + k] + jitter(gen);
+      } else {
+        pts[i * 3] = d_rel(gen);
+        pts[i * 3 + 1] = y_rel(gen);
+        pts[i * 3 + 2] = v_rel(gen);
+      }
+    }
+    printf("%6d %12.1f %12.1f\n", n, time_us(cluster_points_centroid_pdist, pts, n, iterations),
+           time_us(cluster_points_centroid_sweep, pts, n, iterations));
+  }
+  return 0;
+}
@@ -11,6 +11,8 @@
 #include <vector>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <queue>
 
 
 extern "C" {
@@ -202,7 +204,7 @@ extern "C" {
     }
   }
 
-  void cluster_points_centroid(int n, int m, double* pts, double dist, int* idx) {
+  void cluster_points_centroid_pdist(int n, int m, double* pts, double dist, int* idx) {
     double* pdist = new double[n * (n - 1) / 2];
     int* merge = new int[2 * (n - 1)];
     double* height = new double[n - 1];
@@ -215,4 +217,122 @@ extern "C" {
     delete[] merge;
     delete[] height;
   }
+
+
+  //
+  // Centroid clustering of low dimensional points, stopped at cluster distance
+  // dist like cluster_points_centroid_pdist, without the distance matrix.
+  //
+  // Only clusters closer than the cutoff can be merged, so the centroids are
+  // kept sorted by their first coordinate and only those within the cutoff of
+  // it are compared. The candidate pairs wait in a priority queue and the
+  // closest one is merged until none is left. That's the same sequence of
+  // merges the generic algorithm does up to the cutoff, in O(n log n) for
+  // points that spread out along the first coordinate, like radar tracks.
+  //
+  // Input arguments:
+  //   n    = number of observables
+  //   m    = dimension of observable, at most 3
+  //   pts  = n x m array of the observables
+  //   dist = cutoff of the squared centroid distance
+  // Output arguments:
+  //   idx  = allocated integer array of size n for the cluster labels,
+  //          numbered in the order of their first observable
+  //
+  void cluster_points_centroid_sweep(int n, int m, double* pts, double dist, int* idx) {
+    struct Cluster {
+      double centroid[3];
+      int count;
+      int version;
+    };
+    struct Pair {
+      double d;
+      int i, j;
+      int version_i, version_j;
+      bool operator>(const Pair &o) const {
+        return d != o.d ? d > o.d : (i != o.i ? i > o.i : j > o.j);
+      }
+    };
+
+    const double cell = std::sqrt(dist);
+    std::vector<Cluster> clusters(n);
+    std::vector<int> parent(n), order(n);
+    std::vector<Pair> queue;
+    queue.reserve(2 * n);
+    std::priority_queue<Pair, std::vector<Pair>, std::greater<Pair>> pairs(std::greater<Pair>(), std::move(queue));
+
+    auto x = [&](int i) { return clusters[i].centroid[0]; };
+    auto before = [&](int i, int j) { return x(i) != x(j) ? x(i) < x(j) : i < j; };
+    auto push_pair = [&](int i, int j) {
+      double d = 0;
+      for (int k = 0; k < m; k++) {
+        double error = clusters[i].centroid[k] - clusters[j].centroid[k];
+        d += error * error;
+      }
+      if (d < dist) {
+        if (i > j) std::swap(i, j);
+        pairs.push({d, i, j, clusters[i].version, clusters[j].version});
+      }
+    };
+
+    for (int i = 0; i < n; i++) {
+      for (int k = 0; k < m; k++) clusters[i].centroid[k] = pts[i * m + k];
+      clusters[i].count = 1;
+      clusters[i].version = 0;
+      parent[i] = i;
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), before);
+    for (int a = 0; a < n; a++) {
+      for (int b = a + 1; b < n && x(order[b]) - x(order[a]) < cell; b++) {
+        push_pair(order[a], order[b]);
+      }
+    }
+
+    while (!pairs.empty()) {
+      Pair p = pairs.top();
+      pairs.pop();
+      // one of them was merged since the pair was queued
+      if (clusters[p.i].version != p.version_i || clusters[p.j].version != p.version_j) continue;
+
+      for (int c : {p.i, p.j}) {
+        order.erase(std::lower_bound(order.begin(), order.end(), c, before));
+      }
+      Cluster &a = clusters[p.i], &b = clusters[p.j];
+      for (int k = 0; k < m; k++) {
+        a.centroid[k] = (a.centroid[k] * a.count + b.centroid[k] * b.count) / (a.count + b.count);
+      }
+      a.count += b.count;
+      a.version++;
+      b.version = -1;
+      parent[p.j] = p.i;
+
+      auto pos = order.insert(std::lower_bound(order.begin(), order.end(), p.i, before), p.i);
+      for (auto it = pos; it != order.begin() && x(p.i) - x(*(it - 1)) < cell; it--) {
+        push_pair(p.i, *(it - 1));
+      }
+      for (auto it = pos + 1; it != order.end() && x(*it) - x(p.i) < cell; it++) {
+        push_pair(p.i, *it);
+      }
+    }
+
+    // label the clusters in the order of their first point
+    std::vector<int> labels(n, -1);
+    int label = 0;
+    for (int i = 0; i < n; i++) {
+      int root = i;
+      while (parent[root] != root) root = parent[root];
+      parent[i] = root;
+      if (labels[root] < 0) labels[root] = label++;
+      idx[i] = labels[root];
+    }
+  }
+
+  void cluster_points_centroid(int n, int m, double* pts, double dist, int* idx) {
+    if (m >= 1 && m <= 3 && dist > 0) {
+      cluster_points_centroid_sweep(n, m, pts, dist, idx);
+    } else {
+      cluster_points_centroid_pdist(n, m, pts, dist, idx);
+    }
+  }
 }
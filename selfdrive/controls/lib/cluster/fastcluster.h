@@ -71,7 +71,16 @@ enum hclust_fast_methods {
 };
 
 void hclust_pdist(int n, int m, double* pts, double* out);
+
+//
+// Centroid clustering of n points of dimension m, stopped at the squared
+// cluster distance dist. Points of up to 3 dimensions go through a sorted
+// sweep over the first coordinate in O(n log n), others through the
+// distance matrix.
+//
 void cluster_points_centroid(int n, int m, double* pts, double dist, int* idx);
+void cluster_points_centroid_pdist(int n, int m, double* pts, double dist, int* idx);
+void cluster_points_centroid_sweep(int n, int m, double* pts, double dist, int* idx);
 
 
 #endif
@@ -1,4 +1,6 @@
 #include <cassert>
+#include <random>
+#include <vector>
 
 extern "C" {
 #include "fastcluster.h"
@@ -32,4 +34,21 @@ int main(int argc, const char* argv[]) {
   delete[] idx;
   delete[] correct_idx;
   delete[] pts;
+
+  // the sweep path gives the same clusters as the distance matrix
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> d_rel(0, 100), y_rel(-5, 5), v_rel(-10, 10);
+  for (int iter = 0; iter < 1000; iter++) {
+    int n = 2 + iter % 100;
+    std::vector<double> p(n * m);
+    for (int i = 0; i < n; i++) {
+      p[i * m] = d_rel(gen);
+      p[i * m + 1] = y_rel(gen);
+      p[i * m + 2] = v_rel(gen);
+    }
+    std::vector<int> sweep(n), pdist(n);
+    cluster_points_centroid_sweep(n, m, p.data(), 2.5 * 2.5, sweep.data());
+    cluster_points_centroid_pdist(n, m, p.data(), 2.5 * 2.5, pdist.data());
+    assert(sweep == pdist);
+  }
 }
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+#include "selfdrive/common/modeldata.h"
+
+// The constants of drive_helpers.py the native planners use, keep them in sync.
+// LAT_MPC_N and LON_MPC_N come from modeldata.h.
+
+const double V_CRUISE_MAX = 135;  // kph
+const int CONTROL_N = 17;
+constexpr double CAR_ROTATION_RADIUS = 0.0;
+
+// Constants for Limit controllers.
+const double LIMIT_ADAPT_ACC = -0.6;  // m/s^2 Ideal acceleration for the adapting (braking) phase when approaching speed limits.
+const double LIMIT_MIN_ACC = -1.0;  // m/s^2 Maximum deceleration allowed for limit controllers to provide.
+const double LIMIT_MAX_ACC = 1.0;  // m/s^2 Maximum acelration allowed for limit controllers to provide while active.
+const double LIMIT_MIN_SPEED = 8.33;  // m/s, Minimum speed limit to provide as solution on limit controllers.
+const double LIMIT_SPEED_OFFSET_TH = -1.;  // m/s Maximum offset between speed limit and current speed for adapting state.
+const double LIMIT_MAX_MAP_DATA_AGE = 10.;  // s Maximum time to hold to map data, then consider it invalid inside limits controllers.
+
+namespace MPC_COST_LAT {
+const double PATH = 1.0;
+const double HEADING = 1.0;
+const double STEER_RATE = 1.0;
+}  // namespace MPC_COST_LAT
+
+namespace MPC_COST_LONG {
+const double TTC = 5.5;
+const double DISTANCE = 0.1;
+const double ACCELERATION = 10.0;
+const double JERK = 20.0;
+}  // namespace MPC_COST_LONG
+
+const double DT_MDL = 0.05;  // model runs at 20hz
+const double MPH_TO_MS = 1.609344 / 3.6;
+const double KPH_TO_MS = 1. / 3.6;
+const double DEG_TO_RAD = 3.14159265358979323846 / 180.;
+
+// np.interp over the first n points of xp and fp, which are indexable by int
+// (arrays, vectors, capnp lists). xp is increasing, x outside of it is clamped.
+template <typename XP, typename FP>
+inline double interp(double x, const XP &xp, const FP &fp, size_t n) {
+  if (x <= xp[0]) return fp[0];
+  if (x >= xp[n - 1]) return fp[n - 1];
+  size_t hi = 1;
+  while (x > xp[hi]) hi++;
+  size_t lo = hi - 1;
+  return fp[lo] + (x - xp[lo]) * (fp[hi] - fp[lo]) / (xp[hi] - xp[lo]);
+}
+
+template <typename XP, typename FP>
+inline double interp(double x, const XP &xp, const FP &fp) {
+  return interp(x, xp, fp, std::size(xp));
+}
+
+template <typename T>
+inline T clip(T x, T lo, T hi) {
+  return std::max(lo, std::min(hi, x));
+}
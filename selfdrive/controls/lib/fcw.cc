@@ -0,0 +1,78 @@
+#include "selfdrive/controls/lib/fcw.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "selfdrive/controls/lib/drive_helpers.h"
+
+static const double FCW_A_ACT_V[] = {-3., -2.};
+static const double FCW_A_ACT_BP[] = {0., 30.};
+
+void FCWChecker::resetLead(double cur_time) {
+  last_fcw_a = 0.0;
+  v_lead_max = 0.0;
+  lead_seen_t = cur_time;
+  last_fcw_time = 0.0;
+  last_min_a = 0.0;
+
+  counters = {};
+}
+
+double FCWChecker::calcTtc(double v_ego, double a_ego, double x_lead, double v_lead, double a_lead) {
+  const double max_ttc = 5.0;
+
+  double v_rel = v_ego - v_lead;
+  double a_rel = a_ego - a_lead;
+
+  // assuming that closing gap ARel comes from lead vehicle decel,
+  // then limit ARel so that v_lead will get to zero in no sooner than t_decel.
+  // This helps underweighting ARel when v_lead is close to zero.
+  const double t_decel = 2.;
+  a_rel = std::min(a_rel, v_lead / t_decel);
+
+  // delta of the quadratic equation to solve for ttc
+  double delta = v_rel * v_rel + 2 * x_lead * a_rel;
+
+  // assign an arbitrary high ttc value if there is no solution to ttc
+  if (delta < 0.1 || (std::sqrt(delta) + v_rel < 0.1)) {
+    return max_ttc;
+  }
+  return std::min(2 * x_lead / (std::sqrt(delta) + v_rel), max_ttc);
+}
+
+bool FCWChecker::update(const lead_log_t &mpc_solution, double cur_time, bool active, double v_ego, double a_ego,
+                        double x_lead, double v_lead, double a_lead, double y_lead, double vlat_lead, double fcw_lead, bool blinkers) {
+  const double *mpc_solution_a = mpc_solution.a_ego;
+
+  last_min_a = *std::min_element(mpc_solution_a, mpc_solution_a + LEAD_MPC_N + 1);
+  v_lead_max = std::max(v_lead_max, v_lead);
+
+  common_counters.blinkers = !blinkers ? common_counters.blinkers + 10.0 / (20 * 3.0) : 0;
+  common_counters.v_ego = v_ego > 5.0 ? common_counters.v_ego + 1 : 0;
+
+  if (fcw_lead > 0.99) {
+    double ttc = calcTtc(v_ego, a_ego, x_lead, v_lead, a_lead);
+    counters.ttc = ttc < 2.5 ? counters.ttc + 1 : 0;
+    counters.v_lead_max = v_lead_max > 2.5 ? counters.v_lead_max + 1 : 0;
+    counters.v_ego_lead = v_ego > v_lead ? counters.v_ego_lead + 1 : 0;
+    counters.lead_seen = counters.lead_seen + 0.33;
+    counters.y_lead = std::abs(y_lead) < 1.0 ? counters.y_lead + 1 : 0;
+    counters.vlat_lead = std::abs(vlat_lead) < 0.4 ? counters.vlat_lead + 1 : 0;
+
+    double a_thr = interp(v_lead, FCW_A_ACT_BP, FCW_A_ACT_V);
+    double a_delta = *std::min_element(mpc_solution_a, mpc_solution_a + 15) - std::min(0.0, a_ego);
+
+    bool future_fcw_allowed = counters.ttc >= 10 && counters.v_lead_max >= 10 && counters.v_ego_lead >= 10 &&
+                              counters.lead_seen >= 10 && counters.y_lead >= 10 && counters.vlat_lead >= 10;
+    future_fcw_allowed = future_fcw_allowed && common_counters.blinkers >= 10 && common_counters.v_ego >= 10;
+    bool future_fcw = (last_min_a < -3.0 || a_delta < a_thr) && future_fcw_allowed;
+
+    if (future_fcw && (last_fcw_time + 5.0 < cur_time)) {
+      last_fcw_time = cur_time;
+      last_fcw_a = last_min_a;
+      return true;
+    }
+  }
+
+  return false;
+}
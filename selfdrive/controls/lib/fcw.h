@@ -0,0 +1,24 @@
+#pragma once
+
+#include "selfdrive/controls/lib/long_mpc_batch/long_mpc_batch.h"
+
+// fcw.py
+class FCWChecker {
+public:
+  FCWChecker() { resetLead(0.0); }
+  void resetLead(double cur_time);
+  static double calcTtc(double v_ego, double a_ego, double x_lead, double v_lead, double a_lead);
+  bool update(const lead_log_t &mpc_solution, double cur_time, bool active, double v_ego, double a_ego,
+              double x_lead, double v_lead, double a_lead, double y_lead, double vlat_lead, double fcw_lead, bool blinkers);
+
+  struct {
+    double ttc, v_lead_max, v_ego_lead, lead_seen, y_lead, vlat_lead;
+  } counters;
+
+private:
+  struct {
+    double blinkers = 0, v_ego = 0;
+  } common_counters;
+
+  double last_fcw_a, v_lead_max, lead_seen_t, last_fcw_time, last_min_a;
+};
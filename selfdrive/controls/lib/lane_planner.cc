@@ -0,0 +1,92 @@
+#include "selfdrive/controls/lib/lane_planner.h"
+
+#include <cmath>
+
+#include "selfdrive/common/swaglog.h"
+
+// camera offset is meters from center car to camera
+const double CAMERA_OFFSET = -0.04;
+const double PATH_OFFSET = -0.05;
+
+LanePlanner::LanePlanner(bool wide_camera)
+    : lane_width_estimate(3.7, 9.95, DT_MDL), lane_width_certainty(1.0, 0.95, DT_MDL) {
+  camera_offset = wide_camera ? -CAMERA_OFFSET : CAMERA_OFFSET;
+  path_offset = wide_camera ? -PATH_OFFSET : PATH_OFFSET;
+}
+
+void LanePlanner::parseModel(const cereal::ModelDataV2::Reader &md) {
+  auto lane_lines = md.getLaneLines();
+  if (lane_lines.size() == 4 && lane_lines[0].getT().size() == TRAJECTORY_SIZE) {
+    auto left = lane_lines[1], right = lane_lines[2];
+    for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+      ll_t[i] = (left.getT()[i] + right.getT()[i]) / 2;
+      // left and right ll x is the same
+      ll_x[i] = left.getX()[i];
+      // only offset left and right lane lines; offsetting path does not make sense
+      lll_y[i] = left.getY()[i] - camera_offset;
+      rll_y[i] = right.getY()[i] - camera_offset;
+    }
+    lll_prob = md.getLaneLineProbs()[1];
+    rll_prob = md.getLaneLineProbs()[2];
+    lll_std = md.getLaneLineStds()[1];
+    rll_std = md.getLaneLineStds()[2];
+  }
+
+  auto desire_state = md.getMeta().getDesireState();
+  if (desire_state.size()) {
+    l_lane_change_prob = desire_state[(int)cereal::LateralPlan::Desire::LANE_CHANGE_LEFT];
+    r_lane_change_prob = desire_state[(int)cereal::LateralPlan::Desire::LANE_CHANGE_RIGHT];
+  }
+}
+
+void LanePlanner::getDPath(double v_ego, const std::array<double, TRAJECTORY_SIZE> &path_t, PathXYZ &path_xyz) {
+  static const double WIDTH_BP[] = {4.0, 5.0}, WIDTH_V[] = {1.0, 0.0};
+  static const double STD_BP[] = {.15, .3}, STD_V[] = {1.0, 0.0};
+
+  // Reduce reliance on lanelines that are too far apart or
+  // will be in a few seconds
+  for (auto &p : path_xyz) p[1] -= path_offset;
+  double l_prob = lll_prob, r_prob = rll_prob;
+  std::array<double, TRAJECTORY_SIZE> width_pts;
+  for (int i = 0; i < TRAJECTORY_SIZE; i++) width_pts[i] = rll_y[i] - lll_y[i];
+  double mod = 1.0;
+  for (double t_check : {0.0, 1.5, 3.0}) {
+    double width_at_t = interp(t_check * (v_ego + 7), ll_x, width_pts);
+    mod = std::min(mod, interp(width_at_t, WIDTH_BP, WIDTH_V));
+  }
+  l_prob *= mod;
+  r_prob *= mod;
+
+  // Reduce reliance on uncertain lanelines
+  l_prob *= interp(lll_std, STD_BP, STD_V);
+  r_prob *= interp(rll_std, STD_BP, STD_V);
+
+  // Find current lanewidth
+  static const double SPEED_BP[] = {0., 31.}, SPEED_WIDTH_V[] = {2.8, 3.5};
+  lane_width_certainty.update(l_prob * r_prob);
+  lane_width_estimate.update(std::abs(rll_y[0] - lll_y[0]));
+  double speed_lane_width = interp(v_ego, SPEED_BP, SPEED_WIDTH_V);
+  lane_width = lane_width_certainty.x() * lane_width_estimate.x() + (1 - lane_width_certainty.x()) * speed_lane_width;
+
+  double clipped_lane_width = std::min(4.0, lane_width);
+  d_prob = l_prob + r_prob - l_prob * r_prob;
+
+  // the lane path at the finite lane line times
+  std::array<double, TRAJECTORY_SIZE> safe_t, lane_path_y;
+  size_t n = 0;
+  for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+    if (!std::isfinite(ll_t[i])) continue;
+    double path_from_left_lane = lll_y[i] + clipped_lane_width / 2.0;
+    double path_from_right_lane = rll_y[i] - clipped_lane_width / 2.0;
+    safe_t[n] = ll_t[i];
+    lane_path_y[n++] = (l_prob * path_from_left_lane + r_prob * path_from_right_lane) / (l_prob + r_prob + 0.0001);
+  }
+  if (std::isfinite(ll_t[0])) {
+    for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+      double lane_path_y_interp = interp(path_t[i], safe_t, lane_path_y, n);
+      path_xyz[i][1] = d_prob * lane_path_y_interp + (1.0 - d_prob) * path_xyz[i][1];
+    }
+  } else {
+    LOGW("Lateral mpc - NaNs in laneline times, ignoring");
+  }
+}
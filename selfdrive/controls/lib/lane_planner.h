@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/common/modeldata.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/controls/lib/drive_helpers.h"
+
+typedef std::array<std::array<double, 3>, TRAJECTORY_SIZE> PathXYZ;
+
+// lane_planner.py
+class LanePlanner {
+public:
+  LanePlanner(bool wide_camera = false);
+  void parseModel(const cereal::ModelDataV2::Reader &md);
+  // blends the lane lines into path_xyz in place, like the python does
+  void getDPath(double v_ego, const std::array<double, TRAJECTORY_SIZE> &path_t, PathXYZ &path_xyz);
+
+  double lane_width = 3.7;
+  double lll_prob = 0., rll_prob = 0., d_prob = 0.;
+  double l_lane_change_prob = 0., r_lane_change_prob = 0.;
+
+private:
+  std::array<double, TRAJECTORY_SIZE> ll_t = {}, ll_x = {}, lll_y = {}, rll_y = {};
+  double lll_std = 0., rll_std = 0.;
+  FirstOrderFilter lane_width_estimate, lane_width_certainty;
+  double camera_offset, path_offset;
+};
@@ -1,6 +1,8 @@
 #include "acado_common.h"
 #include "acado_auxiliary_functions.h"
 #include "common/modeldata.h"
+#include "selfdrive/controls/lib/mpc_stats.h"
+#include <math.h>
 #include <stdio.h>
 
 #define NX          ACADO_NX  /* Number of differential state variables.  */
@@ -27,8 +29,20 @@ typedef struct {
   double curvature[N+1];
   double curvature_rate[N];
   double cost;
+  double solve_time;    /* s */
+  int sqp_iterations;
+  int qp_iterations;    /* qpOASES working set recalculations, summed */
+  int status;           /* of the last acado_feedbackStep, 0 when the QP was solved */
+  double kkt;           /* KKT tolerance of the final iterate */
+  int qp_hotstarts;     /* SQP iterations whose QP was hot started */
+  double solve_time_p50, solve_time_p90, solve_time_p99;  /* s, see mpc_stats.h */
 } log_t;
 
+static int max_sqp_iterations = 1;
+static double kkt_tolerance = 0.0;
+static double shift_dt = 0.0;
+static mpc_stats_t stats;
+
 void set_weights(double pathCost, double headingCost, double steerRateCost){
   int    i;
   const int STEP_MULTIPLIER = 3.0;
@@ -60,10 +74,73 @@ void init(){
   for (i = 0; i < NX; ++i) acadoVariables.x0[ i ] = 0.0;
 }
 
+/* Up to max_iterations SQP iterations per run_mpc, stopping once the KKT
+   tolerance of the iterate drops below kkt_tol. With dt > 0 the last solution
+   is moved dt seconds ahead along T_IDXS before it warm starts the next solve,
+   otherwise it's reused as it is. */
+void set_solver_options(int max_iterations, double kkt_tol, double dt){
+  max_sqp_iterations = max_iterations > 0 ? max_iterations : 1;
+  kkt_tolerance = kkt_tol;
+  shift_dt = dt;
+}
+
+/* values[k * stride] at T_IDXS[k] for k < len, interpolated at t */
+static double interp_nodes(const real_t * values, int stride, int len, double t){
+  int k = 0;
+  if (t >= T_IDXS[len - 1]) return values[(len - 1) * stride];
+  while (k < len - 2 && T_IDXS[k + 1] <= t) k++;
+  double f = (t - T_IDXS[k]) / (T_IDXS[k + 1] - T_IDXS[k]);
+  return values[k * stride] + f * (values[(k + 1) * stride] - values[k * stride]);
+}
+
+/* The horizon is not uniform, so acado_shiftStates would move the nodes by
+   anything from 10 ms to 300 ms. Resample the trajectory at the shifted times
+   instead, and move it into the frame of the car at dt, which is where the
+   next solve starts from. */
+static void shift_solution(double dt){
+  static real_t x_prev[NX * (N + 1)];
+  static real_t u_prev[NU * N];
+  int i, j;
+
+  for (i = 0; i < NX * (N + 1); i++) x_prev[i] = acadoVariables.x[i];
+  for (i = 0; i < NU * N; i++) u_prev[i] = acadoVariables.u[i];
+
+  for (i = 0; i <= N; i++){
+    for (j = 0; j < NX; j++){
+      acadoVariables.x[i * NX + j] = interp_nodes(&x_prev[j], NX, N + 1, T_IDXS[i] + dt);
+    }
+  }
+  for (i = 0; i < N; i++){
+    for (j = 0; j < NU; j++){
+      acadoVariables.u[i * NU + j] = interp_nodes(&u_prev[j], NU, N, T_IDXS[i] + dt);
+    }
+  }
+
+  /* x, y and psi are relative to the car */
+  double x0 = acadoVariables.x[0], y0 = acadoVariables.x[1], psi0 = acadoVariables.x[2];
+  double c = cos(psi0), s = sin(psi0);
+  for (i = 0; i <= N; i++){
+    double dx = acadoVariables.x[i * NX] - x0, dy = acadoVariables.x[i * NX + 1] - y0;
+    acadoVariables.x[i * NX] = c * dx + s * dy;
+    acadoVariables.x[i * NX + 1] = -s * dx + c * dy;
+    acadoVariables.x[i * NX + 2] -= psi0;
+  }
+}
+
+/* Keep the QP between solves, see acado_qpoases_interface.cpp */
+void set_qp_reuse(int reuse){
+  acado_setQPReuse(reuse);
+}
+
 int run_mpc(state_t * x0, log_t * solution, double v_ego,
              double rotation_radius, double target_y[N+1], double target_psi[N+1]){
 
   int    i;
+  double start = mpc_stats_seconds();
+
+  if (shift_dt > 0){
+    shift_solution(shift_dt);
+  }
 
   for (i = 0; i <= NOD * N; i+= NOD){
     acadoVariables.od[i] = v_ego;
@@ -83,11 +160,17 @@ int run_mpc(state_t * x0, log_t * solution, double v_ego,
   acadoVariables.x0[3] = x0->tire_angle;
 
 
-  acado_preparationStep();
-  acado_feedbackStep();
-
-  /* printf("lat its: %d\n", acado_getNWSR());  // n iterations
-  printf("Objective: %.6f\n", acado_getObjective());  // solution cost */
+  solution->sqp_iterations = 0;
+  solution->qp_iterations = 0;
+  solution->qp_hotstarts = 0;
+  do {
+    acado_preparationStep();
+    solution->status = acado_feedbackStep();
+    solution->qp_iterations += acado_getNWSR();
+    solution->qp_hotstarts += acado_getQPHotstarted();
+    solution->sqp_iterations++;
+    solution->kkt = acado_getKKT();
+  } while (solution->sqp_iterations < max_sqp_iterations && solution->status == 0 && solution->kkt > kkt_tolerance);
 
   for (i = 0; i <= N; i++){
     solution->x[i] = acadoVariables.x[i*NX];
@@ -99,11 +182,11 @@ int run_mpc(state_t * x0, log_t * solution, double v_ego,
     }
   }
   solution->cost = acado_getObjective();
+  solution->solve_time = mpc_stats_seconds() - start;
+  mpc_stats_add(&stats, solution->solve_time);
+  solution->solve_time_p50 = stats.p50;
+  solution->solve_time_p90 = stats.p90;
+  solution->solve_time_p99 = stats.p99;
 
-  // Dont shift states here. Current solution is closer to next timestep than if
-  // we use the old solution as a starting point
-  //acado_shiftStates(2, 0, 0);
-  //acado_shiftControls( 0 );
-
-  return acado_getNWSR();
+  return solution->qp_iterations;
 }
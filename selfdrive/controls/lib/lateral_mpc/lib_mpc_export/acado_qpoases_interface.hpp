@@ -59,6 +59,12 @@ EXTERNC int acado_solve( void );
 /** Get the number of active set changes */
 EXTERNC int acado_getNWSR( void );
 
+/** Keep the QP between solves and hot start it when its matrices are unchanged */
+EXTERNC void acado_setQPReuse( int reuse );
+
+/** Whether the last solve hot started the QP of the solve before */
+EXTERNC int acado_getQPHotstarted( void );
+
 /** Get the error string. */
 const char* acado_getErrorString( int error );
 
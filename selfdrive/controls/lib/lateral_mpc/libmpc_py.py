@@ -20,10 +20,19 @@ typedef struct {
     double curvature[N+1];
     double curvature_rate[N];
     double cost;
+    double solve_time;
+    int sqp_iterations;
+    int qp_iterations;
+    int status;
+    double kkt;
+    int qp_hotstarts;
+    double solve_time_p50, solve_time_p90, solve_time_p99;
 } log_t;
 
 void init();
 void set_weights(double pathCost, double headingCost, double steerRateCost);
+void set_solver_options(int max_iterations, double kkt_tol, double dt);
+void set_qp_reuse(int reuse);
 int run_mpc(state_t * x0, log_t * solution,
              double v_ego, double rotation_radius,
              double target_y[N+1], double target_psi[N+1]);
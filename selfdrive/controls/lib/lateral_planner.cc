@@ -0,0 +1,319 @@
+#include "selfdrive/controls/lib/lateral_planner.h"
+
+#include <cmath>
+
+#include "selfdrive/common/timing.h"
+
+using cereal::LateralPlan;
+typedef LateralPlan::LaneChangeState LaneChangeState;
+typedef LateralPlan::LaneChangeDirection LaneChangeDirection;
+typedef LateralPlan::Desire Desire;
+
+// the last solution is shifted by a model step to warm start the next one,
+// a second SQP iteration only runs if the first didn't converge
+const int LAT_MPC_MAX_ITERATIONS = 2;
+const double LAT_MPC_KKT_TOL = 1e-3;
+
+const double LANE_CHANGE_TIME_MAX = 10.;
+
+static Desire lane_change_desire(LaneChangeDirection direction, LaneChangeState state) {
+  if (state != LaneChangeState::LANE_CHANGE_STARTING && state != LaneChangeState::LANE_CHANGE_FINISHING) {
+    return Desire::NONE;
+  }
+  if (direction == LaneChangeDirection::LEFT) return Desire::LANE_CHANGE_LEFT;
+  if (direction == LaneChangeDirection::RIGHT) return Desire::LANE_CHANGE_RIGHT;
+  return Desire::NONE;
+}
+
+static double norm(const std::array<double, 3> &p) {
+  return std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+}
+
+LateralPlanner::LateralPlanner(const cereal::CarParams::Reader &CP, bool use_lanelines, bool wide_camera)
+    : lib("lib/lateral_mpc/libmpc.so"), use_lanelines(use_lanelines), LP(wide_camera) {
+  steer_rate_cost = CP.getSteerRateCost();
+
+  mpc_init = lib.get<decltype(mpc_init)>("init");
+  mpc_set_weights = lib.get<decltype(mpc_set_weights)>("set_weights");
+  run_mpc = lib.get<decltype(run_mpc)>("run_mpc");
+  mpc_init();
+  lib.get<void (*)(int, double, double)>("set_solver_options")(LAT_MPC_MAX_ITERATIONS, LAT_MPC_KKT_TOL, DT_MDL);
+  lib.get<void (*)(int)>("set_qp_reuse")(true);
+
+  for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+    path_xyz_stds[i] = {1., 1., 1.};
+    t_idxs[i] = i;
+  }
+}
+
+void LateralPlanner::updateLaneChange(SubMaster &sm, double v_ego, bool active) {
+  auto car_state = sm["carState"].getCarState();
+  auto dp = sm["dragonConf"].getDragonConf();
+
+  bool one_blinker = car_state.getLeftBlinker() != car_state.getRightBlinker();
+  bool below_lane_change_speed = v_ego < dp.getDpLcMinMph() * MPH_TO_MS;
+
+  if (!active || lane_change_timer > LANE_CHANGE_TIME_MAX) {
+    lane_change_state = LaneChangeState::OFF;
+    lane_change_direction = LaneChangeDirection::NONE;
+  } else {
+    bool reset = false;
+    if (one_blinker) {
+      double cur_time = seconds_since_boot();
+      // reach auto lc condition
+      if (!below_lane_change_speed && dp.getDpLateralMode() == 2 && v_ego >= dp.getDpLcAutoMinMph() * MPH_TO_MS) {
+        // work out alc start time and torque apply end time
+        if (dp_lc_auto_start == 0.) {
+          dp_lc_auto_start = cur_time + dp.getDpLcAutoDelay();
+          dp_lc_auto_torque_end = dp_lc_auto_start + dp_torque_apply_length;
+        } else {
+          // work out how long til alc start, for display only
+          dp_lc_auto_start_in = dp_lc_auto_start - cur_time;
+          dp_torque_apply = dp_lc_auto_start < cur_time && cur_time <= dp_lc_auto_torque_end;
+        }
+      }
+    } else {
+      reset = true;
+    }
+
+    // reset all vals
+    if (reset) {
+      dp_lc_auto_start = 0.;
+      dp_lc_auto_start_in = 0.;
+      dp_lc_auto_torque_end = 0.;
+      dp_torque_apply = false;
+    }
+
+    if (lane_change_state == LaneChangeState::OFF && one_blinker && !prev_one_blinker && !below_lane_change_speed) {
+      lane_change_state = LaneChangeState::PRE_LANE_CHANGE;
+      lane_change_ll_prob = 1.0;
+
+    } else if (lane_change_state == LaneChangeState::PRE_LANE_CHANGE) {
+      // Set lane change direction
+      if (car_state.getLeftBlinker()) {
+        lane_change_direction = LaneChangeDirection::LEFT;
+      } else if (car_state.getRightBlinker()) {
+        lane_change_direction = LaneChangeDirection::RIGHT;
+      } else {  // If there are no blinkers we will go back to LaneChangeState.off
+        lane_change_direction = LaneChangeDirection::NONE;
+      }
+
+      bool torque_applied = car_state.getSteeringPressed() &&
+                            ((car_state.getSteeringTorque() > 0 && lane_change_direction == LaneChangeDirection::LEFT) ||
+                             (car_state.getSteeringTorque() < 0 && lane_change_direction == LaneChangeDirection::RIGHT));
+
+      bool blindspot_detected = (car_state.getLeftBlindspot() && lane_change_direction == LaneChangeDirection::LEFT) ||
+                                (car_state.getRightBlindspot() && lane_change_direction == LaneChangeDirection::RIGHT);
+
+      // if human made lane change prior alca, we should stop alca until new blinker (off -> on)
+      if (torque_applied) dp_lc_auto_start = dp_lc_auto_torque_end;
+      if (dp_torque_apply) torque_applied = true;
+      if (!one_blinker || below_lane_change_speed) {
+        lane_change_state = LaneChangeState::OFF;
+      } else if (torque_applied && !blindspot_detected) {
+        lane_change_state = LaneChangeState::LANE_CHANGE_STARTING;
+      }
+
+    } else if (lane_change_state == LaneChangeState::LANE_CHANGE_STARTING) {
+      // fade out over .5s
+      lane_change_ll_prob = std::max(lane_change_ll_prob - 2 * DT_MDL, 0.0);
+
+      // 98% certainty
+      double lane_change_prob = LP.l_lane_change_prob + LP.r_lane_change_prob;
+      if (lane_change_prob < 0.02 && lane_change_ll_prob < 0.01) {
+        lane_change_state = LaneChangeState::LANE_CHANGE_FINISHING;
+      }
+
+    } else if (lane_change_state == LaneChangeState::LANE_CHANGE_FINISHING) {
+      // fade in laneline over 1s
+      lane_change_ll_prob = std::min(lane_change_ll_prob + DT_MDL, 1.0);
+      if (one_blinker && lane_change_ll_prob > 0.99) {
+        lane_change_state = LaneChangeState::PRE_LANE_CHANGE;
+      } else if (lane_change_ll_prob > 0.99) {
+        lane_change_state = LaneChangeState::OFF;
+      }
+    }
+  }
+
+  if (lane_change_state == LaneChangeState::OFF || lane_change_state == LaneChangeState::PRE_LANE_CHANGE) {
+    lane_change_timer = 0.0;
+  } else {
+    lane_change_timer += DT_MDL;
+  }
+
+  prev_one_blinker = one_blinker;
+
+  desire = lane_change_desire(lane_change_direction, lane_change_state);
+
+  // Send keep pulse once per second during LaneChangeStart.preLaneChange
+  if (lane_change_state == LaneChangeState::OFF || lane_change_state == LaneChangeState::LANE_CHANGE_STARTING) {
+    keep_pulse_timer = 0.0;
+  } else if (lane_change_state == LaneChangeState::PRE_LANE_CHANGE) {
+    keep_pulse_timer += DT_MDL;
+    if (keep_pulse_timer > 1.0) {
+      keep_pulse_timer = 0.0;
+    } else if (desire == Desire::KEEP_LEFT || desire == Desire::KEEP_RIGHT) {
+      desire = Desire::NONE;
+    }
+  }
+}
+
+void LateralPlanner::setLanelessWeights(double v_ego) {
+  static const double HEADING_BP[] = {5.0, 10.0}, HEADING_V[] = {MPC_COST_LAT::HEADING, 0.0};
+  double path_cost = clip(std::abs(path_xyz[0][1] / path_xyz_stds[0][1]), 0.5, 5.0) * MPC_COST_LAT::PATH;
+  // Heading cost is useful at low speed, otherwise end of plan can be off-heading
+  double heading_cost = interp(v_ego, HEADING_BP, HEADING_V);
+  mpc_set_weights(path_cost, heading_cost, steer_rate_cost);
+}
+
+void LateralPlanner::update(SubMaster &sm) {
+  auto dp = sm["dragonConf"].getDragonConf();
+  auto controls_state = sm["controlsState"].getControlsState();
+  use_lanelines = !dp.getDpLaneLessModeCtrl();
+  laneless_mode = dp.getDpLaneLessMode();
+  double v_ego = sm["carState"].getCarState().getVEgo();
+  bool active = controls_state.getActive();
+  double measured_curvature = controls_state.getCurvature();
+
+  auto md = sm["modelV2"].getModelV2();
+  LP.parseModel(md);
+  auto position = md.getPosition(), orientation = md.getOrientation();
+  if (position.getX().size() == TRAJECTORY_SIZE && orientation.getX().size() == TRAJECTORY_SIZE) {
+    for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+      path_xyz[i] = {position.getX()[i], position.getY()[i], position.getZ()[i]};
+      t_idxs[i] = position.getT()[i];
+      plan_yaw[i] = orientation.getZ()[i];
+    }
+  }
+  if (orientation.getXStd().size() == TRAJECTORY_SIZE) {
+    for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+      path_xyz_stds[i] = {position.getXStd()[i], position.getYStd()[i], position.getZStd()[i]};
+    }
+  }
+
+  updateLaneChange(sm, v_ego, active);
+
+  // Turn off lanes during lane change
+  if (desire == Desire::LANE_CHANGE_RIGHT || desire == Desire::LANE_CHANGE_LEFT) {
+    LP.lll_prob *= lane_change_ll_prob;
+    LP.rll_prob *= lane_change_ll_prob;
+  }
+  LP.getDPath(v_ego, t_idxs, path_xyz);
+
+  // path_xyz already has the lanes in it, the modes that use the path with lanes blend them in once more
+  bool lanes_off = lane_change_state == LaneChangeState::OFF;
+  double ll_prob = (LP.lll_prob + LP.rll_prob) / 2;
+  if (use_lanelines) {
+    mpc_set_weights(MPC_COST_LAT::PATH, MPC_COST_LAT::HEADING, steer_rate_cost);
+    laneless_mode_status = false;
+  } else if (laneless_mode == 0) {
+    LP.getDPath(v_ego, t_idxs, path_xyz);
+    mpc_set_weights(MPC_COST_LAT::PATH, MPC_COST_LAT::HEADING, steer_rate_cost);
+    laneless_mode_status = false;
+  } else if (laneless_mode == 1) {
+    setLanelessWeights(v_ego);
+    laneless_mode_status = true;
+  } else if (laneless_mode == 2 && ll_prob < 0.3 && lanes_off) {
+    setLanelessWeights(v_ego);
+    laneless_mode_status = true;
+    laneless_mode_status_buffer = true;
+  } else if (laneless_mode == 2 && ll_prob > 0.5 && laneless_mode_status_buffer && lanes_off) {
+    LP.getDPath(v_ego, t_idxs, path_xyz);
+    mpc_set_weights(MPC_COST_LAT::PATH, MPC_COST_LAT::HEADING, steer_rate_cost);
+    laneless_mode_status = false;
+    laneless_mode_status_buffer = false;
+  } else if (laneless_mode == 2 && laneless_mode_status_buffer && lanes_off) {
+    setLanelessWeights(v_ego);
+    laneless_mode_status = true;
+  } else {
+    LP.getDPath(v_ego, t_idxs, path_xyz);
+    mpc_set_weights(MPC_COST_LAT::PATH, MPC_COST_LAT::HEADING, steer_rate_cost);
+    laneless_mode_status = false;
+    laneless_mode_status_buffer = false;
+  }
+
+  std::array<double, TRAJECTORY_SIZE> path_dist, path_y;
+  for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+    path_dist[i] = norm(path_xyz[i]);
+    path_y[i] = path_xyz[i][1];
+  }
+  std::array<double, LAT_MPC_N + 1> heading_pts;
+  for (int i = 0; i <= LAT_MPC_N; i++) {
+    y_pts[i] = interp(v_ego * t_idxs[i], path_dist, path_y);
+    heading_pts[i] = interp(v_ego * t_idxs[i], path_dist, plan_yaw);
+  }
+
+  // for now CAR_ROTATION_RADIUS is disabled, to use it, enable it in the MPC
+  static_assert(CAR_ROTATION_RADIUS < 1e-3 && CAR_ROTATION_RADIUS > -1e-3);
+  run_mpc(&cur_state, &mpc_solution, v_ego, CAR_ROTATION_RADIUS, y_pts.data(), heading_pts.data());
+  // init state for next
+  cur_state.x = 0.0;
+  cur_state.y = 0.0;
+  cur_state.psi = 0.0;
+  cur_state.curvature = interp(DT_MDL, t_idxs, mpc_solution.curvature, LAT_MPC_N + 1);
+
+  // Check for infeasable MPC solution
+  bool mpc_nans = false;
+  for (double c : mpc_solution.curvature) mpc_nans |= std::isnan(c);
+  double t = seconds_since_boot();
+  if (mpc_nans) {
+    mpc_init();
+    cur_state.curvature = measured_curvature;
+
+    if (t > last_cloudlog_t + 5.0) {
+      last_cloudlog_t = t;
+      LOGW("Lateral mpc - nan: True");
+    }
+  }
+
+  // TODO: find a better way to detect when MPC did not converge
+  if (mpc_solution.cost > 20000. || mpc_nans) {
+    solution_invalid_cnt += 1;
+  } else {
+    solution_invalid_cnt = 0;
+  }
+}
+
+void LateralPlanner::publish(SubMaster &sm, PubMaster &pm) {
+  bool plan_solution_valid = solution_invalid_cnt < 2;
+  PooledMessageBuilder msg("lateralPlan");
+  auto plan = msg.initEvent(sm.allAliveAndValid({"carState", "controlsState", "modelV2", "dragonConf"})).initLateralPlan();
+  plan.setLaneWidth(LP.lane_width);
+
+  auto d_path_points = plan.initDPathPoints(LAT_MPC_N + 1);
+  for (int i = 0; i <= LAT_MPC_N; i++) d_path_points.set(i, y_pts[i]);
+  auto psis = plan.initPsis(CONTROL_N);
+  auto curvatures = plan.initCurvatures(CONTROL_N);
+  auto curvature_rates = plan.initCurvatureRates(CONTROL_N);
+  for (int i = 0; i < CONTROL_N; i++) {
+    psis.set(i, mpc_solution.psi[i]);
+    curvatures.set(i, mpc_solution.curvature[i]);
+    curvature_rates.set(i, i < CONTROL_N - 1 ? mpc_solution.curvature_rate[i] : 0.0);
+  }
+  plan.setLProb(LP.lll_prob);
+  plan.setRProb(LP.rll_prob);
+  plan.setDProb(LP.d_prob);
+
+  plan.setMpcSolutionValid(plan_solution_valid);
+  plan.setSolverExecutionTime(mpc_solution.solve_time);
+  plan.setSolverIterations(mpc_solution.sqp_iterations);
+  plan.setSolverQpIterations(mpc_solution.qp_iterations);
+  plan.setSolverStatus(mpc_solution.status);
+  plan.setSolverKkt(mpc_solution.kkt);
+
+  plan.setDesire(desire);
+  plan.setLaneChangeState(lane_change_state);
+  plan.setLaneChangeDirection(lane_change_direction);
+  plan.setDpALCAStartIn(dp_lc_auto_start_in);
+
+  auto d_path_x = plan.initDPathWLinesX(TRAJECTORY_SIZE);
+  auto d_path_y = plan.initDPathWLinesY(TRAJECTORY_SIZE);
+  for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+    d_path_x.set(i, path_xyz[i][0]);
+    d_path_y.set(i, path_xyz[i][1]);
+  }
+
+  plan.setDpLaneLessModeStatus(laneless_mode_status);
+
+  pm.send("lateralPlan", msg);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/controls/lib/lane_planner.h"
+#include "selfdrive/controls/lib/mpc_library.h"
+
+// the state_t and log_t of lateral_mpc/lateral_mpc.c
+struct LatMpcState {
+  double x, y, psi, curvature, curvature_rate;
+};
+
+struct LatMpcLog {
+  double x[LAT_MPC_N + 1];
+  double y[LAT_MPC_N + 1];
+  double psi[LAT_MPC_N + 1];
+  double curvature[LAT_MPC_N + 1];
+  double curvature_rate[LAT_MPC_N];
+  double cost;
+  double solve_time;
+  int sqp_iterations;
+  int qp_iterations;
+  int status;
+  double kkt;
+  int qp_hotstarts;
+  double solve_time_p50, solve_time_p90, solve_time_p99;
+};
+
+// lateral_planner.py, publishes the same lateralPlan
+class LateralPlanner {
+public:
+  LateralPlanner(const cereal::CarParams::Reader &CP, bool use_lanelines = true, bool wide_camera = false);
+  void update(SubMaster &sm);
+  void publish(SubMaster &sm, PubMaster &pm);
+
+private:
+  void updateLaneChange(SubMaster &sm, double v_ego, bool active);
+  void setLanelessWeights(double v_ego);
+
+  MpcLibrary lib;
+  void (*mpc_init)();
+  void (*mpc_set_weights)(double path_cost, double heading_cost, double steer_rate_cost);
+  int (*run_mpc)(LatMpcState *x0, LatMpcLog *solution, double v_ego, double rotation_radius,
+                 double *target_y, double *target_psi);
+
+  bool use_lanelines;
+  LanePlanner LP;
+  double steer_rate_cost;
+  double last_cloudlog_t = 0.;
+
+  LatMpcState cur_state = {};
+  LatMpcLog mpc_solution = {};
+  int solution_invalid_cnt = 0;
+
+  cereal::LateralPlan::LaneChangeState lane_change_state = cereal::LateralPlan::LaneChangeState::OFF;
+  cereal::LateralPlan::LaneChangeDirection lane_change_direction = cereal::LateralPlan::LaneChangeDirection::NONE;
+  double lane_change_timer = 0.;
+  double lane_change_ll_prob = 1.;
+  double keep_pulse_timer = 0.;
+  bool prev_one_blinker = false;
+  cereal::LateralPlan::Desire desire = cereal::LateralPlan::Desire::NONE;
+
+  // path_xyz is also the d_path of the python, get_d_path blends the lanes into it in place
+  PathXYZ path_xyz = {}, path_xyz_stds;
+  std::array<double, TRAJECTORY_SIZE> plan_yaw = {}, t_idxs;
+  std::array<double, LAT_MPC_N + 1> y_pts = {};
+
+  // dp
+  double dp_torque_apply_length = 1.5;  // secs of torque we apply for
+  double dp_lc_auto_start = 0.;  // time to start alc
+  double dp_lc_auto_start_in = 0.;  // remaining time to start alc
+  double dp_lc_auto_torque_end = 0.;  // time to end applying torque
+  bool dp_torque_apply = false;  // should we apply torque?
+
+  int laneless_mode = 2;  // AUTO
+  bool laneless_mode_status = false;
+  bool laneless_mode_status_buffer = false;
+};
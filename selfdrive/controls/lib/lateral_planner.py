@@ -13,6 +13,11 @@ from cereal import log
 LaneChangeState = log.LateralPlan.LaneChangeState
 LaneChangeDirection = log.LateralPlan.LaneChangeDirection
 
+# the last solution is shifted by a model step to warm start the next one,
+# a second SQP iteration only runs if the first didn't converge
+LAT_MPC_MAX_ITERATIONS = 2
+LAT_MPC_KKT_TOL = 1e-3
+
 LANE_CHANGE_SPEED_MIN = 30 * CV.MPH_TO_MS
 LANE_CHANGE_TIME_MAX = 10.
 
@@ -77,6 +82,14 @@ class LateralPlanner():
   def setup_mpc(self):
     self.libmpc = libmpc_py.libmpc
     self.libmpc.init()
+    self.libmpc.set_solver_options(LAT_MPC_MAX_ITERATIONS, LAT_MPC_KKT_TOL, DT_MDL)
+    self.libmpc.set_qp_reuse(True)
+
+    # references are written into these in place, instead of new lists every solve
+    self.mpc_y_pts = libmpc_py.ffi.new("double[]", LAT_MPC_N + 1)
+    self.mpc_heading_pts = libmpc_py.ffi.new("double[]", LAT_MPC_N + 1)
+    self.mpc_y_view = np.frombuffer(libmpc_py.ffi.buffer(self.mpc_y_pts), dtype=np.float64)
+    self.mpc_heading_view = np.frombuffer(libmpc_py.ffi.buffer(self.mpc_heading_pts), dtype=np.float64)
 
     self.mpc_solution = libmpc_py.ffi.new("log_t *")
     self.cur_state = libmpc_py.ffi.new("state_t *")
@@ -263,11 +276,13 @@ class LateralPlanner():
     # for now CAR_ROTATION_RADIUS is disabled
     # to use it, enable it in the MPC
     assert abs(CAR_ROTATION_RADIUS) < 1e-3
+    self.mpc_y_view[:] = y_pts
+    self.mpc_heading_view[:] = heading_pts
     self.libmpc.run_mpc(self.cur_state, self.mpc_solution,
                         float(v_ego),
                         CAR_ROTATION_RADIUS,
-                        list(y_pts),
-                        list(heading_pts))
+                        self.mpc_y_pts,
+                        self.mpc_heading_pts)
     # init state for next
     self.cur_state.x = 0.0
     self.cur_state.y = 0.0
@@ -304,6 +319,11 @@ class LateralPlanner():
     plan_send.lateralPlan.dProb = float(self.LP.d_prob)
 
     plan_send.lateralPlan.mpcSolutionValid = bool(plan_solution_valid)
+    plan_send.lateralPlan.solverExecutionTime = float(self.mpc_solution.solve_time)
+    plan_send.lateralPlan.solverIterations = int(self.mpc_solution.sqp_iterations)
+    plan_send.lateralPlan.solverQpIterations = int(self.mpc_solution.qp_iterations)
+    plan_send.lateralPlan.solverStatus = int(self.mpc_solution.status)
+    plan_send.lateralPlan.solverKkt = float(self.mpc_solution.kkt)
 
     plan_send.lateralPlan.desire = self.desire
     plan_send.lateralPlan.laneChangeState = self.lane_change_state
@@ -0,0 +1,124 @@
+#include "selfdrive/controls/lib/lead_mpc.h"
+
+#include <cmath>
+
+#include "selfdrive/common/timing.h"
+
+const double LEAD_ACCEL_TAU = 1.5;  // radar_helpers._LEAD_ACCEL_TAU
+
+// list(np.arange(0,1.,.2)) + list(np.arange(1.,10.6,.6))
+static const std::array<double, LEAD_MPC_N + 1> MPC_T = [] {
+  std::array<double, LEAD_MPC_N + 1> t;
+  for (int i = 0; i < 5; i++) t[i] = 0.2 * i;
+  for (int i = 5; i <= LEAD_MPC_N; i++) t[i] = 1. + 0.6 * (i - 5);
+  return t;
+}();
+
+LeadMpc::LeadMpc(int lead_id, MpcBatch &batch)
+    : solver(LEAD0 + lead_id), mpc_solution(batch.batch.lead[lead_id].solution), lead_id(lead_id),
+      problem(batch.batch.lead[lead_id]), lib(LEAD_MPC_LIBS[lead_id]) {
+  mpc_init = lib.get<decltype(mpc_init)>("init");
+  init_with_simulation = lib.get<decltype(init_with_simulation)>("init_with_simulation");
+  lib.get<void (*)(int)>("set_qp_reuse")(true);
+  status = false;
+  resetMpc();
+}
+
+void LeadMpc::setFollowingDistance(double distance) {
+  following_distance = distance;
+  if (following_distance != following_distance_last) {
+    resetMpc();
+  }
+  following_distance_last = following_distance;
+}
+
+void LeadMpc::resetMpc() {
+  mpc_init(MPC_COST_LONG::TTC, MPC_COST_LONG::DISTANCE, MPC_COST_LONG::ACCELERATION, MPC_COST_LONG::JERK);
+
+  problem.x0.v_ego = 0;
+  problem.x0.a_ego = 0;
+  a_lead_tau = LEAD_ACCEL_TAU;
+}
+
+void LeadMpc::setCurState(double v, double a) {
+  problem.x0.v_ego = std::max(v, 1e-3);
+  problem.x0.a_ego = a;
+}
+
+void LeadMpc::prepare(const cereal::CarState::Reader &CS, const cereal::RadarState::Reader &radar_state) {
+  double v_ego = CS.getVEgo();
+  auto lead = lead_id == 0 ? radar_state.getLeadOne() : radar_state.getLeadTwo();
+  status = lead.getStatus();
+
+  // Setup current mpc state
+  problem.x0.x_ego = 0.0;
+
+  double a_lead;
+  if (lead.getStatus()) {
+    double x_lead = lead.getDRel();
+    double v_lead = std::max(0.0, (double)lead.getVLead());
+    a_lead = lead.getALeadK();
+
+    if (v_lead < 0.1 || -a_lead / 2.0 > v_lead) {
+      v_lead = 0.0;
+      a_lead = 0.0;
+    }
+
+    a_lead_tau = lead.getALeadTau();
+    new_lead = false;
+    if (!prev_lead_status || std::abs(x_lead - prev_lead_x) > 2.5) {
+      init_with_simulation(v_ego, x_lead, v_lead, a_lead, a_lead_tau);
+      new_lead = true;
+    }
+
+    prev_lead_status = true;
+    prev_lead_x = x_lead;
+    problem.x0.x_l = x_lead;
+    problem.x0.v_l = v_lead;
+  } else {
+    prev_lead_status = false;
+    // Fake a fast lead car, so mpc keeps running
+    problem.x0.x_l = 50.0;
+    problem.x0.v_l = v_ego + 10.0;
+    a_lead = 0.0;
+    a_lead_tau = LEAD_ACCEL_TAU;
+  }
+
+  problem.a_lead_tau = a_lead_tau;
+  problem.a_lead = a_lead;
+  problem.TR = following_distance;
+}
+
+void LeadMpc::processSolution(const cereal::CarState::Reader &CS) {
+  n_its = problem.n_its;
+  duration = problem.solve_time * 1e9;
+  for (int i = 0; i < CONTROL_N; i++) {
+    v_solution[i] = interp(T_IDXS[i], MPC_T, mpc_solution.v_ego);
+    a_solution[i] = interp(T_IDXS[i], MPC_T, mpc_solution.a_ego);
+    j_solution[i] = interp(T_IDXS[i], MPC_T, mpc_solution.j_ego, LEAD_MPC_N);
+  }
+
+  // Reset if NaN or goes through lead car
+  bool crashing = false, nans = false;
+  double min_v = mpc_solution.v_ego[0];
+  for (int i = 0; i <= LEAD_MPC_N; i++) {
+    crashing |= mpc_solution.x_l[i] - mpc_solution.x_ego[i] < -50;
+    nans |= std::isnan(mpc_solution.v_ego[i]);
+    min_v = std::min(min_v, mpc_solution.v_ego[i]);
+  }
+  bool backwards = min_v < -0.15;
+
+  if (((backwards || crashing) && prev_lead_status) || nans) {
+    double t = seconds_since_boot();
+    if (t > last_cloudlog_t + 5.0) {
+      last_cloudlog_t = t;
+      LOGW("Longitudinal mpc %d reset - backwards: %s crashing: %s nan: %s", lead_id,
+           backwards ? "True" : "False", crashing ? "True" : "False", nans ? "True" : "False");
+    }
+
+    mpc_init(MPC_COST_LONG::TTC, MPC_COST_LONG::DISTANCE, MPC_COST_LONG::ACCELERATION, MPC_COST_LONG::JERK);
+    problem.x0.v_ego = CS.getVEgo();
+    problem.x0.a_ego = 0.0;
+    prev_lead_status = false;
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/controls/lib/drive_helpers.h"
+#include "selfdrive/controls/lib/mpc_library.h"
+
+// What the longitudinal planner reads back from each of its mpcs, over the control horizon
+struct LongMpcSolution {
+  bool status = true;
+  std::array<double, CONTROL_N> v_solution = {}, a_solution = {}, j_solution = {};
+};
+
+// lead_mpc.py, solved in the planner's batch
+class LeadMpc : public LongMpcSolution {
+public:
+  LeadMpc(int lead_id, MpcBatch &batch);
+  void setFollowingDistance(double following_distance);
+  void setCurState(double v, double a);
+  void prepare(const cereal::CarState::Reader &CS, const cereal::RadarState::Reader &radar_state);
+  void processSolution(const cereal::CarState::Reader &CS);
+
+  const int solver;
+  const lead_log_t &mpc_solution;
+  bool new_lead = false;
+  int n_its = 0;
+  uint64_t duration = 0;
+
+private:
+  void resetMpc();
+
+  int lead_id;
+  lead_problem_t &problem;
+  MpcLibrary lib;
+  void (*mpc_init)(double ttc_cost, double distance_cost, double acceleration_cost, double jerk_cost);
+  void (*init_with_simulation)(double v_ego, double x_l, double v_l, double a_l, double l);
+
+  bool prev_lead_status = false;
+  double prev_lead_x = 0.;
+  double a_lead_tau;
+  double last_cloudlog_t = 0.;
+
+  // dp
+  double following_distance = 1.8;
+  double following_distance_last = -1.;
+};
@@ -5,6 +5,7 @@ from common.realtime import sec_since_boot
 from selfdrive.modeld.constants import T_IDXS
 from selfdrive.controls.lib.radar_helpers import _LEAD_ACCEL_TAU
 from selfdrive.controls.lib.lead_mpc_lib import libmpc_py
+from selfdrive.controls.lib.long_mpc_batch import libmpc_py as batch_py
 from selfdrive.controls.lib.drive_helpers import MPC_COST_LONG, CONTROL_N
 from selfdrive.swaglog import cloudlog
 
@@ -14,6 +15,10 @@ MPC_T = list(np.arange(0,1.,.2)) + list(np.arange(1.,10.6,.6))
 class LeadMpc():
   def __init__(self, mpc_id):
     self.lead_id = mpc_id
+    self.solver = batch_py.libmpc.LEAD0 + mpc_id
+    self.problem = batch_py.batch.lead[mpc_id]
+    self.mpc_solution = batch_py.ffi.addressof(self.problem, 'solution')
+    self.cur_state = batch_py.ffi.addressof(self.problem, 'x0')
 
     self.reset_mpc()
     self.prev_lead_status = False
@@ -40,12 +45,11 @@ class LeadMpc():
     self.following_distance_last = self.following_distance
 
   def reset_mpc(self):
-    ffi, self.libmpc = libmpc_py.get_libmpc(self.lead_id)
+    _, self.libmpc = libmpc_py.get_libmpc(self.lead_id)
     self.libmpc.init(MPC_COST_LONG.TTC, MPC_COST_LONG.DISTANCE,
                      MPC_COST_LONG.ACCELERATION, MPC_COST_LONG.JERK)
+    self.libmpc.set_qp_reuse(True)
 
-    self.mpc_solution = ffi.new("log_t *")
-    self.cur_state = ffi.new("state_t *")
     self.cur_state[0].v_ego = 0
     self.cur_state[0].a_ego = 0
     self.a_lead_tau = _LEAD_ACCEL_TAU
@@ -57,6 +61,11 @@ class LeadMpc():
     self.cur_state[0].a_ego = a_safe
 
   def update(self, CS, radarstate, v_cruise, a_target, active):
+    self.prepare(CS, radarstate, v_cruise, a_target, active)
+    batch_py.run(1 << self.solver)
+    self.process_solution(CS)
+
+  def prepare(self, CS, radarstate, v_cruise, a_target, active):
     v_ego = CS.vEgo
     if self.lead_id == 0:
       lead = radarstate.leadOne
@@ -94,13 +103,16 @@ class LeadMpc():
       a_lead = 0.0
       self.a_lead_tau = _LEAD_ACCEL_TAU
 
-    # Calculate mpc
-    t = sec_since_boot()
-    self.n_its = self.libmpc.run_mpc(self.cur_state, self.mpc_solution, self.a_lead_tau, a_lead, self.following_distance)
+    self.problem.a_lead_tau = self.a_lead_tau
+    self.problem.a_lead = a_lead
+    self.problem.TR = self.following_distance
+
+  def process_solution(self, CS):
+    self.n_its = self.problem.n_its
+    self.duration = int(self.problem.solve_time * 1e9)
     self.v_solution = interp(T_IDXS[:CONTROL_N], MPC_T, self.mpc_solution.v_ego)
     self.a_solution = interp(T_IDXS[:CONTROL_N], MPC_T, self.mpc_solution.a_ego)
     self.j_solution = interp(T_IDXS[:CONTROL_N], MPC_T[:-1], self.mpc_solution.j_ego)
-    self.duration = int((sec_since_boot() - t) * 1e9)
 
     # Reset if NaN or goes through lead car
     crashing = any(lead - ego < -50 for (lead, ego) in zip(self.mpc_solution[0].x_l, self.mpc_solution[0].x_ego))
@@ -108,6 +120,7 @@ class LeadMpc():
     backwards = min(self.mpc_solution[0].v_ego) < -0.15
 
     if ((backwards or crashing) and self.prev_lead_status) or nans:
+      t = sec_since_boot()
       if t > self.last_cloudlog_t + 5.0:
         self.last_cloudlog_t = t
         cloudlog.warning("Longitudinal mpc %d reset - backwards: %s crashing: %s nan: %s" % (
@@ -115,7 +128,8 @@ class LeadMpc():
 
       self.libmpc.init(MPC_COST_LONG.TTC, MPC_COST_LONG.DISTANCE,
                        MPC_COST_LONG.ACCELERATION, MPC_COST_LONG.JERK)
-      self.cur_state[0].v_ego = v_ego
+    self.libmpc.set_qp_reuse(True)
+      self.cur_state[0].v_ego = CS.vEgo
       self.cur_state[0].a_ego = 0.0
       self.a_mpc = CS.aEgo
       self.prev_lead_status = False
@@ -5,9 +5,10 @@ from common.ffi_wrapper import suffix
 
 mpc_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)))
 
-def _get_libmpc(mpc_id):
-    libmpc_fn = os.path.join(mpc_dir, "libmpc%d%s" % (mpc_id, suffix()))
+def libmpc_fn(mpc_id):
+    return os.path.join(mpc_dir, "libmpc%d%s" % (mpc_id, suffix()))
 
+def _get_libmpc(mpc_id):
     ffi = FFI()
     ffi.cdef("""
     typedef struct {
@@ -25,16 +26,21 @@ def _get_libmpc(mpc_id):
     double a_l[21];
     double t[21];
     double cost;
+    double solve_time;
+    int qp_iterations;
+    int qp_hotstarted;
+    double solve_time_p50, solve_time_p90, solve_time_p99;
     } log_t;
 
     void init(double ttcCost, double distanceCost, double accelerationCost, double jerkCost);
     void init_with_simulation(double v_ego, double x_l, double v_l, double a_l, double l);
     void change_tr(double ttcCost, double distanceCost, double accelerationCost, double jerkCost);
+    void set_qp_reuse(int reuse);
     int run_mpc(state_t * x0, log_t * solution,
                 double l, double a_l_0, double TR);
     """)
 
-    return (ffi, ffi.dlopen(libmpc_fn))
+    return (ffi, ffi.dlopen(libmpc_fn(mpc_id)))
 
 mpcs = [_get_libmpc(0), _get_libmpc(1)]
 
@@ -1,5 +1,6 @@
 #include "acado_common.h"
 #include "acado_auxiliary_functions.h"
+#include "selfdrive/controls/lib/mpc_stats.h"
 
 #include <stdio.h>
 #include <math.h>
@@ -17,6 +18,8 @@
 ACADOvariables acadoVariables;
 ACADOworkspace acadoWorkspace;
 
+static mpc_stats_t stats;
+
 typedef struct {
   double x_ego, v_ego, a_ego, x_l, v_l, a_l;
 } state_t;
@@ -32,6 +35,10 @@ typedef struct {
   double a_l[N+1];
   double t[N+1];
   double cost;
+  double solve_time;    /* s */
+  int qp_iterations;    /* qpOASES working set recalculations */
+  int qp_hotstarted;    /* 1 when the QP was hot started from the one of the last solve */
+  double solve_time_p50, solve_time_p90, solve_time_p99;  /* s, see mpc_stats.h */
 } log_t;
 
 void init(double ttcCost, double distanceCost, double accelerationCost, double jerkCost){
@@ -131,9 +138,15 @@ void init_with_simulation(double v_ego, double x_l_0, double v_l_0, double a_l_0
   for (i = 0; i < NYN; ++i)  acadoVariables.yN[ i ] = 0.0;
 }
 
+/* Keep the QP between solves, see acado_qpoases_interface.cpp */
+void set_qp_reuse(int reuse){
+  acado_setQPReuse(reuse);
+}
+
 int run_mpc(state_t * x0, log_t * solution, double l, double a_l_0, double TR){
   // Calculate lead vehicle predictions
   int i;
+  double start = mpc_stats_seconds();
   double t = 0.;
   double dt = 0.2;
   double x_l = x0->x_l;
@@ -173,6 +186,8 @@ int run_mpc(state_t * x0, log_t * solution, double l, double a_l_0, double TR){
 
   acado_preparationStep(TR);
   acado_feedbackStep();
+  solution->qp_iterations = acado_getNWSR();
+  solution->qp_hotstarted = acado_getQPHotstarted();
 
   for (i = 0; i <= N; i++){
     solution->x_ego[i] = acadoVariables.x[i*NX];
@@ -184,6 +199,11 @@ int run_mpc(state_t * x0, log_t * solution, double l, double a_l_0, double TR){
     }
   }
   solution->cost = acado_getObjective(TR);
+  solution->solve_time = mpc_stats_seconds() - start;
+  mpc_stats_add(&stats, solution->solve_time);
+  solution->solve_time_p50 = stats.p50;
+  solution->solve_time_p90 = stats.p90;
+  solution->solve_time_p99 = stats.p99;
 
   // Dont shift states here. Current solution is closer to next timestep than if
   // we shift by 0.2 seconds.
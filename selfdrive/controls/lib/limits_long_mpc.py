@@ -4,12 +4,21 @@ import math
 from selfdrive.swaglog import cloudlog
 from common.realtime import sec_since_boot
 from selfdrive.controls.lib.longitudinal_mpc_lib import libmpc_py
+from selfdrive.controls.lib.long_mpc_batch import libmpc_py as batch_py
 from selfdrive.controls.lib.drive_helpers import LON_MPC_N
 from selfdrive.modeld.constants import T_IDXS
 
 
 class LimitsLongitudinalMpc():
   def __init__(self):
+    self.solver = batch_py.libmpc.LONG1
+    self.problem = batch_py.batch.lon[1]
+    self.mpc_solution = batch_py.ffi.addressof(self.problem, 'solution')
+    self.cur_state = batch_py.ffi.addressof(self.problem, 'x0')
+    self.target_x = np.frombuffer(batch_py.ffi.buffer(self.problem.target_x), dtype=np.float64)
+    self.target_v = np.frombuffer(batch_py.ffi.buffer(self.problem.target_v), dtype=np.float64)
+    self.target_a = np.frombuffer(batch_py.ffi.buffer(self.problem.target_a), dtype=np.float64)
+
     self.reset_mpc()
     self.last_cloudlog_t = 0.0
     self.ts = list(range(10))
@@ -18,11 +27,9 @@ class LimitsLongitudinalMpc():
     self.max_a = 1.2
 
   def reset_mpc(self):
-    self.libmpc = libmpc_py.libmpc
+    _, self.libmpc = libmpc_py.get_libmpc(1)
     self.libmpc.init(0.0, 10.0, 0.0, 50.0, 10000.0)
-
-    self.mpc_solution = libmpc_py.ffi.new("log_t *")
-    self.cur_state = libmpc_py.ffi.new("state_t *")
+    self.libmpc.set_qp_reuse(True)
 
     self.cur_state[0].x_ego = 0
     self.cur_state[0].v_ego = 0
@@ -45,25 +52,28 @@ class LimitsLongitudinalMpc():
     self.cur_state[0].a_ego = a_safe
 
   def update(self, carstate, model, v_cruise, a_target, active):
+    self.prepare(carstate, model, v_cruise, a_target, active)
+    batch_py.run(1 << self.solver)
+    self.process_solution(carstate)
+
+  def prepare(self, carstate, model, v_cruise, a_target, active):
     t = np.array(T_IDXS[:LON_MPC_N + 1])
     v_ego = self.cur_state[0].v_ego
 
     # If active, provide targets for a constant acceleration following a_target
     # otherwise just target cruising at current speed
     if active:
-      poss = v_ego * t + a_target * t**2 / 2.
-      speeds = v_ego + a_target * t
-      accels = a_target + np.ones(LON_MPC_N + 1)
+      self.target_x[:] = v_ego * t + a_target * t**2 / 2.
+      self.target_v[:] = v_ego + a_target * t
+      self.target_a[:] = a_target + 1.
     else:
-      poss = v_ego * t
-      speeds = v_ego * np.ones(LON_MPC_N + 1)
-      accels = np.zeros(LON_MPC_N + 1)
-
-    # Calculate mpc
-    self.libmpc.run_mpc(self.cur_state, self.mpc_solution,
-                        list(poss), list(speeds), list(accels),
-                        self.min_a, self.max_a)
+      self.target_x[:] = v_ego * t
+      self.target_v[:] = v_ego
+      self.target_a[:] = 0.
+    self.problem.min_a = self.min_a
+    self.problem.max_a = self.max_a
 
+  def process_solution(self, carstate):
     self.v_solution = list(self.mpc_solution.v_ego)
     self.a_solution = list(self.mpc_solution.a_ego)
     self.j_solution = list(self.mpc_solution.j_ego)
@@ -0,0 +1,91 @@
+#include "selfdrive/controls/lib/long_mpc.h"
+
+#include <cmath>
+
+#include "selfdrive/common/timing.h"
+
+LongitudinalMpc::LongitudinalMpc(MpcBatch &batch, int mpc_id, double v_cost)
+    : solver(LONG0 + mpc_id), problem(batch.batch.lon[mpc_id]), lib(LONG_MPC_LIBS[mpc_id]), v_cost(v_cost) {
+  mpc_init = lib.get<decltype(mpc_init)>("init");
+  lib.get<void (*)(int)>("set_qp_reuse")(true);
+  resetMpc();
+}
+
+void LongitudinalMpc::resetMpc() {
+  mpc_init(0.0, v_cost, 0.0, 50.0, 10000.0);
+
+  problem.x0.x_ego = 0;
+  problem.x0.v_ego = 0;
+  problem.x0.a_ego = 0;
+
+  v_solution = {};
+  a_solution = {};
+  j_solution = {};
+}
+
+void LongitudinalMpc::setAccelLimits(double min, double max) {
+  min_a = min;
+  max_a = max;
+}
+
+void LongitudinalMpc::setCurState(double v, double a) {
+  double a_safe = std::min(a, max_a - 1e-2);
+  a_safe = std::max(a_safe, min_a + 1e-2);
+  problem.x0.x_ego = 0.0;
+  problem.x0.v_ego = std::max(v, 1e-2);
+  problem.x0.a_ego = a_safe;
+}
+
+void LongitudinalMpc::prepare(double v_cruise) {
+  double v_ego = problem.x0.v_ego;
+  double v_cruise_clipped = clip(v_cruise, v_ego - 10., v_ego + 10.0);
+  for (int i = 0; i <= LON_MPC_N; i++) {
+    problem.target_x[i] = v_cruise_clipped * T_IDXS[i];
+    problem.target_v[i] = v_cruise_clipped;
+    problem.target_a[i] = 0.;
+  }
+  problem.min_a = min_a;
+  problem.max_a = max_a;
+}
+
+void LimitsLongitudinalMpc::prepare(double a_target, bool active) {
+  double v_ego = problem.x0.v_ego;
+
+  // If active, provide targets for a constant acceleration following a_target
+  // otherwise just target cruising at current speed
+  for (int i = 0; i <= LON_MPC_N; i++) {
+    double t = T_IDXS[i];
+    if (active) {
+      problem.target_x[i] = v_ego * t + a_target * t * t / 2.;
+      problem.target_v[i] = v_ego + a_target * t;
+      problem.target_a[i] = a_target + 1.;
+    } else {
+      problem.target_x[i] = v_ego * t;
+      problem.target_v[i] = v_ego;
+      problem.target_a[i] = 0.;
+    }
+  }
+  problem.min_a = min_a;
+  problem.max_a = max_a;
+}
+
+void LongitudinalMpc::processSolution() {
+  const long_log_t &mpc_solution = problem.solution;
+  bool nans = false;
+  for (int i = 0; i <= LON_MPC_N; i++) nans |= std::isnan(mpc_solution.v_ego[i]);
+  for (int i = 0; i < CONTROL_N; i++) {
+    v_solution[i] = mpc_solution.v_ego[i];
+    a_solution[i] = mpc_solution.a_ego[i];
+    j_solution[i] = mpc_solution.j_ego[i];
+  }
+
+  // Reset if NaN or goes through lead car
+  double t = seconds_since_boot();
+  if (nans) {
+    if (t > last_cloudlog_t + 5.0) {
+      last_cloudlog_t = t;
+      LOGW("Longitudinal model mpc reset - nans");
+    }
+    resetMpc();
+  }
+}
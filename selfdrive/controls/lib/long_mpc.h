@@ -0,0 +1,33 @@
+#pragma once
+
+#include "selfdrive/controls/lib/lead_mpc.h"
+
+// long_mpc.py, follows the cruise speed
+class LongitudinalMpc : public LongMpcSolution {
+public:
+  LongitudinalMpc(MpcBatch &batch) : LongitudinalMpc(batch, 0, 1.0) {}
+  void setAccelLimits(double min_a, double max_a);
+  void setCurState(double v, double a);
+  void prepare(double v_cruise);
+  void processSolution();
+
+  const int solver;
+
+protected:
+  LongitudinalMpc(MpcBatch &batch, int mpc_id, double v_cost);
+  void resetMpc();
+
+  long_problem_t &problem;
+  MpcLibrary lib;
+  void (*mpc_init)(double x_cost, double v_cost, double a_cost, double jerk_cost, double constraint_cost);
+  double v_cost;
+  double min_a = -1.2, max_a = 1.2;
+  double last_cloudlog_t = 0.;
+};
+
+// limits_long_mpc.py, follows a constant acceleration from the turn and speed limit controllers
+class LimitsLongitudinalMpc : public LongitudinalMpc {
+public:
+  LimitsLongitudinalMpc(MpcBatch &batch) : LongitudinalMpc(batch, 1, 10.0) {}
+  void prepare(double a_target, bool active);
+};
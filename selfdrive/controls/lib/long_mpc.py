@@ -4,12 +4,21 @@ import math
 from selfdrive.swaglog import cloudlog
 from common.realtime import sec_since_boot
 from selfdrive.controls.lib.longitudinal_mpc_lib import libmpc_py
+from selfdrive.controls.lib.long_mpc_batch import libmpc_py as batch_py
 from selfdrive.controls.lib.drive_helpers import LON_MPC_N
 from selfdrive.modeld.constants import T_IDXS
 
 
 class LongitudinalMpc():
   def __init__(self):
+    self.solver = batch_py.libmpc.LONG0
+    self.problem = batch_py.batch.lon[0]
+    self.mpc_solution = batch_py.ffi.addressof(self.problem, 'solution')
+    self.cur_state = batch_py.ffi.addressof(self.problem, 'x0')
+    self.target_x = np.frombuffer(batch_py.ffi.buffer(self.problem.target_x), dtype=np.float64)
+    self.target_v = np.frombuffer(batch_py.ffi.buffer(self.problem.target_v), dtype=np.float64)
+    self.target_a = np.frombuffer(batch_py.ffi.buffer(self.problem.target_a), dtype=np.float64)
+
     self.reset_mpc()
     self.last_cloudlog_t = 0.0
     self.ts = list(range(10))
@@ -19,11 +28,9 @@ class LongitudinalMpc():
 
 
   def reset_mpc(self):
-    self.libmpc = libmpc_py.libmpc
+    _, self.libmpc = libmpc_py.get_libmpc(0)
     self.libmpc.init(0.0, 1.0, 0.0, 50.0, 10000.0)
-
-    self.mpc_solution = libmpc_py.ffi.new("log_t *")
-    self.cur_state = libmpc_py.ffi.new("state_t *")
+    self.libmpc.set_qp_reuse(True)
 
     self.cur_state[0].x_ego = 0
     self.cur_state[0].v_ego = 0
@@ -46,18 +53,28 @@ class LongitudinalMpc():
     self.cur_state[0].a_ego = a_safe
 
   def update(self, carstate, radarstate, v_cruise, a_target, active):
+    self.prepare(carstate, radarstate, v_cruise, a_target, active)
+    batch_py.run(1 << self.solver)
+    self.process_solution(carstate)
+
+  def prepare(self, carstate, radarstate, v_cruise, a_target, active):
     v_cruise_clipped = np.clip(v_cruise, self.cur_state[0].v_ego - 10., self.cur_state[0].v_ego + 10.0)
-    poss = v_cruise_clipped * np.array(T_IDXS[:LON_MPC_N+1])
-    speeds = v_cruise_clipped * np.ones(LON_MPC_N+1)
-    accels = np.zeros(LON_MPC_N+1)
-    self.update_with_xva(poss, speeds, accels)
+    self.target_x[:] = v_cruise_clipped * np.array(T_IDXS[:LON_MPC_N+1])
+    self.target_v[:] = v_cruise_clipped
+    self.target_a[:] = 0.
+    self.problem.min_a = self.min_a
+    self.problem.max_a = self.max_a
 
   def update_with_xva(self, poss, speeds, accels):
-    # Calculate mpc
-    self.libmpc.run_mpc(self.cur_state, self.mpc_solution,
-                        list(poss), list(speeds), list(accels),
-                        self.min_a, self.max_a)
+    self.target_x[:] = poss
+    self.target_v[:] = speeds
+    self.target_a[:] = accels
+    self.problem.min_a = self.min_a
+    self.problem.max_a = self.max_a
+    batch_py.run(1 << self.solver)
+    self.process_solution(None)
 
+  def process_solution(self, carstate):
     self.v_solution = list(self.mpc_solution.v_ego)
     self.a_solution = list(self.mpc_solution.a_ego)
     self.j_solution = list(self.mpc_solution.j_ego)
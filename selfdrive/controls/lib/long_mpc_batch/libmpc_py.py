@@ -0,0 +1,97 @@
+import os
+
+from cffi import FFI
+from common.ffi_wrapper import suffix
+from selfdrive.controls.lib.lead_mpc_lib import libmpc_py as lead_libmpc_py
+from selfdrive.controls.lib.longitudinal_mpc_lib import libmpc_py as long_libmpc_py
+
+mpc_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)))
+libmpc_fn = os.path.join(mpc_dir, "libmpc_batch" + suffix())
+
+ffi = FFI()
+ffi.cdef("""
+const int LEAD_MPC_N = 20;
+const int LONG_MPC_N = 32;
+
+typedef struct {
+double x_ego, v_ego, a_ego, x_l, v_l, a_l;
+} lead_state_t;
+
+typedef struct {
+double x_ego[LEAD_MPC_N+1];
+double v_ego[LEAD_MPC_N+1];
+double a_ego[LEAD_MPC_N+1];
+double j_ego[LEAD_MPC_N];
+double x_l[LEAD_MPC_N+1];
+double v_l[LEAD_MPC_N+1];
+double a_l[LEAD_MPC_N+1];
+double t[LEAD_MPC_N+1];
+double cost;
+double solve_time;
+int qp_iterations;
+int qp_hotstarted;
+double solve_time_p50, solve_time_p90, solve_time_p99;
+} lead_log_t;
+
+typedef struct {
+double x_ego, v_ego, a_ego;
+} long_state_t;
+
+typedef struct {
+double x_ego[LONG_MPC_N+1];
+double v_ego[LONG_MPC_N+1];
+double a_ego[LONG_MPC_N+1];
+double t[LONG_MPC_N+1];
+double j_ego[LONG_MPC_N];
+double cost;
+double solve_time;
+int qp_iterations;
+int qp_hotstarted;
+double solve_time_p50, solve_time_p90, solve_time_p99;
+} long_log_t;
+
+typedef struct {
+lead_state_t x0;
+double a_lead_tau, a_lead, TR;
+
+lead_log_t solution;
+int n_its;
+double solve_time;
+} lead_problem_t;
+
+typedef struct {
+long_state_t x0;
+double target_x[LONG_MPC_N+1], target_v[LONG_MPC_N+1], target_a[LONG_MPC_N+1];
+double min_a, max_a;
+
+long_log_t solution;
+int n_its;
+double solve_time;
+} long_problem_t;
+
+typedef struct {
+lead_problem_t lead[2];
+long_problem_t lon[2];
+} batch_t;
+
+enum { LEAD0, LEAD1, LONG0, LONG1, NUM_SOLVERS };
+
+int init(const char *lead0, const char *lead1, const char *long0, const char *long1, int use_threads);
+void run(batch_t *batch, int mask);
+""")
+
+libmpc = ffi.dlopen(libmpc_fn)
+
+# plannerd is pinned to one core, solving on more threads only adds the wakeups
+USE_THREADS = False
+
+ret = libmpc.init(lead_libmpc_py.libmpc_fn(0).encode(), lead_libmpc_py.libmpc_fn(1).encode(),
+                  long_libmpc_py.libmpc_fn(0).encode(), long_libmpc_py.libmpc_fn(1).encode(), USE_THREADS)
+assert ret == 0, "can't load the longitudinal mpc libraries"
+
+# the problems of all solvers, each mpc fills in and reads back its own
+batch = ffi.new("batch_t *")
+
+
+def run(mask):
+  libmpc.run(batch, mask)
@@ -0,0 +1,134 @@
+#include "selfdrive/controls/lib/long_mpc_batch/long_mpc_batch.h"
+
+#include <dlfcn.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "selfdrive/common/timing.h"
+
+// Every solver is its own library because the ACADO generated code keeps the
+// solver in globals, so the ones in a run don't share anything and can be solved
+// at the same time.
+
+namespace {
+
+void *run_mpc[NUM_SOLVERS] = {};
+bool parallel = false;
+
+void solve(batch_t *batch, int solver) {
+  uint64_t start = nanos_monotonic();
+  if (solver <= LEAD1) {
+    lead_problem_t &p = batch->lead[solver - LEAD0];
+    p.n_its = ((run_lead_fn)run_mpc[solver])(&p.x0, &p.solution, p.a_lead_tau, p.a_lead, p.TR);
+    p.solve_time = (nanos_monotonic() - start) * 1e-9;
+  } else {
+    long_problem_t &p = batch->lon[solver - LONG0];
+    p.n_its = ((run_long_fn)run_mpc[solver])(&p.x0, &p.solution, p.target_x, p.target_v, p.target_a,
+                                             p.min_a, p.max_a);
+    p.solve_time = (nanos_monotonic() - start) * 1e-9;
+  }
+}
+
+// The caller solves too, the workers take the solvers it didn't get to. A run
+// waits until all of its solvers are done, so there's only one at a time.
+class Pool {
+public:
+  void start(int num_workers) {
+    for (int i = 0; i < num_workers; i++) {
+      std::thread(&Pool::worker, this).detach();
+    }
+  }
+
+  void run(batch_t *b, int mask) {
+    {
+      std::lock_guard lk(lock);
+      batch = b;
+      num_jobs = next_job = 0;
+      for (int i = 0; i < NUM_SOLVERS; i++) {
+        if (mask & (1 << i)) jobs[num_jobs++] = i;
+      }
+      pending = num_jobs;
+      generation++;
+    }
+    work_cv.notify_all();
+
+    solveJobs();
+    std::unique_lock lk(lock);
+    done_cv.wait(lk, [&] { return pending == 0; });
+  }
+
+private:
+  void worker() {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock lk(lock);
+        work_cv.wait(lk, [&] { return generation != seen; });
+        seen = generation;
+      }
+      solveJobs();
+    }
+  }
+
+  void solveJobs() {
+    while (true) {
+      int solver;
+      {
+        std::lock_guard lk(lock);
+        if (next_job == num_jobs) return;
+        solver = jobs[next_job++];
+      }
+      solve(batch, solver);
+
+      std::lock_guard lk(lock);
+      if (--pending == 0) done_cv.notify_one();
+    }
+  }
+
+  std::mutex lock;
+  std::condition_variable work_cv, done_cv;
+  uint64_t generation = 0;
+  batch_t *batch = nullptr;
+  int jobs[NUM_SOLVERS];
+  int num_jobs = 0, next_job = 0, pending = 0;
+};
+
+Pool *pool = nullptr;
+
+}  // namespace
+
+extern "C" {
+
+int init(const char *lead0, const char *lead1, const char *long0, const char *long1, int use_threads) {
+  const char *libs[NUM_SOLVERS] = {lead0, lead1, long0, long1};
+  for (int i = 0; i < NUM_SOLVERS; i++) {
+    void *handle = dlopen(libs[i], RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL || (run_mpc[i] = dlsym(handle, "run_mpc")) == NULL) {
+      fprintf(stderr, "long_mpc_batch: can't load %s: %s\n", libs[i], dlerror());
+      return -1;
+    }
+  }
+
+  parallel = use_threads;
+  return 0;
+}
+
+void run(batch_t *batch, int mask) {
+  if (parallel && (mask & (mask - 1)) != 0) {
+    // started by the first run, so the workers get the cpus and priority the planner runs with
+    if (pool == nullptr) {
+      pool = new Pool();
+      pool->start(NUM_SOLVERS - 1);
+    }
+    pool->run(batch, mask);
+    return;
+  }
+  for (int i = 0; i < NUM_SOLVERS; i++) {
+    if (mask & (1 << i)) solve(batch, i);
+  }
+}
+
+}
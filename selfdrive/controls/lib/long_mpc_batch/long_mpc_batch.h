@@ -0,0 +1,95 @@
+#pragma once
+
+// The problems plannerd solves every cycle, for all solvers at once. The state
+// and log structs are the same as in lead_mpc_lib/longitudinal_mpc.c and
+// longitudinal_mpc_lib/longitudinal_mpc.c, the horizons are ACADO_N of them.
+
+#define LEAD_MPC_N 20
+#define LONG_MPC_N 32
+
+typedef struct {
+  double x_ego, v_ego, a_ego, x_l, v_l, a_l;
+} lead_state_t;
+
+typedef struct {
+  double x_ego[LEAD_MPC_N+1];
+  double v_ego[LEAD_MPC_N+1];
+  double a_ego[LEAD_MPC_N+1];
+  double j_ego[LEAD_MPC_N];
+  double x_l[LEAD_MPC_N+1];
+  double v_l[LEAD_MPC_N+1];
+  double a_l[LEAD_MPC_N+1];
+  double t[LEAD_MPC_N+1];
+  double cost;
+  double solve_time;
+  int qp_iterations;
+  int qp_hotstarted;
+  double solve_time_p50, solve_time_p90, solve_time_p99;
+} lead_log_t;
+
+typedef struct {
+  double x_ego, v_ego, a_ego;
+} long_state_t;
+
+typedef struct {
+  double x_ego[LONG_MPC_N+1];
+  double v_ego[LONG_MPC_N+1];
+  double a_ego[LONG_MPC_N+1];
+  double t[LONG_MPC_N+1];
+  double j_ego[LONG_MPC_N];
+  double cost;
+  double solve_time;
+  int qp_iterations;
+  int qp_hotstarted;
+  double solve_time_p50, solve_time_p90, solve_time_p99;
+} long_log_t;
+
+typedef struct {
+  lead_state_t x0;
+  double a_lead_tau, a_lead, TR;
+
+  lead_log_t solution;
+  int n_its;
+  double solve_time;
+} lead_problem_t;
+
+typedef struct {
+  long_state_t x0;
+  double target_x[LONG_MPC_N+1], target_v[LONG_MPC_N+1], target_a[LONG_MPC_N+1];
+  double min_a, max_a;
+
+  long_log_t solution;
+  int n_its;
+  double solve_time;
+} long_problem_t;
+
+typedef struct {
+  lead_problem_t lead[2];
+  long_problem_t lon[2];
+} batch_t;
+
+// solver i is solved when bit i of a run's mask is set
+enum { LEAD0, LEAD1, LONG0, LONG1, NUM_SOLVERS };
+
+// run_mpc of the solver libraries
+typedef int (*run_lead_fn)(lead_state_t *x0, lead_log_t *solution, double l, double a_l_0, double TR);
+typedef int (*run_long_fn)(long_state_t *x0, long_log_t *solution, double *target_x, double *target_v,
+                           double *target_a, double min_a, double max_a);
+
+// the native planner dlopens this library too, all users have to share the solver libraries
+typedef int (*batch_init_fn)(const char *lead0, const char *lead1, const char *long0, const char *long1, int use_threads);
+typedef void (*batch_run_fn)(batch_t *batch, int mask);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// loads the solver libraries, which are shared with the python side so both see
+// the same solver state. with use_threads the solvers of a run get a thread each,
+// that only helps when the planner isn't limited to one cpu
+int init(const char *lead0, const char *lead1, const char *long0, const char *long1, int use_threads);
+void run(batch_t *batch, int mask);
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,12 +24,52 @@ extern "C"
 
 #include "INCLUDE/QProblem.hpp"
 
+#include <string.h>
+
 #if ACADO_COMPUTE_COVARIANCE_MATRIX == 1
 #include "INCLUDE/EXTRAS/SolutionAnalysis.hpp"
 #endif /* ACADO_COMPUTE_COVARIANCE_MATRIX */
 
 static int acado_nWSR;
 
+/* With QP reuse the QP outlives acado_solve. When condensing gives the same
+ * Hessian and constraint matrix as for the last QP, it is hot started from the
+ * last active set and keeps its factorisations, otherwise it's initialised
+ * again. The matrices stay the same with linear dynamics, a least squares cost
+ * and unchanged weights. */
+static int acado_qpReuse;
+static int acado_qpHotstarted;
+static QProblem acado_qp(68, 96);
+static real_t acado_qpH[sizeof(acadoWorkspace.H) / sizeof(real_t)];
+static real_t acado_qpA[sizeof(acadoWorkspace.A) / sizeof(real_t)];
+
+static int acado_solveReused( void )
+{
+	returnValue retVal = RET_HOTSTART_FAILED;
+
+	if (acado_qp.isInitialised() == BT_TRUE &&
+		memcmp(acado_qpH, acadoWorkspace.H, sizeof(acado_qpH)) == 0 &&
+		memcmp(acado_qpA, acadoWorkspace.A, sizeof(acado_qpA)) == 0)
+	{
+		retVal = acado_qp.hotstart(acadoWorkspace.g, acadoWorkspace.lb, acadoWorkspace.ub, acadoWorkspace.lbA, acadoWorkspace.ubA, acado_nWSR, 0);
+		acado_qpHotstarted = retVal == SUCCESSFUL_RETURN;
+	}
+
+	if (!acado_qpHotstarted)
+	{
+		acado_nWSR = QPOASES_NWSRMAX;
+		acado_qp.reset();
+		retVal = acado_qp.init(acadoWorkspace.H, acadoWorkspace.g, acadoWorkspace.A, acadoWorkspace.lb, acadoWorkspace.ub, acadoWorkspace.lbA, acadoWorkspace.ubA, acado_nWSR, acadoWorkspace.y);
+		memcpy(acado_qpH, acadoWorkspace.H, sizeof(acado_qpH));
+		memcpy(acado_qpA, acadoWorkspace.A, sizeof(acado_qpA));
+	}
+
+	acado_qp.getPrimalSolution( acadoWorkspace.x );
+	acado_qp.getDualSolution( acadoWorkspace.y );
+
+	return (int)retVal;
+}
+
 
 
 #if ACADO_COMPUTE_COVARIANCE_MATRIX == 1
@@ -39,6 +79,12 @@ static SolutionAnalysis acado_sa;
 int acado_solve( void )
 {
 	acado_nWSR = QPOASES_NWSRMAX;
+	acado_qpHotstarted = 0;
+
+#if ACADO_COMPUTE_COVARIANCE_MATRIX != 1
+	if (acado_qpReuse)
+		return acado_solveReused();
+#endif /* ACADO_COMPUTE_COVARIANCE_MATRIX */
 
 	QProblem qp(68, 96);
 	
@@ -64,6 +110,16 @@ int acado_getNWSR( void )
 	return acado_nWSR;
 }
 
+void acado_setQPReuse( int reuse )
+{
+	acado_qpReuse = reuse;
+}
+
+int acado_getQPHotstarted( void )
+{
+	return acado_qpHotstarted;
+}
+
 const char* acado_getErrorString( int error )
 {
 	return MessageHandling::getErrorString( error );
@@ -1,6 +1,7 @@
 #include "acado_common.h"
 #include "acado_auxiliary_functions.h"
 #include "common/modeldata.h"
+#include "selfdrive/controls/lib/mpc_stats.h"
 
 #include <stdio.h>
 #include <math.h>
@@ -18,6 +19,8 @@
 ACADOvariables acadoVariables;
 ACADOworkspace acadoWorkspace;
 
+static mpc_stats_t stats;
+
 typedef struct {
   double x_ego, v_ego, a_ego;
 } state_t;
@@ -30,6 +33,10 @@ typedef struct {
   double t[N+1];
   double j_ego[N];
   double cost;
+  double solve_time;    /* s */
+  int qp_iterations;    /* qpOASES working set recalculations */
+  int qp_hotstarted;    /* 1 when the QP was hot started from the one of the last solve */
+  double solve_time_p50, solve_time_p90, solve_time_p99;  /* s, see mpc_stats.h */
 } log_t;
 
 void init(double xCost, double vCost, double aCost, double jerkCost, double constraintCost){
@@ -65,10 +72,16 @@ void init(double xCost, double vCost, double aCost, double jerkCost, double cons
 }
 
 
+/* Keep the QP between solves, see acado_qpoases_interface.cpp */
+void set_qp_reuse(int reuse){
+  acado_setQPReuse(reuse);
+}
+
 int run_mpc(state_t * x0, log_t * solution,
             double target_x[N+1], double target_v[N+1], double target_a[N+1],
             double min_a, double max_a){
   int i;
+  double start = mpc_stats_seconds();
   for (i = 0; i < N + 1; ++i){
     acadoVariables.od[i*NOD] = min_a;
     acadoVariables.od[i*NOD+1] = max_a;
@@ -90,6 +103,8 @@ int run_mpc(state_t * x0, log_t * solution,
 
   acado_preparationStep();
   acado_feedbackStep();
+  solution->qp_iterations = acado_getNWSR();
+  solution->qp_hotstarted = acado_getQPHotstarted();
 
   for (i = 0; i <= N; i++) {
     solution->x_ego[i] = acadoVariables.x[i*NX];
@@ -101,6 +116,11 @@ int run_mpc(state_t * x0, log_t * solution,
     }
   }
   solution->cost = acado_getObjective();
+  solution->solve_time = mpc_stats_seconds() - start;
+  mpc_stats_add(&stats, solution->solve_time);
+  solution->solve_time_p50 = stats.p50;
+  solution->solve_time_p90 = stats.p90;
+  solution->solve_time_p99 = stats.p99;
 
   // Dont shift states here. Current solution is closer to next timestep than if
   // we shift by 0.1 seconds.
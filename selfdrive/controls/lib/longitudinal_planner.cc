@@ -0,0 +1,235 @@
+#include "selfdrive/controls/lib/longitudinal_planner.h"
+
+#include <cmath>
+
+#include "selfdrive/common/timing.h"
+
+typedef cereal::CarControl::Actuators::LongControlState LongCtrlState;
+
+const double AWARENESS_DECEL = -0.2;  // car smoothly decel at .2m/s^2 when user is distracted
+const double A_CRUISE_MIN = -1.2;
+static const double A_CRUISE_MAX_VALS[] = {1.2, 1.2, 0.8, 0.6};
+static const double A_CRUISE_MAX_BP[] = {0., 15., 25., 40.};
+
+// Lookup table for turns
+static const double A_TOTAL_MAX_V[] = {1.7, 3.2};
+static const double A_TOTAL_MAX_BP[] = {20., 40.};
+
+static const double DP_FOLLOWING_DIST[] = {1.2, 1.5, 1.8, 2.2};
+
+enum { DP_ACCEL_ECO, DP_ACCEL_NORMAL, DP_ACCEL_SPORT };
+
+// accel profile by @arne182 modified by @wer5lcy
+static const double DP_CRUISE_MIN_V[] = {-2.0, -1.8, -1.6, -1.4, -1.2};
+static const double DP_CRUISE_MIN_V_ECO[] = {-2.0, -1.6, -1.4, -1.2, -1.0};
+static const double DP_CRUISE_MIN_V_SPORT[] = {-3.0, -2.6, -2.3, -2.0, -1.0};
+static const double DP_CRUISE_MIN_BP[] = {0.0, 5.0, 10.0, 20.0, 55.0};
+
+static const double DP_CRUISE_MAX_V[] = {1.6, 1.4, 1.0, 0.6, 0.3};
+static const double DP_CRUISE_MAX_V_ECO[] = {1.5, 1.3, 0.8, 0.4, 0.2};
+static const double DP_CRUISE_MAX_V_SPORT[] = {3.0, 3.5, 3.0, 2.0, 2.0};
+static const double DP_CRUISE_MAX_BP[] = {0., 5., 10., 20., 55.};
+
+static std::array<double, 2> dp_calc_cruise_accel_limits(double v_ego, int dp_profile) {
+  if (dp_profile == DP_ACCEL_ECO) {
+    return {interp(v_ego, DP_CRUISE_MIN_BP, DP_CRUISE_MIN_V_ECO), interp(v_ego, DP_CRUISE_MAX_BP, DP_CRUISE_MAX_V_ECO)};
+  } else if (dp_profile == DP_ACCEL_SPORT) {
+    return {interp(v_ego, DP_CRUISE_MIN_BP, DP_CRUISE_MIN_V_SPORT), interp(v_ego, DP_CRUISE_MAX_BP, DP_CRUISE_MAX_V_SPORT)};
+  }
+  return {interp(v_ego, DP_CRUISE_MIN_BP, DP_CRUISE_MIN_V), interp(v_ego, DP_CRUISE_MAX_BP, DP_CRUISE_MAX_V)};
+}
+
+Planner::Planner(const cereal::CarParams::Reader &CP)
+    : steer_ratio(CP.getSteerRatio()), wheelbase(CP.getWheelbase()),
+      lead0(0, batch), lead1(1, batch), cruise(batch), custom(batch), vision_turn_controller(CP) {
+  batch_mask = (1 << lead0.solver) | (1 << lead1.solver) | (1 << cruise.solver) | (1 << custom.solver);
+  alpha = std::exp(-DT_MDL / 2.0);
+}
+
+bool Planner::mpcSolutions(bool enabled, double v_ego, double a_ego, double v_cruise, SubMaster &sm,
+                           double &a_custom, Source &source) {
+  // Update controllers
+  vision_turn_controller.update(enabled, v_ego, a_ego, v_cruise, sm);
+  events.clear();
+  speed_limit_controller.update(enabled, v_ego, a_ego, sm, v_cruise, events);
+  turn_speed_controller.update(enabled, v_ego, a_ego, sm);
+
+  // Pick solution with lowest acceleration target.
+  bool active = false;
+  a_custom = INFINITY;
+  auto pick = [&](bool is_active, double a_target, Source s) {
+    if (is_active && a_target < a_custom) {
+      active = true;
+      a_custom = a_target;
+      source = s;
+    }
+  };
+  pick(vision_turn_controller.isActive(), vision_turn_controller.aTarget(), Source::TURN);
+  pick(speed_limit_controller.isActive(), speed_limit_controller.aTarget(), Source::LIMIT);
+  pick(turn_speed_controller.isActive(), turn_speed_controller.aTarget(), Source::TURNLIMIT);
+
+  if (!active) a_custom = 0.;
+  return active;
+}
+
+void Planner::update(SubMaster &sm) {
+  auto dp = sm["dragonConf"].getDragonConf();
+  auto car_state = sm["carState"].getCarState();
+  auto controls_state = sm["controlsState"].getControlsState();
+  auto radar_state = sm["radarState"].getRadarState();
+
+  // dp
+  int dp_following_profile = dp.getDpFollowingProfileCtrl() ? std::min<int>(dp.getDpFollowingProfile(), 3) : 0;
+  lead0.setFollowingDistance(DP_FOLLOWING_DIST[dp_following_profile]);
+  lead1.setFollowingDistance(DP_FOLLOWING_DIST[dp_following_profile]);
+
+  double cur_time = seconds_since_boot();
+  double v_ego = car_state.getVEgo();
+  double a_ego = car_state.getAEgo();
+
+  double v_cruise_kph = std::min((double)controls_state.getVCruise(), V_CRUISE_MAX);
+  double v_cruise = v_cruise_kph * KPH_TO_MS;
+
+  auto long_control_state = controls_state.getLongControlState();
+  bool force_slow_decel = controls_state.getForceDecel();
+
+  auto lead_1 = radar_state.getLeadTwo();
+
+  bool enabled = long_control_state == LongCtrlState::PID || long_control_state == LongCtrlState::STOPPING;
+  if (!enabled || car_state.getGasPressed()) {
+    v_desired = v_ego;
+    a_desired = a_ego;
+  }
+
+  // Prevent divergence, smooth in current v_ego
+  v_desired = alpha * v_desired + (1 - alpha) * v_ego;
+  v_desired = std::max(0.0, v_desired);
+
+  // Get acceleration and active solutions for custom long mpc.
+  double a_custom;
+  Source c_source = Source::CRUISE;
+  bool custom_active = mpcSolutions(enabled, v_desired, a_desired, v_cruise, sm, a_custom, c_source);
+
+  std::array<double, 2> accel_limits;
+  if (!dp.getDpAccelProfileCtrl()) {
+    accel_limits = {A_CRUISE_MIN, interp(v_ego, A_CRUISE_MAX_BP, A_CRUISE_MAX_VALS)};
+  } else {
+    accel_limits = dp_calc_cruise_accel_limits(v_cruise, dp.getDpAccelProfile());
+  }
+
+  // This limits the long acceleration allowed, depending on the existing lateral acceleration
+  // this should avoid accelerating when losing the target in turns
+  double a_total_max = interp(v_ego, A_TOTAL_MAX_BP, A_TOTAL_MAX_V);
+  double a_y = v_ego * v_ego * car_state.getSteeringAngleDeg() * DEG_TO_RAD / (steer_ratio * wheelbase);
+  double a_x_allowed = std::sqrt(std::max(a_total_max * a_total_max - a_y * a_y, 0.));
+  std::array<double, 2> accel_limits_turns = {accel_limits[0], std::min(accel_limits[1], a_x_allowed)};
+
+  if (force_slow_decel) {
+    // if required so, force a smooth deceleration
+    accel_limits_turns[1] = std::min(accel_limits_turns[1], AWARENESS_DECEL);
+    accel_limits_turns[0] = std::min(accel_limits_turns[0], accel_limits_turns[1]);
+  }
+
+  // clip limits, cannot init MPC outside of bounds
+  accel_limits_turns[0] = std::min(accel_limits_turns[0], a_desired);
+  accel_limits_turns[1] = std::max(accel_limits_turns[1], a_desired);
+  cruise.setAccelLimits(accel_limits_turns[0], accel_limits_turns[1]);
+
+  // ensure lower accel limit (for braking) is lower than target acc for custom controllers.
+  custom.setAccelLimits(std::min(accel_limits_turns[0], a_custom), accel_limits_turns[1]);
+
+  // all mpcs are solved in one call
+  lead0.setCurState(v_desired, a_desired);
+  lead1.setCurState(v_desired, a_desired);
+  cruise.setCurState(v_desired, a_desired);
+  custom.setCurState(v_desired, a_desired);
+  lead0.prepare(car_state, radar_state);
+  lead1.prepare(car_state, radar_state);
+  cruise.prepare(v_cruise);
+  custom.prepare(a_custom, custom_active);
+  batch.run(batch_mask);
+  lead0.processSolution(car_state);
+  lead1.processSolution(car_state);
+  cruise.processSolution();
+  custom.processSolution();
+
+  // picks slowest solution from accel in ~0.2 seconds
+  const std::pair<LongMpcSolution *, Source> mpcs[] = {
+    {&lead0, Source::LEAD0}, {&lead1, Source::LEAD1}, {&cruise, Source::CRUISE}, {&custom, c_source}};
+  double next_a = INFINITY;
+  for (auto &[mpc, source] : mpcs) {
+    bool active = mpc != &custom || custom_active;
+    if (mpc->status && active && mpc->a_solution[5] < next_a) {
+      longitudinal_plan_source = source;
+      v_desired_trajectory = mpc->v_solution;
+      a_desired_trajectory = mpc->a_solution;
+      j_desired_trajectory = mpc->j_solution;
+      next_a = mpc->a_solution[5];
+    }
+  }
+
+  // determine fcw
+  if (lead0.new_lead) {
+    fcw_checker.resetLead(cur_time);
+  }
+  bool blinkers = car_state.getLeftBlinker() || car_state.getRightBlinker();
+  fcw = fcw_checker.update(lead0.mpc_solution, cur_time, controls_state.getActive(), v_ego, a_ego,
+                           lead_1.getDRel(), lead_1.getVLead(), lead_1.getALeadK(), lead_1.getYRel(), lead_1.getVLat(),
+                           lead_1.getFcw(), blinkers) && !car_state.getBrakePressed();
+  if (fcw) {
+    auto &c = fcw_checker.counters;
+    LOG("FCW triggered ttc: %.2f v_lead_max: %.2f v_ego_lead: %.2f lead_seen: %.2f y_lead: %.2f vlat_lead: %.2f",
+        c.ttc, c.v_lead_max, c.v_ego_lead, c.lead_seen, c.y_lead, c.vlat_lead);
+  }
+
+  // Interpolate 0.05 seconds and save as starting point for next iteration
+  double a_prev = a_desired;
+  a_desired = interp(DT_MDL, T_IDXS, a_desired_trajectory, CONTROL_N);
+  v_desired = v_desired + DT_MDL * (a_desired + a_prev) / 2.0;
+}
+
+void Planner::publish(SubMaster &sm, PubMaster &pm) {
+  PooledMessageBuilder msg("longitudinalPlan");
+  auto event = msg.initEvent(sm.allAliveAndValid({"carState", "controlsState"}));
+  auto plan = event.initLongitudinalPlan();
+
+  uint64_t model_mono_time = sm["modelV2"].getLogMonoTime();
+  plan.setModelMonoTime(model_mono_time);
+  // same units as the python
+  plan.setProcessingDelay((event.getLogMonoTime() / 1e9) - model_mono_time);
+
+  auto speeds = plan.initSpeeds(CONTROL_N);
+  auto accels = plan.initAccels(CONTROL_N);
+  auto jerks = plan.initJerks(CONTROL_N);
+  for (int i = 0; i < CONTROL_N; i++) {
+    speeds.set(i, v_desired_trajectory[i]);
+    accels.set(i, a_desired_trajectory[i]);
+    jerks.set(i, j_desired_trajectory[i]);
+  }
+
+  plan.setHasLead(lead0.status);
+  plan.setLongitudinalPlanSource(longitudinal_plan_source);
+  plan.setFcw(fcw);
+
+  plan.setVisionTurnControllerState(vision_turn_controller.state());
+  plan.setVisionTurnSpeed(vision_turn_controller.vTurn());
+
+  plan.setSpeedLimitControlState(speed_limit_controller.state());
+  plan.setSpeedLimit(speed_limit_controller.speedLimit());
+  plan.setSpeedLimitOffset(speed_limit_controller.speedLimitOffset());
+  plan.setDistToSpeedLimit(speed_limit_controller.distance());
+  plan.setIsMapSpeedLimit(speed_limit_controller.source() == SpeedLimitResolver::Source::MAP_DATA);
+  // both speed limit events only have a warning alert
+  auto plan_events = plan.initEventsDEPRECATED(events.size());
+  for (size_t i = 0; i < events.size(); i++) {
+    plan_events[i].setName(events[i]);
+    plan_events[i].setWarning(true);
+  }
+
+  plan.setTurnSpeedControlState(turn_speed_controller.state());
+  plan.setTurnSpeed(turn_speed_controller.speedLimit());
+  plan.setDistToTurn(turn_speed_controller.distance());
+  plan.setTurnSign(turn_speed_controller.turnSign());
+
+  pm.send("longitudinalPlan", msg);
+}
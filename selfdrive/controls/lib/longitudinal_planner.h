@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "selfdrive/controls/lib/fcw.h"
+#include "selfdrive/controls/lib/long_mpc.h"
+#include "selfdrive/controls/lib/speed_limit_controller.h"
+#include "selfdrive/controls/lib/turn_speed_controller.h"
+#include "selfdrive/controls/lib/vision_turn_controller.h"
+
+// longitudinal_planner.py, publishes the same longitudinalPlan
+class Planner {
+public:
+  Planner(const cereal::CarParams::Reader &CP);
+  void update(SubMaster &sm);
+  void publish(SubMaster &sm, PubMaster &pm);
+
+private:
+  typedef cereal::LongitudinalPlan::LongitudinalPlanSource Source;
+  // picks the controller with the lowest acceleration target for the custom mpc
+  bool mpcSolutions(bool enabled, double v_ego, double a_ego, double v_cruise, SubMaster &sm,
+                    double &a_custom, Source &source);
+
+  double steer_ratio, wheelbase;
+
+  MpcBatch batch;
+  LeadMpc lead0, lead1;
+  LongitudinalMpc cruise;
+  LimitsLongitudinalMpc custom;
+  int batch_mask;
+
+  bool fcw = false;
+  FCWChecker fcw_checker;
+
+  double v_desired = 0.0;
+  double a_desired = 0.0;
+  Source longitudinal_plan_source = Source::CRUISE;
+  double alpha;
+
+  std::array<double, CONTROL_N> v_desired_trajectory = {}, a_desired_trajectory = {}, j_desired_trajectory = {};
+
+  VisionTurnController vision_turn_controller;
+  SpeedLimitController speed_limit_controller;
+  TurnSpeedController turn_speed_controller;
+  std::vector<cereal::CarEvent::EventName> events;
+};
@@ -14,6 +14,7 @@ from selfdrive.controls.lib.longcontrol import LongCtrlState
 from selfdrive.controls.lib.lead_mpc import LeadMpc
 from selfdrive.controls.lib.long_mpc import LongitudinalMpc
 from selfdrive.controls.lib.limits_long_mpc import LimitsLongitudinalMpc
+from selfdrive.controls.lib.long_mpc_batch import libmpc_py as batch_py
 from selfdrive.controls.lib.drive_helpers import V_CRUISE_MAX, CONTROL_N
 from selfdrive.controls.lib.vision_turn_controller import VisionTurnController
 from selfdrive.controls.lib.speed_limit_controller import SpeedLimitController, SpeedLimitResolver
@@ -90,6 +91,7 @@ class Planner():
     self.mpcs['lead1'] = LeadMpc(1)
     self.mpcs['cruise'] = LongitudinalMpc()
     self.mpcs['custom'] = LimitsLongitudinalMpc()
+    self.batch_mask = sum(1 << mpc.solver for mpc in self.mpcs.values())
 
     self.fcw = False
     self.fcw_checker = FCWChecker()
@@ -171,10 +173,15 @@ class Planner():
     accel_limits = [min(accel_limits_turns[0], a_mpc['custom']), accel_limits_turns[1]]
     self.mpcs['custom'].set_accel_limits(accel_limits[0], accel_limits[1])
 
-    next_a = np.inf
+    # all mpcs are solved in one call
     for key in self.mpcs:
       self.mpcs[key].set_cur_state(self.v_desired, self.a_desired)
-      self.mpcs[key].update(sm['carState'], sm['radarState'], v_cruise, a_mpc[key], active_mpc[key])
+      self.mpcs[key].prepare(sm['carState'], sm['radarState'], v_cruise, a_mpc[key], active_mpc[key])
+    batch_py.run(self.batch_mask)
+
+    next_a = np.inf
+    for key in self.mpcs:
+      self.mpcs[key].process_solution(sm['carState'])
       # picks slowest solution from accel in ~0.2 seconds
       if self.mpcs[key].status and active_mpc[key] and self.mpcs[key].a_solution[5] < next_a:
         self.longitudinalPlanSource = c_source if key == 'custom' else key
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <dlfcn.h>
+
+#include <cassert>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/controls/lib/long_mpc_batch/long_mpc_batch.h"
+
+// relative to selfdrive/controls, where plannerd runs
+const char *const LEAD_MPC_LIBS[] = {"lib/lead_mpc_lib/libmpc0.so", "lib/lead_mpc_lib/libmpc1.so"};
+const char *const LONG_MPC_LIBS[] = {"lib/longitudinal_mpc_lib/libmpc0.so", "lib/longitudinal_mpc_lib/libmpc1.so"};
+
+// One of the ACADO solver libraries. The generated code keeps its solver in
+// globals and every library exports the same names, so each one is dlopened on
+// its own with RTLD_LOCAL instead of being linked, like cffi does for python.
+class MpcLibrary {
+public:
+  MpcLibrary(const char *path) {
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) LOGE("can't load %s: %s", path, dlerror());
+    assert(handle != nullptr);
+  }
+
+  template <typename F>
+  F get(const char *name) const {
+    void *f = dlsym(handle, name);
+    if (f == nullptr) LOGE("no %s in the mpc library: %s", name, dlerror());
+    assert(f != nullptr);
+    return (F)f;
+  }
+
+private:
+  void *handle;
+};
+
+// long_mpc_batch, the problems of the lead and longitudinal mpcs and the call that solves them.
+// The solver libraries it loads are the same ones the mpcs init through their own MpcLibrary.
+class MpcBatch {
+public:
+  MpcBatch() : lib("lib/long_mpc_batch/libmpc_batch.so") {
+    int ret = lib.get<batch_init_fn>("init")(LEAD_MPC_LIBS[0], LEAD_MPC_LIBS[1], LONG_MPC_LIBS[0], LONG_MPC_LIBS[1], false);
+    if (ret != 0) LOGE("can't load the longitudinal mpc libraries");
+    assert(ret == 0);
+    run_fn = lib.get<batch_run_fn>("run");
+  }
+  void run(int mask) { run_fn(&batch, mask); }
+
+  batch_t batch = {};
+
+private:
+  MpcLibrary lib;
+  batch_run_fn run_fn;
+};
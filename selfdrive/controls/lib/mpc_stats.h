@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdlib.h>
+#include <time.h>
+
+/* Solve times of the MPC libraries. The percentiles are over windows of
+   MPC_STATS_WINDOW solves, they are the ones of the last full window. */
+#define MPC_STATS_WINDOW 100
+
+typedef struct {
+  double times[MPC_STATS_WINDOW];
+  int n;
+  double p50, p90, p99;
+} mpc_stats_t;
+
+static inline double mpc_stats_seconds(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static inline int mpc_stats_compare(const void * a, const void * b){
+  double d = *(const double *)a - *(const double *)b;
+  return (d > 0) - (d < 0);
+}
+
+static inline void mpc_stats_add(mpc_stats_t * stats, double solve_time){
+  stats->times[stats->n++] = solve_time;
+  if (stats->n == MPC_STATS_WINDOW){
+    qsort(stats->times, MPC_STATS_WINDOW, sizeof(double), mpc_stats_compare);
+    stats->p50 = stats->times[MPC_STATS_WINDOW * 50 / 100];
+    stats->p90 = stats->times[MPC_STATS_WINDOW * 90 / 100];
+    stats->p99 = stats->times[MPC_STATS_WINDOW * 99 / 100];
+    stats->n = 0;
+  }
+}
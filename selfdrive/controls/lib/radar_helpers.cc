@@ -0,0 +1,284 @@
+#include "selfdrive/controls/lib/radar_helpers.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "selfdrive/controls/lib/drive_helpers.h"
+
+extern "C" {
+#include "selfdrive/controls/lib/cluster/fastcluster.h"
+}
+
+// stationary qualification parameters
+const double V_EGO_STATIONARY = 4.;  // no stationary object flag below this speed
+
+KalmanParams::KalmanParams(double dt) {
+  // Lead Kalman Filter params, calculating K from A, C, Q, R requires the control library.
+  // hardcoding a lookup table to compute K for values of radar_ts between 0.01s and 0.1s
+  assert(dt > .01 && dt < .1);
+  const double dts[] = {0.01, 0.02, 0.03, 0.04, 0.05, 0.06, 0.07, 0.08, 0.09, 0.1};
+  const double K0[] = {0.12288, 0.14557, 0.16523, 0.18282, 0.19887, 0.21372, 0.22761, 0.24069, 0.2531, 0.26491};
+  const double K1[] = {0.29666, 0.29331, 0.29043, 0.28787, 0.28555, 0.28342, 0.28144, 0.27958, 0.27783, 0.27617};
+  A[0][0] = 1.0; A[0][1] = dt;
+  A[1][0] = 0.0; A[1][1] = 1.0;
+  K[0] = interp(dt, dts, K0);
+  K[1] = interp(dt, dts, K1);
+}
+
+void RadarLead::fill(cereal::RadarState::LeadData::Builder lead) const {
+  lead.setStatus(status);
+  if (!status) return;
+  lead.setDRel(d_rel);
+  lead.setYRel(y_rel);
+  lead.setVRel(v_rel);
+  lead.setVLead(v_lead);
+  lead.setVLeadK(v_lead_k);
+  lead.setALeadK(a_lead_k);
+  lead.setALeadTau(a_lead_tau);
+  lead.setFcw(fcw);
+  lead.setModelProb(model_prob);
+  lead.setRadar(radar);
+}
+
+void RadarTracks::clear() {
+  for (auto *v : {&d_rel, &y_rel, &v_rel, &v_lead, &kf_v, &kf_a, &v_lead_k, &a_lead_k, &a_lead_tau}) v->clear();
+  id.clear();
+  measured.clear();
+  cnt.clear();
+}
+
+void RadarTracks::reserve(size_t n) {
+  for (auto *v : {&d_rel, &y_rel, &v_rel, &v_lead, &kf_v, &kf_a, &v_lead_k, &a_lead_k, &a_lead_tau}) v->reserve(n);
+  id.reserve(n);
+  measured.reserve(n);
+  cnt.reserve(n);
+}
+
+void RadarTracks::push(const RadarTracks &o, size_t i) {
+  id.push_back(o.id[i]);
+  d_rel.push_back(o.d_rel[i]);
+  y_rel.push_back(o.y_rel[i]);
+  v_rel.push_back(o.v_rel[i]);
+  v_lead.push_back(o.v_lead[i]);
+  measured.push_back(o.measured[i]);
+  kf_v.push_back(o.kf_v[i]);
+  kf_a.push_back(o.kf_a[i]);
+  v_lead_k.push_back(o.v_lead_k[i]);
+  a_lead_k.push_back(o.a_lead_k[i]);
+  a_lead_tau.push_back(o.a_lead_tau[i]);
+  cnt.push_back(o.cnt[i]);
+}
+
+void RadarTracks::push_new(const RadarPoint &pt, double v_lead_) {
+  id.push_back(pt.track_id);
+  d_rel.push_back(pt.d_rel);
+  y_rel.push_back(pt.y_rel);
+  v_rel.push_back(pt.v_rel);
+  v_lead.push_back(v_lead_);
+  measured.push_back(pt.measured);
+  kf_v.push_back(v_lead_);
+  kf_a.push_back(0.);
+  v_lead_k.push_back(0.);
+  a_lead_k.push_back(0.);
+  a_lead_tau.push_back(LEAD_ACCEL_TAU);
+  cnt.push_back(0);
+}
+
+void RadarClusters::reset(size_t size) {
+  n.assign(size, 0);
+  n_a.assign(size, 0);
+  for (auto *v : {&d_rel, &y_rel, &v_rel, &v_lead, &v_lead_k, &a_lead_k, &a_lead_tau}) v->assign(size, 0.);
+}
+
+RadarLead RadarClusters::radar_state(size_t c, double model_prob) const {
+  return {
+    .status = true,
+    .d_rel = mean(d_rel, c),
+    .y_rel = mean(y_rel, c),
+    .v_rel = mean(v_rel, c),
+    .v_lead = mean(v_lead, c),
+    .v_lead_k = mean(v_lead_k, c),
+    .a_lead_k = a_lead_k_mean(c),
+    .a_lead_tau = a_lead_tau_mean(c),
+    .fcw = model_prob > .9,
+    .model_prob = model_prob,
+    .radar = true,
+  };
+}
+
+RadarD::RadarD(double radar_ts, int delay) : kalman_params(radar_ts), v_ego_hist({0.}), v_ego_hist_len(delay + 1) {}
+
+void RadarD::update_v_ego(double v) {
+  v_ego = v;
+  v_ego_hist.push_back(v);
+  if (v_ego_hist.size() > v_ego_hist_len) v_ego_hist.pop_front();
+}
+
+void RadarD::update(const RadarData &rr) {
+  // the points by track id, the last one of an id wins as in radard.py's dict
+  points.clear();
+  for (size_t i = 0; i < rr.points.size(); i++) {
+    points.push_back({rr.points[i].track_id, i});
+  }
+  std::stable_sort(points.begin(), points.end(), [](auto &a, auto &b) { return a.first < b.first; });
+  auto last = std::unique(points.rbegin(), points.rend(), [](auto &a, auto &b) { return a.first == b.first; });
+  points.erase(points.begin(), last.base());
+
+  // *** remove missing points from meta data, add the new ones ***
+  // align v_ego by a fixed time to align it with the radar measurement
+  const double v_ego_delayed = v_ego_hist.front();
+  next_tracks.clear();
+  next_tracks.reserve(points.size());
+  size_t t = 0;
+  for (const auto &[id, p] : points) {
+    while (t < tracks_.size() && tracks_.id[t] < id) t++;
+    if (t < tracks_.size() && tracks_.id[t] == id) {
+      next_tracks.push(tracks_, t);
+    } else {
+      next_tracks.push_new(rr.points[p], rr.points[p].v_rel + v_ego_delayed);
+    }
+  }
+  std::swap(tracks_, next_tracks);
+
+  // *** compute the tracks ***, Track.update over all of them
+  const double *A = &kalman_params.A[0][0];
+  const double K0 = kalman_params.K[0], K1 = kalman_params.K[1];
+  const size_t n = tracks_.size();
+  for (size_t i = 0; i < n; i++) {
+    const RadarPoint &pt = rr.points[points[i].second];
+    tracks_.d_rel[i] = pt.d_rel;
+    tracks_.y_rel[i] = pt.y_rel;
+    tracks_.v_rel[i] = pt.v_rel;
+    tracks_.v_lead[i] = pt.v_rel + v_ego_delayed;
+    tracks_.measured[i] = pt.measured;
+  }
+  for (size_t i = 0; i < n; i++) {
+    // KF1D.update with C = [1, 0]
+    if (tracks_.cnt[i] > 0) {
+      const double x0 = tracks_.kf_v[i], x1 = tracks_.kf_a[i], meas = tracks_.v_lead[i];
+      tracks_.kf_v[i] = (A[0] - K0) * x0 + A[1] * x1 + K0 * meas;
+      tracks_.kf_a[i] = (A[2] - K1) * x0 + A[3] * x1 + K1 * meas;
+    }
+    tracks_.v_lead_k[i] = tracks_.kf_v[i];
+    tracks_.a_lead_k[i] = tracks_.kf_a[i];
+    // Learn if constant acceleration
+    tracks_.a_lead_tau[i] = std::abs(tracks_.a_lead_k[i]) < 0.5 ? LEAD_ACCEL_TAU : tracks_.a_lead_tau[i] * 0.9;
+    tracks_.cnt[i]++;
+  }
+
+  // If we have multiple points, cluster them
+  cluster_idx.assign(n, 0);
+  if (n > 1) {
+    // Weigh y higher since radar is inaccurate in this dimension
+    cluster_pts.resize(n * 3);
+    for (size_t i = 0; i < n; i++) {
+      cluster_pts[i * 3] = tracks_.d_rel[i];
+      cluster_pts[i * 3 + 1] = tracks_.y_rel[i] * 2;
+      cluster_pts[i * 3 + 2] = tracks_.v_rel[i];
+    }
+    cluster_points_centroid(n, 3, cluster_pts.data(), 2.5 * 2.5, cluster_idx.data());
+  }
+  clusters_.reset(n > 0 ? *std::max_element(cluster_idx.begin(), cluster_idx.end()) + 1 : 0);
+  for (size_t i = 0; i < n; i++) {
+    const int c = cluster_idx[i];
+    clusters_.n[c]++;
+    clusters_.d_rel[c] += tracks_.d_rel[i];
+    clusters_.y_rel[c] += tracks_.y_rel[i];
+    clusters_.v_rel[c] += tracks_.v_rel[i];
+    clusters_.v_lead[c] += tracks_.v_lead[i];
+    clusters_.v_lead_k[c] += tracks_.v_lead_k[i];
+    if (tracks_.cnt[i] > 1) {
+      clusters_.n_a[c]++;
+      clusters_.a_lead_k[c] += tracks_.a_lead_k[i];
+      clusters_.a_lead_tau[c] += tracks_.a_lead_tau[i];
+    }
+  }
+
+  // if a new point, reset accel to the rest of the cluster
+  for (size_t i = 0; i < n; i++) {
+    if (tracks_.cnt[i] <= 1) {
+      const int c = cluster_idx[i];
+      tracks_.kf_v[i] = tracks_.v_lead[i];
+      tracks_.kf_a[i] = tracks_.a_lead_k[i] = clusters_.a_lead_k_mean(c);
+      tracks_.a_lead_tau[i] = clusters_.a_lead_tau_mean(c);
+    }
+  }
+}
+
+static double laplacian_cdf(double x, double mu, double b) {
+  b = std::max(b, 1e-4);
+  return std::exp(-std::abs(x - mu) / b);
+}
+
+int RadarD::match_vision_to_cluster(const cereal::ModelDataV2::LeadDataV3::Reader &lead) const {
+  // match vision point to best statistical cluster match
+  const double offset_vision_dist = lead.getX()[0] - RADAR_TO_CAMERA;
+  const double x_std = lead.getXStd()[0], y = lead.getY()[0], y_std = lead.getYStd()[0];
+  const double v = lead.getV()[0], v_std = lead.getVStd()[0];
+
+  int best = -1;
+  double best_prob = -1;
+  for (size_t c = 0; c < clusters_.size(); c++) {
+    const double prob_d = laplacian_cdf(clusters_.mean(clusters_.d_rel, c), offset_vision_dist, x_std);
+    const double prob_y = laplacian_cdf(clusters_.mean(clusters_.y_rel, c), -y, y_std);
+    const double prob_v = laplacian_cdf(clusters_.mean(clusters_.v_rel, c) + v_ego, v, v_std);
+
+    // This is isn't exactly right, but good heuristic
+    const double prob = prob_d * prob_y * prob_v;
+    if (prob > best_prob) {
+      best = c;
+      best_prob = prob;
+    }
+  }
+
+  // if no 'sane' match is found return -1
+  // stationary radar points can be false positives
+  const double d_rel = clusters_.mean(clusters_.d_rel, best), v_rel = clusters_.mean(clusters_.v_rel, best);
+  const bool dist_sane = std::abs(d_rel - offset_vision_dist) < std::max(offset_vision_dist * .25, 5.0);
+  const bool vel_sane = std::abs(v_rel + v_ego - v) < 10 || v_ego + v_rel > 3;
+  return dist_sane && vel_sane ? best : -1;
+}
+
+RadarLead RadarD::get_lead(const cereal::ModelDataV2::LeadDataV3::Reader &lead_msg, bool low_speed_override) const {
+  // Determine leads, this is where the essential logic happens
+  const double prob = lead_msg.getProb();
+  const int cluster = clusters_.size() > 0 && ready && prob > .5 ? match_vision_to_cluster(lead_msg) : -1;
+
+  RadarLead lead;
+  if (cluster >= 0) {
+    lead = clusters_.radar_state(cluster, prob);
+  } else if (ready && prob > .5) {
+    const double v = lead_msg.getV()[0];
+    lead = {
+      .status = true,
+      .d_rel = lead_msg.getX()[0] - RADAR_TO_CAMERA,
+      .y_rel = -lead_msg.getY()[0],
+      .v_rel = v - v_ego,
+      .v_lead = v,
+      .v_lead_k = v,
+      .a_lead_k = 0,
+      .a_lead_tau = LEAD_ACCEL_TAU,
+      .fcw = false,
+      .model_prob = prob,
+      .radar = false,
+    };
+  }
+
+  if (low_speed_override) {
+    // stop for stuff in front of you and low speed, even without model confirmation
+    int closest = -1;
+    for (size_t c = 0; c < clusters_.size(); c++) {
+      const double d_rel = clusters_.mean(clusters_.d_rel, c);
+      if (std::abs(clusters_.mean(clusters_.y_rel, c)) < 1.5 && v_ego < V_EGO_STATIONARY && d_rel < 25 &&
+          (closest < 0 || d_rel < clusters_.mean(clusters_.d_rel, closest))) {
+        closest = c;
+      }
+    }
+    // Only choose new cluster if it is actually closer than the previous one
+    if (closest >= 0 && (!lead.status || clusters_.mean(clusters_.d_rel, closest) < lead.d_rel)) {
+      lead = clusters_.radar_state(closest);
+    }
+  }
+  return lead;
+}
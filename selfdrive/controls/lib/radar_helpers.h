@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/controls/lib/radar_interface.h"
+
+// radard.py and radar_helpers.py: radar tracks with a Kalman filter on their
+// speed, clustered and matched to the model's leads.
+
+const double RADAR_TO_CAMERA = 1.52;  // RADAR is ~ 1.5m ahead from center of mesh frame
+// the longer lead decels, the more likely it will keep decelerating
+const double LEAD_ACCEL_TAU = 1.5;
+
+// KalmanParams of radard.py, the gains come from a table over the radar time step
+struct KalmanParams {
+  KalmanParams(double dt);
+  double A[2][2];
+  double K[2];
+};
+
+// RadarState.LeadData
+struct RadarLead {
+  bool status = false;
+  double d_rel = 0, y_rel = 0, v_rel = 0, v_lead = 0, v_lead_k = 0, a_lead_k = 0, a_lead_tau = 0;
+  bool fcw = false;
+  double model_prob = 0;
+  bool radar = false;
+
+  void fill(cereal::RadarState::LeadData::Builder lead) const;
+};
+
+// Tracks sorted by id, a column per field. The rows of the tracks that went
+// away are dropped and the new ones merged in once per scan
+struct RadarTracks {
+  std::vector<uint64_t> id;
+  std::vector<double> d_rel, y_rel, v_rel, v_lead;
+  std::vector<uint8_t> measured;
+  // Kalman filter state on the lead's speed and accel
+  std::vector<double> kf_v, kf_a;
+  std::vector<double> v_lead_k, a_lead_k, a_lead_tau;
+  std::vector<int> cnt;
+
+  size_t size() const { return id.size(); }
+  void clear();
+  void reserve(size_t n);
+  // a copy of row i of other
+  void push(const RadarTracks &other, size_t i);
+  // a new track of point pt, as Track.__init__
+  void push_new(const RadarPoint &pt, double v_lead);
+};
+
+// Clusters of tracks, the sums of what Cluster averages
+struct RadarClusters {
+  std::vector<int> n, n_a;  // tracks, tracks past their first scan
+  std::vector<double> d_rel, y_rel, v_rel, v_lead, v_lead_k, a_lead_k, a_lead_tau;
+
+  size_t size() const { return n.size(); }
+  void reset(size_t size);
+  double mean(const std::vector<double> &sum, size_t c) const { return sum[c] / n[c]; }
+  double a_lead_k_mean(size_t c) const { return n_a[c] > 0 ? a_lead_k[c] / n_a[c] : 0.; }
+  double a_lead_tau_mean(size_t c) const { return n_a[c] > 0 ? a_lead_tau[c] / n_a[c] : LEAD_ACCEL_TAU; }
+  RadarLead radar_state(size_t c, double model_prob = 0.) const;
+};
+
+class RadarD {
+public:
+  RadarD(double radar_ts, int delay = 0);
+
+  // carState's vEgo, each time it comes in
+  void update_v_ego(double v_ego);
+  // the tracks and their clusters for a scan of the radar
+  void update(const RadarData &rr);
+  // the lead of the model's lead, once the model is ready
+  RadarLead get_lead(const cereal::ModelDataV2::LeadDataV3::Reader &lead_msg, bool low_speed_override) const;
+
+  const RadarTracks &tracks() const { return tracks_; }
+  const RadarClusters &clusters() const { return clusters_; }
+
+  bool ready = false;
+
+private:
+  int match_vision_to_cluster(const cereal::ModelDataV2::LeadDataV3::Reader &lead) const;
+
+  const KalmanParams kalman_params;
+  double v_ego = 0.;
+  std::deque<double> v_ego_hist;
+  const size_t v_ego_hist_len;
+
+  RadarTracks tracks_, next_tracks;
+  RadarClusters clusters_;
+  // the points by track id, and each track's [dRel, yRel*2, vRel] and cluster
+  std::vector<std::pair<uint64_t, size_t>> points;
+  std::vector<double> cluster_pts;
+  std::vector<int> cluster_idx;
+};
@@ -0,0 +1,304 @@
+#include "selfdrive/controls/lib/radar_interface.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+// the parser's can_valid is only false after this many updates in a row, like parser_pyx.pyx
+#define CAN_INVALID_CNT 5
+
+RadarInterface::RadarInterface(cereal::CarParams::Reader CP)
+  : radar_ts(CP.getRadarTimeStep()), no_radar_sleep(getenv("NO_RADAR_SLEEP") != nullptr) {}
+
+bool RadarInterface::update(const std::vector<std::string> &can_strings, RadarData &rr) {
+  rr.points.clear();
+  rr.errors.clear();
+  if (!no_radar_sleep) {
+    util::sleep_for(radar_ts * 1000);  // radard runs on RI updates
+  }
+  return true;
+}
+
+CANRadarInterface::CANRadarInterface(cereal::CarParams::Reader CP, const std::string &dbc_name, int bus,
+                                     const std::vector<SignalParseOptions> &signals, uint32_t trigger_msg)
+  : RadarInterface(CP),
+    // without checks, as radard.py's parsers
+    parser(bus, dbc_name, [&]() {
+      std::vector<MessageParseOptions> options;
+      for (const auto &s : signals) {
+        if (std::none_of(options.begin(), options.end(), [&](auto &o) { return o.address == s.address; })) {
+          options.push_back({.address = s.address, .check_frequency = 0});
+        }
+      }
+      return options;
+    }(), signals),
+    trigger_msg(trigger_msg), can_invalid_cnt(CAN_INVALID_CNT) {
+  // the values canshared parsed already, while it runs
+  parser.share_from(CANShare::path(dbc_name, bus));
+}
+
+const double *CANRadarInterface::signal(uint32_t address, const char *name) {
+  const MessageState *state = parser.find_message(address);
+  assert(state != nullptr);
+  for (int i = 0; i < state->parse_sigs.size(); i++) {
+    if (strcmp(state->parse_sigs[i].name, name) == 0) {
+      return &state->vals[i];
+    }
+  }
+  LOGE("radar: signal %s of 0x%X isn't parsed", name, address);
+  assert(false);
+  return nullptr;
+}
+
+RadarPoint &CANRadarInterface::point(uint32_t address, bool new_track) {
+  auto it = pts.find(address);
+  if (it == pts.end() || new_track) {
+    it = pts.insert_or_assign(address, RadarPoint{.track_id = track_id++}).first;
+  }
+  return it->second;
+}
+
+bool CANRadarInterface::update(const std::vector<std::string> &can_strings, RadarData &rr) {
+  for (const auto &s : can_strings) {
+    parser.update_string(s, false);
+
+    can_invalid_cnt = parser.can_valid ? 0 : can_invalid_cnt + 1;
+    can_valid = can_invalid_cnt < CAN_INVALID_CNT;
+
+    const uint64_t *bits = parser.updated_bits();
+    for (size_t w = 0; w < parser.updated_words(); w++) {
+      for (uint64_t word = bits[w]; word; word &= word - 1) {
+        updated_messages.insert(parser.message(w * 64 + __builtin_ctzll(word))->address);
+      }
+    }
+    parser.clear_updated();
+  }
+
+  if (updated_messages.count(trigger_msg) == 0) {
+    return false;
+  }
+
+  rr.points.clear();
+  rr.errors.clear();
+  if (!can_valid) {
+    rr.errors.push_back(cereal::RadarData::Error::CAN_ERROR);
+  }
+  parse(updated_messages, rr);
+  updated_messages.clear();
+
+  for (const auto &[_, pt] : pts) {
+    rr.points.push_back(pt);
+  }
+  return true;
+}
+
+namespace {
+
+// toyota/radar_interface.py
+class ToyotaRadarInterface : public CANRadarInterface {
+public:
+  ToyotaRadarInterface(cereal::CarParams::Reader CP, const std::string &dbc_name, uint32_t msg_a)
+    : CANRadarInterface(CP, dbc_name, 1, signals(msg_a), msg_a + 2 * RADAR_MSGS - 1), msg_a(msg_a) {
+    for (int i = 0; i < RADAR_MSGS; i++) {
+      tracks[i] = {
+        .long_dist = signal(msg_a + i, "LONG_DIST"),
+        .new_track = signal(msg_a + i, "NEW_TRACK"),
+        .lat_dist = signal(msg_a + i, "LAT_DIST"),
+        .rel_speed = signal(msg_a + i, "REL_SPEED"),
+        .valid = signal(msg_a + i, "VALID"),
+        .score = signal(msg_a + RADAR_MSGS + i, "SCORE"),
+      };
+    }
+  }
+
+private:
+  static const int RADAR_MSGS = 16;
+
+  static std::vector<SignalParseOptions> signals(uint32_t msg_a) {
+    std::vector<SignalParseOptions> sigs;
+    for (int i = 0; i < RADAR_MSGS; i++) {
+      sigs.push_back({msg_a + i, "LONG_DIST", 255});
+      sigs.push_back({msg_a + i, "NEW_TRACK", 1});
+      sigs.push_back({msg_a + i, "LAT_DIST", 0});
+      sigs.push_back({msg_a + i, "REL_SPEED", 0});
+      sigs.push_back({msg_a + i, "VALID", 0});
+      sigs.push_back({msg_a + RADAR_MSGS + i, "SCORE", 0});
+    }
+    return sigs;
+  }
+
+  void parse(const std::set<uint32_t> &updated, RadarData &rr) override {
+    for (uint32_t ii : updated) {
+      if (ii < msg_a || ii >= msg_a + RADAR_MSGS) continue;
+      const int i = ii - msg_a;
+      const Track &t = tracks[i];
+
+      if (*t.long_dist >= 255 || *t.new_track) {
+        valid_cnt[i] = 0;
+      }
+      if (*t.valid && *t.long_dist < 255) {
+        valid_cnt[i]++;
+      } else {
+        valid_cnt[i] = std::max(valid_cnt[i] - 1, 0);
+      }
+
+      // radar point only valid if it's a valid measurement and score is above 50
+      if (*t.valid || (*t.score > 50 && *t.long_dist < 255 && valid_cnt[i] > 0)) {
+        RadarPoint &pt = point(ii, *t.new_track);
+        pt.d_rel = *t.long_dist;
+        pt.y_rel = -*t.lat_dist;
+        pt.v_rel = *t.rel_speed;
+        pt.measured = *t.valid;
+      } else {
+        pts.erase(ii);
+      }
+    }
+  }
+
+  struct Track {
+    const double *long_dist, *new_track, *lat_dist, *rel_speed, *valid, *score;
+  };
+  const uint32_t msg_a;
+  Track tracks[RADAR_MSGS];
+  int valid_cnt[RADAR_MSGS] = {};
+};
+
+// honda/radar_interface.py, Nidec
+class HondaRadarInterface : public CANRadarInterface {
+public:
+  HondaRadarInterface(cereal::CarParams::Reader CP, const std::string &dbc_name)
+    : CANRadarInterface(CP, dbc_name, 1, signals(), 0x445) {
+    radar_state = signal(0x400, "RADAR_STATE");
+    for (uint32_t ii : addresses()) {
+      tracks[ii] = {signal(ii, "LONG_DIST"), signal(ii, "NEW_TRACK"), signal(ii, "LAT_DIST"), signal(ii, "REL_SPEED")};
+    }
+  }
+
+private:
+  static std::vector<uint32_t> addresses() {
+    std::vector<uint32_t> ret;
+    for (uint32_t a = 0x430; a < 0x43A; a++) ret.push_back(a);
+    for (uint32_t a = 0x440; a < 0x446; a++) ret.push_back(a);
+    return ret;
+  }
+
+  static std::vector<SignalParseOptions> signals() {
+    std::vector<SignalParseOptions> sigs = {{0x400, "RADAR_STATE", 0}};
+    for (uint32_t ii : addresses()) {
+      sigs.push_back({ii, "LONG_DIST", 255});
+      sigs.push_back({ii, "NEW_TRACK", 1});
+      sigs.push_back({ii, "LAT_DIST", 0});
+      sigs.push_back({ii, "REL_SPEED", 0});
+    }
+    return sigs;
+  }
+
+  void parse(const std::set<uint32_t> &updated, RadarData &rr) override {
+    for (uint32_t ii : updated) {
+      if (ii == 0x400) {
+        // check for radar faults
+        radar_fault = *radar_state != 0x79;
+        radar_wrong_config = *radar_state == 0x69;
+        continue;
+      }
+      auto t = tracks.find(ii);
+      if (t == tracks.end()) continue;
+
+      if (*t->second.long_dist < 255) {
+        RadarPoint &pt = point(ii, *t->second.new_track);
+        pt.d_rel = *t->second.long_dist;
+        pt.y_rel = -*t->second.lat_dist;
+        pt.v_rel = *t->second.rel_speed;
+        pt.measured = true;
+      } else {
+        pts.erase(ii);
+      }
+    }
+
+    if (radar_fault) rr.errors.push_back(cereal::RadarData::Error::FAULT);
+    if (radar_wrong_config) rr.errors.push_back(cereal::RadarData::Error::WRONG_CONFIG);
+  }
+
+  struct Track {
+    const double *long_dist, *new_track, *lat_dist, *rel_speed;
+  };
+  const double *radar_state;
+  std::map<uint32_t, Track> tracks;
+  bool radar_fault = false, radar_wrong_config = false;
+};
+
+// hyundai/radar_interface.py, the SCC's lead on the powertrain bus
+class HyundaiRadarInterface : public CANRadarInterface {
+public:
+  HyundaiRadarInterface(cereal::CarParams::Reader CP, const std::string &dbc_name)
+    : CANRadarInterface(CP, dbc_name, 0, {
+        {SCC11, "ACC_ObjStatus", 0},
+        {SCC11, "ACC_ObjLatPos", 0},
+        {SCC11, "ACC_ObjDist", 0},
+        {SCC11, "ACC_ObjRelSpd", 0},
+      }, SCC11) {
+    obj_status = signal(SCC11, "ACC_ObjStatus");
+    obj_lat_pos = signal(SCC11, "ACC_ObjLatPos");
+    obj_dist = signal(SCC11, "ACC_ObjDist");
+    obj_rel_spd = signal(SCC11, "ACC_ObjRelSpd");
+  }
+
+private:
+  static const uint32_t SCC11 = 0x420;
+
+  void parse(const std::set<uint32_t> &updated, RadarData &rr) override {
+    if (!*obj_status) return;
+    // two points of the same lead, as radard.py gets them
+    for (uint32_t ii = 0; ii < 2; ii++) {
+      RadarPoint &pt = point(ii, false);
+      pt.d_rel = *obj_dist;
+      pt.y_rel = -*obj_lat_pos;
+      pt.v_rel = *obj_rel_spd;
+      pt.measured = true;
+    }
+  }
+
+  const double *obj_status, *obj_lat_pos, *obj_dist, *obj_rel_spd;
+};
+
+// NO_DSU_CAR without the TSS2_CAR of toyota/values.py, keep them in sync
+const char *TOYOTA_NO_RADAR[] = {"TOYOTA C-HR 2018", "TOYOTA C-HR HYBRID 2018", "TOYOTA CAMRY 2018", "TOYOTA CAMRY HYBRID 2018"};
+
+}  // namespace
+
+std::unique_ptr<RadarInterface> radar_interface_create(cereal::CarParams::Reader CP, const json11::Json &dbcs) {
+  const std::string car = CP.getCarName();
+  const std::string fingerprint = CP.getCarFingerprint();
+
+  if (car == "mazda" || car == "nissan" || car == "subaru" || car == "volkswagen" || car == "mock") {
+    return std::make_unique<RadarInterface>(CP);
+  } else if (car == "toyota") {
+    const std::string radar_dbc = dbcs["radar"].string_value();
+    for (const char *f : TOYOTA_NO_RADAR) {
+      if (fingerprint == f) return std::make_unique<RadarInterface>(CP);
+    }
+    // TSS2 cars are the ones with the TSS2 radar DBC
+    const uint32_t msg_a = radar_dbc == "toyota_tss2_adas" ? 0x180 : 0x210;
+    return std::make_unique<ToyotaRadarInterface>(CP, radar_dbc, msg_a);
+  } else if (car == "honda") {
+    std::unique_ptr<RadarInterface> ri;
+    if (CP.getRadarOffCan()) {
+      ri = std::make_unique<RadarInterface>(CP);
+    } else {
+      ri = std::make_unique<HondaRadarInterface>(CP, dbcs["radar"].string_value());
+    }
+    ri->delay = std::round(0.1 / CP.getRadarTimeStep());  // 0.1s delay of radar
+    return ri;
+  } else if (car == "hyundai") {
+    if (CP.getRadarOffCan()) {
+      return std::make_unique<RadarInterface>(CP);
+    }
+    return std::make_unique<HyundaiRadarInterface>(CP, dbcs["pt"].string_value());
+  }
+  return nullptr;
+}
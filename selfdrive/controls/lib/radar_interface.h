@@ -0,0 +1,71 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "json11.hpp"
+
+#include "cereal/messaging/messaging.h"
+#include "opendbc/can/common.h"
+
+// The radar_interface.py of the cars radard has natively, reading the same
+// signals with the same CANParser. The others are left to radard.py.
+
+struct RadarPoint {
+  uint64_t track_id;
+  float d_rel;  // from front of car
+  float y_rel;  // in car frame's y axis, left is positive
+  float v_rel;
+  bool measured;
+};
+
+struct RadarData {
+  std::vector<RadarPoint> points;
+  std::vector<cereal::RadarData::Error> errors;
+};
+
+// RadarInterfaceBase: no radar, empty points every radar time step
+class RadarInterface {
+public:
+  RadarInterface(cereal::CarParams::Reader CP);
+  virtual ~RadarInterface() {}
+  // false while the radar hasn't sent a full scan
+  virtual bool update(const std::vector<std::string> &can_strings, RadarData &rr);
+
+  // radar cycles the measurements are behind carState by
+  int delay = 0;
+
+protected:
+  const double radar_ts;
+  const bool no_radar_sleep;
+};
+
+// A radar read through one CANParser, a scan is done once trigger_msg comes in
+class CANRadarInterface : public RadarInterface {
+public:
+  CANRadarInterface(cereal::CarParams::Reader CP, const std::string &dbc_name, int bus,
+                    const std::vector<SignalParseOptions> &signals, uint32_t trigger_msg);
+  bool update(const std::vector<std::string> &can_strings, RadarData &rr) override;
+
+protected:
+  // the scan of the messages updated since the last one
+  virtual void parse(const std::set<uint32_t> &updated, RadarData &rr) = 0;
+  // where the parser keeps the latest value of a signal
+  const double *signal(uint32_t address, const char *name);
+  // the point of address, a new track when it's new or new_track
+  RadarPoint &point(uint32_t address, bool new_track);
+
+  CANParser parser;
+  const uint32_t trigger_msg;
+  std::set<uint32_t> updated_messages;
+  std::map<uint32_t, RadarPoint> pts;
+  uint64_t track_id = 0;
+  int can_invalid_cnt;
+  bool can_valid = true;
+};
+
+// nullptr for the cars that don't have one natively. dbcs is the car's dbc_dict
+std::unique_ptr<RadarInterface> radar_interface_create(cereal::CarParams::Reader CP, const json11::Json &dbcs);
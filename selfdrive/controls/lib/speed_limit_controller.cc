@@ -0,0 +1,254 @@
+#include "selfdrive/controls/lib/speed_limit_controller.h"
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/controls/lib/drive_helpers.h"
+
+const double PARAMS_UPDATE_PERIOD = 2.;  // secs. Time between parameter updates.
+const double TEMP_INACTIVE_GUARD_PERIOD = 1.;  // secs. Time to wait after activation before considering temp deactivation signal.
+
+// Lookup table for speed limit percent offset depending on speed.
+static const double LIMIT_PERC_OFFSET_V[] = {0.0, 0.1, 0.125, 0.2, 0.21, 0.23};  // 25, 33, 45, 60, 67, 70 mph
+static const double LIMIT_PERC_OFFSET_BP[] = {11.0, 13.4, 20.1, 22.3, 24.58, 29.0};  // 25, 30, 40 50, 55, 65 mph
+
+void SpeedLimitResolver::resolve(double v_ego, double current_speed_limit, SubMaster &sm) {
+  Solution car_state = {sm["carState"].getCarState().getCruiseState().getSpeedLimit(), 0.};
+  Solution map_data = getFromMapData(v_ego, current_speed_limit, sm);
+  consolidate(car_state, map_data);
+}
+
+SpeedLimitResolver::Solution SpeedLimitResolver::getFromMapData(double v_ego, double current_speed_limit, SubMaster &sm) {
+  // Ignore if no live map data
+  if (sm.rcv_frame("liveMapData") == 0) {
+    return {};
+  }
+
+  // Load limits from map_data
+  auto map_data = sm["liveMapData"].getLiveMapData();
+  double speed_limit = map_data.getSpeedLimitValid() ? map_data.getSpeedLimit() : 0.;
+  double next_speed_limit = map_data.getSpeedLimitAheadValid() ? map_data.getSpeedLimitAhead() : 0.;
+
+  // Calculate the age of the gps fix. Ignore if too old.
+  double gps_fix_age = seconds_since_epoch() - map_data.getLastGpsTimestamp() * 1e-3;
+  if (gps_fix_age > LIMIT_MAX_MAP_DATA_AGE) {
+    return {};
+  }
+
+  // When we have no ahead speed limit to consider or it is greater than current speed limit
+  // or car has stopped, then provide current value and reset tracking.
+  if (next_speed_limit == 0. || v_ego <= 0. || next_speed_limit > current_speed_limit) {
+    next_speed_limit_prev = 0.;
+    return {speed_limit, 0.};
+  }
+
+  // Calculate the actual distance to the speed limit ahead corrected by gps_fix_age
+  double distance_since_fix = v_ego * gps_fix_age;
+  double distance_to_speed_limit_ahead = std::max(0., map_data.getSpeedLimitAheadDistance() - distance_since_fix);
+
+  // When we have a next_speed_limit value that has not changed from a provided next speed limit value
+  // in previous resolutions, we keep providing it.
+  if (next_speed_limit == next_speed_limit_prev) {
+    return {next_speed_limit, distance_to_speed_limit_ahead};
+  }
+
+  // Reset tracking
+  next_speed_limit_prev = 0.;
+
+  // Calculated the time needed to adapt to the new limit and the corresponding distance.
+  double adapt_time = (next_speed_limit - v_ego) / LIMIT_ADAPT_ACC;
+  double adapt_distance = v_ego * adapt_time + 0.5 * LIMIT_ADAPT_ACC * adapt_time * adapt_time;
+
+  // When we detect we are close enough, we provide the next limit value and track it.
+  if (distance_to_speed_limit_ahead <= adapt_distance) {
+    next_speed_limit_prev = next_speed_limit;
+    return {next_speed_limit, distance_to_speed_limit_ahead};
+  }
+
+  // Otherwise we just provide the map data speed limit.
+  return {speed_limit, 0.};
+}
+
+void SpeedLimitResolver::consolidate(const Solution &car_state, const Solution &map_data) {
+  std::vector<std::pair<Solution, Source>> solutions;
+
+  if (policy == Policy::CAR_STATE_ONLY || policy == Policy::CAR_STATE_PRIORITY || policy == Policy::COMBINED) {
+    solutions.push_back({car_state, Source::CAR_STATE});
+  }
+  if (policy == Policy::MAP_DATA_ONLY || policy == Policy::MAP_DATA_PRIORITY || policy == Policy::COMBINED) {
+    solutions.push_back({map_data, Source::MAP_DATA});
+  }
+
+  bool any_limit = false;
+  for (auto &s : solutions) any_limit |= s.first.limit != 0.;
+  if (!any_limit) {
+    if (policy == Policy::CAR_STATE_PRIORITY) {
+      solutions.push_back({map_data, Source::MAP_DATA});
+    } else if (policy == Policy::MAP_DATA_PRIORITY) {
+      solutions.push_back({car_state, Source::CAR_STATE});
+    }
+  }
+
+  // Get all non-zero values and set the minimum if any, otherwise 0.
+  speed_limit = 0.;
+  distance = 0.;
+  source = Source::NONE;
+  for (auto &[solution, solution_source] : solutions) {
+    if (solution.limit > 0. && (source == Source::NONE || solution.limit < speed_limit)) {
+      speed_limit = solution.limit;
+      distance = solution.distance;
+      source = solution_source;
+    }
+  }
+}
+
+SpeedLimitController::SpeedLimitController() {
+  is_enabled = params.getBool("SpeedLimitControl");
+  offset_enabled = params.getBool("SpeedLimitPercOffset");
+}
+
+void SpeedLimitController::setState(State value) {
+  if (value != state_ && value == State::TEMP_INACTIVE) {
+    // Reset previous speed limit to current value as to prevent going out of tempInactive in
+    // a single cycle when the speed limit changes at the same time the user has temporarily deactivate it.
+    speed_limit_prev = speed_limit;
+  }
+  state_ = value;
+}
+
+double SpeedLimitController::speedLimitOffset() const {
+  return offset_enabled ? interp(speed_limit, LIMIT_PERC_OFFSET_BP, LIMIT_PERC_OFFSET_V) * speed_limit : 0.;
+}
+
+void SpeedLimitController::updateParams() {
+  double time = seconds_since_boot();
+  if (time > last_params_update + PARAMS_UPDATE_PERIOD) {
+    is_enabled = params.getBool("SpeedLimitControl");
+    offset_enabled = params.getBool("SpeedLimitPercOffset");
+    last_params_update = time;
+  }
+}
+
+void SpeedLimitController::updateCalculations() {
+  // Update current velocity offset (error)
+  v_offset = speedLimitOffseted() - v_ego;
+
+  // Track the time op becomes active to prevent going to tempInactive right away after
+  // op enabling since controlsd will change the cruise speed every time on enabling and this will
+  // cause a temp inactive transition if the controller is updated before controlsd sets actual cruise
+  // speed.
+  if (!op_enabled_prev && op_enabled) {
+    last_op_enabled_time = seconds_since_boot();
+  }
+
+  // Update change tracking variables
+  speed_limit_changed = speed_limit != speed_limit_prev;
+  v_cruise_setpoint_changed = v_cruise_setpoint != v_cruise_setpoint_prev;
+  speed_limit_prev = speed_limit;
+  v_cruise_setpoint_prev = v_cruise_setpoint;
+  op_enabled_prev = op_enabled;
+}
+
+void SpeedLimitController::stateTransition() {
+  state_prev = state_;
+
+  // In any case, if op is disabled, or speed limit control is disabled
+  // or the reported speed limit is 0 or gas is pressed, deactivate.
+  if (!op_enabled || !is_enabled || speed_limit == 0 || gas_pressed) {
+    setState(State::INACTIVE);
+    return;
+  }
+
+  // In any case, we deactivate the speed limit controller temporarily if the user changes the cruise speed.
+  // Ignore if a minimum ammount of time has not passed since activation. This is to prevent temp inactivations
+  // due to controlsd logic changing cruise setpoint when going active.
+  if (v_cruise_setpoint_changed && seconds_since_boot() > (last_op_enabled_time + TEMP_INACTIVE_GUARD_PERIOD)) {
+    setState(State::TEMP_INACTIVE);
+    return;
+  }
+
+  switch (state_) {
+    case State::INACTIVE:
+      // If the limit speed offset is negative (i.e. reduce speed) and lower than threshold
+      // we go to adapting state to quickly reduce speed, otherwise we go directly to active
+      setState(v_offset < LIMIT_SPEED_OFFSET_TH ? State::ADAPTING : State::ACTIVE);
+      break;
+    case State::TEMP_INACTIVE:
+      // if speed limit changes, transition to inactive,
+      // proper active state will be set on next iteration.
+      if (speed_limit_changed) {
+        setState(State::INACTIVE);
+      }
+      break;
+    case State::ADAPTING:
+      // Go to active once the speed offset is over threshold.
+      if (v_offset >= LIMIT_SPEED_OFFSET_TH) {
+        setState(State::ACTIVE);
+      }
+      break;
+    case State::ACTIVE:
+      // Go to adapting if the speed offset goes below threshold.
+      if (v_offset < LIMIT_SPEED_OFFSET_TH) {
+        setState(State::ADAPTING);
+      }
+      break;
+  }
+}
+
+void SpeedLimitController::updateSolution() {
+  double target = a_ego;
+  switch (state_) {
+    case State::INACTIVE:
+    case State::TEMP_INACTIVE:
+      // Preserve current values
+      target = a_ego;
+      break;
+    case State::ADAPTING:
+      // When adapting we target to achieve the speed limit on the distance if not there yet,
+      // otherwise try to keep the speed constant around the control time horizon.
+      if (distance_ > 0) {
+        target = (speedLimitOffseted() * speedLimitOffseted() - v_ego * v_ego) / (2. * distance_);
+      } else {
+        target = v_offset / T_IDXS[CONTROL_N];
+      }
+      break;
+    case State::ACTIVE:
+      // When active we are trying to keep the speed constant around the control time horizon.
+      target = v_offset / T_IDXS[CONTROL_N];
+      break;
+  }
+
+  // Keep solution limited.
+  a_target = clip(target, LIMIT_MIN_ACC, LIMIT_MAX_ACC);
+}
+
+void SpeedLimitController::updateEvents(std::vector<cereal::CarEvent::EventName> &events) {
+  if (!isActive()) {
+    // no event while inactive
+    return;
+  }
+
+  if (state_prev <= State::TEMP_INACTIVE) {
+    events.push_back(cereal::CarEvent::EventName::SPEED_LIMIT_ACTIVE);
+  } else if (speed_limit_changed) {
+    events.push_back(cereal::CarEvent::EventName::SPEED_LIMIT_VALUE_CHANGE);
+  }
+}
+
+void SpeedLimitController::update(bool enabled, double v, double a, SubMaster &sm, double v_cruise,
+                                  std::vector<cereal::CarEvent::EventName> &events) {
+  op_enabled = enabled;
+  v_ego = v;
+  a_ego = a;
+  v_cruise_setpoint = v_cruise;
+  gas_pressed = sm["carState"].getCarState().getGasPressed();
+
+  resolver.resolve(v_ego, speed_limit, sm);
+  speed_limit = resolver.speed_limit;
+  distance_ = resolver.distance;
+  source_ = resolver.source;
+
+  updateParams();
+  updateCalculations();
+  stateTransition();
+  updateSolution();
+  updateEvents(events);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/params.h"
+
+// SpeedLimitResolver of speed_limit_controller.py, picks the speed limit out of the car state and map data
+class SpeedLimitResolver {
+public:
+  enum class Source { NONE, CAR_STATE, MAP_DATA };
+  enum class Policy { CAR_STATE_ONLY, MAP_DATA_ONLY, CAR_STATE_PRIORITY, MAP_DATA_PRIORITY, COMBINED };
+
+  SpeedLimitResolver(Policy policy = Policy::MAP_DATA_PRIORITY) : policy(policy) {}
+  void resolve(double v_ego, double current_speed_limit, SubMaster &sm);
+
+  double speed_limit = 0.;
+  double distance = 0.;
+  Source source = Source::NONE;
+
+private:
+  struct Solution {
+    double limit = 0., distance = 0.;
+  };
+  Solution getFromMapData(double v_ego, double current_speed_limit, SubMaster &sm);
+  void consolidate(const Solution &car_state, const Solution &map_data);
+
+  Policy policy;
+  double next_speed_limit_prev = 0.;
+};
+
+// speed_limit_controller.py
+class SpeedLimitController {
+public:
+  typedef cereal::LongitudinalPlan::SpeedLimitControlState State;
+
+  SpeedLimitController();
+  void update(bool enabled, double v_ego, double a_ego, SubMaster &sm, double v_cruise_setpoint,
+              std::vector<cereal::CarEvent::EventName> &events);
+
+  State state() const { return state_; }
+  bool isActive() const { return state_ > State::TEMP_INACTIVE; }
+  double aTarget() const { return isActive() ? a_target : a_ego; }
+  double speedLimitOffset() const;
+  double speedLimitOffseted() const { return speed_limit + speedLimitOffset(); }
+  double speedLimit() const { return speed_limit; }
+  double distance() const { return distance_; }
+  SpeedLimitResolver::Source source() const { return source_; }
+
+private:
+  void setState(State value);
+  void updateParams();
+  void updateCalculations();
+  void stateTransition();
+  void updateSolution();
+  void updateEvents(std::vector<cereal::CarEvent::EventName> &events);
+
+  Params params;
+  SpeedLimitResolver resolver;
+  double last_params_update = 0.;
+  double last_op_enabled_time = 0.;
+  bool is_enabled;
+  bool offset_enabled;
+  bool op_enabled = false;
+  bool op_enabled_prev = false;
+  double v_ego = 0.;
+  double a_ego = 0.;
+  double v_offset = 0.;
+  double v_cruise_setpoint = 0.;
+  double v_cruise_setpoint_prev = 0.;
+  bool v_cruise_setpoint_changed = false;
+  double speed_limit = 0.;
+  double speed_limit_prev = 0.;
+  bool speed_limit_changed = false;
+  double distance_ = 0.;
+  SpeedLimitResolver::Source source_ = SpeedLimitResolver::Source::NONE;
+  State state_ = State::INACTIVE;
+  State state_prev = State::INACTIVE;
+  bool gas_pressed = false;
+  double a_target = 0.;
+};
@@ -0,0 +1,186 @@
+#include "selfdrive/controls/lib/turn_speed_controller.h"
+
+#include "selfdrive/common/timing.h"
+
+const double ACTIVE_LIMIT_MIN_ACC = -0.5;  // m/s^2 Maximum deceleration allowed while active.
+const double ACTIVE_LIMIT_MAX_ACC = 0.5;  // m/s^2 Maximum acelration allowed while active.
+
+TurnSpeedController::TurnSpeedController() {
+  is_enabled = params.getBool("TurnSpeedControl");
+}
+
+void TurnSpeedController::setState(State value) {
+  if (value != state_ && value == State::TEMP_INACTIVE) {
+    // Track the speed limit value when controller was set to temp inactive.
+    speed_limit_temp_inactive = speed_limit;
+  }
+  state_ = value;
+}
+
+// Provides the speed limit, distance and turn sign to it for turns based on map data.
+std::tuple<double, double, int> TurnSpeedController::getLimitFromMapData(SubMaster &sm) {
+  // Ignore if no live map data
+  if (sm.rcv_frame("liveMapData") == 0) {
+    return {0., 0., 0};
+  }
+
+  // Load map_data and initialize
+  auto map_data = sm["liveMapData"].getLiveMapData();
+  double limit = 0.;
+
+  // Calculate the age of the gps fix. Ignore if too old.
+  double gps_fix_age = seconds_since_epoch() - map_data.getLastGpsTimestamp() * 1e-3;
+  if (gps_fix_age > LIMIT_MAX_MAP_DATA_AGE) {
+    return {0., 0., 0};
+  }
+
+  // Load turn ahead sections info from map_data with distances corrected by gps_fix_age
+  double distance_since_fix = v_ego * gps_fix_age;
+  auto speed_limit_in_sections_ahead = map_data.getTurnSpeedLimitsAhead();
+  auto distances_ahead = map_data.getTurnSpeedLimitsAheadDistances();
+  auto turn_signs_in_sections_ahead = map_data.getTurnSpeedLimitsAheadSigns();
+
+  // Ensure current speed limit is considered only if we are inside the section.
+  if (map_data.getTurnSpeedLimitValid() && v_ego > 0.) {
+    double speed_limit_end_time = (map_data.getTurnSpeedLimitEndDistance() / v_ego) - gps_fix_age;
+    if (speed_limit_end_time > 0.) {
+      limit = map_data.getTurnSpeedLimit();
+    }
+  }
+
+  // When we have no ahead speed limit to consider or all are greater than current speed limit
+  // or car has stopped, then provide current value and reset tracking.
+  int sign = map_data.getTurnSpeedLimitValid() ? map_data.getTurnSpeedLimitSign() : 0;
+  size_t n = speed_limit_in_sections_ahead.size();
+  double min_ahead = n > 0 ? speed_limit_in_sections_ahead[0] : 0.;
+  for (size_t i = 1; i < n; i++) min_ahead = std::min(min_ahead, (double)speed_limit_in_sections_ahead[i]);
+  if (n == 0 || v_ego <= 0. || (limit > 0 && min_ahead > limit)) {
+    next_speed_limit_prev = 0.;
+    return {limit, 0., sign};
+  }
+
+  // Calculated the time needed to adapt to the limits ahead and the corresponding distances.
+  // We select as next speed limit, the one that have the lowest distance gap.
+  size_t next_idx = 0;
+  double distance_gap = 0.;
+  for (size_t i = 0; i < n; i++) {
+    double adapt_time = (std::max((double)speed_limit_in_sections_ahead[i], LIMIT_MIN_SPEED) - v_ego) / LIMIT_ADAPT_ACC;
+    double adapt_distance = v_ego * adapt_time + 0.5 * LIMIT_ADAPT_ACC * adapt_time * adapt_time;
+    double gap = std::max(0., distances_ahead[i] - distance_since_fix) - adapt_distance;
+    if (i == 0 || gap < distance_gap) {
+      next_idx = i;
+      distance_gap = gap;
+    }
+  }
+  double next_speed_limit = speed_limit_in_sections_ahead[next_idx];
+  double distance_to_section_ahead = std::max(0., distances_ahead[next_idx] - distance_since_fix);
+  int next_turn_sign = turn_signs_in_sections_ahead[next_idx];
+
+  // When we have a next_speed_limit value that has not changed from a provided next speed limit value
+  // in previous resolutions, we keep providing it along with the udpated distance to it.
+  if (next_speed_limit == next_speed_limit_prev) {
+    return {next_speed_limit, distance_to_section_ahead, next_turn_sign};
+  }
+
+  // Reset tracking
+  next_speed_limit_prev = 0.;
+
+  // When we detect we are close enough, we provide the next limit value and track it.
+  if (distance_gap <= 0.) {
+    next_speed_limit_prev = next_speed_limit;
+    return {next_speed_limit, distance_to_section_ahead, next_turn_sign};
+  }
+
+  // Otherwise we just provide the calculated speed_limit
+  return {limit, 0., sign};
+}
+
+void TurnSpeedController::updateParams() {
+  double time = seconds_since_boot();
+  if (time > last_params_update + 5.0) {
+    is_enabled = params.getBool("TurnSpeedControl");
+    last_params_update = time;
+  }
+}
+
+void TurnSpeedController::stateTransition(SubMaster &sm) {
+  // In any case, if op is disabled, or turn speed limit control is disabled
+  // or the reported speed limit is 0, deactivate.
+  if (!op_enabled || !is_enabled || speedLimit() == 0.) {
+    setState(State::INACTIVE);
+    return;
+  }
+
+  // In any case, we deactivate the speed limit controller temporarily
+  // if gas is pressed (to support gas override implementations).
+  if (sm["carState"].getCarState().getGasPressed()) {
+    setState(State::TEMP_INACTIVE);
+    return;
+  }
+
+  switch (state_) {
+    case State::INACTIVE:
+      // If the limit speed offset is negative (i.e. reduce speed) and lower than threshold and distanct to turn limit
+      // is positive (not in turn yet) we go to adapting state to reduce speed, otherwise we go directly to active
+      if (v_offset < LIMIT_SPEED_OFFSET_TH && distance() > 0.) {
+        setState(State::ADAPTING);
+      } else {
+        setState(State::ACTIVE);
+      }
+      break;
+    case State::TEMP_INACTIVE:
+      // if the speed limit recorded when going to temp Inactive changes
+      // then set to inactive, activation will happen on next cycle
+      if (speed_limit != speed_limit_temp_inactive) {
+        setState(State::INACTIVE);
+      }
+      break;
+    case State::ADAPTING:
+      // Go to active once the speed offset is over threshold or the distance to turn is now 0.
+      if (v_offset >= LIMIT_SPEED_OFFSET_TH || distance() == 0.) {
+        setState(State::ACTIVE);
+      }
+      break;
+    case State::ACTIVE:
+      // Go to adapting if the speed offset goes below threshold as long as the distance to turn is still positive.
+      if (v_offset < LIMIT_SPEED_OFFSET_TH && distance() > 0.) {
+        setState(State::ADAPTING);
+      }
+      break;
+  }
+}
+
+void TurnSpeedController::updateSolution() {
+  switch (state_) {
+    case State::INACTIVE:
+    case State::TEMP_INACTIVE:
+      // Preserve current values
+      a_target = a_ego;
+      break;
+    case State::ADAPTING:
+      // When adapting we target to achieve the speed limit on the distance.
+      a_target = (speedLimit() * speedLimit() - v_ego * v_ego) / (2. * distance());
+      a_target = clip(a_target, LIMIT_MIN_ACC, LIMIT_MAX_ACC);
+      break;
+    case State::ACTIVE:
+      // When active we are trying to keep the speed constant around the control time horizon.
+      // but under constrained acceleration limits since we are in a turn.
+      a_target = clip(v_offset / T_IDXS[CONTROL_N], ACTIVE_LIMIT_MIN_ACC, ACTIVE_LIMIT_MAX_ACC);
+      break;
+  }
+}
+
+void TurnSpeedController::update(bool enabled, double v, double a, SubMaster &sm) {
+  op_enabled = enabled;
+  v_ego = v;
+  a_ego = a;
+
+  // Get the speed limit from Map Data
+  std::tie(speed_limit, distance_, turn_sign) = getLimitFromMapData(sm);
+
+  updateParams();
+  // Update current velocity offset (error)
+  v_offset = speedLimit() - v_ego;
+  stateTransition(sm);
+  updateSolution();
+}
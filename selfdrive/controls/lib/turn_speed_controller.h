@@ -0,0 +1,48 @@
+#pragma once
+
+#include <tuple>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/params.h"
+#include "selfdrive/controls/lib/drive_helpers.h"
+
+// turn_speed_controller.py, slows down for the turns ahead in the map data
+class TurnSpeedController {
+public:
+  typedef cereal::LongitudinalPlan::SpeedLimitControlState State;
+
+  TurnSpeedController();
+  void update(bool enabled, double v_ego, double a_ego, SubMaster &sm);
+
+  State state() const { return state_; }
+  bool isActive() const { return state_ > State::TEMP_INACTIVE; }
+  double aTarget() const { return isActive() ? a_target : a_ego; }
+  double speedLimit() const { return speed_limit > 0. ? std::max(speed_limit, LIMIT_MIN_SPEED) : 0.; }
+  double distance() const { return std::max(distance_, 0.); }
+  int turnSign() const { return turn_sign; }
+
+private:
+  void setState(State value);
+  std::tuple<double, double, int> getLimitFromMapData(SubMaster &sm);
+  void updateParams();
+  void stateTransition(SubMaster &sm);
+  void updateSolution();
+
+  Params params;
+  double last_params_update = 0.;
+  bool is_enabled;
+  bool op_enabled = false;
+  double v_ego = 0.;
+  double a_ego = 0.;
+
+  double v_offset = 0.;
+  double speed_limit = 0.;
+  double speed_limit_temp_inactive = 0.;
+  double distance_ = 0.;
+  int turn_sign = 0;
+  State state_ = State::INACTIVE;
+
+  double next_speed_limit_prev = 0.;
+
+  double a_target = 0.;
+};
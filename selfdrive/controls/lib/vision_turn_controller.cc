@@ -0,0 +1,244 @@
+#include "selfdrive/controls/lib/vision_turn_controller.h"
+
+#include <cmath>
+
+#include <eigen3/Eigen/Dense>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/controls/lib/drive_helpers.h"
+
+const double MIN_V = 5.6;  // Do not operate under 20km/h
+
+const double ENTERING_PRED_LAT_ACC_TH = 1.3;  // Predicted Lat Acc threshold to trigger entering turn state.
+const double ABORT_ENTERING_PRED_LAT_ACC_TH = 1.1;  // Predicted Lat Acc threshold to abort entering state if speed drops.
+
+const double TURNING_LAT_ACC_TH = 1.6;  // Lat Acc threshold to trigger turning turn state.
+
+const double LEAVING_LAT_ACC_TH = 1.3;  // Lat Acc threshold to trigger leaving turn state.
+const double FINISH_LAT_ACC_TH = 1.1;  // Lat Acc threshold to trigger end of turn cycle.
+
+const double EVAL_STEP = 5.;  // mts. Resolution of the curvature evaluation.
+const double EVAL_START = 20.;  // mts. Distance ahead where to start evaluating vision curvature.
+const double EVAL_LENGHT = 150.;  // mts. Distance ahead where to stop evaluating vision curvature.
+const int EVAL_N = (EVAL_LENGHT - EVAL_START) / EVAL_STEP;
+
+const double A_LAT_REG_MAX = 2.;  // Maximum lateral acceleration
+
+// Lookup table for the minimum smooth deceleration during the ENTERING state
+// depending on the actual maximum absolute lateral acceleration predicted on the turn ahead.
+static const double ENTERING_SMOOTH_DECEL_V[] = {-0.2, -1.};  // min decel value allowed on ENTERING state
+static const double ENTERING_SMOOTH_DECEL_BP[] = {1.3, 3.};  // absolute value of lat acc ahead
+
+// Lookup table for the acceleration for the TURNING state
+// depending on the current lateral acceleration of the vehicle.
+static const double TURNING_ACC_V[] = {0.5, 0., -0.4};  // acc value
+static const double TURNING_ACC_BP[] = {1.5, 2.3, 3.};  // absolute value of current lat acc
+
+const double LEAVING_ACC = 0.5;  // Confortble acceleration to regain speed while leaving a turn.
+
+const double MIN_LANE_PROB = 0.6;  // Minimum lanes probability to allow curvature prediction based on lanes.
+
+// np.polyfit(x, y, 3), highest power first. The columns are scaled like numpy does
+// so the far points don't swamp the fit.
+static Eigen::Vector4d polyfit3(const Eigen::VectorXd &x, const Eigen::VectorXd &y) {
+  Eigen::MatrixXd A(x.size(), 4);
+  for (int i = 0; i < x.size(); i++) {
+    A(i, 0) = x[i] * x[i] * x[i];
+    A(i, 1) = x[i] * x[i];
+    A(i, 2) = x[i];
+    A(i, 3) = 1.;
+  }
+  Eigen::Vector4d scale = A.colwise().norm();
+  for (int j = 0; j < 4; j++) {
+    if (scale[j] > 0.) A.col(j) /= scale[j];
+  }
+  Eigen::Vector4d c = A.colPivHouseholderQr().solve(y);
+  for (int j = 0; j < 4; j++) {
+    if (scale[j] > 0.) c[j] /= scale[j];
+  }
+  return c;
+}
+
+// https://en.wikipedia.org/wiki/Curvature#  Local_expressions
+static double eval_curvature(const Eigen::Vector4d &poly, double x) {
+  return std::abs(2 * poly[1] + 6 * poly[0] * x) /
+         std::pow(1 + std::pow(3 * poly[0] * x * x + 2 * poly[1] * x + poly[2], 2), 1.5);
+}
+
+VisionTurnController::VisionTurnController(const cereal::CarParams::Reader &CP)
+    : steer_ratio(CP.getSteerRatio()), wheelbase(CP.getWheelbase()) {
+  is_enabled = params.getBool("TurnVisionControl");
+  reset();
+}
+
+void VisionTurnController::setState(State value) {
+  if (value != state_ && value == State::DISABLED) {
+    reset();
+  }
+  state_ = value;
+}
+
+void VisionTurnController::reset() {
+  current_lat_acc = 0.;
+  max_v_for_current_curvature = 0.;
+  max_pred_lat_acc = 0.;
+  v_overshoot_distance = 200.;
+  lat_acc_overshoot_ahead = false;
+}
+
+void VisionTurnController::updateParams() {
+  double time = seconds_since_boot();
+  if (time > last_params_update + 5.0) {
+    is_enabled = params.getBool("TurnVisionControl");
+    last_params_update = time;
+  }
+}
+
+void VisionTurnController::updateCalculations(SubMaster &sm) {
+  // Get path polynomial aproximation for curvature estimation from model data.
+  // The python also falls back to the path of lateralPlan, which plannerd doesn't subscribe to.
+  Eigen::Vector4d path_poly = Eigen::Vector4d::Zero();
+
+  // When the probability of lanes is good enough, compute polynomial from lanes as they are way more stable
+  // on current mode than drving path.
+  auto model_data = sm["modelV2"].getModelV2();
+  auto lane_lines = model_data.getLaneLines();
+  if (sm.valid("modelV2") && lane_lines.size() == 4 && lane_lines[0].getT().size() == TRAJECTORY_SIZE) {
+    auto ll_x = lane_lines[1].getX();  // left and right ll x is the same
+    auto lll_y = lane_lines[1].getY();
+    auto rll_y = lane_lines[2].getY();
+    double l_prob = model_data.getLaneLineProbs()[1];
+    double r_prob = model_data.getLaneLineProbs()[2];
+    double lll_std = model_data.getLaneLineStds()[1];
+    double rll_std = model_data.getLaneLineStds()[2];
+
+    // Reduce reliance on lanelines that are too far apart or will be in a few seconds
+    static const double WIDTH_BP[] = {4.0, 5.0}, WIDTH_V[] = {1.0, 0.0};
+    std::array<double, TRAJECTORY_SIZE> width_pts;
+    for (int i = 0; i < TRAJECTORY_SIZE; i++) width_pts[i] = rll_y[i] - lll_y[i];
+    double mod = 1.;
+    for (double t_check : {0.0, 1.5, 3.0}) {
+      double width_at_t = interp(t_check * (v_ego + 7), ll_x, width_pts, TRAJECTORY_SIZE);
+      mod = std::min(mod, interp(width_at_t, WIDTH_BP, WIDTH_V));
+    }
+    l_prob *= mod;
+    r_prob *= mod;
+
+    // Reduce reliance on uncertain lanelines
+    static const double STD_BP[] = {.15, .3}, STD_V[] = {1.0, 0.0};
+    l_prob *= interp(lll_std, STD_BP, STD_V);
+    r_prob *= interp(rll_std, STD_BP, STD_V);
+
+    // Find path from lanes as the average center lane only if min probability on both lanes is above threshold.
+    if (l_prob > MIN_LANE_PROB && r_prob > MIN_LANE_PROB) {
+      Eigen::VectorXd x(TRAJECTORY_SIZE), c_y(TRAJECTORY_SIZE);
+      for (int i = 0; i < TRAJECTORY_SIZE; i++) {
+        x[i] = ll_x[i];
+        c_y[i] = width_pts[i] / 2 + lll_y[i];
+      }
+      path_poly = polyfit3(x, c_y);
+    }
+  }
+
+  double current_curvature = std::abs(sm["carState"].getCarState().getSteeringAngleDeg() * DEG_TO_RAD /
+                                      (steer_ratio * wheelbase));
+  current_lat_acc = current_curvature * v_ego * v_ego;
+  max_v_for_current_curvature = current_curvature > 0 ? std::sqrt(A_LAT_REG_MAX / current_curvature)
+                                                      : V_CRUISE_MAX * KPH_TO_MS;
+
+  double max_curvature_for_vego = A_LAT_REG_MAX / std::pow(std::max(v_ego, 0.1), 2);
+  double max_pred_curvature = 0.;
+  int overshoot_idx = -1;
+  for (int i = 0; i < EVAL_N; i++) {
+    double curvature = eval_curvature(path_poly, EVAL_START + i * EVAL_STEP);
+    max_pred_curvature = i == 0 ? curvature : std::max(max_pred_curvature, curvature);
+    if (overshoot_idx < 0 && curvature >= max_curvature_for_vego) overshoot_idx = i;
+  }
+  max_pred_lat_acc = v_ego * v_ego * max_pred_curvature;
+  lat_acc_overshoot_ahead = overshoot_idx >= 0;
+
+  if (lat_acc_overshoot_ahead) {
+    v_overshoot = std::min(std::sqrt(A_LAT_REG_MAX / max_pred_curvature), v_cruise_setpoint);
+    v_overshoot_distance = std::max(overshoot_idx * EVAL_STEP + EVAL_START, EVAL_STEP);
+  }
+}
+
+void VisionTurnController::stateTransition() {
+  // In any case, if system is disabled or the feature is disabeld or gas is pressed, disable.
+  if (!op_enabled || !is_enabled || gas_pressed) {
+    setState(State::DISABLED);
+    return;
+  }
+
+  switch (state_) {
+    case State::DISABLED:
+      // Do not enter a turn control cycle if speed is low.
+      // If substantial lateral acceleration is predicted ahead, then move to Entering turn state.
+      if (v_ego > MIN_V && max_pred_lat_acc >= ENTERING_PRED_LAT_ACC_TH) {
+        setState(State::ENTERING);
+      }
+      break;
+    case State::ENTERING:
+      // Transition to Turning if current lateral acceleration is over the threshold.
+      if (current_lat_acc >= TURNING_LAT_ACC_TH) {
+        setState(State::TURNING);
+      // Abort if the predicted lateral acceleration drops
+      } else if (max_pred_lat_acc < ABORT_ENTERING_PRED_LAT_ACC_TH) {
+        setState(State::DISABLED);
+      }
+      break;
+    case State::TURNING:
+      // Transition to Leaving if current lateral acceleration drops drops below threshold.
+      if (current_lat_acc <= LEAVING_LAT_ACC_TH) {
+        setState(State::LEAVING);
+      }
+      break;
+    case State::LEAVING:
+      // Transition back to Turning if current lateral acceleration goes back over the threshold.
+      if (current_lat_acc >= TURNING_LAT_ACC_TH) {
+        setState(State::TURNING);
+      // Finish if current lateral acceleration goes below threshold.
+      } else if (current_lat_acc < FINISH_LAT_ACC_TH) {
+        setState(State::DISABLED);
+      }
+      break;
+  }
+}
+
+void VisionTurnController::updateSolution() {
+  switch (state_) {
+    case State::DISABLED:
+      a_target = a_ego;
+      break;
+    case State::ENTERING:
+      // when not overshooting, target a smooth deceleration in preparation for a sharp turn to come.
+      a_target = interp(max_pred_lat_acc, ENTERING_SMOOTH_DECEL_BP, ENTERING_SMOOTH_DECEL_V);
+      if (lat_acc_overshoot_ahead) {
+        // when overshooting, target the acceleration needed to achieve the overshoot speed at
+        // the required distance
+        a_target = std::min((v_overshoot * v_overshoot - v_ego * v_ego) / (2 * v_overshoot_distance), a_target);
+      }
+      break;
+    case State::TURNING:
+      // When turning we provide a target acceleration that is confortable for the lateral accelearation felt.
+      a_target = interp(current_lat_acc, TURNING_ACC_BP, TURNING_ACC_V);
+      break;
+    case State::LEAVING:
+      // When leaving we provide a confortable acceleration to regain speed.
+      a_target = LEAVING_ACC;
+      break;
+  }
+}
+
+void VisionTurnController::update(bool enabled, double v, double a, double v_cruise, SubMaster &sm) {
+  op_enabled = enabled;
+  gas_pressed = sm["carState"].getCarState().getGasPressed();
+  v_ego = v;
+  a_ego = a;
+  v_cruise_setpoint = v_cruise;
+
+  updateParams();
+  updateCalculations(sm);
+  stateTransition();
+  updateSolution();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "cereal/gen/cpp/car.capnp.h"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/params.h"
+
+// vision_turn_controller.py
+class VisionTurnController {
+public:
+  typedef cereal::LongitudinalPlan::VisionTurnControllerState State;
+
+  VisionTurnController(const cereal::CarParams::Reader &CP);
+  void update(bool enabled, double v_ego, double a_ego, double v_cruise_setpoint, SubMaster &sm);
+
+  State state() const { return state_; }
+  bool isActive() const { return state_ != State::DISABLED; }
+  double aTarget() const { return isActive() ? a_target : a_ego; }
+  double vTurn() const { return isActive() && lat_acc_overshoot_ahead ? v_overshoot : v_ego; }
+
+private:
+  void setState(State value);
+  void reset();
+  void updateParams();
+  void updateCalculations(SubMaster &sm);
+  void stateTransition();
+  void updateSolution();
+
+  Params params;
+  double steer_ratio, wheelbase;
+  bool op_enabled = false;
+  bool gas_pressed = false;
+  bool is_enabled;
+  double last_params_update = 0.;
+  double v_cruise_setpoint = 0.;
+  double v_ego = 0.;
+  double a_ego = 0.;
+  double a_target = 0.;
+  double v_overshoot = 0.;
+  State state_ = State::DISABLED;
+
+  double current_lat_acc;
+  double max_v_for_current_curvature;
+  double max_pred_lat_acc;
+  double v_overshoot_distance;
+  bool lat_acc_overshoot_ahead;
+};
@@ -0,0 +1,53 @@
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/params.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/controls/lib/lateral_planner.h"
+#include "selfdrive/controls/lib/longitudinal_planner.h"
+#include "selfdrive/hardware/hw.h"
+
+// plannerd.py, with the planners and their mpcs native. The python planner
+// stays the reference, PY_PLANNERD=1 makes the manager run it instead.
+
+ExitHandler do_exit;
+
+int main() {
+  // same core and priority as config_realtime_process(..., Priority.CTRL_LOW)
+  int ret = set_core_affinity(Hardware::TICI() ? 5 : Hardware::JETSON() ? 4 : 2);
+  if (ret != 0) LOGW("plannerd: couldn't set core affinity");
+  ret = set_realtime_priority(51);
+  if (ret != 0) LOGW("plannerd: couldn't set realtime priority");
+
+  LOG("plannerd is waiting for CarParams");
+  Params params;
+  std::string car_params_str = params.get("CarParams", true);
+  AlignedBuffer aligned_buf;
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.align(car_params_str.data(), car_params_str.size()));
+  cereal::CarParams::Reader CP = cmsg.getRoot<cereal::CarParams>();
+  LOG("plannerd got CarParams: %s", CP.getCarName().cStr());
+
+  bool use_lanelines = !params.getBool("EndToEndToggle");
+  bool wide_camera = Hardware::TICI() ? params.getBool("EnableWideCamera") : false;
+
+  LOG("e2e mode on: %d", use_lanelines);
+
+  Planner longitudinal_planner(CP);
+  LateralPlanner lateral_planner(CP, use_lanelines, wide_camera);
+
+  SubMaster sm({"carState", "controlsState", "radarState", "modelV2", "dragonConf", "liveMapData"});
+  PubMaster pm({"longitudinalPlan", "lateralPlan"});
+
+  while (!do_exit) {
+    sm.update(1000);
+
+    if (sm.updated("modelV2")) {
+      lateral_planner.update(sm);
+      lateral_planner.publish(sm, pm);
+    }
+    if (sm.updated("radarState")) {
+      longitudinal_planner.update(sm);
+      longitudinal_planner.publish(sm, pm);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/params.h"
+#include "selfdrive/common/ratekeeper.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/controls/lib/radar_helpers.h"
+#include "selfdrive/controls/lib/radar_interface.h"
+#include "selfdrive/hardware/hw.h"
+
+// radard.py, fuses camera and radar data for best lead detection. The cars
+// without a native radar interface get radard.py in its place, PY_RADARD=1
+// makes the manager run it for all of them.
+
+ExitHandler do_exit;
+
+int main() {
+  // same core and priority as config_realtime_process(..., Priority.CTRL_LOW)
+  int ret = set_core_affinity(Hardware::TICI() ? 5 : Hardware::JETSON() ? 4 : 2);
+  if (ret != 0) LOGW("radard: couldn't set core affinity");
+  ret = set_realtime_priority(51);
+  if (ret != 0) LOGW("radard: couldn't set realtime priority");
+
+  // wait for stats about the car to come in from controls
+  LOG("radard is waiting for CarParams");
+  Params params;
+  std::string car_params_str = params.get("CarParams", true);
+  AlignedBuffer aligned_buf;
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.align(car_params_str.data(), car_params_str.size()));
+  cereal::CarParams::Reader CP = cmsg.getRoot<cereal::CarParams>();
+  LOG("radard got CarParams: %s", CP.getCarName().cStr());
+
+  std::string err;
+  const json11::Json dbcs = json11::Json::parse(params.get("CarDBCs"), err);
+  std::unique_ptr<RadarInterface> RI = radar_interface_create(CP, dbcs);
+  if (!RI) {
+    LOGW("radard: no native radar interface for %s, running radard.py", CP.getCarName().cStr());
+    execlp("python3", "python3", "-m", "selfdrive.controls.radard", (char *)NULL);
+    LOGE("radard: couldn't run radard.py");
+    return 1;
+  }
+
+  // *** setup messaging
+  std::unique_ptr<Context> context(Context::create());
+  std::unique_ptr<SubSocket> can_sock(SubSocket::create(context.get(), "can"));
+  assert(can_sock != NULL);
+  can_sock->setTimeout(100);
+  SubMaster sm({"modelV2", "carState"});
+  PubMaster pm({"radarState", "liveTracks"});
+
+  RateKeeper rk("radard", 1.0 / CP.getRadarTimeStep());
+  RadarD RD(CP.getRadarTimeStep(), RI->delay);
+  RadarData rr;
+  std::vector<std::string> can_strings;
+
+  while (!do_exit) {
+    // everything that came in, waiting for one
+    can_strings.clear();
+    for (Message *msg = can_sock->receive(); msg != nullptr; msg = can_sock->receive(true)) {
+      can_strings.emplace_back(msg->getData(), msg->getSize());
+      delete msg;
+    }
+    if (can_strings.empty() || !RI->update(can_strings, rr)) {
+      continue;
+    }
+
+    sm.update(0);
+    if (sm.updated("carState")) {
+      RD.update_v_ego(sm["carState"].getCarState().getVEgo());
+    }
+    if (sm.updated("modelV2")) {
+      RD.ready = true;
+    }
+    RD.update(rr);
+
+    // *** publish radarState ***
+    {
+      MessageBuilder msg;
+      auto radar_state = msg.initEvent(sm.allAliveAndValid() && rr.errors.empty()).initRadarState();
+      radar_state.setMdMonoTime(sm["modelV2"].getLogMonoTime());
+      radar_state.setCarStateMonoTime(sm["carState"].getLogMonoTime());
+      auto errors = radar_state.initRadarErrors(rr.errors.size());
+      for (int i = 0; i < rr.errors.size(); i++) {
+        errors.set(i, rr.errors[i]);
+      }
+      radar_state.setCumLagMs(-rk.remaining() * 1e-6);
+
+      auto leads = sm["modelV2"].getModelV2().getLeadsV3();
+      if (leads.size() > 1) {
+        RD.get_lead(leads[0], true).fill(radar_state.initLeadOne());
+        RD.get_lead(leads[1], false).fill(radar_state.initLeadTwo());
+      }
+      pm.send("radarState", msg);
+    }
+
+    // *** publish tracks for UI debugging (keep last) ***
+    {
+      const RadarTracks &tracks = RD.tracks();
+      MessageBuilder msg;
+      auto live_tracks = msg.initEvent().initLiveTracks(tracks.size());
+      for (int i = 0; i < tracks.size(); i++) {
+        live_tracks[i].setTrackId(tracks.id[i]);
+        live_tracks[i].setDRel(tracks.d_rel[i]);
+        live_tracks[i].setYRel(tracks.y_rel[i]);
+        live_tracks[i].setVRel(tracks.v_rel[i]);
+      }
+      pm.send("liveTracks", msg);
+    }
+
+    rk.monitorTime();
+  }
+  return 0;
+}
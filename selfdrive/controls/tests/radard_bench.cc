@@ -0,0 +1,88 @@
+// Times a radard cycle against the number of radar tracks, run from selfdrive/controls.
+//
+//   tests/radard_bench [-n scans]
+//
+// Each scan moves the points of a few lanes of traffic a radar time step on,
+// every second a quarter of them go away for new tracks. A cycle is
+// RadarD::update (tracks, Kalman updates, clustering) and the leadOne and
+// leadTwo lookups.
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/controls/lib/radar_helpers.h"
+
+const double RADAR_TS = 0.05;
+
+int main(int argc, char *argv[]) {
+  int scans = 1000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt == 'n') {
+      scans = atoi(optarg);
+    } else {
+      fprintf(stderr, "usage: %s [-n scans]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // two model leads straight ahead
+  MessageBuilder msg;
+  auto leads = msg.initEvent().initModelV2().initLeadsV3(2);
+  for (int i = 0; i < 2; i++) {
+    leads[i].setProb(0.9);
+    leads[i].setX({20.f + 30 * i});
+    leads[i].setXStd({2.f});
+    leads[i].setY({0.f});
+    leads[i].setYStd({0.5f});
+    leads[i].setV({25.f});
+    leads[i].setVStd({1.f});
+  }
+
+  printf("%6s %10s %10s %12s\n", "tracks", "clusters", "us/cycle", "us/track");
+  for (int n : {4, 8, 16, 32, 64, 128, 256}) {
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<double> d_rel(5, 150), y_rel(-6, 6), v_rel(-10, 10), jitter(-0.3, 0.3);
+
+    RadarD RD(RADAR_TS);
+    RD.ready = true;
+    RD.update_v_ego(25.);
+
+    RadarData rr;
+    uint64_t track_id = 0;
+    for (int i = 0; i < n; i++) {
+      rr.points.push_back({track_id++, (float)d_rel(gen), (float)y_rel(gen), (float)v_rel(gen), true});
+    }
+
+    size_t clusters = 0;
+    double elapsed = 0;
+    for (int s = 0; s < scans; s++) {
+      for (int i = 0; i < n; i++) {
+        RadarPoint &pt = rr.points[i];
+        if (i % 4 == s % 4 && s % 20 == 0) {
+          pt = {track_id++, (float)d_rel(gen), (float)y_rel(gen), (float)v_rel(gen), true};
+        } else {
+          pt.d_rel += pt.v_rel * RADAR_TS;
+          pt.y_rel += jitter(gen) * 0.1;
+          pt.v_rel += jitter(gen);
+        }
+      }
+
+      const double start = nanos_since_boot();
+      RD.update(rr);
+      RD.get_lead(leads[0], true);
+      RD.get_lead(leads[1], false);
+      elapsed += nanos_since_boot() - start;
+      clusters += RD.clusters().size();
+    }
+    const double us = elapsed / scans / 1e3;
+    printf("%6d %10.1f %10.1f %12.3f\n", n, (double)clusters / scans, us, us / n);
+  }
+  return 0;
+}
@@ -36,6 +36,14 @@ def print_logmessage(t, msg, min_level):
 
 
 def print_androidlog(t, msg):
+  # logcatd batches entries, older logs have one per message
+  if len(msg.entries) or len(msg.suppressed):
+    for entry in msg.entries:
+      print_androidlog(t, entry)
+    for s in msg.suppressed:
+      print(f"[{t / 1e9:.6f}] {s.tag} - {s.count} entries rate limited")
+    return
+
   source = ANDROID_LOG_SOURCE[msg.id]
   try:
     m = json.loads(msg.message)['MESSAGE']
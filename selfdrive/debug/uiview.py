@@ -1,11 +1,11 @@
 #!/usr/bin/env python3
 import time
 import cereal.messaging as messaging
-from selfdrive.manager.process_config import managed_processes
+from selfdrive.manager.process_config import managed_processes, PY_CALIBRATIOND
 
 if __name__ == "__main__":
   services = ['controlsState', 'deviceState', 'pandaState']  # the services needed to be spoofed to start ui offroad
-  procs = ['camerad', 'ui', 'modeld', 'calibrationd']
+  procs = ['camerad', 'ui', 'modeld'] + (['calibrationd'] if PY_CALIBRATIOND else [])
 
   for p in procs:
     managed_processes[p].start()
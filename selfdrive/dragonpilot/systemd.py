@@ -33,7 +33,6 @@ from selfdrive.hardware import HARDWARE
 params = Params()
 from common.dp_common import param_get, get_last_modified
 from common.dp_time import LAST_MODIFIED_SYSTEMD
-from selfdrive.dragonpilot.dashcamd import Dashcamd
 from selfdrive.dragonpilot.appd import Appd
 from selfdrive.hardware import EON
 import socket
@@ -62,7 +61,6 @@ def confd_thread():
   battery_percent = 0
   overheat = False
   last_started = False
-  dashcamd = Dashcamd()
   appd = Appd()
   is_eon = EON
   rk = Ratekeeper(HERTZ, print_delay_threshold=None)  # Keeps rate at 2 hz
@@ -156,13 +154,6 @@ def confd_thread():
     #   last_charging_ctrl = process_charging_ctrl(msg, last_charging_ctrl, battery_percent)
     '''
     ===================================================
-    dashcam
-    ===================================================
-    '''
-    if msg.dragonConf.dpDashcamd and frame % HERTZ == 0:
-      dashcamd.run(started, free_space)
-    '''
-    ===================================================
     appd
     ===================================================
     '''
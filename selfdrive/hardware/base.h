@@ -19,6 +19,12 @@ public:
   static bool get_ssh_enabled() { return false; }
   static void set_ssh_enabled(bool enabled) {}
 
+  // keeps the GPU at power level or faster, 0 is the fastest level and -1
+  // hands the GPU back to the governor. false if it can't be set here
+  static bool set_gpu_min_pwrlevel(int level) { return false; }
+  // MHz, 0 when unknown
+  static int get_gpu_freq() { return 0; }
+
   static bool PC() { return false; }
   static bool EON() { return false; }
   static bool TICI() { return false; }
@@ -9,6 +9,7 @@
 
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/base.h"
+#include "selfdrive/hardware/kgsl.h"
 
 class HardwareEon : public HardwareNone {
 public:
@@ -42,6 +43,9 @@ public:
     std::system(cmd.c_str());
   };
 
+  static bool set_gpu_min_pwrlevel(int level) { return kgsl::set_min_pwrlevel(level); }
+  static int get_gpu_freq() { return kgsl::gpu_freq(); }
+
   // android only
   inline static bool launched_activity = false;
   static void check_activity() {
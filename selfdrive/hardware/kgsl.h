@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "selfdrive/common/util.h"
+
+// devfreq of the Adreno GPU on EON and TICI, through the kgsl sysfs nodes
+namespace kgsl {
+
+const std::string SYSFS = "/sys/class/kgsl/kgsl-3d0/";
+
+inline int read_int(const std::string &node, int default_val) {
+  std::ifstream f(SYSFS + node);
+  int val;
+  return (f >> val) ? val : default_val;
+}
+
+inline bool write_int(const std::string &node, int val) {
+  std::ofstream f(SYSFS + node);
+  return f.is_open() && (f << val << "\n") && f.flush();
+}
+
+// the governor doesn't go below level, 0 is the fastest one. -1 allows all of them again
+inline bool set_min_pwrlevel(int level) {
+  const int num_pwrlevels = read_int("num_pwrlevels", 0);
+  if (num_pwrlevels <= 0) return false;
+  if (level < 0 || level >= num_pwrlevels) level = num_pwrlevels - 1;
+  return write_int("min_pwrlevel", level);
+}
+
+// current GPU clock in MHz, 0 when unknown. modeld reads it every frame
+inline int gpu_freq() {
+  thread_local util::FileReader gpuclk(SYSFS + "gpuclk");
+  return std::atoi(gpuclk.read().c_str()) / 1000000;
+}
+
+}  // namespace kgsl
@@ -6,6 +6,7 @@
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/base.h"
+#include "selfdrive/hardware/kgsl.h"
 
 class HardwareTici : public HardwareNone {
 public:
@@ -35,4 +36,7 @@ public:
 
   static bool get_ssh_enabled() { return Params().getBool("SshEnabled"); };
   static void set_ssh_enabled(bool enabled) { Params().putBool("SshEnabled", enabled); };
+
+  static bool set_gpu_min_pwrlevel(int level) { return kgsl::set_min_pwrlevel(level); }
+  static int get_gpu_freq() { return kgsl::gpu_freq(); }
 };
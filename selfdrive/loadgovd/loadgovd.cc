@@ -0,0 +1,119 @@
+// The load governor. Once a second it looks at the temperatures thermald
+// reads, the GPU clock and the deadlines the daemons miss, and under pressure
+// sheds the optional work in load_governor.h one level at a time, before
+// thermald has to go offroad or the SoC throttles the critical paths.
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/load_governor.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
+
+// hotter than this is pressure, it clears below LOAD_TEMP_LOW. thermald goes
+// yellow at 80 and red at 96, this starts before that
+#define LOAD_TEMP_HIGH 75.f
+#define LOAD_TEMP_LOW 70.f
+// fraction of deadlines missed over the last second
+#define LOAD_MISS_HIGH 0.02
+#define LOAD_MISS_LOW 0.005
+// the GPU is throttled when it's below this of the fastest clock seen
+#define LOAD_GPU_THROTTLED 0.75
+// seconds of pressure before the next level, of calm before the one before
+#define LOAD_UP_S 5
+#define LOAD_DOWN_S 30
+
+ExitHandler do_exit;
+
+int main() {
+  setpriority(PRIO_PROCESS, 0, -5);
+
+  LoadGovernorState *state = load_governor();
+  if (state == nullptr) {
+    LOGE("no shared memory for the load governor");
+    return 1;
+  }
+  state->level = 0;
+
+  SubMaster sm({"deviceState"});
+  uint64_t prev_cycles[LOAD_GOVERNOR_MAX_DEADLINES] = {}, prev_misses[LOAD_GOVERNOR_MAX_DEADLINES] = {};
+  int gpu_freq_max = 0;
+  uint32_t level = 0;
+  double last_change = seconds_since_boot(), pressure_since = INFINITY, calm_since = INFINITY;
+
+  while (!do_exit) {
+    util::sleep_for(1000);
+    sm.update(0);
+
+    // deadlines
+    uint64_t cycles = 0, misses = 0;
+    std::string worst;
+    double worst_ratio = 0;
+    for (int i = 0; i < LOAD_GOVERNOR_MAX_DEADLINES; i++) {
+      LoadDeadlineSlot &d = state->deadlines[i];
+      if (d.state.load(std::memory_order_acquire) != 2) continue;
+      const uint64_t c = d.cycles.load(std::memory_order_relaxed), m = d.misses.load(std::memory_order_relaxed);
+      // a daemon that restarted with the slot doesn't go backwards
+      const uint64_t dc = c >= prev_cycles[i] ? c - prev_cycles[i] : 0, dm = m >= prev_misses[i] ? m - prev_misses[i] : 0;
+      prev_cycles[i] = c;
+      prev_misses[i] = m;
+      cycles += dc;
+      misses += dm;
+      if (dc > 0 && (double)dm / dc > worst_ratio) {
+        worst_ratio = (double)dm / dc;
+        worst = std::string(d.name, strnlen(d.name, sizeof(d.name)));
+      }
+    }
+    const double miss_ratio = cycles > 0 ? (double)misses / cycles : 0;
+
+    // temperatures, as thermald reads them from the thermal zones
+    float max_temp = 0;
+    bool thermal_warning = false;
+    if (sm.alive("deviceState")) {
+      auto ds = sm["deviceState"].getDeviceState();
+      for (float t : ds.getCpuTempC()) max_temp = std::max(max_temp, t);
+      for (float t : ds.getGpuTempC()) max_temp = std::max(max_temp, t);
+      max_temp = std::max(max_temp, ds.getMemoryTempC());
+      thermal_warning = ds.getThermalStatus() >= cereal::DeviceState::ThermalStatus::YELLOW;
+    }
+
+    // modeld holds the GPU at a power level, a slower clock than that is the SoC throttling
+    const int gpu_freq = Hardware::get_gpu_freq();
+    gpu_freq_max = std::max(gpu_freq_max, gpu_freq);
+    const bool gpu_throttled = gpu_freq > 0 && gpu_freq < gpu_freq_max * LOAD_GPU_THROTTLED;
+
+    const bool pressure = thermal_warning || max_temp > LOAD_TEMP_HIGH || miss_ratio > LOAD_MISS_HIGH || gpu_throttled;
+    const bool calm = !thermal_warning && max_temp < LOAD_TEMP_LOW && miss_ratio < LOAD_MISS_LOW && !gpu_throttled;
+
+    // a level is held for at least the time before the next step, pressure
+    // and calm each have to last that long in a row
+    const double now = seconds_since_boot();
+    pressure_since = pressure ? std::min(pressure_since, now) : INFINITY;
+    calm_since = calm ? std::min(calm_since, now) : INFINITY;
+    uint32_t new_level = level;
+    if (level < (uint32_t)LoadShed::MAX && now - std::max(pressure_since, last_change) >= LOAD_UP_S) {
+      new_level = level + 1;
+    } else if (level > 0 && now - std::max(calm_since, last_change) >= LOAD_DOWN_S) {
+      new_level = level - 1;
+    }
+
+    if (new_level != level) {
+      LOGW("load level %u -> %u: %.1f C%s, gpu %d/%d MHz, %.1f%% deadlines missed (%s %.1f%%)",
+           level, new_level, max_temp, thermal_warning ? " (thermal warning)" : "", gpu_freq, gpu_freq_max,
+           miss_ratio * 100, worst.empty() ? "-" : worst.c_str(), worst_ratio * 100);
+      level = new_level;
+      last_change = now;
+      state->level.store(level, std::memory_order_relaxed);
+    }
+  }
+
+  // nothing stays shed without a governor
+  state->level = 0;
+  return 0;
+}
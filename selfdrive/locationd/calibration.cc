@@ -0,0 +1,195 @@
+#include "selfdrive/locationd/calibration.h"
+
+#include <limits>
+#include <string>
+
+#include "common/transformations/orientation.hpp"
+#include "selfdrive/common/swaglog.h"
+
+using namespace calibration;
+
+static bool is_calibration_valid(const Eigen::Vector3d &rpy) {
+  return (PITCH_LIMITS[0] < rpy[1] && rpy[1] < PITCH_LIMITS[1]) && (YAW_LIMITS[0] < rpy[2] && rpy[2] < YAW_LIMITS[1]);
+}
+
+static Eigen::Vector3d sanity_clip(const Eigen::Vector3d &rpy) {
+  if (rpy.hasNaN()) {
+    return Eigen::Vector3d::Zero();
+  }
+  return {rpy[0],
+          std::clamp(rpy[1], PITCH_LIMITS[0] - .005, PITCH_LIMITS[1] + .005),
+          std::clamp(rpy[2], YAW_LIMITS[0] - .005, YAW_LIMITS[1] + .005)};
+}
+
+Calibrator::Calibrator(bool wide_camera, bool param_put) : wide_camera(wide_camera) {
+  Eigen::Vector3d rpy_init = Eigen::Vector3d::Zero();
+  int valid_blocks = 0;
+
+  // Read saved calibration
+  if (param_put) {
+    this->params_writer = std::make_unique<ParamsWriter>();
+
+    std::string calibration_params = Params().get("CalibrationParams");
+    if (!calibration_params.empty()) {
+      try {
+        AlignedBuffer aligned_buf;
+        capnp::FlatArrayMessageReader cmsg(aligned_buf.align(calibration_params.data(), calibration_params.size()));
+        auto calib = cmsg.getRoot<cereal::Event>().getLiveCalibration();
+        auto rpy_calib = calib.getRpyCalib();
+        if (rpy_calib.size() == 3) {
+          rpy_init = {rpy_calib[0], rpy_calib[1], rpy_calib[2]};
+        }
+        valid_blocks = calib.getValidBlocks();
+      } catch (kj::Exception &e) {
+        LOGE("Error reading cached CalibrationParams: %s", e.getDescription().cStr());
+      }
+    }
+  }
+
+  this->reset(rpy_init, valid_blocks);
+  this->update_status();
+}
+
+void Calibrator::reset(const Eigen::Vector3d &rpy_init, int valid_blocks, const Eigen::Vector3d *smooth_from) {
+  this->rpy = rpy_init.allFinite() ? rpy_init : Eigen::Vector3d::Zero();
+  this->valid_blocks = std::max(valid_blocks, 0);
+  this->rpys.fill(this->rpy);
+
+  this->idx = 0;
+  this->block_idx = 0;
+  this->v_ego = 0;
+
+  if (smooth_from == nullptr) {
+    this->old_rpy = Eigen::Vector3d::Zero();
+    this->old_rpy_weight = 0.0;
+  } else {
+    this->old_rpy = *smooth_from;
+    this->old_rpy_weight = 1.0;
+  }
+  this->update_blocks();
+}
+
+void Calibrator::update_blocks() {
+  this->rpys_sum.setZero();
+  this->rpys_min.setConstant(std::numeric_limits<double>::infinity());
+  this->rpys_max.setConstant(-std::numeric_limits<double>::infinity());
+  for (int i = 0; i < this->blocks(); i++) {
+    this->rpys_sum += this->rpys[i];
+    if (i != this->block_idx) {
+      this->rpys_min = this->rpys_min.cwiseMin(this->rpys[i]);
+      this->rpys_max = this->rpys_max.cwiseMax(this->rpys[i]);
+    }
+  }
+}
+
+void Calibrator::update_status() {
+  if (this->valid_blocks > 0) {
+    Eigen::Vector3d max_rpy_calib = this->rpys_max, min_rpy_calib = this->rpys_min;
+    if (this->block_idx < this->blocks()) {
+      max_rpy_calib = max_rpy_calib.cwiseMax(this->rpys[this->block_idx]);
+      min_rpy_calib = min_rpy_calib.cwiseMin(this->rpys[this->block_idx]);
+    }
+    this->calib_spread = (max_rpy_calib - min_rpy_calib).cwiseAbs();
+  } else {
+    this->calib_spread.setZero();
+  }
+
+  if (this->valid_blocks < INPUTS_NEEDED) {
+    this->cal_status = UNCALIBRATED;
+  } else if (is_calibration_valid(this->rpy)) {
+    this->cal_status = CALIBRATED;
+  } else {
+    this->cal_status = INVALID;
+  }
+
+  // If spread is too high, assume mounting was changed and reset to last block.
+  // Make the transition smooth. Abrupt transitions are not good foor feedback loop through supercombo model.
+  if (this->calib_spread.maxCoeff() > MAX_ALLOWED_SPREAD && this->cal_status == CALIBRATED) {
+    const Eigen::Vector3d last_block = this->rpys[(this->block_idx + INPUTS_WANTED - 1) % INPUTS_WANTED];
+    const Eigen::Vector3d smooth_from = this->rpy;
+    this->reset(last_block, INPUTS_NEEDED, &smooth_from);
+  }
+
+  bool write_this_cycle = (this->idx == 0) && (this->block_idx % (INPUTS_WANTED / 5) == 5);
+  if (this->params_writer && write_this_cycle) {
+    MessageBuilder msg;
+    this->fill_msg(msg.initEvent().initLiveCalibration());
+    auto bytes = msg.toBytes();
+    this->params_writer->put("CalibrationParams", std::string((const char *)bytes.begin(), bytes.size()));
+  }
+}
+
+Eigen::Vector3d Calibrator::get_smooth_rpy() const {
+  if (this->old_rpy_weight > 0) {
+    return this->old_rpy_weight * this->old_rpy + (1.0 - this->old_rpy_weight) * this->rpy;
+  }
+  return this->rpy;
+}
+
+bool Calibrator::handle_cam_odom(const float trans[3], const float rot[3], const float trans_std[3]) {
+  // as calibrationd.py, the weight of the old calibration is gone with the first sample
+  this->old_rpy_weight = std::min(0.0, this->old_rpy_weight - 1.0 / SMOOTH_CYCLES);
+
+  bool straight_and_fast = (this->v_ego > MIN_SPEED_FILTER) && (trans[0] > MIN_SPEED_FILTER) && (std::abs(rot[2]) < MAX_YAW_RATE_FILTER);
+  double angle_std_threshold = this->wide_camera ? 4 * MAX_VEL_ANGLE_STD : MAX_VEL_ANGLE_STD;
+  bool certain_if_calib = (std::atan2(trans_std[1], trans[0]) < angle_std_threshold) || (this->valid_blocks < INPUTS_NEEDED);
+  if (!(straight_and_fast && certain_if_calib)) {
+    return false;
+  }
+
+  Eigen::Vector3d observed_rpy(0, -std::atan2(trans[2], trans[0]), std::atan2(trans[1], trans[0]));
+  Eigen::Vector3d new_rpy = sanity_clip(rot2euler(euler2rot(this->get_smooth_rpy()) * euler2rot(observed_rpy)));
+
+  Eigen::Vector3d &block = this->rpys[this->block_idx];
+  const Eigen::Vector3d old_block = block;
+  block = (this->idx * block + (BLOCK_SIZE - this->idx) * new_rpy) / (double)BLOCK_SIZE;
+  if (this->block_idx < this->blocks()) {
+    this->rpys_sum += block - old_block;
+  }
+
+  this->idx = (this->idx + 1) % BLOCK_SIZE;
+  if (this->idx == 0) {
+    this->block_idx += 1;
+    this->valid_blocks = std::max(this->block_idx, this->valid_blocks);
+    this->block_idx = this->block_idx % INPUTS_WANTED;
+    this->update_blocks();
+  }
+  if (this->valid_blocks > 0) {
+    this->rpy = this->rpys_sum / this->blocks();
+  }
+
+  this->update_status();
+  return true;
+}
+
+void Calibrator::get_extrinsic_matrix(float extrinsic[4*3]) const {
+  // get_view_frame_from_road_frame(0, pitch, yaw, model_height)
+  const Eigen::Vector3d smooth_rpy = this->get_smooth_rpy();
+  Eigen::Matrix3d view_from_device;
+  view_from_device << 0, 1, 0,
+                      0, 0, 1,
+                      1, 0, 0;
+  Eigen::Matrix3d device_from_road = euler2rot({0., smooth_rpy[1], smooth_rpy[2]}) * Eigen::Vector3d(1., -1., -1.).asDiagonal();
+  Eigen::Matrix3d view_from_road = view_from_device * device_from_road;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      extrinsic[i * 4 + j] = view_from_road(i, j);
+    }
+  }
+  extrinsic[3] = 0;
+  extrinsic[7] = MODEL_HEIGHT;
+  extrinsic[11] = 0;
+}
+
+void Calibrator::fill_msg(cereal::LiveCalibrationData::Builder calib) const {
+  const Eigen::Vector3d smooth_rpy = this->get_smooth_rpy();
+  float extrinsic[4*3];
+  this->get_extrinsic_matrix(extrinsic);
+
+  calib.setValidBlocks(this->valid_blocks);
+  calib.setCalStatus(this->cal_status);
+  calib.setCalPerc(std::min(100 * (this->valid_blocks * BLOCK_SIZE + this->idx) / (INPUTS_NEEDED * BLOCK_SIZE), 100));
+  calib.setExtrinsicMatrix(extrinsic);
+  calib.setRpyCalib({(float)smooth_rpy[0], (float)smooth_rpy[1], (float)smooth_rpy[2]});
+  calib.setRpyCalibSpread({(float)this->calib_spread[0], (float)this->calib_spread[1], (float)this->calib_spread[2]});
+}
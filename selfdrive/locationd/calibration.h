@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <memory>
+
+#include <eigen3/Eigen/Dense>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/params.h"
+
+// calibrationd.py's Calibrator, for modeld to calibrate on its own posenet
+// outputs. The block averages are kept with their running sum and the spread
+// of the finished blocks, so a sample costs the same with any number of them
+// instead of a mean, max and min over the whole buffer.
+
+namespace calibration {
+
+const double MIN_SPEED_FILTER = 15 * 0.44704;  // 15 mph in m/s
+const double MAX_VEL_ANGLE_STD = 0.25 * M_PI / 180.0;
+const double MAX_YAW_RATE_FILTER = 2 * M_PI / 180.0;  // per second
+
+// This is at model frequency, blocks needed for efficiency
+const int SMOOTH_CYCLES = 400;
+const int BLOCK_SIZE = 100;
+const int INPUTS_NEEDED = 5;  // Minimum blocks needed for valid calibration
+const int INPUTS_WANTED = 50;  // We want a little bit more than we need for stability
+const double MAX_ALLOWED_SPREAD = 2 * M_PI / 180.0;
+
+// These values are needed to accommodate biggest modelframe
+const double PITCH_LIMITS[2] = {-0.09074112085129739, 0.14907572052989657};
+const double YAW_LIMITS[2] = {-0.06912048084718224, 0.06912048084718235};
+const double MODEL_HEIGHT = 1.22;
+
+enum Status {
+  UNCALIBRATED = 0,
+  CALIBRATED = 1,
+  INVALID = 2,
+};
+
+}  // namespace calibration
+
+class Calibrator {
+public:
+  // with param_put the calibration starts from CalibrationParams and is saved back to it
+  Calibrator(bool wide_camera, bool param_put = false);
+
+  void handle_v_ego(double v_ego) { this->v_ego = v_ego; }
+  // true when the sample went into the calibration
+  bool handle_cam_odom(const float trans[3], const float rot[3], const float trans_std[3]);
+
+  Eigen::Vector3d get_smooth_rpy() const;
+  // view_frame_from_road_frame of the smoothed calibration, row major 3x4
+  void get_extrinsic_matrix(float extrinsic[4*3]) const;
+  void fill_msg(cereal::LiveCalibrationData::Builder calib) const;
+
+private:
+  void reset(const Eigen::Vector3d &rpy_init, int valid_blocks = 0, const Eigen::Vector3d *smooth_from = nullptr);
+  void update_status();
+  // the sum and the spread of the blocks in use, from scratch. Done as a block finishes
+  void update_blocks();
+  int blocks() const { return std::min(this->valid_blocks, calibration::INPUTS_WANTED); }
+
+  // CalibrationParams is written off the caller's thread
+  std::unique_ptr<ParamsWriter> params_writer;
+  bool wide_camera;
+
+  Eigen::Vector3d rpy, old_rpy;
+  double old_rpy_weight;
+  int valid_blocks;
+  std::array<Eigen::Vector3d, calibration::INPUTS_WANTED> rpys;
+  int idx, block_idx;
+  double v_ego;
+
+  // over the blocks in use, the min and max leave the one being filled out
+  Eigen::Vector3d rpys_sum, rpys_min, rpys_max;
+  Eigen::Vector3d calib_spread;
+  calibration::Status cal_status;
+};
@@ -0,0 +1,292 @@
+#include "selfdrive/locationd/gnss.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "common/transformations/coordinates.hpp"
+
+namespace gnss {
+
+const double GM = 3.986005e14;  // WGS84 earth's gravitational constant, m^3/s^2
+const double OMEGA_E = 7.2921151467e-5;  // earth's rotation rate, rad/s
+const double REL_F = -4.442807633e-10;  // relativistic clock correction, s/m^0.5
+
+const double ELEVATION_MASK = DEG2RAD(5.0);
+const double MAX_EPHEMERIS_AGE = 4 * 3600.0;  // s
+const int MIN_SATS = 4;
+
+// seconds from ref to t within a gps week, across the week rollover
+static double week_diff(double t, double ref) {
+  double d = t - ref;
+  if (d > GPS_WEEK_SECONDS / 2) d -= GPS_WEEK_SECONDS;
+  if (d < -GPS_WEEK_SECONDS / 2) d += GPS_WEEK_SECONDS;
+  return d;
+}
+
+static Eigen::Vector3d sat_position(const Ephemeris &eph, double t, double *rel_correction) {
+  const double tk = week_diff(t, eph.toe);
+  const double n = std::sqrt(GM / (eph.a * eph.a * eph.a)) + eph.delta_n;
+  const double M = eph.m0 + n * tk;
+
+  double E = M;
+  for (int i = 0; i < 10; i++) {
+    const double dE = (M - E + eph.ecc * std::sin(E)) / (1.0 - eph.ecc * std::cos(E));
+    E += dE;
+    if (std::abs(dE) < 1e-12) break;
+  }
+  if (rel_correction) {
+    *rel_correction = REL_F * eph.ecc * std::sqrt(eph.a) * std::sin(E);
+  }
+
+  const double v = std::atan2(std::sqrt(1.0 - eph.ecc * eph.ecc) * std::sin(E), std::cos(E) - eph.ecc);
+  const double phi = v + eph.omega;
+  const double sin2phi = std::sin(2 * phi), cos2phi = std::cos(2 * phi);
+  const double u = phi + eph.cus * sin2phi + eph.cuc * cos2phi;
+  const double r = eph.a * (1.0 - eph.ecc * std::cos(E)) + eph.crs * sin2phi + eph.crc * cos2phi;
+  const double i = eph.i0 + eph.i_dot * tk + eph.cis * sin2phi + eph.cic * cos2phi;
+  const double Omega = eph.omega0 + (eph.omega_dot - OMEGA_E) * tk - OMEGA_E * eph.toe;
+
+  const double x = r * std::cos(u), y = r * std::sin(u);
+  return Eigen::Vector3d(x * std::cos(Omega) - y * std::cos(i) * std::sin(Omega),
+                         x * std::sin(Omega) + y * std::cos(i) * std::cos(Omega),
+                         y * std::sin(i));
+}
+
+SatState sat_state(const Ephemeris &eph, double t) {
+  SatState s;
+  double rel = 0;
+  s.pos = sat_position(eph, t, &rel);
+  // the orbit is smooth enough that a central difference is as good as the derivatives
+  s.vel = (sat_position(eph, t + 0.5, nullptr) - sat_position(eph, t - 0.5, nullptr));
+
+  const double dt = week_diff(t, eph.toc);
+  s.clock_bias = eph.af0 + eph.af1 * dt + eph.af2 * dt * dt + rel - eph.tgd;
+  s.clock_drift = eph.af1 + 2 * eph.af2 * dt;
+  return s;
+}
+
+double iono_delay(const double alpha[4], const double beta[4], double lat, double lon, double az, double el, double t) {
+  // IS-GPS-200 20.3.3.5.2.5, angles in semicircles
+  const double el_sc = el / M_PI;
+  const double psi = 0.0137 / (el_sc + 0.11) - 0.022;
+  const double phi_i = std::clamp(lat / M_PI + psi * std::cos(az), -0.416, 0.416);
+  const double lam_i = lon / M_PI + psi * std::sin(az) / std::cos(phi_i * M_PI);
+  const double phi_m = phi_i + 0.064 * std::cos((lam_i - 1.617) * M_PI);
+
+  double t_local = std::fmod(43200.0 * lam_i + t, 86400.0);
+  if (t_local < 0) t_local += 86400.0;
+
+  double amp = 0, per = 0;
+  for (int i = 3; i >= 0; i--) {
+    amp = amp * phi_m + alpha[i];
+    per = per * phi_m + beta[i];
+  }
+  amp = std::max(amp, 0.0);
+  per = std::max(per, 72000.0);
+
+  const double F = 1.0 + 16.0 * std::pow(0.53 - el_sc, 3);
+  const double x = 2 * M_PI * (t_local - 50400.0) / per;
+  double delay = 5e-9;
+  if (std::abs(x) < 1.57) {
+    delay += amp * (1.0 - x * x / 2.0 + x * x * x * x / 24.0);
+  }
+  return SPEED_OF_LIGHT * F * delay;
+}
+
+double tropo_delay(double el) {
+  // zenith delay of a standard atmosphere with a simple mapping function
+  return 2.47 / (std::sin(el) + 0.0121);
+}
+
+bool solve_position(const std::vector<Observation> &obs, const Eigen::Vector3d &x0, Eigen::Vector3d &pos,
+                    Eigen::Vector3d &pos_std, double &clock_bias) {
+  std::vector<const Observation *> used;
+  for (const Observation &o : obs) {
+    if (o.used) used.push_back(&o);
+  }
+  if (used.size() < MIN_SATS) return false;
+
+  Eigen::Vector4d x(x0.x(), x0.y(), x0.z(), 0.0);
+  Eigen::MatrixXd H(used.size(), 4);
+  Eigen::VectorXd r(used.size()), w(used.size());
+  Eigen::Matrix4d HtWH;
+  for (int iter = 0; iter < 10; iter++) {
+    for (int i = 0; i < used.size(); i++) {
+      const Eigen::Vector3d d = used[i]->sat.pos - x.head<3>();
+      const double range = d.norm();
+      H.row(i) << -(d / range).transpose(), 1.0;
+      r(i) = used[i]->pseudorange - (range + x(3));
+      w(i) = 1.0 / (used[i]->pseudorange_std * used[i]->pseudorange_std);
+    }
+    HtWH = H.transpose() * w.asDiagonal() * H;
+    const Eigen::Vector4d dx = HtWH.ldlt().solve(H.transpose() * w.asDiagonal() * r);
+    x += dx;
+    if (dx.head<3>().norm() < 1e-3) break;
+  }
+
+  // nowhere near the earth's surface, e.g. a bad measurement pulled it away
+  const double radius = x.head<3>().norm();
+  if (!std::isfinite(radius) || radius < 6.0e6 || radius > 7.0e6) return false;
+
+  pos = x.head<3>();
+  pos_std = HtWH.inverse().diagonal().head<3>().cwiseSqrt();
+  clock_bias = x(3);
+  return true;
+}
+
+bool solve_velocity(const std::vector<Observation> &obs, const Eigen::Vector3d &pos, Eigen::Vector3d &vel,
+                    Eigen::Vector3d &vel_std, double &clock_drift) {
+  std::vector<const Observation *> used;
+  for (const Observation &o : obs) {
+    if (o.used && std::isfinite(o.pseudorange_rate)) used.push_back(&o);
+  }
+  if (used.size() < MIN_SATS) return false;
+
+  // the rate is the satellite's velocity relative to ours along the line of sight, plus the clock drift
+  Eigen::MatrixXd H(used.size(), 4);
+  Eigen::VectorXd r(used.size()), w(used.size());
+  for (int i = 0; i < used.size(); i++) {
+    const Eigen::Vector3d los = (used[i]->sat.pos - pos).normalized();
+    H.row(i) << -los.transpose(), 1.0;
+    r(i) = used[i]->pseudorange_rate - los.dot(used[i]->sat.vel);
+    w(i) = 1.0 / (used[i]->pseudorange_rate_std * used[i]->pseudorange_rate_std);
+  }
+  const Eigen::Matrix4d HtWH = H.transpose() * w.asDiagonal() * H;
+  const Eigen::Vector4d x = HtWH.ldlt().solve(H.transpose() * w.asDiagonal() * r);
+  if (!x.allFinite()) return false;
+
+  vel = x.head<3>();
+  vel_std = HtWH.inverse().diagonal().head<3>().cwiseSqrt();
+  clock_drift = x(3);
+  return true;
+}
+
+void Processor::handle_ephemeris(const cereal::UbloxGnss::Ephemeris::Reader &eph) {
+  ephemerides[eph.getSvId()] = {
+    .sv_id = eph.getSvId(),
+    .toe = eph.getToe(), .toc = eph.getToc(),
+    .af0 = eph.getAf0(), .af1 = eph.getAf1(), .af2 = eph.getAf2(), .tgd = eph.getTgd(),
+    .a = eph.getA(), .ecc = eph.getEcc(), .m0 = eph.getM0(), .delta_n = eph.getDeltaN(),
+    .omega0 = eph.getOmega0(), .omega = eph.getOmega(), .omega_dot = eph.getOmegaDot(),
+    .i0 = eph.getI0(), .i_dot = eph.getIDot(),
+    .cuc = eph.getCuc(), .cus = eph.getCus(), .crc = eph.getCrc(), .crs = eph.getCrs(),
+    .cic = eph.getCic(), .cis = eph.getCis(),
+  };
+
+  // every satellite broadcasts the same model, the latest one wins
+  auto alpha = eph.getIonoAlpha(), beta = eph.getIonoBeta();
+  if (alpha.size() == 4 && beta.size() == 4) {
+    for (int i = 0; i < 4; i++) {
+      iono_alpha[i] = alpha[i];
+      iono_beta[i] = beta[i];
+    }
+    iono_valid = true;
+  }
+}
+
+// corrects the measurements of a report, with the atmospheric delays and an
+// elevation mask once the receiver's position is known
+static void correct(const cereal::UbloxGnss::MeasurementReport::Reader &report,
+                    const std::unordered_map<int, Ephemeris> &ephemerides, const Eigen::Vector3d *pos,
+                    const double *iono_alpha, const double *iono_beta, std::vector<Observation> &obs) {
+  const double tow = report.getRcvTow();
+  const double wavelength = SPEED_OF_LIGHT / GPS_L1_FREQ;
+
+  std::unique_ptr<LocalCoord> local;
+  Geodetic geodetic = {};
+  if (pos) {
+    geodetic = ecef2geodetic({pos->x(), pos->y(), pos->z()});
+    local = std::make_unique<LocalCoord>(geodetic);
+  }
+
+  obs.clear();
+  for (const auto &m : report.getMeasurements()) {
+    if (m.getGnssId() != 0 || !m.getTrackingStatus().getPseudorangeValid()) continue;
+    auto it = ephemerides.find(m.getSvId());
+    if (it == ephemerides.end() || std::abs(week_diff(tow, it->second.toe)) > MAX_EPHEMERIS_AGE) continue;
+
+    Observation o = {.sv_id = m.getSvId(), .elevation = NAN, .used = true};
+    const double pr = m.getPseudorange();
+    const double travel_time = pr / SPEED_OF_LIGHT;
+    o.sat = sat_state(it->second, tow - travel_time);
+    o.sat = sat_state(it->second, tow - travel_time - o.sat.clock_bias);
+
+    // the earth turns while the signal travels
+    const Eigen::Matrix3d sagnac = Eigen::AngleAxisd(-OMEGA_E * travel_time, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+    o.sat.pos = sagnac * o.sat.pos;
+    o.sat.vel = sagnac * o.sat.vel;
+
+    o.pseudorange = pr + SPEED_OF_LIGHT * o.sat.clock_bias;
+    o.pseudorange_std = m.getPseudorangeStdev() > 0 ? m.getPseudorangeStdev() : 10.0;
+    o.pseudorange_rate = -m.getDoppler() * wavelength + SPEED_OF_LIGHT * o.sat.clock_drift;
+    o.pseudorange_rate_std = m.getDopplerStdev() > 0 ? m.getDopplerStdev() * wavelength : 1.0;
+
+    if (local) {
+      const Eigen::Vector3d ned = local->ecef2ned_matrix * (o.sat.pos - *pos);
+      o.elevation = std::atan2(-ned.z(), ned.head<2>().norm());
+      const double azimuth = std::atan2(ned.y(), ned.x());
+      o.used = o.elevation > ELEVATION_MASK;
+      if (o.used) {
+        o.pseudorange -= tropo_delay(o.elevation);
+        if (iono_alpha) {
+          o.pseudorange -= iono_delay(iono_alpha, iono_beta, DEG2RAD(geodetic.lat), DEG2RAD(geodetic.lon),
+                                      azimuth, o.elevation, tow);
+        }
+      }
+    }
+    obs.push_back(o);
+  }
+}
+
+void Processor::handle_measurement_report(const cereal::UbloxGnss::MeasurementReport::Reader &report,
+                                          cereal::GnssMeasurements::Builder out) {
+  const double *alpha = iono_valid ? iono_alpha : nullptr;
+  const double *beta = iono_valid ? iono_beta : nullptr;
+
+  // without a position yet, a first fix from the uncorrected measurements gives one to correct them at
+  if (!have_position) {
+    correct(report, ephemerides, nullptr, alpha, beta, observations);
+    have_position = solve_position(observations, Eigen::Vector3d::Zero(), fix.pos, fix.pos_std, fix.clock_bias);
+  }
+  fix.pos_valid = fix.vel_valid = false;
+  if (have_position) {
+    const Eigen::Vector3d last_pos = fix.pos;
+    correct(report, ephemerides, &last_pos, alpha, beta, observations);
+    fix.pos_valid = solve_position(observations, last_pos, fix.pos, fix.pos_std, fix.clock_bias);
+    fix.vel_valid = fix.pos_valid && solve_velocity(observations, fix.pos, fix.vel, fix.vel_std, fix.clock_drift);
+    have_position = fix.pos_valid;
+  }
+
+  out.setGpsWeek(report.getGpsWeek());
+  out.setGpsTimeOfWeek(report.getRcvTow());
+
+  auto pos = out.initPositionECEF();
+  pos.setValue({fix.pos.x(), fix.pos.y(), fix.pos.z()});
+  pos.setStd({fix.pos_std.x(), fix.pos_std.y(), fix.pos_std.z()});
+  pos.setValid(fix.pos_valid);
+  auto vel = out.initVelocityECEF();
+  vel.setValue({fix.vel.x(), fix.vel.y(), fix.vel.z()});
+  vel.setStd({fix.vel_std.x(), fix.vel_std.y(), fix.vel_std.z()});
+  vel.setValid(fix.vel_valid);
+  out.setClockBias(fix.clock_bias);
+  out.setClockDrift(fix.clock_drift);
+
+  auto corrected = out.initCorrectedMeasurements(observations.size());
+  for (int i = 0; i < observations.size(); i++) {
+    const Observation &o = observations[i];
+    auto c = corrected[i];
+    c.setSvId(o.sv_id);
+    c.setPseudorange(o.pseudorange);
+    c.setPseudorangeStd(o.pseudorange_std);
+    c.setPseudorangeRate(o.pseudorange_rate);
+    c.setPseudorangeRateStd(o.pseudorange_rate_std);
+    c.setSatPos({o.sat.pos.x(), o.sat.pos.y(), o.sat.pos.z()});
+    c.setSatVel({o.sat.vel.x(), o.sat.vel.y(), o.sat.vel.z()});
+    c.setSatClockBias(o.sat.clock_bias);
+    c.setElevationDeg(RAD2DEG(o.elevation));
+    c.setUsed(o.used);
+  }
+}
+
+}  // namespace gnss
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <eigen3/Eigen/Dense>
+#include <unordered_map>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+
+// GPS positioning from the receiver's raw measurements, what laika does in
+// python: satellite states from the broadcast ephemerides, pseudorange and
+// doppler corrections, and weighted least squares fixes of position and clock,
+// and of velocity and clock drift. Only GPS, ubloxd decodes no other ephemerides
+
+namespace gnss {
+
+const double SPEED_OF_LIGHT = 2.99792458e8;  // m/s
+const double GPS_L1_FREQ = 1575.42e6;  // Hz
+const double GPS_WEEK_SECONDS = 604800.0;
+
+// a GPS broadcast ephemeris, as ubloxd publishes it
+struct Ephemeris {
+  int sv_id;
+  double toe, toc;  // s of the gps week
+  double af0, af1, af2, tgd;
+  double a, ecc, m0, delta_n, omega0, omega, omega_dot, i0, i_dot;
+  double cuc, cus, crc, crs, cic, cis;
+};
+
+struct SatState {
+  Eigen::Vector3d pos;  // ECEF at transmit time, m
+  Eigen::Vector3d vel;  // m/s
+  double clock_bias;  // s
+  double clock_drift;  // s/s
+};
+
+// the satellite at gps time of week t
+SatState sat_state(const Ephemeris &eph, double t);
+
+// Klobuchar ionospheric delay in m on L1, from the receiver at lat/lon (rad)
+// to a satellite at azimuth/elevation (rad) at gps time of week t
+double iono_delay(const double alpha[4], const double beta[4], double lat, double lon, double az, double el, double t);
+
+// tropospheric delay in m to a satellite at elevation el (rad)
+double tropo_delay(double el);
+
+struct Observation {
+  int sv_id;
+  double pseudorange, pseudorange_std;  // corrected, m
+  double pseudorange_rate, pseudorange_rate_std;  // corrected, m/s
+  SatState sat;  // rotated into the ECEF frame at receive time
+  double elevation;  // rad, NAN without a position
+  bool used;
+};
+
+struct Fix {
+  Eigen::Vector3d pos, pos_std;  // ECEF, m
+  Eigen::Vector3d vel, vel_std;  // ECEF, m/s
+  double clock_bias;  // m
+  double clock_drift;  // m/s
+  bool pos_valid;
+  bool vel_valid;
+};
+
+// position and clock bias from corrected pseudoranges, starting from x0
+bool solve_position(const std::vector<Observation> &obs, const Eigen::Vector3d &x0, Eigen::Vector3d &pos,
+                    Eigen::Vector3d &pos_std, double &clock_bias);
+
+// velocity and clock drift from corrected pseudorange rates seen at pos
+bool solve_velocity(const std::vector<Observation> &obs, const Eigen::Vector3d &pos, Eigen::Vector3d &vel,
+                    Eigen::Vector3d &vel_std, double &clock_drift);
+
+// Turns ubloxGnss into gnssMeasurements, keeping the ephemerides, the
+// ionospheric model and the last position between reports
+class Processor {
+public:
+  void handle_ephemeris(const cereal::UbloxGnss::Ephemeris::Reader &eph);
+  void handle_measurement_report(const cereal::UbloxGnss::MeasurementReport::Reader &report,
+                                 cereal::GnssMeasurements::Builder out);
+
+  // the corrected measurements and fix of the last report
+  std::vector<Observation> observations;
+  Fix fix = {};
+
+private:
+  std::unordered_map<int, Ephemeris> ephemerides;
+  double iono_alpha[4] = {}, iono_beta[4] = {};
+  bool iono_valid = false;
+  bool have_position = false;
+};
+
+}  // namespace gnss
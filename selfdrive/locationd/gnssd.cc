@@ -0,0 +1,51 @@
+#include <cassert>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/locationd/gnss.h"
+
+ExitHandler do_exit;
+
+int main() {
+  LOGW("starting gnssd");
+  AlignedBuffer aligned_buf;
+  gnss::Processor processor;
+
+  PubMaster pm({"gnssMeasurements"});
+
+  Context * context = Context::create();
+  SubSocket * subscriber = SubSocket::create(context, "ubloxGnss");
+  assert(subscriber != NULL);
+  subscriber->setTimeout(100);
+
+  while (!do_exit) {
+    Message * msg = subscriber->receive();
+    if (!msg) {
+      if (errno == EINTR) {
+        do_exit = true;
+      }
+      continue;
+    }
+
+    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg));
+    auto ublox_gnss = cmsg.getRoot<cereal::Event>().getUbloxGnss();
+
+    if (ublox_gnss.isEphemeris()) {
+      processor.handle_ephemeris(ublox_gnss.getEphemeris());
+    } else if (ublox_gnss.isMeasurementReport()) {
+      PooledMessageBuilder msg_builder("gnssMeasurements");
+      auto event = msg_builder.initEvent();
+      processor.handle_measurement_report(ublox_gnss.getMeasurementReport(), event.initGnssMeasurements());
+      event.setValid(processor.fix.pos_valid);
+      pm.send("gnssMeasurements", msg_builder);
+    }
+
+    delete msg;
+  }
+
+  delete subscriber;
+  delete context;
+
+  return 0;
+}
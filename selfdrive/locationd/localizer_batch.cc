@@ -0,0 +1,82 @@
+#include "selfdrive/locationd/localizer_batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "selfdrive/locationd/locationd.h"
+#include "selfdrive/loggerd/log_reader.h"
+
+static LocalizerFix get_fix(Localizer &localizer, uint64_t log_mono_time) {
+  MessageBuilder msg;
+  localizer.build_message(msg, log_mono_time, true, true, true);
+  auto lk = msg.getRoot<cereal::Event>().asReader().getLiveLocationKalman();
+
+  LocalizerFix fix = {.log_mono_time = log_mono_time, .valid = lk.getStatus() == cereal::LiveLocationKalman::Status::VALID};
+  for (int i = 0; i < 3; i++) {
+    fix.position_geodetic[i] = lk.getPositionGeodetic().getValue()[i];
+    fix.position_ecef_std[i] = lk.getPositionECEF().getStd()[i];
+    fix.velocity_ned[i] = lk.getVelocityNED().getValue()[i];
+    fix.orientation_ned[i] = lk.getOrientationNED().getValue()[i];
+  }
+  return fix;
+}
+
+std::vector<LocalizerFix> localize_route(const std::vector<std::string> &logs) {
+  Localizer localizer;
+  std::vector<LocalizerFix> fixes;
+
+  for (const std::string &path : logs) {
+    std::vector<uint8_t> data = log_read_all(path);
+    kj::Array<capnp::word> words = kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+    memcpy(words.begin(), data.data(), words.size() * sizeof(capnp::word));
+
+    kj::ArrayPtr<const capnp::word> rest = words;
+    try {
+      while (rest.size() > 0) {
+        capnp::FlatArrayMessageReader msg(rest);
+        cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+        switch (event.which()) {
+          case cereal::Event::SENSOR_EVENTS:
+          case cereal::Event::GPS_LOCATION_EXTERNAL:
+          case cereal::Event::LIVE_CALIBRATION:
+          case cereal::Event::CAR_STATE:
+            if (event.getValid()) localizer.handle_msg(event);
+            break;
+          case cereal::Event::CAMERA_ODOMETRY:
+            if (event.getValid()) localizer.handle_msg(event);
+            fixes.push_back(get_fix(localizer, event.getLogMonoTime()));
+            break;
+          default:
+            break;
+        }
+        rest = kj::arrayPtr(msg.getEnd(), rest.end());
+      }
+    } catch (const kj::Exception &e) {
+      // the rest of a broken log is lost, carry on with the next segment
+    }
+  }
+  return fixes;
+}
+
+std::vector<std::vector<LocalizerFix>> localize_routes(const std::vector<std::vector<std::string>> &routes,
+                                                       int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min<int>(num_threads, routes.size());
+
+  std::vector<std::vector<LocalizerFix>> trajectories(routes.size());
+  std::atomic<size_t> next_route{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&]() {
+      for (size_t r = next_route++; r < routes.size(); r = next_route++) {
+        trajectories[r] = localize_route(routes[r]);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  return trajectories;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Offline localization of logged routes, e.g. for map building. Every route
+// gets its own Localizer, so routes run in parallel without sharing state and
+// without params or messaging.
+
+struct LocalizerFix {
+  uint64_t log_mono_time;  // of the cameraOdometry it follows
+  double position_geodetic[3];  // deg, deg, m
+  double position_ecef_std[3];  // m
+  double velocity_ned[3];  // m/s
+  double orientation_ned[3];  // rad
+  bool valid;  // liveLocationKalman status
+};
+
+// the trajectory of a route, one fix per cameraOdometry, from its rlogs in order
+std::vector<LocalizerFix> localize_route(const std::vector<std::string> &logs);
+
+// the trajectories of the routes, run on num_threads threads (all cores when 0)
+// that each take the next route as they finish one
+std::vector<std::vector<LocalizerFix>> localize_routes(const std::vector<std::vector<std::string>> &routes,
+                                                       int num_threads = 0);
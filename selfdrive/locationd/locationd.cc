@@ -1,6 +1,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include <algorithm>
 #include <cmath>
 
 #include "locationd.h"
@@ -8,7 +9,6 @@
 using namespace EKFS;
 using namespace Eigen;
 
-ExitHandler do_exit;
 const double ACCEL_SANITY_CHECK = 100.0;  // m/s^2
 const double ROTATION_SANITY_CHECK = 10.0;  // rad/s
 const double TRANS_SANITY_CHECK = 200.0;  // m/s
@@ -18,6 +18,7 @@ const double MIN_STD_SANITY_CHECK = 1e-5; // m or rad
 const double VALID_TIME_SINCE_RESET = 1.0; // s
 const double VALID_POS_STD = 50.0; // m
 const double MAX_RESET_TRACKER = 5.0;
+const double IMU_BATCH_WINDOW = 0.01; // s
 
 static VectorXd floatlist2vector(const capnp::List<float, capnp::Kind::PRIMITIVE>::Reader& floatlist) {
   VectorXd res(floatlist.size());
@@ -202,7 +203,7 @@ void Localizer::handle_sensors(double current_time, const capnp::List<cereal::Se
     // sensor time and log time should be close
     if (std::abs(current_time - sensor_time) > 0.1) {
       LOGE("Sensor reading ignored, sensor timestamp more than 100ms off from log time");
-      return;
+      break;
     }
 
       // TODO: handle messages from two IMUs at the same time
@@ -215,7 +216,7 @@ void Localizer::handle_sensors(double current_time, const capnp::List<cereal::Se
       auto v = sensor_reading.getGyroUncalibrated().getV();
       auto meas = Vector3d(-v[2], -v[1], -v[0]);
       if (meas.norm() < ROTATION_SANITY_CHECK) {
-        this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_GYRO, { meas });
+        this->imu_samples.push_back({ sensor_time, OBSERVATION_PHONE_GYRO, meas });
       }
     }
 
@@ -229,10 +230,32 @@ void Localizer::handle_sensors(double current_time, const capnp::List<cereal::Se
 
       auto meas = Vector3d(-v[2], -v[1], -v[0]);
       if (meas.norm() < ACCEL_SANITY_CHECK) {
-        this->kf->predict_and_observe(sensor_time, OBSERVATION_PHONE_ACCEL, { meas });
+        this->imu_samples.push_back({ sensor_time, OBSERVATION_PHONE_ACCEL, meas });
       }
     }
   }
+
+  this->observe_imu_samples();
+}
+
+void Localizer::observe_imu_samples() {
+  std::stable_sort(this->imu_samples.begin(), this->imu_samples.end(),
+                   [](const ImuSample& a, const ImuSample& b) { return a.t < b.t; });
+
+  // consecutive samples of one kind within IMU_BATCH_WINDOW go in one update at the time of the last
+  for (int start = 0; start < this->imu_samples.size();) {
+    const ImuSample& first = this->imu_samples[start];
+    int end = start;
+    this->imu_batch.clear();
+    while (end < this->imu_samples.size() && this->imu_samples[end].kind == first.kind &&
+           this->imu_samples[end].t - first.t <= IMU_BATCH_WINDOW) {
+      this->imu_batch.push_back(this->imu_samples[end].meas);
+      end++;
+    }
+    this->kf->predict_and_observe(this->imu_samples[end - 1].t, first.kind, this->imu_batch);
+    start = end;
+  }
+  this->imu_samples.clear();
 }
 
 void Localizer::handle_gps(double current_time, const cereal::GpsLocationData::Reader& log) {
@@ -421,9 +444,7 @@ void Localizer::handle_msg(const cereal::Event::Reader& log) {
   this->update_reset_tracker();
 }
 
-kj::ArrayPtr<capnp::byte> Localizer::get_message_bytes(MessageBuilder& msg_builder, uint64_t logMonoTime,
-  bool inputsOK, bool sensorsOK, bool gpsOK)
-{
+void Localizer::build_message(MessageBuilder& msg_builder, uint64_t logMonoTime, bool inputsOK, bool sensorsOK, bool gpsOK) {
   cereal::Event::Builder evt = msg_builder.initEvent();
   evt.setLogMonoTime(logMonoTime);
   cereal::LiveLocationKalman::Builder liveLoc = evt.initLiveLocationKalman();
@@ -431,6 +452,12 @@ kj::ArrayPtr<capnp::byte> Localizer::get_message_bytes(MessageBuilder& msg_build
   liveLoc.setInputsOK(inputsOK);
   liveLoc.setSensorsOK(sensorsOK);
   liveLoc.setGpsOK(gpsOK);
+}
+
+kj::ArrayPtr<capnp::byte> Localizer::get_message_bytes(MessageBuilder& msg_builder, uint64_t logMonoTime,
+  bool inputsOK, bool sensorsOK, bool gpsOK)
+{
+  this->build_message(msg_builder, logMonoTime, inputsOK, sensorsOK, gpsOK);
   return msg_builder.toBytes();
 }
 
@@ -439,43 +466,46 @@ bool Localizer::isGpsOK() {
   return this->kf->get_filter_time() - this->last_gps_fix < 1.0;
 }
 
+// the daemon's loop and main are left out when the Localizer is linked as a library,
+// which has no global state then
+#ifndef LOCATIOND_NO_MAIN
+ExitHandler do_exit;
+
 int Localizer::locationd_thread() {
   const std::initializer_list<const char *> service_list =
       { "gpsLocationExternal", "sensorEvents", "cameraOdometry", "liveCalibration", "carState" };
   PubMaster pm({ "liveLocationKalman" });
   SubMaster sm(service_list, nullptr, { "gpsLocationExternal" });
 
-  Params params;
+  // LastGPSPosition is written from a background thread, so the loop never waits on the filesystem
+  ParamsWriter params_writer;
 
-  while (!do_exit) {
-    sm.update();
-    for (const char* service : service_list) {
-      if (sm.updated(service) && sm.valid(service)) {
-        const cereal::Event::Reader log = sm[service];
-        this->handle_msg(log);
-      }
-    }
-
-    if (sm.updated("cameraOdometry")) {
-      uint64_t logMonoTime = sm["cameraOdometry"].getLogMonoTime();
-      bool inputsOK = sm.allAliveAndValid();
-      bool sensorsOK = sm.alive("sensorEvents") && sm.valid("sensorEvents");
-      bool gpsOK = this->isGpsOK();
+  // messages are handled as the poller hands them over, liveLocationKalman goes out right after cameraOdometry
+  for (const char* service : service_list) {
+    sm.set_callback(service, [this](const cereal::Event::Reader &log) {
+      if (log.getValid()) this->handle_msg(log);
+    });
+  }
+  sm.set_callback("cameraOdometry", [&](const cereal::Event::Reader &log) {
+    if (log.getValid()) this->handle_msg(log);
 
-      MessageBuilder msg_builder;
-      kj::ArrayPtr<capnp::byte> bytes = this->get_message_bytes(msg_builder, logMonoTime, inputsOK, sensorsOK, gpsOK);
-      pm.send("liveLocationKalman", bytes.begin(), bytes.size());
+    bool inputsOK = sm.allAliveAndValid();
+    bool sensorsOK = sm.alive("sensorEvents") && sm.valid("sensorEvents");
+    bool gpsOK = this->isGpsOK();
 
-      if (sm.frame % 1200 == 0 && gpsOK) {  // once a minute
-        VectorXd posGeo = this->get_position_geodetic();
-        std::string lastGPSPosJSON = util::string_format(
-          "{\"latitude\": %.15f, \"longitude\": %.15f, \"altitude\": %.15f}", posGeo(0), posGeo(1), posGeo(2));
+    RingMessageBuilder msg_builder(pm, "liveLocationKalman", LIVE_LOCATION_MSG_SIZE);
+    this->build_message(msg_builder, log.getLogMonoTime(), inputsOK, sensorsOK, gpsOK);
+    msg_builder.send();
 
-        std::thread([&params] (const std::string gpsjson) {
-          params.put("LastGPSPosition", gpsjson);
-        }, lastGPSPosJSON).detach();
-      }
+    if (sm.frame % 1200 == 0 && gpsOK) {  // once a minute
+      VectorXd posGeo = this->get_position_geodetic();
+      params_writer.put("LastGPSPosition", util::string_format(
+        "{\"latitude\": %.15f, \"longitude\": %.15f, \"altitude\": %.15f}", posGeo(0), posGeo(1), posGeo(2)));
     }
+  });
+
+  while (!do_exit) {
+    sm.update();
   }
   return 0;
 }
@@ -486,3 +516,4 @@ int main() {
   Localizer localizer;
   return localizer.locationd_thread();
 }
+#endif
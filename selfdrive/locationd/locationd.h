@@ -19,6 +19,13 @@
 #include "selfdrive/locationd/models/live_kf.h"
 
 #define POSENET_STD_HIST_HALF 20
+#define LIVE_LOCATION_MSG_SIZE 4096
+
+struct ImuSample {
+  double t;
+  int kind;
+  Eigen::Vector3d meas;
+};
 
 class Localizer {
 public:
@@ -33,6 +40,7 @@ public:
   void update_reset_tracker();
   bool isGpsOK();
 
+  void build_message(MessageBuilder& msg_builder, uint64_t logMonoTime, bool inputsOK, bool sensorsOK, bool gpsOK);
   kj::ArrayPtr<capnp::byte> get_message_bytes(MessageBuilder& msg_builder, uint64_t logMonoTime,
     bool inputsOK, bool sensorsOK, bool gpsOK);
   void build_live_location(cereal::LiveLocationKalman::Builder& fix);
@@ -42,6 +50,7 @@ public:
   void handle_msg_bytes(const char *data, const size_t size);
   void handle_msg(const cereal::Event::Reader& log);
   void handle_sensors(double current_time, const capnp::List<cereal::SensorEventData, capnp::Kind::STRUCT>::Reader& log);
+  void observe_imu_samples();
   void handle_gps(double current_time, const cereal::GpsLocationData::Reader& log);
   void handle_car_state(double current_time, const cereal::CarState::Reader& log);
   void handle_cam_odo(double current_time, const cereal::CameraOdometry::Reader& log);
@@ -65,4 +74,8 @@ private:
   double last_gps_fix = 0;
   double reset_tracker = 0.0;
   bool device_fell = false;
+
+  // reused across sensorEvents
+  std::vector<ImuSample> imu_samples;
+  std::vector<Eigen::VectorXd> imu_batch;
 };
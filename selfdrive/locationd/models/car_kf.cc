@@ -0,0 +1,34 @@
+#include "car_kf.h"
+
+using namespace EKFS;
+using namespace Eigen;
+
+CarKalman::CarKalman(const cereal::CarParams::Reader &CP, double steer_ratio, double stiffness_factor, double angle_offset) {
+  CarEKF::StateVec x_init = car_initial_x;
+  x_init(CAR_STATE_STEER_RATIO_START) = steer_ratio;
+  x_init(CAR_STATE_STIFFNESS_START) = stiffness_factor;
+  x_init(CAR_STATE_ANGLE_OFFSET_START) = angle_offset;
+
+  // init filter
+  CarEKF::CovMat Q = car_Q_diag.asDiagonal();
+  CarEKF::CovMat P_initial = car_initial_P_diag.asDiagonal();
+  this->filter = std::make_unique<CarEKF>(this->name, Q, x_init, P_initial);
+
+  this->filter->set_global("mass", CP.getMass());
+  this->filter->set_global("rotational_inertia", CP.getRotationalInertia());
+  this->filter->set_global("center_to_front", CP.getCenterToFront());
+  this->filter->set_global("center_to_rear", CP.getWheelbase() - CP.getCenterToFront());
+  this->filter->set_global("stiffness_front", CP.getTireStiffnessFront());
+  this->filter->set_global("stiffness_rear", CP.getTireStiffnessRear());
+}
+
+bool CarKalman::predict_and_observe(double t, int kind, double z) {
+  return this->predict_and_observe(t, kind, z, car_obs_noise.at(kind));
+}
+
+bool CarKalman::predict_and_observe(double t, int kind, double z, double R) {
+  Matrix<double, 1, 1> zm, Rm;
+  zm << z;
+  Rm << R;
+  return this->filter->predict_and_update(t, kind, zm, Rm);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Dense>
+
+#include "cereal/gen/cpp/car.capnp.h"
+#include "generated/car_kf_constants.h"
+#include "rednose/helpers/ekf_sym.h"
+#include "rednose/helpers/ekf_sym_fixed.h"
+
+using namespace EKFS;
+
+typedef EKFSymFixed<CAR_DIM_STATE, CAR_DIM_STATE_ERR> CarEKF;
+
+// car_kf.py: the vehicle model of the car, learning its steer ratio, tire
+// stiffness and steering angle offsets. All its observations are scalars
+class CarKalman {
+public:
+  CarKalman(const cereal::CarParams::Reader &CP, double steer_ratio = 15.0, double stiffness_factor = 1.0,
+            double angle_offset = 0.0);
+
+  const CarEKF::StateVec &get_x() const { return this->filter->state(); }
+  const CarEKF::CovMat &get_P() const { return this->filter->covs(); }
+  double get_filter_time() const { return this->filter->get_filter_time(); }
+  void set_filter_time(double t) { this->filter->set_filter_time(t); }
+  void reset_rewind() { this->filter->reset_rewind(); }
+
+  // with the kind's observation noise, or a variance of R
+  bool predict_and_observe(double t, int kind, double z);
+  bool predict_and_observe(double t, int kind, double z, double R);
+
+private:
+  std::string name = "car";
+
+  std::unique_ptr<CarEKF> filter;
+};
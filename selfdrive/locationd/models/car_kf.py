@@ -11,8 +11,11 @@ from selfdrive.swaglog import cloudlog
 from rednose.helpers.kalmanfilter import KalmanFilter
 
 if __name__ == '__main__':  # Generating sympy
+  import inspect
+  import os
   import sympy as sp
   from rednose.helpers.ekf_sym import gen_code
+  from selfdrive.locationd.models.live_kf import numpy2eigenstring
 else:
   from rednose.helpers.ekf_sym_pyx import EKF_sym  # pylint: disable=no-name-in-module, import-error
 
@@ -149,6 +152,32 @@ class CarKalman(KalmanFilter):
 
     gen_code(generated_dir, name, f_sym, dt, state_sym, obs_eqs, dim_state, dim_state, global_vars=global_vars)
 
+    # write constants to extra header file for use in cpp
+    car_kf_header = "#pragma once\n\n"
+    car_kf_header += "#include <unordered_map>\n"
+    car_kf_header += "#include <eigen3/Eigen/Dense>\n\n"
+    car_kf_header += f'#define CAR_DIM_STATE {dim_state}\n'
+    car_kf_header += f'#define CAR_DIM_STATE_ERR {dim_state}\n\n'
+    for state, slc in inspect.getmembers(States, lambda x: type(x) == slice):
+      assert(slc.step is None)  # unsupported
+      car_kf_header += f'#define CAR_STATE_{state}_START {slc.start}\n'
+      car_kf_header += f'#define CAR_STATE_{state}_LEN {slc.stop - slc.start}\n'
+    car_kf_header += "\n"
+
+    for kind, val in inspect.getmembers(ObservationKind, lambda x: type(x) == int):
+      car_kf_header += f'#define OBSERVATION_{kind} {val}\n'
+    car_kf_header += "\n"
+
+    car_kf_header += f"static const Eigen::VectorXd car_initial_x = {numpy2eigenstring(CarKalman.initial_x)};\n"
+    car_kf_header += f"static const Eigen::VectorXd car_initial_P_diag = {numpy2eigenstring(np.diag(CarKalman.P_initial))};\n"
+    car_kf_header += f"static const Eigen::VectorXd car_Q_diag = {numpy2eigenstring(np.diag(CarKalman.Q))};\n"
+    car_kf_header += "static const std::unordered_map<int, double> car_obs_noise = {\n"
+    for kind, noise in CarKalman.obs_noise.items():
+      car_kf_header += f"  {{ {kind}, {noise[0, 0]:.20g} }},\n"
+    car_kf_header += "};\n\n"
+
+    open(os.path.join(generated_dir, "car_kf_constants.h"), 'w').write(car_kf_header)
+
   def __init__(self, generated_dir, steer_ratio=15, stiffness_factor=1, angle_offset=0):  # pylint: disable=super-init-not-called
     dim_state = self.initial_x.shape[0]
     dim_state_err = self.P_initial.shape[0]
@@ -28,34 +28,32 @@ std::vector<Eigen::Map<MatrixXdr>> get_vec_mapmat(std::vector<MatrixXdr>& mat_ve
 }
 
 LiveKalman::LiveKalman() {
-  this->dim_state = 23;
-  this->dim_state_err = 22;
+  this->dim_state = LIVE_DIM_STATE;
+  this->dim_state_err = LIVE_DIM_STATE_ERR;
 
   this->initial_x = live_initial_x;
   this->initial_P = live_initial_P_diag.asDiagonal();
-  this->Q = live_Q_diag.asDiagonal();
   for (auto& pair : live_obs_noise_diag) {
     this->obs_noise[pair.first] = pair.second.asDiagonal();
   }
 
   // init filter
-  this->filter = std::make_shared<EKFSym>(this->name, get_mapmat(this->Q), get_mapvec(this->initial_x),
-    get_mapmat(initial_P),  this->dim_state, this->dim_state_err, 0, 0, 0, std::vector<int>(),
-    std::vector<int>{3}, std::vector<std::string>(), 0.2);
+  LiveEKF::CovMat Q = live_Q_diag.asDiagonal();
+  this->filter = std::make_unique<LiveEKF>(this->name, Q, this->initial_x, this->initial_P, std::vector<int>{3}, 0.2);
 }
 
 void LiveKalman::init_state(VectorXd& state, VectorXd& covs_diag, double filter_time) {
-  MatrixXdr covs = covs_diag.asDiagonal();
-  this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  LiveEKF::CovMat covs = covs_diag.asDiagonal();
+  this->filter->init_state(state, covs, filter_time);
 }
 
 void LiveKalman::init_state(VectorXd& state, MatrixXdr& covs, double filter_time) {
-  this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  this->filter->init_state(state, covs, filter_time);
 }
 
 void LiveKalman::init_state(VectorXd& state, double filter_time) {
-  MatrixXdr covs = this->filter->covs();
-  this->filter->init_state(get_mapvec(state), get_mapmat(covs), filter_time);
+  LiveEKF::CovMat covs = this->filter->covs();
+  this->filter->init_state(state, covs, filter_time);
 }
 
 VectorXd LiveKalman::get_x() {
@@ -78,54 +76,64 @@ std::vector<MatrixXdr> LiveKalman::get_R(int kind, int n) {
   return R;
 }
 
-std::optional<Estimate> LiveKalman::predict_and_observe(double t, int kind, std::vector<VectorXd> meas, std::vector<MatrixXdr> R) {
-  std::optional<Estimate> r;
+bool LiveKalman::predict_and_observe(double t, int kind, const std::vector<VectorXd>& meas, const std::vector<MatrixXdr>& R) {
   switch (kind) {
   case OBSERVATION_CAMERA_ODO_TRANSLATION:
-    r = this->predict_and_update_odo_trans(meas, t, kind);
-    break;
+    return this->predict_and_update_odo_trans(meas, t, kind);
   case OBSERVATION_CAMERA_ODO_ROTATION:
-    r = this->predict_and_update_odo_rot(meas, t, kind);
-    break;
+    return this->predict_and_update_odo_rot(meas, t, kind);
   case OBSERVATION_ODOMETRIC_SPEED:
-    r = this->predict_and_update_odo_speed(meas, t, kind);
-    break;
+    return this->predict_and_update_odo_speed(meas, t, kind);
   default:
-    if (R.size() == 0) {
-      R = this->get_R(kind, meas.size());
-    }
-    r = this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(meas), get_vec_mapmat(R));
     break;
   }
-  return r;
+
+  // stack the measurements into batches, each applied after a single predict
+  bool ok = true;
+  LiveEKF::BatchVec z;
+  LiveEKF::BatchMat Rs;
+  for (int start = 0; start < meas.size(); start += LiveEKF::max_batch) {
+    int n = std::min((int)meas.size() - start, LiveEKF::max_batch);
+    int dim_z = meas[start].size();
+    z.resize(n * dim_z);
+    Rs.resize(n * dim_z, dim_z);
+    for (int i = 0; i < n; i++) {
+      z.segment(i * dim_z, dim_z) = meas[start + i];
+      Rs.middleRows(i * dim_z, dim_z) = R.size() == 0 ? this->obs_noise.at(kind) : R[start + i];
+    }
+    ok &= this->filter->predict_and_update_batch(t, kind, z, Rs);
+  }
+  return ok;
 }
 
-std::optional<Estimate> LiveKalman::predict_and_update_odo_speed(std::vector<VectorXd> speed, double t, int kind) {
-  std::vector<MatrixXdr> R;
-  R.assign(speed.size(), (MatrixXdr(1, 1) << std::pow(0.2, 2)).finished().asDiagonal());
-  return this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(speed), get_vec_mapmat(R));
+bool LiveKalman::predict_and_update_odo_speed(const std::vector<VectorXd>& speed, double t, int kind) {
+  Matrix<double, 1, 1> R;
+  R << std::pow(0.2, 2);
+  bool ok = true;
+  for (const VectorXd& spd : speed) {
+    ok &= this->filter->predict_and_update(t, kind, spd, R);
+  }
+  return ok;
 }
 
-std::optional<Estimate> LiveKalman::predict_and_update_odo_trans(std::vector<VectorXd> trans, double t, int kind) {
-  std::vector<VectorXd> z;
-  std::vector<MatrixXdr> R;
-  for (VectorXd& trns : trans) {
+bool LiveKalman::predict_and_update_odo_trans(const std::vector<VectorXd>& trans, double t, int kind) {
+  bool ok = true;
+  for (const VectorXd& trns : trans) {
     assert(trns.size() == 6); // TODO remove
-    z.push_back(trns.head(3));
-    R.push_back(trns.segment<3>(3).array().square().matrix().asDiagonal());
+    Matrix<double, 3, 3, Eigen::RowMajor> R = trns.segment<3>(3).array().square().matrix().asDiagonal();
+    ok &= this->filter->predict_and_update(t, kind, trns.head(3), R);
   }
-  return this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(z), get_vec_mapmat(R));
+  return ok;
 }
 
-std::optional<Estimate> LiveKalman::predict_and_update_odo_rot(std::vector<VectorXd> rot, double t, int kind) {
-  std::vector<VectorXd> z;
-  std::vector<MatrixXdr> R;
-  for (VectorXd& rt : rot) {
+bool LiveKalman::predict_and_update_odo_rot(const std::vector<VectorXd>& rot, double t, int kind) {
+  bool ok = true;
+  for (const VectorXd& rt : rot) {
     assert(rt.size() == 6); // TODO remove
-    z.push_back(rt.head(3));
-    R.push_back(rt.segment<3>(3).array().square().matrix().asDiagonal());
+    Matrix<double, 3, 3, Eigen::RowMajor> R = rt.segment<3>(3).array().square().matrix().asDiagonal();
+    ok &= this->filter->predict_and_update(t, kind, rt.head(3), R);
   }
-  return this->filter->predict_and_update_batch(t, kind, get_vec_mapvec(z), get_vec_mapmat(R));
+  return ok;
 }
 
 Eigen::VectorXd LiveKalman::get_initial_x() {
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+
+#include "json11.hpp"
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/params.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/locationd/models/car_kf.h"
+
+// paramsd.py on the generated car_kf filter directly, learning the steer
+// ratio, tire stiffness and angle offsets. PY_PARAMSD=1 makes the manager run
+// paramsd.py instead.
+
+const double DT_MDL = 0.05;
+const double MAX_ANGLE_OFFSET_DELTA = 20 * DT_MDL;  // Max 20 deg/s
+
+class ParamsLearner {
+public:
+  ParamsLearner(const cereal::CarParams::Reader &CP, double steer_ratio, double stiffness_factor, double angle_offset)
+    : kf(CP, steer_ratio, stiffness_factor, angle_offset) {}
+
+  void handle_log(double t, const cereal::Event::Reader &log);
+
+  CarKalman kf;
+  bool active = false;
+
+private:
+  double speed = 0;
+  bool steering_pressed = false;
+  double steering_angle = 0;
+};
+
+void ParamsLearner::handle_log(double t, const cereal::Event::Reader &log) {
+  if (log.isLiveLocationKalman()) {
+    auto msg = log.getLiveLocationKalman();
+    auto yaw_rate_calib = msg.getAngularVelocityCalibrated();
+    double yaw_rate = yaw_rate_calib.getValue()[2];
+    double yaw_rate_std = yaw_rate_calib.getStd()[2];
+
+    bool yaw_rate_valid = yaw_rate_calib.getValid();
+    yaw_rate_valid = yaw_rate_valid && 0 < yaw_rate_std && yaw_rate_std < 10;  // rad/s
+    yaw_rate_valid = yaw_rate_valid && std::abs(yaw_rate) < 1;  // rad/s
+
+    if (this->active) {
+      if (msg.getInputsOK() && msg.getPosenetOK() && yaw_rate_valid) {
+        this->kf.predict_and_observe(t, OBSERVATION_ROAD_FRAME_YAW_RATE, -yaw_rate, std::pow(yaw_rate_std, 2));
+      }
+      this->kf.predict_and_observe(t, OBSERVATION_ANGLE_OFFSET_FAST, 0.0);
+    }
+  } else if (log.isCarState()) {
+    auto msg = log.getCarState();
+    this->steering_angle = msg.getSteeringAngleDeg();
+    this->steering_pressed = msg.getSteeringPressed();
+    this->speed = msg.getVEgo();
+
+    bool in_linear_region = std::abs(this->steering_angle) < 45 || !this->steering_pressed;
+    this->active = this->speed > 5 && in_linear_region;
+
+    if (this->active) {
+      this->kf.predict_and_observe(t, OBSERVATION_STEER_ANGLE, this->steering_angle * M_PI / 180.0);
+      this->kf.predict_and_observe(t, OBSERVATION_ROAD_FRAME_X_SPEED, this->speed);
+    }
+  }
+
+  if (!this->active) {
+    // Reset time when stopped so uncertainty doesn't grow
+    this->kf.set_filter_time(t);
+    this->kf.reset_rewind();
+  }
+}
+
+ExitHandler do_exit;
+
+int main() {
+  set_realtime_priority(5);
+
+  Params params_reader;
+  // wait for stats about the car to come in from controls
+  LOG("paramsd is waiting for CarParams");
+  std::string car_params_str = params_reader.get("CarParams", true);
+  AlignedBuffer aligned_buf;
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.align(car_params_str.data(), car_params_str.size()));
+  cereal::CarParams::Reader CP = cmsg.getRoot<cereal::CarParams>();
+  LOG("paramsd got CarParams");
+
+  const double min_sr = 0.5 * CP.getSteerRatio(), max_sr = 2.0 * CP.getSteerRatio();
+  const std::string car_fingerprint = CP.getCarFingerprint().cStr();
+
+  std::string err;
+  json11::Json params;
+  if (!params_reader.getBool("dp_reset_live_param_on_start")) {
+    params = json11::Json::parse(params_reader.get("LiveParameters"), err);
+  }
+
+  // Check if car model matches
+  if (params.is_object() && params["carFingerprint"].string_value() != car_fingerprint) {
+    LOG("Parameter learner found parameters for wrong car.");
+    params = nullptr;
+  }
+
+  // Check if starting values are sane
+  if (params.is_object()) {
+    const json11::Json &angle_offset = params["angleOffsetAverageDeg"], &steer_ratio = params["steerRatio"];
+    bool params_sane = angle_offset.is_number() && std::abs(angle_offset.number_value()) < 10.0 &&
+                       steer_ratio.is_number() && min_sr <= steer_ratio.number_value() && steer_ratio.number_value() <= max_sr;
+    if (!params_sane) {
+      LOG("Invalid starting values found %s", params.dump().c_str());
+      params = nullptr;
+    }
+  }
+
+  double steer_ratio = CP.getSteerRatio(), angle_offset_average = 0.0;
+  if (params.is_object()) {
+    steer_ratio = params["steerRatio"].number_value();
+    angle_offset_average = params["angleOffsetAverageDeg"].number_value();
+  } else {
+    LOG("Parameter learner resetting to default values");
+  }
+
+  // When driving in wet conditions the stiffness can go down, and then be too low on the next drive
+  // Without a way to detect this we have to reset the stiffness every drive
+  auto learner = std::make_unique<ParamsLearner>(CP, steer_ratio, 1.0, angle_offset_average * M_PI / 180.0);
+  double angle_offset = angle_offset_average;
+
+  const std::initializer_list<const char *> service_list = {"liveLocationKalman", "carState"};
+  SubMaster sm(service_list);
+  PubMaster pm({"liveParameters"});
+  for (const char *service : service_list) {
+    sm.set_callback(service, [&](const cereal::Event::Reader &log) {
+      learner->handle_log(log.getLogMonoTime() * 1e-9, log);
+    });
+  }
+
+  // LiveParameters is written from a background thread, so the loop never waits on the filesystem
+  ParamsWriter params_writer;
+  uint64_t llk_frame = 0;
+
+  while (!do_exit) {
+    sm.update();
+    if (!sm.updated("liveLocationKalman")) continue;
+    llk_frame++;
+
+    if (!learner->kf.get_x().allFinite()) {
+      LOGE("NaN in liveParameters estimate. Resetting to default values");
+      learner = std::make_unique<ParamsLearner>(CP, CP.getSteerRatio(), 1.0, 0.0);
+    }
+    const CarEKF::StateVec &x = learner->kf.get_x();
+
+    const double offset_deg = x(CAR_STATE_ANGLE_OFFSET_START) * 180.0 / M_PI;
+    const double offset_fast_deg = x(CAR_STATE_ANGLE_OFFSET_FAST_START) * 180.0 / M_PI;
+    angle_offset_average = std::clamp(offset_deg, angle_offset_average - MAX_ANGLE_OFFSET_DELTA, angle_offset_average + MAX_ANGLE_OFFSET_DELTA);
+    angle_offset = std::clamp(offset_deg + offset_fast_deg, angle_offset - MAX_ANGLE_OFFSET_DELTA, angle_offset + MAX_ANGLE_OFFSET_DELTA);
+
+    MessageBuilder msg;
+    auto evt = msg.initEvent();
+    evt.setLogMonoTime(sm["carState"].getLogMonoTime());
+    auto live_params = evt.initLiveParameters();
+    live_params.setPosenetValid(true);
+    live_params.setSensorValid(true);
+    live_params.setSteerRatio(x(CAR_STATE_STEER_RATIO_START));
+    live_params.setStiffnessFactor(x(CAR_STATE_STIFFNESS_START));
+    live_params.setAngleOffsetAverageDeg(angle_offset_average);
+    live_params.setAngleOffsetDeg(angle_offset);
+    // checked on the logged float32s, as paramsd.py does
+    live_params.setValid(std::abs(live_params.getAngleOffsetAverageDeg()) < 10.0 &&
+                         std::abs(live_params.getAngleOffsetDeg()) < 10.0 &&
+                         0.2 <= live_params.getStiffnessFactor() && live_params.getStiffnessFactor() <= 5.0 &&
+                         min_sr <= live_params.getSteerRatio() && live_params.getSteerRatio() <= max_sr);
+
+    if (llk_frame % 1200 == 0) {  // once a minute
+      params_writer.put("LiveParameters", json11::Json(json11::Json::object{
+        {"carFingerprint", car_fingerprint},
+        {"steerRatio", live_params.getSteerRatio()},
+        {"stiffnessFactor", live_params.getStiffnessFactor()},
+        {"angleOffsetAverageDeg", live_params.getAngleOffsetAverageDeg()},
+      }).dump());
+    }
+
+    pm.send("liveParameters", msg);
+  }
+  return 0;
+}
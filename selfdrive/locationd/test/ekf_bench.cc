@@ -0,0 +1,139 @@
+// Times the generated live EKF, run from selfdrive/locationd.
+//
+//   ekf_bench [-n iterations]
+//
+// Compares the fused state and observation functions predict and update use
+// (f_F_fun, hH_<kind>) against the separate value and jacobian functions they
+// replaced, checks that both give the same results, and times predict and the
+// update of every observation kind.
+
+#include <getopt.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "rednose/helpers/common_ekf.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/locationd/models/generated/live_kf_constants.h"
+
+static double time_ns(int iterations, std::function<void()> f) {
+  double start = nanos_since_boot();
+  for (int i = 0; i < iterations; i++) {
+    f();
+  }
+  return (nanos_since_boot() - start) / iterations;
+}
+
+static double max_diff(const std::vector<double> &a, const std::vector<double> &b) {
+  double d = 0;
+  for (int i = 0; i < a.size(); i++) {
+    d = std::max(d, std::abs(a[i] - b[i]));
+  }
+  return d;
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = 100000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt == 'n') {
+      iterations = atoi(optarg);
+    } else {
+      fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  const EKF *ekf = ekf_lookup("live");
+  if (!ekf) {
+    fprintf(stderr, "live EKF not linked in\n");
+    return 1;
+  }
+
+  const int dim_x = LIVE_DIM_STATE, dim_err = LIVE_DIM_STATE_ERR;
+  std::mt19937 gen(0);
+  std::normal_distribution<double> noise(0.0, 0.1);
+
+  std::vector<double> x(dim_x);
+  for (int i = 0; i < dim_x; i++) {
+    x[i] = live_initial_x[i] + noise(gen);
+  }
+  Eigen::Map<Eigen::Vector4d>(&x[STATE_ECEF_ORIENTATION_START]).normalize();
+  std::vector<double> ea(8, 0.0);
+  const double dt = 0.01;
+
+  int failed = 0;
+  printf("%-10s %12s %12s %12s %10s\n", "function", "fused ns", "separate ns", "max diff", "update ns");
+
+  {
+    std::vector<double> f(dim_x), F(dim_err * dim_err), f_ref(dim_x), F_ref(dim_err * dim_err);
+    ekf->f_F_fun(x.data(), dt, f.data(), F.data());
+    ekf->f_fun(x.data(), dt, f_ref.data());
+    ekf->F_fun(x.data(), dt, F_ref.data());
+    double diff = std::max(max_diff(f, f_ref), max_diff(F, F_ref));
+    failed += diff > 1e-9;
+
+    double fused = time_ns(iterations, [&]() { ekf->f_F_fun(x.data(), dt, f.data(), F.data()); });
+    double separate = time_ns(iterations, [&]() {
+      ekf->f_fun(x.data(), dt, f_ref.data());
+      ekf->F_fun(x.data(), dt, F_ref.data());
+    });
+
+    Eigen::MatrixXd Q = live_Q_diag.asDiagonal();
+    std::vector<double> P(dim_err * dim_err), xp(dim_x);
+    double predict = time_ns(iterations, [&]() {
+      xp = x;
+      Eigen::Map<Eigen::Matrix<double, dim_err, dim_err, Eigen::RowMajor>>(P.data()) = live_initial_P_diag.asDiagonal();
+      ekf->predict(xp.data(), P.data(), Q.data(), dt);
+    });
+    printf("%-10s %12.1f %12.1f %12.2e %10.1f\n", "predict", fused, separate, diff, predict);
+  }
+
+  for (int kind : ekf->kinds) {
+    auto noise_it = live_obs_noise_diag.find(kind);
+    if (noise_it == live_obs_noise_diag.end()) {
+      continue;
+    }
+    const int dim_z = noise_it->second.size();
+
+    std::vector<double> h(dim_z), H(dim_z * dim_x), h_ref(dim_z), H_ref(dim_z * dim_x);
+    ekf->hHs.at(kind)(x.data(), ea.data(), h.data(), H.data());
+    ekf->hs.at(kind)(x.data(), ea.data(), h_ref.data());
+    ekf->Hs.at(kind)(x.data(), ea.data(), H_ref.data());
+    double diff = std::max(max_diff(h, h_ref), max_diff(H, H_ref));
+    failed += diff > 1e-9;
+
+    double fused = time_ns(iterations, [&]() { ekf->hHs.at(kind)(x.data(), ea.data(), h.data(), H.data()); });
+    double separate = time_ns(iterations, [&]() {
+      ekf->hs.at(kind)(x.data(), ea.data(), h_ref.data());
+      ekf->Hs.at(kind)(x.data(), ea.data(), H_ref.data());
+    });
+
+    // observe what the filter expects with a little noise
+    Eigen::MatrixXd R = noise_it->second.asDiagonal();
+    std::vector<double> P(dim_err * dim_err), xu(dim_x), z(dim_z);
+    double update = time_ns(iterations, [&]() {
+      xu = x;
+      Eigen::Map<Eigen::Matrix<double, dim_err, dim_err, Eigen::RowMajor>>(P.data()) = live_initial_P_diag.asDiagonal();
+      for (int i = 0; i < dim_z; i++) {
+        z[i] = h_ref[i] + 0.01;
+      }
+      ekf->updates.at(kind)(xu.data(), P.data(), z.data(), R.data(), ea.data());
+    });
+
+    char name[32];
+    snprintf(name, sizeof(name), "obs %d", kind);
+    printf("%-10s %12.1f %12.1f %12.2e %10.1f\n", name, fused, separate, diff, update);
+  }
+
+  if (failed) {
+    printf("%d fused functions differ from the separate ones\n", failed);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+// Replays rlogs through the Localizer as fast as it goes, run from selfdrive/locationd.
+//
+//   locationd_bench [-n iterations] [-o track.csv] rlog...
+//
+// Feeds the sensorEvents, gpsLocationExternal, cameraOdometry, liveCalibration
+// and carState events of the logs into Localizer::handle_msg_bytes in log
+// order, with a fresh Localizer for each iteration, and builds
+// liveLocationKalman after every cameraOdometry like locationd does. Reports
+// events/s, ns per event of each service and per liveLocationKalman, and the
+// position and heading error against every valid GPS fix of the last
+// iteration, which -o writes out as a CSV track.
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "selfdrive/locationd/locationd.h"
+#include "selfdrive/loggerd/log_reader.h"
+
+static const std::vector<std::pair<const char *, cereal::Event::Which>> SERVICES = {
+  {"sensorEvents", cereal::Event::SENSOR_EVENTS},
+  {"gpsLocationExternal", cereal::Event::GPS_LOCATION_EXTERNAL},
+  {"cameraOdometry", cereal::Event::CAMERA_ODOMETRY},
+  {"liveCalibration", cereal::Event::LIVE_CALIBRATION},
+  {"carState", cereal::Event::CAR_STATE},
+};
+
+struct Event {
+  std::string data;
+  int service;  // index into SERVICES
+};
+
+struct TrackPoint {
+  double t;
+  Geodetic gps, kf;
+  double pos_error;  // m, horizontal
+  double gps_bearing, kf_yaw, heading_error;  // deg, NAN when standing still
+};
+
+static void load_log(const std::string &path, std::vector<Event> &events) {
+  std::vector<uint8_t> data = log_read_all(path);
+  kj::Array<capnp::word> words = kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+  memcpy(words.begin(), data.data(), words.size() * sizeof(capnp::word));
+
+  kj::ArrayPtr<const capnp::word> rest = words;
+  try {
+    while (rest.size() > 0) {
+      capnp::FlatArrayMessageReader msg(rest);
+      auto which = msg.getRoot<cereal::Event>().which();
+      for (int i = 0; i < SERVICES.size(); i++) {
+        if (SERVICES[i].second == which) {
+          auto bytes = kj::arrayPtr(rest.begin(), msg.getEnd()).asBytes();
+          events.push_back({std::string(bytes.begin(), bytes.end()), i});
+          break;
+        }
+      }
+      rest = kj::arrayPtr(msg.getEnd(), rest.end());
+    }
+  } catch (const kj::Exception &e) {
+    fprintf(stderr, "%s: stopped at a broken event\n", path.c_str());
+  }
+}
+
+static double wrap_deg(double a) {
+  a = std::fmod(a + 180.0, 360.0);
+  return (a < 0 ? a + 360.0 : a) - 180.0;
+}
+
+static TrackPoint track_point(Localizer &localizer, const cereal::Event::Reader &event) {
+  auto gps = event.getGpsLocationExternal();
+  TrackPoint p = {.t = event.getLogMonoTime() * 1e-9};
+  p.gps = {gps.getLatitude(), gps.getLongitude(), gps.getAltitude()};
+
+  MessageBuilder msg;
+  localizer.build_message(msg, event.getLogMonoTime(), true, true, true);
+  auto fix = msg.getRoot<cereal::Event>().asReader().getLiveLocationKalman();
+  auto pos = fix.getPositionGeodetic().getValue();
+  p.kf = {pos[0], pos[1], pos[2]};
+
+  LocalCoord local(p.gps);
+  NED ned = local.geodetic2ned(p.kf);
+  p.pos_error = std::hypot(ned.n, ned.e);
+
+  p.gps_bearing = p.kf_yaw = p.heading_error = NAN;
+  if (gps.getSpeed() > 5.0) {
+    p.gps_bearing = gps.getBearingDeg();
+    p.kf_yaw = RAD2DEG(fix.getOrientationNED().getValue()[2]);
+    p.heading_error = wrap_deg(p.kf_yaw - p.gps_bearing);
+  }
+  return p;
+}
+
+static void print_errors(const char *name, std::vector<double> errors) {
+  errors.erase(std::remove_if(errors.begin(), errors.end(), [](double e) { return std::isnan(e); }), errors.end());
+  if (errors.empty()) {
+    printf("%-22s no fixes\n", name);
+    return;
+  }
+  double sum = 0;
+  for (double &e : errors) {
+    e = std::abs(e);
+    sum += e;
+  }
+  std::sort(errors.begin(), errors.end());
+  printf("%-22s %8zu fixes, mean %8.2f p50 %8.2f p95 %8.2f max %8.2f\n", name, errors.size(), sum / errors.size(),
+         errors[errors.size() / 2], errors[errors.size() * 95 / 100], errors.back());
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = 1;
+  const char *track_path = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:o:")) != -1) {
+    switch (opt) {
+      case 'n': iterations = atoi(optarg); break;
+      case 'o': track_path = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-n iterations] [-o track.csv] rlog...\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<Event> events;
+  for (int i = optind; i < argc; i++) {
+    load_log(argv[i], events);
+  }
+  if (events.empty()) {
+    fprintf(stderr, "no localizer events in the logs\n");
+    return 1;
+  }
+
+  std::vector<double> service_ns(SERVICES.size(), 0.0);
+  std::vector<size_t> service_count(SERVICES.size(), 0);
+  double publish_ns = 0;
+  size_t publishes = 0;
+  std::vector<TrackPoint> track;
+
+  for (int n = 0; n < iterations; n++) {
+    Localizer localizer;
+    track.clear();
+    for (const Event &e : events) {
+      double start = nanos_since_boot();
+      localizer.handle_msg_bytes(e.data.data(), e.data.size());
+      service_ns[e.service] += nanos_since_boot() - start;
+      service_count[e.service]++;
+
+      if (SERVICES[e.service].second == cereal::Event::CAMERA_ODOMETRY) {
+        start = nanos_since_boot();
+        MessageBuilder msg;
+        localizer.get_message_bytes(msg, 0, true, true, true);
+        publish_ns += nanos_since_boot() - start;
+        publishes++;
+      } else if (SERVICES[e.service].second == cereal::Event::GPS_LOCATION_EXTERNAL) {
+        AlignedBuffer aligned_buf;
+        capnp::FlatArrayMessageReader msg(aligned_buf.align(e.data.data(), e.data.size()));
+        cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+        if (event.getGpsLocationExternal().getFlags() % 2 == 1) {
+          track.push_back(track_point(localizer, event));
+        }
+      }
+    }
+  }
+
+  double total_ns = publish_ns;
+  for (double ns : service_ns) total_ns += ns;
+  printf("%zu events x %d, %.0f events/s\n", events.size(), iterations, events.size() * iterations / (total_ns * 1e-9));
+  for (int i = 0; i < SERVICES.size(); i++) {
+    if (service_count[i] > 0) {
+      printf("%-22s %10zu events %10.1f ns/event\n", SERVICES[i].first, service_count[i], service_ns[i] / service_count[i]);
+    }
+  }
+  if (publishes > 0) {
+    printf("%-22s %10zu msgs   %10.1f ns/msg\n", "liveLocationKalman", publishes, publish_ns / publishes);
+  }
+
+  std::vector<double> pos_errors, heading_errors;
+  for (const TrackPoint &p : track) {
+    pos_errors.push_back(p.pos_error);
+    heading_errors.push_back(p.heading_error);
+  }
+  print_errors("position error (m)", pos_errors);
+  print_errors("heading error (deg)", heading_errors);
+
+  if (track_path) {
+    FILE *f = fopen(track_path, "w");
+    if (!f) {
+      fprintf(stderr, "can't write %s\n", track_path);
+      return 1;
+    }
+    fprintf(f, "t,gps_lat,gps_lon,gps_alt,kf_lat,kf_lon,kf_alt,pos_error,gps_bearing,kf_yaw,heading_error\n");
+    for (const TrackPoint &p : track) {
+      fprintf(f, "%.3f,%.8f,%.8f,%.2f,%.8f,%.8f,%.2f,%.3f,%.2f,%.2f,%.2f\n", p.t, p.gps.lat, p.gps.lon, p.gps.alt,
+              p.kf.lat, p.kf.lon, p.kf.alt, p.pos_error, p.gps_bearing, p.kf_yaw, p.heading_error);
+    }
+    fclose(f);
+  }
+  return 0;
+}
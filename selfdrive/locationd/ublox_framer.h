@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// protocol constants
+namespace ublox {
+  const uint8_t PREAMBLE1 = 0xb5;
+  const uint8_t PREAMBLE2 = 0x62;
+
+  const int UBLOX_HEADER_SIZE = 6;
+  const int UBLOX_CHECKSUM_SIZE = 2;
+  const int UBLOX_MAX_MSG_SIZE = 65536;
+}
+
+// Splits a stream of UBX into messages: two sync chars, class, id, a u16 payload
+// length, the payload and a two byte checksum. Messages within the data that's
+// added are handed out where they are, only the ones it splits are copied.
+// Bytes that aren't part of a valid message are skipped
+class UbloxFramer {
+public:
+  // f(const uint8_t *msg, size_t len) for every message completed by data,
+  // msg is only valid during the call
+  template <typename F>
+  void add_data(const uint8_t *data, size_t len, F &&f) {
+    size_t pos = 0;
+
+    // finish a message that an earlier call cut off
+    while (!partial.empty() && pos < len) {
+      const size_t take = std::min(needed(partial.data(), partial.size()), len - pos);
+      partial.insert(partial.end(), data + pos, data + pos + take);
+      pos += take;
+
+      while (!partial.empty()) {
+        const int r = check(partial.data(), partial.size());
+        if (r == 0) break;
+        if (r > 0) {
+          // after skipping a bad one there can be more than a message in it
+          f((const uint8_t *)partial.data(), (size_t)r);
+          partial.erase(partial.begin(), partial.begin() + r);
+        } else {
+          const size_t skip = next_preamble(partial.data(), partial.size());
+          skipped += skip;
+          partial.erase(partial.begin(), partial.begin() + skip);
+        }
+      }
+    }
+
+    while (pos < len) {
+      const int r = check(data + pos, len - pos);
+      if (r > 0) {
+        f(data + pos, (size_t)r);
+        pos += r;
+      } else if (r < 0) {
+        const size_t skip = next_preamble(data + pos, len - pos);
+        skipped += skip;
+        pos += skip;
+      } else {
+        partial.assign(data + pos, data + len);
+        pos = len;
+      }
+    }
+  }
+
+  void reset() { partial.clear(); }
+
+  // bytes dropped while looking for messages
+  uint64_t skipped = 0;
+
+private:
+  // the length of a valid message at p, 0 if it could become one with more data, -1 if it can't
+  static int check(const uint8_t *p, size_t n) {
+    if (p[0] != ublox::PREAMBLE1 || (n > 1 && p[1] != ublox::PREAMBLE2)) return -1;
+    if (n < ublox::UBLOX_HEADER_SIZE) return 0;
+
+    const size_t total = ublox::UBLOX_HEADER_SIZE + (p[4] | (p[5] << 8)) + ublox::UBLOX_CHECKSUM_SIZE;
+    if (n < total) return 0;
+
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < total - ublox::UBLOX_CHECKSUM_SIZE; i++) {
+      ck_a += p[i];
+      ck_b += ck_a;
+    }
+    return (ck_a == p[total - 2] && ck_b == p[total - 1]) ? (int)total : -1;
+  }
+
+  // bytes still missing for what check() said could become a message
+  static size_t needed(const uint8_t *p, size_t n) {
+    if (n < ublox::UBLOX_HEADER_SIZE) return ublox::UBLOX_HEADER_SIZE - n;
+    return ublox::UBLOX_HEADER_SIZE + (p[4] | (p[5] << 8)) + ublox::UBLOX_CHECKSUM_SIZE - n;
+  }
+
+  // from the byte after p to the next sync char, or all of it
+  static size_t next_preamble(const uint8_t *p, size_t n) {
+    const void *next = n > 1 ? memchr(p + 1, ublox::PREAMBLE1, n - 1) : nullptr;
+    return next ? (const uint8_t *)next - p : n;
+  }
+
+  std::vector<uint8_t> partial;
+};
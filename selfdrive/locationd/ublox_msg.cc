@@ -2,191 +2,148 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <unordered_map>
 
 #include "selfdrive/common/swaglog.h"
 
 const double gpsPi = 3.1415926535898;
-#define UBLOX_MSG_SIZE(hdr) (*(uint16_t *)&hdr[4])
 
 inline static bool bit_to_bool(uint8_t val, int shifts) {
   return (bool)(val & (1 << shifts));
 }
 
-inline int UbloxMsgParser::needed_bytes() {
-  // Msg header incomplete?
-  if(bytes_in_parse_buf < ublox::UBLOX_HEADER_SIZE)
-    return ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_CHECKSUM_SIZE - bytes_in_parse_buf;
-  uint16_t needed = UBLOX_MSG_SIZE(msg_parse_buf) + ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_CHECKSUM_SIZE;
-  // too much data
-  if(needed < (uint16_t)bytes_in_parse_buf)
-    return -1;
-  return needed - (uint16_t)bytes_in_parse_buf;
+// little endian field at offset off of a payload
+template <typename T>
+inline static T get(const uint8_t *p, size_t off) {
+  T v;
+  memcpy(&v, p + off, sizeof(T));
+  return v;
 }
 
-inline bool UbloxMsgParser::valid_cheksum() {
-  uint8_t ck_a = 0, ck_b = 0;
-  for(int i = 2; i < bytes_in_parse_buf - ublox::UBLOX_CHECKSUM_SIZE;i++) {
-    ck_a = (ck_a + msg_parse_buf[i]) & 0xFF;
-    ck_b = (ck_b + ck_a) & 0xFF;
-  }
-  if(ck_a != msg_parse_buf[bytes_in_parse_buf - 2]) {
-    LOGD("Checksum a mismtach: %02X, %02X", ck_a, msg_parse_buf[6]);
-    return false;
-  }
-  if(ck_b != msg_parse_buf[bytes_in_parse_buf - 1]) {
-    LOGD("Checksum b mismtach: %02X, %02X", ck_b, msg_parse_buf[7]);
-    return false;
-  }
-  return true;
-}
+// payload sizes, RAWX and SFRBX have this much before their repeated part
+const size_t NAV_PVT_SIZE = 92;
+const size_t RXM_SFRBX_SIZE = 8;
+const size_t RXM_RAWX_SIZE = 16;
+const size_t RXM_RAWX_MEAS_SIZE = 32;
+const size_t MON_HW_SIZE = 60;
+const size_t MON_HW2_SIZE = 28;
 
-inline bool UbloxMsgParser::valid() {
-  return bytes_in_parse_buf >= ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_CHECKSUM_SIZE &&
-         needed_bytes() == 0 && valid_cheksum();
-}
-
-inline bool UbloxMsgParser::valid_so_far() {
-  if(bytes_in_parse_buf > 0 && msg_parse_buf[0] != ublox::PREAMBLE1) {
-    return false;
-  }
-  if(bytes_in_parse_buf > 1 && msg_parse_buf[1] != ublox::PREAMBLE2) {
-    return false;
-  }
-  if(needed_bytes() == 0 && !valid()) {
-    return false;
-  }
-  return true;
-}
-
-
-bool UbloxMsgParser::add_data(const uint8_t *incoming_data, uint32_t incoming_data_len, size_t &bytes_consumed) {
-  int needed = needed_bytes();
-  if(needed > 0) {
-    bytes_consumed = std::min((uint32_t)needed, incoming_data_len );
-    // Add data to buffer
-    memcpy(msg_parse_buf + bytes_in_parse_buf, incoming_data, bytes_consumed);
-    bytes_in_parse_buf += bytes_consumed;
-  } else {
-    bytes_consumed = incoming_data_len;
-  }
+const uint8_t GNSS_ID_GPS = 0;
+const uint8_t GPS_TLM_PREAMBLE = 0x8b;
 
-  // Validate msg format, detect invalid header and invalid checksum.
-  while(!valid_so_far() && bytes_in_parse_buf != 0) {
-    // Corrupted msg, drop a byte.
-    bytes_in_parse_buf -= 1;
-    if(bytes_in_parse_buf > 0)
-      memmove(&msg_parse_buf[0], &msg_parse_buf[1], bytes_in_parse_buf);
-  }
-
-  // There is redundant data at the end of buffer, reset the buffer.
-  if(needed_bytes() == -1) {
-    bytes_in_parse_buf = 0;
+std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg(const uint8_t *msg, size_t len) {
+  if (len < ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_CHECKSUM_SIZE || msg[0] != ublox::PREAMBLE1 || msg[1] != ublox::PREAMBLE2) {
+    LOGE("Invalid ublox message of %zu bytes", len);
+    return {"ubloxGnss", kj::Array<capnp::word>()};
   }
-  return valid();
-}
-
-
-std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg() {
-  std::string dat = data();
-  kaitai::kstream stream(dat);
 
-  ubx_t ubx_message(&stream);
-  auto body = ubx_message.body();
+  const uint16_t msg_type = (msg[2] << 8) | msg[3];
+  const uint8_t *payload = msg + ublox::UBLOX_HEADER_SIZE;
+  const size_t payload_len = std::min<size_t>(get<uint16_t>(msg, 4), len - ublox::UBLOX_HEADER_SIZE - ublox::UBLOX_CHECKSUM_SIZE);
 
-  switch (ubx_message.msg_type()) {
+  switch (msg_type) {
   case 0x0107:
-    return {"gpsLocationExternal", gen_nav_pvt(static_cast<ubx_t::nav_pvt_t*>(body))};
+    return {"gpsLocationExternal", gen_nav_pvt(payload, payload_len)};
     break;
   case 0x0213:
-    return {"ubloxGnss", gen_rxm_sfrbx(static_cast<ubx_t::rxm_sfrbx_t*>(body))};
+    return {"ubloxGnss", gen_rxm_sfrbx(payload, payload_len)};
     break;
   case 0x0215:
-    return {"ubloxGnss", gen_rxm_rawx(static_cast<ubx_t::rxm_rawx_t*>(body))};
+    return {"ubloxGnss", gen_rxm_rawx(payload, payload_len)};
     break;
   case 0x0a09:
-    return {"ubloxGnss", gen_mon_hw(static_cast<ubx_t::mon_hw_t*>(body))};
+    return {"ubloxGnss", gen_mon_hw(payload, payload_len)};
     break;
   case 0x0a0b:
-    return {"ubloxGnss", gen_mon_hw2(static_cast<ubx_t::mon_hw2_t*>(body))};
+    return {"ubloxGnss", gen_mon_hw2(payload, payload_len)};
     break;
   default:
-    LOGE("Unknown message type %x", ubx_message.msg_type());
+    LOGE("Unknown message type %x", msg_type);
     return {"ubloxGnss", kj::Array<capnp::word>()};
     break;
   }
 }
 
 
-kj::Array<capnp::word> UbloxMsgParser::gen_nav_pvt(ubx_t::nav_pvt_t *msg) {
-  MessageBuilder msg_builder;
+kj::Array<capnp::word> UbloxMsgParser::gen_nav_pvt(const uint8_t *p, size_t len) {
+  if (len < NAV_PVT_SIZE) return kj::Array<capnp::word>();
+
+  PooledMessageBuilder msg_builder("gpsLocationExternal");
   auto gpsLoc = msg_builder.initEvent().initGpsLocationExternal();
   gpsLoc.setSource(cereal::GpsLocationData::SensorSource::UBLOX);
-  gpsLoc.setFlags(msg->flags());
-  gpsLoc.setLatitude(msg->lat() * 1e-07);
-  gpsLoc.setLongitude(msg->lon() * 1e-07);
-  gpsLoc.setAltitude(msg->height() * 1e-03);
-  gpsLoc.setSpeed(msg->g_speed() * 1e-03);
-  gpsLoc.setBearingDeg(msg->head_mot() * 1e-5);
-  gpsLoc.setAccuracy(msg->h_acc() * 1e-03);
+  gpsLoc.setFlags(get<uint8_t>(p, 21));
+  gpsLoc.setLatitude(get<int32_t>(p, 28) * 1e-07);
+  gpsLoc.setLongitude(get<int32_t>(p, 24) * 1e-07);
+  gpsLoc.setAltitude(get<int32_t>(p, 32) * 1e-03);
+  gpsLoc.setSpeed(get<int32_t>(p, 60) * 1e-03);
+  gpsLoc.setBearingDeg(get<int32_t>(p, 64) * 1e-5);
+  gpsLoc.setAccuracy(get<uint32_t>(p, 40) * 1e-03);
   std::tm timeinfo = std::tm();
-  timeinfo.tm_year = msg->year() - 1900;
-  timeinfo.tm_mon = msg->month() - 1;
-  timeinfo.tm_mday = msg->day();
-  timeinfo.tm_hour = msg->hour();
-  timeinfo.tm_min = msg->min();
-  timeinfo.tm_sec = msg->sec();
+  timeinfo.tm_year = get<uint16_t>(p, 4) - 1900;
+  timeinfo.tm_mon = get<uint8_t>(p, 6) - 1;
+  timeinfo.tm_mday = get<uint8_t>(p, 7);
+  timeinfo.tm_hour = get<uint8_t>(p, 8);
+  timeinfo.tm_min = get<uint8_t>(p, 9);
+  timeinfo.tm_sec = get<uint8_t>(p, 10);
 
   std::time_t utc_tt = timegm(&timeinfo);
-  gpsLoc.setTimestamp(utc_tt * 1e+03 + msg->nano() * 1e-06);
-  float f[] = { msg->vel_n() * 1e-03f, msg->vel_e() * 1e-03f, msg->vel_d() * 1e-03f };
+  gpsLoc.setTimestamp(utc_tt * 1e+03 + get<int32_t>(p, 16) * 1e-06);
+  float f[] = { get<int32_t>(p, 48) * 1e-03f, get<int32_t>(p, 52) * 1e-03f, get<int32_t>(p, 56) * 1e-03f };
   gpsLoc.setVNED(f);
-  gpsLoc.setVerticalAccuracy(msg->v_acc() * 1e-03);
-  gpsLoc.setSpeedAccuracy(msg->s_acc() * 1e-03);
-  gpsLoc.setBearingAccuracyDeg(msg->head_acc() * 1e-05);
+  gpsLoc.setVerticalAccuracy(get<uint32_t>(p, 44) * 1e-03);
+  gpsLoc.setSpeedAccuracy(get<int32_t>(p, 68) * 1e-03);
+  gpsLoc.setBearingAccuracyDeg(get<uint32_t>(p, 72) * 1e-05);
   return capnp::messageToFlatArray(msg_builder);
 }
 
 
-kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
-  auto body = *msg->body();
+kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(const uint8_t *p, size_t len) {
+  if (len < RXM_SFRBX_SIZE) return kj::Array<capnp::word>();
+
+  const uint8_t gnss_id = get<uint8_t>(p, 0);
+  const uint8_t sv_id = get<uint8_t>(p, 1);
+  const uint8_t num_words = get<uint8_t>(p, 4);
+  if (len < RXM_SFRBX_SIZE + num_words * 4) return kj::Array<capnp::word>();
 
-  if (msg->gnss_id() == ubx_t::gnss_type_t::GNSS_TYPE_GPS) {
+  if (gnss_id == GNSS_ID_GPS) {
     // GPS subframes are packed into 10x 4 bytes, each containing 3 actual bytes
     // We will first need to separate the data from the padding and parity
-    assert(body.size() == 10);
+    assert(num_words == 10);
 
     std::string subframe_data;
     subframe_data.reserve(30);
-    for (uint32_t word : body) {
+    for (int i = 0; i < num_words; i++) {
+      uint32_t word = get<uint32_t>(p, RXM_SFRBX_SIZE + i * 4);
       word = word >> 6; // TODO: Verify parity
       subframe_data.push_back(word >> 16);
       subframe_data.push_back(word >> 8);
       subframe_data.push_back(word >> 0);
     }
 
-    // Collect subframes in map and parse when we have all the parts
-    kaitai::kstream stream(subframe_data);
-    gps_t subframe(&stream);
-    int subframe_id = subframe.how()->subframe_id();
+    // Collect subframes in map and parse when we have all the parts,
+    // the subframe id is in the handover word after the telemetry word
+    if ((uint8_t)subframe_data[0] != GPS_TLM_PREAMBLE) return kj::Array<capnp::word>();
+    int subframe_id = ((uint8_t)subframe_data[5] >> 2) & 0x7;
 
-    if (subframe_id == 1) gps_subframes[msg->sv_id()].clear();
-    gps_subframes[msg->sv_id()][subframe_id] = subframe_data;
+    if (subframe_id == 1) gps_subframes[sv_id].clear();
+    gps_subframes[sv_id][subframe_id] = subframe_data;
 
-    if (gps_subframes[msg->sv_id()].size() == 5) {
-      MessageBuilder msg_builder;
+    if (gps_subframes[sv_id].size() == 5) {
+      PooledMessageBuilder msg_builder("ubloxGnss");
       auto eph = msg_builder.initEvent().initUbloxGnss().initEphemeris();
-      eph.setSvId(msg->sv_id());
+      eph.setSvId(sv_id);
 
       // Subframe 1
       {
-        kaitai::kstream stream(gps_subframes[msg->sv_id()][1]);
+        kaitai::kstream stream(gps_subframes[sv_id][1]);
         gps_t subframe(&stream);
         gps_t::subframe_1_t* subframe_1 = static_cast<gps_t::subframe_1_t*>(subframe.body());
 
@@ -200,7 +157,7 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
 
       // Subframe 2
       {
-        kaitai::kstream stream(gps_subframes[msg->sv_id()][2]);
+        kaitai::kstream stream(gps_subframes[sv_id][2]);
         gps_t subframe(&stream);
         gps_t::subframe_2_t* subframe_2 = static_cast<gps_t::subframe_2_t*>(subframe.body());
 
@@ -216,7 +173,7 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
 
       // Subframe 3
       {
-        kaitai::kstream stream(gps_subframes[msg->sv_id()][3]);
+        kaitai::kstream stream(gps_subframes[sv_id][3]);
         gps_t subframe(&stream);
         gps_t::subframe_3_t* subframe_3 = static_cast<gps_t::subframe_3_t*>(subframe.body());
 
@@ -233,7 +190,7 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
 
       // Subframe 4
       {
-        kaitai::kstream stream(gps_subframes[msg->sv_id()][4]);
+        kaitai::kstream stream(gps_subframes[sv_id][4]);
         gps_t subframe(&stream);
         gps_t::subframe_4_t* subframe_4 = static_cast<gps_t::subframe_4_t*>(subframe.body());
 
@@ -260,75 +217,84 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
   return kj::Array<capnp::word>();
 }
 
-kj::Array<capnp::word> UbloxMsgParser::gen_rxm_rawx(ubx_t::rxm_rawx_t *msg) {
-  MessageBuilder msg_builder;
+kj::Array<capnp::word> UbloxMsgParser::gen_rxm_rawx(const uint8_t *p, size_t len) {
+  if (len < RXM_RAWX_SIZE) return kj::Array<capnp::word>();
+
+  const uint8_t num_meas = get<uint8_t>(p, 11);
+  const uint8_t rec_stat = get<uint8_t>(p, 12);
+  if (len < RXM_RAWX_SIZE + num_meas * RXM_RAWX_MEAS_SIZE) return kj::Array<capnp::word>();
+
+  PooledMessageBuilder msg_builder("ubloxGnss");
   auto mr = msg_builder.initEvent().initUbloxGnss().initMeasurementReport();
-  mr.setRcvTow(msg->rcv_tow());
-  mr.setGpsWeek(msg->week());
-  mr.setLeapSeconds(msg->leap_s());
-  mr.setGpsWeek(msg->week());
-
-  auto mb = mr.initMeasurements(msg->num_meas());
-  auto measurements = *msg->measurements();
-  for(int8_t i = 0; i < msg->num_meas(); i++) {
-    mb[i].setSvId(measurements[i]->sv_id());
-    mb[i].setPseudorange(measurements[i]->pr_mes());
-    mb[i].setCarrierCycles(measurements[i]->cp_mes());
-    mb[i].setDoppler(measurements[i]->do_mes());
-    mb[i].setGnssId(measurements[i]->gnss_id());
-    mb[i].setGlonassFrequencyIndex(measurements[i]->freq_id());
-    mb[i].setLocktime(measurements[i]->lock_time());
-    mb[i].setCno(measurements[i]->cno());
-    mb[i].setPseudorangeStdev(0.01 * (pow(2, (measurements[i]->pr_stdev() & 15)))); // weird scaling, might be wrong
-    mb[i].setCarrierPhaseStdev(0.004 * (measurements[i]->cp_stdev() & 15));
-    mb[i].setDopplerStdev(0.002 * (pow(2, (measurements[i]->do_stdev() & 15)))); // weird scaling, might be wrong
+  mr.setRcvTow(get<double>(p, 0));
+  mr.setGpsWeek(get<uint16_t>(p, 8));
+  mr.setLeapSeconds(get<int8_t>(p, 10));
+
+  auto mb = mr.initMeasurements(num_meas);
+  for (int i = 0; i < num_meas; i++) {
+    const uint8_t *m = p + RXM_RAWX_SIZE + i * RXM_RAWX_MEAS_SIZE;
+    mb[i].setSvId(get<uint8_t>(m, 21));
+    mb[i].setPseudorange(get<double>(m, 0));
+    mb[i].setCarrierCycles(get<double>(m, 8));
+    mb[i].setDoppler(get<float>(m, 16));
+    mb[i].setGnssId(get<uint8_t>(m, 20));
+    mb[i].setGlonassFrequencyIndex(get<uint8_t>(m, 23));
+    mb[i].setLocktime(get<uint16_t>(m, 24));
+    mb[i].setCno(get<uint8_t>(m, 26));
+    mb[i].setPseudorangeStdev(0.01 * (pow(2, (get<uint8_t>(m, 27) & 15)))); // weird scaling, might be wrong
+    mb[i].setCarrierPhaseStdev(0.004 * (get<uint8_t>(m, 28) & 15));
+    mb[i].setDopplerStdev(0.002 * (pow(2, (get<uint8_t>(m, 29) & 15)))); // weird scaling, might be wrong
 
     auto ts = mb[i].initTrackingStatus();
-    auto trk_stat = measurements[i]->trk_stat();
+    auto trk_stat = get<uint8_t>(m, 30);
     ts.setPseudorangeValid(bit_to_bool(trk_stat, 0));
     ts.setCarrierPhaseValid(bit_to_bool(trk_stat, 1));
     ts.setHalfCycleValid(bit_to_bool(trk_stat, 2));
     ts.setHalfCycleSubtracted(bit_to_bool(trk_stat, 3));
   }
 
-  mr.setNumMeas(msg->num_meas());
+  mr.setNumMeas(num_meas);
   auto rs = mr.initReceiverStatus();
-  rs.setLeapSecValid(bit_to_bool(msg->rec_stat(), 0));
-  rs.setClkReset(bit_to_bool(msg->rec_stat(), 2));
+  rs.setLeapSecValid(bit_to_bool(rec_stat, 0));
+  rs.setClkReset(bit_to_bool(rec_stat, 2));
   return capnp::messageToFlatArray(msg_builder);
 }
 
-kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw(ubx_t::mon_hw_t *msg) {
-  MessageBuilder msg_builder;
+kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw(const uint8_t *p, size_t len) {
+  if (len < MON_HW_SIZE) return kj::Array<capnp::word>();
+
+  PooledMessageBuilder msg_builder("ubloxGnss");
   auto hwStatus = msg_builder.initEvent().initUbloxGnss().initHwStatus();
-  hwStatus.setNoisePerMS(msg->noise_per_ms());
-  hwStatus.setFlags(msg->flags());
-  hwStatus.setAgcCnt(msg->agc_cnt());
-  hwStatus.setAStatus((cereal::UbloxGnss::HwStatus::AntennaSupervisorState) msg->a_status());
-  hwStatus.setAPower((cereal::UbloxGnss::HwStatus::AntennaPowerStatus) msg->a_power());
-  hwStatus.setJamInd(msg->jam_ind());
+  hwStatus.setNoisePerMS(get<uint16_t>(p, 16));
+  hwStatus.setFlags(get<uint8_t>(p, 22));
+  hwStatus.setAgcCnt(get<uint16_t>(p, 18));
+  hwStatus.setAStatus((cereal::UbloxGnss::HwStatus::AntennaSupervisorState) get<uint8_t>(p, 20));
+  hwStatus.setAPower((cereal::UbloxGnss::HwStatus::AntennaPowerStatus) get<uint8_t>(p, 21));
+  hwStatus.setJamInd(get<uint8_t>(p, 45));
   return capnp::messageToFlatArray(msg_builder);
 }
 
-kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw2(ubx_t::mon_hw2_t *msg) {
-  MessageBuilder msg_builder;
+kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw2(const uint8_t *p, size_t len) {
+  if (len < MON_HW2_SIZE) return kj::Array<capnp::word>();
+
+  PooledMessageBuilder msg_builder("ubloxGnss");
   auto hwStatus = msg_builder.initEvent().initUbloxGnss().initHwStatus2();
-  hwStatus.setOfsI(msg->ofs_i());
-  hwStatus.setMagI(msg->mag_i());
-  hwStatus.setOfsQ(msg->ofs_q());
-  hwStatus.setMagQ(msg->mag_q());
+  hwStatus.setOfsI(get<int8_t>(p, 0));
+  hwStatus.setMagI(get<uint8_t>(p, 1));
+  hwStatus.setOfsQ(get<int8_t>(p, 2));
+  hwStatus.setMagQ(get<uint8_t>(p, 3));
 
-  switch (msg->cfg_source()) {
-    case ubx_t::mon_hw2_t::config_source_t::CONFIG_SOURCE_ROM:
+  switch (get<uint8_t>(p, 4)) {
+    case 113:
       hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::ROM);
       break;
-    case ubx_t::mon_hw2_t::config_source_t::CONFIG_SOURCE_OTP:
+    case 111:
       hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::OTP);
       break;
-    case ubx_t::mon_hw2_t::config_source_t::CONFIG_SOURCE_CONFIG_PINS:
+    case 112:
       hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::CONFIGPINS);
       break;
-    case ubx_t::mon_hw2_t::config_source_t::CONFIG_SOURCE_FLASH:
+    case 102:
       hwStatus.setCfgSource(cereal::UbloxGnss::HwStatus2::ConfigSource::FLASH);
       break;
     default:
@@ -336,8 +302,8 @@ kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw2(ubx_t::mon_hw2_t *msg) {
       break;
   }
 
-  hwStatus.setLowLevCfg(msg->low_lev_cfg());
-  hwStatus.setPostStatus(msg->post_status());
+  hwStatus.setLowLevCfg(get<uint32_t>(p, 8));
+  hwStatus.setPostStatus(get<uint32_t>(p, 20));
 
   return capnp::messageToFlatArray(msg_builder);
 }
@@ -9,20 +9,12 @@
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/util.h"
+#include "selfdrive/locationd/ublox_framer.h"
 #include "selfdrive/locationd/generated/gps.h"
-#include "selfdrive/locationd/generated/ubx.h"
 
 using namespace std::string_literals;
 
-// protocol constants
 namespace ublox {
-  const uint8_t PREAMBLE1 = 0xb5;
-  const uint8_t PREAMBLE2 = 0x62;
-
-  const int UBLOX_HEADER_SIZE = 6;
-  const int UBLOX_CHECKSUM_SIZE = 2;
-  const int UBLOX_MAX_MSG_SIZE = 65536;
-
   // Boardd still uses these:
   const uint8_t CLASS_NAV = 0x01;
   const uint8_t CLASS_RXM = 0x02;
@@ -88,29 +80,19 @@ namespace ublox {
   }
 }
 
+// Makes events of the UBX messages ubloxd uses, msg is one whole message.
+// The payloads are read at their offsets straight into the event, the gen_*
+// functions get the payload without header and checksum and return an empty
+// array for ones that are too short
 class UbloxMsgParser {
   public:
-    bool add_data(const uint8_t *incoming_data, uint32_t incoming_data_len, size_t &bytes_consumed);
-    inline void reset() {bytes_in_parse_buf = 0;}
-    inline int needed_bytes();
-    inline std::string data() {return std::string((const char*)msg_parse_buf, bytes_in_parse_buf);}
-
-    std::pair<std::string, kj::Array<capnp::word>> gen_msg();
-    kj::Array<capnp::word> gen_nav_pvt(ubx_t::nav_pvt_t *msg);
-    kj::Array<capnp::word> gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
-    kj::Array<capnp::word> gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
-    kj::Array<capnp::word> gen_mon_hw(ubx_t::mon_hw_t *msg);
-    kj::Array<capnp::word> gen_mon_hw2(ubx_t::mon_hw2_t *msg);
+    std::pair<std::string, kj::Array<capnp::word>> gen_msg(const uint8_t *msg, size_t len);
+    kj::Array<capnp::word> gen_nav_pvt(const uint8_t *p, size_t len);
+    kj::Array<capnp::word> gen_rxm_sfrbx(const uint8_t *p, size_t len);
+    kj::Array<capnp::word> gen_rxm_rawx(const uint8_t *p, size_t len);
+    kj::Array<capnp::word> gen_mon_hw(const uint8_t *p, size_t len);
+    kj::Array<capnp::word> gen_mon_hw2(const uint8_t *p, size_t len);
 
   private:
-    inline bool valid_cheksum();
-    inline bool valid();
-    inline bool valid_so_far();
-
     std::unordered_map<int, std::unordered_map<int, std::string>> gps_subframes;
-
-    size_t bytes_in_parse_buf = 0;
-    uint8_t msg_parse_buf[ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_MAX_MSG_SIZE];
-
 };
-
@@ -13,6 +13,7 @@ using namespace ublox;
 int main() {
   LOGW("starting ubloxd");
   AlignedBuffer aligned_buf;
+  UbloxFramer framer;
   UbloxMsgParser parser;
 
   PubMaster pm({"ubloxGnss", "gpsLocationExternal"});
@@ -36,28 +37,19 @@ int main() {
     cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
     auto ubloxRaw = event.getUbloxRaw();
 
-    const uint8_t *data = ubloxRaw.begin();
-    size_t len = ubloxRaw.size();
-    size_t bytes_consumed = 0;
-
-    while(bytes_consumed < len && !do_exit) {
-      size_t bytes_consumed_this_time = 0U;
-      if(parser.add_data(data + bytes_consumed, (uint32_t)(len - bytes_consumed), bytes_consumed_this_time)) {
-
-        try {
-          auto msg = parser.gen_msg();
-          if (msg.second.size() > 0) {
-            auto bytes = msg.second.asBytes();
-            pm.send(msg.first.c_str(), bytes.begin(), bytes.size());
-          }
-        } catch (const std::exception& e) {
-          LOGE("Error parsing ublox message %s", e.what());
+    // boardd sends whole messages, older logs have them split anywhere
+    framer.add_data(ubloxRaw.begin(), ubloxRaw.size(), [&](const uint8_t *data, size_t len) {
+      try {
+        auto [service, event_msg] = parser.gen_msg(data, len);
+        if (event_msg.size() > 0) {
+          auto bytes = event_msg.asBytes();
+          pm.send(service.c_str(), bytes.begin(), bytes.size());
         }
-
-        parser.reset();
+      } catch (const std::exception& e) {
+        LOGE("Error parsing ublox message %s", e.what());
       }
-      bytes_consumed += bytes_consumed_this_time;
-    }
+    });
+
     delete msg;
   }
 
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+// Batches log entries into one androidLog message per LOGCATD_BATCH_MS, so a
+// noisy source doesn't turn into thousands of tiny messages. Each tag gets a
+// token bucket of LOGCATD_RATE entries/s with a burst of LOGCATD_BURST, what's
+// dropped by it is counted and sent in the next message.
+#define LOGCATD_BATCH_MS 100
+#define LOGCATD_RATE 50
+#define LOGCATD_BURST 200
+
+struct LogcatEntry {
+  uint8_t id = 0;
+  uint64_t ts = 0;
+  uint8_t priority = 0;
+  int32_t pid = 0, tid = 0;
+  std::string tag, message;
+};
+
+class LogcatBatcher {
+ public:
+  LogcatBatcher() : pm({"androidLog"}) {
+    rate = util::getenv("LOGCATD_RATE", LOGCATD_RATE);
+    burst = util::getenv("LOGCATD_BURST", LOGCATD_BURST);
+  }
+
+  // false if the entry's tag is over its rate
+  bool add(LogcatEntry &&entry) {
+    const uint64_t now = nanos_since_boot();
+    Bucket &b = buckets[entry.tag];
+    if (b.last == 0) b.tokens = burst;
+    b.tokens = std::min<double>(burst, b.tokens + (now - b.last) * 1e-9 * rate);
+    b.last = now;
+    if (b.tokens < 1.) {
+      b.suppressed++;
+      return false;
+    }
+    b.tokens -= 1.;
+    entries.push_back(std::move(entry));
+    return true;
+  }
+
+  // ms until the next flush is due
+  int until_flush() const {
+    return std::max<int>(0, LOGCATD_BATCH_MS - (int)((nanos_since_boot() - last_flush) / 1000000));
+  }
+
+  void flush() {
+    last_flush = nanos_since_boot();
+
+    std::vector<std::pair<std::string, uint32_t>> suppressed;
+    for (auto it = buckets.begin(); it != buckets.end();) {
+      if (it->second.suppressed > 0) {
+        suppressed.push_back({it->first, it->second.suppressed});
+        it->second.suppressed = 0;
+      }
+      // forget the tags that are quiet again
+      it = (it->second.tokens >= burst - 1 && last_flush - it->second.last > 60 * 1000000000ULL) ? buckets.erase(it) : std::next(it);
+    }
+    if (entries.empty() && suppressed.empty()) return;
+
+    MessageBuilder msg;
+    auto android_log = msg.initEvent().initAndroidLog();
+    auto list = android_log.initEntries(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+      const LogcatEntry &e = entries[i];
+      list[i].setId(e.id);
+      list[i].setTs(e.ts);
+      list[i].setPriority(e.priority);
+      list[i].setPid(e.pid);
+      list[i].setTid(e.tid);
+      list[i].setTag(e.tag);
+      list[i].setMessage(e.message);
+    }
+    auto suppressed_list = android_log.initSuppressed(suppressed.size());
+    for (size_t i = 0; i < suppressed.size(); i++) {
+      suppressed_list[i].setTag(suppressed[i].first);
+      suppressed_list[i].setCount(suppressed[i].second);
+    }
+    pm.send("androidLog", msg);
+    entries.clear();
+  }
+
+  void flush_if_due() {
+    if (until_flush() == 0) flush();
+  }
+
+ private:
+  struct Bucket {
+    double tokens = 0;
+    uint64_t last = 0;
+    uint32_t suppressed = 0;
+  };
+
+  PubMaster pm;
+  int rate, burst;
+  uint64_t last_flush = 0;
+  std::vector<LogcatEntry> entries;
+  std::map<std::string, Bucket> buckets;
+};
@@ -5,14 +5,18 @@
 #include <log/logger.h>
 #include <log/logprint.h>
 
-#include "cereal/messaging/messaging.h"
 #include "selfdrive/common/util.h"
+#include "selfdrive/logcatd/logcat_batch.h"
+
+// entries below LOGCATD_MIN_PRIORITY aren't sent
+#define LOGCATD_MIN_PRIORITY ANDROID_LOG_INFO
 
 int main() {
   setpriority(PRIO_PROCESS, 0, -15);
 
   ExitHandler do_exit;
-  PubMaster pm({"androidLog"});
+  LogcatBatcher batcher;
+  const int min_priority = util::getenv("LOGCATD_MIN_PRIORITY", LOGCATD_MIN_PRIORITY);
 
   log_time last_log_time = {};
   logger_list *logger_list = android_logger_list_alloc(ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 0, 0);
@@ -36,6 +40,8 @@ int main() {
     assert(kernel_logger);
 
     while (!do_exit) {
+      batcher.flush_if_due();
+
       log_msg log_msg;
       int err = android_logger_list_read(logger_list, &log_msg);
       if (err <= 0) break;
@@ -45,19 +51,13 @@ int main() {
       if (err < 0) continue;
       last_log_time.tv_sec = entry.tv_sec;
       last_log_time.tv_nsec = entry.tv_nsec;
+      if (entry.priority < min_priority) continue;
 
-      MessageBuilder msg;
-      auto androidEntry = msg.initEvent().initAndroidLog();
-      androidEntry.setId(log_msg.id());
-      androidEntry.setTs(entry.tv_sec * 1000000000ULL + entry.tv_nsec);
-      androidEntry.setPriority(entry.priority);
-      androidEntry.setPid(entry.pid);
-      androidEntry.setTid(entry.tid);
-      androidEntry.setTag(entry.tag);
-      androidEntry.setMessage(entry.message);
-
-      pm.send("androidLog", msg);
+      batcher.add({.id = log_msg.id(), .ts = entry.tv_sec * 1000000000ULL + entry.tv_nsec,
+                   .priority = (uint8_t)entry.priority, .pid = entry.pid, .tid = entry.tid,
+                   .tag = entry.tag, .message = entry.message});
     }
+    batcher.flush();
 
     android_logger_list_free(logger_list);
     logger_list = NULL;
@@ -7,30 +7,39 @@
 
 #include "json11.hpp"
 
-#include "cereal/messaging/messaging.h"
-#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
+#include "selfdrive/logcatd/logcat_batch.h"
+
+// syslog priorities, 0 is emerg and 7 debug. Entries above LOGCATD_MAX_PRIORITY are filtered out by the journal
+#define LOGCATD_MAX_PRIORITY 6
 
 ExitHandler do_exit;
 int main(int argc, char *argv[]) {
 
-  PubMaster pm({"androidLog"});
+  LogcatBatcher batcher;
 
   sd_journal *journal;
   int err = sd_journal_open(&journal, 0);
   assert(err >= 0);
+  const int max_priority = util::getenv("LOGCATD_MAX_PRIORITY", LOGCATD_MAX_PRIORITY);
+  for (int p = 0; p <= max_priority; p++) {
+    err = sd_journal_add_match(journal, util::string_format("PRIORITY=%d", p).c_str(), 0);
+    assert(err >= 0);
+  }
   err = sd_journal_get_fd(journal); // needed so sd_journal_wait() works properly if files rotate
   assert(err >= 0);
   err = sd_journal_seek_tail(journal);
   assert(err >= 0);
 
   while (!do_exit) {
+    batcher.flush_if_due();
+
     err = sd_journal_next(journal);
     assert(err >= 0);
 
-    // Wait for new message if we didn't receive anything
+    // Wait for new message if we didn't receive anything, at most until the next batch is due
     if (err == 0) {
-      err = sd_journal_wait(journal, 1000 * 1000);
+      err = sd_journal_wait(journal, batcher.until_flush() * 1000 + 1000);
       assert (err >= 0);
       continue; // Try again
     }
@@ -53,19 +62,16 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    MessageBuilder msg;
-
-    // Build message
-    auto androidEntry = msg.initEvent().initAndroidLog();
-    androidEntry.setTs(timestamp);
-    androidEntry.setMessage(json11::Json(kv).dump());
-    if (kv.count("_PID")) androidEntry.setPid(std::atoi(kv["_PID"].c_str()));
-    if (kv.count("PRIORITY")) androidEntry.setPriority(std::atoi(kv["PRIORITY"].c_str()));
-    if (kv.count("SYSLOG_IDENTIFIER")) androidEntry.setTag(kv["SYSLOG_IDENTIFIER"]);
-
-    pm.send("androidLog", msg);
+    LogcatEntry entry;
+    entry.ts = timestamp;
+    if (kv.count("_PID")) entry.pid = std::atoi(kv["_PID"].c_str());
+    if (kv.count("PRIORITY")) entry.priority = std::atoi(kv["PRIORITY"].c_str());
+    if (kv.count("SYSLOG_IDENTIFIER")) entry.tag = kv["SYSLOG_IDENTIFIER"];
+    entry.message = json11::Json(kv).dump();
+    batcher.add(std::move(entry));
   }
 
+  batcher.flush();
   sd_journal_close(journal);
   return 0;
 }
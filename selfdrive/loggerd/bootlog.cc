@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cstdlib>
 #include <string>
 
 #include "cereal/messaging/messaging.h"
@@ -36,20 +37,21 @@ static kj::Array<capnp::word> build_boot_log() {
 
 int main(int argc, char** argv) {
 
-  const std::string path = LOG_ROOT + "/boot/" + logger_get_route_name() + ".bz2";
+  const LogCompressionConfig compression = log_compression_parse(getenv("LOGGERD_LOG_COMPRESSION"), LOG_COMPRESSION_DEFAULT);
+  const std::string path = LOG_ROOT + "/boot/" + logger_get_route_name() + "." + log_compression_extension(compression.type);
   LOGW("bootlog to %s", path.c_str());
 
   // Open bootlog
   int r = logger_mkpath((char*)path.c_str());
   assert(r == 0);
 
-  BZFile bz_file(path.c_str());
+  std::unique_ptr<LogFile> log_file = log_file_open(path.c_str(), compression);
 
   // Write initdata
-  bz_file.write(logger_build_init_data().asBytes());
+  log_file->write(logger_build_init_data().asBytes());
 
   // Write bootlog
-  bz_file.write(build_boot_log().asBytes());
+  log_file->write(build_boot_log().asBytes());
 
   return 0;
 }
@@ -0,0 +1,249 @@
+#include "selfdrive/loggerd/column_logger.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+#include <capnp/serialize.h>
+#include <zlib.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/common/swaglog.h"
+
+namespace {
+
+struct DType {
+  capnp::schema::Type::Which type;
+  const char* descr;
+  size_t size;
+};
+
+const DType DTYPES[] = {
+  {capnp::schema::Type::BOOL, "|b1", 1},
+  {capnp::schema::Type::INT8, "|i1", 1},
+  {capnp::schema::Type::INT16, "<i2", 2},
+  {capnp::schema::Type::INT32, "<i4", 4},
+  {capnp::schema::Type::INT64, "<i8", 8},
+  {capnp::schema::Type::UINT8, "|u1", 1},
+  {capnp::schema::Type::UINT16, "<u2", 2},
+  {capnp::schema::Type::UINT32, "<u4", 4},
+  {capnp::schema::Type::UINT64, "<u8", 8},
+  {capnp::schema::Type::FLOAT32, "<f4", 4},
+  {capnp::schema::Type::FLOAT64, "<f8", 8},
+  {capnp::schema::Type::ENUM, "<u2", 2},
+};
+
+template <class T>
+void put(std::vector<uint8_t>& data, T v) {
+  const uint8_t* p = (const uint8_t*)&v;
+  data.insert(data.end(), p, p + sizeof(v));
+}
+
+// .npy of a 1d array
+std::vector<uint8_t> npy(const char* descr, size_t elem_size, const std::vector<uint8_t>& data) {
+  std::string header = "{'descr': '" + std::string(descr) + "', 'fortran_order': False, 'shape': (" +
+                       std::to_string(data.size() / elem_size) + ",), }";
+  // magic, version and length take 10 bytes, the header ends in a newline at a multiple of 64
+  header.append(63 - (10 + header.size()) % 64, ' ');
+  header += '\n';
+
+  std::vector<uint8_t> out = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0};
+  put(out, (uint16_t)header.size());
+  out.insert(out.end(), header.begin(), header.end());
+  out.insert(out.end(), data.begin(), data.end());
+  return out;
+}
+
+// .npz is an uncompressed zip of .npy files
+bool write_npz(const std::string& path, const std::vector<std::pair<std::string, std::vector<uint8_t>>>& arrays) {
+  std::vector<uint8_t> out, central;
+  for (auto& [name, data] : arrays) {
+    const std::string fn = name + ".npy";
+    const uint32_t crc = crc32(0, data.data(), data.size());
+    const uint32_t offset = out.size();
+
+    put(out, (uint32_t)0x04034b50);
+    put(out, (uint16_t)20);  // version needed
+    put(out, (uint16_t)0);   // flags
+    put(out, (uint16_t)0);   // stored
+    put(out, (uint16_t)0);   // time
+    put(out, (uint16_t)0x21);  // date, 1980-01-01
+    put(out, crc);
+    put(out, (uint32_t)data.size());
+    put(out, (uint32_t)data.size());
+    put(out, (uint16_t)fn.size());
+    put(out, (uint16_t)0);
+    out.insert(out.end(), fn.begin(), fn.end());
+    out.insert(out.end(), data.begin(), data.end());
+
+    put(central, (uint32_t)0x02014b50);
+    put(central, (uint16_t)20);  // version made by
+    put(central, (uint16_t)20);  // version needed
+    put(central, (uint16_t)0);
+    put(central, (uint16_t)0);
+    put(central, (uint16_t)0);
+    put(central, (uint16_t)0x21);
+    put(central, crc);
+    put(central, (uint32_t)data.size());
+    put(central, (uint32_t)data.size());
+    put(central, (uint16_t)fn.size());
+    put(central, (uint16_t)0);  // extra
+    put(central, (uint16_t)0);  // comment
+    put(central, (uint16_t)0);  // disk
+    put(central, (uint16_t)0);  // internal attributes
+    put(central, (uint32_t)0);  // external attributes
+    put(central, offset);
+    central.insert(central.end(), fn.begin(), fn.end());
+  }
+
+  const uint32_t central_offset = out.size();
+  out.insert(out.end(), central.begin(), central.end());
+  put(out, (uint32_t)0x06054b50);
+  put(out, (uint16_t)0);
+  put(out, (uint16_t)0);
+  put(out, (uint16_t)arrays.size());
+  put(out, (uint16_t)arrays.size());
+  put(out, (uint32_t)central.size());
+  put(out, central_offset);
+  put(out, (uint16_t)0);
+
+  // written under a temporary name so the uploader never sees a partial file
+  const std::string tmp_path = path + ".tmp";
+  FILE* f = fopen(tmp_path.c_str(), "wb");
+  if (f == nullptr) return false;
+  bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+  ok = (fclose(f) == 0) && ok;
+  return ok && rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+}  // namespace
+
+ColumnLogger::ColumnLogger(const std::vector<ColumnSpec>& specs) {
+  const capnp::StructSchema event_schema = capnp::Schema::from<cereal::Event>();
+
+  for (auto& spec : specs) {
+    Service service = {.field = event_schema.getFieldByName(spec.service), .name = spec.service};
+
+    for (const char* field_path : spec.fields) {
+      Column col = {.name = std::string(spec.service) + "." + field_path};
+      capnp::Type type = service.field.getType();
+
+      // walk "a.b[1].c" down from the service struct
+      const std::string path = field_path;
+      for (size_t start = 0; start <= path.size();) {
+        size_t end = path.find('.', start);
+        if (end == std::string::npos) end = path.size();
+        std::string token = path.substr(start, end - start);
+        start = end + 1;
+
+        int index = -1;
+        if (size_t bracket = token.find('['); bracket != std::string::npos) {
+          index = atoi(token.c_str() + bracket + 1);
+          token = token.substr(0, bracket);
+        }
+
+        assert(type.isStruct());
+        capnp::StructSchema::Field field = type.asStruct().getFieldByName(token);
+        type = field.getType();
+        if (index >= 0) {
+          assert(type.isList());
+          type = type.asList().getElementType();
+        }
+        col.path.push_back({field, index});
+      }
+
+      col.type = type.which();
+      for (auto& d : DTYPES) {
+        if (d.type == col.type) {
+          col.dtype = d.descr;
+          col.elem_size = d.size;
+        }
+      }
+      assert(col.dtype != nullptr);
+      service.columns.push_back(std::move(col));
+    }
+    services.push_back(std::move(service));
+  }
+}
+
+int ColumnLogger::service_index(const char* service) const {
+  for (int i = 0; i < services.size(); i++) {
+    if (services[i].name == service) return i;
+  }
+  return -1;
+}
+
+void ColumnLogger::log(int service, kj::ArrayPtr<const capnp::word> data) {
+  Service& s = services[service];
+  try {
+    capnp::FlatArrayMessageReader msg(data);
+    cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+    capnp::DynamicStruct::Reader dyn = capnp::toDynamic(event);
+    KJ_IF_MAYBE(which, dyn.which()) {
+      if (*which != s.field) return;
+    } else {
+      return;
+    }
+
+    capnp::DynamicStruct::Reader reader = dyn.get(s.field).as<capnp::DynamicStruct>();
+    s.mono_times.push_back(event.getLogMonoTime());
+    for (auto& col : s.columns) {
+      append(col, reader);
+    }
+  } catch (const kj::Exception& e) {
+    LOGE("column logger: %s %s", s.name.c_str(), e.getDescription().cStr());
+  }
+}
+
+void ColumnLogger::append(Column& col, capnp::DynamicStruct::Reader reader) {
+  capnp::DynamicValue::Reader v = reader;
+  bool present = true;
+  for (auto& step : col.path) {
+    v = v.as<capnp::DynamicStruct>().get(step.field);
+    if (step.index >= 0) {
+      capnp::DynamicList::Reader list = v.as<capnp::DynamicList>();
+      if (step.index >= list.size()) {
+        present = false;
+        break;
+      }
+      v = list[step.index];
+    }
+  }
+
+  // missing list elements become NaN or 0 so every column lines up with logMonoTime
+  switch (col.type) {
+    case capnp::schema::Type::BOOL: put(col.data, (uint8_t)(present && v.as<bool>())); break;
+    case capnp::schema::Type::INT8: put(col.data, present ? v.as<int8_t>() : (int8_t)0); break;
+    case capnp::schema::Type::INT16: put(col.data, present ? v.as<int16_t>() : (int16_t)0); break;
+    case capnp::schema::Type::INT32: put(col.data, present ? v.as<int32_t>() : (int32_t)0); break;
+    case capnp::schema::Type::INT64: put(col.data, present ? v.as<int64_t>() : (int64_t)0); break;
+    case capnp::schema::Type::UINT8: put(col.data, present ? v.as<uint8_t>() : (uint8_t)0); break;
+    case capnp::schema::Type::UINT16: put(col.data, present ? v.as<uint16_t>() : (uint16_t)0); break;
+    case capnp::schema::Type::UINT32: put(col.data, present ? v.as<uint32_t>() : (uint32_t)0); break;
+    case capnp::schema::Type::UINT64: put(col.data, present ? v.as<uint64_t>() : (uint64_t)0); break;
+    case capnp::schema::Type::FLOAT32: put(col.data, present ? v.as<float>() : std::numeric_limits<float>::quiet_NaN()); break;
+    case capnp::schema::Type::FLOAT64: put(col.data, present ? v.as<double>() : std::numeric_limits<double>::quiet_NaN()); break;
+    case capnp::schema::Type::ENUM: put(col.data, present ? v.as<capnp::DynamicEnum>().getRaw() : (uint16_t)0); break;
+    default: break;
+  }
+}
+
+void ColumnLogger::write(const std::string& segment_path) {
+  std::vector<std::pair<std::string, std::vector<uint8_t>>> arrays;
+  for (auto& s : services) {
+    if (s.mono_times.empty()) continue;
+
+    std::vector<uint8_t> times((const uint8_t*)s.mono_times.data(), (const uint8_t*)(s.mono_times.data() + s.mono_times.size()));
+    arrays.push_back({s.name + ".logMonoTime", npy("<u8", sizeof(uint64_t), times)});
+    for (auto& col : s.columns) {
+      arrays.push_back({col.name, npy(col.dtype, col.elem_size, col.data)});
+      col.data.clear();
+    }
+    s.mono_times.clear();
+  }
+
+  if (!arrays.empty() && !write_npz(segment_path + "/columns.npz", arrays)) {
+    LOGE("failed to write columns to %s", segment_path.c_str());
+  }
+}
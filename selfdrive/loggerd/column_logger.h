@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <capnp/dynamic.h>
+#include <capnp/schema.h>
+#include <kj/array.h>
+
+// Selected scalar fields of one service. A field is a dotted path below the
+// service, list elements are picked with an index: "leadsV3[0].prob"
+struct ColumnSpec {
+  const char* service;
+  std::vector<const char*> fields;
+};
+
+// Collects the fields of every segment into typed columns and writes them as
+// columns.npz next to the rlog, one array per field plus "<service>.logMonoTime".
+// numpy loads it directly: np.load("columns.npz")["carState.vEgo"]
+class ColumnLogger {
+ public:
+  ColumnLogger(const std::vector<ColumnSpec>& specs);
+  // index into specs of the service, or -1 if none of its fields are logged
+  int service_index(const char* service) const;
+  void log(int service, kj::ArrayPtr<const capnp::word> data);
+  // writes the columns collected so far to segment_path and starts over
+  void write(const std::string& segment_path);
+
+ private:
+  struct Step {
+    capnp::StructSchema::Field field;
+    int index;  // list element, -1 for plain fields
+  };
+  struct Column {
+    std::string name;
+    std::vector<Step> path;
+    capnp::schema::Type::Which type;
+    const char* dtype;
+    size_t elem_size;
+    std::vector<uint8_t> data;
+  };
+  struct Service {
+    capnp::StructSchema::Field field;
+    std::string name;
+    std::vector<uint64_t> mono_times;
+    std::vector<Column> columns;
+  };
+
+  void append(Column& col, capnp::DynamicStruct::Reader reader);
+  std::vector<Service> services;
+};
@@ -4,7 +4,7 @@ import shutil
 import threading
 from selfdrive.swaglog import cloudlog
 from selfdrive.loggerd.config import ROOT, get_available_bytes, get_available_percent
-from selfdrive.loggerd.uploader import listdir_by_creation
+from selfdrive.loggerd.uploader import ROUTE_FILE_EXTS, listdir_by_creation
 
 MIN_BYTES = 5 * 1024 * 1024 * 1024
 MIN_PERCENT = 10
@@ -29,6 +29,15 @@ def deleter_thread(exit_event):
         try:
           cloudlog.info("deleting %s" % delete_path)
           shutil.rmtree(delete_path)
+
+          # the route's manifest and index go with its last segment
+          route = delete_dir.rpartition('--')[0]
+          if route and not any(d.startswith(route + '--') for d in dirs if d != delete_dir):
+            for ext in ROUTE_FILE_EXTS:
+              try:
+                os.unlink(os.path.join(ROOT, route + ext))
+              except FileNotFoundError:
+                pass
           break
         except OSError:
           cloudlog.exception("issue deleting %s" % delete_path)
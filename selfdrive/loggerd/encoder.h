@@ -1,6 +1,24 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+
+// How a camera is encoded. loggerd starts from the camera's LogCameraInfo and
+// applies overrides from the EncoderProfiles param
+struct EncoderProfile {
+  bool h265;
+  int bitrate;
+  bool cbr;                   // constant bitrate, otherwise variable
+  int gop;                    // frames from one IDR frame to the next, 0 keeps the encoder default
+  int bframes;                // B frames between two P frames
+  bool idr_at_segment_start;  // every segment file starts with an IDR frame and decodes on its own
+  int intra_refresh_mbs;      // macroblocks per frame of cyclic intra refresh, 0 for off
+};
+
+// An encoded packet as it comes out of the encoder, with the timestamp of its frame in us.
+// Codec config packets hold the parameter sets and no frame
+typedef std::function<void(const uint8_t *data, size_t size, uint64_t ts_us, bool config, bool keyframe)> EncoderPacketCallback;
 
 class VideoEncoder {
 public:
@@ -9,4 +27,8 @@ public:
                            int in_width, int in_height, uint64_t ts) = 0;
   virtual void encoder_open(const char* path) = 0;
   virtual void encoder_close() = 0;
+  // changes the target bitrate of the running encoder, lossless encoders ignore it
+  virtual void set_bitrate(int bitrate) {}
+  // also hands every encoded packet to cb, encoders that only write files ignore it
+  virtual void set_packet_callback(EncoderPacketCallback cb) {}
 };
@@ -0,0 +1,371 @@
+#include "selfdrive/loggerd/file_sink.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define FILE_SINK_URING
+#endif
+
+FileWriteStats file_write_stats;
+
+void file_preallocate(int fd, uint64_t size) {
+#ifdef __linux__
+  if (size > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+    LOGD("fallocate of %lu bytes failed: %s", (unsigned long)size, strerror(errno));
+  }
+#endif
+}
+
+void file_release_unused(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) == 0 && ftruncate(fd, st.st_size) != 0) {
+    LOGE("failed to truncate file: %s", strerror(errno));
+  }
+}
+
+FileSink::FileSink(const char *path) {
+#ifdef O_DIRECT
+  fd = HANDLE_EINTR(open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0664));
+  direct = fd >= 0;
+#endif
+  if (fd < 0) {
+    // not every filesystem supports O_DIRECT
+    fd = HANDLE_EINTR(open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664));
+  }
+  if (fd < 0) {
+    LOGE("failed to open %s: %s", path, strerror(errno));
+    return;
+  }
+
+  chunks.reserve(FILE_SINK_CHUNKS);
+  if (!direct || !uring_init()) {
+    thread = std::thread(&FileSink::thread_loop, this);
+  }
+}
+
+FileSink::~FileSink() {
+  close();
+  for (auto &c : chunks) {
+    free(c.data);
+  }
+}
+
+void FileSink::preallocate(uint64_t size) {
+  if (fd < 0) return;
+  file_preallocate(fd, size);
+  preallocated = true;
+}
+
+void FileSink::write(const void *data, size_t size) {
+  if (fd < 0) return;
+
+  const uint8_t *p = (const uint8_t *)data;
+  crc = crc32(crc, p, size);
+  while (size > 0) {
+    if (cur == nullptr) {
+      cur = acquire();
+      cur->size = 0;
+      cur->offset = offset;
+    }
+    const size_t n = std::min(size, FILE_SINK_CHUNK_SIZE - cur->size);
+    memcpy(cur->data + cur->size, p, n);
+    cur->size += n;
+    offset += n;
+    p += n;
+    size -= n;
+    if (cur->size == FILE_SINK_CHUNK_SIZE) {
+      submit();
+    }
+  }
+}
+
+void FileSink::close() {
+  if (fd < 0) return;
+
+  if (cur != nullptr && cur->size > 0) {
+    submit();
+  }
+  if (uring) {
+    while (uring_reap(true)) {}
+  } else {
+    {
+      std::lock_guard lk(lock);
+      exit = true;
+    }
+    cv.notify_all();
+    thread.join();
+  }
+
+  // the last chunk was padded to the block size, and the reservation may go past the end
+  if ((direct || preallocated) && ftruncate(fd, offset) != 0) {
+    LOGE("failed to truncate file: %s", strerror(errno));
+  }
+  fsync(fd);
+  ::close(fd);
+  fd = -1;
+
+  if (uring) uring_close();
+
+  if (stalls > 0) {
+    LOGW("file sink stalled %lu times", (unsigned long)stalls);
+  }
+}
+
+void FileSink::submit() {
+  Chunk *c = cur;
+  cur = nullptr;
+
+  if (direct) {
+    const size_t padded = (c->size + FILE_SINK_ALIGN - 1) / FILE_SINK_ALIGN * FILE_SINK_ALIGN;
+    memset(c->data + c->size, 0, padded - c->size);
+    c->size = padded;
+  }
+
+  if (uring) {
+    uring_submit(c);
+  } else {
+    {
+      std::lock_guard lk(lock);
+      queue.push_back(c);
+    }
+    cv.notify_all();
+  }
+}
+
+FileSink::Chunk *FileSink::acquire() {
+  if (uring) uring_reap(false);
+
+  std::unique_lock lk(lock);
+  if (free_chunks.empty() && chunks.size() < FILE_SINK_CHUNKS) {
+    // chunks are only allocated once the disk falls behind
+    Chunk c = {};
+    int err = posix_memalign((void **)&c.data, FILE_SINK_ALIGN, FILE_SINK_CHUNK_SIZE);
+    assert(err == 0);
+    chunks.push_back(c);
+    return &chunks.back();
+  }
+
+  if (free_chunks.empty()) {
+    stalls++;
+    file_write_stats.stalls++;
+    if (uring) {
+      while (free_chunks.empty()) {
+        lk.unlock();
+        uring_reap(true);
+        lk.lock();
+      }
+    } else {
+      cv.wait(lk, [&] { return !free_chunks.empty(); });
+    }
+  }
+  Chunk *c = free_chunks.back();
+  free_chunks.pop_back();
+  return c;
+}
+
+void FileSink::release(Chunk *c) {
+  {
+    std::lock_guard lk(lock);
+    free_chunks.push_back(c);
+  }
+  cv.notify_all();
+}
+
+void FileSink::write_chunk(Chunk *c) {
+  const uint64_t start_ns = nanos_since_boot();
+  size_t written = 0;
+  while (written < c->size) {
+    ssize_t ret = HANDLE_EINTR(pwrite(fd, c->data + written, c->size - written, c->offset + written));
+    if (ret <= 0) {
+      if (!error_logged) {
+        LOGE("file sink write failed: %s", strerror(errno));
+        error_logged = true;
+      }
+      return;
+    }
+    written += ret;
+  }
+  file_write_stats.add(written, (nanos_since_boot() - start_ns) / 1000);
+
+#ifdef __linux__
+  // start writeback of what was just written, then wait for the previous range
+  // and drop it from the page cache
+  const uint64_t end = c->offset + c->size;
+  if (!direct && end - synced >= FILE_SINK_SYNC_BYTES) {
+    sync_file_range(fd, synced, end - synced, SYNC_FILE_RANGE_WRITE);
+    if (synced > 0) {
+      sync_file_range(fd, 0, synced, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+      posix_fadvise(fd, 0, synced, POSIX_FADV_DONTNEED);
+    }
+    synced = end;
+  }
+#endif
+}
+
+void FileSink::thread_loop() {
+  set_thread_name("file_sink");
+  while (true) {
+    Chunk *c;
+    {
+      std::unique_lock lk(lock);
+      cv.wait(lk, [&] { return exit || !queue.empty(); });
+      if (queue.empty()) break;
+      c = queue.front();
+      queue.pop_front();
+    }
+    write_chunk(c);
+    release(c);
+  }
+}
+
+// ***** io_uring *****
+// raw syscalls, liburing isn't available on every target
+
+#ifdef FILE_SINK_URING
+
+struct FileSink::Uring {
+  int fd;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_len, cq_len, sqes_len;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  io_uring_sqe *sqes;
+  io_uring_cqe *cqes;
+  int inflight;
+  struct iovec iov[FILE_SINK_CHUNKS];
+};
+
+bool FileSink::uring_init() {
+  io_uring_params p = {};
+  int ring_fd = syscall(__NR_io_uring_setup, FILE_SINK_CHUNKS, &p);
+  if (ring_fd < 0) return false;
+
+  Uring *u = new Uring{.fd = ring_fd};
+  u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  u->sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+  u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+  void *sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (u->sq_ptr == MAP_FAILED || u->cq_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+    if (u->sq_ptr != MAP_FAILED) munmap(u->sq_ptr, u->sq_len);
+    if (u->cq_ptr != MAP_FAILED) munmap(u->cq_ptr, u->cq_len);
+    if (sqes != MAP_FAILED) munmap(sqes, u->sqes_len);
+    ::close(ring_fd);
+    delete u;
+    return false;
+  }
+
+  uint8_t *sq = (uint8_t *)u->sq_ptr, *cq = (uint8_t *)u->cq_ptr;
+  u->sq_head = (unsigned *)(sq + p.sq_off.head);
+  u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(sq + p.sq_off.array);
+  u->cq_head = (unsigned *)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+  u->sqes = (io_uring_sqe *)sqes;
+  uring = u;
+  return true;
+}
+
+void FileSink::uring_submit(Chunk *c) {
+  Uring *u = uring;
+  const size_t idx = c - chunks.data();
+  u->iov[idx] = {.iov_base = c->data, .iov_len = c->size};
+
+  const unsigned tail = *u->sq_tail;
+  const unsigned slot = tail & *u->sq_mask;
+  io_uring_sqe *sqe = &u->sqes[slot];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->off = c->offset;
+  sqe->addr = (uint64_t)&u->iov[idx];
+  sqe->len = 1;
+  sqe->user_data = (uint64_t)c;
+  c->submit_ns = nanos_since_boot();
+  u->sq_array[slot] = slot;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  int ret = HANDLE_EINTR(syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0));
+  if (ret != 1) {
+    // the ring is sized for every chunk, this only fails if the kernel rejects the write
+    LOGE("io_uring submit failed: %s", strerror(errno));
+    __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+    write_chunk(c);
+    release(c);
+    return;
+  }
+  u->inflight++;
+}
+
+void FileSink::uring_close() {
+  munmap(uring->sq_ptr, uring->sq_len);
+  munmap(uring->cq_ptr, uring->cq_len);
+  munmap(uring->sqes, uring->sqes_len);
+  ::close(uring->fd);
+  delete uring;
+  uring = nullptr;
+}
+
+// returns false once nothing is in flight
+bool FileSink::uring_reap(bool wait) {
+  Uring *u = uring;
+  if (u->inflight == 0) return false;
+
+  unsigned head = *u->cq_head;
+  if (wait && head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+    HANDLE_EINTR(syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0));
+  }
+
+  for (; head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE); head++) {
+    io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+    Chunk *c = (Chunk *)cqe->user_data;
+    file_write_stats.add(std::max(cqe->res, 0), (nanos_since_boot() - c->submit_ns) / 1000);
+    if (cqe->res != (int)c->size) {
+      // short or failed write, finish it synchronously
+      const size_t done = std::max(cqe->res, 0);
+      c->data += done;
+      c->offset += done;
+      c->size -= done;
+      write_chunk(c);
+      c->data -= done;
+    }
+    u->inflight--;
+    release(c);
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+  return u->inflight > 0;
+}
+
+#else
+
+struct FileSink::Uring {};
+
+bool FileSink::uring_init() { return false; }
+void FileSink::uring_submit(Chunk *c) {}
+bool FileSink::uring_reap(bool wait) { return false; }
+void FileSink::uring_close() {}
+
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define FILE_SINK_CHUNK_SIZE (1024 * 1024)
+#define FILE_SINK_CHUNKS 8
+#define FILE_SINK_ALIGN 4096
+// buffered files start writeback every this many bytes and drop the range before from the page cache
+#define FILE_SINK_SYNC_BYTES (8 * 1024 * 1024)
+
+// Disk writes of every FileSink and log file in the process, loggerd watches
+// these to notice a disk that can't keep up
+struct FileWriteStats {
+  std::atomic<uint64_t> bytes = 0, writes = 0, write_us = 0, max_write_us = 0;
+  std::atomic<uint64_t> stalls = 0;  // writers that had to wait for the disk
+
+  void add(size_t size, uint64_t us) {
+    bytes += size;
+    writes++;
+    write_us += us;
+    uint64_t max = max_write_us.load();
+    while (us > max && !max_write_us.compare_exchange_weak(max, us)) {}
+  }
+};
+extern FileWriteStats file_write_stats;
+
+// Reserves size bytes for a file that is about to grow by appends, without
+// changing its size, so it ends up in few extents instead of one per write.
+// Best effort, file_release_unused gives back what wasn't written
+void file_preallocate(int fd, uint64_t size);
+// drops any space reserved past the end of the file
+void file_release_unused(int fd);
+
+// Append-only file written in large aligned chunks off the caller's thread.
+// write() only copies into the current chunk, full chunks go to io_uring when
+// the kernel has it and the file could be opened O_DIRECT, otherwise to a
+// writer thread. Buffered files are flushed with sync_file_range as they grow,
+// so the page cache never builds up a large burst of dirty pages.
+// One thread writes, close() may be called from another one afterwards.
+class FileSink {
+public:
+  FileSink(const char *path);
+  ~FileSink();
+  bool is_open() const { return fd >= 0; }
+  // reserves the expected size of the file, the unused rest is released on close
+  void preallocate(uint64_t size);
+  void write(const void *data, size_t size);
+  // flushes, fsyncs and closes the file, blocks until all chunks are written
+  void close();
+  uint64_t size() const { return offset; }
+  uint32_t checksum() const { return crc; }  // CRC-32 of everything written
+
+  uint64_t stalls = 0;  // writes that waited for a free chunk
+
+private:
+  struct Chunk {
+    uint8_t *data;
+    size_t size;
+    uint64_t offset;
+    uint64_t submit_ns;
+  };
+
+  void submit();
+  Chunk *acquire();
+  void write_chunk(Chunk *c);
+  void release(Chunk *c);
+  void thread_loop();
+  bool uring_init();
+  void uring_submit(Chunk *c);
+  bool uring_reap(bool wait);
+  void uring_close();
+
+  int fd = -1;
+  bool direct = false, preallocated = false;
+  uint64_t offset = 0, synced = 0;
+  uint32_t crc = 0;
+  bool error_logged = false;
+  std::vector<Chunk> chunks;
+  Chunk *cur = nullptr;
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::vector<Chunk *> free_chunks;
+  std::deque<Chunk *> queue;
+  bool exit = false;
+  std::thread thread;
+
+  struct Uring;
+  Uring *uring = nullptr;
+};
@@ -0,0 +1,139 @@
+#include "selfdrive/loggerd/frame_reader.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+}
+
+#include "libyuv.h"
+#include "selfdrive/common/swaglog.h"
+
+static AVPixelFormat get_hw_format(AVCodecContext* ctx, const AVPixelFormat* fmts) {
+  AVPixelFormat hw_pix_fmt = *(AVPixelFormat*)ctx->opaque;
+  for (const AVPixelFormat* p = fmts; *p != AV_PIX_FMT_NONE; p++) {
+    if (*p == hw_pix_fmt) return *p;
+  }
+  LOGW("hardware decoding unavailable, falling back to software");
+  return fmts[0];
+}
+
+FrameReader::~FrameReader() {
+  for (AVPacket* pkt : packets) av_packet_free(&pkt);
+  av_frame_free(&frame);
+  av_frame_free(&sw_frame);
+  avcodec_free_context(&ctx);
+  av_buffer_unref(&hw_device);
+}
+
+bool FrameReader::open_decoder(const AVCodecParameters* par, bool hw_decode) {
+  const AVCodec* codec = avcodec_find_decoder(par->codec_id);
+  if (!codec) return false;
+  ctx = avcodec_alloc_context3(codec);
+  if (!ctx || avcodec_parameters_to_context(ctx, par) < 0) return false;
+  ctx->thread_count = 0;  // one per core
+  ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+  // the first device type the decoder has a config for, and that opens
+  for (int i = 0; hw_decode; i++) {
+    const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+    if (!config) break;
+    if (!(config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX)) continue;
+    if (av_hwdevice_ctx_create(&hw_device, config->device_type, nullptr, nullptr, 0) == 0) {
+      hw_pix_fmt = config->pix_fmt;
+      ctx->opaque = &hw_pix_fmt;
+      ctx->get_format = get_hw_format;
+      ctx->hw_device_ctx = av_buffer_ref(hw_device);
+      LOGD("decoding on %s", av_hwdevice_get_type_name(config->device_type));
+      break;
+    }
+  }
+
+  frame = av_frame_alloc();
+  sw_frame = av_frame_alloc();
+  return frame && sw_frame && avcodec_open2(ctx, codec, nullptr) == 0;
+}
+
+bool FrameReader::load(const std::string& path, bool hw_decode) {
+  AVFormatContext* fmt = nullptr;
+  // raw hevc isn't always probed right from the start of a segment
+  const bool hevc = path.size() > 5 && path.compare(path.size() - 5, 5, ".hevc") == 0;
+  const AVInputFormat* in_fmt = hevc ? av_find_input_format("hevc") : nullptr;
+  if (avformat_open_input(&fmt, path.c_str(), (AVInputFormat*)in_fmt, nullptr) != 0) return false;
+
+  bool ret = avformat_find_stream_info(fmt, nullptr) >= 0 && fmt->nb_streams > 0 &&
+             open_decoder(fmt->streams[0]->codecpar, hw_decode);
+  if (ret) {
+    width = ctx->width;
+    height = ctx->height;
+    AVPacket* pkt = av_packet_alloc();
+    while (av_read_frame(fmt, pkt) == 0) {
+      if (pkt->stream_index == 0) {
+        if (pkt->flags & AV_PKT_FLAG_KEY) keyframes.push_back(packets.size());
+        packets.push_back(av_packet_clone(pkt));
+      }
+      av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    if (keyframes.empty() || keyframes[0] != 0) keyframes.insert(keyframes.begin(), 0);
+  }
+  avformat_close_input(&fmt);
+  return ret && !packets.empty();
+}
+
+bool FrameReader::get(int idx, uint8_t* y, uint8_t* u, uint8_t* v) {
+  if (idx < 0 || idx >= size()) return false;
+
+  // start over from the keyframe before idx if the decoder is past it, or far before it
+  int key = *(std::upper_bound(keyframes.begin(), keyframes.end(), idx) - 1);
+  if (idx < out || key > out) {
+    avcodec_flush_buffers(ctx);
+    sent = out = key;
+  }
+
+  while (true) {
+    int ret = avcodec_receive_frame(ctx, frame);
+    if (ret == 0) {
+      if (out++ == idx) return copy_frame(frame, y, u, v);
+    } else if (ret == AVERROR(EAGAIN)) {
+      // a packet that doesn't decode gives no frame, the frames after it would be off by one
+      while (sent < size() && avcodec_send_packet(ctx, packets[sent]) < 0) {
+        LOGW("failed to decode packet %d", sent);
+        sent++;
+        out++;
+      }
+      if (sent < size()) {
+        sent++;
+      } else {
+        avcodec_send_packet(ctx, nullptr);  // drain the last frames
+      }
+    } else {
+      // drained, the next get starts over
+      avcodec_flush_buffers(ctx);
+      sent = out = size();
+      return false;
+    }
+  }
+}
+
+bool FrameReader::copy_frame(const AVFrame* f, uint8_t* y, uint8_t* u, uint8_t* v) {
+  if (f->format == hw_pix_fmt) {
+    av_frame_unref(sw_frame);
+    if (av_hwframe_transfer_data(sw_frame, f, 0) < 0) return false;
+    f = sw_frame;
+  }
+
+  switch (f->format) {
+    case AV_PIX_FMT_NV12:
+      return libyuv::NV12ToI420(f->data[0], f->linesize[0], f->data[1], f->linesize[1],
+                                y, width, u, width / 2, v, width / 2, width, height) == 0;
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+      return libyuv::I420Copy(f->data[0], f->linesize[0], f->data[1], f->linesize[1], f->data[2], f->linesize[2],
+                              y, width, u, width / 2, v, width / 2, width, height) == 0;
+    default:
+      LOGE("unsupported pixel format %d", f->format);
+      return false;
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Random access to the frames of a camera file, for replay. The packets are
+// read into memory on load, frames are decoded on get: in order they're
+// decoded one by one, a jump starts from the keyframe before the frame.
+// Decoding is on a hardware decoder when there is one, FFmpeg's otherwise.
+class FrameReader {
+ public:
+  FrameReader() = default;
+  FrameReader(const FrameReader&) = delete;
+  FrameReader& operator=(const FrameReader&) = delete;
+  ~FrameReader();
+
+  bool load(const std::string& path, bool hw_decode = true);
+  // frame idx as YUV420P into planes of width x height
+  bool get(int idx, uint8_t* y, uint8_t* u, uint8_t* v);
+
+  int size() const { return packets.size(); }
+  int width = 0, height = 0;
+
+ private:
+  bool open_decoder(const AVCodecParameters* par, bool hw_decode);
+  bool copy_frame(const AVFrame* f, uint8_t* y, uint8_t* u, uint8_t* v);
+
+  std::vector<AVPacket*> packets;  // in decode order, no B frames so that's the frame order
+  std::vector<int> keyframes;
+  AVCodecContext* ctx = nullptr;
+  AVBufferRef* hw_device = nullptr;
+  AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
+  AVFrame* frame = nullptr;
+  AVFrame* sw_frame = nullptr;
+  int sent = 0;  // next packet into the decoder
+  int out = 0;   // frame the decoder gives out next
+};
@@ -0,0 +1,69 @@
+// Cuts a time window and a set of services out of stored logs into a compact log, see log_extract.h
+//   ./log_cut <out.zst|.lz4|.bz2> <start> <end> [--services a,b] <log or segment dir>...
+// start and end are logMonoTime in seconds. Segment dirs stand for their rlog.
+#include <capnp/schema.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/log_extract.h"
+
+static const char *usage = "usage: %s <out.zst|.lz4|.bz2> <start> <end> [--services a,b] <log or segment dir>...\n";
+
+int main(int argc, char *argv[]) {
+  if (argc < 5) {
+    fprintf(stderr, usage, argv[0]);
+    return 1;
+  }
+
+  const std::string out = argv[1];
+  const uint64_t mono_start = atof(argv[2]) * 1e9, mono_end = atof(argv[3]) * 1e9;
+  const std::string ext = out.substr(out.rfind('.') + 1);
+  // compressed like qlogs, they're uploaded the same way
+  const LogCompressionConfig config = ext == "zst" ? QLOG_COMPRESSION_DEFAULT : log_compression_parse(ext.c_str(), QLOG_COMPRESSION_DEFAULT);
+  if (ext != log_compression_extension(config.type)) {
+    fprintf(stderr, "can't write .%s logs\n", ext.c_str());
+    return 1;
+  }
+
+  std::vector<unsigned int> services;
+  std::vector<std::string> logs;
+  auto event_struct = capnp::Schema::from<cereal::Event>().asStruct();
+  for (int i = 4; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--services" && i + 1 < argc) {
+      std::string list = argv[++i];
+      size_t start = 0;
+      while (start < list.size()) {
+        size_t end = std::min(list.find(',', start), list.size());
+        const std::string name = list.substr(start, end - start);
+        start = end + 1;
+        if (name.empty()) continue;
+        KJ_IF_MAYBE(field, event_struct.findFieldByName(name)) {
+          services.push_back(field->getProto().getDiscriminantValue());
+        } else {
+          fprintf(stderr, "unknown service %s\n", name.c_str());
+          return 1;
+        }
+      }
+      continue;
+    }
+
+    std::string log = arg;
+    for (const char *fn : {"rlog.zst", "rlog.lz4", "rlog.bz2", "rlog"}) {
+      if (util::file_exists(arg + "/" + fn)) {
+        log = arg + "/" + fn;
+        break;
+      }
+    }
+    logs.push_back(log);
+  }
+
+  const size_t count = log_extract(logs, out, mono_start, mono_end, services, config);
+  printf("%zu events written to %s\n", count, out.c_str());
+  return count > 0 ? 0 : 1;
+}
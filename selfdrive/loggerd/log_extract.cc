@@ -0,0 +1,37 @@
+#include "selfdrive/loggerd/log_extract.h"
+
+#include <memory>
+
+#include "selfdrive/loggerd/log_reader.h"
+
+size_t log_extract(const std::vector<std::string>& logs, const std::string& out, uint64_t mono_start, uint64_t mono_end,
+                   const std::vector<unsigned int>& services, LogCompressionConfig config) {
+  std::unique_ptr<LogFile> file = log_file_open(out.c_str(), config);
+  size_t count = 0, block_size = 0;
+  LogBlockInfo info;
+
+  for (const auto& path : logs) {
+    LogReader reader;
+    if (!reader.load(path, services, 0, mono_start, mono_end)) {
+      LOGW("failed to read %s", path.c_str());
+      continue;
+    }
+    for (size_t i = 0; i < reader.size(); i++) {
+      capnp::FlatArrayMessageReader msg(reader.event(i));
+      auto event = msg.getRoot<cereal::Event>();
+      info.add(event.getLogMonoTime(), (unsigned int)event.which());
+
+      auto bytes = reader.event(i).asBytes();
+      file->write((void*)bytes.begin(), bytes.size());
+      block_size += bytes.size();
+      count++;
+      if (block_size >= LOG_WRITER_CHUNK_SIZE) {
+        file->end_block(info);
+        info = LogBlockInfo();
+        block_size = 0;
+      }
+    }
+  }
+  if (block_size > 0) file->end_block(info);
+  return count;
+}
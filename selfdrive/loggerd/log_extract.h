@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "selfdrive/loggerd/logger.h"
+
+// Cuts a time window and a set of services out of stored logs, e.g. the 30 s
+// around a disengagement from a route's rlogs, for uploading instead of them.
+
+// Writes the events of services (all of them if it's empty) with logMonoTime in
+// [mono_start, mono_end] from logs, in order, to a new seekable log at out in
+// blocks of LOG_WRITER_CHUNK_SIZE. Of seekable logs only the blocks with such
+// events are read and decompressed. The number of events written
+size_t log_extract(const std::vector<std::string>& logs, const std::string& out, uint64_t mono_start, uint64_t mono_end,
+                   const std::vector<unsigned int>& services = {}, LogCompressionConfig config = QLOG_COMPRESSION_DEFAULT);
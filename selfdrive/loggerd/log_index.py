@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Reads the event index of seekable zstd and lz4 logs, see LOG_INDEX_MAGIC in logger.h"""
+import struct
+import sys
+from collections import namedtuple
+
+LOG_INDEX_MAGIC = 0x5844494C
+LOG_INDEX_VERSION = 1
+SKIPPABLE_MAGIC = 0x184D2A5D
+SEEKABLE_MAGIC = 0x8F92EAB1
+
+ENTRY = struct.Struct("<IIQQ4Q")
+FOOTER = struct.Struct("<III")
+
+Block = namedtuple("Block", ["offset", "compressed_size", "uncompressed_size", "mono_start", "mono_end", "services"])
+
+
+def read_index(path):
+  """Returns the blocks of a seekable log, or None if it has no index"""
+  with open(path, "rb") as f:
+    f.seek(0, 2)
+    end = f.tell()
+
+    # step over the zstd seek table, it follows the event index
+    if end >= 9:
+      f.seek(end - 9)
+      num_frames, _, magic = struct.unpack("<IBI", f.read(9))
+      if magic == SEEKABLE_MAGIC:
+        end -= 8 + num_frames * 8 + 9
+
+    if end < FOOTER.size:
+      return None
+    f.seek(end - FOOTER.size)
+    num_blocks, version, magic = FOOTER.unpack(f.read(FOOTER.size))
+    if magic != LOG_INDEX_MAGIC or version != LOG_INDEX_VERSION:
+      return None
+
+    size = num_blocks * ENTRY.size + FOOTER.size
+    f.seek(end - size - 8)
+    skippable_magic, frame_size = struct.unpack("<II", f.read(8))
+    if skippable_magic != SKIPPABLE_MAGIC or frame_size != size:
+      return None
+    data = f.read(num_blocks * ENTRY.size)
+
+  blocks, offset = [], 0
+  for compressed, uncompressed, mono_start, mono_end, *masks in ENTRY.iter_unpack(data):
+    services = sum(m << (64 * i) for i, m in enumerate(masks))
+    blocks.append(Block(offset, compressed, uncompressed, mono_start, mono_end, services))
+    offset += compressed
+  return blocks
+
+
+def service_ids(names):
+  from cereal import log
+  return [log.Event.schema.fields[n].proto.discriminantValue for n in names]
+
+
+def find_blocks(blocks, services=None, start=None, end=None):
+  """Blocks holding any of the services (names) with a logMonoTime in [start, end]"""
+  mask = sum(1 << i for i in service_ids(services)) if services else -1
+  return [b for b in blocks if b.services & mask and
+          (start is None or b.mono_end >= start) and (end is None or b.mono_start <= end)]
+
+
+def read_block(path, block):
+  """Decompressed events of one block"""
+  with open(path, "rb") as f:
+    f.seek(block.offset)
+    data = f.read(block.compressed_size)
+
+  if path.endswith(".zst"):
+    import zstandard
+    return zstandard.ZstdDecompressor().decompress(data, max_output_size=block.uncompressed_size)
+  import lz4.frame
+  return lz4.frame.decompress(data)
+
+
+def read_events(path, services=None, start=None, end=None):
+  """Events of the matching blocks, without decompressing the rest of the file"""
+  from cereal import log
+  blocks = read_index(path)
+  if blocks is None:
+    raise ValueError(f"{path} has no event index")
+
+  for b in find_blocks(blocks, services, start, end):
+    for event in log.Event.read_multiple_bytes(read_block(path, b)):
+      if services and event.which() not in services:
+        continue
+      if (start is not None and event.logMonoTime < start) or (end is not None and event.logMonoTime > end):
+        continue
+      yield event
+
+
+if __name__ == "__main__":
+  for b in read_index(sys.argv[1]) or []:
+    print(f"offset {b.offset:10d} size {b.compressed_size:8d} -> {b.uncompressed_size:8d} "
+          f"mono {b.mono_start} - {b.mono_end}")
@@ -0,0 +1,394 @@
+#include "selfdrive/loggerd/log_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <bzlib.h>
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "selfdrive/common/util.h"
+
+#define SKIPPABLE_MAGIC 0x184D2A5D
+#define SEEKABLE_MAGIC 0x8F92EAB1
+#define LOG_INDEX_ENTRY_SIZE 56
+#define LOG_INDEX_FOOTER_SIZE 12
+#define BZ2_BLOCK_MAGIC 0x314159265359ULL
+#define BZ2_EOS_MAGIC 0x177245385090ULL
+
+static bool read_at(FILE* f, long offset, void* data, size_t size) {
+  return fseek(f, offset, SEEK_SET) == 0 && fread(data, 1, size, f) == size;
+}
+
+static void* map_file(const std::string& path, size_t* size) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) return nullptr;
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) return nullptr;
+  *size = st.st_size;
+  return data;
+}
+
+// f(i) for i in [0, n), spread over the threads
+template <typename F>
+static void parallel_for(size_t n, int threads, F f) {
+  std::atomic<size_t> next = 0;
+  auto work = [&]() {
+    for (size_t i = next++; i < n; i = next++) f(i);
+  };
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < std::min<size_t>(threads, n); t++) workers.emplace_back(work);
+  work();
+  for (auto& w : workers) w.join();
+}
+static uint32_t get_u32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// by the magic bytes, blocks start with a frame header too
+static LogCompression compression(const void* data, size_t size) {
+  if (size >= 4 && get_u32((const uint8_t*)data) == 0xFD2FB528) return LogCompression::ZSTD;
+  if (size >= 4 && get_u32((const uint8_t*)data) == 0x184D2204) return LogCompression::LZ4;
+  return LogCompression::BZ2;
+}
+
+static std::vector<LogIndexBlock> parse_index(const uint8_t* data, size_t file_size) {
+  size_t end = file_size;
+
+  // step over the zstd seek table, it follows the event index
+  if (end >= 9 && get_u32(data + end - 4) == SEEKABLE_MAGIC) {
+    const size_t seek_table = 8 + (size_t)get_u32(data + end - 9) * 8 + 9;
+    if (seek_table > end) return {};
+    end -= seek_table;
+  }
+
+  if (end < LOG_INDEX_FOOTER_SIZE) return {};
+  const uint8_t* footer = data + end - LOG_INDEX_FOOTER_SIZE;
+  const uint32_t num_blocks = get_u32(footer);
+  if (get_u32(footer + 8) != LOG_INDEX_MAGIC || get_u32(footer + 4) != LOG_INDEX_VERSION) return {};
+
+  const size_t size = (size_t)num_blocks * LOG_INDEX_ENTRY_SIZE + LOG_INDEX_FOOTER_SIZE;
+  if (end < size + 8) return {};
+  const uint8_t* index = data + end - size - 8;
+  if (get_u32(index) != SKIPPABLE_MAGIC || get_u32(index + 4) != size) return {};
+
+  std::vector<LogIndexBlock> blocks(num_blocks);
+  uint64_t offset = 0;
+  for (uint32_t i = 0; i < num_blocks; i++) {
+    const uint8_t* p = index + 8 + i * LOG_INDEX_ENTRY_SIZE;
+    LogIndexBlock& b = blocks[i];
+    b.offset = offset;
+    b.compressed = get_u32(p);
+    b.uncompressed = get_u32(p + 4);
+    b.info.mono_start = get_u64(p + 8);
+    b.info.mono_end = get_u64(p + 16);
+    for (int m = 0; m < 4; m++) b.info.services[m] = get_u64(p + 24 + m * 8);
+    offset += b.compressed;
+  }
+  return blocks;
+}
+
+// without the library a zstd or lz4 log can't be read, it comes out empty
+static void unsupported(LogCompression type) {
+  static std::atomic<bool> warned = false;
+  if (!warned.exchange(true)) {
+    fprintf(stderr, "built without %s, can't read the log\n", type == LogCompression::ZSTD ? "zstd" : "lz4");
+  }
+}
+
+static bool decompress_block(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_size) {
+  const LogCompression type = compression(in, in_size);
+  if (type == LogCompression::ZSTD) {
+#ifdef HAVE_ZSTD
+    const size_t ret = ZSTD_decompress(out, out_size, in, in_size);
+    return !ZSTD_isError(ret) && ret == out_size;
+#else
+    unsupported(type);
+    return false;
+#endif
+  }
+
+#ifndef HAVE_LZ4
+  unsupported(type);
+  return false;
+#else
+  // one lz4 frame per block
+  LZ4F_dctx* dctx;
+  if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) return false;
+  size_t in_pos = 0, out_pos = 0, ret = 1;
+  while (ret != 0 && in_pos < in_size && out_pos < out_size) {
+    size_t src_size = in_size - in_pos, dst_size = out_size - out_pos;
+    ret = LZ4F_decompress(dctx, out + out_pos, &dst_size, in + in_pos, &src_size, NULL);
+    if (LZ4F_isError(ret)) break;
+    in_pos += src_size;
+    out_pos += dst_size;
+  }
+  LZ4F_freeDecompressionContext(dctx);
+  return out_pos == out_size;
+#endif
+}
+
+// false if the stream is cut short or corrupt, out has what came before
+static bool bz2_decompress(const uint8_t* in, size_t in_size, std::vector<uint8_t>& out) {
+  bz_stream bz = {};
+  if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK) return false;
+  bz.next_in = (char*)in;
+  bz.avail_in = in_size;
+  std::vector<uint8_t> buf(1 << 20);
+  int ret = BZ_OK;
+  while (ret == BZ_OK) {
+    bz.next_out = (char*)buf.data();
+    bz.avail_out = buf.size();
+    ret = BZ2_bzDecompress(&bz);
+    out.insert(out.end(), buf.begin(), buf.end() - bz.avail_out);
+    // all input taken and nothing more came out
+    if (ret == BZ_OK && bz.avail_in == 0 && bz.avail_out == buf.size()) break;
+  }
+  BZ2_bzDecompressEnd(&bz);
+  return ret == BZ_STREAM_END;
+}
+
+static std::vector<uint8_t> decompress_all(const uint8_t* in, size_t in_size) {
+  const LogCompression type = compression(in, in_size);
+  std::vector<uint8_t> out;
+  if (type == LogCompression::ZSTD) {
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* ds = ZSTD_createDStream();
+    ZSTD_inBuffer zin = {in, in_size, 0};
+    std::vector<uint8_t> buf(ZSTD_DStreamOutSize());
+    while (true) {
+      ZSTD_outBuffer zout = {buf.data(), buf.size(), 0};
+      if (ZSTD_isError(ZSTD_decompressStream(ds, &zout, &zin))) break;
+      out.insert(out.end(), buf.begin(), buf.begin() + zout.pos);
+      // a full output buffer may leave more behind
+      if (zin.pos == zin.size && zout.pos < zout.size) break;
+    }
+    ZSTD_freeDStream(ds);
+#else
+    unsupported(type);
+#endif
+  } else if (type == LogCompression::LZ4) {
+#ifdef HAVE_LZ4
+    LZ4F_dctx* dctx;
+    LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    std::vector<uint8_t> buf(1 << 20);
+    size_t pos = 0;
+    while (true) {
+      size_t src_size = in_size - pos, dst_size = buf.size();
+      if (LZ4F_isError(LZ4F_decompress(dctx, buf.data(), &dst_size, in + pos, &src_size, NULL))) break;
+      out.insert(out.end(), buf.begin(), buf.begin() + dst_size);
+      pos += src_size;
+      if (pos == in_size && dst_size < buf.size()) break;
+    }
+    LZ4F_freeDecompressionContext(dctx);
+#else
+    unsupported(type);
+#endif
+  } else {
+    bz2_decompress(in, in_size, out);
+  }
+  return out;
+}
+
+static uint64_t get_bits(const uint8_t* data, uint64_t pos, int n) {
+  uint64_t v = 0;
+  for (int i = 0; i < n; i++, pos++) v = (v << 1) | ((data[pos / 8] >> (7 - pos % 8)) & 1);
+  return v;
+}
+
+// Bit offsets of the blocks of a bz2 file, each up to the next block or end of
+// stream marker. bz2 blocks are bit aligned and not indexed, they are found by
+// their 48 bit magic. Compressed data can hold the magic too, a block split
+// there just doesn't decompress
+static std::vector<std::pair<uint64_t, uint64_t>> bz2_find_blocks(const uint8_t* data, size_t size) {
+  std::vector<std::pair<uint64_t, uint64_t>> blocks;
+  bool open = false;
+  uint64_t bits = 0;
+  for (uint64_t i = 0; i < size * 8; i++) {
+    bits = (bits << 1) | ((data[i / 8] >> (7 - i % 8)) & 1);
+    const uint64_t magic = bits & 0xFFFFFFFFFFFFULL;
+    if (i < 47 || (magic != BZ2_BLOCK_MAGIC && magic != BZ2_EOS_MAGIC)) continue;
+
+    const uint64_t start = i - 47;
+    if (open) blocks.back().second = start;
+    open = magic == BZ2_BLOCK_MAGIC;
+    if (open) blocks.push_back({start, 0});
+  }
+  // a truncated file's last block has no end
+  if (open) blocks.pop_back();
+  return blocks;
+}
+
+// A bz2 stream of just the block at bits [start, end). Its CRC is the one of
+// the block, which follows the block magic
+static std::vector<uint8_t> bz2_block_stream(const uint8_t* data, uint64_t start, uint64_t end) {
+  const uint64_t nbits = end - start;
+  std::vector<uint8_t> s = {'B', 'Z', 'h', '9'};
+  s.reserve(4 + nbits / 8 + 12);
+  const uint8_t* p = data + start / 8;
+  const int shift = start % 8;
+  // the end of stream marker after the block keeps p[i + 1] in the file
+  for (uint64_t i = 0; i < (nbits + 7) / 8; i++) {
+    s.push_back(shift == 0 ? p[i] : (uint8_t)((p[i] << shift) | (p[i + 1] >> (8 - shift))));
+  }
+
+  uint64_t pos = 32 + nbits;
+  if (pos % 8) s.back() &= (uint8_t)(0xFF << (8 - pos % 8));
+  auto put = [&](uint64_t v, int n) {
+    for (int i = n - 1; i >= 0; i--, pos++) {
+      if (pos % 8 == 0) s.push_back(0);
+      s.back() |= (uint8_t)(((v >> i) & 1) << (7 - pos % 8));
+    }
+  };
+  put(BZ2_EOS_MAGIC, 48);
+  put(get_bits(data, start + 48, 32), 32);
+  return s;
+}
+
+std::vector<LogIndexBlock> log_read_index(const std::string& path) {
+  size_t size = 0;
+  void* data = map_file(path, &size);
+  if (data == nullptr) return {};
+  std::vector<LogIndexBlock> blocks = parse_index((const uint8_t*)data, size);
+  munmap(data, size);
+  return blocks;
+}
+
+std::vector<uint8_t> log_read_block(const std::string& path, const LogIndexBlock& block) {
+  std::vector<uint8_t> in(block.compressed), out(block.uncompressed);
+  {
+    std::unique_ptr<FILE, decltype(&fclose)> f(fopen(path.c_str(), "rb"), &fclose);
+    if (!f || !read_at(f.get(), block.offset, in.data(), in.size())) return {};
+  }
+  if (!decompress_block(in.data(), in.size(), out.data(), out.size())) return {};
+  return out;
+}
+
+std::vector<uint8_t> log_read_all(const std::string& path) {
+  const std::string in = util::read_file(path);
+  return decompress_all((const uint8_t*)in.data(), in.size());
+}
+
+void LogReader::clear() {
+  events.clear();
+  words = nullptr;
+  buf = nullptr;
+  if (map != nullptr) munmap(map, map_size);
+  map = nullptr;
+  map_size = 0;
+}
+
+bool LogReader::load(const std::string& path, const std::vector<unsigned int>& services, int threads,
+                     uint64_t mono_start, uint64_t mono_end) {
+  clear();
+  map = map_file(path, &map_size);
+  if (map == nullptr) return false;
+  if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  const uint8_t* in = (const uint8_t*)map;
+
+  // the parts of the log, decompressed on the threads, then put together
+  std::vector<std::vector<uint8_t>> parts;
+  const std::vector<LogIndexBlock> blocks = parse_index(in, map_size);
+  if (!blocks.empty()) {
+    std::vector<const LogIndexBlock*> needed;
+    for (const auto& b : blocks) {
+      bool has = services.empty();
+      for (unsigned int s : services) has = has || b.has(s);
+      has = has && b.info.mono_end >= mono_start && b.info.mono_start <= mono_end;
+      if (has && b.offset + b.compressed <= map_size) needed.push_back(&b);
+    }
+    parts.resize(needed.size());
+    parallel_for(needed.size(), threads, [&](size_t i) {
+      const LogIndexBlock* b = needed[i];
+      parts[i].resize(b->uncompressed);
+      if (!decompress_block(in + b->offset, b->compressed, parts[i].data(), parts[i].size())) parts[i].clear();
+    });
+  } else if (map_size >= 4 && memcmp(in, "BZh", 3) == 0) {
+    const auto bz2_blocks = bz2_find_blocks(in, map_size);
+    parts.resize(bz2_blocks.size());
+    std::atomic<bool> failed = false;
+    parallel_for(bz2_blocks.size(), threads, [&](size_t i) {
+      const std::vector<uint8_t> s = bz2_block_stream(in, bz2_blocks[i].first, bz2_blocks[i].second);
+      if (!failed && !bz2_decompress(s.data(), s.size(), parts[i])) failed = true;
+    });
+    if (failed || parts.empty()) {
+      parts = {decompress_all(in, map_size)};
+    }
+  } else if (compression(in, map_size) != LogCompression::BZ2) {
+    parts = {decompress_all(in, map_size)};
+  } else {
+    // not compressed, the events are read where they are
+    madvise(map, map_size, MADV_SEQUENTIAL);
+    words = kj::ArrayPtr<const capnp::word>((const capnp::word*)map, map_size / sizeof(capnp::word));
+    index(services, mono_start, mono_end);
+    return true;
+  }
+
+  size_t total = 0;
+  for (const auto& part : parts) total += part.size();
+  buf = kj::heapArray<capnp::word>(total / sizeof(capnp::word));
+  uint8_t* out = (uint8_t*)buf.begin();
+  for (const auto& part : parts) {
+    const size_t n = std::min(part.size(), buf.size() * sizeof(capnp::word) - (out - (uint8_t*)buf.begin()));
+    memcpy(out, part.data(), n);
+    out += n;
+  }
+  words = buf;
+  munmap(map, map_size);
+  map = nullptr;
+  map_size = 0;
+
+  index(services, mono_start, mono_end);
+  return true;
+}
+
+void LogReader::index(const std::vector<unsigned int>& services, uint64_t mono_start, uint64_t mono_end) {
+  const bool all_times = mono_start == 0 && mono_end == UINT64_MAX;
+  kj::ArrayPtr<const capnp::word> rest = words;
+  try {
+    while (rest.size() > 0) {
+      const size_t size = capnp::expectedSizeInWordsFromPrefix(rest);
+      // a truncated last event
+      if (size > rest.size()) break;
+
+      bool keep = services.empty() && all_times;
+      if (!keep) {
+        capnp::FlatArrayMessageReader msg(rest.slice(0, size));
+        auto event = msg.getRoot<cereal::Event>();
+        const unsigned int which = (unsigned int)event.which();
+        keep = (services.empty() || std::find(services.begin(), services.end(), which) != services.end()) &&
+               event.getLogMonoTime() >= mono_start && event.getLogMonoTime() <= mono_end;
+      }
+      if (keep) events.push_back({(size_t)(rest.begin() - words.begin()), size});
+      rest = rest.slice(size, rest.size());
+    }
+  } catch (const kj::Exception& e) {
+    // corrupt from here on, keep what came before
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <capnp/serialize.h>
+#include <kj/array.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/loggerd/logger.h"
+
+// Reads logs back, the C++ side of log_index.py. Seekable logs are read by
+// block, with the event index picking the ones that are needed
+
+struct LogIndexBlock {
+  uint64_t offset;  // in the file
+  uint32_t compressed, uncompressed;
+  LogBlockInfo info;
+
+  inline bool has(unsigned int service) const {
+    return info.services[(service / 64) % 4] & (1ULL << (service % 64));
+  }
+};
+
+// the blocks of a seekable log, empty if it has no index
+std::vector<LogIndexBlock> log_read_index(const std::string& path);
+// the events of one block, empty if it doesn't decompress
+std::vector<uint8_t> log_read_block(const std::string& path, const LogIndexBlock& block);
+// all events of a log of any compression, as far as it decompresses
+std::vector<uint8_t> log_read_all(const std::string& path);
+
+// A whole log in memory with its events indexed, for tools that go through all
+// of it. Decompression runs on several threads, the blocks of seekable logs as
+// they are and bz2 logs split at their bz2 blocks. Uncompressed logs are read
+// straight from the mapped file. Events are iterated in place, not copied,
+// log_reader_pyx.pyx hands them to python the same way.
+class LogReader {
+ public:
+  LogReader() = default;
+  LogReader(const LogReader&) = delete;
+  LogReader& operator=(const LogReader&) = delete;
+  ~LogReader() { clear(); }
+
+  // keeps the events of services (cereal::Event::Which), all of them if it's
+  // empty, with logMonoTime in [mono_start, mono_end]. Blocks of seekable logs
+  // without any of them aren't decompressed. threads 0 is one per core. false
+  // if the file can't be read
+  bool load(const std::string& path, const std::vector<unsigned int>& services = {}, int threads = 0,
+            uint64_t mono_start = 0, uint64_t mono_end = UINT64_MAX);
+  void clear();
+
+  size_t size() const { return events.size(); }
+  kj::ArrayPtr<const capnp::word> data() const { return words; }
+  kj::ArrayPtr<const capnp::word> event(size_t i) const {
+    return words.slice(events[i].first, events[i].first + events[i].second);
+  }
+
+  // f(cereal::Event::Reader) for each event, the readers are only valid inside f
+  template <typename F>
+  void for_each(F f) const {
+    for (size_t i = 0; i < events.size(); i++) {
+      capnp::FlatArrayMessageReader msg(event(i));
+      f(msg.getRoot<cereal::Event>());
+    }
+  }
+
+ private:
+  void index(const std::vector<unsigned int>& services, uint64_t mono_start, uint64_t mono_end);
+
+  void* map = nullptr;
+  size_t map_size = 0;
+  kj::Array<capnp::word> buf;
+  kj::ArrayPtr<const capnp::word> words;  // into buf or the mapped file
+  std::vector<std::pair<size_t, size_t>> events;  // word offset and size
+};
@@ -0,0 +1,74 @@
+# distutils: language = c++
+# cython: language_level = 3
+from cpython.buffer cimport PyBuffer_FillInfo
+from libcpp cimport bool
+from libcpp.string cimport string
+from libcpp.vector cimport vector
+
+from cereal import log
+from selfdrive.loggerd.log_index import service_ids
+
+cdef extern from "selfdrive/loggerd/log_reader.cc":
+  pass
+
+cdef extern from "selfdrive/loggerd/log_reader.h":
+  cdef cppclass WordArray "kj::ArrayPtr<const capnp::word>":
+    const void* begin()
+    size_t size()
+
+  cdef cppclass LogReader_c "LogReader":
+    bool load(string, vector[unsigned int], int) nogil
+    size_t size()
+    WordArray data()
+    WordArray event(size_t)
+
+NO_TRAVERSAL_LIMIT = 2**64-1
+
+
+cdef class LogReader:
+  """All events of a log, read by the C++ LogReader on `threads` threads (0 is one per core).
+  `services` are names, only their events are kept. Iterating gives log.Event readers on top of
+  the decompressed log, nothing is copied, they keep the LogReader alive.
+  """
+  cdef LogReader_c* lr
+
+  def __cinit__(self, path, services=None, int threads=0):
+    cdef string c_path = path.encode()
+    cdef vector[unsigned int] ids = service_ids(services) if services else []
+    cdef bool ok
+    self.lr = new LogReader_c()
+    with nogil:
+      ok = self.lr.load(c_path, ids, threads)
+    if not ok:
+      raise IOError(f"failed to read {path}")
+
+  def __dealloc__(self):
+    del self.lr
+
+  def __len__(self):
+    return self.lr.size()
+
+  def __getbuffer__(self, Py_buffer* buffer, int flags):
+    cdef WordArray d = self.lr.data()
+    PyBuffer_FillInfo(buffer, self, <void*>d.begin(), d.size() * 8, 1, flags)
+
+  def raw(self, size_t i):
+    """Event i's bytes, a memoryview into the log"""
+    if i >= self.lr.size():
+      raise IndexError(i)
+    cdef WordArray d = self.lr.data()
+    cdef WordArray e = self.lr.event(i)
+    start = <const char*>e.begin() - <const char*>d.begin()
+    return memoryview(self)[start:start + e.size() * 8]
+
+  def __getitem__(self, size_t i):
+    return log.Event.from_bytes(self.raw(i), traversal_limit_in_words=NO_TRAVERSAL_LIMIT)
+
+  def __iter__(self):
+    view = memoryview(self)
+    cdef WordArray d = self.lr.data()
+    cdef WordArray e
+    for i in range(self.lr.size()):
+      e = self.lr.event(i)
+      start = <const char*>e.begin() - <const char*>d.begin()
+      yield log.Event.from_bytes(view[start:start + e.size() * 8], traversal_limit_in_words=NO_TRAVERSAL_LIMIT)
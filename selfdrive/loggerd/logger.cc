@@ -1,8 +1,12 @@
 #include "selfdrive/loggerd/logger.h"
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstdint>
@@ -11,15 +15,24 @@
 #include <cstring>
 #include <ctime>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
 #include <streambuf>
+
+#include <zlib.h>
 #ifdef QCOM
 #include <cutils/properties.h>
 #endif
 
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/sched.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/time_sync.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/version.h"
+#include "selfdrive/loggerd/file_sink.h"
 
 // ***** logging helpers *****
 
@@ -46,6 +59,679 @@ int logger_mkpath(char* file_path) {
   return 0;
 }
 
+// ***** log compression *****
+
+LogCompressionConfig log_compression_parse(const char* str, LogCompressionConfig def) {
+  if (str == nullptr || *str == '\0') return def;
+
+  static const struct {
+    const char* name;
+    LogCompression type;
+    int default_level, min_level, max_level;
+  } formats[] = {
+    {"bz2", LogCompression::BZ2, 9, 1, 9},
+    {"zstd", LogCompression::ZSTD, 3, 1, 19},
+    {"lz4", LogCompression::LZ4, 0, 0, 12},
+  };
+
+  const std::string s(str);
+  const size_t colon = s.find(':');
+  for (auto& f : formats) {
+    if (s.compare(0, colon, f.name) == 0) {
+      if (!log_compression_available(f.type)) {
+        LOGE("built without %s, logs are %s", f.name, log_compression_extension(def.type));
+        return def;
+      }
+      const int level = colon == std::string::npos ? f.default_level : atoi(s.c_str() + colon + 1);
+      return {f.type, std::clamp(level, f.min_level, f.max_level)};
+    }
+  }
+  LOGE("unknown log compression %s", str);
+  return def;
+}
+
+bool log_compression_available(LogCompression type) {
+  switch (type) {
+#ifdef HAVE_ZSTD
+    case LogCompression::ZSTD: return true;
+#endif
+#ifdef HAVE_LZ4
+    case LogCompression::LZ4: return true;
+#endif
+    case LogCompression::BZ2: return true;
+    default: return false;
+  }
+}
+
+const char* log_compression_extension(LogCompression type) {
+  switch (type) {
+    case LogCompression::ZSTD: return "zst";
+    case LogCompression::LZ4: return "lz4";
+    default: return "bz2";
+  }
+}
+
+std::unique_ptr<LogFile> log_file_open(const char* path, LogCompressionConfig config, uint64_t reserve) {
+  switch (config.type) {
+#ifdef HAVE_ZSTD
+    case LogCompression::ZSTD: return std::make_unique<ZstdFile>(path, config.level, reserve);
+#endif
+#ifdef HAVE_LZ4
+    case LogCompression::LZ4: return std::make_unique<LZ4File>(path, config.level, reserve);
+#endif
+    default: return std::make_unique<BZFile>(path, config.level, reserve);
+  }
+}
+
+FILE* LogFile::open_file(const char* path, uint64_t reserve) {
+  this->path = path;
+  FILE* file = fopen(path, "wb");
+  assert(file != nullptr);
+  if (reserve > 0) file_preallocate(fileno(file), reserve);
+  return file;
+}
+
+void LogFile::close_file(FILE* file) {
+  fflush(file);
+  const long size = ftell(file);
+  file_release_unused(fileno(file));
+  int err = fclose(file);
+  assert(err == 0);
+  logger_file_closed(path, std::max(size, 0L), crc);
+}
+
+void LogFile::write_file(FILE* file, const void* data, size_t size) {
+  if (size == 0) return;
+  const uint64_t start_ns = nanos_since_boot();
+  const size_t written = fwrite(data, 1, size, file);
+  file_write_stats.add(written, (nanos_since_boot() - start_ns) / 1000);
+  crc = crc32(crc, (const uint8_t*)data, written);
+  if (written != size && !error_logged) {
+    LOGE("log write error, errno=%d", errno);
+    error_logged = true;
+  }
+}
+
+void SeekableLogFile::add_block(size_t compressed, size_t uncompressed, const LogBlockInfo& info) {
+  blocks.push_back({(uint32_t)compressed, (uint32_t)uncompressed, info});
+}
+
+void SeekableLogFile::write_block(const std::vector<uint8_t>& block, size_t uncompressed, const LogBlockInfo& info) {
+  write_file(file, block.data(), block.size());
+  add_block(block.size(), uncompressed, info);
+}
+
+void SeekableLogFile::write_index() {
+  std::vector<uint8_t> index;
+  auto put = [&](auto v) {
+    const uint8_t* p = (const uint8_t*)&v;
+    index.insert(index.end(), p, p + sizeof(v));
+  };
+
+  for (auto& b : blocks) {
+    put(b.compressed);
+    put(b.uncompressed);
+    put(b.info.mono_start);
+    put(b.info.mono_end);
+    for (uint64_t mask : b.info.services) put(mask);
+  }
+  put((uint32_t)blocks.size());
+  put((uint32_t)LOG_INDEX_VERSION);
+  put((uint32_t)LOG_INDEX_MAGIC);
+
+  const uint32_t header[2] = {0x184D2A5D, (uint32_t)index.size()};
+  write_file(file, header, sizeof(header));
+  write_file(file, index.data(), index.size());
+}
+
+#ifdef HAVE_ZSTD
+ZstdFile::ZstdFile(const char* path, int level, uint64_t reserve) : level(level) {
+  file = open_file(path, reserve);
+  cctx = ZSTD_createCCtx();
+  assert(cctx != nullptr);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+  out_buf.resize(ZSTD_CStreamOutSize());
+}
+
+ZstdFile::~ZstdFile() {
+  if (block_in > 0) end_block(LogBlockInfo::unknown());
+  write_index();
+  write_seek_table();
+  ZSTD_freeCCtx(cctx);
+  close_file(file);
+}
+
+void ZstdFile::write(void* data, size_t size) {
+  ZSTD_inBuffer in = {data, size, 0};
+  compress(&in, ZSTD_e_continue);
+  block_in += size;
+}
+
+void ZstdFile::compress(ZSTD_inBuffer* in, ZSTD_EndDirective mode) {
+  size_t remaining;
+  do {
+    ZSTD_outBuffer out = {out_buf.data(), out_buf.size(), 0};
+    remaining = ZSTD_compressStream2(cctx, &out, in, mode);
+    if (ZSTD_isError(remaining)) {
+      if (!error_logged) {
+        LOGE("ZSTD_compressStream2 error: %s", ZSTD_getErrorName(remaining));
+        error_logged = true;
+      }
+      return;
+    }
+    write_file(file, out_buf.data(), out.pos);
+    block_out += out.pos;
+  } while (mode == ZSTD_e_end ? remaining != 0 : in->pos < in->size);
+}
+
+void ZstdFile::end_block(const LogBlockInfo& info) {
+  if (block_in == 0) return;
+
+  ZSTD_inBuffer in = {nullptr, 0, 0};
+  compress(&in, ZSTD_e_end);
+  add_block(block_out, block_in, info);
+  block_in = block_out = 0;
+}
+
+std::vector<uint8_t> ZstdFile::compress_block(const uint8_t* data, size_t size) const {
+  // one context per worker thread, contexts are expensive to set up
+  thread_local ZSTD_CCtx* ctx = ZSTD_createCCtx();
+  ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+  ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level);
+  ZSTD_CCtx_setParameter(ctx, ZSTD_c_checksumFlag, 1);
+
+  std::vector<uint8_t> out(ZSTD_compressBound(size));
+  size_t ret = ZSTD_compress2(ctx, out.data(), out.size(), data, size);
+  if (ZSTD_isError(ret)) {
+    LOGE("ZSTD_compress2 error: %s", ZSTD_getErrorName(ret));
+    ret = 0;
+  }
+  out.resize(ret);
+  return out;
+}
+
+void ZstdFile::write_seek_table() {
+  // skippable frame holding the entries followed by the footer: frame count,
+  // descriptor (no checksums) and the seekable magic number. The event index
+  // frame counts as a frame without content
+  std::vector<uint32_t> table = {0x184D2A5E, (uint32_t)((blocks.size() + 1) * 8 + 9)};
+  for (auto& b : blocks) {
+    table.push_back(b.compressed);
+    table.push_back(b.uncompressed);
+  }
+  table.push_back(8 + (blocks.size() * 56 + 12));
+  table.push_back(0);
+  table.push_back(blocks.size() + 1);
+  write_file(file, table.data(), table.size() * sizeof(uint32_t));
+
+  const uint8_t footer[5] = {0, 0xB1, 0xEA, 0x92, 0x8F};
+  write_file(file, footer, sizeof(footer));
+}
+#endif
+
+#ifdef HAVE_LZ4
+// lz4 is fed in chunks so the output buffer stays small
+#define LZ4_CHUNK_SIZE (64 * 1024)
+
+LZ4File::LZ4File(const char* path, int level, uint64_t reserve) {
+  file = open_file(path, reserve);
+  LZ4F_errorCode_t err = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+  assert(!LZ4F_isError(err));
+  prefs.compressionLevel = level;
+  prefs.frameInfo.blockSizeID = LZ4F_max256KB;
+  prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+  out_buf.resize(std::max((size_t)LZ4F_HEADER_SIZE_MAX, LZ4F_compressBound(LZ4_CHUNK_SIZE, &prefs)));
+}
+
+LZ4File::~LZ4File() {
+  if (in_frame) end_block(LogBlockInfo::unknown());
+  write_index();
+  LZ4F_freeCompressionContext(cctx);
+  close_file(file);
+}
+
+void LZ4File::write(void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  while (size > 0) {
+    if (!in_frame) begin_frame();
+
+    const size_t n = std::min(size, (size_t)LZ4_CHUNK_SIZE);
+    size_t ret = LZ4F_compressUpdate(cctx, out_buf.data(), out_buf.size(), p, n, nullptr);
+    if (LZ4F_isError(ret)) {
+      if (!error_logged) {
+        LOGE("LZ4F_compressUpdate error: %s", LZ4F_getErrorName(ret));
+        error_logged = true;
+      }
+      return;
+    }
+    write_out(ret);
+    block_in += n;
+    p += n;
+    size -= n;
+  }
+}
+
+void LZ4File::write_out(size_t size) {
+  write_file(file, out_buf.data(), size);
+  block_out += size;
+}
+
+void LZ4File::begin_frame() {
+  size_t ret = LZ4F_compressBegin(cctx, out_buf.data(), out_buf.size(), &prefs);
+  assert(!LZ4F_isError(ret));
+  write_out(ret);
+  in_frame = true;
+}
+
+void LZ4File::end_block(const LogBlockInfo& info) {
+  if (!in_frame) return;
+
+  size_t ret = LZ4F_compressEnd(cctx, out_buf.data(), out_buf.size(), nullptr);
+  if (!LZ4F_isError(ret)) write_out(ret);
+  add_block(block_out, block_in, info);
+  in_frame = false;
+  block_in = block_out = 0;
+}
+
+std::vector<uint8_t> LZ4File::compress_block(const uint8_t* data, size_t size) const {
+  std::vector<uint8_t> out(LZ4F_compressFrameBound(size, &prefs));
+  size_t ret = LZ4F_compressFrame(out.data(), out.size(), data, size, &prefs);
+  if (LZ4F_isError(ret)) {
+    LOGE("LZ4F_compressFrame error: %s", LZ4F_getErrorName(ret));
+    ret = 0;
+  }
+  out.resize(ret);
+  return out;
+}
+#endif
+
+// ***** compression workers *****
+
+namespace {
+
+// shared by the writers of all handles, never destroyed like the closer
+class CompressPool {
+ public:
+  CompressPool(int n) : size(n) {
+    for (int i = 0; i < n; i++) {
+      std::thread([this] {
+        set_thread_name("log_compress");
+        sched_apply("loggerd", "compress");
+        std::unique_lock lk(lock);
+        while (true) {
+          cv.wait(lk, [&] { return !tasks.empty(); });
+          auto task = std::move(tasks.front());
+          tasks.pop_front();
+          lk.unlock();
+          task();
+          lk.lock();
+        }
+      }).detach();
+    }
+  }
+
+  template <class F>
+  auto submit(F f) {
+    auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+    auto result = task->get_future();
+    {
+      std::unique_lock lk(lock);
+      tasks.push_back([task] { (*task)(); });
+    }
+    cv.notify_one();
+    return result;
+  }
+
+  const int size;
+
+ private:
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> tasks;
+};
+
+// nullptr with LOGGERD_COMPRESS_THREADS=0, compression then stays on the writer threads
+CompressPool* compress_pool() {
+  static CompressPool* pool = []() -> CompressPool* {
+    int n = 0;
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+      n = std::clamp(CPU_COUNT(&cpus) - 1, 0, 4);
+    }
+    if (const char* env = getenv("LOGGERD_COMPRESS_THREADS")) {
+      n = atoi(env);
+    }
+    LOGW("log compression on %d worker threads", n);
+    return n > 0 ? new CompressPool(n) : nullptr;
+  }();
+  return pool;
+}
+
+}  // namespace
+
+// ***** log writer *****
+
+// chunks are whole serialized events back to back
+static LogBlockInfo block_info(const uint8_t* data, size_t size) {
+  LogBlockInfo info;
+  try {
+    kj::ArrayPtr<const capnp::word> words((const capnp::word*)data, size / sizeof(capnp::word));
+    while (words.size() > 0) {
+      capnp::FlatArrayMessageReader reader(words);
+      auto event = reader.getRoot<cereal::Event>();
+      info.add(event.getLogMonoTime(), (unsigned int)event.which());
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+  } catch (const kj::Exception& e) {
+    LOGE("log block not indexed: %s", e.getDescription().cStr());
+    return LogBlockInfo::unknown();
+  }
+  return info;
+}
+
+LogWriter::LogWriter(std::unique_ptr<LogFile> log_file, std::unique_ptr<LogFile> qlog_file)
+    : log(std::move(log_file)), q_log(std::move(qlog_file)) {
+  log_chunk.reserve(LOG_WRITER_CHUNK_SIZE);
+  qlog_chunk.reserve(LOG_WRITER_CHUNK_SIZE);
+  thread = std::thread(&LogWriter::writer_thread, this);
+}
+
+LogWriter::~LogWriter() {
+  push(log.get(), log_chunk);
+  if (q_log) push(q_log.get(), qlog_chunk);
+  {
+    std::unique_lock lk(lock);
+    exit = true;
+  }
+  cv.notify_all();
+  thread.join();
+  log.reset();
+  q_log.reset();
+}
+
+void LogWriter::write(const uint8_t* data, size_t size, bool in_qlog) {
+  append(log_chunk, log_chunk_start, log.get(), data, size);
+  if (in_qlog && q_log) {
+    append(qlog_chunk, qlog_chunk_start, q_log.get(), data, size);
+  }
+}
+
+void LogWriter::append(std::vector<uint8_t>& chunk, double& chunk_start, LogFile* file, const uint8_t* data, size_t size) {
+  const double now = millis_since_boot();
+  if (chunk.empty()) chunk_start = now;
+
+  chunk.insert(chunk.end(), data, data + size);
+  if (chunk.size() >= LOG_WRITER_CHUNK_SIZE || now - chunk_start >= LOG_WRITER_CHUNK_MS) push(file, chunk);
+}
+
+void LogWriter::push(LogFile* file, std::vector<uint8_t>& chunk) {
+  if (chunk.empty()) return;
+
+  std::unique_lock lk(lock);
+  if (queue.size() >= LOG_WRITER_QUEUE_CHUNKS) {
+    const double start = millis_since_boot();
+    cv.wait(lk, [&] { return queue.size() < LOG_WRITER_QUEUE_CHUNKS; });
+    writer_stats.stalls++;
+    writer_stats.stall_ms += millis_since_boot() - start;
+    file_write_stats.stalls++;
+  }
+
+  writer_stats.queued_bytes += chunk.size();
+  writer_stats.max_queued_bytes = std::max(writer_stats.max_queued_bytes, writer_stats.queued_bytes);
+  queue.push_back({file, std::move(chunk)});
+
+  // swap in a buffer the writer is done with
+  if (!free_chunks.empty()) {
+    chunk = std::move(free_chunks.back());
+    free_chunks.pop_back();
+  } else {
+    chunk = std::vector<uint8_t>();
+    chunk.reserve(LOG_WRITER_CHUNK_SIZE);
+  }
+  lk.unlock();
+  cv.notify_all();
+}
+
+void LogWriter::writer_thread() {
+  set_thread_name("log_writer");
+
+  // blocks out on the compression workers, written in the order they were queued
+  struct Compressed {
+    std::vector<uint8_t> data;
+    LogBlockInfo info;
+  };
+  struct Pending {
+    Chunk chunk;
+    std::future<Compressed> block;
+  };
+  std::deque<Pending> pending;
+  CompressPool* pool = compress_pool();
+  const size_t max_pending = pool ? pool->size * 2 : 1;
+
+  std::unique_lock lk(lock);
+  while (true) {
+    cv.wait(lk, [&] { return !queue.empty() || !pending.empty() || exit; });
+    size_t size = 0;
+    std::vector<uint8_t> done;
+
+    if (!queue.empty() && pending.size() < max_pending) {
+      Chunk chunk = std::move(queue.front());
+      queue.pop_front();
+      lk.unlock();
+      cv.notify_all();
+
+      if (pool && chunk.file->seekable()) {
+        // the chunk's buffer moves along with it, the pointer stays valid
+        auto file = static_cast<SeekableLogFile*>(chunk.file);
+        const uint8_t* data = chunk.data.data();
+        const size_t n = chunk.data.size();
+        auto block = pool->submit([file, data, n] { return Compressed{file->compress_block(data, n), block_info(data, n)}; });
+        pending.push_back({std::move(chunk), std::move(block)});
+        lk.lock();
+        continue;
+      }
+
+      size = chunk.data.size();
+      chunk.file->write(chunk.data.data(), size);
+      if (chunk.file->seekable()) {
+        chunk.file->end_block(block_info(chunk.data.data(), size));
+      }
+      done = std::move(chunk.data);
+    } else if (!pending.empty()) {
+      lk.unlock();
+      Pending p = std::move(pending.front());
+      pending.pop_front();
+      Compressed block = p.block.get();
+      size = p.chunk.data.size();
+      static_cast<SeekableLogFile*>(p.chunk.file)->write_block(block.data, size, block.info);
+      done = std::move(p.chunk.data);
+    } else {
+      break;
+    }
+
+    done.clear();
+    lk.lock();
+    writer_stats.queued_bytes -= size;
+    free_chunks.push_back(std::move(done));
+  }
+}
+
+LogWriterStats LogWriter::stats() {
+  std::unique_lock lk(lock);
+  return writer_stats;
+}
+
+// ***** deferred closing *****
+
+namespace {
+
+struct Closer {
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> tasks;
+  int pending = 0;
+
+  Closer() {
+    std::thread([this] {
+      set_thread_name("log_closer");
+      std::unique_lock lk(lock);
+      while (true) {
+        cv.wait(lk, [&] { return !tasks.empty(); });
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        lk.unlock();
+        task();
+        lk.lock();
+        pending--;
+        cv.notify_all();
+      }
+    }).detach();
+  }
+};
+
+// never destroyed, the thread may still run while static destructors do
+Closer &closer() {
+  static Closer *c = new Closer();
+  return *c;
+}
+
+}  // namespace
+
+void logger_close_deferred(std::function<void()> task) {
+  Closer &c = closer();
+  {
+    std::unique_lock lk(c.lock);
+    c.tasks.push_back(std::move(task));
+    c.pending++;
+  }
+  c.cv.notify_all();
+}
+
+void logger_wait_closed() {
+  Closer &c = closer();
+  std::unique_lock lk(c.lock);
+  c.cv.wait(lk, [&] { return c.pending == 0; });
+}
+
+int logger_fsync(const char* path) {
+  int fd = HANDLE_EINTR(open(path, O_RDONLY));
+  if (fd < 0) return -1;
+  int err = fsync(fd);
+  close(fd);
+  return err;
+}
+
+// ***** segment lifecycle *****
+// Events and manifest lines are only written from the closer thread, so they
+// come out in order with the files being closed
+
+namespace {
+
+struct SegmentFile {
+  std::string name;
+  uint64_t size;
+  uint32_t crc;
+};
+
+std::mutex closed_files_lock;
+std::map<std::string, std::pair<uint64_t, uint32_t>> closed_files;  // path -> size, crc
+
+// removes and returns what was reported for the files in dir
+std::map<std::string, std::pair<uint64_t, uint32_t>> take_closed_files(const std::string& dir) {
+  const std::string prefix = dir + "/";
+  std::map<std::string, std::pair<uint64_t, uint32_t>> files;
+  std::lock_guard lk(closed_files_lock);
+  auto it = closed_files.lower_bound(prefix);
+  while (it != closed_files.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+    files[it->first.substr(prefix.size())] = it->second;
+    it = closed_files.erase(it);
+  }
+  return files;
+}
+
+std::vector<SegmentFile> segment_files(const std::string& segment_path) {
+  auto reported = take_closed_files(segment_path);
+  std::vector<SegmentFile> files;
+  DIR* dir = opendir(segment_path.c_str());
+  if (dir == nullptr) return files;
+  while (struct dirent* entry = readdir(dir)) {
+    const std::string name = entry->d_name;
+    if (name == "." || name == ".." || (name.size() > 5 && name.compare(name.size() - 5, 5, ".lock") == 0)) continue;
+
+    if (auto it = reported.find(name); it != reported.end()) {
+      files.push_back({name, it->second.first, it->second.second});
+    } else {
+      struct stat st;
+      if (stat((segment_path + "/" + name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        files.push_back({name, (uint64_t)st.st_size, 0});
+      }
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end(), [](auto& a, auto& b) { return a.name < b.name; });
+  return files;
+}
+
+// publishes the event and appends it to the route's manifest as one line of json:
+//   {"segment": 3, "state": "finalized", "files": {"rlog.zst": [size, crc32], ...}}
+void segment_event(const std::string& route, int part, const std::string& segment_path,
+                   const std::string& manifest_path, cereal::LoggerdSegment::State state) {
+  const bool finalized = state == cereal::LoggerdSegment::State::FINALIZED;
+  const std::vector<SegmentFile> files = finalized ? segment_files(segment_path) : std::vector<SegmentFile>{};
+
+  MessageBuilder msg;
+  auto seg = msg.initEvent().initLoggerdSegment();
+  seg.setRoute(route.c_str());
+  seg.setSegmentNum(part);
+  seg.setPath(segment_path.c_str());
+  seg.setState(state);
+  auto lfiles = seg.initFiles(files.size());
+  std::string line = util::string_format("{\"segment\": %d, \"state\": \"%s\"", part, finalized ? "finalized" : "opened");
+  if (finalized) {
+    line += ", \"files\": {";
+    for (int i = 0; i < files.size(); i++) {
+      lfiles[i].setName(files[i].name.c_str());
+      lfiles[i].setSize(files[i].size);
+      lfiles[i].setCrc32(files[i].crc);
+      line += util::string_format("%s\"%s\": [%llu, %u]", i > 0 ? ", " : "", files[i].name.c_str(),
+                                  (unsigned long long)files[i].size, files[i].crc);
+    }
+    line += "}";
+  }
+  line += "}\n";
+
+  // a single append per line, a crash can at most cut off the last one
+  int fd = HANDLE_EINTR(open(manifest_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0664));
+  if (fd >= 0) {
+    if (HANDLE_EINTR(write(fd, line.data(), line.size())) != (ssize_t)line.size()) {
+      LOGE("failed to write %s: %s", manifest_path.c_str(), strerror(errno));
+    }
+    fsync(fd);
+    close(fd);
+  } else {
+    LOGE("failed to open %s: %s", manifest_path.c_str(), strerror(errno));
+  }
+
+  static PubMaster pm({"loggerdSegment"});
+  pm.send("loggerdSegment", msg);
+}
+
+// the handle is reused once it's closed, the deferred task gets copies
+void segment_event_deferred(const LoggerHandle* h, cereal::LoggerdSegment::State state) {
+  logger_close_deferred([=, route = h->route_name, part = h->part, segment_path = std::string(h->segment_path),
+                         manifest_path = std::string(h->manifest_path)]() {
+    segment_event(route, part, segment_path, manifest_path, state);
+  });
+}
+
+}  // namespace
+
+void logger_file_closed(const std::string& path, uint64_t size, uint32_t crc) {
+  std::lock_guard lk(closed_files_lock);
+  closed_files[path] = {size, crc};
+}
+
 // ***** log metadata *****
 kj::Array<capnp::word> logger_build_init_data() {
   MessageBuilder msg;
@@ -119,17 +805,17 @@ kj::Array<capnp::word> logger_build_init_data() {
 std::string logger_get_route_name() {
   char route_name[64] = {'\0'};
   time_t rawtime = time(NULL);
+  // before the system time is set, GPS time is better than 1970
+  if (!util::time_valid(util::get_time())) {
+    uint64_t gps_time = time_sync_boot_to_gps(nanos_since_boot());
+    if (gps_time != 0) rawtime = gps_time / 1000000000ULL;
+  }
   struct tm timeinfo;
   localtime_r(&rawtime, &timeinfo);
   strftime(route_name, sizeof(route_name), "%Y-%m-%d--%H-%M-%S", &timeinfo);
   return route_name;
 }
 
-void log_init_data(LoggerState *s) {
-  auto bytes = s->init_data.asBytes();
-  logger_log(s, bytes.begin(), bytes.size(), s->has_qlog);
-}
-
 
 static void lh_log_sentinel(LoggerHandle *h, SentinelType type) {
   MessageBuilder msg;
@@ -151,9 +837,20 @@ void logger_init(LoggerState *s, const char* log_name, bool has_qlog) {
   s->route_name = logger_get_route_name();
   snprintf(s->log_name, sizeof(s->log_name), "%s", log_name);
   s->init_data = logger_build_init_data();
+  s->log_compression = log_compression_parse(getenv("LOGGERD_LOG_COMPRESSION"), LOG_COMPRESSION_DEFAULT);
+  s->qlog_compression = log_compression_parse(getenv("LOGGERD_QLOG_COMPRESSION"), QLOG_COMPRESSION_DEFAULT);
+}
+
+// compressed sizes of the last closed segment's logs, the files of the next
+// ones get a quarter more than that reserved
+static std::atomic<uint64_t> last_log_bytes = 0, last_qlog_bytes = 0;
+
+static uint64_t file_size(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
 }
 
-static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
+static LoggerHandle* logger_open(LoggerState *s, const char* root_path, int part) {
   int err;
 
   LoggerHandle *h = NULL;
@@ -166,13 +863,19 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
   assert(h);
 
   snprintf(h->segment_path, sizeof(h->segment_path),
-          "%s/%s--%d", root_path, s->route_name.c_str(), s->part);
+          "%s/%s--%d", root_path, s->route_name.c_str(), part);
 
-  snprintf(h->log_path, sizeof(h->log_path), "%s/%s.bz2", h->segment_path, s->log_name);
-  snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog.bz2", h->segment_path);
+  snprintf(h->log_path, sizeof(h->log_path), "%s/%s.%s", h->segment_path, s->log_name,
+           log_compression_extension(s->log_compression.type));
+  snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog.%s", h->segment_path,
+           log_compression_extension(s->qlog_compression.type));
   snprintf(h->lock_path, sizeof(h->lock_path), "%s.lock", h->log_path);
+  snprintf(h->manifest_path, sizeof(h->manifest_path), "%s/%s.manifest", root_path, s->route_name.c_str());
+  h->route_name = s->route_name;
+  h->part = part;
   h->end_sentinel_type = SentinelType::END_OF_SEGMENT;
   h->exit_signal = 0;
+  h->used = false;
 
   err = logger_mkpath(h->log_path);
   if (err) return NULL;
@@ -181,16 +884,41 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
   if (lock_file == NULL) return NULL;
   fclose(lock_file);
 
-  h->log = std::make_unique<BZFile>(h->log_path);
-  if (s->has_qlog) {
-    h->q_log = std::make_unique<BZFile>(h->qlog_path);
-  }
+  const uint64_t log_reserve = last_log_bytes + last_log_bytes / 4;
+  const uint64_t qlog_reserve = last_qlog_bytes + last_qlog_bytes / 4;
+  h->writer = std::make_unique<LogWriter>(log_file_open(h->log_path, s->log_compression, log_reserve),
+                                          s->has_qlog ? log_file_open(h->qlog_path, s->qlog_compression, qlog_reserve) : nullptr);
 
   pthread_mutex_init(&h->lock, NULL);
   h->refcnt++;
   return h;
 }
 
+// opens the handle of the segment after part, with its metadata already written
+static LoggerHandle* logger_preopen(LoggerState *s, const char* root_path, int part) {
+  LoggerHandle *h = logger_open(s, root_path, part);
+  if (h) {
+    auto bytes = s->init_data.asBytes();
+    lh_log(h, bytes.begin(), bytes.size(), s->has_qlog);
+    lh_log_sentinel(h, SentinelType::START_OF_SEGMENT);
+  }
+  return h;
+}
+
+// removes a pre-opened segment nothing was logged to
+static void lh_discard(LoggerHandle *h) {
+  pthread_mutex_lock(&h->lock);
+  h->writer.reset(nullptr);
+  take_closed_files(h->segment_path);
+  unlink(h->log_path);
+  unlink(h->qlog_path);
+  unlink(h->lock_path);
+  rmdir(h->segment_path);
+  h->refcnt = 0;
+  pthread_mutex_unlock(&h->lock);
+  pthread_mutex_destroy(&h->lock);
+}
+
 int logger_next(LoggerState *s, const char* root_path,
                             char* out_segment_path, size_t out_segment_path_len,
                             int* out_part) {
@@ -199,7 +927,17 @@ int logger_next(LoggerState *s, const char* root_path,
   pthread_mutex_lock(&s->lock);
   s->part++;
 
-  LoggerHandle* next_h = logger_open(s, root_path);
+  // the next segment is normally opened ahead, so rotating only swaps handles
+  LoggerHandle* next_h = s->next_handle;
+  s->next_handle = NULL;
+  if (next_h && (next_h->part != s->part || strncmp(next_h->segment_path, root_path, strlen(root_path)) != 0)) {
+    lh_discard(next_h);
+    next_h = NULL;
+  }
+  const bool preopened = next_h != NULL;
+  if (!next_h) {
+    next_h = logger_open(s, root_path, s->part);
+  }
   if (!next_h) {
     pthread_mutex_unlock(&s->lock);
     return -1;
@@ -209,6 +947,7 @@ int logger_next(LoggerState *s, const char* root_path,
     lh_close(s->cur_handle);
   }
   s->cur_handle = next_h;
+  segment_event_deferred(next_h, cereal::LoggerdSegment::State::OPENED);
 
   if (out_segment_path) {
     snprintf(out_segment_path, out_segment_path_len, "%s", next_h->segment_path);
@@ -217,11 +956,15 @@ int logger_next(LoggerState *s, const char* root_path,
     *out_part = s->part;
   }
 
-  pthread_mutex_unlock(&s->lock);
+  if (!preopened) {
+    // write beggining of log metadata
+    auto bytes = s->init_data.asBytes();
+    lh_log(next_h, bytes.begin(), bytes.size(), s->has_qlog);
+    lh_log_sentinel(next_h, is_start_of_route ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT);
+  }
 
-  // write beggining of log metadata
-  log_init_data(s);
-  lh_log_sentinel(s->cur_handle, is_start_of_route ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT);
+  s->next_handle = logger_preopen(s, root_path, s->part + 1);
+  pthread_mutex_unlock(&s->lock);
   return 0;
 }
 
@@ -245,8 +988,42 @@ void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog) {
   pthread_mutex_unlock(&s->lock);
 }
 
+LogWriterStats logger_writer_stats(LoggerState *s) {
+  LogWriterStats stats = {};
+  pthread_mutex_lock(&s->lock);
+  if (s->cur_handle) {
+    stats = s->cur_handle->writer->stats();
+  }
+  pthread_mutex_unlock(&s->lock);
+  return stats;
+}
+
+LoggerHandle* logger_get_next_handle(LoggerState *s) {
+  pthread_mutex_lock(&s->lock);
+  LoggerHandle* h = s->next_handle;
+  if (h) {
+    pthread_mutex_lock(&h->lock);
+    h->refcnt++;
+    h->used = true;
+    pthread_mutex_unlock(&h->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return h;
+}
+
 void logger_close(LoggerState *s, ExitHandler *exit_handler) {
   pthread_mutex_lock(&s->lock);
+  if (s->next_handle) {
+    if (s->next_handle->used) {
+      // an encoder already started the next segment, it ends the route
+      if (s->cur_handle) lh_close(s->cur_handle);
+      s->cur_handle = s->next_handle;
+      segment_event_deferred(s->cur_handle, cereal::LoggerdSegment::State::OPENED);
+    } else {
+      lh_discard(s->next_handle);
+    }
+    s->next_handle = NULL;
+  }
   if (s->cur_handle) {
     s->cur_handle->exit_signal = exit_handler && exit_handler->signal.load();
     s->cur_handle->end_sentinel_type = SentinelType::END_OF_ROUTE;
@@ -258,10 +1035,7 @@ void logger_close(LoggerState *s, ExitHandler *exit_handler) {
 void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog) {
   pthread_mutex_lock(&h->lock);
   assert(h->refcnt > 0);
-  h->log->write(data, data_size);
-  if (in_qlog && h->q_log) {
-    h->q_log->write(data, data_size);
-  }
+  h->writer->write(data, data_size, in_qlog);
   pthread_mutex_unlock(&h->lock);
 }
 
@@ -276,9 +1050,22 @@ void lh_close(LoggerHandle* h) {
   }
   h->refcnt--;
   if (h->refcnt == 0) {
-    h->log.reset(nullptr);
-    h->q_log.reset(nullptr);
-    unlink(h->lock_path);
+    // flushing the writer and syncing the files happens off the caller's thread
+    std::shared_ptr<LogWriter> writer(std::move(h->writer));
+    logger_close_deferred([writer, segment_path = std::string(h->segment_path), log_path = std::string(h->log_path),
+                           qlog_path = std::string(h->qlog_path), lock_path = std::string(h->lock_path)]() mutable {
+      LogWriterStats stats = writer->stats();
+      writer.reset();
+      last_log_bytes = file_size(log_path);
+      last_qlog_bytes = file_size(qlog_path);
+      logger_fsync(log_path.c_str());
+      logger_fsync(qlog_path.c_str());
+      unlink(lock_path.c_str());
+      LOGW("log writer for %s: max queued %zu KB, %lu stalls, %.1f ms stalled", segment_path.c_str(),
+           stats.max_queued_bytes / 1024, (unsigned long)stats.stalls, stats.stall_ms);
+    });
+    // the encoders closed their files of the segment before letting go of it
+    segment_event_deferred(h, cereal::LoggerdSegment::State::FINALIZED);
     pthread_mutex_unlock(&h->lock);
     pthread_mutex_destroy(&h->lock);
     return;
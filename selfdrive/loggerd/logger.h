@@ -3,13 +3,29 @@
 #include <cassert>
 #include <pthread.h>
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
+#include <deque>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <bzlib.h>
 #include <capnp/serialize.h>
 #include <kj/array.h>
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/util.h"
@@ -20,13 +36,81 @@ const std::string LOG_ROOT = Path::log_root();
 
 #define LOGGER_MAX_HANDLES 16
 
-class BZFile {
+// Compressed log file. The format is picked per file, readers tell them apart
+// by their magic bytes: bz2 "BZh", zstd 28 b5 2f fd and lz4 04 22 4d 18.
+// zstd and lz4 are only there when the sysroot has them (HAVE_ZSTD, HAVE_LZ4),
+// bz2 always is
+enum class LogCompression { BZ2, ZSTD, LZ4 };
+
+struct LogCompressionConfig {
+  LogCompression type;
+  int level;
+};
+
+// Parses "bz2", "zstd" or "lz4" with an optional ":level", e.g. "zstd:9".
+// Falls back to def for empty, unknown or unavailable values
+// rlogs favor cheap compression, qlogs are small and uploaded over cellular
+#ifdef HAVE_ZSTD
+const LogCompressionConfig LOG_COMPRESSION_DEFAULT = {LogCompression::ZSTD, 5};
+const LogCompressionConfig QLOG_COMPRESSION_DEFAULT = {LogCompression::ZSTD, 10};
+#else
+const LogCompressionConfig LOG_COMPRESSION_DEFAULT = {LogCompression::BZ2, 9};
+const LogCompressionConfig QLOG_COMPRESSION_DEFAULT = {LogCompression::BZ2, 9};
+#endif
+
+LogCompressionConfig log_compression_parse(const char* str, LogCompressionConfig def);
+bool log_compression_available(LogCompression type);
+const char* log_compression_extension(LogCompression type);
+
+struct LogBlockInfo {
+  uint64_t mono_start = UINT64_MAX, mono_end = 0;
+  uint64_t services[4] = {};
+
+  inline void add(uint64_t mono_time, unsigned int service) {
+    mono_start = std::min(mono_start, mono_time);
+    mono_end = std::max(mono_end, mono_time);
+    services[(service / 64) % 4] |= 1ULL << (service % 64);
+  }
+  // for blocks whose events weren't parsed
+  static LogBlockInfo unknown() {
+    LogBlockInfo info;
+    info.mono_start = 0;
+    info.mono_end = UINT64_MAX;
+    std::fill(std::begin(info.services), std::end(info.services), UINT64_MAX);
+    return info;
+  }
+};
+
+class LogFile {
+ public:
+  virtual ~LogFile() = default;
+  virtual void write(void* data, size_t size) = 0;
+  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+  // seekable files start a new block after info's events
+  virtual bool seekable() const { return false; }
+  virtual void end_block(const LogBlockInfo& info) {}
+
+ protected:
+  // opens path for writing with reserve bytes set aside for it
+  FILE* open_file(const char* path, uint64_t reserve);
+  // gives back the reserved space that wasn't written, closes and reports the
+  // file with logger_file_closed
+  void close_file(FILE* file);
+  void write_file(FILE* file, const void* data, size_t size);
+  bool error_logged = false;
+  std::string path;
+  uint32_t crc = 0;  // of everything that went through write_file
+};
+
+// reserve is the expected compressed size, see file_preallocate
+std::unique_ptr<LogFile> log_file_open(const char* path, LogCompressionConfig config, uint64_t reserve = 0);
+
+class BZFile : public LogFile {
  public:
-  BZFile(const char* path) {
-    file = fopen(path, "wb");
-    assert(file != nullptr);
+  BZFile(const char* path, int level = 9, uint64_t reserve = 0) {
+    file = open_file(path, reserve);
     int bzerror;
-    bz_file = BZ2_bzWriteOpen(&bzerror, file, 9, 0, 30);
+    bz_file = BZ2_bzWriteOpen(&bzerror, file, level, 0, 30);
     assert(bzerror == BZ_OK);
   }
   ~BZFile() {
@@ -35,10 +119,9 @@ class BZFile {
     if (bzerror != BZ_OK) {
       LOGE("BZ2_bzWriteClose error, bzerror=%d", bzerror);
     }
-    int err = fclose(file);
-    assert(err == 0);
+    close_file(file);
   }
-  inline void write(void* data, size_t size) {
+  void write(void* data, size_t size) override {
     int bzerror;
     do {
       BZ2_bzWrite(&bzerror, bz_file, data, size);
@@ -49,14 +132,135 @@ class BZFile {
       error_logged = true;
     }
   }
-  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+  using LogFile::write;
 
  private:
-  bool error_logged = false;
   FILE* file = nullptr;
   BZFILE* bz_file = nullptr;
 };
 
+// Seekable files (zstd and lz4) are a sequence of independently compressed
+// blocks that each hold whole events, followed by an event index in a skippable
+// frame. All fields are little endian:
+//   u32 0x184D2A5D, u32 frame size
+//   per block: u32 compressed size, u32 uncompressed size,
+//              u64 first and last logMonoTime, u64[4] bit n set if Event union member n is present
+//   u32 block count, u32 version, u32 LOG_INDEX_MAGIC
+// zstd files then end with a seek table in the zstd seekable format.
+#define LOG_INDEX_MAGIC 0x5844494C  // "LIDX"
+#define LOG_INDEX_VERSION 1
+
+class SeekableLogFile : public LogFile {
+ public:
+  bool seekable() const override { return true; }
+  // Compresses data into a frame of its own, safe to call from any thread. The
+  // result is appended with write_block, in place of write and end_block
+  virtual std::vector<uint8_t> compress_block(const uint8_t* data, size_t size) const = 0;
+  void write_block(const std::vector<uint8_t>& block, size_t uncompressed, const LogBlockInfo& info);
+
+ protected:
+  void add_block(size_t compressed, size_t uncompressed, const LogBlockInfo& info);
+  void write_index();
+
+  FILE* file = nullptr;
+  struct Block {
+    uint32_t compressed, uncompressed;
+    LogBlockInfo info;
+  };
+  std::vector<Block> blocks;
+};
+
+#ifdef HAVE_ZSTD
+class ZstdFile : public SeekableLogFile {
+ public:
+  ZstdFile(const char* path, int level, uint64_t reserve = 0);
+  ~ZstdFile();
+  void write(void* data, size_t size) override;
+  void end_block(const LogBlockInfo& info) override;
+  std::vector<uint8_t> compress_block(const uint8_t* data, size_t size) const override;
+  using LogFile::write;
+
+ private:
+  void compress(ZSTD_inBuffer* in, ZSTD_EndDirective mode);
+  void write_seek_table();
+
+  int level;
+  ZSTD_CCtx* cctx = nullptr;
+  std::vector<uint8_t> out_buf;
+  size_t block_in = 0, block_out = 0;
+};
+#endif
+
+#ifdef HAVE_LZ4
+class LZ4File : public SeekableLogFile {
+ public:
+  LZ4File(const char* path, int level, uint64_t reserve = 0);
+  ~LZ4File();
+  void write(void* data, size_t size) override;
+  void end_block(const LogBlockInfo& info) override;
+  std::vector<uint8_t> compress_block(const uint8_t* data, size_t size) const override;
+  using LogFile::write;
+
+ private:
+  void begin_frame();
+  void write_out(size_t size);
+
+  LZ4F_cctx* cctx = nullptr;
+  LZ4F_preferences_t prefs = {};
+  std::vector<uint8_t> out_buf;
+  size_t block_in = 0, block_out = 0;
+  bool in_frame = false;
+};
+#endif
+
+// Compresses a handle's files on its own thread so callers of lh_log only copy
+// the event. Events collect in one chunk per file; a chunk is queued for the
+// writer once it holds LOG_WRITER_CHUNK_SIZE bytes or LOG_WRITER_CHUNK_MS of
+// events while the next one fills, and becomes one block of a seekable file.
+// A caller only blocks when LOG_WRITER_QUEUE_CHUNKS chunks are already waiting.
+// With compression workers (LOGGERD_COMPRESS_THREADS, by default one less than
+// the cores loggerd may run on, at most 4) blocks of seekable files are
+// compressed in parallel and the writer only appends them in order
+#define LOG_WRITER_CHUNK_SIZE (1024 * 1024)
+#define LOG_WRITER_CHUNK_MS 1000
+#define LOG_WRITER_QUEUE_CHUNKS 8
+
+struct LogWriterStats {
+  size_t queued_bytes, max_queued_bytes;
+  uint64_t stalls;
+  double stall_ms;
+};
+
+class LogWriter {
+ public:
+  LogWriter(std::unique_ptr<LogFile> log, std::unique_ptr<LogFile> qlog);
+  // writes everything still queued before returning
+  ~LogWriter();
+  void write(const uint8_t* data, size_t size, bool in_qlog);
+  LogWriterStats stats();
+
+ private:
+  struct Chunk {
+    LogFile* file;
+    std::vector<uint8_t> data;
+  };
+  void append(std::vector<uint8_t>& chunk, double& chunk_start, LogFile* file, const uint8_t* data, size_t size);
+  void push(LogFile* file, std::vector<uint8_t>& chunk);
+  void writer_thread();
+
+  std::unique_ptr<LogFile> log, q_log;
+  std::vector<uint8_t> log_chunk, qlog_chunk;
+  double log_chunk_start = 0, qlog_chunk_start = 0;
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<Chunk> queue;
+  std::vector<std::vector<uint8_t>> free_chunks;
+  LogWriterStats writer_stats = {};
+  bool exit = false;
+  std::thread thread;
+};
+
 typedef cereal::Sentinel::SentinelType SentinelType;
 
 typedef struct LoggerHandle {
@@ -64,11 +268,15 @@ typedef struct LoggerHandle {
   SentinelType end_sentinel_type;
   int exit_signal;
   int refcnt;
+  int part;
+  bool used;  // taken as the next segment before the logger rotated to it
   char segment_path[4096];
   char log_path[4096];
   char qlog_path[4096];
   char lock_path[4096];
-  std::unique_ptr<BZFile> log, q_log;
+  char manifest_path[4096];
+  std::string route_name;
+  std::unique_ptr<LogWriter> writer;
 } LoggerHandle;
 
 typedef struct LoggerState {
@@ -78,11 +286,24 @@ typedef struct LoggerState {
   std::string route_name;
   char log_name[64];
   bool has_qlog;
+  LogCompressionConfig log_compression, qlog_compression;
 
   LoggerHandle handles[LOGGER_MAX_HANDLES];
   LoggerHandle* cur_handle;
+  LoggerHandle* next_handle;  // opened ahead of the next rotation
 } LoggerState;
 
+// Runs the slow part of closing a segment's files (trailers, fsync, fclose,
+// removing the lock) on one background thread, in order
+void logger_close_deferred(std::function<void()> task);
+// waits until everything deferred so far is closed
+void logger_wait_closed();
+int logger_fsync(const char* path);
+// Size and CRC-32 of a segment file that was just closed, they go into the
+// segment's finalized event. Files nothing reports are listed with their size
+// on disk and no checksum
+void logger_file_closed(const std::string& path, uint64_t size, uint32_t crc);
+
 int logger_mkpath(char* file_path);
 kj::Array<capnp::word> logger_build_init_data();
 std::string logger_get_route_name();
@@ -91,8 +312,12 @@ int logger_next(LoggerState *s, const char* root_path,
                             char* out_segment_path, size_t out_segment_path_len,
                             int* out_part);
 LoggerHandle* logger_get_handle(LoggerState *s);
+// the pre-opened handle of the segment after the current one, for switching to
+// it at a frame boundary before the logger rotates. NULL if there is none
+LoggerHandle* logger_get_next_handle(LoggerState *s);
 void logger_close(LoggerState *s, ExitHandler *exit_handler=nullptr);
 void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog);
+LogWriterStats logger_writer_stats(LoggerState *s);
 
 void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog);
 void lh_close(LoggerHandle* h);
@@ -1,8 +1,11 @@
+#include <dirent.h>
 #include <ftw.h>
 #include <pthread.h>
-#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cerrno>
@@ -11,8 +14,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <mutex>
 #include <random>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -22,14 +27,20 @@
 #include "cereal/visionipc/visionipc.h"
 #include "cereal/visionipc/visionipc_client.h"
 #include "selfdrive/camerad/cameras/camera_common.h"
+#include "selfdrive/common/load_governor.h"
+#include "selfdrive/common/metrics.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/sched.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
 
+#include "selfdrive/loggerd/column_logger.h"
 #include "selfdrive/loggerd/encoder.h"
+#include "selfdrive/loggerd/file_sink.h"
 #include "selfdrive/loggerd/logger.h"
+#include "selfdrive/loggerd/route_index.h"
 #if defined(QCOM) || defined(QCOM2)
 #include "selfdrive/loggerd/omx_encoder.h"
 #define Encoder OmxEncoder
@@ -51,6 +62,28 @@ const int SEGMENT_LENGTH = LOGGERD_TEST ? atoi(getenv("LOGGERD_SEGMENT_LENGTH"))
 
 ExitHandler do_exit;
 
+// the disk counts as falling behind for a second with any of these
+#define DISK_MAX_LATENCY_MS 250.  // a single write
+#define DISK_AVG_LATENCY_MS 50.
+#define DISK_MAX_QUEUED_BYTES (LOG_WRITER_QUEUE_CHUNKS * LOG_WRITER_CHUNK_SIZE / 2)
+#define DISK_MIN_FREE_BYTES (2ULL * 1024 * 1024 * 1024)  // deleter.py keeps 5 GB free, it's not keeping up
+// degrade one step after this many unhealthy seconds, recover one step after this many healthy ones
+#define DISK_DEGRADE_SECONDS 2
+#define DISK_RECOVER_SECONDS 30
+#define DISK_STEP_MS 10000.  // at least this long between two steps
+
+// dashcam: the road camera as MP4s of DASHCAM_DURATION each in DASHCAM_ROOT,
+// the oldest are deleted past DASHCAM_MAX_BYTES or with the disk getting full
+#define DASHCAM_DURATION 180  // s
+#define DASHCAM_BITRATE 4000000
+#define DASHCAM_MAX_BYTES (21ULL * 1024 * 1024 * 1024)  // 12 h
+#define DASHCAM_MIN_FREE 0.15  // of the disk
+const char *DASHCAM_ROOT = "/data/media/0/dashcam";
+// set by the manager when only the dashcam is wanted, no logs or segments
+const bool DASHCAM_ONLY = getenv("LOGGERD_DASHCAM_ONLY");
+
+typedef cereal::LoggerdState::Degradation Degradation;
+
 const LogCameraInfo cameras_logged[] = {
   {
     .type = RoadCam,
@@ -94,17 +127,83 @@ const LogCameraInfo cameras_logged[] = {
 };
 const LogCameraInfo qcam_info = {
   .filename = "qcamera.ts",
+  .stream_type = VISION_STREAM_YUV_BACK_SMALL,  // prescaled by camerad on device
   .fps = MAIN_FPS,
   .bitrate = 256000,
   .is_h265 = false,
   .downscale = true,
-  .frame_width = Hardware::TICI() ? 526 : 480,
-  .frame_height = Hardware::TICI() ? 330 : 360 // keep pixel count the same?
+  .frame_width = QCAM_WIDTH,
+  .frame_height = QCAM_HEIGHT // keep pixel count the same?
+};
+
+// fields written to columns.npz next to every rlog when RecordColumns is set
+const std::vector<ColumnSpec> columns_logged = {
+  {"carState", {"vEgo", "aEgo", "steeringAngleDeg", "steeringPressed", "gasPressed", "brakePressed"}},
+  {"controlsState", {"enabled", "vCruise", "curvature"}},
+  {"modelV2", {"leadsV3[0].prob", "leadsV3[1].prob", "leadsV3[2].prob"}},
 };
 
+// services the rlog keeps only every RLOG_DECIMATION-th message of at Degradation::DECIMATE_RLOG,
+// messages that go into the qlog are always kept
+#define RLOG_DECIMATION 4
+const char *rlog_low_priority[] = {
+  "sensorEvents", "gpsNMEA", "ubloxRaw", "ubloxGnss", "liveTracks", "procLog", "androidLog", "cameraOdometry",
+};
+
+// Applies the overrides for cam_info from the EncoderProfiles param, one camera per line:
+//   fcamera.hevc: bitrate=8000000 rc=cbr gop=40 bframes=0 idr=1 intra_refresh=0 codec=hevc
+EncoderProfile encoder_profile(const LogCameraInfo &cam_info, const std::string &overrides) {
+  EncoderProfile profile = {
+    .h265 = cam_info.is_h265,
+    .bitrate = cam_info.bitrate,
+    .cbr = false,
+    .gop = 0,
+    .bframes = 0,
+    .idr_at_segment_start = true,
+    .intra_refresh_mbs = 0,
+  };
+
+  std::istringstream lines(overrides);
+  for (std::string line; std::getline(lines, line);) {
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos || line.substr(0, colon) != cam_info.filename) continue;
+
+    std::istringstream options(line.substr(colon + 1));
+    for (std::string option; options >> option;) {
+      const size_t eq = option.find('=');
+      const std::string key = option.substr(0, eq), value = eq == std::string::npos ? "" : option.substr(eq + 1);
+      try {
+        if (key == "codec") {
+          // qcamera is always remuxed h264
+          if (cam_info.is_h265) profile.h265 = value != "h264";
+        } else if (key == "bitrate") {
+          profile.bitrate = std::stoi(value);
+        } else if (key == "rc") {
+          profile.cbr = value == "cbr";
+        } else if (key == "gop") {
+          profile.gop = std::stoi(value);
+        } else if (key == "bframes") {
+          profile.bframes = std::stoi(value);
+        } else if (key == "idr") {
+          profile.idr_at_segment_start = value != "0";
+        } else if (key == "intra_refresh") {
+          profile.intra_refresh_mbs = std::stoi(value);
+        } else {
+          LOGW("%s: unknown encoder option %s", cam_info.filename, option.c_str());
+        }
+      } catch (const std::exception &e) {
+        LOGW("%s: invalid encoder option %s", cam_info.filename, option.c_str());
+      }
+    }
+  }
+  return profile;
+}
+
 struct LoggerdState {
   Context *ctx;
   LoggerState logger = {};
+  std::unique_ptr<ColumnLogger> columns;
+  std::unique_ptr<RouteIndex> route_index;
   char segment_path[4096];
   std::mutex rotate_lock;
   std::condition_variable rotate_cv;
@@ -114,6 +213,14 @@ struct LoggerdState {
   int max_waiting = 0;
   double last_rotate_tms = 0.;
 
+  // disk health, only the degradation is read by the encoder threads
+  std::atomic<int> degradation;
+  struct {
+    double last_check_tms, last_step_tms;
+    uint64_t bytes, writes, write_us, stalls;
+    int unhealthy_seconds, healthy_seconds;
+  } disk;
+
   // Sync logic for startup
   std::atomic<bool> encoders_synced;
   std::atomic<int> encoders_ready;
@@ -127,10 +234,18 @@ void encoder_thread(const LogCameraInfo &cam_info) {
 
   int cnt = 0, cur_seg = -1;
   int encode_idx = 0;
+  bool low_bitrate = false;
   LoggerHandle *lh = NULL;
+  const std::string profile_overrides = Params().get("EncoderProfiles");
+  const EncoderProfile profile = encoder_profile(cam_info, profile_overrides);
+  const EncoderProfile qcam_profile = encoder_profile(qcam_info, profile_overrides);
   std::vector<Encoder *> encoders;
   VisionIpcClient vipc_client = VisionIpcClient("camerad", cam_info.stream_type, false);
 
+  // camerad on device publishes the road camera already downscaled for qcamera
+  const bool use_small_stream = cam_info.has_qcamera && (Hardware::EON() || Hardware::TICI());
+  VisionIpcClient qcam_client = VisionIpcClient("camerad", qcam_info.stream_type, false);
+
   bool ready = false;
 
   while (!do_exit) {
@@ -138,6 +253,9 @@ void encoder_thread(const LogCameraInfo &cam_info) {
       util::sleep_for(5);
       continue;
     }
+    if (use_small_stream) {
+      qcam_client.connect(false);
+    }
 
     // init encoders
     if (encoders.empty()) {
@@ -146,11 +264,11 @@ void encoder_thread(const LogCameraInfo &cam_info) {
 
       // main encoder
       encoders.push_back(new Encoder(cam_info.filename, buf_info.width, buf_info.height,
-                                     cam_info.fps, cam_info.bitrate, cam_info.is_h265, cam_info.downscale));
+                                     cam_info.fps, profile, cam_info.downscale));
       // qcamera encoder
       if (cam_info.has_qcamera) {
         encoders.push_back(new Encoder(qcam_info.filename, qcam_info.frame_width, qcam_info.frame_height,
-                                       qcam_info.fps, qcam_info.bitrate, qcam_info.is_h265, qcam_info.downscale));
+                                       qcam_info.fps, qcam_profile, qcam_info.downscale));
       }
     }
 
@@ -182,23 +300,47 @@ void encoder_thread(const LogCameraInfo &cam_info) {
         s.last_camera_seen_tms = millis_since_boot();
       }
 
-      if (cam_info.trigger_rotate && (cnt >= SEGMENT_LENGTH * MAIN_FPS)) {
-        // trigger rotate and wait logger rotated to new segment
-        ++s.waiting_rotate;
-        std::unique_lock lk(s.rotate_lock);
-        s.rotate_cv.wait(lk, [&] { return s.rotate_segment > cur_seg || do_exit; });
+      if (cam_info.trigger_rotate && (cnt >= SEGMENT_LENGTH * MAIN_FPS) && s.rotate_segment == cur_seg) {
+        LoggerHandle *next = logger_get_next_handle(&s.logger);
+        if (next == nullptr) {
+          // nothing opened ahead, trigger rotate and wait logger rotated to new segment
+          ++s.waiting_rotate;
+          std::unique_lock lk(s.rotate_lock);
+          s.rotate_cv.wait(lk, [&] { return s.rotate_segment > cur_seg || do_exit; });
+        } else {
+          // switch to the pre-opened segment at this frame, the old files are closed
+          // in the background and the logger rotates once every camera got here
+          cur_seg = next->part;
+          cnt = 0;
+
+          LOGW("camera %d rotate encoder to %s", cam_info.type, next->segment_path);
+          for (auto &e : encoders) {
+            e->encoder_close();
+            e->encoder_open(next->segment_path);
+          }
+          if (lh) {
+            lh_close(lh);
+          }
+          lh = next;
+          ++s.waiting_rotate;
+        }
       }
       if (do_exit) break;
 
       // rotate the encoder if the logger is on a newer segment
       if (s.rotate_segment > cur_seg) {
-        cur_seg = s.rotate_segment;
+        char segment_path[4096];
+        {
+          std::unique_lock lk(s.rotate_lock);
+          cur_seg = s.rotate_segment;
+          snprintf(segment_path, sizeof(segment_path), "%s", s.segment_path);
+        }
         cnt = 0;
 
-        LOGW("camera %d rotate encoder to %s", cam_info.type, s.segment_path);
+        LOGW("camera %d rotate encoder to %s", cam_info.type, segment_path);
         for (auto &e : encoders) {
           e->encoder_close();
-          e->encoder_open(s.segment_path);
+          e->encoder_open(segment_path);
         }
         if (lh) {
           lh_close(lh);
@@ -206,10 +348,48 @@ void encoder_thread(const LogCameraInfo &cam_info) {
         lh = logger_get_handle(&s.logger);
       }
 
+      // step down while the disk falls behind, this only reads an atomic so the road camera never waits on it
+      const int degradation = s.degradation.load(std::memory_order_relaxed);
+      if ((degradation >= (int)Degradation::LOW_BITRATE) != low_bitrate) {
+        low_bitrate = !low_bitrate;
+        for (int i = 0; i < encoders.size(); ++i) {
+          const int bitrate = i == 0 ? profile.bitrate : qcam_profile.bitrate;
+          encoders[i]->set_bitrate(low_bitrate ? bitrate / 2 : bitrate);
+        }
+      }
+      if (cam_info.type == DriverCam && degradation >= (int)Degradation::NO_DRIVER_CAMERA) {
+        // dropped frames still count towards the segment length
+        cnt++;
+        continue;
+      }
+
+      // find the downscaled copy of this frame, otherwise qcamera scales the full frame
+      VisionBuf *qcam_buf = nullptr;
+      if (qcam_client.connected) {
+        VisionIpcBufExtra qcam_extra;
+        while (VisionBuf *b = qcam_client.recv(&qcam_extra, 5)) {
+          if (qcam_extra.frame_id >= extra.frame_id) {
+            if (qcam_extra.frame_id == extra.frame_id) qcam_buf = b;
+            break;
+          }
+        }
+      }
+
+      // camerad ran out of free buffers and reused this one, what's there now isn't this frame
+      if (buf->overwritten()) {
+        LOGW("%s frame %d overwritten before encoding, dropped", cam_info.filename, extra.frame_id);
+        cnt++;
+        continue;
+      }
+      if (qcam_buf != nullptr && qcam_buf->overwritten()) qcam_buf = nullptr;
+
       // encode a frame
       for (int i = 0; i < encoders.size(); ++i) {
-        int out_id = encoders[i]->encode_frame(buf->y, buf->u, buf->v,
-                                               buf->width, buf->height, extra.timestamp_eof);
+        // qcamera goes to half rate under load
+        if (i == 1 && extra.frame_id % 2 && load_shed(LoadShed::QCAMERA)) continue;
+        VisionBuf *src = (i == 1 && qcam_buf != nullptr) ? qcam_buf : buf;
+        int out_id = encoders[i]->encode_frame(src->y, src->u, src->v,
+                                               src->width, src->height, extra.timestamp_eof);
         
         if (out_id == -1) {
           LOGE("Failed to encode frame. frame_id: %d encode_id: %d", extra.frame_id, encode_idx);
@@ -257,6 +437,107 @@ void encoder_thread(const LogCameraInfo &cam_info) {
   }
 }
 
+void dashcam_clean_up(const std::string &recording) {
+  DIR *dir = opendir(DASHCAM_ROOT);
+  if (dir == nullptr) return;
+  // named by their start time, sorted they're oldest first
+  std::vector<std::pair<std::string, uint64_t>> files;
+  uint64_t total = 0;
+  while (struct dirent *ent = readdir(dir)) {
+    const std::string name = ent->d_name;
+    struct stat st;
+    const std::string path = std::string(DASHCAM_ROOT) + "/" + name;
+    const bool mp4 = name.size() > 4 && name.compare(name.size() - 4, 4, ".mp4") == 0;
+    if (!mp4 || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+    total += st.st_size;
+    if (name != recording) files.push_back({path, st.st_size});
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+
+  auto low_on_space = []() {
+    struct statvfs st;
+    return statvfs(DASHCAM_ROOT, &st) == 0 && st.f_bavail < st.f_blocks * DASHCAM_MIN_FREE;
+  };
+  for (const auto &[path, size] : files) {
+    if (total <= DASHCAM_MAX_BYTES && !low_on_space()) break;
+    if (unlink(path.c_str()) != 0) {
+      LOGE("failed to delete %s: %s", path.c_str(), strerror(errno));
+      break;
+    }
+    total -= size;
+  }
+}
+
+void dashcam_thread() {
+  set_thread_name("dashcam");
+  if (mkdir(DASHCAM_ROOT, 0775) != 0 && errno != EEXIST) {
+    LOGE("failed to create %s: %s", DASHCAM_ROOT, strerror(errno));
+    return;
+  }
+
+  // the encoder keeps the pointer, the name is written in place for every file
+  char filename[64] = "dashcam.mp4";
+  const EncoderProfile profile = {
+    .h265 = false,  // remuxed, into MP4 by the name
+    .bitrate = DASHCAM_BITRATE,
+    .cbr = false,
+    .gop = 0,
+    .bframes = 0,
+    .idr_at_segment_start = true,
+    .intra_refresh_mbs = 0,
+  };
+  std::unique_ptr<Encoder> encoder;
+  VisionIpcClient vipc_client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  int cnt = 0;
+  bool recording = false, low_bitrate = false;
+
+  while (!do_exit) {
+    if (!vipc_client.connect(false)) {
+      util::sleep_for(5);
+      continue;
+    }
+    if (!encoder) {
+      VisionBuf buf_info = vipc_client.buffers[0];
+      encoder = std::make_unique<Encoder>(filename, buf_info.width, buf_info.height, MAIN_FPS, profile, false);
+    }
+
+    while (!do_exit) {
+      VisionIpcBufExtra extra;
+      VisionBuf* buf = vipc_client.recv(&extra);
+      if (buf == nullptr) continue;
+
+      if (!recording || cnt >= DASHCAM_DURATION * MAIN_FPS) {
+        encoder->encoder_close();
+        const time_t t = time(nullptr);
+        struct tm tm;
+        strftime(filename, sizeof(filename), "%Y-%m-%d_%H-%M-%S.mp4", localtime_r(&t, &tm));
+        encoder->encoder_open(DASHCAM_ROOT);
+        recording = true;
+        cnt = 0;
+        LOGW("dashcam recording to %s/%s", DASHCAM_ROOT, filename);
+        // after the last file is finished on the closer thread
+        logger_close_deferred([recording = std::string(filename)]() { dashcam_clean_up(recording); });
+      }
+
+      const int degradation = s.degradation.load(std::memory_order_relaxed);
+      if ((degradation >= (int)Degradation::LOW_BITRATE) != low_bitrate) {
+        low_bitrate = !low_bitrate;
+        encoder->set_bitrate(low_bitrate ? DASHCAM_BITRATE / 2 : DASHCAM_BITRATE);
+      }
+
+      if (buf->overwritten()) {
+        LOGW("dashcam frame %d overwritten before encoding, dropped", extra.frame_id);
+      } else if (encoder->encode_frame(buf->y, buf->u, buf->v, buf->width, buf->height, extra.timestamp_eof) == -1) {
+        LOGE("dashcam failed to encode frame %d", extra.frame_id);
+      }
+      cnt++;
+    }
+  }
+
+  if (encoder) encoder->encoder_close();
+}
+
 int clear_locks_fn(const char* fpath, const struct stat *sb, int tyupeflag) {
   const char* dot = strrchr(fpath, '.');
   if (dot && strcmp(dot, ".lock") == 0) {
@@ -270,6 +551,12 @@ void clear_locks() {
 }
 
 void logger_rotate() {
+  if (s.columns && s.logger.part >= 0) {
+    s.columns->write(s.segment_path);
+  }
+  if (s.route_index && s.logger.part >= 0) {
+    s.route_index->finish_segment(s.logger.part, (millis_since_boot() - s.last_rotate_tms) / 1000.);
+  }
   {
     std::unique_lock lk(s.rotate_lock);
     int segment = -1;
@@ -297,21 +584,99 @@ void rotate_if_needed() {
   }
 }
 
+void update_disk_health(PubMaster &pm) {
+  const double tms = millis_since_boot();
+  const double dt = tms - s.disk.last_check_tms;
+  if (dt < 1000.) return;
+  s.disk.last_check_tms = tms;
+
+  const uint64_t bytes = file_write_stats.bytes, writes = file_write_stats.writes;
+  const uint64_t write_us = file_write_stats.write_us, stalls = file_write_stats.stalls;
+  const double max_ms = file_write_stats.max_write_us.exchange(0) / 1000.;
+  const uint64_t window_writes = writes - s.disk.writes, window_stalls = stalls - s.disk.stalls;
+  const double avg_ms = window_writes > 0 ? (write_us - s.disk.write_us) / 1000. / window_writes : 0;
+  const double rate = (bytes - s.disk.bytes) * 1000. / dt;
+  s.disk.bytes = bytes;
+  s.disk.writes = writes;
+  s.disk.write_us = write_us;
+  s.disk.stalls = stalls;
+
+  const LogWriterStats ws = logger_writer_stats(&s.logger);
+  struct statvfs st;
+  const uint64_t free_bytes = statvfs(LOG_ROOT.c_str(), &st) == 0 ? (uint64_t)st.f_bavail * st.f_frsize : UINT64_MAX;
+
+  const bool healthy = window_stalls == 0 && max_ms < DISK_MAX_LATENCY_MS && avg_ms < DISK_AVG_LATENCY_MS &&
+                       ws.queued_bytes < DISK_MAX_QUEUED_BYTES && free_bytes >= DISK_MIN_FREE_BYTES;
+  s.disk.unhealthy_seconds = healthy ? 0 : s.disk.unhealthy_seconds + 1;
+  s.disk.healthy_seconds = healthy ? s.disk.healthy_seconds + 1 : 0;
+
+  int degradation = s.degradation;
+  if (tms - s.disk.last_step_tms >= DISK_STEP_MS) {
+    if (s.disk.unhealthy_seconds >= DISK_DEGRADE_SECONDS && degradation < (int)Degradation::DECIMATE_RLOG) {
+      degradation++;
+    } else if (s.disk.healthy_seconds >= DISK_RECOVER_SECONDS && degradation > (int)Degradation::NONE) {
+      degradation--;
+      s.disk.healthy_seconds = 0;
+    }
+  }
+  if (degradation != s.degradation) {
+    LOGW("disk %s, degradation %d -> %d: %.0f KB/s, latency avg %.1f ms max %.1f ms, %lu stalls, queued %zu KB, free %lu MB",
+         healthy ? "recovered" : "falling behind", s.degradation.load(), degradation, rate / 1024, avg_ms, max_ms,
+         (unsigned long)window_stalls, ws.queued_bytes / 1024, (unsigned long)(free_bytes / (1024 * 1024)));
+    s.degradation = degradation;
+    s.disk.last_step_tms = tms;
+  }
+
+  MessageBuilder msg;
+  auto state = msg.initEvent().initLoggerdState();
+  state.setWriteBytesPerSec(rate);
+  state.setWriteLatencyAvgMs(avg_ms);
+  state.setWriteLatencyMaxMs(max_ms);
+  state.setWriterQueuedBytes(ws.queued_bytes);
+  state.setStalls(window_stalls);
+  state.setFreeBytes(free_bytes);
+  state.setDegradation((Degradation)degradation);
+  pm.send("loggerdState", msg);
+}
+
 } // namespace
 
 int main(int argc, char** argv) {
-  setpriority(PRIO_PROCESS, 0, -20);
+  sched_apply("loggerd", "main");
 
   clear_locks();
 
+  const bool dashcam = Params().getBool("dp_dashcamd") && (Hardware::EON() || Hardware::TICI());
+  if (DASHCAM_ONLY) {
+    std::thread dashcam_recorder;
+    if (dashcam) dashcam_recorder = std::thread(dashcam_thread);
+    while (!do_exit) util::sleep_for(100);
+    if (dashcam_recorder.joinable()) dashcam_recorder.join();
+    logger_wait_closed();
+    return 0;
+  }
+
   // setup messaging
   typedef struct QlogState {
     int counter, freq;
+    int columns;
+    bool route_index;
+    bool low_priority;
+    int rlog_counter;
+    bool qlog_only;
   } QlogState;
   std::unordered_map<SubSocket*, QlogState> qlog_states;
 
+  if (Params().getBool("RecordColumns")) {
+    s.columns = std::make_unique<ColumnLogger>(columns_logged);
+  }
+
   s.ctx = Context::create();
   Poller * poller = Poller::create();
+  PubMaster pm({"loggerdState"});
+
+  // modeld sends modelV2Compact for the rlog, the full modelV2 is only kept where the qlog has it
+  const bool model_compact = Params().getBool("LogModelCompact");
 
   // subscribe to all socks
   for (const auto& it : services) {
@@ -320,11 +685,19 @@ int main(int argc, char** argv) {
     SubSocket * sock = SubSocket::create(s.ctx, it.name);
     assert(sock != NULL);
     poller->registerSocket(sock);
-    qlog_states[sock] = {.counter = 0, .freq = it.decimation};
+    const bool low_priority = std::any_of(std::begin(rlog_low_priority), std::end(rlog_low_priority),
+                                          [&](const char *name) { return strcmp(name, it.name) == 0; });
+    qlog_states[sock] = {.counter = 0, .freq = it.decimation,
+                         .columns = s.columns ? s.columns->service_index(it.name) : -1,
+                         .route_index = strcmp(it.name, "carState") == 0 || strcmp(it.name, "thumbnail") == 0,
+                         .low_priority = low_priority, .rlog_counter = 0,
+                         .qlog_only = model_compact && strcmp(it.name, "modelV2") == 0};
   }
 
+
   // init logger
   logger_init(&s.logger, "rlog", true);
+  s.route_index = std::make_unique<RouteIndex>(LOG_ROOT, s.logger.route_name);
   logger_rotate();
   Params().put("CurrentRoute", s.logger.route_name);
 
@@ -337,9 +710,18 @@ int main(int argc, char** argv) {
       if (ci.trigger_rotate) s.max_waiting++;
     }
   }
+  if (dashcam) {
+    encoder_threads.push_back(std::thread(dashcam_thread));
+  }
 
-  uint64_t msg_count = 0, bytes_count = 0;
-  double start_ts = millis_since_boot();
+  AlignedBuffer recv_buf;
+  uint64_t msg_count = 0;
+  metrics::Counter &messages = metrics::counter("messages");
+  metrics::Counter &bytes_count = metrics::counter("bytes");
+  metrics::Gauge &writer_queue = metrics::gauge("writer_queue_bytes");
+  metrics::Gauge &writer_queue_max = metrics::gauge("writer_queue_max_bytes");
+  metrics::Gauge &writer_stalls = metrics::gauge("writer_stalls");
+  metrics::Gauge &writer_stall_ms = metrics::gauge("writer_stall_ms");
   while (!do_exit) {
     // Check if all encoders are ready and start encoding at the same time
     if ((s.max_waiting > 1) && !s.encoders_synced && (s.encoders_ready == s.max_waiting)) {
@@ -350,22 +732,42 @@ int main(int argc, char** argv) {
     }
 
 
+    update_disk_health(pm);
+
     // poll for new messages on all sockets
     for (auto sock : poller->poll(1000)) {
       // drain socket
       QlogState &qs = qlog_states[sock];
-      Message *msg = nullptr;
-      while (!do_exit && (msg = sock->receive(true))) {
+      // receive into one reused buffer, msgq copies straight from the ring without allocating
+      kj::ArrayPtr<const capnp::word> words;
+      while (!do_exit && (words = sock->receiveAligned(recv_buf)).size() > 0) {
         const bool in_qlog = qs.freq != -1 && (qs.counter++ % qs.freq == 0);
-        logger_log(&s.logger, (uint8_t *)msg->getData(), msg->getSize(), in_qlog);
-        bytes_count += msg->getSize();
-        delete msg;
+        if (qs.low_priority && !in_qlog && (qs.rlog_counter++ % RLOG_DECIMATION != 0) &&
+            s.degradation >= (int)Degradation::DECIMATE_RLOG) {
+          continue;
+        }
+        auto bytes = recv_buf.bytes();
+        if (qs.columns != -1) {
+          s.columns->log(qs.columns, words);
+        }
+        if (qs.qlog_only && !in_qlog) {
+          continue;
+        }
+        logger_log(&s.logger, (uint8_t *)bytes.begin(), bytes.size(), in_qlog);
+        if (qs.route_index) {
+          s.route_index->log(words);
+        }
+        bytes_count.add(bytes.size());
+        messages.add();
 
         rotate_if_needed();
 
         if ((++msg_count % 1000) == 0) {
-          double seconds = (millis_since_boot() - start_ts) / 1000.0;
-          LOGD("%lu messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
+          LogWriterStats ws = logger_writer_stats(&s.logger);
+          writer_queue.set(ws.queued_bytes);
+          writer_queue_max.set(ws.max_queued_bytes);
+          writer_stalls.set(ws.stalls);
+          writer_stall_ms.set(ws.stall_ms);
         }
       }
     }
@@ -376,7 +778,12 @@ int main(int argc, char** argv) {
   for (auto &t : encoder_threads) t.join();
 
   LOGW("closing logger");
+  if (s.columns) {
+    s.columns->write(s.segment_path);
+  }
+  s.route_index->finish_segment(s.logger.part, (millis_since_boot() - s.last_rotate_tms) / 1000.);
   logger_close(&s.logger, &do_exit);
+  logger_wait_closed();
 
   if (do_exit.power_failure) {
     LOGE("power failure");
@@ -0,0 +1,97 @@
+"""Decodes the modelV2Compact that modeld logs with LogModelCompact back into modelV2,
+see selfdrive/modeld/models/model_compact.cc for the encoding."""
+import numpy as np
+
+
+def _varints(data):
+  """zigzag varints -> int64"""
+  b = np.frombuffer(data, dtype=np.uint8)
+  if len(b) == 0:
+    return np.zeros(0, dtype=np.int64)
+  ends = np.flatnonzero(b < 0x80)
+  starts = np.concatenate(([0], ends[:-1] + 1))
+  idx = np.arange(len(b)) - np.repeat(starts, ends - starts + 1)
+  z = np.zeros(len(ends), dtype=np.uint64)
+  np.add.at(z, np.repeat(np.arange(len(ends)), ends - starts + 1),
+            (b & 0x7f).astype(np.uint64) << (7 * idx).astype(np.uint64))
+  return (z >> np.uint64(1)).astype(np.int64) ^ -(z & np.uint64(1)).astype(np.int64)
+
+
+def _fill(builder, values, counts, pos):
+  """Sets the floats of builder in schema order, the same walk as the encoder. pos is [leaf, value]"""
+  for field in builder.schema.node.struct.fields:
+    if field.which() != 'slot':
+      continue
+    name, t = field.name, field.slot.type
+    kind = t.which()
+    if kind == 'float32':
+      setattr(builder, name, float(values[pos[1]]))
+      pos[0] += 1
+      pos[1] += 1
+    elif kind == 'struct':
+      _fill(getattr(builder, name), values, counts, pos)
+    elif kind == 'list' and t.list.elementType.which() == 'float32':
+      n = counts[pos[0]]
+      setattr(builder, name, values[pos[1]:pos[1] + n].tolist())
+      pos[0] += 1
+      pos[1] += n
+    elif kind == 'list' and t.list.elementType.which() == 'struct':
+      for elem in getattr(builder, name):
+        _fill(elem, values, counts, pos)
+
+
+class ModelV2Decoder():
+  """Feed it the modelV2Compact events of a log in order. A log read from the middle, or with a
+  dropped message, decodes from the next keyframe on, what's before is None."""
+  def __init__(self):
+    self.counts = None
+    self.scales = None
+    self.prev = None
+    self.frame_id = None
+
+  def decode(self, compact):
+    if compact.keyframe:
+      self.counts = list(compact.counts)
+      self.scales = np.repeat(np.array(compact.scales, dtype=np.float64), self.counts)
+      self.prev = np.zeros(len(self.scales), dtype=np.int64)
+    elif self.prev is None or compact.refFrameId != self.frame_id:
+      self.prev = None
+      return None
+
+    deltas = _varints(compact.values)
+    if len(deltas) != len(self.prev):
+      self.prev = None
+      return None
+    self.prev = self.prev + deltas
+
+    model = compact.skeleton.as_builder()
+    _fill(model, (self.prev * self.scales).astype(np.float32), self.counts, [0, 0])
+    self.frame_id = model.frameId
+    return model
+
+
+def model_v2(events):
+  """(logMonoTime, modelV2) of a log, whether it has the full modelV2 or the compact one,
+  or both like the rlog with LogModelCompact where every qlog'd frame is full as well"""
+  decoder = ModelV2Decoder()
+  seen = set()
+  for msg in events:
+    which = msg.which()
+    if which == 'modelV2':
+      model = msg.modelV2
+    elif which == 'modelV2Compact':
+      model = decoder.decode(msg.modelV2Compact)
+    else:
+      continue
+    if model is not None and model.frameId not in seen:
+      seen.add(model.frameId)
+      yield msg.logMonoTime, model
+
+
+if __name__ == "__main__":
+  import sys
+  from selfdrive.loggerd.log_reader_pyx import LogReader  # pylint: disable=no-name-in-module,import-error
+
+  lr = LogReader(sys.argv[1], services=['modelV2', 'modelV2Compact'])
+  n = sum(1 for _ in model_v2(lr))
+  print(f"{n} modelV2 frames of {len(lr)} events")
@@ -9,6 +9,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
+#include <string>
 
 #include <OMX_Component.h>
 #include <OMX_IndexExt.h>
@@ -19,6 +20,7 @@
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/loggerd/include/msm_media_info.h"
+#include "selfdrive/loggerd/logger.h"
 
 // Check the OMX error code and assert if an error occurred.
 #define OMX_CHECK(_expr)              \
@@ -156,12 +158,16 @@ static const char* omx_color_fomat_name(uint32_t format) {
 
 // ***** encoder functions *****
 
-OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale) {
+OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, const EncoderProfile &profile, bool downscale) {
   this->filename = filename;
   this->width = width;
   this->height = height;
   this->fps = fps;
-  this->remuxing = !h265;
+  this->profile = profile;
+  this->bitrate = profile.bitrate;
+  this->remuxing = !profile.h265;
+  const bool h265 = profile.h265;
+  const int bitrate = profile.bitrate;
 
   this->downscale = downscale;
   if (this->downscale) {
@@ -226,7 +232,7 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
   bitrate_type.nSize = sizeof(bitrate_type);
   bitrate_type.nPortIndex = (OMX_U32) PORT_INDEX_OUT;
   OMX_CHECK(OMX_GetParameter(this->handle, OMX_IndexParamVideoBitrate, (OMX_PTR) &bitrate_type));
-  bitrate_type.eControlRate = OMX_Video_ControlRateVariable;
+  bitrate_type.eControlRate = profile.cbr ? OMX_Video_ControlRateConstant : OMX_Video_ControlRateVariable;
   bitrate_type.nTargetBitrate = bitrate;
 
   OMX_CHECK(OMX_SetParameter(this->handle, OMX_IndexParamVideoBitrate, (OMX_PTR) &bitrate_type));
@@ -257,6 +263,10 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
 
     avc.nBFrames = 0;
     avc.nPFrames = 15;
+    if (profile.gop > 0) {
+      avc.nPFrames = (profile.gop - 1) / (profile.bframes + 1);
+      avc.nBFrames = profile.gop - 1 - avc.nPFrames;
+    }
 
     avc.eProfile = OMX_VIDEO_AVCProfileHigh;
     avc.eLevel = OMX_VIDEO_AVCLevel31;
@@ -273,6 +283,26 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
     OMX_CHECK(OMX_SetParameter(this->handle, OMX_IndexParamVideoAvc, &avc));
   }
 
+  if (profile.gop > 0) {
+    // every I frame is an IDR frame, so a file can be cut at any of them
+    QOMX_VIDEO_INTRAPERIODTYPE intra_period = {0};
+    intra_period.nSize = sizeof(intra_period);
+    intra_period.nPortIndex = (OMX_U32) PORT_INDEX_OUT;
+    intra_period.nPFrames = (profile.gop - 1) / (profile.bframes + 1);
+    intra_period.nBFrames = profile.gop - 1 - intra_period.nPFrames;
+    intra_period.nIDRPeriod = 1;
+    OMX_CHECK(OMX_SetConfig(this->handle, (OMX_INDEXTYPE) QOMX_IndexConfigVideoIntraperiod, (OMX_PTR) &intra_period));
+  }
+
+  if (profile.intra_refresh_mbs > 0) {
+    OMX_VIDEO_PARAM_INTRAREFRESHTYPE intra_refresh = {0};
+    intra_refresh.nSize = sizeof(intra_refresh);
+    intra_refresh.nPortIndex = (OMX_U32) PORT_INDEX_OUT;
+    intra_refresh.eRefreshMode = OMX_VIDEO_IntraRefreshCyclic;
+    intra_refresh.nCirMBs = profile.intra_refresh_mbs;
+    OMX_CHECK(OMX_SetParameter(this->handle, OMX_IndexParamVideoIntraRefresh, (OMX_PTR) &intra_refresh));
+  }
+
 
   // for (int i = 0; ; i++) {
   //   OMX_VIDEO_PARAM_PORTFORMATTYPE video_port_format = {0};
@@ -326,6 +356,11 @@ OmxEncoder::OmxEncoder(const char* filename, int width, int height, int fps, int
   }
 }
 
+int OmxEncoder::avio_write(void *opaque, uint8_t *buf, int buf_size) {
+  ((FileSink *)opaque)->write(buf, buf_size);
+  return buf_size;
+}
+
 void OmxEncoder::handle_out_buf(OmxEncoder *e, OMX_BUFFERHEADERTYPE *out_buf) {
   int err;
   uint8_t *buf_data = out_buf->pBuffer + out_buf->nOffset;
@@ -341,12 +376,23 @@ void OmxEncoder::handle_out_buf(OmxEncoder *e, OMX_BUFFERHEADERTYPE *out_buf) {
 #endif
   }
 
-  if (e->of) {
+  const bool is_frame = out_buf->nFilledLen > 0 && !(out_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG);
+  const bool is_keyframe = out_buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME;
+
+  if (!e->remuxing && e->sink) {
     //printf("write %d flags 0x%x\n", out_buf->nFilledLen, out_buf->nFlags);
-    fwrite(buf_data, out_buf->nFilledLen, 1, e->of);
+    if (is_frame && e->index) {
+      e->index->add(e->sink->size(), out_buf->nTimeStamp, is_keyframe);
+    }
+    e->sink->write(buf_data, out_buf->nFilledLen);
+  }
+
+  if (e->packet_cb && out_buf->nFilledLen > 0) {
+    e->packet_cb(buf_data, out_buf->nFilledLen, out_buf->nTimeStamp, out_buf->nFlags & OMX_BUFFERFLAG_CODECCONFIG,
+                 out_buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME);
   }
 
-  if (e->remuxing) {
+  if (e->remuxing && e->ofmt_ctx) {
     if (!e->wrote_codec_config && e->codec_config_len > 0) {
       // extradata will be freed by av_free() in avcodec_free_context()
       e->codec_ctx->extradata = (uint8_t*)av_mallocz(e->codec_config_len + AV_INPUT_BUFFER_PADDING_SIZE);
@@ -374,10 +420,14 @@ void OmxEncoder::handle_out_buf(OmxEncoder *e, OMX_BUFFERHEADERTYPE *out_buf) {
       pkt.pts = pkt.dts = av_rescale_q_rnd(out_buf->nTimeStamp, in_timebase, e->ofmt_ctx->streams[0]->time_base, rnd);
       pkt.duration = av_rescale_q(50*1000, in_timebase, e->ofmt_ctx->streams[0]->time_base);
 
-      if (out_buf->nFlags & OMX_BUFFERFLAG_SYNCFRAME) {
+      if (is_keyframe) {
         pkt.flags |= AV_PKT_FLAG_KEY;
       }
 
+      // mpegts writes video packets right away, the muxer's position is where this one starts
+      if (is_frame && e->index) {
+        e->index->add(avio_tell(e->ofmt_ctx->pb), out_buf->nTimeStamp, is_keyframe);
+      }
       err = av_write_frame(e->ofmt_ctx, &pkt);
       if (err < 0) { LOGW("ts encoder write issue"); }
 
@@ -424,7 +474,8 @@ int OmxEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const u
   // uint8_t *in_uv_ptr = in_buf_ptr + (this->width * this->height);
   uint8_t *in_uv_ptr = in_buf_ptr + (in_y_stride * VENUS_Y_SCANLINES(COLOR_FMT_NV12, this->height));
 
-  if (this->downscale) {
+  // frames that already come at the encoder size, like camerad's small road stream, skip the cpu scaling
+  if (this->downscale && (in_width != this->width || in_height != this->height)) {
     I420Scale(y_ptr, in_width,
               u_ptr, in_width/2,
               v_ptr, in_width/2,
@@ -471,13 +522,37 @@ int OmxEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const u
   return ret;
 }
 
-void OmxEncoder::encoder_open(const char* path) {
-  int err;
+void OmxEncoder::set_bitrate(int bitrate) {
+  OMX_VIDEO_CONFIG_BITRATETYPE config = {0};
+  config.nSize = sizeof(config);
+  config.nPortIndex = (OMX_U32) PORT_INDEX_OUT;
+  config.nEncodeBitrate = bitrate;
+  if (OMX_SetConfig(this->handle, OMX_IndexConfigVideoBitrate, (OMX_PTR) &config) != OMX_ErrorNone) {
+    LOGE("%s: failed to set bitrate %d", this->filename, bitrate);
+    return;
+  }
+  this->bitrate = bitrate;
+}
 
-  snprintf(this->vid_path, sizeof(this->vid_path), "%s/%s", path, this->filename);
+// reserves the file's expected size up front, it's truncated to what was written on close
+void OmxEncoder::preallocate() {
+  const uint64_t expected = (uint64_t)this->bitrate / 8 * this->last_segment_frames / this->fps;
+  if (expected > 0) {
+    this->sink->preallocate(expected + expected / 8);
+  }
+}
+
+void OmxEncoder::encoder_open(const char* path) {
+  if (path == nullptr) {
+    this->vid_path[0] = this->lock_path[0] = '\0';
+  } else {
+    snprintf(this->vid_path, sizeof(this->vid_path), "%s/%s", path, this->filename);
+  }
   LOGD("encoder_open %s remuxing:%d", this->vid_path, this->remuxing);
 
-  if (this->remuxing) {
+  if (path == nullptr) {
+    // packets only go to the callback
+  } else if (this->remuxing) {
     avformat_alloc_output_context2(&this->ofmt_ctx, NULL, NULL, this->vid_path);
     assert(this->ofmt_ctx);
 
@@ -498,25 +573,45 @@ void OmxEncoder::encoder_open(const char* path) {
     this->codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
     this->codec_ctx->time_base = (AVRational){ 1, this->fps };
 
-    err = avio_open(&this->ofmt_ctx->pb, this->vid_path, AVIO_FLAG_WRITE);
-    assert(err >= 0);
+    // the muxer writes into the sink through a custom io context, file io stays off the OMX callbacks
+    this->sink = new FileSink(this->vid_path);
+    assert(this->sink->is_open());
+    preallocate();
+    uint8_t *avio_buf = (uint8_t *)av_malloc(OMX_AVIO_BUF_SIZE);
+    assert(avio_buf);
+    this->ofmt_ctx->pb = avio_alloc_context(avio_buf, OMX_AVIO_BUF_SIZE, 1, this->sink, NULL, avio_write, NULL);
+    assert(this->ofmt_ctx->pb);
+    this->ofmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
 
     this->wrote_codec_config = false;
   } else {
-    this->of = fopen(this->vid_path, "wb");
-    assert(this->of);
+    this->sink = new FileSink(this->vid_path);
+    assert(this->sink->is_open());
+    preallocate();
 #ifndef QCOM2
     if (this->codec_config_len > 0) {
-      fwrite(this->codec_config, this->codec_config_len, 1, this->of);
+      this->sink->write(this->codec_config, this->codec_config_len);
     }
 #endif
   }
 
   // create camera lock file
-  snprintf(this->lock_path, sizeof(this->lock_path), "%s/%s.lock", path, this->filename);
-  int lock_fd = HANDLE_EINTR(open(this->lock_path, O_RDWR | O_CREAT, 0664));
-  assert(lock_fd >= 0);
-  close(lock_fd);
+  if (path != nullptr) {
+    this->index = new VideoIndex(this->vid_path);
+    snprintf(this->lock_path, sizeof(this->lock_path), "%s/%s.lock", path, this->filename);
+    int lock_fd = HANDLE_EINTR(open(this->lock_path, O_RDWR | O_CREAT, 0664));
+    assert(lock_fd >= 0);
+    close(lock_fd);
+  }
+
+  if (this->profile.idr_at_segment_start) {
+    // the encoder keeps running across segments, force a new IDR for the first frame of this file
+    OMX_CONFIG_INTRAREFRESHVOPTYPE vop = {0};
+    vop.nSize = sizeof(vop);
+    vop.nPortIndex = (OMX_U32) PORT_INDEX_OUT;
+    vop.IntraRefreshVOP = OMX_TRUE;
+    OMX_CHECK(OMX_SetConfig(this->handle, OMX_IndexConfigVideoIntraVOPRefresh, (OMX_PTR) &vop));
+  }
 
   this->is_open = true;
   this->counter = 0;
@@ -524,6 +619,7 @@ void OmxEncoder::encoder_open(const char* path) {
 
 void OmxEncoder::encoder_close() {
   if (this->is_open) {
+    this->last_segment_frames = this->counter;
     if (this->dirty) {
       // drain output only if there could be frames in the encoder
 
@@ -547,16 +643,31 @@ void OmxEncoder::encoder_close() {
       this->dirty = false;
     }
 
-    if (this->remuxing) {
-      av_write_trailer(this->ofmt_ctx);
-      avcodec_free_context(&this->codec_ctx);
-      avio_closep(&this->ofmt_ctx->pb);
-      avformat_free_context(this->ofmt_ctx);
-    } else {
-      fclose(this->of);
-      this->of = nullptr;
+    // finishing the file is left to the closer thread, the next segment can start right away
+    if (this->sink != nullptr) {
+      logger_close_deferred([remuxing = this->remuxing, ofmt_ctx = this->ofmt_ctx, codec_ctx = this->codec_ctx, sink = this->sink,
+                             index = this->index, vid_path = std::string(this->vid_path), lock_path = std::string(this->lock_path)]() mutable {
+        if (remuxing) {
+          av_write_trailer(ofmt_ctx);
+          avio_flush(ofmt_ctx->pb);
+          avcodec_free_context(&codec_ctx);
+          av_freep(&ofmt_ctx->pb->buffer);
+          av_freep(&ofmt_ctx->pb);
+          avformat_free_context(ofmt_ctx);
+        }
+        // flushes and fsyncs
+        sink->close();
+        logger_file_closed(vid_path, sink->size(), sink->checksum());
+        delete sink;
+        index->write();
+        delete index;
+        unlink(lock_path.c_str());
+      });
     }
-    unlink(this->lock_path);
+    this->ofmt_ctx = nullptr;
+    this->codec_ctx = nullptr;
+    this->sink = nullptr;
+    this->index = nullptr;
   }
   this->is_open = false;
 }
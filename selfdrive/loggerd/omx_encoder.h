@@ -11,16 +11,23 @@ extern "C" {
 
 #include "selfdrive/common/queue.h"
 #include "selfdrive/loggerd/encoder.h"
+#include "selfdrive/loggerd/file_sink.h"
+#include "selfdrive/loggerd/video_index.h"
+
+#define OMX_AVIO_BUF_SIZE (64 * 1024)
 
 // OmxEncoder, lossey codec using hardware hevc
 class OmxEncoder : public VideoEncoder {
 public:
-  OmxEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale);
+  OmxEncoder(const char* filename, int width, int height, int fps, const EncoderProfile &profile, bool downscale);
   ~OmxEncoder();
   int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
                    int in_width, int in_height, uint64_t ts);
   void encoder_open(const char* path);
   void encoder_close();
+  void set_bitrate(int bitrate);
+  // encoder_open(nullptr) then writes no file, the packets only go to cb
+  void set_packet_callback(EncoderPacketCallback cb) { packet_cb = cb; }
 
   // OMX callbacks
   static OMX_ERRORTYPE event_handler(OMX_HANDLETYPE component, OMX_PTR app_data, OMX_EVENTTYPE event,
@@ -32,17 +39,24 @@ public:
 
 private:
   void wait_for_state(OMX_STATETYPE state);
+  void preallocate();
   static void handle_out_buf(OmxEncoder *e, OMX_BUFFERHEADERTYPE *out_buf);
+  static int avio_write(void *opaque, uint8_t *buf, int buf_size);
 
   int width, height, fps;
+  EncoderProfile profile;
   char vid_path[1024];
   char lock_path[1024];
   bool is_open = false;
   bool dirty = false;
   int counter = 0;
+  int bitrate;
+  int last_segment_frames = 0;  // the next file is expected to span as many frames
 
   const char* filename;
-  FILE *of;
+  FileSink *sink = nullptr;
+  VideoIndex *index = nullptr;
+  EncoderPacketCallback packet_cb;
 
   size_t codec_config_len;
   uint8_t *codec_config = NULL;
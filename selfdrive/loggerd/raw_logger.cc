@@ -8,58 +8,141 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #define __STDC_CONSTANT_MACROS
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
 #include <libavutil/imgutils.h>
 }
 
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/logger.h"
+
+struct HwEncoder {
+  const char *name, *hevc, *h264;
+  AVHWDeviceType device;  // AV_HWDEVICE_TYPE_NONE if the encoder takes frames in system memory
+  AVPixelFormat hw_format;
+};
+
+static const HwEncoder HW_ENCODERS[] = {
+  {"nvenc", "hevc_nvenc", "h264_nvenc", AV_HWDEVICE_TYPE_NONE, AV_PIX_FMT_NONE},
+  {"v4l2m2m", "hevc_v4l2m2m", "h264_v4l2m2m", AV_HWDEVICE_TYPE_NONE, AV_PIX_FMT_NONE},
+  {"vaapi", "hevc_vaapi", "h264_vaapi", AV_HWDEVICE_TYPE_VAAPI, AV_PIX_FMT_VAAPI},
+};
 
 RawLogger::RawLogger(const char* filename, int width, int height, int fps,
-                     int bitrate, bool h265, bool downscale)
+                     const EncoderProfile &profile, bool downscale)
   : filename(filename),
-    fps(fps) {
+    width(width),
+    height(height),
+    fps(fps),
+    profile(profile) {
 
   av_register_all();
-  codec = avcodec_find_encoder(AV_CODEC_ID_FFVHUFF);
-  // codec = avcodec_find_encoder(AV_CODEC_ID_FFV1);
-  assert(codec);
-
-  codec_ctx = avcodec_alloc_context3(codec);
-  assert(codec_ctx);
-  codec_ctx->width = width;
-  codec_ctx->height = height;
-  codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
 
-  // codec_ctx->thread_count = 2;
-
-  // ffv1enc doesn't respect AV_PICTURE_TYPE_I. make every frame a key frame for now.
-  // codec_ctx->gop_size = 0;
-
-  codec_ctx->time_base = (AVRational){ 1, fps };
+  if (const char *name = getenv("LOGGERD_HW_ENCODER")) {
+    for (auto &h : HW_ENCODERS) {
+      if (strcmp(h.name, name) == 0) hw = &h;
+    }
+    if (hw == nullptr) {
+      LOGE("unknown hw encoder %s", name);
+    }
+  }
+  if (hw && hw->device != AV_HWDEVICE_TYPE_NONE && av_hwdevice_ctx_create(&hw_device, hw->device, NULL, NULL, 0) < 0) {
+    LOGE("%s: no %s device, logging lossless", filename, hw->name);
+    hw = nullptr;
+  }
 
-  int err = avcodec_open2(codec_ctx, codec, NULL);
-  assert(err >= 0);
+  // the first segment's context, opened here so a missing encoder falls back right away
+  codec_ctx = codec_open();
+  if (codec_ctx == NULL && hw) {
+    LOGE("%s: failed to open %s, logging lossless", filename, hw->name);
+    hw = nullptr;
+    codec_ctx = codec_open();
+  }
+  assert(codec_ctx);
 
   frame = av_frame_alloc();
   assert(frame);
-  frame->format = codec_ctx->pix_fmt;
+  frame->format = AV_PIX_FMT_YUV420P;
   frame->width = width;
   frame->height = height;
   frame->linesize[0] = width;
   frame->linesize[1] = width/2;
   frame->linesize[2] = width/2;
+
+  if (hw_device) {
+    hw_frame = av_frame_alloc();
+    assert(hw_frame);
+  }
 }
 
 RawLogger::~RawLogger() {
   av_frame_free(&frame);
-  avcodec_close(codec_ctx);
-  av_free(codec_ctx);
+  av_frame_free(&hw_frame);
+  avcodec_free_context(&codec_ctx);
+  av_buffer_unref(&hw_device);
+}
+
+// lossless ignores the profile's codec and rate control
+AVCodecContext *RawLogger::codec_open() {
+  AVCodec *codec = hw ? avcodec_find_encoder_by_name(profile.h265 ? hw->hevc : hw->h264)
+                      : avcodec_find_encoder(AV_CODEC_ID_FFVHUFF);
+  if (codec == NULL) return NULL;
+
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  assert(ctx);
+  ctx->width = width;
+  ctx->height = height;
+  ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  ctx->time_base = (AVRational){ 1, fps };
+  ctx->framerate = (AVRational){ fps, 1 };
+  // the mkv muxer wants the parameter sets up front
+  ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+  if (hw) {
+    ctx->bit_rate = profile.bitrate;
+    if (profile.cbr) {
+      ctx->rc_min_rate = ctx->rc_max_rate = profile.bitrate;
+      ctx->rc_buffer_size = profile.bitrate;
+    }
+    if (profile.gop > 0) ctx->gop_size = profile.gop;
+    ctx->max_b_frames = profile.bframes;
+  }
+
+  if (hw_device) {
+    // frames are uploaded into surfaces from this context's pool, which grows on
+    // demand and reuses a surface once the encoder is done with it
+    AVBufferRef *frames_ref = av_hwframe_ctx_alloc(hw_device);
+    assert(frames_ref);
+    AVHWFramesContext *frames = (AVHWFramesContext *)frames_ref->data;
+    frames->format = hw->hw_format;
+    frames->sw_format = AV_PIX_FMT_YUV420P;
+    frames->width = width;
+    frames->height = height;
+    if (av_hwframe_ctx_init(frames_ref) < 0) {
+      av_buffer_unref(&frames_ref);
+      avcodec_free_context(&ctx);
+      return NULL;
+    }
+    ctx->pix_fmt = hw->hw_format;
+    ctx->hw_frames_ctx = frames_ref;
+  }
+
+  if (avcodec_open2(ctx, codec, NULL) < 0) {
+    avcodec_free_context(&ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+void RawLogger::set_bitrate(int bitrate) {
+  profile.bitrate = bitrate;
 }
 
 void RawLogger::encoder_open(const char* path) {
@@ -74,16 +157,19 @@ void RawLogger::encoder_open(const char* path) {
   assert(lock_fd >= 0);
   close(lock_fd);
 
+  if (codec_ctx == NULL) {
+    codec_ctx = codec_open();
+    assert(codec_ctx);
+  }
+
   format_ctx = NULL;
   avformat_alloc_output_context2(&format_ctx, NULL, NULL, vid_path.c_str());
   assert(format_ctx);
 
-  stream = avformat_new_stream(format_ctx, codec);
-  // AVStream *stream = avformat_new_stream(format_ctx, NULL);
+  stream = avformat_new_stream(format_ctx, NULL);
   assert(stream);
   stream->id = 0;
   stream->time_base = (AVRational){ 1, fps };
-  // codec_ctx->time_base = stream->time_base;
 
   int err = avcodec_parameters_from_context(stream->codecpar, codec_ctx);
   assert(err >= 0);
@@ -94,6 +180,8 @@ void RawLogger::encoder_open(const char* path) {
   err = avformat_write_header(format_ctx, NULL);
   assert(err >= 0);
 
+  index = new VideoIndex(vid_path);
+
   is_open = true;
   counter = 0;
 }
@@ -101,50 +189,108 @@ void RawLogger::encoder_open(const char* path) {
 void RawLogger::encoder_close() {
   if (!is_open) return;
 
-  int err = av_write_trailer(format_ctx);
-  assert(err == 0);
-
-  avcodec_close(stream->codec);
-
-  err = avio_closep(&format_ctx->pb);
-  assert(err == 0);
-
-  avformat_free_context(format_ctx);
+  // finishing the file is left to the closer thread, the next segment can start right away.
+  // that includes draining the frames still in the encoder, so it gets a fresh context
+  logger_close_deferred([codec_ctx = codec_ctx, format_ctx = format_ctx, stream = stream, index = index,
+                         vid_path = vid_path, lock_path = lock_path]() mutable {
+    avcodec_send_frame(codec_ctx, NULL);
+    write_packets(codec_ctx, format_ctx, stream, index);
+    avcodec_free_context(&codec_ctx);
+
+    int err = av_write_trailer(format_ctx);
+    assert(err == 0);
+
+    err = avio_closep(&format_ctx->pb);
+    assert(err == 0);
+
+    avformat_free_context(format_ctx);
+    logger_fsync(vid_path.c_str());
+    index->write();
+    delete index;
+    unlink(lock_path.c_str());
+  });
+  codec_ctx = NULL;
   format_ctx = NULL;
-
-  unlink(lock_path.c_str());
+  stream = NULL;
+  index = nullptr;
   is_open = false;
 }
 
-int RawLogger::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
-                            int in_width, int in_height, uint64_t ts) {
+// writes whatever the encoder has ready
+int RawLogger::write_packets(AVCodecContext *ctx, AVFormatContext *format_ctx, AVStream *stream, VideoIndex *index) {
   AVPacket pkt;
   av_init_packet(&pkt);
   pkt.data = NULL;
   pkt.size = 0;
 
+  int err;
+  while ((err = avcodec_receive_packet(ctx, &pkt)) == 0) {
+    // the frames' pts are the camera's timestamp_eof. mkv holds packets back
+    // for its clusters, so there is no offset to give, players use its cues
+    index->add(VIDEO_INDEX_NO_OFFSET, pkt.pts / 1000, pkt.flags & AV_PKT_FLAG_KEY);
+    av_packet_rescale_ts(&pkt, ctx->time_base, stream->time_base);
+    pkt.stream_index = stream->index;
+    if (av_interleaved_write_frame(format_ctx, &pkt) < 0) {
+      LOGE("encoder writer error\n");
+      return -1;
+    }
+  }
+  return (err == AVERROR(EAGAIN) || err == AVERROR_EOF) ? 0 : err;
+}
+
+void RawLogger::borrowed_free(void *opaque, uint8_t *data) {
+  *(bool *)opaque = true;
+}
+
+int RawLogger::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                            int in_width, int in_height, uint64_t ts) {
+  if (!is_open) return -1;
+
   frame->data[0] = (uint8_t*)y_ptr;
   frame->data[1] = (uint8_t*)u_ptr;
   frame->data[2] = (uint8_t*)v_ptr;
   frame->pts = ts;
 
-  int ret = counter;
+  // a frame without buffers would be copied by send_frame, so the planes get a
+  // buffer that doesn't own them. the encoders here copy or upload their input,
+  // the VisionBuf is only borrowed for the call
+  if (borrow && !hw_frame) {
+    borrowed_released = false;
+    frame->buf[0] = av_buffer_create((uint8_t *)y_ptr, width * height * 3 / 2, borrowed_free,
+                                     &borrowed_released, AV_BUFFER_FLAG_READONLY);
+  }
 
-  int got_output = 0;
-  int err = avcodec_encode_video2(codec_ctx, &pkt, frame, &got_output);
-  if (err) {
+  AVFrame *input = frame;
+  if (hw_frame) {
+    int err = av_hwframe_get_buffer(codec_ctx->hw_frames_ctx, hw_frame, 0);
+    if (err >= 0) err = av_hwframe_transfer_data(hw_frame, frame, 0);
+    if (err < 0) {
+      LOGE("%s: frame upload failed\n", filename);
+      av_frame_unref(hw_frame);
+      return -1;
+    }
+    hw_frame->pts = ts;
+    input = hw_frame;
+  }
+
+  // packets come out as the encoder has them, not necessarily one per frame
+  int ret = counter;
+  int err = avcodec_send_frame(codec_ctx, input);
+  if (err < 0 || write_packets(codec_ctx, format_ctx, stream, index) < 0) {
     LOGE("encoding error\n");
     ret = -1;
-  } else if (got_output) {
-    av_packet_rescale_ts(&pkt, codec_ctx->time_base, stream->time_base);
-    pkt.stream_index = 0;
+  } else {
+    counter++;
+  }
 
-    err = av_interleaved_write_frame(format_ctx, &pkt);
-    if (err < 0) {
-      LOGE("encoder writer error\n");
-      ret = -1;
-    } else {
-      counter++;
+  if (input == hw_frame) {
+    av_frame_unref(hw_frame);
+  } else if (frame->buf[0]) {
+    av_buffer_unref(&frame->buf[0]);
+    if (!borrowed_released) {
+      // the encoder kept a reference to memory the camera is about to reuse
+      LOGW("%s: encoder holds on to its input, copying frames from now on", filename);
+      borrow = false;
     }
   }
 
@@ -8,34 +8,55 @@
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
 #include <libavutil/imgutils.h>
 }
 
 #include "selfdrive/loggerd/encoder.h"
+#include "selfdrive/loggerd/video_index.h"
 
+struct HwEncoder;
+
+// Lossless FFVHUFF by default. LOGGERD_HW_ENCODER=nvenc, v4l2m2m or vaapi
+// switches to that hardware encoder with the camera's profile, falling back
+// to lossless if it can't be opened. Every segment gets its own codec context,
+// the old one is drained and closed on the closer thread.
 class RawLogger : public VideoEncoder {
  public:
   RawLogger(const char* filename, int width, int height, int fps,
-            int bitrate, bool h265, bool downscale);
+            const EncoderProfile &profile, bool downscale);
   ~RawLogger();
   int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
                    int in_width, int in_height, uint64_t ts);
   void encoder_open(const char* path);
   void encoder_close();
+  // takes effect with the next segment
+  void set_bitrate(int bitrate);
 
 private:
+  AVCodecContext *codec_open();
+  static int write_packets(AVCodecContext *ctx, AVFormatContext *format_ctx, AVStream *stream, VideoIndex *index);
+  static void borrowed_free(void *opaque, uint8_t *data);
+
   const char* filename;
-  int fps;
+  int width, height, fps;
+  EncoderProfile profile;
   int counter = 0;
   bool is_open = false;
 
   std::string vid_path, lock_path;
 
-  AVCodec *codec = NULL;
+  const HwEncoder *hw = nullptr;  // nullptr when lossless
+  AVBufferRef *hw_device = NULL;
   AVCodecContext *codec_ctx = NULL;
 
   AVStream *stream = NULL;
   AVFormatContext *format_ctx = NULL;
+  VideoIndex *index = nullptr;
 
   AVFrame *frame = NULL;
+  AVFrame *hw_frame = NULL;
+  // frames wrap the caller's planes until an encoder is seen holding on to one
+  bool borrow = true;
+  bool borrowed_released = false;
 };
@@ -0,0 +1,518 @@
+// Replays a route into msgq and VisionIPC, at the pace it was logged or N times it
+//   ./replay <route> [--data_dir DIR] [--start SEC] [--speed X] [--allow a,b] [--block a,b] [--no-vipc] [--no-hw]
+// Commands on stdin: "p" pauses and resumes, "s <sec>" seeks to sec into the route, "+<sec>" and
+// "-<sec>" seek relative to now, "x <speed>" changes the speed.
+//
+// Segments are loaded SEGMENTS_AHEAD ahead of the one playing, on a loader thread and with the
+// log decompressed on all cores. Events go out with their original logMonoTime. The frames of a
+// camera state event are served from the segment's camera file through VisionIpcServer "camerad"
+// with the extras of its encode index, decoded on a thread per camera that keeps DECODE_AHEAD
+// frames ready. A seek decodes from the keyframe before the frame, so it's well under a second.
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <capnp/schema.h>
+
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+#include "cereal/visionipc/visionipc_server.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
+#include "selfdrive/loggerd/frame_reader.h"
+#include "selfdrive/loggerd/log_reader.h"
+
+#define SEGMENTS_AHEAD 2
+#define DECODE_AHEAD 4
+#define VIPC_BUFFERS 20
+#define SEGMENT_SECONDS 60
+
+ExitHandler do_exit;
+
+const struct {
+  const char *filename;
+  cereal::Event::Which state, encode_idx;
+  VisionStreamType stream;
+} cameras[] = {
+  {"fcamera.hevc", cereal::Event::ROAD_CAMERA_STATE, cereal::Event::ROAD_ENCODE_IDX, VISION_STREAM_YUV_BACK},
+  {"dcamera.hevc", cereal::Event::DRIVER_CAMERA_STATE, cereal::Event::DRIVER_ENCODE_IDX, VISION_STREAM_YUV_FRONT},
+  {"ecamera.hevc", cereal::Event::WIDE_ROAD_CAMERA_STATE, cereal::Event::WIDE_ROAD_ENCODE_IDX, VISION_STREAM_YUV_WIDE},
+};
+const int NUM_CAMERAS = std::size(cameras);
+
+struct EncodedFrame {
+  uint32_t segment_id;  // index into the camera file
+  VisionIpcBufExtra extra;
+};
+
+struct Segment {
+  int num;
+  LogReader log;
+  std::vector<std::pair<uint64_t, uint32_t>> order;  // logMonoTime and event index, by time
+  std::vector<uint16_t> which;  // of each event
+  std::unique_ptr<FrameReader> frames[NUM_CAMERAS];
+  std::unordered_map<uint32_t, EncodedFrame> encode_idx[NUM_CAMERAS];  // by frame id
+
+  bool load(const std::string &path, bool vipc, bool hw_decode) {
+    bool loaded = false;
+    for (const char *fn : {"rlog.zst", "rlog.lz4", "rlog.bz2", "rlog"}) {
+      if (util::file_exists(path + "/" + fn)) {
+        loaded = log.load(path + "/" + fn);
+        break;
+      }
+    }
+    if (!loaded) return false;
+
+    which.reserve(log.size());
+    order.reserve(log.size());
+    log.for_each([&](cereal::Event::Reader event) {
+      const uint32_t i = which.size();
+      which.push_back(event.which());
+      order.push_back({event.getLogMonoTime(), i});
+      for (int c = 0; c < NUM_CAMERAS && vipc; c++) {
+        if (event.which() != cameras[c].encode_idx) continue;
+        auto idx = (c == 0) ? event.getRoadEncodeIdx() : (c == 1) ? event.getDriverEncodeIdx() : event.getWideRoadEncodeIdx();
+        encode_idx[c][idx.getFrameId()] = {idx.getSegmentId(), {.frame_id = idx.getFrameId(),
+                                           .timestamp_sof = idx.getTimestampSof(), .timestamp_eof = idx.getTimestampEof()}};
+      }
+    });
+    // the log is in the order loggerd received the events, close to but not quite by time
+    std::stable_sort(order.begin(), order.end(), [](auto &a, auto &b) { return a.first < b.first; });
+
+    for (int c = 0; c < NUM_CAMERAS && vipc; c++) {
+      const std::string fn = path + "/" + cameras[c].filename;
+      if (encode_idx[c].empty() || !util::file_exists(fn)) continue;
+      frames[c] = std::make_unique<FrameReader>();
+      if (!frames[c]->load(fn, hw_decode)) {
+        LOGW("failed to read %s", fn.c_str());
+        frames[c].reset();
+      }
+    }
+    return !order.empty();
+  }
+};
+
+// Serves the frames of one camera, decoding the ones after the last served while it waits
+class CameraServer {
+ public:
+  CameraServer(VisionIpcServer *server, int cam) : server(server), cam(cam), thread(&CameraServer::run, this) {}
+  ~CameraServer() {
+    {
+      std::lock_guard lk(lock);
+      stop = true;
+    }
+    cv.notify_one();
+    thread.join();
+  }
+
+  void push(std::shared_ptr<Segment> seg, const EncodedFrame &frame) {
+    {
+      std::lock_guard lk(lock);
+      queue.push_back({seg, frame});
+    }
+    cv.notify_one();
+  }
+
+  void clear() {
+    std::lock_guard lk(lock);
+    queue.clear();
+  }
+
+ private:
+  struct Request {
+    std::shared_ptr<Segment> seg;
+    EncodedFrame frame;
+  };
+  struct Decoded {
+    int id;
+    std::vector<uint8_t> yuv;
+  };
+
+  bool decode(FrameReader *fr, int id, uint8_t *yuv) {
+    return fr->get(id, yuv, yuv + fr->width * fr->height, yuv + fr->width * fr->height * 5 / 4);
+  }
+
+  // false if there's nothing to decode
+  bool decode_ahead() {
+    FrameReader *fr = last_seg ? last_seg->frames[cam].get() : nullptr;
+    const int id = ahead.empty() ? last_id + 1 : ahead.back().id + 1;
+    if (fr == nullptr || ahead.size() >= DECODE_AHEAD || id >= fr->size()) return false;
+
+    Decoded d = {id, std::vector<uint8_t>(fr->width * fr->height * 3 / 2)};
+    if (decode(fr, id, d.yuv.data())) ahead.push_back(std::move(d));
+    return true;
+  }
+
+  void run() {
+    set_thread_name(cameras[cam].filename);
+    while (true) {
+      Request r;
+      {
+        std::unique_lock lk(lock);
+        if (stop) break;
+        if (!queue.empty()) {
+          r = std::move(queue.front());
+          queue.pop_front();
+        }
+      }
+      if (!r.seg) {
+        if (!decode_ahead()) {
+          std::unique_lock lk(lock);
+          cv.wait_for(lk, std::chrono::milliseconds(10), [&] { return stop || !queue.empty(); });
+        }
+        continue;
+      }
+
+      FrameReader *fr = r.seg->frames[cam].get();
+      VisionBuf *buf = server->get_buffer(cameras[cam].stream);
+      if (fr == nullptr || fr->width != (int)buf->width || fr->height != (int)buf->height) continue;
+
+      if (r.seg != last_seg) ahead.clear();
+      while (!ahead.empty() && ahead.front().id < (int)r.frame.segment_id) ahead.pop_front();
+      bool ok;
+      if (!ahead.empty() && ahead.front().id == (int)r.frame.segment_id) {
+        memcpy(buf->y, ahead.front().yuv.data(), ahead.front().yuv.size());
+        ahead.pop_front();
+        ok = true;
+      } else {
+        ahead.clear();
+        ok = decode(fr, r.frame.segment_id, buf->y);
+      }
+      if (ok) server->send(buf, &r.frame.extra);
+      last_seg = r.seg;
+      last_id = r.frame.segment_id;
+    }
+  }
+
+  VisionIpcServer *server;
+  const int cam;
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<Request> queue;
+  bool stop = false;
+
+  // only touched by the thread
+  std::shared_ptr<Segment> last_seg;
+  int last_id = -1;
+  std::deque<Decoded> ahead;
+
+  std::thread thread;
+};
+
+class Replay {
+ public:
+  Replay(const std::string &data_dir, const std::string &route, bool vipc, bool hw_decode)
+      : data_dir(data_dir), route(route), vipc(vipc), hw_decode(hw_decode) {
+    const std::string prefix = route + "--";
+    if (DIR *d = opendir(data_dir.c_str())) {
+      while (struct dirent *de = readdir(d)) {
+        std::string name = de->d_name;
+        if (name.compare(0, prefix.size(), prefix) == 0) {
+          segment_nums.push_back(atoi(name.c_str() + prefix.size()));
+        }
+      }
+      closedir(d);
+    }
+    std::sort(segment_nums.begin(), segment_nums.end());
+
+    // the services of the event union, by discriminant
+    auto event_struct = capnp::Schema::from<cereal::Event>().asStruct();
+    for (const auto &s : services) {
+      KJ_IF_MAYBE(field, event_struct.findFieldByName(s.name)) {
+        service_names[field->getProto().getDiscriminantValue()] = s.name;
+      }
+    }
+  }
+
+  ~Replay() {
+    do_exit = true;
+    loader_cv.notify_all();
+    if (loader.joinable()) loader.join();
+    camera_servers.clear();
+    for (auto &[_, sock] : socks) delete sock;
+  }
+
+  bool empty() const { return segment_nums.empty(); }
+
+  void set_filter(const std::set<std::string> &allow, const std::set<std::string> &block) {
+    for (auto it = service_names.begin(); it != service_names.end();) {
+      bool keep = (allow.empty() || allow.count(it->second)) && !block.count(it->second);
+      it = keep ? std::next(it) : service_names.erase(it);
+    }
+  }
+
+  void seek(double seconds) {
+    seek_to = std::max(seconds, 0.);
+    loader_cv.notify_all();
+  }
+  double position() const { return cur_seconds; }
+  std::atomic<bool> paused = false;
+  std::atomic<float> speed = 1.0;
+
+  void run(double start) {
+    seek_to = start;
+    loader = std::thread(&Replay::load_thread, this);
+
+    while (!do_exit) {
+      // a seek lands in a segment by its number, and then on the first event at or after the time
+      double target = seek_to.exchange(-1);
+      if (target >= 0) {
+        cur = std::lower_bound(segment_nums.begin(), segment_nums.end(), (int)(target / SEGMENT_SECONDS)) - segment_nums.begin();
+        cur = std::min<int>(cur, segment_nums.size() - 1);
+        loader_cv.notify_all();
+        for (auto &c : camera_servers) c->clear();
+      }
+      if (cur >= (int)segment_nums.size()) break;
+
+      std::shared_ptr<Segment> seg = get_segment(cur);
+      if (do_exit) break;
+      if (seek_to >= 0) continue;
+      if (!seg) {
+        LOGW("skipping segment %d", segment_nums[cur]);
+        cur++;
+        continue;
+      }
+      if (route_start == 0) {
+        route_start = seg->order[0].first - seg->num * SEGMENT_SECONDS * 1000000000ULL;
+        start_vipc(seg.get());
+      }
+
+      size_t i = 0;
+      if (target >= 0) {
+        const uint64_t t = route_start + (uint64_t)(target * 1e9);
+        i = std::lower_bound(seg->order.begin(), seg->order.end(), std::make_pair(t, 0U)) - seg->order.begin();
+        LOGW("seeked to %.1f s, segment %d", target, seg->num);
+      }
+      play(seg, i);
+      if (seek_to < 0) cur++;
+    }
+  }
+
+ private:
+  void play(std::shared_ptr<Segment> seg, size_t i) {
+    uint64_t mono_start = 0, real_start = 0;
+    for (; i < seg->order.size() && !do_exit && seek_to < 0; i++) {
+      const auto [mono_time, idx] = seg->order[i];
+      cur_seconds = (mono_time - route_start) * 1e-9;
+
+      // keep to the log's pace from the first event after a start, seek, pause or speed change
+      float cur_speed = speed;
+      while (!do_exit && seek_to < 0) {
+        if (paused || cur_speed != speed) {
+          mono_start = 0;
+          cur_speed = speed;
+          if (paused) util::sleep_for(10);
+          continue;
+        }
+        const uint64_t now = nanos_monotonic();
+        if (mono_start == 0) {
+          mono_start = mono_time;
+          real_start = now;
+        }
+        const int64_t wait = (int64_t)((mono_time - mono_start) / cur_speed) - (int64_t)(now - real_start);
+        if (wait <= 0) break;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<int64_t>(wait, 10000000)));
+      }
+      if (do_exit || seek_to >= 0) break;
+
+      publish(seg, idx);
+    }
+  }
+
+  void publish(const std::shared_ptr<Segment> &seg, uint32_t idx) {
+    const uint16_t which = seg->which[idx];
+    auto name = service_names.find(which);
+    if (name == service_names.end()) return;
+
+    // the frame goes out first, so it's there when the camera state is
+    for (int c = 0; c < NUM_CAMERAS && vipc; c++) {
+      if (which != cameras[c].state || !seg->frames[c] || !camera_servers[c]) continue;
+      capnp::FlatArrayMessageReader msg(seg->log.event(idx));
+      auto event = msg.getRoot<cereal::Event>();
+      auto state = (c == 0) ? event.getRoadCameraState() : (c == 1) ? event.getDriverCameraState() : event.getWideRoadCameraState();
+      auto frame = seg->encode_idx[c].find(state.getFrameId());
+      if (frame != seg->encode_idx[c].end()) camera_servers[c]->push(seg, frame->second);
+    }
+
+    PubSocket *&sock = socks[which];
+    if (sock == nullptr) {
+      sock = PubSocket::create(ctx.get(), name->second);
+      assert(sock != nullptr);
+    }
+    auto bytes = seg->log.event(idx).asBytes();
+    sock->send((char *)bytes.begin(), bytes.size());
+  }
+
+  void start_vipc(const Segment *seg) {
+    if (!vipc) return;
+    vipc_server = std::make_unique<VisionIpcServer>("camerad");
+    camera_servers.resize(NUM_CAMERAS);
+    for (int c = 0; c < NUM_CAMERAS; c++) {
+      if (!seg->frames[c] || !service_names.count(cameras[c].state)) continue;
+      vipc_server->create_buffers(cameras[c].stream, VIPC_BUFFERS, false, seg->frames[c]->width, seg->frames[c]->height);
+    }
+    vipc_server->start_listener();
+    for (int c = 0; c < NUM_CAMERAS; c++) {
+      if (seg->frames[c] && service_names.count(cameras[c].state)) {
+        camera_servers[c] = std::make_unique<CameraServer>(vipc_server.get(), c);
+      }
+    }
+  }
+
+  // the segment at position n, waits for the loader. nullptr if it doesn't load
+  std::shared_ptr<Segment> get_segment(int n) {
+    std::unique_lock lk(segments_lock);
+    loader_cv.notify_all();
+    segments_cv.wait(lk, [&] { return do_exit || seek_to >= 0 || segments.count(n); });
+    return segments.count(n) ? segments[n] : nullptr;
+  }
+
+  void load_thread() {
+    set_thread_name("replay_loader");
+    while (!do_exit) {
+      int n = -1;
+      {
+        std::unique_lock lk(segments_lock);
+        // drop the segments behind and far ahead, a seek makes it from there
+        const int first = cur;
+        for (auto it = segments.begin(); it != segments.end();) {
+          it = (it->first < first || it->first > first + SEGMENTS_AHEAD) ? segments.erase(it) : std::next(it);
+        }
+        for (int i = first; i <= first + SEGMENTS_AHEAD && i < (int)segment_nums.size(); i++) {
+          if (!segments.count(i)) {
+            n = i;
+            break;
+          }
+        }
+        if (n < 0) {
+          loader_cv.wait_for(lk, std::chrono::milliseconds(100));
+          continue;
+        }
+      }
+
+      auto seg = std::make_shared<Segment>();
+      seg->num = segment_nums[n];
+      const std::string path = data_dir + "/" + route + "--" + std::to_string(seg->num);
+      double t = millis_since_boot();
+      if (!seg->load(path, vipc, hw_decode)) {
+        LOGE("failed to load %s", path.c_str());
+        seg.reset();
+      } else {
+        LOGD("loaded %s in %.0f ms", path.c_str(), millis_since_boot() - t);
+      }
+      {
+        std::lock_guard lk(segments_lock);
+        segments[n] = seg;
+      }
+      segments_cv.notify_all();
+    }
+    segments_cv.notify_all();
+  }
+
+  const std::string data_dir, route;
+  const bool vipc, hw_decode;
+  std::vector<int> segment_nums;
+  std::map<uint16_t, std::string> service_names;  // the ones to publish
+
+  std::atomic<int> cur = 0;  // position in segment_nums
+  std::atomic<double> seek_to = -1, cur_seconds = 0;
+  uint64_t route_start = 0;
+
+  std::mutex segments_lock;
+  std::condition_variable segments_cv, loader_cv;
+  std::map<int, std::shared_ptr<Segment>> segments;  // by position in segment_nums, nullptr if it failed
+  std::thread loader;
+
+  std::unique_ptr<Context> ctx{Context::create()};
+  std::map<uint16_t, PubSocket *> socks;
+  std::unique_ptr<VisionIpcServer> vipc_server;
+  std::vector<std::unique_ptr<CameraServer>> camera_servers;
+};
+
+static std::set<std::string> split(const std::string &s) {
+  std::set<std::string> out;
+  size_t start = 0;
+  while (start < s.size()) {
+    size_t end = s.find(',', start);
+    if (end == std::string::npos) end = s.size();
+    if (end > start) out.insert(s.substr(start, end - start));
+    start = end + 1;
+  }
+  return out;
+}
+
+static void command_thread(Replay *replay) {
+  std::string line;
+  while (!do_exit && std::getline(std::cin, line)) {
+    if (line == "p") {
+      replay->paused = !replay->paused;
+      printf("%s at %.1f s\n", replay->paused ? "paused" : "resumed", replay->position());
+    } else if (line.size() > 1 && line[0] == 's') {
+      replay->seek(atof(line.c_str() + 1));
+    } else if (line.size() > 1 && (line[0] == '+' || line[0] == '-')) {
+      replay->seek(replay->position() + atof(line.c_str()));
+    } else if (line.size() > 1 && line[0] == 'x' && atof(line.c_str() + 1) > 0) {
+      replay->speed = atof(line.c_str() + 1);
+    } else {
+      printf("at %.1f s, commands: p, s <sec>, +<sec>, -<sec>, x <speed>\n", replay->position());
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *usage = "usage: %s <route> [--data_dir DIR] [--start SEC] [--speed X] [--allow a,b] [--block a,b] [--no-vipc] [--no-hw]\n";
+  if (argc < 2) {
+    fprintf(stderr, usage, argv[0]);
+    return 1;
+  }
+
+  std::string data_dir = Path::log_root();
+  std::set<std::string> allow, block;
+  double start = 0;
+  float speed = 1.0;
+  bool vipc = true, hw_decode = true;
+  for (int i = 2; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--data_dir" && has_value) data_dir = argv[++i];
+    else if (arg == "--start" && has_value) start = atof(argv[++i]);
+    else if (arg == "--speed" && has_value) speed = atof(argv[++i]);
+    else if (arg == "--allow" && has_value) allow = split(argv[++i]);
+    else if (arg == "--block" && has_value) block = split(argv[++i]);
+    else if (arg == "--no-vipc") vipc = false;
+    else if (arg == "--no-hw") hw_decode = false;
+    else {
+      fprintf(stderr, usage, argv[0]);
+      return 1;
+    }
+  }
+
+  Replay replay(data_dir, argv[1], vipc, hw_decode);
+  if (replay.empty()) {
+    fprintf(stderr, "no segments of %s in %s\n", argv[1], data_dir.c_str());
+    return 1;
+  }
+  replay.set_filter(allow, block);
+  replay.speed = speed > 0 ? speed : 1.0;
+
+  std::thread(command_thread, &replay).detach();
+  replay.run(start);
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include "selfdrive/loggerd/route_index.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/logger.h"
+
+// carState gaps longer than this are not integrated, the car was off or loggerd stalled
+const double MAX_CAR_STATE_GAP = 1.;  // s
+
+static bool pwrite_file(const std::string& path, const void* data, size_t size, off_t offset) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0664));
+  if (fd < 0) {
+    LOGE("failed to open %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  bool ok = HANDLE_EINTR(pwrite(fd, data, size, offset)) == (ssize_t)size;
+  if (!ok) LOGE("failed to write %s: %s", path.c_str(), strerror(errno));
+  close(fd);
+  return ok;
+}
+
+RouteIndex::RouteIndex(const std::string& root, const std::string& route)
+    : index_path(root + "/" + route + ".index"), thumbs_path(root + "/" + route + ".thumbs") {
+  struct stat st;
+  thumbs_size = stat(thumbs_path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+void RouteIndex::log(kj::ArrayPtr<const capnp::word> data) {
+  capnp::FlatArrayMessageReader msg(data);
+  cereal::Event::Reader event = msg.getRoot<cereal::Event>();
+
+  if (event.which() == cereal::Event::CAR_STATE) {
+    const uint64_t mono = event.getLogMonoTime();
+    const float v_ego = event.getCarState().getVEgo();
+    const double dt = (mono - last_car_state_mono) * 1e-9;
+    if (last_car_state_mono != 0 && mono > last_car_state_mono && dt < MAX_CAR_STATE_GAP) {
+      distance += (v_ego + last_v_ego) / 2. * dt;
+    }
+    last_car_state_mono = mono;
+    last_v_ego = v_ego;
+  } else if (event.which() == cereal::Event::THUMBNAIL && thumbnail.empty()) {
+    auto jpeg = event.getThumbnail().getThumbnail();
+    thumbnail.assign(jpeg.begin(), jpeg.end());
+  }
+}
+
+void RouteIndex::finish_segment(int segment, double duration) {
+  RouteIndexEntry entry = {
+    .magic = ROUTE_INDEX_MAGIC,
+    .segment = (uint32_t)segment,
+    .thumbnail_offset = thumbs_size,
+    .thumbnail_size = (uint32_t)thumbnail.size(),
+    .duration = (float)duration,
+    .distance = (float)distance,
+    .reserved = 0,
+  };
+  thumbs_size += thumbnail.size();
+
+  // the thumbnail is on disk before the entry pointing at it
+  logger_close_deferred([entry, thumbnail = std::move(thumbnail), index_path = index_path, thumbs_path = thumbs_path]() {
+    if (!thumbnail.empty() && !pwrite_file(thumbs_path, thumbnail.data(), thumbnail.size(), entry.thumbnail_offset)) {
+      return;
+    }
+    pwrite_file(index_path, &entry, sizeof(entry), (off_t)entry.segment * sizeof(entry));
+  });
+  thumbnail.clear();
+  distance = 0.;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <capnp/message.h>
+#include <kj/array.h>
+
+// Browsing data of a route, next to its segments, so a route list can page
+// through it without decoding logs or video:
+//   <route>.index   one RouteIndexEntry per segment, segment n's at n * sizeof(RouteIndexEntry)
+//   <route>.thumbs  the JPEG thumbnails the entries point into
+// Both only grow and are meant to be mmapped, route_index.py reads them.
+#define ROUTE_INDEX_MAGIC 0x58444952  // "RIDX"
+
+struct RouteIndexEntry {
+  uint32_t magic;  // 0 for segments not written (yet)
+  uint32_t segment;
+  uint64_t thumbnail_offset;
+  uint32_t thumbnail_size;  // 0 if the segment got no thumbnail
+  float duration;  // s
+  float distance;  // m, carState.vEgo integrated
+  uint32_t reserved;
+};
+static_assert(sizeof(RouteIndexEntry) == 32);
+
+class RouteIndex {
+ public:
+  RouteIndex(const std::string& root, const std::string& route);
+  // takes the first thumbnail of the segment and the carState speeds
+  void log(kj::ArrayPtr<const capnp::word> data);
+  // writes the segment's entry on the logger's close thread and starts over
+  void finish_segment(int segment, double duration);
+
+ private:
+  std::string index_path, thumbs_path;
+  uint64_t thumbs_size;
+  std::vector<uint8_t> thumbnail;
+  double distance = 0.;
+  uint64_t last_car_state_mono = 0;
+  float last_v_ego = 0.;
+};
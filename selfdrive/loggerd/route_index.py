@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Reads the per route thumbnails and segment summaries loggerd keeps next to the segments, see route_index.h"""
+import mmap
+import os
+import struct
+import sys
+from collections import namedtuple
+
+ROUTE_INDEX_MAGIC = 0x58444952
+INDEX_EXT = ".index"
+THUMBS_EXT = ".thumbs"
+
+ENTRY = struct.Struct("<IIQIffI")
+
+Segment = namedtuple("Segment", ["segment", "duration", "distance", "thumbnail_offset", "thumbnail_size"])
+
+
+def _mmap(path):
+  try:
+    with open(path, "rb") as f:
+      return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+  except (OSError, ValueError):  # ValueError for empty files
+    return None
+
+
+class RouteIndex():
+  """Pages through a route's index and thumbnails without reading them in, a route list only touches
+  the entries and thumbnails it shows. Segments loggerd has not finished yet are None."""
+  def __init__(self, root, route):
+    self.route = route
+    self._index = _mmap(os.path.join(root, route + INDEX_EXT))
+    self._thumbs = _mmap(os.path.join(root, route + THUMBS_EXT))
+
+  def __len__(self):
+    return len(self._index) // ENTRY.size if self._index is not None else 0
+
+  def segment(self, i):
+    magic, segment, offset, size, duration, distance, _ = ENTRY.unpack_from(self._index, i * ENTRY.size)
+    if magic != ROUTE_INDEX_MAGIC:
+      return None
+    return Segment(segment, duration, distance, offset, size)
+
+  def segments(self):
+    return [s for s in map(self.segment, range(len(self))) if s is not None]
+
+  def thumbnail(self, i):
+    """JPEG bytes of the segment's thumbnail, or None"""
+    s = self.segment(i)
+    if s is None or s.thumbnail_size == 0 or self._thumbs is None or s.thumbnail_offset + s.thumbnail_size > len(self._thumbs):
+      return None
+    return self._thumbs[s.thumbnail_offset:s.thumbnail_offset + s.thumbnail_size]
+
+  def summary(self):
+    """(segment count, duration in s, distance in m) of the finished segments"""
+    segments = self.segments()
+    return len(segments), sum(s.duration for s in segments), sum(s.distance for s in segments)
+
+  def close(self):
+    for m in (self._index, self._thumbs):
+      if m is not None:
+        m.close()
+
+
+def list_routes(root):
+  """Names of the routes with an index under root, oldest first"""
+  try:
+    return sorted(f[:-len(INDEX_EXT)] for f in os.listdir(root) if f.endswith(INDEX_EXT))
+  except OSError:
+    return []
+
+
+if __name__ == "__main__":
+  from selfdrive.loggerd.config import ROOT
+  root = sys.argv[1] if len(sys.argv) > 1 else ROOT
+  for route in list_routes(root):
+    index = RouteIndex(root, route)
+    count, duration, distance = index.summary()
+    print(f"{route}: {count} segments, {duration / 60:.1f} min, {distance / 1000:.1f} km")
+    index.close()
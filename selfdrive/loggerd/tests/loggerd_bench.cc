@@ -0,0 +1,405 @@
+// Runs loggerd against synthetic publishers and reports how it keeps up, run from selfdrive/loggerd.
+//
+//   loggerd_bench [-t seconds] [-l segment_seconds] [-r rate_scale] [-b msg_bytes] [-e entropy]
+//                 [-S service=hz:bytes]... [-W width -H height] [-x loggerd] [-d log_root]
+//
+// Every logged service in services.h is published at its own frequency times -r with
+// -b byte messages (services with no fixed frequency at 1 Hz), -S overrides one service.
+// -e is the fraction of each payload that is random, the rest compresses to nothing.
+// The road camera gets synthetic VisionIPC frames. After the run the rlogs are read
+// back to count dropped messages, and the encode index gives the rotation stalls.
+
+#include <dirent.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <bzlib.h>
+#include <capnp/dynamic.h>
+#include <capnp/schema.h>
+#include <capnp/serialize.h>
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+#include "cereal/visionipc/visionipc_server.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+struct Publisher {
+  std::string name;
+  double hz;
+  size_t bytes;
+  PubSocket *sock = nullptr;
+  double next_ms = 0;
+  uint64_t sent = 0, sent_bytes = 0;
+};
+
+struct Options {
+  double seconds = 60, rate_scale = 1, entropy = 0.5;
+  int segment_seconds = 10;
+  size_t msg_bytes = 1024;
+  int width = 1164, height = 874;
+  std::string loggerd = "./loggerd", log_root;
+  std::map<std::string, std::pair<double, size_t>> overrides;
+};
+
+static std::atomic<bool> do_exit = false;
+
+static bool ends_with(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static uint64_t xorshift(uint64_t &s) {
+  s ^= s << 13;
+  s ^= s >> 7;
+  s ^= s << 17;
+  return s;
+}
+
+// an Event with name's union member set, padded with an unadopted orphan up to bytes
+static void send_event(Publisher &p, double entropy, uint64_t &seed) {
+  MessageBuilder msg;
+  auto event = msg.initEvent();
+  capnp::DynamicStruct::Builder dyn = capnp::toDynamic(event);
+  dyn.clear(dyn.getSchema().getFieldByName(p.name));
+
+  auto pad = msg.getOrphanage().newOrphan<capnp::Data>(p.bytes);
+  auto data = pad.get();
+  const size_t random = data.size() * entropy;
+  for (size_t i = 0; i < random; i += 8) {
+    const uint64_t v = xorshift(seed);
+    memcpy(data.begin() + i, &v, std::min<size_t>(8, random - i));
+  }
+
+  auto bytes = msg.toBytes();
+  p.sock->send((char *)bytes.begin(), bytes.size());
+  p.sent++;
+  p.sent_bytes += bytes.size();
+}
+
+static void publisher_thread(std::vector<Publisher> *pubs, double entropy) {
+  uint64_t seed = 0x9E3779B97F4A7C15ULL;
+  for (auto &p : *pubs) p.next_ms = millis_since_boot();
+
+  while (!do_exit) {
+    const double now = millis_since_boot();
+    for (auto &p : *pubs) {
+      // catch up in bursts instead of falling behind
+      while (p.next_ms <= now) {
+        send_event(p, entropy, seed);
+        p.next_ms += 1000. / p.hz;
+      }
+    }
+    util::sleep_for(1);
+  }
+}
+
+static void camera_thread(int width, int height, std::atomic<uint64_t> *frames) {
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 8, false, width, height);
+  server.start_listener();
+
+  for (uint32_t frame_id = 0; !do_exit; frame_id++) {
+    const double start = millis_since_boot();
+    VisionBuf *buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+    // a moving gradient, so the encoder has something to do
+    for (int y = 0; y < height; y++) {
+      memset(buf->y + y * width, (y + frame_id) & 0xff, width);
+    }
+    memset(buf->u, 128, width * height / 4);
+    memset(buf->v, 128, width * height / 4);
+
+    VisionIpcBufExtra extra = {};
+    extra.frame_id = frame_id;
+    extra.timestamp_sof = extra.timestamp_eof = nanos_since_boot();
+    server.send(buf, &extra);
+    (*frames)++;
+
+    util::sleep_for(std::max(0., 50. - (millis_since_boot() - start)));
+  }
+}
+
+// ***** process stats *****
+
+static std::map<std::string, uint64_t> thread_ticks(pid_t pid) {
+  std::map<std::string, uint64_t> ticks;
+  const std::string task_dir = "/proc/" + std::to_string(pid) + "/task";
+  DIR *d = opendir(task_dir.c_str());
+  if (d == nullptr) return ticks;
+  while (struct dirent *de = readdir(d)) {
+    if (de->d_name[0] == '.') continue;
+    const std::string stat = util::read_file(task_dir + "/" + de->d_name + "/stat");
+    const size_t open = stat.find('('), close = stat.rfind(')');
+    if (open == std::string::npos || close == std::string::npos) continue;
+
+    // utime and stime are the 14th and 15th fields, the name in parens is the 2nd
+    unsigned long utime = 0, stime = 0;
+    sscanf(stat.c_str() + close + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    ticks[stat.substr(open + 1, close - open - 1)] += utime + stime;
+  }
+  closedir(d);
+  return ticks;
+}
+
+// ***** reading the logs back *****
+
+static std::vector<uint8_t> decompress(const std::string &path) {
+  const std::string in = util::read_file(path);
+  std::vector<uint8_t> out;
+  if (ends_with(path, ".bz2")) {
+    bz_stream bz = {};
+    BZ2_bzDecompressInit(&bz, 0, 0);
+    bz.next_in = (char *)in.data();
+    bz.avail_in = in.size();
+    std::vector<uint8_t> buf(1 << 20);
+    int ret = BZ_OK;
+    while (ret == BZ_OK) {
+      bz.next_out = (char *)buf.data();
+      bz.avail_out = buf.size();
+      ret = BZ2_bzDecompress(&bz);
+      out.insert(out.end(), buf.begin(), buf.end() - bz.avail_out);
+    }
+    BZ2_bzDecompressEnd(&bz);
+#ifdef HAVE_ZSTD
+  } else if (ends_with(path, ".zst")) {
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    ZSTD_inBuffer zin = {in.data(), in.size(), 0};
+    std::vector<uint8_t> buf(ZSTD_DStreamOutSize());
+    while (true) {
+      ZSTD_outBuffer zout = {buf.data(), buf.size(), 0};
+      if (ZSTD_isError(ZSTD_decompressStream(ds, &zout, &zin))) break;
+      out.insert(out.end(), buf.begin(), buf.begin() + zout.pos);
+      // a full output buffer may leave more behind
+      if (zin.pos == zin.size && zout.pos < zout.size) break;
+    }
+    ZSTD_freeDStream(ds);
+#endif
+#ifdef HAVE_LZ4
+  } else if (ends_with(path, ".lz4")) {
+    LZ4F_dctx *dctx;
+    LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    std::vector<uint8_t> buf(1 << 20);
+    size_t pos = 0;
+    while (true) {
+      size_t src_size = in.size() - pos, dst_size = buf.size();
+      if (LZ4F_isError(LZ4F_decompress(dctx, buf.data(), &dst_size, in.data() + pos, &src_size, NULL))) break;
+      out.insert(out.end(), buf.begin(), buf.begin() + dst_size);
+      pos += src_size;
+      if (pos == in.size() && dst_size < buf.size()) break;
+    }
+    LZ4F_freeDecompressionContext(dctx);
+#endif
+  }
+  return out;
+}
+
+struct LogStats {
+  std::map<uint16_t, uint64_t> events;  // by Event union member
+  std::vector<double> encode_ms, rotation_ms;
+};
+
+static void read_rlog(const std::string &path, LogStats &stats) {
+  const std::vector<uint8_t> data = decompress(path);
+  kj::Array<capnp::word> words = kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+  memcpy(words.begin(), data.data(), words.size() * sizeof(capnp::word));
+
+  kj::ArrayPtr<const capnp::word> rest = words;
+  try {
+    while (rest.size() > 0) {
+      capnp::FlatArrayMessageReader msg(rest);
+      auto event = msg.getRoot<cereal::Event>();
+      stats.events[event.which()]++;
+      if (event.isRoadEncodeIdx()) {
+        auto idx = event.getRoadEncodeIdx();
+        const double ms = (event.getLogMonoTime() - idx.getTimestampEof()) / 1e6;
+        stats.encode_ms.push_back(ms);
+        // the first frames of every segment but the first wait for the rotation
+        if (idx.getSegmentId() < 2 && idx.getSegmentNum() > 0) stats.rotation_ms.push_back(ms);
+      }
+      rest = kj::arrayPtr(msg.getEnd(), rest.end());
+    }
+  } catch (const kj::Exception &e) {
+    fprintf(stderr, "%s: %s\n", path.c_str(), e.getDescription().cStr());
+  }
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static uint64_t dir_size(const std::string &path, std::vector<std::string> *rlogs) {
+  uint64_t size = 0;
+  DIR *d = opendir(path.c_str());
+  if (d == nullptr) return 0;
+  while (struct dirent *de = readdir(d)) {
+    if (de->d_name[0] == '.') continue;
+    const std::string p = path + "/" + de->d_name;
+    struct stat st;
+    if (stat(p.c_str(), &st) != 0) continue;
+    if (S_ISDIR(st.st_mode)) {
+      size += dir_size(p, rlogs);
+    } else {
+      size += st.st_size;
+      if (strncmp(de->d_name, "rlog.", 5) == 0) rlogs->push_back(p);
+    }
+  }
+  closedir(d);
+  return size;
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  int c;
+  while ((c = getopt(argc, argv, "t:l:r:b:e:S:W:H:x:d:")) != -1) {
+    switch (c) {
+      case 't': opt.seconds = atof(optarg); break;
+      case 'l': opt.segment_seconds = atoi(optarg); break;
+      case 'r': opt.rate_scale = atof(optarg); break;
+      case 'b': opt.msg_bytes = atol(optarg); break;
+      case 'e': opt.entropy = std::clamp(atof(optarg), 0., 1.); break;
+      case 'S': {
+        std::string s = optarg;
+        size_t eq = s.find('='), colon = s.find(':');
+        if (eq == std::string::npos || colon == std::string::npos) {
+          fprintf(stderr, "-S takes service=hz:bytes\n");
+          return 1;
+        }
+        opt.overrides[s.substr(0, eq)] = {atof(s.substr(eq + 1).c_str()), (size_t)atol(s.substr(colon + 1).c_str())};
+        break;
+      }
+      case 'W': opt.width = atoi(optarg); break;
+      case 'H': opt.height = atoi(optarg); break;
+      case 'x': opt.loggerd = optarg; break;
+      case 'd': opt.log_root = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-t seconds] [-l segment_seconds] [-r rate_scale] [-b msg_bytes] [-e entropy]\n"
+                        "       [-S service=hz:bytes]... [-W width -H height] [-x loggerd] [-d log_root]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (opt.log_root.empty()) {
+    char tmpl[] = "/tmp/loggerd_bench_XXXXXX";
+    opt.log_root = mkdtemp(tmpl);
+  }
+
+  // loggerd first, nothing is published before it subscribed
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    setenv("LOG_ROOT", opt.log_root.c_str(), 1);
+    setenv("LOGGERD_TEST", "1", 1);
+    setenv("LOGGERD_SEGMENT_LENGTH", std::to_string(opt.segment_seconds).c_str(), 1);
+    execl(opt.loggerd.c_str(), opt.loggerd.c_str(), (char *)NULL);
+    perror("exec loggerd");
+    _exit(1);
+  }
+  util::sleep_for(2000);
+
+  Context *ctx = Context::create();
+  std::vector<Publisher> pubs;
+  for (const auto &it : services) {
+    if (!it.should_log || strcmp(it.name, "loggerdState") == 0) continue;
+    Publisher p = {.name = it.name, .hz = std::max(it.frequency, 1) * opt.rate_scale, .bytes = opt.msg_bytes};
+    if (auto o = opt.overrides.find(it.name); o != opt.overrides.end()) {
+      std::tie(p.hz, p.bytes) = o->second;
+    }
+    if (p.hz <= 0) continue;
+    p.sock = PubSocket::create(ctx, it.name);
+    assert(p.sock != nullptr);
+    pubs.push_back(p);
+  }
+  SubMaster sm({"loggerdState"});
+
+  const auto ticks_start = thread_ticks(pid);
+  const double start_ms = millis_since_boot();
+  std::atomic<uint64_t> frames = 0;
+  std::thread pub_thread(publisher_thread, &pubs, opt.entropy);
+  std::thread cam_thread(camera_thread, opt.width, opt.height, &frames);
+
+  float max_latency_ms = 0, min_write_rate = 1e12;
+  int max_degradation = 0;
+  while (millis_since_boot() - start_ms < opt.seconds * 1000) {
+    sm.update(1000);
+    if (sm.updated("loggerdState")) {
+      auto ls = sm["loggerdState"].getLoggerdState();
+      max_latency_ms = std::max(max_latency_ms, ls.getWriteLatencyMaxMs());
+      min_write_rate = std::min(min_write_rate, ls.getWriteBytesPerSec());
+      max_degradation = std::max(max_degradation, (int)ls.getDegradation());
+    }
+  }
+  const double seconds = (millis_since_boot() - start_ms) / 1000.;
+  const auto ticks_end = thread_ticks(pid);
+
+  do_exit = true;
+  pub_thread.join();
+  cam_thread.join();
+
+  // let loggerd drain what was published, then stop it
+  util::sleep_for(1000);
+  kill(pid, SIGINT);
+  int status;
+  waitpid(pid, &status, 0);
+
+  // read back
+  std::vector<std::string> rlogs;
+  const uint64_t written = dir_size(opt.log_root, &rlogs);
+  LogStats stats;
+  for (auto &path : rlogs) read_rlog(path, stats);
+
+  const capnp::StructSchema event_schema = capnp::Schema::from<cereal::Event>();
+  uint64_t sent = 0, sent_bytes = 0, logged = 0;
+  printf("%-24s %10s %10s %10s\n", "service", "sent", "logged", "dropped");
+  for (auto &p : pubs) {
+    const uint16_t which = event_schema.getFieldByName(p.name).getProto().getDiscriminantValue();
+    const uint64_t n = stats.events[which];
+    sent += p.sent;
+    sent_bytes += p.sent_bytes;
+    logged += n;
+    if (n != p.sent) printf("%-24s %10lu %10lu %10ld\n", p.name.c_str(), p.sent, n, (long)(p.sent - n));
+  }
+
+  printf("\n%.1f s, %lu segments in %s\n", seconds, rlogs.size(), opt.log_root.c_str());
+  printf("messages: %.0f msgs/s, %.2f MB/s in, %lu of %lu dropped\n", sent / seconds, sent_bytes / seconds / 1e6,
+         (unsigned long)(sent > logged ? sent - logged : 0), (unsigned long)sent);
+  printf("disk: %.2f MB/s written, slowest second %.2f MB/s, write latency max %.1f ms, degradation reached %d\n",
+         written / seconds / 1e6, min_write_rate / 1e6, max_latency_ms, max_degradation);
+  printf("frames: %lu sent, encode latency p50 %.1f ms p99 %.1f ms, at rotation max %.1f ms\n",
+         (unsigned long)frames.load(), percentile(stats.encode_ms, 0.5), percentile(stats.encode_ms, 0.99),
+         percentile(stats.rotation_ms, 1.));
+
+  printf("\ncpu per thread:\n");
+  const double tick_s = seconds * sysconf(_SC_CLK_TCK);
+  for (auto &[name, ticks] : ticks_end) {
+    auto it = ticks_start.find(name);
+    const uint64_t used = ticks - (it != ticks_start.end() ? std::min(it->second, ticks) : 0);
+    printf("  %-16s %6.1f%%\n", name.c_str(), 100. * used / tick_s);
+  }
+
+  for (auto &p : pubs) delete p.sock;
+  delete ctx;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
@@ -1,17 +1,23 @@
 #!/usr/bin/env python3
+import base64
 import json
+import mmap
 import os
 import random
 import requests
 import threading
 import time
 import traceback
+from concurrent.futures import ThreadPoolExecutor
 from pathlib import Path
+from urllib.parse import quote
 
 from cereal import log
 import cereal.messaging as messaging
 from common.api import Api
 from common.params import Params
+from common.realtime import sec_since_boot
+from common.xattr import getxattr as getxattr_uncached
 from selfdrive.hardware import TICI
 from selfdrive.loggerd.xattr_cache import getxattr, setxattr
 from selfdrive.loggerd.config import ROOT
@@ -20,18 +26,30 @@ from selfdrive.swaglog import cloudlog
 NetworkType = log.DeviceState.NetworkType
 UPLOAD_ATTR_NAME = 'user.upload'
 UPLOAD_ATTR_VALUE = b'1'
+# chunks of a file already uploaded, "<chunk size>:<bitmask in hex>"
+UPLOAD_CHUNKS_ATTR_NAME = 'user.upload.chunks'
+
+UPLOAD_CHUNK_SIZE = 4 * 1024 * 1024
+UPLOAD_THREADS = 4
+UPLOAD_RATE_ONROAD = 500 * 1000  # B/s, leaves the link to openpilot and athena while driving
+ATHENA_YIELD_TIME = 3.  # s, uploads pause for this long after athenad was busy
 
 allow_sleep = bool(os.getenv("UPLOADER_SLEEP", "1"))
 force_wifi = os.getenv("FORCEWIFI") is not None
 fake_upload = os.getenv("FAKEUPLOAD") is not None
 
+# loggerd appends a line per segment event to <route>.manifest next to the segments
+MANIFEST_EXT = ".manifest"
+# files loggerd keeps per route next to the segments, see route_index.h
+ROUTE_FILE_EXTS = (MANIFEST_EXT, ".index", ".thumbs")
+
 
 def get_directory_sort(d):
   return list(map(lambda s: s.rjust(10, '0'), d.rsplit('--', 1)))
 
 def listdir_by_creation(d):
   try:
-    paths = os.listdir(d)
+    paths = [p for p in os.listdir(d) if not p.endswith(ROUTE_FILE_EXTS)]
     paths = sorted(paths, key=get_directory_sort)
     return paths
   except OSError:
@@ -39,7 +57,7 @@ def listdir_by_creation(d):
     return list()
 
 def clear_locks(root):
-  for logname in os.listdir(root):
+  for logname in listdir_by_creation(root):
     path = os.path.join(root, logname)
     try:
       for fname in os.listdir(path):
@@ -49,11 +67,111 @@ def clear_locks(root):
       cloudlog.exception("clear_locks failed")
 
 
+class RateLimiter():
+  """Token bucket shared by the upload threads, rate None is unlimited.
+  Uploads also pause while athenad serves requests or uploads for the user."""
+  def __init__(self, params):
+    self.params = params
+    self.rate = None
+    self.lock = threading.Lock()
+    self.tokens = 0.
+    self.last = time.monotonic()
+    self.athena_checked = 0.
+    self.athena_active = False
+
+  def athena_busy(self):
+    now = time.monotonic()
+    if now - self.athena_checked > 1.:
+      self.athena_checked = now
+      try:
+        t = int(self.params.get("AthenadActiveTime") or 0) / 1e9
+      except ValueError:
+        t = 0.
+      self.athena_active = t > 0 and sec_since_boot() - t < ATHENA_YIELD_TIME
+    return self.athena_active
+
+  def consume(self, n):
+    while True:
+      with self.lock:
+        busy = self.athena_busy()
+        if not busy:
+          now = time.monotonic()
+          if self.rate is None:
+            self.tokens, self.last = 0., now
+            return
+          # at most a second of burst
+          self.tokens = min(self.tokens + (now - self.last) * self.rate, self.rate) - n
+          self.last = now
+          wait = -self.tokens / self.rate if self.tokens < 0 else 0.
+      if not busy:
+        time.sleep(wait)
+        return
+      time.sleep(0.1)
+
+
+class ShapedReader():
+  """File-like over a memoryview of the mapped file for requests, reads are slices of it and not copies"""
+  def __init__(self, data, limiter):
+    self.data = data
+    self.pos = 0
+    self.limiter = limiter
+
+  def __len__(self):
+    return len(self.data) - self.pos
+
+  def read(self, n=-1):
+    if n is None or n < 0:
+      n = len(self)
+    chunk = self.data[self.pos:self.pos + n]
+    self.pos += len(chunk)
+    self.limiter.consume(len(chunk))
+    return chunk
+
+
+def read_upload_chunks(fn):
+  """Indices of the chunks of fn already uploaded"""
+  try:
+    value = getxattr_uncached(fn, UPLOAD_CHUNKS_ATTR_NAME)
+    chunk_size, mask = value.decode().split(":")
+    if int(chunk_size) == UPLOAD_CHUNK_SIZE:
+      mask = int(mask, 16)
+      return {i for i in range(mask.bit_length()) if mask & (1 << i)}
+  except (OSError, AttributeError, ValueError):
+    pass
+  return set()
+
+
+def write_upload_chunks(fn, chunks):
+  mask = sum(1 << i for i in chunks)
+  try:
+    setxattr(fn, UPLOAD_CHUNKS_ATTR_NAME, f"{UPLOAD_CHUNK_SIZE}:{mask:x}".encode())
+  except OSError:
+    cloudlog.event("uploader_setxattr_failed", fn=fn)
+
+
+def read_manifest(path):
+  """Files of the finalized segments in a route manifest, {segment number: {name: size}}"""
+  finalized = {}
+  try:
+    with open(path) as f:
+      for line in f:
+        try:
+          event = json.loads(line)
+        except ValueError:
+          continue  # cut off by a crash
+        if event.get("state") == "finalized":
+          finalized[event["segment"]] = {name: v[0] for name, v in event["files"].items()}
+  except OSError:
+    pass
+  return finalized
+
+
 class Uploader():
-  def __init__(self, dongle_id, root):
+  def __init__(self, dongle_id, root, params=None):
     self.dongle_id = dongle_id
     self.api = Api(dongle_id)
     self.root = root
+    self.limiter = RateLimiter(params or Params())
 
     self.upload_thread = None
 
@@ -70,9 +188,11 @@ class Uploader():
     self.last_speed = 0
     self.last_filename = ""
 
+    self.manifests = {}  # route -> (mtime, finalized segments)
+
     self.immediate_folders = ["crash/", "boot/"]
-    self.immediate_priority = {"qlog.bz2": 0, "qcamera.ts": 1}
-    self.high_priority = {"rlog.bz2": 0, "fcamera.hevc": 1, "dcamera.hevc": 2, "ecamera.hevc": 3}
+    self.immediate_priority = {"qlog.bz2": 0, "qlog.zst": 0, "qlog.lz4": 0, "qcamera.ts": 1, "columns.npz": 2}
+    self.high_priority = {"rlog.bz2": 0, "rlog.zst": 0, "rlog.lz4": 0, "fcamera.hevc": 1, "dcamera.hevc": 2, "ecamera.hevc": 3}
 
   def get_upload_sort(self, name):
     if name in self.immediate_priority:
@@ -81,6 +201,24 @@ class Uploader():
       return self.high_priority[name] + 100
     return 1000
 
+  def finalized_files(self, logname):
+    """The segment's files and sizes if its route manifest has it finalized, else None.
+    Segments loggerd finalized need neither a listdir nor a lock check"""
+    route, _, num = logname.rpartition("--")
+    if not route or not num.isdigit():
+      return None
+
+    path = os.path.join(self.root, route + MANIFEST_EXT)
+    try:
+      mtime = os.stat(path).st_mtime_ns
+    except OSError:
+      return None
+    cached = self.manifests.get(route)
+    if cached is None or cached[0] != mtime:
+      cached = (mtime, read_manifest(path))
+      self.manifests[route] = cached
+    return cached[1].get(int(num))
+
   def list_upload_files(self):
     if not os.path.isdir(self.root):
       return
@@ -92,13 +230,17 @@ class Uploader():
 
     for logname in listdir_by_creation(self.root):
       path = os.path.join(self.root, logname)
-      try:
-        names = os.listdir(path)
-      except OSError:
-        continue
+      sizes = self.finalized_files(logname)
+      if sizes is not None:
+        names = list(sizes)
+      else:
+        try:
+          names = os.listdir(path)
+        except OSError:
+          continue
 
-      if any(name.endswith(".lock") for name in names):
-        continue
+        if any(name.endswith(".lock") for name in names):
+          continue
 
       for name in sorted(names, key=self.get_upload_sort):
         key = os.path.join(logname, name)
@@ -113,12 +255,13 @@ class Uploader():
           continue
 
         try:
+          size = sizes[name] if sizes is not None else os.path.getsize(fn)
           if name in self.immediate_priority:
             self.immediate_count += 1
-            self.immediate_size += os.path.getsize(fn)
+            self.immediate_size += size
           else:
             self.raw_count += 1
-            self.raw_size += os.path.getsize(fn)
+            self.raw_size += size
         except OSError:
           pass
 
@@ -166,12 +309,53 @@ class Uploader():
 
         self.last_resp = FakeResponse()
       else:
-        with open(fn, "rb") as f:
-          self.last_resp = requests.put(url, data=f, headers=headers, timeout=10)
+        self.last_resp = self.put_file(url, headers, fn)
     except Exception as e:
       self.last_exc = (e, traceback.format_exc())
       raise
 
+  def put_file(self, url, headers, fn):
+    with open(fn, "rb") as f:
+      # the mapping goes away with the last slice of it
+      data = memoryview(mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ))
+
+    if len(data) > UPLOAD_CHUNK_SIZE and headers.get("x-ms-blob-type") == "BlockBlob":
+      return self.put_blocks(url, headers, fn, data)
+    return requests.put(url, data=ShapedReader(data, self.limiter), headers=headers, timeout=10)
+
+  def put_blocks(self, url, headers, fn, data):
+    """Uploads a block blob in chunks, UPLOAD_THREADS at a time, and commits them. The chunks that made it
+    are kept in an xattr, so a retry sends only the rest. The server keeps uncommitted blocks for a week."""
+    n = (len(data) + UPLOAD_CHUNK_SIZE - 1) // UPLOAD_CHUNK_SIZE
+    block_ids = [quote(base64.b64encode(b"%08d" % i).decode()) for i in range(n)]
+    block_headers = {k: v for k, v in headers.items() if k.lower() != "x-ms-blob-type"}
+    done = read_upload_chunks(fn)
+    lock = threading.Lock()
+
+    def put_block(i):
+      chunk = data[i * UPLOAD_CHUNK_SIZE:(i + 1) * UPLOAD_CHUNK_SIZE]
+      resp = requests.put(f"{url}&comp=block&blockid={block_ids[i]}", data=ShapedReader(chunk, self.limiter),
+                          headers=block_headers, timeout=10)
+      if resp.status_code not in (200, 201):
+        return resp
+      with lock:
+        done.add(i)
+        write_upload_chunks(fn, done)
+      return None
+
+    with ThreadPoolExecutor(max_workers=UPLOAD_THREADS) as pool:
+      failed = [r for r in pool.map(put_block, [i for i in range(n) if i not in done]) if r is not None]
+    if failed:
+      return failed[0]
+
+    block_list = "".join(f"<Latest>{base64.b64encode(b'%08d' % i).decode()}</Latest>" for i in range(n))
+    resp = requests.put(f"{url}&comp=blocklist", data=f'<?xml version="1.0" encoding="utf-8"?><BlockList>{block_list}</BlockList>',
+                        headers=block_headers, timeout=10)
+    if resp.status_code == 400:
+      # the blocks expired, the next try starts over
+      write_upload_chunks(fn, set())
+    return resp
+
   def normal_upload(self, key, fn):
     self.last_resp = None
     self.last_exc = None
@@ -247,7 +431,7 @@ def uploader_fn(exit_event):
 
   sm = messaging.SubMaster(['deviceState'])
   pm = messaging.PubMaster(['uploaderState'])
-  uploader = Uploader(dongle_id, ROOT)
+  uploader = Uploader(dongle_id, ROOT, params)
 
   backoff = 0.1
   while not exit_event.is_set():
@@ -261,6 +445,7 @@ def uploader_fn(exit_event):
 
     on_wifi = network_type == NetworkType.wifi
     allow_raw_upload = params.get_bool("UploadRaw")
+    uploader.limiter.rate = None if offroad else UPLOAD_RATE_ONROAD
 
     d = uploader.next_file_to_upload(with_raw=allow_raw_upload and on_wifi and offroad)
     if d is None:  # Nothing to upload
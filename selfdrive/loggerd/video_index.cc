@@ -0,0 +1,34 @@
+#include "selfdrive/loggerd/video_index.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/logger.h"
+
+void VideoIndex::add(uint64_t offset, uint64_t timestamp_us, bool keyframe) {
+  const uint32_t frame = entries.size();
+  if (keyframe) last_keyframe = frame;
+  entries.push_back({VIDEO_INDEX_MAGIC, frame, offset, timestamp_us,
+                     keyframe ? VIDEO_INDEX_KEYFRAME : 0u, last_keyframe});
+}
+
+void VideoIndex::write() const {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664));
+  if (fd < 0) {
+    LOGE("failed to open %s: %s", path.c_str(), strerror(errno));
+    return;
+  }
+  const size_t size = entries.size() * sizeof(VideoIndexEntry);
+  bool ok = HANDLE_EINTR(::write(fd, entries.data(), size)) == (ssize_t)size;
+  if (!ok) LOGE("failed to write %s: %s", path.c_str(), strerror(errno));
+  fsync(fd);
+  close(fd);
+  if (ok) logger_file_closed(path, size, crc32(0, (const uint8_t *)entries.data(), size));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Seek index next to each video file, <video>.idx, so a player can start at
+// any frame without the rlog or scanning the bitstream. One VideoIndexEntry per
+// packet in file order, frame n's at n * sizeof(VideoIndexEntry). The encoders
+// make no B-frames, so that is also the encodeIdx segmentId of the frame.
+// video_index.py reads it.
+#define VIDEO_INDEX_MAGIC 0x58444956  // "VIDX"
+#define VIDEO_INDEX_EXT ".idx"
+
+#define VIDEO_INDEX_KEYFRAME 1
+// the muxer keeps the packet back, e.g. mkv clusters. Readers seek with the container's own index
+#define VIDEO_INDEX_NO_OFFSET UINT64_MAX
+
+struct VideoIndexEntry {
+  uint32_t magic;
+  uint32_t frame;
+  uint64_t offset;  // of the packet in the file
+  uint64_t timestamp_us;  // OMX_TICKS, the camera frame's timestamp
+  uint32_t flags;
+  uint32_t keyframe;  // the frame decoding starts from to get this one
+};
+static_assert(sizeof(VideoIndexEntry) == 32);
+
+class VideoIndex {
+ public:
+  VideoIndex(const std::string& video_path) : path(video_path + VIDEO_INDEX_EXT) {}
+  void add(uint64_t offset, uint64_t timestamp_us, bool keyframe);
+  uint32_t frames() const { return entries.size(); }
+  // writes and fsyncs the file and reports it for the segment's manifest, on the logger's close thread
+  void write() const;
+
+ private:
+  std::string path;
+  std::vector<VideoIndexEntry> entries;
+  uint32_t last_keyframe = 0;
+};
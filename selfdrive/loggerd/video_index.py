@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Reads the seek index loggerd writes next to each video file, see video_index.h"""
+import mmap
+import struct
+import sys
+from collections import namedtuple
+
+VIDEO_INDEX_MAGIC = 0x58444956
+VIDEO_INDEX_EXT = ".idx"
+VIDEO_INDEX_KEYFRAME = 1
+VIDEO_INDEX_NO_OFFSET = 2**64 - 1
+
+ENTRY = struct.Struct("<IIQQII")
+
+Frame = namedtuple("Frame", ["frame", "offset", "timestamp_us", "keyframe", "decode_from"])
+
+
+class VideoIndex():
+  """Frame n of the video, and the keyframe to start decoding at for it, without reading the video.
+  offset is None where the container doesn't give one, mkv"""
+  def __init__(self, video_path):
+    with open(video_path + VIDEO_INDEX_EXT, "rb") as f:
+      self._index = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+  def __len__(self):
+    return len(self._index) // ENTRY.size
+
+  def frame(self, i):
+    magic, frame, offset, timestamp_us, flags, keyframe = ENTRY.unpack_from(self._index, i * ENTRY.size)
+    if magic != VIDEO_INDEX_MAGIC:
+      raise ValueError(f"bad video index entry {i}")
+    return Frame(frame, None if offset == VIDEO_INDEX_NO_OFFSET else offset, timestamp_us,
+                 bool(flags & VIDEO_INDEX_KEYFRAME), keyframe)
+
+  def seek(self, i):
+    """the keyframe to start at to get to frame i, decode and drop the frames up to it"""
+    return self.frame(self.frame(i).decode_from)
+
+  def keyframes(self):
+    return [f for f in map(self.frame, range(len(self))) if f.keyframe]
+
+  def cut(self, start, end):
+    """byte range of the file holding frames [start, end), starting at a keyframe. None for the end of the file"""
+    first = self.seek(start)
+    last = self.frame(end).offset if end < len(self) else None
+    return first.offset, last
+
+  def close(self):
+    self._index.close()
+
+
+if __name__ == "__main__":
+  index = VideoIndex(sys.argv[1])
+  keyframes = index.keyframes()
+  print(f"{len(index)} frames, {len(keyframes)} keyframes")
+  for f in keyframes:
+    print(f"  frame {f.frame:5d} at {f.offset}, {f.timestamp_us} us")
+  index.close()
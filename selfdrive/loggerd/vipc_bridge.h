@@ -0,0 +1,57 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+
+#include "cereal/visionipc/visionipc.h"
+
+// VisionIPC over the network, for running models off the device. vipc_sender
+// encodes camera streams on the device with the hardware encoder, vipc_receiver
+// decodes them on a workstation into a local VisionIpcServer named "camerad",
+// so its VisionIpcClients work as they would on the device.
+//
+// Each stream is its own TCP connection on VIPC_BRIDGE_PORT + VisionStreamType,
+// a sequence of VipcBridgeHeader followed by one encoded packet.
+#define VIPC_BRIDGE_PORT 8600
+#define VIPC_BRIDGE_MAGIC 0x42504956  // "VIPB"
+
+struct VipcBridgeHeader {
+  uint32_t magic;
+  uint32_t size;  // of the packet that follows
+  uint16_t width, height;
+  uint8_t stream_type;  // VisionStreamType
+  uint8_t h265;
+  uint8_t config;  // codec config, no frame
+  uint8_t keyframe;
+  uint32_t frame_id;
+  uint32_t reserved;
+  uint64_t timestamp_sof, timestamp_eof;
+};
+static_assert(sizeof(VipcBridgeHeader) == 40);
+
+static inline bool vipc_bridge_send_all(int fd, const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static inline bool vipc_bridge_recv_all(int fd, void *data, size_t size) {
+  uint8_t *p = (uint8_t *)data;
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
@@ -0,0 +1,205 @@
+// Decodes the streams of a vipc_sender into a local VisionIpcServer, see vipc_bridge.h
+//   ./vipc_receiver <device ip> [road] [driver] [wide]
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "cereal/visionipc/visionipc_server.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/vipc_bridge.h"
+
+#define RECEIVER_BUFFERS 8
+
+ExitHandler do_exit;
+
+const struct {
+  const char *name;
+  VisionStreamType type;
+} streams[] = {
+  {"road", VISION_STREAM_YUV_BACK},
+  {"driver", VISION_STREAM_YUV_FRONT},
+  {"wide", VISION_STREAM_YUV_WIDE},
+};
+
+struct Stream {
+  const char *name;
+  VisionStreamType type;
+  int fd = -1;
+  VipcBridgeHeader header;
+  std::vector<uint8_t> data;  // the packet after header, padded for the decoder
+};
+
+static int connect_to(const std::string &host, int port) {
+  struct addrinfo hints = {}, *res = nullptr;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) return -1;
+
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai != nullptr && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  if (fd >= 0) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  return fd;
+}
+
+static bool read_packet(Stream &s) {
+  if (!vipc_bridge_recv_all(s.fd, &s.header, sizeof(s.header)) || s.header.magic != VIPC_BRIDGE_MAGIC) return false;
+  s.data.assign(s.header.size + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+  return vipc_bridge_recv_all(s.fd, s.data.data(), s.header.size);
+}
+
+// connects and reads the first packet, which has the size of the frames
+static bool open_stream(const std::string &host, Stream &s) {
+  while (!do_exit) {
+    s.fd = connect_to(host, VIPC_BRIDGE_PORT + s.type);
+    if (s.fd >= 0 && read_packet(s)) {
+      LOGW("%s: connected, %dx%d", s.name, s.header.width, s.header.height);
+      return true;
+    }
+    if (s.fd >= 0) close(s.fd);
+    s.fd = -1;
+    util::sleep_for(1000);
+  }
+  return false;
+}
+
+void decode_thread(const std::string host, Stream s, VisionIpcServer *server) {
+  set_thread_name(s.name);
+  const int width = s.header.width, height = s.header.height;
+
+  const AVCodec *codec = avcodec_find_decoder(s.header.h265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264);
+  assert(codec);
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  assert(ctx);
+  // a frame out for every packet in, nothing held back for reordering
+  ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+  ctx->thread_type = FF_THREAD_SLICE;
+  int err = avcodec_open2(ctx, codec, NULL);
+  assert(err >= 0);
+  AVFrame *frame = av_frame_alloc();
+  assert(frame);
+
+  std::map<int64_t, VisionIpcBufExtra> extras;  // by frame id, until decoded
+  std::vector<uint8_t> config;
+  while (!do_exit) {
+    if (s.header.config) {
+      // goes in front of the next frame's packet
+      config.assign(s.data.begin(), s.data.begin() + s.header.size);
+    } else {
+      if (!config.empty()) {
+        s.data.insert(s.data.begin(), config.begin(), config.end());
+        s.header.size += config.size();
+        config.clear();
+      }
+      extras[s.header.frame_id] = {.frame_id = s.header.frame_id, .timestamp_sof = s.header.timestamp_sof,
+                                   .timestamp_eof = s.header.timestamp_eof};
+
+      AVPacket pkt;
+      av_init_packet(&pkt);
+      pkt.data = s.data.data();
+      pkt.size = s.header.size;
+      pkt.pts = s.header.frame_id;
+      if (avcodec_send_packet(ctx, &pkt) < 0) {
+        LOGW("%s: failed to decode frame %u", s.name, s.header.frame_id);
+      }
+
+      while (avcodec_receive_frame(ctx, frame) == 0) {
+        auto it = extras.find(frame->pts);
+        if (it == extras.end()) continue;
+        VisionIpcBufExtra extra = it->second;
+        extras.erase(extras.begin(), ++it);
+        if (frame->format != AV_PIX_FMT_YUV420P || frame->width != width || frame->height != height) {
+          LOGE("%s: unexpected frame format %d %dx%d", s.name, frame->format, frame->width, frame->height);
+          continue;
+        }
+
+        VisionBuf *buf = server->get_buffer(s.type);
+        for (int y = 0; y < height; y++) {
+          memcpy(buf->y + y * width, frame->data[0] + y * frame->linesize[0], width);
+        }
+        for (int y = 0; y < height / 2; y++) {
+          memcpy(buf->u + y * width / 2, frame->data[1] + y * frame->linesize[1], width / 2);
+          memcpy(buf->v + y * width / 2, frame->data[2] + y * frame->linesize[2], width / 2);
+        }
+        server->send(buf, &extra);
+      }
+    }
+
+    if (read_packet(s)) continue;
+
+    // the sender restarts the stream with the parameter sets and an IDR frame
+    LOGW("%s: disconnected", s.name);
+    close(s.fd);
+    extras.clear();
+    avcodec_flush_buffers(ctx);
+    if (!open_stream(host, s)) break;
+    if (s.header.width != width || s.header.height != height) {
+      LOGE("%s: frame size changed to %dx%d", s.name, s.header.width, s.header.height);
+      do_exit = true;
+    }
+  }
+
+  if (s.fd >= 0) close(s.fd);
+  av_frame_free(&frame);
+  avcodec_free_context(&ctx);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <device ip> [road] [driver] [wide]\n", argv[0]);
+    return 1;
+  }
+  const std::string host = argv[1];
+
+  std::vector<Stream> wanted;
+  for (const auto &s : streams) {
+    bool want = argc <= 2 && s.type == VISION_STREAM_YUV_BACK;
+    for (int i = 2; i < argc; i++) want = want || strcmp(argv[i], s.name) == 0;
+    if (want) wanted.push_back({.name = s.name, .type = s.type});
+  }
+  if (wanted.empty()) {
+    fprintf(stderr, "usage: %s <device ip> [road] [driver] [wide]\n", argv[0]);
+    return 1;
+  }
+
+  // the buffers of all streams exist before anyone can connect
+  for (auto &s : wanted) {
+    if (!open_stream(host, s)) return 0;
+  }
+  VisionIpcServer server("camerad");
+  for (auto &s : wanted) {
+    server.create_buffers(s.type, RECEIVER_BUFFERS, false, s.header.width, s.header.height);
+  }
+  server.start_listener();
+
+  std::vector<std::thread> threads;
+  for (auto &s : wanted) {
+    threads.emplace_back(decode_thread, host, s, &server);
+  }
+  for (auto &t : threads) t.join();
+  return 0;
+}
@@ -0,0 +1,164 @@
+// Serves camera streams to vipc_receiver, see vipc_bridge.h
+//   ./vipc_sender [road] [driver] [wide]
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cereal/visionipc/visionipc_client.h"
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/omx_encoder.h"
+#include "selfdrive/loggerd/vipc_bridge.h"
+
+#define SENDER_FPS 20
+#define SENDER_BITRATE 5000000
+
+ExitHandler do_exit;
+
+const struct {
+  const char *name;
+  VisionStreamType type;
+} streams[] = {
+  {"road", VISION_STREAM_YUV_BACK},
+  {"driver", VISION_STREAM_YUV_FRONT},
+  {"wide", VISION_STREAM_YUV_WIDE},
+};
+
+static int listen_on(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  assert(fd >= 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+    LOGE("failed to listen on port %d: %s", port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void stream_thread(const char *name, VisionStreamType type) {
+  set_thread_name(name);
+  const int listen_fd = listen_on(VIPC_BRIDGE_PORT + type);
+  if (listen_fd < 0) return;
+
+  // conflating, a link that can't keep up drops frames instead of falling behind
+  VisionIpcClient vipc_client = VisionIpcClient("camerad", type, true);
+  std::unique_ptr<OmxEncoder> encoder;
+  std::deque<VisionIpcBufExtra> pending;  // frames in the encoder
+  std::vector<uint8_t> codec_config;
+  int client = -1;
+
+  auto send_packet = [&](const VipcBridgeHeader &header, const uint8_t *data) {
+    if (client < 0) return;
+    if (!vipc_bridge_send_all(client, &header, sizeof(header)) || !vipc_bridge_send_all(client, data, header.size)) {
+      LOGW("%s: client disconnected", name);
+      close(client);
+      client = -1;
+    }
+  };
+
+  while (!do_exit) {
+    if (client < 0) {
+      struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+      if (poll(&pfd, 1, 100) <= 0 || (client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) < 0) continue;
+      int on = 1;
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      LOGW("%s: client connected", name);
+
+      // a new client starts from an IDR frame, after the parameter sets
+      pending.clear();
+      if (encoder) {
+        encoder->encoder_close();
+        encoder->encoder_open(nullptr);
+      }
+      if (!codec_config.empty()) {
+        VipcBridgeHeader header = {.magic = VIPC_BRIDGE_MAGIC, .size = (uint32_t)codec_config.size(),
+                                   .width = (uint16_t)vipc_client.buffers[0].width, .height = (uint16_t)vipc_client.buffers[0].height,
+                                   .stream_type = (uint8_t)type, .h265 = 1, .config = 1};
+        send_packet(header, codec_config.data());
+      }
+    }
+
+    if (!vipc_client.connected && !vipc_client.connect(false)) {
+      util::sleep_for(5);
+      continue;
+    }
+
+    if (!encoder) {
+      const VisionBuf &buf_info = vipc_client.buffers[0];
+      const EncoderProfile profile = {
+        .h265 = true,
+        .bitrate = SENDER_BITRATE,
+        .cbr = true,
+        .gop = 0,
+        .bframes = 0,
+        .idr_at_segment_start = true,
+        // the whole frame once a second, no periodic IDR frames bursting the link
+        .intra_refresh_mbs = (int)((buf_info.width / 16) * (buf_info.height / 16) / SENDER_FPS),
+      };
+      encoder = std::make_unique<OmxEncoder>(name, buf_info.width, buf_info.height, SENDER_FPS, profile, false);
+      encoder->set_packet_callback([&](const uint8_t *data, size_t size, uint64_t ts_us, bool config, bool keyframe) {
+        VipcBridgeHeader header = {.magic = VIPC_BRIDGE_MAGIC, .size = (uint32_t)size,
+                                   .width = (uint16_t)buf_info.width, .height = (uint16_t)buf_info.height,
+                                   .stream_type = (uint8_t)type, .h265 = 1, .config = config, .keyframe = keyframe};
+        if (config) {
+          codec_config.assign(data, data + size);
+        } else {
+          // no B frames, packets come out in the order the frames went in
+          while (!pending.empty() && pending.front().timestamp_eof / 1000 != ts_us) pending.pop_front();
+          if (pending.empty()) return;
+          header.frame_id = pending.front().frame_id;
+          header.timestamp_sof = pending.front().timestamp_sof;
+          header.timestamp_eof = pending.front().timestamp_eof;
+          pending.pop_front();
+        }
+        send_packet(header, data);
+      });
+      encoder->encoder_open(nullptr);
+    }
+
+    VisionIpcBufExtra extra;
+    VisionBuf *buf = vipc_client.recv(&extra);
+    if (buf == nullptr) continue;
+
+    pending.push_back(extra);
+    if (encoder->encode_frame(buf->y, buf->u, buf->v, buf->width, buf->height, extra.timestamp_eof) == -1) {
+      pending.pop_back();
+    }
+  }
+
+  if (encoder) encoder->encoder_close();
+  if (client >= 0) close(client);
+  close(listen_fd);
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::thread> threads;
+  for (const auto &s : streams) {
+    bool wanted = argc <= 1 && s.type == VISION_STREAM_YUV_BACK;
+    for (int i = 1; i < argc; i++) wanted = wanted || strcmp(argv[i], s.name) == 0;
+    if (wanted) threads.emplace_back(stream_thread, s.name, s.type);
+  }
+  if (threads.empty()) {
+    fprintf(stderr, "usage: %s [road] [driver] [wide]\n", argv[0]);
+    return 1;
+  }
+  for (auto &t : threads) t.join();
+  return 0;
+}
@@ -1,11 +1,87 @@
 #!/usr/bin/env python3
+import json
+import re
+import struct
 import zmq
-from typing import NoReturn
+from typing import Dict, NoReturn, Optional, Tuple
 
 import cereal.messaging as messaging
 from common.logging_extra import SwagLogFileFormatter
 from selfdrive.swaglog import get_file_handler
 
+# binary frames of structured native logs, see selfdrive/common/swaglog.cc
+FRAME_CONTEXT = 1
+FRAME_SITE = 2
+FRAME_RECORD = 3
+
+C_FORMAT = re.compile(r"%([-+ #0]*(?:\*|\d+)?(?:\.(?:\*|\d+))?)(?:hh|h|ll|l|j|z|t|L|q)?([diouxXeEfFgGcsp%])")
+
+
+def c_format(fmt: str, args: list) -> str:
+  def conversion(m):
+    spec, conv = m.groups()
+    return "0x%x" if conv == 'p' else "%" + spec + conv
+  try:
+    return C_FORMAT.sub(conversion, fmt) % tuple(args)
+  except (TypeError, ValueError):
+    return f"{fmt} {args}"
+
+
+def decode_args(dat: bytes) -> list:
+  args: list = []
+  i = 0
+  while i < len(dat):
+    tag = dat[i:i+1]
+    if tag == b's':
+      if i + 3 > len(dat):
+        break
+      n, = struct.unpack_from("<H", dat, i + 1)
+      args.append(dat[i+3:i+3+n].decode("utf-8", "replace"))
+      i += 3 + n
+    elif tag in (b'i', b'u', b'p', b'f') and i + 9 <= len(dat):
+      fmt = {b'i': "<q", b'u': "<Q", b'p': "<Q", b'f': "<d"}[tag]
+      args.append(struct.unpack_from(fmt, dat, i + 1)[0])
+      i += 9
+    else:
+      break
+  return args
+
+
+class StructuredLogDecoder:
+  """Turns the binary frames of structured native logs back into the json swaglog sends"""
+  def __init__(self):
+    self.ctxs: Dict[int, dict] = {}
+    self.sites: Dict[Tuple[int, int], tuple] = {}
+
+  def decode(self, frame_type: int, dat: bytes) -> Optional[Tuple[int, str]]:
+    pid, = struct.unpack_from("<I", dat)
+    dat = dat[4:]
+    if frame_type == FRAME_CONTEXT:
+      self.ctxs[pid] = json.loads(dat)
+      # a new process with the pid of an old one
+      self.sites = {k: v for k, v in self.sites.items() if k[0] != pid}
+    elif frame_type == FRAME_SITE:
+      site_id, levelnum, lineno = struct.unpack_from("<Iii", dat)
+      filename, func, fmt = dat[12:].decode("utf-8", "replace").split("\0", 2)
+      self.sites[(pid, site_id)] = (levelnum, lineno, filename, func, fmt)
+    elif frame_type == FRAME_RECORD:
+      site_id, created = struct.unpack_from("<Id", dat)
+      site = self.sites.get((pid, site_id))
+      if site is None:
+        return None  # logmessaged restarted after the process sent its sites
+      levelnum, lineno, filename, func, fmt = site
+      record = {
+        "msg": c_format(fmt, decode_args(dat[12:])),
+        "ctx": self.ctxs.get(pid, {}),
+        "levelnum": levelnum,
+        "filename": filename,
+        "lineno": lineno,
+        "funcname": func,
+        "created": created,
+      }
+      return levelnum, json.dumps(record)
+    return None
+
 
 def main() -> NoReturn:
   log_handler = get_file_handler()
@@ -19,10 +95,18 @@ def main() -> NoReturn:
   # and we publish them
   pub_sock = messaging.pub_sock('logMessage')
 
+  decoder = StructuredLogDecoder()
+
   while True:
     dat = b''.join(sock.recv_multipart())
     level = dat[0]
-    record = dat[1:].decode("utf-8")
+    if level in (FRAME_CONTEXT, FRAME_SITE, FRAME_RECORD):
+      decoded = decoder.decode(level, dat[1:])
+      if decoded is None:
+        continue
+      level, record = decoded
+    else:
+      record = dat[1:].decode("utf-8")
     if level >= log_level:
       log_handler.emit(record)
 
@@ -10,12 +10,14 @@ import cereal.messaging as messaging
 import selfdrive.crash as crash
 from common.basedir import BASEDIR
 from common.params import Params, ParamKeyType
+from common.realtime import sec_since_boot
 from common.text_window import TextWindow
 from selfdrive.boardd.set_time import set_time
 from selfdrive.hardware import HARDWARE, PC, EON
 from selfdrive.manager.helpers import unblock_stdout
 from selfdrive.manager.process import ensure_running
 from selfdrive.manager.process_config import managed_processes
+from selfdrive.manager.readiness import read_readiness, READY
 from selfdrive.athena.registration import register, UNREGISTERED_DONGLE_ID
 from selfdrive.swaglog import cloudlog, add_file_handler
 from selfdrive.version import dirty, get_git_commit, version, origin, branch, commit, \
@@ -52,9 +54,7 @@ def manager_init():
     params.put_bool("RecordFront", True)
 
   # set unset params
-  for k, v in default_params:
-    if params.get(k) is None:
-      params.put(k, v)
+  params.put_many({k: v for k, v in default_params if params.get(k) is None})
 
   # dp init params
   init_params_vals(params)
@@ -75,12 +75,14 @@ def manager_init():
     print("WARNING: failed to make /dev/shm")
 
   # set version params
-  params.put("Version", version)
-  params.put("TermsVersion", terms_version)
-  params.put("TrainingVersion", training_version)
-  params.put("GitCommit", get_git_commit(default=""))
-  params.put("GitBranch", get_git_branch(default=""))
-  params.put("GitRemote", get_git_remote(default=""))
+  params.put_many({
+    "Version": version,
+    "TermsVersion": terms_version,
+    "TrainingVersion": training_version,
+    "GitCommit": get_git_commit(default=""),
+    "GitBranch": get_git_branch(default=""),
+    "GitRemote": get_git_remote(default=""),
+  })
 
   # set dongle id
   reg_res = register(show_spinner=True)
@@ -145,12 +147,15 @@ def manager_thread():
   ignore = []
   if dp_jetson:
     ignore += ['dmonitoringmodeld', 'dmonitoringd']
-  if not params.get_bool('dp_dashcamd'):
-    ignore += ['dashcamd']
   if not params.get_bool('dp_updated'):
     ignore += ['updated']
   if not dp_logger:
-    ignore += ['logcatd', 'loggerd', 'proclogd', 'logmessaged', 'tombstoned']
+    ignore += ['logcatd', 'proclogd', 'logmessaged', 'tombstoned']
+    # loggerd records the dashcam, without logging anything else
+    if params.get_bool('dp_dashcamd'):
+      os.environ['LOGGERD_DASHCAM_ONLY'] = '1'
+    else:
+      ignore += ['loggerd']
   if not dp_athenad:
     ignore += ['manage_athenad']
   if not dp_athenad and not dp_uploader:
@@ -171,6 +176,8 @@ def manager_thread():
   ensure_running(managed_processes.values(), started=False, not_run=ignore)
 
   started_prev = False
+  started_ns = 0
+  ready_time_ns = 0
   sm = messaging.SubMaster(['deviceState'])
   pm = messaging.PubMaster(['managerState'])
 
@@ -190,15 +197,31 @@ def manager_thread():
       os.sync()
       managed_processes['updated'].signal(signal.SIGHUP)
 
+    if started and not started_prev:
+      started_ns = int(sec_since_boot() * 1e9)
+      ready_time_ns = 0
+
     started_prev = started
 
+    # onroad is ready once every running process that reports readiness is ready
+    readiness = read_readiness()
+    if started and ready_time_ns == 0:
+      reporting = [(p.name, readiness[p.name]) for p in managed_processes.values()
+                   if p.proc is not None and p.proc.is_alive() and p.name in readiness]
+      if len(reporting) and all(r['pid'] == managed_processes[name].proc.pid and r['state'] == READY for name, r in reporting):
+        slowest, r = max(reporting, key=lambda x: x[1]['ready_ns'])
+        ready_time_ns = max(1, r['ready_ns'] - started_ns)
+        cloudlog.event("onroad ready", ready_time=ready_time_ns * 1e-9, slowest=slowest,
+                       init_times={name: (r['ready_ns'] - r['start_ns']) * 1e-9 for name, r in reporting})
+
     running_list = ["%s%s\u001b[0m" % ("\u001b[32m" if p.proc.is_alive() else "\u001b[31m", p.name)
                     for p in managed_processes.values() if p.proc]
     cloudlog.debug(' '.join(running_list))
 
     # send managerState
     msg = messaging.new_message('managerState')
-    msg.managerState.processes = [p.get_process_state_msg() for p in managed_processes.values()]
+    msg.managerState.processes = [p.get_process_state_msg(readiness.get(p.name)) for p in managed_processes.values()]
+    msg.managerState.readyTimeNanos = ready_time_ns if started else 0
     pm.send('managerState', msg)
 
     # TODO: let UI handle this
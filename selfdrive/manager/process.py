@@ -15,6 +15,7 @@ from common.params import Params
 from common.realtime import sec_since_boot
 from selfdrive.swaglog import cloudlog
 from selfdrive.hardware import HARDWARE
+from selfdrive.manager.readiness import READY
 from cereal import log
 
 WATCHDOG_FN = "/dev/shm/wd_"
@@ -155,13 +156,19 @@ class ManagerProcess(ABC):
     cloudlog.info(f"sending signal {sig} to {self.name}")
     os.kill(self.proc.pid, sig)
 
-  def get_process_state_msg(self):
+  def get_process_state_msg(self, readiness=None):
     state = log.ManagerState.ProcessState.new_message()
     state.name = self.name
     if self.proc:
       state.running = self.proc.is_alive()
       state.pid = self.proc.pid or 0
       state.exitCode = self.proc.exitcode or 0
+      # the readiness of an earlier run doesn't count
+      if readiness is not None and readiness['pid'] == self.proc.pid:
+        state.ready = readiness['state'] == READY
+        if state.ready:
+          state.initTimeNanos = readiness['ready_ns'] - readiness['start_ns']
+        state.initPhases = [{'name': name, 'durationNanos': duration} for name, duration in readiness['phases']]
     return state
 
 
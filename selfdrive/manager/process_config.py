@@ -5,6 +5,12 @@ from selfdrive.hardware import EON, TICI, PC
 
 WEBCAM = os.getenv("USE_WEBCAM") is not None
 MIPI = os.getenv("USE_MIPI") is not None
+PY_PLANNERD = os.getenv("PY_PLANNERD") is not None
+PY_RADARD = os.getenv("PY_RADARD") is not None
+PY_PARAMSD = os.getenv("PY_PARAMSD") is not None
+PY_CALIBRATIOND = os.getenv("PY_CALIBRATIOND") is not None
+# the CANParsers read what canshared parsed, opt-in
+CANSHARE = os.getenv("CANSHARE") is not None
 
 procs = [
   DaemonProcess("manage_athenad", "selfdrive.athena.manage_athenad", "AthenadPid"),
@@ -13,24 +19,31 @@ procs = [
   NativeProcess("clocksd", "selfdrive/clocksd", ["./clocksd"]),
   NativeProcess("dmonitoringmodeld", "selfdrive/modeld", ["./dmonitoringmodeld"], enabled=not MIPI and (not PC or WEBCAM), driverview=True),
   NativeProcess("logcatd", "selfdrive/logcatd", ["./logcatd"]),
+  NativeProcess("loadgovd", "selfdrive/loadgovd", ["./loadgovd"]),
   NativeProcess("loggerd", "selfdrive/loggerd", ["./loggerd"]),
   NativeProcess("modeld", "selfdrive/modeld", ["./modeld"]),
   NativeProcess("proclogd", "selfdrive/proclogd", ["./proclogd"]),
   NativeProcess("sensord", "selfdrive/sensord", ["./sensord"], enabled=not PC and not MIPI, persistent=EON, sigkill=EON),
   NativeProcess("ubloxd", "selfdrive/locationd", ["./ubloxd"], enabled=(not PC or WEBCAM)),
+  NativeProcess("gnssd", "selfdrive/locationd", ["./gnssd"], enabled=(not PC or WEBCAM)),
   NativeProcess("ui", "selfdrive/ui", ["./ui"], persistent=True, watchdog_max_dt=(5 if TICI else None)),
   NativeProcess("soundd", "selfdrive/ui", ["./soundd"], enabled= not MIPI),
   NativeProcess("locationd", "selfdrive/locationd", ["./locationd"]),
   NativeProcess("boardd", "selfdrive/boardd", ["./boardd"], enabled=False),
-  PythonProcess("calibrationd", "selfdrive.locationd.calibrationd"),
+  # modeld calibrates the camera itself, calibrationd.py is kept as the reference
+  PythonProcess("calibrationd", "selfdrive.locationd.calibrationd", enabled=PY_CALIBRATIOND),
+  PythonProcess("canshared", "selfdrive.canshared", enabled=CANSHARE),
+  PythonProcess("cansignalsd", "selfdrive.cansignalsd"),
   PythonProcess("controlsd", "selfdrive.controls.controlsd"),
   PythonProcess("deleter", "selfdrive.loggerd.deleter", persistent=True),
   PythonProcess("dmonitoringd", "selfdrive.monitoring.dmonitoringd", enabled=not MIPI and (not PC or WEBCAM), driverview=True),
   PythonProcess("logmessaged", "selfdrive.logmessaged", persistent=True),
   PythonProcess("pandad", "selfdrive.pandad", persistent=True),
-  PythonProcess("paramsd", "selfdrive.locationd.paramsd"),
-  PythonProcess("plannerd", "selfdrive.controls.plannerd"),
-  PythonProcess("radard", "selfdrive.controls.radard"),
+  PythonProcess("paramsd", "selfdrive.locationd.paramsd") if PY_PARAMSD else NativeProcess("paramsd", "selfdrive/locationd", ["./paramsd"]),
+  # the native planner publishes the same plans, the python one is kept as the reference
+  PythonProcess("plannerd", "selfdrive.controls.plannerd") if PY_PLANNERD else NativeProcess("plannerd", "selfdrive/controls", ["./plannerd"]),
+  # radard runs radard.py itself for the cars without a native radar interface
+  PythonProcess("radard", "selfdrive.controls.radard") if PY_RADARD else NativeProcess("radard", "selfdrive/controls", ["./radard"]),
   PythonProcess("thermald", "selfdrive.thermald.thermald", persistent=True),
   PythonProcess("timezoned", "selfdrive.timezoned", enabled=TICI, persistent=True),
   PythonProcess("tombstoned", "selfdrive.tombstoned", enabled=not PC and not MIPI, persistent=True),
@@ -0,0 +1,117 @@
+"""Startup readiness of the daemons, see selfdrive/common/readiness.h for the layout."""
+import fcntl
+import mmap
+import os
+import struct
+
+from common.realtime import sec_since_boot
+
+READINESS_PATH = "/dev/shm/readiness"
+READINESS_SLOTS = 64
+READINESS_MAX_PHASES = 7
+SLOT_SIZE = 256
+
+INITIALIZING = 1
+READY = 2
+
+# used, seq, pid, state, name, start_ns, ready_ns, num_phases, reserved
+HEADER = struct.Struct("<IIiI32sQQII")
+PHASE = struct.Struct("<16sQ")
+SEQ_OFFSET = 4
+
+
+def _cstr(b):
+  return b.split(b'\0', 1)[0].decode('utf-8', 'replace')
+
+
+def read_readiness(path=READINESS_PATH):
+  """name -> dict of pid, state, start_ns, ready_ns and phases [(name, duration_ns)]"""
+  try:
+    with open(path, 'rb') as f:
+      buf = f.read(SLOT_SIZE * READINESS_SLOTS)
+  except OSError:
+    return {}
+
+  ret = {}
+  for i in range(len(buf) // SLOT_SIZE):
+    slot = buf[i * SLOT_SIZE:(i + 1) * SLOT_SIZE]
+    used, seq, pid, state, name, start_ns, ready_ns, num_phases, _ = HEADER.unpack_from(slot)
+    # a slot in the middle of an update is skipped, it's read again in a moment
+    if not used or seq % 2:
+      continue
+    phases = []
+    for j in range(min(num_phases, READINESS_MAX_PHASES)):
+      phase_name, duration_ns = PHASE.unpack_from(slot, HEADER.size + j * PHASE.size)
+      phases.append((_cstr(phase_name), duration_ns))
+    ret[_cstr(name)] = {'pid': pid, 'state': state, 'start_ns': start_ns, 'ready_ns': ready_ns, 'phases': phases}
+  return ret
+
+
+class Readiness:
+  """Readiness of a python daemon, like the native one"""
+  def __init__(self, name, path=READINESS_PATH):
+    self.name = name
+    self.start_ns = int(sec_since_boot() * 1e9)
+    self.phase_start_ns = self.start_ns
+    self.current = None
+    self.num_phases = 0
+    self.mm = None
+    self.offset = 0
+
+    try:
+      fd = os.open(path, os.O_RDWR | os.O_CREAT, 0o666)
+    except OSError:
+      return
+    try:
+      fcntl.flock(fd, fcntl.LOCK_EX)
+      os.ftruncate(fd, SLOT_SIZE * READINESS_SLOTS)
+      self.mm = mmap.mmap(fd, SLOT_SIZE * READINESS_SLOTS)
+      free = None
+      for i in range(READINESS_SLOTS):
+        used, _, _, _, slot_name = HEADER.unpack_from(self.mm, i * SLOT_SIZE)[:5]
+        if used and _cstr(slot_name) == name[:31]:
+          free = i
+          break
+        if not used and free is None:
+          free = i
+      if free is None:
+        self.mm = None
+      else:
+        self.offset = free * SLOT_SIZE
+        struct.pack_into("<I", self.mm, self.offset, 1)
+        struct.pack_into("32s", self.mm, self.offset + 16, name[:31].encode())
+    finally:
+      fcntl.flock(fd, fcntl.LOCK_UN)
+      os.close(fd)
+
+    self._update(pid=os.getpid(), state=INITIALIZING, start_ns=self.start_ns, ready_ns=0, num_phases=0)
+
+  def _update(self, **kw):
+    if self.mm is None:
+      return
+    seq = struct.unpack_from("<I", self.mm, self.offset + SEQ_OFFSET)[0]
+    struct.pack_into("<I", self.mm, self.offset + SEQ_OFFSET, (seq + 1) & 0xffffffff)
+    for key, fmt, off in (('pid', '<i', 8), ('state', '<I', 12), ('start_ns', '<Q', 48),
+                          ('ready_ns', '<Q', 56), ('num_phases', '<I', 64)):
+      if key in kw:
+        struct.pack_into(fmt, self.mm, self.offset + off, kw[key])
+    if 'phase' in kw:
+      idx, phase_name, duration_ns = kw['phase']
+      PHASE.pack_into(self.mm, self.offset + HEADER.size + idx * PHASE.size, phase_name[:15].encode(), duration_ns)
+    struct.pack_into("<I", self.mm, self.offset + SEQ_OFFSET, (seq + 2) & 0xffffffff)
+
+  def _end_phase(self):
+    now = int(sec_since_boot() * 1e9)
+    if self.current is not None and self.num_phases < READINESS_MAX_PHASES:
+      self._update(phase=(self.num_phases, self.current, now - self.phase_start_ns), num_phases=self.num_phases + 1)
+      self.num_phases += 1
+    self.current = None
+    self.phase_start_ns = now
+
+  def phase(self, name):
+    self._end_phase()
+    self.current = name
+
+  def ready(self):
+    self._end_phase()
+    self._update(state=READY, ready_ns=int(sec_since_boot() * 1e9))
@@ -1,6 +1,7 @@
-from selfdrive.mapd.lib.WayRelation import WayRelation
+from selfdrive.mapd.lib.WayRelation import WayRelation, _WAY_BBOX_PADING
 from selfdrive.mapd.lib.WayRelationIndex import WayRelationIndex
 from selfdrive.mapd.lib.Route import Route
+from selfdrive.mapd.lib.way_index_pyx import WayIndex  # pylint: disable=no-name-in-module, import-error
 from selfdrive.mapd.config import LANE_WIDTH
 import uuid
 
@@ -23,6 +24,8 @@ class WayCollection():
     self.query_center = query_center
 
     self.wr_index = WayRelationIndex(self.way_relations)
+    self.segment_index = WayIndex([wr.nodes_np for wr in self.way_relations], _WAY_BBOX_PADING)
+    self._located_way_relations = []
 
   def get_route(self, location_rad, bearing_rad, location_stdev):
     """Provides the best route found in the way collection based on current location and bearing.
@@ -30,13 +33,18 @@ class WayCollection():
     if location_rad is None or bearing_rad is None or location_stdev is None:
       return None
 
-    # Update all way relations in collection to the provided location and bearing.
-    for wr in self.way_relations:
+    # Update the way relations close enough to the location to the provided location and bearing, the rest
+    # can not be active. The segment index gives them without going through the whole collection.
+    for wr in self._located_way_relations:
+      wr.reset_location_variables()
+    way_relations = [self.way_relations[idx] for idx in self.segment_index.ways_at(location_rad)]
+    for wr in way_relations:
       wr.update(location_rad, bearing_rad, location_stdev)
+    self._located_way_relations = way_relations
 
     # Get the way relations where a match was found. i.e. those now marked as active as long as the direction of
     # travel is valid.
-    valid_way_relations = [wr for wr in self.way_relations if wr.active and not wr.is_prohibited]
+    valid_way_relations = [wr for wr in way_relations if wr.active and not wr.is_prohibited]
 
     # If no active, then we could not find a current way to build a route.
     if len(valid_way_relations) == 0:
@@ -205,6 +205,12 @@ class WayRelation():
   def id(self):
     return self.way.id
 
+  @property
+  def nodes_np(self):
+    """The (N, 2) array of [lat, lon] of the way nodes in radians.
+    """
+    return self._nodes_np
+
   @property
   def road_name(self):
     if self.name is not None:
@@ -0,0 +1,110 @@
+#include "selfdrive/mapd/lib/way_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+const double R = 6373000.0;  // approximate radius of earth in mts, same as geo.py
+const size_t NODE_SIZE = 16;
+
+WayIndex::WayIndex(const double *nodes, const int *node_counts, size_t way_count, double padding) {
+  for (size_t i = 0; i < way_count; i++) {
+    for (int j = 0; j < node_counts[i] - 1; j++) {
+      const double *n = &nodes[2 * j];
+      segments.push_back({n[0], n[1], n[2], n[3], (int32_t)i, j});
+    }
+    nodes += 2 * std::max(node_counts[i], 0);
+  }
+
+  // Sort tile recursive: slices by latitude, each slice sorted by longitude, so that
+  // every run of NODE_SIZE segments is spatially close.
+  auto center_lat = [](const Segment &s) { return s.lat0 + s.lat1; };
+  auto center_lon = [](const Segment &s) { return s.lon0 + s.lon1; };
+  std::sort(segments.begin(), segments.end(), [&](auto &a, auto &b) { return center_lat(a) < center_lat(b); });
+  size_t leaves = (segments.size() + NODE_SIZE - 1) / NODE_SIZE;
+  size_t slice = NODE_SIZE * (size_t)std::ceil(std::sqrt((double)leaves));
+  for (size_t i = 0; i < segments.size(); i += slice) {
+    auto end = segments.begin() + std::min(i + slice, segments.size());
+    std::sort(segments.begin() + i, end, [&](auto &a, auto &b) { return center_lon(a) < center_lon(b); });
+  }
+
+  std::vector<Box> level;
+  level.reserve(segments.size());
+  for (auto &s : segments) {
+    level.push_back({std::min(s.lat0, s.lat1) - padding, std::min(s.lon0, s.lon1) - padding,
+                     std::max(s.lat0, s.lat1) + padding, std::max(s.lon0, s.lon1) + padding});
+  }
+  boxes.push_back(std::move(level));
+
+  while (boxes.back().size() > 1) {
+    const std::vector<Box> &children = boxes.back();
+    std::vector<Box> parents;
+    parents.reserve((children.size() + NODE_SIZE - 1) / NODE_SIZE);
+    for (size_t i = 0; i < children.size(); i += NODE_SIZE) {
+      Box b = children[i];
+      for (size_t j = i + 1; j < std::min(i + NODE_SIZE, children.size()); j++) {
+        b.min_lat = std::min(b.min_lat, children[j].min_lat);
+        b.min_lon = std::min(b.min_lon, children[j].min_lon);
+        b.max_lat = std::max(b.max_lat, children[j].max_lat);
+        b.max_lon = std::max(b.max_lon, children[j].max_lon);
+      }
+      parents.push_back(b);
+    }
+    boxes.push_back(std::move(parents));
+  }
+}
+
+template <typename Visit>
+void WayIndex::query(const Box &box, Visit visit) const {
+  if (segments.empty()) return;
+
+  auto intersects = [&](const Box &b) {
+    return b.min_lat <= box.max_lat && b.max_lat >= box.min_lat && b.min_lon <= box.max_lon && b.max_lon >= box.min_lon;
+  };
+  // (level, index) of the nodes left to descend
+  std::vector<std::pair<int, size_t>> stack = {{(int)boxes.size() - 1, 0}};
+  while (!stack.empty()) {
+    auto [l, i] = stack.back();
+    stack.pop_back();
+    if (!intersects(boxes[l][i])) continue;
+
+    if (l == 0) {
+      visit(segments[i]);
+      continue;
+    }
+    for (size_t j = i * NODE_SIZE; j < std::min((i + 1) * NODE_SIZE, boxes[l - 1].size()); j++) {
+      stack.push_back({l - 1, j});
+    }
+  }
+}
+
+std::vector<int> WayIndex::ways_at(double lat, double lon) const {
+  std::vector<int> ways;
+  query({lat, lon, lat, lon}, [&](const Segment &s) { ways.push_back(s.way); });
+  std::sort(ways.begin(), ways.end());
+  ways.erase(std::unique(ways.begin(), ways.end()), ways.end());
+  return ways;
+}
+
+double WayIndex::distance_to_segment(const Segment &s, double lat, double lon) {
+  // Equirectangular projection around the location, fine at the scale of a way segment.
+  double k = std::cos(lat);
+  double ax = (s.lon0 - lon) * k * R, ay = (s.lat0 - lat) * R;
+  double bx = (s.lon1 - lon) * k * R, by = (s.lat1 - lat) * R;
+  double dx = bx - ax, dy = by - ay;
+  double len2 = dx * dx + dy * dy;
+  double t = len2 > 0. ? std::clamp(-(ax * dx + ay * dy) / len2, 0., 1.) : 0.;
+  return std::hypot(ax + t * dx, ay + t * dy);
+}
+
+WayIndex::Nearest WayIndex::nearest(double lat, double lon, double max_distance) const {
+  double dlat = max_distance / R;
+  double dlon = dlat / std::max(std::cos(lat), 1e-6);
+  Nearest result;
+  query({lat - dlat, lon - dlon, lat + dlat, lon + dlon}, [&](const Segment &s) {
+    double d = distance_to_segment(s, lat, lon);
+    if (d <= max_distance && (result.way == -1 || d < result.distance)) {
+      result = {s.way, s.index, d};
+    }
+  });
+  return result;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Spatial index over the segments of the ways of a WayCollection.
+// Segments are bulk loaded into a packed R-tree (sort tile recursive), nodes are
+// stored level by level in flat arrays so a query is a walk over contiguous memory.
+// Coordinates are [lat, lon] in radians, distances in meters.
+class WayIndex {
+public:
+  // `nodes` holds the (lat, lon) pairs of all ways back to back, way i has
+  // `node_counts[i]` nodes. `padding` is added around every segment bounding box.
+  WayIndex(const double *nodes, const int *node_counts, size_t way_count, double padding);
+
+  // Indices of the ways having a padded segment bounding box that contains the location. Sorted, no repeats.
+  std::vector<int> ways_at(double lat, double lon) const;
+
+  struct Nearest {
+    int way = -1;
+    int segment = -1;  // index of the first node of the segment on the way
+    double distance = 0.;
+  };
+  // Closest segment to the location among the ones within `max_distance`. way is -1 when none.
+  Nearest nearest(double lat, double lon, double max_distance) const;
+
+  size_t size() const { return segments.size(); }
+
+private:
+  struct Box {
+    double min_lat, min_lon, max_lat, max_lon;
+    bool contains(double lat, double lon) const {
+      return lat >= min_lat && lat <= max_lat && lon >= min_lon && lon <= max_lon;
+    }
+  };
+  struct Segment {
+    double lat0, lon0, lat1, lon1;
+    int32_t way, index;
+  };
+
+  template <typename Visit>
+  void query(const Box &box, Visit visit) const;
+  static double distance_to_segment(const Segment &s, double lat, double lon);
+
+  std::vector<Segment> segments;
+  // boxes[0] are the padded segment boxes, boxes[l + 1] the parents of boxes[l]: entry i covers
+  // entries [i * NODE_SIZE, (i + 1) * NODE_SIZE) of the level below. The last level is the root.
+  std::vector<std::vector<Box>> boxes;
+};
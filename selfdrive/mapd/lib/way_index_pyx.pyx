@@ -0,0 +1,55 @@
+# distutils: language = c++
+# cython: language_level = 3
+from libcpp.vector cimport vector
+
+import numpy as np
+cimport numpy as np
+
+cdef extern from "selfdrive/mapd/lib/way_index.cc":
+  pass
+
+cdef extern from "selfdrive/mapd/lib/way_index.h":
+  cdef cppclass WayIndex_c "WayIndex":
+    cppclass Nearest:
+      int way
+      int segment
+      double distance
+
+    WayIndex_c(const double*, const int*, size_t, double)
+    vector[int] ways_at(double, double)
+    Nearest nearest(double, double, double)
+    size_t size()
+
+
+cdef class WayIndex:
+  """R-tree over the segments of a list of ways. `ways_nodes` is a list of (N, 2) arrays
+  of [lat, lon] in radians, results refer to ways by their position in the list.
+  """
+  cdef WayIndex_c* idx
+
+  def __cinit__(self, ways_nodes, double padding):
+    counts = np.array([len(nodes) for nodes in ways_nodes], dtype=np.intc)
+    nodes = np.ascontiguousarray(np.concatenate(ways_nodes) if len(ways_nodes) > 0 else np.zeros((0, 2)),
+                                 dtype=np.float64)
+    cdef np.ndarray[int, ndim=1, mode="c"] c_counts = counts
+    cdef np.ndarray[double, ndim=2, mode="c"] c_nodes = nodes.reshape(-1, 2)
+    self.idx = new WayIndex_c(<double*>c_nodes.data, <int*>c_counts.data, len(counts), padding)
+
+  def __dealloc__(self):
+    del self.idx
+
+  def __len__(self):
+    return self.idx.size()
+
+  def ways_at(self, location_rad):
+    """Indices of the ways with a segment whose padded bounding box contains `location_rad`.
+    """
+    return self.idx.ways_at(location_rad[0], location_rad[1])
+
+  def nearest(self, location_rad, double max_distance):
+    """(way index, segment index, distance) of the closest segment within `max_distance` mts, None if there is none.
+    """
+    cdef WayIndex_c.Nearest n = self.idx.nearest(location_rad[0], location_rad[1], max_distance)
+    if n.way < 0:
+      return None
+    return n.way, n.segment, n.distance
@@ -5,14 +5,20 @@
 #include <cstdlib>
 
 #include "cereal/visionipc/visionipc_client.h"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/load_governor.h"
+#include "selfdrive/common/readiness.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
+#include "selfdrive/hardware/hw.h"
 #include "selfdrive/modeld/models/dmonitoring.h"
 
 ExitHandler do_exit;
 
 void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
   PubMaster pm({"driverState"});
+  SubMaster sm({"carState", "controlsState", "deviceState", "driverMonitoringState"});
+  DMonitoringRate rate;
   double last = 0;
 
   while (!do_exit) {
@@ -20,12 +26,31 @@ void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
     VisionBuf *buf = vipc_client.recv(&extra);
     if (buf == nullptr) continue;
 
+    sm.update(0);
+    const DMonitoringVehicle vehicle = {
+      .onroad = sm["deviceState"].getDeviceState().getStarted(),
+      .engaged = sm["controlsState"].getControlsState().getEnabled(),
+      // without a car it stands still
+      .standstill = !sm.alive("carState") || sm["carState"].getCarState().getStandstill(),
+      .v_ego = sm["carState"].getCarState().getVEgo(),
+      .distracted = sm["driverMonitoringState"].getDriverMonitoringState().getIsDistracted(),
+      .awareness = sm.rcv_frame("driverMonitoringState") > 0 ? sm["driverMonitoringState"].getDriverMonitoringState().getAwarenessStatus() : 1.f,
+    };
+
+    // the frames the model skips get the last outputs again, dmonitoringd
+    // counts time in messages
     double t1 = millis_since_boot();
-    DMonitoringResult res = dmonitoring_eval_frame(&model, buf->addr, buf->width, buf->height);
+    if (!dmonitoring_rate_update(&rate, vehicle, extra.frame_id, t1 / 1000.0, load_shed(LoadShed::DMONITORING_RATE))) {
+      dmonitoring_publish(pm, extra.frame_id, rate.last, 0, model.output, &rate, true);
+      continue;
+    }
+
+    DMonitoringResult res = dmonitoring_eval_frame(&model, buf->buf_cl, buf->width, buf->height);
     double t2 = millis_since_boot();
+    dmonitoring_rate_ran(&rate, res, extra.frame_id, t1 / 1000.0);
 
     // send dm packet
-    dmonitoring_publish(pm, extra.frame_id, res, (t2 - t1) / 1000.0, model.output);
+    dmonitoring_publish(pm, extra.frame_id, res, (t2 - t1) / 1000.0, model.output, &rate);
 
     //printf("dmonitoring process: %.2fms, from last %.2fms\n", t2 - t1, t1 - last);
     last = t1;
@@ -33,13 +58,31 @@ void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
 }
 
 int main(int argc, char **argv) {
+  Readiness readiness("dmonitoringmodeld");
   setpriority(PRIO_PROCESS, 0, -15);
+#ifdef USE_THNEED
+  // whatever runs on the GPU here goes behind the driving model
+  thneed_set_context_priority(8);
+#endif
+
+  // cl init
+  readiness.phase("cl init");
+  #ifdef XNX
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_GPU);
+  #else
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+  #endif
+  cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
 
   // init the models
+  readiness.phase("model load");
   DMonitoringModelState model;
-  dmonitoring_init(&model);
+  dmonitoring_init(&model, device_id, context);
 
-  VisionIpcClient vipc_client = VisionIpcClient("camerad", VISION_STREAM_YUV_FRONT, true);
+  // camerad crops the driver on the GPU where it can
+  const bool roi_stream = Hardware::EON() || Hardware::TICI();
+  VisionIpcClient vipc_client = VisionIpcClient("camerad", roi_stream ? VISION_STREAM_YUV_FRONT_ROI : VISION_STREAM_YUV_FRONT, true, device_id, context);
+  readiness.phase("camerad");
   while (!do_exit && !vipc_client.connect(false)) {
     util::sleep_for(100);
   }
@@ -47,9 +90,11 @@ int main(int argc, char **argv) {
   // run the models
   if (vipc_client.connected) {
     LOGW("connected with buffer size: %d", vipc_client.buffers[0].len);
+    readiness.ready();
     run_model(model, vipc_client);
   }
 
   dmonitoring_free(&model);
+  CL_CHECK(clReleaseContext(context));
   return 0;
 }
@@ -0,0 +1,105 @@
+// Runs the model io recorded by modeld (ModelIORecordFrames) through a model
+// file with the runner for its extension, and reports how long every run took
+// and how far the outputs are from the recorded ones. Every frame gets the
+// recorded inputs and recurrent state, so differences don't build up:
+//   ./model_replay model_io_1234.bin ../../models/supercombo_opt.thneed --tolerance 1e-3
+// exits with 1 when an output is further off than the tolerance.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/modeld/models/driving.h"
+#include "selfdrive/modeld/models/model_io.h"
+
+static double percentile(std::vector<double> v, double p) {
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s recording.bin model [--runs N] [--tolerance T]\n", argv[0]);
+    return 1;
+  }
+  int runs = 1;
+  double tolerance = -1;
+  for (int i = 3; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--runs" && i + 1 < argc) {
+      runs = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--tolerance" && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    }
+  }
+
+  ModelIOHeader header;
+  std::vector<ModelIOFrame> frames;
+  if (!model_io_read(argv[1], &header, &frames)) {
+    fprintf(stderr, "can't read %s\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<float> output(header.output_size), recurrent(header.recurrent_size);
+  std::vector<float> desire(header.desire_size), traffic(header.traffic_size), input(header.input_size);
+  std::unique_ptr<RunModel> m = model_runner(argv[2], output.data(), output.size());
+  if (!m) {
+    fprintf(stderr, "can't run %s in this build\n", argv[2]);
+    return 1;
+  }
+  if (header.recurrent_size) m->addRecurrent(recurrent.data(), recurrent.size());
+  if (header.desire_size) m->addDesire(desire.data(), desire.size());
+  if (header.traffic_size) m->addTrafficConvention(traffic.data(), traffic.size());
+
+  std::vector<double> times;
+  double max_diff = 0, sum_diff = 0;
+  float max_diff_value = 0;
+  size_t max_diff_frame = 0, max_diff_idx = 0, compared = 0, nans = 0;
+  for (int run = 0; run < runs; run++) {
+    for (size_t i = 0; i < frames.size(); i++) {
+      const ModelIOFrame &f = frames[i];
+      std::copy(f.recurrent.begin(), f.recurrent.end(), recurrent.begin());
+      std::copy(f.desire.begin(), f.desire.end(), desire.begin());
+      std::copy(f.traffic.begin(), f.traffic.end(), traffic.begin());
+      // the runner may use the input as scratch space
+      std::copy(f.input.begin(), f.input.end(), input.begin());
+
+      double t1 = millis_since_boot();
+      m->execute(input.data(), input.size());
+      times.push_back(millis_since_boot() - t1);
+
+      if (run > 0) continue;
+      for (size_t j = 0; j < output.size(); j++) {
+        const double diff = std::abs((double)output[j] - f.output[j]);
+        if (std::isnan(diff)) {
+          nans++;
+          continue;
+        }
+        sum_diff += diff;
+        if (diff > max_diff) {
+          max_diff = diff;
+          max_diff_value = output[j];
+          max_diff_frame = i;
+          max_diff_idx = j;
+        }
+      }
+      compared += output.size();
+    }
+  }
+
+  printf("%zu frames, %d runs of %s\n", frames.size(), runs, argv[2]);
+  printf("latency ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+         percentile(times, 0.5), percentile(times, 0.9), percentile(times, 0.99), percentile(times, 1.0));
+  printf("output diff: mean %.3g  max %.3g (frame %zu, output %zu: %g recorded, %g now), %zu nan\n",
+         sum_diff / std::max<size_t>(compared, 1), max_diff, max_diff_frame, max_diff_idx,
+         frames[max_diff_frame].output[max_diff_idx], max_diff_value, nans);
+  if (tolerance >= 0 && (max_diff > tolerance || nans > 0)) {
+    printf("FAIL: max diff over %g\n", tolerance);
+    return 1;
+  }
+  return 0;
+}
@@ -1,16 +1,26 @@
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <mutex>
-
-#include <eigen3/Eigen/Dense>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "cereal/visionipc/visionipc_client.h"
 #include "selfdrive/common/clutil.h"
+#include "selfdrive/common/load_governor.h"
+#include "selfdrive/common/metrics.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/readiness.h"
+#include "selfdrive/common/sched.h"
+#include "selfdrive/common/spsc_queue.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
+#include "selfdrive/locationd/calibration.h"
 #include "selfdrive/modeld/models/driving.h"
 
 ExitHandler do_exit;
@@ -19,58 +29,212 @@ bool live_calib_seen;
 mat3 cur_transform;
 std::mutex transform_lock;
 
+static void set_calib_transform(const float *extrinsic, bool wide_camera) {
+  mat3 model_transform = model_calib_transform(extrinsic, wide_camera);
+  std::lock_guard lk(transform_lock);
+  cur_transform = model_transform;
+  live_calib_seen = true;
+}
+
+// The camera is calibrated here on the posenet outputs of the frames the model
+// ran on, as they come out of it. liveCalibration is still published for the
+// others. PY_CALIBRATIOND=1 leaves it to calibrationd.py, the transform follows
+// its liveCalibration then
+struct CameraOdom {
+  float trans[3], rot[3], trans_std[3];
+};
+static SPSCQueue<CameraOdom, 16> calib_odoms;
+
+static void calibrate_on(const ModelDataRaw &net_outputs) {
+  CameraOdom odom;
+  for (int i = 0; i < 3; i++) {
+    odom.trans[i] = net_outputs.pose[i];
+    odom.rot[i] = net_outputs.pose[3 + i];
+    odom.trans_std[i] = exp(net_outputs.pose[6 + i]);
+  }
+  // full only when the calibration thread isn't taking them
+  calib_odoms.push(odom);
+}
+
 void calibration_thread(bool wide_camera) {
   set_thread_name("calibration");
-  set_realtime_priority(50);
+  sched_apply("modeld", "calibration");
+
+  if (getenv("PY_CALIBRATIOND")) {
+    SubMaster sm({"liveCalibration"});
+    while (!do_exit) {
+      sm.update(100);
+      if(sm.updated("liveCalibration")) {
+        auto extrinsic_matrix = sm["liveCalibration"].getLiveCalibration().getExtrinsicMatrix();
+        float extrinsic[4*3];
+        for (int i = 0; i < 4*3; i++) {
+          extrinsic[i] = extrinsic_matrix[i];
+        }
+        set_calib_transform(extrinsic, wide_camera);
+      }
+    }
+    return;
+  }
+
+  SubMaster sm({"carState"});
+  PubMaster pm({"liveCalibration"});
+  Calibrator calibrator(wide_camera, true);
+  float extrinsic[4*3];
+
+  // the model starts on the saved calibration
+  calibrator.get_extrinsic_matrix(extrinsic);
+  set_calib_transform(extrinsic, wide_camera);
+
+  uint64_t frame = 0;
+  while (!do_exit) {
+    CameraOdom odom;
+    const bool updated = calib_odoms.try_pop(odom, 100);
+    sm.update(0);
+    if (updated) {
+      calibrator.handle_v_ego(sm["carState"].getCarState().getVEgo());
+      calibrator.handle_cam_odom(odom.trans, odom.rot, odom.trans_std);
+      calibrator.get_extrinsic_matrix(extrinsic);
+      set_calib_transform(extrinsic, wide_camera);
+    }
+
+    // 4Hz driven by cameraOdometry
+    if (frame++ % 5 == 0) {
+      MessageBuilder msg;
+      calibrator.fill_msg(msg.initEvent().initLiveCalibration());
+      pm.send("liveCalibration", msg);
+    }
+  }
+}
+
+// A frame that is this old when the model gets to it means modeld is behind.
+// It is skipped for a newer one if there is one, planning wants the freshest
+const uint64_t MODEL_DEADLINE_NS = 1.5 * 1e9 / MODEL_FREQ;
+
+// frames skipped for a newer one count as missed for the load governor
+static LoadDeadline model_deadline("modeld");
+
+static bool past_deadline(const VisionIpcBufExtra &extra) {
+  return extra.timestamp_eof != 0 && nanos_since_boot() > extra.timestamp_eof + MODEL_DEADLINE_NS;
+}
+
+// the newest frame once the one received is past its deadline. NULL if none
+// is left, a newer frame that was already overwritten released this one too
+static VisionBuf *recv_newest(VisionIpcClient &vipc_client, VisionIpcBufExtra *extra) {
+  VisionBuf *buf = vipc_client.recv(extra);
+  while (buf != nullptr && past_deadline(*extra)) {
+    const uint64_t overwritten = vipc_client.frames_overwritten;
+    VisionIpcBufExtra newer_extra = {};
+    VisionBuf *newer = vipc_client.recv(&newer_extra, 0);
+    if (newer == nullptr) {
+      return vipc_client.frames_overwritten == overwritten ? buf : nullptr;
+    }
+    model_deadline.add(1, 1);
+    buf = newer;
+    *extra = newer_extra;
+  }
+  if (buf != nullptr) model_deadline.add(1);
+  return buf;
+}
+
+// A second model from ShadowModelPath runs next to the one driving, on every
+// ShadowModelInterval-th frame, and publishes modelV2Shadow. It has its own
+// camera client and recurrent state, gives way to the primary on the GPU, and
+// switches itself off for good if the primary falls behind while it runs.
+// The path is checked again every few seconds, a new one is loaded in place.
+const float SHADOW_PRIMARY_BUDGET = 0.8 / MODEL_FREQ;  // of the primary's execution time
+const int SHADOW_MAX_OVER_BUDGET = 10;  // primary frames in a row
+const double SHADOW_PARAMS_INTERVAL_MS = 5000;
 
-  SubMaster sm({"liveCalibration"});
+void shadow_thread(VisionStreamType stream, cl_device_id device_id, cl_context context) {
+  set_thread_name("model_shadow");
+  sched_apply("modeld", "shadow");
 
-  /*
-     import numpy as np
-     from common.transformations.model import medmodel_frame_from_road_frame
-     medmodel_frame_from_ground = medmodel_frame_from_road_frame[:, (0, 1, 3)]
-     ground_from_medmodel_frame = np.linalg.inv(medmodel_frame_from_ground)
-  */
-  Eigen::Matrix<float, 3, 3> ground_from_medmodel_frame;
-  ground_from_medmodel_frame <<
-    0.00000000e+00, 0.00000000e+00, 1.00000000e+00,
-    -1.09890110e-03, 0.00000000e+00, 2.81318681e-01,
-    -1.84808520e-20, 9.00738606e-04,-4.28751576e-02;
+  Params params;
+  std::unique_ptr<ModelState> shadow;
+  std::string path;
+  int interval = 1;
+  double last_params = 0;
 
-  Eigen::Matrix<float, 3, 3> cam_intrinsics = Eigen::Matrix<float, 3, 3, Eigen::RowMajor>(wide_camera ? ecam_intrinsic_matrix.v : fcam_intrinsic_matrix.v);
-  const mat3 yuv_transform = get_model_yuv_transform();
+  VisionIpcClient vipc_client("camerad", stream, true, device_id, context);
+  PubMaster pm({"modelV2Shadow"});
+  SubMaster sm({"lateralPlan", "roadCameraState", "modelV2"});
+  int over_budget = 0;
 
   while (!do_exit) {
-    sm.update(100);
-    if(sm.updated("liveCalibration")) {
-      auto extrinsic_matrix = sm["liveCalibration"].getLiveCalibration().getExtrinsicMatrix();
-      Eigen::Matrix<float, 3, 4> extrinsic_matrix_eigen;
-      for (int i = 0; i < 4*3; i++) {
-        extrinsic_matrix_eigen(i / 4, i % 4) = extrinsic_matrix[i];
+    if (millis_since_boot() - last_params > SHADOW_PARAMS_INTERVAL_MS) {
+      last_params = millis_since_boot();
+      interval = std::max(1, atoi(params.get("ShadowModelInterval").c_str()));
+      std::string new_path = params.get("ShadowModelPath");
+      if (new_path != path) {
+        path = new_path;
+        if (shadow) {
+          model_free(shadow.get());
+          shadow.reset();
+        }
+        if (!path.empty()) {
+          shadow = std::make_unique<ModelState>();
+          if (model_init(shadow.get(), device_id, context, path.c_str())) {
+            shadow->m->setBackground(true);
+            LOGW("shadow model %s loaded, every %d frames", path.c_str(), interval);
+          } else {
+            shadow.reset();
+          }
+        }
       }
+    }
+    if (!shadow) {
+      util::sleep_for(100);
+      continue;
+    }
+    if (!vipc_client.connected && !vipc_client.connect(false)) {
+      util::sleep_for(100);
+      continue;
+    }
 
-      auto camera_frame_from_road_frame = cam_intrinsics * extrinsic_matrix_eigen;
-      Eigen::Matrix<float, 3, 3> camera_frame_from_ground;
-      camera_frame_from_ground.col(0) = camera_frame_from_road_frame.col(0);
-      camera_frame_from_ground.col(1) = camera_frame_from_road_frame.col(1);
-      camera_frame_from_ground.col(2) = camera_frame_from_road_frame.col(3);
+    VisionIpcBufExtra extra = {};
+    VisionBuf *buf = vipc_client.recv(&extra);
+    if (buf == nullptr) continue;
 
-      auto warp_matrix = camera_frame_from_ground * ground_from_medmodel_frame;
-      mat3 transform = {};
-      for (int i=0; i<3*3; i++) {
-        transform.v[i] = warp_matrix(i / 3, i % 3);
+    sm.update(0);
+    if (sm.updated("modelV2")) {
+      const float primary_time = sm["modelV2"].getModelV2().getModelExecutionTime();
+      over_budget = primary_time > SHADOW_PRIMARY_BUDGET ? over_budget + 1 : 0;
+      if (over_budget >= SHADOW_MAX_OVER_BUDGET) {
+        LOGE("shadow model off, primary model took %.1f ms", primary_time * 1000);
+        model_free(shadow.get());
+        break;
       }
-      mat3 model_transform = matmul3(yuv_transform, transform);
-      std::lock_guard lk(transform_lock);
-      cur_transform = model_transform;
-      live_calib_seen = true;
     }
+    if (extra.frame_id % interval != 0 || load_shed(LoadShed::SHADOW_MODELS)) continue;
+
+    transform_lock.lock();
+    mat3 model_transform = cur_transform;
+    const bool run_model_this_iter = live_calib_seen;
+    transform_lock.unlock();
+    if (!run_model_this_iter) continue;
+
+    float vec_desire[DESIRE_LEN] = {0};
+    int desire = ((int)sm["lateralPlan"].getLateralPlan().getDesire());
+    if (desire >= 0 && desire < DESIRE_LEN) {
+      vec_desire[desire] = 1.0;
+    }
+    const uint32_t frame_id = sm["roadCameraState"].getRoadCameraState().getFrameId();
+
+    double mt1 = millis_since_boot();
+    ModelDataRaw model_buf = model_eval_frame(shadow.get(), buf->buf_cl, buf->width, buf->height,
+                                              model_transform, vec_desire);
+    double mt2 = millis_since_boot();
+    shadow->timings.gpu_freq = Hardware::get_gpu_freq();
+    model_publish(pm, extra.frame_id, frame_id, 0, interval - 1, model_buf, extra, shadow->timings, (mt2 - mt1) / 1000.0,
+                  kj::ArrayPtr<const float>(shadow->output.data(), shadow->output.size()), true);
   }
 }
 
+static metrics::Histogram &execution_us = metrics::histogram("execution_us");
+
 void run_model(ModelState &model, VisionIpcClient &vipc_client) {
   // messaging
-  PubMaster pm({"modelV2", "cameraOdometry"});
+  PubMaster pm({"modelV2", "modelV2Compact", "cameraOdometry"});
   SubMaster sm({"lateralPlan", "roadCameraState"});
 
   // setup filter to track dropped frames
@@ -82,7 +246,7 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
 
   while (!do_exit) {
     VisionIpcBufExtra extra = {};
-    VisionBuf *buf = vipc_client.recv(&extra);
+    VisionBuf *buf = recv_newest(vipc_client, &extra);
     if (buf == nullptr) continue;
 
     transform_lock.lock();
@@ -104,10 +268,17 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
       }
 
       double mt1 = millis_since_boot();
+#ifdef USE_CUDA
+      ModelDataRaw model_buf = model_eval_frame_cuda(&model, (const uint8_t *)buf->buf_cuda, buf->width, buf->height,
+                                                     model_transform, vec_desire);
+#else
       ModelDataRaw model_buf = model_eval_frame(&model, buf->buf_cl, buf->width, buf->height,
                                                 model_transform, vec_desire);
+#endif
       double mt2 = millis_since_boot();
       float model_execution_time = (mt2 - mt1) / 1000.0;
+      execution_us.record(model_execution_time * 1e6);
+      model.timings.gpu_freq = Hardware::get_gpu_freq();
 
       // tracked dropped frames
       uint32_t vipc_dropped_frames = extra.frame_id - last_vipc_frame_id - 1;
@@ -119,9 +290,11 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
 
       float frame_drop_ratio = frames_dropped / (1 + frames_dropped);
 
-      model_publish(pm, extra.frame_id, frame_id, frame_drop_ratio, model_buf, extra.timestamp_eof, model_execution_time,
+      const uint32_t frames_skipped = run_count > 1 ? vipc_dropped_frames : 0;
+      model_publish(pm, extra.frame_id, frame_id, frame_drop_ratio, frames_skipped, model_buf, extra, model.timings, model_execution_time,
                     kj::ArrayPtr<const float>(model.output.data(), model.output.size()));
       posenet_publish(pm, extra.frame_id, vipc_dropped_frames, model_buf, extra.timestamp_eof);
+      calibrate_on(model_buf);
 
       //printf("model process: %.2fms, from last %.2fms, vipc_frame_id %u, frame_id, %u, frame_drop %.3f\n", mt2 - mt1, mt1 - last, extra.frame_id, frame_id, frame_drop_ratio);
       last = mt1;
@@ -130,22 +303,179 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
   }
 }
 
-int main(int argc, char **argv) {
-  set_realtime_priority(54);
-
-  if (Hardware::EON()) {
-    set_core_affinity(2);
-  } else if (Hardware::TICI()) {
-    set_core_affinity(7);  
-  } else if (Hardware::JETSON()) {
-    set_core_affinity(1);
+// MODELD_PIPELINE splits run_model over three threads: the next frame is
+// received and warped while the model runs on the current one, and the
+// messages of the previous one are built and sent behind it
+struct PreparedFrame {
+  int slot;  // staging slot in model.frame
+  VisionIpcBufExtra extra;
+  uint32_t frame_id;
+  float desire[DESIRE_LEN];
+  uint64_t prepare_start, prepare_end;
+};
+
+struct ModelResult {
+  int slot;  // copy of the outputs in ModelPipeline::outputs
+  VisionIpcBufExtra extra;
+  uint32_t frame_id;
+  ModelTimings timings;
+  float execution_time;
+};
+
+struct ModelPipeline {
+  SPSCQueue<PreparedFrame, 4> prepared;
+  SPSCQueue<int, 4> free_staging;
+  SPSCQueue<ModelResult, 4> results;
+  SPSCQueue<int, 4> free_outputs;
+  std::vector<float> outputs[2];
+};
+
+void prepare_thread(ModelState &model, VisionIpcClient &vipc_client, ModelPipeline &p) {
+  set_thread_name("model_prepare");
+  sched_apply("modeld", "prepare");
+
+  SubMaster sm({"lateralPlan", "roadCameraState"});
+
+  while (!do_exit) {
+    VisionIpcBufExtra extra = {};
+    VisionBuf *buf = recv_newest(vipc_client, &extra);
+    if (buf == nullptr) continue;
+
+    transform_lock.lock();
+    mat3 model_transform = cur_transform;
+    const bool run_model_this_iter = live_calib_seen;
+    transform_lock.unlock();
+
+    sm.update(0);
+    if (!run_model_this_iter) continue;
+
+    // both slots still queued means the model is behind, the frame is dropped
+    PreparedFrame f = {.extra = extra};
+    if (!p.free_staging.try_pop(f.slot)) continue;
+
+    int desire = ((int)sm["lateralPlan"].getLateralPlan().getDesire());
+    f.frame_id = sm["roadCameraState"].getRoadCameraState().getFrameId();
+    std::fill_n(f.desire, DESIRE_LEN, 0.f);
+    if (desire >= 0 && desire < DESIRE_LEN) {
+      f.desire[desire] = 1.0;
+    }
+
+    f.prepare_start = nanos_since_boot();
+    model_prepare(&model, f.slot, buf->buf_cl, buf->width, buf->height, model_transform);
+    f.prepare_end = nanos_since_boot();
+    p.prepared.push(f);
   }
+}
+
+void publish_thread(ModelPipeline &p) {
+  set_thread_name("model_publish");
+  sched_apply("modeld", "publish");
+
+  PubMaster pm({"modelV2", "modelV2Compact", "cameraOdometry"});
+  FirstOrderFilter frame_dropped_filter(0., 10., 1. / MODEL_FREQ);
+  uint32_t last_vipc_frame_id = 0;
+  uint32_t run_count = 0;
+
+  while (!do_exit) {
+    ModelResult r;
+    if (!p.results.try_pop(r, 100)) continue;
+    run_count++;
+
+    uint32_t vipc_dropped_frames = r.extra.frame_id - last_vipc_frame_id - 1;
+    float frames_dropped = frame_dropped_filter.update((float)std::min(vipc_dropped_frames, 10U));
+    if (run_count < 10) { // let frame drops warm up
+      frame_dropped_filter.reset(0);
+      frames_dropped = 0.;
+    }
+    float frame_drop_ratio = frames_dropped / (1 + frames_dropped);
+
+    std::vector<float> &output = p.outputs[r.slot];
+    ModelDataRaw model_buf = model_outputs(output.data());
+    const uint32_t frames_skipped = run_count > 1 ? vipc_dropped_frames : 0;
+    model_publish(pm, r.extra.frame_id, r.frame_id, frame_drop_ratio, frames_skipped, model_buf, r.extra, r.timings, r.execution_time,
+                  kj::ArrayPtr<const float>(output.data(), output.size()));
+    posenet_publish(pm, r.extra.frame_id, vipc_dropped_frames, model_buf, r.extra.timestamp_eof);
+    calibrate_on(model_buf);
+
+    last_vipc_frame_id = r.extra.frame_id;
+    p.free_outputs.push(r.slot);
+  }
+}
+
+void run_model_pipelined(ModelState &model, VisionIpcClient &vipc_client) {
+  ModelPipeline p;
+  for (int i = 0; i < ModelFrame::STAGING_SLOTS; i++) {
+    p.free_staging.push(i);
+  }
+  for (int i = 0; i < std::size(p.outputs); i++) {
+    p.outputs[i].resize(model.output.size());
+    p.free_outputs.push(i);
+  }
+
+  std::thread prepare(prepare_thread, std::ref(model), std::ref(vipc_client), std::ref(p));
+  std::thread publish(publish_thread, std::ref(p));
+
+  // frames run in order, the recurrent state depends on the one before. The
+  // next frame is already waited for here while the model runs
+  while (!do_exit) {
+    PreparedFrame f;
+    if (!p.prepared.try_pop(f, 100)) continue;
+    // behind, the frame that waited is skipped for the newer one already warped
+    // behind it. It still is the previous frame of that one
+    int prev_slot = -1;
+    PreparedFrame newer;
+    while (past_deadline(f.extra) && p.prepared.try_pop(newer)) {
+      if (prev_slot >= 0) p.free_staging.push(prev_slot);
+      prev_slot = f.slot;
+      f = newer;
+      model_deadline.add(1, 1);
+    }
+    model_deadline.add(1);
+    int out_slot;
+    while (!do_exit && !p.free_outputs.try_pop(out_slot, 100)) {}
+    if (do_exit) break;
+
+    double mt1 = millis_since_boot();
+    model_execute(&model, f.slot, prev_slot, f.desire, f.prepare_start, [&model, &p, f, out_slot, mt1]() {
+      ModelResult r = {.slot = out_slot, .extra = f.extra, .frame_id = f.frame_id, .timings = model.timings};
+      r.execution_time = (f.prepare_end - f.prepare_start) * 1e-9 + (millis_since_boot() - mt1) / 1000.0;
+      execution_us.record(r.execution_time * 1e6);
+      r.timings.gpu_freq = Hardware::get_gpu_freq();
+      std::copy(model.output.begin(), model.output.end(), p.outputs[r.slot].begin());
+      p.results.push(r);
+    });
+    p.free_staging.push(f.slot);
+    if (prev_slot >= 0) p.free_staging.push(prev_slot);
+  }
+  model.m->wait();
+
+  prepare.join();
+  publish.join();
+}
+
+// modeld only runs onroad, so the GPU is held at a power level for it from
+// start to exit. A modeld that crashed left it set, the next one resets it
+// on exit. MODELD_GPU_PWRLEVEL=-1 leaves the GPU to the governor
+void set_gpu_pwrlevel(bool onroad) {
+  const int level = onroad ? util::getenv("MODELD_GPU_PWRLEVEL", 1) : -1;
+  if (Hardware::set_gpu_min_pwrlevel(level)) {
+    LOGW("gpu min power level %d, at %d MHz", level, Hardware::get_gpu_freq());
+  } else if (!Hardware::PC()) {
+    LOGE("failed to set gpu min power level %d", level);
+  }
+}
+
+int main(int argc, char **argv) {
+  Readiness readiness("modeld");
+  sched_apply("modeld", "main");
+
   bool wide_camera = Hardware::TICI() ? Params().getBool("EnableWideCamera") : false;
 
   // start calibration thread
   std::thread thread = std::thread(calibration_thread, wide_camera);
 
   // cl init
+  readiness.phase("cl init");
   #ifdef XNX
   cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_GPU);
   #else
@@ -153,25 +483,45 @@ int main(int argc, char **argv) {
   #endif
   cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
 
-  // init the models
+  // the model loads while camerad comes up, connecting only needs the context
+  readiness.phase("model+camerad");
   ModelState model;
-  model_init(&model, device_id, context);
-  LOGW("models loaded, modeld starting");
+  std::thread load([&]() {
+    model_init(&model, device_id, context);
+    LOGW("models loaded, modeld starting");
+  });
 
   VisionIpcClient vipc_client = VisionIpcClient("camerad", wide_camera ? VISION_STREAM_YUV_WIDE : VISION_STREAM_YUV_BACK, true, device_id, context);
   while (!do_exit && !vipc_client.connect(false)) {
     util::sleep_for(100);
   }
+  load.join();
+
+  std::thread shadow(shadow_thread, wide_camera ? VISION_STREAM_YUV_WIDE : VISION_STREAM_YUV_BACK, device_id, context);
 
   // run the models
   // vipc_client.connected is false only when do_exit is true
   if (vipc_client.connected) {
     const VisionBuf *b = &vipc_client.buffers[0];
     LOGW("connected with buffer size: %d (%d x %d)", b->len, b->width, b->height);
-    run_model(model, vipc_client);
+#ifdef USE_CUDA
+    // the frames go from camerad to the model without leaving the GPU
+    for (int i = 0; i < vipc_client.num_buffers; i++) {
+      vipc_client.buffers[i].init_cuda();
+    }
+#endif
+    readiness.ready();
+    set_gpu_pwrlevel(true);
+    if (getenv("MODELD_PIPELINE")) {
+      run_model_pipelined(model, vipc_client);
+    } else {
+      run_model(model, vipc_client);
+    }
+    set_gpu_pwrlevel(false);
   }
 
   model_free(&model);
+  shadow.join();
   LOG("joining calibration thread");
   thread.join();
   CL_CHECK(clReleaseContext(context));
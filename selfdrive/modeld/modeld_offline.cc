@@ -0,0 +1,252 @@
+// Runs the driving model over recorded segments and writes what modeld would
+// have published, for evaluating a model over many routes. Every segment
+// directory needs its rlog, as loggerd writes it (rlog.zst, rlog.lz4 or
+// rlog.bz2) or uncompressed (rlog), and fcamera.yuv, the road camera decoded
+// to raw I420 with one frame per roadCameraState in the rlog:
+//   ffmpeg -i fcamera.hevc -f rawvideo -pix_fmt yuv420p fcamera.yuv
+// The model and cameraOdometry events go to modelV2.log in the same directory.
+//
+// The recurrent state makes the frames of a segment depend on each other, so
+// --batch runs that many segments side by side, one frame of each per model run.
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/log_reader.h"
+#include "selfdrive/modeld/models/driving.h"
+#include "selfdrive/modeld/runners/onnxmodel.h"
+
+struct Frame {
+  uint64_t mono_time;
+  uint32_t frame_id;
+  uint64_t timestamp_eof;
+  bool calibrated;
+  mat3 transform;
+  int desire;
+};
+
+struct Segment {
+  std::string dir;
+  std::vector<Frame> frames;
+  size_t next = 0;
+  FILE *yuv = NULL, *out = NULL;
+  std::unique_ptr<ModelFrame> model_frame;
+  float prev_desire[DESIRE_LEN] = {};
+  uint32_t last_frame_id = 0;
+};
+
+// the compression is told by the magic bytes, not the name
+static std::string find_log(const std::string &dir) {
+  for (const char *name : {"rlog", "rlog.zst", "rlog.lz4", "rlog.bz2"}) {
+    std::string path = dir + "/" + name;
+    if (util::file_exists(path)) return path;
+  }
+  return "";
+}
+
+// one frame per roadCameraState, with the calibration and desire modeld had at that point
+static std::vector<Frame> read_frames(const std::string &dir, bool wide_camera) {
+  std::vector<Frame> frames;
+  LogReader log;
+  const std::string path = find_log(dir);
+  const std::vector<unsigned int> services = {cereal::Event::LIVE_CALIBRATION, cereal::Event::LATERAL_PLAN,
+                                              wide_camera ? cereal::Event::WIDE_ROAD_CAMERA_STATE : cereal::Event::ROAD_CAMERA_STATE};
+  if (path.empty() || !log.load(path, services)) {
+    fprintf(stderr, "%s: no rlog\n", dir.c_str());
+    return frames;
+  }
+
+  Frame cur = {};
+  log.for_each([&](cereal::Event::Reader event) {
+    if (event.isLiveCalibration()) {
+      auto extrinsic_matrix = event.getLiveCalibration().getExtrinsicMatrix();
+      if (extrinsic_matrix.size() == 4*3) {
+        float extrinsic[4*3];
+        for (int i = 0; i < 4*3; i++) {
+          extrinsic[i] = extrinsic_matrix[i];
+        }
+        cur.transform = model_calib_transform(extrinsic, wide_camera);
+        cur.calibrated = true;
+      }
+    } else if (event.isLateralPlan()) {
+      cur.desire = (int)event.getLateralPlan().getDesire();
+    } else if ((!wide_camera && event.isRoadCameraState()) || (wide_camera && event.isWideRoadCameraState())) {
+      auto cs = wide_camera ? event.getWideRoadCameraState() : event.getRoadCameraState();
+      cur.mono_time = event.getLogMonoTime();
+      cur.frame_id = cs.getFrameId();
+      cur.timestamp_eof = cs.getTimestampEof();
+      frames.push_back(cur);
+    }
+  });
+  return frames;
+}
+
+static void write_event(FILE *f, MessageBuilder &msg) {
+  auto bytes = msg.toBytes();
+  fwrite(bytes.begin(), 1, bytes.size(), f);
+}
+
+int main(int argc, char **argv) {
+  int batch = 1, width = 1164, height = 874;
+  bool wide_camera = false, rhd = false;
+  const char *model_path = "../../models/supercombo.onnx";
+  std::deque<std::string> pending;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--batch" && i + 1 < argc) {
+      batch = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--width" && i + 1 < argc) {
+      width = atoi(argv[++i]);
+    } else if (arg == "--height" && i + 1 < argc) {
+      height = atoi(argv[++i]);
+    } else if (arg == "--model" && i + 1 < argc) {
+      model_path = argv[++i];
+    } else if (arg == "--wide") {
+      wide_camera = true;
+    } else if (arg == "--rhd") {
+      rhd = true;
+    } else {
+      pending.push_back(arg);
+    }
+  }
+  if (pending.empty()) {
+    fprintf(stderr, "usage: %s [--batch N] [--width W --height H] [--wide] [--rhd] [--model path] segment_dir...\n", argv[0]);
+    return 1;
+  }
+
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+  cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+  const size_t yuv_size = width * height * 3 / 2;
+  std::vector<uint8_t> yuv(yuv_size);
+  cl_mem yuv_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, yuv_size, NULL, &err));
+  cl_command_queue q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+
+  // the inputs of every stream of the batch, one after the other
+  const size_t output_size = model_output_size();
+  const int frame_size = MODEL_FRAME_SIZE * 2;
+  std::vector<float> input(frame_size * batch), output(output_size * batch);
+  std::vector<float> recurrent(TEMPORAL_SIZE * batch), desire(DESIRE_LEN * batch);
+  std::vector<float> traffic_convention(TRAFFIC_CONVENTION_LEN * batch);
+  for (int b = 0; b < batch; b++) {
+    traffic_convention[b * TRAFFIC_CONVENTION_LEN + (rhd ? 1 : 0)] = 1.0;
+  }
+
+  ONNXModel model(model_path, output.data(), output_size, USE_GPU_RUNTIME, batch);
+  model.addRecurrent(recurrent.data(), TEMPORAL_SIZE);
+  model.addDesire(desire.data(), DESIRE_LEN);
+  model.addTrafficConvention(traffic_convention.data(), TRAFFIC_CONVENTION_LEN);
+
+  std::vector<std::unique_ptr<Segment>> streams(batch);
+  uint64_t frames_run = 0;
+  double t_start = millis_since_boot();
+
+  while (true) {
+    bool any = false;
+    for (int b = 0; b < batch; b++) {
+      std::unique_ptr<Segment> &s = streams[b];
+      float *stream_input = &input[b * frame_size];
+
+      // the next calibrated frame of this stream, opening the next segment when it's done
+      const Frame *f = NULL;
+      while (f == NULL) {
+        if (s && s->next >= s->frames.size()) {
+          fclose(s->yuv);
+          fclose(s->out);
+          printf("%s: %zu frames\n", s->dir.c_str(), s->frames.size());
+          s.reset();
+        }
+        if (!s) {
+          if (pending.empty()) break;
+          s = std::make_unique<Segment>();
+          s->dir = pending.front();
+          pending.pop_front();
+          s->frames = read_frames(s->dir, wide_camera);
+          s->yuv = fopen((s->dir + "/fcamera.yuv").c_str(), "rb");
+          s->out = fopen((s->dir + "/modelV2.log").c_str(), "wb");
+          if (s->frames.empty() || s->yuv == NULL || s->out == NULL) {
+            fprintf(stderr, "%s: no frames, skipping\n", s->dir.c_str());
+            if (s->yuv) fclose(s->yuv);
+            if (s->out) fclose(s->out);
+            s.reset();
+            continue;
+          }
+          s->model_frame = std::make_unique<ModelFrame>(device_id, context);
+          std::fill_n(&recurrent[b * TEMPORAL_SIZE], TEMPORAL_SIZE, 0.f);
+        }
+
+        const Frame &next = s->frames[s->next++];
+        if (fread(yuv.data(), 1, yuv_size, s->yuv) != yuv_size) {
+          fprintf(stderr, "%s: fcamera.yuv ends at frame %zu of %zu\n", s->dir.c_str(), s->next - 1, s->frames.size());
+          s->next = s->frames.size();
+          continue;
+        }
+        if (next.calibrated) f = &next;
+      }
+
+      float *stream_desire = &desire[b * DESIRE_LEN];
+      if (f == NULL) {
+        // nothing left for this stream, it runs on zeros until the others are done
+        std::fill_n(stream_input, frame_size, 0.f);
+        std::fill_n(stream_desire, DESIRE_LEN, 0.f);
+        continue;
+      }
+      any = true;
+
+      CL_CHECK(clEnqueueWriteBuffer(q, yuv_cl, CL_TRUE, 0, yuv_size, yuv.data(), 0, NULL, NULL));
+      float *prepared = s->model_frame->prepare(yuv_cl, width, height, f->transform);
+      std::copy(prepared, prepared + frame_size, stream_input);
+
+      float vec_desire[DESIRE_LEN] = {0};
+      if (f->desire >= 0 && f->desire < DESIRE_LEN) {
+        vec_desire[f->desire] = 1.0;
+      }
+      model_desire_pulse(vec_desire, s->prev_desire, stream_desire);
+    }
+    if (!any) break;
+
+    model.execute(input.data(), frame_size);
+
+    for (int b = 0; b < batch; b++) {
+      Segment *s = streams[b].get();
+      if (s == NULL) continue;
+      float *stream_output = &output[b * output_size];
+      std::copy(stream_output + output_size - TEMPORAL_SIZE, stream_output + output_size, &recurrent[b * TEMPORAL_SIZE]);
+
+      const Frame &f = s->frames[s->next - 1];
+      ModelDataRaw net_outputs = model_outputs(stream_output);
+      const uint32_t dropped = (s->last_frame_id != 0 && f.frame_id > s->last_frame_id) ? f.frame_id - s->last_frame_id - 1 : 0;
+      s->last_frame_id = f.frame_id;
+
+      MessageBuilder model_msg;
+      auto event = model_msg.initEvent();
+      event.setLogMonoTime(f.mono_time);
+      fill_model_msg(event.initModelV2(), f.frame_id, f.frame_id, 0, dropped, net_outputs, f.timestamp_eof, 0,
+                     send_raw_pred ? kj::ArrayPtr<const float>(stream_output, output_size) : kj::ArrayPtr<const float>());
+      write_event(s->out, model_msg);
+
+      MessageBuilder posenet_msg;
+      auto posenet_event = posenet_msg.initEvent(dropped < 1);
+      posenet_event.setLogMonoTime(f.mono_time);
+      fill_posenet_msg(posenet_event.initCameraOdometry(), f.frame_id, net_outputs, f.timestamp_eof);
+      write_event(s->out, posenet_msg);
+      frames_run++;
+    }
+  }
+
+  const double dt = (millis_since_boot() - t_start) / 1000.;
+  printf("%lu frames in %.1f s, %.1f fps\n", frames_run, dt, frames_run / dt);
+
+  CL_CHECK(clReleaseCommandQueue(q));
+  CL_CHECK(clReleaseMemObject(yuv_cl));
+  CL_CHECK(clReleaseContext(context));
+  return 0;
+}
@@ -4,57 +4,255 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/mat.h"
+#include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
 
-ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) {
+ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) : context(context) {
   input_frames = std::make_unique<float[]>(buf_size);
 
   q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+  stack_q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
   y_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_WIDTH * MODEL_HEIGHT, NULL, &err));
   u_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
   v_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2), NULL, &err));
-  net_input_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_FRAME_SIZE * sizeof(float), NULL, &err));
+  // the first frame sees a black previous one
+  input_frames_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                                buf_size * sizeof(float), &input_frames[0], &err));
 
   transform_init(&transform, context, device_id);
   loadyuv_init(&loadyuv, context, device_id, MODEL_WIDTH, MODEL_HEIGHT);
 }
 
-float* ModelFrame::prepare(cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform) {
-  transform_queue(&this->transform, q,
-                  yuv_cl, frame_width, frame_height,
-                  y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, transform);
-  loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, net_input_cl);
+float* ModelFrame::prepare(cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform, cl_mem *output) {
+  const size_t frame_bytes = MODEL_FRAME_SIZE * sizeof(float);
+  cl_mem out = output ? *output : input_frames_cl;
+
+  // the previous frame moves to the front, from another buffer if the backend switched to its own
+  CL_CHECK(clEnqueueCopyBuffer(q, last_output ? last_output : out, out, frame_bytes, 0, frame_bytes, 0, nullptr, nullptr));
+  warp_to(yuv_cl, frame_width, frame_height, transform, out, MODEL_FRAME_SIZE);
+  return finish(q, out, output);
+}
+
+// The fused warp and load kernel, or with MODELD_WARP=unfused the warp of each
+// plane and loadyuv behind it. MODELD_WARP=check runs both and compares them
+void ModelFrame::warp_to(cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform, cl_mem out, int out_offset) {
+  static const std::string mode = util::getenv("MODELD_WARP", "");
+  if (mode != "unfused") {
+    transform_load_queue(&this->transform, q, yuv_cl, frame_width, frame_height,
+                         out, out_offset, MODEL_WIDTH, MODEL_HEIGHT, transform);
+  }
+  if (mode == "unfused" || mode == "check") {
+    if (mode == "check" && check_cl == NULL) {
+      check_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_FRAME_SIZE * sizeof(float), NULL, &err));
+    }
+    transform_queue(&this->transform, q,
+                    yuv_cl, frame_width, frame_height,
+                    y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, transform);
+    loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, mode == "check" ? check_cl : out, mode == "check" ? 0 : out_offset);
+  }
+
+  if (mode == "check") {
+    std::vector<float> fused(MODEL_FRAME_SIZE), unfused(MODEL_FRAME_SIZE);
+    CL_CHECK(clEnqueueReadBuffer(q, out, CL_TRUE, out_offset * sizeof(float), MODEL_FRAME_SIZE * sizeof(float), fused.data(), 0, nullptr, nullptr));
+    CL_CHECK(clEnqueueReadBuffer(q, check_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), unfused.data(), 0, nullptr, nullptr));
+    int mismatches = 0;
+    for (int i = 0; i < MODEL_FRAME_SIZE; i++) {
+      mismatches += fused[i] != unfused[i];
+    }
+    if (mismatches > 0) {
+      LOGE("fused warp differs from transform + loadyuv in %d of %d values", mismatches, MODEL_FRAME_SIZE);
+    }
+  }
+}
+
+void ModelFrame::warp(int slot, cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform) {
+  assert(slot >= 0 && slot < STAGING_SLOTS);
+  if (staging_cl[slot] == NULL) {
+    staging_cl[slot] = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_FRAME_SIZE * sizeof(float), NULL, &err));
+  }
+  warp_to(yuv_cl, frame_width, frame_height, transform, staging_cl[slot], 0);
+  // the camera reuses its buffer once this returns
+  CL_CHECK(clFinish(q));
+}
 
-  std::memmove(&input_frames[0], &input_frames[MODEL_FRAME_SIZE], sizeof(float) * MODEL_FRAME_SIZE);
-  clEnqueueReadBuffer(q, net_input_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr);
-  clFinish(q);
+float* ModelFrame::stack(int slot, cl_mem *output, int prev_slot) {
+  const size_t frame_bytes = MODEL_FRAME_SIZE * sizeof(float);
+  cl_mem out = output ? *output : input_frames_cl;
+  if (prev_slot >= 0) {
+    CL_CHECK(clEnqueueCopyBuffer(stack_q, staging_cl[prev_slot], out, 0, 0, frame_bytes, 0, nullptr, nullptr));
+  } else {
+    CL_CHECK(clEnqueueCopyBuffer(stack_q, last_output ? last_output : out, out, frame_bytes, 0, frame_bytes, 0, nullptr, nullptr));
+  }
+  CL_CHECK(clEnqueueCopyBuffer(stack_q, staging_cl[slot], out, 0, frame_bytes, frame_bytes, 0, nullptr, nullptr));
+  return finish(stack_q, out, output, prev_slot >= 0);
+}
+
+#ifdef USE_CUDA
+float* ModelFrame::prepare_cuda(const uint8_t *yuv, int frame_width, int frame_height, const mat3 &transform, float *output) {
+  const size_t frame_bytes = MODEL_FRAME_SIZE * sizeof(float);
+  cudaError_t err;
+  if (stream_cuda == nullptr) {
+    err = cudaStreamCreate(&stream_cuda);
+    assert(err == cudaSuccess);
+    err = cudaMalloc((void **)&input_frames_cuda, buf_size * sizeof(float));
+    assert(err == cudaSuccess);
+    err = cudaMemset(input_frames_cuda, 0, buf_size * sizeof(float));
+    assert(err == cudaSuccess);
+  }
+  float *out = output ? output : input_frames_cuda;
+
+  // the previous frame moves to the front, as in prepare
+  const float *prev = (last_output_cuda ? last_output_cuda : out) + MODEL_FRAME_SIZE;
+  err = cudaMemcpyAsync(out, prev, frame_bytes, cudaMemcpyDeviceToDevice, stream_cuda);
+  assert(err == cudaSuccess);
+  transform_load_cuda(stream_cuda, yuv, frame_width, frame_height, out, MODEL_FRAME_SIZE, MODEL_WIDTH, MODEL_HEIGHT, transform);
+  last_output_cuda = out;
+
+  if (!output) {
+    err = cudaMemcpyAsync(&input_frames[0], out, 2 * frame_bytes, cudaMemcpyDeviceToHost, stream_cuda);
+    assert(err == cudaSuccess);
+  }
+  err = cudaStreamSynchronize(stream_cuda);
+  assert(err == cudaSuccess);
+  return output ? NULL : &input_frames[0];
+}
+#endif
+
+float* ModelFrame::finish(cl_command_queue queue, cl_mem out, cl_mem *output, bool read_prev) {
+  const size_t frame_bytes = MODEL_FRAME_SIZE * sizeof(float);
+  last_output = out;
+
+  if (output) {
+    // the backend runs outside of this queue
+    CL_CHECK(clFinish(queue));
+    return NULL;
+  }
+
+  if (read_prev) {
+    CL_CHECK(clEnqueueReadBuffer(queue, out, CL_TRUE, 0, 2 * frame_bytes, &input_frames[0], 0, nullptr, nullptr));
+    return &input_frames[0];
+  }
+  std::memmove(&input_frames[0], &input_frames[MODEL_FRAME_SIZE], frame_bytes);
+  CL_CHECK(clEnqueueReadBuffer(queue, out, CL_TRUE, frame_bytes, frame_bytes, &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr));
   return &input_frames[0];
 }
 
 ModelFrame::~ModelFrame() {
+#ifdef USE_CUDA
+  if (input_frames_cuda) cudaFree(input_frames_cuda);
+  if (stream_cuda) cudaStreamDestroy(stream_cuda);
+#endif
   transform_destroy(&transform);
   loadyuv_destroy(&loadyuv);
-  CL_CHECK(clReleaseMemObject(net_input_cl));
+  for (cl_mem staging : staging_cl) {
+    if (staging) CL_CHECK(clReleaseMemObject(staging));
+  }
+  if (check_cl) CL_CHECK(clReleaseMemObject(check_cl));
+  CL_CHECK(clReleaseMemObject(input_frames_cl));
   CL_CHECK(clReleaseMemObject(v_cl));
   CL_CHECK(clReleaseMemObject(u_cl));
   CL_CHECK(clReleaseMemObject(y_cl));
+  CL_CHECK(clReleaseCommandQueue(stack_q));
   CL_CHECK(clReleaseCommandQueue(q));
 }
 
+// exp(x) = 2^n * exp(r) with |r| <= ln(2)/2, exp(r) from the cephes expf polynomial
+#define EXP_MIN -87.3f
+#define EXP_MAX 88.3f
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_LN2_HI 0.693359375f
+#define EXP_LN2_LO -2.12194440e-4f
+static const float EXP_POLY[] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+                                 4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+
+static inline float exp_1(float x) {
+  x = std::min(std::max(x, EXP_MIN), EXP_MAX);
+  const float n = floorf(x * EXP_LOG2E + 0.5f);
+  const float r = x - n * EXP_LN2_HI - n * EXP_LN2_LO;
+  float y = EXP_POLY[0];
+  for (int i = 1; i < 6; i++) {
+    y = y * r + EXP_POLY[i];
+  }
+  y = y * r * r + r + 1.f;
+  int32_t bits = ((int32_t)n + 127) << 23;
+  float scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return y * scale;
+}
+
+#ifdef __ARM_NEON
+static inline float32x4_t exp_4(float32x4_t x) {
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(EXP_MIN)), vdupq_n_f32(EXP_MAX));
+  // floor, vcvtq truncates towards zero
+  const float32x4_t t = vmlaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(EXP_LOG2E));
+  float32x4_t n = vcvtq_f32_s32(vcvtq_s32_f32(t));
+  n = vsubq_f32(n, vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(n, t), vreinterpretq_u32_f32(vdupq_n_f32(1.f)))));
+  float32x4_t r = vmlsq_f32(x, n, vdupq_n_f32(EXP_LN2_HI));
+  r = vmlsq_f32(r, n, vdupq_n_f32(EXP_LN2_LO));
+
+  float32x4_t y = vdupq_n_f32(EXP_POLY[0]);
+  for (int i = 1; i < 6; i++) {
+    y = vmlaq_f32(vdupq_n_f32(EXP_POLY[i]), y, r);
+  }
+  y = vaddq_f32(vmlaq_f32(r, y, vmulq_f32(r, r)), vdupq_n_f32(1.f));
+  const int32x4_t bits = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+  return vmulq_f32(y, vreinterpretq_f32_s32(bits));
+}
+#endif
+
+void exp_n(const float* input, float* output, size_t len) {
+  size_t i = 0;
+#ifdef __ARM_NEON
+  for (; i + 4 <= len; i += 4) {
+    vst1q_f32(&output[i], exp_4(vld1q_f32(&input[i])));
+  }
+#endif
+  for (; i < len; i++) {
+    output[i] = exp_1(input[i]);
+  }
+}
+
+void sigmoid_n(const float* input, float* output, size_t len) {
+  size_t i = 0;
+#ifdef __ARM_NEON
+  const float32x4_t one = vdupq_n_f32(1.f);
+  for (; i + 4 <= len; i += 4) {
+    const float32x4_t d = vaddq_f32(one, exp_4(vnegq_f32(vld1q_f32(&input[i]))));
+    // reciprocal estimate and two newton steps, exact to float precision
+    float32x4_t inv = vrecpeq_f32(d);
+    inv = vmulq_f32(vrecpsq_f32(d, inv), inv);
+    inv = vmulq_f32(vrecpsq_f32(d, inv), inv);
+    vst1q_f32(&output[i], inv);
+  }
+#endif
+  for (; i < len; i++) {
+    output[i] = 1.f / (1.f + exp_1(-input[i]));
+  }
+}
+
 void softmax(const float* input, float* output, size_t len) {
   const float max_val = *std::max_element(input, input + len);
-  float denominator = 0;
-  for(int i = 0; i < len; i++) {
-    float const v_exp = expf(input[i] - max_val);
-    denominator += v_exp;
-    output[i] = v_exp;
+  for (size_t i = 0; i < len; i++) {
+    output[i] = input[i] - max_val;
   }
+  exp_n(output, output, len);
 
+  float denominator = 0;
+  for (size_t i = 0; i < len; i++) {
+    denominator += output[i];
+  }
   const float inv_denominator = 1. / denominator;
-  for(int i = 0; i < len; i++) {
+  for (size_t i = 0; i < len; i++) {
     output[i] *= inv_denominator;
   }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cfloat>
+#include <cstdint>
 #include <cstdlib>
 
 #include <memory>
@@ -15,6 +16,9 @@
 #include "selfdrive/common/mat.h"
 #include "selfdrive/modeld/transforms/loadyuv.h"
 #include "selfdrive/modeld/transforms/transform.h"
+#ifdef USE_CUDA
+#include "selfdrive/modeld/transforms/transform_cuda.h"
+#endif
 
 constexpr int MODEL_WIDTH = 512;
 constexpr int MODEL_HEIGHT = 256;
@@ -26,18 +30,57 @@ void softmax(const float* input, float* output, size_t len);
 float softplus(float input);
 float sigmoid(float input);
 
+// The same over arrays, four at a time with NEON. exp is a polynomial fit
+// within 2e-7 relative error of expf, it saturates below -87 and above 88.
+// output may be input
+void exp_n(const float* input, float* output, size_t len);
+void sigmoid_n(const float* input, float* output, size_t len);
+
+// The model takes the previous and the current frame back to back. Both stay
+// on the GPU: every frame moves the current one into the first slot of the
+// input buffer and loads the new one behind it.
 class ModelFrame {
  public:
   ModelFrame(cl_device_id device_id, cl_context context);
   ~ModelFrame();
-  float* prepare(cl_mem yuv_cl, int width, int height, const mat3& transform);
+  // Stacks the frames into output, a backend's own input buffer, and returns
+  // NULL once it's ready. Without one they're read back and the host copy is returned
+  float* prepare(cl_mem yuv_cl, int width, int height, const mat3& transform, cl_mem *output = NULL);
+
+  // The same split in two for a pipeline: warp converts a camera frame into a
+  // staging slot on one thread, stack puts the slot behind the previous frame
+  // on another, while the next frame is warped into the other slot. A frame
+  // that is skipped can still be the previous one of the next, from prev_slot
+  void warp(int slot, cl_mem yuv_cl, int width, int height, const mat3& transform);
+  float* stack(int slot, cl_mem *output = NULL, int prev_slot = -1);
+
+#ifdef USE_CUDA
+  // prepare for a frame in CUDA memory, the buf_cuda of a VisionBuf. output
+  // is a device pointer, e.g. RunModel::getInputBufCuda
+  float* prepare_cuda(const uint8_t *yuv, int width, int height, const mat3& transform, float *output = NULL);
+#endif
 
   const int buf_size = MODEL_FRAME_SIZE * 2;
+  static constexpr int STAGING_SLOTS = 2;
 
  private:
+  // read_prev: the previous frame didn't come from the host copy either
+  float* finish(cl_command_queue queue, cl_mem out, cl_mem *output, bool read_prev = false);
+  void warp_to(cl_mem yuv_cl, int width, int height, const mat3& transform, cl_mem out, int out_offset);
+
+  cl_context context;
   Transform transform;
   LoadYUVState loadyuv;
-  cl_command_queue q;
-  cl_mem y_cl, u_cl, v_cl, net_input_cl;
+  cl_command_queue q, stack_q;
+  cl_mem y_cl, u_cl, v_cl, input_frames_cl;
+  cl_mem staging_cl[STAGING_SLOTS] = {};  // allocated on first use
+  cl_mem last_output = NULL;  // where the previous frame was written
+  cl_mem check_cl = NULL;  // MODELD_WARP=check
   std::unique_ptr<float[]> input_frames;
+
+#ifdef USE_CUDA
+  cudaStream_t stream_cuda = nullptr;
+  float *input_frames_cuda = nullptr;  // both allocated on first use
+  float *last_output_cuda = nullptr;
+#endif
 };
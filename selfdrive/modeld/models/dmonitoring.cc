@@ -1,130 +1,60 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 
-#include "libyuv.h"
-
+#include "selfdrive/common/clutil.h"
 #include "selfdrive/common/mat.h"
+#include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/params.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/hardware/hw.h"
 
 #include "selfdrive/modeld/models/dmonitoring.h"
 
-#define MODEL_WIDTH 320
-#define MODEL_HEIGHT 640
+#define MODEL_WIDTH DM_INPUT_WIDTH
+#define MODEL_HEIGHT DM_INPUT_HEIGHT
 #define FULL_W 852 // should get these numbers from camerad
 
-void dmonitoring_init(DMonitoringModelState* s) {
+void dmonitoring_init(DMonitoringModelState* s, cl_device_id device_id, cl_context context) {
   s->is_rhd = Params().getBool("IsRHD");
-  for (int x = 0; x < std::size(s->tensor); ++x) {
-    s->tensor[x] = (x - 128.f) * 0.0078125f;
-  }
 
-#ifdef USE_ONNX_MODEL
+  char args[128];
+  snprintf(args, sizeof(args), "-DOUT_WIDTH=%d -DOUT_HEIGHT=%d", MODEL_WIDTH, MODEL_HEIGHT);
+  cl_program prg = cl_program_from_file(context, device_id, "transforms/dmonitoring.cl", args);
+  s->crop_krnl = CL_CHECK_ERR(clCreateKernel(prg, "cropTensor", &err));
+  CL_CHECK(clReleaseProgram(prg));
+  s->q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+  s->net_input_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                                MODEL_WIDTH * MODEL_HEIGHT * 3 / 2 * sizeof(float), NULL, &err));
+
+#if defined(USE_ONNXRT)
+  s->m = new ONNXRTModel("../../models/dmonitoring_model.onnx", &s->output[0], OUTPUT_SIZE, USE_DSP_RUNTIME);
+#elif defined(USE_ONNX_MODEL)
   s->m = new ONNXModel("../../models/dmonitoring_model.onnx", &s->output[0], OUTPUT_SIZE, USE_DSP_RUNTIME);
 #else
   s->m = new SNPEModel("../../models/dmonitoring_model_q.dlc", &s->output[0], OUTPUT_SIZE, USE_DSP_RUNTIME);
 #endif
 }
 
-template <class T>
-static inline T *get_buffer(std::vector<T> &buf, const size_t size) {
-  if (buf.size() < size) buf.resize(size);
-  return buf.data();
-}
-
-static inline auto get_yuv_buf(std::vector<uint8_t> &buf, const int width, int height) {
-  uint8_t *y = get_buffer(buf, width * height * 3 / 2);
-  uint8_t *u = y + width * height;
-  uint8_t *v = u + (width /2) * (height / 2);
-  return std::make_tuple(y, u, v);
-}
-
-struct Rect {int x, y, w, h;};
-void crop_yuv(uint8_t *raw, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v, const Rect &rect) {
-  uint8_t *raw_y = raw;
-  uint8_t *raw_u = raw_y + (width * height);
-  uint8_t *raw_v = raw_u + ((width / 2) * (height / 2));
-  for (int r = 0; r < rect.h / 2; r++) {
-    memcpy(y + 2 * r * rect.w, raw_y + (2 * r + rect.y) * width + rect.x, rect.w);
-    memcpy(y + (2 * r + 1) * rect.w, raw_y + (2 * r + rect.y + 1) * width + rect.x, rect.w);
-    memcpy(u + r * (rect.w / 2), raw_u + (r + (rect.y / 2)) * width / 2 + (rect.x / 2), rect.w / 2);
-    memcpy(v + r * (rect.w / 2), raw_v + (r + (rect.y / 2)) * width / 2 + (rect.x / 2), rect.w / 2);
-  }
-}
-
-DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, int width, int height) {
-  Rect crop_rect;
-  if (Hardware::TICI()) {
-    const int full_width_tici = 1928;
-    const int full_height_tici = 1208;
-    const int adapt_width_tici = 668;
-    const int cropped_height = adapt_width_tici / 1.33;
-    crop_rect = {full_width_tici / 2 - adapt_width_tici / 2,
-                 full_height_tici / 2 - cropped_height / 2 - 196,
-                 cropped_height / 2,
-                 cropped_height};
-    if (!s->is_rhd) {
-      crop_rect.x += adapt_width_tici - crop_rect.w + 32;
-    }
-
-  } else {
-    crop_rect = {0, 0, height / 2, height};
-    if (!s->is_rhd) {
-      crop_rect.x += width - crop_rect.w;
-    }
+DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, cl_mem yuv_cl, int width, int height) {
+  // frames from the ROI stream are already the model size, they are only converted
+  const bool full_frame = width != MODEL_WIDTH || height != MODEL_HEIGHT;
+  const DMCropRect crop_rect = full_frame ? get_driver_crop_rect(width, height, s->is_rhd) : DMCropRect{0, 0, width, height};
+  const cl_int mirror = full_frame && s->is_rhd;
+  const cl_int args[] = {width, height, crop_rect.x, crop_rect.y, crop_rect.w, crop_rect.h, mirror};
+  CL_CHECK(clSetKernelArg(s->crop_krnl, 0, sizeof(cl_mem), &yuv_cl));
+  for (int i = 0; i < std::size(args); i++) {
+    CL_CHECK(clSetKernelArg(s->crop_krnl, i + 1, sizeof(cl_int), &args[i]));
   }
-
-  int resized_width = MODEL_WIDTH;
-  int resized_height = MODEL_HEIGHT;
-
-  auto [cropped_y, cropped_u, cropped_v] = get_yuv_buf(s->cropped_buf, crop_rect.w, crop_rect.h);
-  if (!s->is_rhd) {
-    crop_yuv((uint8_t *)stream_buf, width, height, cropped_y, cropped_u, cropped_v, crop_rect);
-  } else {
-    auto [mirror_y, mirror_u, mirror_v] = get_yuv_buf(s->premirror_cropped_buf, crop_rect.w, crop_rect.h);
-    crop_yuv((uint8_t *)stream_buf, width, height, mirror_y, mirror_u, mirror_v, crop_rect);
-    libyuv::I420Mirror(mirror_y, crop_rect.w,
-                       mirror_u, crop_rect.w / 2,
-                       mirror_v, crop_rect.w / 2,
-                       cropped_y, crop_rect.w,
-                       cropped_u, crop_rect.w / 2,
-                       cropped_v, crop_rect.w / 2,
-                       crop_rect.w, crop_rect.h);
-  }
-
-  auto [resized_buf, resized_u, resized_v] = get_yuv_buf(s->resized_buf, resized_width, resized_height);
-  uint8_t *resized_y = resized_buf;
-  libyuv::FilterMode mode = libyuv::FilterModeEnum::kFilterBilinear;
-  libyuv::I420Scale(cropped_y, crop_rect.w,
-                    cropped_u, crop_rect.w / 2,
-                    cropped_v, crop_rect.w / 2,
-                    crop_rect.w, crop_rect.h,
-                    resized_y, resized_width,
-                    resized_u, resized_width / 2,
-                    resized_v, resized_width / 2,
-                    resized_width, resized_height,
-                    mode);
+  CL_CHECK(clSetKernelArg(s->crop_krnl, std::size(args) + 1, sizeof(cl_mem), &s->net_input_cl));
+  const size_t work_size[2] = {MODEL_WIDTH / 2, MODEL_HEIGHT / 2};
+  CL_CHECK(clEnqueueNDRangeKernel(s->q, s->crop_krnl, 2, NULL, work_size, NULL, 0, NULL, NULL));
 
   int yuv_buf_len = (MODEL_WIDTH/2) * (MODEL_HEIGHT/2) * 6; // Y|u|v -> y|y|y|y|u|v
-  float *net_input_buf = get_buffer(s->net_input_buf, yuv_buf_len);
-  // one shot conversion, O(n) anyway
-  // yuvframe2tensor, normalize
-  for (int r = 0; r < MODEL_HEIGHT/2; r++) {
-    for (int c = 0; c < MODEL_WIDTH/2; c++) {
-      // Y_ul
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (0*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_y[(2*r)*resized_width + 2*c]];
-      // Y_dl
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (1*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_y[(2*r+1)*resized_width + 2*c]];
-      // Y_ur
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (2*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_y[(2*r)*resized_width + 2*c+1]];
-      // Y_dr
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (3*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_y[(2*r+1)*resized_width + 2*c+1]];
-      // U
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (4*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_u[r*resized_width/2 + c]];
-      // V
-      net_input_buf[(r*MODEL_WIDTH/2) + c + (5*(MODEL_WIDTH/2)*(MODEL_HEIGHT/2))] = s->tensor[resized_v[r*resized_width/2 + c]];
-    }
-  }
+  // host allocated, mapping it doesn't copy on a shared memory GPU
+  float *net_input_buf = (float *)CL_CHECK_ERR(clEnqueueMapBuffer(s->q, s->net_input_cl, CL_TRUE, CL_MAP_READ, 0,
+                                                                  yuv_buf_len * sizeof(float), 0, NULL, NULL, &err));
 
   //printf("preprocess completed. %d \n", yuv_buf_len);
   //FILE *dump_yuv_file = fopen("/tmp/rawdump.yuv", "wb");
@@ -142,6 +72,7 @@ DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_
   double t1 = millis_since_boot();
   s->m->execute(net_input_buf, yuv_buf_len);
   double t2 = millis_since_boot();
+  CL_CHECK(clEnqueueUnmapMemObject(s->q, s->net_input_cl, net_input_buf, 0, NULL, NULL));
 
   DMonitoringResult ret = {0};
   for (int i = 0; i < 3; ++i) {
@@ -166,9 +97,77 @@ DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_
   return ret;
 }
 
-void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, kj::ArrayPtr<const float> raw_pred) {
+// the last outputs are sure when the face is well above dmonitoringd's
+// thresholds, its pose certain and nothing hints at a distraction
+#define DMON_CONFIDENT_FACE_PROB 0.9
+#define DMON_CONFIDENT_POSE_STD 0.1
+#define DMON_CONFIDENT_DISTRACTED 0.3
+// radians the face may turn between runs and still be steady
+#define DMON_STEADY_FACE_MOVED 0.05
+// m/s, moving
+#define DMON_MOVING_SPEED 0.5
+
+static bool dmonitoring_confident(const DMonitoringRate* r, const DMonitoringVehicle &v) {
+  if (!r->has_last || v.distracted || v.awareness < 1.0) return false;
+  const DMonitoringResult &res = r->last;
+  bool ret = res.face_prob > DMON_CONFIDENT_FACE_PROB &&
+             res.distracted_pose < DMON_CONFIDENT_DISTRACTED && res.distracted_eyes < DMON_CONFIDENT_DISTRACTED;
+  for (int i = 0; i < 3; i++) {
+    ret = ret && res.face_orientation_meta[i] < DMON_CONFIDENT_POSE_STD;
+  }
+  return ret;
+}
+
+bool dmonitoring_rate_update(DMonitoringRate* r, const DMonitoringVehicle &v, uint32_t frame_id, double now, bool load_shed) {
+  using Reason = cereal::DriverState::ModelRateReason;
+  const bool moving = !v.standstill && v.v_ego > DMON_MOVING_SPEED;
+
+  if (v.onroad && v.engaged && moving) {
+    r->interval = 1;
+    r->reason = Reason::ENGAGED;
+  } else if (!dmonitoring_confident(r, v)) {
+    r->interval = 1;
+    r->reason = Reason::LOW_CONFIDENCE;
+  } else if (r->face_moved > DMON_STEADY_FACE_MOVED) {
+    r->interval = 1;
+    r->reason = Reason::UNSTABLE;
+  } else if (!v.onroad) {
+    r->interval = 4;
+    r->reason = Reason::OFFROAD;
+  } else if (!moving) {
+    r->interval = 4;
+    r->reason = Reason::PARKED;
+  } else {
+    r->interval = 2;
+    r->reason = Reason::CONFIDENT;
+  }
+  // half rate at most under load, it's still bound by the gap below
+  if (load_shed) {
+    r->interval = std::max(r->interval, 2);
+  }
+
+  if (!r->has_last || now - r->last_run >= DMONITORING_MAX_GAP_S) return true;
+  return frame_id - r->last_frame_id >= (uint32_t)r->interval;
+}
+
+void dmonitoring_rate_ran(DMonitoringRate* r, const DMonitoringResult &res, uint32_t frame_id, double now) {
+  if (r->has_last) {
+    float moved = 0;
+    for (int i = 0; i < 3; i++) {
+      moved = std::max(moved, std::abs(res.face_orientation[i] - r->last.face_orientation[i]));
+    }
+    r->face_moved = moved;
+  }
+  r->last = res;
+  r->has_last = true;
+  r->last_frame_id = frame_id;
+  r->last_run = now;
+}
+
+void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, kj::ArrayPtr<const float> raw_pred,
+                         const DMonitoringRate *rate, bool held) {
   // make msg
-  MessageBuilder msg;
+  PooledMessageBuilder msg("driverState");
   auto framed = msg.initEvent().initDriverState();
   framed.setFrameId(frame_id);
   framed.setModelExecutionTime(execution_time);
@@ -188,13 +187,21 @@ void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResu
   framed.setPartialFace(res.partial_face);
   framed.setDistractedPose(res.distracted_pose);
   framed.setDistractedEyes(res.distracted_eyes);
-  if (send_raw_pred) {
+  if (send_raw_pred && !held) {
     framed.setRawPredictions(raw_pred.asBytes());
   }
+  if (rate != nullptr) {
+    framed.setModelInterval(rate->interval);
+    framed.setModelRateReason(rate->reason);
+    framed.setModelHeld(held);
+  }
 
   pm.send("driverState", msg);
 }
 
 void dmonitoring_free(DMonitoringModelState* s) {
   delete s->m;
+  CL_CHECK(clReleaseMemObject(s->net_input_cl));
+  CL_CHECK(clReleaseKernel(s->crop_krnl));
+  CL_CHECK(clReleaseCommandQueue(s->q));
 }
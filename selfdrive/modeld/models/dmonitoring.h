@@ -1,7 +1,5 @@
 #pragma once
 
-#include <vector>
-
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/modeld/models/commonmodel.h"
@@ -31,15 +29,44 @@ typedef struct DMonitoringModelState {
   RunModel *m;
   bool is_rhd;
   float output[OUTPUT_SIZE];
-  std::vector<uint8_t> resized_buf;
-  std::vector<uint8_t> cropped_buf;
-  std::vector<uint8_t> premirror_cropped_buf;
-  std::vector<float> net_input_buf;
-  float tensor[UINT8_MAX + 1];
+  // the crop, scale and normalization of a frame run on the GPU, into a
+  // buffer the model reads on the host
+  cl_command_queue q;
+  cl_kernel crop_krnl;
+  cl_mem net_input_cl;
 } DMonitoringModelState;
 
-void dmonitoring_init(DMonitoringModelState* s);
-DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, void* stream_buf, int width, int height);
-void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, kj::ArrayPtr<const float> raw_pred);
+// How often the model runs. Every frame while engaged and moving or when the
+// last outputs were unsure or moving, less often otherwise. Never longer than
+// DMONITORING_MAX_GAP_S between runs, whatever else slows it down
+#define DMONITORING_MAX_GAP_S 0.5
+
+struct DMonitoringVehicle {
+  bool onroad;
+  bool engaged;
+  bool standstill;
+  float v_ego;
+  bool distracted;  // dmonitoringd's verdict
+  float awareness;
+};
+
+typedef struct DMonitoringRate {
+  int interval = 1;
+  cereal::DriverState::ModelRateReason reason = cereal::DriverState::ModelRateReason::ENGAGED;
+  uint32_t last_frame_id = 0;
+  double last_run = 0;  // seconds since boot, 0 before the first run
+  bool has_last = false;
+  DMonitoringResult last = {};  // of the last run
+  float face_moved = 0;  // radians the face turned between the last two runs
+} DMonitoringRate;
+
+void dmonitoring_init(DMonitoringModelState* s, cl_device_id device_id, cl_context context);
+DMonitoringResult dmonitoring_eval_frame(DMonitoringModelState* s, cl_mem yuv_cl, int width, int height);
+// picks the rate for the vehicle and the last outputs, true if the model runs on this frame
+bool dmonitoring_rate_update(DMonitoringRate* r, const DMonitoringVehicle &v, uint32_t frame_id, double now, bool load_shed);
+// the outputs of a run, for the rate of the frames after it
+void dmonitoring_rate_ran(DMonitoringRate* r, const DMonitoringResult &res, uint32_t frame_id, double now);
+void dmonitoring_publish(PubMaster &pm, uint32_t frame_id, const DMonitoringResult &res, float execution_time, kj::ArrayPtr<const float> raw_pred,
+                         const DMonitoringRate *rate = nullptr, bool held = false);
 void dmonitoring_free(DMonitoringModelState* s);
 
@@ -10,7 +10,11 @@
 
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
+#include "selfdrive/hardware/hw.h"
+#include "selfdrive/modeld/models/model_compact.h"
+#include "cereal/messaging/trace.h"
 
 constexpr int DESIRE_PRED_SIZE = 32;
 constexpr int OTHER_META_SIZE = 48;
@@ -42,34 +46,66 @@ constexpr int DESIRE_STATE_IDX = LEAD_PROB_IDX + 3;
 constexpr int META_IDX = DESIRE_STATE_IDX + DESIRE_LEN;
 constexpr int POSE_IDX = META_IDX + OTHER_META_SIZE + DESIRE_PRED_SIZE;
 constexpr int OUTPUT_SIZE =  POSE_IDX + POSE_SIZE;
-#ifdef TEMPORAL
-  constexpr int TEMPORAL_SIZE = 512;
-#else
-  constexpr int TEMPORAL_SIZE = 0;
-#endif
 
 constexpr float FCW_THRESHOLD_5MS2_HIGH = 0.15;
 constexpr float FCW_THRESHOLD_5MS2_LOW = 0.05;
 constexpr float FCW_THRESHOLD_3MS2 = 0.7;
 
+// upper bound on the encoded modelV2 size without raw predictions
+constexpr size_t MODEL_MSG_MAX_SIZE = 64 * 1024;
+
 float prev_brake_5ms2_probs[5] = {0,0,0,0,0};
 float prev_brake_3ms2_probs[3] = {0,0,0};
 
 // #define DUMP_YUV
 
-void model_init(ModelState* s, cl_device_id device_id, cl_context context) {
-  s->frame = new ModelFrame(device_id, context);
+static bool has_suffix(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
 
-  constexpr int output_size = OUTPUT_SIZE + TEMPORAL_SIZE;
+std::unique_ptr<RunModel> model_runner(const std::string &path, float *output, size_t output_size) {
+#ifdef USE_THNEED
+  if (has_suffix(path, ".thneed")) return std::make_unique<ThneedModel>(path.c_str(), output, output_size, USE_GPU_RUNTIME);
+#endif
+#ifdef USE_TENSORRT
+  if (has_suffix(path, ".engine") || has_suffix(path, ".onnx")) return std::make_unique<TRTModel>(path.c_str(), output, output_size, USE_GPU_RUNTIME);
+#endif
+#if defined(USE_ONNXRT)
+  if (has_suffix(path, ".onnx")) return std::make_unique<ONNXRTModel>(path.c_str(), output, output_size, USE_GPU_RUNTIME);
+#elif USE_ONNX_MODEL
+  if (has_suffix(path, ".onnx")) return std::make_unique<ONNXModel>(path.c_str(), output, output_size, USE_GPU_RUNTIME);
+#endif
+#ifndef NO_SNPE
+  if (has_suffix(path, ".dlc")) return std::make_unique<SNPEModel>(path.c_str(), output, output_size, USE_GPU_RUNTIME);
+#endif
+  return nullptr;
+}
+
+bool model_init(ModelState* s, cl_device_id device_id, cl_context context, const char *path) {
+  const int output_size = model_output_size();
   s->output.resize(output_size);
 
+  if (path != NULL) {
+    if (!util::file_exists(path) || !(s->m = model_runner(path, &s->output[0], output_size))) {
+      LOGE("can't run model %s", path);
+      return false;
+    }
+  } else {
 #ifdef USE_THNEED
-  s->m = std::make_unique<ThneedModel>("../../models/supercombo.thneed", &s->output[0], output_size, USE_GPU_RUNTIME);
+    const char *thneed_path = util::file_exists("../../models/supercombo_opt.thneed") ? "../../models/supercombo_opt.thneed"
+                                                                                    : "../../models/supercombo.thneed";
+    s->m = std::make_unique<ThneedModel>(thneed_path, &s->output[0], output_size, USE_GPU_RUNTIME);
+#elif defined(USE_TENSORRT)
+    s->m = std::make_unique<TRTModel>("../../models/supercombo.onnx", &s->output[0], output_size, USE_GPU_RUNTIME);
+#elif defined(USE_ONNXRT)
+    s->m = std::make_unique<ONNXRTModel>("../../models/supercombo.onnx", &s->output[0], output_size, USE_GPU_RUNTIME);
 #elif USE_ONNX_MODEL
-  s->m = std::make_unique<ONNXModel>("../../models/supercombo.onnx", &s->output[0], output_size, USE_GPU_RUNTIME);
+    s->m = std::make_unique<ONNXModel>("../../models/supercombo.onnx", &s->output[0], output_size, USE_GPU_RUNTIME);
 #else
-  s->m = std::make_unique<SNPEModel>("../../models/supercombo.dlc", &s->output[0], output_size, USE_GPU_RUNTIME);
+    s->m = std::make_unique<SNPEModel>("../../models/supercombo.dlc", &s->output[0], output_size, USE_GPU_RUNTIME);
 #endif
+  }
+  s->frame = new ModelFrame(device_id, context);
 
 #ifdef TEMPORAL
   s->m->addRecurrent(&s->output[OUTPUT_SIZE], TEMPORAL_SIZE);
@@ -84,40 +120,182 @@ void model_init(ModelState* s, cl_device_id device_id, cl_context context) {
   s->traffic_convention[idx] = 1.0;
   s->m->addTrafficConvention(s->traffic_convention, TRAFFIC_CONVENTION_LEN);
 #endif
+
+  // ModelIORecordFrames records what the model gets and returns for that many frames, once
+  Params params;
+  const int record_frames = atoi(params.get("ModelIORecordFrames").c_str());
+  if (record_frames > 0 && path == NULL) {
+    params.remove("ModelIORecordFrames");
+    ModelIOHeader header;
+    header.input_size = s->frame->buf_size;
+    header.desire_size = DESIRE_LEN;
+    header.traffic_size = TRAFFIC_CONVENTION_LEN;
+    header.recurrent_size = TEMPORAL_SIZE;
+    header.output_size = output_size;
+    const std::string io_path = Path::log_root() + "/model_io_" + std::to_string(time(NULL)) + ".bin";
+    s->io = std::make_unique<ModelIOWriter>(io_path, header, record_frames);
+  }
+  return true;
 }
 
-ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
-                           const mat3 &transform, float *desire_in) {
+void model_desire_pulse(const float *desire_in, float *prev_desire, float *pulse_desire) {
+  for (int i = 1; i < DESIRE_LEN; i++) {
+    // Model decides when action is completed
+    // so desire input is just a pulse triggered on rising edge
+    if (desire_in[i] - prev_desire[i] > .99) {
+      pulse_desire[i] = desire_in[i];
+    } else {
+      pulse_desire[i] = 0.0;
+    }
+    prev_desire[i] = desire_in[i];
+  }
+}
+
+static void update_desire(ModelState* s, float *desire_in) {
 #ifdef DESIRE
   if (desire_in != NULL) {
-    for (int i = 1; i < DESIRE_LEN; i++) {
-      // Model decides when action is completed
-      // so desire input is just a pulse triggered on rising edge
-      if (desire_in[i] - s->prev_desire[i] > .99) {
-        s->pulse_desire[i] = desire_in[i];
-      } else {
-        s->pulse_desire[i] = 0.0;
-      }
-      s->prev_desire[i] = desire_in[i];
-    }
+    model_desire_pulse(desire_in, s->prev_desire, s->pulse_desire);
   }
 #endif
+}
+
+static bool recording(ModelState* s) {
+  return s->io && s->io->is_open();
+}
+
+// the backend's own input buffer, unless the input is recorded and has to be on the host
+static cl_mem *input_buf(ModelState* s) {
+  return recording(s) ? nullptr : s->m->getInputBuf();
+}
+
+static void record_inputs(ModelState* s, const float *net_input_buf) {
+  if (recording(s)) {
+    s->m->syncRecurrent();
+    s->io->write_inputs(net_input_buf, s->pulse_desire, s->traffic_convention, &s->output[OUTPUT_SIZE]);
+  }
+}
+
+static void record_outputs(ModelState* s) {
+  if (recording(s)) {
+    s->io->write_outputs(&s->output[0]);
+  }
+}
+
+static ModelDataRaw execute_net(ModelState* s, float *net_input_buf) {
+  record_inputs(s, net_input_buf);
+  s->timings.execute_start = nanos_since_boot();
+  {
+    TRACE_SPAN("model_execute");
+    s->m->execute(net_input_buf, s->frame->buf_size);
+  }
+  s->timings.execute_end = nanos_since_boot();
+  record_outputs(s);
+  return model_outputs(&s->output[0]);
+}
+
+ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
+                           const mat3 &transform, float *desire_in) {
+  update_desire(s, desire_in);
 
   //for (int i = 0; i < OUTPUT_SIZE + TEMPORAL_SIZE; i++) { printf("%f ", s->output[i]); } printf("\n");
 
-  auto net_input_buf = s->frame->prepare(yuv_cl, width, height, transform);
-  s->m->execute(net_input_buf, s->frame->buf_size);
+  TRACE_SPAN("model_eval_frame");
+  float *net_input_buf;
+  s->timings.prepare_start = nanos_since_boot();
+  {
+    TRACE_SPAN("model_prepare");
+    net_input_buf = s->frame->prepare(yuv_cl, width, height, transform, input_buf(s));
+  }
+  return execute_net(s, net_input_buf);
+}
+
+#ifdef USE_CUDA
+ModelDataRaw model_eval_frame_cuda(ModelState* s, const uint8_t *yuv, int width, int height,
+                                   const mat3 &transform, float *desire_in) {
+  update_desire(s, desire_in);
+
+  TRACE_SPAN("model_eval_frame");
+  float *net_input_buf;
+  s->timings.prepare_start = nanos_since_boot();
+  {
+    TRACE_SPAN("model_prepare");
+    net_input_buf = s->frame->prepare_cuda(yuv, width, height, transform, recording(s) ? nullptr : s->m->getInputBufCuda());
+  }
+  return execute_net(s, net_input_buf);
+}
+#endif
+
+void model_prepare(ModelState* s, int slot, cl_mem yuv_cl, int width, int height, const mat3 &transform) {
+  TRACE_SPAN("model_prepare");
+  s->frame->warp(slot, yuv_cl, width, height, transform);
+}
+
+void model_execute(ModelState* s, int slot, int prev_slot, float *desire_in, uint64_t prepare_start, std::function<void()> done) {
+  // the inputs and the recurrent state are the model's until the last frame is done
+  s->m->wait();
+  update_desire(s, desire_in);
+
+  TRACE_SPAN("model_eval_frame");
+  s->timings.prepare_start = prepare_start;
+  float *net_input_buf = s->frame->stack(slot, input_buf(s), prev_slot);
+  record_inputs(s, net_input_buf);
+  s->timings.execute_start = nanos_since_boot();
+  s->m->executeAsync(net_input_buf, s->frame->buf_size, [s, done = std::move(done)]() {
+    s->timings.execute_end = nanos_since_boot();
+    record_outputs(s);
+    done();
+  });
+}
+
+mat3 model_calib_transform(const float *extrinsic_matrix, bool wide_camera) {
+  /*
+     import numpy as np
+     from common.transformations.model import medmodel_frame_from_road_frame
+     medmodel_frame_from_ground = medmodel_frame_from_road_frame[:, (0, 1, 3)]
+     ground_from_medmodel_frame = np.linalg.inv(medmodel_frame_from_ground)
+  */
+  Eigen::Matrix<float, 3, 3> ground_from_medmodel_frame;
+  ground_from_medmodel_frame <<
+    0.00000000e+00, 0.00000000e+00, 1.00000000e+00,
+    -1.09890110e-03, 0.00000000e+00, 2.81318681e-01,
+    -1.84808520e-20, 9.00738606e-04,-4.28751576e-02;
+
+  Eigen::Matrix<float, 3, 3> cam_intrinsics = Eigen::Matrix<float, 3, 3, Eigen::RowMajor>(wide_camera ? ecam_intrinsic_matrix.v : fcam_intrinsic_matrix.v);
+  const mat3 yuv_transform = get_model_yuv_transform();
+
+  Eigen::Matrix<float, 3, 4> extrinsic_matrix_eigen;
+  for (int i = 0; i < 4*3; i++) {
+    extrinsic_matrix_eigen(i / 4, i % 4) = extrinsic_matrix[i];
+  }
+
+  auto camera_frame_from_road_frame = cam_intrinsics * extrinsic_matrix_eigen;
+  Eigen::Matrix<float, 3, 3> camera_frame_from_ground;
+  camera_frame_from_ground.col(0) = camera_frame_from_road_frame.col(0);
+  camera_frame_from_ground.col(1) = camera_frame_from_road_frame.col(1);
+  camera_frame_from_ground.col(2) = camera_frame_from_road_frame.col(3);
+
+  auto warp_matrix = camera_frame_from_ground * ground_from_medmodel_frame;
+  mat3 transform = {};
+  for (int i=0; i<3*3; i++) {
+    transform.v[i] = warp_matrix(i / 3, i % 3);
+  }
+  return matmul3(yuv_transform, transform);
+}
 
-  // net outputs
+size_t model_output_size() {
+  return OUTPUT_SIZE + TEMPORAL_SIZE;
+}
+
+ModelDataRaw model_outputs(float *output) {
   ModelDataRaw net_outputs;
-  net_outputs.plan = &s->output[PLAN_IDX];
-  net_outputs.lane_lines = &s->output[LL_IDX];
-  net_outputs.lane_lines_prob = &s->output[LL_PROB_IDX];
-  net_outputs.road_edges = &s->output[RE_IDX];
-  net_outputs.lead = &s->output[LEAD_IDX];
-  net_outputs.lead_prob = &s->output[LEAD_PROB_IDX];
-  net_outputs.meta = &s->output[DESIRE_STATE_IDX];
-  net_outputs.pose = &s->output[POSE_IDX];
+  net_outputs.plan = &output[PLAN_IDX];
+  net_outputs.lane_lines = &output[LL_IDX];
+  net_outputs.lane_lines_prob = &output[LL_PROB_IDX];
+  net_outputs.road_edges = &output[RE_IDX];
+  net_outputs.lead = &output[LEAD_IDX];
+  net_outputs.lead_prob = &output[LEAD_PROB_IDX];
+  net_outputs.meta = &output[DESIRE_STATE_IDX];
+  net_outputs.pose = &output[POSE_IDX];
   return net_outputs;
 }
 
@@ -147,8 +325,9 @@ static const float *get_lead_data(const float *lead, int t_offset) {
 
 void fill_sigmoid(const float *input, float *output, int len, int stride) {
   for (int i=0; i<len; i++) {
-    output[i] = sigmoid(input[i*stride]);
+    output[i] = input[i*stride];
   }
+  sigmoid_n(output, output, len);
 }
 
 void fill_lead_v3(cereal::ModelDataV2::LeadDataV3::Builder lead, const float *lead_data, const float *prob, int t_offset, float prob_t) {
@@ -156,33 +335,24 @@ void fill_lead_v3(cereal::ModelDataV2::LeadDataV3::Builder lead, const float *le
   const float *data = get_lead_data(lead_data, t_offset);
   lead.setProb(sigmoid(prob[t_offset]));
   lead.setProbTime(prob_t);
-  float x_arr[LEAD_TRAJ_LEN];
-  float y_arr[LEAD_TRAJ_LEN];
-  float v_arr[LEAD_TRAJ_LEN];
-  float a_arr[LEAD_TRAJ_LEN];
-  float x_stds_arr[LEAD_TRAJ_LEN];
-  float y_stds_arr[LEAD_TRAJ_LEN];
-  float v_stds_arr[LEAD_TRAJ_LEN];
-  float a_stds_arr[LEAD_TRAJ_LEN];
-  for (int i=0; i<LEAD_TRAJ_LEN; i++) {
-    x_arr[i] = data[i*LEAD_PRED_DIM+0];
-    y_arr[i] = data[i*LEAD_PRED_DIM+1];
-    v_arr[i] = data[i*LEAD_PRED_DIM+2];
-    a_arr[i] = data[i*LEAD_PRED_DIM+3];
-    x_stds_arr[i] = exp(data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+0]);
-    y_stds_arr[i] = exp(data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+1]);
-    v_stds_arr[i] = exp(data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+2]);
-    a_stds_arr[i] = exp(data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+3]);
+  // x, y, v, a and their stds one after the other, so the stds are a single exp_n
+  float soa[2*LEAD_PRED_DIM][LEAD_TRAJ_LEN];
+  for (int j=0; j<LEAD_PRED_DIM; j++) {
+    for (int i=0; i<LEAD_TRAJ_LEN; i++) {
+      soa[j][i] = data[i*LEAD_PRED_DIM+j];
+      soa[LEAD_PRED_DIM+j][i] = data[LEAD_MHP_VALS + i*LEAD_PRED_DIM+j];
+    }
   }
+  exp_n(soa[LEAD_PRED_DIM], soa[LEAD_PRED_DIM], LEAD_PRED_DIM*LEAD_TRAJ_LEN);
   lead.setT(t);
-  lead.setX(x_arr);
-  lead.setY(y_arr);
-  lead.setV(v_arr);
-  lead.setA(a_arr);
-  lead.setXStd(x_stds_arr);
-  lead.setYStd(y_stds_arr);
-  lead.setVStd(v_stds_arr);
-  lead.setAStd(a_stds_arr);
+  lead.setX(soa[0]);
+  lead.setY(soa[1]);
+  lead.setV(soa[2]);
+  lead.setA(soa[3]);
+  lead.setXStd(soa[4]);
+  lead.setYStd(soa[5]);
+  lead.setVStd(soa[6]);
+  lead.setAStd(soa[7]);
 }
 
 void fill_meta(cereal::ModelDataV2::MetaData::Builder meta, const float *meta_data) {
@@ -309,9 +479,11 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_ou
   float lane_line_stds_arr[4];
   for (int i = 0; i < 4; i++) {
     fill_xyzt(lane_lines[i], &net_outputs.lane_lines[i*TRAJECTORY_SIZE*2], 2, -1, plan_t_arr, false);
-    lane_line_probs_arr[i] = sigmoid(net_outputs.lane_lines_prob[i*2+1]);
-    lane_line_stds_arr[i] = exp(net_outputs.lane_lines[2*TRAJECTORY_SIZE*(4 + i)]);
+    lane_line_probs_arr[i] = net_outputs.lane_lines_prob[i*2+1];
+    lane_line_stds_arr[i] = net_outputs.lane_lines[2*TRAJECTORY_SIZE*(4 + i)];
   }
+  sigmoid_n(lane_line_probs_arr, lane_line_probs_arr, 4);
+  exp_n(lane_line_stds_arr, lane_line_stds_arr, 4);
   framed.setLaneLineProbs(lane_line_probs_arr);
   framed.setLaneLineStds(lane_line_stds_arr);
 
@@ -320,8 +492,9 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_ou
   float road_edge_stds_arr[2];
   for (int i = 0; i < 2; i++) {
     fill_xyzt(road_edges[i], &net_outputs.road_edges[i*TRAJECTORY_SIZE*2], 2, -1, plan_t_arr, false);
-    road_edge_stds_arr[i] = exp(net_outputs.road_edges[2*TRAJECTORY_SIZE*(2 + i)]);
+    road_edge_stds_arr[i] = net_outputs.road_edges[2*TRAJECTORY_SIZE*(2 + i)];
   }
+  exp_n(road_edge_stds_arr, road_edge_stds_arr, 2);
   framed.setRoadEdgeStds(road_edge_stds_arr);
 
   // meta
@@ -335,26 +508,64 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelDataRaw &net_ou
   }
 }
 
-void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
-                   const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
-                   float model_execution_time, kj::ArrayPtr<const float> raw_pred) {
+static void fill_frame_latency(cereal::ModelDataV2::FrameLatency::Builder latency, const VisionIpcBufExtra &extra,
+                               const ModelTimings &timings, uint64_t publish_time) {
+  auto dt = [](uint64_t start, uint64_t end) {
+    return (start != 0 && end > start) ? (end - start) * 1e-9f : 0.f;
+  };
+  const uint64_t sof = extra.timestamp_sof != 0 ? extra.timestamp_sof : extra.timestamp_eof;
+  latency.setIsp(dt(sof, extra.timestamp_isp));
+  latency.setDebayer(dt(extra.timestamp_isp, extra.timestamp_sent));
+  latency.setVipcTransit(dt(extra.timestamp_sent, extra.timestamp_received));
+  latency.setModelPrepare(dt(timings.prepare_start, timings.execute_start));
+  latency.setModelExecute(dt(timings.execute_start, timings.execute_end));
+  latency.setPublish(dt(timings.execute_end, publish_time));
+  latency.setTotal(dt(sof, publish_time));
+}
+
+void fill_model_msg(cereal::ModelDataV2::Builder framed, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
+                    uint32_t frames_skipped, const ModelDataRaw &net_outputs, uint64_t timestamp_eof, float model_execution_time,
+                    kj::ArrayPtr<const float> raw_pred) {
   const uint32_t frame_age = (frame_id > vipc_frame_id) ? (frame_id - vipc_frame_id) : 0;
-  MessageBuilder msg;
-  auto framed = msg.initEvent().initModelV2();
   framed.setFrameId(vipc_frame_id);
   framed.setFrameAge(frame_age);
   framed.setFrameDropPerc(frame_drop * 100);
+  framed.setFramesSkipped(frames_skipped);
   framed.setTimestampEof(timestamp_eof);
   framed.setModelExecutionTime(model_execution_time);
-  if (send_raw_pred) {
+  if (raw_pred.size() > 0) {
     framed.setRawPredictions(raw_pred.asBytes());
   }
   fill_model(framed, net_outputs);
-  pm.send("modelV2", msg);
 }
 
-void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
-                     const ModelDataRaw &net_outputs, uint64_t timestamp_eof) {
+void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop, uint32_t frames_skipped,
+                   const ModelDataRaw &net_outputs, const VisionIpcBufExtra &extra, const ModelTimings &timings,
+                   float model_execution_time, kj::ArrayPtr<const float> raw_pred, bool shadow) {
+  // built in place in the modelV2 ring, avoids an allocation and a copy of ~40 KB per frame
+  RingMessageBuilder msg(pm, shadow ? "modelV2Shadow" : "modelV2", MODEL_MSG_MAX_SIZE + (send_raw_pred ? raw_pred.asBytes().size() : 0));
+  auto event = msg.initEvent();
+  auto framed = shadow ? event.initModelV2Shadow() : event.initModelV2();
+  fill_model_msg(framed, vipc_frame_id, frame_id, frame_drop, frames_skipped, net_outputs, extra.timestamp_eof, model_execution_time,
+                 send_raw_pred ? raw_pred : kj::ArrayPtr<const float>());
+  fill_frame_latency(framed.initFrameLatency(), extra, timings, nanos_since_boot());
+  framed.setGpuFrequency(timings.gpu_freq);
+
+  // the copy loggerd logs instead, it's encoded before the ring slot is handed over
+  static const bool log_compact = Params().getBool("LogModelCompact");
+  if (log_compact && !shadow) {
+    static ModelCompactEncoder encoder;
+    MessageBuilder compact_msg;
+    encoder.encode(framed.asReader(), compact_msg.initEvent().initModelV2Compact());
+    msg.send();
+    pm.send("modelV2Compact", compact_msg);
+    return;
+  }
+  msg.send();
+}
+
+void fill_posenet_msg(cereal::CameraOdometry::Builder posenetd, uint32_t vipc_frame_id,
+                      const ModelDataRaw &net_outputs, uint64_t timestamp_eof) {
   float trans_arr[3];
   float trans_std_arr[3];
   float rot_arr[3];
@@ -368,8 +579,6 @@ void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_droppe
     rot_std_arr[i] = exp(net_outputs.pose[9 + i]);
   }
 
-  MessageBuilder msg;
-  auto posenetd = msg.initEvent(vipc_dropped_frames < 1).initCameraOdometry();
   posenetd.setTrans(trans_arr);
   posenetd.setRot(rot_arr);
   posenetd.setTransStd(trans_std_arr);
@@ -377,6 +586,11 @@ void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_droppe
 
   posenetd.setTimestampEof(timestamp_eof);
   posenetd.setFrameId(vipc_frame_id);
+}
 
+void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
+                     const ModelDataRaw &net_outputs, uint64_t timestamp_eof) {
+  PooledMessageBuilder msg("cameraOdometry");
+  fill_posenet_msg(msg.initEvent(vipc_dropped_frames < 1).initCameraOdometry(), vipc_frame_id, net_outputs, timestamp_eof);
   pm.send("cameraOdometry", msg);
 }
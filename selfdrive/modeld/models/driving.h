@@ -5,18 +5,26 @@
 #define DESIRE
 #define TRAFFIC_CONVENTION
 
+#include <functional>
 #include <memory>
 
 #include "cereal/messaging/messaging.h"
+#include "cereal/visionipc/visionipc.h"
 #include "selfdrive/common/mat.h"
 #include "selfdrive/common/modeldata.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/modeld/models/commonmodel.h"
+#include "selfdrive/modeld/models/model_io.h"
 #include "selfdrive/modeld/runners/run.h"
 
 constexpr int DESIRE_LEN = 8;
 constexpr int TRAFFIC_CONVENTION_LEN = 2;
 constexpr int MODEL_FREQ = 20;
+#ifdef TEMPORAL
+  constexpr int TEMPORAL_SIZE = 512;
+#else
+  constexpr int TEMPORAL_SIZE = 0;
+#endif
 
 struct ModelDataRaw {
   float *plan;
@@ -31,6 +39,12 @@ struct ModelDataRaw {
   float *pose;
 };
 
+// stage timings of one frame, nanos_since_boot
+struct ModelTimings {
+  uint64_t prepare_start = 0, execute_start = 0, execute_end = 0;
+  uint32_t gpu_freq = 0;  // MHz, set by the caller when the model is done
+};
+
 typedef struct ModelState {
   ModelFrame *frame;
   std::vector<float> output;
@@ -42,15 +56,49 @@ typedef struct ModelState {
 #ifdef TRAFFIC_CONVENTION
   float traffic_convention[TRAFFIC_CONVENTION_LEN] = {};
 #endif
+
+  ModelTimings timings;  // of the last frame
+  std::unique_ptr<ModelIOWriter> io;  // ModelIORecordFrames
 } ModelState;
 
-void model_init(ModelState* s, cl_device_id device_id, cl_context context);
+// loads the model this build runs, or the one at path with the runner its
+// extension asks for. False if the file is missing or this build can't run it
+bool model_init(ModelState* s, cl_device_id device_id, cl_context context, const char *path = NULL);
+// the runner for a model file, by its extension, out of the ones this build has. NULL for others
+std::unique_ptr<RunModel> model_runner(const std::string &path, float *output, size_t output_size);
 ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
                            const mat3 &transform, float *desire_in);
+#ifdef USE_CUDA
+// model_eval_frame of a frame in CUDA memory, the buf_cuda of a VisionBuf
+ModelDataRaw model_eval_frame_cuda(ModelState* s, const uint8_t *yuv, int width, int height,
+                                   const mat3 &transform, float *desire_in);
+#endif
+// model_eval_frame split for a pipeline: model_prepare warps a camera frame
+// into a staging slot of s->frame, model_execute runs the model on it. Frames
+// have to be executed in order, the recurrent state is carried between them.
+// model_execute returns once the slot is free again, done is called when
+// s->output and s->timings are written, possibly from another thread.
+// prev_slot is a frame that was skipped right before this one, or -1
+void model_prepare(ModelState* s, int slot, cl_mem yuv_cl, int width, int height, const mat3 &transform);
+void model_execute(ModelState* s, int slot, int prev_slot, float *desire_in, uint64_t prepare_start, std::function<void()> done);
+// the outputs of a buffer laid out like s->output, e.g. a copy of it
+ModelDataRaw model_outputs(float *output);
+// floats in s->output, the net outputs followed by TEMPORAL_SIZE of recurrent state
+size_t model_output_size();
+// warp from the camera to the model input for a liveCalibration extrinsic matrix, 3x4 row major
+mat3 model_calib_transform(const float *extrinsic_matrix, bool wide_camera);
+// turns the desire of a frame into the rising edge pulse the model takes
+void model_desire_pulse(const float *desire_in, float *prev_desire, float *pulse_desire);
 void model_free(ModelState* s);
 void poly_fit(float *in_pts, float *in_stds, float *out);
-void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
-                   const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
-                   float model_execution_time, kj::ArrayPtr<const float> raw_pred);
+void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop, uint32_t frames_skipped,
+                   const ModelDataRaw &net_outputs, const VisionIpcBufExtra &extra, const ModelTimings &timings,
+                   float model_execution_time, kj::ArrayPtr<const float> raw_pred, bool shadow = false);
+// the messages model_publish and posenet_publish send, for writing them elsewhere
+void fill_model_msg(cereal::ModelDataV2::Builder framed, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
+                    uint32_t frames_skipped, const ModelDataRaw &net_outputs, uint64_t timestamp_eof, float model_execution_time,
+                    kj::ArrayPtr<const float> raw_pred);
+void fill_posenet_msg(cereal::CameraOdometry::Builder posenetd, uint32_t vipc_frame_id,
+                      const ModelDataRaw &net_outputs, uint64_t timestamp_eof);
 void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
                      const ModelDataRaw &net_outputs, uint64_t timestamp_eof);
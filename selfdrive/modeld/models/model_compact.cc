@@ -0,0 +1,108 @@
+#include "selfdrive/modeld/models/model_compact.h"
+
+#include <cmath>
+
+#include <capnp/dynamic.h>
+#include <capnp/schema.h>
+
+namespace {
+
+// The fixed point step of a float field, by its path. The error is half of it
+float leaf_scale(const std::string &path) {
+  auto has = [&](const char *s) { return path.find(s) != std::string::npos; };
+  if (has("orientation")) return 1e-5;  // rad, rad/s
+  if (has("rob") || has("desire") || has("engaged")) return 1e-4;  // probabilities
+  if (has("Execution") || has("frameLatency")) return 1e-5;  // s
+  return 1e-3;  // m, m/s, m/s^2, s and their stds
+}
+
+// Collects the floats of r in schema order and copies everything else into skel
+void walk(capnp::DynamicStruct::Reader r, capnp::DynamicStruct::Builder skel, const std::string &path,
+          std::vector<std::string> &paths, std::vector<uint16_t> &counts, std::vector<float> &values) {
+  for (auto field : r.getSchema().getFields()) {
+    if (!field.getProto().isSlot()) continue;
+    const std::string name = path + "." + field.getProto().getName().cStr();
+    const capnp::Type type = field.getType();
+
+    if (type.isFloat32()) {
+      paths.push_back(name);
+      counts.push_back(1);
+      values.push_back(r.get(field).as<float>());
+    } else if (type.isStruct()) {
+      walk(r.get(field).as<capnp::DynamicStruct>(), skel.init(field).as<capnp::DynamicStruct>(), name, paths, counts, values);
+    } else if (type.isList() && type.asList().getElementType().isFloat32()) {
+      auto list = r.get(field).as<capnp::DynamicList>();
+      paths.push_back(name);
+      counts.push_back(list.size());
+      for (auto v : list) values.push_back(v.as<float>());
+    } else if (type.isList() && type.asList().getElementType().isStruct()) {
+      auto list = r.get(field).as<capnp::DynamicList>();
+      auto skel_list = skel.init(field, list.size()).as<capnp::DynamicList>();
+      for (int i = 0; i < list.size(); i++) {
+        walk(list[i].as<capnp::DynamicStruct>(), skel_list[i].as<capnp::DynamicStruct>(), name, paths, counts, values);
+      }
+    } else if (r.has(field)) {
+      skel.set(field, r.get(field));
+    }
+  }
+}
+
+void put_varint(std::vector<uint8_t> &out, int64_t v) {
+  uint64_t z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);  // zigzag
+  while (z >= 0x80) {
+    out.push_back((z & 0x7f) | 0x80);
+    z >>= 7;
+  }
+  out.push_back(z);
+}
+
+}  // namespace
+
+void ModelCompactEncoder::encode(cereal::ModelDataV2::Reader model, cereal::ModelDataV2Compact::Builder out) {
+  std::vector<std::string> paths;
+  std::vector<uint16_t> counts;
+  values.clear();
+  walk(model, out.initSkeleton(), "", paths, counts, values);
+
+  // a new layout starts over from a keyframe
+  bool keyframe = ++since_keyframe >= KEYFRAME_INTERVAL || counts.size() != leaves.size();
+  for (int i = 0; !keyframe && i < counts.size(); i++) {
+    keyframe = counts[i] != leaves[i].count;
+  }
+  if (keyframe) {
+    leaves.clear();
+    scales.clear();
+    for (int i = 0; i < counts.size(); i++) {
+      leaves.push_back({paths[i], counts[i]});
+      scales.push_back(leaf_scale(paths[i]));
+    }
+    prev.assign(values.size(), 0);
+    since_keyframe = 0;
+  }
+
+  packed.clear();
+  size_t idx = 0;
+  for (int i = 0; i < leaves.size(); i++) {
+    const float scale = scales[i];
+    for (int j = 0; j < leaves[i].count; j++, idx++) {
+      // NaN and inf don't survive, they're 0 or the largest value
+      const float v = values[idx];
+      const int64_t q = std::isnan(v) ? 0 : (int64_t)std::llround(std::fmax(std::fmin(v / scale, 1e15), -1e15));
+      put_varint(packed, q - prev[idx]);
+      prev[idx] = q;
+    }
+  }
+
+  out.setValues(kj::arrayPtr(packed.data(), packed.size()));
+  out.setKeyframe(keyframe);
+  out.setRefFrameId(prev_frame_id);
+  if (keyframe) {
+    auto c = out.initCounts(leaves.size());
+    auto s = out.initScales(leaves.size());
+    for (int i = 0; i < leaves.size(); i++) {
+      c.set(i, leaves[i].count);
+      s.set(i, scales[i]);
+    }
+  }
+  prev_frame_id = model.getFrameId();
+}
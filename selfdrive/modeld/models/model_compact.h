@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+
+// Encodes modelV2 into the modelV2Compact that is logged in its place with
+// LogModelCompact. Floats go into fixed point with a scale per field, delta
+// coded against the frame before and packed as varints, the rest of the
+// message is copied as is. selfdrive/loggerd/model_compact.py decodes it.
+class ModelCompactEncoder {
+ public:
+  void encode(cereal::ModelDataV2::Reader model, cereal::ModelDataV2Compact::Builder out);
+
+  // a keyframe at least this often, a log read from the middle decodes from the next one
+  static constexpr int KEYFRAME_INTERVAL = 20;
+
+ private:
+  struct Leaf {
+    std::string path;
+    uint16_t count;
+  };
+
+  std::vector<Leaf> leaves;
+  std::vector<float> values;
+  std::vector<int64_t> prev;  // quantized values of the last frame
+  std::vector<float> scales;
+  std::vector<uint8_t> packed;
+  int since_keyframe = KEYFRAME_INTERVAL;
+  uint32_t prev_frame_id = 0;
+};
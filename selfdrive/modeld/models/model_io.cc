@@ -0,0 +1,75 @@
+#include "selfdrive/modeld/models/model_io.h"
+
+#include <cstring>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+ModelIOWriter::ModelIOWriter(const std::string &path, const ModelIOHeader &header, int frames)
+    : path(path), header(header), frames_left(frames) {
+  f = fopen(path.c_str(), "wb");
+  if (f == NULL) {
+    LOGE("can't record model io to %s", path.c_str());
+    return;
+  }
+  fwrite(&header, sizeof(header), 1, f);
+}
+
+ModelIOWriter::~ModelIOWriter() {
+  if (f) fclose(f);
+}
+
+void ModelIOWriter::write(const float *data, size_t size) {
+  if (size == 0) return;
+  if (data != NULL) {
+    fwrite(data, sizeof(float), size, f);
+  } else {
+    // an input the model doesn't take
+    std::vector<float> zeros(size);
+    fwrite(zeros.data(), sizeof(float), size, f);
+  }
+}
+
+bool ModelIOWriter::write_inputs(const float *input, const float *desire, const float *traffic, const float *recurrent) {
+  if (f == NULL || frames_left <= 0) return false;
+  write(input, header.input_size);
+  write(desire, header.desire_size);
+  write(traffic, header.traffic_size);
+  write(recurrent, header.recurrent_size);
+  return true;
+}
+
+bool ModelIOWriter::write_outputs(const float *output) {
+  if (f == NULL || frames_left <= 0) return false;
+  write(output, header.output_size);
+  if (--frames_left == 0) {
+    fclose(f);
+    f = NULL;
+    LOGW("recorded model io to %s", path.c_str());
+  }
+  return true;
+}
+
+bool model_io_read(const std::string &path, ModelIOHeader *header, std::vector<ModelIOFrame> *frames) {
+  std::string dat = util::read_file(path);
+  if (dat.size() < sizeof(ModelIOHeader)) return false;
+  memcpy(header, dat.data(), sizeof(ModelIOHeader));
+  if (memcmp(header->magic, "MDIO", 4) != 0 || header->version != 1) return false;
+
+  const size_t sizes[] = {header->input_size, header->desire_size, header->traffic_size, header->recurrent_size, header->output_size};
+  size_t frame_floats = 0;
+  for (size_t s : sizes) frame_floats += s;
+  if (frame_floats == 0) return false;
+
+  const float *p = (const float *)(dat.data() + sizeof(ModelIOHeader));
+  const size_t count = (dat.size() - sizeof(ModelIOHeader)) / (frame_floats * sizeof(float));
+  frames->resize(count);
+  for (ModelIOFrame &frame : *frames) {
+    std::vector<float> *fields[] = {&frame.input, &frame.desire, &frame.traffic, &frame.recurrent, &frame.output};
+    for (int i = 0; i < std::size(fields); i++) {
+      fields[i]->assign(p, p + sizes[i]);
+      p += sizes[i];
+    }
+  }
+  return count > 0;
+}
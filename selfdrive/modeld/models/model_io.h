@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Recorded model runs for replaying them through any backend: a header with
+// the sizes, then for every frame the image input, desire, traffic convention
+// and recurrent state the model got, followed by what it returned. All floats
+struct ModelIOHeader {
+  char magic[4] = {'M', 'D', 'I', 'O'};
+  uint32_t version = 1;
+  uint32_t input_size, desire_size, traffic_size, recurrent_size, output_size;
+};
+
+struct ModelIOFrame {
+  std::vector<float> input, desire, traffic, recurrent, output;
+};
+
+class ModelIOWriter {
+public:
+  ModelIOWriter(const std::string &path, const ModelIOHeader &header, int frames);
+  ~ModelIOWriter();
+  bool is_open() const { return f != NULL; }
+  // inputs before a run, outputs after it. False once all frames are written
+  bool write_inputs(const float *input, const float *desire, const float *traffic, const float *recurrent);
+  bool write_outputs(const float *output);
+
+  const std::string path;
+
+private:
+  void write(const float *data, size_t size);
+
+  FILE *f = NULL;
+  ModelIOHeader header;
+  int frames_left;
+};
+
+// the frames of a recording, empty if it can't be read
+bool model_io_read(const std::string &path, ModelIOHeader *header, std::vector<ModelIOFrame> *frames);
@@ -21,8 +21,12 @@ def read(sz):
 def write(d):
   os.write(1, d.tobytes())
 
-def run_loop(m):
-  ishapes = [[1]+ii.shape[1:] for ii in m.get_inputs()]
+def run_loop(m, batch=1):
+  # frames of independent streams are stacked along the first dimension
+  for ii in m.get_inputs():
+    assert(batch == 1 or not isinstance(ii.shape[0], int) or ii.shape[0] == batch), \
+      f"{ii.name} has a fixed batch size of {ii.shape[0]}"
+  ishapes = [[batch]+ii.shape[1:] for ii in m.get_inputs()]
   keys = [x.name for x in m.get_inputs()]
   print("ready to run onnx model", keys, ishapes, file=sys.stderr)
   while 1:
@@ -61,4 +65,4 @@ if __name__ == "__main__":
 
   ort_session = ort.InferenceSession(sys.argv[1], options)
   ort_session.set_providers([provider], None)
-  run_loop(ort_session)
+  run_loop(ort_session, int(sys.argv[2]) if len(sys.argv) > 2 else 1)
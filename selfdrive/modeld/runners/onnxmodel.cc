@@ -14,11 +14,12 @@
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
 
-ONNXModel::ONNXModel(const char *path, float *_output, size_t _output_size, int runtime) {
+ONNXModel::ONNXModel(const char *path, float *_output, size_t _output_size, int runtime, int _batch) {
   LOGD("loading model %s", path);
 
   output = _output;
   output_size = _output_size;
+  batch = _batch;
 
   int err = pipe(pipein);
   assert(err == 0);
@@ -31,7 +32,8 @@ ONNXModel::ONNXModel(const char *path, float *_output, size_t _output_size, int
   proc_pid = fork();
   if (proc_pid == 0) {
     LOGD("spawning onnx process %s", onnx_runner.c_str());
-    char *argv[] = {(char*)onnx_runner.c_str(), (char*)path, nullptr};
+    std::string batch_arg = std::to_string(batch);
+    char *argv[] = {(char*)onnx_runner.c_str(), (char*)path, (char*)batch_arg.c_str(), nullptr};
     dup2(pipein[0], 0);
     dup2(pipeout[1], 1);
     close(pipein[0]);
@@ -101,16 +103,16 @@ void ONNXModel::addTrafficConvention(float *state, int state_size) {
 
 void ONNXModel::execute(float *net_input_buf, int buf_size) {
   // order must be this
-  pwrite(net_input_buf, buf_size);
+  pwrite(net_input_buf, buf_size * batch);
   if (desire_input_buf != NULL) {
-    pwrite(desire_input_buf, desire_state_size);
+    pwrite(desire_input_buf, desire_state_size * batch);
   }
   if (traffic_convention_input_buf != NULL) {
-    pwrite(traffic_convention_input_buf, traffic_convention_size);
+    pwrite(traffic_convention_input_buf, traffic_convention_size * batch);
   }
   if (rnn_input_buf != NULL) {
-    pwrite(rnn_input_buf, rnn_state_size);
+    pwrite(rnn_input_buf, rnn_state_size * batch);
   }
-  pread(output, output_size);
+  pread(output, output_size * batch);
 }
 
@@ -6,7 +6,9 @@
 
 class ONNXModel : public RunModel {
 public:
-  ONNXModel(const char *path, float *output, size_t output_size, int runtime);
+  // batch > 1 runs that many frames of independent streams at once, every
+  // buffer then holds batch times its size, one stream after the other
+  ONNXModel(const char *path, float *output, size_t output_size, int runtime, int batch = 1);
 	~ONNXModel();
   void addRecurrent(float *state, int state_size);
   void addDesire(float *state, int state_size);
@@ -14,6 +16,7 @@ public:
   void execute(float *net_input_buf, int buf_size);
 private:
   int proc_pid;
+  int batch;
 
   float *output;
   size_t output_size;
@@ -0,0 +1,122 @@
+#include "selfdrive/modeld/runners/onnxrtmodel.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "selfdrive/common/swaglog.h"
+
+static bool append_provider(Ort::SessionOptions &options, const char *name) {
+  try {
+    if (strcmp(name, "tensorrt") == 0) {
+      const OrtApi &api = Ort::GetApi();
+      OrtTensorRTProviderOptionsV2 *trt = nullptr;
+      Ort::ThrowOnError(api.CreateTensorRTProviderOptions(&trt));
+      // building the engine takes minutes, it's kept next to the other caches
+      const char *keys[] = {"device_id", "trt_engine_cache_enable", "trt_engine_cache_path"};
+      const char *values[] = {"0", "1", "/tmp/onnxrt_cache"};
+      Ort::ThrowOnError(api.UpdateTensorRTProviderOptions(trt, keys, values, 3));
+      options.AppendExecutionProvider_TensorRT_V2(*trt);
+      api.ReleaseTensorRTProviderOptions(trt);
+    } else {
+      OrtCUDAProviderOptions cuda;
+      cuda.device_id = 0;
+      options.AppendExecutionProvider_CUDA(cuda);
+    }
+  } catch (const Ort::Exception &e) {
+    LOGW("onnxruntime: no %s execution provider: %s", name, e.what());
+    return false;
+  }
+  return true;
+}
+
+ONNXRTModel::ONNXRTModel(const char *path, float *_output, size_t _output_size, int runtime)
+  : env(ORT_LOGGING_LEVEL_WARNING, "modeld"), output(_output), output_size(_output_size) {
+  LOGD("loading model %s", path);
+
+  Ort::SessionOptions options;
+  options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+  // TensorRT first where there is one, it hands what it can't run to CUDA
+#ifdef XNX
+  append_provider(options, "tensorrt");
+#endif
+  const bool gpu = append_provider(options, "cuda");
+  session = Ort::Session(env, path, options);
+
+  // without a GPU pinned memory doesn't exist, plain CPU buffers are as good
+  pinned_info = gpu ? Ort::MemoryInfo("CudaPinned", OrtDeviceAllocator, 0, OrtMemTypeCPUOutput)
+                    : Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault);
+  pinned = std::make_unique<Ort::Allocator>(session, pinned_info);
+  LOGW("onnxruntime: loaded %s, %s", path, gpu ? "cuda" : "cpu");
+}
+
+ONNXRTModel::~ONNXRTModel() {
+  binding.reset();
+  tensors.clear();
+  for (float *buf : pinned_bufs) {
+    pinned->Free(buf);
+  }
+}
+
+void ONNXRTModel::addRecurrent(float *state, int state_size) {
+  recurrent = {state, (size_t)state_size};
+}
+
+void ONNXRTModel::addDesire(float *state, int state_size) {
+  desire = {state, (size_t)state_size};
+}
+
+void ONNXRTModel::addTrafficConvention(float *state, int state_size) {
+  traffic_convention = {state, (size_t)state_size};
+}
+
+float *ONNXRTModel::pinned_alloc(size_t size) {
+  float *buf = (float *)pinned->Alloc(size * sizeof(float));
+  assert(buf != NULL);
+  pinned_bufs.push_back(buf);
+  return buf;
+}
+
+void ONNXRTModel::bind(int buf_size) {
+  binding = std::make_unique<Ort::IoBinding>(session);
+
+  std::vector<Input> order = {{NULL, (size_t)buf_size}};
+  for (const Input &in : {desire, traffic_convention, recurrent}) {
+    if (in.src != NULL) order.push_back(in);
+  }
+  assert(order.size() == session.GetInputCount());
+
+  Ort::AllocatorWithDefaultOptions allocator;
+  for (int i = 0; i < order.size(); i++) {
+    auto shape = session.GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+    size_t count = 1;
+    for (auto &d : shape) {
+      if (d < 0) d = 1;  // batch
+      count *= d;
+    }
+    assert(count == order[i].size);
+
+    float *buf = pinned_alloc(count);
+    tensors.push_back(Ort::Value::CreateTensor<float>(pinned_info, buf, count, shape.data(), shape.size()));
+    binding->BindInput(session.GetInputNameAllocated(i, allocator).get(), tensors.back());
+    inputs.push_back({order[i], buf});
+  }
+
+  assert(session.GetOutputCount() == 1);
+  auto shape = session.GetOutputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+  for (auto &d : shape) {
+    if (d < 0) d = 1;
+  }
+  pinned_output = pinned_alloc(output_size);
+  tensors.push_back(Ort::Value::CreateTensor<float>(pinned_info, pinned_output, output_size, shape.data(), shape.size()));
+  binding->BindOutput(session.GetOutputNameAllocated(0, allocator).get(), tensors.back());
+}
+
+void ONNXRTModel::execute(float *net_input_buf, int buf_size) {
+  if (!binding) bind(buf_size);
+
+  for (auto &[in, buf] : inputs) {
+    memcpy(buf, in.src != NULL ? in.src : net_input_buf, in.size * sizeof(float));
+  }
+  session.Run(Ort::RunOptions{nullptr}, *binding);
+  memcpy(output, pinned_output, output_size * sizeof(float));
+}
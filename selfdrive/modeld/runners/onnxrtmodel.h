@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <onnxruntime_cxx_api.h>
+
+#include "selfdrive/modeld/runners/runmodel.h"
+
+// Runs the model with ONNX Runtime in this process. Inputs and the output are
+// bound once to pinned host buffers, so with the TensorRT or CUDA execution
+// provider every run is a copy into pinned memory, the DMA and the compute
+class ONNXRTModel : public RunModel {
+public:
+  ONNXRTModel(const char *path, float *output, size_t output_size, int runtime);
+  ~ONNXRTModel();
+  void addRecurrent(float *state, int state_size);
+  void addDesire(float *state, int state_size);
+  void addTrafficConvention(float *state, int state_size);
+  void execute(float *net_input_buf, int buf_size);
+
+private:
+  struct Input {
+    float *src;  // where the caller keeps it, NULL for the image
+    size_t size;
+  };
+  void bind(int buf_size);
+  float *pinned_alloc(size_t size);
+
+  Ort::Env env;
+  Ort::Session session{nullptr};
+  Ort::MemoryInfo pinned_info{nullptr};
+  std::unique_ptr<Ort::Allocator> pinned;
+  std::unique_ptr<Ort::IoBinding> binding;
+  std::vector<Ort::Value> tensors;
+  std::vector<float *> pinned_bufs;
+
+  float *output;
+  size_t output_size;
+  float *pinned_output = NULL;
+
+  // same order as the inputs of the model, like onnx_runner.py takes them
+  Input desire = {}, traffic_convention = {}, recurrent = {};
+  std::vector<std::pair<Input, float *>> inputs;
+};
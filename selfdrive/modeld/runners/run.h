@@ -8,3 +8,11 @@
 #elif defined(USE_ONNX_MODEL)
 #include "onnxmodel.h"
 #endif
+
+#ifdef USE_ONNXRT
+#include "onnxrtmodel.h"
+#endif
+
+#ifdef USE_TENSORRT
+#include "trtmodel.h"
+#endif
@@ -1,9 +1,37 @@
 #pragma once
+
+#include <functional>
+
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
 class RunModel {
 public:
   virtual void addRecurrent(float *state, int state_size) {}
   virtual void addDesire(float *state, int state_size) {}
   virtual void addTrafficConvention(float *state, int state_size) {}
+  // the GPU buffer the model reads its image input from, if the image can be
+  // written there directly. execute then gets a NULL net_input_buf
+  virtual cl_mem *getInputBuf() { return nullptr; }
+  // the same as a CUDA device pointer, on the Jetson
+  virtual float *getInputBufCuda() { return nullptr; }
   virtual void execute(float *net_input_buf, int buf_size) {}
+  // execute without waiting for it, done is called once the outputs are
+  // written, possibly from another thread. Inputs and outputs belong to the
+  // model until then, wait() blocks until the last run is done
+  virtual void executeAsync(float *net_input_buf, int buf_size, std::function<void()> done) {
+    execute(net_input_buf, buf_size);
+    done();
+  }
+  virtual void wait() {}
+  // a model may keep the recurrent state on the GPU between runs, this brings
+  // the addRecurrent buffer up to date for when the host reads it
+  virtual void syncRecurrent() {}
+  // a model that has to give way to others on the GPU, e.g. a shadow model
+  virtual void setBackground(bool background) {}
 };
 
@@ -6,6 +6,8 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <DiagLog/IDiagLog.hpp>
+
 #include "selfdrive/common/util.h"
 
 void PrintErrorStringAndExit() {
@@ -36,6 +38,11 @@ SNPEModel::SNPEModel(const char *path, float *loutput, size_t loutput_size, int
 
   // create model runner
   zdl::SNPE::SNPEBuilder snpeBuilder(container.get());
+  // per layer timings go to DiagLog files for snpe-diagview
+  const char *profile_dir = getenv("SNPE_PROFILE_DIR");
+  if (profile_dir != NULL) {
+    snpeBuilder.setProfilingLevel(zdl::DlSystem::ProfilingLevel_t::DETAILED);
+  }
   while (!snpe) {
 #if defined(QCOM) || defined(QCOM2)
     snpe = snpeBuilder.setOutputLayers({})
@@ -52,6 +59,17 @@ SNPEModel::SNPEModel(const char *path, float *loutput, size_t loutput_size, int
     if (!snpe) std::cerr << zdl::DlSystem::getLastErrorString() << std::endl;
   }
 
+  if (profile_dir != NULL) {
+    auto diag_log = snpe->getDiagLogInterface();
+    if (diag_log) {
+      zdl::DiagLog::Options options = (*diag_log)->getOptions();
+      options.LogFileDirectory = profile_dir;
+      (*diag_log)->setOptions(options);
+      (*diag_log)->start();
+      printf("snpe profiling to %s\n", profile_dir);
+    }
+  }
+
   // get input and output names
   const auto &strListi_opt = snpe->getInputTensorNames();
   if (!strListi_opt) throw std::runtime_error("Error obtaining Input tensor names");
@@ -136,13 +154,75 @@ std::unique_ptr<zdl::DlSystem::IUserBuffer> SNPEModel::addExtra(float *state, in
   return ret;
 }
 
+// snpe itself reads host memory, only the recorded thneed takes the image on the GPU
+cl_mem *SNPEModel::getInputBuf() {
+#ifdef USE_THNEED
+  if (Runtime == zdl::DlSystem::Runtime_t::GPU && thneed != NULL && thneed->input_clmem.size() > 3) {
+    return &thneed->input_clmem[3];
+  }
+#endif
+  return nullptr;
+}
+
+SNPEModel::~SNPEModel() {
+  if (async_thread.joinable()) {
+    {
+      std::lock_guard lk(async_lock);
+      async_exit = true;
+    }
+    async_cv.notify_all();
+    async_thread.join();
+  }
+}
+
+void SNPEModel::exec_thread() {
+  std::unique_lock lk(async_lock);
+  while (true) {
+    async_cv.wait(lk, [&] { return async_exit || async_input != NULL; });
+    if (async_input == NULL) break;
+
+    float *input = async_input;
+    lk.unlock();
+    run(input);
+    async_done();
+    lk.lock();
+
+    async_input = NULL;
+    async_busy = false;
+    async_cv.notify_all();
+  }
+}
+
+void SNPEModel::executeAsync(float *net_input_buf, int buf_size, std::function<void()> done) {
+  std::unique_lock lk(async_lock);
+  async_cv.wait(lk, [&] { return !async_busy; });
+  if (!async_thread.joinable()) {
+    async_thread = std::thread(&SNPEModel::exec_thread, this);
+  }
+  async_busy = true;
+  async_input = net_input_buf;
+  async_done = std::move(done);
+  async_cv.notify_all();
+}
+
+void SNPEModel::wait() {
+  std::unique_lock lk(async_lock);
+  async_cv.wait(lk, [&] { return !async_busy; });
+}
+
 void SNPEModel::execute(float *net_input_buf, int buf_size) {
+  wait();
+  run(net_input_buf);
+}
+
+void SNPEModel::run(float *net_input_buf) {
 #ifdef USE_THNEED
   if (Runtime == zdl::DlSystem::Runtime_t::GPU) {
     float *inputs[4] = {recurrent, trafficConvention, desire, net_input_buf};
     if (thneed == NULL) {
       bool ret = inputBuffer->setBufferAddress(net_input_buf);
       assert(ret == true);
+      bound_input = net_input_buf;
       if (!snpe->execute(inputMap, outputMap)) {
         PrintErrorStringAndExit();
       }
@@ -175,8 +255,11 @@ void SNPEModel::execute(float *net_input_buf, int buf_size) {
     }
   } else {
 #endif
-    bool ret = inputBuffer->setBufferAddress(net_input_buf);
-    assert(ret == true);
+    if (net_input_buf != bound_input) {
+      bool ret = inputBuffer->setBufferAddress(net_input_buf);
+      assert(ret == true);
+      bound_input = net_input_buf;
+    }
     if (!snpe->execute(inputMap, outputMap)) {
       PrintErrorStringAndExit();
     }
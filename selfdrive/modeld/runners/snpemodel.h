@@ -1,5 +1,10 @@
 #pragma once
 
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 #include <DlContainer/IDlContainer.hpp>
 #include <DlSystem/DlError.hpp>
 #include <DlSystem/ITensor.hpp>
@@ -23,18 +28,33 @@
 class SNPEModel : public RunModel {
 public:
   SNPEModel(const char *path, float *loutput, size_t loutput_size, int runtime);
+  ~SNPEModel();
   void addRecurrent(float *state, int state_size);
   void addTrafficConvention(float *state, int state_size);
   void addDesire(float *state, int state_size);
+  cl_mem *getInputBuf();
   void execute(float *net_input_buf, int buf_size);
+  void executeAsync(float *net_input_buf, int buf_size, std::function<void()> done);
+  void wait();
 
 #ifdef USE_THNEED
   Thneed *thneed = NULL;
 #endif
 
 private:
+  void run(float *net_input_buf);
+  void exec_thread();
+
   std::string model_data;
 
+  // executeAsync runs one model at a time on exec_thread
+  std::thread async_thread;
+  std::mutex async_lock;
+  std::condition_variable async_cv;
+  bool async_busy = false, async_exit = false;
+  float *async_input = NULL;
+  std::function<void()> async_done;
+
 #if defined(QCOM) || defined(QCOM2)
   zdl::DlSystem::Runtime_t Runtime;
 #endif
@@ -45,6 +65,7 @@ private:
   // snpe input stuff
   zdl::DlSystem::UserBufferMap inputMap;
   std::unique_ptr<zdl::DlSystem::IUserBuffer> inputBuffer;
+  float *bound_input = NULL;  // set once, the ModelFrame buffer doesn't change
 
   // snpe output stuff
   zdl::DlSystem::UserBufferMap outputMap;
@@ -11,10 +11,16 @@ ThneedModel::ThneedModel(const char *path, float *loutput, size_t loutput_size,
 
   recorded = false;
   output = loutput;
+  output_size = loutput_size;
+}
+
+void ThneedModel::setBackground(bool background) {
+  thneed->priority = background ? THNEED_PRIORITY_LOW : THNEED_PRIORITY_HIGH;
 }
 
 void ThneedModel::addRecurrent(float *state, int state_size) {
   recurrent = state;
+  recurrent_size = state_size;
 }
 
 void ThneedModel::addTrafficConvention(float *state, int state_size) {
@@ -25,6 +31,11 @@ void ThneedModel::addDesire(float *state, int state_size) {
   desire = state;
 }
 
+// the image is the last of the inputs
+cl_mem *ThneedModel::getInputBuf() {
+  return thneed->input_clmem.size() > 3 ? &thneed->input_clmem[3] : nullptr;
+}
+
 void ThneedModel::execute(float *net_input_buf, int buf_size) {
   float *inputs[4] = {recurrent, trafficConvention, desire, net_input_buf};
   if (!recorded) {
@@ -33,6 +44,10 @@ void ThneedModel::execute(float *net_input_buf, int buf_size) {
     thneed->clexec();
     thneed->copy_output(output);
     thneed->stop();
+    if (recurrent != NULL) {
+      assert(recurrent == &output[output_size - recurrent_size]);
+      thneed->set_feedback(0, output_size - recurrent_size);
+    }
 
     recorded = true;
   } else {
@@ -40,3 +55,6 @@ void ThneedModel::execute(float *net_input_buf, int buf_size) {
   }
 }
 
+void ThneedModel::syncRecurrent() {
+  if (recorded && recurrent != NULL) thneed->read_feedback(recurrent);
+}
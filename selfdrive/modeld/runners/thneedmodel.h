@@ -9,16 +9,22 @@ public:
   void addRecurrent(float *state, int state_size);
   void addTrafficConvention(float *state, int state_size);
   void addDesire(float *state, int state_size);
+  cl_mem *getInputBuf();
   void execute(float *net_input_buf, int buf_size);
+  void syncRecurrent();
+  void setBackground(bool background);
 private:
   Thneed *thneed = NULL;
   bool recorded;
 
   float *output;
+  size_t output_size;
 
-  // recurrent and desire
-  float *recurrent;
-  float *trafficConvention;
-  float *desire;
+  // recurrent and desire. The recurrent state is at the end of the output and
+  // stays on the GPU after the first run
+  float *recurrent = NULL;
+  int recurrent_size = 0;
+  float *trafficConvention = NULL;
+  float *desire = NULL;
 };
 
@@ -0,0 +1,193 @@
+#include "selfdrive/modeld/runners/trtmodel.h"
+
+#include <sys/stat.h>
+
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include <NvOnnxParser.h>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+// building an engine takes minutes, it's kept next to the onnxruntime ones
+#define TRT_CACHE_DIR "/tmp/trt_cache"
+
+namespace {
+
+class Logger : public nvinfer1::ILogger {
+  void log(Severity severity, const char *msg) noexcept override {
+    if (severity <= Severity::kERROR) {
+      LOGE("tensorrt: %s", msg);
+    } else if (severity == Severity::kWARNING) {
+      LOGW("tensorrt: %s", msg);
+    } else if (severity == Severity::kINFO) {
+      LOGD("tensorrt: %s", msg);
+    }
+  }
+} logger;
+
+bool has_suffix(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+long mtime(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+}
+
+std::string build_engine(const char *onnx_path) {
+  std::unique_ptr<nvinfer1::IBuilder> builder(nvinfer1::createInferBuilder(logger));
+  const auto flags = 1U << static_cast<uint32_t>(nvinfer1::NetworkDefinitionCreationFlag::kEXPLICIT_BATCH);
+  std::unique_ptr<nvinfer1::INetworkDefinition> network(builder->createNetworkV2(flags));
+  std::unique_ptr<nvonnxparser::IParser> parser(nvonnxparser::createParser(*network, logger));
+  if (!parser->parseFromFile(onnx_path, (int)nvinfer1::ILogger::Severity::kWARNING)) {
+    LOGE("tensorrt: can't parse %s", onnx_path);
+    return "";
+  }
+
+  std::unique_ptr<nvinfer1::IBuilderConfig> config(builder->createBuilderConfig());
+  config->setMaxWorkspaceSize(256 << 20);
+  if (builder->platformHasFastFp16()) {
+    config->setFlag(nvinfer1::BuilderFlag::kFP16);
+  }
+  std::unique_ptr<nvinfer1::IHostMemory> plan(builder->buildSerializedNetwork(*network, *config));
+  if (!plan) {
+    LOGE("tensorrt: can't build an engine for %s", onnx_path);
+    return "";
+  }
+  return std::string((const char *)plan->data(), plan->size());
+}
+
+// the engine of a .engine file, or of an .onnx file from the cache, built if
+// the cached one is older than the model
+std::string load_engine(const char *path) {
+  if (has_suffix(path, ".engine")) {
+    return util::read_file(path);
+  }
+
+  const std::string cache_path = std::string(TRT_CACHE_DIR) + "/" + util::base_name(path) + ".engine";
+  if (util::file_exists(cache_path) && mtime(cache_path) >= mtime(path)) {
+    return util::read_file(cache_path);
+  }
+
+  LOGW("tensorrt: building an engine for %s, this takes a while", path);
+  std::string engine = build_engine(path);
+  if (!engine.empty()) {
+    mkdir(TRT_CACHE_DIR, 0775);
+    if (util::write_file(cache_path.c_str(), engine.data(), engine.size(), O_WRONLY | O_CREAT | O_TRUNC) != 0) {
+      LOGW("tensorrt: can't cache the engine at %s", cache_path.c_str());
+    }
+  }
+  return engine;
+}
+
+}  // namespace
+
+TRTModel::TRTModel(const char *path, float *_output, size_t _output_size, int runtime_)
+  : output(_output), output_size(_output_size) {
+  LOGD("loading model %s", path);
+
+  const std::string plan = load_engine(path);
+  assert(!plan.empty());
+  runtime.reset(nvinfer1::createInferRuntime(logger));
+  engine.reset(runtime->deserializeCudaEngine(plan.data(), plan.size()));
+  assert(engine);
+  context.reset(engine->createExecutionContext());
+  assert(context);
+
+  cudaError_t err = cudaStreamCreate(&stream);
+  assert(err == cudaSuccess);
+
+  // every binding in mapped host memory, zeroed so the first frame sees a
+  // black previous one like the other runners
+  for (int i = 0; i < engine->getNbBindings(); i++) {
+    const nvinfer1::Dims dims = engine->getBindingDimensions(i);
+    size_t size = 1;
+    for (int d = 0; d < dims.nbDims; d++) {
+      size *= dims.d[d] < 0 ? 1 : dims.d[d];  // batch
+    }
+
+    Binding b = {.size = size};
+    err = cudaHostAlloc((void **)&b.host, size * sizeof(float), cudaHostAllocMapped);
+    assert(err == cudaSuccess);
+    err = cudaHostGetDevicePointer((void **)&b.device, b.host, 0);
+    assert(err == cudaSuccess);
+    memset(b.host, 0, size * sizeof(float));
+
+    if (engine->bindingIsInput(i)) {
+      if (image < 0) image = i;
+    } else {
+      assert(out < 0);
+      out = i;
+    }
+    bindings.push_back(b);
+    device_ptrs.push_back(b.device);
+  }
+  assert(image >= 0 && out >= 0);
+  assert(bindings[out].size == output_size);
+  LOGW("tensorrt: loaded %s, %d bindings", path, (int)bindings.size());
+}
+
+TRTModel::~TRTModel() {
+  context.reset();
+  engine.reset();
+  runtime.reset();
+  for (auto &b : bindings) {
+    cudaFreeHost(b.host);
+  }
+  if (stream) cudaStreamDestroy(stream);
+}
+
+void TRTModel::addRecurrent(float *state, int state_size) {
+  recurrent = {.src = state, .size = (size_t)state_size};
+}
+
+void TRTModel::addDesire(float *state, int state_size) {
+  desire = {.src = state, .size = (size_t)state_size};
+}
+
+void TRTModel::addTrafficConvention(float *state, int state_size) {
+  traffic_convention = {.src = state, .size = (size_t)state_size};
+}
+
+float *TRTModel::getInputBufCuda() {
+  return bindings[image].device;
+}
+
+// the inputs after the image get what was added, in the order the model takes them
+void TRTModel::bind() {
+  std::vector<Binding> order;
+  for (const Binding &in : {desire, traffic_convention, recurrent}) {
+    if (in.src != NULL) order.push_back(in);
+  }
+
+  int n = 0;
+  for (int i = 0; i < bindings.size(); i++) {
+    if (i == image || i == out) continue;
+    assert(n < order.size() && order[n].size == bindings[i].size);
+    bindings[i].src = order[n++].src;
+  }
+  assert(n == order.size());
+  inputs_bound = true;
+}
+
+void TRTModel::execute(float *net_input_buf, int buf_size) {
+  if (!inputs_bound) bind();
+
+  // NULL when the image was written to getInputBufCuda already
+  if (net_input_buf != NULL) {
+    assert(buf_size == bindings[image].size);
+    memcpy(bindings[image].host, net_input_buf, buf_size * sizeof(float));
+  }
+  for (auto &b : bindings) {
+    if (b.src != NULL) memcpy(b.host, b.src, b.size * sizeof(float));
+  }
+
+  const bool ok = context->enqueueV2(device_ptrs.data(), stream, nullptr);
+  assert(ok);
+  cudaError_t err = cudaStreamSynchronize(stream);
+  assert(err == cudaSuccess);
+  memcpy(output, bindings[out].host, output_size * sizeof(float));
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <NvInfer.h>
+#include <cuda_runtime.h>
+
+#include "selfdrive/modeld/runners/runmodel.h"
+
+// Runs the model with TensorRT in this process, on the Jetson. A .engine file
+// is deserialized as is, an .onnx file is built into an engine the first time
+// and the engine is cached. Every input and the output is host memory mapped
+// into CUDA, which on the Jetson is the same memory: the image can be warped
+// straight into the model input, see getInputBufCuda
+class TRTModel : public RunModel {
+public:
+  TRTModel(const char *path, float *output, size_t output_size, int runtime);
+  ~TRTModel();
+  void addRecurrent(float *state, int state_size);
+  void addDesire(float *state, int state_size);
+  void addTrafficConvention(float *state, int state_size);
+  float *getInputBufCuda();
+  void execute(float *net_input_buf, int buf_size);
+
+private:
+  struct Binding {
+    float *src;  // where the caller keeps an input, NULL for the image and the output
+    size_t size;
+    float *host, *device;
+  };
+  void bind();
+
+  std::unique_ptr<nvinfer1::IRuntime> runtime;
+  std::unique_ptr<nvinfer1::ICudaEngine> engine;
+  std::unique_ptr<nvinfer1::IExecutionContext> context;
+  cudaStream_t stream = nullptr;
+
+  float *output;
+  size_t output_size;
+
+  // same order as the inputs of the model, like onnx_runner.py takes them
+  Binding desire = {}, traffic_convention = {}, recurrent = {};
+  std::vector<Binding> bindings;  // in the engine's order
+  std::vector<void *> device_ptrs;
+  int image = -1, out = -1;  // index in bindings
+  bool inputs_bound = false;
+};
@@ -1,4 +1,6 @@
+#include <cstdlib>
 #include <cstring>
+#include <string>
 
 #include "selfdrive/modeld/runners/snpemodel.h"
 #include "selfdrive/modeld/thneed/thneed.h"
@@ -27,8 +29,31 @@ int main(int argc, char* argv[]) {
   memset(output, 0, OUTPUT_SIZE * sizeof(float));
   mdl.execute(input, 0);
 
+  bool save_binaries = false, fuse = false, optimize = false;
+  int profile_iterations = 0;
+  for (int i = 3; i < argc; i++) {
+    save_binaries |= strcmp(argv[i], "--binary") == 0;
+    fuse |= strcmp(argv[i], "--fuse") == 0;
+    optimize |= strcmp(argv[i], "--optimize") == 0;
+    if (strncmp(argv[i], "--profile=", 10) == 0) profile_iterations = atoi(argv[i] + 10);
+  }
+
+  // the optimized variant is only written if it matches the recorded run
+  if (fuse && mdl.thneed->fuse() < 0) {
+    printf("not saving %s\n", argv[2]);
+    return 0;
+  }
+  if (optimize && mdl.thneed->optimize() < 0) {
+    printf("not saving %s\n", argv[2]);
+    return 0;
+  }
+
+  // per kernel timings of the model as it's saved, json for comparing models
+  if (profile_iterations > 0) {
+    mdl.thneed->profile(profile_iterations, (std::string(argv[2]) + ".profile.json").c_str());
+  }
+
   // save model
-  bool save_binaries = (argc > 3) && (strcmp(argv[3], "--binary") == 0);
   mdl.thneed->save(argv[2], save_binaries);
   return 0;
 }
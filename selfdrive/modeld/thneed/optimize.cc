@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <regex>
+#include <vector>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/modeld/thneed/thneed.h"
+
+#define OPTIMIZE_RUNS 5
+// a retuned kernel is kept if it's at least this much faster
+#define OPTIMIZE_MIN_GAIN 0.95
+// outputs may differ by the rounding of a different reduction order
+#define OPTIMIZE_TOLERANCE 1e-3
+
+static uint64_t time_kernel(CLQueuedKernel *k, cl_command_queue q) {
+  // warm up, the first run after a change compiles and caches
+  if (k->exec() != CL_SUCCESS) return UINT64_MAX;
+  clFinish(q);
+
+  uint64_t tb = nanos_since_boot();
+  for (int i = 0; i < OPTIMIZE_RUNS; i++) k->exec();
+  clFinish(q);
+  return (nanos_since_boot() - tb) / OPTIMIZE_RUNS;
+}
+
+// local work sizes next to the recorded one, halved and doubled in each
+// dimension, that divide the global size and fit in a work group
+static vector<vector<size_t> > candidate_sizes(CLQueuedKernel *k, size_t max_group_size) {
+  vector<vector<size_t> > ret = {{}};
+  for (int d = 0; d < k->work_dim; d++) {
+    vector<vector<size_t> > next;
+    const size_t l = k->local_work_size[d];
+    for (size_t s : {l / 2, l, l * 2}) {
+      if (s == 0 || k->global_work_size[d] % s != 0) continue;
+      for (auto c : ret) {
+        c.push_back(s);
+        next.push_back(c);
+      }
+    }
+    ret = next;
+  }
+
+  vector<vector<size_t> > valid;
+  for (auto &c : ret) {
+    size_t group_size = 1;
+    for (size_t s : c) group_size *= s;
+    if (group_size <= max_group_size) valid.push_back(c);
+  }
+  return valid;
+}
+
+vector<float> Thneed::run_reference() {
+  size_t sz;
+  clGetMemObjectInfo(output, CL_MEM_SIZE, sizeof(sz), &sz, NULL);
+  vector<float> out(sz / sizeof(float));
+  clexec();
+  copy_output(out.data());
+  return out;
+}
+
+// Specializes the kernels of a recorded model for the device it runs on, by
+// timing local work sizes around the ones SNPE picked. The tuned sizes end up
+// in a thneed saved afterwards. The model is run on the inputs as recorded
+// before and after, and everything is reverted if the outputs don't match.
+// Returns the number of kernels changed, or -1 if it was reverted
+int Thneed::optimize() {
+  assert(output != NULL);
+  const vector<float> reference = run_reference();
+
+  vector<size_t> recorded;
+  for (auto &k : kq) {
+    recorded.insert(recorded.end(), k->local_work_size, k->local_work_size + 3);
+  }
+
+  size_t device_max;
+  clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(device_max), &device_max, NULL);
+
+  int changed = 0;
+  uint64_t total_before = 0, total_after = 0;
+  for (auto &k : kq) {
+    k->exec();  // creates the kernel of a loaded thneed
+    size_t max_group_size;
+    clGetKernelWorkGroupInfo(k->kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, NULL);
+    max_group_size = std::min(max_group_size, device_max);
+
+    const vector<size_t> orig(k->local_work_size, k->local_work_size + k->work_dim);
+    const uint64_t orig_time = time_kernel(k.get(), command_queue);
+    vector<size_t> best = orig;
+    uint64_t best_time = orig_time;
+
+    for (auto &c : candidate_sizes(k.get(), max_group_size)) {
+      if (c == orig) continue;
+      std::copy(c.begin(), c.end(), k->local_work_size);
+      uint64_t t = time_kernel(k.get(), command_queue);
+      if (t < best_time) {
+        best = c;
+        best_time = t;
+      }
+    }
+
+    if (best != orig && best_time < orig_time * OPTIMIZE_MIN_GAIN) {
+      std::copy(best.begin(), best.end(), k->local_work_size);
+      changed++;
+    } else {
+      std::copy(orig.begin(), orig.end(), k->local_work_size);
+      best_time = orig_time;
+    }
+    total_before += orig_time;
+    total_after += best_time;
+
+    if (record & THNEED_DEBUG) {
+      printf("optimize %56s: %7lu -> %7lu ns\n", k->name.c_str(), orig_time, best_time);
+    }
+  }
+
+  const vector<float> out = run_reference();
+  float max_err = 0;
+  for (int i = 0; i < out.size(); i++) {
+    max_err = std::max(max_err, std::abs(out[i] - reference[i]) / std::max(1.f, std::abs(reference[i])));
+  }
+  printf("Thneed::optimize: retuned %d of %zu kernels, %lu -> %lu us, max error %e\n",
+         changed, kq.size(), total_before / 1000, total_after / 1000, max_err);
+
+  if (!(max_err <= OPTIMIZE_TOLERANCE)) {
+    printf("Thneed::optimize: outputs don't match the recorded run, reverting\n");
+    int i = 0;
+    for (auto &k : kq) {
+      std::copy(&recorded[i], &recorded[i + 3], k->local_work_size);
+      i += 3;
+    }
+    return -1;
+  }
+  return changed;
+}
+
+// *********** kernel fusion ***********
+
+extern map<cl_program, string> g_program_source;
+
+// kernels that read their inputs only at the coordinate they write
+static const char *POINTWISE_KERNELS[] = {"elementwise", "relu", "activation", "add", "sum", "mul", "sigmoid", "tanh"};
+
+static bool is_pointwise(const string &name) {
+  if (name.find("conv") != string::npos || name.find("pool") != string::npos) return false;
+  for (auto p : POINTWISE_KERNELS) {
+    if (name.find(p) != string::npos) return true;
+  }
+  return false;
+}
+
+static string build_options(cl_program program, cl_device_id device_id) {
+  size_t len = 0;
+  clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_OPTIONS, 0, NULL, &len);
+  string options(len, '\0');
+  clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_OPTIONS, len, options.data(), NULL);
+  return options.c_str();
+}
+
+// Turns "__kernel void name(params) {" in src into a plain function named
+// body_name, and returns its parameters with every name prefixed, or an
+// empty list if the kernel isn't found
+static vector<string> kernel_to_function(string &src, const string &name, const string &body_name, const string &prefix) {
+  std::smatch m;
+  if (!std::regex_search(src, m, std::regex("__kernel\\s+(__attribute__\\s*\\(\\(.*?\\)\\)\\s*)?void\\s+" + name + "\\s*\\("))) return {};
+
+  const size_t params_start = m.position(0) + m.length(0);
+  size_t params_end = params_start;
+  for (int depth = 1; depth > 0 && params_end < src.size(); params_end++) {
+    if (src[params_end] == '(') depth++;
+    if (src[params_end] == ')') depth--;
+  }
+  const string params = src.substr(params_start, params_end - 1 - params_start);
+  src.replace(m.position(0), m.length(0), "void " + body_name + "(");
+
+  vector<string> ret;
+  size_t start = 0;
+  for (size_t i = 0; i <= params.size(); i++) {
+    if (i == params.size() || params[i] == ',') {
+      string p = params.substr(start, i - start);
+      size_t end = p.find_last_not_of(" \t\n");
+      size_t begin = p.find_last_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", end);
+      if (end == string::npos || begin == string::npos) return {};
+      ret.push_back(p.substr(0, begin + 1) + prefix + p.substr(begin + 1, end - begin));
+      start = i + 1;
+    }
+  }
+  return ret;
+}
+
+// a kernel running b after a in each work item, or NULL if they can't be fused
+shared_ptr<CLQueuedKernel> Thneed::fuse_pair(CLQueuedKernel *a, CLQueuedKernel *b) {
+  string a_src = g_program_source[a->program], b_src = g_program_source[b->program];
+  if (a_src.empty() || b_src.empty()) return NULL;  // loaded from binaries
+  const string options = build_options(a->program, device_id);
+  if (options != build_options(b->program, device_id)) return NULL;
+
+  const string name = a->name + "__" + b->name;
+  vector<string> a_params = kernel_to_function(a_src, a->name, a->name + "_body", "a_");
+  if (a->program == b->program) b_src = a_src;
+  vector<string> b_params = kernel_to_function(b_src, b->name, b->name + "_body", "b_");
+  if (a_params.size() != a->num_args || b_params.size() != b->num_args) return NULL;
+
+  string src = (a->program == b->program) ? b_src : a_src + "\n" + b_src;
+  string sig, a_call, b_call;
+  for (int i = 0; i < a->num_args; i++) {
+    sig += (i ? ", " : "") + a_params[i];
+    a_call += string(i ? ", " : "") + "a_" + a->arg_names[i];
+  }
+  for (int i = 0; i < b->num_args; i++) {
+    sig += ", " + b_params[i];
+    b_call += string(i ? ", " : "") + "b_" + b->arg_names[i];
+  }
+  src += "\n__kernel void " + name + "(" + sig + ") {\n"
+         "  " + a->name + "_body(" + a_call + ");\n"
+         "  mem_fence(CLK_GLOBAL_MEM_FENCE);\n"
+         "  " + b->name + "_body(" + b_call + ");\n"
+         "}\n";
+
+  const char *srcs[1] = {src.c_str()};
+  size_t length = src.size();
+  cl_program program = clCreateProgramWithSource(context, 1, srcs, &length, NULL);
+  if (clBuildProgram(program, 1, &device_id, options.c_str(), NULL, NULL) != CL_SUCCESS) {
+    if (record & THNEED_DEBUG) printf("fuse %s: build failed\n", name.c_str());
+    clReleaseProgram(program);
+    return NULL;
+  }
+  g_program_source[program] = src;
+
+  auto k = make_shared<CLQueuedKernel>(this);
+  k->name = name;
+  k->program = program;
+  k->work_dim = a->work_dim;
+  std::copy(a->global_work_size, a->global_work_size + 3, k->global_work_size);
+  std::copy(a->local_work_size, a->local_work_size + 3, k->local_work_size);
+  k->num_args = a->num_args + b->num_args;
+  for (auto *src_k : {a, b}) {
+    k->args.insert(k->args.end(), src_k->args.begin(), src_k->args.end());
+    k->args_size.insert(k->args_size.end(), src_k->args_size.begin(), src_k->args_size.end());
+  }
+  return k;
+}
+
+// Fuses a pointwise kernel into the kernel before it when that one's output
+// is read by nothing else and both run the same work items. That saves a
+// launch, and the intermediate is read back by the work item which wrote it
+// while it is still in cache. Checked against the recorded run like optimize.
+// Returns the number of fused pairs, or -1 if it was reverted
+int Thneed::fuse() {
+  assert(output != NULL);
+  const vector<float> reference = run_reference();
+
+  // readers of every buffer, to know which intermediates are private to a pair
+  map<string, int> readers;
+  auto is_output = [](const CLQueuedKernel *k, int i) { return k->arg_names[i].find("output") != string::npos; };
+  for (auto &k : kq) {
+    for (int i = 0; i < k->num_args; i++) {
+      if (k->args_size[i] == 8 && !is_output(k.get(), i)) readers[k->args[i]]++;
+    }
+  }
+  const string model_output((char *)&output, sizeof(output));
+
+  vector<shared_ptr<CLQueuedKernel> > fused;
+  int pairs = 0;
+  for (int i = 0; i < kq.size(); i++) {
+    CLQueuedKernel *a = kq[i].get();
+    CLQueuedKernel *b = (i + 1 < kq.size()) ? kq[i + 1].get() : NULL;
+
+    // find_inputs_outputs looks for these by name
+    bool fusible = b != NULL && a->name != "zero_pad_image_float" && b->name != "image2d_to_buffer_float" &&
+                   is_pointwise(b->name) && a->work_dim == b->work_dim &&
+                   std::equal(a->global_work_size, a->global_work_size + 3, b->global_work_size) &&
+                   std::equal(a->local_work_size, a->local_work_size + 3, b->local_work_size);
+    if (fusible) {
+      int a_outputs = 0;
+      bool private_output = true;
+      for (int j = 0; j < a->num_args; j++) {
+        if (a->args_size[j] != 8 || !is_output(a, j)) continue;
+        a_outputs++;
+        private_output &= readers[a->args[j]] == 1 && a->args[j] != model_output &&
+                          std::find(b->args.begin(), b->args.end(), a->args[j]) != b->args.end();
+      }
+      fusible = a_outputs == 1 && private_output;
+    }
+
+    shared_ptr<CLQueuedKernel> k = fusible ? fuse_pair(a, b) : NULL;
+    if (k == NULL) {
+      fused.push_back(kq[i]);
+      continue;
+    }
+
+    if (record & THNEED_DEBUG) {
+      uint64_t ta = time_kernel(a, command_queue), tb = time_kernel(b, command_queue);
+      uint64_t tf = time_kernel(k.get(), command_queue);
+      printf("fuse %56s: %7lu + %7lu -> %7lu ns\n", k->name.c_str(), ta, tb, tf);
+    }
+    fused.push_back(k);
+    pairs++;
+    i++;
+  }
+
+  vector<shared_ptr<CLQueuedKernel> > orig = kq;
+  kq = fused;
+  const vector<float> out = run_reference();
+  float max_err = 0;
+  for (int i = 0; i < out.size(); i++) {
+    max_err = std::max(max_err, std::abs(out[i] - reference[i]) / std::max(1.f, std::abs(reference[i])));
+  }
+  printf("Thneed::fuse: fused %d pairs, %zu -> %zu kernels, max error %e\n", pairs, orig.size(), kq.size(), max_err);
+
+  if (!(max_err <= OPTIMIZE_TOLERANCE)) {
+    printf("Thneed::fuse: outputs don't match the recorded run, reverting\n");
+    kq = orig;
+    return -1;
+  }
+  return pairs;
+}
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+#include "json11.hpp"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/modeld/thneed/thneed.h"
+using namespace json11;
+
+static string work_size(const size_t *ws, int dim) {
+  string ret;
+  for (int i = 0; i < dim; i++) {
+    ret += (i ? "x" : "") + std::to_string(ws[i]);
+  }
+  return ret;
+}
+
+void Thneed::profile(int iterations, const char *json_path) {
+  assert(iterations > 0);
+
+  // kernels are timed on a queue of their own, that's the only one with profiling
+  cl_command_queue_properties props[3] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+  cl_command_queue profiling_queue = CL_CHECK_ERR(clCreateCommandQueueWithProperties(context, device_id, props, &err));
+  cl_command_queue queue = command_queue;
+  command_queue = profiling_queue;
+
+  // warm up, creates the kernels of a loaded thneed
+  for (auto &k : kq) k->exec();
+  clFinish(command_queue);
+
+  vector<vector<uint64_t> > times(kq.size(), vector<uint64_t>(iterations));
+  vector<cl_event> events(kq.size());
+  for (int it = 0; it < iterations; it++) {
+    for (int i = 0; i < kq.size(); i++) {
+      CL_CHECK(kq[i]->exec(&events[i]));
+    }
+    clFinish(command_queue);
+
+    for (int i = 0; i < kq.size(); i++) {
+      cl_ulong start, end;
+      clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+      clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+      times[i][it] = end - start;
+      clReleaseEvent(events[i]);
+    }
+  }
+
+  command_queue = queue;
+  clReleaseCommandQueue(profiling_queue);
+
+  struct Stat {
+    int index;
+    double mean_us, p99_us;
+  };
+  vector<Stat> stats;
+  double total_us = 0;
+  for (int i = 0; i < kq.size(); i++) {
+    vector<uint64_t> &t = times[i];
+    std::sort(t.begin(), t.end());
+    double mean = std::accumulate(t.begin(), t.end(), 0.0) / t.size() / 1000.;
+    double p99 = t[std::min(t.size() - 1, (size_t)(t.size() * 0.99))] / 1000.;
+    stats.push_back({i, mean, p99});
+    total_us += mean;
+  }
+  std::sort(stats.begin(), stats.end(), [](const Stat &a, const Stat &b) { return a.mean_us > b.mean_us; });
+
+  printf("Thneed::profile: %zu kernels, %d iterations, %.1f us per run\n", kq.size(), iterations, total_us);
+  printf("%4s %-56s %-14s %-10s %9s %9s %6s\n", "idx", "kernel", "global", "local", "mean us", "p99 us", "share");
+  vector<Json> jkernels;
+  for (auto &s : stats) {
+    auto &k = kq[s.index];
+    const string global = work_size(k->global_work_size, k->work_dim), local = work_size(k->local_work_size, k->work_dim);
+    const double share = total_us > 0 ? s.mean_us / total_us : 0;
+    printf("%4d %-56s %-14s %-10s %9.1f %9.1f %5.1f%%\n", s.index, k->name.c_str(), global.c_str(), local.c_str(),
+           s.mean_us, s.p99_us, share * 100);
+    jkernels.push_back(Json::object({
+      {"index", s.index},
+      {"name", k->name},
+      {"global_work_size", global},
+      {"local_work_size", local},
+      {"mean_us", s.mean_us},
+      {"p99_us", s.p99_us},
+      {"share", share},
+    }));
+  }
+
+  if (json_path != NULL) {
+    Json jdat = Json::object({
+      {"iterations", iterations},
+      {"total_us", total_us},
+      {"kernels", jkernels},
+    });
+    FILE *f = fopen(json_path, "w");
+    assert(f != NULL);
+    string str = jdat.dump();
+    fwrite(str.data(), 1, str.size(), f);
+    fclose(f);
+    printf("Thneed::profile: wrote %s\n", json_path);
+  }
+}
@@ -1,5 +1,13 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
 #include <cassert>
+#include <cstring>
 #include <set>
+#include <thread>
 
 #include "json11.hpp"
 #include "selfdrive/modeld/thneed/thneed.h"
@@ -7,17 +15,238 @@ using namespace json11;
 
 extern map<cl_program, string> g_program_source;
 
+// thneed files are a fixed header, the object records, the programs and
+// kernels, then the page aligned weights. Loading maps the file and copies
+// the weights to the GPU straight from the mapping
+#define THNEED_MAGIC "THNEED2"
+#define THNEED_VERSION 2
+#define THNEED_ALIGN 4096
+#define THNEED_NOT_LOADED UINT64_MAX
+
+#define THNEED_OBJECT_BUFFER 0
+#define THNEED_OBJECT_IMAGE2D 1
+#define THNEED_OBJECT_IMAGE1D 2
+
+struct ThneedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_objects, num_programs, num_kernels;
+  uint64_t weights_offset, weights_size;
+  // program binaries are only used by the driver that built them
+  char driver_version[64];
+  char device_name[64];
+};
+
+struct ThneedObject {
+  // the cl_mem when the thneed was saved, buffer_id is the buffer under an image
+  uint64_t id, buffer_id;
+  uint64_t size;
+  uint64_t offset;  // into the weights, THNEED_NOT_LOADED for buffers that start empty
+  uint32_t type;
+  uint32_t width, height, row_pitch;
+};
+
+// programs and kernels are strings and numbers one after the other
+class ThneedReader {
+  public:
+    ThneedReader(const char *lbuf, size_t lsize) { buf = lbuf; size = lsize; }
+    const char *take(size_t len) {
+      assert(len <= size - pos);
+      const char *ret = &buf[pos];
+      pos += len;
+      return ret;
+    }
+    template <typename T> T get() {
+      T ret;
+      memcpy(&ret, take(sizeof(ret)), sizeof(ret));
+      return ret;
+    }
+    pair<const char *, size_t> get_bytes() {
+      size_t len = get<uint64_t>();
+      return {take(len), len};
+    }
+    string get_string() {
+      auto b = get_bytes();
+      return string(b.first, b.second);
+    }
+  private:
+    const char *buf;
+    size_t size, pos = 0;
+};
+
+class ThneedWriter {
+  public:
+    template <typename T> void put(const T &v) { data.append((const char *)&v, sizeof(v)); }
+    void put_bytes(const string &s) {
+      put<uint64_t>(s.size());
+      data += s;
+    }
+    string data;
+};
+
+static string device_info(cl_device_id device_id, cl_device_info param) {
+  char buf[64] = {};
+  clGetDeviceInfo(device_id, param, sizeof(buf) - 1, buf, NULL);
+  return buf;
+}
+
+struct ThneedProgram {
+  string name, options;
+  pair<const char *, size_t> source, binary;
+  cl_program program = NULL;
+};
+
+static cl_program build_program(cl_context context, cl_device_id device_id, const ThneedProgram &p, bool use_binary) {
+  cl_int err;
+  cl_program program;
+  if (use_binary) {
+    const unsigned char *bins[1] = {(const unsigned char *)p.binary.first};
+    program = clCreateProgramWithBinary(context, 1, &device_id, &p.binary.second, bins, NULL, &err);
+  } else {
+    const char *srcs[1] = {p.source.first};
+    program = clCreateProgramWithSource(context, 1, srcs, &p.source.second, &err);
+  }
+  if (err == CL_SUCCESS) err = clBuildProgram(program, 1, &device_id, p.options.c_str(), NULL, NULL);
+  if (err != CL_SUCCESS) {
+    char log[2048] = {};
+    clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(log) - 1, log, NULL);
+    printf("Thneed::load: building %s from %s failed with %d\n%s\n", p.name.c_str(), use_binary ? "binary" : "source", err, log);
+    if (program != NULL) clReleaseProgram(program);
+    return NULL;
+  }
+  return program;
+}
+
 void Thneed::load(const char *filename) {
   printf("Thneed::load: loading from %s\n", filename);
 
-  FILE *f = fopen(filename, "rb");
-  fseek(f, 0L, SEEK_END);
-  int sz = ftell(f);
-  fseek(f, 0L, SEEK_SET);
-  char *buf = (char*)malloc(sz);
-  fread(buf, 1, sz, f);
-  fclose(f);
+  int file_fd = open(filename, O_RDONLY);
+  assert(file_fd >= 0);
+  struct stat st;
+  int ret = fstat(file_fd, &st);
+  assert(ret == 0);
+  size_t sz = st.st_size;
+  const char *buf = (const char *)mmap(NULL, sz, PROT_READ, MAP_PRIVATE, file_fd, 0);
+  close(file_fd);
+  assert(buf != MAP_FAILED);
+
+  if (sz < sizeof(ThneedHeader) || memcmp(buf, THNEED_MAGIC, sizeof(THNEED_MAGIC)) != 0) {
+    load_json(buf);
+    munmap((void *)buf, sz);
+    return;
+  }
+
+  ThneedHeader header;
+  memcpy(&header, buf, sizeof(header));
+  assert(header.version == THNEED_VERSION);
+  assert(header.weights_offset <= sz && header.weights_size <= sz - header.weights_offset);
+  const char *weights = &buf[header.weights_offset];
+  ThneedReader r(&buf[sizeof(header)], header.weights_offset - sizeof(header));
+
+  map<uint64_t, cl_mem> real_mem;
+  for (int i = 0; i < header.num_objects; i++) {
+    ThneedObject obj = r.get<ThneedObject>();
+    cl_mem clbuf = NULL;
+
+    if (obj.buffer_id != 0) {
+      // image buffer must already be allocated
+      clbuf = real_mem[obj.buffer_id];
+      assert(obj.offset == THNEED_NOT_LOADED);
+    } else if (obj.offset != THNEED_NOT_LOADED) {
+      assert(obj.offset + obj.size <= header.weights_size);
+      clbuf = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_WRITE, obj.size, (void *)&weights[obj.offset], NULL);
+    } else {
+      clbuf = clCreateBuffer(context, CL_MEM_READ_WRITE, obj.size, NULL, NULL);
+    }
+    assert(clbuf != NULL);
+
+    if (obj.type == THNEED_OBJECT_IMAGE2D || obj.type == THNEED_OBJECT_IMAGE1D) {
+      cl_image_desc desc = {0};
+      desc.image_type = (obj.type == THNEED_OBJECT_IMAGE2D) ? CL_MEM_OBJECT_IMAGE2D : CL_MEM_OBJECT_IMAGE1D_BUFFER;
+      desc.image_width = obj.width;
+      desc.image_height = obj.height;
+      desc.image_row_pitch = obj.row_pitch;
+      desc.buffer = clbuf;
+
+      cl_image_format format;
+      format.image_channel_order = CL_RGBA;
+      format.image_channel_data_type = CL_HALF_FLOAT;
+
+      clbuf = clCreateImage(context, CL_MEM_READ_WRITE, &format, &desc, NULL, NULL);
+      assert(clbuf != NULL);
+    }
+
+    real_mem[obj.id] = clbuf;
+  }
+
+  vector<ThneedProgram> programs(header.num_programs);
+  for (auto &p : programs) {
+    p.name = r.get_string();
+    p.options = r.get_string();
+    p.source = r.get_bytes();
+    p.binary = r.get_bytes();
+  }
+
+  // binaries from another driver may not load, or worse, load and run wrong
+  const bool same_driver = device_info(device_id, CL_DRIVER_VERSION) == header.driver_version &&
+                           device_info(device_id, CL_DEVICE_NAME) == header.device_name;
+  if (!same_driver) {
+    printf("Thneed::load: saved with driver \"%s\" on \"%s\", building programs from source\n", header.driver_version, header.device_name);
+  }
 
+  // the programs are independent, the driver builds them on as many threads as we give it
+  atomic<int> next_program(0);
+  auto build_programs = [&]() {
+    for (int i = next_program++; i < programs.size(); i = next_program++) {
+      ThneedProgram &p = programs[i];
+      if (same_driver && p.binary.second > 0) p.program = build_program(context, device_id, p, true);
+      if (p.program == NULL && p.source.second > 0) p.program = build_program(context, device_id, p, false);
+    }
+  };
+  vector<thread> builders;
+  const int num_builders = std::min<int>(programs.size(), std::max(1u, thread::hardware_concurrency())) - 1;
+  for (int i = 0; i < num_builders; i++) builders.emplace_back(build_programs);
+  build_programs();
+  for (auto &t : builders) t.join();
+
+  map<string, cl_program> g_programs;
+  for (auto &p : programs) {
+    if (p.program == NULL) printf("Thneed::load: no usable binary or source for %s\n", p.name.c_str());
+    assert(p.program != NULL);
+    if (record & THNEED_DEBUG) printf("built %s\n", p.name.c_str());
+    g_programs[p.name] = p.program;
+  }
+
+  for (int i = 0; i < header.num_kernels; i++) {
+    auto kk = shared_ptr<CLQueuedKernel>(new CLQueuedKernel(this));
+    kk->name = r.get_string();
+    kk->program = g_programs[kk->name];
+    kk->work_dim = r.get<uint32_t>();
+    assert(kk->work_dim <= 3);
+    for (int j = 0; j < 3; j++) kk->global_work_size[j] = r.get<uint64_t>();
+    for (int j = 0; j < 3; j++) kk->local_work_size[j] = r.get<uint64_t>();
+    kk->num_args = r.get<uint32_t>();
+    for (int j = 0; j < kk->num_args; j++) {
+      int arg_size = r.get<uint32_t>();
+      string arg = r.get_string();
+      kk->args_size.push_back(arg_size);
+      if (arg.size() == sizeof(cl_mem)) {
+        uint64_t val;
+        memcpy(&val, arg.data(), sizeof(val));
+        auto it = real_mem.find(val);
+        if (it != real_mem.end()) arg = string((char *)&it->second, sizeof(cl_mem));
+      }
+      kk->args.push_back(arg);
+    }
+    kq.push_back(kk);
+  }
+
+  clFinish(command_queue);
+  munmap((void *)buf, sz);
+}
+
+// the json format thneed files had before THNEED_VERSION 2
+void Thneed::load_json(const char *buf) {
   int jsz = *(int *)buf;
   string jj(buf+4, jsz);
   string err;
@@ -39,7 +268,7 @@ void Thneed::load(const char *filename) {
     } else {
       if (mobj["needs_load"].bool_value()) {
         //printf("loading %p %d @ 0x%X\n", clbuf, sz, ptr);
-        clbuf = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_WRITE, sz, &buf[ptr], NULL);
+        clbuf = clCreateBuffer(context, CL_MEM_COPY_HOST_PTR | CL_MEM_READ_WRITE, sz, (void *)&buf[ptr], NULL);
         ptr += sz;
       } else {
         clbuf = clCreateBuffer(context, CL_MEM_READ_WRITE, sz, NULL, NULL);
@@ -135,146 +364,148 @@ void Thneed::load(const char *filename) {
     kq.push_back(kk);
   }
 
-  free(buf);
   clFinish(command_queue);
 }
 
 void Thneed::save(const char *filename, bool save_binaries) {
   printf("Thneed::save: saving to %s\n", filename);
 
-  // get kernels
-  std::vector<Json> kernels;
-  std::set<string> saved_objects;
-  std::vector<Json> objects;
-  std::map<string, string> programs;
-  std::map<string, string> binaries;
+  std::set<uint64_t> saved_objects;
+  std::vector<ThneedObject> objects;
+  std::map<string, cl_program> programs;
+  ThneedWriter kernels;
 
   for (auto &k : kq) {
-    kernels.push_back(k->to_json());
+    kernels.put_bytes(k->name);
+    kernels.put<uint32_t>(k->work_dim);
+    for (int i = 0; i < 3; i++) kernels.put<uint64_t>(k->global_work_size[i]);
+    for (int i = 0; i < 3; i++) kernels.put<uint64_t>(k->local_work_size[i]);
+    kernels.put<uint32_t>(k->num_args);
+    for (int i = 0; i < k->num_args; i++) {
+      kernels.put<uint32_t>(k->args_size[i]);
+      kernels.put_bytes(k->args[i]);
+    }
+    programs[k->name] = k->program;
 
     // check args for objects
-    int i = 0;
-    for (auto &a : k->args) {
-      if (a.size() == 8) {
-        if (saved_objects.find(a) == saved_objects.end()) {
-          saved_objects.insert(a);
-          cl_mem val = *(cl_mem*)(a.data());
-          if (val != NULL) {
-            bool needs_load = k->arg_names[i] == "weights" || k->arg_names[i] == "biases";
-
-            auto jj = Json::object({
-              {"id", a},
-              {"arg_type", k->arg_types[i]},
-            });
-
-            if (k->arg_types[i] == "image2d_t" || k->arg_types[i] == "image1d_t") {
-              cl_mem buf;
-              clGetImageInfo(val, CL_IMAGE_BUFFER, sizeof(buf), &buf, NULL);
-              string aa = string((char *)&buf, sizeof(buf));
-              jj["buffer_id"] = aa;
-
-              size_t width, height, row_pitch;
-              clGetImageInfo(val, CL_IMAGE_WIDTH, sizeof(width), &width, NULL);
-              clGetImageInfo(val, CL_IMAGE_HEIGHT, sizeof(height), &height, NULL);
-              clGetImageInfo(val, CL_IMAGE_ROW_PITCH, sizeof(row_pitch), &row_pitch, NULL);
-              jj["width"] = (int)width;
-              jj["height"] = (int)height;
-              jj["row_pitch"] = (int)row_pitch;
-              jj["size"] = (int)(height * row_pitch);
-              jj["needs_load"] = false;
-
-              if (saved_objects.find(aa) == saved_objects.end()) {
-                saved_objects.insert(aa);
-                size_t sz;
-                clGetMemObjectInfo(buf, CL_MEM_SIZE, sizeof(sz), &sz, NULL);
-                // save the buffer
-                objects.push_back(Json::object({
-                  {"id", aa},
-                  {"arg_type", "<image buffer>"},
-                  {"needs_load", needs_load},
-                  {"size", (int)sz}
-                }));
-                if (needs_load) assert(sz == height * row_pitch);
-              }
-            } else {
-              size_t sz = 0;
-              clGetMemObjectInfo(val, CL_MEM_SIZE, sizeof(sz), &sz, NULL);
-              jj["size"] = (int)sz;
-              jj["needs_load"] = needs_load;
-            }
-
-            objects.push_back(jj);
-          }
+    for (int i = 0; i < k->num_args; i++) {
+      const string &a = k->args[i];
+      if (a.size() != sizeof(cl_mem)) continue;
+      cl_mem val = *(cl_mem*)(a.data());
+      if (val == NULL || saved_objects.count((uint64_t)val)) continue;
+      saved_objects.insert((uint64_t)val);
+
+      // fused kernels prefix the names of their parts
+      const string &arg_name = k->arg_names[i];
+      auto ends_with = [&](const string &suffix) {
+        return arg_name.size() >= suffix.size() && arg_name.compare(arg_name.size() - suffix.size(), suffix.size(), suffix) == 0;
+      };
+      bool needs_load = ends_with("weights") || ends_with("biases");
+
+      ThneedObject obj = {};
+      obj.id = (uint64_t)val;
+      obj.offset = needs_load ? 0 : THNEED_NOT_LOADED;
+
+      if (k->arg_types[i] == "image2d_t" || k->arg_types[i] == "image1d_t") {
+        cl_mem buf;
+        clGetImageInfo(val, CL_IMAGE_BUFFER, sizeof(buf), &buf, NULL);
+        size_t width, height, row_pitch;
+        clGetImageInfo(val, CL_IMAGE_WIDTH, sizeof(width), &width, NULL);
+        clGetImageInfo(val, CL_IMAGE_HEIGHT, sizeof(height), &height, NULL);
+        clGetImageInfo(val, CL_IMAGE_ROW_PITCH, sizeof(row_pitch), &row_pitch, NULL);
+        obj.type = (k->arg_types[i] == "image2d_t") ? THNEED_OBJECT_IMAGE2D : THNEED_OBJECT_IMAGE1D;
+        obj.buffer_id = (uint64_t)buf;
+        obj.width = width;
+        obj.height = height;
+        obj.row_pitch = row_pitch;
+        obj.size = height * row_pitch;
+        obj.offset = THNEED_NOT_LOADED;
+
+        // save the buffer
+        if (!saved_objects.count((uint64_t)buf)) {
+          saved_objects.insert((uint64_t)buf);
+          ThneedObject bobj = {};
+          bobj.id = (uint64_t)buf;
+          bobj.type = THNEED_OBJECT_BUFFER;
+          clGetMemObjectInfo(buf, CL_MEM_SIZE, sizeof(bobj.size), &bobj.size, NULL);
+          bobj.offset = needs_load ? 0 : THNEED_NOT_LOADED;
+          if (needs_load) assert(bobj.size == height * row_pitch);
+          objects.push_back(bobj);
         }
+      } else {
+        obj.type = THNEED_OBJECT_BUFFER;
+        clGetMemObjectInfo(val, CL_MEM_SIZE, sizeof(obj.size), &obj.size, NULL);
       }
-      i++;
+      objects.push_back(obj);
     }
+  }
 
+  // the weights, each one aligned for the copy to the GPU
+  string weights;
+  for (auto &obj : objects) {
+    if (obj.offset == THNEED_NOT_LOADED) continue;
+    weights.resize((weights.size() + 63) & ~63);
+    obj.offset = weights.size();
+    weights.resize(obj.offset + obj.size);
+
+    // buffers allocated with CL_MEM_HOST_WRITE_ONLY, hence this hack
+    // the worst hack in thneed, the flags are at 0x14
+    cl_mem val = (cl_mem)obj.id;
+    ((uint32_t*)val)[0x14] &= ~CL_MEM_HOST_WRITE_ONLY;
+    cl_int ret = clEnqueueReadBuffer(command_queue, val, CL_TRUE, 0, obj.size, &weights[obj.offset], 0, NULL, NULL);
+    assert(ret == CL_SUCCESS);
+  }
+
+  // the source is kept next to the binary, a thneed from another driver builds from it
+  ThneedWriter tables;
+  for (auto &obj : objects) tables.put(obj);
+  for (auto &p : programs) {
+    size_t len = 0;
+    clGetProgramBuildInfo(p.second, device_id, CL_PROGRAM_BUILD_OPTIONS, 0, NULL, &len);
+    string options(len, '\0');
+    clGetProgramBuildInfo(p.second, device_id, CL_PROGRAM_BUILD_OPTIONS, len, options.data(), NULL);
+
+    string binary;
     if (save_binaries) {
-      int err;
       size_t binary_size = 0;
-      err = clGetProgramInfo(k->program, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL);
+      int err = clGetProgramInfo(p.second, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL);
       assert(err == 0);
       assert(binary_size > 0);
-      string sv(binary_size, '\x00');
-
-      uint8_t* bufs[1] = { (uint8_t*)sv.data(), };
-      err = clGetProgramInfo(k->program, CL_PROGRAM_BINARIES, sizeof(bufs), &bufs, NULL);
+      binary.resize(binary_size);
+      uint8_t* bufs[1] = { (uint8_t*)binary.data(), };
+      err = clGetProgramInfo(p.second, CL_PROGRAM_BINARIES, sizeof(bufs), &bufs, NULL);
       assert(err == 0);
-
-      binaries[k->name] = sv;
-    } else {
-      programs[k->name] = g_program_source[k->program];
-    }
-  }
-
-  vector<string> saved_buffers;
-  for (auto &obj : objects) {
-    auto mobj = obj.object_items();
-    cl_mem val = *(cl_mem*)(mobj["id"].string_value().data());
-    int sz = mobj["size"].int_value();
-    if (mobj["needs_load"].bool_value()) {
-      char *buf = (char *)malloc(sz);
-      if (mobj["arg_type"] == "image2d_t" || mobj["arg_type"] == "image1d_t") {
-        assert(false);
-      } else {
-        // buffers allocated with CL_MEM_HOST_WRITE_ONLY, hence this hack
-        //hexdump((uint32_t*)val, 0x100);
-
-        // the worst hack in thneed, the flags are at 0x14
-        ((uint32_t*)val)[0x14] &= ~CL_MEM_HOST_WRITE_ONLY;
-        cl_int ret = clEnqueueReadBuffer(command_queue, val, CL_TRUE, 0, sz, buf, 0, NULL, NULL);
-        assert(ret == CL_SUCCESS);
-      }
-      //printf("saving buffer: %d %p %s\n", sz, buf, mobj["arg_type"].string_value().c_str());
-      saved_buffers.push_back(string(buf, sz));
-      free(buf);
     }
-  }
 
-  std::vector<Json> jbinaries;
-  for (auto &obj : binaries) {
-    jbinaries.push_back(Json::object({{"name", obj.first}, {"length", (int)obj.second.size()}}));
-    saved_buffers.push_back(obj.second);
+    auto src = g_program_source.find(p.second);
+    assert(save_binaries || src != g_program_source.end());
+    tables.put_bytes(p.first);
+    tables.put_bytes(options.c_str());
+    tables.put_bytes(src != g_program_source.end() ? src->second : "");
+    tables.put_bytes(binary);
   }
-
-  Json jdat = Json::object({
-    {"kernels", kernels},
-    {"objects", objects},
-    {"programs", programs},
-    {"binaries", jbinaries},
-  });
-
-  string str = jdat.dump();
-  int jsz = str.length();
+  tables.data += kernels.data;
+
+  ThneedHeader header = {};
+  memcpy(header.magic, THNEED_MAGIC, sizeof(THNEED_MAGIC));
+  header.version = THNEED_VERSION;
+  header.num_objects = objects.size();
+  header.num_programs = programs.size();
+  header.num_kernels = kq.size();
+  header.weights_offset = (sizeof(header) + tables.data.size() + THNEED_ALIGN - 1) & ~(uint64_t)(THNEED_ALIGN - 1);
+  header.weights_size = weights.size();
+  strncpy(header.driver_version, device_info(device_id, CL_DRIVER_VERSION).c_str(), sizeof(header.driver_version) - 1);
+  strncpy(header.device_name, device_info(device_id, CL_DEVICE_NAME).c_str(), sizeof(header.device_name) - 1);
 
   FILE *f = fopen(filename, "wb");
-  fwrite(&jsz, 1, sizeof(jsz), f);
-  fwrite(str.data(), 1, jsz, f);
-  for (auto &s : saved_buffers) {
-    fwrite(s.data(), 1, s.length(), f);
-  }
+  assert(f != NULL);
+  fwrite(&header, 1, sizeof(header), f);
+  fwrite(tables.data.data(), 1, tables.data.size(), f);
+  string padding(header.weights_offset - sizeof(header) - tables.data.size(), '\0');
+  fwrite(padding.data(), 1, padding.size(), f);
+  fwrite(weights.data(), 1, weights.size(), f);
   fclose(f);
+  printf("Thneed::save: %zu objects, %zu programs, %zu kernels, %zu bytes of weights\n", objects.size(), programs.size(), kq.size(), weights.size());
 }
 
 Json CLQueuedKernel::to_json() const {
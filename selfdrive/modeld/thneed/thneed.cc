@@ -20,6 +20,12 @@ int g_fd = -1;
 map<pair<cl_kernel, int>, string> g_args;
 map<pair<cl_kernel, int>, int> g_args_size;
 map<cl_program, string> g_program_source;
+int g_context_priority = 1;
+ThneedScheduler g_scheduler;
+
+void thneed_set_context_priority(int priority) {
+  g_context_priority = priority;
+}
 
 void hexdump(uint32_t *d, int len) {
   assert((len%4) == 0);
@@ -49,7 +55,7 @@ int ioctl(int filedes, unsigned long request, void *argp) {
   if (request == IOCTL_KGSL_DRAWCTXT_CREATE) {
     struct kgsl_drawctxt_create *create = (struct kgsl_drawctxt_create *)argp;
     create->flags &= ~KGSL_CONTEXT_PRIORITY_MASK;
-    create->flags |= 1 << KGSL_CONTEXT_PRIORITY_SHIFT;   // priority from 1-15, 1 is max priority
+    create->flags |= g_context_priority << KGSL_CONTEXT_PRIORITY_SHIFT;   // priority from 1-15, 1 is max priority
     printf("IOCTL_KGSL_DRAWCTXT_CREATE: creating context with flags 0x%x\n", create->flags);
   }
 
@@ -214,6 +220,29 @@ void CachedCommand::exec() {
   assert(ret == 0);
 }
 
+// *********** ThneedScheduler ***********
+
+void ThneedScheduler::begin(int priority) {
+  std::lock_guard lk(lock);
+  running[priority]++;
+}
+
+void ThneedScheduler::end(int priority) {
+  std::lock_guard lk(lock);
+  running[priority]--;
+  cv.notify_all();
+}
+
+void ThneedScheduler::yield(int priority) {
+  std::unique_lock lk(lock);
+  cv.wait(lk, [&] {
+    for (int p = 0; p < priority; p++) {
+      if (running[p] > 0) return false;
+    }
+    return true;
+  });
+}
+
 // *********** Thneed ***********
 
 Thneed::Thneed(bool do_clinit) {
@@ -245,6 +274,7 @@ void Thneed::find_inputs_outputs() {
         size_t sz;
         clGetMemObjectInfo(aa, CL_MEM_SIZE, sizeof(sz), &sz, NULL);
         input_sizes.push_back(sz);
+        input_clmem.push_back(aa);
 
         void *ret = clEnqueueMapBuffer(command_queue, aa, CL_TRUE, CL_MAP_WRITE, 0, sz, 0, NULL, NULL, &err);
         assert(err == CL_SUCCESS);
@@ -261,6 +291,7 @@ void Thneed::find_inputs_outputs() {
 void Thneed::copy_inputs(float **finputs) {
   //cl_int ret;
   for (int idx = 0; idx < inputs.size(); ++idx) {
+    if (finputs[idx] == NULL || (idx == feedback_input && feedback_ready)) continue;
     if (record & THNEED_DEBUG) printf("copying %lu -- %p -> %p\n", input_sizes[idx], finputs[idx], inputs[idx]);
     memcpy(inputs[idx], finputs[idx], input_sizes[idx]);
   }
@@ -270,13 +301,54 @@ void Thneed::copy_output(float *foutput) {
   if (output != NULL) {
     size_t sz;
     clGetMemObjectInfo(output, CL_MEM_SIZE, sizeof(sz), &sz, NULL);
-    if (record & THNEED_DEBUG) printf("copying %lu for output %p -> %p\n", sz, output, foutput);
-    clEnqueueReadBuffer(command_queue, output, CL_TRUE, 0, sz, foutput, 0, NULL, NULL);
+    const size_t read_sz = feedback_input >= 0 ? feedback_offset * sizeof(float) : sz;
+    if (record & THNEED_DEBUG) printf("copying %lu of %lu for output %p -> %p\n", read_sz, sz, output, foutput);
+    cl_event read_event;
+    cl_int err = clEnqueueReadBuffer(command_queue, output, CL_FALSE, 0, read_sz, foutput, 0, NULL, &read_event);
+    assert(err == CL_SUCCESS);
+    if (feedback_input >= 0) {
+      // the state goes straight to the next run's input, queued behind the outputs
+      // so the caller has those first. The replayed commands don't go through the
+      // queue, the next execute waits for it
+      wait_feedback();
+      err = clEnqueueReadBuffer(command_queue, output, CL_FALSE, read_sz, sz - read_sz, inputs[feedback_input], 0, NULL, &feedback_event);
+      assert(err == CL_SUCCESS);
+      clFlush(command_queue);
+      feedback_ready = true;
+    }
+    clWaitForEvents(1, &read_event);
+    clReleaseEvent(read_event);
   } else {
     printf("CAUTION: model output is NULL, does it have no outputs?\n");
   }
 }
 
+void Thneed::set_feedback(int idx, size_t offset) {
+  assert(output != NULL && idx >= 0 && idx < input_clmem.size());
+  size_t sz;
+  clGetMemObjectInfo(output, CL_MEM_SIZE, sizeof(sz), &sz, NULL);
+  assert(offset * sizeof(float) + input_sizes[idx] == sz);
+  feedback_input = idx;
+  feedback_offset = offset;
+  feedback_ready = false;
+}
+
+void Thneed::read_feedback(float *finput) {
+  assert(feedback_input >= 0);
+  if (feedback_ready) {
+    wait_feedback();
+    memcpy(finput, inputs[feedback_input], input_sizes[feedback_input]);
+  }
+}
+
+void Thneed::wait_feedback() {
+  if (feedback_event != NULL) {
+    clWaitForEvents(1, &feedback_event);
+    clReleaseEvent(feedback_event);
+    feedback_event = NULL;
+  }
+}
+
 void Thneed::wait() {
   struct kgsl_device_waittimestamp_ctxtid wait;
   wait.context_id = context_id;
@@ -296,6 +368,7 @@ void Thneed::execute(float **finputs, float *foutput, bool slow) {
 
   // ****** copy inputs
   copy_inputs(finputs);
+  wait_feedback();
 
   // ****** set power constraint
   int ret;
@@ -316,13 +389,17 @@ void Thneed::execute(float **finputs, float *foutput, bool slow) {
   assert(ret == 0);
 
   // ****** run commands
+  g_scheduler.begin(priority);
+  const bool low_priority = priority != THNEED_PRIORITY_HIGH;
   int i = 0;
   for (auto &it : cmds) {
     ++i;
+    if (low_priority) g_scheduler.yield(priority);
     if (record & THNEED_DEBUG) printf("run %2d @ %7lu us: ", i, (nanos_since_boot()-tb)/1000);
     it->exec();
-    if ((i == cmds.size()) || slow) wait();
+    if ((i == cmds.size()) || slow || low_priority) wait();
   }
+  g_scheduler.end(priority);
 
   // ****** copy outputs
   copy_output(foutput);
@@ -496,7 +573,7 @@ int CLQueuedKernel::get_arg_num(const char *search_arg_name) {
   assert(false);
 }
 
-cl_int CLQueuedKernel::exec() {
+cl_int CLQueuedKernel::exec(cl_event *event) {
   if (kernel == NULL) {
     kernel = clCreateKernel(program, name.c_str(), NULL);
     arg_names.clear();
@@ -525,7 +602,7 @@ cl_int CLQueuedKernel::exec() {
   }
 
   return clEnqueueNDRangeKernel(thneed->command_queue,
-    kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, NULL);
+    kernel, work_dim, NULL, global_work_size, local_work_size, 0, NULL, event);
 }
 
 void CLQueuedKernel::debug_print(bool verbose) {
@@ -4,9 +4,11 @@
 #define __user __attribute__(())
 #endif
 
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -18,8 +20,16 @@
 #define THNEED_DEBUG 2
 #define THNEED_VERBOSE_DEBUG 4
 
+#define THNEED_PRIORITY_HIGH 0
+#define THNEED_PRIORITY_LOW 1
+#define THNEED_PRIORITIES 2
+
 using namespace std;
 
+// kgsl priority of the GPU contexts this process creates from now on, 1-15,
+// 1 is max. Processes whose GPU work should yield to modeld lower it first
+void thneed_set_context_priority(int priority);
+
 namespace json11 {
   class Json;
 }
@@ -43,7 +53,7 @@ class CLQueuedKernel {
                    cl_uint _work_dim,
                    const size_t *_global_work_size,
                    const size_t *_local_work_size);
-    cl_int exec();
+    cl_int exec(cl_event *event = NULL);
     void debug_print(bool verbose);
     int get_arg_num(const char *search_arg_name);
     cl_program program;
@@ -90,6 +100,22 @@ class CachedCommand: public CachedIoctl {
     vector<shared_ptr<CLQueuedKernel> > kq;
 };
 
+// Takes turns between the Thneeds of one process. A stream submits its next
+// command only while no stream of higher priority is running, so a high
+// priority model waits for at most one command of a lower one. Lower priority
+// streams wait for each command they submit to keep the GPU queue short
+class ThneedScheduler {
+  public:
+    void begin(int priority);
+    void end(int priority);
+    // blocks while a stream of higher priority than this one is running
+    void yield(int priority);
+  private:
+    mutex lock;
+    condition_variable cv;
+    int running[THNEED_PRIORITIES] = {};
+};
+
 class Thneed {
   public:
     Thneed(bool do_clinit=false);
@@ -97,10 +123,16 @@ class Thneed {
     void execute(float **finputs, float *foutput, bool slow=false);
     void wait();
     int optimize();
+    int fuse();
+    // runs kq iterations times with profiling events, prints where the time
+    // goes per kernel and writes the same as json to json_path if it's set
+    void profile(int iterations, const char *json_path = NULL);
 
     vector<void *> inputs;
+    vector<cl_mem> input_clmem;
     vector<size_t> input_sizes;
     cl_mem output = NULL;
+    int priority = THNEED_PRIORITY_HIGH;
 
     cl_context context = NULL;
     cl_command_queue command_queue;
@@ -116,18 +148,37 @@ class Thneed {
 
     // all CL kernels
     void find_inputs_outputs();
+    // inputs that are NULL were already written to input_clmem on the GPU
     void copy_inputs(float **finputs);
+    // with a feedback input, only the outputs before it are read back
     void copy_output(float *foutput);
+    // the output from offset on, in floats, is the next run's input idx, e.g.
+    // a recurrent state. It's read straight into the mapped input behind the
+    // other outputs, and finputs[idx] is ignored from then on. Set after recording
+    void set_feedback(int idx, size_t offset);
+    // the last fed back state, for when the host needs it after all
+    void read_feedback(float *finput);
     cl_int clexec();
+    // runs kq on the current inputs and returns the output
+    vector<float> run_reference();
     vector<shared_ptr<CLQueuedKernel> > kq;
 
     // pending CL kernels
     vector<shared_ptr<CLQueuedKernel> > ckq;
 
+    shared_ptr<CLQueuedKernel> fuse_pair(CLQueuedKernel *a, CLQueuedKernel *b);
+
     // loading and saving
     void load(const char *filename);
     void save(const char *filename, bool save_binaries=false);
   private:
+    int feedback_input = -1;
+    size_t feedback_offset = 0;
+    bool feedback_ready = false;
+    cl_event feedback_event = NULL;
+    void wait_feedback();
+
     void clinit();
+    void load_json(const char *buf);
 };
 
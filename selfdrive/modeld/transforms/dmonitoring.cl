@@ -0,0 +1,58 @@
+#define UV_WIDTH (OUT_WIDTH / 2)
+#define UV_HEIGHT (OUT_HEIGHT / 2)
+
+// bilinear at (x, y) of the rectangle at (rx, ry) of a plane, clamped to it.
+// Rounded to a pixel value, the model is trained on 8 bit frames
+inline float sample(__global const uchar * plane, int stride, int rx, int ry, int rw, int rh, float x, float y)
+{
+    x = clamp(x, 0.f, rw - 1.f);
+    y = clamp(y, 0.f, rh - 1.f);
+    const int x0 = (int)x;
+    const int y0 = (int)y;
+    const int x1 = min(x0 + 1, rw - 1);
+    const int y1 = min(y0 + 1, rh - 1);
+    __global const uchar * row0 = plane + (ry + y0) * stride + rx;
+    __global const uchar * row1 = plane + (ry + y1) * stride + rx;
+    const float top = mix(convert_float(row0[x0]), convert_float(row0[x1]), x - x0);
+    const float bottom = mix(convert_float(row1[x0]), convert_float(row1[x1]), x - x0);
+    return rint(mix(top, bottom, y - y0));
+}
+
+inline float normalize(float v)
+{
+    return (v - 128.f) * 0.0078125f;
+}
+
+// The driver crop of a frame scaled to OUT_WIDTH x OUT_HEIGHT, mirrored for
+// RHD, as the input tensor of the model: four Y planes of the even and odd
+// rows and columns, then U and V. One work item per 2x2 block of Y
+__kernel void cropTensor(__global const uchar * src, int src_width, int src_height,
+                         int crop_x, int crop_y, int crop_w, int crop_h, int mirror,
+                         __global float * out)
+{
+    const int c = get_global_id(0);
+    const int r = get_global_id(1);
+    if (c >= UV_WIDTH || r >= UV_HEIGHT) return;
+
+    const float sx = (float)crop_w / OUT_WIDTH;
+    const float sy = (float)crop_h / OUT_HEIGHT;
+    const int uv_size = UV_WIDTH * UV_HEIGHT;
+    const int idx = r * UV_WIDTH + c;
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            float x = (2*c + i + 0.5f) * sx - 0.5f;
+            const float y = (2*r + j + 0.5f) * sy - 0.5f;
+            if (mirror) x = crop_w - 1 - x;
+            out[(i*2 + j) * uv_size + idx] = normalize(sample(src, src_width, crop_x, crop_y, crop_w, crop_h, x, y));
+        }
+    }
+
+    __global const uchar * src_u = src + src_width * src_height;
+    __global const uchar * src_v = src_u + (src_width / 2) * (src_height / 2);
+    float x = (c + 0.5f) * sx - 0.5f;
+    const float y = (r + 0.5f) * sy - 0.5f;
+    if (mirror) x = crop_w / 2 - 1 - x;
+    out[4 * uv_size + idx] = normalize(sample(src_u, src_width / 2, crop_x / 2, crop_y / 2, crop_w / 2, crop_h / 2, x, y));
+    out[5 * uv_size + idx] = normalize(sample(src_v, src_width / 2, crop_x / 2, crop_y / 2, crop_w / 2, crop_h / 2, x, y));
+}
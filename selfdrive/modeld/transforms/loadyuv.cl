@@ -1,8 +1,10 @@
 #define UV_SIZE ((TRANSFORMED_WIDTH/2)*(TRANSFORMED_HEIGHT/2))
 
 __kernel void loadys(__global uchar8 const * const Y,
-                     __global float * out)
+                     __global float * out,
+                     int out_offset)
 {
+    out += out_offset;
     const int gid = get_global_id(0);
     const int ois = gid * 8;
     const int oy = ois / TRANSFORMED_WIDTH;
@@ -11,6 +11,7 @@ void loadyuv_init(LoadYUVState* s, cl_context ctx, cl_device_id device_id, int w
 
 void loadyuv_destroy(LoadYUVState* s);
 
+// writes one frame of floats to out_cl, starting out_offset floats in
 void loadyuv_queue(LoadYUVState* s, cl_command_queue q,
                    cl_mem y_cl, cl_mem u_cl, cl_mem v_cl,
-                   cl_mem out_cl);
+                   cl_mem out_cl, cl_int out_offset = 0);
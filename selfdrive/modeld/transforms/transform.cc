@@ -10,6 +10,7 @@ void transform_init(Transform* s, cl_context ctx, cl_device_id device_id) {
 
   cl_program prg = cl_program_from_file(ctx, device_id, "transforms/transform.cl", "");
   s->krnl = CL_CHECK_ERR(clCreateKernel(prg, "warpPerspective", &err));
+  s->load_krnl = CL_CHECK_ERR(clCreateKernel(prg, "warpLoadYUV", &err));
   // done with this
   CL_CHECK(clReleaseProgram(prg));
 
@@ -21,16 +22,10 @@ void transform_destroy(Transform* s) {
   CL_CHECK(clReleaseMemObject(s->m_y_cl));
   CL_CHECK(clReleaseMemObject(s->m_uv_cl));
   CL_CHECK(clReleaseKernel(s->krnl));
+  CL_CHECK(clReleaseKernel(s->load_krnl));
 }
 
-void transform_queue(Transform* s,
-                     cl_command_queue q,
-                     cl_mem in_yuv, int in_width, int in_height,
-                     cl_mem out_y, cl_mem out_u, cl_mem out_v,
-                     int out_width, int out_height,
-                     const mat3& projection) {
-  const int zero = 0;
-
+static void write_projections(Transform* s, cl_command_queue q, const mat3& projection) {
   // sampled using pixel center origin
   // (because thats how fastcv and opencv does it)
 
@@ -41,6 +36,16 @@ void transform_queue(Transform* s,
 
   CL_CHECK(clEnqueueWriteBuffer(q, s->m_y_cl, CL_TRUE, 0, 3*3*sizeof(float), (void*)projection_y.v, 0, NULL, NULL));
   CL_CHECK(clEnqueueWriteBuffer(q, s->m_uv_cl, CL_TRUE, 0, 3*3*sizeof(float), (void*)projection_uv.v, 0, NULL, NULL));
+}
+
+void transform_queue(Transform* s,
+                     cl_command_queue q,
+                     cl_mem in_yuv, int in_width, int in_height,
+                     cl_mem out_y, cl_mem out_u, cl_mem out_v,
+                     int out_width, int out_height,
+                     const mat3& projection) {
+  const int zero = 0;
+  write_projections(s, q, projection);
 
   const int in_y_width = in_width;
   const int in_y_height = in_height;
@@ -93,3 +98,26 @@ void transform_queue(Transform* s,
   CL_CHECK(clEnqueueNDRangeKernel(q, s->krnl, 2, NULL,
                               (const size_t*)&work_size_uv, NULL, 0, 0, NULL));
 }
+
+void transform_load_queue(Transform* s, cl_command_queue q,
+                          cl_mem in_yuv, int in_width, int in_height,
+                          cl_mem out, cl_int out_offset,
+                          int out_width, int out_height,
+                          const mat3& projection) {
+  write_projections(s, q, projection);
+
+  CL_CHECK(clSetKernelArg(s->load_krnl, 0, sizeof(cl_mem), &in_yuv));
+  CL_CHECK(clSetKernelArg(s->load_krnl, 1, sizeof(cl_int), &in_width));
+  CL_CHECK(clSetKernelArg(s->load_krnl, 2, sizeof(cl_int), &in_height));
+  CL_CHECK(clSetKernelArg(s->load_krnl, 3, sizeof(cl_mem), &out));
+  CL_CHECK(clSetKernelArg(s->load_krnl, 4, sizeof(cl_int), &out_offset));
+  CL_CHECK(clSetKernelArg(s->load_krnl, 5, sizeof(cl_int), &out_width));
+  CL_CHECK(clSetKernelArg(s->load_krnl, 6, sizeof(cl_int), &out_height));
+  CL_CHECK(clSetKernelArg(s->load_krnl, 7, sizeof(cl_mem), &s->m_y_cl));
+  CL_CHECK(clSetKernelArg(s->load_krnl, 8, sizeof(cl_mem), &s->m_uv_cl));
+
+  // one work item per 2x2 block of Y
+  const size_t work_size[2] = {(size_t)out_width/2, (size_t)out_height/2};
+  CL_CHECK(clEnqueueNDRangeKernel(q, s->load_krnl, 2, NULL,
+                                  (const size_t*)&work_size, NULL, 0, 0, NULL));
+}
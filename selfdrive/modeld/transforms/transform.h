@@ -10,7 +10,7 @@
 #include "selfdrive/common/mat.h"
 
 typedef struct {
-  cl_kernel krnl;
+  cl_kernel krnl, load_krnl;
   cl_mem m_y_cl, m_uv_cl;
 } Transform;
 
@@ -23,3 +23,11 @@ void transform_queue(Transform* s, cl_command_queue q,
                      cl_mem out_y, cl_mem out_u, cl_mem out_v,
                      int out_width, int out_height,
                      const mat3& projection);
+
+// transform_queue followed by loadyuv_queue in a single kernel: writes the
+// warped frame to out as the floats loadyuv would, out_offset floats in
+void transform_load_queue(Transform* s, cl_command_queue q,
+                          cl_mem yuv, int in_width, int in_height,
+                          cl_mem out, cl_int out_offset,
+                          int out_width, int out_height,
+                          const mat3& projection);
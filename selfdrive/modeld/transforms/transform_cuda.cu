@@ -0,0 +1,94 @@
+#include "selfdrive/modeld/transforms/transform_cuda.h"
+
+#include <cassert>
+
+#define INTER_BITS 5
+#define INTER_TAB_SIZE (1 << INTER_BITS)
+
+#define INTER_REMAP_COEF_BITS 15
+#define INTER_REMAP_COEF_SCALE (1 << INTER_REMAP_COEF_BITS)
+
+struct Projection {
+  float m[9];
+};
+
+__device__ static inline int sat(int v, int lo, int hi) {
+  return min(max(v, lo), hi);
+}
+
+// warp_pixel of transform.cl
+__device__ static inline uint8_t warp_pixel(const uint8_t *src, int src_step, int src_offset, int src_rows, int src_cols,
+                                            const Projection &M, int dx, int dy) {
+  const float X0 = M.m[0] * dx + M.m[1] * dy + M.m[2];
+  const float Y0 = M.m[3] * dx + M.m[4] * dy + M.m[5];
+  float W = M.m[6] * dx + M.m[7] * dy + M.m[8];
+  W = W != 0.0f ? INTER_TAB_SIZE / W : 0.0f;
+  const int X = __float2int_rn(X0 * W), Y = __float2int_rn(Y0 * W);
+
+  const int sx = sat(X >> INTER_BITS, -32768, 32767);
+  const int sy = sat(Y >> INTER_BITS, -32768, 32767);
+  const int ay = Y & (INTER_TAB_SIZE - 1);
+  const int ax = X & (INTER_TAB_SIZE - 1);
+
+  const bool x0 = sx >= 0 && sx < src_cols, x1 = sx + 1 >= 0 && sx + 1 < src_cols;
+  const bool y0 = sy >= 0 && sy < src_rows, y1 = sy + 1 >= 0 && sy + 1 < src_rows;
+  const int v0 = x0 && y0 ? src[sy * src_step + src_offset + sx] : 0;
+  const int v1 = x1 && y0 ? src[sy * src_step + src_offset + sx + 1] : 0;
+  const int v2 = x0 && y1 ? src[(sy + 1) * src_step + src_offset + sx] : 0;
+  const int v3 = x1 && y1 ? src[(sy + 1) * src_step + src_offset + sx + 1] : 0;
+
+  const float taby = 1.f / INTER_TAB_SIZE * ay;
+  const float tabx = 1.f / INTER_TAB_SIZE * ax;
+
+  const int itab0 = sat(__float2int_rn((1.0f - taby) * (1.0f - tabx) * INTER_REMAP_COEF_SCALE), -32768, 32767);
+  const int itab1 = sat(__float2int_rn((1.0f - taby) * tabx * INTER_REMAP_COEF_SCALE), -32768, 32767);
+  const int itab2 = sat(__float2int_rn(taby * (1.0f - tabx) * INTER_REMAP_COEF_SCALE), -32768, 32767);
+  const int itab3 = sat(__float2int_rn(taby * tabx * INTER_REMAP_COEF_SCALE), -32768, 32767);
+
+  const int val = v0 * itab0 + v1 * itab1 + v2 * itab2 + v3 * itab3;
+  return sat((val + (1 << (INTER_REMAP_COEF_BITS - 1))) >> INTER_REMAP_COEF_BITS, 0, 255);
+}
+
+// warpLoadYUV of transform.cl, a thread per 2x2 block of Y
+__global__ static void warp_load_yuv(const uint8_t *src, int src_width, int src_height,
+                                     float *out, int out_width, int out_height,
+                                     Projection M_y, Projection M_uv) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  const int uv_width = out_width / 2;
+  const int uv_height = out_height / 2;
+  if (x >= uv_width || y >= uv_height) return;
+
+  const int uv_size = uv_width * uv_height;
+  const int src_uv_width = src_width / 2;
+  const int src_uv_height = src_height / 2;
+  const int src_u_offset = src_width * src_height;
+  const int src_v_offset = src_u_offset + src_uv_width * src_uv_height;
+  const int idx = y * uv_width + x;
+
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      out[(i * 2 + j) * uv_size + idx] = warp_pixel(src, src_width, 0, src_height, src_width, M_y, 2 * x + i, 2 * y + j);
+    }
+  }
+  out[4 * uv_size + idx] = warp_pixel(src, src_uv_width, src_u_offset, src_uv_height, src_uv_width, M_uv, x, y);
+  out[5 * uv_size + idx] = warp_pixel(src, src_uv_width, src_v_offset, src_uv_height, src_uv_width, M_uv, x, y);
+}
+
+void transform_load_cuda(cudaStream_t stream, const uint8_t *yuv, int in_width, int in_height,
+                         float *out, int out_offset, int out_width, int out_height,
+                         const mat3 &projection) {
+  // by value, the projections go with the launch instead of a copy before it
+  Projection M_y, M_uv;
+  const mat3 projection_uv = transform_scale_buffer(projection, 0.5);
+  for (int i = 0; i < 9; i++) {
+    M_y.m[i] = projection.v[i];
+    M_uv.m[i] = projection_uv.v[i];
+  }
+
+  const dim3 block(16, 16);
+  const dim3 grid((out_width / 2 + block.x - 1) / block.x, (out_height / 2 + block.y - 1) / block.y);
+  warp_load_yuv<<<grid, block, 0, stream>>>(yuv, in_width, in_height, out + out_offset, out_width, out_height, M_y, M_uv);
+  cudaError_t err = cudaGetLastError();
+  assert(err == cudaSuccess);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+#include <cuda_runtime.h>
+
+#include "selfdrive/common/mat.h"
+
+// transform_load_queue in CUDA, for the Jetson: the warp of the yuv frame at
+// yuv, the device pointer of a VisionBuf, written to out as the floats
+// loadyuv would, out_offset floats in. The same math as warpLoadYUV in
+// transform.cl
+void transform_load_cuda(cudaStream_t stream, const uint8_t *yuv, int in_width, int in_height,
+                         float *out, int out_offset, int out_width, int out_height,
+                         const mat3 &projection);
@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 from cereal import car
 from common.params import Params
+from common.realtime import DT_DMON
 import cereal.messaging as messaging
 from selfdrive.controls.lib.events import Events
 from selfdrive.monitoring.driver_monitor import DriverStatus
@@ -23,6 +24,7 @@ def dmonitoringd_thread(sm=None, pm=None):
 
   v_cruise_last = 0
   driver_engaged = False
+  last_driver_state_time = None
 
   # 10Hz <- dmonitoringmodeld
   while True:
@@ -31,6 +33,13 @@ def dmonitoringd_thread(sm=None, pm=None):
     if not sm.updated['driverState']:
       continue
 
+    # the model may skip frames under load, the timers advance by the time between messages.
+    # A long gap is the model restarting, not the driver looking away for that long
+    t = sm.logMonoTime['driverState']
+    steps = 1 if last_driver_state_time is None else int(round((t - last_driver_state_time) * 1e-9 / DT_DMON))
+    steps = min(max(steps, 1), 10)
+    last_driver_state_time = t
+
     # Get interaction
     if sm.updated['carState']:
       v_cruise = sm['carState'].cruiseState.speed
@@ -48,7 +57,7 @@ def dmonitoringd_thread(sm=None, pm=None):
 
     # Get data from dmonitoringmodeld
     events = Events()
-    driver_status.get_pose(sm['driverState'], sm['liveCalibration'].rpyCalib, sm['carState'].vEgo, sm['controlsState'].enabled)
+    driver_status.get_pose(sm['driverState'], sm['liveCalibration'].rpyCalib, sm['carState'].vEgo, sm['controlsState'].enabled, steps)
 
     # Block engaging after max number of distrations
     if driver_status.terminal_alert_cnt >= driver_status.settings._MAX_TERMINAL_ALERTS or \
@@ -56,7 +65,7 @@ def dmonitoringd_thread(sm=None, pm=None):
       events.add(car.CarEvent.EventName.tooDistracted)
 
     # Update events from driver state
-    driver_status.update(events, driver_engaged, sm['controlsState'].enabled, sm['carState'].standstill)
+    driver_status.update(events, driver_engaged, sm['controlsState'].enabled, sm['carState'].standstill, steps)
 
     # build driverMonitoringState packet
     dat = messaging.new_message('driverMonitoringState')
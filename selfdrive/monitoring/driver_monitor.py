@@ -194,7 +194,9 @@ class DriverStatus():
                                             self.settings._BLINK_THRESHOLD,
                                             self.settings._BLINK_THRESHOLD_SLACK]) / self.settings._BLINK_THRESHOLD
 
-  def get_pose(self, driver_state, cal_rpy, car_speed, op_engaged):
+  # steps is the number of DT_DMON periods since the last driverState, the timers advance by time
+  # even when dmonitoringmodeld skips frames
+  def get_pose(self, driver_state, cal_rpy, car_speed, op_engaged, steps=1):
     if not all(len(x) > 0 for x in [driver_state.faceOrientation, driver_state.facePosition,
                                     driver_state.faceOrientationStd, driver_state.facePositionStd]):
       return
@@ -215,7 +217,8 @@ class DriverStatus():
     distracted_E2E = (driver_state.distractedPose > self.settings._E2E_POSE_THRESHOLD or driver_state.distractedEyes > self.settings._E2E_EYES_THRESHOLD) and \
                               (self.face_detected and not self.face_partial)
     self.driver_distracted = distracted_normal or distracted_E2E
-    self.driver_distraction_filter.update(self.driver_distracted)
+    for _ in range(steps):
+      self.driver_distraction_filter.update(self.driver_distracted)
 
     # update offseter
     # only update when driver is actively driving the car above a certain speed
@@ -229,11 +232,11 @@ class DriverStatus():
     self.is_model_uncertain = self.hi_stds > self.settings._HI_STD_FALLBACK_TIME
     self._set_timers(self.face_detected and not self.is_model_uncertain)
     if self.face_detected and not self.pose.low_std and not self.driver_distracted:
-      self.hi_stds += 1
+      self.hi_stds += steps
     elif self.face_detected and self.pose.low_std:
       self.hi_stds = 0
 
-  def update(self, events, driver_engaged, ctrl_active, standstill):
+  def update(self, events, driver_engaged, ctrl_active, standstill, steps=1):
     if (driver_engaged and self.awareness > 0) or not ctrl_active:
       # reset only when on disengagement if red reached
       self.awareness = 1.
@@ -243,29 +246,30 @@ class DriverStatus():
 
     driver_attentive = self.driver_distraction_filter.x < 0.37
     awareness_prev = self.awareness
+    step_change = self.step_change * steps
 
     if (driver_attentive and self.face_detected and self.pose.low_std and self.awareness > 0):
       # only restore awareness when paying attention and alert is not red
-      self.awareness = min(self.awareness + ((self.settings._RECOVERY_FACTOR_MAX-self.settings._RECOVERY_FACTOR_MIN)*(1.-self.awareness)+self.settings._RECOVERY_FACTOR_MIN)*self.step_change, 1.)
+      self.awareness = min(self.awareness + ((self.settings._RECOVERY_FACTOR_MAX-self.settings._RECOVERY_FACTOR_MIN)*(1.-self.awareness)+self.settings._RECOVERY_FACTOR_MIN)*step_change, 1.)
       if self.awareness == 1.:
-        self.awareness_passive = min(self.awareness_passive + self.step_change, 1.)
+        self.awareness_passive = min(self.awareness_passive + step_change, 1.)
       # don't display alert banner when awareness is recovering and has cleared orange
       if self.awareness > self.threshold_prompt:
         return
 
-    standstill_exemption = standstill and self.awareness - self.step_change <= self.threshold_prompt
+    standstill_exemption = standstill and self.awareness - step_change <= self.threshold_prompt
     certainly_distracted = self.driver_distraction_filter.x > 0.63 and self.driver_distracted and self.face_detected
     maybe_distracted = self.hi_stds > self.settings._HI_STD_FALLBACK_TIME or not self.face_detected
     if certainly_distracted or maybe_distracted:
       # should always be counting if distracted unless at standstill and reaching orange
       if not standstill_exemption:
-        self.awareness = max(self.awareness - self.step_change, -0.1)
+        self.awareness = max(self.awareness - step_change, -0.1)
 
     alert = None
     if self.awareness <= 0.:
       # terminal red alert: disengagement required
       alert = EventName.driverDistracted if self.active_monitoring_mode else EventName.driverUnresponsive
-      self.terminal_time += 1
+      self.terminal_time += steps
       if awareness_prev > 0.:
         self.terminal_alert_cnt += 1
     elif self.awareness <= self.threshold_prompt:
@@ -6,16 +6,35 @@
 
 ExitHandler do_exit;
 
+// the daemons threadLog covers
+const std::vector<std::string> THREAD_LOG_PROCESSES = {
+  "boardd", "camerad", "controlsd", "modeld", "loggerd", "locationd", "plannerd", "radard", "sensord", "ui",
+};
+
 int main(int argc, char **argv) {
   setpriority(PRIO_PROCESS, 0, -15);
 
-  PubMaster publisher({"procLog"});
-  while (!do_exit) {
-    MessageBuilder msg;
-    buildProcLogMessage(msg);
-    publisher.send("procLog", msg);
+  PubMaster publisher({"procLog", "threadLog", "daemonMetrics"});
+  ThreadLogBuilder thread_log(THREAD_LOG_PROCESSES);
+  DaemonMetricsBuilder daemon_metrics;
+  for (uint64_t frame = 0; !do_exit; frame++) {
+    // threadLog at 10 Hz, daemonMetrics every sec, procLog every 2 secs
+    if (frame % 20 == 0) {
+      PooledMessageBuilder msg("procLog");
+      buildProcLogMessage(msg);
+      publisher.send("procLog", msg);
+    }
+    if (frame % 10 == 0) {
+      PooledMessageBuilder msg("daemonMetrics");
+      daemon_metrics.build(msg);
+      publisher.send("daemonMetrics", msg);
+    }
+
+    PooledMessageBuilder msg("threadLog");
+    thread_log.build(msg);
+    publisher.send("threadLog", msg);
 
-    util::sleep_for(2000);  // 2 secs
+    util::sleep_for(100);
   }
 
   return 0;
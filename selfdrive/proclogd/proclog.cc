@@ -1,8 +1,14 @@
 #include "selfdrive/proclogd/proclog.h"
 
 #include <dirent.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
 
 #include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
 #include <fstream>
 #include <iterator>
 #include <sstream>
@@ -59,6 +65,8 @@ enum StatPos {
   vsize = 23,
   rss = 24,
   processor = 39,
+  rt_priority = 40,
+  policy = 41,
   MAX_FIELD = 52,
 };
 
@@ -97,6 +105,8 @@ std::optional<ProcStat> procStat(std::string stat) {
       .vms = stoul(v[StatPos::vsize - 1]),
       .rss = stoul(v[StatPos::rss - 1]),
       .processor = stoi(v[StatPos::processor - 1]),
+      .rt_priority = stoi(v[StatPos::rt_priority - 1]),
+      .policy = stoi(v[StatPos::policy - 1]),
     };
     return p;
   } catch (const std::invalid_argument &e) {
@@ -152,6 +162,61 @@ const ProcCache &getProcExtraInfo(int pid, const std::string &name) {
   return cache;
 }
 
+// return list of TIDs from /proc/pid/task
+std::vector<int> threadIds(int pid) {
+  std::vector<int> ids;
+  std::string path = "/proc/" + std::to_string(pid) + "/task";
+  DIR *d = opendir(path.c_str());
+  if (!d) return ids;
+  struct dirent *de = NULL;
+  while ((de = readdir(d))) {
+    if (de->d_name[0] != '.') {
+      ids.push_back(atoi(de->d_name));
+    }
+  }
+  closedir(d);
+  return ids;
+}
+
+// the ThreadStats taskstats gives, from /proc/pid/task/tid/{schedstat,status}
+std::optional<ThreadStats> threadStats(int pid, int tid) {
+  std::string path = "/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid);
+  ThreadStats stats = {};
+  std::istringstream schedstat(util::read_file(path + "/schedstat"));
+  if (!(schedstat >> stats.cpu_ns >> stats.delay_ns >> stats.delay_count)) {
+    return std::nullopt;
+  }
+  std::istringstream status(util::read_file(path + "/status"));
+  std::string line;
+  while (std::getline(status, line)) {
+    sscanf(line.c_str(), "voluntary_ctxt_switches: %" SCNu64, &stats.nvcsw);
+    sscanf(line.c_str(), "nonvoluntary_ctxt_switches: %" SCNu64, &stats.nivcsw);
+  }
+  return stats;
+}
+
+// se.nr_migrations of /proc/pid/task/tid/sched, which needs CONFIG_SCHED_DEBUG
+std::optional<uint64_t> threadMigrations(int pid, int tid) {
+  std::istringstream sched(util::read_file("/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid) + "/sched"));
+  std::string line;
+  while (std::getline(sched, line)) {
+    uint64_t migrations;
+    if (sscanf(line.c_str(), "se.nr_migrations : %" SCNu64, &migrations) == 1) {
+      return migrations;
+    }
+  }
+  return std::nullopt;
+}
+
+// "./_modeld" and "selfdrive.controls.controlsd" are modeld and controlsd
+std::string processName(const std::vector<std::string> &cmdline) {
+  if (cmdline.empty()) return "";
+  std::string name = cmdline[0].substr(cmdline[0].rfind('/') + 1);
+  name = name.substr(name.rfind('.') + 1);
+  size_t start = name.find_first_not_of('_');
+  return start == std::string::npos ? name : name.substr(start);
+}
+
 }  // namespace Parser
 
 const double jiffy = sysconf(_SC_CLK_TCK);
@@ -237,3 +302,224 @@ void buildProcLogMessage(MessageBuilder &msg) {
   buildCPUTimes(procLog);
   buildMemInfo(procLog);
 }
+
+ThreadLogBuilder::ThreadLogBuilder(const std::vector<std::string> &process_names) : process_names(process_names) {
+  if (!taskstats.available()) {
+    LOGW("threadLog from /proc");
+  }
+}
+
+void ThreadLogBuilder::updateProcesses() {
+  processes.clear();
+  for (int pid : Parser::pids()) {
+    std::string comm = util::read_file("/proc/" + std::to_string(pid) + "/comm");
+    if (comm.empty()) continue;
+    std::string name = Parser::processName(Parser::getProcExtraInfo(pid, comm).cmdline);
+    if (std::find(process_names.begin(), process_names.end(), name) != process_names.end()) {
+      processes[pid] = name;
+    }
+  }
+}
+
+void ThreadLogBuilder::build(MessageBuilder &msg) {
+  uint64_t now = nanos_since_boot();
+  // daemons come and go rarely, their threads are listed every time
+  if (now - last_update > 2e9) {
+    updateProcesses();
+    last_update = now;
+  }
+  double dt = (now - last_build) * 1e-9;
+  last_build = now;
+
+  // migrations are cumulative and /proc/tid/sched is long, read it at 1 Hz
+  bool read_migrations = frame++ % 10 == 0;
+
+  struct Sample {
+    int tid;
+    ProcStat stat;
+    const Thread *prev;
+  };
+  std::unordered_map<int, Thread> current;
+  std::vector<Sample> samples;
+  for (auto &[pid, process_name] : processes) {
+    for (int tid : Parser::threadIds(pid)) {
+      auto stats = taskstats.available() ? taskstats.get(tid) : Parser::threadStats(pid, tid);
+      if (!stats) continue;
+
+      auto it = threads.find(tid);
+      const Thread *prev = it != threads.end() && it->second.pid == pid ? &it->second : nullptr;
+
+      // the stat file stays open, a new thread or a reused tid opens it again
+      auto file = stat_files.find(tid);
+      if (file == stat_files.end() || !prev) {
+        stat_files.erase(tid);
+        file = stat_files.emplace(tid, "/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid) + "/stat").first;
+      }
+      auto stat = Parser::procStat(file->second.read());
+      if (!stat) continue;
+
+      uint64_t migrations = prev ? prev->migrations : 0;
+      if (read_migrations || !prev) {
+        migrations = Parser::threadMigrations(pid, tid).value_or(migrations);
+      }
+      current[tid] = {pid, *stats, migrations};
+      samples.push_back({tid, *stat, prev});
+    }
+  }
+
+  auto log_threads = msg.initEvent().initThreadLog().initThreads(samples.size());
+  for (int i = 0; i < samples.size(); i++) {
+    const Sample &sample = samples[i];
+    const Thread &t = current[sample.tid];
+    auto l = log_threads[i];
+    l.setPid(t.pid);
+    l.setTid(sample.tid);
+    l.setName(sample.stat.name);
+    l.setProcessName(processes[t.pid]);
+    l.setVoluntaryContextSwitches(t.stats.nvcsw);
+    l.setInvoluntaryContextSwitches(t.stats.nivcsw);
+    l.setMigrations(t.migrations);
+    l.setProcessor(sample.stat.processor);
+    l.setPolicy(sample.stat.policy);
+    l.setRtPriority(sample.stat.rt_priority);
+
+    cpu_set_t affinity;
+    if (sched_getaffinity(sample.tid, sizeof(affinity), &affinity) == 0) {
+      uint64_t mask = 0;
+      for (int cpu = 0; cpu < 64; cpu++) {
+        if (CPU_ISSET(cpu, &affinity)) mask |= 1ULL << cpu;
+      }
+      l.setAffinity(mask);
+    }
+
+    // nothing to compare a new thread with
+    if (sample.prev && dt > 0) {
+      const ThreadStats &prev = sample.prev->stats;
+      l.setCpuUsage((t.stats.cpu_ns - prev.cpu_ns) * 1e-9 / dt);
+      l.setCpuDelay((t.stats.delay_ns - prev.delay_ns) * 1e-9);
+      if (t.stats.delay_count > prev.delay_count) {
+        l.setWakeupLatency((t.stats.delay_ns - prev.delay_ns) * 1e-9 / (t.stats.delay_count - prev.delay_count));
+      }
+    }
+  }
+  threads = std::move(current);
+  for (auto it = stat_files.begin(); it != stat_files.end();) {
+    it = threads.count(it->first) ? std::next(it) : stat_files.erase(it);
+  }
+}
+
+DaemonMetricsBuilder::~DaemonMetricsBuilder() {
+  for (auto &[pid, p] : processes) {
+    munmap((void *)p.registry, sizeof(metrics::Registry));
+  }
+}
+
+void DaemonMetricsBuilder::build(MessageBuilder &msg) {
+  // map the files of new processes, forget the ones of exited processes
+  std::vector<int> pids;
+  const std::string dir = metrics::SHM_PREFIX.substr(0, metrics::SHM_PREFIX.rfind('/'));
+  const std::string prefix = metrics::SHM_PREFIX.substr(dir.size() + 1);
+  if (DIR *d = opendir(dir.c_str())) {
+    while (struct dirent *de = readdir(d)) {
+      if (strncmp(de->d_name, prefix.c_str(), prefix.size()) == 0) {
+        pids.push_back(atoi(de->d_name + prefix.size()));
+      }
+    }
+    closedir(d);
+  }
+
+  for (int pid : pids) {
+    std::string path = metrics::SHM_PREFIX + std::to_string(pid);
+    if (kill(pid, 0) != 0 && errno == ESRCH) {
+      unlink(path.c_str());  // it crashed
+      continue;
+    }
+    if (processes.count(pid)) continue;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    void *p = mmap(nullptr, sizeof(metrics::Registry), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p != MAP_FAILED) {
+      processes[pid] = {(const metrics::Registry *)p};
+    }
+  }
+  for (auto it = processes.begin(); it != processes.end();) {
+    if (std::find(pids.begin(), pids.end(), it->first) == pids.end()) {
+      munmap((void *)it->second.registry, sizeof(metrics::Registry));
+      it = processes.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  auto log_processes = msg.initEvent().initDaemonMetrics().initProcesses(processes.size());
+  int i = 0;
+  uint64_t buckets[metrics::HISTOGRAM_BUCKETS];
+  for (auto &[pid, p] : processes) {
+    const metrics::Registry *r = p.registry;
+    auto l = log_processes[i++];
+    l.setPid(pid);
+    std::string comm = util::read_file("/proc/" + std::to_string(pid) + "/comm");
+    l.setName(Parser::processName(Parser::getProcExtraInfo(pid, comm).cmdline));
+    if (r->magic != metrics::SHM_MAGIC) continue;
+
+    auto counters = l.initCounters(std::min<uint32_t>(r->num_counters.load(std::memory_order_acquire), metrics::MAX_COUNTERS));
+    for (int j = 0; j < counters.size(); j++) {
+      counters[j].setName(r->counters[j].name);
+      counters[j].setValue(r->counters[j].value());
+    }
+
+    auto gauges = l.initGauges(std::min<uint32_t>(r->num_gauges.load(std::memory_order_acquire), metrics::MAX_GAUGES));
+    for (int j = 0; j < gauges.size(); j++) {
+      gauges[j].setName(r->gauges[j].name);
+      gauges[j].setValue(r->gauges[j].value());
+    }
+
+    auto histograms = l.initHistograms(std::min<uint32_t>(r->num_histograms.load(std::memory_order_acquire), metrics::MAX_HISTOGRAMS));
+    for (int j = 0; j < histograms.size(); j++) {
+      const metrics::Histogram &h = r->histograms[j];
+      uint64_t sum;
+      h.read(buckets, sum);
+
+      // what was added since the last build, all of it for a new histogram or process
+      std::vector<uint64_t> &last = p.last_buckets[h.name];
+      last.resize(metrics::HISTOGRAM_BUCKETS + 1);
+      bool restarted = sum < last.back();
+      uint64_t count = 0;
+      for (int k = 0; k < metrics::HISTOGRAM_BUCKETS; k++) {
+        restarted |= buckets[k] < last[k];
+      }
+      for (int k = 0; k < metrics::HISTOGRAM_BUCKETS; k++) {
+        uint64_t total = buckets[k];
+        buckets[k] -= restarted ? 0 : last[k];
+        last[k] = total;
+        count += buckets[k];
+      }
+      uint64_t interval_sum = sum - (restarted ? 0 : last.back());
+      last.back() = sum;
+
+      auto lh = histograms[j];
+      lh.setName(h.name);
+      lh.setCount(count);
+      if (count == 0) continue;
+
+      // the middle of the bucket holding the given fraction of the values
+      auto percentile = [&](double q) {
+        uint64_t target = std::max<uint64_t>(1, std::ceil(q * count)), seen = 0;
+        for (int k = 0; k < metrics::HISTOGRAM_BUCKETS; k++) {
+          seen += buckets[k];
+          if (seen >= target) {
+            return k < metrics::SUB_BUCKETS ? k : (metrics::bucket_value(k) + metrics::bucket_value(k + 1)) / 2.0;
+          }
+        }
+        return (double)metrics::bucket_value(metrics::HISTOGRAM_BUCKETS - 1);
+      };
+      lh.setMean((double)interval_sum / count);
+      lh.setP50(percentile(0.5));
+      lh.setP90(percentile(0.9));
+      lh.setP99(percentile(0.99));
+      lh.setMax(percentile(1.0));
+    }
+  }
+}
@@ -4,6 +4,9 @@
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
+#include "selfdrive/common/metrics.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/proclogd/taskstats.h"
 
 struct CPUTime {
   int id;
@@ -24,6 +27,7 @@ struct ProcStat {
   unsigned long utime, stime, vms, rss;
   unsigned long long starttime;
   std::string name;
+  int rt_priority, policy;
 };
 
 namespace Parser {
@@ -34,7 +38,49 @@ std::vector<std::string> cmdline(std::istream &stream);
 std::vector<CPUTime> cpuTimes(std::istream &stream);
 std::unordered_map<std::string, uint64_t> memInfo(std::istream &stream);
 const ProcCache &getProcExtraInfo(int pid, const std::string &name);
+std::vector<int> threadIds(int pid);
+std::optional<ThreadStats> threadStats(int pid, int tid);
+std::optional<uint64_t> threadMigrations(int pid, int tid);
+std::string processName(const std::vector<std::string> &cmdline);
 
 };  // namespace Parser
 
 void buildProcLogMessage(MessageBuilder &msg);
+
+// threadLog: every thread of the given processes, by the name processName gives them
+class ThreadLogBuilder {
+public:
+  ThreadLogBuilder(const std::vector<std::string> &process_names);
+  void build(MessageBuilder &msg);
+
+private:
+  struct Thread {
+    int pid;
+    ThreadStats stats;
+    uint64_t migrations;
+  };
+  void updateProcesses();
+
+  std::vector<std::string> process_names;
+  std::unordered_map<int, std::string> processes;  // pid -> name
+  std::unordered_map<int, Thread> threads;  // tid -> the last stats
+  std::unordered_map<int, util::FileReader> stat_files;  // tid -> its /proc stat
+  TaskStats taskstats;
+  uint64_t last_update = 0, last_build = 0;
+  int frame = 0;
+};
+
+// daemonMetrics: the metrics every process keeps in /dev/shm/metrics_<pid>,
+// histograms with what was recorded since the last build
+class DaemonMetricsBuilder {
+public:
+  ~DaemonMetricsBuilder();
+  void build(MessageBuilder &msg);
+
+private:
+  struct Process {
+    const metrics::Registry *registry;
+    std::unordered_map<std::string, std::vector<uint64_t>> last_buckets;
+  };
+  std::unordered_map<int, Process> processes;
+};
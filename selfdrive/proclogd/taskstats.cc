@@ -0,0 +1,134 @@
+#include "selfdrive/proclogd/taskstats.h"
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "selfdrive/common/swaglog.h"
+
+namespace {
+
+struct NetlinkMsg {
+  struct nlmsghdr n;
+  struct genlmsghdr g;
+  char buf[1024];
+};
+
+#define GENLMSG_DATA(msg) ((char *)NLMSG_DATA(msg) + GENL_HDRLEN)
+#define GENLMSG_PAYLOAD(msg) (NLMSG_PAYLOAD(msg, 0) - GENL_HDRLEN)
+
+// the attribute of type in [data, data + len)
+const struct nlattr *find_attr(const char *data, int len, uint16_t type) {
+  while (len >= (int)NLA_HDRLEN) {
+    auto attr = (const struct nlattr *)data;
+    if (attr->nla_len < NLA_HDRLEN || attr->nla_len > len) break;
+    if ((attr->nla_type & NLA_TYPE_MASK) == type) return attr;
+    int step = NLA_ALIGN(attr->nla_len);
+    data += step;
+    len -= step;
+  }
+  return nullptr;
+}
+
+const char *attr_data(const struct nlattr *attr) { return (const char *)attr + NLA_HDRLEN; }
+int attr_len(const struct nlattr *attr) { return attr->nla_len - NLA_HDRLEN; }
+
+}  // namespace
+
+TaskStats::TaskStats() {
+  fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+  if (fd < 0) {
+    LOGW("taskstats: no generic netlink socket");
+    return;
+  }
+  struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+  struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    LOGW("taskstats: can't bind the netlink socket");
+    return;
+  }
+
+  // resolve the family id of TASKSTATS
+  NetlinkMsg msg;
+  if (!send(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME, strlen(TASKSTATS_GENL_NAME) + 1)) {
+    return;
+  }
+  int len = recv(&msg, sizeof(msg));
+  if (len > 0) {
+    auto attr = find_attr(GENLMSG_DATA(&msg.n), GENLMSG_PAYLOAD(&msg.n), CTRL_ATTR_FAMILY_ID);
+    if (attr && attr_len(attr) >= (int)sizeof(uint16_t)) {
+      memcpy(&family_id, attr_data(attr), sizeof(family_id));
+    }
+  }
+  if (!available()) {
+    LOGW("taskstats: not supported by the kernel");
+  }
+}
+
+TaskStats::~TaskStats() {
+  if (fd >= 0) close(fd);
+}
+
+bool TaskStats::send(uint16_t type, uint8_t cmd, uint16_t attr_type, const void *data, uint16_t len) {
+  NetlinkMsg msg = {};
+  msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  msg.n.nlmsg_type = type;
+  msg.n.nlmsg_flags = NLM_F_REQUEST;
+  msg.n.nlmsg_seq = ++seq;
+  msg.n.nlmsg_pid = getpid();
+  msg.g.cmd = cmd;
+  msg.g.version = 1;
+
+  auto attr = (struct nlattr *)GENLMSG_DATA(&msg.n);
+  attr->nla_type = attr_type;
+  attr->nla_len = NLA_HDRLEN + len;
+  memcpy((char *)attr + NLA_HDRLEN, data, len);
+  msg.n.nlmsg_len += NLA_ALIGN(attr->nla_len);
+
+  struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+  return sendto(fd, &msg, msg.n.nlmsg_len, 0, (struct sockaddr *)&addr, sizeof(addr)) == msg.n.nlmsg_len;
+}
+
+// receives the reply to the last request, skipping stale ones
+int TaskStats::recv(void *buf, int size) {
+  while (true) {
+    int len = ::recv(fd, buf, size, 0);
+    auto n = (struct nlmsghdr *)buf;
+    if (len < 0 || !NLMSG_OK(n, len) || n->nlmsg_type == NLMSG_ERROR) {
+      return -1;
+    }
+    if (n->nlmsg_seq == seq) return len;
+  }
+}
+
+std::optional<ThreadStats> TaskStats::get(int tid) {
+  if (!available()) return std::nullopt;
+
+  uint32_t pid = tid;
+  NetlinkMsg msg;
+  if (!send(family_id, TASKSTATS_CMD_GET, TASKSTATS_CMD_ATTR_PID, &pid, sizeof(pid)) || recv(&msg, sizeof(msg)) < 0) {
+    return std::nullopt;  // the thread exited
+  }
+
+  // TASKSTATS_TYPE_AGGR_PID nests TASKSTATS_TYPE_PID and TASKSTATS_TYPE_STATS
+  auto aggr = find_attr(GENLMSG_DATA(&msg.n), GENLMSG_PAYLOAD(&msg.n), TASKSTATS_TYPE_AGGR_PID);
+  auto stats = aggr ? find_attr(attr_data(aggr), attr_len(aggr), TASKSTATS_TYPE_STATS) : nullptr;
+  if (!stats) return std::nullopt;
+
+  // older kernels send a shorter struct
+  struct taskstats ts = {};
+  memcpy(&ts, attr_data(stats), std::min<size_t>(attr_len(stats), sizeof(ts)));
+  return ThreadStats{
+    .cpu_ns = ts.cpu_run_real_total,
+    .delay_ns = ts.cpu_delay_total,
+    .delay_count = ts.cpu_count,
+    .nvcsw = ts.nvcsw,
+    .nivcsw = ts.nivcsw,
+  };
+}
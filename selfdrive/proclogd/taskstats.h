@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+// a thread's cumulative scheduler counters
+struct ThreadStats {
+  uint64_t cpu_ns;  // time on a cpu
+  uint64_t delay_ns;  // time runnable, waiting for a cpu
+  uint64_t delay_count;  // times it waited
+  uint64_t nvcsw, nivcsw;  // voluntary and involuntary context switches
+};
+
+// Per-thread accounting from the kernel's taskstats generic netlink family,
+// one request per thread, instead of parsing three /proc files for it.
+class TaskStats {
+public:
+  TaskStats();
+  ~TaskStats();
+  // false when the kernel has no taskstats, get() always fails then
+  bool available() const { return family_id != 0; }
+  std::optional<ThreadStats> get(int tid);
+
+private:
+  bool send(uint16_t type, uint8_t cmd, uint16_t attr, const void *data, uint16_t len);
+  int recv(void *buf, int size);
+
+  int fd = -1;
+  uint16_t family_id = 0;
+  uint32_t seq = 0;
+};
@@ -1,18 +1,17 @@
 #pragma once
 
-#include <fstream>
 #include <string>
 
 #include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/common/util.h"
 #include "selfdrive/sensord/sensors/sensor.h"
 
 class FileSensor : public Sensor {
 protected:
-  std::ifstream file;
+  util::FileReader file;
 
 public:
   FileSensor(std::string filename);
-  ~FileSensor();
   int init();
   virtual void get_event(cereal::SensorEventData::Builder &event) = 0;
 };
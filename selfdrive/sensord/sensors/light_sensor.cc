@@ -1,5 +1,6 @@
 #include "light_sensor.h"
 
+#include <cstdlib>
 #include <string>
 
 #include "selfdrive/common/timing.h"
@@ -7,11 +8,7 @@
 
 void LightSensor::get_event(cereal::SensorEventData::Builder &event) {
   uint64_t start_time = nanos_since_boot();
-  file.clear();
-  file.seekg(0);
-
-  int value;
-  file >> value;
+  int value = std::atoi(file.read().c_str());
 
   event.setSource(cereal::SensorEventData::SensorSource::RPR0521);
   event.setVersion(1);
@@ -0,0 +1,145 @@
+#include "lsm6ds3_fifo.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/sensord/sensors/constants.h"
+#include "selfdrive/sensord/sensors/i2c_sensor.h"
+
+#define DEG2RAD(x) ((x) * M_PI / 180.0)
+
+
+LSM6DS3_FIFO::LSM6DS3_FIFO(I2CBus *bus) : bus(bus) {}
+
+int LSM6DS3_FIFO::init() {
+  int ret = 0;
+  uint8_t buffer[1];
+  const int threshold = LSM6DS3_FIFO_WATERMARK_SETS * LSM6DS3_FIFO_SET_WORDS;
+
+  ret = bus->read_register(LSM6DS3_FIFO_I2C_ADDR, LSM6DS3_FIFO_I2C_REG_ID, buffer, 1);
+  if(ret < 0) {
+    LOGE("Reading chip ID failed: %d", ret);
+    goto fail;
+  }
+
+  if(buffer[0] != LSM6DS3_FIFO_CHIP_ID && buffer[0] != LSM6DS3TRC_FIFO_CHIP_ID) {
+    LOGE("Chip ID wrong. Got: %d, Expected %d", buffer[0], LSM6DS3_FIFO_CHIP_ID);
+    ret = -1;
+    goto fail;
+  }
+
+  if (buffer[0] == LSM6DS3TRC_FIFO_CHIP_ID) {
+    source = cereal::SensorEventData::SensorSource::LSM6DS3TRC;
+  }
+
+  // same scales as the polled sensors, +- 2G and +- 250 deg/s
+  {
+    const uint8_t regs[][2] = {
+      {LSM6DS3_FIFO_I2C_REG_CTRL1_XL, LSM6DS3_FIFO_ODR_416HZ << 4},
+      {LSM6DS3_FIFO_I2C_REG_CTRL2_G, LSM6DS3_FIFO_ODR_416HZ << 4},
+      {LSM6DS3_FIFO_I2C_REG_FIFO_CTRL1, threshold & 0xFF},
+      {LSM6DS3_FIFO_I2C_REG_FIFO_CTRL2, (threshold >> 8) & 0x07},
+      {LSM6DS3_FIFO_I2C_REG_FIFO_CTRL3, LSM6DS3_FIFO_NO_DECIMATION},
+      // bypass first to empty it
+      {LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5, 0},
+      {LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5, (LSM6DS3_FIFO_ODR_416HZ << 3) | LSM6DS3_FIFO_MODE_CONTINUOUS},
+      {LSM6DS3_FIFO_I2C_REG_INT1_CTRL, LSM6DS3_FIFO_INT1_FTH},
+    };
+    for (auto &reg : regs) {
+      ret = bus->set_register(LSM6DS3_FIFO_I2C_ADDR, reg[0], reg[1]);
+      if (ret < 0) {
+        goto fail;
+      }
+    }
+  }
+
+fail:
+  return ret;
+}
+
+int LSM6DS3_FIFO::read(std::vector<Sample> &samples, uint64_t irq_time) {
+  uint64_t read_time = nanos_since_boot();
+
+  // unread words and the position in the gyro/accel pattern of the next one
+  uint8_t status[4];
+  int ret = bus->read_register(LSM6DS3_FIFO_I2C_ADDR, LSM6DS3_FIFO_I2C_REG_FIFO_STATUS1, status, sizeof(status));
+  if (ret < 0) {
+    return ret;
+  }
+  if (status[1] & LSM6DS3_FIFO_OVER_RUN) {
+    LOGW("LSM6DS3 FIFO overrun");
+  }
+  int words = ((status[1] & 0x07) << 8) | status[0];
+  int pattern = ((status[3] & 0x03) << 8) | status[2];
+
+  // skip to the start of a set, this only happens after an overrun
+  uint8_t data[LSM6DS3_FIFO_MAX_SETS * LSM6DS3_FIFO_SET_WORDS * 2];
+  if (pattern != 0) {
+    int skip = LSM6DS3_FIFO_SET_WORDS - pattern;
+    if (skip > words) {
+      return 0;
+    }
+    ret = bus->read_burst(LSM6DS3_FIFO_I2C_ADDR, LSM6DS3_FIFO_I2C_REG_DATA_OUT_L, data, skip * 2);
+    if (ret < 0) {
+      return ret;
+    }
+    words -= skip;
+  }
+
+  int sets = std::min(words / LSM6DS3_FIFO_SET_WORDS, LSM6DS3_FIFO_MAX_SETS);
+  if (sets == 0) {
+    return 0;
+  }
+  ret = bus->read_burst(LSM6DS3_FIFO_I2C_ADDR, LSM6DS3_FIFO_I2C_REG_DATA_OUT_L, data, sets * LSM6DS3_FIFO_SET_WORDS * 2);
+  if (ret < 0) {
+    return ret;
+  }
+
+  // the watermark set was sampled at the interrupt, the others one period apart from it.
+  // Polled, the newest set was sampled right before the read.
+  const uint64_t period = 1000000000ULL / LSM6DS3_FIFO_RATE;
+  int anchor = irq_time ? std::min(sets, LSM6DS3_FIFO_WATERMARK_SETS) - 1 : sets - 1;
+  uint64_t anchor_time = irq_time ? irq_time : read_time;
+
+  const float gyro_scale = 8.75 / 1000.0;
+  const float accel_scale = 9.81 * 2.0f / (1 << 15);
+  for (int i = 0; i < sets; i++) {
+    const uint8_t *d = &data[i * LSM6DS3_FIFO_SET_WORDS * 2];
+    Sample s;
+    s.timestamp = anchor_time + (int64_t)(i - anchor) * (int64_t)period;
+    for (int j = 0; j < 3; j++) {
+      s.gyro[j] = DEG2RAD(read_16_bit(d[2 * j], d[2 * j + 1]) * gyro_scale);
+      s.accel[j] = read_16_bit(d[6 + 2 * j], d[6 + 2 * j + 1]) * accel_scale;
+    }
+    samples.push_back(s);
+  }
+  return sets;
+}
+
+void LSM6DS3_FIFO::get_gyro_event(const Sample &sample, cereal::SensorEventData::Builder &event) {
+  event.setSource(source);
+  event.setVersion(2);
+  event.setSensor(SENSOR_GYRO_UNCALIBRATED);
+  event.setType(SENSOR_TYPE_GYROSCOPE_UNCALIBRATED);
+  event.setTimestamp(sample.timestamp);
+
+  float xyz[] = {sample.gyro[1], -sample.gyro[0], sample.gyro[2]};
+  auto svec = event.initGyroUncalibrated();
+  svec.setV(xyz);
+  svec.setStatus(true);
+}
+
+void LSM6DS3_FIFO::get_accel_event(const Sample &sample, cereal::SensorEventData::Builder &event) {
+  event.setSource(source);
+  event.setVersion(1);
+  event.setSensor(SENSOR_ACCELEROMETER);
+  event.setType(SENSOR_TYPE_ACCELEROMETER);
+  event.setTimestamp(sample.timestamp);
+
+  float xyz[] = {sample.accel[1], -sample.accel[0], sample.accel[2]};
+  auto svec = event.initAcceleration();
+  svec.setV(xyz);
+  svec.setStatus(true);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "selfdrive/common/i2c.h"
+
+// Address of the chip on the bus
+#define LSM6DS3_FIFO_I2C_ADDR       0x6A
+
+// Registers of the chip
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL1   0x06
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL2   0x07
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL3   0x08
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5   0x0A
+#define LSM6DS3_FIFO_I2C_REG_INT1_CTRL    0x0D
+#define LSM6DS3_FIFO_I2C_REG_ID           0x0F
+#define LSM6DS3_FIFO_I2C_REG_CTRL1_XL     0x10
+#define LSM6DS3_FIFO_I2C_REG_CTRL2_G      0x11
+#define LSM6DS3_FIFO_I2C_REG_FIFO_STATUS1 0x3A
+#define LSM6DS3_FIFO_I2C_REG_DATA_OUT_L   0x3E
+
+// Constants
+#define LSM6DS3_FIFO_CHIP_ID        0x69
+#define LSM6DS3TRC_FIFO_CHIP_ID     0x6A
+#define LSM6DS3_FIFO_ODR_416HZ      0b0110
+#define LSM6DS3_FIFO_RATE           416
+#define LSM6DS3_FIFO_NO_DECIMATION  ((0b001 << 3) | 0b001)  // gyro and accel both in the FIFO
+#define LSM6DS3_FIFO_MODE_CONTINUOUS 0b110
+#define LSM6DS3_FIFO_INT1_FTH       (1 << 3)
+#define LSM6DS3_FIFO_OVER_RUN       (1 << 6)
+#define LSM6DS3_FIFO_SET_WORDS      6  // gyro xyz then accel xyz
+#define LSM6DS3_FIFO_WATERMARK_SETS 4  // interrupt every ~10 ms
+#define LSM6DS3_FIFO_MAX_SETS       64
+
+
+// Gyro and accel of the LSM6DS3 through its FIFO at LSM6DS3_FIFO_RATE. The
+// FIFO threshold interrupt on INT1 fires every LSM6DS3_FIFO_WATERMARK_SETS
+// samples, which are then read in one burst and timestamped back from the
+// time of the interrupt.
+class LSM6DS3_FIFO {
+  I2CBus *bus;
+  cereal::SensorEventData::SensorSource source = cereal::SensorEventData::SensorSource::LSM6DS3;
+
+public:
+  struct Sample {
+    uint64_t timestamp;
+    float gyro[3];  // rad/s
+    float accel[3];  // m/s^2
+  };
+
+  LSM6DS3_FIFO(I2CBus *bus);
+  int init();
+  // appends the samples in the FIFO, irq_time is when the watermark was
+  // reached, or 0 when polling without the interrupt
+  int read(std::vector<Sample> &samples, uint64_t irq_time);
+  void get_gyro_event(const Sample &sample, cereal::SensorEventData::Builder &event);
+  void get_accel_event(const Sample &sample, cereal::SensorEventData::Builder &event);
+};
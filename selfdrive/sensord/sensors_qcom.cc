@@ -12,8 +12,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/swaglog.h"
@@ -31,6 +33,11 @@
 #define SENSOR_PROXIMITY 6
 #define SENSOR_LIGHT 7
 
+// how long the HAL may hold samples in the hardware FIFO before waking us up.
+// the samples keep their own timestamps, so this only adds latency
+const int64_t MAX_REPORT_LATENCY_ONROAD = ms2ns(20);
+const int64_t MAX_REPORT_LATENCY_OFFROAD = ms2ns(1000);
+
 ExitHandler do_exit;
 volatile sig_atomic_t re_init_sensors = 0;
 
@@ -44,7 +51,6 @@ void sigpipe_handler(int sig) {
 void sensor_loop() {
   LOG("*** sensor loop");
 
-  uint64_t frame = 0;
   bool low_power_mode = false;
 
   while (!do_exit) {
@@ -57,6 +63,13 @@ void sensor_loop() {
     hw_get_module(SENSORS_HARDWARE_MODULE_ID, (hw_module_t const**)&module);
     sensors_open(&module->common, &device);
 
+    // HALs from 1.0 on can batch samples in the hardware FIFO. this HAL header
+    // has no direct channel (1.4 and up), so poll is the only way to read them
+    sensors_poll_device_1_t* device_1 = nullptr;
+    if (device->common.version >= SENSORS_DEVICE_API_VERSION_1_0) {
+      device_1 = (sensors_poll_device_1_t*)device;
+    }
+
     // required
     struct sensor_t const* list;
     int count = module->get_sensors_list(module, &list);
@@ -67,7 +80,8 @@ void sensor_loop() {
     }
 
     for (int i = 0; i < count; i++) {
-      LOGD("sensor %4d: %4d %60s  %d-%ld us", i, list[i].handle, list[i].name, list[i].minDelay, list[i].maxDelay);
+      LOGD("sensor %4d: %4d %60s  %d-%ld us, fifo %u", i, list[i].handle, list[i].name, list[i].minDelay, list[i].maxDelay,
+           device_1 ? list[i].fifoMaxEventCount : 0);
     }
 
     std::set<int> sensor_types = {
@@ -97,19 +111,34 @@ void sensor_loop() {
       SENSOR_GYRO_UNCALIBRATED,
     };
 
+    auto set_rate = [&](int handle, int64_t period, int64_t max_report_latency) {
+      if (!device_1 || device_1->batch(device_1, handle, 0, period, max_report_latency) != 0) {
+        device->setDelay(device, handle, period);
+      }
+    };
+
     // init all the sensors
     for (auto &s : sensors) {
       device->activate(device, s.first, 0);
+      set_rate(s.first, s.second, MAX_REPORT_LATENCY_ONROAD);
       device->activate(device, s.first, 1);
-      device->setDelay(device, s.first, s.second);
     }
 
-    // TODO: why is this 16?
-    static const size_t numEvents = 16;
-    sensors_event_t buffer[numEvents];
+    // large enough to drain a full hardware FIFO in one poll
+    size_t num_events = 16;
+    if (device_1) {
+      for (int i = 0; i < count; i++) {
+        if (sensors.find(list[i].handle) != sensors.end()) {
+          num_events = std::max<size_t>(num_events, list[i].fifoMaxEventCount);
+        }
+      }
+      num_events = std::min<size_t>(num_events, 1024);
+    }
+    std::vector<sensors_event_t> buffer(num_events);
 
+    uint64_t last_mode_check = 0;
     while (!do_exit) {
-      int n = device->poll(device, buffer, numEvents);
+      int n = device->poll(device, buffer.data(), buffer.size());
       if (n == 0) continue;
       if (n < 0) {
         LOG("sensor_loop poll failed: %d", n);
@@ -195,22 +224,23 @@ void sensor_loop() {
         break;
       }
 
-      // Check whether to go into low power mode at 5Hz
-      if (frame % 20 == 0) {
+      // Check whether to go into low power mode at 5Hz, wakeups are batched so count time instead of polls
+      uint64_t now = nanos_since_boot();
+      if (now - last_mode_check > ms2ns(200)) {
+        last_mode_check = now;
         sm.update(0);
         bool offroad = !sm["deviceState"].getDeviceState().getStarted();
         if (low_power_mode != offroad) {
           for (auto &s : sensors) {
             device->activate(device, s.first, 0);
             if (!offroad || offroad_sensors.find(s.first) != offroad_sensors.end()) {
+              set_rate(s.first, s.second, offroad ? MAX_REPORT_LATENCY_OFFROAD : MAX_REPORT_LATENCY_ONROAD);
               device->activate(device, s.first, 1);
             }
           }
           low_power_mode = offroad;
         }
       }
-
-      frame++;
     }
     sensors_close(device);
   }
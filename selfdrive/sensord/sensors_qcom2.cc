@@ -1,11 +1,15 @@
+#include <poll.h>
 #include <sys/resource.h>
+#include <unistd.h>
 
-#include <chrono>
-#include <thread>
+#include <algorithm>
+#include <cassert>
 #include <vector>
 
 #include "cereal/messaging/messaging.h"
+#include "selfdrive/common/gpio.h"
 #include "selfdrive/common/i2c.h"
+#include "selfdrive/common/ratekeeper.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
@@ -16,12 +20,26 @@
 #include "selfdrive/sensord/sensors/constants.h"
 #include "selfdrive/sensord/sensors/light_sensor.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_accel.h"
+#include "selfdrive/sensord/sensors/lsm6ds3_fifo.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_gyro.h"
 #include "selfdrive/sensord/sensors/lsm6ds3_temp.h"
 #include "selfdrive/sensord/sensors/mmc5603nj_magn.h"
 #include "selfdrive/sensord/sensors/sensor.h"
 
 #define I2C_BUS_IMU 1
+// every sensor rate divides the loop's rate, the FIFO is polled every cycle
+#define LOOP_RATE 100
+
+struct SensorConfig {
+  Sensor *sensor;
+  bool required;
+  int rate;  // Hz
+};
+
+struct ScheduledSensor {
+  Sensor *sensor;
+  int every;  // loop cycles
+};
 
 ExitHandler do_exit;
 
@@ -43,60 +61,126 @@ int sensor_loop() {
   LSM6DS3_Accel lsm6ds3_accel(i2c_bus_imu);
   LSM6DS3_Gyro lsm6ds3_gyro(i2c_bus_imu);
   LSM6DS3_Temp lsm6ds3_temp(i2c_bus_imu);
+  LSM6DS3_FIFO lsm6ds3_fifo(i2c_bus_imu);
 
   MMC5603NJ_Magn mmc5603nj_magn(i2c_bus_imu);
 
   LightSensor light("/sys/class/i2c-adapter/i2c-2/2-0038/iio:device1/in_intensity_both_raw");
 
-  // Sensor init
-  std::vector<std::pair<Sensor *, bool>> sensors_init; // Sensor, required
-  sensors_init.push_back({&bmx055_accel, true});
-  sensors_init.push_back({&bmx055_gyro, true});
-  sensors_init.push_back({&bmx055_magn, true});
-  sensors_init.push_back({&bmx055_temp, true});
+  // Read rates in Hz, each sensorEvents only has the sensors that were due
+  const std::vector<SensorConfig> sensors_config = {
+    {&bmx055_accel, true, 100},
+    {&bmx055_gyro, true, 100},
+    {&bmx055_magn, true, 25},
+    {&bmx055_temp, true, 1},
 
-  sensors_init.push_back({&lsm6ds3_accel, true});
-  sensors_init.push_back({&lsm6ds3_gyro, true});
-  sensors_init.push_back({&lsm6ds3_temp, true});
+    {&lsm6ds3_accel, true, 100},
+    {&lsm6ds3_gyro, true, 100},
+    {&lsm6ds3_temp, true, 1},
 
-  sensors_init.push_back({&mmc5603nj_magn, false});
+    {&mmc5603nj_magn, false, 25},
 
-  sensors_init.push_back({&light, true});
+    {&light, true, 5},
+  };
 
+  // The LSM6DS3 gyro and accel come from its FIFO unless that's off or fails to set up
+  bool use_fifo = getenv("SENSORD_NO_FIFO") == nullptr && lsm6ds3_fifo.init() >= 0;
 
   // Initialize sensors
-  std::vector<Sensor *> sensors;
-  for (auto &sensor : sensors_init) {
-    int err = sensor.first->init();
+  std::vector<ScheduledSensor> sensors;
+  for (auto &config : sensors_config) {
+    if (use_fifo && (config.sensor == &lsm6ds3_accel || config.sensor == &lsm6ds3_gyro)) {
+      continue;
+    }
+    int err = config.sensor->init();
     if (err < 0) {
       // Fail on required sensors
-      if (sensor.second) {
+      if (config.required) {
         LOGE("Error initializing sensors");
         return -1;
       }
     } else {
-      sensors.push_back(sensor.first);
+      assert(LOOP_RATE % config.rate == 0);
+      sensors.push_back({config.sensor, LOOP_RATE / config.rate});
+    }
+  }
+
+  // Without the interrupt the FIFO is read every loop cycle
+  int irq_fd = -1;
+  if (use_fifo) {
+    if (gpio_init(GPIO_LSM_INT, false) == 0 && gpio_set_edge(GPIO_LSM_INT, "rising") == 0) {
+      irq_fd = gpio_open(GPIO_LSM_INT);
+    }
+    if (irq_fd < 0) {
+      LOGW("LSM6DS3 interrupt unavailable, polling its FIFO");
     }
   }
+  bool poll_fifo = use_fifo && irq_fd < 0;
 
   PubMaster pm({"sensorEvents"});
+  std::vector<LSM6DS3_FIFO::Sample> samples;
+  std::vector<Sensor *> due;
+  RateKeeper rk("sensor_loop", LOOP_RATE);
 
   while (!do_exit) {
-    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    // wake up on the FIFO watermark or for the next cycle
+    uint64_t irq_time = 0;
+    if (irq_fd >= 0) {
+      int64_t remaining = std::max<int64_t>(0, rk.remaining());
+      struct timespec timeout = {.tv_sec = remaining / 1000000000, .tv_nsec = remaining % 1000000000};
+      struct pollfd fds = {.fd = irq_fd, .events = POLLPRI};
+      if (ppoll(&fds, 1, &timeout, nullptr) > 0) {
+        irq_time = nanos_since_boot();
+        gpio_get(irq_fd);
+      }
+    }
 
-    const int num_events = sensors.size();
-    MessageBuilder msg;
+    due.clear();
+    bool cycle = irq_fd < 0 || rk.remaining() <= 0;
+    if (cycle) {
+      if (irq_fd >= 0) {
+        rk.monitorTime();
+      } else {
+        rk.keepTime();
+      }
+      // the sensors due in the cycle that just started
+      for (const ScheduledSensor &s : sensors) {
+        if ((rk.frame() - 1) % s.every == 0) {
+          due.push_back(s.sensor);
+        }
+      }
+    }
+
+    samples.clear();
+    if (irq_time || (poll_fifo && cycle)) {
+      lsm6ds3_fifo.read(samples, irq_time);
+    }
+
+    const int num_events = samples.size() * 2 + due.size();
+    if (num_events == 0) {
+      continue;
+    }
+
+    PooledMessageBuilder msg("sensorEvents");
     auto sensor_events = msg.initEvent().initSensorEvents(num_events);
 
-    for (int i = 0; i < num_events; i++) {
-      auto event = sensor_events[i];
-      sensors[i]->get_event(event);
+    int i = 0;
+    for (const auto &sample : samples) {
+      auto gyro_event = sensor_events[i++];
+      lsm6ds3_fifo.get_gyro_event(sample, gyro_event);
+      auto accel_event = sensor_events[i++];
+      lsm6ds3_fifo.get_accel_event(sample, accel_event);
+    }
+    for (Sensor *sensor : due) {
+      auto event = sensor_events[i++];
+      sensor->get_event(event);
     }
 
     pm.send("sensorEvents", msg);
+  }
 
-    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::milliseconds(10) - (end - begin));
+  if (irq_fd >= 0) {
+    close(irq_fd);
   }
   return 0;
 }
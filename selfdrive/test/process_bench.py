@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+"""Replays recorded segments into one daemon at a time and measures it: CPU time, latency from
+an input message to the outputs it triggers, and peak RSS. The results are compared against
+process_bench_baseline.json, --update-baseline writes it from the run.
+
+  selfdrive/test/process_bench.py /data/media/0/realdata/<segment>/rlog.bz2 ... [--procs locationd modeld]
+
+Inputs go out in log order, each one that triggers outputs waits for them before the next is sent,
+so the latencies are of the daemon alone. camerad is the source of the frames, it has nothing to
+replay into; modeld gets the segment's fcamera.hevc frames over VisionIPC instead. boardd needs a
+panda to send to, it only runs with --hardware.
+
+With --simulated-time the daemon runs on a clock that only moves to each input's logMonoTime as
+it is sent, so the inputs go out as fast as it takes them and its timers fire as they did in
+the drive, see cereal/messaging/sim_clock.h.
+"""
+import argparse
+import json
+import os
+import sys
+import time
+from collections import namedtuple
+from pathlib import Path
+
+import numpy as np
+
+import cereal.messaging as messaging
+from common.sim_clock import SimClock
+from selfdrive.manager.process_config import managed_processes
+from selfdrive.test.helpers import set_params_enabled
+from tools.lib.logreader import LogReader
+
+BASELINE_FN = os.path.join(os.path.dirname(os.path.abspath(__file__)), "process_bench_baseline.json")
+
+# how much worse than the baseline is still a pass: relative, and absolute for the small values
+TOLERANCES = {
+  "cpu_time": (0.15, 0.5),      # s
+  "latency_p50": (0.20, 0.5),   # ms
+  "latency_p99": (0.30, 2.0),   # ms
+  "peak_rss": (0.10, 5.0),      # MB
+}
+
+OUTPUT_TIMEOUT = 1.0  # s, an input whose outputs don't come in time counts as a timeout
+
+# pub_sub: input services to the outputs each message of it triggers, inputs that trigger
+# nothing are sent and not waited for
+BenchConfig = namedtuple("BenchConfig", ["proc_name", "pub_sub", "frames", "hardware", "environ"])
+
+CONFIGS = [
+  BenchConfig(
+    proc_name="locationd",
+    pub_sub={
+      "cameraOdometry": ["liveLocationKalman"],
+      "sensorEvents": [], "gpsLocationExternal": [], "liveCalibration": [], "carState": [],
+    },
+    frames=False,
+    hardware=False,
+    environ={},
+  ),
+  BenchConfig(
+    proc_name="modeld",
+    pub_sub={
+      "roadCameraState": ["modelV2", "cameraOdometry"],
+      "lateralPlan": [], "liveCalibration": [],
+    },
+    frames=True,
+    hardware=False,
+    environ={},
+  ),
+  BenchConfig(
+    proc_name="loggerd",
+    pub_sub=None,  # everything in the log, nothing to wait for
+    frames=False,
+    hardware=False,
+    environ={},
+  ),
+  BenchConfig(
+    proc_name="boardd",
+    pub_sub={"sendcan": ["sendcanTiming"]},
+    frames=False,
+    hardware=True,
+    environ={"BOARDD_ASYNC_SEND": "1"},
+  ),
+]
+
+
+def proc_cpu_time(pid):
+  with open(f"/proc/{pid}/stat") as f:
+    fields = f.read().rsplit(")", 1)[1].split()
+  # utime and stime are the 14th and 15th fields, 12th and 13th after the name
+  return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def proc_peak_rss(pid):
+  with open(f"/proc/{pid}/status") as f:
+    for line in f:
+      if line.startswith("VmHWM:"):
+        return int(line.split()[1]) / 1024.
+  return 0.
+
+
+class FrameSender:
+  """Serves a segment's road camera frames as camerad would"""
+  def __init__(self, segment_dir):
+    from cereal.visionipc.visionipc_pyx import VisionIpcServer, VisionStreamType  # pylint: disable=no-name-in-module, import-error
+    from tools.lib.framereader import FrameReader
+    self.fr = FrameReader(str(Path(segment_dir) / "fcamera.hevc"))
+    self.stream = VisionStreamType.VISION_STREAM_YUV_BACK
+    self.server = VisionIpcServer("camerad")
+    self.server.create_buffers(self.stream, 40, False, self.fr.w, self.fr.h)
+    self.server.start_listener()
+
+  def send(self, camera_state):
+    frame_id = camera_state.frameId
+    if frame_id >= self.fr.frame_count:
+      return
+    img = self.fr.get(frame_id, pix_fmt="yuv420p")[0]
+    self.server.send(self.stream, img.flatten().tobytes(), frame_id, camera_state.timestampSof, camera_state.timestampEof)
+
+
+def bench_process(cfg, rlogs, simulated_time=False):
+  msgs = []
+  for rlog in rlogs:
+    msgs += [m for m in LogReader(rlog) if cfg.pub_sub is None or m.which() in cfg.pub_sub]
+  msgs.sort(key=lambda m: m.logMonoTime)
+  pub_sub = cfg.pub_sub or {s: [] for s in {m.which() for m in msgs}}
+  outputs = {o for outs in pub_sub.values() for o in outs}
+
+  pm = messaging.PubMaster(list(pub_sub.keys()))
+  socks = {o: messaging.sub_sock(o, timeout=int(OUTPUT_TIMEOUT * 1000)) for o in outputs}
+  frames = FrameSender(Path(rlogs[0]).parent) if cfg.frames else None
+
+  os.environ.update(cfg.environ)
+  clock = SimClock(msgs[0].logMonoTime) if simulated_time and msgs else None
+  proc = managed_processes[cfg.proc_name]
+  proc.prepare()
+  if clock is not None:
+    # only the daemon runs on it, the waits for its outputs here are in real time
+    os.environ.update(clock.environ)
+  proc.start()
+  if clock is not None:
+    del os.environ["SIMULATED_TIME"]
+  # let it subscribe before anything is sent
+  time.sleep(2)
+  pid = proc.proc.pid
+  cpu_start = proc_cpu_time(pid)
+
+  latencies, timeouts = [], 0
+  try:
+    for m in msgs:
+      service = m.which()
+      if frames is not None and service == "roadCameraState":
+        frames.send(m.roadCameraState)
+      if clock is not None:
+        clock.advance_to(m.logMonoTime)
+      t0 = time.monotonic()
+      pm.send(service, m.as_builder())
+      for o in pub_sub[service]:
+        if messaging.recv_one(socks[o]) is None:
+          timeouts += 1
+          break
+      else:
+        if pub_sub[service]:
+          latencies.append((time.monotonic() - t0) * 1e3)
+    cpu_time = proc_cpu_time(pid) - cpu_start
+    peak_rss = proc_peak_rss(pid)
+  finally:
+    proc.stop()
+    if clock is not None:
+      clock.close()
+
+  return {
+    "messages": len(msgs),
+    "cpu_time": cpu_time,
+    "latency_p50": float(np.percentile(latencies, 50)) if latencies else 0.,
+    "latency_p99": float(np.percentile(latencies, 99)) if latencies else 0.,
+    "timeouts": timeouts,
+    "peak_rss": peak_rss,
+  }
+
+
+def compare(name, result, baseline):
+  ok = True
+  print(f"{name}: {result['messages']} messages, {result['timeouts']} timeouts")
+  for metric, (rel, absolute) in TOLERANCES.items():
+    value, base = result[metric], baseline.get(metric) if baseline else None
+    if base is None:
+      print(f"  {metric.ljust(12)} {value:10.2f}")
+      continue
+    limit = max(base * (1. + rel), base + absolute)
+    passed = value <= limit
+    ok &= passed
+    print(f"  {metric.ljust(12)} {value:10.2f}  baseline {base:10.2f}  {'ok' if passed else 'REGRESSION'}")
+  if baseline and result["timeouts"] > baseline.get("timeouts", 0):
+    print(f"  timeouts up from {baseline.get('timeouts', 0)}")
+    ok = False
+  return ok
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Replay segments into the native daemons and compare their performance against a baseline")
+  parser.add_argument("rlogs", nargs="+", help="rlogs of the segments, modeld takes the fcamera.hevc next to the first one")
+  parser.add_argument("--procs", nargs="*", default=None, help="daemons to bench, all by default")
+  parser.add_argument("--hardware", action="store_true", help="also bench the daemons that need a panda")
+  parser.add_argument("--simulated-time", action="store_true", help="run the daemons on a clock driven by the log instead of real time")
+  parser.add_argument("--update-baseline", action="store_true", help=f"write the results to {BASELINE_FN}")
+  args = parser.parse_args()
+
+  set_params_enabled()
+  os.environ["SKIP_FW_QUERY"] = "1"
+
+  baseline = {}
+  if os.path.exists(BASELINE_FN):
+    with open(BASELINE_FN) as f:
+      baseline = json.load(f)
+  segments = sorted(Path(r).parent.name for r in args.rlogs)
+  if baseline and baseline.get("segments") != segments:
+    print(f"warning: baseline is of the segments {baseline.get('segments')}, not these")
+
+  results, ok = {"segments": segments}, True
+  for cfg in CONFIGS:
+    if (args.procs is not None and cfg.proc_name not in args.procs) or (cfg.hardware and not args.hardware):
+      continue
+    results[cfg.proc_name] = bench_process(cfg, args.rlogs, args.simulated_time)
+    ok &= compare(cfg.proc_name, results[cfg.proc_name], baseline.get(cfg.proc_name))
+
+  if args.update_baseline:
+    baseline.update(results)
+    with open(BASELINE_FN, "w") as f:
+      json.dump(baseline, f, indent=2, sort_keys=True)
+    print(f"baseline written to {BASELINE_FN}")
+    return 0
+  return 0 if ok else 1
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""Replays recorded segments into the native daemons and the python ones they replace, one after
+the other, and checks that both publish the same outputs: the same number of messages, each field
+within its tolerance.
+
+  selfdrive/test/process_equivalence.py /data/media/0/realdata/<segment>/rlog.bz2 ... [--procs plannerd]
+
+Inputs go out in log order, each one that triggers outputs waits for them before the next is sent,
+so both daemons see the inputs the same way. CarParams is the segment's, and each daemon starts
+without learned params.
+"""
+import argparse
+import importlib
+import math
+import os
+import sys
+import time
+from collections import namedtuple
+
+import cereal.messaging as messaging
+from common.params import Params
+from selfdrive.manager.process import NativeProcess, PythonProcess
+from selfdrive.test.helpers import set_params_enabled
+from tools.lib.logreader import LogReader
+
+OUTPUT_TIMEOUT = 1.0  # s, an input whose outputs don't come in time fails the run
+
+# pub_sub: input services to the outputs each message of it triggers, inputs that trigger
+# nothing are sent and not waited for. triggers: when only some of those messages trigger the
+# outputs, a function of CarParams to the check of a message. fields: per output the fields
+# compared, dotted into structs, with their absolute tolerance, None is exact. The timing fields
+# are left out
+EquivalenceConfig = namedtuple("EquivalenceConfig", ["proc_name", "native", "python", "pub_sub", "triggers", "fields"])
+
+PLAN_VECTOR_TOL = 1e-3
+
+
+def radar_trigger(CP):
+  """The cans with the message radard publishes on, none for the cars without one"""
+  RadarInterface = importlib.import_module(f"selfdrive.car.{CP.carName}.radar_interface").RadarInterface
+  trigger_msg = getattr(RadarInterface(CP), "trigger_msg", None)
+  if trigger_msg is None:
+    return None
+  return lambda m: any(c.address == trigger_msg for c in m.can)
+
+
+CONFIGS = [
+  EquivalenceConfig(
+    proc_name="plannerd",
+    native=NativeProcess("plannerd", "selfdrive/controls", ["./plannerd"]),
+    python=PythonProcess("plannerd", "selfdrive.controls.plannerd"),
+    pub_sub={
+      "modelV2": ["lateralPlan"], "radarState": ["longitudinalPlan"],
+      "carState": [], "controlsState": [], "dragonConf": [], "liveMapData": [],
+    },
+    triggers=None,
+    fields={
+      "lateralPlan": {
+        "laneWidth": 1e-3, "dPathPoints": PLAN_VECTOR_TOL, "psis": PLAN_VECTOR_TOL,
+        "curvatures": 1e-5, "curvatureRates": 1e-5,
+        "lProb": 1e-4, "rProb": 1e-4, "dProb": 1e-4, "mpcSolutionValid": None,
+        "desire": None, "laneChangeState": None, "laneChangeDirection": None,
+        "dPathWLinesX": PLAN_VECTOR_TOL, "dPathWLinesY": PLAN_VECTOR_TOL, "dpLaneLessModeStatus": None,
+      },
+      "longitudinalPlan": {
+        "modelMonoTime": None, "speeds": PLAN_VECTOR_TOL, "accels": PLAN_VECTOR_TOL, "jerks": 1e-2,
+        "hasLead": None, "longitudinalPlanSource": None, "fcw": None,
+        "visionTurnControllerState": None, "visionTurnSpeed": 1e-3,
+        "speedLimitControlState": None, "speedLimit": 1e-3, "speedLimitOffset": 1e-3,
+        "distToSpeedLimit": 1e-2, "isMapSpeedLimit": None,
+        "turnSpeedControlState": None, "turnSpeed": 1e-3, "distToTurn": 1e-2, "turnSign": None,
+      },
+    },
+  ),
+  EquivalenceConfig(
+    proc_name="radard",
+    native=NativeProcess("radard", "selfdrive/controls", ["./radard"]),
+    python=PythonProcess("radard", "selfdrive.controls.radard"),
+    pub_sub={"can": ["radarState"], "carState": [], "modelV2": []},
+    triggers=radar_trigger,
+    fields={
+      "radarState": {
+        "mdMonoTime": None, "carStateMonoTime": None, "radarErrors": None,
+        **{f"{lead}.{f}": tol for lead in ("leadOne", "leadTwo") for f, tol in {
+          "dRel": 1e-3, "yRel": 1e-3, "vRel": 1e-3, "vLead": 1e-3, "vLeadK": 1e-3,
+          "aLeadK": 1e-3, "aLeadTau": 1e-3, "modelProb": 1e-4,
+          "status": None, "fcw": None, "radar": None,
+        }.items()},
+      },
+    },
+  ),
+  EquivalenceConfig(
+    proc_name="paramsd",
+    native=NativeProcess("paramsd", "selfdrive/locationd", ["./paramsd"]),
+    python=PythonProcess("paramsd", "selfdrive.locationd.paramsd"),
+    pub_sub={"liveLocationKalman": ["liveParameters"], "carState": []},
+    triggers=None,
+    fields={
+      "liveParameters": {
+        "steerRatio": 1e-3, "stiffnessFactor": 1e-4,
+        "angleOffsetAverageDeg": 1e-3, "angleOffsetDeg": 1e-3,
+        "valid": None, "posenetValid": None, "sensorValid": None,
+      },
+    },
+  ),
+]
+
+
+def run_process(proc, cfg, msgs, trigger=None):
+  """The outputs proc publishes for msgs, per output service in order"""
+  outputs = {o for outs in cfg.pub_sub.values() for o in outs}
+  pm = messaging.PubMaster(list(cfg.pub_sub.keys()))
+  socks = {o: messaging.sub_sock(o, timeout=int(OUTPUT_TIMEOUT * 1000)) for o in outputs}
+
+  proc.prepare()
+  proc.start()
+  # let it subscribe before anything is sent
+  time.sleep(2)
+
+  results = {o: [] for o in outputs}
+  try:
+    for m in msgs:
+      service = m.which()
+      pm.send(service, m.as_builder())
+      if trigger is not None and not trigger(m):
+        continue
+      for o in cfg.pub_sub[service]:
+        out = messaging.recv_one(socks[o])
+        if out is None:
+          raise RuntimeError(f"{proc.name}: no {o} for the {service} at {m.logMonoTime}")
+        results[o].append(getattr(out, o).to_dict())
+  finally:
+    proc.stop()
+  return results
+
+
+def field(d, path):
+  for k in path.split("."):
+    d = d.get(k) if isinstance(d, dict) else None
+  return d
+
+
+def within(a, b, tol):
+  if isinstance(a, list) or isinstance(b, list):
+    return isinstance(a, list) and isinstance(b, list) and len(a) == len(b) and all(within(x, y, tol) for x, y in zip(a, b))
+  if tol is None or not isinstance(a, float) or not isinstance(b, float):
+    return a == b
+  return (math.isnan(a) and math.isnan(b)) or abs(a - b) <= tol
+
+
+def compare(cfg, native, python):
+  ok = True
+  for service, fields in cfg.fields.items():
+    n, p = native[service], python[service]
+    if len(n) != len(p):
+      print(f"  {service}: {len(n)} messages native, {len(p)} python")
+      ok = False
+    mismatches = {}
+    for i, (a, b) in enumerate(zip(n, p)):
+      for f, tol in fields.items():
+        if not within(field(a, f), field(b, f), tol) and f not in mismatches:
+          mismatches[f] = (i, field(a, f), field(b, f))
+    for f, (i, a, b) in mismatches.items():
+      print(f"  {service}.{f} differs first in message {i}: native {a}, python {b}")
+    ok &= not mismatches
+    print(f"  {service}: {min(len(n), len(p))} messages compared, {'ok' if not mismatches else 'MISMATCH'}")
+  return ok
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Replay segments into the native daemons and the python ones and compare their outputs")
+  parser.add_argument("rlogs", nargs="+", help="rlogs of the segments, in order")
+  parser.add_argument("--procs", nargs="*", default=None, help="daemons to compare, all by default")
+  args = parser.parse_args()
+
+  set_params_enabled()
+  os.environ["SKIP_FW_QUERY"] = "1"
+
+  lr = [m for rlog in args.rlogs for m in LogReader(rlog)]
+  car_params = next((m.carParams for m in lr if m.which() == "carParams"), None)
+  if car_params is None:
+    print("no carParams in the segments")
+    return 1
+
+  params, ok = Params(), True
+  for cfg in CONFIGS:
+    if args.procs is not None and cfg.proc_name not in args.procs:
+      continue
+    msgs = sorted((m for m in lr if m.which() in cfg.pub_sub), key=lambda m: m.logMonoTime)
+    trigger = None
+    if cfg.triggers is not None:
+      trigger = cfg.triggers(car_params)
+      if trigger is None:
+        print(f"{cfg.proc_name}: nothing to compare for {car_params.carFingerprint}")
+        continue
+
+    outputs = []
+    for proc in (cfg.native, cfg.python):
+      params.put("CarParams", car_params.as_builder().to_bytes())
+      params.delete("LiveParameters")
+      outputs.append(run_process(proc, cfg, msgs, trigger))
+
+    print(f"{cfg.proc_name}: {len(msgs)} inputs")
+    ok &= compare(cfg, *outputs)
+  return 0 if ok else 1
+
+
+if __name__ == "__main__":
+  sys.exit(main())